@@ -0,0 +1,315 @@
+/*! \file    affinity.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    CPU/NUMA affinity policy
+ * \details  Optional policy to pin media event loops and plugin threads
+ * to specific CPUs, configured via the \c media_cpus and \c plugin_cpus
+ * properties in \c janus.cfg. CPUs are grouped by the NUMA node they
+ * belong to, and arbitrary strings (e.g., a VideoRoom room or a Streaming
+ * mountpoint) can be mapped consistently to a node, so that all the
+ * threads and handles involved in the same media path stay on the
+ * same socket. Pinning is currently only supported on Linux.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "affinity.h"
+#include "debug.h"
+
+#ifndef CPU_SETSIZE
+#define CPU_SETSIZE 1024
+#endif
+
+/* A pool of CPUs, sorted and with the NUMA node each of them belongs to */
+typedef struct janus_affinity_cpus {
+	int *cpus;
+	int *nodes;
+	guint count;
+} janus_affinity_cpus;
+static janus_affinity_cpus pools[2];
+/* Distinct NUMA nodes of the media CPUs, used to map groups */
+static int *media_nodes = NULL;
+static guint media_nodes_count = 0;
+
+/* Find out the NUMA node of a CPU from sysfs */
+static int janus_affinity_lookup_node(int cpu) {
+	char path[128];
+	g_snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	GDir *dir = g_dir_open(path, 0, NULL);
+	if(dir == NULL)
+		return -1;
+	int node = -1;
+	const char *name = NULL;
+	while((name = g_dir_read_name(dir)) != NULL) {
+		if(strncmp(name, "node", 4) || !g_ascii_isdigit(name[4]))
+			continue;
+		node = atoi(name+4);
+		break;
+	}
+	g_dir_close(dir);
+	if(node < 0) {
+		/* No NUMA information, fallback to the physical package (socket) */
+		g_snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+		gchar *contents = NULL;
+		if(g_file_get_contents(path, &contents, NULL, NULL)) {
+			node = atoi(contents);
+			g_free(contents);
+		}
+	}
+	return node < 0 ? 0 : node;
+}
+
+static gint janus_affinity_int_compare(gconstpointer a, gconstpointer b) {
+	return *(const int *)a - *(const int *)b;
+}
+
+/* Parse a list like "0-3,8,10-11" */
+static int janus_affinity_parse(const char *list, janus_affinity_cpus *pool) {
+	memset(pool, 0, sizeof(*pool));
+	if(list == NULL || strlen(list) == 0)
+		return 0;
+	GArray *cpus = g_array_new(FALSE, FALSE, sizeof(int));
+	gchar **items = g_strsplit(list, ",", -1);
+	int i = 0;
+	for(i=0; items[i] != NULL; i++) {
+		gchar *item = g_strstrip(items[i]);
+		if(strlen(item) == 0)
+			continue;
+		char *end = NULL;
+		errno = 0;
+		long first = strtol(item, &end, 10), last = first;
+		if(errno || end == item) {
+			JANUS_LOG(LOG_ERR, "Invalid CPU list '%s' (at '%s')\n", list, item);
+			goto error;
+		}
+		if(*end == '-') {
+			char *start = end+1;
+			last = strtol(start, &end, 10);
+			if(errno || end == start) {
+				JANUS_LOG(LOG_ERR, "Invalid CPU list '%s' (at '%s')\n", list, item);
+				goto error;
+			}
+		}
+		if(*end != '\0' || first < 0 || last < first || last >= CPU_SETSIZE) {
+			JANUS_LOG(LOG_ERR, "Invalid CPU list '%s' (at '%s')\n", list, item);
+			goto error;
+		}
+		long cpu = 0;
+		for(cpu=first; cpu<=last; cpu++) {
+			int value = cpu;
+			g_array_append_val(cpus, value);
+		}
+	}
+	g_strfreev(items);
+	/* Sort and get rid of duplicates */
+	g_array_sort(cpus, janus_affinity_int_compare);
+	guint j = 0, count = 0;
+	for(j=0; j<cpus->len; j++) {
+		if(count > 0 && g_array_index(cpus, int, j) == g_array_index(cpus, int, count-1))
+			continue;
+		g_array_index(cpus, int, count) = g_array_index(cpus, int, j);
+		count++;
+	}
+	pool->count = count;
+	pool->cpus = g_malloc(count * sizeof(int));
+	pool->nodes = g_malloc(count * sizeof(int));
+	for(j=0; j<count; j++) {
+		pool->cpus[j] = g_array_index(cpus, int, j);
+		pool->nodes[j] = janus_affinity_lookup_node(pool->cpus[j]);
+	}
+	g_array_free(cpus, TRUE);
+	return 0;
+
+error:
+	g_strfreev(items);
+	g_array_free(cpus, TRUE);
+	return -1;
+}
+
+static void janus_affinity_free(janus_affinity_cpus *pool) {
+	g_free(pool->cpus);
+	g_free(pool->nodes);
+	memset(pool, 0, sizeof(*pool));
+}
+
+int janus_affinity_init(const char *media_cpus, const char *plugin_cpus) {
+#ifndef __linux__
+	if(media_cpus != NULL || plugin_cpus != NULL)
+		JANUS_LOG(LOG_WARN, "CPU affinity is only supported on Linux, threads will not be pinned\n");
+#endif
+	if(janus_affinity_parse(media_cpus, &pools[janus_affinity_pool_media]) < 0 ||
+			janus_affinity_parse(plugin_cpus, &pools[janus_affinity_pool_plugin]) < 0) {
+		janus_affinity_deinit();
+		return -1;
+	}
+	/* Check which NUMA nodes media can use */
+	janus_affinity_cpus *media = &pools[janus_affinity_pool_media];
+	if(media->count > 0) {
+		media_nodes = g_malloc(media->count * sizeof(int));
+		guint i = 0, j = 0;
+		for(i=0; i<media->count; i++) {
+			for(j=0; j<media_nodes_count; j++) {
+				if(media_nodes[j] == media->nodes[i])
+					break;
+			}
+			if(j == media_nodes_count)
+				media_nodes[media_nodes_count++] = media->nodes[i];
+		}
+		char *cpus = janus_affinity_pool_cpus(janus_affinity_pool_media, -1);
+		JANUS_LOG(LOG_INFO, "Media event loops will be pinned to CPUs %s (%u NUMA node%s)\n",
+			cpus, media_nodes_count, media_nodes_count == 1 ? "" : "s");
+		g_free(cpus);
+	}
+	if(pools[janus_affinity_pool_plugin].count > 0) {
+		char *cpus = janus_affinity_pool_cpus(janus_affinity_pool_plugin, -1);
+		JANUS_LOG(LOG_INFO, "Plugin threads will be pinned to CPUs %s\n", cpus);
+		g_free(cpus);
+	}
+	return 0;
+}
+
+void janus_affinity_deinit(void) {
+	janus_affinity_free(&pools[janus_affinity_pool_media]);
+	janus_affinity_free(&pools[janus_affinity_pool_plugin]);
+	g_free(media_nodes);
+	media_nodes = NULL;
+	media_nodes_count = 0;
+}
+
+gboolean janus_affinity_is_enabled(janus_affinity_pool pool) {
+	if(pool != janus_affinity_pool_media && pool != janus_affinity_pool_plugin)
+		return FALSE;
+	return pools[pool].count > 0;
+}
+
+int janus_affinity_group_node(const char *group) {
+	if(group == NULL || media_nodes_count == 0)
+		return -1;
+	return media_nodes[g_str_hash(group) % media_nodes_count];
+}
+
+int janus_affinity_cpu_node(int cpu) {
+	guint p = 0, i = 0;
+	for(p=0; p<2; p++) {
+		for(i=0; i<pools[p].count; i++) {
+			if(pools[p].cpus[i] == cpu)
+				return pools[p].nodes[i];
+		}
+	}
+	return -1;
+}
+
+int janus_affinity_get_cpu(janus_affinity_pool pool, int node, guint index) {
+	if(!janus_affinity_is_enabled(pool))
+		return -1;
+	janus_affinity_cpus *cpus = &pools[pool];
+	guint i = 0, count = 0;
+	for(i=0; i<cpus->count; i++) {
+		if(node < 0 || cpus->nodes[i] == node)
+			count++;
+	}
+	if(count == 0)
+		return -1;
+	index = index % count;
+	for(i=0; i<cpus->count; i++) {
+		if(node >= 0 && cpus->nodes[i] != node)
+			continue;
+		if(index == 0)
+			return cpus->cpus[i];
+		index--;
+	}
+	return -1;
+}
+
+#ifdef __linux__
+static int janus_affinity_set(cpu_set_t *set) {
+	int res = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), set);
+	if(res != 0) {
+		JANUS_LOG(LOG_WARN, "Error setting the CPU affinity of the thread: %d (%s)\n", res, strerror(res));
+		return -1;
+	}
+	return 0;
+}
+#endif
+
+int janus_affinity_pin_cpu(int cpu) {
+#ifdef __linux__
+	if(cpu < 0 || cpu >= CPU_SETSIZE)
+		return -1;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return janus_affinity_set(&set);
+#else
+	return -1;
+#endif
+}
+
+int janus_affinity_pin_pool(janus_affinity_pool pool, int node) {
+#ifdef __linux__
+	if(!janus_affinity_is_enabled(pool))
+		return -1;
+	janus_affinity_cpus *cpus = &pools[pool];
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	guint i = 0, count = 0;
+	for(i=0; i<cpus->count; i++) {
+		if(node < 0 || cpus->nodes[i] == node) {
+			CPU_SET(cpus->cpus[i], &set);
+			count++;
+		}
+	}
+	if(count == 0) {
+		/* No CPU on that node, use the whole pool */
+		for(i=0; i<cpus->count; i++)
+			CPU_SET(cpus->cpus[i], &set);
+	}
+	return janus_affinity_set(&set);
+#else
+	return -1;
+#endif
+}
+
+int janus_affinity_pin_plugin_thread(const char *group) {
+	return janus_affinity_pin_pool(janus_affinity_pool_plugin, janus_affinity_group_node(group));
+}
+
+char *janus_affinity_pool_cpus(janus_affinity_pool pool, int node) {
+	if(!janus_affinity_is_enabled(pool))
+		return NULL;
+	janus_affinity_cpus *cpus = &pools[pool];
+	GString *list = g_string_new(NULL);
+	guint i = 0;
+	int first = -1, last = -1;
+	for(i=0; i<=cpus->count; i++) {
+		if(i < cpus->count && node >= 0 && cpus->nodes[i] != node)
+			continue;
+		int cpu = i < cpus->count ? cpus->cpus[i] : -1;
+		if(cpu >= 0 && last >= 0 && cpu == last+1) {
+			last = cpu;
+			continue;
+		}
+		/* Close the current range, if any */
+		if(first >= 0) {
+			if(list->len > 0)
+				g_string_append_c(list, ',');
+			if(first == last)
+				g_string_append_printf(list, "%d", first);
+			else
+				g_string_append_printf(list, "%d-%d", first, last);
+		}
+		first = last = cpu;
+	}
+	if(list->len == 0) {
+		g_string_free(list, TRUE);
+		return NULL;
+	}
+	return g_string_free(list, FALSE);
+}
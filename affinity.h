@@ -0,0 +1,81 @@
+/*! \file    affinity.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    CPU/NUMA affinity policy (headers)
+ * \details  Optional policy to pin media event loops and plugin threads
+ * to specific CPUs, configured via the \c media_cpus and \c plugin_cpus
+ * properties in \c janus.cfg. CPUs are grouped by the NUMA node they
+ * belong to, and arbitrary strings (e.g., a VideoRoom room or a Streaming
+ * mountpoint) can be mapped consistently to a node, so that all the
+ * threads and handles involved in the same media path stay on the
+ * same socket. Pinning is currently only supported on Linux.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef _JANUS_AFFINITY_H
+#define _JANUS_AFFINITY_H
+
+#include <glib.h>
+
+/*! \brief Pools of CPUs threads can be pinned to */
+typedef enum janus_affinity_pool {
+	/*! \brief CPUs for the event loops taking care of media (\c media_cpus) */
+	janus_affinity_pool_media = 0,
+	/*! \brief CPUs for the threads plugins spawn (\c plugin_cpus) */
+	janus_affinity_pool_plugin,
+} janus_affinity_pool;
+
+/*! \brief Initialize the affinity policy
+ * \note Both lists have the same syntax as \c taskset, e.g., "0-3,8,10-11":
+ * passing NULL for a pool means threads in that pool will not be pinned
+ * @param[in] media_cpus The CPUs to use for media event loops, if any
+ * @param[in] plugin_cpus The CPUs to use for plugin threads, if any
+ * @returns 0 in case of success, a negative integer on errors */
+int janus_affinity_init(const char *media_cpus, const char *plugin_cpus);
+/*! \brief De-initialize the affinity policy */
+void janus_affinity_deinit(void);
+
+/*! \brief Check whether threads in a specific pool are pinned
+ * @param[in] pool The pool to check
+ * @returns TRUE if CPUs were configured for this pool, FALSE otherwise */
+gboolean janus_affinity_is_enabled(janus_affinity_pool pool);
+/*! \brief Map a group (e.g., "videoroom-1234") to one of the NUMA nodes available to media
+ * \note The same group is always mapped to the same node
+ * @param[in] group The group to map
+ * @returns The NUMA node, or -1 if there's no affinity policy for media */
+int janus_affinity_group_node(const char *group);
+/*! \brief Get the NUMA node a CPU belongs to
+ * @param[in] cpu The CPU to query
+ * @returns The NUMA node, or -1 if unknown */
+int janus_affinity_cpu_node(int cpu);
+/*! \brief Pick a CPU from a pool, in a round robin fashion
+ * @param[in] pool The pool to pick the CPU from
+ * @param[in] node The NUMA node the CPU must belong to, or -1 for any
+ * @param[in] index Index of the CPU to pick (wraps around the number of available CPUs)
+ * @returns The CPU, or -1 if there's no CPU in the pool for that node */
+int janus_affinity_get_cpu(janus_affinity_pool pool, int node, guint index);
+/*! \brief Pin the calling thread to a single CPU
+ * @param[in] cpu The CPU to pin the thread to
+ * @returns 0 in case of success, a negative integer on errors */
+int janus_affinity_pin_cpu(int cpu);
+/*! \brief Pin the calling thread to all the CPUs of a pool
+ * \note If there are no CPUs in the pool for the specified node, all the CPUs in the pool are used
+ * @param[in] pool The pool to pin the thread to
+ * @param[in] node The NUMA node to restrict the CPUs to, or -1 for all of them
+ * @returns 0 in case of success, a negative integer on errors (or if there's no policy for the pool) */
+int janus_affinity_pin_pool(janus_affinity_pool pool, int node);
+/*! \brief Pin the calling plugin thread according to the group it works for
+ * \note Shortcut for janus_affinity_pin_pool on the plugin pool and the group node
+ * @param[in] group The group the thread works for (e.g., "audiobridge-1234"), if any
+ * @returns 0 in case of success, a negative integer on errors (or if there's no policy for plugins) */
+int janus_affinity_pin_plugin_thread(const char *group);
+/*! \brief Get a string representation of the CPUs in a pool (e.g., "0-3,8")
+ * \note The returned string must be freed with g_free
+ * @param[in] pool The pool to describe
+ * @param[in] node The NUMA node to restrict the CPUs to, or -1 for all of them
+ * @returns A string describing the CPUs, or NULL if there are none */
+char *janus_affinity_pool_cpus(janus_affinity_pool pool, int node);
+
+#endif
@@ -50,6 +50,8 @@ const char *janus_get_api_error(int error) {
 			return "Unexpected ANSWER (no OFFER)";
 		case JANUS_ERROR_TOKEN_NOT_FOUND:
 			return "Token not found";
+		case JANUS_ERROR_OVERLOADED:
+			return "Overloaded";
 		default:
 			return "Unknown error";
 	}
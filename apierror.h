@@ -65,6 +65,8 @@
 #define JANUS_ERROR_TOKEN_NOT_FOUND				470
 /*! \brief The current request cannot be handled because of not compatible WebRTC state */
 #define JANUS_ERROR_WEBRTC_STATE				471
+/*! \brief The instance is too loaded to accept new handles (see admission control) */
+#define JANUS_ERROR_OVERLOADED					472
 
 
 /*! \brief Helper method to get a string representation of an API error code
@@ -0,0 +1,1129 @@
+/*! \file    janus-bench.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Load generator and relay benchmark for Janus media plugins
+ * \details  This utility loads a media plugin (the EchoTest, VideoRoom,
+ * Streaming or AudioBridge plugins are supported) outside of Janus, and
+ * drives it with a fake implementation of the janus_callbacks interface,
+ * so that the relay path of the plugin can be measured without any ICE,
+ * DTLS or SRTP involved, and regressions between releases caught in a
+ * reproducible way. Depending on the plugin, the tool creates a room
+ * (or a mountpoint), a configurable number of publishers and of
+ * subscribers for each of them, negotiates their PeerConnections with
+ * synthetic SDPs, and then injects RTP packets (Opus with audio levels,
+ * and VP8 with optional simulcast) at the configured rates, exactly as
+ * the core would after decrypting them; for the Streaming plugin, packets
+ * are sent via UDP to the mountpoint ports instead. Every packet carries
+ * the time it was injected in its last bytes, which means that when the
+ * plugin relays it (or an echo of it) the tool can measure how long it
+ * spent in the plugin.
+ *
+ * Using the utility is quite simple. Just pass, as arguments to the tool,
+ * the path to the plugin shared object and, optionally, the path to the
+ * JSON file to save the results to (by default they're printed on the
+ * standard output), e.g.:
+ *
+\verbatim
+./janus-bench /usr/local/lib/janus/plugins/libjanus_videoroom.so results.json
+\endverbatim
+ *
+ * The load is configured with environment variables:
+ *
+ * - \c JANUS_BENCH_PUBLISHERS: number of publishers (or mountpoints), 10 by default;
+ * - \c JANUS_BENCH_SUBSCRIBERS: number of subscribers for each publisher (or mountpoint), 1 by default;
+ * - \c JANUS_BENCH_DURATION: how long to measure for, in seconds, 10 by default;
+ * - \c JANUS_BENCH_WARMUP: how long to wait before measuring, in seconds, 2 by default;
+ * - \c JANUS_BENCH_AUDIO_RATE: Opus packets per second for each publisher, 50 by default (0 disables audio);
+ * - \c JANUS_BENCH_VIDEO_FPS: VP8 frames per second for each publisher, 30 by default (0 disables video);
+ * - \c JANUS_BENCH_VIDEO_PACKETS: RTP packets per video frame (for the highest substream), 3 by default;
+ * - \c JANUS_BENCH_PACKET_SIZE: size of video packets, 1100 bytes by default;
+ * - \c JANUS_BENCH_SIMULCAST: whether publishers should simulcast three substreams, no by default;
+ * - \c JANUS_BENCH_THREADS: number of threads injecting packets, 1 by default;
+ * - \c JANUS_BENCH_PORT: for the Streaming plugin, the first of the ports to use for mountpoints, 20000 by default;
+ * - \c JANUS_BENCH_CONFIG: the folder the plugin should read its configuration from, the current one by default;
+ * - \c JANUS_BENCH_DEBUG: the logging level, 3 (warnings) by default.
+ *
+ * The results include the packets injected and relayed per second, the
+ * CPU time (of the whole process) per injected and per relayed packet,
+ * and the 50th, 90th, 99th and 99.9th percentiles of the latency: notice
+ * that the AudioBridge plugin mixes the audio it receives, which means
+ * latency can't be measured in that case.
+ *
+ * \ingroup benchmark
+ * \ref benchmark
+ */
+
+#include <arpa/inet.h>
+#include <dlfcn.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <glib.h>
+#include <jansson.h>
+
+#include "../debug.h"
+#include "../metrics.h"
+#include "../mutex.h"
+#include "../record.h"
+#include "../refcount.h"
+#include "../rtp.h"
+#include "../sdp-utils.h"
+#include "../utils.h"
+#include "../version.h"
+#include "../plugins/plugin.h"
+
+
+#ifdef REFCOUNT_DEBUG
+/* Reference counters debugging */
+GHashTable *counters = NULL;
+janus_mutex counters_mutex;
+#endif
+
+/* Logging */
+int janus_log_level = LOG_WARN;
+gboolean janus_log_timestamps = FALSE;
+gboolean janus_log_colors = TRUE;
+int lock_debug = 0;
+#ifdef REFCOUNT_DEBUG
+int refcount_debug = 1;
+#else
+int refcount_debug = 0;
+#endif
+
+/* Load settings */
+static int publishers = 10, subscribers = 1;
+static int duration = 10, warmup = 2;
+static int audio_rate = 50, video_fps = 30, video_packets = 3, packet_size = 1100;
+static gboolean simulcast = FALSE;
+static int threads = 1;
+static int base_port = 20000;
+static const char *config_folder = ".";
+
+static volatile gint stop = 0;
+static void janus_bench_handle_signal(int signum) {
+	g_atomic_int_set(&stop, 1);
+}
+
+/* Helper to read an integer setting from the environment */
+static int janus_bench_env_int(const char *name, int def, int min) {
+	const char *value = g_getenv(name);
+	if(value == NULL)
+		return def;
+	int val = atoi(value);
+	if(val < min) {
+		JANUS_LOG(LOG_WARN, "Invalid value for %s (%s), using %d\n", name, value, def);
+		return def;
+	}
+	return val;
+}
+
+
+/* Packets we inject are tagged, in their last bytes, with a magic value
+ * and the monotonic time they were injected at (in network byte order) */
+#define JANUS_BENCH_TAG_MAGIC	0x4A424E43
+#define JANUS_BENCH_TAG_SIZE	12
+/* RTP extension ID we use for audio levels */
+#define JANUS_BENCH_AUDIO_LEVEL_ID	1
+/* Size of Opus packets */
+#define JANUS_BENCH_AUDIO_SIZE	80
+/* Payload types we negotiate (the defaults of janus_sdp_generate_offer) */
+#define JANUS_BENCH_AUDIO_PT	111
+#define JANUS_BENCH_VIDEO_PT	96
+/* How often publishers send a keyframe */
+#define JANUS_BENCH_KEYFRAME_INTERVAL	(2*G_USEC_PER_SEC)
+
+static void janus_bench_tag(char *buf, int len, gint64 when) {
+	uint32_t magic = htonl(JANUS_BENCH_TAG_MAGIC);
+	memcpy(buf+len-JANUS_BENCH_TAG_SIZE, &magic, sizeof(magic));
+	uint32_t high = htonl((uint32_t)(when >> 32)), low = htonl((uint32_t)(when & 0xFFFFFFFF));
+	memcpy(buf+len-8, &high, sizeof(high));
+	memcpy(buf+len-4, &low, sizeof(low));
+}
+
+static gint64 janus_bench_tag_get(const char *buf, int len) {
+	if(buf == NULL || len < RTP_HEADER_SIZE+JANUS_BENCH_TAG_SIZE)
+		return 0;
+	uint32_t magic = 0, high = 0, low = 0;
+	memcpy(&magic, buf+len-JANUS_BENCH_TAG_SIZE, sizeof(magic));
+	if(ntohl(magic) != JANUS_BENCH_TAG_MAGIC)
+		return 0;
+	memcpy(&high, buf+len-8, sizeof(high));
+	memcpy(&low, buf+len-4, sizeof(low));
+	return ((gint64)ntohl(high) << 32) | ntohl(low);
+}
+
+/* Latency histogram: buckets of 10us, up to 100ms (anything above that ends in the last one) */
+#define JANUS_BENCH_LATENCY_STEP	10
+#define JANUS_BENCH_LATENCY_BUCKETS	10000
+static volatile gint latency[JANUS_BENCH_LATENCY_BUCKETS+1];
+
+static void janus_bench_latency_track(const char *buf, int len) {
+	gint64 when = janus_bench_tag_get(buf, len);
+	if(when == 0)
+		return;
+	gint64 elapsed = janus_get_monotonic_time() - when;
+	if(elapsed < 0)
+		elapsed = 0;
+	gint64 bucket = elapsed / JANUS_BENCH_LATENCY_STEP;
+	if(bucket > JANUS_BENCH_LATENCY_BUCKETS)
+		bucket = JANUS_BENCH_LATENCY_BUCKETS;
+	g_atomic_int_inc(&latency[bucket]);
+}
+
+
+/* Fake handles */
+typedef enum janus_bench_role {
+	janus_bench_role_admin = 0,
+	janus_bench_role_publisher,
+	janus_bench_role_subscriber,
+} janus_bench_role;
+
+typedef struct janus_bench_event {
+	json_t *message;
+	json_t *jsep;
+} janus_bench_event;
+
+static void janus_bench_event_free(janus_bench_event *event) {
+	if(event == NULL)
+		return;
+	if(event->message)
+		json_decref(event->message);
+	if(event->jsep)
+		json_decref(event->jsep);
+	g_free(event);
+}
+
+typedef struct janus_bench_session {
+	janus_plugin_session *handle;
+	janus_bench_role role;
+	int index;
+	/* Events the plugin sent us via push_event */
+	GAsyncQueue *events;
+	/* What the plugin relayed to this handle */
+	volatile gint rtp, rtcp, data;
+	/* Publisher state */
+	guint64 feed;
+	int audio_fd, video_fd[3];
+	struct sockaddr_in audio_addr, video_addr[3];
+	guint32 assrc, vssrc[3];
+	guint16 aseq, vseq[3], picid[3];
+	guint8 tl0picidx[3];
+	guint32 ats, vts;
+	gint64 last_keyframe;
+} janus_bench_session;
+
+static janus_plugin *plugin = NULL;
+static GList *sessions = NULL;
+static janus_bench_session **publisher_list = NULL;
+
+static void janus_bench_handle_free(const janus_refcount *handle_ref) {
+	janus_plugin_session *handle = janus_refcount_containerof(handle_ref, janus_plugin_session, ref);
+	g_free(handle);
+}
+
+static janus_bench_session *janus_bench_session_create(janus_bench_role role, int index) {
+	janus_bench_session *session = g_malloc0(sizeof(janus_bench_session));
+	session->role = role;
+	session->index = index;
+	session->events = g_async_queue_new_full((GDestroyNotify)janus_bench_event_free);
+	session->audio_fd = -1;
+	session->video_fd[0] = session->video_fd[1] = session->video_fd[2] = -1;
+	janus_plugin_session *handle = g_malloc0(sizeof(janus_plugin_session));
+	handle->gateway_handle = session;
+	handle->plugin_handle = NULL;
+	handle->stopped = 0;
+	janus_refcount_init(&handle->ref, janus_bench_handle_free);
+	session->handle = handle;
+	int error = 0;
+	plugin->create_session(handle, &error);
+	if(error) {
+		JANUS_LOG(LOG_ERR, "Error creating plugin session: %d\n", error);
+		janus_refcount_decrease(&handle->ref);
+		g_async_queue_unref(session->events);
+		g_free(session);
+		return NULL;
+	}
+	sessions = g_list_append(sessions, session);
+	return session;
+}
+
+static void janus_bench_session_destroy(janus_bench_session *session) {
+	if(session == NULL)
+		return;
+	int error = 0;
+	g_atomic_int_set(&session->handle->stopped, 1);
+	plugin->hangup_media(session->handle);
+	plugin->destroy_session(session->handle, &error);
+	janus_refcount_decrease(&session->handle->ref);
+	if(session->audio_fd > -1)
+		close(session->audio_fd);
+	int i = 0;
+	for(i=0; i<3; i++) {
+		if(session->video_fd[i] > -1)
+			close(session->video_fd[i]);
+	}
+	g_async_queue_unref(session->events);
+	g_free(session);
+}
+
+
+/* Fake core callbacks */
+static int janus_bench_push_event(janus_plugin_session *handle, janus_plugin *p, const char *transaction, json_t *message, json_t *jsep) {
+	if(handle == NULL || handle->gateway_handle == NULL || message == NULL)
+		return -1;
+	janus_bench_session *session = (janus_bench_session *)handle->gateway_handle;
+	janus_bench_event *event = g_malloc0(sizeof(janus_bench_event));
+	event->message = json_incref(message);
+	event->jsep = jsep ? json_incref(jsep) : NULL;
+	g_async_queue_push(session->events, event);
+	return 0;
+}
+static void janus_bench_relay_rtp(janus_plugin_session *handle, int video, char *buf, int len) {
+	janus_bench_session *session = (janus_bench_session *)handle->gateway_handle;
+	g_atomic_int_inc(&session->rtp);
+	janus_bench_latency_track(buf, len);
+}
+static void janus_bench_relay_rtp_shared(janus_plugin_session *handle, int video, janus_plugin_rtp_shared *packet, janus_plugin_rtp_override *override) {
+	janus_bench_session *session = (janus_bench_session *)handle->gateway_handle;
+	g_atomic_int_inc(&session->rtp);
+	janus_bench_latency_track(packet->buffer, packet->length);
+}
+static void janus_bench_relay_rtcp(janus_plugin_session *handle, int video, char *buf, int len) {
+	janus_bench_session *session = (janus_bench_session *)handle->gateway_handle;
+	g_atomic_int_inc(&session->rtcp);
+}
+static void janus_bench_relay_data(janus_plugin_session *handle, char *buf, int len) {
+	janus_bench_session *session = (janus_bench_session *)handle->gateway_handle;
+	g_atomic_int_inc(&session->data);
+}
+static int janus_bench_data_buffered(janus_plugin_session *handle) {
+	return 0;
+}
+static void janus_bench_relay_data_shared(janus_plugin_session *handle, janus_plugin_rtp_shared *packet, gboolean binary) {
+	janus_bench_session *session = (janus_bench_session *)handle->gateway_handle;
+	g_atomic_int_inc(&session->data);
+}
+static void janus_bench_close_pc(janus_plugin_session *handle) {
+	/* Nothing to do, we'll just stop injecting when we're done */
+}
+static void janus_bench_end_session(janus_plugin_session *handle) {
+	/* Nothing to do, we'll destroy all sessions when we're done */
+}
+static void janus_bench_set_affinity_group(janus_plugin_session *handle, const char *group) {
+	/* There are no event loops to pick here */
+}
+static gboolean janus_bench_admission_check(janus_plugin *p) {
+	/* We're the ones deciding the load here */
+	return TRUE;
+}
+static gboolean janus_bench_events_is_enabled(void) {
+	return FALSE;
+}
+static void janus_bench_notify_event(janus_plugin *p, janus_plugin_session *handle, json_t *event) {
+	if(event)
+		json_decref(event);
+}
+static gboolean janus_bench_auth_is_signature_valid(janus_plugin *p, const char *token) {
+	return TRUE;
+}
+static gboolean janus_bench_auth_signature_contains(janus_plugin *p, const char *token, const char *descriptor) {
+	return TRUE;
+}
+
+static janus_callbacks janus_bench_callbacks =
+	{
+		.push_event = janus_bench_push_event,
+		.relay_rtp = janus_bench_relay_rtp,
+		.relay_rtp_shared = janus_bench_relay_rtp_shared,
+		.relay_rtcp = janus_bench_relay_rtcp,
+		.relay_data = janus_bench_relay_data,
+		.relay_binary_data = janus_bench_relay_data,
+		.data_buffered = janus_bench_data_buffered,
+		.relay_data_shared = janus_bench_relay_data_shared,
+		.close_pc = janus_bench_close_pc,
+		.end_session = janus_bench_end_session,
+		.set_affinity_group = janus_bench_set_affinity_group,
+		.admission_check = janus_bench_admission_check,
+		.events_is_enabled = janus_bench_events_is_enabled,
+		.notify_event = janus_bench_notify_event,
+		.auth_is_signature_valid = janus_bench_auth_is_signature_valid,
+		.auth_signature_contains = janus_bench_auth_signature_contains,
+	};
+
+
+/* Signalling helpers */
+static json_t *janus_bench_request(janus_bench_session *session, json_t *message, json_t *jsep) {
+	/* Returns the content of a synchronous response, if any */
+	janus_plugin_result *result = plugin->handle_message(session->handle, g_strdup("bench"), message, jsep);
+	if(result == NULL) {
+		JANUS_LOG(LOG_ERR, "No result from the plugin\n");
+		return NULL;
+	}
+	json_t *content = NULL;
+	if(result->type == JANUS_PLUGIN_ERROR) {
+		JANUS_LOG(LOG_ERR, "Error from the plugin: %s\n", result->text ? result->text : "??");
+	} else if(result->type == JANUS_PLUGIN_OK && result->content != NULL) {
+		content = json_incref(result->content);
+	}
+	janus_plugin_result_destroy(result);
+	return content;
+}
+
+/* Wait for an event from the plugin: if jsep is TRUE, only events with a JSEP count */
+static janus_bench_event *janus_bench_wait_event(janus_bench_session *session, gboolean jsep) {
+	while(!g_atomic_int_get(&stop)) {
+		janus_bench_event *event = g_async_queue_timeout_pop(session->events, 5*G_USEC_PER_SEC);
+		if(event == NULL) {
+			JANUS_LOG(LOG_ERR, "Timeout waiting for an event from the plugin\n");
+			return NULL;
+		}
+		if(json_object_get(event->message, "error_code") != NULL) {
+			char *text = json_dumps(event->message, JSON_PRESERVE_ORDER);
+			JANUS_LOG(LOG_ERR, "Error from the plugin: %s\n", text);
+			free(text);
+			janus_bench_event_free(event);
+			return NULL;
+		}
+		if(!jsep || event->jsep != NULL)
+			return event;
+		janus_bench_event_free(event);
+	}
+	return NULL;
+}
+
+/* Prepare a JSEP offer for a publisher */
+static json_t *janus_bench_offer(janus_bench_session *session) {
+	gboolean audio = (audio_rate > 0), video = (video_fps > 0);
+	janus_sdp *offer = janus_sdp_generate_offer("janus-bench", "127.0.0.1",
+		JANUS_SDP_OA_AUDIO, audio,
+		JANUS_SDP_OA_VIDEO, video,
+		JANUS_SDP_OA_DATA, FALSE,
+		JANUS_SDP_OA_DONE);
+	if(offer == NULL)
+		return NULL;
+	janus_sdp_mline *m = janus_sdp_mline_find(offer, JANUS_SDP_AUDIO);
+	if(m != NULL) {
+		janus_sdp_attribute *a = janus_sdp_attribute_create("extmap",
+			"%d %s", JANUS_BENCH_AUDIO_LEVEL_ID, JANUS_RTP_EXTMAP_AUDIO_LEVEL);
+		janus_sdp_attribute_add_to_mline(m, a);
+	}
+	char *sdp = janus_sdp_write(offer);
+	janus_sdp_destroy(offer);
+	json_t *jsep = json_pack("{ssss}", "type", "offer", "sdp", sdp);
+	g_free(sdp);
+	if(video && simulcast) {
+		/* The core tells plugins about simulcast SSRCs this way */
+		json_t *s = json_object();
+		json_object_set_new(s, "ssrc-0", json_integer(session->vssrc[0]));
+		json_object_set_new(s, "ssrc-1", json_integer(session->vssrc[1]));
+		json_object_set_new(s, "ssrc-2", json_integer(session->vssrc[2]));
+		json_object_set_new(jsep, "simulcast", s);
+	}
+	return jsep;
+}
+
+/* Prepare a JSEP answer to an offer from the plugin */
+static json_t *janus_bench_answer(json_t *jsep) {
+	const char *sdp = json_string_value(json_object_get(jsep, "sdp"));
+	if(sdp == NULL)
+		return NULL;
+	char error[200];
+	janus_sdp *offer = janus_sdp_parse(sdp, error, sizeof(error));
+	if(offer == NULL) {
+		JANUS_LOG(LOG_ERR, "Error parsing offer from the plugin: %s\n", error);
+		return NULL;
+	}
+	janus_sdp *answer = janus_sdp_generate_answer(offer,
+		JANUS_SDP_OA_DATA, FALSE,
+		JANUS_SDP_OA_DONE);
+	janus_sdp_destroy(offer);
+	if(answer == NULL)
+		return NULL;
+	char *text = janus_sdp_write(answer);
+	janus_sdp_destroy(answer);
+	json_t *result = json_pack("{ssss}", "type", "answer", "sdp", text);
+	g_free(text);
+	return result;
+}
+
+/* Complete the negotiation of a subscriber, once we have an offer from the plugin */
+static int janus_bench_subscriber_start(janus_bench_session *session, json_t *request) {
+	janus_bench_event *event = janus_bench_wait_event(session, TRUE);
+	if(event == NULL)
+		return -1;
+	json_t *answer = janus_bench_answer(event->jsep);
+	janus_bench_event_free(event);
+	if(answer == NULL)
+		return -1;
+	json_t *content = janus_bench_request(session, request, answer);
+	if(content)
+		json_decref(content);
+	event = janus_bench_wait_event(session, FALSE);
+	if(event == NULL)
+		return -1;
+	janus_bench_event_free(event);
+	plugin->setup_media(session->handle);
+	return 0;
+}
+
+/* Create a new publisher, with random SSRCs */
+static janus_bench_session *janus_bench_publisher_create(int index) {
+	janus_bench_session *session = janus_bench_session_create(janus_bench_role_publisher, index);
+	if(session == NULL)
+		return NULL;
+	session->assrc = janus_random_uint32();
+	int i = 0;
+	for(i=0; i<3; i++) {
+		session->vssrc[i] = janus_random_uint32();
+		session->vseq[i] = janus_random_uint32() & 0xFFFF;
+		session->picid[i] = janus_random_uint32() & 0x7FFF;
+	}
+	session->aseq = janus_random_uint32() & 0xFFFF;
+	session->ats = janus_random_uint32();
+	session->vts = janus_random_uint32();
+	return session;
+}
+
+/* Negotiate a publisher: the plugin is expected to answer with a JSEP */
+static int janus_bench_publisher_start(janus_bench_session *session, json_t *request) {
+	json_t *offer = janus_bench_offer(session);
+	if(offer == NULL) {
+		json_decref(request);
+		return -1;
+	}
+	json_t *content = janus_bench_request(session, request, offer);
+	if(content)
+		json_decref(content);
+	janus_bench_event *event = janus_bench_wait_event(session, TRUE);
+	if(event == NULL)
+		return -1;
+	json_t *id = json_object_get(event->message, "id");
+	if(id != NULL)
+		session->feed = json_integer_value(id);
+	janus_bench_event_free(event);
+	plugin->setup_media(session->handle);
+	return 0;
+}
+
+
+/* Scenarios */
+static int janus_bench_setup_echotest(void) {
+	int i = 0;
+	for(i=0; i<publishers; i++) {
+		janus_bench_session *session = janus_bench_publisher_create(i);
+		if(session == NULL)
+			return -1;
+		publisher_list[i] = session;
+		json_t *request = json_pack("{sbsb}", "audio", audio_rate > 0, "video", video_fps > 0);
+		if(janus_bench_publisher_start(session, request) < 0)
+			return -1;
+	}
+	if(subscribers > 0)
+		JANUS_LOG(LOG_INFO, "The EchoTest has no subscribers, media is echoed back to each publisher\n");
+	return 0;
+}
+
+static int janus_bench_setup_videoroom(void) {
+	janus_bench_session *admin = janus_bench_session_create(janus_bench_role_admin, 0);
+	if(admin == NULL)
+		return -1;
+	json_t *content = janus_bench_request(admin, json_pack("{sssisbsb}",
+		"request", "create", "publishers", publishers,
+		"audiolevel_ext", TRUE, "audiolevel_event", TRUE), NULL);
+	if(content == NULL)
+		return -1;
+	guint64 room = json_integer_value(json_object_get(content, "room"));
+	json_decref(content);
+	if(room == 0) {
+		JANUS_LOG(LOG_ERR, "Couldn't create the room\n");
+		return -1;
+	}
+	JANUS_LOG(LOG_INFO, "Created room %"SCNu64"\n", room);
+	int i = 0, j = 0;
+	for(i=0; i<publishers; i++) {
+		janus_bench_session *session = janus_bench_publisher_create(i);
+		if(session == NULL)
+			return -1;
+		publisher_list[i] = session;
+		char display[32];
+		g_snprintf(display, sizeof(display), "bench-%d", i);
+		json_t *request = json_pack("{sssIsssssbsb}",
+			"request", "joinandconfigure", "room", (json_int_t)room,
+			"ptype", "publisher", "display", display,
+			"audio", audio_rate > 0, "video", video_fps > 0);
+		if(janus_bench_publisher_start(session, request) < 0 || session->feed == 0) {
+			JANUS_LOG(LOG_ERR, "Couldn't publish in room %"SCNu64"\n", room);
+			return -1;
+		}
+		for(j=0; j<subscribers; j++) {
+			janus_bench_session *subscriber = janus_bench_session_create(janus_bench_role_subscriber, j);
+			if(subscriber == NULL)
+				return -1;
+			content = janus_bench_request(subscriber, json_pack("{sssIsssI}",
+				"request", "join", "room", (json_int_t)room,
+				"ptype", "subscriber", "feed", (json_int_t)session->feed), NULL);
+			if(content)
+				json_decref(content);
+			if(janus_bench_subscriber_start(subscriber,
+					json_pack("{sssI}", "request", "start", "room", (json_int_t)room)) < 0) {
+				JANUS_LOG(LOG_ERR, "Couldn't subscribe to %"SCNu64"\n", session->feed);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static int janus_bench_setup_streaming(void) {
+	janus_bench_session *admin = janus_bench_session_create(janus_bench_role_admin, 0);
+	if(admin == NULL)
+		return -1;
+	int i = 0, j = 0, k = 0;
+	for(i=0; i<publishers; i++) {
+		/* There are no actual publishers here: we'll send packets to the mountpoint ports */
+		janus_bench_session *session = g_malloc0(sizeof(janus_bench_session));
+		session->role = janus_bench_role_publisher;
+		session->index = i;
+		session->audio_fd = -1;
+		session->video_fd[0] = session->video_fd[1] = session->video_fd[2] = -1;
+		publisher_list[i] = session;
+		int port = base_port + 4*i;
+		char name[32];
+		g_snprintf(name, sizeof(name), "bench-%d", i);
+		json_t *request = json_pack("{sssssssb}",
+			"request", "create", "type", "rtp", "name", name, "audio", audio_rate > 0);
+		if(audio_rate > 0) {
+			json_object_set_new(request, "audioport", json_integer(port));
+			json_object_set_new(request, "audiopt", json_integer(JANUS_BENCH_AUDIO_PT));
+			json_object_set_new(request, "audiortpmap", json_string("opus/48000/2"));
+		}
+		json_object_set_new(request, "video", video_fps > 0 ? json_true() : json_false());
+		if(video_fps > 0) {
+			json_object_set_new(request, "videoport", json_integer(port+1));
+			json_object_set_new(request, "videopt", json_integer(JANUS_BENCH_VIDEO_PT));
+			json_object_set_new(request, "videortpmap", json_string("VP8/90000"));
+			if(simulcast) {
+				json_object_set_new(request, "videosimulcast", json_true());
+				json_object_set_new(request, "videoport2", json_integer(port+2));
+				json_object_set_new(request, "videoport3", json_integer(port+3));
+			}
+		}
+		json_t *content = janus_bench_request(admin, request, NULL);
+		if(content == NULL)
+			return -1;
+		session->feed = json_integer_value(json_object_get(json_object_get(content, "stream"), "id"));
+		json_decref(content);
+		if(session->feed == 0) {
+			JANUS_LOG(LOG_ERR, "Couldn't create mountpoint %d\n", i);
+			return -1;
+		}
+		/* Prepare the sockets to send media with */
+		session->assrc = janus_random_uint32();
+		session->aseq = janus_random_uint32() & 0xFFFF;
+		session->ats = janus_random_uint32();
+		session->vts = janus_random_uint32();
+		session->audio_fd = socket(AF_INET, SOCK_DGRAM, 0);
+		session->audio_addr.sin_family = AF_INET;
+		session->audio_addr.sin_port = htons(port);
+		session->audio_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		for(k=0; k<3; k++) {
+			session->vssrc[k] = janus_random_uint32();
+			session->vseq[k] = janus_random_uint32() & 0xFFFF;
+			session->picid[k] = janus_random_uint32() & 0x7FFF;
+			session->video_fd[k] = socket(AF_INET, SOCK_DGRAM, 0);
+			session->video_addr[k].sin_family = AF_INET;
+			session->video_addr[k].sin_port = htons(port+1+k);
+			session->video_addr[k].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		}
+		for(j=0; j<subscribers; j++) {
+			janus_bench_session *viewer = janus_bench_session_create(janus_bench_role_subscriber, j);
+			if(viewer == NULL)
+				return -1;
+			content = janus_bench_request(viewer, json_pack("{sssI}",
+				"request", "watch", "id", (json_int_t)session->feed), NULL);
+			if(content)
+				json_decref(content);
+			if(janus_bench_subscriber_start(viewer, json_pack("{ss}", "request", "start")) < 0) {
+				JANUS_LOG(LOG_ERR, "Couldn't watch mountpoint %"SCNu64"\n", session->feed);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static int janus_bench_setup_audiobridge(void) {
+	janus_bench_session *admin = janus_bench_session_create(janus_bench_role_admin, 0);
+	if(admin == NULL)
+		return -1;
+	json_t *content = janus_bench_request(admin, json_pack("{ss}", "request", "create"), NULL);
+	if(content == NULL)
+		return -1;
+	guint64 room = json_integer_value(json_object_get(content, "room"));
+	json_decref(content);
+	if(room == 0) {
+		JANUS_LOG(LOG_ERR, "Couldn't create the room\n");
+		return -1;
+	}
+	JANUS_LOG(LOG_INFO, "Created room %"SCNu64"\n", room);
+	/* Participants both send and receive (the mix), and there's no video */
+	video_fps = 0;
+	int i = 0;
+	for(i=0; i<publishers; i++) {
+		janus_bench_session *session = janus_bench_publisher_create(i);
+		if(session == NULL)
+			return -1;
+		publisher_list[i] = session;
+		char display[32];
+		g_snprintf(display, sizeof(display), "bench-%d", i);
+		json_t *request = json_pack("{sssIss}",
+			"request", "join", "room", (json_int_t)room, "display", display);
+		if(janus_bench_publisher_start(session, request) < 0) {
+			JANUS_LOG(LOG_ERR, "Couldn't join room %"SCNu64"\n", room);
+			return -1;
+		}
+	}
+	if(subscribers > 0)
+		JANUS_LOG(LOG_INFO, "The AudioBridge has no subscribers, each participant gets the mix\n");
+	return 0;
+}
+
+
+/* Injecting packets */
+static void janus_bench_inject(janus_bench_session *session, int video, int fd, struct sockaddr_in *addr, char *buf, int len) {
+	if(fd > -1) {
+		/* Streaming plugin, send the packet to the mountpoint */
+		if(sendto(fd, buf, len, 0, (struct sockaddr *)addr, sizeof(*addr)) < 0 && errno != EAGAIN)
+			JANUS_LOG(LOG_WARN, "Error sending packet: %d (%s)\n", errno, strerror(errno));
+		return;
+	}
+	/* Pass the packet to the plugin the same way the core does */
+	if(plugin->incoming_rtp_packet) {
+		janus_plugin_rtp_packet packet = { .video = video, .buffer = buf, .length = len };
+		janus_rtp_ext_info_parse(buf, len, &packet.extensions);
+		if(video)
+			janus_rtp_media_info_parse(JANUS_VIDEOCODEC_VP8, buf, len, &packet.media);
+		plugin->incoming_rtp_packet(session->handle, &packet);
+	} else {
+		plugin->incoming_rtp(session->handle, video, buf, len);
+	}
+}
+
+static int janus_bench_send_audio(janus_bench_session *session) {
+	char buf[JANUS_BENCH_AUDIO_SIZE];
+	memset(buf, 0, sizeof(buf));
+	janus_rtp_header *rtp = (janus_rtp_header *)buf;
+	rtp->version = 2;
+	rtp->extension = 1;
+	rtp->type = JANUS_BENCH_AUDIO_PT;
+	rtp->seq_number = htons(session->aseq++);
+	rtp->timestamp = htonl(session->ats);
+	session->ats += 960;
+	rtp->ssrc = htonl(session->assrc);
+	/* One-byte extension header with the audio level: one in four participants is talking */
+	unsigned char *ext = (unsigned char *)buf + RTP_HEADER_SIZE;
+	uint16_t profile = htons(0xBEDE), words = htons(1);
+	memcpy(ext, &profile, sizeof(profile));
+	memcpy(ext+2, &words, sizeof(words));
+	ext[4] = (JANUS_BENCH_AUDIO_LEVEL_ID << 4);
+	ext[5] = (session->index % 4 == 0) ? (0x80 | 20) : 100;
+	/* Opus TOC for a 20ms CELT fullband frame, followed by filler */
+	unsigned char *payload = ext + 8;
+	payload[0] = 0xF8;
+	payload[1] = 0xFF;
+	payload[2] = 0xFE;
+	janus_bench_tag(buf, sizeof(buf), janus_get_monotonic_time());
+	janus_bench_inject(session, 0, session->audio_fd, &session->audio_addr, buf, sizeof(buf));
+	return 1;
+}
+
+static int janus_bench_send_video(janus_bench_session *session, gint64 now) {
+	char buf[1500];
+	int size = packet_size;
+	if(size > (int)sizeof(buf))
+		size = sizeof(buf);
+	if(size < RTP_HEADER_SIZE + 32)
+		size = RTP_HEADER_SIZE + 32;
+	gboolean keyframe = (now - session->last_keyframe >= JANUS_BENCH_KEYFRAME_INTERVAL);
+	if(keyframe)
+		session->last_keyframe = now;
+	int sent = 0, layers = simulcast ? 3 : 1, layer = 0, i = 0;
+	for(layer=0; layer<layers; layer++) {
+		/* Lower substreams have smaller frames */
+		int index = simulcast ? layer : 0;
+		int count = video_packets >> (layers-1-layer);
+		if(count < 1)
+			count = 1;
+		session->picid[index] = (session->picid[index] + 1) & 0x7FFF;
+		session->tl0picidx[index]++;
+		for(i=0; i<count; i++) {
+			memset(buf, 0, size);
+			janus_rtp_header *rtp = (janus_rtp_header *)buf;
+			rtp->version = 2;
+			rtp->markerbit = (i == count-1);
+			rtp->type = JANUS_BENCH_VIDEO_PT;
+			rtp->seq_number = htons(session->vseq[index]++);
+			rtp->timestamp = htonl(session->vts);
+			rtp->ssrc = htonl(session->vssrc[index]);
+			/* VP8 payload descriptor, with a 15-bit PictureID, TL0PICIDX and TID */
+			unsigned char *vp8 = (unsigned char *)buf + RTP_HEADER_SIZE;
+			vp8[0] = 0x80 | (i == 0 ? 0x10 : 0x00);
+			vp8[1] = 0xE0;
+			vp8[2] = 0x80 | ((session->picid[index] >> 8) & 0x7F);
+			vp8[3] = session->picid[index] & 0xFF;
+			vp8[4] = session->tl0picidx[index];
+			vp8[5] = 0x20;
+			if(i == 0) {
+				/* VP8 payload header: a keyframe (P bit not set) is followed by a start code and the resolution */
+				unsigned char *header = vp8 + 6;
+				header[0] = keyframe ? 0x10 : 0x11;
+				if(keyframe) {
+					header[3] = 0x9d;
+					header[4] = 0x01;
+					header[5] = 0x2a;
+					header[6] = 0x00;	/* 1280 */
+					header[7] = 0x05;
+					header[8] = 0xd0;	/* 720 */
+					header[9] = 0x02;
+				}
+			}
+			janus_bench_tag(buf, size, janus_get_monotonic_time());
+			janus_bench_inject(session, 1, session->video_fd[index], &session->video_addr[index], buf, size);
+			sent++;
+		}
+	}
+	session->vts += 90000/video_fps;
+	return sent;
+}
+
+typedef struct janus_bench_injector {
+	int index;
+	GThread *thread;
+	GList *publishers;
+	guint64 packets;
+	gint64 lag;
+} janus_bench_injector;
+
+static void *janus_bench_injector_thread(void *data) {
+	janus_bench_injector *injector = (janus_bench_injector *)data;
+	gint64 audio_interval = audio_rate > 0 ? G_USEC_PER_SEC/audio_rate : 0;
+	gint64 video_interval = video_fps > 0 ? G_USEC_PER_SEC/video_fps : 0;
+	gint64 now = janus_get_monotonic_time();
+	gint64 next_audio = now, next_video = now;
+	GList *l = NULL;
+	while(!g_atomic_int_get(&stop)) {
+		now = janus_get_monotonic_time();
+		if(audio_interval && now >= next_audio) {
+			if(now - next_audio > injector->lag)
+				injector->lag = now - next_audio;
+			for(l = injector->publishers; l != NULL; l = l->next)
+				injector->packets += janus_bench_send_audio((janus_bench_session *)l->data);
+			next_audio += audio_interval;
+		}
+		if(video_interval && now >= next_video) {
+			if(now - next_video > injector->lag)
+				injector->lag = now - next_video;
+			for(l = injector->publishers; l != NULL; l = l->next)
+				injector->packets += janus_bench_send_video((janus_bench_session *)l->data, now);
+			next_video += video_interval;
+		}
+		gint64 next = audio_interval ? next_audio : next_video;
+		if(video_interval && next_video < next)
+			next = next_video;
+		now = janus_get_monotonic_time();
+		if(next > now)
+			g_usleep(next - now);
+	}
+	return NULL;
+}
+
+
+/* Measurements */
+typedef struct janus_bench_snapshot {
+	gint64 when;
+	guint64 injected, relayed, rtcp;
+	gint64 cpu;
+	guint64 latency[JANUS_BENCH_LATENCY_BUCKETS+1];
+} janus_bench_snapshot;
+
+static void janus_bench_snapshot_take(janus_bench_snapshot *snapshot, janus_bench_injector *injectors) {
+	memset(snapshot, 0, sizeof(*snapshot));
+	snapshot->when = janus_get_monotonic_time();
+	int i = 0;
+	for(i=0; i<threads; i++)
+		snapshot->injected += injectors[i].packets;
+	GList *l = NULL;
+	for(l = sessions; l != NULL; l = l->next) {
+		janus_bench_session *session = (janus_bench_session *)l->data;
+		snapshot->relayed += g_atomic_int_get(&session->rtp);
+		snapshot->rtcp += g_atomic_int_get(&session->rtcp);
+	}
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) == 0) {
+		snapshot->cpu = (gint64)usage.ru_utime.tv_sec*G_USEC_PER_SEC + usage.ru_utime.tv_usec +
+			(gint64)usage.ru_stime.tv_sec*G_USEC_PER_SEC + usage.ru_stime.tv_usec;
+	}
+	for(i=0; i<=JANUS_BENCH_LATENCY_BUCKETS; i++)
+		snapshot->latency[i] = (guint)g_atomic_int_get(&latency[i]);
+}
+
+/* Get a latency percentile (in microseconds) out of the histogram */
+static gint64 janus_bench_percentile(janus_bench_snapshot *start, janus_bench_snapshot *end, guint64 samples, double percentile) {
+	if(samples == 0)
+		return -1;
+	double rank = (double)samples * percentile / 100.0;
+	guint64 target = (guint64)rank, count = 0;
+	if((double)target < rank || target == 0)
+		target++;
+	int i = 0;
+	for(i=0; i<=JANUS_BENCH_LATENCY_BUCKETS; i++) {
+		count += end->latency[i] - start->latency[i];
+		if(count >= target)
+			return (gint64)(i+1)*JANUS_BENCH_LATENCY_STEP;
+	}
+	return (gint64)JANUS_BENCH_LATENCY_BUCKETS*JANUS_BENCH_LATENCY_STEP;
+}
+
+
+int main(int argc, char *argv[])
+{
+	janus_log_init(FALSE, TRUE, NULL);
+	atexit(janus_log_destroy);
+
+	/* Check the JANUS_BENCH_DEBUG environment variable for the debugging level */
+	janus_log_level = janus_bench_env_int("JANUS_BENCH_DEBUG", LOG_WARN, LOG_NONE);
+	if(janus_log_level > LOG_MAX)
+		janus_log_level = LOG_MAX;
+
+	if(argc < 2 || argc > 3) {
+		JANUS_PRINT("Usage: %s /path/to/plugin.so [results.json]\n", argv[0]);
+		JANUS_PRINT("Check the documentation for the JANUS_BENCH_* environment variables to configure the load\n");
+		exit(1);
+	}
+	JANUS_LOG(LOG_INFO, "Janus version: %d (%s)\n", janus_version, janus_version_string);
+	JANUS_LOG(LOG_INFO, "Janus commit: %s\n", janus_build_git_sha);
+
+	publishers = janus_bench_env_int("JANUS_BENCH_PUBLISHERS", publishers, 1);
+	subscribers = janus_bench_env_int("JANUS_BENCH_SUBSCRIBERS", subscribers, 0);
+	duration = janus_bench_env_int("JANUS_BENCH_DURATION", duration, 1);
+	warmup = janus_bench_env_int("JANUS_BENCH_WARMUP", warmup, 0);
+	audio_rate = janus_bench_env_int("JANUS_BENCH_AUDIO_RATE", audio_rate, 0);
+	video_fps = janus_bench_env_int("JANUS_BENCH_VIDEO_FPS", video_fps, 0);
+	video_packets = janus_bench_env_int("JANUS_BENCH_VIDEO_PACKETS", video_packets, 1);
+	packet_size = janus_bench_env_int("JANUS_BENCH_PACKET_SIZE", packet_size, 100);
+	threads = janus_bench_env_int("JANUS_BENCH_THREADS", threads, 1);
+	base_port = janus_bench_env_int("JANUS_BENCH_PORT", base_port, 1);
+	if(g_getenv("JANUS_BENCH_SIMULCAST") != NULL)
+		simulcast = janus_is_true(g_getenv("JANUS_BENCH_SIMULCAST"));
+	if(g_getenv("JANUS_BENCH_CONFIG") != NULL)
+		config_folder = g_getenv("JANUS_BENCH_CONFIG");
+	if(audio_rate == 0 && video_fps == 0) {
+		JANUS_LOG(LOG_FATAL, "Both audio and video are disabled, nothing to do\n");
+		exit(1);
+	}
+	if(threads > publishers)
+		threads = publishers;
+	/* Plugins may record, and expect the recorder code to be initialized */
+	janus_recorder_init(FALSE, NULL);
+
+	/* Load the plugin */
+	void *library = dlopen(argv[1], RTLD_NOW | RTLD_GLOBAL);
+	if(!library) {
+		JANUS_LOG(LOG_FATAL, "Couldn't load plugin '%s': %s\n", argv[1], dlerror());
+		exit(1);
+	}
+	create_p *create = (create_p *)dlsym(library, "create");
+	const char *dlsym_error = dlerror();
+	if(dlsym_error || create == NULL) {
+		JANUS_LOG(LOG_FATAL, "Couldn't load symbol 'create': %s\n", dlsym_error ? dlsym_error : "??");
+		exit(1);
+	}
+	plugin = create();
+	if(!plugin || plugin->get_api_compatibility() < JANUS_PLUGIN_API_VERSION) {
+		JANUS_LOG(LOG_FATAL, "Invalid plugin, or API version mismatch\n");
+		exit(1);
+	}
+	const char *package = plugin->get_package();
+	int (*setup)(void) = NULL;
+	if(!strcmp(package, "janus.plugin.echotest"))
+		setup = janus_bench_setup_echotest;
+	else if(!strcmp(package, "janus.plugin.videoroom"))
+		setup = janus_bench_setup_videoroom;
+	else if(!strcmp(package, "janus.plugin.streaming"))
+		setup = janus_bench_setup_streaming;
+	else if(!strcmp(package, "janus.plugin.audiobridge"))
+		setup = janus_bench_setup_audiobridge;
+	if(setup == NULL) {
+		JANUS_LOG(LOG_FATAL, "Unsupported plugin %s\n", package);
+		exit(1);
+	}
+	signal(SIGINT, janus_bench_handle_signal);
+	signal(SIGTERM, janus_bench_handle_signal);
+	signal(SIGPIPE, SIG_IGN);
+	if(plugin->init(&janus_bench_callbacks, config_folder) < 0) {
+		JANUS_LOG(LOG_FATAL, "Couldn't initialize plugin %s\n", package);
+		exit(1);
+	}
+	JANUS_LOG(LOG_INFO, "Loaded plugin %s (%s)\n", plugin->get_name(), plugin->get_version_string());
+
+	/* Create the publishers and subscribers */
+	JANUS_LOG(LOG_INFO, "Setting up %d publishers with %d subscribers each...\n", publishers, subscribers);
+	publisher_list = g_malloc0(publishers * sizeof(janus_bench_session *));
+	gint64 setup_start = janus_get_monotonic_time();
+	int res = setup();
+	gint64 setup_time = janus_get_monotonic_time() - setup_start;
+	janus_bench_injector *injectors = g_malloc0(threads * sizeof(janus_bench_injector));
+	janus_bench_snapshot *start = NULL, *end = NULL;
+	int i = 0;
+	if(res < 0) {
+		JANUS_LOG(LOG_FATAL, "Error setting up the scenario\n");
+		goto done;
+	}
+	JANUS_LOG(LOG_INFO, "Setup done in %"SCNi64"ms\n", setup_time/1000);
+
+	/* Start injecting */
+	for(i=0; i<publishers; i++)
+		injectors[i % threads].publishers = g_list_append(injectors[i % threads].publishers, publisher_list[i]);
+	for(i=0; i<threads; i++) {
+		injectors[i].index = i;
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "bench %d", i);
+		GError *error = NULL;
+		injectors[i].thread = g_thread_try_new(tname, janus_bench_injector_thread, &injectors[i], &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_FATAL, "Got error %d (%s) trying to launch the injector thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			g_atomic_int_set(&stop, 1);
+			res = -1;
+			goto done;
+		}
+	}
+	JANUS_LOG(LOG_INFO, "Warming up for %d seconds...\n", warmup);
+	gint64 deadline = janus_get_monotonic_time() + (gint64)warmup*G_USEC_PER_SEC;
+	while(!g_atomic_int_get(&stop) && janus_get_monotonic_time() < deadline)
+		g_usleep(100000);
+	start = g_malloc(sizeof(janus_bench_snapshot));
+	end = g_malloc(sizeof(janus_bench_snapshot));
+	janus_bench_snapshot_take(start, injectors);
+	JANUS_LOG(LOG_INFO, "Measuring for %d seconds...\n", duration);
+	deadline = start->when + (gint64)duration*G_USEC_PER_SEC;
+	while(!g_atomic_int_get(&stop) && janus_get_monotonic_time() < deadline)
+		g_usleep(100000);
+	janus_bench_snapshot_take(end, injectors);
+	g_atomic_int_set(&stop, 1);
+	for(i=0; i<threads; i++) {
+		if(injectors[i].thread != NULL)
+			g_thread_join(injectors[i].thread);
+		injectors[i].thread = NULL;
+	}
+
+	/* Done, prepare the results */
+	double elapsed = (double)(end->when - start->when)/G_USEC_PER_SEC;
+	guint64 injected = end->injected - start->injected, relayed = end->relayed - start->relayed;
+	guint64 samples = 0;
+	for(i=0; i<=JANUS_BENCH_LATENCY_BUCKETS; i++)
+		samples += end->latency[i] - start->latency[i];
+	gint64 cpu = end->cpu - start->cpu, lag = 0;
+	for(i=0; i<threads; i++) {
+		if(injectors[i].lag > lag)
+			lag = injectors[i].lag;
+	}
+	json_t *results = json_object();
+	json_object_set_new(results, "plugin", json_string(package));
+	json_object_set_new(results, "plugin_version", json_string(plugin->get_version_string()));
+	json_object_set_new(results, "janus_version", json_string(janus_version_string));
+	json_object_set_new(results, "janus_commit", json_string(janus_build_git_sha));
+	json_t *settings = json_object();
+	json_object_set_new(settings, "publishers", json_integer(publishers));
+	json_object_set_new(settings, "subscribers", json_integer(subscribers));
+	json_object_set_new(settings, "audio_rate", json_integer(audio_rate));
+	json_object_set_new(settings, "video_fps", json_integer(video_fps));
+	json_object_set_new(settings, "video_packets", json_integer(video_packets));
+	json_object_set_new(settings, "packet_size", json_integer(packet_size));
+	json_object_set_new(settings, "simulcast", simulcast ? json_true() : json_false());
+	json_object_set_new(settings, "threads", json_integer(threads));
+	json_object_set_new(results, "settings", settings);
+	json_object_set_new(results, "setup_time_ms", json_integer(setup_time/1000));
+	json_object_set_new(results, "duration", json_real(elapsed));
+	json_t *packets = json_object();
+	json_object_set_new(packets, "injected", json_integer(injected));
+	json_object_set_new(packets, "injected_per_second", json_real(elapsed > 0 ? injected/elapsed : 0));
+	json_object_set_new(packets, "relayed", json_integer(relayed));
+	json_object_set_new(packets, "relayed_per_second", json_real(elapsed > 0 ? relayed/elapsed : 0));
+	json_object_set_new(packets, "rtcp", json_integer(end->rtcp - start->rtcp));
+	json_object_set_new(results, "packets", packets);
+	json_t *usage = json_object();
+	json_object_set_new(usage, "cpu_time_ms", json_integer(cpu/1000));
+	json_object_set_new(usage, "cpu_percent", json_real(elapsed > 0 ? 100.0*cpu/(elapsed*G_USEC_PER_SEC) : 0));
+	json_object_set_new(usage, "us_per_injected_packet", json_real(injected ? (double)cpu/injected : 0));
+	json_object_set_new(usage, "us_per_relayed_packet", json_real(relayed ? (double)cpu/relayed : 0));
+	json_object_set_new(usage, "max_injection_lag_us", json_integer(lag));
+	json_object_set_new(results, "cpu", usage);
+	json_t *lat = json_object();
+	json_object_set_new(lat, "samples", json_integer(samples));
+	if(samples > 0) {
+		json_object_set_new(lat, "p50_us", json_integer(janus_bench_percentile(start, end, samples, 50)));
+		json_object_set_new(lat, "p90_us", json_integer(janus_bench_percentile(start, end, samples, 90)));
+		json_object_set_new(lat, "p99_us", json_integer(janus_bench_percentile(start, end, samples, 99)));
+		json_object_set_new(lat, "p999_us", json_integer(janus_bench_percentile(start, end, samples, 99.9)));
+		json_object_set_new(lat, "max_us", json_integer(janus_bench_percentile(start, end, samples, 100)));
+	}
+	json_object_set_new(results, "latency", lat);
+	if(argc == 3) {
+		if(json_dump_file(results, argv[2], JSON_INDENT(3) | JSON_PRESERVE_ORDER) < 0) {
+			JANUS_LOG(LOG_ERR, "Error saving results to %s\n", argv[2]);
+			res = -1;
+		} else {
+			JANUS_LOG(LOG_INFO, "Results saved to %s\n", argv[2]);
+		}
+	} else {
+		char *text = json_dumps(results, JSON_INDENT(3) | JSON_PRESERVE_ORDER);
+		JANUS_PRINT("%s\n", text);
+		free(text);
+	}
+	json_decref(results);
+
+done:
+	/* Get rid of all the sessions, and of the plugin */
+	g_atomic_int_set(&stop, 1);
+	for(i=0; i<threads; i++) {
+		if(injectors[i].thread != NULL)
+			g_thread_join(injectors[i].thread);
+		g_list_free(injectors[i].publishers);
+	}
+	g_free(injectors);
+	g_list_free_full(sessions, (GDestroyNotify)janus_bench_session_destroy);
+	sessions = NULL;
+	/* Streaming publishers are not plugin sessions */
+	if(!strcmp(package, "janus.plugin.streaming")) {
+		for(i=0; i<publishers; i++) {
+			janus_bench_session *session = publisher_list[i];
+			if(session == NULL)
+				continue;
+			int k = 0;
+			if(session->audio_fd > -1)
+				close(session->audio_fd);
+			for(k=0; k<3; k++) {
+				if(session->video_fd[k] > -1)
+					close(session->video_fd[k]);
+			}
+			g_free(session);
+		}
+	}
+	g_free(publisher_list);
+	g_free(start);
+	g_free(end);
+	plugin->destroy();
+	janus_recorder_deinit();
+	janus_metrics_deinit();
+
+	return res < 0 ? 1 : 0;
+}
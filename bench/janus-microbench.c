@@ -0,0 +1,757 @@
+/*! \file    janus-microbench.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Microbenchmarks for the RTP, RTCP and SDP helpers of the core
+ * \details  This utility runs a set of microbenchmarks on the helpers that
+ * are on the hot path of every packet Janus relays: the RTP header and
+ * extensions parsing and rewriting code in rtp.c, the RTCP parsing,
+ * filtering and generation code in rtcp.c, the keyframe and payload
+ * descriptor parsers in utils.c, and the SDP parser and writer in
+ * sdp-utils.c. The inputs are a small corpus of packets and SDPs laid out
+ * the way browsers (Chrome, specifically) send them, i.e., with the same
+ * extensions, IDs and compound packets, so that the numbers are as close
+ * as possible to what happens in production. For each benchmark, the time
+ * per operation in nanoseconds and, where the C library allows it
+ * (glibc), the number of heap allocations per operation are reported:
+ * this makes it easy to check whether an optimization actually made a
+ * difference, or whether a change introduced a regression.
+ *
+ * Using the utility is quite simple. Just launch it and, optionally, pass
+ * the path to the JSON file to save the results to (by default only a
+ * table is printed on the standard output), e.g.:
+ *
+\verbatim
+./janus-microbench results.json
+\endverbatim
+ *
+ * A few environment variables can be used to tweak the behaviour:
+ *
+ * - \c JANUS_MICROBENCH_FILTER: only run the benchmarks whose name contains this string (e.g., "rtcp/");
+ * - \c JANUS_MICROBENCH_TIME: how long to run each benchmark for, in milliseconds, 500 by default;
+ * - \c JANUS_MICROBENCH_DEBUG: the logging level, 3 (warnings) by default.
+ *
+ * \ingroup benchmark
+ * \ref benchmark
+ */
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <glib.h>
+#include <jansson.h>
+
+#include "../debug.h"
+#include "../mutex.h"
+#include "../rtcp.h"
+#include "../rtp.h"
+#include "../sdp-utils.h"
+#include "../utils.h"
+#include "../version.h"
+
+
+#ifdef REFCOUNT_DEBUG
+/* Reference counters debugging */
+GHashTable *counters = NULL;
+janus_mutex counters_mutex;
+#endif
+
+/* Logging */
+int janus_log_level = LOG_WARN;
+gboolean janus_log_timestamps = FALSE;
+gboolean janus_log_colors = TRUE;
+int lock_debug = 0;
+#ifdef REFCOUNT_DEBUG
+int refcount_debug = 1;
+#else
+int refcount_debug = 0;
+#endif
+
+
+/* Allocations counting: on glibc we can wrap malloc and friends, and
+ * count how many times they're called (GLib uses the system allocator) */
+static volatile gint allocations = 0;
+#ifdef __GLIBC__
+#define JANUS_MICROBENCH_COUNT_ALLOCATIONS
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+void *malloc(size_t size) {
+	g_atomic_int_inc(&allocations);
+	return __libc_malloc(size);
+}
+void *calloc(size_t nmemb, size_t size) {
+	g_atomic_int_inc(&allocations);
+	return __libc_calloc(nmemb, size);
+}
+void *realloc(void *ptr, size_t size) {
+	g_atomic_int_inc(&allocations);
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+/* Results are accumulated here, so that the compiler can't optimize the calls away */
+static volatile int sink = 0;
+
+static gint64 janus_microbench_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (gint64)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+
+/* Corpus */
+#define JANUS_MICROBENCH_PACKET_SIZE	1500
+/* Extension IDs, as negotiated by Chrome */
+#define JANUS_MICROBENCH_EXT_AUDIO_LEVEL	1
+#define JANUS_MICROBENCH_EXT_ABS_SEND_TIME	2
+#define JANUS_MICROBENCH_EXT_TWCC		3
+#define JANUS_MICROBENCH_EXT_MID		4
+#define JANUS_MICROBENCH_EXT_RID		10
+
+typedef struct janus_microbench_packet {
+	char buffer[JANUS_MICROBENCH_PACKET_SIZE];
+	int length;
+} janus_microbench_packet;
+
+/* Opus packet: audio level, abs-send-time, transport-wide CC and mid extensions */
+static const unsigned char janus_microbench_opus_header[] = {
+	0x90, 0x6f, 0x1a, 0x2b, 0x00, 0x01, 0x2c, 0x00, 0x5d, 0x3f, 0x2a, 0x11,
+	0xbe, 0xde, 0x00, 0x03,
+	0x10, 0x9e,
+	0x22, 0x4c, 0x8a, 0x31,
+	0x31, 0x01, 0x2c,
+	0x40, 0x30,
+	0x00,
+	0xfc	/* Opus TOC: 20ms SILK+CELT fullband frame */
+};
+/* VP8 packet: abs-send-time, transport-wide CC, mid and rid extensions,
+ * a Picture ID/TL0PICIDX/TID descriptor and the beginning of a keyframe */
+static const unsigned char janus_microbench_vp8_header[] = {
+	0x90, 0x60, 0x3c, 0x4d, 0x00, 0x54, 0x5f, 0x20, 0x72, 0x1b, 0x94, 0x07,
+	0xbe, 0xde, 0x00, 0x03,
+	0x22, 0x4c, 0x8a, 0x35,
+	0x31, 0x01, 0x2d,
+	0x40, 0x30,
+	0xa0, 0x68,
+	0x00,
+	0x90, 0xe0, 0x8b, 0x2e, 0x5a, 0x20,
+	0x10, 0x02, 0x00, 0x9d, 0x01, 0x2a, 0x80, 0x02, 0xe0, 0x01
+};
+/* VP9 packet (as sent with the SVC profile): layer indices and a scalability structure */
+static const unsigned char janus_microbench_vp9_header[] = {
+	0x90, 0x62, 0x0e, 0x71, 0x00, 0x2a, 0x11, 0x70, 0x44, 0x9a, 0x12, 0x3c,
+	0xbe, 0xde, 0x00, 0x03,
+	0x22, 0x4c, 0x8a, 0x39,
+	0x31, 0x01, 0x2e,
+	0x40, 0x30,
+	0x00, 0x00, 0x00,
+	0xaa, 0x8b, 0x2e, 0x00, 0x05,
+	0x18, 0x02, 0x80, 0x01, 0xe0, 0x01, 0x04, 0x01,
+	0x82, 0x49, 0x83, 0x42, 0x00
+};
+/* H.264 packet: beginning of an IDR fragmented as FU-A */
+static const unsigned char janus_microbench_h264_header[] = {
+	0x90, 0x66, 0x5e, 0x30, 0x00, 0x71, 0x09, 0xa0, 0x0b, 0x31, 0xc6, 0x52,
+	0xbe, 0xde, 0x00, 0x03,
+	0x22, 0x4c, 0x8a, 0x3b,
+	0x31, 0x01, 0x2f,
+	0x40, 0x30,
+	0x00, 0x00, 0x00,
+	0x7c, 0x85, 0x88, 0x84, 0x00, 0x33, 0xff
+};
+
+/* RTCP compound packets */
+static unsigned char janus_microbench_rtcp_sr_sdes[] = {
+	/* SR */
+	0x80, 0xc8, 0x00, 0x06, 0x5d, 0x3f, 0x2a, 0x11,
+	0xe6, 0x3c, 0x1f, 0x42, 0x8f, 0x5c, 0x28, 0xf5,
+	0x00, 0x01, 0x2c, 0x00, 0x00, 0x00, 0x01, 0xf4, 0x00, 0x00, 0x9c, 0x40,
+	/* SDES (CNAME) */
+	0x81, 0xca, 0x00, 0x06, 0x5d, 0x3f, 0x2a, 0x11,
+	0x01, 0x10, 'q', 'N', '3', 'x', 'L', 'k', 'z', '9', 'P', 'b', 'T', 'w', 'e', 'Y', 'u', 'S',
+	0x00, 0x00
+};
+static unsigned char janus_microbench_rtcp_rr_remb[] = {
+	/* RR */
+	0x81, 0xc9, 0x00, 0x07, 0x00, 0x00, 0x00, 0x01,
+	0x72, 0x1b, 0x94, 0x07, 0x02, 0x00, 0x00, 0x05, 0x00, 0x00, 0x3c, 0x4d,
+	0x00, 0x00, 0x00, 0x2a, 0x1f, 0x42, 0x8f, 0x5c, 0x00, 0x00, 0x10, 0x00,
+	/* REMB (1.5mbps) */
+	0x8f, 0xce, 0x00, 0x05, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+	'R', 'E', 'M', 'B', 0x01, 0x0e, 0xdc, 0x6c, 0x72, 0x1b, 0x94, 0x07
+};
+static unsigned char janus_microbench_rtcp_rr_nack_pli[] = {
+	/* RR */
+	0x81, 0xc9, 0x00, 0x07, 0x00, 0x00, 0x00, 0x01,
+	0x72, 0x1b, 0x94, 0x07, 0x02, 0x00, 0x00, 0x05, 0x00, 0x00, 0x3c, 0x4d,
+	0x00, 0x00, 0x00, 0x2a, 0x1f, 0x42, 0x8f, 0x5c, 0x00, 0x00, 0x10, 0x00,
+	/* NACK */
+	0x81, 0xcd, 0x00, 0x04, 0x00, 0x00, 0x00, 0x01, 0x72, 0x1b, 0x94, 0x07,
+	0x3c, 0x40, 0x00, 0x15, 0x3c, 0x52, 0x80, 0x01,
+	/* PLI */
+	0x81, 0xce, 0x00, 0x02, 0x00, 0x00, 0x00, 0x01, 0x72, 0x1b, 0x94, 0x07
+};
+static unsigned char janus_microbench_rtcp_twcc[] = {
+	/* Transport-wide CC feedback: 22 packets, all received with small deltas */
+	0x8f, 0xcd, 0x00, 0x0a, 0x00, 0x00, 0x00, 0x01, 0x72, 0x1b, 0x94, 0x07,
+	0x01, 0x2c, 0x00, 0x16, 0x00, 0x10, 0x20, 0x05,
+	0x20, 0x16,
+	0x14, 0x03, 0x01, 0x10, 0x02, 0x05, 0x00, 0x12, 0x04, 0x01, 0x01,
+	0x0f, 0x06, 0x02, 0x00, 0x11, 0x03, 0x01, 0x13, 0x02, 0x04, 0x01
+};
+
+/* SDP offer, as generated by Chrome for audio, simulcast video and data channels */
+static const char *janus_microbench_sdp =
+	"v=0\r\n"
+	"o=- 4611731400430051336 2 IN IP4 127.0.0.1\r\n"
+	"s=-\r\n"
+	"t=0 0\r\n"
+	"a=group:BUNDLE 0 1 2\r\n"
+	"a=extmap-allow-mixed\r\n"
+	"a=msid-semantic: WMS 5XOfvK6vBwvR2eJhUBIKNwztSfwHhcxsOCIV\r\n"
+	"m=audio 9 UDP/TLS/RTP/SAVPF 111 63 9 0 8 13 110 126\r\n"
+	"c=IN IP4 0.0.0.0\r\n"
+	"a=rtcp:9 IN IP4 0.0.0.0\r\n"
+	"a=ice-ufrag:Xa2F\r\n"
+	"a=ice-pwd:pC6Vag0ftlcMsfmv2Nd7T6Zb\r\n"
+	"a=ice-options:trickle\r\n"
+	"a=fingerprint:sha-256 2B:4F:6E:A1:3D:11:D4:8C:97:F0:AB:64:5E:93:72:C9:0E:8D:55:1A:BC:3E:F2:61:49:E7:07:D6:82:A5:1C:3B\r\n"
+	"a=setup:actpass\r\n"
+	"a=mid:0\r\n"
+	"a=extmap:1 urn:ietf:params:rtp-hdrext:ssrc-audio-level\r\n"
+	"a=extmap:2 http://www.webrtc.org/experiments/rtp-hdrext/abs-send-time\r\n"
+	"a=extmap:3 http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01\r\n"
+	"a=extmap:4 urn:ietf:params:rtp-hdrext:sdes:mid\r\n"
+	"a=sendrecv\r\n"
+	"a=msid:5XOfvK6vBwvR2eJhUBIKNwztSfwHhcxsOCIV 8d9a3c5e-2f14-4b8e-9c71-0a6e3b5d4f21\r\n"
+	"a=rtcp-mux\r\n"
+	"a=rtpmap:111 opus/48000/2\r\n"
+	"a=rtcp-fb:111 transport-cc\r\n"
+	"a=fmtp:111 minptime=10;useinbandfec=1\r\n"
+	"a=rtpmap:63 red/48000/2\r\n"
+	"a=fmtp:63 111/111\r\n"
+	"a=rtpmap:9 G722/8000\r\n"
+	"a=rtpmap:0 PCMU/8000\r\n"
+	"a=rtpmap:8 PCMA/8000\r\n"
+	"a=rtpmap:13 CN/8000\r\n"
+	"a=rtpmap:110 telephone-event/48000\r\n"
+	"a=rtpmap:126 telephone-event/8000\r\n"
+	"a=ssrc:1564420625 cname:qN3xLkz9PbTweYuS\r\n"
+	"a=ssrc:1564420625 msid:5XOfvK6vBwvR2eJhUBIKNwztSfwHhcxsOCIV 8d9a3c5e-2f14-4b8e-9c71-0a6e3b5d4f21\r\n"
+	"m=video 9 UDP/TLS/RTP/SAVPF 96 97 98 99 100 101 102 103 104 105 106 107 108 109 127 125 39 40 45 46 35 36\r\n"
+	"c=IN IP4 0.0.0.0\r\n"
+	"a=rtcp:9 IN IP4 0.0.0.0\r\n"
+	"a=ice-ufrag:Xa2F\r\n"
+	"a=ice-pwd:pC6Vag0ftlcMsfmv2Nd7T6Zb\r\n"
+	"a=ice-options:trickle\r\n"
+	"a=fingerprint:sha-256 2B:4F:6E:A1:3D:11:D4:8C:97:F0:AB:64:5E:93:72:C9:0E:8D:55:1A:BC:3E:F2:61:49:E7:07:D6:82:A5:1C:3B\r\n"
+	"a=setup:actpass\r\n"
+	"a=mid:1\r\n"
+	"a=extmap:14 urn:ietf:params:rtp-hdrext:toffset\r\n"
+	"a=extmap:2 http://www.webrtc.org/experiments/rtp-hdrext/abs-send-time\r\n"
+	"a=extmap:13 urn:3gpp:video-orientation\r\n"
+	"a=extmap:3 http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01\r\n"
+	"a=extmap:5 http://www.webrtc.org/experiments/rtp-hdrext/playout-delay\r\n"
+	"a=extmap:6 http://www.webrtc.org/experiments/rtp-hdrext/video-content-type\r\n"
+	"a=extmap:7 http://www.webrtc.org/experiments/rtp-hdrext/video-timing\r\n"
+	"a=extmap:8 http://www.webrtc.org/experiments/rtp-hdrext/color-space\r\n"
+	"a=extmap:4 urn:ietf:params:rtp-hdrext:sdes:mid\r\n"
+	"a=extmap:10 urn:ietf:params:rtp-hdrext:sdes:rtp-stream-id\r\n"
+	"a=extmap:11 urn:ietf:params:rtp-hdrext:sdes:repaired-rtp-stream-id\r\n"
+	"a=sendrecv\r\n"
+	"a=msid:5XOfvK6vBwvR2eJhUBIKNwztSfwHhcxsOCIV 1f7e2d3c-6b5a-4c9d-8e0f-7a6b5c4d3e2f\r\n"
+	"a=rtcp-mux\r\n"
+	"a=rtcp-rsize\r\n"
+	"a=rtpmap:96 VP8/90000\r\n"
+	"a=rtcp-fb:96 goog-remb\r\n"
+	"a=rtcp-fb:96 transport-cc\r\n"
+	"a=rtcp-fb:96 ccm fir\r\n"
+	"a=rtcp-fb:96 nack\r\n"
+	"a=rtcp-fb:96 nack pli\r\n"
+	"a=rtpmap:97 rtx/90000\r\n"
+	"a=fmtp:97 apt=96\r\n"
+	"a=rtpmap:98 VP9/90000\r\n"
+	"a=rtcp-fb:98 goog-remb\r\n"
+	"a=rtcp-fb:98 transport-cc\r\n"
+	"a=rtcp-fb:98 ccm fir\r\n"
+	"a=rtcp-fb:98 nack\r\n"
+	"a=rtcp-fb:98 nack pli\r\n"
+	"a=fmtp:98 profile-id=0\r\n"
+	"a=rtpmap:99 rtx/90000\r\n"
+	"a=fmtp:99 apt=98\r\n"
+	"a=rtpmap:100 VP9/90000\r\n"
+	"a=rtcp-fb:100 goog-remb\r\n"
+	"a=rtcp-fb:100 transport-cc\r\n"
+	"a=rtcp-fb:100 ccm fir\r\n"
+	"a=rtcp-fb:100 nack\r\n"
+	"a=rtcp-fb:100 nack pli\r\n"
+	"a=fmtp:100 profile-id=2\r\n"
+	"a=rtpmap:101 rtx/90000\r\n"
+	"a=fmtp:101 apt=100\r\n"
+	"a=rtpmap:102 H264/90000\r\n"
+	"a=rtcp-fb:102 goog-remb\r\n"
+	"a=rtcp-fb:102 transport-cc\r\n"
+	"a=rtcp-fb:102 ccm fir\r\n"
+	"a=rtcp-fb:102 nack\r\n"
+	"a=rtcp-fb:102 nack pli\r\n"
+	"a=fmtp:102 level-asymmetry-allowed=1;packetization-mode=1;profile-level-id=42001f\r\n"
+	"a=rtpmap:103 rtx/90000\r\n"
+	"a=fmtp:103 apt=102\r\n"
+	"a=rtpmap:104 H264/90000\r\n"
+	"a=rtcp-fb:104 goog-remb\r\n"
+	"a=rtcp-fb:104 transport-cc\r\n"
+	"a=rtcp-fb:104 ccm fir\r\n"
+	"a=rtcp-fb:104 nack\r\n"
+	"a=rtcp-fb:104 nack pli\r\n"
+	"a=fmtp:104 level-asymmetry-allowed=1;packetization-mode=0;profile-level-id=42001f\r\n"
+	"a=rtpmap:105 rtx/90000\r\n"
+	"a=fmtp:105 apt=104\r\n"
+	"a=rtpmap:106 H264/90000\r\n"
+	"a=rtcp-fb:106 goog-remb\r\n"
+	"a=rtcp-fb:106 transport-cc\r\n"
+	"a=rtcp-fb:106 ccm fir\r\n"
+	"a=rtcp-fb:106 nack\r\n"
+	"a=rtcp-fb:106 nack pli\r\n"
+	"a=fmtp:106 level-asymmetry-allowed=1;packetization-mode=1;profile-level-id=42e01f\r\n"
+	"a=rtpmap:107 rtx/90000\r\n"
+	"a=fmtp:107 apt=106\r\n"
+	"a=rtpmap:108 H264/90000\r\n"
+	"a=rtcp-fb:108 goog-remb\r\n"
+	"a=rtcp-fb:108 transport-cc\r\n"
+	"a=rtcp-fb:108 ccm fir\r\n"
+	"a=rtcp-fb:108 nack\r\n"
+	"a=rtcp-fb:108 nack pli\r\n"
+	"a=fmtp:108 level-asymmetry-allowed=1;packetization-mode=0;profile-level-id=42e01f\r\n"
+	"a=rtpmap:109 rtx/90000\r\n"
+	"a=fmtp:109 apt=108\r\n"
+	"a=rtpmap:127 H264/90000\r\n"
+	"a=rtcp-fb:127 goog-remb\r\n"
+	"a=rtcp-fb:127 transport-cc\r\n"
+	"a=rtcp-fb:127 ccm fir\r\n"
+	"a=rtcp-fb:127 nack\r\n"
+	"a=rtcp-fb:127 nack pli\r\n"
+	"a=fmtp:127 level-asymmetry-allowed=1;packetization-mode=1;profile-level-id=4d001f\r\n"
+	"a=rtpmap:125 rtx/90000\r\n"
+	"a=fmtp:125 apt=127\r\n"
+	"a=rtpmap:39 H264/90000\r\n"
+	"a=rtcp-fb:39 goog-remb\r\n"
+	"a=rtcp-fb:39 transport-cc\r\n"
+	"a=rtcp-fb:39 ccm fir\r\n"
+	"a=rtcp-fb:39 nack\r\n"
+	"a=rtcp-fb:39 nack pli\r\n"
+	"a=fmtp:39 level-asymmetry-allowed=1;packetization-mode=0;profile-level-id=4d001f\r\n"
+	"a=rtpmap:40 rtx/90000\r\n"
+	"a=fmtp:40 apt=39\r\n"
+	"a=rtpmap:45 AV1/90000\r\n"
+	"a=rtcp-fb:45 goog-remb\r\n"
+	"a=rtcp-fb:45 transport-cc\r\n"
+	"a=rtcp-fb:45 ccm fir\r\n"
+	"a=rtcp-fb:45 nack\r\n"
+	"a=rtcp-fb:45 nack pli\r\n"
+	"a=rtpmap:46 rtx/90000\r\n"
+	"a=fmtp:46 apt=45\r\n"
+	"a=rtpmap:35 red/90000\r\n"
+	"a=rtpmap:36 rtx/90000\r\n"
+	"a=fmtp:36 apt=35\r\n"
+	"a=rid:h send\r\n"
+	"a=rid:m send\r\n"
+	"a=rid:l send\r\n"
+	"a=simulcast:send h;m;l\r\n"
+	"m=application 9 UDP/DTLS/SCTP webrtc-datachannel\r\n"
+	"c=IN IP4 0.0.0.0\r\n"
+	"a=ice-ufrag:Xa2F\r\n"
+	"a=ice-pwd:pC6Vag0ftlcMsfmv2Nd7T6Zb\r\n"
+	"a=ice-options:trickle\r\n"
+	"a=fingerprint:sha-256 2B:4F:6E:A1:3D:11:D4:8C:97:F0:AB:64:5E:93:72:C9:0E:8D:55:1A:BC:3E:F2:61:49:E7:07:D6:82:A5:1C:3B\r\n"
+	"a=setup:actpass\r\n"
+	"a=mid:2\r\n"
+	"a=sctp-port:5000\r\n"
+	"a=max-message-size:262144\r\n";
+
+static janus_microbench_packet opus, vp8, vp9, h264, work;
+static janus_rtp_switching_context switching;
+static janus_rtcp_context rtcp_ctx;
+static gint64 skew_now = 0;
+static guint64 twcc_timestamps[100];
+static GSList *nack_list = NULL;
+static janus_sdp *parsed_sdp = NULL;
+
+/* Packets are the header above, followed by payload bytes that don't look like anything */
+static void janus_microbench_packet_prepare(janus_microbench_packet *packet, const unsigned char *header, int hlen, int len) {
+	memcpy(packet->buffer, header, hlen);
+	guint32 seed = 0x4a616e75;
+	int i = 0;
+	for(i=hlen; i<len; i++) {
+		seed = seed * 1103515245 + 12345;
+		packet->buffer[i] = (seed >> 16) & 0xFF;
+	}
+	packet->length = len;
+}
+
+static void janus_microbench_corpus_prepare(void) {
+	janus_microbench_packet_prepare(&opus, janus_microbench_opus_header, sizeof(janus_microbench_opus_header), 88);
+	janus_microbench_packet_prepare(&vp8, janus_microbench_vp8_header, sizeof(janus_microbench_vp8_header), 1172);
+	janus_microbench_packet_prepare(&vp9, janus_microbench_vp9_header, sizeof(janus_microbench_vp9_header), 1168);
+	janus_microbench_packet_prepare(&h264, janus_microbench_h264_header, sizeof(janus_microbench_h264_header), 1180);
+	janus_rtp_switching_context_reset(&switching);
+	memset(&rtcp_ctx, 0, sizeof(rtcp_ctx));
+	rtcp_ctx.tb = 90000;
+	/* Reception times for transport-wide CC feedback: one in twenty packets is lost */
+	int i = 0;
+	for(i=0; i<100; i++)
+		twcc_timestamps[i] = (i % 20 == 19) ? 0 : (guint64)1000000 + i*2500;
+	for(i=0; i<10; i++)
+		nack_list = g_slist_append(nack_list, GUINT_TO_POINTER(15420 + 2*i));
+	char error[200];
+	parsed_sdp = janus_sdp_parse(janus_microbench_sdp, error, sizeof(error));
+	if(parsed_sdp == NULL)
+		JANUS_LOG(LOG_ERR, "Error parsing the SDP corpus: %s\n", error);
+}
+
+static void janus_microbench_corpus_destroy(void) {
+	g_slist_free(nack_list);
+	nack_list = NULL;
+	janus_sdp_destroy(parsed_sdp);
+	parsed_sdp = NULL;
+}
+
+
+/* Benchmarks: each function performs a single operation */
+static int janus_microbench_baseline_copy(void) {
+	memcpy(work.buffer, janus_microbench_rtcp_rr_nack_pli, sizeof(janus_microbench_rtcp_rr_nack_pli));
+	return work.buffer[0];
+}
+
+static int janus_microbench_rtp_ext_info_parse(void) {
+	janus_rtp_ext_info info;
+	return janus_rtp_ext_info_parse(vp8.buffer, vp8.length, &info);
+}
+
+static int janus_microbench_rtp_ext_info_audio(void) {
+	/* What the core does now: one pass, then the lookups */
+	janus_rtp_ext_info info;
+	int level = 0;
+	uint16_t seq = 0;
+	janus_rtp_ext_info_parse(opus.buffer, opus.length, &info);
+	janus_rtp_ext_info_audio_level(&info, opus.buffer, JANUS_MICROBENCH_EXT_AUDIO_LEVEL, &level);
+	janus_rtp_ext_info_transport_wide_cc(&info, opus.buffer, JANUS_MICROBENCH_EXT_TWCC, &seq);
+	return level + seq;
+}
+
+static int janus_microbench_rtp_ext_parse_audio(void) {
+	/* The same lookups, with a walk of the extensions block each */
+	int level = 0;
+	uint16_t seq = 0;
+	janus_rtp_header_extension_parse_audio_level(opus.buffer, opus.length, JANUS_MICROBENCH_EXT_AUDIO_LEVEL, &level);
+	janus_rtp_header_extension_parse_transport_wide_cc(opus.buffer, opus.length, JANUS_MICROBENCH_EXT_TWCC, &seq);
+	return level + seq;
+}
+
+static int janus_microbench_rtp_payload(void) {
+	int plen = 0;
+	char *payload = janus_rtp_payload(vp8.buffer, vp8.length, &plen);
+	return payload ? plen : 0;
+}
+
+static int janus_microbench_rtp_header_update(void) {
+	/* Consecutive packets of the same stream */
+	janus_rtp_header *header = (janus_rtp_header *)work.buffer;
+	uint16_t seq = ntohs(header->seq_number) + 1;
+	uint32_t ts = ntohl(header->timestamp) + 3000;
+	memcpy(work.buffer, vp8.buffer, RTP_HEADER_SIZE);
+	header->seq_number = htons(seq);
+	header->timestamp = htonl(ts);
+	janus_rtp_header_update(header, &switching, TRUE, 0);
+	return header->seq_number;
+}
+
+static int janus_microbench_rtp_skew_audio(void) {
+	/* Consecutive packets of the same stream, sent at the right pace */
+	janus_rtp_header *header = (janus_rtp_header *)work.buffer;
+	uint16_t seq = ntohs(header->seq_number) + 1;
+	uint32_t ts = ntohl(header->timestamp) + 960;
+	memcpy(work.buffer, opus.buffer, RTP_HEADER_SIZE);
+	header->seq_number = htons(seq);
+	header->timestamp = htonl(ts);
+	skew_now += 20000;
+	janus_rtp_header_update(header, &switching, FALSE, 0);
+	return janus_rtp_skew_compensate_audio(header, &switching, skew_now);
+}
+
+static int janus_microbench_rtp_media_info_vp8(void) {
+	janus_rtp_media_info info;
+	janus_rtp_media_info_parse(JANUS_VIDEOCODEC_VP8, vp8.buffer, vp8.length, &info);
+	return info.keyframe + info.vp8_picid;
+}
+
+static int janus_microbench_vp8_is_keyframe(void) {
+	int plen = 0;
+	char *payload = janus_rtp_payload(vp8.buffer, vp8.length, &plen);
+	return janus_vp8_is_keyframe(payload, plen);
+}
+
+static int janus_microbench_vp8_parse_descriptor(void) {
+	int plen = 0;
+	char *payload = janus_rtp_payload(vp8.buffer, vp8.length, &plen);
+	uint16_t picid = 0;
+	uint8_t tl0picidx = 0, tid = 0, y = 0, keyidx = 0;
+	janus_vp8_parse_descriptor(payload, plen, &picid, &tl0picidx, &tid, &y, &keyidx);
+	return picid + tl0picidx + tid;
+}
+
+static int janus_microbench_vp9_is_keyframe(void) {
+	int plen = 0;
+	char *payload = janus_rtp_payload(vp9.buffer, vp9.length, &plen);
+	return janus_vp9_is_keyframe(payload, plen);
+}
+
+static int janus_microbench_vp9_parse_svc(void) {
+	int plen = 0;
+	char *payload = janus_rtp_payload(vp9.buffer, vp9.length, &plen);
+	int found = 0, spatial = 0, temporal = 0;
+	uint8_t p = 0, d = 0, u = 0, b = 0, e = 0;
+	janus_vp9_parse_svc(payload, plen, &found, &spatial, &temporal, &p, &d, &u, &b, &e);
+	return found + spatial + temporal;
+}
+
+static int janus_microbench_h264_is_keyframe(void) {
+	int plen = 0;
+	char *payload = janus_rtp_payload(h264.buffer, h264.length, &plen);
+	return janus_h264_is_keyframe(payload, plen);
+}
+
+static int janus_microbench_rtcp_fix_ssrc(void) {
+	/* The packet is modified, so we work on a copy (see baseline/copy) */
+	memcpy(work.buffer, janus_microbench_rtcp_rr_nack_pli, sizeof(janus_microbench_rtcp_rr_nack_pli));
+	return janus_rtcp_fix_ssrc(&rtcp_ctx, work.buffer, sizeof(janus_microbench_rtcp_rr_nack_pli), 1, 0x01020304, 0x05060708);
+}
+
+static int janus_microbench_rtcp_filter(void) {
+	int newlen = 0;
+	char *filtered = janus_rtcp_filter((char *)janus_microbench_rtcp_rr_nack_pli,
+		sizeof(janus_microbench_rtcp_rr_nack_pli), &newlen);
+	g_free(filtered);
+	return newlen;
+}
+
+static int janus_microbench_rtcp_filter_inplace(void) {
+	memcpy(work.buffer, janus_microbench_rtcp_rr_nack_pli, sizeof(janus_microbench_rtcp_rr_nack_pli));
+	return janus_rtcp_filter_inplace(work.buffer, sizeof(janus_microbench_rtcp_rr_nack_pli));
+}
+
+static int janus_microbench_rtcp_summarize(void) {
+	janus_rtcp_summary summary;
+	janus_rtcp_summarize((char *)janus_microbench_rtcp_rr_nack_pli, sizeof(janus_microbench_rtcp_rr_nack_pli), &summary);
+	return summary.nacks_count + summary.has_pli;
+}
+
+static int janus_microbench_rtcp_lookups(void) {
+	/* The same info as rtcp/summarize, one scan each */
+	char *packet = (char *)janus_microbench_rtcp_rr_nack_pli;
+	int len = sizeof(janus_microbench_rtcp_rr_nack_pli);
+	int result = janus_rtcp_has_pli(packet, len) + janus_rtcp_has_fir(packet, len) +
+		janus_rtcp_get_remb(packet, len) + janus_rtcp_get_sender_ssrc(packet, len);
+	GSList *nacks = janus_rtcp_get_nacks(packet, len);
+	result += g_slist_length(nacks);
+	g_slist_free(nacks);
+	return result;
+}
+
+static int janus_microbench_rtcp_summarize_sr_sdes(void) {
+	janus_rtcp_summary summary;
+	janus_rtcp_summarize((char *)janus_microbench_rtcp_sr_sdes, sizeof(janus_microbench_rtcp_sr_sdes), &summary);
+	return summary.sender_ssrc;
+}
+
+static int janus_microbench_rtcp_summarize_remb(void) {
+	janus_rtcp_summary summary;
+	janus_rtcp_summarize((char *)janus_microbench_rtcp_rr_remb, sizeof(janus_microbench_rtcp_rr_remb), &summary);
+	return summary.remb;
+}
+
+static int janus_microbench_rtcp_summarize_twcc(void) {
+	janus_rtcp_summary summary;
+	janus_rtcp_summarize((char *)janus_microbench_rtcp_twcc, sizeof(janus_microbench_rtcp_twcc), &summary);
+	return summary.count;
+}
+
+static int janus_microbench_rtcp_get_nacks(void) {
+	GSList *nacks = janus_rtcp_get_nacks((char *)janus_microbench_rtcp_rr_nack_pli, sizeof(janus_microbench_rtcp_rr_nack_pli));
+	int count = g_slist_length(nacks);
+	g_slist_free(nacks);
+	return count;
+}
+
+static int janus_microbench_rtcp_nacks(void) {
+	return janus_rtcp_nacks(work.buffer, 120, nack_list);
+}
+
+static int janus_microbench_rtcp_twcc_feedback(void) {
+	return janus_rtcp_transport_wide_cc_feedback(work.buffer, sizeof(work.buffer),
+		0x00000001, 0x721b9407, 5, 300, twcc_timestamps, 100);
+}
+
+static int janus_microbench_sdp_parse(void) {
+	char error[200];
+	janus_sdp *sdp = janus_sdp_parse(janus_microbench_sdp, error, sizeof(error));
+	int result = sdp ? 1 : 0;
+	janus_sdp_destroy(sdp);
+	return result;
+}
+
+static int janus_microbench_sdp_parse_transient(void) {
+	char error[200];
+	janus_sdp *sdp = janus_sdp_parse_transient(janus_microbench_sdp, error, sizeof(error));
+	int result = sdp ? 1 : 0;
+	janus_sdp_destroy(sdp);
+	return result;
+}
+
+static int janus_microbench_sdp_write(void) {
+	char *sdp = janus_sdp_write(parsed_sdp);
+	int result = sdp ? strlen(sdp) : 0;
+	g_free(sdp);
+	return result;
+}
+
+typedef struct janus_microbench {
+	const char *name;
+	int (*run)(void);
+} janus_microbench;
+
+static janus_microbench benchmarks[] = {
+	{ "baseline/copy", janus_microbench_baseline_copy },
+	{ "rtp/ext_info_parse", janus_microbench_rtp_ext_info_parse },
+	{ "rtp/ext_info_audio", janus_microbench_rtp_ext_info_audio },
+	{ "rtp/ext_parse_audio", janus_microbench_rtp_ext_parse_audio },
+	{ "rtp/payload", janus_microbench_rtp_payload },
+	{ "rtp/header_update", janus_microbench_rtp_header_update },
+	{ "rtp/header_update_skew_audio", janus_microbench_rtp_skew_audio },
+	{ "rtp/media_info_vp8", janus_microbench_rtp_media_info_vp8 },
+	{ "utils/vp8_is_keyframe", janus_microbench_vp8_is_keyframe },
+	{ "utils/vp8_parse_descriptor", janus_microbench_vp8_parse_descriptor },
+	{ "utils/vp9_is_keyframe", janus_microbench_vp9_is_keyframe },
+	{ "utils/vp9_parse_svc", janus_microbench_vp9_parse_svc },
+	{ "utils/h264_is_keyframe", janus_microbench_h264_is_keyframe },
+	{ "rtcp/fix_ssrc", janus_microbench_rtcp_fix_ssrc },
+	{ "rtcp/filter", janus_microbench_rtcp_filter },
+	{ "rtcp/filter_inplace", janus_microbench_rtcp_filter_inplace },
+	{ "rtcp/summarize", janus_microbench_rtcp_summarize },
+	{ "rtcp/lookups", janus_microbench_rtcp_lookups },
+	{ "rtcp/summarize_sr_sdes", janus_microbench_rtcp_summarize_sr_sdes },
+	{ "rtcp/summarize_remb", janus_microbench_rtcp_summarize_remb },
+	{ "rtcp/summarize_twcc", janus_microbench_rtcp_summarize_twcc },
+	{ "rtcp/get_nacks", janus_microbench_rtcp_get_nacks },
+	{ "rtcp/nacks", janus_microbench_rtcp_nacks },
+	{ "rtcp/twcc_feedback", janus_microbench_rtcp_twcc_feedback },
+	{ "sdp/parse", janus_microbench_sdp_parse },
+	{ "sdp/parse_transient", janus_microbench_sdp_parse_transient },
+	{ "sdp/write", janus_microbench_sdp_write },
+	{ NULL, NULL }
+};
+
+/* Run a benchmark for (at least) the specified time, and return the ns/op */
+static double janus_microbench_run(janus_microbench *bench, gint64 duration, guint64 *iterations, double *allocs) {
+	guint64 count = 100, i = 0;
+	gint64 elapsed = 0;
+	int result = 0;
+	/* Warm up the caches first */
+	for(i=0; i<count; i++)
+		result += bench->run();
+	while(TRUE) {
+		gint before = g_atomic_int_get(&allocations);
+		gint64 start = janus_microbench_now_ns();
+		for(i=0; i<count; i++)
+			result += bench->run();
+		elapsed = janus_microbench_now_ns() - start;
+		gint after = g_atomic_int_get(&allocations);
+		if(elapsed >= duration || count >= G_MAXUINT32) {
+			*allocs = (double)(after - before)/count;
+			break;
+		}
+		/* Not enough, try again with more iterations */
+		guint64 next = elapsed > 0 ? (guint64)((double)count * duration * 1.2 / elapsed) : count * 100;
+		if(next > count * 100)
+			next = count * 100;
+		count = next > count ? next : count * 2;
+	}
+	sink += result;
+	*iterations = count;
+	return (double)elapsed/count;
+}
+
+
+int main(int argc, char *argv[])
+{
+	janus_log_init(FALSE, TRUE, NULL);
+	atexit(janus_log_destroy);
+
+	/* Check the JANUS_MICROBENCH_DEBUG environment variable for the debugging level */
+	if(g_getenv("JANUS_MICROBENCH_DEBUG") != NULL) {
+		int val = atoi(g_getenv("JANUS_MICROBENCH_DEBUG"));
+		if(val >= LOG_NONE && val <= LOG_MAX)
+			janus_log_level = val;
+	}
+	if(argc > 2) {
+		JANUS_PRINT("Usage: %s [results.json]\n", argv[0]);
+		exit(1);
+	}
+	const char *filter = g_getenv("JANUS_MICROBENCH_FILTER");
+	gint64 duration = 500;
+	if(g_getenv("JANUS_MICROBENCH_TIME") != NULL) {
+		int val = atoi(g_getenv("JANUS_MICROBENCH_TIME"));
+		if(val > 0)
+			duration = val;
+	}
+	duration *= 1000000;
+	JANUS_LOG(LOG_INFO, "Janus version: %d (%s)\n", janus_version, janus_version_string);
+	JANUS_LOG(LOG_INFO, "Janus commit: %s\n", janus_build_git_sha);
+
+	janus_microbench_corpus_prepare();
+	if(parsed_sdp == NULL)
+		exit(1);
+
+	json_t *results = json_object();
+	json_object_set_new(results, "janus_version", json_string(janus_version_string));
+	json_object_set_new(results, "janus_commit", json_string(janus_build_git_sha));
+	json_t *list = json_array();
+	JANUS_PRINT("%-32s %14s %12s %12s\n", "benchmark", "iterations", "ns/op", "allocs/op");
+	janus_microbench *bench = NULL;
+	for(bench = benchmarks; bench->name != NULL; bench++) {
+		if(filter && !strstr(bench->name, filter))
+			continue;
+		guint64 iterations = 0;
+		double allocs = 0;
+		double ns = janus_microbench_run(bench, duration, &iterations, &allocs);
+#ifdef JANUS_MICROBENCH_COUNT_ALLOCATIONS
+		JANUS_PRINT("%-32s %14"SCNu64" %12.1f %12.2f\n", bench->name, iterations, ns, allocs);
+#else
+		JANUS_PRINT("%-32s %14"SCNu64" %12.1f %12s\n", bench->name, iterations, ns, "n/a");
+#endif
+		json_t *r = json_object();
+		json_object_set_new(r, "name", json_string(bench->name));
+		json_object_set_new(r, "iterations", json_integer(iterations));
+		json_object_set_new(r, "ns_per_op", json_real(ns));
+#ifdef JANUS_MICROBENCH_COUNT_ALLOCATIONS
+		json_object_set_new(r, "allocs_per_op", json_real(allocs));
+#endif
+		json_array_append_new(list, r);
+	}
+	json_object_set_new(results, "benchmarks", list);
+	int res = 0;
+	if(argc == 2) {
+		if(json_dump_file(results, argv[1], JSON_INDENT(3) | JSON_PRESERVE_ORDER) < 0) {
+			JANUS_LOG(LOG_ERR, "Error saving results to %s\n", argv[1]);
+			res = 1;
+		} else {
+			JANUS_LOG(LOG_INFO, "Results saved to %s\n", argv[1]);
+		}
+	}
+	json_decref(results);
+	janus_microbench_corpus_destroy();
+
+	return res;
+}
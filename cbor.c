@@ -0,0 +1,440 @@
+/*! \file    cbor.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    CBOR encoding of Janus API messages
+ * \details  Minimal implementation of CBOR (RFC 8949), used by the
+ * transports that allow clients to use a binary encoding for the Janus
+ * API instead of JSON text. Messages are converted from and to the same
+ * jansson model the core uses, so nothing changes for the core or the
+ * plugins: only the data types JSON supports are handled (byte strings,
+ * for instance, are rejected), and tags are ignored.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "cbor.h"
+
+/* CBOR major types */
+#define JANUS_CBOR_UINT		0
+#define JANUS_CBOR_NEGINT	1
+#define JANUS_CBOR_BYTES	2
+#define JANUS_CBOR_TEXT		3
+#define JANUS_CBOR_ARRAY	4
+#define JANUS_CBOR_MAP		5
+#define JANUS_CBOR_TAG		6
+#define JANUS_CBOR_SIMPLE	7
+/* Additional info for indefinite lengths, and the "break" byte that ends them */
+#define JANUS_CBOR_INDEFINITE	31
+#define JANUS_CBOR_BREAK		0xFF
+/* Janus API messages are never this nested: deeper payloads are rejected */
+#define JANUS_CBOR_MAX_DEPTH	64
+
+gboolean janus_cbor_is_cbor(const char *data, size_t len) {
+	if(data == NULL || len == 0)
+		return FALSE;
+	return ((unsigned char)data[0] >> 5) == JANUS_CBOR_MAP;
+}
+
+
+/* Encoder */
+typedef struct janus_cbor_buffer {
+	char *data;
+	size_t len, size;
+	gboolean failed;
+} janus_cbor_buffer;
+
+static gboolean janus_cbor_reserve(janus_cbor_buffer *buf, size_t len) {
+	if(buf->failed)
+		return FALSE;
+	if(buf->len + len <= buf->size)
+		return TRUE;
+	size_t size = buf->size;
+	while(size < buf->len + len)
+		size *= 2;
+	char *data = realloc(buf->data, size);
+	if(data == NULL) {
+		buf->failed = TRUE;
+		return FALSE;
+	}
+	buf->data = data;
+	buf->size = size;
+	return TRUE;
+}
+
+static void janus_cbor_put_head(janus_cbor_buffer *buf, uint8_t major, uint64_t value) {
+	if(!janus_cbor_reserve(buf, 9))
+		return;
+	unsigned char *p = (unsigned char *)buf->data + buf->len;
+	major <<= 5;
+	if(value < 24) {
+		p[0] = major | value;
+		buf->len += 1;
+	} else if(value <= 0xFF) {
+		p[0] = major | 24;
+		p[1] = value;
+		buf->len += 2;
+	} else if(value <= 0xFFFF) {
+		p[0] = major | 25;
+		p[1] = value >> 8;
+		p[2] = value;
+		buf->len += 3;
+	} else if(value <= 0xFFFFFFFF) {
+		p[0] = major | 26;
+		int i = 0;
+		for(i=0; i<4; i++)
+			p[1+i] = value >> (8*(3-i));
+		buf->len += 5;
+	} else {
+		p[0] = major | 27;
+		int i = 0;
+		for(i=0; i<8; i++)
+			p[1+i] = value >> (8*(7-i));
+		buf->len += 9;
+	}
+}
+
+static void janus_cbor_put_text(janus_cbor_buffer *buf, const char *text, size_t len) {
+	janus_cbor_put_head(buf, JANUS_CBOR_TEXT, len);
+	if(!janus_cbor_reserve(buf, len))
+		return;
+	memcpy(buf->data + buf->len, text, len);
+	buf->len += len;
+}
+
+static void janus_cbor_put_real(janus_cbor_buffer *buf, double value) {
+	if(!janus_cbor_reserve(buf, 9))
+		return;
+	unsigned char *p = (unsigned char *)buf->data + buf->len;
+	float single = (float)value;
+	int i = 0;
+	if((double)single == value) {
+		/* No precision lost, use a single precision float */
+		uint32_t bits = 0;
+		memcpy(&bits, &single, sizeof(bits));
+		p[0] = (JANUS_CBOR_SIMPLE << 5) | 26;
+		for(i=0; i<4; i++)
+			p[1+i] = bits >> (8*(3-i));
+		buf->len += 5;
+	} else {
+		uint64_t bits = 0;
+		memcpy(&bits, &value, sizeof(bits));
+		p[0] = (JANUS_CBOR_SIMPLE << 5) | 27;
+		for(i=0; i<8; i++)
+			p[1+i] = bits >> (8*(7-i));
+		buf->len += 9;
+	}
+}
+
+static void janus_cbor_put(janus_cbor_buffer *buf, json_t *json) {
+	if(buf->failed)
+		return;
+	switch(json_typeof(json)) {
+		case JSON_OBJECT: {
+			janus_cbor_put_head(buf, JANUS_CBOR_MAP, json_object_size(json));
+			const char *key = NULL;
+			json_t *value = NULL;
+			json_object_foreach(json, key, value) {
+				janus_cbor_put_text(buf, key, strlen(key));
+				janus_cbor_put(buf, value);
+			}
+			break;
+		}
+		case JSON_ARRAY: {
+			size_t i = 0, size = json_array_size(json);
+			janus_cbor_put_head(buf, JANUS_CBOR_ARRAY, size);
+			for(i=0; i<size; i++)
+				janus_cbor_put(buf, json_array_get(json, i));
+			break;
+		}
+		case JSON_STRING: {
+			const char *text = json_string_value(json);
+			janus_cbor_put_text(buf, text, strlen(text));
+			break;
+		}
+		case JSON_INTEGER: {
+			json_int_t value = json_integer_value(json);
+			if(value >= 0)
+				janus_cbor_put_head(buf, JANUS_CBOR_UINT, (uint64_t)value);
+			else
+				janus_cbor_put_head(buf, JANUS_CBOR_NEGINT, (uint64_t)(-1 - value));
+			break;
+		}
+		case JSON_REAL:
+			janus_cbor_put_real(buf, json_real_value(json));
+			break;
+		case JSON_TRUE:
+			janus_cbor_put_head(buf, JANUS_CBOR_SIMPLE, 21);
+			break;
+		case JSON_FALSE:
+			janus_cbor_put_head(buf, JANUS_CBOR_SIMPLE, 20);
+			break;
+		case JSON_NULL:
+		default:
+			janus_cbor_put_head(buf, JANUS_CBOR_SIMPLE, 22);
+			break;
+	}
+}
+
+char *janus_cbor_dumps(json_t *json, size_t headroom, size_t *len) {
+	if(json == NULL || len == NULL)
+		return NULL;
+	janus_cbor_buffer buf = { .data = NULL, .len = headroom, .size = 256, .failed = FALSE };
+	while(buf.size < headroom + 64)
+		buf.size *= 2;
+	buf.data = malloc(buf.size);
+	if(buf.data == NULL)
+		return NULL;
+	janus_cbor_put(&buf, json);
+	if(buf.failed) {
+		free(buf.data);
+		return NULL;
+	}
+	*len = buf.len - headroom;
+	return buf.data;
+}
+
+
+/* Decoder */
+typedef struct janus_cbor_parser {
+	const unsigned char *data;
+	size_t len, offset;
+	json_error_t *error;
+} janus_cbor_parser;
+
+static void janus_cbor_error(janus_cbor_parser *parser, const char *reason) {
+	if(parser->error == NULL || parser->error->text[0] != '\0')
+		return;
+	parser->error->line = -1;
+	parser->error->column = -1;
+	parser->error->position = parser->offset;
+	g_snprintf(parser->error->source, JSON_ERROR_SOURCE_LENGTH, "<cbor>");
+	g_snprintf(parser->error->text, JSON_ERROR_TEXT_LENGTH, "CBOR error at byte %zu: %s", parser->offset, reason);
+}
+
+/* Read the initial byte of an item and its argument */
+static int janus_cbor_get_head(janus_cbor_parser *parser, uint8_t *major, uint8_t *info, uint64_t *value) {
+	if(parser->offset >= parser->len) {
+		janus_cbor_error(parser, "unexpected end of data");
+		return -1;
+	}
+	uint8_t byte = parser->data[parser->offset++];
+	*major = byte >> 5;
+	*info = byte & 0x1F;
+	*value = 0;
+	size_t size = 0;
+	if(*info < 24) {
+		*value = *info;
+		return 0;
+	} else if(*info == 24) {
+		size = 1;
+	} else if(*info == 25) {
+		size = 2;
+	} else if(*info == 26) {
+		size = 4;
+	} else if(*info == 27) {
+		size = 8;
+	} else if(*info == JANUS_CBOR_INDEFINITE) {
+		return 0;
+	} else {
+		janus_cbor_error(parser, "invalid additional information");
+		return -1;
+	}
+	if(parser->len - parser->offset < size) {
+		janus_cbor_error(parser, "unexpected end of data");
+		return -1;
+	}
+	size_t i = 0;
+	for(i=0; i<size; i++)
+		*value = (*value << 8) | parser->data[parser->offset++];
+	return 0;
+}
+
+static gboolean janus_cbor_is_break(janus_cbor_parser *parser) {
+	if(parser->offset < parser->len && parser->data[parser->offset] == JANUS_CBOR_BREAK) {
+		parser->offset++;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/* Read a text string (possibly in chunks) as a new NULL-terminated string */
+static char *janus_cbor_get_text(janus_cbor_parser *parser, uint8_t info, uint64_t value) {
+	if(info != JANUS_CBOR_INDEFINITE) {
+		if((uint64_t)(parser->len - parser->offset) < value) {
+			janus_cbor_error(parser, "unexpected end of data");
+			return NULL;
+		}
+		char *text = g_malloc(value+1);
+		memcpy(text, parser->data + parser->offset, value);
+		text[value] = '\0';
+		parser->offset += value;
+		return text;
+	}
+	GString *text = g_string_new(NULL);
+	while(!janus_cbor_is_break(parser)) {
+		uint8_t major = 0;
+		if(janus_cbor_get_head(parser, &major, &info, &value) < 0) {
+			g_string_free(text, TRUE);
+			return NULL;
+		}
+		if(major != JANUS_CBOR_TEXT || info == JANUS_CBOR_INDEFINITE ||
+				(uint64_t)(parser->len - parser->offset) < value) {
+			janus_cbor_error(parser, "invalid text string chunk");
+			g_string_free(text, TRUE);
+			return NULL;
+		}
+		g_string_append_len(text, (const char *)parser->data + parser->offset, value);
+		parser->offset += value;
+	}
+	return g_string_free(text, FALSE);
+}
+
+static double janus_cbor_half(uint16_t half) {
+	int exponent = (half >> 10) & 0x1F, mantissa = half & 0x3FF;
+	double value = 0.0;
+	if(exponent == 0)
+		value = mantissa / 16777216.0;		/* mantissa * 2^-24 */
+	else if(exponent != 31)
+		value = (mantissa + 1024) * (double)(1 << exponent) / 33554432.0;	/* * 2^(exponent-25) */
+	else
+		value = mantissa == 0 ? INFINITY : NAN;
+	return (half & 0x8000) ? -value : value;
+}
+
+static json_t *janus_cbor_get(janus_cbor_parser *parser, int depth) {
+	if(depth > JANUS_CBOR_MAX_DEPTH) {
+		janus_cbor_error(parser, "too many nested items");
+		return NULL;
+	}
+	uint8_t major = 0, info = 0;
+	uint64_t value = 0;
+	if(janus_cbor_get_head(parser, &major, &info, &value) < 0)
+		return NULL;
+	/* Tags don't mean anything to us, just get the item they refer to */
+	while(major == JANUS_CBOR_TAG) {
+		if(info == JANUS_CBOR_INDEFINITE || janus_cbor_get_head(parser, &major, &info, &value) < 0) {
+			janus_cbor_error(parser, "invalid tag");
+			return NULL;
+		}
+	}
+	if(info == JANUS_CBOR_INDEFINITE && major != JANUS_CBOR_TEXT &&
+			major != JANUS_CBOR_ARRAY && major != JANUS_CBOR_MAP) {
+		janus_cbor_error(parser, "unexpected indefinite length or break");
+		return NULL;
+	}
+	switch(major) {
+		case JANUS_CBOR_UINT:
+			if(value > (uint64_t)JSON_INTEGER_MAX)
+				return json_real((double)value);
+			return json_integer((json_int_t)value);
+		case JANUS_CBOR_NEGINT:
+			if(value > (uint64_t)JSON_INTEGER_MAX)
+				return json_real(-1.0 - (double)value);
+			return json_integer(-1 - (json_int_t)value);
+		case JANUS_CBOR_TEXT: {
+			char *text = janus_cbor_get_text(parser, info, value);
+			if(text == NULL)
+				return NULL;
+			json_t *string = json_string(text);
+			g_free(text);
+			if(string == NULL)
+				janus_cbor_error(parser, "invalid UTF-8 string");
+			return string;
+		}
+		case JANUS_CBOR_ARRAY: {
+			json_t *array = json_array();
+			uint64_t i = 0;
+			for(i=0; info == JANUS_CBOR_INDEFINITE || i < value; i++) {
+				if(info == JANUS_CBOR_INDEFINITE && janus_cbor_is_break(parser))
+					break;
+				json_t *item = janus_cbor_get(parser, depth+1);
+				if(item == NULL) {
+					json_decref(array);
+					return NULL;
+				}
+				json_array_append_new(array, item);
+			}
+			return array;
+		}
+		case JANUS_CBOR_MAP: {
+			json_t *object = json_object();
+			uint64_t i = 0;
+			for(i=0; info == JANUS_CBOR_INDEFINITE || i < value; i++) {
+				if(info == JANUS_CBOR_INDEFINITE && janus_cbor_is_break(parser))
+					break;
+				uint8_t kmajor = 0, kinfo = 0;
+				uint64_t kvalue = 0;
+				if(janus_cbor_get_head(parser, &kmajor, &kinfo, &kvalue) < 0) {
+					json_decref(object);
+					return NULL;
+				}
+				if(kmajor != JANUS_CBOR_TEXT) {
+					janus_cbor_error(parser, "map keys must be text strings");
+					json_decref(object);
+					return NULL;
+				}
+				char *key = janus_cbor_get_text(parser, kinfo, kvalue);
+				json_t *item = key ? janus_cbor_get(parser, depth+1) : NULL;
+				if(item == NULL || json_object_set_new(object, key, item) < 0) {
+					janus_cbor_error(parser, "invalid map key");
+					g_free(key);
+					json_decref(object);
+					return NULL;
+				}
+				g_free(key);
+			}
+			return object;
+		}
+		case JANUS_CBOR_SIMPLE: {
+			if(info == 20)
+				return json_false();
+			if(info == 21)
+				return json_true();
+			if(info == 22 || info == 23)
+				return json_null();
+			if(info == 25)
+				return json_real(janus_cbor_half(value));
+			if(info == 26) {
+				uint32_t bits = value;
+				float single = 0;
+				memcpy(&single, &bits, sizeof(single));
+				return json_real(single);
+			}
+			if(info == 27) {
+				double real = 0;
+				memcpy(&real, &value, sizeof(real));
+				return json_real(real);
+			}
+			janus_cbor_error(parser, "unsupported simple value");
+			return NULL;
+		}
+		case JANUS_CBOR_BYTES:
+		default:
+			janus_cbor_error(parser, "byte strings are not supported");
+			return NULL;
+	}
+}
+
+json_t *janus_cbor_loadb(const char *data, size_t len, json_error_t *error) {
+	if(error != NULL)
+		memset(error, 0, sizeof(*error));
+	janus_cbor_parser parser = {
+		.data = (const unsigned char *)data,
+		.len = data ? len : 0,
+		.offset = 0,
+		.error = error
+	};
+	json_t *root = janus_cbor_get(&parser, 0);
+	if(root != NULL && parser.offset < parser.len) {
+		janus_cbor_error(&parser, "end of data expected");
+		json_decref(root);
+		root = NULL;
+	}
+	return root;
+}
@@ -0,0 +1,50 @@
+/*! \file    cbor.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    CBOR encoding of Janus API messages (headers)
+ * \details  Minimal implementation of CBOR (RFC 8949), used by the
+ * transports that allow clients to use a binary encoding for the Janus
+ * API instead of JSON text. Messages are converted from and to the same
+ * jansson model the core uses, so nothing changes for the core or the
+ * plugins: only the data types JSON supports are handled (byte strings,
+ * for instance, are rejected), and tags are ignored.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef _JANUS_CBOR_H
+#define _JANUS_CBOR_H
+
+#include <stddef.h>
+#include <glib.h>
+#include <jansson.h>
+
+/*! \brief Check whether a payload looks like CBOR rather than JSON text
+ * \note This works because the Janus API always uses objects, and a CBOR
+ * map can never start with a byte that's valid at the start of JSON text
+ * @param[in] data The payload to check
+ * @param[in] len The size of the payload
+ * @returns TRUE if the payload is a CBOR map, FALSE otherwise */
+gboolean janus_cbor_is_cbor(const char *data, size_t len);
+
+/*! \brief Encode a jansson object as CBOR
+ * \note The buffer is allocated with malloc, just as json_dumps does, and
+ * so must be freed with free. Transports that need some room for their
+ * own framing before the payload can ask for it with \c headroom
+ * @param[in] json The object to encode
+ * @param[in] headroom How many bytes to leave empty at the start of the buffer
+ * @param[out] len The size of the encoded payload (headroom excluded)
+ * @returns A buffer with the encoded payload, or NULL in case of errors */
+char *janus_cbor_dumps(json_t *json, size_t headroom, size_t *len);
+
+/*! \brief Decode a CBOR payload into a jansson object
+ * \note In case of errors, \c error is filled just as json_loadb would do,
+ * with the position of the offending byte
+ * @param[in] data The payload to decode
+ * @param[in] len The size of the payload
+ * @param[out] error Where to store information on the error, if any
+ * @returns A new reference to the decoded object, or NULL in case of errors */
+json_t *janus_cbor_loadb(const char *data, size_t len, json_error_t *error);
+
+#endif
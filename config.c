@@ -66,6 +66,8 @@ static void janus_config_free_category(gpointer data) {
 	janus_config_category *c = (janus_config_category *)data;
 	if(c) {
 		g_free((gpointer)c->name);
+		if(c->items_table)
+			g_hash_table_destroy(c->items_table);
 		if(c->items)
 			g_list_free_full(c->items, janus_config_free_item);
 		g_free(c);
@@ -73,6 +75,55 @@ static void janus_config_free_category(gpointer data) {
 }
 
 
+/* Lookup helpers: categories and items are indexed in hash tables by their
+ * lowercase name, so that lookups (which are case insensitive) don't need
+ * to traverse the lists, which can get huge (e.g., thousands of rooms) */
+static GHashTable *janus_config_table_new(void) {
+	return g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, NULL);
+}
+
+static void janus_config_table_insert(GHashTable *table, const char *name, gpointer data) {
+	g_hash_table_insert(table, g_ascii_strdown(name, -1), data);
+}
+
+static gpointer janus_config_table_lookup(GHashTable *table, const char *name) {
+	if(table == NULL || name == NULL)
+		return NULL;
+	char *key = g_ascii_strdown(name, -1);
+	gpointer data = g_hash_table_lookup(table, key);
+	g_free(key);
+	return data;
+}
+
+static void janus_config_table_remove(GHashTable *table, const char *name) {
+	if(table == NULL || name == NULL)
+		return;
+	char *key = g_ascii_strdown(name, -1);
+	g_hash_table_remove(table, key);
+	g_free(key);
+}
+
+/* List helpers: we keep track of the last link of the lists, so that appending
+ * doesn't need to traverse them either (g_list_append does) */
+static void janus_config_list_append(GList **list, GList **last, gpointer data) {
+	GList *link = g_list_alloc();
+	link->data = data;
+	link->prev = *last;
+	link->next = NULL;
+	if(*last)
+		(*last)->next = link;
+	else
+		*list = link;
+	*last = link;
+}
+
+static void janus_config_list_remove(GList **list, GList **last, gpointer data) {
+	if(*last && (*last)->data == data)
+		*last = (*last)->prev;
+	*list = g_list_remove(*list, data);
+}
+
+
 /* Public methods */
 janus_config *janus_config_parse(const char *config_file) {
 	if(config_file == NULL)
@@ -91,6 +142,7 @@ janus_config *janus_config_parse(const char *config_file) {
 	/* Create configuration instance */
 	janus_config *jc = g_malloc0(sizeof(janus_config));
 	jc->name = g_strdup(filename);
+	jc->categories_table = janus_config_table_new();
 	/* Traverse and parse it */
 	int line_number = 0;
 	char line_buffer[BUFSIZ];
@@ -188,6 +240,7 @@ janus_config *janus_config_create(const char *name) {
 	if(name != NULL) {
 		jc->name = g_strdup(name);
 	}
+	jc->categories_table = janus_config_table_new();
 	return jc;
 }
 
@@ -202,14 +255,7 @@ janus_config_category *janus_config_get_category(janus_config *config, const cha
 		return NULL;
 	if(config->categories == NULL)
 		return NULL;
-	GList *l = config->categories;
-	while(l) {
-		janus_config_category *c = (janus_config_category *)l->data;
-		if(c && c->name && !strcasecmp(name, c->name))
-			return c;
-		l = l->next;
-	}
-	return NULL;
+	return (janus_config_category *)janus_config_table_lookup(config->categories_table, name);
 }
 
 GList *janus_config_get_items(janus_config_category *category) {
@@ -223,14 +269,7 @@ janus_config_item *janus_config_get_item(janus_config_category *category, const
 		return NULL;
 	if(category->items == NULL)
 		return NULL;
-	GList *l = category->items;
-	while(l) {
-		janus_config_item *i = (janus_config_item *)l->data;
-		if(i && i->name && !strcasecmp(name, i->name))
-			return i;
-		l = l->next;
-	}
-	return NULL;
+	return (janus_config_item *)janus_config_table_lookup(category->items_table, name);
 }
 
 janus_config_item *janus_config_get_item_drilldown(janus_config *config, const char *category, const char *name) {
@@ -252,7 +291,11 @@ janus_config_category *janus_config_add_category(janus_config *config, const cha
 	}
 	c = g_malloc0(sizeof(janus_config_category));
 	c->name = g_strdup(category);
-	config->categories = g_list_append(config->categories, c);
+	c->items_table = janus_config_table_new();
+	if(config->categories_table == NULL)
+		config->categories_table = janus_config_table_new();
+	janus_config_table_insert(config->categories_table, c->name, c);
+	janus_config_list_append(&config->categories, &config->categories_last, c);
 	return c;
 }
 
@@ -261,7 +304,8 @@ int janus_config_remove_category(janus_config *config, const char *category) {
 		return -1;
 	janus_config_category *c = janus_config_get_category(config, category);
 	if(c) {
-		config->categories = g_list_remove(config->categories, c);
+		janus_config_table_remove(config->categories_table, c->name);
+		janus_config_list_remove(&config->categories, &config->categories_last, c);
 		janus_config_free_category(c);
 		return 0;
 	}
@@ -286,7 +330,8 @@ janus_config_item *janus_config_add_item(janus_config *config, const char *categ
 		item->value = g_strdup(value);
 		if(c != NULL) {
 			/* Add to category */
-			c->items = g_list_append(c->items, item);
+			janus_config_table_insert(c->items_table, item->name, item);
+			janus_config_list_append(&c->items, &c->items_last, item);
 		} else {
 			/* Uncategorized item */
 			config->items = g_list_append(config->items, item);
@@ -309,7 +354,8 @@ int janus_config_remove_item(janus_config *config, const char *category, const c
 	janus_config_item *item = janus_config_get_item(c, name);
 	if(item == NULL)
 		return -3;
-	c->items = g_list_remove(c->items, item);
+	janus_config_table_remove(c->items_table, item->name);
+	janus_config_list_remove(&c->items, &c->items_last, item);
 	janus_config_free_item(item);
 	return 0;
 }
@@ -433,9 +479,14 @@ void janus_config_destroy(janus_config *config) {
 		g_list_free_full(config->items, janus_config_free_item);
 		config->items = NULL;
 	}
+	if(config->categories_table) {
+		g_hash_table_destroy(config->categories_table);
+		config->categories_table = NULL;
+	}
 	if(config->categories) {
 		g_list_free_full(config->categories, janus_config_free_category);
 		config->categories = NULL;
+		config->categories_last = NULL;
 	}
 	g_free((gpointer)config->name);
 	g_free((gpointer)config);
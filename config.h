@@ -27,6 +27,10 @@ typedef struct janus_config_category {
 	const char *name;
 	/*! \brief Linked list of items */
 	GList *items;
+	/*! \brief Last item in the list, to append new items quickly */
+	GList *items_last;
+	/*! \brief Items indexed by (lowercase) name, for quick lookups */
+	GHashTable *items_table;
 } janus_config_category;
 
 /*! \brief Configuration container */
@@ -37,6 +41,10 @@ typedef struct janus_config {
 	GList *items;
 	/*! \brief Linked list of categories category */
 	GList *categories;
+	/*! \brief Last category in the list, to append new categories quickly */
+	GList *categories_last;
+	/*! \brief Categories indexed by (lowercase) name, for quick lookups */
+	GHashTable *categories_table;
 } janus_config;
 
 
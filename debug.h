@@ -108,6 +108,38 @@ do { \
 			##__VA_ARGS__); \
 	} \
 } while (0)
+
+/*! \brief Same as JANUS_LOG, but the line is only formatted by the log thread
+ * \note Only meant for hot paths: all the arguments must be integers (or
+ * pointers cast to guintptr), as they're stored as such, and no more than
+ * JANUS_LOG_DEFERRED_MAX_ARGS */
+#define JANUS_LOG_DEFERRED(level, format, ...) \
+do { \
+	if (level > LOG_NONE && level <= LOG_MAX && level <= janus_log_level) { \
+		guint64 janus_log_args[] = { 0, ##__VA_ARGS__ }; \
+		G_STATIC_ASSERT(G_N_ELEMENTS(janus_log_args) <= JANUS_LOG_DEFERRED_MAX_ARGS + 1); \
+		janus_log_deferred(level, __FILE__, __FUNCTION__, __LINE__, format, \
+			janus_log_args + 1, G_N_ELEMENTS(janus_log_args) - 1); \
+	} \
+} while (0)
+
+/*! \brief Same as JANUS_LOG, but the call site logs at most one line
+ * every JANUS_LOG_RATELIMIT_INTERVAL: how many lines were suppressed in
+ * the meanwhile is logged with the next one. Useful for errors that may
+ * be triggered by each packet, and would flood the log otherwise */
+#define JANUS_LOG_RATELIMITED(level, format, ...) \
+do { \
+	if (level > LOG_NONE && level <= LOG_MAX && level <= janus_log_level) { \
+		static volatile gint64 janus_log_rl_next = 0; \
+		static volatile gint janus_log_rl_suppressed = 0; \
+		int janus_log_rl = janus_log_ratelimit(&janus_log_rl_next, &janus_log_rl_suppressed); \
+		if (janus_log_rl >= 0) { \
+			JANUS_LOG(level, format, ##__VA_ARGS__); \
+			if (janus_log_rl > 0) \
+				JANUS_LOG(level, "  -- (%d similar lines suppressed)\n", janus_log_rl); \
+		} \
+	} \
+} while (0)
 ///@}
 
 #endif
@@ -11,6 +11,7 @@
  * \ref protocols
  */
 
+#include <string.h>
 #include <glib.h>
 
 #include "dtls-bio.h"
@@ -25,9 +26,16 @@ void janus_dtls_bio_filter_set_mtu(int start_mtu) {
 		JANUS_LOG(LOG_ERR, "Invalid MTU...\n");
 		return;
 	}
+	if(start_mtu > JANUS_DTLS_BIO_BUFFER) {
+		JANUS_LOG(LOG_WARN, "MTU too large (%d), using %d instead\n", start_mtu, JANUS_DTLS_BIO_BUFFER);
+		start_mtu = JANUS_DTLS_BIO_BUFFER;
+	}
 	mtu = start_mtu;
 	JANUS_LOG(LOG_VERB, "Setting starting MTU in the DTLS BIO filter: %d\n", mtu);
 }
+int janus_dtls_bio_filter_get_mtu(void) {
+	return mtu;
+}
 
 /* Filter implementation */
 int janus_dtls_bio_filter_write(BIO *h, const char *buf,int num);
@@ -78,8 +86,57 @@ BIO_METHOD *BIO_janus_dtls_filter(void) {
 typedef struct janus_dtls_bio_filter {
 	GList *packets;
 	janus_mutex mutex;
+	/* If set, where to send datagrams to directly, rather than queueing them in the next BIO */
+	janus_dtls_bio_filter_sink sink;
+	void *sink_data;
+	/* Datagram we're coalescing records in, when corked */
+	gboolean corked;
+	char *buffer;
+	int buffered;
+	/* Whether we already warned about records larger than the MTU */
+	gboolean warned;
 } janus_dtls_bio_filter;
 
+static janus_dtls_bio_filter *janus_dtls_bio_filter_get(BIO *bio) {
+	if(bio == NULL)
+		return NULL;
+#if JANUS_USE_OPENSSL_PRE_1_1_API
+	return (janus_dtls_bio_filter *)bio->ptr;
+#else
+	return (janus_dtls_bio_filter *)BIO_get_data(bio);
+#endif
+}
+
+void janus_dtls_bio_filter_set_sink(BIO *bio, janus_dtls_bio_filter_sink sink, void *data) {
+	janus_dtls_bio_filter *filter = janus_dtls_bio_filter_get(bio);
+	if(filter == NULL)
+		return;
+	filter->sink = sink;
+	filter->sink_data = data;
+	if(sink != NULL && filter->buffer == NULL)
+		filter->buffer = g_malloc(JANUS_DTLS_BIO_BUFFER);
+}
+
+void janus_dtls_bio_filter_cork(BIO *bio) {
+	janus_dtls_bio_filter *filter = janus_dtls_bio_filter_get(bio);
+	if(filter == NULL || filter->sink == NULL)
+		return;
+	filter->corked = TRUE;
+}
+
+int janus_dtls_bio_filter_flush(BIO *bio) {
+	janus_dtls_bio_filter *filter = janus_dtls_bio_filter_get(bio);
+	if(filter == NULL)
+		return 0;
+	filter->corked = FALSE;
+	if(filter->sink == NULL || filter->buffered == 0)
+		return 0;
+	int len = filter->buffered;
+	filter->buffered = 0;
+	filter->sink(filter->sink_data, filter->buffer, len);
+	return len;
+}
+
 
 int janus_dtls_bio_filter_new(BIO *bio) {
 	/* Create a filter state struct */
@@ -113,6 +170,7 @@ int janus_dtls_bio_filter_free(BIO *bio) {
 	if(filter != NULL) {
 		g_list_free(filter->packets);
 		filter->packets = NULL;
+		g_free(filter->buffer);
 		g_free(filter);
 	}
 #if JANUS_USE_OPENSSL_PRE_1_1_API
@@ -134,6 +192,29 @@ int janus_dtls_bio_filter_write(BIO *bio, const char *in, int inl) {
 		JANUS_LOG(LOG_WARN, "janus_dtls_bio_filter_write failed: negative size (%d)\n", inl);
 		return inl;
 	}
+	janus_dtls_bio_filter *filter = janus_dtls_bio_filter_get(bio);
+	if(filter != NULL && filter->sink != NULL) {
+		/* Each write is a datagram: send it right away from the DTLS stack buffer,
+		 * unless we're corked and it fits in the datagram we're coalescing records in */
+		if(inl > mtu && !filter->warned) {
+			JANUS_LOG(LOG_WARN, "The DTLS stack is trying to send a packet of %d bytes, this may be larger than the MTU and get dropped!\n", inl);
+			filter->warned = TRUE;
+		}
+		if(filter->corked && filter->buffered > 0 && filter->buffered + inl > mtu) {
+			/* No room for this record, send what we have first */
+			int len = filter->buffered;
+			filter->buffered = 0;
+			filter->sink(filter->sink_data, filter->buffer, len);
+		}
+		if(filter->corked && filter->buffered + inl <= mtu) {
+			memcpy(filter->buffer + filter->buffered, in, inl);
+			filter->buffered += inl;
+			return inl;
+		}
+		filter->sink(filter->sink_data, (char *)in, inl);
+		/* Datagrams that couldn't be sent are like packets lost on the network */
+		return inl;
+	}
 #if JANUS_USE_OPENSSL_PRE_1_1_API
 	long ret = BIO_write(bio->next_bio, in, inl);
 #else
@@ -142,11 +223,6 @@ int janus_dtls_bio_filter_write(BIO *bio, const char *in, int inl) {
 	JANUS_LOG(LOG_HUGE, "  -- %ld\n", ret);
 	
 	/* Keep track of the packet, as we'll advertize them one by one after a pending check */
-#if JANUS_USE_OPENSSL_PRE_1_1_API
-	janus_dtls_bio_filter *filter = (janus_dtls_bio_filter *)bio->ptr;
-#else
-	janus_dtls_bio_filter *filter = (janus_dtls_bio_filter *)BIO_get_data(bio);
-#endif
 	if(filter != NULL) {
 		janus_mutex_lock(&filter->mutex);
 		filter->packets = g_list_append(filter->packets, GINT_TO_POINTER(ret));
@@ -34,6 +34,40 @@ BIO_METHOD *BIO_janus_dtls_filter(void);
  */
 void janus_dtls_bio_filter_set_mtu(int start_mtu);
 
+/*! \brief Get the MTU currently configured for the BIO filter
+ * @returns The MTU */
+int janus_dtls_bio_filter_get_mtu(void);
+
+/*! \brief Size of the buffer the BIO filter coalesces records in (and so maximum MTU) */
+#define JANUS_DTLS_BIO_BUFFER	1500
+/*! \brief Worst case overhead of a DTLS record (header, explicit IV, MAC and padding with CBC ciphers) */
+#define JANUS_DTLS_RECORD_OVERHEAD	65
+
+/*! \brief Callback the BIO filter can use to send datagrams directly
+ * @param data Opaque pointer passed to janus_dtls_bio_filter_set_sink
+ * @param buf The datagram to send
+ * @param len The size of the datagram
+ * @returns The number of bytes sent, or a negative integer on errors */
+typedef int (*janus_dtls_bio_filter_sink)(void *data, char *buf, int len);
+/*! \brief Have the BIO filter send datagrams directly via a callback
+ * \note By default, the filter writes all DTLS records to the next BIO in the
+ * chain, and advertizes them one by one via BIO_ctrl_pending so that they
+ * can be read and sent: with a sink, datagrams are sent straight from the
+ * buffer of the DTLS stack instead, without any intermediate copy
+ * @param bio The BIO filter to configure
+ * @param sink The callback to send datagrams with (NULL to go back to the default behaviour)
+ * @param data Opaque pointer to pass to the callback */
+void janus_dtls_bio_filter_set_sink(BIO *bio, janus_dtls_bio_filter_sink sink, void *data);
+/*! \brief Start coalescing DTLS records in a single datagram, up to the MTU
+ * \note Only works when a sink is configured: records are actually sent
+ * either when no more fit in the datagram, or when janus_dtls_bio_filter_flush is called
+ * @param bio The BIO filter to cork */
+void janus_dtls_bio_filter_cork(BIO *bio);
+/*! \brief Send the datagram the BIO filter was coalescing records in, if any, and stop coalescing
+ * @param bio The BIO filter to flush
+ * @returns The size of the datagram that was sent, if any */
+int janus_dtls_bio_filter_flush(BIO *bio);
+
 #if defined(LIBRESSL_VERSION_NUMBER)
 #define JANUS_USE_OPENSSL_PRE_1_1_API (1)
 #else
@@ -73,9 +73,56 @@ const gchar *janus_get_dtls_srtp_profile(int profile) {
 	return NULL;
 }
 
+/* DTLS workers: when enabled, the handshake of each DTLS stack is performed
+ * by a thread pool rather than by the loop of the handle. Operations on the
+ * same stack are serialized (each stack has its own queue, and only one
+ * worker at a time takes care of it), and once the handshake is over and
+ * nothing is pending anymore, everything is done on the handle loop again */
+#define JANUS_DTLS_WORKERS_QUEUE	1000
+static GThreadPool *janus_dtls_workers = NULL;
+static int janus_dtls_workers_count = 0, janus_dtls_workers_max_queue = JANUS_DTLS_WORKERS_QUEUE;
+static volatile gint janus_dtls_queued = 0, janus_dtls_queued_max = 0, janus_dtls_dropped = 0;
+static volatile gint janus_dtls_handshakes = 0, janus_dtls_handshakes_failed = 0;
+static janus_histogram janus_dtls_handshake_time, janus_dtls_queue_time;
+typedef enum janus_dtls_operation_type {
+	janus_dtls_operation_handshake = 0,
+	janus_dtls_operation_message,
+	janus_dtls_operation_timeout,
+	janus_dtls_operation_alert,
+} janus_dtls_operation_type;
+typedef struct janus_dtls_operation {
+	janus_dtls_operation_type type;
+	gint64 queued;
+	uint16_t length;
+	char data[];
+} janus_dtls_operation;
+static void janus_dtls_worker(gpointer data, gpointer user_data);
+
+void janus_dtls_set_workers(int workers, int max_queue) {
+	janus_dtls_workers_count = workers > 0 ? workers : 0;
+	janus_dtls_workers_max_queue = max_queue > 0 ? max_queue : JANUS_DTLS_WORKERS_QUEUE;
+}
+json_t *janus_dtls_workers_info(void) {
+	if(janus_dtls_workers == NULL)
+		return NULL;
+	json_t *info = json_object();
+	json_object_set_new(info, "workers", json_integer(janus_dtls_workers_count));
+	json_object_set_new(info, "max-queue", json_integer(janus_dtls_workers_max_queue));
+	json_object_set_new(info, "queued", json_integer(g_atomic_int_get(&janus_dtls_queued)));
+	json_object_set_new(info, "queued-max", json_integer(g_atomic_int_get(&janus_dtls_queued_max)));
+	json_object_set_new(info, "busy", json_integer(g_thread_pool_get_num_threads(janus_dtls_workers)));
+	json_object_set_new(info, "waiting", json_integer(g_thread_pool_unprocessed(janus_dtls_workers)));
+	json_object_set_new(info, "dropped", json_integer(g_atomic_int_get(&janus_dtls_dropped)));
+	json_object_set_new(info, "handshakes", json_integer(g_atomic_int_get(&janus_dtls_handshakes)));
+	json_object_set_new(info, "failed", json_integer(g_atomic_int_get(&janus_dtls_handshakes_failed)));
+	json_object_set_new(info, "handshake-us", janus_histogram_summary(&janus_dtls_handshake_time));
+	json_object_set_new(info, "queue-us", janus_histogram_summary(&janus_dtls_queue_time));
+	return info;
+}
+
 /* Helper to notify DTLS state changes to the event handlers */
 static void janus_dtls_notify_state_change(janus_dtls_srtp *dtls) {
-	if(!janus_events_is_enabled())
+	if(!janus_events_should_notify(JANUS_EVENT_TYPE_WEBRTC))
 		return;
 	if(dtls == NULL)
 		return;
@@ -96,6 +143,15 @@ static void janus_dtls_notify_state_change(janus_dtls_srtp *dtls) {
 	json_object_set_new(info, "stream_id", json_integer(stream->stream_id));
 	json_object_set_new(info, "component_id", json_integer(component->component_id));
 	json_object_set_new(info, "retransmissions", json_integer(dtls->retransmissions));
+	if(dtls->dtls_state == JANUS_DTLS_STATE_CONNECTED && dtls->dtls_connected > 0) {
+		json_object_set_new(info, "handshake-us", json_integer(dtls->dtls_connected - dtls->dtls_started));
+		if(dtls->ssl != NULL)
+			json_object_set_new(info, "resumed", SSL_session_reused(dtls->ssl) ? json_true() : json_false());
+		if(janus_dtls_workers != NULL) {
+			json_object_set_new(info, "queued-us", json_integer(dtls->dtls_queued));
+			json_object_set_new(info, "queue-depth", json_integer(g_atomic_int_get(&janus_dtls_queued)));
+		}
+	}
 	janus_events_notify_handlers(JANUS_EVENT_TYPE_WEBRTC, session->session_id, handle->handle_id, handle->opaque_id, info);
 }
 
@@ -115,6 +171,129 @@ gchar *janus_dtls_get_local_fingerprint(void) {
 	return (gchar *)local_fingerprint;
 }
 
+/* SRTP profiles to negotiate, in order of preference: when we're the DTLS
+ * server, OpenSSL picks the first one in this list the client offered too */
+#ifdef HAVE_SRTP_AESGCM
+#define JANUS_DTLS_SRTP_PROFILES	"SRTP_AEAD_AES_256_GCM:SRTP_AEAD_AES_128_GCM:SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32"
+#else
+#define JANUS_DTLS_SRTP_PROFILES	"SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32"
+#endif
+static char *janus_dtls_srtp_profiles = NULL;
+int janus_dtls_set_srtp_profiles(const char *profiles) {
+	if(profiles == NULL)
+		return -1;
+	GString *list = g_string_new(NULL);
+	gchar **names = g_strsplit_set(profiles, ",:", -1);
+	int i = 0, res = 0;
+	for(i=0; names[i] != NULL; i++) {
+		gchar *name = g_strstrip(names[i]);
+		if(strlen(name) == 0)
+			continue;
+		if(strcasecmp(name, "SRTP_AES128_CM_SHA1_80") && strcasecmp(name, "SRTP_AES128_CM_SHA1_32") &&
+				strcasecmp(name, "SRTP_AEAD_AES_128_GCM") && strcasecmp(name, "SRTP_AEAD_AES_256_GCM")) {
+			JANUS_LOG(LOG_ERR, "Unsupported SRTP profile '%s'\n", name);
+			res = -1;
+			break;
+		}
+#ifndef HAVE_SRTP_AESGCM
+		if(strstr(name, "GCM") != NULL || strstr(name, "gcm") != NULL) {
+			JANUS_LOG(LOG_WARN, "The libsrtp installation does not support AES-GCM profiles, skipping %s\n", name);
+			continue;
+		}
+#endif
+		if(list->len > 0)
+			g_string_append_c(list, ':');
+		g_string_append(list, name);
+	}
+	g_strfreev(names);
+	if(res < 0 || list->len == 0) {
+		if(res == 0)
+			JANUS_LOG(LOG_ERR, "No usable SRTP profile in '%s'\n", profiles);
+		g_string_free(list, TRUE);
+		return -1;
+	}
+	g_free(janus_dtls_srtp_profiles);
+	janus_dtls_srtp_profiles = g_ascii_strup(list->str, -1);
+	g_string_free(list, TRUE);
+	return 0;
+}
+
+/* Certificate type and session resumption */
+#define JANUS_DTLS_SESSION_TIMEOUT	300
+#define JANUS_DTLS_SESSIONS_MAX		10000
+static gboolean janus_dtls_ecdsa = FALSE;
+static gboolean janus_dtls_resumption = FALSE;
+static int janus_dtls_resumption_timeout = JANUS_DTLS_SESSION_TIMEOUT;
+static volatile gint janus_dtls_resumed = 0;
+/* Sessions we got when acting as DTLS clients, indexed by the remote fingerprint */
+static GHashTable *janus_dtls_sessions = NULL;
+static janus_mutex janus_dtls_sessions_mutex = JANUS_MUTEX_INITIALIZER;
+
+void janus_dtls_set_ecdsa(gboolean ecdsa) {
+	janus_dtls_ecdsa = ecdsa;
+}
+void janus_dtls_set_session_resumption(gboolean enabled, int timeout) {
+	janus_dtls_resumption = enabled;
+	janus_dtls_resumption_timeout = timeout > 0 ? timeout : JANUS_DTLS_SESSION_TIMEOUT;
+}
+json_t *janus_dtls_session_resumption_info(void) {
+	if(!janus_dtls_resumption)
+		return NULL;
+	json_t *info = json_object();
+	json_object_set_new(info, "timeout", json_integer(janus_dtls_resumption_timeout));
+	janus_mutex_lock(&janus_dtls_sessions_mutex);
+	json_object_set_new(info, "cached", json_integer(janus_dtls_sessions ? g_hash_table_size(janus_dtls_sessions) : 0));
+	janus_mutex_unlock(&janus_dtls_sessions_mutex);
+	json_object_set_new(info, "resumed", json_integer(g_atomic_int_get(&janus_dtls_resumed)));
+	return info;
+}
+
+static gboolean janus_dtls_session_is_expired(gpointer key, gpointer value, gpointer user_data) {
+	SSL_SESSION *session = (SSL_SESSION *)value;
+	long now = GPOINTER_TO_SIZE(user_data);
+	return (SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session)) < now;
+}
+/* Callback OpenSSL invokes when a new session is established */
+static int janus_dtls_new_session(SSL *ssl, SSL_SESSION *session) {
+	janus_dtls_srtp *dtls = (janus_dtls_srtp *)SSL_get_ex_data(ssl, 0);
+	if(dtls == NULL || dtls->dtls_role != JANUS_DTLS_ROLE_CLIENT)
+		return 0;
+	janus_ice_component *component = (janus_ice_component *)dtls->component;
+	if(component == NULL || component->stream == NULL || component->stream->remote_fingerprint == NULL)
+		return 0;
+	janus_mutex_lock(&janus_dtls_sessions_mutex);
+	if(g_hash_table_size(janus_dtls_sessions) >= JANUS_DTLS_SESSIONS_MAX) {
+		g_hash_table_foreach_remove(janus_dtls_sessions, janus_dtls_session_is_expired, GSIZE_TO_POINTER(time(NULL)));
+		if(g_hash_table_size(janus_dtls_sessions) >= JANUS_DTLS_SESSIONS_MAX) {
+			/* Still full, don't cache this one */
+			janus_mutex_unlock(&janus_dtls_sessions_mutex);
+			return 0;
+		}
+	}
+	/* The session is ours now */
+	g_hash_table_insert(janus_dtls_sessions, g_strdup(component->stream->remote_fingerprint), session);
+	janus_mutex_unlock(&janus_dtls_sessions_mutex);
+	return 1;
+}
+/* Helper to try and resume a previous session, when acting as DTLS clients */
+static void janus_dtls_resume_session(janus_dtls_srtp *dtls) {
+	janus_ice_component *component = (janus_ice_component *)dtls->component;
+	if(component == NULL || component->stream == NULL || component->stream->remote_fingerprint == NULL)
+		return;
+	janus_mutex_lock(&janus_dtls_sessions_mutex);
+	SSL_SESSION *session = g_hash_table_lookup(janus_dtls_sessions, component->stream->remote_fingerprint);
+	if(session != NULL) {
+		if(janus_dtls_session_is_expired(NULL, session, GSIZE_TO_POINTER(time(NULL)))) {
+			g_hash_table_remove(janus_dtls_sessions, component->stream->remote_fingerprint);
+		} else {
+			/* The peer may still reject it, in which case a full handshake will take place */
+			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Trying to resume previous DTLS session\n", component->stream->handle->handle_id);
+			SSL_set_session(dtls->ssl, session);
+		}
+	}
+	janus_mutex_unlock(&janus_dtls_sessions_mutex);
+}
+
 
 #if JANUS_USE_OPENSSL_PRE_1_1_API
 /*
@@ -170,9 +349,37 @@ static int janus_dtls_generate_keys(X509 **certificate, EVP_PKEY **private_key)
 	static const int num_bits = 2048;
 	BIGNUM *bne = NULL;
 	RSA *rsa_key = NULL;
+	EC_KEY *ecc_key = NULL;
 	X509_NAME *cert_name = NULL;
 
-	JANUS_LOG(LOG_VERB, "Generating DTLS key / cert\n");
+	JANUS_LOG(LOG_VERB, "Generating DTLS key / cert (%s)\n", janus_dtls_ecdsa ? "ECDSA P-256" : "RSA");
+
+	if(janus_dtls_ecdsa) {
+		/* Generate a P-256 key: much cheaper than RSA to sign with during handshakes */
+		ecc_key = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+		if(!ecc_key) {
+			JANUS_LOG(LOG_FATAL, "EC_KEY_new_by_curve_name() failed\n");
+			goto error;
+		}
+		/* Make sure the curve is encoded by name in the certificate */
+		EC_KEY_set_asn1_flag(ecc_key, OPENSSL_EC_NAMED_CURVE);
+		if(!EC_KEY_generate_key(ecc_key)) {
+			JANUS_LOG(LOG_FATAL, "EC_KEY_generate_key() failed\n");
+			goto error;
+		}
+		*private_key = EVP_PKEY_new();
+		if(!*private_key) {
+			JANUS_LOG(LOG_FATAL, "EVP_PKEY_new() failed\n");
+			goto error;
+		}
+		if(!EVP_PKEY_assign_EC_KEY(*private_key, ecc_key)) {
+			JANUS_LOG(LOG_FATAL, "EVP_PKEY_assign_EC_KEY() failed\n");
+			goto error;
+		}
+		/* The EC key now belongs to the private key, so don't clean it up separately. */
+		ecc_key = NULL;
+		goto certificate;
+	}
 
 	/* Create a big number object. */
 	bne = BN_new();
@@ -213,6 +420,7 @@ static int janus_dtls_generate_keys(X509 **certificate, EVP_PKEY **private_key)
 	/* The RSA key now belongs to the private key, so don't clean it up separately. */
 	rsa_key = NULL;
 
+certificate:
 	/* Create the X509 certificate. */
 	*certificate = X509_new();
 	if(!*certificate) {
@@ -252,7 +460,7 @@ static int janus_dtls_generate_keys(X509 **certificate, EVP_PKEY **private_key)
 	}
 
 	/* Sign the certificate with the private key. */
-	if(!X509_sign(*certificate, *private_key, EVP_sha1())) {
+	if(!X509_sign(*certificate, *private_key, janus_dtls_ecdsa ? EVP_sha256() : EVP_sha1())) {
 		JANUS_LOG(LOG_FATAL, "X509_sign() failed\n");
 		goto error;
 	}
@@ -266,6 +474,8 @@ error:
 		BN_free(bne);
 	if(rsa_key && !*private_key)
 		RSA_free(rsa_key);
+	if(ecc_key)
+		EC_KEY_free(ecc_key);
 	if(*private_key)
 		EVP_PKEY_free(*private_key);  /* This also frees the RSA key. */
 	if(*certificate)
@@ -356,12 +566,12 @@ gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const
 		return -1;
 	}
 	SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, janus_dtls_verify_callback);
-	SSL_CTX_set_tlsext_use_srtp(ssl_ctx,
-#ifdef HAVE_SRTP_AESGCM
-		"SRTP_AEAD_AES_256_GCM:SRTP_AEAD_AES_128_GCM:SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32");
-#else
-		"SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32");
-#endif
+	if(SSL_CTX_set_tlsext_use_srtp(ssl_ctx, janus_dtls_srtp_profiles ? janus_dtls_srtp_profiles : JANUS_DTLS_SRTP_PROFILES) != 0) {
+		JANUS_LOG(LOG_FATAL, "Error setting the SRTP profiles (%s)\n", ERR_reason_error_string(ERR_get_error()));
+		return -1;
+	}
+	JANUS_LOG(LOG_INFO, "SRTP profiles (in order of preference): %s\n",
+		janus_dtls_srtp_profiles ? janus_dtls_srtp_profiles : JANUS_DTLS_SRTP_PROFILES);
 
 	if(!server_pem && !server_key) {
 		JANUS_LOG(LOG_WARN, "No cert/key specified, autogenerating some...\n");
@@ -374,6 +584,12 @@ gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const
 		return -2;
 	} else if(janus_dtls_load_keys(server_pem, server_key, password, &ssl_cert, &ssl_key) != 0) {
 		return -3;
+	} else {
+		gboolean ecdsa = (EVP_PKEY_base_id(ssl_key) == EVP_PKEY_EC);
+		JANUS_LOG(LOG_INFO, "Loaded %s DTLS certificate\n", ecdsa ? "ECDSA" : "RSA");
+		if(janus_dtls_ecdsa && !ecdsa)
+			JANUS_LOG(LOG_WARN, "ECDSA keys were requested, but the configured key is not an ECDSA key\n");
+		janus_dtls_ecdsa = ecdsa;
 	}
 
 	if(!SSL_CTX_use_certificate(ssl_ctx, ssl_cert)) {
@@ -389,6 +605,18 @@ gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const
 		return -6;
 	}
 	SSL_CTX_set_read_ahead(ssl_ctx,1);
+	if(janus_dtls_resumption) {
+		/* Allow peers that reconnect quickly (e.g., page reloads) to resume their
+		 * DTLS session, via session tickets or IDs when we're the server, and via
+		 * the sessions we cached for their fingerprint when we're the client */
+		SSL_CTX_set_session_id_context(ssl_ctx, (const unsigned char *)"janus", strlen("janus"));
+		SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_CLIENT);
+		SSL_CTX_set_timeout(ssl_ctx, janus_dtls_resumption_timeout);
+		SSL_CTX_sess_set_new_cb(ssl_ctx, janus_dtls_new_session);
+		janus_dtls_sessions = g_hash_table_new_full(g_str_hash, g_str_equal,
+			(GDestroyNotify)g_free, (GDestroyNotify)SSL_SESSION_free);
+		JANUS_LOG(LOG_INFO, "DTLS session resumption enabled (timeout: %ds)\n", janus_dtls_resumption_timeout);
+	}
 
 	unsigned int size;
 	unsigned char fingerprint[EVP_MAX_MD_SIZE];
@@ -416,9 +644,123 @@ gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const
 		JANUS_LOG(LOG_FATAL, "Ops, error setting up libsrtp?\n");
 		return 5;
 	}
+
+	/* Start the DTLS workers, if we were asked to offload handshakes */
+	if(janus_dtls_workers_count > 0) {
+		GError *error = NULL;
+		janus_dtls_workers = g_thread_pool_new(janus_dtls_worker, NULL, janus_dtls_workers_count, FALSE, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Error creating the DTLS workers, handshakes will be performed in the handle loops: %s\n",
+				error->message);
+			g_error_free(error);
+			janus_dtls_workers = NULL;
+		} else {
+			JANUS_LOG(LOG_INFO, "DTLS handshakes will be offloaded to %d workers (max %d queued messages)\n",
+				janus_dtls_workers_count, janus_dtls_workers_max_queue);
+		}
+	}
 	return 0;
 }
 
+/* Startup benchmark: full handshakes between two in-memory endpoints */
+static int janus_dtls_benchmark_handshake(void) {
+	SSL *ssl[2] = { NULL, NULL };
+	BIO *in[2] = { NULL, NULL }, *out[2] = { NULL, NULL };
+	char buffer[1500];
+	int res = -1, i = 0, round = 0, len = 0;
+	for(i=0; i<2; i++) {
+		ssl[i] = SSL_new(ssl_ctx);
+		in[i] = BIO_new(BIO_s_mem());
+		out[i] = BIO_new(BIO_s_mem());
+		if(ssl[i] == NULL || in[i] == NULL || out[i] == NULL) {
+			BIO_free(in[i]);
+			BIO_free(out[i]);
+			goto done;
+		}
+		BIO_set_mem_eof_return(in[i], -1);
+		BIO_set_mem_eof_return(out[i], -1);
+		SSL_set_bio(ssl[i], in[i], out[i]);
+		SSL_set_options(ssl[i], SSL_OP_NO_QUERY_MTU);
+		SSL_set_mtu(ssl[i], 1200);
+		EC_KEY *ecdh = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+		if(ecdh != NULL) {
+			SSL_set_tmp_ecdh(ssl[i], ecdh);
+			EC_KEY_free(ecdh);
+		}
+	}
+	SSL_set_connect_state(ssl[0]);
+	SSL_set_accept_state(ssl[1]);
+	for(round=0; round<16; round++) {
+		for(i=0; i<2; i++) {
+			SSL_do_handshake(ssl[i]);
+			/* Deliver whatever this endpoint wrote to the other one */
+			while((len = BIO_read(out[i], buffer, sizeof(buffer))) > 0)
+				BIO_write(in[1-i], buffer, len);
+		}
+		if(SSL_is_init_finished(ssl[0]) && SSL_is_init_finished(ssl[1])) {
+			res = 0;
+			break;
+		}
+	}
+done:
+	/* BIOs are destroyed by SSL_free */
+	for(i=0; i<2; i++) {
+		if(ssl[i] != NULL)
+			SSL_free(ssl[i]);
+	}
+	return res;
+}
+
+int janus_dtls_benchmark(int handshakes) {
+	if(ssl_ctx == NULL || handshakes < 1)
+		return -1;
+	JANUS_LOG(LOG_INFO, "Benchmarking %d DTLS handshakes (%s certificate)...\n",
+		handshakes, janus_dtls_ecdsa ? "ECDSA" : "RSA");
+	int i = 0, done = 0;
+	gint64 start = janus_get_monotonic_time();
+	for(i=0; i<handshakes; i++) {
+		if(janus_dtls_benchmark_handshake() == 0)
+			done++;
+	}
+	gint64 elapsed = janus_get_monotonic_time() - start;
+	if(done == 0 || elapsed <= 0) {
+		JANUS_LOG(LOG_ERR, "Error benchmarking DTLS handshakes (%s)\n", ERR_reason_error_string(ERR_get_error()));
+		return -1;
+	}
+	/* Get rid of the sessions we just created */
+	SSL_CTX_flush_sessions(ssl_ctx, (long)time(NULL) + janus_dtls_resumption_timeout + 1);
+	/* Both ends of each handshake run on this thread, so a single endpoint can do about twice as many */
+	double rate = (double)done * G_USEC_PER_SEC / elapsed;
+	JANUS_LOG(LOG_INFO, "  -- %d handshakes in %"SCNi64"ms: %.1f handshakes/s per core (~%.1f as a single endpoint)\n",
+		done, elapsed/1000, rate, rate*2);
+	return (int)(rate*2);
+}
+
+/* Callback the BIO filter uses to send outgoing datagrams */
+static int janus_dtls_bio_sink(void *data, char *buf, int len) {
+	janus_dtls_srtp *dtls = (janus_dtls_srtp *)data;
+	janus_ice_component *component = (janus_ice_component *)dtls->component;
+	if(component == NULL || component->stream == NULL || component->stream->handle == NULL)
+		return -1;
+	janus_ice_handle *handle = component->stream->handle;
+	if(handle->agent == NULL)
+		return -1;
+	int bytes = janus_ice_send_raw(handle, component, len, buf);
+	if(bytes < len) {
+		JANUS_LOG(LOG_ERR, "[%"SCNu64"] Error sending DTLS message on component %d of stream %d (%d)\n",
+			handle->handle_id, component->component_id, component->stream_id, bytes);
+	} else {
+		JANUS_LOG(LOG_HUGE, "[%"SCNu64"] >> >> Sent %d bytes of DTLS data on the socket\n", handle->handle_id, bytes);
+	}
+	/* Update stats (TODO Do the same for the last second window as well)
+	 * FIXME: the Data stats includes the bytes used for the handshake */
+	if(bytes > 0) {
+		component->out_stats.data.packets++;
+		component->out_stats.data.bytes += bytes;
+	}
+	return bytes;
+}
+
 static void janus_dtls_srtp_free(const janus_refcount *dtls_ref) {
 	janus_dtls_srtp *dtls = janus_refcount_containerof(dtls_ref, janus_dtls_srtp, ref);
 	/* This stack can be destroyed, free all the resources */
@@ -442,11 +784,34 @@ static void janus_dtls_srtp_free(const janus_refcount *dtls_ref) {
 		}
 		/* FIXME What about dtls->remote_policy and dtls->local_policy? */
 	}
+	if(dtls->pending != NULL) {
+		/* Nothing can be queued anymore at this stage, but just in case */
+		janus_dtls_operation *op = NULL;
+		while((op = g_queue_pop_head(dtls->pending)) != NULL) {
+			g_free(op);
+			(void)g_atomic_int_dec_and_test(&janus_dtls_queued);
+		}
+		g_queue_free(dtls->pending);
+		dtls->pending = NULL;
+	}
+	janus_mutex_destroy(&dtls->mutex);
 	g_free(dtls);
 	dtls = NULL;
 }
 
 void janus_dtls_srtp_cleanup(void) {
+	g_free(janus_dtls_srtp_profiles);
+	janus_dtls_srtp_profiles = NULL;
+	janus_mutex_lock(&janus_dtls_sessions_mutex);
+	if(janus_dtls_sessions != NULL) {
+		g_hash_table_destroy(janus_dtls_sessions);
+		janus_dtls_sessions = NULL;
+	}
+	janus_mutex_unlock(&janus_dtls_sessions_mutex);
+	if(janus_dtls_workers != NULL) {
+		g_thread_pool_free(janus_dtls_workers, FALSE, TRUE);
+		janus_dtls_workers = NULL;
+	}
 	if(ssl_cert != NULL) {
 		X509_free(ssl_cert);
 		ssl_cert = NULL;
@@ -521,6 +886,8 @@ janus_dtls_srtp *janus_dtls_srtp_create(void *ice_component, janus_dtls_role rol
 	}
 	/* Chain filter and write BIOs */
 	BIO_push(dtls->filter_bio, dtls->write_bio);
+	/* Actually, have the filter send datagrams directly, so that we don't need to copy them */
+	janus_dtls_bio_filter_set_sink(dtls->filter_bio, janus_dtls_bio_sink, dtls);
 	/* Set the filter as the BIO to use for outgoing data */
 	SSL_set_bio(dtls->ssl, dtls->read_bio, dtls->filter_bio);
 	/* The role may change later, depending on the negotiation */
@@ -551,12 +918,104 @@ janus_dtls_srtp *janus_dtls_srtp_create(void *ice_component, janus_dtls_role rol
 #ifdef HAVE_SCTP
 	dtls->sctp = NULL;
 #endif
+	dtls->pending = g_queue_new();
+	janus_mutex_init(&dtls->mutex);
 	/* Done */
 	dtls->dtls_connected = 0;
 	dtls->component = component;
 	return dtls;
 }
 
+/* DTLS workers */
+static void janus_dtls_srtp_do_handshake(janus_dtls_srtp *dtls);
+static void janus_dtls_srtp_process_msg(janus_dtls_srtp *dtls, char *buf, uint16_t len, gboolean offloaded);
+static void janus_dtls_srtp_check_timeout(janus_dtls_srtp *dtls);
+static void janus_dtls_srtp_shutdown(janus_dtls_srtp *dtls);
+static void janus_dtls_worker(gpointer data, gpointer user_data) {
+	janus_dtls_srtp *dtls = (janus_dtls_srtp *)data;
+	janus_ice_component *component = (janus_ice_component *)dtls->component;
+	while(TRUE) {
+		janus_mutex_lock(&dtls->mutex);
+		janus_dtls_operation *op = g_queue_pop_head(dtls->pending);
+		if(op == NULL) {
+			/* Done for now: from now on, the handle loop may touch the stack again */
+			dtls->working = FALSE;
+			janus_mutex_unlock(&dtls->mutex);
+			break;
+		}
+		janus_mutex_unlock(&dtls->mutex);
+		gint64 waited = janus_get_monotonic_time() - op->queued;
+		janus_histogram_add(&janus_dtls_queue_time, waited);
+		dtls->dtls_queued += waited;
+		switch(op->type) {
+			case janus_dtls_operation_handshake:
+				janus_dtls_srtp_do_handshake(dtls);
+				break;
+			case janus_dtls_operation_message:
+				janus_dtls_srtp_process_msg(dtls, op->data, op->length, TRUE);
+				break;
+			case janus_dtls_operation_timeout:
+				janus_dtls_srtp_check_timeout(dtls);
+				break;
+			case janus_dtls_operation_alert:
+				janus_dtls_srtp_shutdown(dtls);
+				break;
+			default:
+				break;
+		}
+		g_free(op);
+		(void)g_atomic_int_dec_and_test(&janus_dtls_queued);
+	}
+	janus_refcount_decrease(&component->ref);
+	janus_refcount_decrease(&dtls->ref);
+}
+/* Returns TRUE if the operation has been taken care of (queued for a worker,
+ * or dropped), or FALSE if it should be performed on the handle loop right away */
+static gboolean janus_dtls_offload(janus_dtls_srtp *dtls, janus_dtls_operation_type type, char *buf, uint16_t len) {
+	if(janus_dtls_workers == NULL)
+		return FALSE;
+	janus_mutex_lock(&dtls->mutex);
+	/* Only the handshake involves expensive crypto: anything else is only
+	 * queued if a worker is taking care of the stack, to preserve the order */
+	gboolean expensive = (type == janus_dtls_operation_handshake || type == janus_dtls_operation_message) && !dtls->ready;
+	if(!dtls->working && !expensive) {
+		janus_mutex_unlock(&dtls->mutex);
+		return FALSE;
+	}
+	if(type == janus_dtls_operation_timeout) {
+		/* A worker is busy with this stack already, we'll check again later */
+		janus_mutex_unlock(&dtls->mutex);
+		return TRUE;
+	}
+	if(type == janus_dtls_operation_message && g_atomic_int_get(&janus_dtls_queued) >= janus_dtls_workers_max_queue) {
+		/* Too many handshakes in progress, drop the message: the peer will retransmit */
+		janus_mutex_unlock(&dtls->mutex);
+		g_atomic_int_inc(&janus_dtls_dropped);
+		return TRUE;
+	}
+	janus_dtls_operation *op = g_malloc(sizeof(janus_dtls_operation) + len);
+	op->type = type;
+	op->queued = janus_get_monotonic_time();
+	op->length = len;
+	if(len > 0)
+		memcpy(op->data, buf, len);
+	g_queue_push_tail(dtls->pending, op);
+	gint queued = g_atomic_int_add(&janus_dtls_queued, 1) + 1;
+	if(queued > g_atomic_int_get(&janus_dtls_queued_max))
+		g_atomic_int_set(&janus_dtls_queued_max, queued);
+	gboolean schedule = !dtls->working;
+	dtls->working = TRUE;
+	janus_mutex_unlock(&dtls->mutex);
+	if(schedule) {
+		/* The worker needs both the stack and the component to stay around */
+		janus_ice_component *component = (janus_ice_component *)dtls->component;
+		janus_refcount_increase(&dtls->ref);
+		janus_refcount_increase(&component->ref);
+		g_thread_pool_push(janus_dtls_workers, dtls, NULL);
+	}
+	return TRUE;
+}
+
 void janus_dtls_srtp_handshake(janus_dtls_srtp *dtls) {
 	if(dtls == NULL || dtls->ssl == NULL)
 		return;
@@ -564,12 +1023,19 @@ void janus_dtls_srtp_handshake(janus_dtls_srtp *dtls) {
 		/* Starting the handshake now: enforce the role */
 		dtls->dtls_started = janus_get_monotonic_time();
 		if(dtls->dtls_role == JANUS_DTLS_ROLE_CLIENT) {
+			if(janus_dtls_resumption)
+				janus_dtls_resume_session(dtls);
 			SSL_set_connect_state(dtls->ssl);
 		} else {
 			SSL_set_accept_state(dtls->ssl);
 		}
 		dtls->dtls_state = JANUS_DTLS_STATE_TRYING;
 	}
+	if(janus_dtls_offload(dtls, janus_dtls_operation_handshake, NULL, 0))
+		return;
+	janus_dtls_srtp_do_handshake(dtls);
+}
+static void janus_dtls_srtp_do_handshake(janus_dtls_srtp *dtls) {
 	SSL_do_handshake(dtls->ssl);
 	janus_dtls_fd_bridge(dtls);
 
@@ -636,6 +1102,53 @@ void janus_dtls_srtp_incoming_msg(janus_dtls_srtp *dtls, char *buf, uint16_t len
 		/* Handshake not started yet: maybe we're still waiting for the answer and the DTLS role? */
 		return;
 	}
+	/* If the handshake is in progress, let a worker take care of it */
+	if(janus_dtls_offload(dtls, janus_dtls_operation_message, buf, len))
+		return;
+	janus_dtls_srtp_process_msg(dtls, buf, len, FALSE);
+}
+
+/* Called on the handle loop when the handshake is over, successfully or not */
+static void janus_dtls_srtp_handshake_over(janus_dtls_srtp *dtls) {
+	janus_ice_component *component = (janus_ice_component *)dtls->component;
+	if(component == NULL || component->stream == NULL || component->stream->handle == NULL)
+		return;
+	janus_ice_handle *handle = component->stream->handle;
+	if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT) && g_atomic_int_get(&dtls->srtp_valid)) {
+#ifdef HAVE_SCTP
+		if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_DATA_CHANNELS)) {
+			/* Create SCTP association as well */
+			janus_dtls_srtp_create_sctp(dtls);
+		}
+#endif
+		/* Handshake successfully completed */
+		janus_ice_dtls_handshake_done(handle, component);
+	} else {
+		/* Something went wrong in either DTLS or SRTP... tell the plugin about it */
+		janus_dtls_callback(dtls->ssl, SSL_CB_ALERT, 0);
+		janus_flags_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_CLEANING);
+	}
+}
+static gboolean janus_dtls_srtp_handshake_over_cb(gpointer user_data) {
+	janus_dtls_srtp_handshake_over((janus_dtls_srtp *)user_data);
+	return G_SOURCE_REMOVE;
+}
+static void janus_dtls_srtp_handshake_over_done(gpointer user_data) {
+	janus_dtls_srtp *dtls = (janus_dtls_srtp *)user_data;
+	janus_ice_component *component = (janus_ice_component *)dtls->component;
+	if(component != NULL)
+		janus_refcount_decrease(&component->ref);
+	janus_refcount_decrease(&dtls->ref);
+}
+
+static void janus_dtls_srtp_process_msg(janus_dtls_srtp *dtls, char *buf, uint16_t len, gboolean offloaded) {
+	janus_ice_component *component = (janus_ice_component *)dtls->component;
+	janus_ice_stream *stream = component->stream;
+	janus_ice_handle *handle = stream->handle;
+	if(offloaded && janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT)) {
+		/* The PeerConnection went away while this message was queued */
+		return;
+	}
 	janus_dtls_fd_bridge(dtls);
 	int written = BIO_write(dtls->read_bio, buf, len);
 	if(written != len) {
@@ -716,6 +1229,12 @@ void janus_dtls_srtp_incoming_msg(janus_dtls_srtp *dtls, char *buf, uint16_t len
 				JANUS_LOG(LOG_VERB, "[%"SCNu64"]  Fingerprint is a match!\n", handle->handle_id);
 				dtls->dtls_state = JANUS_DTLS_STATE_CONNECTED;
 				dtls->dtls_connected = janus_get_monotonic_time();
+				janus_histogram_add(&janus_dtls_handshake_time, dtls->dtls_connected - dtls->dtls_started);
+				g_atomic_int_inc(&janus_dtls_handshakes);
+				if(SSL_session_reused(dtls->ssl)) {
+					JANUS_LOG(LOG_VERB, "[%"SCNu64"]  DTLS session resumed\n", handle->handle_id);
+					g_atomic_int_inc(&janus_dtls_resumed);
+				}
 				/* Notify event handlers */
 				janus_dtls_notify_state_change(dtls);
 			} else {
@@ -875,38 +1394,45 @@ void janus_dtls_srtp_incoming_msg(janus_dtls_srtp *dtls, char *buf, uint16_t len
 					goto done;
 				}
 				dtls->srtp_profile = srtp_profile->id;
-				dtls->srtp_valid = 1;
+				/* The SRTP contexts may have been created by a worker: make sure they're visible to the loop first */
+				g_atomic_int_set(&dtls->srtp_valid, 1);
 				JANUS_LOG(LOG_VERB, "[%"SCNu64"] Created outbound SRTP session for component %d in stream %d\n", handle->handle_id, component->component_id, stream->stream_id);
-#ifdef HAVE_SCTP
-				if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_DATA_CHANNELS)) {
-					/* Create SCTP association as well */
-					janus_dtls_srtp_create_sctp(dtls);
-				}
-#endif
 				dtls->ready = 1;
 			}
 done:
-			if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT) && dtls->srtp_valid) {
-				/* Handshake successfully completed */
-				janus_ice_dtls_handshake_done(handle, component);
-			} else {
-				/* Something went wrong in either DTLS or SRTP... tell the plugin about it */
-				janus_dtls_callback(dtls->ssl, SSL_CB_ALERT, 0);
-				janus_flags_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_CLEANING);
+			if(!dtls->srtp_valid)
+				g_atomic_int_inc(&janus_dtls_handshakes_failed);
+			if(!offloaded) {
+				janus_dtls_srtp_handshake_over(dtls);
+			} else if(handle->icectx != NULL) {
+				/* We're in a DTLS worker, let the handle loop take it from here */
+				janus_refcount_increase(&dtls->ref);
+				janus_refcount_increase(&component->ref);
+				GSource *source = g_idle_source_new();
+				g_source_set_priority(source, G_PRIORITY_DEFAULT);
+				g_source_set_callback(source, janus_dtls_srtp_handshake_over_cb, dtls, janus_dtls_srtp_handshake_over_done);
+				g_source_attach(source, handle->icectx);
+				g_source_unref(source);
 			}
 		}
 	}
 }
 
 void janus_dtls_srtp_send_alert(janus_dtls_srtp *dtls) {
-	/* Send alert */
+	if(dtls == NULL)
+		return;
+	/* Send alert (after whatever a worker may still be doing on this stack) */
 	janus_refcount_increase(&dtls->ref);
-	if(dtls != NULL && dtls->ssl != NULL) {
-		SSL_shutdown(dtls->ssl);
-		janus_dtls_fd_bridge(dtls);
-	}
+	if(dtls->ssl != NULL && !janus_dtls_offload(dtls, janus_dtls_operation_alert, NULL, 0))
+		janus_dtls_srtp_shutdown(dtls);
 	janus_refcount_decrease(&dtls->ref);
 }
+static void janus_dtls_srtp_shutdown(janus_dtls_srtp *dtls) {
+	/* Make sure nothing we coalesced is sent after the alert */
+	janus_dtls_bio_filter_flush(dtls->filter_bio);
+	SSL_shutdown(dtls->ssl);
+	janus_dtls_fd_bridge(dtls);
+}
 
 void janus_dtls_srtp_destroy(janus_dtls_srtp *dtls) {
 	if(!dtls || !g_atomic_int_compare_and_exchange(&dtls->destroyed, 0, 1))
@@ -990,7 +1516,7 @@ void janus_dtls_fd_bridge(janus_dtls_srtp *dtls) {
 			/* FIXME Just a warning for now, this will need to be solved with proper fragmentation */
 			JANUS_LOG(LOG_WARN, "[%"SCNu64"] The DTLS stack is trying to send a packet of %d bytes, this may be larger than the MTU and get dropped!\n", handle->handle_id, out);
 		}
-		int bytes = nice_agent_send(handle->agent, component->stream_id, component->component_id, out, outgoing);
+		int bytes = janus_ice_send_raw(handle, component, out, outgoing);
 		if(bytes < out) {
 			JANUS_LOG(LOG_ERR, "[%"SCNu64"] Error sending DTLS message on component %d of stream %d (%d)\n", handle->handle_id, component->component_id, stream->stream_id, bytes);
 		} else {
@@ -1008,15 +1534,23 @@ void janus_dtls_fd_bridge(janus_dtls_srtp *dtls) {
 }
 
 #ifdef HAVE_SCTP
-void janus_dtls_wrap_sctp_data(janus_dtls_srtp *dtls, char *buf, int len) {
+void janus_dtls_wrap_sctp_data(janus_dtls_srtp *dtls, char *buf, int len, gboolean binary) {
 	if(dtls == NULL || !dtls->ready || dtls->sctp == NULL || buf == NULL || len < 1)
 		return;
-	janus_sctp_send_data(dtls->sctp, buf, len);
+	janus_sctp_send_data(dtls->sctp, buf, len, binary);
+}
+
+void janus_dtls_send_pending_sctp_data(janus_dtls_srtp *dtls) {
+	if(dtls == NULL || !dtls->ready || dtls->sctp == NULL)
+		return;
+	janus_sctp_send_pending(dtls->sctp);
 }
 
 int janus_dtls_send_sctp_data(janus_dtls_srtp *dtls, char *buf, int len) {
 	if(dtls == NULL || !dtls->ready || buf == NULL || len < 1)
 		return -1;
+	/* Small SCTP packets are coalesced in the same datagram until janus_dtls_srtp_flush is called */
+	janus_dtls_bio_filter_cork(dtls->filter_bio);
 	int res = SSL_write(dtls->ssl, buf, len);
 	if(res <= 0) {
 		unsigned long err = SSL_get_error(dtls->ssl, res);
@@ -1027,6 +1561,12 @@ int janus_dtls_send_sctp_data(janus_dtls_srtp *dtls, char *buf, int len) {
 	return res;
 }
 
+void janus_dtls_srtp_flush(janus_dtls_srtp *dtls) {
+	if(dtls == NULL || dtls->filter_bio == NULL)
+		return;
+	janus_dtls_bio_filter_flush(dtls->filter_bio);
+}
+
 void janus_dtls_notify_data(janus_dtls_srtp *dtls, char *buf, int len) {
 	if(dtls == NULL || buf == NULL || len < 1)
 		return;
@@ -1075,6 +1615,24 @@ gboolean janus_dtls_retry(gpointer stack) {
 		janus_ice_webrtc_hangup(handle, "DTLS timeout");
 		goto stoptimer;
 	}
+	/* If a worker is busy with the handshake, we'll check the next time */
+	if(!janus_dtls_offload(dtls, janus_dtls_operation_timeout, NULL, 0))
+		janus_dtls_srtp_check_timeout(dtls);
+	return TRUE;
+
+stoptimer:
+	if(component->dtlsrt_source != NULL) {
+		g_source_destroy(component->dtlsrt_source);
+		g_source_unref(component->dtlsrt_source);
+		component->dtlsrt_source = NULL;
+	}
+	return FALSE;
+}
+
+static void janus_dtls_srtp_check_timeout(janus_dtls_srtp *dtls) {
+	janus_ice_component *component = (janus_ice_component *)dtls->component;
+	janus_ice_stream *stream = component->stream;
+	janus_ice_handle *handle = stream->handle;
 	struct timeval timeout = {0};
 	DTLSv1_get_timeout(dtls->ssl, &timeout);
 	guint64 timeout_value = timeout.tv_sec*1000 + timeout.tv_usec/1000;
@@ -1088,13 +1646,4 @@ gboolean janus_dtls_retry(gpointer stack) {
 		DTLSv1_handle_timeout(dtls->ssl);
 		janus_dtls_fd_bridge(dtls);
 	}
-	return TRUE;
-
-stoptimer:
-	if(component->dtlsrt_source != NULL) {
-		g_source_destroy(component->dtlsrt_source);
-		g_source_unref(component->dtlsrt_source);
-		component->dtlsrt_source = NULL;
-	}
-	return FALSE;
 }
@@ -17,11 +17,13 @@
 
 #include <inttypes.h>
 #include <glib.h>
+#include <jansson.h>
 
 #include "rtp.h"
 #include "rtpsrtp.h"
 #include "sctp.h"
 #include "refcount.h"
+#include "mutex.h"
 #include "dtls-bio.h"
 
 /*! \brief DTLS stuff initialization
@@ -34,6 +36,48 @@ gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const
 void janus_dtls_srtp_cleanup(void);
 /*! \brief Method to return a string representation (SHA-256) of the certificate fingerprint */
 gchar *janus_dtls_get_local_fingerprint(void);
+/*! \brief Method to choose the type of key to autogenerate, when no certificate is configured
+ * \note ECDSA (P-256) signatures are much cheaper than RSA ones, which makes each
+ * handshake less expensive. Must be called before janus_dtls_srtp_init.
+ * @param[in] ecdsa Whether an ECDSA key should be generated instead of an RSA one */
+void janus_dtls_set_ecdsa(gboolean ecdsa);
+/*! \brief Method to enable DTLS session resumption (session tickets/IDs when acting
+ * as the server, cached sessions per remote fingerprint when acting as the client)
+ * \note Must be called before janus_dtls_srtp_init.
+ * @param[in] enabled Whether session resumption should be enabled
+ * @param[in] timeout How long sessions can be resumed for, in seconds (0 for the default, 300) */
+void janus_dtls_set_session_resumption(gboolean enabled, int timeout);
+/*! \brief Method to get a summary of DTLS session resumption
+ * @returns A JSON object with the summary, or NULL if session resumption is disabled */
+json_t *janus_dtls_session_resumption_info(void);
+/*! \brief Method to configure which SRTP profiles should be negotiated, and in which order
+ * \note The order is only honoured when we're the DTLS server, as it's the server that
+ * picks the profile. AES-GCM profiles are only available if libsrtp supports them,
+ * and are usually much cheaper per packet on CPUs with AES-NI. Must be called before janus_dtls_srtp_init.
+ * @param[in] profiles Comma separated list of profiles (e.g., "SRTP_AEAD_AES_128_GCM,SRTP_AES128_CM_SHA1_80")
+ * @returns 0 in case of success, a negative integer otherwise (in which case the default list is used) */
+int janus_dtls_set_srtp_profiles(const char *profiles);
+/*! \brief Method to benchmark how many DTLS handshakes can be performed per core
+ * \note This performs full handshakes in memory with the configured certificate,
+ * and so must be called after janus_dtls_srtp_init. The results are logged.
+ * @param[in] handshakes How many handshakes to perform
+ * @returns The estimated number of handshakes per second a single core can perform as one endpoint, -1 on errors */
+int janus_dtls_benchmark(int handshakes);
+/*! \brief Method to configure a pool of workers to offload DTLS handshakes to
+ * \details By default, the DTLS handshake is performed on the same loop
+ * that takes care of the media of the handle, which means the key exchange
+ * competes with media for the same thread: when many PeerConnections are
+ * set up at the same time (e.g., after a failover), this can stall the loops.
+ * With a worker pool, the handshake crypto is performed by the workers
+ * instead, and the handle loop is only notified when the SRTP contexts are
+ * ready. Must be called before janus_dtls_srtp_init.
+ * @param[in] workers Number of worker threads (0 disables the pool)
+ * @param[in] max_queue Maximum number of pending handshake messages, after which
+ * new ones are dropped (peers will retransmit them), 0 for a default value */
+void janus_dtls_set_workers(int workers, int max_queue);
+/*! \brief Method to get a summary of the DTLS workers activity (queue depth and handshake timings)
+ * @returns A JSON object with the summary, or NULL if no worker pool is in use */
+json_t *janus_dtls_workers_info(void);
 
 
 /*! \brief DTLS roles */
@@ -63,6 +107,8 @@ typedef struct janus_dtls_srtp {
 	gint64 dtls_started;
 	/*! \brief Monotonic time of when the DTLS state has switched to connected */
 	gint64 dtls_connected;
+	/*! \brief How long the handshake messages waited for a DTLS worker, in total */
+	gint64 dtls_queued;
 	/*! \brief SSL context used for DTLS for this component */
 	SSL *ssl;
 	/*! \brief Read BIO (incoming DTLS data) */
@@ -91,6 +137,12 @@ typedef struct janus_dtls_srtp {
 	/*! \brief SCTP association, if DataChannels are involved */
 	janus_sctp_association *sctp;
 #endif
+	/*! \brief Operations waiting for a DTLS worker, when the handshake is offloaded */
+	GQueue *pending;
+	/*! \brief Whether a DTLS worker is currently taking care of this instance */
+	gboolean working;
+	/*! \brief Mutex to lock pending and working */
+	janus_mutex mutex;
 	/*! \brief Atomic flag to check if this instance has been destroyed */
 	volatile gint destroyed;
 	/*! \brief Reference counter for this instance */
@@ -146,8 +198,13 @@ void janus_dtls_fd_bridge(janus_dtls_srtp *dtls);
 /*! \brief Callback (called from the ICE handle) to encapsulate in DTLS outgoing SCTP data (DataChannel)
  * @param[in] dtls The janus_dtls_srtp instance to use
  * @param[in] buf The data buffer to encapsulate
- * @param[in] len The data length */
-void janus_dtls_wrap_sctp_data(janus_dtls_srtp *dtls, char *buf, int len);
+ * @param[in] len The data length
+ * @param[in] binary Whether this is binary data or text */
+void janus_dtls_wrap_sctp_data(janus_dtls_srtp *dtls, char *buf, int len, gboolean binary);
+
+/*! \brief Callback (called from the ICE handle) to send the DataChannel messages that were waiting for room in the SCTP send buffer
+ * @param[in] dtls The janus_dtls_srtp instance to use */
+void janus_dtls_send_pending_sctp_data(janus_dtls_srtp *dtls);
 
 /*! \brief Callback (called from the SCTP stack) to encapsulate in DTLS outgoing SCTP data (DataChannel)
  * @param[in] dtls The janus_dtls_srtp instance to use
@@ -156,6 +213,12 @@ void janus_dtls_wrap_sctp_data(janus_dtls_srtp *dtls, char *buf, int len);
  * @returns The number of sent bytes in case of success, 0 or a negative integer otherwise */
 int janus_dtls_send_sctp_data(janus_dtls_srtp *dtls, char *buf, int len);
 
+/*! \brief Send the DTLS records that janus_dtls_send_sctp_data coalesced, if any
+ * \note Small SCTP packets sent in a row are coalesced in a single datagram, up
+ * to the MTU: this must be called when done sending, e.g., at the end of a loop iteration
+ * @param[in] dtls The janus_dtls_srtp instance to flush */
+void janus_dtls_srtp_flush(janus_dtls_srtp *dtls);
+
 /*! \brief Callback to be notified about incoming SCTP data (DataChannel) to forward to the handle
  * @param[in] dtls The janus_dtls_srtp instance to use
  * @param[in] buf The data buffer
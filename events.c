@@ -4,41 +4,165 @@
  * \brief    Event handler notifications
  * \details  Event handler plugins can receive events from the Janus core
  * and other plugins, in order to handle them somehow. This methods
- * provide helpers to notify events to such handlers. 
+ * provide helpers to notify events to such handlers. To avoid building
+ * events nobody is interested in, the union of the masks of all handlers
+ * is kept, so that callers can check it (via janus_events_should_notify)
+ * before preparing the event: events of specific types can also be
+ * sampled, e.g., to only keep some of the media statistics. Events are
+ * queued in a ring that can be bounded, in which case a policy decides
+ * what to do when it's full (drop the oldest or the newest event, or make
+ * the caller wait), and are passed to the handlers in batches.
  * 
  * \ingroup core
  * \ref core
  */
  
 #include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "events.h"
+#include "metrics.h"
+#include "memory.h"
 #include "utils.h"
 
 static gboolean eventsenabled = FALSE;
 static char *server = NULL;
 static GHashTable *eventhandlers = NULL;
 
-static GAsyncQueue *events = NULL;
-static json_t exit_event;
+/* Queue of events to pass to handlers: it only grows if it's unbounded */
+static json_t **events = NULL;
+static guint events_capacity = 0, events_head = 0, events_count = 0;
+static guint events_max = 0;
+static janus_events_queue_policy events_policy = janus_events_queue_drop_oldest;
+static gboolean events_stopping = FALSE;
+static janus_mutex events_mutex = JANUS_MUTEX_INITIALIZER;
+static janus_condition events_cond, events_space_cond;
+static janus_metric *metric_dropped = NULL, *metric_blocked = NULL;
+/* Account for the memory of the ring (the events themselves are owned by whoever built them) */
+static janus_memory_account *events_memory = NULL;
+/* How many events the thread hands to handlers at most at the same time */
+#define JANUS_EVENTS_BATCH	64
+#define JANUS_EVENTS_INITIAL_CAPACITY	1024
+
+/* Union of the masks of all handlers */
+static volatile gint events_mask = JANUS_EVENT_TYPE_NONE;
+/* Sampling ratios and counters, one per type (the index is the bit of the type) */
+#define JANUS_EVENTS_TYPES	9
+static const char *janus_events_type_names[JANUS_EVENTS_TYPES] = {
+	"sessions", "handles", "external", "jsep", "webrtc", "media", "plugins", "transports", "core"
+};
+static guint sampling_ratio[JANUS_EVENTS_TYPES];
+static volatile gint sampling_counter[JANUS_EVENTS_TYPES];
 
 static GThread *events_thread;
 void *janus_events_thread(void *data);
 
+static gint64 janus_events_queue_metric(gpointer data) {
+	janus_mutex_lock(&events_mutex);
+	gint64 count = events_count;
+	janus_mutex_unlock(&events_mutex);
+	return count;
+}
+
+int janus_events_set_queue(guint size, janus_events_queue_policy policy) {
+	if(policy != janus_events_queue_drop_oldest && policy != janus_events_queue_drop_newest &&
+			policy != janus_events_queue_block)
+		return -1;
+	events_max = size;
+	events_policy = policy;
+	return 0;
+}
+
+janus_events_queue_policy janus_events_queue_policy_from_string(const char *policy) {
+	if(policy == NULL)
+		return janus_events_queue_drop_oldest;
+	if(!strcasecmp(policy, "drop-oldest"))
+		return janus_events_queue_drop_oldest;
+	if(!strcasecmp(policy, "drop-newest"))
+		return janus_events_queue_drop_newest;
+	if(!strcasecmp(policy, "block"))
+		return janus_events_queue_block;
+	return -1;
+}
+
+/* Add an event to the ring, enforcing the policy if needed (events_mutex must be locked) */
+static void janus_events_queue_push(json_t *event) {
+	if(events_max > 0 && events_count >= events_max) {
+		if(events_policy == janus_events_queue_drop_newest) {
+			janus_metric_inc(metric_dropped);
+			json_decref(event);
+			return;
+		} else if(events_policy == janus_events_queue_drop_oldest) {
+			janus_metric_inc(metric_dropped);
+			json_decref(events[events_head]);
+			events_head = (events_head + 1) % events_capacity;
+			events_count--;
+		} else {
+			/* Wait for the events thread to make some room */
+			janus_metric_inc(metric_blocked);
+			while(events_count >= events_max && !events_stopping)
+				janus_condition_wait(&events_space_cond, &events_mutex);
+			if(events_stopping) {
+				json_decref(event);
+				return;
+			}
+		}
+	}
+	if(events_count == events_capacity) {
+		/* Only unbounded queues get here once they're full: grow the ring */
+		guint capacity = events_capacity ? events_capacity*2 : JANUS_EVENTS_INITIAL_CAPACITY;
+		json_t **list = g_malloc(capacity * sizeof(json_t *));
+		guint i = 0;
+		for(i=0; i<events_count; i++)
+			list[i] = events[(events_head + i) % events_capacity];
+		g_free(events);
+		events = list;
+		janus_memory_charge(events_memory, janus_memory_events, (capacity - events_capacity) * sizeof(json_t *));
+		events_capacity = capacity;
+		events_head = 0;
+	}
+	events[(events_head + events_count) % events_capacity] = event;
+	events_count++;
+	janus_condition_signal(&events_cond);
+}
+
 int janus_events_init(gboolean enabled, char *server_name, GHashTable *handlers) {
 	eventsenabled = enabled;
 	if(eventsenabled) {
-		events = g_async_queue_new();
+		janus_condition_init(&events_cond);
+		janus_condition_init(&events_space_cond);
+		events_stopping = FALSE;
+		events_capacity = events_max > 0 ? events_max : JANUS_EVENTS_INITIAL_CAPACITY;
+		events = g_malloc(events_capacity * sizeof(json_t *));
+		events_memory = janus_memory_account_create("events", NULL);
+		janus_memory_charge(events_memory, janus_memory_events, events_capacity * sizeof(json_t *));
+		if(events_max > 0) {
+			const char *policy = events_policy == janus_events_queue_drop_newest ? "dropping the newest event" :
+				(events_policy == janus_events_queue_block ? "blocking" : "dropping the oldest event");
+			JANUS_LOG(LOG_INFO, "Event handlers queue limited to %u events (%s when full)\n", events_max, policy);
+		}
 		if(server_name != NULL)
 			server = g_strdup(server_name);
 		eventhandlers = handlers;
+		janus_events_update_mask();
+		janus_metric_register_callback("janus_events_queue_depth", NULL,
+			"Events waiting to be passed to event handlers", janus_metric_gauge,
+			janus_events_queue_metric, NULL);
+		metric_dropped = janus_metric_register("janus_events_dropped_total", NULL,
+			"Events dropped because the event handlers queue was full", janus_metric_counter);
+		metric_blocked = janus_metric_register("janus_events_blocked_total", NULL,
+			"Events that had to wait for room in the event handlers queue", janus_metric_counter);
 		/* We setup a thread for passing events to the handlers */
 		GError *error = NULL;
 		events_thread = g_thread_try_new("janus events thread", janus_events_thread, NULL, &error);
 		if(error != NULL) {
 			eventsenabled = FALSE;
 			g_free(server);
-			g_async_queue_unref(events);
+			g_free(events);
+			events = NULL;
+			janus_memory_account_destroy(events_memory);
+			events_memory = NULL;
 			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Events handler thread...\n", error->code, error->message ? error->message : "??");
 			return -1;
 		}
@@ -48,15 +172,28 @@ int janus_events_init(gboolean enabled, char *server_name, GHashTable *handlers)
 
 void janus_events_deinit(void) {
 	eventsenabled = FALSE;
-	if(events != NULL) {
-		g_async_queue_push(events, &exit_event);
-	}
+	janus_mutex_lock(&events_mutex);
+	events_stopping = TRUE;
+	janus_condition_broadcast(&events_cond);
+	janus_condition_broadcast(&events_space_cond);
+	janus_mutex_unlock(&events_mutex);
 	if(events_thread != NULL) {
 		g_thread_join(events_thread);
 		events_thread = NULL;
 	}
-	if(events != NULL)
-		g_async_queue_unref(events);
+	janus_mutex_lock(&events_mutex);
+	/* Cleanup pending events */
+	while(events_count > 0) {
+		json_decref(events[events_head]);
+		events_head = (events_head + 1) % events_capacity;
+		events_count--;
+	}
+	g_free(events);
+	events = NULL;
+	events_capacity = 0;
+	janus_memory_account_destroy(events_memory);
+	events_memory = NULL;
+	janus_mutex_unlock(&events_mutex);
 	g_free(server);
 }
 
@@ -64,13 +201,89 @@ gboolean janus_events_is_enabled(void) {
 	return eventsenabled;
 }
 
+int janus_events_set_sampling(const char *list) {
+	if(list == NULL)
+		return 0;
+	int res = 0;
+	gchar **items = g_strsplit(list, ",", -1);
+	int i = 0;
+	for(i=0; items[i] != NULL; i++) {
+		gchar *item = g_strstrip(items[i]);
+		if(strlen(item) == 0)
+			continue;
+		gchar *ratio = strchr(item, ':');
+		if(ratio == NULL) {
+			JANUS_LOG(LOG_WARN, "Invalid event sampling '%s', should be type:ratio\n", item);
+			res = -1;
+			continue;
+		}
+		*ratio = '\0';
+		ratio++;
+		g_strstrip(item);
+		int t = 0, value = atoi(ratio);
+		for(t=0; t<JANUS_EVENTS_TYPES; t++) {
+			if(!strcasecmp(item, janus_events_type_names[t]))
+				break;
+		}
+		if(t == JANUS_EVENTS_TYPES || value < 1) {
+			JANUS_LOG(LOG_WARN, "Invalid event sampling '%s:%s'\n", item, ratio);
+			res = -1;
+			continue;
+		}
+		sampling_ratio[t] = value;
+		if(value > 1)
+			JANUS_LOG(LOG_INFO, "Only notifying one '%s' event every %d\n", item, value);
+	}
+	g_strfreev(items);
+	return res;
+}
+
+void janus_events_update_mask(void) {
+	gint mask = JANUS_EVENT_TYPE_NONE;
+	if(eventhandlers != NULL) {
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, eventhandlers);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_eventhandler *e = value;
+			if(e != NULL)
+				mask |= (gint)e->events_mask;
+		}
+	}
+	g_atomic_int_set(&events_mask, mask);
+}
+
+gboolean janus_events_is_type_enabled(int type) {
+	return eventsenabled && (g_atomic_int_get(&events_mask) & type);
+}
+
+gboolean janus_events_should_notify(int type) {
+	if(!janus_events_is_type_enabled(type))
+		return FALSE;
+	int index = g_bit_nth_lsf(type, -1);
+	if(index < 0 || index >= JANUS_EVENTS_TYPES || sampling_ratio[index] <= 1)
+		return TRUE;
+	return ((guint)g_atomic_int_add(&sampling_counter[index], 1) % sampling_ratio[index]) == 0;
+}
+
+gboolean janus_events_should_notify_sampled(int type, guint *counter) {
+	if(counter == NULL)
+		return janus_events_should_notify(type);
+	if(!janus_events_is_type_enabled(type))
+		return FALSE;
+	int index = g_bit_nth_lsf(type, -1);
+	if(index < 0 || index >= JANUS_EVENTS_TYPES || sampling_ratio[index] <= 1)
+		return TRUE;
+	return ((*counter)++ % sampling_ratio[index]) == 0;
+}
+
 void janus_events_notify_handlers(int type, guint64 session_id, ...) {
 	/* This method has a variable list of arguments, depending on the event type */
 	va_list args;
 	va_start(args, session_id);
 
-	if(!eventsenabled || eventhandlers == NULL || g_hash_table_size(eventhandlers) == 0) {
-		/* Event handlers disabled, or no event handler plugins available: free resources, if needed */
+	if(!janus_events_is_type_enabled(type)) {
+		/* Event handlers disabled, or no event handler interested in this event: free resources, if needed */
 		if(type == JANUS_EVENT_TYPE_MEDIA || type == JANUS_EVENT_TYPE_WEBRTC) {
 			/* These events allocate a json_t object for their data, skip some arguments and unref it */
 			va_arg(args, guint64);
@@ -241,45 +454,74 @@ void janus_events_notify_handlers(int type, guint64 session_id, ...) {
 		return;
 	}
 	/* Enqueue the event */
-	g_async_queue_push(events, event);
+	janus_mutex_lock(&events_mutex);
+	if(events_stopping) {
+		janus_mutex_unlock(&events_mutex);
+		json_decref(event);
+		return;
+	}
+	janus_events_queue_push(event);
+	janus_mutex_unlock(&events_mutex);
 }
 
 void *janus_events_thread(void *data) {
 	JANUS_LOG(LOG_VERB, "Joining Events handler thread\n");
-	json_t *event = NULL;
+	janus_json_event *batch[JANUS_EVENTS_BATCH], *filtered[JANUS_EVENTS_BATCH];
+	int types[JANUS_EVENTS_BATCH];
+	guint count = 0, i = 0;
 
-	while(eventsenabled) {
-		/* Any event in queue? */
-		event = g_async_queue_pop(events);
-		if(event == NULL)
-			continue;
-		if(event == &exit_event)
+	while(TRUE) {
+		/* Any event in queue? Take as many as we can at once */
+		janus_mutex_lock(&events_mutex);
+		while(events_count == 0 && !events_stopping)
+			janus_condition_wait(&events_cond, &events_mutex);
+		if(events_count == 0) {
+			/* We're stopping, and we passed everything that was queued before that */
+			janus_mutex_unlock(&events_mutex);
 			break;
+		}
+		json_t *list[JANUS_EVENTS_BATCH];
+		count = 0;
+		while(events_count > 0 && count < JANUS_EVENTS_BATCH) {
+			list[count++] = events[events_head];
+			events_head = (events_head + 1) % events_capacity;
+			events_count--;
+		}
+		if(events_policy == janus_events_queue_block)
+			janus_condition_broadcast(&events_space_cond);
+		janus_mutex_unlock(&events_mutex);
 
-		/* Notify all interested handlers, increasing the event reference to make sure it's not lost because of errors */
-		int type = json_integer_value(json_object_get(event, "type"));
+		/* Wrap the events, so that all interested handlers share the same
+		 * object, and the same serialization if they use the same format */
+		for(i=0; i<count; i++) {
+			types[i] = json_integer_value(json_object_get(list[i], "type"));
+			batch[i] = janus_json_event_new(list[i]);
+		}
 		GHashTableIter iter;
 		gpointer value;
 		g_hash_table_iter_init(&iter, eventhandlers);
-		json_incref(event);
 		while(g_hash_table_iter_next(&iter, NULL, &value)) {
 			janus_eventhandler *e = value;
 			if(e == NULL)
 				continue;
-			if(!janus_flags_is_set(&e->events_mask, type))
+			guint interested = 0;
+			for(i=0; i<count; i++) {
+				if(janus_flags_is_set(&e->events_mask, types[i]))
+					filtered[interested++] = batch[i];
+			}
+			if(interested == 0)
 				continue;
-			e->incoming_event(event);
+			if(e->incoming_events != NULL) {
+				e->incoming_events(filtered, interested);
+			} else {
+				for(i=0; i<interested; i++)
+					e->incoming_event(filtered[i]);
+			}
 		}
-		json_decref(event);
 
-		/* Unref the final event reference, interested handlers will have their own reference */
-		json_decref(event);
-	}
-
-	/* Cleanup pending events */
-	while((event = g_async_queue_try_pop(events)) != NULL) {
-		if(event != &exit_event)
-			json_decref(event);
+		/* Unref the final event references, interested handlers will have their own reference */
+		for(i=0; i<count; i++)
+			janus_refcount_decrease(&batch[i]->ref);
 	}
 
 	JANUS_LOG(LOG_VERB, "Leaving Events handler thread\n");
@@ -16,6 +16,28 @@
 #include "debug.h"
 #include "events/eventhandler.h"
 
+/*! \brief What to do when the queue of events for handlers is full */
+typedef enum janus_events_queue_policy {
+	/*! \brief Drop the oldest event in the queue to make room for the new one */
+	janus_events_queue_drop_oldest = 0,
+	/*! \brief Drop the new event */
+	janus_events_queue_drop_newest,
+	/*! \brief Wait for the events thread to make room (which blocks the thread notifying the event) */
+	janus_events_queue_block,
+} janus_events_queue_policy;
+
+/*! \brief Helper to parse a queue policy ("drop-oldest", "drop-newest" or "block")
+ * @param[in] policy The string to parse
+ * @returns The queue policy, or -1 if the string is invalid */
+janus_events_queue_policy janus_events_queue_policy_from_string(const char *policy);
+
+/*! \brief Configure the queue of events for handlers
+ * @note This must be called before janus_events_init
+ * @param[in] size The maximum number of events in the queue (0 means unbounded)
+ * @param[in] policy What to do when the queue is full
+ * @returns 0 on success, a negative integer otherwise */
+int janus_events_set_queue(guint size, janus_events_queue_policy policy);
+
 /*! \brief Initialize the event handlers broadcaster
  * @param[in] enabled Whether broadcasting events should be supported at all
  * @param[in] server_name The name of this server, to be added to all events
@@ -30,6 +52,44 @@ void janus_events_deinit(void);
  * @returns TRUE if they're enabled, FALSE if not */
 gboolean janus_events_is_enabled(void);
 
+/*! \brief Configure how many events of specific types should be dropped
+ * @note The list is a comma separated list of type:ratio couples, where
+ * type is the same name handlers use in their masks (e.g., "media") and
+ * ratio means that only one event every ratio will be passed to handlers:
+ * e.g., "media:10,webrtc:2" only keeps one media event in ten, and one
+ * WebRTC event in two. This must be called before janus_events_init
+ * @param[in] list The list of sampling ratios
+ * @returns 0 on success, a negative integer otherwise */
+int janus_events_set_sampling(const char *list);
+
+/*! \brief Update the union of the masks of all the event handlers
+ * @note This is done automatically at startup, but needs to be done again
+ * whenever a handler may have changed its mask (e.g., after a request) */
+void janus_events_update_mask(void);
+
+/*! \brief Quick method to check whether any event handler is interested in a specific type of events
+ * @param[in] type The type of event
+ * @returns TRUE if at least a handler is interested, FALSE otherwise */
+gboolean janus_events_is_type_enabled(int type);
+
+/*! \brief Check whether an event of a specific type should be prepared and notified
+ * @note This is what should be used before building an event, as it takes into
+ * account both the masks of the handlers and the sampling ratio for the type:
+ * since this moves the sampling forward, it must be called once per event.
+ * @param[in] type The type of event
+ * @returns TRUE if the event should be notified, FALSE otherwise */
+gboolean janus_events_should_notify(int type);
+
+/*! \brief Same as janus_events_should_notify, but with a sampling counter owned by the caller
+ * @note This is needed when the same source notifies several events of the same type
+ * in a row (e.g., the audio and video statistics of a handle), as the shared counter
+ * of the type would otherwise always sample them the same way. The counter is not
+ * atomic, so it must only be used by a single thread at a time
+ * @param[in] type The type of event
+ * @param[in,out] counter The sampling counter to use
+ * @returns TRUE if the event should be notified, FALSE otherwise */
+gboolean janus_events_should_notify_sampled(int type, guint *counter);
+
 /*! \brief Notify an event to all interested handlers
  * @note According to the type of event to notify, different arguments may
  * be required and used in order to prepare the actual object to pass to handlers.
@@ -59,7 +59,9 @@ janus_eventhandler *create(void) {
  * 
  * All the above methods and callbacks are mandatory: the Janus core will
  * reject an event handler plugin that doesn't implement any of the
- * mandatory callbacks.
+ * mandatory callbacks. Handlers can also implement \c incoming_events()
+ * to receive events in batches, rather than one at a time: when it's
+ * available, the core will only use that one.
  * 
  * Additionally, a \c janus_eventhandler instance must also include a
  * mask of the events it is interested in, a \c events_mask janus_flag
@@ -101,7 +103,7 @@ janus_eventhandler *create(void) {
 
 
 /*! \brief Version of the API, to match the one event handler plugins were compiled against */
-#define JANUS_EVENTHANDLER_API_VERSION	2
+#define JANUS_EVENTHANDLER_API_VERSION	4
 
 /*! \brief Initialization of all event handler plugin properties to NULL
  * 
@@ -161,6 +163,7 @@ static janus_eventhandler janus_fake_eventhandler handler plugin =
 		.get_author = NULL,						\
 		.get_package = NULL,					\
 		.incoming_event = NULL,					\
+		.incoming_events = NULL,				\
 		.events_mask = JANUS_EVENT_TYPE_NONE,	\
 		## __VA_ARGS__ }
 
@@ -211,10 +214,24 @@ struct janus_eventhandler {
 	 * \endverbatim
 	 * \note Do NOT handle the event directly in this method. Janus sends events from its
 	 * working threads, and so you'd most likely end up slowing it down. Just take note of it
-	 * and handle it somewhere else. It's your responsibility to \c json_decref the event
-	 * object once you're done with it: a failure to do so will result in memory leaks.
-	 * @param[in] event Jansson object containing the event details */
-	void (* const incoming_event)(json_t *event);
+	 * and handle it somewhere else. The same event instance is shared by all the
+	 * handlers, which means its JSON object must NOT be modified: use
+	 * janus_json_event_text to get its serialized version, which is only encoded
+	 * once for all the handlers that use the same jansson flags. If you need the
+	 * event after this method returns, increase its reference with \c janus_refcount_increase,
+	 * and decrease it once you're done with it: a failure to do so will result in memory leaks.
+	 * @param[in] event Shared event containing the event details */
+	void (* const incoming_event)(janus_json_event *event);
+	/*! \brief Method to notify the event handler plugin that new events are available (optional)
+	 * \details The events thread hands events to handlers in batches, which
+	 * means handlers implementing this method can queue all of them at once
+	 * (e.g., taking a lock only once). Events are the same as in \c incoming_event,
+	 * and are passed in the order they were generated: the same rules apply,
+	 * so increase the reference of the events you need after this returns.
+	 * \note When this is implemented, \c incoming_event is never called
+	 * @param[in] events Array of shared events
+	 * @param[in] count Number of events in the array */
+	void (* const incoming_events)(janus_json_event **events, guint count);
 
 	/*! \brief Method to send a request to this specific event handler plugin
 	 * \details The method takes a Jansson json_t, that contains all the info related
@@ -21,6 +21,7 @@
 #include "../config.h"
 #include "../mutex.h"
 #include "../utils.h"
+#include "../metrics.h"
 
 
 /* Plugin information */
@@ -42,7 +43,8 @@ const char *janus_rabbitmqevh_get_description(void);
 const char *janus_rabbitmqevh_get_name(void);
 const char *janus_rabbitmqevh_get_author(void);
 const char *janus_rabbitmqevh_get_package(void);
-void janus_rabbitmqevh_incoming_event(json_t *event);
+void janus_rabbitmqevh_incoming_event(janus_json_event *event);
+void janus_rabbitmqevh_incoming_events(janus_json_event **list, guint count);
 json_t *janus_rabbitmqevh_handle_request(json_t *request);
 
 /* Event handler setup */
@@ -60,6 +62,7 @@ static janus_eventhandler janus_rabbitmqevh =
 		.get_package = janus_rabbitmqevh_get_package,
 
 		.incoming_event = janus_rabbitmqevh_incoming_event,
+		.incoming_events = janus_rabbitmqevh_incoming_events,
 		.handle_request = janus_rabbitmqevh_handle_request,
 
 		.events_mask = JANUS_EVENT_TYPE_NONE
@@ -74,30 +77,89 @@ janus_eventhandler *create(void) {
 
 /* Useful stuff */
 static volatile gint initialized = 0, stopping = 0;
-static GThread *handler_thread;
 static void *janus_rabbitmqevh_handler(void *data);
 
 /* Queue of events to handle */
-static GAsyncQueue *events = NULL;
 static gboolean group_events = TRUE;
-static json_t exit_event;
-static void janus_rabbitmqevh_event_free(json_t *event) {
+static janus_json_event exit_event;
+static void janus_rabbitmqevh_event_free(janus_json_event *event) {
 	if(!event || event == &exit_event)
 		return;
-	json_decref(event);
+	janus_refcount_decrease(&event->ref);
 }
 
 /* JSON serialization options */
 static size_t json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
 
-/* FIXME: Should it be configurable? */
+/* Exchange type to declare, when an exchange is configured */
 #define JANUS_RABBITMQ_EXCHANGE_TYPE "fanout"
 
-/* RabbitMQ session */
-static amqp_connection_state_t rmq_conn;
-static amqp_channel_t rmq_channel = 0;
+/* Maximum number of messages waiting for a confirm, per channel, and
+ * how long we wait for the broker to confirm them (in seconds) */
+#define JANUS_RABBITMQEVH_MAX_IN_FLIGHT		256
+#define JANUS_RABBITMQEVH_CONFIRM_TIMEOUT	5
+
+/* RabbitMQ server and credentials, shared by all the publishers */
+static char *rmq_host = NULL, *rmq_vhost = NULL, *rmq_username = NULL, *rmq_password = NULL;
+static int rmq_port = AMQP_PROTOCOL_PORT;
+static gboolean rmq_ssl_enable = FALSE, rmq_ssl_verify_peer = FALSE, rmq_ssl_verify_hostname = FALSE;
+static char *rmq_ssl_cacert_file = NULL, *rmq_ssl_cert_file = NULL, *rmq_ssl_key_file = NULL;
+static char *rmq_exchange_type = NULL;
 static amqp_bytes_t rmq_exchange;
 static amqp_bytes_t rmq_route_key;
+/* When sharding by session, events are published with a "<route_key>.<shard>" routing key */
+static guint rmq_route_key_shards = 0;
+static amqp_bytes_t *rmq_route_keys = NULL;
+/* Whether we should ask the broker to confirm what we publish */
+static gboolean rmq_confirms = FALSE;
+static guint rmq_max_in_flight = JANUS_RABBITMQEVH_MAX_IN_FLIGHT;
+
+/* Message we published, waiting for a confirm from the broker */
+typedef struct janus_rabbitmqevh_message {
+	guint64 tag;
+	GString *body;
+	guint shard;
+	gint64 sent;
+	gboolean retransmitted;
+} janus_rabbitmqevh_message;
+static void janus_rabbitmqevh_message_free(janus_rabbitmqevh_message *msg) {
+	if(msg == NULL)
+		return;
+	if(msg->body)
+		g_string_free(msg->body, TRUE);
+	g_free(msg);
+}
+
+/* Since librabbitmq connections can't be shared by different threads,
+ * each publisher has its own thread, queue, connection and channel */
+typedef struct janus_rabbitmqevh_publisher {
+	guint index;
+	GThread *thread;
+	GAsyncQueue *events;
+	amqp_connection_state_t conn;
+	amqp_channel_t channel;
+	gboolean logged_in;
+	/* Messages waiting for a confirm, sorted by delivery tag */
+	GQueue *pending;
+	guint64 next_tag;
+	volatile gint in_flight;
+	volatile gint64 rtt;
+	janus_metric *in_flight_metric, *rtt_metric;
+} janus_rabbitmqevh_publisher;
+static janus_rabbitmqevh_publisher *publishers = NULL;
+static guint publishers_count = 1;
+static volatile gint publishers_next = 0;
+
+/* Metrics */
+static janus_metric *metric_published = NULL, *metric_nacked = NULL, *metric_retransmitted = NULL;
+static gint64 janus_rabbitmqevh_in_flight_metric(gpointer data) {
+	janus_rabbitmqevh_publisher *pub = (janus_rabbitmqevh_publisher *)data;
+	return g_atomic_int_get(&pub->in_flight);
+}
+static gint64 janus_rabbitmqevh_rtt_metric(gpointer data) {
+	janus_rabbitmqevh_publisher *pub = (janus_rabbitmqevh_publisher *)data;
+	return __atomic_load_n(&pub->rtt, __ATOMIC_RELAXED);
+}
 
 
 /* Parameter validation (for tweaking via Admin API) */
@@ -172,6 +234,198 @@ static void janus_rabbitmqevh_edit_events_mask(const char *list) {
 }
 
 
+/* Helpers to figure out the routing key shard of an event, and which
+ * publisher should send it: events for the same session always end up on
+ * the same channel, so that their order is preserved */
+static guint64 janus_rabbitmqevh_event_session(janus_json_event *event) {
+	json_t *session = json_object_get(event->json, "session_id");
+	return json_is_integer(session) ? (guint64)json_integer_value(session) : 0;
+}
+static guint janus_rabbitmqevh_event_shard(janus_json_event *event) {
+	if(rmq_route_key_shards == 0)
+		return 0;
+	return janus_rabbitmqevh_event_session(event) % rmq_route_key_shards;
+}
+static janus_rabbitmqevh_publisher *janus_rabbitmqevh_pick_publisher(janus_json_event *event) {
+	if(publishers_count == 1)
+		return &publishers[0];
+	/* A shard is always handled by the same publisher */
+	if(rmq_route_key_shards > 0)
+		return &publishers[janus_rabbitmqevh_event_shard(event) % publishers_count];
+	guint64 session_id = janus_rabbitmqevh_event_session(event);
+	if(session_id > 0)
+		return &publishers[session_id % publishers_count];
+	/* Not related to a session, any publisher will do */
+	return &publishers[(guint)g_atomic_int_add(&publishers_next, 1) % publishers_count];
+}
+
+/* Helper to connect a publisher to the broker and open its channel */
+static int janus_rabbitmqevh_connect(janus_rabbitmqevh_publisher *pub) {
+	pub->conn = amqp_new_connection();
+	amqp_socket_t *socket = NULL;
+	int status;
+	JANUS_LOG(LOG_VERB, "RabbitMQEventHandler: Creating RabbitMQ socket (channel %u)...\n", pub->index);
+	if (rmq_ssl_enable) {
+		socket = amqp_ssl_socket_new(pub->conn);
+		if(socket == NULL) {
+			JANUS_LOG(LOG_FATAL, "RabbitMQEventHandler: Can't connect to RabbitMQ server: error creating socket...\n");
+			return -1;
+		}
+		if(rmq_ssl_verify_peer) {
+			amqp_ssl_socket_set_verify_peer(socket, 1);
+		} else {
+			amqp_ssl_socket_set_verify_peer(socket, 0);
+		}
+		if(rmq_ssl_verify_hostname) {
+			amqp_ssl_socket_set_verify_hostname(socket, 1);
+		} else {
+			amqp_ssl_socket_set_verify_hostname(socket, 0);
+		}
+		if(rmq_ssl_cacert_file) {
+			status = amqp_ssl_socket_set_cacert(socket, rmq_ssl_cacert_file);
+			if(status != AMQP_STATUS_OK) {
+				JANUS_LOG(LOG_FATAL, "RabbitMQEventHandler: Can't connect to RabbitMQ server: error setting CA certificate... (%s)\n", amqp_error_string2(status));
+				return -1;
+			}
+		}
+		if(rmq_ssl_cert_file && rmq_ssl_key_file) {
+			status = amqp_ssl_socket_set_key(socket, rmq_ssl_cert_file, rmq_ssl_key_file);
+			if(status != AMQP_STATUS_OK) {
+				JANUS_LOG(LOG_FATAL, "RabbitMQEventHandler: Can't connect to RabbitMQ server: error setting key... (%s)\n", amqp_error_string2(status));
+				return -1;
+			}
+		}
+	} else {
+		socket = amqp_tcp_socket_new(pub->conn);
+		if(socket == NULL) {
+			JANUS_LOG(LOG_FATAL, "RabbitMQEventHandler: Can't connect to RabbitMQ server: error creating socket...\n");
+			return -1;
+		}
+	}
+
+	JANUS_LOG(LOG_VERB, "RabbitMQEventHandler: Connecting to RabbitMQ server...\n");
+	status = amqp_socket_open(socket, rmq_host, rmq_port);
+	if(status != AMQP_STATUS_OK) {
+		JANUS_LOG(LOG_FATAL, "Can't connect to RabbitMQ server: error opening socket... (%s)\n", amqp_error_string2(status));
+		return -1;
+	}
+	JANUS_LOG(LOG_VERB, "RabbitMQEventHandler: Logging in...\n");
+	amqp_rpc_reply_t result = amqp_login(pub->conn, rmq_vhost, 0, 131072, 0, AMQP_SASL_METHOD_PLAIN, rmq_username, rmq_password);
+	if(result.reply_type != AMQP_RESPONSE_NORMAL) {
+		JANUS_LOG(LOG_FATAL, "RabbitMQEventHandler: Can't connect to RabbitMQ server: error logging in... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
+		return -1;
+	}
+	pub->logged_in = TRUE;
+	JANUS_LOG(LOG_VERB, "Opening channel...\n");
+	amqp_channel_open(pub->conn, 1);
+	result = amqp_get_rpc_reply(pub->conn);
+	if(result.reply_type != AMQP_RESPONSE_NORMAL) {
+		JANUS_LOG(LOG_FATAL, "RabbitMQEventHandler: Can't connect to RabbitMQ server: error opening channel... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
+		return -1;
+	}
+	pub->channel = 1;
+	if(rmq_exchange.bytes != NULL) {
+		JANUS_LOG(LOG_VERB, "RabbitMQEventHandler: Declaring exchange...\n");
+		amqp_exchange_declare(pub->conn, pub->channel, rmq_exchange, amqp_cstring_bytes(rmq_exchange_type), 0, 0, 0, 0, amqp_empty_table);
+		result = amqp_get_rpc_reply(pub->conn);
+		if(result.reply_type != AMQP_RESPONSE_NORMAL) {
+			JANUS_LOG(LOG_FATAL, "RabbitMQEventHandler: Can't connect to RabbitMQ server: error diclaring exchange... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
+			return -1;
+		}
+	}
+	/* Declare the queues this publisher will send messages to */
+	guint i = 0;
+	for(i=0; i<MAX(rmq_route_key_shards, 1); i++) {
+		if(i % publishers_count != pub->index)
+			continue;
+		amqp_bytes_t queue = rmq_route_key_shards > 0 ? rmq_route_keys[i] : rmq_route_key;
+		JANUS_LOG(LOG_VERB, "Declaring outgoing queue... (%.*s)\n", (int)queue.len, (char *)queue.bytes);
+		amqp_queue_declare(pub->conn, pub->channel, queue, 0, 0, 0, 0, amqp_empty_table);
+		result = amqp_get_rpc_reply(pub->conn);
+		if(result.reply_type != AMQP_RESPONSE_NORMAL) {
+			JANUS_LOG(LOG_FATAL, "RabbitMQEventHandler: Can't connect to RabbitMQ server: error declaring queue... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
+			return -1;
+		}
+	}
+	if(rmq_confirms) {
+		/* Put the channel in confirm mode: delivery tags start from 1 */
+		amqp_confirm_select(pub->conn, pub->channel);
+		result = amqp_get_rpc_reply(pub->conn);
+		if(result.reply_type != AMQP_RESPONSE_NORMAL) {
+			JANUS_LOG(LOG_FATAL, "RabbitMQEventHandler: Can't enable publisher confirms... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
+			return -1;
+		}
+		pub->next_tag = 1;
+	}
+	return 0;
+}
+
+/* Helper to stop the publishers and get rid of all the resources */
+static void janus_rabbitmqevh_cleanup(void) {
+	guint i = 0;
+	if(publishers != NULL) {
+		for(i=0; i<publishers_count; i++) {
+			janus_rabbitmqevh_publisher *pub = &publishers[i];
+			if(pub->thread != NULL) {
+				g_async_queue_push(pub->events, &exit_event);
+				g_thread_join(pub->thread);
+				pub->thread = NULL;
+			}
+			janus_metric_unregister(pub->in_flight_metric);
+			janus_metric_unregister(pub->rtt_metric);
+			if(pub->events != NULL)
+				g_async_queue_unref(pub->events);
+			if(pub->pending != NULL)
+				g_queue_free_full(pub->pending, (GDestroyNotify)janus_rabbitmqevh_message_free);
+			if(pub->conn != NULL) {
+				if(pub->channel)
+					amqp_channel_close(pub->conn, pub->channel, AMQP_REPLY_SUCCESS);
+				if(pub->logged_in)
+					amqp_connection_close(pub->conn, AMQP_REPLY_SUCCESS);
+				amqp_destroy_connection(pub->conn);
+			}
+		}
+		g_free(publishers);
+		publishers = NULL;
+	}
+	janus_metric_unregister(metric_published);
+	metric_published = NULL;
+	janus_metric_unregister(metric_nacked);
+	metric_nacked = NULL;
+	janus_metric_unregister(metric_retransmitted);
+	metric_retransmitted = NULL;
+	if(rmq_exchange.bytes)
+		g_free((char *)rmq_exchange.bytes);
+	rmq_exchange = amqp_empty_bytes;
+	if(rmq_route_key.bytes)
+		g_free((char *)rmq_route_key.bytes);
+	rmq_route_key = amqp_empty_bytes;
+	if(rmq_route_keys != NULL) {
+		for(i=0; i<rmq_route_key_shards; i++)
+			g_free((char *)rmq_route_keys[i].bytes);
+		g_free(rmq_route_keys);
+		rmq_route_keys = NULL;
+	}
+	g_free(rmq_host);
+	rmq_host = NULL;
+	g_free(rmq_vhost);
+	rmq_vhost = NULL;
+	g_free(rmq_username);
+	rmq_username = NULL;
+	g_free(rmq_password);
+	rmq_password = NULL;
+	g_free(rmq_ssl_cacert_file);
+	rmq_ssl_cacert_file = NULL;
+	g_free(rmq_ssl_cert_file);
+	rmq_ssl_cert_file = NULL;
+	g_free(rmq_ssl_key_file);
+	rmq_ssl_key_file = NULL;
+	g_free(rmq_exchange_type);
+	rmq_exchange_type = NULL;
+	rmq_ssl_enable = rmq_ssl_verify_peer = rmq_ssl_verify_hostname = FALSE;
+}
+
+
 /* Plugin implementation */
 int janus_rabbitmqevh_init(const char *config_path) {
 	if(g_atomic_int_get(&stopping)) {
@@ -190,15 +444,8 @@ int janus_rabbitmqevh_init(const char *config_path) {
 	if(config != NULL)
 		janus_config_print(config);
 
-	char *rmqhost = NULL;
-	const char *vhost = NULL, *username = NULL, *password = NULL;
-	const char *ssl_cacert_file = NULL;
-	const char *ssl_cert_file = NULL;
-	const char *ssl_key_file = NULL;
-	gboolean ssl_enable = FALSE;
-	gboolean ssl_verify_peer = FALSE;
-	gboolean ssl_verify_hostname = FALSE;
 	const char *route_key = NULL, *exchange = NULL;
+	guint i = 0;
 
 	/* Setup the event handler, if required */
 	janus_config_item *item = janus_config_get_item_drilldown(config, "general", "enabled");
@@ -238,52 +485,79 @@ int janus_rabbitmqevh_init(const char *config_path) {
 	/* Handle configuration, starting from the server details */
 	item = janus_config_get_item_drilldown(config, "general", "host");
 	if(item && item->value)
-		rmqhost = g_strdup(item->value);
+		rmq_host = g_strdup(item->value);
 	else
-		rmqhost = g_strdup("localhost");
-	int rmqport = AMQP_PROTOCOL_PORT;
+		rmq_host = g_strdup("localhost");
+	rmq_port = AMQP_PROTOCOL_PORT;
 	item = janus_config_get_item_drilldown(config, "general", "port");
 	if(item && item->value)
-		rmqport = atoi(item->value);
+		rmq_port = atoi(item->value);
 
 	/* Credentials and Virtual Host */
 	item = janus_config_get_item_drilldown(config, "general", "vhost");
 	if(item && item->value)
-		vhost = g_strdup(item->value);
+		rmq_vhost = g_strdup(item->value);
 	else
-	vhost = g_strdup("/");
+		rmq_vhost = g_strdup("/");
 	item = janus_config_get_item_drilldown(config, "general", "username");
 	if(item && item->value)
-		username = g_strdup(item->value);
+		rmq_username = g_strdup(item->value);
 	else
-		username = g_strdup("guest");
+		rmq_username = g_strdup("guest");
 	item = janus_config_get_item_drilldown(config, "general", "password");
 	if(item && item->value)
-		password = g_strdup(item->value);
+		rmq_password = g_strdup(item->value);
 	else
-		password = g_strdup("guest");
+		rmq_password = g_strdup("guest");
 
 	/* SSL config*/
 	item = janus_config_get_item_drilldown(config, "general", "ssl_enable");
 	if(!item || !item->value || !janus_is_true(item->value)) {
 		JANUS_LOG(LOG_INFO, "RabbitMQEventHandler: RabbitMQ SSL support disabled\n");
 	} else {
-		ssl_enable = TRUE;
+		rmq_ssl_enable = TRUE;
 		item = janus_config_get_item_drilldown(config, "general", "ssl_cacert");
 		if(item && item->value)
-			ssl_cacert_file = g_strdup(item->value);
+			rmq_ssl_cacert_file = g_strdup(item->value);
 		item = janus_config_get_item_drilldown(config, "general", "ssl_cert");
 		if(item && item->value)
-			ssl_cert_file = g_strdup(item->value);
+			rmq_ssl_cert_file = g_strdup(item->value);
 		item = janus_config_get_item_drilldown(config, "general", "ssl_key");
 		if(item && item->value)
-			ssl_key_file = g_strdup(item->value);
+			rmq_ssl_key_file = g_strdup(item->value);
 		item = janus_config_get_item_drilldown(config, "general", "ssl_verify_peer");
 		if(item && item->value && janus_is_true(item->value))
-			ssl_verify_peer = TRUE;
+			rmq_ssl_verify_peer = TRUE;
 		item = janus_config_get_item_drilldown(config, "general", "ssl_verify_hostname");
 		if(item && item->value && janus_is_true(item->value))
-			ssl_verify_hostname = TRUE;
+			rmq_ssl_verify_hostname = TRUE;
+	}
+
+	/* How many channels (and threads) should we publish on? */
+	publishers_count = 1;
+	item = janus_config_get_item_drilldown(config, "general", "channels");
+	if(item && item->value) {
+		int channels = atoi(item->value);
+		if(channels < 1 || channels > 64) {
+			JANUS_LOG(LOG_WARN, "RabbitMQEventHandler: Invalid number of channels %d, using 1\n", channels);
+			channels = 1;
+		}
+		publishers_count = channels;
+	}
+	/* Should we wait for the broker to confirm the messages we publish? */
+	item = janus_config_get_item_drilldown(config, "general", "confirms");
+	if(item && item->value)
+		rmq_confirms = janus_is_true(item->value);
+	rmq_max_in_flight = JANUS_RABBITMQEVH_MAX_IN_FLIGHT;
+	item = janus_config_get_item_drilldown(config, "general", "max_in_flight");
+	if(item && item->value) {
+		int max_in_flight = atoi(item->value);
+		if(max_in_flight < 1) {
+			JANUS_LOG(LOG_WARN, "RabbitMQEventHandler: Invalid max_in_flight %d, using %d\n",
+				max_in_flight, JANUS_RABBITMQEVH_MAX_IN_FLIGHT);
+			max_in_flight = JANUS_RABBITMQEVH_MAX_IN_FLIGHT;
+		}
+		rmq_max_in_flight = max_in_flight;
 	}
 
 	/* Parse configuration */
@@ -299,112 +573,84 @@ int janus_rabbitmqevh_init(const char *config_path) {
 	} else {
 		exchange = g_strdup(item->value);
 	}
+	item = janus_config_get_item_drilldown(config, "general", "exchange_type");
+	rmq_exchange_type = g_strdup((item && item->value) ? item->value : JANUS_RABBITMQ_EXCHANGE_TYPE);
+	/* Should we shard the routing key by session? */
+	rmq_route_key_shards = 0;
+	item = janus_config_get_item_drilldown(config, "general", "route_key_shards");
+	if(item && item->value) {
+		int shards = atoi(item->value);
+		if(shards < 0 || shards > 1024) {
+			JANUS_LOG(LOG_WARN, "RabbitMQEventHandler: Invalid number of routing key shards %d, not sharding\n", shards);
+			shards = 0;
+		}
+		rmq_route_key_shards = shards;
+	}
 	if (exchange == NULL) {
-		JANUS_LOG(LOG_INFO, "RabbitMQ event handler enabled, %s:%d (%s)\n", rmqhost, rmqport, route_key);
+		JANUS_LOG(LOG_INFO, "RabbitMQ event handler enabled, %s:%d (%s)\n", rmq_host, rmq_port, route_key);
 	} else {
-		JANUS_LOG(LOG_INFO, "RabbitMQ event handler enabled, %s:%d (%s) exch: (%s)\n", rmqhost, rmqport, route_key, exchange);
+		JANUS_LOG(LOG_INFO, "RabbitMQ event handler enabled, %s:%d (%s) exch: (%s, %s)\n",
+			rmq_host, rmq_port, route_key, exchange, rmq_exchange_type);
 	}
-
-	/* Connect */
-	rmq_conn = amqp_new_connection();
-	amqp_socket_t *socket = NULL;
-	int status;
-	JANUS_LOG(LOG_VERB, "RabbitMQEventHandler: Creating RabbitMQ socket...\n");
-	if (ssl_enable) {
-		socket = amqp_ssl_socket_new(rmq_conn);
-		if(socket == NULL) {
-			JANUS_LOG(LOG_FATAL, "RabbitMQEventHandler: Can't connect to RabbitMQ server: error creating socket...\n");
-			goto error;
-		}
-		if(ssl_verify_peer) {
-			amqp_ssl_socket_set_verify_peer(socket, 1);
-		} else {
-			amqp_ssl_socket_set_verify_peer(socket, 0);
-		}
-		if(ssl_verify_hostname) {
-			amqp_ssl_socket_set_verify_hostname(socket, 1);
-		} else {
-			amqp_ssl_socket_set_verify_hostname(socket, 0);
-		}
-		if(ssl_cacert_file) {
-			status = amqp_ssl_socket_set_cacert(socket, ssl_cacert_file);
-			if(status != AMQP_STATUS_OK) {
-				JANUS_LOG(LOG_FATAL, "RabbitMQEventHandler: Can't connect to RabbitMQ server: error setting CA certificate... (%s)\n", amqp_error_string2(status));
-				goto error;
-			}
-		}
-		if(ssl_cert_file && ssl_key_file) {
-			amqp_ssl_socket_set_key(socket, ssl_cert_file, ssl_key_file);
-			if(status != AMQP_STATUS_OK) {
-				JANUS_LOG(LOG_FATAL, "RabbitMQEventHandler: Can't connect to RabbitMQ server: error setting key... (%s)\n", amqp_error_string2(status));
-				goto error;
-			}
-		}
-	} else {
-		socket = amqp_tcp_socket_new(rmq_conn);
-		if(socket == NULL) {
-			JANUS_LOG(LOG_FATAL, "RabbitMQEventHandler: Can't connect to RabbitMQ server: error creating socket...\n");
-			goto error;
-		}
+	JANUS_LOG(LOG_INFO, "RabbitMQEventHandler: %u channel%s, publisher confirms %s, %u routing key shards\n",
+		publishers_count, publishers_count == 1 ? "" : "s", rmq_confirms ? "enabled" : "disabled", rmq_route_key_shards);
+	rmq_exchange = exchange ? amqp_cstring_bytes(exchange) : amqp_empty_bytes;
+	exchange = NULL;
+	rmq_route_key = amqp_cstring_bytes(route_key);
+	route_key = NULL;
+	if(rmq_route_key_shards > 0) {
+		rmq_route_keys = g_malloc0(rmq_route_key_shards * sizeof(amqp_bytes_t));
+		for(i=0; i<rmq_route_key_shards; i++)
+			rmq_route_keys[i] = amqp_cstring_bytes(g_strdup_printf("%s.%u", (char *)rmq_route_key.bytes, i));
 	}
 
-	JANUS_LOG(LOG_VERB, "RabbitMQEventHandler: Connecting to RabbitMQ server...\n");
-	status = amqp_socket_open(socket, rmqhost, rmqport);
-	if(status != AMQP_STATUS_OK) {
-		JANUS_LOG(LOG_FATAL, "Can't connect to RabbitMQ server: error opening socket... (%s)\n", amqp_error_string2(status));
-		goto error;
-	}
-	JANUS_LOG(LOG_VERB, "RabbitMQEventHandler: Logging in...\n");
-	amqp_rpc_reply_t result = amqp_login(rmq_conn, vhost, 0, 131072, 0, AMQP_SASL_METHOD_PLAIN, username, password);
-	if(result.reply_type != AMQP_RESPONSE_NORMAL) {
-		JANUS_LOG(LOG_FATAL, "RabbitMQEventHandler: Can't connect to RabbitMQ server: error logging in... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
-		goto error;
-	}
-	rmq_channel = 1;
-	JANUS_LOG(LOG_VERB, "Opening channel...\n");
-	amqp_channel_open(rmq_conn, rmq_channel);
-	result = amqp_get_rpc_reply(rmq_conn);
-	if(result.reply_type != AMQP_RESPONSE_NORMAL) {
-		JANUS_LOG(LOG_FATAL, "RabbitMQEventHandler: Can't connect to RabbitMQ server: error opening channel... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
-		goto error;
-	}
-	rmq_exchange = amqp_empty_bytes;
-	if(exchange != NULL) {
-		JANUS_LOG(LOG_VERB, "RabbitMQEventHandler: Declaring exchange...\n");
-		rmq_exchange = amqp_cstring_bytes(exchange);
-		amqp_exchange_declare(rmq_conn, rmq_channel, rmq_exchange, amqp_cstring_bytes(JANUS_RABBITMQ_EXCHANGE_TYPE), 0, 0, 0, 0, amqp_empty_table);
-		result = amqp_get_rpc_reply(rmq_conn);
-		if(result.reply_type != AMQP_RESPONSE_NORMAL) {
-			JANUS_LOG(LOG_FATAL, "RabbitMQEventHandler: Can't connect to RabbitMQ server: error diclaring exchange... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
+	/* Connect all the publishers */
+	publishers = g_malloc0(publishers_count * sizeof(janus_rabbitmqevh_publisher));
+	for(i=0; i<publishers_count; i++) {
+		janus_rabbitmqevh_publisher *pub = &publishers[i];
+		pub->index = i;
+		if(janus_rabbitmqevh_connect(pub) < 0)
 			goto error;
-		}
+		pub->events = g_async_queue_new_full((GDestroyNotify) janus_rabbitmqevh_event_free);
+		pub->pending = g_queue_new();
 	}
-	JANUS_LOG(LOG_VERB, "Declaring outgoing queue... (%s)\n", route_key);
-	rmq_route_key = amqp_cstring_bytes(route_key);
-	amqp_queue_declare(rmq_conn, rmq_channel, rmq_route_key, 0, 0, 0, 0, amqp_empty_table);
-	result = amqp_get_rpc_reply(rmq_conn);
-	if(result.reply_type != AMQP_RESPONSE_NORMAL) {
-		JANUS_LOG(LOG_FATAL, "RabbitMQEventHandler: Can't connect to RabbitMQ server: error declaring queue... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
-		goto error;
+	/* Metrics */
+	metric_published = janus_metric_register("janus_rabbitmqevh_published_total", NULL,
+		"Messages published by the RabbitMQ event handler", janus_metric_counter);
+	metric_nacked = janus_metric_register("janus_rabbitmqevh_nacked_total", NULL,
+		"Messages the broker refused to confirm", janus_metric_counter);
+	metric_retransmitted = janus_metric_register("janus_rabbitmqevh_retransmitted_total", NULL,
+		"Messages published again after a negative confirm", janus_metric_counter);
+	for(i=0; i<publishers_count; i++) {
+		janus_rabbitmqevh_publisher *pub = &publishers[i];
+		char labels[32];
+		g_snprintf(labels, sizeof(labels), "channel=\"%u\"", i);
+		pub->in_flight_metric = janus_metric_register_callback("janus_rabbitmqevh_in_flight", labels,
+			"Messages waiting for a confirm from the broker", janus_metric_gauge,
+			janus_rabbitmqevh_in_flight_metric, pub);
+		pub->rtt_metric = janus_metric_register_callback("janus_rabbitmqevh_confirm_rtt_us", labels,
+			"Time it took the broker to confirm the last message, in microseconds", janus_metric_gauge,
+			janus_rabbitmqevh_rtt_metric, pub);
 	}
 
-	/* Initialize the events queue */
-	events = g_async_queue_new_full((GDestroyNotify) janus_rabbitmqevh_event_free);
 	g_atomic_int_set(&initialized, 1);
 
-	GError *error = NULL;
-	handler_thread = g_thread_try_new("janus rabbitmqevh handler", janus_rabbitmqevh_handler, NULL, &error);
-	if(error != NULL) {
-		g_atomic_int_set(&initialized, 0);
-		JANUS_LOG(LOG_FATAL, "Got error %d (%s) trying to launch the RabbitMQEventHandler handler thread...\n", error->code, error->message ? error->message : "??");
-		goto error;
+	for(i=0; i<publishers_count; i++) {
+		janus_rabbitmqevh_publisher *pub = &publishers[i];
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "rabbitmqevh %u", i);
+		GError *error = NULL;
+		pub->thread = g_thread_try_new(tname, janus_rabbitmqevh_handler, pub, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_FATAL, "Got error %d (%s) trying to launch the RabbitMQEventHandler handler thread...\n", error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			goto error;
+		}
 	}
 
 	/* Done */
 	JANUS_LOG(LOG_INFO, "Setup of RabbitMQ event handler completed\n");
 
-	if(rmqhost)
-		g_free((char *)rmqhost);
 	if(config)
 		janus_config_destroy(config);
 
@@ -413,26 +659,16 @@ int janus_rabbitmqevh_init(const char *config_path) {
 
 error:
 	/* If we got here, something went wrong */
-	if(rmqhost)
-		g_free((char *)rmqhost);
-	if(vhost)
-		g_free((char *)vhost);
-	if(username)
-		g_free((char *)username);
-	if(password)
-		g_free((char *)password);
+	g_atomic_int_set(&stopping, 1);
+	janus_rabbitmqevh_cleanup();
 	if(route_key)
 		g_free((char *)route_key);
 	if(exchange)
 		g_free((char *)exchange);
-	if(ssl_cacert_file)
-		g_free((char *)ssl_cacert_file);
-	if(ssl_cert_file)
-		g_free((char *)ssl_cert_file);
-	if(ssl_key_file)
-		g_free((char *)ssl_key_file);
 	if(config)
 		janus_config_destroy(config);
+	g_atomic_int_set(&initialized, 0);
+	g_atomic_int_set(&stopping, 0);
 	return -1;
 }
 
@@ -441,24 +677,7 @@ void janus_rabbitmqevh_destroy(void) {
 		return;
 	g_atomic_int_set(&stopping, 1);
 
-	g_async_queue_push(events, &exit_event);
-	if(handler_thread != NULL) {
-		g_thread_join(handler_thread);
-		handler_thread = NULL;
-	}
-
-	g_async_queue_unref(events);
-	events = NULL;
-
-	if(rmq_conn && rmq_channel) {
-		amqp_channel_close(rmq_conn, rmq_channel, AMQP_REPLY_SUCCESS);
-		amqp_connection_close(rmq_conn, AMQP_REPLY_SUCCESS);
-		amqp_destroy_connection(rmq_conn);
-	}
-	if(rmq_exchange.bytes)
-		g_free((char *)rmq_exchange.bytes);
-	if(rmq_route_key.bytes)
-		g_free((char *)rmq_route_key.bytes);
+	janus_rabbitmqevh_cleanup();
 
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
@@ -494,10 +713,9 @@ const char *janus_rabbitmqevh_get_package(void) {
 	return JANUS_RABBITMQEVH_PACKAGE;
 }
 
-void janus_rabbitmqevh_incoming_event(json_t *event) {
+void janus_rabbitmqevh_incoming_event(janus_json_event *event) {
 	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized)) {
-		/* Janus is closing or the plugin is: unref the event as we won't handle it */
-		json_decref(event);
+		/* Janus is closing or the plugin is: ignore the event as we won't handle it */
 		return;
 	}
 
@@ -508,8 +726,33 @@ void janus_rabbitmqevh_incoming_event(json_t *event) {
 	 * and handle it in our own thread: the event contains a monotonic time indicator of
 	 * when the event actually happened on this machine, so that, if relevant, we can compute
 	 * any delay in the actual event processing ourselves. */
-	json_incref(event);
-	g_async_queue_push(events, event);
+	janus_refcount_increase(&event->ref);
+	g_async_queue_push(janus_rabbitmqevh_pick_publisher(event)->events, event);
+}
+
+void janus_rabbitmqevh_incoming_events(janus_json_event **list, guint count) {
+	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized)) {
+		/* Janus is closing or the plugin is: ignore the events as we won't handle them */
+		return;
+	}
+
+	/* Same as above, but we enqueue the whole batch at once */
+	if(publishers_count == 1) {
+		GAsyncQueue *events = publishers[0].events;
+		g_async_queue_lock(events);
+		guint i = 0;
+		for(i=0; i<count; i++) {
+			janus_refcount_increase(&list[i]->ref);
+			g_async_queue_push_unlocked(events, list[i]);
+		}
+		g_async_queue_unlock(events);
+		return;
+	}
+	guint i = 0;
+	for(i=0; i<count; i++) {
+		janus_refcount_increase(&list[i]->ref);
+		g_async_queue_push(janus_rabbitmqevh_pick_publisher(list[i])->events, list[i]);
+	}
 }
 
 json_t *janus_rabbitmqevh_handle_request(json_t *request) {
@@ -560,69 +803,211 @@ plugin_response:
 		}
 }
 
+/* Helper to publish a message: if confirms are enabled, the message is
+ * kept around until the broker tells us whether it got it or not */
+static int janus_rabbitmqevh_publish(janus_rabbitmqevh_publisher *pub, janus_rabbitmqevh_message *msg) {
+	amqp_basic_properties_t props;
+	props._flags = 0;
+	props._flags |= AMQP_BASIC_CONTENT_TYPE_FLAG;
+	props.content_type = amqp_cstring_bytes("application/json");
+	amqp_bytes_t message;
+	message.len = msg->body->len;
+	message.bytes = msg->body->str;
+	amqp_bytes_t route_key = rmq_route_key_shards > 0 ? rmq_route_keys[msg->shard] : rmq_route_key;
+	int status = amqp_basic_publish(pub->conn, pub->channel, rmq_exchange, route_key, 0, 0, &props, message);
+	if(status != AMQP_STATUS_OK) {
+		JANUS_LOG(LOG_ERR, "RabbitMQEventHandler: Error publishing... %d, %s\n", status, amqp_error_string2(status));
+		janus_rabbitmqevh_message_free(msg);
+		return -1;
+	}
+	janus_metric_inc(metric_published);
+	if(!rmq_confirms) {
+		janus_rabbitmqevh_message_free(msg);
+		return 0;
+	}
+	msg->tag = pub->next_tag++;
+	msg->sent = janus_get_monotonic_time();
+	g_queue_push_tail(pub->pending, msg);
+	g_atomic_int_inc(&pub->in_flight);
+	return 0;
+}
+
+/* Helper to get rid of all the messages waiting for a confirm */
+static void janus_rabbitmqevh_drop_pending(janus_rabbitmqevh_publisher *pub) {
+	guint count = g_queue_get_length(pub->pending);
+	if(count == 0)
+		return;
+	JANUS_LOG(LOG_ERR, "RabbitMQEventHandler: Dropping %u unconfirmed messages (channel %u)\n", count, pub->index);
+	janus_rabbitmqevh_message *msg = NULL;
+	while((msg = g_queue_pop_head(pub->pending)) != NULL)
+		janus_rabbitmqevh_message_free(msg);
+	g_atomic_int_set(&pub->in_flight, 0);
+}
+
+/* Helper to handle a basic.ack or basic.nack from the broker: messages
+ * that were refused are published again, but only once */
+static void janus_rabbitmqevh_confirm(janus_rabbitmqevh_publisher *pub, guint64 tag, gboolean multiple, gboolean ack) {
+	gint64 now = janus_get_monotonic_time();
+	GList *nacked = NULL;
+	GList *l = pub->pending->head;
+	while(l) {
+		janus_rabbitmqevh_message *msg = (janus_rabbitmqevh_message *)l->data;
+		if(msg->tag > tag)
+			break;
+		GList *next = l->next;
+		if(multiple || msg->tag == tag) {
+			g_queue_delete_link(pub->pending, l);
+			g_atomic_int_add(&pub->in_flight, -1);
+			if(msg->tag == tag)
+				__atomic_store_n(&pub->rtt, now - msg->sent, __ATOMIC_RELAXED);
+			if(ack)
+				janus_rabbitmqevh_message_free(msg);
+			else
+				nacked = g_list_prepend(nacked, msg);
+		}
+		l = next;
+	}
+	if(nacked == NULL)
+		return;
+	nacked = g_list_reverse(nacked);
+	for(l = nacked; l; l = l->next) {
+		janus_rabbitmqevh_message *msg = (janus_rabbitmqevh_message *)l->data;
+		janus_metric_inc(metric_nacked);
+		if(msg->retransmitted) {
+			JANUS_LOG_RATELIMITED(LOG_ERR, "RabbitMQEventHandler: Message refused by the broker twice, dropping it\n");
+			janus_rabbitmqevh_message_free(msg);
+			continue;
+		}
+		msg->retransmitted = TRUE;
+		janus_metric_inc(metric_retransmitted);
+		janus_rabbitmqevh_publish(pub, msg);
+	}
+	g_list_free(nacked);
+}
+
+/* Helper to wait for confirms, until no more than threshold messages are in flight */
+static int janus_rabbitmqevh_wait_confirms(janus_rabbitmqevh_publisher *pub, guint threshold) {
+	while(g_queue_get_length(pub->pending) > threshold) {
+		amqp_maybe_release_buffers(pub->conn);
+		struct timeval timeout;
+		timeout.tv_sec = JANUS_RABBITMQEVH_CONFIRM_TIMEOUT;
+		timeout.tv_usec = 0;
+		amqp_frame_t frame;
+		int res = amqp_simple_wait_frame_noblock(pub->conn, &frame, &timeout);
+		if(res != AMQP_STATUS_OK) {
+			JANUS_LOG(LOG_ERR, "RabbitMQEventHandler: Error waiting for confirms... %d, %s\n", res, amqp_error_string2(res));
+			janus_rabbitmqevh_drop_pending(pub);
+			return -1;
+		}
+		if(frame.frame_type != AMQP_FRAME_METHOD)
+			continue;
+		if(frame.payload.method.id == AMQP_BASIC_ACK_METHOD) {
+			amqp_basic_ack_t *ack = (amqp_basic_ack_t *)frame.payload.method.decoded;
+			janus_rabbitmqevh_confirm(pub, ack->delivery_tag, ack->multiple, TRUE);
+		} else if(frame.payload.method.id == AMQP_BASIC_NACK_METHOD) {
+			amqp_basic_nack_t *nack = (amqp_basic_nack_t *)frame.payload.method.decoded;
+			janus_rabbitmqevh_confirm(pub, nack->delivery_tag, nack->multiple, FALSE);
+		} else if(frame.payload.method.id == AMQP_CHANNEL_CLOSE_METHOD ||
+				frame.payload.method.id == AMQP_CONNECTION_CLOSE_METHOD) {
+			JANUS_LOG(LOG_ERR, "RabbitMQEventHandler: The broker closed the channel (%s)\n",
+				amqp_method_name(frame.payload.method.id));
+			janus_rabbitmqevh_drop_pending(pub);
+			return -1;
+		}
+	}
+	return 0;
+}
+
 /* Thread to handle incoming events */
 static void *janus_rabbitmqevh_handler(void *data) {
-	JANUS_LOG(LOG_VERB, "Joining RabbitMQEventHandler handler thread\n");
-	json_t *event = NULL, *output = NULL;
-	char *event_text = NULL;
+	janus_rabbitmqevh_publisher *pub = (janus_rabbitmqevh_publisher *)data;
+	JANUS_LOG(LOG_VERB, "Joining RabbitMQEventHandler handler thread (channel %u)\n", pub->index);
+	janus_json_event *event = NULL, *held = NULL;
+	GString *output = NULL;
 	int count = 0, max = group_events ? 100 : 1;
+	guint shard = 0;
 
 	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
 
-		event = g_async_queue_pop(events);
+		if(held != NULL) {
+			/* We stopped grouping because of this event, start from it */
+			event = held;
+			held = NULL;
+		} else {
+			/* Before waiting for more events, make sure whatever we published has been confirmed */
+			if(rmq_confirms && g_async_queue_length(pub->events) <= 0)
+				janus_rabbitmqevh_wait_confirms(pub, 0);
+			event = g_async_queue_pop(pub->events);
+		}
 		if(event == NULL)
 			continue;
 		if(event == &exit_event)
 			break;
 		count = 0;
 		output = NULL;
+		shard = janus_rabbitmqevh_event_shard(event);
 
 		while(TRUE) {
 			/* Handle event: just for fun, let's see how long it took for us to take care of this */
-			json_t *created = json_object_get(event, "timestamp");
+			json_t *created = json_object_get(event->json, "timestamp");
 			if(created && json_is_integer(created)) {
 				gint64 then = json_integer_value(created);
 				gint64 now = janus_get_monotonic_time();
 				JANUS_LOG(LOG_DBG, "Handled event after %"SCNu64" us\n", now-then);
 			}
+			/* Since this a simple plugin, it does the same for all events: so just convert
+			 * to string... the serialization is shared with other handlers using the same format */
+			const char *text = janus_json_event_text(event, json_format, NULL);
 			if(!group_events) {
 				/* We're done here, we just need a single event */
-				output = event;
+				output = g_string_new(text);
+				janus_refcount_decrease(&event->ref);
 				break;
 			}
-			/* If we got here, we're grouping */
+			/* If we got here, we're grouping: build the array out of the serialized events */
 			if(output == NULL)
-				output = json_array();
-			json_array_append_new(output, event);
+				output = g_string_new("[");
+			else
+				g_string_append_c(output, ',');
+			if(text != NULL)
+				g_string_append(output, text);
+			janus_refcount_decrease(&event->ref);
 			/* Never group more than a maximum number of events, though, or we might stay here forever */
 			count++;
 			if(count == max)
 				break;
-			event = g_async_queue_try_pop(events);
+			event = g_async_queue_try_pop(pub->events);
 			if(event == NULL || event == &exit_event)
 				break;
+			/* Events in the same message must share the routing key */
+			if(janus_rabbitmqevh_event_shard(event) != shard) {
+				held = event;
+				break;
+			}
 		}
 
+		if(group_events)
+			g_string_append_c(output, ']');
 		if(!g_atomic_int_get(&stopping)) {
-			/* Since this a simple plugin, it does the same for all events: so just convert to string... */
-			event_text = json_dumps(output, json_format);
-			amqp_basic_properties_t props;
-			props._flags = 0;
-			props._flags |= AMQP_BASIC_CONTENT_TYPE_FLAG;
-			props.content_type = amqp_cstring_bytes("application/json");
-			amqp_bytes_t message = amqp_cstring_bytes(event_text);
-			int status = amqp_basic_publish(rmq_conn, rmq_channel, rmq_exchange, rmq_route_key, 0, 0, &props, message);
-			if(status != AMQP_STATUS_OK) {
-				JANUS_LOG(LOG_ERR, "RabbitMQEventHandler: Error publishing... %d, %s\n", status, amqp_error_string2(status));
-			}
-			free(event_text);
-			event_text = NULL;
+			janus_rabbitmqevh_message *msg = g_malloc0(sizeof(janus_rabbitmqevh_message));
+			msg->body = output;
+			msg->shard = shard;
+			output = NULL;
+			/* Publish the message, and if too many are in flight wait for some confirms */
+			if(janus_rabbitmqevh_publish(pub, msg) == 0 && rmq_confirms)
+				janus_rabbitmqevh_wait_confirms(pub, rmq_max_in_flight - 1);
 		}
 
-		/* Done, let's unref the event */
-		json_decref(output);
+		/* Done, let's get rid of the payload */
+		if(output != NULL)
+			g_string_free(output, TRUE);
 		output = NULL;
 	}
-	JANUS_LOG(LOG_VERB, "Leaving RabbitMQEventHandler handler thread\n");
+	if(held != NULL)
+		janus_refcount_decrease(&held->ref);
+	/* Give the broker a chance to confirm what we sent before leaving */
+	if(rmq_confirms)
+		janus_rabbitmqevh_wait_confirms(pub, 0);
+	JANUS_LOG(LOG_VERB, "Leaving RabbitMQEventHandler handler thread (channel %u)\n", pub->index);
 	return NULL;
 }
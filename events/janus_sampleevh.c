@@ -5,7 +5,9 @@
  * \details  This is a trivial event handler plugin for Janus, which is only
  * there to showcase how you can handle an event coming from the Janus core
  * or one of the plugins. This specific plugin forwards every event it receives
- * to a web server via an HTTP POST request, using libcurl.
+ * to a web server via an HTTP POST request, using libcurl. Requests are
+ * sent asynchronously (more of them can be in flight at the same time),
+ * on connections that are kept alive, and can optionally be compressed.
  * 
  * \ingroup eventhandlers
  * \ref eventhandlers
@@ -15,6 +17,9 @@
 
 #include <math.h>
 #include <curl/curl.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #include "../debug.h"
 #include "../config.h"
@@ -41,7 +46,8 @@ const char *janus_sampleevh_get_description(void);
 const char *janus_sampleevh_get_name(void);
 const char *janus_sampleevh_get_author(void);
 const char *janus_sampleevh_get_package(void);
-void janus_sampleevh_incoming_event(json_t *event);
+void janus_sampleevh_incoming_event(janus_json_event *event);
+void janus_sampleevh_incoming_events(janus_json_event **list, guint count);
 json_t *janus_sampleevh_handle_request(json_t *request);
 
 /* Event handler setup */
@@ -59,6 +65,7 @@ static janus_eventhandler janus_sampleevh =
 		.get_package = janus_sampleevh_get_package,
 		
 		.incoming_event = janus_sampleevh_incoming_event,
+		.incoming_events = janus_sampleevh_incoming_events,
 		.handle_request = janus_sampleevh_handle_request,
 
 		.events_mask = JANUS_EVENT_TYPE_NONE
@@ -80,11 +87,19 @@ static janus_mutex evh_mutex;
 /* Queue of events to handle */
 static GAsyncQueue *events = NULL;
 static gboolean group_events = TRUE;
-static json_t exit_event;
-static void janus_sampleevh_event_free(json_t *event) {
+/* Flushing thresholds for grouped events: number of events, bytes and milliseconds */
+static int group_max = 100;
+static size_t flush_size = 0;
+static int flush_time = 0;
+/* How many POSTs can be in flight at the same time */
+static int max_in_flight = 4;
+/* Whether payloads should be compressed with gzip */
+static gboolean compress_events = FALSE;
+static janus_json_event exit_event;
+static void janus_sampleevh_event_free(janus_json_event *event) {
 	if(!event || event == &exit_event)
 		return;
-	json_decref(event);
+	janus_refcount_decrease(&event->ref);
 }
 
 /* Retransmission management */
@@ -110,7 +125,12 @@ static struct janus_json_parameter tweak_parameters[] = {
 	{"backend_user", JSON_STRING, 0},
 	{"backend_pwd", JSON_STRING, 0},
 	{"max_retransmissions", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
-	{"retransmissions_backoff", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
+	{"retransmissions_backoff", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"group_max", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"flush_size", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"flush_time", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"max_in_flight", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"compress", JANUS_JSON_BOOL, 0}
 };
 /* Error codes (for the tweaking via Admin API */
 #define JANUS_SAMPLEEVH_ERROR_INVALID_REQUEST		411
@@ -243,6 +263,50 @@ int janus_sampleevh_init(const char *config_path) {
 				item = janus_config_get_item_drilldown(config, "general", "grouping");
 				if(item && item->value)
 					group_events = janus_is_true(item->value);
+				/* When should grouped events be sent? */
+				item = janus_config_get_item_drilldown(config, "general", "group_max");
+				if(item && item->value) {
+					int gm = atoi(item->value);
+					if(gm <= 0)
+						JANUS_LOG(LOG_WARN, "Invalid value for 'group_max', using default (%d)\n", group_max);
+					else
+						group_max = gm;
+				}
+				item = janus_config_get_item_drilldown(config, "general", "flush_size");
+				if(item && item->value) {
+					int fs = atoi(item->value);
+					if(fs < 0)
+						JANUS_LOG(LOG_WARN, "Invalid negative value for 'flush_size', ignoring\n");
+					else
+						flush_size = fs;
+				}
+				item = janus_config_get_item_drilldown(config, "general", "flush_time");
+				if(item && item->value) {
+					int ft = atoi(item->value);
+					if(ft < 0)
+						JANUS_LOG(LOG_WARN, "Invalid negative value for 'flush_time', ignoring\n");
+					else
+						flush_time = ft;
+				}
+				/* How many concurrent requests can we have? */
+				item = janus_config_get_item_drilldown(config, "general", "max_in_flight");
+				if(item && item->value) {
+					int mif = atoi(item->value);
+					if(mif <= 0)
+						JANUS_LOG(LOG_WARN, "Invalid value for 'max_in_flight', using default (%d)\n", max_in_flight);
+					else
+						max_in_flight = mif;
+				}
+				/* Should we compress the events? */
+				item = janus_config_get_item_drilldown(config, "general", "compress");
+				if(item && item->value)
+					compress_events = janus_is_true(item->value);
+#ifndef HAVE_ZLIB
+				if(compress_events) {
+					JANUS_LOG(LOG_WARN, "zlib support not available, events will not be compressed\n");
+					compress_events = FALSE;
+				}
+#endif
 				/* Done */
 				enabled = TRUE;
 			}
@@ -328,10 +392,9 @@ const char *janus_sampleevh_get_package(void) {
 	return JANUS_SAMPLEEVH_PACKAGE;
 }
 
-void janus_sampleevh_incoming_event(json_t *event) {
+void janus_sampleevh_incoming_event(janus_json_event *event) {
 	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized)) {
-		/* Janus is closing or the plugin is: unref the event as we won't handle it */
-		json_decref(event);
+		/* Janus is closing or the plugin is: ignore the event as we won't handle it */
 		return;
 	}
 
@@ -342,11 +405,27 @@ void janus_sampleevh_incoming_event(json_t *event) {
 	 * and handle it in our own thread: the event contains a monotonic time indicator of
 	 * when the event actually happened on this machine, so that, if relevant, we can compute
 	 * any delay in the actual event processing ourselves. */
-	json_incref(event);
+	janus_refcount_increase(&event->ref);
 	g_async_queue_push(events, event);
 
 }
 
+void janus_sampleevh_incoming_events(janus_json_event **list, guint count) {
+	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized)) {
+		/* Janus is closing or the plugin is: ignore the events as we won't handle them */
+		return;
+	}
+
+	/* Same as above, but we enqueue the whole batch at once */
+	g_async_queue_lock(events);
+	guint i = 0;
+	for(i=0; i<count; i++) {
+		janus_refcount_increase(&list[i]->ref);
+		g_async_queue_push_unlocked(events, list[i]);
+	}
+	g_async_queue_unlock(events);
+}
+
 json_t *janus_sampleevh_handle_request(json_t *request) {
 	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized)) {
 		return NULL;
@@ -371,7 +450,8 @@ json_t *janus_sampleevh_handle_request(json_t *request) {
 		/* Parameters we can change */
 		const char *req_events = NULL, *req_backend = NULL,
 			*req_backend_user = NULL, *req_backend_pwd = NULL;
-		int req_grouping = -1, req_maxretr = -1, req_backoff = -1;
+		int req_grouping = -1, req_maxretr = -1, req_backoff = -1,
+			req_group_max = -1, req_flush_size = -1, req_flush_time = -1, req_in_flight = -1, req_compress = -1;
 		/* Events */
 		if(json_object_get(request, "events"))
 			req_events = json_string_value(json_object_get(request, "events"));
@@ -396,6 +476,24 @@ json_t *janus_sampleevh_handle_request(json_t *request) {
 			req_maxretr = json_integer_value(json_object_get(request, "max_retransmissions"));
 		if(json_object_get(request, "retransmissions_backoff"))
 			req_backoff = json_integer_value(json_object_get(request, "retransmissions_backoff"));
+		/* Delivery stuff */
+		if(json_object_get(request, "group_max"))
+			req_group_max = json_integer_value(json_object_get(request, "group_max"));
+		if(json_object_get(request, "flush_size"))
+			req_flush_size = json_integer_value(json_object_get(request, "flush_size"));
+		if(json_object_get(request, "flush_time"))
+			req_flush_time = json_integer_value(json_object_get(request, "flush_time"));
+		if(json_object_get(request, "max_in_flight"))
+			req_in_flight = json_integer_value(json_object_get(request, "max_in_flight"));
+		if(json_object_get(request, "compress"))
+			req_compress = json_is_true(json_object_get(request, "compress"));
+#ifndef HAVE_ZLIB
+		if(req_compress == 1) {
+			error_code = JANUS_SAMPLEEVH_ERROR_INVALID_ELEMENT;
+			g_snprintf(error_cause, sizeof(error_cause), "zlib support not available, can't compress events");
+			goto plugin_response;
+		}
+#endif
 		/* If we got here, we can enforce */
 		if(req_events)
 			janus_sampleevh_edit_events_mask(req_events);
@@ -421,6 +519,16 @@ json_t *janus_sampleevh_handle_request(json_t *request) {
 			max_retransmissions = req_maxretr;
 		if(req_backoff > -1)
 			retransmissions_backoff = req_backoff;
+		if(req_group_max > 0)
+			group_max = req_group_max;
+		if(req_flush_size > -1)
+			flush_size = req_flush_size;
+		if(req_flush_time > -1)
+			flush_time = req_flush_time;
+		if(req_in_flight > 0)
+			max_in_flight = req_in_flight;
+		if(req_compress > -1)
+			compress_events = req_compress ? TRUE : FALSE;
 	} else {
 		JANUS_LOG(LOG_VERB, "Unknown request '%s'\n", request_text);
 		error_code = JANUS_SAMPLEEVH_ERROR_INVALID_REQUEST;
@@ -442,331 +550,508 @@ plugin_response:
 		}
 }
 
-/* Thread to handle incoming events */
-static void *janus_sampleevh_handler(void *data) {
-	JANUS_LOG(LOG_VERB, "Joining SampleEventHandler handler thread\n");
-	json_t *event = NULL, *output = NULL;
-	char *event_text = NULL;
-	int count = 0, max = group_events ? 100 : 1;
-	int retransmit = 0;
-	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
-		if(!retransmit) {
-			event = g_async_queue_pop(events);
-			if(event == NULL)
-				continue;
-			if(event == &exit_event)
-				break;
-			count = 0;
-			output = NULL;
+/* Let's check what kind of event this is: we don't really do anything
+ * with it in this plugin, it's just to show how you can handle
+ * different types of events in an event handler. */
+static void janus_sampleevh_inspect_event(janus_json_event *event) {
+	/* Handle event: just for fun, let's see how long it took for us to take care of this */
+	json_t *created = json_object_get(event->json, "timestamp");
+	if(created && json_is_integer(created)) {
+		gint64 then = json_integer_value(created);
+		gint64 now = janus_get_monotonic_time();
+		JANUS_LOG(LOG_DBG, "Handled event after %"SCNu64" us\n", now-then);
+	}
 
-			while(TRUE) {
-				/* Handle event: just for fun, let's see how long it took for us to take care of this */
-				json_t *created = json_object_get(event, "timestamp");
-				if(created && json_is_integer(created)) {
-					gint64 then = json_integer_value(created);
-					gint64 now = janus_get_monotonic_time();
-					JANUS_LOG(LOG_DBG, "Handled event after %"SCNu64" us\n", now-then);
+	int type = json_integer_value(json_object_get(event->json, "type"));
+	switch(type) {
+		case JANUS_EVENT_TYPE_SESSION:
+			/* This is a session related event. The only info that is
+			 * required is a name for the event itself: a "created"
+			 * event may also contain transport info, in the form of
+			 * the transport module that originated the session
+			 * (e.g., "janus.transport.http") and an internal unique
+			 * ID for the transport instance (which may be associated
+			 * to a connection or anything else within the specifics
+			 * of the transport module itself). Here's an example of
+			 * a new session being created:
+				{
+				   "type": 1,
+				   "timestamp": 3583879627,
+				   "session_id": 2004798115,
+				   "event": {
+					  "name": "created"
+				   },
+				   "transport": {
+				      "transport": "janus.transport.http",
+				      "id": "0x7fcb100008c0"
+				   }
 				}
-
-				/* Let's check what kind of event this is: we don't really do anything
-				 * with it in this plugin, it's just to show how you can handle
-				 * different types of events in an event handler. */
-				int type = json_integer_value(json_object_get(event, "type"));
-				switch(type) {
-					case JANUS_EVENT_TYPE_SESSION:
-						/* This is a session related event. The only info that is
-						 * required is a name for the event itself: a "created"
-						 * event may also contain transport info, in the form of
-						 * the transport module that originated the session
-						 * (e.g., "janus.transport.http") and an internal unique
-						 * ID for the transport instance (which may be associated
-						 * to a connection or anything else within the specifics
-						 * of the transport module itself). Here's an example of
-						 * a new session being created:
-							{
-							   "type": 1,
-							   "timestamp": 3583879627,
-							   "session_id": 2004798115,
-							   "event": {
-								  "name": "created"
-							   },
-							   "transport": {
-							      "transport": "janus.transport.http",
-							      "id": "0x7fcb100008c0"
-							   }
-							}
-						*/
-						break;
-					case JANUS_EVENT_TYPE_HANDLE:
-						/* This is a handle related event. The only info that is provided
-						 * are the name for the event itself and the package name of the
-						 * plugin this handle refers to (e.g., "janus.plugin.echotest").
-						 * Here's an example of a new handled being attached in a session
-						 * to the EchoTest plugin:
-							{
-							   "type": 2,
-							   "timestamp": 3570304977,
-							   "session_id": 2004798115,
-							   "handle_id": 3708519405,
-							   "event": {
-								  "name": "attached",
-								  "plugin: "janus.plugin.echotest"
-							   }
-							}
-						*/
-						break;
-					case JANUS_EVENT_TYPE_JSEP:
-						/* This is a JSEP/SDP related event. It provides information
-						 * about an ongoing WebRTC negotiation, and so tells you
-						 * about the SDP being sent/received, and who's sending it
-						 * ("local" means Janus, "remote" means the user). Here's an
-						 * example, where the user originated an offer towards Janus:
-							{
-							   "type": 8,
-							   "timestamp": 3570400208,
-							   "session_id": 2004798115,
-							   "handle_id": 3708519405,
-							   "event": {
-								  "owner": "remote",
-								  "jsep": {
-									 "type": "offer",
-									 "sdp": "v=0[..]\r\n"
-								  }
-							   }
-							}
-						*/
-						break;
-					case JANUS_EVENT_TYPE_WEBRTC:
-						/* This is a WebRTC related event, and so the content of
-						 * the event may vary quite a bit. In fact, you may be notified
-						 * about ICE or DTLS states, or when a WebRTC PeerConnection
-						 * goes up or down. Here are some examples, in no particular order:
-							{
-							   "type": 16,
-							   "timestamp": 3570416659,
-							   "session_id": 2004798115,
-							   "handle_id": 3708519405,
-							   "event": {
-								  "ice": "connecting",
-								  "stream_id": 1,
-								  "component_id": 1
-							   }
-							}
-						 *
-							{
-							   "type": 16,
-							   "timestamp": 3570637554,
-							   "session_id": 2004798115,
-							   "handle_id": 3708519405,
-							   "event": {
-								  "selected-pair": "[..]",
-								  "stream_id": 1,
-								  "component_id": 1
-							   }
-							}
-						 *
-							{
-							   "type": 16,
-							   "timestamp": 3570656112,
-							   "session_id": 2004798115,
-							   "handle_id": 3708519405,
-							   "event": {
-								  "dtls": "connected",
-								  "stream_id": 1,
-								  "component_id": 1
-							   }
-							}
-						 *
-							{
-							   "type": 16,
-							   "timestamp": 3570657237,
-							   "session_id": 2004798115,
-							   "handle_id": 3708519405,
-							   "event": {
-								  "connection": "webrtcup"
-							   }
-							}
-						*/
-						break;
-					case JANUS_EVENT_TYPE_MEDIA:
-						/* This is a media related event. This can contain different
-						 * information about the health of a media session, or about
-						 * what's going on in general (e.g., when Janus started/stopped
-						 * receiving media of a certain type, or (TODO) when some media related
-						 * statistics are available). Here's an example of Janus getting
-						 * video from the peer for the first time, or after a second
-						 * of no video at all (which would have triggered a "receiving": false):
-							{
-							   "type": 32,
-							   "timestamp": 3571078797,
-							   "session_id": 2004798115,
-							   "handle_id": 3708519405,
-							   "event": {
-								  "media": "video",
-								  "receiving": "true"
-							   }
-							}
-						*/
-						break;
-					case JANUS_EVENT_TYPE_PLUGIN:
-						/* This is a plugin related event. Since each plugin may
-						 * provide info in a very custom way, the format of this event
-						 * is in general very dynamic. You'll always find, though,
-						 * an "event" object containing the package name of the
-						 * plugin (e.g., "janus.plugin.echotest") and a "data"
-						 * object that contains whatever the plugin decided to
-						 * notify you about, that will always vary from plugin to
-						 * plugin. Besides, notice that "session_id" and "handle_id"
-						 * may or may not be present: when they are, you'll know
-						 * the event has been triggered within the context of a
-						 * specific handle session with the plugin; when they're
-						 * not, the plugin sent an event out of context of a
-						 * specific session it is handling. Here's an example:
-							{
-							   "type": 64,
-							   "timestamp": 3570336031,
-							   "session_id": 2004798115,
-							   "handle_id": 3708519405,
-							   "event": {
-								  "plugin": "janus.plugin.echotest",
-								  "data": {
-									 "audio_active": "true",
-									 "video_active": "true",
-									 "bitrate": 0
-								  }
-							   }
-							}
-						*/
-						break;
-					case JANUS_EVENT_TYPE_TRANSPORT:
-						/* This is a transport related event (TODO). The syntax of
-						 * the common format (transport specific data aside) is
-						 * exactly the same as that of the plugin related events
-						 * above, with a "transport" property instead of "plugin"
-						 * to contain the transport package name. */
-						break;
-					case JANUS_EVENT_TYPE_CORE:
-						/* This is a core related event. This can contain different
-						 * information about the health of the Janus instance, or
-						 * more generically on some events in the Janus life cycle
-						 * (e.g., when it's just been started or when a shutdown
-						 * has been requested). Considering the heterogeneous nature
-						 * of the information being reported, the content is always
-						 * a JSON object (event). Core events are the only ones
-						 * missing a session_id. Here's an example:
-							{
-							   "type": 256,
-							   "timestamp": 28381185382,
-							   "event": {
-								  "status": "started"
-							   }
-							}
-						*/
-					case JANUS_EVENT_TYPE_EXTERNAL:
-						/* This is an external event, not originated by Janus itself
-						 * or any of its plugins, but from an ad-hoc Admin API request
-						 * instead. As such, the content of the event is not bound to
-						 * any rules (apart from the fact that it needs to be a JSON
-						 * object), but can be whatever the external source thought
-						 * appropriate. In order to facilitare life to recipients, all
-						 * external events must contain a "schema" property, which anyway
-						 * is not bound to any rules either. As an example:
-							{
-							   "type": 4,
-							   "timestamp": 28381185382,
-							   "event": {
-								  "schema": "my.custom.source",
-								  "data": {
-								     "whatever": "youwant"
-								  }
-							   }
-							}
-						*/
-						break;
-					default:
-						JANUS_LOG(LOG_WARN, "Unknown type of event '%d'\n", type);
-						break;
+			*/
+			break;
+		case JANUS_EVENT_TYPE_HANDLE:
+			/* This is a handle related event. The only info that is provided
+			 * are the name for the event itself and the package name of the
+			 * plugin this handle refers to (e.g., "janus.plugin.echotest").
+			 * Here's an example of a new handled being attached in a session
+			 * to the EchoTest plugin:
+				{
+				   "type": 2,
+				   "timestamp": 3570304977,
+				   "session_id": 2004798115,
+				   "handle_id": 3708519405,
+				   "event": {
+					  "name": "attached",
+					  "plugin: "janus.plugin.echotest"
+				   }
 				}
-				if(!group_events) {
-					/* We're done here, we just need a single event */
-					output = event;
-					break;
+			*/
+			break;
+		case JANUS_EVENT_TYPE_JSEP:
+			/* This is a JSEP/SDP related event. It provides information
+			 * about an ongoing WebRTC negotiation, and so tells you
+			 * about the SDP being sent/received, and who's sending it
+			 * ("local" means Janus, "remote" means the user). Here's an
+			 * example, where the user originated an offer towards Janus:
+				{
+				   "type": 8,
+				   "timestamp": 3570400208,
+				   "session_id": 2004798115,
+				   "handle_id": 3708519405,
+				   "event": {
+					  "owner": "remote",
+					  "jsep": {
+						 "type": "offer",
+						 "sdp": "v=0[..]\r\n"
+					  }
+				   }
 				}
-				/* If we got here, we're grouping */
-				if(output == NULL)
-					output = json_array();
-				json_array_append_new(output, event);
-				/* Never group more than a maximum number of events, though, or we might stay here forever */
-				count++;
-				if(count == max)
-					break;
-				event = g_async_queue_try_pop(events);
-				if(event == NULL || event == &exit_event)
-					break;
-			}
+			*/
+			break;
+		case JANUS_EVENT_TYPE_WEBRTC:
+			/* This is a WebRTC related event, and so the content of
+			 * the event may vary quite a bit. In fact, you may be notified
+			 * about ICE or DTLS states, or when a WebRTC PeerConnection
+			 * goes up or down. Here are some examples, in no particular order:
+				{
+				   "type": 16,
+				   "timestamp": 3570416659,
+				   "session_id": 2004798115,
+				   "handle_id": 3708519405,
+				   "event": {
+					  "ice": "connecting",
+					  "stream_id": 1,
+					  "component_id": 1
+				   }
+				}
+			 *
+				{
+				   "type": 16,
+				   "timestamp": 3570637554,
+				   "session_id": 2004798115,
+				   "handle_id": 3708519405,
+				   "event": {
+					  "selected-pair": "[..]",
+					  "stream_id": 1,
+					  "component_id": 1
+				   }
+				}
+			 *
+				{
+				   "type": 16,
+				   "timestamp": 3570656112,
+				   "session_id": 2004798115,
+				   "handle_id": 3708519405,
+				   "event": {
+					  "dtls": "connected",
+					  "stream_id": 1,
+					  "component_id": 1
+				   }
+				}
+			 *
+				{
+				   "type": 16,
+				   "timestamp": 3570657237,
+				   "session_id": 2004798115,
+				   "handle_id": 3708519405,
+				   "event": {
+					  "connection": "webrtcup"
+				   }
+				}
+			*/
+			break;
+		case JANUS_EVENT_TYPE_MEDIA:
+			/* This is a media related event. This can contain different
+			 * information about the health of a media session, or about
+			 * what's going on in general (e.g., when Janus started/stopped
+			 * receiving media of a certain type, or (TODO) when some media related
+			 * statistics are available). Here's an example of Janus getting
+			 * video from the peer for the first time, or after a second
+			 * of no video at all (which would have triggered a "receiving": false):
+				{
+				   "type": 32,
+				   "timestamp": 3571078797,
+				   "session_id": 2004798115,
+				   "handle_id": 3708519405,
+				   "event": {
+					  "media": "video",
+					  "receiving": "true"
+				   }
+				}
+			*/
+			break;
+		case JANUS_EVENT_TYPE_PLUGIN:
+			/* This is a plugin related event. Since each plugin may
+			 * provide info in a very custom way, the format of this event
+			 * is in general very dynamic. You'll always find, though,
+			 * an "event" object containing the package name of the
+			 * plugin (e.g., "janus.plugin.echotest") and a "data"
+			 * object that contains whatever the plugin decided to
+			 * notify you about, that will always vary from plugin to
+			 * plugin. Besides, notice that "session_id" and "handle_id"
+			 * may or may not be present: when they are, you'll know
+			 * the event has been triggered within the context of a
+			 * specific handle session with the plugin; when they're
+			 * not, the plugin sent an event out of context of a
+			 * specific session it is handling. Here's an example:
+				{
+				   "type": 64,
+				   "timestamp": 3570336031,
+				   "session_id": 2004798115,
+				   "handle_id": 3708519405,
+				   "event": {
+					  "plugin": "janus.plugin.echotest",
+					  "data": {
+						 "audio_active": "true",
+						 "video_active": "true",
+						 "bitrate": 0
+					  }
+				   }
+				}
+			*/
+			break;
+		case JANUS_EVENT_TYPE_TRANSPORT:
+			/* This is a transport related event (TODO). The syntax of
+			 * the common format (transport specific data aside) is
+			 * exactly the same as that of the plugin related events
+			 * above, with a "transport" property instead of "plugin"
+			 * to contain the transport package name. */
+			break;
+		case JANUS_EVENT_TYPE_CORE:
+			/* This is a core related event. This can contain different
+			 * information about the health of the Janus instance, or
+			 * more generically on some events in the Janus life cycle
+			 * (e.g., when it's just been started or when a shutdown
+			 * has been requested). Considering the heterogeneous nature
+			 * of the information being reported, the content is always
+			 * a JSON object (event). Core events are the only ones
+			 * missing a session_id. Here's an example:
+				{
+				   "type": 256,
+				   "timestamp": 28381185382,
+				   "event": {
+					  "status": "started"
+				   }
+				}
+			*/
+		case JANUS_EVENT_TYPE_EXTERNAL:
+			/* This is an external event, not originated by Janus itself
+			 * or any of its plugins, but from an ad-hoc Admin API request
+			 * instead. As such, the content of the event is not bound to
+			 * any rules (apart from the fact that it needs to be a JSON
+			 * object), but can be whatever the external source thought
+			 * appropriate. In order to facilitare life to recipients, all
+			 * external events must contain a "schema" property, which anyway
+			 * is not bound to any rules either. As an example:
+				{
+				   "type": 4,
+				   "timestamp": 28381185382,
+				   "event": {
+					  "schema": "my.custom.source",
+					  "data": {
+					     "whatever": "youwant"
+					  }
+				   }
+				}
+			*/
+			break;
+		default:
+			JANUS_LOG(LOG_WARN, "Unknown type of event '%d'\n", type);
+			break;
+	}
+}
+
+/* Compress a payload with gzip */
+#ifdef HAVE_ZLIB
+static char *janus_sampleevh_gzip(const char *text, size_t len, size_t *compressed_len) {
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	/* 15+16 as window bits means a gzip header and trailer */
+	if(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return NULL;
+	size_t size = deflateBound(&zs, len);
+	char *buffer = g_malloc(size);
+	zs.next_in = (Bytef *)text;
+	zs.avail_in = len;
+	zs.next_out = (Bytef *)buffer;
+	zs.avail_out = size;
+	int res = deflate(&zs, Z_FINISH);
+	deflateEnd(&zs);
+	if(res != Z_STREAM_END) {
+		g_free(buffer);
+		return NULL;
+	}
+	*compressed_len = zs.total_out;
+	return buffer;
+}
+#endif
+
+/* A POST to the backend, either in flight or waiting to be retransmitted */
+typedef struct janus_sampleevh_request {
+	CURL *curl;
+	struct curl_slist *headers;
+	char *payload;
+	size_t length;
+	gboolean compressed;
+	int retransmit;
+	gint64 retry_at;
+} janus_sampleevh_request;
+
+/* Easy handles are reused, so that connections to the backend are kept alive */
+static GList *idle_handles = NULL;
 
-			/* Since this a simple plugin, it does the same for all events: so just convert to string... */
-			event_text = json_dumps(output, JSON_INDENT(3) | JSON_PRESERVE_ORDER);
+static void janus_sampleevh_request_free(janus_sampleevh_request *request) {
+	if(request == NULL)
+		return;
+	if(request->curl != NULL)
+		idle_handles = g_list_prepend(idle_handles, request->curl);
+	if(request->headers != NULL)
+		curl_slist_free_all(request->headers);
+	g_free(request->payload);
+	g_free(request);
+}
+
+/* Prepare a new request out of the payload (which is stolen) */
+static janus_sampleevh_request *janus_sampleevh_request_new(char *payload, size_t length) {
+	janus_sampleevh_request *request = g_malloc0(sizeof(janus_sampleevh_request));
+	request->payload = payload;
+	request->length = length;
+#ifdef HAVE_ZLIB
+	if(compress_events) {
+		size_t compressed_len = 0;
+		char *compressed = janus_sampleevh_gzip(payload, length, &compressed_len);
+		if(compressed == NULL) {
+			JANUS_LOG(LOG_WARN, "Error compressing events, sending them uncompressed\n");
+		} else {
+			g_free(request->payload);
+			request->payload = compressed;
+			request->length = compressed_len;
+			request->compressed = TRUE;
+		}
+	}
+#endif
+	return request;
+}
+
+/* Add a request to the multi handle (again, if it's a retransmission) */
+static int janus_sampleevh_request_start(CURLM *multi, janus_sampleevh_request *request) {
+	if(request->curl == NULL) {
+		if(idle_handles != NULL) {
+			request->curl = idle_handles->data;
+			idle_handles = g_list_delete_link(idle_handles, idle_handles);
+			curl_easy_reset(request->curl);
+		} else {
+			request->curl = curl_easy_init();
 		}
-		/* Whether we just prepared the event or this is a retransmission, send it via HTTP POST */
-		CURLcode res;
-		struct curl_slist *headers = NULL;
-		CURL *curl = curl_easy_init();
-		if(curl == NULL) {
+		if(request->curl == NULL) {
 			JANUS_LOG(LOG_ERR, "Error initializing CURL context\n");
-			goto done;
+			return -1;
 		}
-		janus_mutex_lock(&evh_mutex);
-		curl_easy_setopt(curl, CURLOPT_URL, backend);
-		/* Any credentials? */
-		if(backend_user != NULL && backend_pwd != NULL) {
-			curl_easy_setopt(curl, CURLOPT_USERNAME, backend_user);
-			curl_easy_setopt(curl, CURLOPT_PASSWORD, backend_pwd);
+	}
+	CURL *curl = request->curl;
+	janus_mutex_lock(&evh_mutex);
+	curl_easy_setopt(curl, CURLOPT_URL, backend);
+	/* Any credentials? */
+	if(backend_user != NULL && backend_pwd != NULL) {
+		curl_easy_setopt(curl, CURLOPT_USERNAME, backend_user);
+		curl_easy_setopt(curl, CURLOPT_PASSWORD, backend_pwd);
+	}
+	janus_mutex_unlock(&evh_mutex);
+	if(request->headers == NULL) {
+		request->headers = curl_slist_append(request->headers, "Accept: application/json");
+		request->headers = curl_slist_append(request->headers, "Content-Type: application/json");
+		request->headers = curl_slist_append(request->headers, "charsets: utf-8");
+		if(request->compressed)
+			request->headers = curl_slist_append(request->headers, "Content-Encoding: gzip");
+	}
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, request->headers);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request->payload);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)request->length);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, janus_sampleehv_write_data);
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, request);
+	/* Don't wait forever (let's say, 10 seconds) */
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
+	if(curl_multi_add_handle(multi, curl) != CURLM_OK) {
+		JANUS_LOG(LOG_ERR, "Error adding CURL context to the multi handle\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* Thread to handle incoming events: events are grouped (if allowed) in
+ * batches, which are sent via HTTP POST using a curl multi handle, so
+ * that more batches can be in flight at the same time, and connections
+ * to the backend are reused: flushing a batch is triggered by its size
+ * (number of events or bytes), or by how long its oldest event waited */
+static void *janus_sampleevh_handler(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining SampleEventHandler handler thread\n");
+	CURLM *multi = curl_multi_init();
+	if(multi == NULL) {
+		JANUS_LOG(LOG_FATAL, "Error initializing CURL multi handle...\n");
+		return NULL;
+	}
+	janus_json_event *event = NULL;
+	GString *output = NULL;
+	int count = 0, in_flight = 0;
+	gint64 batch_start = 0;
+	GList *transfers = NULL, *retransmissions = NULL;
+	gboolean exiting = FALSE;
+	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping) && !exiting) {
+		gint64 now = janus_get_monotonic_time();
+		int max = group_events ? group_max : 1;
+		/* Check if there's any new event to add to the current batch */
+		gboolean flush = (count >= max || (flush_size > 0 && output != NULL && output->len >= flush_size));
+		while(!flush) {
+			if(in_flight == 0) {
+				/* No transfer to take care of, we can wait for events here */
+				event = g_async_queue_timeout_pop(events,
+					(count == 0 && retransmissions == NULL) ? G_USEC_PER_SEC : 10000);
+				now = janus_get_monotonic_time();
+			} else {
+				event = g_async_queue_try_pop(events);
+			}
+			if(event == NULL)
+				break;
+			if(event == &exit_event) {
+				exiting = TRUE;
+				break;
+			}
+			janus_sampleevh_inspect_event(event);
+			/* Since this a simple plugin, it does the same for all events: so just convert
+			 * to string... the serialization is shared with other handlers using the same format */
+			size_t len = 0;
+			const char *text = janus_json_event_text(event, JSON_INDENT(3) | JSON_PRESERVE_ORDER, &len);
+			if(output == NULL) {
+				output = g_string_sized_new(len + 2);
+				if(group_events)
+					g_string_append_c(output, '[');
+				batch_start = now;
+			} else {
+				g_string_append_c(output, ',');
+			}
+			if(text != NULL)
+				g_string_append_len(output, text, len);
+			janus_refcount_decrease(&event->ref);
+			count++;
+			/* Never group more than a maximum number of events or bytes, though */
+			if(count >= max || (flush_size > 0 && output->len >= flush_size))
+				flush = TRUE;
 		}
-		janus_mutex_unlock(&evh_mutex);
-		headers = curl_slist_append(headers, "Accept: application/json");
-		headers = curl_slist_append(headers, "Content-Type: application/json");
-		headers = curl_slist_append(headers, "charsets: utf-8");
-		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, event_text);
-		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, janus_sampleehv_write_data);
-		/* Don't wait forever (let's say, 10 seconds) */
-		curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
-		/* Send the request */
-		res = curl_easy_perform(curl);
-		if(res != CURLE_OK) {
-			JANUS_LOG(LOG_ERR, "Couldn't relay event to the backend: %s\n", curl_easy_strerror(res));
-			if(max_retransmissions > 0) {
-				/* Retransmissions enabled, let's try again */
-				if(retransmit == max_retransmissions) {
-					retransmit = 0;
-					JANUS_LOG(LOG_WARN, "Maximum number of retransmissions reached (%d), event lost...\n", max_retransmissions);
+		if(exiting)
+			break;
+		if(count > 0 && !flush)
+			flush = !group_events || flush_time == 0 || (now - batch_start) >= (gint64)flush_time*1000;
+		/* If the batch is ready and we can send it, do it */
+		if(flush && in_flight < max_in_flight) {
+			if(group_events)
+				g_string_append_c(output, ']');
+			size_t length = output->len;
+			janus_sampleevh_request *request = janus_sampleevh_request_new(g_string_free(output, FALSE), length);
+			output = NULL;
+			count = 0;
+			if(janus_sampleevh_request_start(multi, request) < 0) {
+				JANUS_LOG(LOG_WARN, "Couldn't send events, lost...\n");
+				janus_sampleevh_request_free(request);
+			} else {
+				transfers = g_list_prepend(transfers, request);
+				in_flight++;
+			}
+		}
+		/* Any retransmission due? */
+		GList *temp = retransmissions;
+		while(temp && in_flight < max_in_flight) {
+			janus_sampleevh_request *request = (janus_sampleevh_request *)temp->data;
+			GList *next = temp->next;
+			if(request->retry_at <= now) {
+				retransmissions = g_list_delete_link(retransmissions, temp);
+				if(janus_sampleevh_request_start(multi, request) < 0) {
+					JANUS_LOG(LOG_WARN, "Couldn't retransmit events, lost...\n");
+					janus_sampleevh_request_free(request);
 				} else {
-					int next = retransmissions_backoff * (pow(2, retransmit));
-					JANUS_LOG(LOG_WARN, "Retransmitting event in %d ms...\n", next);
-					g_usleep(next*1000);
-					retransmit++;
+					transfers = g_list_prepend(transfers, request);
+					in_flight++;
 				}
-			} else {
+			}
+			temp = next;
+		}
+		if(in_flight == 0)
+			continue;
+		/* Move the transfers forward, and wait a bit for something to happen */
+		int running = 0;
+		curl_multi_perform(multi, &running);
+		curl_multi_wait(multi, NULL, 0, 10, NULL);
+		curl_multi_perform(multi, &running);
+		/* Check which requests are done */
+		CURLMsg *msg = NULL;
+		int pending = 0;
+		while((msg = curl_multi_info_read(multi, &pending)) != NULL) {
+			if(msg->msg != CURLMSG_DONE)
+				continue;
+			janus_sampleevh_request *request = NULL;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&request);
+			CURLcode res = msg->data.result;
+			curl_multi_remove_handle(multi, msg->easy_handle);
+			in_flight--;
+			if(request == NULL)
+				continue;
+			transfers = g_list_remove(transfers, request);
+			if(res == CURLE_OK) {
+				JANUS_LOG(LOG_DBG, "Event sent!\n");
+				janus_sampleevh_request_free(request);
+				continue;
+			}
+			JANUS_LOG(LOG_ERR, "Couldn't relay event to the backend: %s\n", curl_easy_strerror(res));
+			if(max_retransmissions == 0) {
 				JANUS_LOG(LOG_WARN, "Retransmissions disabled, event lost...\n");
+				janus_sampleevh_request_free(request);
+			} else if(request->retransmit == max_retransmissions) {
+				JANUS_LOG(LOG_WARN, "Maximum number of retransmissions reached (%d), event lost...\n", max_retransmissions);
+				janus_sampleevh_request_free(request);
+			} else {
+				/* Retransmissions enabled, let's try again later */
+				int next = retransmissions_backoff * (pow(2, request->retransmit));
+				JANUS_LOG(LOG_WARN, "Retransmitting event in %d ms...\n", next);
+				request->retransmit++;
+				request->retry_at = janus_get_monotonic_time() + (gint64)next*1000;
+				retransmissions = g_list_append(retransmissions, request);
 			}
-		} else {
-			JANUS_LOG(LOG_DBG, "Event sent!\n");
-			retransmit = 0;
 		}
-done:
-		/* Cleanup */
-		if(curl)
-			curl_easy_cleanup(curl);
-		if(headers)
-			curl_slist_free_all(headers);
-		if(!retransmit)
-			g_free(event_text);
-
-		/* Done, let's unref the event */
-		json_decref(output);
-		output = NULL;
 	}
+	/* Get rid of whatever is left */
+	if(output != NULL)
+		g_string_free(output, TRUE);
+	GList *temp = transfers;
+	while(temp) {
+		janus_sampleevh_request *request = (janus_sampleevh_request *)temp->data;
+		curl_multi_remove_handle(multi, request->curl);
+		temp = temp->next;
+	}
+	g_list_free_full(transfers, (GDestroyNotify)janus_sampleevh_request_free);
+	g_list_free_full(retransmissions, (GDestroyNotify)janus_sampleevh_request_free);
+	curl_multi_cleanup(multi);
+	g_list_free_full(idle_handles, (GDestroyNotify)curl_easy_cleanup);
+	idle_handles = NULL;
 	JANUS_LOG(LOG_VERB, "Leaving SampleEventHandler handler thread\n");
 	return NULL;
 }
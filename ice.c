@@ -15,18 +15,22 @@
  */
 
 #include <ifaddrs.h>
+#include <errno.h>
 #include <poll.h>
 #include <net/if.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <netinet/in.h>
 #include <stun/usages/bind.h>
+#include <stun/usages/ice.h>
 #include <nice/debug.h>
 
 #include "janus.h"
 #include "debug.h"
 #include "ice.h"
+#include "affinity.h"
 #include "turnrest.h"
 #include "sdp.h"
 #include "rtpsrtp.h"
@@ -34,6 +38,23 @@
 #include "apierror.h"
 #include "ip-utils.h"
 #include "events.h"
+#include "metrics.h"
+#include "memory.h"
+#include "trace.h"
+
+#if defined(__linux__) && GLIB_CHECK_VERSION(2, 36, 0)
+#include <sys/eventfd.h>
+#define JANUS_ICE_QUEUE_EVENTFD
+#endif
+#if defined(HAVE_LIBNICE_SELECTED_SOCKET) && defined(HAVE_SENDMMSG)
+#include <netinet/udp.h>
+#define JANUS_ICE_EGRESS_BATCH
+#endif
+#ifdef __linux__
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#define JANUS_ICE_NETLINK
+#endif
 
 /* STUN server/port, if any */
 static char *janus_stun_server = NULL;
@@ -129,33 +150,41 @@ void janus_ice_enable_nat_1_1(void) {
 	nat_1_1_enabled = TRUE;
 }
 
-/* Interface/IP enforce/ignore lists */
-GList *janus_ice_enforce_list = NULL, *janus_ice_ignore_list = NULL;
+/* Interface/IP enforce/ignore lists: values are pre-parsed when added, so
+ * that checking an address doesn't involve any string comparison */
+static janus_network_filter *janus_ice_enforce_list = NULL, *janus_ice_ignore_list = NULL;
 janus_mutex ice_list_mutex;
+static void janus_ice_local_addresses_invalidate(void);
+
+/* Helper to check an interface name or address against one of the lists */
+static gboolean janus_ice_filter_matches(janus_network_filter *filter, const char *ip) {
+	if(janus_network_filter_matches_name(filter, ip))
+		return TRUE;
+	janus_network_address address;
+	if(janus_network_string_to_address(janus_network_query_options_any_ip, ip, &address) == 0 &&
+			janus_network_filter_matches_address(filter, &address))
+		return TRUE;
+	return FALSE;
+}
 
 void janus_ice_enforce_interface(const char *ip) {
 	if(ip == NULL)
 		return;
 	/* Is this an IP or an interface? */
 	janus_mutex_lock(&ice_list_mutex);
-	janus_ice_enforce_list = g_list_append(janus_ice_enforce_list, (gpointer)ip);
+	if(janus_ice_enforce_list == NULL)
+		janus_ice_enforce_list = janus_network_filter_new();
+	janus_network_filter_add(janus_ice_enforce_list, ip);
 	janus_mutex_unlock(&ice_list_mutex);
+	janus_ice_local_addresses_invalidate();
 }
 gboolean janus_ice_is_enforced(const char *ip) {
 	if(ip == NULL || janus_ice_enforce_list == NULL)
 		return false;
 	janus_mutex_lock(&ice_list_mutex);
-	GList *temp = janus_ice_enforce_list;
-	while(temp) {
-		const char *enforced = (const char *)temp->data;
-		if(enforced != NULL && strstr(ip, enforced)) {
-			janus_mutex_unlock(&ice_list_mutex);
-			return true;
-		}
-		temp = temp->next;
-	}
+	gboolean enforced = janus_ice_filter_matches(janus_ice_enforce_list, ip);
 	janus_mutex_unlock(&ice_list_mutex);
-	return false;
+	return enforced;
 }
 
 void janus_ice_ignore_interface(const char *ip) {
@@ -163,27 +192,189 @@ void janus_ice_ignore_interface(const char *ip) {
 		return;
 	/* Is this an IP or an interface? */
 	janus_mutex_lock(&ice_list_mutex);
-	janus_ice_ignore_list = g_list_append(janus_ice_ignore_list, (gpointer)ip);
+	if(janus_ice_ignore_list == NULL)
+		janus_ice_ignore_list = janus_network_filter_new();
+	janus_network_filter_add(janus_ice_ignore_list, ip);
 	if(janus_ice_enforce_list != NULL) {
 		JANUS_LOG(LOG_WARN, "Added %s to the ICE ignore list, but the ICE enforce list is not empty: the ICE ignore list will not be used\n", ip);
 	}
 	janus_mutex_unlock(&ice_list_mutex);
+	janus_ice_local_addresses_invalidate();
 }
 gboolean janus_ice_is_ignored(const char *ip) {
 	if(ip == NULL || janus_ice_ignore_list == NULL)
 		return false;
 	janus_mutex_lock(&ice_list_mutex);
-	GList *temp = janus_ice_ignore_list;
-	while(temp) {
-		const char *ignored = (const char *)temp->data;
-		if(ignored != NULL && strstr(ip, ignored)) {
-			janus_mutex_unlock(&ice_list_mutex);
-			return true;
+	gboolean ignored = janus_ice_filter_matches(janus_ice_ignore_list, ip);
+	janus_mutex_unlock(&ice_list_mutex);
+	return ignored;
+}
+
+/* Local addresses to gather candidates for: rather than enumerating the
+ * interfaces (and checking the enforce/ignore lists) for each new handle,
+ * we cache the list and only refresh it when something changes. On Linux
+ * we're notified of changes via netlink, elsewhere we refresh periodically */
+#define JANUS_ICE_LOCAL_ADDRESSES_TTL	(5*G_USEC_PER_SEC)
+static GArray *janus_ice_local_addresses = NULL;
+static gint64 janus_ice_local_addresses_updated = 0;
+static guint janus_ice_local_addresses_refreshes = 0;
+static volatile gint janus_ice_local_addresses_dirty = 1;
+static int janus_ice_netlink_fd = -1;
+static janus_mutex janus_ice_local_addresses_mutex = JANUS_MUTEX_INITIALIZER;
+static void janus_ice_local_addresses_invalidate(void) {
+	g_atomic_int_set(&janus_ice_local_addresses_dirty, 1);
+}
+#ifdef JANUS_ICE_NETLINK
+static void janus_ice_netlink_open(void) {
+	int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if(fd < 0) {
+		JANUS_LOG(LOG_WARN, "Couldn't create netlink socket (%d, %s), refreshing local addresses periodically\n",
+			errno, strerror(errno));
+		return;
+	}
+	struct sockaddr_nl address;
+	memset(&address, 0, sizeof(address));
+	address.nl_family = AF_NETLINK;
+	address.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+	if(bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		JANUS_LOG(LOG_WARN, "Couldn't bind netlink socket (%d, %s), refreshing local addresses periodically\n",
+			errno, strerror(errno));
+		close(fd);
+		return;
+	}
+	janus_ice_netlink_fd = fd;
+}
+/* Drain the netlink socket: any notification means our cache is stale */
+static gboolean janus_ice_netlink_changed(void) {
+	if(janus_ice_netlink_fd < 0)
+		return FALSE;
+	gboolean changed = FALSE;
+	char buffer[4096];
+	while(TRUE) {
+		ssize_t res = recv(janus_ice_netlink_fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+		if(res > 0) {
+			changed = TRUE;
+			continue;
 		}
-		temp = temp->next;
+		/* If we overflowed the socket buffer, we lost notifications */
+		if(res < 0 && errno == ENOBUFS)
+			changed = TRUE;
+		else if(res < 0 && errno == EINTR)
+			continue;
+		break;
+	}
+	return changed;
+}
+#endif
+/* Enumerate the interfaces again (must be called with the mutex locked) */
+static void janus_ice_local_addresses_refresh(void) {
+	if(janus_ice_local_addresses == NULL)
+		janus_ice_local_addresses = g_array_new(FALSE, FALSE, sizeof(NiceAddress));
+	g_array_set_size(janus_ice_local_addresses, 0);
+	struct ifaddrs *ifaddr, *ifa;
+	int family, n;
+	if(getifaddrs(&ifaddr) == -1) {
+		JANUS_LOG(LOG_ERR, "Error getting list of interfaces...");
+		return;
+	}
+	janus_mutex_lock(&ice_list_mutex);
+	for(ifa = ifaddr, n = 0; ifa != NULL; ifa = ifa->ifa_next, n++) {
+		if(ifa->ifa_addr == NULL)
+			continue;
+		/* Skip interfaces which are not up and running */
+		if (!((ifa->ifa_flags & IFF_UP) && (ifa->ifa_flags & IFF_RUNNING)))
+			continue;
+		/* Skip loopback interfaces */
+		if (ifa->ifa_flags & IFF_LOOPBACK)
+			continue;
+		family = ifa->ifa_addr->sa_family;
+		if(family != AF_INET && family != AF_INET6)
+			continue;
+		/* We only add IPv6 addresses if support for them has been explicitly enabled (still WIP, mostly) */
+		if(family == AF_INET6 && !janus_ipv6_enabled)
+			continue;
+		/* Check the interface name first, we can ignore that as well: enforce list would be checked later */
+		if(janus_ice_enforce_list == NULL && ifa->ifa_name != NULL &&
+				janus_network_filter_matches_name(janus_ice_ignore_list, ifa->ifa_name))
+			continue;
+		janus_network_address address;
+		if(janus_network_address_from_sockaddr(ifa->ifa_addr, &address) != 0)
+			continue;
+		/* Skip 0.0.0.0, :: and local scoped addresses  */
+		if((family == AF_INET && address.ipv4.s_addr == INADDR_ANY) ||
+				(family == AF_INET6 && (IN6_IS_ADDR_UNSPECIFIED(&address.ipv6) || IN6_IS_ADDR_LINKLOCAL(&address.ipv6))))
+			continue;
+		/* Check if this IP address is in the ignore/enforce list, now: the enforce list has the precedence */
+		if(janus_ice_enforce_list != NULL) {
+			if(!janus_network_filter_matches_name(janus_ice_enforce_list, ifa->ifa_name) &&
+					!janus_network_filter_matches_address(janus_ice_enforce_list, &address))
+				continue;
+		} else {
+			if(janus_network_filter_matches_address(janus_ice_ignore_list, &address))
+				continue;
+		}
+		/* Ok, add interface to the list */
+		NiceAddress addr_local;
+		nice_address_init (&addr_local);
+		nice_address_set_from_sockaddr (&addr_local, ifa->ifa_addr);
+		nice_address_set_port (&addr_local, 0);
+		if(!nice_address_is_valid (&addr_local)) {
+			JANUS_LOG(LOG_WARN, "Skipping invalid address on %s\n", ifa->ifa_name);
+			continue;
+		}
+		if(janus_log_level >= LOG_VERB) {
+			char host[NICE_ADDRESS_STRING_LEN];
+			nice_address_to_string(&addr_local, host);
+			JANUS_LOG(LOG_VERB, "Adding %s to the addresses to gather candidates for\n", host);
+		}
+		g_array_append_val(janus_ice_local_addresses, addr_local);
 	}
 	janus_mutex_unlock(&ice_list_mutex);
-	return false;
+	freeifaddrs(ifaddr);
+	janus_ice_local_addresses_refreshes++;
+	janus_ice_local_addresses_updated = janus_get_monotonic_time();
+}
+/* Add all the cached local addresses to an agent, refreshing the cache first if needed */
+/* Must be called with janus_ice_local_addresses_mutex locked */
+static void janus_ice_local_addresses_check(void) {
+	gboolean refresh = g_atomic_int_compare_and_exchange(&janus_ice_local_addresses_dirty, 1, 0);
+#ifdef JANUS_ICE_NETLINK
+	if(janus_ice_netlink_changed())
+		refresh = TRUE;
+	if(janus_ice_netlink_fd < 0 &&
+			janus_get_monotonic_time() - janus_ice_local_addresses_updated > JANUS_ICE_LOCAL_ADDRESSES_TTL)
+		refresh = TRUE;
+#else
+	if(janus_get_monotonic_time() - janus_ice_local_addresses_updated > JANUS_ICE_LOCAL_ADDRESSES_TTL)
+		refresh = TRUE;
+#endif
+	if(refresh || janus_ice_local_addresses == NULL)
+		janus_ice_local_addresses_refresh();
+}
+static guint janus_ice_local_addresses_add(NiceAgent *agent) {
+	janus_mutex_lock(&janus_ice_local_addresses_mutex);
+	janus_ice_local_addresses_check();
+	guint i = 0;
+	for(i=0; i<janus_ice_local_addresses->len; i++)
+		nice_agent_add_local_address(agent, &g_array_index(janus_ice_local_addresses, NiceAddress, i));
+	janus_mutex_unlock(&janus_ice_local_addresses_mutex);
+	return i;
+}
+json_t *janus_ice_local_addresses_info(void) {
+	json_t *info = json_object();
+	janus_mutex_lock(&janus_ice_local_addresses_mutex);
+	json_t *list = json_array();
+	guint i = 0;
+	for(i=0; janus_ice_local_addresses && i<janus_ice_local_addresses->len; i++) {
+		gchar address[NICE_ADDRESS_STRING_LEN];
+		nice_address_to_string(&g_array_index(janus_ice_local_addresses, NiceAddress, i), address);
+		json_array_append_new(list, json_string(address));
+	}
+	json_object_set_new(info, "addresses", list);
+	json_object_set_new(info, "refreshes", json_integer(janus_ice_local_addresses_refreshes));
+	json_object_set_new(info, "netlink", janus_ice_netlink_fd >= 0 ? json_true() : json_false());
+	janus_mutex_unlock(&janus_ice_local_addresses_mutex);
+	return info;
 }
 
 
@@ -197,6 +388,23 @@ int janus_ice_get_event_stats_period(void) {
 }
 
 
+/* DataChannel watermarks: when what's buffered for a peer goes above the high
+ * one, we tell the plugin (data_ready) as soon as it goes below the low one */
+#define JANUS_ICE_DATA_HIGH_WATERMARK	(1024*1024)
+#define JANUS_ICE_DATA_LOW_WATERMARK	(256*1024)
+static int janus_ice_data_high_watermark = JANUS_ICE_DATA_HIGH_WATERMARK;
+static int janus_ice_data_low_watermark = JANUS_ICE_DATA_LOW_WATERMARK;
+void janus_ice_set_data_watermarks(int high, int low) {
+	if(high <= 0)
+		high = JANUS_ICE_DATA_HIGH_WATERMARK;
+	if(low < 0 || low >= high)
+		low = high/4;
+	janus_ice_data_high_watermark = high;
+	janus_ice_data_low_watermark = low;
+	JANUS_LOG(LOG_VERB, "DataChannel watermarks: %d (high), %d (low)\n", high, low);
+}
+
+
 /* RTP/RTCP port range */
 uint16_t rtp_range_min = 0;
 uint16_t rtp_range_max = 0;
@@ -230,9 +438,963 @@ typedef struct janus_ice_queued_packet {
 	gboolean control;
 	gboolean retransmission;
 	gboolean encrypted;
+	/* Whether this is a binary DataChannel message, or a text one */
+	gboolean binary;
+	/* Shared packet to copy data from when sending, if any, and how to modify it */
+	janus_plugin_rtp_shared *shared;
+	janus_plugin_rtp_override override;
+	/* When the packet this originated from was received, and when this was queued (media latency tracking) */
+	gint64 ingress, queued;
+	/* Pool this packet belongs to, if any, and the buffer it owns there */
+	janus_ice_packet_pool *pool;
+	char *pool_buffer;
+	struct janus_ice_queued_packet *next;
 } janus_ice_queued_packet;
-/* This is a static, fake, message we use as a trigger to send a DTLS alert */
-static janus_ice_queued_packet janus_ice_dtls_handshake, janus_ice_dtls_alert;
+/* These are static, fake, messages we use as a trigger to start the DTLS handshake,
+ * send a DTLS alert, or send the DataChannel messages waiting for room in the SCTP buffer */
+static janus_ice_queued_packet janus_ice_dtls_handshake, janus_ice_dtls_alert, janus_ice_data_writable;
+
+/* Pool of outgoing packets: most packets we send fit in a fixed size buffer
+ * (MTU plus room for the SRTP tag and a REMB/RR), so rather than allocating
+ * and freeing the packet and its buffer each time, we recycle them */
+#define JANUS_ICE_PACKET_POOL_BUFFER	(1500+SRTP_MAX_TAG_LEN+4)
+#define JANUS_ICE_PACKET_POOL_MAX		2048
+struct janus_ice_packet_pool {
+	/* Recycled packets, ready to be used again */
+	janus_ice_queued_packet *free;
+	guint available;
+	/* Counters for the Admin API */
+	guint64 hits, misses;
+	guint in_use, high_water;
+	janus_mutex mutex;
+};
+static janus_ice_packet_pool janus_ice_shared_packet_pool = {
+	.free = NULL, .available = 0,
+	.hits = 0, .misses = 0,
+	.in_use = 0, .high_water = 0,
+	.mutex = JANUS_MUTEX_INITIALIZER
+};
+static void janus_ice_packet_pool_init(janus_ice_packet_pool *pool) {
+	memset(pool, 0, sizeof(*pool));
+	janus_mutex_init(&pool->mutex);
+}
+static void janus_ice_packet_pool_clear(janus_ice_packet_pool *pool) {
+	janus_mutex_lock(&pool->mutex);
+	while(pool->free != NULL) {
+		janus_ice_queued_packet *pkt = pool->free;
+		pool->free = pkt->next;
+		g_free(pkt->pool_buffer);
+		g_free(pkt);
+	}
+	pool->available = 0;
+	janus_mutex_unlock(&pool->mutex);
+}
+static void janus_ice_packet_pool_summary(janus_ice_packet_pool *pool, json_t *info) {
+	janus_mutex_lock(&pool->mutex);
+	json_object_set_new(info, "hits", json_integer(pool->hits));
+	json_object_set_new(info, "misses", json_integer(pool->misses));
+	json_object_set_new(info, "in-use", json_integer(pool->in_use));
+	json_object_set_new(info, "available", json_integer(pool->available));
+	json_object_set_new(info, "high-water", json_integer(pool->high_water));
+	janus_mutex_unlock(&pool->mutex);
+}
+/* Copy the content of a shared packet, applying the per-peer changes, if needed */
+static void janus_ice_queued_packet_unshare(janus_ice_queued_packet *pkt) {
+	if(pkt == NULL || pkt->shared == NULL)
+		return;
+	janus_plugin_rtp_shared *shared = pkt->shared;
+	memcpy(pkt->data, shared->buffer, shared->length);
+	pkt->length = shared->length;
+	pkt->shared = NULL;
+	janus_refcount_decrease(&shared->ref);
+	janus_rtp_header *header = (janus_rtp_header *)pkt->data;
+	header->seq_number = htons(pkt->override.seq_number);
+	header->timestamp = htonl(pkt->override.timestamp);
+	if(pkt->override.markerbit >= 0)
+		header->markerbit = pkt->override.markerbit;
+	if(pkt->override.payload_len > 0) {
+		int plen = 0;
+		char *payload = janus_rtp_payload(pkt->data, pkt->length, &plen);
+		if(payload != NULL && pkt->override.payload_offset >= 0 &&
+				pkt->override.payload_offset + pkt->override.payload_len <= plen)
+			memcpy(payload + pkt->override.payload_offset, pkt->override.payload, pkt->override.payload_len);
+	}
+}
+static json_t *janus_ice_static_event_loops_pools_info(void);
+/* Get a packet that can contain at least size bytes, from the pool if possible */
+static janus_ice_queued_packet *janus_ice_queued_packet_new(janus_ice_handle *handle, int size) {
+	janus_ice_packet_pool *pool = (handle && handle->static_loop) ?
+		handle->static_loop->packet_pool : &janus_ice_shared_packet_pool;
+	janus_ice_queued_packet *pkt = NULL;
+	if(size > JANUS_ICE_PACKET_POOL_BUFFER) {
+		/* Too large for the pool (e.g., a big data channel message) */
+		pkt = g_malloc(sizeof(janus_ice_queued_packet));
+		pkt->data = g_malloc(size);
+		pkt->shared = NULL;
+		pkt->ingress = 0;
+		pkt->queued = 0;
+		pkt->pool = NULL;
+		pkt->pool_buffer = NULL;
+		pkt->next = NULL;
+		janus_mutex_lock(&pool->mutex);
+		pool->misses++;
+		janus_mutex_unlock(&pool->mutex);
+		return pkt;
+	}
+	janus_mutex_lock(&pool->mutex);
+	if(pool->free != NULL) {
+		pkt = pool->free;
+		pool->free = pkt->next;
+		pool->available--;
+		pool->hits++;
+	} else {
+		pool->misses++;
+	}
+	pool->in_use++;
+	if(pool->in_use > pool->high_water)
+		pool->high_water = pool->in_use;
+	janus_mutex_unlock(&pool->mutex);
+	if(pkt == NULL) {
+		/* Pool is empty, allocate a new packet that will be recycled later */
+		pkt = g_malloc(sizeof(janus_ice_queued_packet));
+		pkt->pool_buffer = g_malloc(JANUS_ICE_PACKET_POOL_BUFFER);
+	}
+	pkt->shared = NULL;
+	pkt->ingress = 0;
+	pkt->queued = 0;
+	pkt->pool = pool;
+	pkt->data = pkt->pool_buffer;
+	pkt->next = NULL;
+	return pkt;
+}
+json_t *janus_ice_packet_pool_info(void) {
+	json_t *info = json_object();
+	json_object_set_new(info, "buffer-size", json_integer(JANUS_ICE_PACKET_POOL_BUFFER));
+	json_t *shared = json_object();
+	janus_ice_packet_pool_summary(&janus_ice_shared_packet_pool, shared);
+	json_object_set_new(info, "shared", shared);
+	json_t *loops = janus_ice_static_event_loops_pools_info();
+	if(loops != NULL)
+		json_object_set_new(info, "loops", loops);
+	return info;
+}
+
+/* Outgoing packets queue: this is a bounded MPSC ring (each cell has a sequence
+ * number that tells producers and the consumer whether it's free or ready), so
+ * pushing a packet doesn't need any lock. Only items that must be sent first
+ * (DTLS handshake/alert, retransmissions) go in a separate, locked, queue */
+#define JANUS_ICE_QUEUE_SIZE	2048
+/* Maximum number of packets we send per dispatch, to avoid starving other sources */
+#define JANUS_ICE_QUEUE_BATCH	64
+static janus_ice_queue *janus_ice_queue_create(void) {
+	janus_ice_queue *queue = g_malloc0(sizeof(janus_ice_queue));
+	queue->cells = g_malloc0(JANUS_ICE_QUEUE_SIZE * sizeof(janus_ice_queue_cell));
+	queue->mask = JANUS_ICE_QUEUE_SIZE-1;
+	guint i = 0;
+	for(i=0; i<JANUS_ICE_QUEUE_SIZE; i++)
+		queue->cells[i].seq = (gint)i;
+	queue->priority = g_queue_new();
+	janus_mutex_init(&queue->mutex);
+	queue->efd = -1;
+#ifdef JANUS_ICE_QUEUE_EVENTFD
+	queue->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(queue->efd < 0) {
+		JANUS_LOG(LOG_WARN, "Error creating eventfd for the outgoing queue (%d, %s), falling back to context wakeups\n",
+			errno, strerror(errno));
+	}
+#endif
+	return queue;
+}
+/* Memory a handle holds in itself and its queues, for accounting purposes */
+static gint64 janus_ice_handle_memory(janus_ice_handle *handle) {
+	gint64 queue = sizeof(janus_ice_queue) + JANUS_ICE_QUEUE_SIZE * sizeof(janus_ice_queue_cell);
+	return sizeof(janus_ice_handle) + (handle->queued_packets ? queue : 0) + (handle->mux_incoming ? queue : 0);
+}
+static void janus_ice_queue_destroy(janus_ice_queue *queue) {
+	if(queue == NULL)
+		return;
+	if(queue->efd >= 0)
+		close(queue->efd);
+	g_queue_free(queue->priority);
+	g_free(queue->cells);
+	g_free(queue);
+}
+/* Only notify the loop if it hasn't been notified already since the last drain */
+static void janus_ice_queue_signal(janus_ice_queue *queue, GMainContext *ctx) {
+	if(!g_atomic_int_compare_and_exchange(&queue->signalled, 0, 1))
+		return;
+	if(queue->efd >= 0) {
+		uint64_t one = 1;
+		if(write(queue->efd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+			JANUS_LOG(LOG_WARN, "Error signalling the outgoing queue (%d, %s)\n", errno, strerror(errno));
+		}
+	} else if(ctx != NULL) {
+		g_main_context_wakeup(ctx);
+	}
+}
+/* Called by the loop before draining: any packet queued after this will signal again */
+static void janus_ice_queue_reset_signal(janus_ice_queue *queue) {
+	if(queue->efd >= 0) {
+		uint64_t count = 0;
+		if(read(queue->efd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+			JANUS_LOG(LOG_WARN, "Error reading the outgoing queue eventfd (%d, %s)\n", errno, strerror(errno));
+		}
+	}
+	g_atomic_int_set(&queue->signalled, 0);
+}
+static gboolean janus_ice_queue_push(janus_ice_queue *queue, gpointer data) {
+	janus_ice_queue_cell *cell = NULL;
+	guint pos = (guint)g_atomic_int_get(&queue->tail);
+	while(TRUE) {
+		cell = &queue->cells[pos & queue->mask];
+		guint seq = (guint)g_atomic_int_get(&cell->seq);
+		gint diff = (gint)(seq - pos);
+		if(diff == 0) {
+			/* The cell is free, try to claim it */
+			if(g_atomic_int_compare_and_exchange(&queue->tail, (gint)pos, (gint)(pos+1)))
+				break;
+		} else if(diff < 0) {
+			/* The consumer didn't get to this cell yet: the queue is full */
+			return FALSE;
+		}
+		pos = (guint)g_atomic_int_get(&queue->tail);
+	}
+	cell->data = data;
+	/* Publish the item to the consumer */
+	g_atomic_int_set(&cell->seq, (gint)(pos+1));
+	return TRUE;
+}
+static void janus_ice_queue_push_priority(janus_ice_queue *queue, gpointer data) {
+	janus_mutex_lock(&queue->mutex);
+	g_queue_push_head(queue->priority, data);
+	g_atomic_int_inc(&queue->priority_count);
+	janus_mutex_unlock(&queue->mutex);
+}
+/* Only the handle loop pops packets, so there's no contention on the head */
+static gpointer janus_ice_queue_pop(janus_ice_queue *queue) {
+	gpointer data = NULL;
+	if(g_atomic_int_get(&queue->priority_count) > 0) {
+		janus_mutex_lock(&queue->mutex);
+		data = g_queue_pop_head(queue->priority);
+		if(data != NULL)
+			g_atomic_int_dec_and_test(&queue->priority_count);
+		janus_mutex_unlock(&queue->mutex);
+		if(data != NULL)
+			return data;
+	}
+	guint pos = (guint)queue->head;
+	janus_ice_queue_cell *cell = &queue->cells[pos & queue->mask];
+	guint seq = (guint)g_atomic_int_get(&cell->seq);
+	if((gint)(seq - (pos+1)) < 0) {
+		/* Empty, or the producer that claimed this cell hasn't published it yet
+		 * (in which case it will signal us as soon as it's done) */
+		return NULL;
+	}
+	data = cell->data;
+	cell->data = NULL;
+	/* Make the cell available again for the next round */
+	g_atomic_int_set(&cell->seq, (gint)(pos + queue->mask + 1));
+	g_atomic_int_set(&queue->head, (gint)(pos+1));
+	return data;
+}
+guint janus_ice_queue_length(janus_ice_queue *queue) {
+	if(queue == NULL)
+		return 0;
+	/* Read the head first, so that the tail is never behind it */
+	guint head = (guint)g_atomic_int_get(&queue->head);
+	guint tail = (guint)g_atomic_int_get(&queue->tail);
+	return (tail - head) + g_atomic_int_get(&queue->priority_count);
+}
+int janus_ice_handle_queue_usage(janus_ice_handle *handle) {
+	if(handle == NULL || g_atomic_int_get(&handle->destroyed) ||
+			janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_CLEANING) ||
+			!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY))
+		return -1;
+	/* The queue is only destroyed when the handle is freed, so a reference is enough */
+	janus_refcount_increase(&handle->ref);
+	int usage = -1;
+	janus_ice_queue *queue = handle->queued_packets;
+	if(queue != NULL) {
+		guint length = janus_ice_queue_length(queue);
+		guint size = queue->mask + 1;
+		usage = length >= size ? 100 : (int)((length*100)/size);
+	}
+	janus_refcount_decrease(&handle->ref);
+	return usage;
+}
+
+/* ICE-Lite multiplexing: rather than having each handle bind its own port(s),
+ * all handles share the same UDP port (optionally on multiple SO_REUSEPORT
+ * sockets, each served by its own thread). Connectivity checks are answered
+ * here, and matched to handles by the local username fragment; the address
+ * they're nominated from is then used to route all the other packets */
+#define JANUS_ICE_MUX_MAX_SOCKETS	32
+#define JANUS_ICE_MUX_BUFFER		65536
+/* Maximum number of packets we pass to a handle per dispatch */
+#define JANUS_ICE_MUX_BATCH			64
+struct janus_ice_mux_socket {
+	/* Index of the socket */
+	int id;
+	/* The socket itself */
+	int fd;
+	/* Thread receiving on the socket */
+	GThread *thread;
+	/* Tie-breaker used for connectivity check responses */
+	guint64 tie;
+	/* Addresses nominated on this socket, mapped to handles (each holds a reference) */
+	GHashTable *addresses;
+	janus_mutex mutex;
+	/* Statistics (only updated by the socket thread) */
+	guint64 packets, bytes, checks, dropped;
+};
+static uint16_t janus_ice_mux_port = 0;
+static int janus_ice_mux_sockets_count = 1;
+static janus_ice_mux_socket *janus_ice_mux_sockets = NULL;
+static volatile gint janus_ice_mux_stopping = 0;
+/* Local username fragments of all handles (each holds a reference) */
+typedef struct janus_ice_mux_credentials {
+	janus_ice_handle *handle;
+	gchar *ufrag;
+	gchar *pwd;
+} janus_ice_mux_credentials;
+static GHashTable *janus_ice_mux_credentials_table = NULL;
+static janus_mutex janus_ice_mux_credentials_mutex = JANUS_MUTEX_INITIALIZER;
+static void janus_ice_mux_credentials_free(janus_ice_mux_credentials *c) {
+	janus_refcount_decrease(&c->handle->ref);
+	g_free(c->ufrag);
+	g_free(c->pwd);
+	g_free(c);
+}
+/* Address of a peer, used as a key in the sockets tables */
+typedef struct janus_ice_mux_address {
+	struct sockaddr_storage addr;
+	socklen_t len;
+} janus_ice_mux_address;
+static guint janus_ice_mux_address_hash(gconstpointer key) {
+	const struct sockaddr_storage *addr = &((const janus_ice_mux_address *)key)->addr;
+	if(addr->ss_family == AF_INET) {
+		const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+		return in->sin_addr.s_addr ^ ((guint)in->sin_port << 16);
+	} else if(addr->ss_family == AF_INET6) {
+		const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)addr;
+		guint32 a[4];
+		memcpy(a, &in6->sin6_addr, sizeof(a));
+		return a[0] ^ a[1] ^ a[2] ^ a[3] ^ ((guint)in6->sin6_port << 16);
+	}
+	return 0;
+}
+static gboolean janus_ice_mux_address_equal(gconstpointer a, gconstpointer b) {
+	const struct sockaddr_storage *first = &((const janus_ice_mux_address *)a)->addr;
+	const struct sockaddr_storage *second = &((const janus_ice_mux_address *)b)->addr;
+	if(first->ss_family != second->ss_family)
+		return FALSE;
+	if(first->ss_family == AF_INET) {
+		const struct sockaddr_in *f = (const struct sockaddr_in *)first, *s = (const struct sockaddr_in *)second;
+		return f->sin_port == s->sin_port && f->sin_addr.s_addr == s->sin_addr.s_addr;
+	} else if(first->ss_family == AF_INET6) {
+		const struct sockaddr_in6 *f = (const struct sockaddr_in6 *)first, *s = (const struct sockaddr_in6 *)second;
+		return f->sin6_port == s->sin6_port && !memcmp(&f->sin6_addr, &s->sin6_addr, sizeof(f->sin6_addr));
+	}
+	return FALSE;
+}
+/* Packet (or nomination) received on a shared socket, to be processed in the handle loop */
+struct janus_ice_mux_packet {
+	janus_ice_mux_socket *socket;
+	/* If TRUE, this is not a packet, but a notification that the peer nominated an address */
+	gboolean nominated;
+	janus_ice_mux_address address;
+	guint length;
+	char data[];
+};
+
+void janus_ice_set_lite_mux(uint16_t port, int sockets) {
+	janus_ice_mux_port = port;
+	if(sockets < 1)
+		sockets = 1;
+	if(sockets > JANUS_ICE_MUX_MAX_SOCKETS) {
+		JANUS_LOG(LOG_WARN, "Too many ICE-Lite multiplexing sockets (%d), using %d\n", sockets, JANUS_ICE_MUX_MAX_SOCKETS);
+		sockets = JANUS_ICE_MUX_MAX_SOCKETS;
+	}
+	janus_ice_mux_sockets_count = sockets;
+}
+gboolean janus_ice_is_lite_mux_enabled(void) {
+	return janus_ice_mux_port > 0;
+}
+json_t *janus_ice_lite_mux_info(void) {
+	if(janus_ice_mux_port == 0)
+		return NULL;
+	json_t *info = json_object();
+	json_object_set_new(info, "port", json_integer(janus_ice_mux_port));
+	janus_mutex_lock(&janus_ice_mux_credentials_mutex);
+	json_object_set_new(info, "credentials", json_integer(janus_ice_mux_credentials_table ?
+		g_hash_table_size(janus_ice_mux_credentials_table) : 0));
+	janus_mutex_unlock(&janus_ice_mux_credentials_mutex);
+	json_t *list = json_array();
+	int i = 0;
+	for(i=0; janus_ice_mux_sockets && i<janus_ice_mux_sockets_count; i++) {
+		janus_ice_mux_socket *ms = &janus_ice_mux_sockets[i];
+		json_t *sock = json_object();
+		json_object_set_new(sock, "id", json_integer(ms->id));
+		janus_mutex_lock(&ms->mutex);
+		json_object_set_new(sock, "addresses", json_integer(g_hash_table_size(ms->addresses)));
+		janus_mutex_unlock(&ms->mutex);
+		json_object_set_new(sock, "packets", json_integer(ms->packets));
+		json_object_set_new(sock, "bytes", json_integer(ms->bytes));
+		json_object_set_new(sock, "checks", json_integer(ms->checks));
+		json_object_set_new(sock, "dropped", json_integer(ms->dropped));
+		json_array_append_new(list, sock);
+	}
+	json_object_set_new(info, "sockets", list);
+	return info;
+}
+
+/* Make the local credentials of a handle known to the shared sockets */
+static void janus_ice_mux_register(janus_ice_handle *handle) {
+	int attempt = 0;
+	for(attempt=0; attempt<3; attempt++) {
+		gchar *ufrag = NULL, *pwd = NULL;
+		if(!nice_agent_get_local_credentials(handle->agent, handle->stream_id, &ufrag, &pwd)) {
+			JANUS_LOG(LOG_ERR, "[%"SCNu64"] Couldn't get the local ICE credentials, connectivity checks will fail\n", handle->handle_id);
+			return;
+		}
+		janus_mutex_lock(&janus_ice_mux_credentials_mutex);
+		if(!g_hash_table_contains(janus_ice_mux_credentials_table, ufrag)) {
+			janus_ice_mux_credentials *c = g_malloc(sizeof(janus_ice_mux_credentials));
+			janus_refcount_increase(&handle->ref);
+			c->handle = handle;
+			c->ufrag = ufrag;
+			c->pwd = pwd;
+			g_hash_table_insert(janus_ice_mux_credentials_table, c->ufrag, c);
+			janus_mutex_unlock(&janus_ice_mux_credentials_mutex);
+			return;
+		}
+		janus_mutex_unlock(&janus_ice_mux_credentials_mutex);
+		/* The username fragment is already taken by another handle: since
+		 * we haven't sent an SDP yet, restarting ICE is enough to get new ones */
+		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Local ICE ufrag %s already in use, regenerating credentials\n", handle->handle_id, ufrag);
+		g_free(ufrag);
+		g_free(pwd);
+		nice_agent_restart(handle->agent);
+	}
+	JANUS_LOG(LOG_ERR, "[%"SCNu64"] Couldn't get unique local ICE credentials, connectivity checks will fail\n", handle->handle_id);
+}
+/* Stop routing packets to a handle: references are released after the
+ * locks, as this may be the last one for the handle */
+static void janus_ice_mux_unregister(janus_ice_handle *handle) {
+	if(janus_ice_mux_port == 0 || janus_ice_mux_sockets == NULL)
+		return;
+	GSList *credentials = NULL;
+	GHashTableIter iter;
+	gpointer key = NULL, value = NULL;
+	janus_mutex_lock(&janus_ice_mux_credentials_mutex);
+	g_hash_table_iter_init(&iter, janus_ice_mux_credentials_table);
+	while(g_hash_table_iter_next(&iter, &key, &value)) {
+		janus_ice_mux_credentials *c = (janus_ice_mux_credentials *)value;
+		if(c->handle != handle)
+			continue;
+		g_hash_table_iter_steal(&iter);
+		credentials = g_slist_prepend(credentials, c);
+	}
+	janus_mutex_unlock(&janus_ice_mux_credentials_mutex);
+	g_slist_free_full(credentials, (GDestroyNotify)janus_ice_mux_credentials_free);
+	int i = 0;
+	for(i=0; i<janus_ice_mux_sockets_count; i++) {
+		janus_ice_mux_socket *ms = &janus_ice_mux_sockets[i];
+		guint removed = 0;
+		janus_mutex_lock(&ms->mutex);
+		g_hash_table_iter_init(&iter, ms->addresses);
+		while(g_hash_table_iter_next(&iter, &key, &value)) {
+			if(value != handle)
+				continue;
+			g_hash_table_iter_steal(&iter);
+			g_free(key);
+			removed++;
+		}
+		janus_mutex_unlock(&ms->mutex);
+		while(removed > 0) {
+			janus_refcount_decrease(&handle->ref);
+			removed--;
+		}
+	}
+}
+
+/* Pass a packet to the handle loop */
+static void janus_ice_mux_push(janus_ice_mux_socket *ms, janus_ice_handle *handle, janus_ice_mux_packet *pkt) {
+	if(handle->mux_incoming == NULL || janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT)) {
+		g_free(pkt);
+		ms->dropped++;
+		return;
+	}
+	if(pkt->nominated) {
+		/* Nominations must never be dropped */
+		janus_ice_queue_push_priority(handle->mux_incoming, pkt);
+	} else if(!janus_ice_queue_push(handle->mux_incoming, pkt)) {
+		/* The loop can't keep up, drop the packet */
+		g_free(pkt);
+		ms->dropped++;
+		return;
+	}
+	/* Without an eventfd we wake the loop up via its context, which goes
+	 * away when the PeerConnection is freed: our reference is to the
+	 * handle, so get one to the context as well, in case we need it */
+	GMainContext *ctx = NULL;
+	if(handle->mux_incoming->efd < 0) {
+		janus_mutex_lock(&handle->mutex);
+		if(handle->icectx != NULL)
+			ctx = g_main_context_ref(handle->icectx);
+		janus_mutex_unlock(&handle->mutex);
+	}
+	janus_ice_queue_signal(handle->mux_incoming, ctx);
+	if(ctx != NULL)
+		g_main_context_unref(ctx);
+}
+
+/* Connectivity checks */
+static const uint16_t janus_ice_mux_stun_attributes[] = {
+	STUN_ATTRIBUTE_USERNAME,
+	STUN_ATTRIBUTE_MESSAGE_INTEGRITY,
+	STUN_ATTRIBUTE_FINGERPRINT,
+	STUN_ATTRIBUTE_PRIORITY,
+	STUN_ATTRIBUTE_USE_CANDIDATE,
+	STUN_ATTRIBUTE_ICE_CONTROLLED,
+	STUN_ATTRIBUTE_ICE_CONTROLLING,
+	0
+};
+typedef struct janus_ice_mux_check {
+	janus_ice_handle *handle;
+	uint8_t pwd[256];
+	size_t pwd_len;
+} janus_ice_mux_check;
+static gboolean janus_ice_mux_is_stun(const char *buf, ssize_t len) {
+	/* RFC 5389: first two bits set to zero, and the magic cookie */
+	if(len < 20 || (buf[0] & 0xC0) != 0)
+		return FALSE;
+	uint32_t cookie = 0;
+	memcpy(&cookie, buf+4, sizeof(cookie));
+	return ntohl(cookie) == 0x2112A442;
+}
+static bool janus_ice_mux_stun_validater(StunAgent *agent, StunMessage *message,
+		uint8_t *username, uint16_t username_len, uint8_t **password, size_t *password_len, void *user_data) {
+	janus_ice_mux_check *check = (janus_ice_mux_check *)user_data;
+	/* The username is made of our own ufrag, a colon, and the ufrag of the peer */
+	uint16_t ufrag_len = 0;
+	while(ufrag_len < username_len && username[ufrag_len] != ':')
+		ufrag_len++;
+	if(ufrag_len == 0 || ufrag_len >= 256)
+		return false;
+	char ufrag[256];
+	memcpy(ufrag, username, ufrag_len);
+	ufrag[ufrag_len] = '\0';
+	gboolean found = FALSE;
+	janus_mutex_lock(&janus_ice_mux_credentials_mutex);
+	janus_ice_mux_credentials *c = g_hash_table_lookup(janus_ice_mux_credentials_table, ufrag);
+	if(c != NULL) {
+		size_t len = strlen(c->pwd);
+		if(len > sizeof(check->pwd))
+			len = sizeof(check->pwd);
+		memcpy(check->pwd, c->pwd, len);
+		check->pwd_len = len;
+		if(check->handle == NULL) {
+			check->handle = c->handle;
+			janus_refcount_increase(&check->handle->ref);
+		}
+		found = TRUE;
+	}
+	janus_mutex_unlock(&janus_ice_mux_credentials_mutex);
+	if(!found)
+		return false;
+	*password = check->pwd;
+	*password_len = check->pwd_len;
+	return true;
+}
+static void janus_ice_mux_handle_stun(janus_ice_mux_socket *ms, StunAgent *agent, char *buf, ssize_t len, janus_ice_mux_address *from) {
+	ms->checks++;
+	janus_ice_mux_check check;
+	memset(&check, 0, sizeof(check));
+	StunMessage req;
+	StunValidationStatus status = stun_agent_validate(agent, &req, (uint8_t *)buf, len, janus_ice_mux_stun_validater, &check);
+	janus_ice_handle *handle = check.handle;
+	if(status != STUN_VALIDATION_SUCCESS || handle == NULL ||
+			stun_message_get_class(&req) != STUN_REQUEST || stun_message_get_method(&req) != STUN_BINDING ||
+			janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT)) {
+		/* Not a connectivity check for any of our handles */
+		JANUS_LOG(LOG_HUGE, "[mux#%d] Dropping STUN message (validation: %d)\n", ms->id, status);
+		ms->dropped++;
+		if(handle != NULL)
+			janus_refcount_decrease(&handle->ref);
+		return;
+	}
+	/* We're ICE-Lite, so we're always controlled */
+	uint8_t rbuf[1280];
+	size_t rlen = sizeof(rbuf);
+	StunMessage resp;
+	bool control = false;
+	StunUsageIceReturn ret = stun_usage_ice_conncheck_create_reply(agent, &req, &resp, rbuf, &rlen,
+		&from->addr, from->len, &control, ms->tie, STUN_USAGE_ICE_COMPATIBILITY_RFC5245);
+	if((ret == STUN_USAGE_ICE_RETURN_SUCCESS || ret == STUN_USAGE_ICE_RETURN_ROLE_CONFLICT) && rlen > 0) {
+		if(sendto(ms->fd, rbuf, rlen, 0, (struct sockaddr *)&from->addr, from->len) < 0) {
+			JANUS_LOG(LOG_WARN, "[%"SCNu64"] [mux#%d] Error sending connectivity check response (%d, %s)\n",
+				handle->handle_id, ms->id, errno, strerror(errno));
+		}
+	}
+	if(ret == STUN_USAGE_ICE_RETURN_SUCCESS && stun_usage_ice_conncheck_use_candidate(&req)) {
+		/* The peer nominated this address: route its packets to this handle from now on */
+		janus_ice_handle *prev = NULL;
+		gboolean nominated = FALSE;
+		janus_mutex_lock(&ms->mutex);
+		gpointer key = NULL, value = NULL;
+		if(g_hash_table_lookup_extended(ms->addresses, from, &key, &value)) {
+			prev = (janus_ice_handle *)value;
+			if(prev != handle) {
+				g_hash_table_steal(ms->addresses, from);
+				g_free(key);
+			}
+		}
+		if(prev != handle) {
+			janus_ice_mux_address *address = g_malloc(sizeof(janus_ice_mux_address));
+			memcpy(address, from, sizeof(janus_ice_mux_address));
+			janus_refcount_increase(&handle->ref);
+			g_hash_table_insert(ms->addresses, address, handle);
+			nominated = TRUE;
+		}
+		janus_mutex_unlock(&ms->mutex);
+		if(prev != NULL && prev != handle)
+			janus_refcount_decrease(&prev->ref);
+		if(nominated) {
+			janus_ice_mux_packet *pkt = g_malloc(sizeof(janus_ice_mux_packet));
+			pkt->socket = ms;
+			pkt->nominated = TRUE;
+			memcpy(&pkt->address, from, sizeof(janus_ice_mux_address));
+			pkt->length = 0;
+			janus_ice_mux_push(ms, handle, pkt);
+		}
+	}
+	janus_refcount_decrease(&handle->ref);
+}
+static void janus_ice_mux_handle_packet(janus_ice_mux_socket *ms, char *buf, ssize_t len, janus_ice_mux_address *from) {
+	janus_mutex_lock(&ms->mutex);
+	janus_ice_handle *handle = g_hash_table_lookup(ms->addresses, from);
+	if(handle != NULL)
+		janus_refcount_increase(&handle->ref);
+	janus_mutex_unlock(&ms->mutex);
+	if(handle == NULL) {
+		/* Not from a nominated address */
+		ms->dropped++;
+		return;
+	}
+	janus_ice_mux_packet *pkt = g_malloc(sizeof(janus_ice_mux_packet) + len);
+	pkt->socket = ms;
+	pkt->nominated = FALSE;
+	pkt->length = len;
+	memcpy(pkt->data, buf, len);
+	janus_ice_mux_push(ms, handle, pkt);
+	janus_refcount_decrease(&handle->ref);
+}
+static void *janus_ice_mux_thread(void *data) {
+	janus_ice_mux_socket *ms = (janus_ice_mux_socket *)data;
+	JANUS_LOG(LOG_VERB, "[mux#%d] ICE-Lite multiplexing thread started\n", ms->id);
+	/* If there's an affinity policy, this is media traffic too */
+	if(janus_affinity_is_enabled(janus_affinity_pool_media))
+		janus_affinity_pin_pool(janus_affinity_pool_media, -1);
+	StunAgent agent;
+	stun_agent_init(&agent, janus_ice_mux_stun_attributes, STUN_COMPATIBILITY_RFC5389,
+		STUN_AGENT_USAGE_SHORT_TERM_CREDENTIALS | STUN_AGENT_USAGE_USE_FINGERPRINT);
+	char *buffer = g_malloc(JANUS_ICE_MUX_BUFFER);
+	janus_ice_mux_address from;
+	struct pollfd fds[1];
+	while(!g_atomic_int_get(&janus_ice_mux_stopping)) {
+		fds[0].fd = ms->fd;
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		int res = poll(fds, 1, 200);
+		if(res < 0) {
+			if(errno == EINTR)
+				continue;
+			JANUS_LOG(LOG_ERR, "[mux#%d] Error polling the socket (%d, %s)\n", ms->id, errno, strerror(errno));
+			break;
+		}
+		if(res == 0)
+			continue;
+		/* Read everything that's available, without blocking */
+		while(TRUE) {
+			from.len = sizeof(from.addr);
+			ssize_t len = recvfrom(ms->fd, buffer, JANUS_ICE_MUX_BUFFER, MSG_DONTWAIT, (struct sockaddr *)&from.addr, &from.len);
+			if(len < 0) {
+				if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+					JANUS_LOG(LOG_WARN, "[mux#%d] Error receiving on the socket (%d, %s)\n", ms->id, errno, strerror(errno));
+				break;
+			}
+			if(len == 0)
+				continue;
+			ms->packets++;
+			ms->bytes += len;
+			if(janus_ice_mux_is_stun(buffer, len))
+				janus_ice_mux_handle_stun(ms, &agent, buffer, len, &from);
+			else
+				janus_ice_mux_handle_packet(ms, buffer, len, &from);
+		}
+	}
+	g_free(buffer);
+	JANUS_LOG(LOG_VERB, "[mux#%d] ICE-Lite multiplexing thread leaving\n", ms->id);
+	return NULL;
+}
+static int janus_ice_mux_socket_open(int family) {
+	int fd = socket(family, SOCK_DGRAM, IPPROTO_UDP);
+	if(fd < 0)
+		return -1;
+	int yes = 1, no = 0;
+	if(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) < 0) {
+		JANUS_LOG(LOG_WARN, "Error setting SO_REUSEADDR on the ICE-Lite multiplexing socket (%d, %s)\n", errno, strerror(errno));
+	}
+#ifdef SO_REUSEPORT
+	if(janus_ice_mux_sockets_count > 1 && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) < 0) {
+		JANUS_LOG(LOG_ERR, "Error setting SO_REUSEPORT on the ICE-Lite multiplexing socket (%d, %s)\n", errno, strerror(errno));
+		close(fd);
+		return -1;
+	}
+#endif
+	/* All the media goes through this socket, use larger buffers */
+	int size = 4*1024*1024;
+	(void)setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	(void)setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	int res = 0;
+	if(family == AF_INET6) {
+		/* Use a dual-stack socket, IPv4 peers will show up as IPv4-mapped addresses */
+		(void)setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no));
+		struct sockaddr_in6 address;
+		memset(&address, 0, sizeof(address));
+		address.sin6_family = AF_INET6;
+		address.sin6_port = htons(janus_ice_mux_port);
+		address.sin6_addr = in6addr_any;
+		res = bind(fd, (struct sockaddr *)&address, sizeof(address));
+	} else {
+		struct sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_port = htons(janus_ice_mux_port);
+		address.sin_addr.s_addr = INADDR_ANY;
+		res = bind(fd, (struct sockaddr *)&address, sizeof(address));
+	}
+	if(res < 0) {
+		JANUS_LOG(LOG_ERR, "Error binding the ICE-Lite multiplexing socket to port %"SCNu16" (%d, %s)\n",
+			janus_ice_mux_port, errno, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+static void janus_ice_mux_start(void) {
+#ifndef SO_REUSEPORT
+	if(janus_ice_mux_sockets_count > 1) {
+		JANUS_LOG(LOG_WARN, "SO_REUSEPORT unavailable, using a single ICE-Lite multiplexing socket\n");
+		janus_ice_mux_sockets_count = 1;
+	}
+#endif
+	janus_ice_mux_credentials_table = g_hash_table_new(g_str_hash, g_str_equal);
+	janus_ice_mux_sockets = g_malloc0(janus_ice_mux_sockets_count * sizeof(janus_ice_mux_socket));
+	g_atomic_int_set(&janus_ice_mux_stopping, 0);
+	int i = 0;
+	for(i=0; i<janus_ice_mux_sockets_count; i++) {
+		janus_ice_mux_socket *ms = &janus_ice_mux_sockets[i];
+		ms->id = i;
+		ms->fd = -1;
+		if(janus_ipv6_enabled)
+			ms->fd = janus_ice_mux_socket_open(AF_INET6);
+		if(ms->fd < 0)
+			ms->fd = janus_ice_mux_socket_open(AF_INET);
+		if(ms->fd < 0)
+			break;
+		ms->tie = janus_random_uint64();
+		ms->addresses = g_hash_table_new(janus_ice_mux_address_hash, janus_ice_mux_address_equal);
+		janus_mutex_init(&ms->mutex);
+		GError *error = NULL;
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "icemux %d", ms->id);
+		ms->thread = g_thread_try_new(tname, &janus_ice_mux_thread, ms, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the ICE-Lite multiplexing thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			close(ms->fd);
+			g_hash_table_destroy(ms->addresses);
+			break;
+		}
+	}
+	if(i == 0) {
+		JANUS_LOG(LOG_ERR, "Couldn't create any ICE-Lite multiplexing socket, falling back to one port per handle\n");
+		g_free(janus_ice_mux_sockets);
+		janus_ice_mux_sockets = NULL;
+		g_hash_table_destroy(janus_ice_mux_credentials_table);
+		janus_ice_mux_credentials_table = NULL;
+		janus_ice_mux_port = 0;
+		return;
+	}
+	janus_ice_mux_sockets_count = i;
+	JANUS_LOG(LOG_INFO, "ICE-Lite multiplexing enabled on port %"SCNu16" (%d socket%s)\n",
+		janus_ice_mux_port, janus_ice_mux_sockets_count, janus_ice_mux_sockets_count == 1 ? "" : "s");
+}
+static void janus_ice_mux_stop(void) {
+	if(janus_ice_mux_sockets == NULL)
+		return;
+	g_atomic_int_set(&janus_ice_mux_stopping, 1);
+	int i = 0;
+	for(i=0; i<janus_ice_mux_sockets_count; i++) {
+		janus_ice_mux_socket *ms = &janus_ice_mux_sockets[i];
+		if(ms->thread != NULL)
+			g_thread_join(ms->thread);
+		close(ms->fd);
+		GHashTableIter iter;
+		gpointer key = NULL, value = NULL;
+		g_hash_table_iter_init(&iter, ms->addresses);
+		while(g_hash_table_iter_next(&iter, &key, &value)) {
+			janus_ice_handle *handle = (janus_ice_handle *)value;
+			g_hash_table_iter_steal(&iter);
+			g_free(key);
+			janus_refcount_decrease(&handle->ref);
+		}
+		g_hash_table_destroy(ms->addresses);
+	}
+	g_free(janus_ice_mux_sockets);
+	janus_ice_mux_sockets = NULL;
+	janus_mutex_lock(&janus_ice_mux_credentials_mutex);
+	GList *credentials = g_hash_table_get_values(janus_ice_mux_credentials_table);
+	g_hash_table_destroy(janus_ice_mux_credentials_table);
+	janus_ice_mux_credentials_table = NULL;
+	janus_mutex_unlock(&janus_ice_mux_credentials_mutex);
+	g_list_free_full(credentials, (GDestroyNotify)janus_ice_mux_credentials_free);
+}
+
+/* Custom GSource passing the packets received on the shared sockets to the handle */
+typedef struct janus_ice_mux_source {
+	GSource parent;
+	/* No reference here, as the source is always destroyed in janus_ice_webrtc_free */
+	janus_ice_handle *handle;
+} janus_ice_mux_source;
+static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint component_id, guint len, gchar *buf, gpointer ice);
+static void janus_ice_cb_component_state_changed(NiceAgent *agent, guint stream_id, guint component_id, guint state, gpointer ice);
+static void janus_ice_component_connected(janus_ice_handle *handle, janus_ice_component *component);
+static void janus_ice_mux_nominated(janus_ice_handle *handle, janus_ice_component *component, janus_ice_mux_packet *pkt) {
+	/* From now on, we send on the shared socket to this address */
+	component->mux_socket = pkt->socket;
+	memcpy(&component->mux_address, &pkt->address.addr, pkt->address.len);
+	component->mux_address_len = pkt->address.len;
+	NiceAddress address;
+	nice_address_set_from_sockaddr(&address, (struct sockaddr *)&pkt->address.addr);
+	gchar raddress[NICE_ADDRESS_STRING_LEN];
+	nice_address_to_string(&address, raddress);
+	char sp[200];
+	g_snprintf(sp, sizeof(sp), "mux#%d:%"SCNu16" <-> %s:%u", pkt->socket->id, janus_ice_mux_port,
+		raddress, nice_address_get_port(&address));
+	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Address nominated for component %d in stream %d: %s\n",
+		handle->handle_id, component->component_id, component->stream_id, sp);
+	gchar *prev_selected_pair = component->selected_pair;
+	component->selected_pair = g_strdup(sp);
+	g_clear_pointer(&prev_selected_pair, g_free);
+	/* Notify event handlers */
+	if(janus_events_should_notify(JANUS_EVENT_TYPE_WEBRTC)) {
+		janus_session *session = (janus_session *)handle->session;
+		json_t *info = json_object();
+		json_object_set_new(info, "selected-pair", json_string(sp));
+		json_object_set_new(info, "stream_id", json_integer(component->stream_id));
+		json_object_set_new(info, "component_id", json_integer(component->component_id));
+		janus_events_notify_handlers(JANUS_EVENT_TYPE_WEBRTC, session->session_id, handle->handle_id, handle->opaque_id, info);
+	}
+	/* There's no libnice state machine involved, so we notify the state ourselves */
+	if(component->state != NICE_COMPONENT_STATE_READY)
+		janus_ice_cb_component_state_changed(handle->agent, component->stream_id, component->component_id, NICE_COMPONENT_STATE_READY, handle);
+	janus_ice_component_connected(handle, component);
+}
+static gboolean janus_ice_mux_source_prepare(GSource *source, gint *timeout) {
+	janus_ice_mux_source *t = (janus_ice_mux_source *)source;
+	janus_ice_queue *queue = t->handle->mux_incoming;
+	/* When we have an eventfd, GLib will dispatch us as soon as it's readable */
+	if(queue->efd >= 0)
+		return FALSE;
+	return (janus_ice_queue_length(queue) > 0);
+}
+static gboolean janus_ice_mux_source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data) {
+	janus_ice_mux_source *t = (janus_ice_mux_source *)source;
+	janus_ice_handle *handle = t->handle;
+	janus_ice_queue *queue = handle->mux_incoming;
+	janus_ice_queue_reset_signal(queue);
+	int count = 0;
+	janus_ice_mux_packet *pkt = NULL;
+	while(count < JANUS_ICE_MUX_BATCH && (pkt = janus_ice_queue_pop(queue)) != NULL) {
+		janus_ice_stream *stream = handle->stream;
+		janus_ice_component *component = stream ? stream->component : NULL;
+		if(component != NULL) {
+			if(pkt->nominated)
+				janus_ice_mux_nominated(handle, component, pkt);
+			else {
+				/* The ingress batch may keep this packet rather than copying it */
+				handle->mux_current = pkt;
+				janus_ice_cb_nice_recv(handle->agent, stream->stream_id, component->component_id, pkt->length, pkt->data, component);
+				pkt = handle->mux_current;
+				handle->mux_current = NULL;
+			}
+		}
+		g_free(pkt);
+		count++;
+	}
+	if(count == JANUS_ICE_MUX_BATCH) {
+		/* There may be more packets, make sure we get dispatched again */
+		janus_ice_queue_signal(queue, NULL);
+	}
+	return G_SOURCE_CONTINUE;
+}
+static GSourceFuncs janus_ice_mux_source_funcs = {
+	janus_ice_mux_source_prepare,
+	NULL,	/* We don't need check */
+	janus_ice_mux_source_dispatch,
+	NULL,
+	NULL, NULL
+};
+static GSource *janus_ice_mux_source_create(janus_ice_handle *handle) {
+	GSource *source = g_source_new(&janus_ice_mux_source_funcs, sizeof(janus_ice_mux_source));
+	janus_ice_mux_source *t = (janus_ice_mux_source *)source;
+	char name[255];
+	g_snprintf(name, sizeof(name), "mux-%"SCNu64, handle->handle_id);
+	g_source_set_name(source, name);
+	t->handle = handle;
+#ifdef JANUS_ICE_QUEUE_EVENTFD
+	if(handle->mux_incoming->efd >= 0)
+		g_source_add_unix_fd(source, handle->mux_incoming->efd, G_IO_IN);
+#endif
+	return source;
+}
+static void janus_ice_mux_source_destroy(janus_ice_handle *handle) {
+	if(handle->mux_source == NULL)
+		return;
+	g_source_destroy(handle->mux_source);
+	g_source_unref(handle->mux_source);
+	handle->mux_source = NULL;
+}
+/* Since all handles share the same port, the candidates are always the same */
+static void janus_ice_mux_candidates_to_sdp(janus_ice_handle *handle, janus_sdp_mline *mline) {
+	guint count = 0;
+	if(nat_1_1_enabled) {
+		/* A 1:1 NAT mapping was specified, use the public IP */
+		janus_sdp_attribute *a = janus_sdp_attribute_create("candidate", "1 1 udp 2130706431 %s %"SCNu16" typ host",
+			janus_get_public_ip(), janus_ice_mux_port);
+		mline->attributes = g_list_append(mline->attributes, a);
+		count++;
+	} else {
+		janus_mutex_lock(&janus_ice_local_addresses_mutex);
+		janus_ice_local_addresses_check();
+		guint i = 0;
+		for(i=0; i<janus_ice_local_addresses->len; i++) {
+			NiceAddress *address = &g_array_index(janus_ice_local_addresses, NiceAddress, i);
+			gchar host[NICE_ADDRESS_STRING_LEN];
+			nice_address_to_string(address, host);
+			janus_sdp_attribute *a = janus_sdp_attribute_create("candidate", "%u 1 udp %u %s %"SCNu16" typ host",
+				i+1, 2130706431 - i, host, janus_ice_mux_port);
+			mline->attributes = g_list_append(mline->attributes, a);
+			count++;
+		}
+		janus_mutex_unlock(&janus_ice_local_addresses_mutex);
+	}
+	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Added %u host candidates for the ICE-Lite multiplexing port\n", handle->handle_id, count);
+}
 
 /* Janus NACKed packet we're tracking (to avoid duplicates) */
 typedef struct janus_ice_nacked_packet {
@@ -243,7 +1405,7 @@ typedef struct janus_ice_nacked_packet {
 static gboolean janus_ice_nacked_packet_cleanup(gpointer user_data) {
 	janus_ice_nacked_packet *pkt = (janus_ice_nacked_packet *)user_data;
 
-	JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Cleaning up NACKed packet %"SCNu16" (SSRC %"SCNu32", vindex %d)...\n",
+	JANUS_LOG_DEFERRED(LOG_HUGE, "[%"SCNu64"] Cleaning up NACKed packet %"SCNu16" (SSRC %"SCNu32", vindex %d)...\n",
 		pkt->handle->handle_id, pkt->seq_number, pkt->handle->stream->video_ssrc_peer[pkt->vindex], pkt->vindex);
 	g_hash_table_remove(pkt->handle->stream->rtx_nacked[pkt->vindex], GUINT_TO_POINTER(pkt->seq_number));
 
@@ -256,27 +1418,174 @@ typedef struct janus_ice_outgoing_traffic {
 	janus_ice_handle *handle;
 	GDestroyNotify destroy;
 } janus_ice_outgoing_traffic;
+/* Media latency tracking */
+static volatile gint media_latency = 0;
+/* Arrival time of the packet a plugin callback is handling on this thread, if any:
+ * packets relayed with relay_rtp from within the callback inherit it, while
+ * shared packets carry their own, as they may be relayed by other threads */
+static GPrivate janus_ice_ingress_time = G_PRIVATE_INIT(NULL);
+typedef struct janus_ice_plugin_latency {
+	/* Time spent in the plugin incoming_rtp callback */
+	janus_histogram incoming_rtp;
+	/* Time from when a packet was received to when the plugin relayed it was sent */
+	janus_histogram end_to_end;
+} janus_ice_plugin_latency;
+static GHashTable *plugin_latencies = NULL;
+static janus_mutex plugin_latencies_mutex = JANUS_MUTEX_INITIALIZER;
+struct janus_ice_latency {
+	/* Time spent in the plugin incoming_rtp callback */
+	janus_histogram incoming_rtp;
+	/* Time packets spent in the outgoing queue */
+	janus_histogram queue;
+	/* Time from when a packet was received (e.g., from a publisher) to when it was sent */
+	janus_histogram end_to_end;
+	/* Number of queued packets when the loop wakes up */
+	janus_histogram queue_depth;
+	/* Time spent in srtp_protect/srtp_unprotect (and their RTCP versions), in nanoseconds */
+	janus_histogram srtp_protect;
+	janus_histogram srtp_unprotect;
+	/* Arrival time of the packet we're passing to the plugin */
+	gint64 ingress;
+	/* Histograms of the plugin this handle is attached to */
+	janus_ice_plugin_latency *plugin;
+};
+void janus_ice_set_media_latency_enabled(gboolean enabled) {
+	g_atomic_int_set(&media_latency, enabled ? 1 : 0);
+	JANUS_LOG(LOG_VERB, "Media latency tracking %s\n", enabled ? "enabled" : "disabled");
+}
+gboolean janus_ice_is_media_latency_enabled(void) {
+	return g_atomic_int_get(&media_latency);
+}
+static janus_ice_plugin_latency *janus_ice_plugin_latency_get(janus_plugin *plugin) {
+	if(plugin == NULL)
+		return NULL;
+	janus_mutex_lock(&plugin_latencies_mutex);
+	if(plugin_latencies == NULL)
+		plugin_latencies = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)g_free);
+	janus_ice_plugin_latency *latency = g_hash_table_lookup(plugin_latencies, plugin);
+	if(latency == NULL) {
+		latency = g_malloc0(sizeof(janus_ice_plugin_latency));
+		g_hash_table_insert(plugin_latencies, plugin, latency);
+	}
+	janus_mutex_unlock(&plugin_latencies_mutex);
+	return latency;
+}
+/* The receiving and sending threads may both get here first: whoever loses the
+ * race to set the histograms of the handle gets rid of its own copy */
+static janus_ice_latency *janus_ice_latency_get(janus_ice_handle *handle) {
+	if(!g_atomic_int_get(&media_latency))
+		return NULL;
+	janus_ice_latency *latency = g_atomic_pointer_get(&handle->latency);
+	if(latency != NULL)
+		return latency;
+	latency = g_malloc0(sizeof(janus_ice_latency));
+	latency->plugin = janus_ice_plugin_latency_get((janus_plugin *)handle->app);
+	if(!g_atomic_pointer_compare_and_exchange(&handle->latency, NULL, latency)) {
+		g_free(latency);
+		latency = g_atomic_pointer_get(&handle->latency);
+	}
+	return latency;
+}
+/* Helpers to track the time spent in the plugin when passing it incoming packets */
+static gint64 janus_ice_latency_plugin_start(janus_ice_latency *latency, gint64 received) {
+	if(latency == NULL)
+		return 0;
+	latency->ingress = received;
+	g_private_set(&janus_ice_ingress_time, &latency->ingress);
+	return janus_get_monotonic_time();
+}
+static void janus_ice_latency_plugin_end(janus_ice_latency *latency, gint64 start) {
+	if(latency == NULL)
+		return;
+	g_private_set(&janus_ice_ingress_time, NULL);
+	gint64 elapsed = janus_get_monotonic_time() - start;
+	janus_histogram_add(&latency->incoming_rtp, elapsed);
+	if(latency->plugin)
+		janus_histogram_add(&latency->plugin->incoming_rtp, elapsed);
+}
+/* Helper to track queue and end-to-end latency of a packet we just sent */
+static void janus_ice_latency_track_sent(janus_ice_handle *handle, janus_ice_queued_packet *pkt) {
+	if(pkt->queued == 0)
+		return;
+	janus_ice_latency *latency = janus_ice_latency_get(handle);
+	if(latency == NULL)
+		return;
+	gint64 now = janus_get_monotonic_time();
+	janus_histogram_add(&latency->queue, now - pkt->queued);
+	if(pkt->ingress > 0) {
+		janus_histogram_add(&latency->end_to_end, now - pkt->ingress);
+		if(latency->plugin)
+			janus_histogram_add(&latency->plugin->end_to_end, now - pkt->ingress);
+	}
+}
 static gboolean janus_ice_outgoing_rtcp_handle(gpointer user_data);
 static gboolean janus_ice_outgoing_stats_handle(gpointer user_data);
 static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janus_ice_queued_packet *pkt);
+static void janus_ice_egress_flush(janus_ice_handle *handle);
+static void janus_ice_ingress_flush(janus_ice_handle *handle);
+#ifdef HAVE_SCTP
+static void janus_ice_data_check_watermarks(janus_ice_handle *handle);
+#endif
+/* Batched ingress: incoming packets are passed to plugins by the outgoing traffic source */
+struct janus_ice_ingress_batch {
+	int size, count;
+	janus_plugin_rtp_packet *packets;
+	/* Packets from a shared socket we kept a reference to, if any */
+	janus_ice_mux_packet **owned;
+	/* RTP headers as the plugin must see them, since we restore the original ones */
+	janus_rtp_header *headers;
+	/* Copies of the packets libnice gave us, as its buffers don't outlive the callback */
+	char *buffers;
+};
 static gboolean janus_ice_outgoing_traffic_prepare(GSource *source, gint *timeout) {
 	janus_ice_outgoing_traffic *t = (janus_ice_outgoing_traffic *)source;
-	return (g_async_queue_length(t->handle->queued_packets) > 0);
+	janus_ice_queue *queue = t->handle->queued_packets;
+	/* If we have incoming packets for the plugin, get them out as soon as possible */
+	if(t->handle->ingress_batch != NULL && t->handle->ingress_batch->count > 0)
+		return TRUE;
+	/* When we have an eventfd, GLib will dispatch us as soon as it's readable */
+	if(queue->efd >= 0)
+		return FALSE;
+	return (janus_ice_queue_length(queue) > 0);
 }
 static gboolean janus_ice_outgoing_traffic_dispatch(GSource *source, GSourceFunc callback, gpointer user_data) {
 	janus_ice_outgoing_traffic *t = (janus_ice_outgoing_traffic *)source;
-	/* FIXME */
-	int ret = G_SOURCE_CONTINUE;
+	janus_ice_queue *queue = t->handle->queued_packets;
+	/* Pass the incoming packets we accumulated in this iteration to the plugin */
+	janus_ice_ingress_flush(t->handle);
+	janus_ice_queue_reset_signal(queue);
+	janus_ice_latency *latency = janus_ice_latency_get(t->handle);
+	if(latency != NULL)
+		janus_histogram_add(&latency->queue_depth, janus_ice_queue_length(queue));
+	int ret = G_SOURCE_CONTINUE, count = 0;
 	janus_ice_queued_packet *pkt = NULL;
-	while((pkt = g_async_queue_try_pop(t->handle->queued_packets)) != NULL) {
+	while(count < JANUS_ICE_QUEUE_BATCH && (pkt = janus_ice_queue_pop(queue)) != NULL) {
 		if(janus_ice_outgoing_traffic_handle(t->handle, pkt) == G_SOURCE_REMOVE)
 			ret = G_SOURCE_REMOVE;
+		count++;
+	}
+#ifdef HAVE_SCTP
+	/* Send the datachannel messages we may have coalesced */
+	if(t->handle->stream && t->handle->stream->component)
+		janus_dtls_srtp_flush(t->handle->stream->component->dtls);
+#endif
+	/* If we're batching, send whatever we accumulated */
+	janus_ice_egress_flush(t->handle);
+	if(count == JANUS_ICE_QUEUE_BATCH && ret == G_SOURCE_CONTINUE) {
+		/* There may be more packets, make sure we get dispatched again */
+		janus_ice_queue_signal(queue, NULL);
 	}
 	return ret;
 }
+static gboolean janus_ice_static_event_loop_cleanup(gpointer user_data);
 static void janus_ice_outgoing_traffic_finalize(GSource *source) {
 	janus_ice_outgoing_traffic *t = (janus_ice_outgoing_traffic *)source;
-	g_main_loop_quit(t->handle->iceloop);
+	if(t->handle->static_loop != NULL) {
+		/* This handle is sharing its loop with others, only free our own resources */
+		(void)janus_ice_static_event_loop_cleanup(t->handle);
+	} else {
+		g_main_loop_quit(t->handle->iceloop);
+	}
 	janus_refcount_decrease(&t->handle->ref);
 }
 static GSourceFuncs janus_ice_outgoing_traffic_funcs = {
@@ -295,6 +1604,10 @@ static GSource *janus_ice_outgoing_traffic_create(janus_ice_handle *handle, GDes
 	janus_refcount_increase(&handle->ref);
 	t->handle = handle;
 	t->destroy = destroy;
+#ifdef JANUS_ICE_QUEUE_EVENTFD
+	if(handle->queued_packets->efd >= 0)
+		g_source_add_unix_fd(source, handle->queued_packets->efd, G_IO_IN);
+#endif
 	return source;
 }
 
@@ -320,21 +1633,506 @@ void janus_set_rfc4588_enabled(gboolean enabled) {
 	rfc4588_enabled = enabled;
 	JANUS_LOG(LOG_VERB, "RFC4588 support is %s\n", rfc4588_enabled ? "enabled" : "disabled");
 }
-gboolean janus_is_rfc4588_enabled(void) {
-	return rfc4588_enabled;
+gboolean janus_is_rfc4588_enabled(void) {
+	return rfc4588_enabled;
+}
+
+/* Batched egress */
+#define JANUS_ICE_EGRESS_MAX_BATCH	64
+/* UDP GSO messages can't be larger than 64k, so we cap the segments per message */
+#define JANUS_ICE_EGRESS_MAX_GSO	32
+static int egress_batch = 0;
+#ifdef UDP_SEGMENT
+/* We disable GSO the first time the kernel (or the NIC) refuses it */
+static volatile gint egress_gso = 1;
+#endif
+void janus_set_egress_batch(int size) {
+#ifndef JANUS_ICE_EGRESS_BATCH
+	if(size > 0) {
+		JANUS_LOG(LOG_WARN, "Batched egress not supported (needs sendmmsg and libnice >= 0.1.5), ignoring\n");
+		size = 0;
+	}
+#endif
+	if(size < 0)
+		size = 0;
+	if(size > JANUS_ICE_EGRESS_MAX_BATCH)
+		size = JANUS_ICE_EGRESS_MAX_BATCH;
+	egress_batch = size;
+	if(egress_batch == 0)
+		JANUS_LOG(LOG_VERB, "Batched egress disabled\n");
+	else
+		JANUS_LOG(LOG_VERB, "Batched egress enabled (up to %d packets per syscall)\n", egress_batch);
+}
+int janus_get_egress_batch(void) {
+	return egress_batch;
+}
+
+struct janus_ice_egress_batch {
+	/* Socket of the selected pair (we keep a reference so that the fd stays valid) */
+	GSocket *socket;
+	int fd;
+	/* Address of the peer in the selected pair */
+	struct sockaddr_storage address;
+	socklen_t address_len;
+	/* Whether we checked the selected pair, and if we can bypass libnice for it */
+	gboolean checked, usable;
+	/* Packets waiting to be flushed */
+	int size, count;
+	int *lengths;
+	char *buffers;
+};
+static void janus_ice_egress_batch_destroy(janus_ice_egress_batch *batch) {
+	if(batch == NULL)
+		return;
+	if(batch->socket != NULL)
+		g_object_unref(batch->socket);
+	g_free(batch->lengths);
+	g_free(batch->buffers);
+	g_free(batch);
+}
+#ifdef JANUS_ICE_EGRESS_BATCH
+/* Check if we can send directly on the socket of the selected pair */
+static void janus_ice_egress_batch_setup(janus_ice_handle *handle, janus_ice_component *component, janus_ice_egress_batch *batch) {
+	batch->checked = TRUE;
+	batch->usable = FALSE;
+	if(batch->socket != NULL) {
+		g_object_unref(batch->socket);
+		batch->socket = NULL;
+	}
+	NiceCandidate *local = NULL, *remote = NULL;
+	if(!nice_agent_get_selected_pair(handle->agent, component->stream_id, component->component_id, &local, &remote) ||
+			local == NULL || remote == NULL)
+		return;
+	/* We can only do this for plain UDP pairs: TURN and ICE-TCP need libnice's framing */
+	if(local->type == NICE_CANDIDATE_TYPE_RELAYED)
+		return;
+#ifdef HAVE_LIBNICE_TCP
+	if(local->transport != NICE_CANDIDATE_TRANSPORT_UDP)
+		return;
+#endif
+	GSocket *socket = nice_agent_get_selected_socket(handle->agent, component->stream_id, component->component_id);
+	if(socket == NULL)
+		return;
+	memset(&batch->address, 0, sizeof(batch->address));
+	nice_address_copy_to_sockaddr(&remote->addr, (struct sockaddr *)&batch->address);
+	batch->address_len = (nice_address_ip_version(&remote->addr) == 6) ?
+		sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+	batch->socket = socket;
+	batch->fd = g_socket_get_fd(socket);
+	batch->usable = TRUE;
+	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Using batched egress on the selected pair\n", handle->handle_id);
+}
+#endif
+/* Send all the packets in the batch: consecutive packets with the same size are
+ * sent as a single GSO message, if supported, and all messages via sendmmsg */
+static void janus_ice_egress_flush(janus_ice_handle *handle) {
+#ifdef JANUS_ICE_EGRESS_BATCH
+	janus_ice_component *component = (handle && handle->stream) ? handle->stream->component : NULL;
+	janus_ice_egress_batch *batch = component ? component->egress_batch : NULL;
+	if(batch == NULL || batch->count == 0)
+		return;
+	struct mmsghdr msgs[JANUS_ICE_EGRESS_MAX_BATCH];
+	struct iovec iovs[JANUS_ICE_EGRESS_MAX_BATCH];
+#ifdef UDP_SEGMENT
+	char controls[JANUS_ICE_EGRESS_MAX_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+	gboolean gso = g_atomic_int_get(&egress_gso);
+#endif
+	memset(msgs, 0, sizeof(msgs));
+	int i = 0, m = 0;
+	while(i < batch->count) {
+		int first = i, segment = batch->lengths[i];
+		iovs[i].iov_base = batch->buffers + i*JANUS_ICE_PACKET_POOL_BUFFER;
+		iovs[i].iov_len = batch->lengths[i];
+		i++;
+#ifdef UDP_SEGMENT
+		/* The last segment of a GSO message is allowed to be shorter */
+		while(gso && i < batch->count && batch->lengths[i] <= segment && (i-first) < JANUS_ICE_EGRESS_MAX_GSO) {
+			iovs[i].iov_base = batch->buffers + i*JANUS_ICE_PACKET_POOL_BUFFER;
+			iovs[i].iov_len = batch->lengths[i];
+			i++;
+			if(batch->lengths[i-1] < segment)
+				break;
+		}
+#endif
+		msgs[m].msg_hdr.msg_name = &batch->address;
+		msgs[m].msg_hdr.msg_namelen = batch->address_len;
+		msgs[m].msg_hdr.msg_iov = &iovs[first];
+		msgs[m].msg_hdr.msg_iovlen = i-first;
+#ifdef UDP_SEGMENT
+		if(i-first > 1) {
+			msgs[m].msg_hdr.msg_control = controls[m];
+			msgs[m].msg_hdr.msg_controllen = sizeof(controls[m]);
+			struct cmsghdr *cm = CMSG_FIRSTHDR(&msgs[m].msg_hdr);
+			cm->cmsg_level = SOL_UDP;
+			cm->cmsg_type = UDP_SEGMENT;
+			cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			*((uint16_t *)CMSG_DATA(cm)) = segment;
+			component->egress_gso_packets += (i-first);
+		}
+#endif
+		m++;
+	}
+	int done = 0;
+	while(done < m) {
+		int res = sendmmsg(batch->fd, &msgs[done], m-done, 0);
+		component->egress_syscalls++;
+		if(res > 0) {
+			done += res;
+			continue;
+		}
+		if(res < 0 && errno == EINTR)
+			continue;
+#ifdef UDP_SEGMENT
+		if(res < 0 && msgs[done].msg_hdr.msg_controllen > 0 && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT)) {
+			/* GSO isn't supported here: send these packets one by one, and stop using it */
+			if(g_atomic_int_compare_and_exchange(&egress_gso, 1, 0)) {
+				JANUS_LOG(LOG_WARN, "[%"SCNu64"] UDP GSO not supported (%d, %s), disabling it\n",
+					handle->handle_id, errno, strerror(errno));
+			}
+			size_t n = 0;
+			for(n=0; n<msgs[done].msg_hdr.msg_iovlen; n++) {
+				struct iovec *iov = &msgs[done].msg_hdr.msg_iov[n];
+				if(sendto(batch->fd, iov->iov_base, iov->iov_len, 0, (struct sockaddr *)&batch->address, batch->address_len) < 0) {
+					JANUS_LOG_RATELIMITED(LOG_ERR, "[%"SCNu64"] ... error sending packet (%d, %s)\n", handle->handle_id, errno, strerror(errno));
+				}
+				component->egress_syscalls++;
+			}
+			component->egress_gso_packets -= msgs[done].msg_hdr.msg_iovlen;
+			done++;
+			continue;
+		}
+#endif
+		/* Whatever is left gets dropped, as it would with nice_agent_send */
+		JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... sendmmsg only sent %d/%d messages (%d, %s)\n",
+			handle->handle_id, done, m, errno, strerror(errno));
+		break;
+	}
+	component->egress_packets += batch->count;
+	batch->count = 0;
+#endif
+}
+/* Cost of SRTP per negotiated profile, in nanoseconds */
+static janus_histogram srtp_protect_time[4], srtp_unprotect_time[4];
+
+/* Core media metrics, exposed via the metrics registry (index 0 is audio, 1 video and 2 data) */
+static janus_metric *metric_handles = NULL;
+/* Root account for the memory held by handles */
+static janus_memory_account *handles_memory = NULL;
+static janus_metric *metric_packets_received[3], *metric_bytes_received[3];
+static janus_metric *metric_packets_sent[2], *metric_bytes_sent[2];
+static janus_metric *metric_nacks_received = NULL, *metric_nacks_sent = NULL;
+static janus_metric *metric_srtp_errors = NULL;
+static void janus_ice_metrics_register(void) {
+	const char *media[] = { "media=\"audio\"", "media=\"video\"", "media=\"data\"" };
+	metric_handles = janus_metric_register("janus_handles", NULL, "Handles currently allocated", janus_metric_gauge);
+	int i = 0;
+	for(i=0; i<3; i++) {
+		metric_packets_received[i] = janus_metric_register("janus_packets_received_total", media[i],
+			"Packets received from peers", janus_metric_counter);
+		metric_bytes_received[i] = janus_metric_register("janus_bytes_received_total", media[i],
+			"Bytes received from peers", janus_metric_counter);
+	}
+	for(i=0; i<2; i++) {
+		metric_packets_sent[i] = janus_metric_register("janus_packets_sent_total", media[i],
+			"Packets sent to peers", janus_metric_counter);
+		metric_bytes_sent[i] = janus_metric_register("janus_bytes_sent_total", media[i],
+			"Bytes sent to peers", janus_metric_counter);
+	}
+	metric_nacks_received = janus_metric_register("janus_nacks_received_total", NULL,
+		"Packets peers asked us to retransmit", janus_metric_counter);
+	metric_nacks_sent = janus_metric_register("janus_nacks_sent_total", NULL,
+		"Packets we asked peers to retransmit", janus_metric_counter);
+	metric_srtp_errors = janus_metric_register("janus_srtp_errors_total", NULL,
+		"SRTP/SRTCP protect and unprotect errors (replays excluded)", janus_metric_counter);
+}
+static int janus_ice_srtp_profile_index(int profile) {
+	switch(profile) {
+		case SRTP_AES128_CM_SHA1_80:
+			return 0;
+		case SRTP_AES128_CM_SHA1_32:
+			return 1;
+#ifdef HAVE_SRTP_AESGCM
+		case SRTP_AEAD_AES_128_GCM:
+			return 2;
+		case SRTP_AEAD_AES_256_GCM:
+			return 3;
+#endif
+		default:
+			return -1;
+	}
+}
+static gint64 janus_ice_srtp_timing_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * (gint64)1000000000) + ts.tv_nsec;
+}
+/* Helpers to track how much srtp_protect and srtp_unprotect cost */
+static gint64 janus_ice_srtp_timing_start(void) {
+	return g_atomic_int_get(&media_latency) ? janus_ice_srtp_timing_now() : 0;
+}
+static void janus_ice_srtp_timing_end(janus_ice_handle *handle, janus_dtls_srtp *dtls, gboolean protect, gint64 start) {
+	if(start == 0)
+		return;
+	janus_ice_latency *latency = janus_ice_latency_get(handle);
+	if(latency == NULL)
+		return;
+	gint64 elapsed = janus_ice_srtp_timing_now() - start;
+	janus_histogram_add(protect ? &latency->srtp_protect : &latency->srtp_unprotect, elapsed);
+	int index = janus_ice_srtp_profile_index(dtls->srtp_profile);
+	if(index >= 0)
+		janus_histogram_add(protect ? &srtp_protect_time[index] : &srtp_unprotect_time[index], elapsed);
+}
+json_t *janus_ice_srtp_timing_info(void) {
+	static const int profiles[] = { SRTP_AES128_CM_SHA1_80, SRTP_AES128_CM_SHA1_32,
+#ifdef HAVE_SRTP_AESGCM
+		SRTP_AEAD_AES_128_GCM, SRTP_AEAD_AES_256_GCM
+#endif
+	};
+	json_t *info = json_object();
+	guint i = 0;
+	for(i=0; i<G_N_ELEMENTS(profiles); i++) {
+		int index = janus_ice_srtp_profile_index(profiles[i]);
+		json_t *p = json_object();
+		json_object_set_new(p, "protect_ns", janus_histogram_summary(&srtp_protect_time[index]));
+		json_object_set_new(p, "unprotect_ns", janus_histogram_summary(&srtp_unprotect_time[index]));
+		json_object_set_new(info, janus_get_dtls_srtp_profile(profiles[i]), p);
+	}
+	return info;
+}
+void janus_ice_media_latency_reset(void) {
+	int i = 0;
+	for(i=0; i<4; i++) {
+		janus_histogram_reset(&srtp_protect_time[i]);
+		janus_histogram_reset(&srtp_unprotect_time[i]);
+	}
+	janus_mutex_lock(&plugin_latencies_mutex);
+	if(plugin_latencies != NULL) {
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, plugin_latencies);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_ice_plugin_latency *latency = value;
+			janus_histogram_reset(&latency->incoming_rtp);
+			janus_histogram_reset(&latency->end_to_end);
+		}
+	}
+	janus_mutex_unlock(&plugin_latencies_mutex);
+}
+json_t *janus_ice_media_latency_info(void) {
+	json_t *info = json_object();
+	janus_mutex_lock(&plugin_latencies_mutex);
+	if(plugin_latencies != NULL) {
+		GHashTableIter iter;
+		gpointer key, value;
+		g_hash_table_iter_init(&iter, plugin_latencies);
+		while(g_hash_table_iter_next(&iter, &key, &value)) {
+			janus_plugin *plugin = (janus_plugin *)key;
+			janus_ice_plugin_latency *latency = value;
+			json_t *pl = json_object();
+			json_object_set_new(pl, "incoming_rtp", janus_histogram_summary(&latency->incoming_rtp));
+			json_object_set_new(pl, "end_to_end", janus_histogram_summary(&latency->end_to_end));
+			json_object_set_new(info, plugin->get_package(), pl);
+		}
+	}
+	janus_mutex_unlock(&plugin_latencies_mutex);
+	return info;
+}
+json_t *janus_ice_handle_latency_info(janus_ice_handle *handle) {
+	if(handle == NULL || handle->latency == NULL)
+		return NULL;
+	janus_ice_latency *latency = handle->latency;
+	json_t *info = json_object();
+	json_object_set_new(info, "incoming_rtp", janus_histogram_summary(&latency->incoming_rtp));
+	json_object_set_new(info, "queue", janus_histogram_summary(&latency->queue));
+	json_object_set_new(info, "end_to_end", janus_histogram_summary(&latency->end_to_end));
+	json_object_set_new(info, "queue_depth", janus_histogram_summary(&latency->queue_depth));
+	json_object_set_new(info, "srtp_protect_ns", janus_histogram_summary(&latency->srtp_protect));
+	json_object_set_new(info, "srtp_unprotect_ns", janus_histogram_summary(&latency->srtp_unprotect));
+	return info;
+}
+
+/* Batched ingress */
+#define JANUS_ICE_INGRESS_MAX_BATCH	32
+static int ingress_batch = 0;
+void janus_set_ingress_batch(int size) {
+	if(size < 0)
+		size = 0;
+	if(size > JANUS_ICE_INGRESS_MAX_BATCH)
+		size = JANUS_ICE_INGRESS_MAX_BATCH;
+	ingress_batch = size;
+	if(ingress_batch == 0)
+		JANUS_LOG(LOG_VERB, "Batched ingress disabled\n");
+	else
+		JANUS_LOG(LOG_VERB, "Batched ingress enabled (up to %d packets per batch)\n", ingress_batch);
+}
+int janus_get_ingress_batch(void) {
+	return ingress_batch;
+}
+
+/* Forget the packets in the batch, releasing the ones we kept a reference to */
+static void janus_ice_ingress_batch_reset(janus_ice_ingress_batch *batch) {
+	if(batch == NULL)
+		return;
+	int i = 0;
+	for(i=0; i<batch->count; i++) {
+		g_free(batch->owned[i]);
+		batch->owned[i] = NULL;
+	}
+	batch->count = 0;
+}
+static void janus_ice_ingress_batch_destroy(janus_ice_ingress_batch *batch) {
+	if(batch == NULL)
+		return;
+	janus_ice_ingress_batch_reset(batch);
+	g_free(batch->packets);
+	g_free(batch->owned);
+	g_free(batch->headers);
+	g_free(batch->buffers);
+	g_free(batch);
+}
+/* Pass the packets we accumulated to the plugin: this is done by the outgoing
+ * traffic source, which means once per loop iteration, or when the batch is full */
+static void janus_ice_ingress_flush(janus_ice_handle *handle) {
+	janus_ice_ingress_batch *batch = handle->ingress_batch;
+	if(batch == NULL || batch->count == 0)
+		return;
+	int count = batch->count;
+	janus_plugin *plugin = (janus_plugin *)handle->app;
+	if(plugin && plugin->incoming_rtp_batch && handle->app_handle &&
+			!g_atomic_int_get(&handle->app_handle->stopped) &&
+			!g_atomic_int_get(&handle->destroyed)) {
+		/* Put back the headers we were asked to restore after adding the packets */
+		int i = 0;
+		for(i=0; i<count; i++)
+			*((janus_rtp_header *)batch->packets[i].buffer) = batch->headers[i];
+		janus_ice_latency *latency = janus_ice_latency_get(handle);
+		gint64 start = janus_ice_latency_plugin_start(latency, batch->packets[0].received);
+		JANUS_TRACE2(plugin_rtp_batch_start, handle->handle_id, count);
+		plugin->incoming_rtp_batch(handle->app_handle, batch->packets, count);
+		JANUS_TRACE2(plugin_rtp_batch_done, handle->handle_id, count);
+		janus_ice_latency_plugin_end(latency, start);
+		handle->ingress_batches++;
+		handle->ingress_batched_packets += count;
+	}
+	janus_ice_ingress_batch_reset(batch);
+}
+/* Add a decrypted packet to the batch: returns FALSE if it should be passed to
+ * the plugin right away instead (batching disabled or not supported by the plugin).
+ * If the packet came from a shared socket, we keep it rather than copying it */
+static gboolean janus_ice_ingress_batch_add(janus_ice_handle *handle, janus_plugin *plugin,
+		janus_plugin_rtp_packet *pkt) {
+	if(ingress_batch == 0 || plugin->incoming_rtp_batch == NULL)
+		return FALSE;
+	janus_ice_mux_packet *mux = handle->mux_current;
+	if(mux != NULL && (pkt->buffer < mux->data || pkt->buffer >= mux->data + mux->length))
+		mux = NULL;
+	if(mux == NULL && pkt->length > JANUS_ICE_PACKET_POOL_BUFFER) {
+		/* Too large for the batch: flush what we have, to preserve the order */
+		janus_ice_ingress_flush(handle);
+		return FALSE;
+	}
+	janus_ice_ingress_batch *batch = handle->ingress_batch;
+	if(batch == NULL) {
+		batch = g_malloc0(sizeof(janus_ice_ingress_batch));
+		batch->size = ingress_batch;
+		batch->packets = g_malloc0(batch->size * sizeof(janus_plugin_rtp_packet));
+		batch->owned = g_malloc0(batch->size * sizeof(janus_ice_mux_packet *));
+		batch->headers = g_malloc(batch->size * sizeof(janus_rtp_header));
+		handle->ingress_batch = batch;
+	}
+	if(batch->count == batch->size)
+		janus_ice_ingress_flush(handle);
+	janus_plugin_rtp_packet *packet = &batch->packets[batch->count];
+	/* Copy the parsed extensions and media info too, offsets are relative to the buffer */
+	*packet = *pkt;
+	batch->headers[batch->count] = *((janus_rtp_header *)pkt->buffer);
+	if(mux != NULL) {
+		/* Take ownership of the packet, it will be freed when the batch is flushed */
+		batch->owned[batch->count] = mux;
+		handle->mux_current = NULL;
+	} else {
+		if(batch->buffers == NULL)
+			batch->buffers = g_malloc(batch->size * JANUS_ICE_PACKET_POOL_BUFFER);
+		packet->buffer = batch->buffers + batch->count*JANUS_ICE_PACKET_POOL_BUFFER;
+		memcpy(packet->buffer, pkt->buffer, pkt->length);
+	}
+	batch->count++;
+	return TRUE;
+}
+/* Send a packet on the selected pair: with batched egress, this only copies the
+ * packet to the batch, which is flushed when full or when the loop is done */
+static int janus_ice_component_send(janus_ice_handle *handle, janus_ice_component *component, gint len, gchar *buf) {
+	if(component->mux_socket != NULL) {
+		/* We're sending on a shared socket, which libnice knows nothing about */
+		return janus_ice_send_raw(handle, component, len, buf);
+	}
+#ifdef JANUS_ICE_EGRESS_BATCH
+	if(egress_batch > 0 && len <= JANUS_ICE_PACKET_POOL_BUFFER) {
+		janus_ice_egress_batch *batch = component->egress_batch;
+		if(batch == NULL) {
+			batch = g_malloc0(sizeof(janus_ice_egress_batch));
+			batch->fd = -1;
+			batch->size = egress_batch;
+			batch->lengths = g_malloc0(batch->size * sizeof(int));
+			batch->buffers = g_malloc(batch->size * JANUS_ICE_PACKET_POOL_BUFFER);
+			component->egress_batch = batch;
+		}
+		if(!batch->checked)
+			janus_ice_egress_batch_setup(handle, component, batch);
+		if(batch->usable) {
+			if(batch->count == batch->size)
+				janus_ice_egress_flush(handle);
+			memcpy(batch->buffers + batch->count*JANUS_ICE_PACKET_POOL_BUFFER, buf, len);
+			batch->lengths[batch->count] = len;
+			batch->count++;
+			return len;
+		}
+	}
+#endif
+	return janus_ice_send_raw(handle, component, len, buf);
 }
-
-static inline void janus_ice_free_rtp_packet(janus_rtp_packet *pkt) {
-	if(pkt == NULL) {
-		return;
+int janus_ice_send_raw(janus_ice_handle *handle, janus_ice_component *component, int len, char *buf) {
+	if(handle == NULL || component == NULL || buf == NULL)
+		return -1;
+	if(component->mux_socket != NULL) {
+		return sendto(component->mux_socket->fd, buf, len, 0,
+			(struct sockaddr *)&component->mux_address, component->mux_address_len);
 	}
-
-	g_free(pkt->data);
-	g_free(pkt);
+	return nice_agent_send(handle->agent, component->stream_id, component->component_id, len, buf);
 }
 
 static inline void janus_ice_free_queued_packet(janus_ice_queued_packet *pkt) {
-	if(pkt == NULL || pkt == &janus_ice_dtls_alert || pkt == &janus_ice_dtls_alert) {
+	if(pkt == NULL || pkt == &janus_ice_dtls_handshake || pkt == &janus_ice_dtls_alert || pkt == &janus_ice_data_writable) {
+		return;
+	}
+	if(pkt->shared != NULL) {
+		/* We never got to copy the shared packet, release it */
+		janus_refcount_decrease(&pkt->shared->ref);
+		pkt->shared = NULL;
+	}
+	if(pkt->pool != NULL) {
+		/* Return this packet to the pool it came from */
+		janus_ice_packet_pool *pool = pkt->pool;
+		if(pkt->data != pkt->pool_buffer) {
+			/* The buffer was replaced (e.g., REMB with a RR prepended) */
+			g_free(pkt->data);
+		}
+		pkt->data = NULL;
+		pkt->pool = NULL;
+		janus_mutex_lock(&pool->mutex);
+		pool->in_use--;
+		if(pool->available < JANUS_ICE_PACKET_POOL_MAX) {
+			pkt->next = pool->free;
+			pool->free = pkt;
+			pool->available++;
+			pkt = NULL;
+		}
+		janus_mutex_unlock(&pool->mutex);
+		if(pkt != NULL) {
+			/* Pool is full, get rid of this one */
+			g_free(pkt->pool_buffer);
+			g_free(pkt);
+		}
 		return;
 	}
 
@@ -358,37 +2156,94 @@ void janus_set_max_nack_queue(uint mnq) {
 uint janus_get_max_nack_queue(void) {
 	return max_nack_queue;
 }
-/* Helper to clean old NACK packets in the buffer when they exceed the queue time limit */
-static void janus_cleanup_nack_buffer(gint64 now, janus_ice_stream *stream, gboolean audio, gboolean video) {
+/* Retransmit buffers: packets are stored in a ring indexed by their sequence
+ * number, which means insertion, lookup and expiry don't need any hashing or
+ * allocation (buffers are recycled), and memory is bounded by the ring size */
+#define JANUS_ICE_RETRANSMIT_MIN_SLOTS	256
+#define JANUS_ICE_RETRANSMIT_MAX_SLOTS	4096
+#define JANUS_ICE_RETRANSMIT_SLOT_SIZE	(1500+SRTP_MAX_TAG_LEN+2)
+/* Slots are found by masking the sequence number, which only works with powers of two */
+G_STATIC_ASSERT((JANUS_ICE_RETRANSMIT_MIN_SLOTS & (JANUS_ICE_RETRANSMIT_MIN_SLOTS-1)) == 0);
+G_STATIC_ASSERT((JANUS_ICE_RETRANSMIT_MAX_SLOTS & (JANUS_ICE_RETRANSMIT_MAX_SLOTS-1)) == 0);
+G_STATIC_ASSERT(JANUS_ICE_RETRANSMIT_MAX_SLOTS <= 65536);
+static janus_ice_retransmit_buffer *janus_ice_retransmit_buffer_create(janus_memory_account *account) {
+	janus_ice_retransmit_buffer *rb = g_malloc0(sizeof(janus_ice_retransmit_buffer));
+	/* We size the ring so that it can hold one packet per millisecond of queue,
+	 * rounded up to the next power of two (since we index it with a mask) */
+	guint slots = MIN(MAX(max_nack_queue, JANUS_ICE_RETRANSMIT_MIN_SLOTS), JANUS_ICE_RETRANSMIT_MAX_SLOTS);
+	rb->size = 1;
+	while(rb->size < slots)
+		rb->size <<= 1;
+	rb->mask = rb->size-1;
+	rb->slots = g_malloc0(rb->size * sizeof(janus_ice_retransmit_slot));
+	/* Generation 0 is never used, so that empty slots are always stale */
+	rb->generation = 1;
+	rb->memory = sizeof(janus_ice_retransmit_buffer) + rb->size * sizeof(janus_ice_retransmit_slot);
+	rb->account = janus_memory_account_ref(account);
+	janus_memory_charge(rb->account, janus_memory_nack, rb->memory);
+	return rb;
+}
+static void janus_ice_retransmit_buffer_destroy(janus_ice_retransmit_buffer *rb) {
+	if(rb == NULL)
+		return;
+	guint i = 0;
+	for(i=0; i<rb->size; i++)
+		g_free(rb->slots[i].packet.data);
+	g_free(rb->slots);
+	janus_memory_release(rb->account, janus_memory_nack, rb->memory);
+	janus_memory_account_destroy(rb->account);
+	g_free(rb);
+}
+/* Get the slot to store a packet with the provided sequence number in, making
+ * sure it can contain at least length bytes: this overwrites any older packet */
+static janus_rtp_packet *janus_ice_retransmit_buffer_store(janus_ice_retransmit_buffer *rb, guint16 seq, gint length) {
+	janus_ice_retransmit_slot *slot = &rb->slots[seq & rb->mask];
+	if(slot->capacity < length) {
+		gint capacity = MAX(length, JANUS_ICE_RETRANSMIT_SLOT_SIZE);
+		g_free(slot->packet.data);
+		slot->packet.data = g_malloc(capacity);
+		rb->memory += capacity - slot->capacity;
+		janus_memory_charge(rb->account, janus_memory_nack, capacity - slot->capacity);
+		slot->capacity = capacity;
+	}
+	slot->seq = seq;
+	slot->generation = rb->generation;
+	slot->packet.length = length;
+	slot->packet.created = janus_get_monotonic_time();
+	slot->packet.last_retransmit = 0;
+	return &slot->packet;
+}
+/* Get rid of a packet we just stored (e.g., because encrypting it failed) */
+static void janus_ice_retransmit_buffer_drop(janus_ice_retransmit_buffer *rb, guint16 seq) {
+	janus_ice_retransmit_slot *slot = &rb->slots[seq & rb->mask];
+	if(slot->seq == seq)
+		slot->generation = 0;
+}
+/* Look for a packet: anything older than max_nack_queue is considered expired */
+static janus_rtp_packet *janus_ice_retransmit_buffer_lookup(janus_ice_retransmit_buffer *rb, guint16 seq, gint64 now) {
+	if(rb == NULL)
+		return NULL;
+	janus_ice_retransmit_slot *slot = &rb->slots[seq & rb->mask];
+	if(slot->generation != rb->generation || slot->seq != seq)
+		return NULL;
+	if(now - slot->packet.created >= (gint64)max_nack_queue*1000)
+		return NULL;
+	return &slot->packet;
+}
+/* Helper to flush the retransmit buffers (e.g., when a keyframe has been sent) */
+static void janus_cleanup_nack_buffer(janus_ice_stream *stream, gboolean audio, gboolean video) {
 	if(stream && stream->component) {
 		janus_ice_component *component = stream->component;
+		/* Bumping the generation makes all the stored packets stale at once */
 		if(audio && component->audio_retransmit_buffer) {
-			janus_rtp_packet *p = (janus_rtp_packet *)g_queue_peek_head(component->audio_retransmit_buffer);
-			while(p && (!now || (now - p->created >= (gint64)max_nack_queue*1000))) {
-				/* Packet is too old, get rid of it */
-				g_queue_pop_head(component->audio_retransmit_buffer);
-				/* Remove from hashtable too */
-				janus_rtp_header *header = (janus_rtp_header *)p->data;
-				guint16 seq = ntohs(header->seq_number);
-				g_hash_table_remove(component->audio_retransmit_seqs, GUINT_TO_POINTER(seq));
-				/* Free the packet */
-				janus_ice_free_rtp_packet(p);
-				p = (janus_rtp_packet *)g_queue_peek_head(component->audio_retransmit_buffer);
-			}
+			component->audio_retransmit_buffer->generation++;
+			if(component->audio_retransmit_buffer->generation == 0)
+				component->audio_retransmit_buffer->generation = 1;
 		}
 		if(video && component->video_retransmit_buffer) {
-			janus_rtp_packet *p = (janus_rtp_packet *)g_queue_peek_head(component->video_retransmit_buffer);
-			while(p && (!now || (now - p->created >= (gint64)max_nack_queue*1000))) {
-				/* Packet is too old, get rid of it */
-				g_queue_pop_head(component->video_retransmit_buffer);
-				/* Remove from hashtable too */
-				janus_rtp_header *header = (janus_rtp_header *)p->data;
-				guint16 seq = ntohs(header->seq_number);
-				g_hash_table_remove(component->video_retransmit_seqs, GUINT_TO_POINTER(seq));
-				/* Free the packet */
-				janus_ice_free_rtp_packet(p);
-				p = (janus_rtp_packet *)g_queue_peek_head(component->video_retransmit_buffer);
-			}
+			component->video_retransmit_buffer->generation++;
+			if(component->video_retransmit_buffer->generation == 0)
+				component->video_retransmit_buffer->generation = 1;
 		}
 	}
 }
@@ -396,44 +2251,36 @@ static void janus_cleanup_nack_buffer(gint64 now, janus_ice_stream *stream, gboo
 
 #define SEQ_MISSING_WAIT 12000 /*  12ms */
 #define SEQ_NACKED_WAIT 155000 /* 155ms */
-/* janus_seq_info list functions */
-static void janus_seq_append(janus_seq_info **head, janus_seq_info *new_seq) {
-	if(*head == NULL) {
-		new_seq->prev = new_seq;
-		new_seq->next = new_seq;
-		*head = new_seq;
-	} else {
-		janus_seq_info *last_seq = (*head)->prev;
-		new_seq->prev = last_seq;
-		new_seq->next = *head;
-		(*head)->prev = new_seq;
-		last_seq->next = new_seq;
-	}
-}
-static janus_seq_info *janus_seq_pop_head(janus_seq_info **head) {
-	janus_seq_info *pop_seq = *head;
-	if(pop_seq) {
-		janus_seq_info *new_head = pop_seq->next;
-		if(pop_seq == new_head || new_head == NULL) {
-			*head = NULL;
-		} else {
-			*head = new_head;
-			new_head->prev = pop_seq->prev;
-			new_head->prev->next = new_head;
-		}
-	}
-	return pop_seq;
-}
-void janus_seq_list_free(janus_seq_info **head) {
-	if(!*head)
+/* janus_seq_window functions */
+#define JANUS_SEQ_WINDOW_MASK	(JANUS_SEQ_WINDOW_SIZE-1)
+void janus_seq_window_reset(janus_seq_window *window) {
+	if(window == NULL)
 		return;
-	janus_seq_info *cur = *head;
-	do {
-		janus_seq_info *next = cur->next;
-		g_free(cur);
-		cur = next;
-	} while(cur != *head);
-	*head = NULL;
+	window->count = 0;
+	memset(window->pending, 0, sizeof(window->pending));
+}
+static inline void janus_seq_window_set_pending(janus_seq_window *window, guint idx, gboolean pending) {
+	if(pending)
+		window->pending[idx >> 5] |= (1U << (idx & 31));
+	else
+		window->pending[idx >> 5] &= ~(1U << (idx & 31));
+}
+/* Add a new sequence number at the end of the window */
+static void janus_seq_window_append(janus_seq_window *window, guint16 seq, guint8 state, gint64 now) {
+	guint idx = seq & JANUS_SEQ_WINDOW_MASK;
+	window->state[idx] = state;
+	window->ts[idx] = now;
+	janus_seq_window_set_pending(window, idx, state == SEQ_MISSING);
+	window->last = seq;
+	window->count++;
+}
+/* Get rid of the oldest sequence numbers, so that at most max_len are left */
+static void janus_seq_window_trim(janus_seq_window *window, guint16 max_len) {
+	while(window->count > max_len) {
+		guint16 oldest = window->last - window->count + 1;
+		janus_seq_window_set_pending(window, oldest & JANUS_SEQ_WINDOW_MASK, FALSE);
+		window->count--;
+	}
 }
 static int janus_seq_in_range(guint16 seqn, guint16 start, guint16 len) {
 	/* Supports wrapping sequence (easier with int range) */
@@ -448,6 +2295,80 @@ static int janus_seq_in_range(guint16 seqn, guint16 start, guint16 len) {
 /* Internal method for relaying RTCP messages, optionally filtering them in case they come from plugins */
 void janus_ice_relay_rtcp_internal(janus_ice_handle *handle, int video, char *buf, int len, gboolean filter_rtcp);
 
+/* Transport wide cc: reception times are stored in a circular array indexed by
+ * the extended sequence number, so that feedback can be generated in order
+ * without sorting, and with no allocation on a per-packet basis */
+#define JANUS_ICE_TWCC_WINDOW	4096
+#define JANUS_ICE_TWCC_MASK		(JANUS_ICE_TWCC_WINDOW-1)
+/* Max number of packets to report in a single feedback, to make sure it fits in our buffer */
+#define JANUS_ICE_TWCC_MAX_FEEDBACK	400
+/* Send feedback for all the transport wide sequence numbers up to the highest
+ * we received (if any), splitting it in multiple messages if needed */
+static void janus_ice_transport_wide_cc_feedback(janus_ice_handle *handle, janus_ice_stream *stream) {
+	char rtcpbuf[1300];
+	guint64 timestamps[JANUS_ICE_TWCC_MAX_FEEDBACK];
+	while(TRUE) {
+		janus_mutex_lock(&stream->mutex);
+		if(stream->transport_wide_cc_timestamps == NULL ||
+				stream->transport_wide_cc_max_seq_num < stream->transport_wide_cc_base_seq_num) {
+			/* Nothing to report */
+			janus_mutex_unlock(&stream->mutex);
+			break;
+		}
+		guint32 base = stream->transport_wide_cc_base_seq_num;
+		guint count = stream->transport_wide_cc_max_seq_num - base + 1;
+		if(count > JANUS_ICE_TWCC_MAX_FEEDBACK)
+			count = JANUS_ICE_TWCC_MAX_FEEDBACK;
+		/* Copy the reception times and clear the slots for the next round */
+		guint i = 0;
+		for(i=0; i<count; i++) {
+			guint idx = (base + i) & JANUS_ICE_TWCC_MASK;
+			timestamps[i] = stream->transport_wide_cc_timestamps[idx];
+			stream->transport_wide_cc_timestamps[idx] = 0;
+		}
+		stream->transport_wide_cc_base_seq_num = base + count;
+		/* Get feedback packet count and increase it for next one */
+		guint8 feedback_packet_count = stream->transport_wide_cc_feedback_count++;
+		janus_mutex_unlock(&stream->mutex);
+		/* Create rtcp packet */
+		int len = janus_rtcp_transport_wide_cc_feedback(rtcpbuf, sizeof(rtcpbuf),
+			stream->video_ssrc, stream->video_ssrc_peer[0], feedback_packet_count, (guint16)base, timestamps, count);
+		/* Enqueue it, we'll send it later */
+		if(len > 0)
+			janus_ice_relay_rtcp_internal(handle, 1, rtcpbuf, len, FALSE);
+	}
+}
+/* Keep track of the reception time of a transport wide sequence number */
+static void janus_ice_transport_wide_cc_track(janus_ice_handle *handle, janus_ice_stream *stream, guint32 ext_seq_num, guint64 timestamp) {
+	janus_mutex_lock(&stream->mutex);
+	if(stream->transport_wide_cc_timestamps == NULL) {
+		/* First packet */
+		stream->transport_wide_cc_timestamps = g_malloc0(JANUS_ICE_TWCC_WINDOW * sizeof(guint64));
+		stream->transport_wide_cc_base_seq_num = ext_seq_num;
+		stream->transport_wide_cc_max_seq_num = ext_seq_num;
+	}
+	if(ext_seq_num < stream->transport_wide_cc_base_seq_num) {
+		/* Too late, it was already reported as lost */
+		janus_mutex_unlock(&stream->mutex);
+		return;
+	}
+	if(ext_seq_num - stream->transport_wide_cc_base_seq_num >= JANUS_ICE_TWCC_WINDOW) {
+		/* No room left in the window: send feedback for what we have right away */
+		janus_mutex_unlock(&stream->mutex);
+		janus_ice_transport_wide_cc_feedback(handle, stream);
+		janus_mutex_lock(&stream->mutex);
+		if(ext_seq_num - stream->transport_wide_cc_base_seq_num >= JANUS_ICE_TWCC_WINDOW) {
+			/* Still too far ahead (the array is empty now), skip the gap */
+			stream->transport_wide_cc_base_seq_num = ext_seq_num;
+		}
+	}
+	stream->transport_wide_cc_timestamps[ext_seq_num & JANUS_ICE_TWCC_MASK] = timestamp;
+	if(ext_seq_num > stream->transport_wide_cc_max_seq_num ||
+			stream->transport_wide_cc_max_seq_num < stream->transport_wide_cc_base_seq_num)
+		stream->transport_wide_cc_max_seq_num = ext_seq_num;
+	janus_mutex_unlock(&stream->mutex);
+}
+
 
 /* Map of active plugin sessions */
 static GHashTable *plugin_sessions;
@@ -469,10 +2390,8 @@ static void janus_ice_clear_queued_packets(janus_ice_handle *handle) {
 		return;
 	}
 	janus_ice_queued_packet *pkt = NULL;
-	while(g_async_queue_length(handle->queued_packets) > 0) {
-		pkt = g_async_queue_try_pop(handle->queued_packets);
+	while((pkt = janus_ice_queue_pop(handle->queued_packets)) != NULL)
 		janus_ice_free_queued_packet(pkt);
-	}
 }
 
 
@@ -526,7 +2445,7 @@ static void janus_ice_notify_media(janus_ice_handle *handle, gboolean video, gbo
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Sending event to transport...\n", handle->handle_id);
 	janus_session_notify_event(session, event);
 	/* Notify event handlers as well */
-	if(janus_events_is_enabled()) {
+	if(janus_events_should_notify(JANUS_EVENT_TYPE_MEDIA)) {
 		json_t *info = json_object();
 		json_object_set_new(info, "media", json_string(video ? "video" : "audio"));
 		json_object_set_new(info, "receiving", up ? json_true() : json_false());
@@ -554,7 +2473,7 @@ void janus_ice_notify_hangup(janus_ice_handle *handle, const char *reason) {
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Sending event to transport...; %p\n", handle->handle_id, handle);
 	janus_session_notify_event(session, event);
 	/* Notify event handlers as well */
-	if(janus_events_is_enabled()) {
+	if(janus_events_should_notify(JANUS_EVENT_TYPE_WEBRTC)) {
 		json_t *info = json_object();
 		json_object_set_new(info, "connection", json_string("hangup"));
 		if(reason != NULL)
@@ -653,12 +2572,168 @@ void janus_ice_trickle_destroy(janus_ice_trickle *trickle) {
 }
 
 
+/* Static event loops: by default each handle gets its own loop and thread,
+ * but a fixed pool of loops can be shared by all handles instead */
+static int static_event_loops = 0;
+static GSList *event_loops = NULL;
+static janus_mutex event_loops_mutex = JANUS_MUTEX_INITIALIZER;
+void janus_ice_set_static_event_loops(int loops) {
+	if(loops < 0) {
+		JANUS_LOG(LOG_WARN, "Invalid number of static event loops (%d), falling back to one loop per handle\n", loops);
+		loops = 0;
+	}
+	static_event_loops = loops;
+}
+int janus_ice_get_static_event_loops(void) {
+	return static_event_loops;
+}
+static json_t *janus_ice_static_event_loops_pools_info(void) {
+	if(static_event_loops == 0)
+		return NULL;
+	json_t *list = json_array();
+	janus_mutex_lock(&event_loops_mutex);
+	GSList *l = event_loops;
+	while(l) {
+		janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)l->data;
+		json_t *info = json_object();
+		json_object_set_new(info, "id", json_integer(loop->id));
+		janus_ice_packet_pool_summary(loop->packet_pool, info);
+		json_array_append_new(list, info);
+		l = l->next;
+	}
+	janus_mutex_unlock(&event_loops_mutex);
+	return list;
+}
+json_t *janus_ice_static_event_loops_info(void) {
+	if(static_event_loops == 0)
+		return NULL;
+	json_t *list = json_array();
+	janus_mutex_lock(&event_loops_mutex);
+	GSList *l = event_loops;
+	while(l) {
+		janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)l->data;
+		json_t *info = json_object();
+		json_object_set_new(info, "id", json_integer(loop->id));
+		json_object_set_new(info, "handles", json_integer(g_atomic_int_get(&loop->handles)));
+		if(loop->cpu >= 0) {
+			json_object_set_new(info, "cpu", json_integer(loop->cpu));
+			json_object_set_new(info, "node", json_integer(loop->node));
+		}
+		json_array_append_new(list, info);
+		l = l->next;
+	}
+	janus_mutex_unlock(&event_loops_mutex);
+	return list;
+}
+static void *janus_ice_static_event_loop_thread(void *data) {
+	janus_ice_static_event_loop *loop = data;
+	JANUS_LOG(LOG_VERB, "[loop#%d] Event loop thread started\n", loop->id);
+	if(loop->mainloop == NULL) {
+		JANUS_LOG(LOG_ERR, "[loop#%d] Invalid loop...\n", loop->id);
+		g_thread_unref(g_thread_self());
+		return NULL;
+	}
+	if(loop->cpu >= 0 && janus_affinity_pin_cpu(loop->cpu) == 0)
+		JANUS_LOG(LOG_VERB, "[loop#%d] Pinned to CPU %d (NUMA node %d)\n", loop->id, loop->cpu, loop->node);
+	JANUS_LOG(LOG_DBG, "[loop#%d] Looping...\n", loop->id);
+	g_main_loop_run(loop->mainloop);
+	JANUS_LOG(LOG_VERB, "[loop#%d] Event loop thread ended!\n", loop->id);
+	return NULL;
+}
+/* Pick the static event loop with the fewest handles, preferring the ones
+ * pinned to the NUMA node of the handle affinity group, if any */
+static janus_ice_static_event_loop *janus_ice_static_event_loop_pick(int node) {
+	janus_ice_static_event_loop *best = NULL;
+	janus_mutex_lock(&event_loops_mutex);
+	GSList *l = event_loops;
+	while(l) {
+		janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)l->data;
+		gboolean same_node = (node < 0 || loop->node == node);
+		gboolean best_same_node = best && (node < 0 || best->node == node);
+		if(best == NULL || (same_node && !best_same_node) ||
+				(same_node == best_same_node && g_atomic_int_get(&loop->handles) < g_atomic_int_get(&best->handles)))
+			best = loop;
+		l = l->next;
+	}
+	if(best != NULL)
+		g_atomic_int_inc(&best->handles);
+	janus_mutex_unlock(&event_loops_mutex);
+	return best;
+}
+/* When using static event loops there's no per-handle thread to get rid
+ * of the WebRTC resources when the loop quits, so we do it here instead */
+static gboolean janus_ice_static_event_loop_cleanup(gpointer user_data) {
+	janus_ice_handle *handle = (janus_ice_handle *)user_data;
+	if(handle->cdone == 0)
+		handle->cdone = -1;
+	janus_flags_clear(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ICE_RESTART);
+	janus_flags_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_CLEANING);
+	janus_ice_webrtc_free(handle);
+	return G_SOURCE_REMOVE;
+}
+static void janus_ice_static_event_loop_cleanup_done(gpointer user_data) {
+	janus_ice_handle *handle = (janus_ice_handle *)user_data;
+	janus_refcount_decrease(&handle->ref);
+}
+
+/* Affinity groups */
+void janus_ice_handle_set_affinity_group(janus_ice_handle *handle, const char *group) {
+	if(handle == NULL)
+		return;
+	janus_mutex_lock(&handle->mutex);
+	if(handle->affinity_group == NULL || group == NULL || strcmp(handle->affinity_group, group)) {
+		g_free(handle->affinity_group);
+		handle->affinity_group = group ? g_strdup(group) : NULL;
+		handle->affinity_node = janus_affinity_group_node(group);
+		if(handle->agent != NULL && handle->affinity_node >= 0) {
+			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Affinity group set to %s after the ICE agent was created, placement won't change\n",
+				handle->handle_id, group);
+		}
+	}
+	janus_mutex_unlock(&handle->mutex);
+}
+json_t *janus_ice_handle_affinity_info(janus_ice_handle *handle) {
+	if(handle == NULL || !janus_affinity_is_enabled(janus_affinity_pool_media))
+		return NULL;
+	json_t *info = json_object();
+	janus_mutex_lock(&handle->mutex);
+	if(handle->affinity_group)
+		json_object_set_new(info, "group", json_string(handle->affinity_group));
+	if(handle->static_loop != NULL) {
+		json_object_set_new(info, "event-loop", json_integer(handle->static_loop->id));
+		if(handle->static_loop->cpu >= 0) {
+			char cpu[16];
+			g_snprintf(cpu, sizeof(cpu), "%d", handle->static_loop->cpu);
+			json_object_set_new(info, "node", json_integer(handle->static_loop->node));
+			json_object_set_new(info, "cpus", json_string(cpu));
+		}
+	} else {
+		/* Dedicated thread, pinned to all the media CPUs of the node (or all of them) */
+		int node = handle->affinity_node;
+		char *cpus = janus_affinity_pool_cpus(janus_affinity_pool_media, node);
+		if(cpus == NULL) {
+			node = -1;
+			cpus = janus_affinity_pool_cpus(janus_affinity_pool_media, -1);
+		}
+		if(node >= 0)
+			json_object_set_new(info, "node", json_integer(node));
+		if(cpus != NULL)
+			json_object_set_new(info, "cpus", json_string(cpus));
+		g_free(cpus);
+	}
+	janus_mutex_unlock(&handle->mutex);
+	return info;
+}
+
+
 /* libnice initialization */
 void janus_ice_init(gboolean ice_lite, gboolean ice_tcp, gboolean full_trickle, gboolean ipv6, uint16_t rtp_min_port, uint16_t rtp_max_port) {
 	janus_ice_lite_enabled = ice_lite;
 	janus_ice_tcp_enabled = ice_tcp;
 	janus_full_trickle_enabled = full_trickle;
 	janus_ipv6_enabled = ipv6;
+	janus_ice_metrics_register();
+	handles_memory = janus_memory_account_create("handles", NULL);
 	JANUS_LOG(LOG_INFO, "Initializing ICE stuff (%s mode, ICE-TCP candidates %s, %s-trickle, IPv6 support %s)\n",
 		janus_ice_lite_enabled ? "Lite" : "Full",
 		janus_ice_tcp_enabled ? "enabled" : "disabled",
@@ -694,6 +2769,26 @@ void janus_ice_init(gboolean ice_lite, gboolean ice_tcp, gboolean full_trickle,
 #endif
 	}
 
+#ifdef JANUS_ICE_NETLINK
+	/* Get notified about interface changes, so that we know when to refresh the local addresses */
+	janus_ice_netlink_open();
+#endif
+	janus_ice_local_addresses_invalidate();
+
+	/* Check if all handles should share the same port */
+	if(janus_ice_mux_port > 0) {
+		if(!janus_ice_lite_enabled) {
+			JANUS_LOG(LOG_WARN, "ICE-Lite multiplexing only works if you enable ICE Lite too: disabling it\n");
+			janus_ice_mux_port = 0;
+		} else {
+			if(janus_ice_tcp_enabled) {
+				JANUS_LOG(LOG_WARN, "ICE-TCP is not supported when multiplexing: disabling ICE-TCP support\n");
+				janus_ice_tcp_enabled = FALSE;
+			}
+			janus_ice_mux_start();
+		}
+	}
+
 	/* We keep track of plugin sessions to avoid problems */
 	plugin_sessions = g_hash_table_new(NULL, NULL);
 	janus_mutex_init(&plugin_sessions_mutex);
@@ -703,12 +2798,94 @@ void janus_ice_init(gboolean ice_lite, gboolean ice_tcp, gboolean full_trickle,
 	janus_turnrest_init();
 #endif
 
+	/* If we need to use static event loops, create them now */
+	if(static_event_loops > 0) {
+		JANUS_LOG(LOG_INFO, "Using %d static event loops for media traffic\n", static_event_loops);
+		int i = 0;
+		for(i=0; i<static_event_loops; i++) {
+			janus_ice_static_event_loop *loop = g_malloc0(sizeof(janus_ice_static_event_loop));
+			loop->id = i;
+			loop->mainctx = g_main_context_new();
+			loop->mainloop = g_main_loop_new(loop->mainctx, FALSE);
+			loop->packet_pool = g_malloc(sizeof(janus_ice_packet_pool));
+			janus_ice_packet_pool_init(loop->packet_pool);
+			/* If there's an affinity policy, loops are spread on the media CPUs */
+			loop->cpu = janus_affinity_get_cpu(janus_affinity_pool_media, -1, i);
+			loop->node = loop->cpu >= 0 ? janus_affinity_cpu_node(loop->cpu) : -1;
+			GError *error = NULL;
+			char tname[16];
+			g_snprintf(tname, sizeof(tname), "hloop %d", loop->id);
+			loop->thread = g_thread_try_new(tname, &janus_ice_static_event_loop_thread, loop, &error);
+			if(error != NULL) {
+				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch a new event loop thread...\n",
+					error->code, error->message ? error->message : "??");
+				g_error_free(error);
+				g_main_loop_unref(loop->mainloop);
+				g_main_context_unref(loop->mainctx);
+				g_free(loop->packet_pool);
+				g_free(loop);
+				break;
+			}
+			event_loops = g_slist_append(event_loops, loop);
+		}
+		if(event_loops == NULL) {
+			JANUS_LOG(LOG_WARN, "Couldn't create any static event loop, falling back to one loop per handle\n");
+			static_event_loops = 0;
+		} else {
+			static_event_loops = g_slist_length(event_loops);
+		}
+	}
 }
 
 void janus_ice_deinit(void) {
+	janus_ice_mux_stop();
+	janus_mutex_lock(&janus_ice_local_addresses_mutex);
+	if(janus_ice_netlink_fd >= 0)
+		close(janus_ice_netlink_fd);
+	janus_ice_netlink_fd = -1;
+	if(janus_ice_local_addresses != NULL)
+		g_array_free(janus_ice_local_addresses, TRUE);
+	janus_ice_local_addresses = NULL;
+	janus_mutex_unlock(&janus_ice_local_addresses_mutex);
+	janus_mutex_lock(&ice_list_mutex);
+	g_clear_pointer(&janus_ice_enforce_list, janus_network_filter_destroy);
+	g_clear_pointer(&janus_ice_ignore_list, janus_network_filter_destroy);
+	janus_mutex_unlock(&ice_list_mutex);
+	/* Stop the static event loops, if any */
+	janus_mutex_lock(&event_loops_mutex);
+	GSList *l = event_loops;
+	while(l) {
+		janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)l->data;
+		if(loop->mainloop != NULL && g_main_loop_is_running(loop->mainloop))
+			g_main_loop_quit(loop->mainloop);
+		if(loop->thread != NULL)
+			g_thread_join(loop->thread);
+		g_main_loop_unref(loop->mainloop);
+		g_main_context_unref(loop->mainctx);
+		janus_ice_packet_pool_clear(loop->packet_pool);
+		if(loop->packet_pool->in_use == 0) {
+			g_free(loop->packet_pool);
+		} else {
+			/* Some packets still reference this pool, leave it be */
+			JANUS_LOG(LOG_WARN, "[loop#%d] %u packets still in use, not freeing the pool\n", loop->id, loop->packet_pool->in_use);
+		}
+		g_free(loop);
+		l = l->next;
+	}
+	g_slist_free(event_loops);
+	event_loops = NULL;
+	janus_mutex_unlock(&event_loops_mutex);
+	janus_ice_packet_pool_clear(&janus_ice_shared_packet_pool);
+	janus_mutex_lock(&plugin_latencies_mutex);
+	if(plugin_latencies != NULL)
+		g_hash_table_destroy(plugin_latencies);
+	plugin_latencies = NULL;
+	janus_mutex_unlock(&plugin_latencies_mutex);
 #ifdef HAVE_LIBCURL
 	janus_turnrest_deinit();
 #endif
+	janus_memory_account_destroy(handles_memory);
+	handles_memory = NULL;
 }
 
 int janus_ice_set_stun_server(gchar *stun_server, uint16_t stun_port) {
@@ -963,6 +3140,7 @@ janus_ice_handle *janus_ice_handle_create(void *core_session, const char *opaque
 	handle = (janus_ice_handle *)g_malloc0(sizeof(janus_ice_handle));
 	JANUS_LOG(LOG_INFO, "Creating new handle in session %"SCNu64": %"SCNu64"; %p %p\n", session->session_id, handle_id, core_session, handle);
 	janus_refcount_init(&handle->ref, janus_ice_free);
+	janus_metric_inc(metric_handles);
 	janus_refcount_increase(&session->ref);
 	handle->session = core_session;
 	if(opaque_id)
@@ -971,7 +3149,14 @@ janus_ice_handle *janus_ice_handle_create(void *core_session, const char *opaque
 	handle->handle_id = handle_id;
 	handle->app = NULL;
 	handle->app_handle = NULL;
-	handle->queued_packets = g_async_queue_new();
+	handle->queued_packets = janus_ice_queue_create();
+	if(janus_ice_mux_port > 0)
+		handle->mux_incoming = janus_ice_queue_create();
+	char account[32];
+	g_snprintf(account, sizeof(account), "handle-%"SCNu64, handle_id);
+	handle->memory = janus_memory_account_create(account, handles_memory);
+	janus_memory_charge(handle->memory, janus_memory_handles, janus_ice_handle_memory(handle));
+	handle->affinity_node = -1;
 	janus_mutex_init(&handle->mutex);
 	janus_session_handles_insert(session, handle);
 	return handle;
@@ -1012,7 +3197,7 @@ gint janus_ice_handle_attach_plugin(void *core_session, janus_ice_handle *handle
 	g_hash_table_insert(plugin_sessions, session_handle, session_handle);
 	janus_mutex_unlock(&plugin_sessions_mutex);
 	/* Notify event handlers */
-	if(janus_events_is_enabled())
+	if(janus_events_should_notify(JANUS_EVENT_TYPE_HANDLE))
 		janus_events_notify_handlers(JANUS_EVENT_TYPE_HANDLE,
 			session->session_id, handle->handle_id, "attached", plugin->get_package(), handle->opaque_id);
 	return 0;
@@ -1048,7 +3233,7 @@ gint janus_ice_handle_destroy(void *core_session, janus_ice_handle *handle) {
 			if(handle->stream_id > 0) {
 				nice_agent_attach_recv(handle->agent, handle->stream_id, 1, g_main_loop_get_context (handle->iceloop), NULL, NULL);
 			}
-			if(handle->iceloop != NULL && g_main_loop_is_running(handle->iceloop)) {
+			if(handle->static_loop == NULL && handle->iceloop != NULL && g_main_loop_is_running(handle->iceloop)) {
 				g_main_loop_quit(handle->iceloop);
 			}
 		}
@@ -1080,7 +3265,7 @@ gint janus_ice_handle_destroy(void *core_session, janus_ice_handle *handle) {
 	/* We only actually destroy the handle later */
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Handle detached (error=%d), scheduling destruction\n", handle->handle_id, error);
 	/* Notify event handlers as well */
-	if(janus_events_is_enabled())
+	if(janus_events_should_notify(JANUS_EVENT_TYPE_HANDLE))
 		janus_events_notify_handlers(JANUS_EVENT_TYPE_HANDLE,
 			session->session_id, handle->handle_id, "detached", plugin_t->get_package(), handle->opaque_id);
 	/* Unref the handle: we only unref the session too when actually freeing the handle, so that it is freed before that */
@@ -1090,11 +3275,27 @@ gint janus_ice_handle_destroy(void *core_session, janus_ice_handle *handle) {
 
 void janus_ice_free(const janus_refcount *handle_ref) {
 	janus_ice_handle *handle = janus_refcount_containerof(handle_ref, janus_ice_handle, ref);
+	janus_metric_dec(metric_handles);
+	gint64 memory = janus_ice_handle_memory(handle);
 	/* This stack can be destroyed, free all the resources */
 	janus_mutex_lock(&handle->mutex);
 	if(handle->queued_packets != NULL) {
 		janus_ice_clear_queued_packets(handle);
-		g_async_queue_unref(handle->queued_packets);
+		janus_ice_queue_destroy(handle->queued_packets);
+		handle->queued_packets = NULL;
+	}
+	if(handle->mux_incoming != NULL) {
+		janus_ice_mux_packet *pkt = NULL;
+		while((pkt = janus_ice_queue_pop(handle->mux_incoming)) != NULL)
+			g_free(pkt);
+		janus_ice_queue_destroy(handle->mux_incoming);
+		handle->mux_incoming = NULL;
+	}
+	g_free(handle->latency);
+	handle->latency = NULL;
+	if(handle->ingress_batch != NULL) {
+		janus_ice_ingress_batch_destroy(handle->ingress_batch);
+		handle->ingress_batch = NULL;
 	}
 	if(handle->app_handle != NULL)
 		janus_refcount_decrease(&handle->app_handle->ref);
@@ -1106,7 +3307,12 @@ void janus_ice_free(const janus_refcount *handle_ref) {
 		janus_session *session = (janus_session *)handle->session;
 		janus_refcount_decrease(&session->ref);
 	}
+	/* Anything still charged to the handle account goes away with it: the
+	 * retransmit buffers hold their own reference, in case they outlive us */
+	janus_memory_release(handle->memory, janus_memory_handles, memory);
+	janus_memory_account_destroy(handle->memory);
 	g_free(handle->opaque_id);
+	g_free(handle->affinity_group);
 	g_free(handle);
 }
 
@@ -1134,19 +3340,28 @@ void janus_ice_webrtc_hangup(janus_ice_handle *handle, const char *reason) {
 			handle->hangup_reason = reason;
 		}
 	}
-	if(handle->queued_packets != NULL)
-#if GLIB_CHECK_VERSION(2, 46, 0)
-		g_async_queue_push_front(handle->queued_packets, &janus_ice_dtls_alert);
-#else
-		g_async_queue_push(handle->queued_packets, &janus_ice_dtls_alert);
-#endif
+	if(handle->queued_packets != NULL) {
+		janus_ice_queue_push_priority(handle->queued_packets, &janus_ice_dtls_alert);
+		janus_ice_queue_signal(handle->queued_packets, handle->icectx);
+	}
+	/* If we're multiplexing, stop routing incoming packets to this handle */
+	janus_ice_mux_unregister(handle);
 	/* Get rid of the loop */
 	if(handle->iceloop != NULL) {
 		if(handle->stream_id > 0) {
 			nice_agent_attach_recv(handle->agent, handle->stream_id, 1, g_main_loop_get_context (handle->iceloop), NULL, NULL);
 		}
 		if(handle->rtp_source == NULL) {
-			g_main_loop_quit(handle->iceloop);
+			if(handle->static_loop == NULL) {
+				g_main_loop_quit(handle->iceloop);
+			} else {
+				/* The loop is shared, schedule the cleanup of this handle on it */
+				GSource *cleanup = g_idle_source_new();
+				janus_refcount_increase(&handle->ref);
+				g_source_set_callback(cleanup, janus_ice_static_event_loop_cleanup, handle, janus_ice_static_event_loop_cleanup_done);
+				g_source_attach(cleanup, handle->icectx);
+				g_source_unref(cleanup);
+			}
 		}
 	}
 }
@@ -1154,8 +3369,11 @@ void janus_ice_webrtc_hangup(janus_ice_handle *handle, const char *reason) {
 void janus_ice_webrtc_free(janus_ice_handle *handle) {
 	if(handle == NULL)
 		return;
+	/* If we're multiplexing, this may release references to the handle, so do it before locking */
+	janus_ice_mux_unregister(handle);
 	janus_mutex_lock(&handle->mutex);
 	janus_flags_clear(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY);
+	janus_ice_mux_source_destroy(handle);
 	if(handle->iceloop != NULL) {
 		g_main_loop_unref (handle->iceloop);
 		handle->iceloop = NULL;
@@ -1164,6 +3382,10 @@ void janus_ice_webrtc_free(janus_ice_handle *handle) {
 		g_main_context_unref (handle->icectx);
 		handle->icectx = NULL;
 	}
+	if(handle->static_loop != NULL) {
+		(void)g_atomic_int_dec_and_test(&handle->static_loop->handles);
+		handle->static_loop = NULL;
+	}
 	if(handle->stream != NULL) {
 		janus_ice_stream_destroy(handle->stream);
 		handle->stream = NULL;
@@ -1270,8 +3492,8 @@ void janus_ice_stream_free(const janus_refcount *stream_ref) {
 	if(stream->rtx_nacked[2])
 		g_hash_table_destroy(stream->rtx_nacked[2]);
 	stream->rtx_nacked[2] = NULL;
-	g_slist_free_full(stream->transport_wide_received_seq_nums, (GDestroyNotify)g_free);
-	stream->transport_wide_received_seq_nums = NULL;
+	g_free(stream->transport_wide_cc_timestamps);
+	stream->transport_wide_cc_timestamps = NULL;
 	stream->audio_first_ntp_ts = 0;
 	stream->audio_first_rtp_ts = 0;
 	stream->video_first_ntp_ts[0] = 0;
@@ -1315,32 +3537,12 @@ void janus_ice_component_free(const janus_refcount *component_ref) {
 		janus_refcount_decrease(&component->dtls->ref);
 		component->dtls = NULL;
 	}
-	if(component->audio_retransmit_buffer != NULL) {
-		janus_rtp_packet *p = NULL;
-		while((p = (janus_rtp_packet *)g_queue_pop_head(component->audio_retransmit_buffer)) != NULL) {
-			/* Remove from hashtable too */
-			janus_rtp_header *header = (janus_rtp_header *)p->data;
-			guint16 seq = ntohs(header->seq_number);
-			g_hash_table_remove(component->audio_retransmit_seqs, GUINT_TO_POINTER(seq));
-			/* Free the packet */
-			janus_ice_free_rtp_packet(p);
-		}
-		g_queue_free(component->audio_retransmit_buffer);
-		g_hash_table_destroy(component->audio_retransmit_seqs);
-	}
-	if(component->video_retransmit_buffer != NULL) {
-		janus_rtp_packet *p = NULL;
-		while((p = (janus_rtp_packet *)g_queue_pop_head(component->video_retransmit_buffer)) != NULL) {
-			/* Remove from hashtable too */
-			janus_rtp_header *header = (janus_rtp_header *)p->data;
-			guint16 seq = ntohs(header->seq_number);
-			g_hash_table_remove(component->video_retransmit_seqs, GUINT_TO_POINTER(seq));
-			/* Free the packet */
-			janus_ice_free_rtp_packet(p);
-		}
-		g_queue_free(component->video_retransmit_buffer);
-		g_hash_table_destroy(component->video_retransmit_seqs);
-	}
+	janus_ice_egress_batch_destroy(component->egress_batch);
+	component->egress_batch = NULL;
+	janus_ice_retransmit_buffer_destroy(component->audio_retransmit_buffer);
+	component->audio_retransmit_buffer = NULL;
+	janus_ice_retransmit_buffer_destroy(component->video_retransmit_buffer);
+	component->video_retransmit_buffer = NULL;
 	if(component->candidates != NULL) {
 		GSList *i = NULL, *candidates = component->candidates;
 		for (i = candidates; i; i = i->next) {
@@ -1376,14 +3578,14 @@ void janus_ice_component_free(const janus_refcount *component_ref) {
 	component->remote_candidates = NULL;
 	g_free(component->selected_pair);
 	component->selected_pair = NULL;
-	if(component->last_seqs_audio)
-		janus_seq_list_free(&component->last_seqs_audio);
-	if(component->last_seqs_video[0])
-		janus_seq_list_free(&component->last_seqs_video[0]);
-	if(component->last_seqs_video[1])
-		janus_seq_list_free(&component->last_seqs_video[1]);
-	if(component->last_seqs_video[2])
-		janus_seq_list_free(&component->last_seqs_video[2]);
+	g_free(component->last_seqs_audio);
+	component->last_seqs_audio = NULL;
+	g_free(component->last_seqs_video[0]);
+	component->last_seqs_video[0] = NULL;
+	g_free(component->last_seqs_video[1]);
+	component->last_seqs_video[1] = NULL;
+	g_free(component->last_seqs_video[2]);
+	component->last_seqs_video[2] = NULL;
 	g_free(component);
 	//~ janus_mutex_unlock(&handle->mutex);
 }
@@ -1433,7 +3635,7 @@ janus_slow_link_update(janus_ice_component *component, janus_ice_handle *handle,
 			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Sending event to transport...; %p\n", handle->handle_id, handle);
 			janus_session_notify_event(session, event);
 			/* Finally, notify event handlers */
-			if(janus_events_is_enabled()) {
+			if(janus_events_should_notify(JANUS_EVENT_TYPE_MEDIA)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "media", json_string(video ? "video" : "audio"));
 				json_object_set_new(info, "slow_link", json_string(uplink ? "uplink" : "downlink"));
@@ -1519,6 +3721,15 @@ static void janus_ice_cb_candidate_gathering_done(NiceAgent *agent, guint stream
 		return;
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Gathering done for stream %d\n", handle->handle_id, stream_id);
 	handle->cdone++;
+	if(handle->gathering_done == 0) {
+		handle->gathering_done = janus_get_monotonic_time();
+		GSList *candidates = nice_agent_get_local_candidates(agent, stream_id, 1);
+		handle->gathered_candidates = g_slist_length(candidates);
+		g_slist_free_full(candidates, (GDestroyNotify)nice_candidate_free);
+		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Gathered %u candidates in %"SCNi64"us (setup took %"SCNi64"us)\n",
+			handle->handle_id, handle->gathered_candidates, handle->gathering_done - handle->gathering_started,
+			handle->gathering_started - handle->setup_started);
+	}
 	janus_ice_stream *stream = handle->stream;
 	if(!stream || stream->stream_id != stream_id) {
 		JANUS_LOG(LOG_ERR, "[%"SCNu64"]  No stream %d??\n", handle->handle_id, stream_id);
@@ -1554,7 +3765,7 @@ static void janus_ice_cb_component_state_changed(NiceAgent *agent, guint stream_
 	}
 	component->state = state;
 	/* Notify event handlers */
-	if(janus_events_is_enabled()) {
+	if(janus_events_should_notify(JANUS_EVENT_TYPE_WEBRTC)) {
 		janus_session *session = (janus_session *)handle->session;
 		json_t *info = json_object();
 		json_object_set_new(info, "ice", json_string(janus_get_ice_state_name(state)));
@@ -1666,9 +3877,14 @@ static void janus_ice_cb_new_selected_pair (NiceAgent *agent, guint stream_id, g
 		gchar *prev_selected_pair = component->selected_pair;
 		component->selected_pair = g_strdup(sp);
 		g_clear_pointer(&prev_selected_pair, g_free);
+		/* If we're batching, we'll need to check the new pair before sending again */
+		if(component->egress_batch != NULL) {
+			janus_ice_egress_flush(handle);
+			component->egress_batch->checked = FALSE;
+		}
 	}
 	/* Notify event handlers */
-	if(newpair && janus_events_is_enabled()) {
+	if(newpair && janus_events_should_notify(JANUS_EVENT_TYPE_WEBRTC)) {
 		janus_session *session = (janus_session *)handle->session;
 		json_t *info = json_object();
 		json_object_set_new(info, "selected-pair", json_string(sp));
@@ -1694,6 +3910,11 @@ static void janus_ice_cb_new_selected_pair (NiceAgent *agent, guint stream_id, g
 		json_object_set_new(info, "component_id", json_integer(component_id));
 		janus_events_notify_handlers(JANUS_EVENT_TYPE_WEBRTC, session->session_id, handle->handle_id, handle->opaque_id, info);
 	}
+	janus_ice_component_connected(handle, component);
+}
+
+/* Called when the component has a pair (or, when multiplexing, an address) to use */
+static void janus_ice_component_connected(janus_ice_handle *handle, janus_ice_component *component) {
 	/* Have we been here before? (might happen, when trickling) */
 	if(component->component_connected > 0)
 		return;
@@ -1706,11 +3927,8 @@ static void janus_ice_cb_new_selected_pair (NiceAgent *agent, guint stream_id, g
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"]   Component is ready enough, starting DTLS handshake...\n", handle->handle_id);
 	component->component_connected = janus_get_monotonic_time();
 	/* Start the DTLS handshake, at last */
-#if GLIB_CHECK_VERSION(2, 46, 0)
-	g_async_queue_push_front(handle->queued_packets, &janus_ice_dtls_handshake);
-#else
-	g_async_queue_push(handle->queued_packets, &janus_ice_dtls_handshake);
-#endif
+	janus_ice_queue_push_priority(handle->queued_packets, &janus_ice_dtls_handshake);
+	janus_ice_queue_signal(handle->queued_packets, handle->icectx);
 }
 
 /* Candidates management */
@@ -1948,7 +4166,7 @@ static void janus_ice_cb_new_remote_candidate (NiceAgent *agent, NiceCandidate *
 	component->remote_candidates = g_slist_append(component->remote_candidates, g_strdup(buffer));
 
 	/* Notify event handlers */
-	if(janus_events_is_enabled()) {
+	if(janus_events_should_notify(JANUS_EVENT_TYPE_WEBRTC)) {
 		janus_session *session = (janus_session *)handle->session;
 		json_t *info = json_object();
 		json_object_set_new(info, "remote-candidate", json_string(buffer));
@@ -1981,6 +4199,9 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 		return;
 	}
 	janus_session *session = (janus_session *)handle->session;
+	JANUS_TRACE3(ice_recv, handle->handle_id, component_id, len);
+	/* If we're tracking latency, this is where packets enter the pipeline */
+	gint64 received = g_atomic_int_get(&media_latency) ? janus_get_monotonic_time() : 0;
 	if(!component->dtls) {	/* Still waiting for the DTLS stack */
 		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Still waiting for the DTLS stack for component %d in stream %d...\n", handle->handle_id, component_id, stream_id);
 		return;
@@ -1993,6 +4214,8 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 		/* Update stats (TODO Do the same for the last second window as well) */
 		component->in_stats.data.packets++;
 		component->in_stats.data.bytes += len;
+		janus_metric_inc(metric_packets_received[2]);
+		janus_metric_add(metric_bytes_received[2], len);
 		return;
 	}
 	/* Not DTLS... RTP or RTCP? (http://tools.ietf.org/html/rfc5761#section-4) */
@@ -2001,7 +4224,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 	if(janus_is_rtp(buf)) {
 		/* This is RTP */
 		if(!component->dtls || !component->dtls->srtp_valid || !component->dtls->srtp_in) {
-			JANUS_LOG(LOG_WARN, "[%"SCNu64"]     Missing valid SRTP session (packet arrived too early?), skipping...\n", handle->handle_id);
+			JANUS_LOG_RATELIMITED(LOG_WARN, "[%"SCNu64"]     Missing valid SRTP session (packet arrived too early?), skipping...\n", handle->handle_id);
 		} else {
 			janus_rtp_header *header = (janus_rtp_header *)buf;
 			guint32 packet_ssrc = ntohl(header->ssrc);
@@ -2050,7 +4273,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 					}
 				}
 				if(!video && stream->audio_ssrc_peer != packet_ssrc) {
-					JANUS_LOG(LOG_WARN, "[%"SCNu64"] Not video and not audio? dropping (SSRC %"SCNu32")...\n", handle->handle_id, packet_ssrc);
+					JANUS_LOG_RATELIMITED(LOG_WARN, "[%"SCNu64"] Not video and not audio? dropping (SSRC %"SCNu32")...\n", handle->handle_id, packet_ssrc);
 					return;
 				}
 			}
@@ -2089,13 +4312,18 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 			}
 
 			int buflen = len;
+			gint64 srtp_start = janus_ice_srtp_timing_start();
+			JANUS_TRACE3(srtp_unprotect_start, handle->handle_id, 0, len);
 			srtp_err_status_t res = srtp_unprotect(component->dtls->srtp_in, buf, &buflen);
+			JANUS_TRACE4(srtp_unprotect_done, handle->handle_id, 0, buflen, res);
+			janus_ice_srtp_timing_end(handle, component->dtls, FALSE, srtp_start);
 			if(res != srtp_err_status_ok) {
 				if(res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
 					/* Only print the error if it's not a 'replay fail' or 'replay old' (which is probably just the result of us NACKing a packet) */
+					janus_metric_inc(metric_srtp_errors);
 					guint32 timestamp = ntohl(header->timestamp);
 					guint16 seq = ntohs(header->seq_number);
-					JANUS_LOG(LOG_ERR, "[%"SCNu64"]     SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n", handle->handle_id, janus_srtp_error_str(res), len, buflen, timestamp, seq);
+					JANUS_LOG_RATELIMITED(LOG_ERR, "[%"SCNu64"]     SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n", handle->handle_id, janus_srtp_error_str(res), len, buflen, timestamp, seq);
 				}
 			} else {
 				if(video) {
@@ -2141,12 +4369,12 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 					int nstate = GPOINTER_TO_INT(g_hash_table_lookup(stream->rtx_nacked[vindex], GUINT_TO_POINTER(seqno)));
 					if(nstate == 1) {
 						/* Packet was NACKed and this is the first time we receive it: change state to received */
-						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Received NACKed packet %"SCNu16" (SSRC %"SCNu32", vindex %d)...\n",
+						JANUS_LOG_DEFERRED(LOG_HUGE, "[%"SCNu64"] Received NACKed packet %"SCNu16" (SSRC %"SCNu32", vindex %d)...\n",
 							handle->handle_id, seqno, packet_ssrc, vindex);
 						g_hash_table_insert(stream->rtx_nacked[vindex], GUINT_TO_POINTER(seqno), GUINT_TO_POINTER(2));
 					} else if(nstate == 2) {
 						/* We already received this packet: drop it */
-						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Detected duplicate packet %"SCNu16" (SSRC %"SCNu32", vindex %d)...\n",
+						JANUS_LOG_DEFERRED(LOG_HUGE, "[%"SCNu64"] Detected duplicate packet %"SCNu16" (SSRC %"SCNu32", vindex %d)...\n",
 							handle->handle_id, seqno, packet_ssrc, vindex);
 						return;
 					}
@@ -2192,18 +4420,23 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 							stream->video_is_keyframe = &janus_vp9_is_keyframe;
 						else if(!strcasecmp(stream->video_codec, "h264"))
 							stream->video_is_keyframe = &janus_h264_is_keyframe;
+						stream->video_codec_id = janus_videocodec_from_name(stream->video_codec);
 					}
 				}
+				/* Parse the RTP extensions once, for us and for the plugin */
+				janus_plugin_rtp_packet packet = { .video = video, .buffer = buf, .length = buflen, .received = received };
+				janus_rtp_ext_info_parse(buf, buflen, &packet.extensions);
+				/* Parse the video payload descriptor once as well */
+				if(video)
+					janus_rtp_media_info_parse(stream->video_codec_id, buf, buflen, &packet.media);
 				/* Check if we need to handle transport wide cc */
 				if(stream->do_transport_wide_cc) {
 					guint16 transport_seq_num;
 					/* Get transport wide seq num */
-					if(janus_rtp_header_extension_parse_transport_wide_cc(buf, buflen, stream->transport_wide_cc_ext_id, &transport_seq_num)==0) {
+					if(janus_rtp_ext_info_transport_wide_cc(&packet.extensions, buf, stream->transport_wide_cc_ext_id, &transport_seq_num)==0) {
 						/* Get current timestamp */
 						struct timeval now;
 						gettimeofday(&now,0);
-						/* Create <seq num, time> pair */
-						janus_rtcp_transport_wide_cc_stats *stats = g_malloc0(sizeof(janus_rtcp_transport_wide_cc_stats));
 						/* Check if we have a sequence wrap */
 						if(transport_seq_num<0x0FFF && (stream->transport_wide_cc_last_seq_num&0xFFFF)>0xF000) {
 							/* Increase cycles */
@@ -2213,21 +4446,27 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						guint32 transport_ext_seq_num = stream->transport_wide_cc_cycles<<16 | transport_seq_num;
 						/* Store last received transport seq num */
 						stream->transport_wide_cc_last_seq_num = transport_seq_num;
-						/* Set stats values */
-						stats->transport_seq_num = transport_ext_seq_num;
-						stats->timestamp = (((guint64)now.tv_sec)*1E6+now.tv_usec);
-						/* Lock & append to received list*/
-						janus_mutex_lock(&stream->mutex);
-						stream->transport_wide_received_seq_nums = g_slist_prepend(stream->transport_wide_received_seq_nums, stats);
-						janus_mutex_unlock(&stream->mutex);
+						/* Store the reception time */
+						janus_ice_transport_wide_cc_track(handle, stream, transport_ext_seq_num,
+							(((guint64)now.tv_sec)*1E6+now.tv_usec));
 					}
 				}
 				/* Pass the data to the responsible plugin */
 				janus_plugin *plugin = (janus_plugin *)handle->app;
 				if(plugin && plugin->incoming_rtp &&
 						!g_atomic_int_get(&handle->app_handle->stopped) &&
-						!g_atomic_int_get(&handle->destroyed))
-					plugin->incoming_rtp(handle->app_handle, video, buf, buflen);
+						!g_atomic_int_get(&handle->destroyed) &&
+						!janus_ice_ingress_batch_add(handle, plugin, &packet)) {
+					janus_ice_latency *latency = janus_ice_latency_get(handle);
+					gint64 start = janus_ice_latency_plugin_start(latency, received);
+					JANUS_TRACE3(plugin_rtp_start, handle->handle_id, video, buflen);
+					if(plugin->incoming_rtp_packet)
+						plugin->incoming_rtp_packet(handle->app_handle, &packet);
+					else
+						plugin->incoming_rtp(handle->app_handle, video, buf, buflen);
+					JANUS_TRACE3(plugin_rtp_done, handle->handle_id, video, buflen);
+					janus_ice_latency_plugin_end(latency, start);
+				}
 				/* Restore the header for the stats (plugins may have messed with it) */
 				*header = backup;
 				/* Update stats (overall data received, and data received in the last second) */
@@ -2242,6 +4481,8 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						/* Overall audio data */
 						component->in_stats.audio.packets++;
 						component->in_stats.audio.bytes += buflen;
+						janus_metric_inc(metric_packets_received[0]);
+						janus_metric_add(metric_bytes_received[0], buflen);
 						/* Last second audio data */
 						if(component->in_stats.audio.updated == 0)
 							component->in_stats.audio.updated = now;
@@ -2261,6 +4502,8 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						/* Overall video data for this SSRC */
 						component->in_stats.video[vindex].packets++;
 						component->in_stats.video[vindex].bytes += buflen;
+						janus_metric_inc(metric_packets_received[1]);
+						janus_metric_add(metric_bytes_received[1], buflen);
 						/* Last second video data for this SSRC */
 						if(component->in_stats.video[vindex].updated == 0)
 							component->in_stats.video[vindex].updated = now;
@@ -2287,24 +4530,19 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 					return;
 				}
 				/* If this is video, check if this is a keyframe: if so, we empty our NACK queue */
-				if(video && stream->video_is_keyframe) {
-					int plen = 0;
-					char *payload = janus_rtp_payload(buf, buflen, &plen);
-					if(stream->video_is_keyframe(payload, plen)) {
-						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Keyframe received, resetting NACK queue\n", handle->handle_id);
-						if(component->last_seqs_video[vindex])
-							janus_seq_list_free(&component->last_seqs_video[vindex]);
-					}
+				if(video && packet.media.keyframe) {
+					JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Keyframe received, resetting NACK queue\n", handle->handle_id);
+					janus_seq_window_reset(component->last_seqs_video[vindex]);
 				}
 				guint16 new_seqn = ntohs(header->seq_number);
 				guint16 cur_seqn;
-				int last_seqs_len = 0;
 				janus_mutex_lock(&component->mutex);
-				janus_seq_info **last_seqs = video ? &component->last_seqs_video[vindex] : &component->last_seqs_audio;
-				janus_seq_info *cur_seq = *last_seqs;
-				if(cur_seq) {
-					cur_seq = cur_seq->prev;
-					cur_seqn = cur_seq->seq;
+				janus_seq_window **last_seqs = video ? &component->last_seqs_video[vindex] : &component->last_seqs_audio;
+				if(*last_seqs == NULL)
+					*last_seqs = g_malloc0(sizeof(janus_seq_window));
+				janus_seq_window *window = *last_seqs;
+				if(window->count > 0) {
+					cur_seqn = window->last;
 				} else {
 					/* First seq, set up to add one seq */
 					cur_seqn = new_seqn - (guint16)1; /* Can wrap */
@@ -2314,74 +4552,84 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 					/* Jump too big, start fresh */
 					JANUS_LOG(LOG_WARN, "[%"SCNu64"] Big sequence number jump %hu -> %hu (%s stream #%d)\n",
 						handle->handle_id, cur_seqn, new_seqn, video ? "video" : "audio", vindex);
-					janus_seq_list_free(last_seqs);
-					cur_seq = NULL;
+					janus_seq_window_reset(window);
 					cur_seqn = new_seqn - (guint16)1;
 				}
 
 				GSList *nacks = NULL;
 				gint64 now = janus_get_monotonic_time();
 
+				/* These are the sequence numbers we had before this packet */
+				guint16 oldest = window->last - window->count + 1;
+				int remaining = window->count;
 				if(janus_seq_in_range(new_seqn, cur_seqn, LAST_SEQS_MAX_LEN)) {
-					/* Add new seq objs forward */
+					/* Add new seqs forward */
 					while(cur_seqn != new_seqn) {
 						cur_seqn += (guint16)1; /* can wrap */
-						janus_seq_info *seq_obj = g_malloc0(sizeof(janus_seq_info));
-						seq_obj->seq = cur_seqn;
-						seq_obj->ts = now;
-						seq_obj->state = (cur_seqn == new_seqn) ? SEQ_RECVED : SEQ_MISSING;
-						janus_seq_append(last_seqs, seq_obj);
-						last_seqs_len++;
+						janus_seq_window_append(window, cur_seqn,
+							(cur_seqn == new_seqn) ? SEQ_RECVED : SEQ_MISSING, now);
+					}
+				}
+				if(remaining > 0 && janus_seq_in_range(new_seqn, oldest, remaining)) {
+					/* This is an old seq, maybe one we were waiting for */
+					guint idx = new_seqn & JANUS_SEQ_WINDOW_MASK;
+					if(window->state[idx] != SEQ_RECVED) {
+						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Received missed sequence number %"SCNu16" (%s stream #%d)\n",
+							handle->handle_id, new_seqn, video ? "video" : "audio", vindex);
 					}
+					window->state[idx] = SEQ_RECVED;
+					janus_seq_window_set_pending(window, idx, FALSE);
 				}
-				if(cur_seq) {
-					/* Scan old seq objs backwards */
-					while(cur_seq != NULL) {
-						last_seqs_len++;
-						if(cur_seq->seq == new_seqn) {
-							JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Received missed sequence number %"SCNu16" (%s stream #%d)\n",
-								handle->handle_id, cur_seq->seq, video ? "video" : "audio", vindex);
-							cur_seq->state = SEQ_RECVED;
-						} else if(cur_seq->state == SEQ_MISSING && now - cur_seq->ts > SEQ_MISSING_WAIT) {
+				if(remaining > 0) {
+					/* Check the old seqs: thanks to the bitmap, we only visit those we're still waiting for */
+					guint16 seq = oldest;
+					while(remaining > 0) {
+						guint idx = seq & JANUS_SEQ_WINDOW_MASK;
+						guint32 bits = window->pending[idx >> 5] >> (idx & 31);
+						if(!(bits & 1)) {
+							/* Skip to the next pending seq in this word, if any, or to the next word */
+							int skip = bits ? g_bit_nth_lsf(bits, -1) : 32 - (int)(idx & 31);
+							skip = MIN(skip, remaining);
+							seq += skip;
+							remaining -= skip;
+							continue;
+						}
+						if(window->state[idx] == SEQ_MISSING && now - window->ts[idx] > SEQ_MISSING_WAIT) {
 							JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Missed sequence number %"SCNu16" (%s stream #%d), sending 1st NACK\n",
-								handle->handle_id, cur_seq->seq, video ? "video" : "audio", vindex);
-							nacks = g_slist_append(nacks, GUINT_TO_POINTER(cur_seq->seq));
-							cur_seq->state = SEQ_NACKED;
+								handle->handle_id, seq, video ? "video" : "audio", vindex);
+							nacks = g_slist_prepend(nacks, GUINT_TO_POINTER(seq));
+							window->state[idx] = SEQ_NACKED;
 							if(video && janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX)) {
 								/* Keep track of this sequence number, we need to avoid duplicates */
-								JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Tracking NACKed packet %"SCNu16" (SSRC %"SCNu32", vindex %d)...\n",
-									handle->handle_id, cur_seq->seq, packet_ssrc, vindex);
+								JANUS_LOG_DEFERRED(LOG_HUGE, "[%"SCNu64"] Tracking NACKed packet %"SCNu16" (SSRC %"SCNu32", vindex %d)...\n",
+									handle->handle_id, seq, packet_ssrc, vindex);
 								if(stream->rtx_nacked[vindex] == NULL)
 									stream->rtx_nacked[vindex] = g_hash_table_new(NULL, NULL);
-								g_hash_table_insert(stream->rtx_nacked[vindex], GUINT_TO_POINTER(cur_seq->seq), GINT_TO_POINTER(1));
+								g_hash_table_insert(stream->rtx_nacked[vindex], GUINT_TO_POINTER(seq), GINT_TO_POINTER(1));
 								/* We don't track it forever, though: add a timed source to remove it in a few seconds */
 								janus_ice_nacked_packet *np = g_malloc(sizeof(janus_ice_nacked_packet));
 								np->handle = handle;
-								np->seq_number = new_seqn;
+								np->seq_number = seq;
 								np->vindex = vindex;
 								GSource *timeout_source = g_timeout_source_new_seconds(5);
 								g_source_set_callback(timeout_source, janus_ice_nacked_packet_cleanup, np, (GDestroyNotify)g_free);
 								g_source_attach(timeout_source, handle->icectx);
 								g_source_unref(timeout_source);
 							}
-						} else if(cur_seq->state == SEQ_NACKED  && now - cur_seq->ts > SEQ_NACKED_WAIT) {
+						} else if(window->state[idx] == SEQ_NACKED && now - window->ts[idx] > SEQ_NACKED_WAIT) {
 							JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Missed sequence number %"SCNu16" (%s stream #%d), sending 2nd NACK\n",
-								handle->handle_id, cur_seq->seq, video ? "video" : "audio", vindex);
-							nacks = g_slist_append(nacks, GUINT_TO_POINTER(cur_seq->seq));
-							cur_seq->state = SEQ_GIVEUP;
+								handle->handle_id, seq, video ? "video" : "audio", vindex);
+							nacks = g_slist_prepend(nacks, GUINT_TO_POINTER(seq));
+							window->state[idx] = SEQ_GIVEUP;
+							janus_seq_window_set_pending(window, idx, FALSE);
 						}
-						if(cur_seq == *last_seqs) {
-							/* Just processed head */
-							break;
-						}
-						cur_seq = cur_seq->prev;
+						seq++;
+						remaining--;
 					}
+					/* We visited the seqs from the oldest to the most recent, let's keep that order */
+					nacks = g_slist_reverse(nacks);
 				}
-				while(last_seqs_len > LAST_SEQS_MAX_LEN) {
-					janus_seq_info *node = janus_seq_pop_head(last_seqs);
-					g_free(node);
-					last_seqs_len--;
-				}
+				janus_seq_window_trim(window, LAST_SEQS_MAX_LEN);
 
 				guint nacks_count = g_slist_length(nacks);
 				if(nacks_count) {
@@ -2399,6 +4647,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 					}
 					/* Update stats */
 					component->nack_sent_recent_cnt += nacks_count;
+					janus_metric_add(metric_nacks_sent, nacks_count);
 					if(video) {
 						component->out_stats.video[vindex].nacks += nacks_count;
 					} else {
@@ -2424,19 +4673,27 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 		/* This is RTCP */
 		JANUS_LOG(LOG_HUGE, "[%"SCNu64"]  Got an RTCP packet\n", handle->handle_id);
 		if(!component->dtls || !component->dtls->srtp_valid || !component->dtls->srtp_in) {
-			JANUS_LOG(LOG_WARN, "[%"SCNu64"]     Missing valid SRTP session (packet arrived too early?), skipping...\n", handle->handle_id);
+			JANUS_LOG_RATELIMITED(LOG_WARN, "[%"SCNu64"]     Missing valid SRTP session (packet arrived too early?), skipping...\n", handle->handle_id);
 		} else {
 			int buflen = len;
+			gint64 srtp_start = janus_ice_srtp_timing_start();
+			JANUS_TRACE3(srtp_unprotect_start, handle->handle_id, 1, len);
 			srtp_err_status_t res = srtp_unprotect_rtcp(component->dtls->srtp_in, buf, &buflen);
+			JANUS_TRACE4(srtp_unprotect_done, handle->handle_id, 1, buflen, res);
+			janus_ice_srtp_timing_end(handle, component->dtls, FALSE, srtp_start);
 			if(res != srtp_err_status_ok) {
-				JANUS_LOG(LOG_ERR, "[%"SCNu64"]     SRTCP unprotect error: %s (len=%d-->%d)\n", handle->handle_id, janus_srtp_error_str(res), len, buflen);
+				janus_metric_inc(metric_srtp_errors);
+				JANUS_LOG_RATELIMITED(LOG_ERR, "[%"SCNu64"]     SRTCP unprotect error: %s (len=%d-->%d)\n", handle->handle_id, janus_srtp_error_str(res), len, buflen);
 			} else {
 				/* Do we need to dump this packet for debugging? */
 				if(g_atomic_int_get(&handle->dump_packets))
 					janus_text2pcap_dump(handle->text2pcap, JANUS_TEXT2PCAP_RTCP, TRUE, buf, buflen,
 						"[session=%"SCNu64"][handle=%"SCNu64"]", session->session_id, handle->handle_id);
+				/* Walk the compound packet once, and check what's in there */
+				janus_rtcp_summary summary;
+				janus_rtcp_summarize(buf, buflen, &summary);
 				/* Check if there's an RTCP BYE: in case, let's log it */
-				if(janus_rtcp_has_bye(buf, buflen)) {
+				if(summary.has_bye) {
 					/* Note: we used to use this as a trigger to close the PeerConnection, but not anymore
 					 * Discussion here, https://groups.google.com/forum/#!topic/meetecho-janus/4XtfbYB7Jvc */
 					JANUS_LOG(LOG_VERB, "[%"SCNu64"] Got RTCP BYE on stream %"SCNu16" (component %"SCNu16")\n", handle->handle_id, stream->stream_id, component->component_id);
@@ -2457,14 +4714,14 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						/* We don't know the remote SSRC: this can happen for recvonly clients
 						 * (see https://groups.google.com/forum/#!topic/discuss-webrtc/5yuZjV7lkNc)
 						 * Check the local SSRC, compare it to what we have */
-						guint32 rtcp_ssrc = janus_rtcp_get_receiver_ssrc(buf, len);
+						guint32 rtcp_ssrc = summary.receiver_ssrc;
 						if(rtcp_ssrc == stream->audio_ssrc) {
 							video = 0;
 						} else if(rtcp_ssrc == stream->video_ssrc) {
 							video = 1;
 						} else {
 							/* Mh, no SR or RR? Try checking if there's any FIR, PLI or REMB */
-							if(janus_rtcp_has_fir(buf, len) || janus_rtcp_has_pli(buf, len) || janus_rtcp_get_remb(buf, len)) {
+							if(summary.has_fir || summary.has_pli || summary.remb) {
 								video = 1;
 							}
 						}
@@ -2473,7 +4730,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 					} else {
 						/* Check the remote SSRC, compare it to what we have: in case
 						 * we're simulcasting, let's compare to the other SSRCs too */
-						guint32 rtcp_ssrc = janus_rtcp_get_sender_ssrc(buf, len);
+						guint32 rtcp_ssrc = summary.sender_ssrc;
 						if(rtcp_ssrc == stream->audio_ssrc_peer) {
 							video = 0;
 						} else if(rtcp_ssrc == stream->video_ssrc_peer[0]) {
@@ -2497,37 +4754,34 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 
 				/* Now let's see if there are any NACKs to handle */
 				gint64 now = janus_get_monotonic_time();
-				GSList *nacks = janus_rtcp_get_nacks(buf, buflen);
-				guint nacks_count = g_slist_length(nacks);
+				guint nacks_count = summary.nacks_count;
 				if(nacks_count && ((!video && component->do_audio_nacks) || (video && component->do_video_nacks))) {
 					/* Handle NACK */
 					JANUS_LOG(LOG_HUGE, "[%"SCNu64"]     Just got some NACKS (%d) we should handle...\n", handle->handle_id, nacks_count);
-					GSList *list = nacks;
 					int retransmits_cnt = 0;
+					guint i = 0;
 					janus_mutex_lock(&component->mutex);
-					while(list) {
-						unsigned int seqnr = GPOINTER_TO_UINT(list->data);
+					for(i=0; i<nacks_count; i++) {
+						unsigned int seqnr = summary.nacks[i];
 						JANUS_LOG(LOG_DBG, "[%"SCNu64"]   >> %u\n", handle->handle_id, seqnr);
 						int in_rb = 0;
 						/* Check if we have the packet */
-						janus_rtp_packet *p = g_hash_table_lookup(video ?
-							component->video_retransmit_seqs : component->audio_retransmit_seqs, GUINT_TO_POINTER(seqnr));
+						janus_rtp_packet *p = janus_ice_retransmit_buffer_lookup(video ?
+							component->video_retransmit_buffer : component->audio_retransmit_buffer, seqnr, now);
 						if(p == NULL) {
-							JANUS_LOG(LOG_HUGE, "[%"SCNu64"]   >> >> Can't retransmit packet %u, we don't have it...\n", handle->handle_id, seqnr);
+							JANUS_LOG_DEFERRED(LOG_HUGE, "[%"SCNu64"]   >> >> Can't retransmit packet %u, we don't have it...\n", handle->handle_id, seqnr);
 						} else {
 							/* Should we retransmit this packet? */
 							if((p->last_retransmit > 0) && (now-p->last_retransmit < MAX_NACK_IGNORE)) {
-								JANUS_LOG(LOG_HUGE, "[%"SCNu64"]   >> >> Packet %u was retransmitted just %"SCNi64"ms ago, skipping\n", handle->handle_id, seqnr, now-p->last_retransmit);
-								list = list->next;
+								JANUS_LOG_DEFERRED(LOG_HUGE, "[%"SCNu64"]   >> >> Packet %u was retransmitted just %"SCNi64"ms ago, skipping\n", handle->handle_id, seqnr, now-p->last_retransmit);
 								continue;
 							}
 							in_rb = 1;
-							JANUS_LOG(LOG_HUGE, "[%"SCNu64"]   >> >> Scheduling %u for retransmission due to NACK\n", handle->handle_id, seqnr);
+							JANUS_LOG_DEFERRED(LOG_HUGE, "[%"SCNu64"]   >> >> Scheduling %u for retransmission due to NACK\n", handle->handle_id, seqnr);
 							p->last_retransmit = now;
 							retransmits_cnt++;
 							/* Enqueue it */
-							janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
-							pkt->data = g_malloc(p->length+SRTP_MAX_TAG_LEN);
+							janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(handle, p->length+SRTP_MAX_TAG_LEN);
 							memcpy(pkt->data, p->data, p->length);
 							pkt->length = p->length;
 							pkt->type = video ? JANUS_ICE_PACKET_VIDEO : JANUS_ICE_PACKET_AUDIO;
@@ -2545,22 +4799,22 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 								component->rtx_seq_number++;
 								header->seq_number = htons(component->rtx_seq_number);
 							}
-							if(handle->queued_packets != NULL)
-#if GLIB_CHECK_VERSION(2, 46, 0)
-								g_async_queue_push_front(handle->queued_packets, pkt);
-#else
-								g_async_queue_push(handle->queued_packets, pkt);
-#endif
+							if(handle->queued_packets != NULL) {
+								janus_ice_queue_push_priority(handle->queued_packets, pkt);
+								janus_ice_queue_signal(handle->queued_packets, handle->icectx);
+							} else {
+								janus_ice_free_queued_packet(pkt);
+							}
 						}
 						if (rtcp_ctx != NULL && in_rb) {
 							g_atomic_int_inc(&rtcp_ctx->nack_count);
 						}
-						list = list->next;
 					}
 					component->retransmit_recent_cnt += retransmits_cnt;
 					/* FIXME Remove the NACK compound packet, we've handled it */
 					buflen = janus_rtcp_remove_nacks(buf, buflen);
 					/* Update stats */
+					janus_metric_add(metric_nacks_received, nacks_count);
 					if(video) {
 						component->in_stats.video[vindex].nacks += nacks_count;
 					} else {
@@ -2569,8 +4823,6 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 					/* Inform the plugin about the slow uplink in case it's needed */
 					janus_slow_link_update(component, handle, retransmits_cnt, video, 1, now);
 					janus_mutex_unlock(&component->mutex);
-					g_slist_free(nacks);
-					nacks = NULL;
 				}
 				if(component->retransmit_recent_cnt &&
 						now - component->retransmit_log_ts > 5*G_USEC_PER_SEC) {
@@ -2595,6 +4847,8 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 		if(len > 0) {
 			component->in_stats.data.packets++;
 			component->in_stats.data.bytes += len;
+			janus_metric_inc(metric_packets_received[2]);
+			janus_metric_add(metric_bytes_received[2], len);
 		}
 		return;
 	}
@@ -2622,6 +4876,9 @@ static void *janus_ice_thread(void *data) {
 		g_thread_unref(g_thread_self());
 		return NULL;
 	}
+	/* If there's an affinity policy, stay on the media CPUs of our NUMA node */
+	if(janus_affinity_is_enabled(janus_affinity_pool_media))
+		janus_affinity_pin_pool(janus_affinity_pool_media, handle->affinity_node);
 	JANUS_LOG(LOG_DBG, "[%"SCNu64"] Looping (ICE)...\n", handle->handle_id);
 	if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT)) {
 		g_main_loop_run (loop);
@@ -2788,7 +5045,7 @@ static int janus_ice_candidate_to_string(janus_ice_handle *handle, NiceCandidate
 		/* Save for the summary, in case we need it */
 		component->local_candidates = g_slist_append(component->local_candidates, g_strdup(buffer));
 		/* Notify event handlers */
-		if(janus_events_is_enabled()) {
+		if(janus_events_should_notify(JANUS_EVENT_TYPE_WEBRTC)) {
 			janus_session *session = (janus_session *)handle->session;
 			json_t *info = json_object();
 			json_object_set_new(info, "local-candidate", json_string(buffer));
@@ -2813,6 +5070,11 @@ void janus_ice_candidates_to_sdp(janus_ice_handle *handle, janus_sdp_mline *mlin
 		JANUS_LOG(LOG_ERR, "[%"SCNu64"]     No component %d in stream %d??\n", handle->handle_id, component_id, stream_id);
 		return;
 	}
+	if(janus_ice_mux_port > 0) {
+		/* We didn't gather anything, all handles share the same port */
+		janus_ice_mux_candidates_to_sdp(handle, mline);
+		return;
+	}
 	NiceAgent *agent = handle->agent;
 	/* Iterate on all */
 	gchar buffer[200];
@@ -2908,6 +5170,10 @@ int janus_ice_setup_local(janus_ice_handle *handle, int offer, int audio, int vi
 		return -2;
 	}
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Setting ICE locally: got %s (%d audios, %d videos)\n", handle->handle_id, offer ? "OFFER" : "ANSWER", audio, video);
+	handle->setup_started = janus_get_monotonic_time();
+	handle->gathering_started = 0;
+	handle->gathering_done = 0;
+	handle->gathered_candidates = 0;
 	janus_flags_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_AGENT);
 	janus_flags_clear(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_START);
 	janus_flags_clear(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY);
@@ -2944,8 +5210,16 @@ int janus_ice_setup_local(janus_ice_handle *handle, int offer, int audio, int vi
 	janus_flags_clear(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALL_TRICKLES);
 	janus_flags_clear(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_TRICKLE_SYNCED);
 
-	handle->icectx = g_main_context_new();
-	handle->iceloop = g_main_loop_new(handle->icectx, FALSE);
+	if(static_event_loops > 0) {
+		/* We're using static event loops, pick the least loaded one */
+		handle->static_loop = janus_ice_static_event_loop_pick(handle->affinity_node);
+		handle->icectx = g_main_context_ref(handle->static_loop->mainctx);
+		handle->iceloop = g_main_loop_ref(handle->static_loop->mainloop);
+		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Using static event loop #%d\n", handle->handle_id, handle->static_loop->id);
+	} else {
+		handle->icectx = g_main_context_new();
+		handle->iceloop = g_main_loop_new(handle->icectx, FALSE);
+	}
 	/* Note: NICE_COMPATIBILITY_RFC5245 is only available in more recent versions of libnice */
 	handle->controlling = janus_ice_lite_enabled ? FALSE : !offer;
 	JANUS_LOG(LOG_INFO, "[%"SCNu64"] Creating ICE agent (ICE %s mode, %s)\n", handle->handle_id,
@@ -2973,7 +5247,8 @@ int janus_ice_setup_local(janus_ice_handle *handle, int offer, int audio, int vi
 	/* Any dynamic TURN credentials to retrieve via REST API? */
 	gboolean have_turnrest_credentials = FALSE;
 #ifdef HAVE_LIBCURL
-	janus_turnrest_response *turnrest_credentials = janus_turnrest_request();
+	/* When multiplexing we don't gather any candidate, so there's no point asking */
+	janus_turnrest_response *turnrest_credentials = janus_ice_mux_port > 0 ? NULL : janus_turnrest_request();
 	if(turnrest_credentials != NULL) {
 		have_turnrest_credentials = TRUE;
 		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Got credentials from the TURN REST API backend!\n", handle->handle_id);
@@ -3016,60 +5291,10 @@ int janus_ice_setup_local(janus_ice_handle *handle, int offer, int audio, int vi
 #endif
 		G_CALLBACK (janus_ice_cb_new_remote_candidate), handle);
 
-	/* Add all local addresses, except those in the ignore list */
-	struct ifaddrs *ifaddr, *ifa;
-	int family, s, n;
-	char host[NI_MAXHOST];
-	if(getifaddrs(&ifaddr) == -1) {
-		JANUS_LOG(LOG_ERR, "[%"SCNu64"] Error getting list of interfaces...", handle->handle_id);
-	} else {
-		for(ifa = ifaddr, n = 0; ifa != NULL; ifa = ifa->ifa_next, n++) {
-			if(ifa->ifa_addr == NULL)
-				continue;
-			/* Skip interfaces which are not up and running */
-			if (!((ifa->ifa_flags & IFF_UP) && (ifa->ifa_flags & IFF_RUNNING)))
-				continue;
-			/* Skip loopback interfaces */
-			if (ifa->ifa_flags & IFF_LOOPBACK)
-				continue;
-			family = ifa->ifa_addr->sa_family;
-			if(family != AF_INET && family != AF_INET6)
-				continue;
-			/* We only add IPv6 addresses if support for them has been explicitly enabled (still WIP, mostly) */
-			if(family == AF_INET6 && !janus_ipv6_enabled)
-				continue;
-			/* Check the interface name first, we can ignore that as well: enforce list would be checked later */
-			if(janus_ice_enforce_list == NULL && ifa->ifa_name != NULL && janus_ice_is_ignored(ifa->ifa_name))
-				continue;
-			s = getnameinfo(ifa->ifa_addr,
-					(family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6),
-					host, NI_MAXHOST, NULL, 0, NI_NUMERICHOST);
-			if(s != 0) {
-				JANUS_LOG(LOG_ERR, "[%"SCNu64"] getnameinfo() failed: %s\n", handle->handle_id, gai_strerror(s));
-				continue;
-			}
-			/* Skip 0.0.0.0, :: and local scoped addresses  */
-			if(!strcmp(host, "0.0.0.0") || !strcmp(host, "::") || !strncmp(host, "fe80:", 5))
-				continue;
-			/* Check if this IP address is in the ignore/enforce list, now: the enforce list has the precedence */
-			if(janus_ice_enforce_list != NULL) {
-				if(ifa->ifa_name != NULL && !janus_ice_is_enforced(ifa->ifa_name) && !janus_ice_is_enforced(host))
-					continue;
-			} else {
-				if(janus_ice_is_ignored(host))
-					continue;
-			}
-			/* Ok, add interface to the ICE agent */
-			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Adding %s to the addresses to gather candidates for\n", handle->handle_id, host);
-			NiceAddress addr_local;
-			nice_address_init (&addr_local);
-			if(!nice_address_set_from_string (&addr_local, host)) {
-				JANUS_LOG(LOG_WARN, "[%"SCNu64"] Skipping invalid address %s\n", handle->handle_id, host);
-				continue;
-			}
-			nice_agent_add_local_address (handle->agent, &addr_local);
-		}
-		freeifaddrs(ifaddr);
+	/* Add all local addresses, except those in the ignore list (we use a cached list) */
+	if(janus_ice_mux_port == 0) {
+		guint addresses = janus_ice_local_addresses_add(handle->agent);
+		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Added %u local addresses to gather candidates for\n", handle->handle_id, addresses);
 	}
 
 	handle->cdone = 0;
@@ -3162,12 +5387,26 @@ int janus_ice_setup_local(janus_ice_handle *handle, int offer, int audio, int vi
 	component->component_id = 1;
 	janus_mutex_init(&component->mutex);
 	stream->component = component;
+	if(janus_ice_mux_port > 0) {
+		/* All handles share the same port: there's nothing to gather, and
+		 * incoming packets will come from the multiplexing sockets instead */
+		janus_ice_mux_register(handle);
+		handle->mux_source = janus_ice_mux_source_create(handle);
+		g_source_set_priority(handle->mux_source, G_PRIORITY_DEFAULT);
+		g_source_attach(handle->mux_source, handle->icectx);
+		handle->gathering_started = janus_get_monotonic_time();
+		handle->gathering_done = handle->gathering_started;
+		handle->cdone = 1;
+		stream->cdone = 1;
+	} else {
 #ifdef HAVE_PORTRANGE
-	/* FIXME: libnice supports this since 0.1.0, but the 0.1.3 on Fedora fails with an undefined reference! */
-	nice_agent_set_port_range(handle->agent, handle->stream_id, 1, rtp_range_min, rtp_range_max);
+		/* FIXME: libnice supports this since 0.1.0, but the 0.1.3 on Fedora fails with an undefined reference! */
+		nice_agent_set_port_range(handle->agent, handle->stream_id, 1, rtp_range_min, rtp_range_max);
 #endif
-	nice_agent_gather_candidates(handle->agent, handle->stream_id);
-	nice_agent_attach_recv(handle->agent, handle->stream_id, 1, g_main_loop_get_context(handle->iceloop), janus_ice_cb_nice_recv, component);
+		handle->gathering_started = janus_get_monotonic_time();
+		nice_agent_gather_candidates(handle->agent, handle->stream_id);
+		nice_agent_attach_recv(handle->agent, handle->stream_id, 1, g_main_loop_get_context(handle->iceloop), janus_ice_cb_nice_recv, component);
+	}
 #ifdef HAVE_LIBCURL
 	if(turnrest_credentials != NULL) {
 		janus_turnrest_response_destroy(turnrest_credentials);
@@ -3184,6 +5423,10 @@ int janus_ice_setup_local(janus_ice_handle *handle, int offer, int audio, int vi
 		return -1;
 	}
 	janus_refcount_increase(&component->dtls->ref);
+	if(handle->static_loop != NULL) {
+		/* The loop is shared and already running, no need for a dedicated thread */
+		return 0;
+	}
 	GError *error = NULL;
 	char tname[16];
 	g_snprintf(tname, sizeof(tname), "iceloop %"SCNu64, handle->handle_id);
@@ -3206,6 +5449,9 @@ void janus_ice_restart(janus_ice_handle *handle) {
 	if(nice_agent_restart(handle->agent) == FALSE) {
 		JANUS_LOG(LOG_WARN, "[%"SCNu64"] ICE restart failed...\n", handle->handle_id);
 	}
+	/* The credentials changed: the old ones will keep on working until the handle goes away */
+	if(janus_ice_mux_port > 0)
+		janus_ice_mux_register(handle);
 	janus_flags_clear(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ICE_RESTART);
 }
 
@@ -3240,10 +5486,6 @@ void janus_ice_resend_trickles(janus_ice_handle *handle) {
 	janus_ice_notify_trickle(handle, NULL);
 }
 
-static gint rtcp_transport_wide_cc_stats_comparator(gconstpointer item1, gconstpointer item2) {
-	return ((rtcp_transport_wide_cc_stats*)item1)->transport_seq_num - ((rtcp_transport_wide_cc_stats*)item2)->transport_seq_num;
-}
-
 
 static gboolean janus_ice_outgoing_rtcp_handle(gpointer user_data) {
 	janus_ice_handle *handle = (janus_ice_handle *)user_data;
@@ -3361,55 +5603,8 @@ static gboolean janus_ice_outgoing_rtcp_handle(gpointer user_data) {
 		}
 	}
 	if(stream && stream->do_transport_wide_cc) {
-		/* Create a transport wide feedback message */
-		size_t size = 1300;
-		char rtcpbuf[1300];
-		/* Order packet list */
-		GSList *sorted = g_slist_sort(handle->stream->transport_wide_received_seq_nums, rtcp_transport_wide_cc_stats_comparator);
-		/* Create full stats queue */
-		GQueue *packets = g_queue_new();
-		/* For all packets */
-		GSList *it = NULL;
-		for (it = sorted; it; it = it->next) {
-			/* Get stat */
-			janus_rtcp_transport_wide_cc_stats *stats = (janus_rtcp_transport_wide_cc_stats *)it->data;
-			/* Get transport seq */
-			guint32 transport_seq_num = stats->transport_seq_num;
-			/* Check if it is an out of order  */
-			if (transport_seq_num < handle->stream->transport_wide_cc_last_feedback_seq_num)
-				/* Skip, it was already reported as lost */
-				continue;
-			/* If not first */
-			if (handle->stream->transport_wide_cc_last_feedback_seq_num) {
-				/* For each lost */
-				guint32 i = 0;
-				for (i = handle->stream->transport_wide_cc_last_feedback_seq_num+1; i<transport_seq_num; ++i) {
-					/* Create new stat */
-					janus_rtcp_transport_wide_cc_stats *missing = g_malloc(sizeof(janus_rtcp_transport_wide_cc_stats));
-					/* Add missing packet */
-					missing->transport_seq_num = i;
-					missing->timestamp = 0;
-					/* Add it */
-					g_queue_push_tail(packets, missing);
-				}
-			}
-			/* Store last */
-			handle->stream->transport_wide_cc_last_feedback_seq_num = transport_seq_num;
-			/* Add this one */
-			g_queue_push_tail(packets, stats);
-		}
-		/* Clear stats */
-		g_slist_free(handle->stream->transport_wide_received_seq_nums);
-		/* Reset list */
-		handle->stream->transport_wide_received_seq_nums = NULL;
-		/* Get feedback pacakte count and increase it for next one */
-		guint8 feedback_packet_count = handle->stream->transport_wide_cc_feedback_count++;
-		/* Create rtcp packet */
-		int len = janus_rtcp_transport_wide_cc_feedback(rtcpbuf, size, handle->stream->video_ssrc, stream->video_ssrc_peer[0] , feedback_packet_count, packets);
-		/* Enqueue it, we'll send it later */
-		janus_ice_relay_rtcp_internal(handle, 1, rtcpbuf, len, FALSE);
-		/* Free mem */
-		g_queue_free(packets);
+		/* Create transport wide feedback messages for what we received so far */
+		janus_ice_transport_wide_cc_feedback(handle, stream);
 	}
 	return G_SOURCE_CONTINUE;
 }
@@ -3477,7 +5672,8 @@ static gboolean janus_ice_outgoing_stats_handle(gpointer user_data) {
 	if(janus_ice_event_stats_period > 0 && handle->last_event_stats >= janus_ice_event_stats_period) {
 		handle->last_event_stats = 0;
 		/* Audio */
-		if(janus_events_is_enabled() && janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_AUDIO)) {
+		if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_AUDIO) &&
+				janus_events_should_notify_sampled(JANUS_EVENT_TYPE_MEDIA, &handle->event_stats_sampling[0])) {
 			if(stream && stream->audio_rtcp_ctx) {
 				json_t *info = json_object();
 				json_object_set_new(info, "media", json_string("audio"));
@@ -3505,7 +5701,8 @@ static gboolean janus_ice_outgoing_stats_handle(gpointer user_data) {
 			}
 		}
 		/* Do the same for video */
-		if(janus_events_is_enabled() && janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_VIDEO)) {
+		if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_VIDEO) &&
+				janus_events_should_notify_sampled(JANUS_EVENT_TYPE_MEDIA, &handle->event_stats_sampling[1])) {
 			int vindex=0;
 			for(vindex=0; vindex<3; vindex++) {
 				if(stream && stream->video_rtcp_ctx[vindex]) {
@@ -3542,8 +5739,6 @@ static gboolean janus_ice_outgoing_stats_handle(gpointer user_data) {
 			}
 		}
 	}
-	/* Should we clean up old NACK buffers for any of the streams? */
-	janus_cleanup_nack_buffer(now, handle->stream, TRUE, TRUE);
 	/* Check if we should also print a summary of SRTP-related errors */
 	handle->last_srtp_summary++;
 	if(handle->last_srtp_summary == 0 || handle->last_srtp_summary == 2) {
@@ -3562,6 +5757,7 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 	janus_session *session = (janus_session *)handle->session;
 	janus_ice_stream *stream = handle->stream;
 	janus_ice_component *component = stream->component;
+	JANUS_TRACE3(ice_send, handle->handle_id, pkt->type, pkt->length);
 	if(pkt == &janus_ice_dtls_handshake) {
 		/* Start the DTLS handshake */
 		janus_dtls_srtp_handshake(component->dtls);
@@ -3571,8 +5767,19 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 		guint id = g_source_attach(component->dtlsrt_source, handle->icectx);
 		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Creating retransmission timer with ID %u\n", handle->handle_id, id);
 		return G_SOURCE_CONTINUE;
+	} else if(pkt == &janus_ice_data_writable) {
+#ifdef HAVE_SCTP
+		/* The SCTP stack has room again: send what's pending, and check if the plugin is waiting */
+		if(component && component->dtls)
+			janus_dtls_send_pending_sctp_data(component->dtls);
+		janus_ice_data_check_watermarks(handle);
+#endif
+		return G_SOURCE_CONTINUE;
 	} else if(pkt == &janus_ice_dtls_alert) {
 		/* The session is over, send an alert on all streams and components */
+		janus_ice_egress_flush(handle);
+		/* The plugin was already told about the hangup, drop any incoming packet left */
+		janus_ice_ingress_batch_reset(handle->ingress_batch);
 		if(handle->stream && handle->stream->component && janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY)) {
 			janus_dtls_srtp_send_alert(handle->stream->component->dtls);
 		}
@@ -3592,13 +5799,16 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 			g_source_unref(handle->rtp_source);
 			handle->rtp_source = NULL;
 		}
+		janus_ice_mux_source_destroy(handle);
 		/* If event handlers are active, send stats one last time */
-		if(janus_events_is_enabled()) {
+		if(janus_events_is_type_enabled(JANUS_EVENT_TYPE_MEDIA)) {
 			handle->last_event_stats = janus_ice_event_stats_period;
 			(void)janus_ice_outgoing_stats_handle(handle);
 		}
 		return G_SOURCE_REMOVE;
 	}
+	if(pkt->type == JANUS_ICE_PACKET_DATA)
+		g_atomic_int_add(&handle->data_queued, -pkt->length);
 	if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY)) {
 		janus_ice_free_queued_packet(pkt);
 		return G_SOURCE_CONTINUE;
@@ -3612,7 +5822,7 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 	}
 	if(!stream->cdone) {
 		if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT) && !stream->noerrorlog) {
-			JANUS_LOG(LOG_ERR, "[%"SCNu64"] No candidates not gathered yet for stream??\n", handle->handle_id);
+			JANUS_LOG_RATELIMITED(LOG_ERR, "[%"SCNu64"] No candidates not gathered yet for stream??\n", handle->handle_id);
 			stream->noerrorlog = TRUE;	/* Don't flood with the same error all over again */
 		}
 		janus_ice_free_queued_packet(pkt);
@@ -3634,9 +5844,9 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 		component->noerrorlog = FALSE;
 		if(pkt->encrypted) {
 			/* Already SRTCP */
-			int sent = nice_agent_send(handle->agent, stream->stream_id, component->component_id, pkt->length, (const gchar *)pkt->data);
+			int sent = janus_ice_component_send(handle, component, pkt->length, pkt->data);
 			if(sent < pkt->length) {
-				JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, pkt->length);
+				JANUS_LOG_RATELIMITED(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, pkt->length);
 			}
 		} else {
 			/* Check if there's anything we need to do before sending */
@@ -3670,7 +5880,8 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 				char *prev_data = pkt->data;
 				pkt->data = rtcpbuf;
 				pkt->length = rrlen+pkt->length;
-				g_clear_pointer(&prev_data, g_free);
+				if(prev_data != pkt->pool_buffer)
+					g_clear_pointer(&prev_data, g_free);
 			}
 			/* Do we need to dump this packet for debugging? */
 			if(g_atomic_int_get(&handle->dump_packets))
@@ -3678,18 +5889,23 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 					"[session=%"SCNu64"][handle=%"SCNu64"]", session->session_id, handle->handle_id);
 			/* Encrypt SRTCP */
 			int protected = pkt->length;
+			gint64 srtp_start = janus_ice_srtp_timing_start();
+			JANUS_TRACE3(srtp_protect_start, handle->handle_id, 1, pkt->length);
 			int res = srtp_protect_rtcp(component->dtls->srtp_out, pkt->data, &protected);
+			JANUS_TRACE4(srtp_protect_done, handle->handle_id, 1, protected, res);
+			janus_ice_srtp_timing_end(handle, component->dtls, TRUE, srtp_start);
 			if(res != srtp_err_status_ok) {
 				/* We don't spam the logs for every SRTP error: just take note of this, and print a summary later */
 				handle->srtp_errors_count++;
+				janus_metric_inc(metric_srtp_errors);
 				handle->last_srtp_error = res;
 				/* If we're debugging, though, print every occurrence */
 				JANUS_LOG(LOG_DBG, "[%"SCNu64"] ... SRTCP protect error... %s (len=%d-->%d)...\n", handle->handle_id, janus_srtp_error_str(res), pkt->length, protected);
 			} else {
 				/* Shoot! */
-				int sent = nice_agent_send(handle->agent, stream->stream_id, component->component_id, protected, pkt->data);
+				int sent = janus_ice_component_send(handle, component, protected, pkt->data);
 				if(sent < protected) {
-					JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, protected);
+					JANUS_LOG_RATELIMITED(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, protected);
 				}
 			}
 		}
@@ -3716,12 +5932,14 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 			if(pkt->encrypted) {
 				/* Already RTP (probably a retransmission?) */
 				janus_rtp_header *header = (janus_rtp_header *)pkt->data;
-				JANUS_LOG(LOG_HUGE, "[%"SCNu64"] ... Retransmitting seq.nr %"SCNu16"\n\n", handle->handle_id, ntohs(header->seq_number));
-				int sent = nice_agent_send(handle->agent, stream->stream_id, component->component_id, pkt->length, (const gchar *)pkt->data);
+				JANUS_LOG_DEFERRED(LOG_HUGE, "[%"SCNu64"] ... Retransmitting seq.nr %"SCNu16"\n\n", handle->handle_id, ntohs(header->seq_number));
+				int sent = janus_ice_component_send(handle, component, pkt->length, pkt->data);
 				if(sent < pkt->length) {
-					JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, pkt->length);
+					JANUS_LOG_RATELIMITED(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, pkt->length);
 				}
 			} else {
+				/* If this packet is shared with other peers, this is where we get our own copy */
+				janus_ice_queued_packet_unshare(pkt);
 				/* Overwrite SSRC */
 				janus_rtp_header *header = (janus_rtp_header *)pkt->data;
 				if(!pkt->retransmission) {
@@ -3756,6 +5974,7 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 							stream->video_is_keyframe = &janus_vp9_is_keyframe;
 						else if(!strcasecmp(stream->video_codec, "h264"))
 							stream->video_is_keyframe = &janus_h264_is_keyframe;
+						stream->video_codec_id = janus_videocodec_from_name(stream->video_codec);
 					}
 				}
 				/* Do we need to dump this packet for debugging? */
@@ -3768,7 +5987,7 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 					char *payload = janus_rtp_payload(pkt->data, pkt->length, &plen);
 					if(stream->video_is_keyframe(payload, plen)) {
 						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Keyframe sent, cleaning retransmit buffer\n", handle->handle_id);
-						janus_cleanup_nack_buffer(0, stream, FALSE, TRUE);
+						janus_cleanup_nack_buffer(stream, FALSE, TRUE);
 					}
 				}
 				/* Before encrypting, check if we need to copy the unencrypted payload (e.g., for rtx/90000) */
@@ -3777,11 +5996,11 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 						janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX)) {
 					/* Save the packet for retransmissions that may be needed later: start by
 					 * making room for two more bytes to store the original sequence number */
-					p = g_malloc(sizeof(janus_rtp_packet));
 					janus_rtp_header *header = (janus_rtp_header *)pkt->data;
 					guint16 original_seq = header->seq_number;
-					p->data = g_malloc(pkt->length+2);
-					p->length = pkt->length+2;
+					if(component->video_retransmit_buffer == NULL)
+						component->video_retransmit_buffer = janus_ice_retransmit_buffer_create(handle->memory);
+					p = janus_ice_retransmit_buffer_store(component->video_retransmit_buffer, ntohs(original_seq), pkt->length+2);
 					/* Check where the payload starts */
 					int plen = 0;
 					char *payload = janus_rtp_payload(pkt->data, pkt->length, &plen);
@@ -3795,23 +6014,30 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 				}
 				/* Encrypt SRTP */
 				int protected = pkt->length;
+				gint64 srtp_start = janus_ice_srtp_timing_start();
+				JANUS_TRACE3(srtp_protect_start, handle->handle_id, 0, pkt->length);
 				int res = srtp_protect(component->dtls->srtp_out, pkt->data, &protected);
+				JANUS_TRACE4(srtp_protect_done, handle->handle_id, 0, protected, res);
+				janus_ice_srtp_timing_end(handle, component->dtls, TRUE, srtp_start);
 				if(res != srtp_err_status_ok) {
 					/* We don't spam the logs for every SRTP error: just take note of this, and print a summary later */
 					handle->srtp_errors_count++;
+					janus_metric_inc(metric_srtp_errors);
 					handle->last_srtp_error = res;
 					/* If we're debugging, though, print every occurrence */
 					janus_rtp_header *header = (janus_rtp_header *)pkt->data;
 					guint32 timestamp = ntohl(header->timestamp);
 					guint16 seq = ntohs(header->seq_number);
-					JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... SRTP protect error... %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")...\n", handle->handle_id, janus_srtp_error_str(res), pkt->length, protected, timestamp, seq);
-					janus_ice_free_rtp_packet(p);
+					JANUS_LOG_RATELIMITED(LOG_ERR, "[%"SCNu64"] ... SRTP protect error... %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")...\n", handle->handle_id, janus_srtp_error_str(res), pkt->length, protected, timestamp, seq);
+					if(p != NULL)
+						janus_ice_retransmit_buffer_drop(component->video_retransmit_buffer, seq);
 				} else {
 					/* Shoot! */
-					int sent = nice_agent_send(handle->agent, stream->stream_id, component->component_id, protected, pkt->data);
+					int sent = janus_ice_component_send(handle, component, protected, pkt->data);
 					if(sent < protected) {
-						JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, protected);
+						JANUS_LOG_RATELIMITED(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, protected);
 					}
+					janus_ice_latency_track_sent(handle, pkt);
 					/* Update stats */
 					if(sent > 0) {
 						/* Update the RTCP context as well */
@@ -3820,6 +6046,8 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 						if(pkt->type == JANUS_ICE_PACKET_AUDIO) {
 							component->out_stats.audio.packets++;
 							component->out_stats.audio.bytes += pkt->length;
+							janus_metric_inc(metric_packets_sent[0]);
+							janus_metric_add(metric_bytes_sent[0], pkt->length);
 							/* Last second outgoing audio */
 							gint64 now = janus_get_monotonic_time();
 							if(component->out_stats.audio.updated == 0)
@@ -3846,6 +6074,8 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 						} else if(pkt->type == JANUS_ICE_PACKET_VIDEO) {
 							component->out_stats.video[0].packets++;
 							component->out_stats.video[0].bytes += pkt->length;
+							janus_metric_inc(metric_packets_sent[1]);
+							janus_metric_add(metric_bytes_sent[1], pkt->length);
 							/* Last second outgoing video */
 							gint64 now = janus_get_monotonic_time();
 							if(component->out_stats.video[0].updated == 0)
@@ -3869,7 +6099,7 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 						rtcp_context *rtcp_ctx = video ? stream->video_rtcp_ctx[0] : stream->audio_rtcp_ctx;
 						g_atomic_int_inc(&rtcp_ctx->sent_packets_since_last_rr);
 					}
-					if(max_nack_queue > 0) {
+					if(max_nack_queue > 0 && p == NULL) {
 						/* Save the packet for retransmissions that may be needed later */
 						if((pkt->type == JANUS_ICE_PACKET_AUDIO && !component->do_audio_nacks) ||
 								(pkt->type == JANUS_ICE_PACKET_VIDEO && !component->do_video_nacks)) {
@@ -3877,36 +6107,15 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 							janus_ice_free_queued_packet(pkt);
 							return G_SOURCE_CONTINUE;
 						}
-						if(p == NULL) {
-							/* If we're not doing RFC4588, we're saving the SRTP packet as it is */
-							p = g_malloc(sizeof(janus_rtp_packet));
-							p->data = g_malloc(protected);
-							memcpy(p->data, pkt->data, protected);
-							p->length = protected;
-						}
-						p->created = janus_get_monotonic_time();
-						p->last_retransmit = 0;
+						/* If we're not doing RFC4588, we're saving the SRTP packet as it is */
 						janus_rtp_header *header = (janus_rtp_header *)pkt->data;
 						guint16 seq = ntohs(header->seq_number);
-						if(!video) {
-							if(component->audio_retransmit_buffer == NULL) {
-								component->audio_retransmit_buffer = g_queue_new();
-								component->audio_retransmit_seqs = g_hash_table_new(NULL, NULL);
-							}
-							g_queue_push_tail(component->audio_retransmit_buffer, p);
-							/* Insert in the table too, for quick lookup */
-							g_hash_table_insert(component->audio_retransmit_seqs, GUINT_TO_POINTER(seq), p);
-						} else {
-							if(component->video_retransmit_buffer == NULL) {
-								component->video_retransmit_buffer = g_queue_new();
-								component->video_retransmit_seqs = g_hash_table_new(NULL, NULL);
-							}
-							g_queue_push_tail(component->video_retransmit_buffer, p);
-							/* Insert in the table too, for quick lookup */
-							g_hash_table_insert(component->video_retransmit_seqs, GUINT_TO_POINTER(seq), p);
-						}
-					} else {
-						janus_ice_free_rtp_packet(p);
+						janus_ice_retransmit_buffer **rb = video ?
+							&component->video_retransmit_buffer : &component->audio_retransmit_buffer;
+						if(*rb == NULL)
+							*rb = janus_ice_retransmit_buffer_create(handle->memory);
+						p = janus_ice_retransmit_buffer_store(*rb, seq, protected);
+						memcpy(p->data, pkt->data, protected);
 					}
 				}
 			}
@@ -3926,7 +6135,8 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 				return G_SOURCE_CONTINUE;
 			}
 			component->noerrorlog = FALSE;
-			janus_dtls_wrap_sctp_data(component->dtls, pkt->data, pkt->length);
+			janus_dtls_wrap_sctp_data(component->dtls, pkt->shared ? pkt->shared->buffer : pkt->data, pkt->length, pkt->binary);
+			janus_ice_data_check_watermarks(handle);
 #endif
 		} else if(pkt->type == JANUS_ICE_PACKET_SCTP) {
 			/* SCTP data to push */
@@ -3956,14 +6166,26 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 }
 
 static void janus_ice_queue_packet(janus_ice_handle *handle, janus_ice_queued_packet *pkt) {
-	/* TODO: There is a potential race condition where the "queued_packets"
-	 * could get released between the condition and pushing the packet. */
-	if(handle->queued_packets != NULL) {
-		g_async_queue_push(handle->queued_packets, pkt);
-		g_main_context_wakeup(handle->icectx);
-	} else {
+	if(g_atomic_int_get(&media_latency)) {
+		/* Shared packets carry their ingress time: for anything else, check if we're
+		 * relaying something we just received on this very thread */
+		if(pkt->ingress == 0) {
+			gint64 *ingress = g_private_get(&janus_ice_ingress_time);
+			pkt->ingress = ingress ? *ingress : 0;
+		}
+		pkt->queued = janus_get_monotonic_time();
+	}
+	/* The queue is created with the handle and only destroyed when the last
+	 * reference to the handle goes away, so it can't disappear while we push */
+	if(!janus_ice_queue_push(handle->queued_packets, pkt)) {
+		if(g_atomic_int_add(&handle->queued_packets->dropped, 1) % 100 == 0) {
+			JANUS_LOG(LOG_WARN, "[%"SCNu64"] Outgoing queue is full, dropping packet (%d dropped so far)\n",
+				handle->handle_id, g_atomic_int_get(&handle->queued_packets->dropped));
+		}
 		janus_ice_free_queued_packet(pkt);
+		return;
 	}
+	janus_ice_queue_signal(handle->queued_packets, handle->icectx);
 }
 
 void janus_ice_relay_rtp(janus_ice_handle *handle, int video, char *buf, int len) {
@@ -3973,8 +6195,7 @@ void janus_ice_relay_rtp(janus_ice_handle *handle, int video, char *buf, int len
 			|| (video && !janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_VIDEO)))
 		return;
 	/* Queue this packet */
-	janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
-	pkt->data = g_malloc(len+SRTP_MAX_TAG_LEN);
+	janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(handle, len+SRTP_MAX_TAG_LEN);
 	memcpy(pkt->data, buf, len);
 	pkt->length = len;
 	pkt->type = video ? JANUS_ICE_PACKET_VIDEO : JANUS_ICE_PACKET_AUDIO;
@@ -3984,46 +6205,69 @@ void janus_ice_relay_rtp(janus_ice_handle *handle, int video, char *buf, int len
 	janus_ice_queue_packet(handle, pkt);
 }
 
+void janus_ice_relay_rtp_shared(janus_ice_handle *handle, int video, janus_plugin_rtp_shared *packet, janus_plugin_rtp_override *override) {
+	if(!handle || handle->queued_packets == NULL || packet == NULL || packet->buffer == NULL || packet->length < 12)
+		return;
+	if((!video && !janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_AUDIO))
+			|| (video && !janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_VIDEO)))
+		return;
+	/* Queue a reference to this packet: we'll only copy it when it's time to send it */
+	janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(handle, packet->length+SRTP_MAX_TAG_LEN);
+	janus_refcount_increase(&packet->ref);
+	pkt->shared = packet;
+	/* If the plugin told us when the original packet was received, we can track the end-to-end latency */
+	pkt->ingress = packet->received;
+	if(override != NULL) {
+		pkt->override = *override;
+		if(pkt->override.payload_len > JANUS_PLUGIN_RTP_OVERRIDE_PAYLOAD)
+			pkt->override.payload_len = 0;
+	} else {
+		janus_plugin_rtp_override_from_header(&pkt->override, packet->buffer, packet->length);
+	}
+	pkt->length = packet->length;
+	pkt->type = video ? JANUS_ICE_PACKET_VIDEO : JANUS_ICE_PACKET_AUDIO;
+	pkt->control = FALSE;
+	pkt->encrypted = FALSE;
+	pkt->retransmission = FALSE;
+	janus_ice_queue_packet(handle, pkt);
+}
+
 void janus_ice_relay_rtcp_internal(janus_ice_handle *handle, int video, char *buf, int len, gboolean filter_rtcp) {
 	if(!handle || handle->queued_packets == NULL || buf == NULL || len < 1)
 		return;
 	/* We use this internal method to check whether we need to filter RTCP (e.g., to make
 	 * sure we don't just forward any SR/RR from peers/plugins, but use our own) or it has
 	 * already been done, and so this is actually a packet added by the ICE send thread */
-	char *rtcp_buf = buf;
-	int rtcp_len = len;
+	janus_ice_stream *stream = handle->stream;
+	if(filter_rtcp && stream == NULL)
+		return;
+	/* Copy the packet first: if needed, we'll filter it and fix it in place */
+	janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(handle, len+SRTP_MAX_TAG_LEN+4);
+	memcpy(pkt->data, buf, len);
+	pkt->length = len;
 	if(filter_rtcp) {
 		/* FIXME Strip RR/SR/SDES/NACKs/etc. */
-		janus_ice_stream *stream = handle->stream;
-		if(stream == NULL)
-			return;
-		rtcp_buf = janus_rtcp_filter(buf, len, &rtcp_len);
-		if(rtcp_buf == NULL || rtcp_len < 1)
+		pkt->length = janus_rtcp_filter_inplace(pkt->data, len);
+		if(pkt->length < 1) {
+			janus_ice_free_queued_packet(pkt);
 			return;
+		}
 		/* Fix all SSRCs before enqueueing, as we need to use the ones for this media
 		 * leg. Note that this is only needed for RTCP packets coming from plugins: the
 		 * ones created by the core already have the right SSRCs in the right place */
 		JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Fixing SSRCs (local %u, peer %u)\n", handle->handle_id,
 			video ? stream->video_ssrc : stream->audio_ssrc,
 			video ? stream->video_ssrc_peer[0] : stream->audio_ssrc_peer);
-		janus_rtcp_fix_ssrc(NULL, rtcp_buf, rtcp_len, 1,
+		janus_rtcp_fix_ssrc(NULL, pkt->data, pkt->length, 1,
 			video ? stream->video_ssrc : stream->audio_ssrc,
 			video ? stream->video_ssrc_peer[0] : stream->audio_ssrc_peer);
 	}
 	/* Queue this packet */
-	janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
-	pkt->data = g_malloc(rtcp_len+SRTP_MAX_TAG_LEN+4);
-	memcpy(pkt->data, rtcp_buf, rtcp_len);
-	pkt->length = rtcp_len;
 	pkt->type = video ? JANUS_ICE_PACKET_VIDEO : JANUS_ICE_PACKET_AUDIO;
 	pkt->control = TRUE;
 	pkt->encrypted = FALSE;
 	pkt->retransmission = FALSE;
 	janus_ice_queue_packet(handle, pkt);
-	if(rtcp_buf != buf) {
-		/* We filtered the original packet, deallocate it */
-		g_free(rtcp_buf);
-	}
 }
 
 void janus_ice_relay_rtcp(janus_ice_handle *handle, int video, char *buf, int len) {
@@ -4031,20 +6275,80 @@ void janus_ice_relay_rtcp(janus_ice_handle *handle, int video, char *buf, int le
 }
 
 #ifdef HAVE_SCTP
-void janus_ice_relay_data(janus_ice_handle *handle, char *buf, int len) {
+static void janus_ice_relay_data_internal(janus_ice_handle *handle, char *buf, int len, gboolean binary) {
 	if(!handle || handle->queued_packets == NULL || buf == NULL || len < 1)
 		return;
 	/* Queue this packet */
-	janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
-	pkt->data = g_malloc(len);
+	janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(handle, len);
 	memcpy(pkt->data, buf, len);
 	pkt->length = len;
 	pkt->type = JANUS_ICE_PACKET_DATA;
 	pkt->control = FALSE;
 	pkt->encrypted = FALSE;
 	pkt->retransmission = FALSE;
+	pkt->binary = binary;
+	/* Keep track of how much the plugin is queueing, for backpressure */
+	g_atomic_int_add(&handle->data_queued, len);
+	if(janus_ice_data_buffered(handle) >= janus_ice_data_high_watermark)
+		g_atomic_int_set(&handle->data_throttled, 1);
+	janus_ice_queue_packet(handle, pkt);
+}
+
+void janus_ice_relay_data(janus_ice_handle *handle, char *buf, int len) {
+	janus_ice_relay_data_internal(handle, buf, len, FALSE);
+}
+
+void janus_ice_relay_binary_data(janus_ice_handle *handle, char *buf, int len) {
+	janus_ice_relay_data_internal(handle, buf, len, TRUE);
+}
+
+void janus_ice_relay_data_shared(janus_ice_handle *handle, janus_plugin_rtp_shared *packet, gboolean binary) {
+	if(!handle || handle->queued_packets == NULL || packet == NULL || packet->buffer == NULL || packet->length < 1)
+		return;
+	/* Queue a reference to this message: the SCTP stack copies it when we send it */
+	janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(handle, 0);
+	janus_refcount_increase(&packet->ref);
+	pkt->shared = packet;
+	pkt->length = packet->length;
+	pkt->type = JANUS_ICE_PACKET_DATA;
+	pkt->control = FALSE;
+	pkt->encrypted = FALSE;
+	pkt->retransmission = FALSE;
+	pkt->binary = binary;
+	/* Keep track of how much the plugin is queueing, for backpressure */
+	g_atomic_int_add(&handle->data_queued, packet->length);
+	if(janus_ice_data_buffered(handle) >= janus_ice_data_high_watermark)
+		g_atomic_int_set(&handle->data_throttled, 1);
 	janus_ice_queue_packet(handle, pkt);
 }
+
+int janus_ice_data_buffered(janus_ice_handle *handle) {
+	if(handle == NULL)
+		return -1;
+	return g_atomic_int_get(&handle->data_queued) + g_atomic_int_get(&handle->data_buffered);
+}
+
+void janus_ice_notify_data_writable(janus_ice_handle *handle) {
+	if(handle == NULL || handle->queued_packets == NULL || g_atomic_int_get(&handle->destroyed))
+		return;
+	janus_ice_queue_push_priority(handle->queued_packets, &janus_ice_data_writable);
+	janus_ice_queue_signal(handle->queued_packets, handle->icectx);
+}
+
+/* Check if the plugin was waiting for the buffered data to go below the low watermark */
+static void janus_ice_data_check_watermarks(janus_ice_handle *handle) {
+	if(!g_atomic_int_get(&handle->data_throttled))
+		return;
+	if(janus_ice_data_buffered(handle) > janus_ice_data_low_watermark)
+		return;
+	if(!g_atomic_int_compare_and_exchange(&handle->data_throttled, 1, 0))
+		return;
+	janus_plugin *plugin = (janus_plugin *)handle->app;
+	if(plugin && plugin->data_ready && handle->app_handle &&
+			!g_atomic_int_get(&handle->app_handle->stopped) &&
+			!g_atomic_int_get(&handle->destroyed))
+		plugin->data_ready(handle->app_handle);
+}
 #endif
 
 void janus_ice_relay_sctp(janus_ice_handle *handle, char *buffer, int length) {
@@ -4052,8 +6356,7 @@ void janus_ice_relay_sctp(janus_ice_handle *handle, char *buffer, int length) {
 	if(!handle || handle->queued_packets == NULL || buffer == NULL || length < 1)
 		return;
 	/* Queue this packet */
-	janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
-	pkt->data = g_malloc(length);
+	janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(handle, length);
 	memcpy(pkt->data, buffer, length);
 	pkt->length = length;
 	pkt->type = JANUS_ICE_PACKET_SCTP;
@@ -4091,6 +6394,8 @@ void janus_ice_dtls_handshake_done(janus_ice_handle *handle, janus_ice_component
 	g_source_set_callback(handle->rtcp_source, janus_ice_outgoing_rtcp_handle, handle, NULL);
 	g_source_attach(handle->rtcp_source, handle->icectx);
 	handle->last_event_stats = 0;
+	handle->event_stats_sampling[0] = 0;
+	handle->event_stats_sampling[1] = 0;
 	handle->last_srtp_summary = -1;
 	handle->stats_source = g_timeout_source_new_seconds(1);
 	g_source_set_callback(handle->stats_source, janus_ice_outgoing_stats_handle, handle, NULL);
@@ -4117,7 +6422,7 @@ void janus_ice_dtls_handshake_done(janus_ice_handle *handle, janus_ice_component
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Sending event to transport...; %p\n", handle->handle_id, handle);
 	janus_session_notify_event(session, event);
 	/* Notify event handlers as well */
-	if(janus_events_is_enabled()) {
+	if(janus_events_should_notify(JANUS_EVENT_TYPE_WEBRTC)) {
 		json_t *info = json_object();
 		json_object_set_new(info, "connection", json_string("webrtcup"));
 		janus_events_notify_handlers(JANUS_EVENT_TYPE_WEBRTC, session->session_id, handle->handle_id, handle->opaque_id, info);
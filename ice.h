@@ -19,6 +19,7 @@
 
 #include <glib.h>
 #include <agent.h>
+#include <sys/socket.h>
 
 #include "sdp.h"
 #include "dtls.h"
@@ -27,6 +28,7 @@
 #include "text2pcap.h"
 #include "utils.h"
 #include "refcount.h"
+#include "memory.h"
 #include "plugins/plugin.h"
 
 
@@ -40,6 +42,42 @@
 void janus_ice_init(gboolean ice_lite, gboolean ice_tcp, gboolean full_trickle, gboolean ipv6, uint16_t rtp_min_port, uint16_t rtp_max_port);
 /*! \brief ICE stuff de-initialization */
 void janus_ice_deinit(void);
+/*! \brief Method to configure the number of static event loops to use
+ * \details By default (0) each ICE handle creates its own GMainLoop and thread.
+ * When a positive value is passed, a fixed pool of loops is created instead,
+ * and handles are assigned to the least loaded one when their ICE agent is
+ * created. Must be called before janus_ice_init.
+ * @param[in] loops The number of static event loops to create (0 to disable) */
+void janus_ice_set_static_event_loops(int loops);
+/*! \brief Method to get the number of static event loops currently in use
+ * @returns The number of static event loops, or 0 if each handle has its own thread */
+int janus_ice_get_static_event_loops(void);
+/*! \brief Method to get a summary of the static event loops, if any
+ * @returns A JSON array with the loops and handles assigned to each of them, or NULL if not in use */
+json_t *janus_ice_static_event_loops_info(void);
+/*! \brief Method to get a summary of the outgoing packets pools (hits, misses, high-water mark)
+ * @returns A JSON object with the pools statistics */
+json_t *janus_ice_packet_pool_info(void);
+/*! \brief Method to enable ICE-Lite multiplexing, i.e., all handles sharing the same UDP port
+ * \details When enabled (and ICE Lite is enabled too), handles don't gather
+ * candidates and don't bind any socket of their own: Janus listens on a single
+ * port instead (optionally on multiple \c SO_REUSEPORT sockets, to let the
+ * kernel spread the traffic on different threads), replies to connectivity
+ * checks itself, and demultiplexes incoming packets to handles by STUN
+ * username fragment first, and by address/port then. Must be called before janus_ice_init.
+ * @param[in] port The UDP port to listen on (0 to disable)
+ * @param[in] sockets How many \c SO_REUSEPORT sockets to bind on that port */
+void janus_ice_set_lite_mux(uint16_t port, int sockets);
+/*! \brief Method to check whether ICE-Lite multiplexing is enabled
+ * @returns TRUE if it's enabled, FALSE otherwise */
+gboolean janus_ice_is_lite_mux_enabled(void);
+/*! \brief Method to get a summary of the ICE-Lite multiplexing sockets
+ * @returns A JSON object with the port and per-socket statistics, or NULL if not enabled */
+json_t *janus_ice_lite_mux_info(void);
+/*! \brief Method to get the cached list of local addresses candidates are gathered for
+ * \note The list is refreshed when interfaces change (via netlink on Linux, periodically elsewhere)
+ * @returns A JSON object with the addresses and how many times the list was refreshed */
+json_t *janus_ice_local_addresses_info(void);
 /*! \brief Method to force Janus to use a STUN server when gathering candidates
  * @param[in] stun_server STUN server address to use
  * @param[in] stun_port STUN port to use
@@ -83,7 +121,9 @@ void janus_ice_enable_nat_1_1(void);
  * if you know in advance which interface must be used (e.g., the main interface connected to the internet),
  * adding it to the enforce list will prevent libnice from gathering candidates from other interfaces.
  * If you're interested in excluding interfaces explicitly, instead, check janus_ice_ignore_interface.
- * @param[in] ip Interface/IP to enforce (e.g., 192.168. or eth0) */
+ * \note Addresses, partial addresses and CIDR prefixes (e.g., 192.168.0.0/16) are parsed when
+ * added, and matched as binary prefixes; anything else is matched as (part of) an interface name.
+ * @param[in] ip Interface/IP to enforce (e.g., 192.168. or eth0); the string is copied */
 void janus_ice_enforce_interface(const char *ip);
 /*! \brief Method to check whether an interface is currently in the enforce list for ICE (that is, won't have candidates)
  * @param[in] ip Interface/IP to check (e.g., 192.168.244.1 or eth1)
@@ -95,7 +135,7 @@ gboolean janus_ice_is_enforced(const char *ip);
  * adding it to the ignore list will prevent libnice from gathering a candidate for it.
  * Unlike the enforce list, the ignore list also accepts IP addresses, partial or complete.
  * If you're interested in only using specific interfaces, instead, check janus_ice_enforce_interface.
- * @param[in] ip Interface/IP to ignore (e.g., 192.168. or eth1) */
+ * @param[in] ip Interface/IP to ignore (e.g., 192.168., 10.0.0.0/8 or eth1); the string is copied */
 void janus_ice_ignore_interface(const char *ip);
 /*! \brief Method to check whether an interface/IP is currently in the ignore list for ICE (that is, won't have candidates)
  * @param[in] ip Interface/IP to check (e.g., 192.168.244.1 or eth1)
@@ -131,9 +171,49 @@ void janus_set_rfc4588_enabled(gboolean enabled);
 /*! \brief Method to check whether the RFC4588 support is enabled
  * @returns TRUE if it's enabled, FALSE otherwise */
 gboolean janus_is_rfc4588_enabled(void);
+/*! \brief Method to configure batched egress: when enabled, outgoing packets are
+ * accumulated and sent with sendmmsg (and UDP GSO, if supported) on the socket
+ * of the selected pair, rather than with a syscall per packet via libnice
+ * @param[in] size Maximum number of packets per batch (0 disables batched egress) */
+void janus_set_egress_batch(int size);
+/*! \brief Method to get the size of the egress batches
+ * @returns The maximum number of packets per batch, 0 if batched egress is disabled */
+int janus_get_egress_batch(void);
+/*! \brief Method to configure batched ingress: when enabled, decrypted RTP packets are
+ * accumulated and passed to plugins implementing incoming_rtp_batch all at once,
+ * at most once per loop iteration, rather than one incoming_rtp call per packet
+ * @param[in] size Maximum number of packets per batch (0 disables batched ingress) */
+void janus_set_ingress_batch(int size);
+/*! \brief Method to get the size of the ingress batches
+ * @returns The maximum number of packets per batch, 0 if batched ingress is disabled */
+int janus_get_ingress_batch(void);
+/*! \brief Method to enable or disable media latency tracking: when enabled, we keep
+ * histograms of the time spent in plugins' incoming_rtp, in the outgoing queues,
+ * and from when a packet was received to when a plugin relayed it was sent (shared
+ * packets carry their reception time, while packets relayed with relay_rtp
+ * inherit it when relayed from within the incoming_rtp callback)
+ * @param[in] enabled Whether latency tracking should be enabled or not */
+void janus_ice_set_media_latency_enabled(gboolean enabled);
+/*! \brief Method to check whether media latency tracking is enabled
+ * @returns TRUE if it's enabled, FALSE otherwise */
+gboolean janus_ice_is_media_latency_enabled(void);
+/*! \brief Method to reset the per-plugin latency histograms */
+void janus_ice_media_latency_reset(void);
+/*! \brief Method to get a summary of the per-plugin latency histograms
+ * @returns A JSON object with a summary for each plugin */
+json_t *janus_ice_media_latency_info(void);
+/*! \brief Method to get a summary of how much SRTP costs (protect and unprotect, in nanoseconds) per negotiated profile
+ * \note Only updated when media latency tracking is enabled, and reset by janus_ice_media_latency_reset
+ * @returns A JSON object with the summary */
+json_t *janus_ice_srtp_timing_info(void);
 /*! \brief Method to modify the event handler statistics period (i.e., the number of seconds that should pass before Janus notifies event handlers about media statistics for a PeerConnection)
  * @param[in] timer The new timer value, in seconds */
 void janus_ice_set_event_stats_period(int period);
+/*! \brief Method to set the DataChannel watermarks: when the data buffered for a peer goes above
+ * the high one, plugins are notified via data_ready as soon as it goes below the low one
+ * @param[in] high The high watermark, in bytes
+ * @param[in] low The low watermark, in bytes */
+void janus_ice_set_data_watermarks(int high, int low);
 /*! \brief Method to get the current event handler statistics period (see above)
  * @returns The current event handler stats period */
 int janus_ice_get_event_stats_period(void);
@@ -160,6 +240,22 @@ typedef struct janus_ice_stream janus_ice_stream;
 typedef struct janus_ice_component janus_ice_component;
 /*! \brief Helper to handle pending trickle candidates (e.g., when we're still waiting for an offer) */
 typedef struct janus_ice_trickle janus_ice_trickle;
+/*! \brief Event loop shared by multiple handles (when static event loops are enabled) */
+typedef struct janus_ice_static_event_loop janus_ice_static_event_loop;
+/*! \brief Pool of recycled buffers for outgoing packets */
+typedef struct janus_ice_packet_pool janus_ice_packet_pool;
+/*! \brief Shared UDP socket all handles receive and send on, when ICE-Lite multiplexing is enabled */
+typedef struct janus_ice_mux_socket janus_ice_mux_socket;
+/*! \brief Packet received on a shared socket, waiting to be processed by the handle loop */
+typedef struct janus_ice_mux_packet janus_ice_mux_packet;
+/*! \brief Queue of packets waiting to be sent by the handle loop */
+typedef struct janus_ice_queue janus_ice_queue;
+/*! \brief Batch of outgoing packets to send with a single syscall */
+typedef struct janus_ice_egress_batch janus_ice_egress_batch;
+/*! \brief Batch of incoming RTP packets to pass to the plugin at once */
+typedef struct janus_ice_ingress_batch janus_ice_ingress_batch;
+/*! \brief Latency histograms for a handle (when media latency tracking is enabled) */
+typedef struct janus_ice_latency janus_ice_latency;
 
 #define JANUS_ICE_HANDLE_WEBRTC_PROCESSING_OFFER	(1 << 0)
 #define JANUS_ICE_HANDLE_WEBRTC_START				(1 << 1)
@@ -227,15 +323,29 @@ void janus_ice_notify_hangup(janus_ice_handle *handle, const char *reason);
 gboolean janus_plugin_session_is_alive(janus_plugin_session *plugin_session);
 
 
-/*! \brief A helper struct for determining when to send NACKs */
-typedef struct janus_seq_info {
-	gint64 ts;
-	guint16 seq;
-	guint16 state;
-	struct janus_seq_info *next;
-	struct janus_seq_info *prev;
-} janus_seq_info;
-void janus_seq_list_free(janus_seq_info **head);
+/*! \brief Size of the sliding window of sequence numbers we track for NACKs
+ * \note This is a power of two, large enough for LAST_SEQS_MAX_LEN sequence
+ * numbers plus a full jump forward before the window is trimmed again */
+#define JANUS_SEQ_WINDOW_SIZE	512
+/*! \brief A helper struct for determining when to send NACKs: a sliding window of
+ * the recently received sequence numbers, indexed by sequence number modulo its
+ * size, with a bitmap of the ones we're still waiting for, so that they can be
+ * found without visiting all the others, and no allocation per packet */
+typedef struct janus_seq_window {
+	/*! \brief Most recent sequence number in the window */
+	guint16 last;
+	/*! \brief Number of sequence numbers in the window (the oldest is last-count+1) */
+	guint16 count;
+	/*! \brief Bitmap of the sequence numbers that are missing or NACKed */
+	guint32 pending[JANUS_SEQ_WINDOW_SIZE/32];
+	/*! \brief State of each sequence number */
+	guint8 state[JANUS_SEQ_WINDOW_SIZE];
+	/*! \brief When each sequence number was added to the window */
+	gint64 ts[JANUS_SEQ_WINDOW_SIZE];
+} janus_seq_window;
+/*! \brief Helper to empty a sequence numbers window (e.g., after a keyframe or an SSRC change)
+ * @param window The window to reset (can be NULL) */
+void janus_seq_window_reset(janus_seq_window *window);
 enum {
 	SEQ_MISSING,
 	SEQ_NACKED,
@@ -244,6 +354,100 @@ enum {
 };
 
 
+/*! \brief Janus static event loop */
+struct janus_ice_static_event_loop {
+	/*! \brief Index of this loop in the pool */
+	int id;
+	/*! \brief GLib context shared by all handles assigned to this loop */
+	GMainContext *mainctx;
+	/*! \brief GLib loop shared by all handles assigned to this loop */
+	GMainLoop *mainloop;
+	/*! \brief GLib thread running this loop */
+	GThread *thread;
+	/*! \brief Number of handles currently assigned to this loop */
+	volatile gint handles;
+	/*! \brief Pool of outgoing packets for the handles assigned to this loop */
+	janus_ice_packet_pool *packet_pool;
+	/*! \brief CPU the thread running this loop is pinned to, if any (-1 otherwise) */
+	int cpu;
+	/*! \brief NUMA node of the CPU the thread running this loop is pinned to, if any (-1 otherwise) */
+	int node;
+};
+
+
+/*! \brief Slot in a retransmit buffer, containing a previously sent RTP packet */
+typedef struct janus_ice_retransmit_slot {
+	/*! \brief The packet itself (the buffer is recycled when the slot is reused) */
+	janus_rtp_packet packet;
+	/*! \brief Size of the allocated buffer */
+	gint capacity;
+	/*! \brief Sequence number of the packet currently in this slot */
+	guint16 seq;
+	/*! \brief Generation the packet belongs to (packets from older generations are stale) */
+	guint generation;
+} janus_ice_retransmit_slot;
+
+/*! \brief Ring buffer of previously sent RTP packets, indexed by sequence number modulo its size */
+typedef struct janus_ice_retransmit_buffer {
+	/*! \brief Slots of the ring */
+	janus_ice_retransmit_slot *slots;
+	/*! \brief Number of slots (a power of two, so that it divides the 16-bit sequence number space) */
+	guint size;
+	/*! \brief Mask to get the slot of a sequence number (size-1) */
+	guint mask;
+	/*! \brief Current generation: bumping it invalidates all the stored packets at once */
+	guint generation;
+	/*! \brief Memory currently allocated for this buffer, in bytes */
+	size_t memory;
+	/*! \brief Account the memory of this buffer is charged to, if any (we hold a reference) */
+	janus_memory_account *account;
+} janus_ice_retransmit_buffer;
+
+
+/*! \brief Cell in the outgoing packets queue */
+typedef struct janus_ice_queue_cell {
+	/*! \brief Sequence number of the cell, used to synchronize producers and the consumer */
+	volatile gint seq;
+	/*! \brief The queued item */
+	gpointer data;
+} janus_ice_queue_cell;
+
+/*! \brief Bounded multiple producers/single consumer queue of outgoing packets:
+ * plugins (and the core) push packets without any lock, while the handle loop
+ * is the only one popping them. The loop is only woken up when the first
+ * packet is queued after the queue has been drained, rather than once per packet */
+struct janus_ice_queue {
+	/*! \brief Cells of the ring */
+	janus_ice_queue_cell *cells;
+	/*! \brief Number of cells minus one (the size is a power of two) */
+	guint mask;
+	/*! \brief Position producers enqueue at */
+	volatile gint tail;
+	/*! \brief Position the consumer dequeues from */
+	volatile gint head;
+	/*! \brief Items that must be sent before anything else (DTLS handshake/alert, retransmissions) */
+	GQueue *priority;
+	/*! \brief Number of items in the priority queue (so that we don't lock when it's empty) */
+	volatile gint priority_count;
+	/*! \brief Mutex to lock the priority queue */
+	janus_mutex mutex;
+	/*! \brief Whether the loop has already been notified about pending packets */
+	volatile gint signalled;
+	/*! \brief Event file descriptor the loop polls, if supported (-1 otherwise) */
+	int efd;
+	/*! \brief Number of packets we had to drop because the queue was full */
+	volatile gint dropped;
+};
+/*! \brief Helper to get the approximate number of packets in a queue
+ * @param[in] queue The queue to inspect
+ * @returns The number of queued packets */
+guint janus_ice_queue_length(janus_ice_queue *queue);
+/*! \brief Helper to get how full the outgoing queue of a handle is, e.g., to compute the load score
+ * @param[in] handle The handle to inspect
+ * @returns The percentage of the queue in use, or -1 if the handle has no PeerConnection */
+int janus_ice_handle_queue_usage(janus_ice_handle *handle);
+
+
 /*! \brief Janus ICE handle */
 struct janus_ice_handle {
 	/*! \brief Opaque pointer to the gateway/peer session */
@@ -268,12 +472,22 @@ struct janus_ice_handle {
 	GMainLoop *iceloop;
 	/*! \brief GLib thread for libnice */
 	GThread *icethread;
+	/*! \brief Static event loop this handle has been assigned to, if any (icethread is NULL, in that case) */
+	janus_ice_static_event_loop *static_loop;
 	/*! \brief GLib sources for outgoing traffic, recurring RTCP, and stats */
 	GSource *rtp_source, *rtcp_source, *stats_source;
 	/*! \brief libnice ICE agent */
 	NiceAgent *agent;
 	/*! \brief Monotonic time of when the ICE agent has been created */
 	gint64 agent_created;
+	/*! \brief Monotonic time of when janus_ice_setup_local was called for this handle */
+	gint64 setup_started;
+	/*! \brief Monotonic time of when candidates gathering started */
+	gint64 gathering_started;
+	/*! \brief Monotonic time of when candidates gathering was completed */
+	gint64 gathering_done;
+	/*! \brief Number of local candidates gathered */
+	guint gathered_candidates;
 	/*! \brief ICE role (controlling or controlled) */
 	gboolean controlling;
 	/*! \brief Audio mid (media ID) */
@@ -298,14 +512,44 @@ struct janus_ice_handle {
 	const gchar *hangup_reason;
 	/*! \brief List of pending trickle candidates (those we received before getting the JSEP offer) */
 	GList *pending_trickles;
-	/*! \brief Queue of outgoing packets to send */
-	GAsyncQueue *queued_packets;
+	/*! \brief Queue of outgoing packets to send (lives as long as the handle) */
+	janus_ice_queue *queued_packets;
+	/*! \brief Queue of incoming packets from the ICE-Lite multiplexing sockets, if enabled (lives as long as the handle) */
+	janus_ice_queue *mux_incoming;
+	/*! \brief GLib source draining mux_incoming in the handle loop */
+	GSource *mux_source;
+	/*! \brief Packet from mux_incoming being processed, that the ingress batch can take ownership of instead of copying it */
+	janus_ice_mux_packet *mux_current;
+	/*! \brief Incoming RTP packets waiting to be passed to the plugin, if batched ingress is enabled */
+	janus_ice_ingress_batch *ingress_batch;
+	/*! \brief Number of batches passed to the plugin */
+	guint64 ingress_batches;
+	/*! \brief Number of packets passed to the plugin as part of batches */
+	guint64 ingress_batched_packets;
+	/*! \brief Latency histograms, if media latency tracking is enabled */
+	janus_ice_latency *latency;
+	/*! \brief Affinity group this handle belongs to, as suggested by the plugin (e.g., "videoroom-1234"), if any */
+	gchar *affinity_group;
+	/*! \brief NUMA node the affinity group maps to, or -1 if none */
+	int affinity_node;
+	/*! \brief Account the memory held by this handle (queues, retransmit buffers) is charged to */
+	janus_memory_account *memory;
 	/*! \brief Count of the recent SRTP replay errors, in order to avoid spamming the logs */
 	guint srtp_errors_count;
 	/*! \brief Count of the recent SRTP replay errors, in order to avoid spamming the logs */
 	gint last_srtp_error, last_srtp_summary;
 	/*! \brief Count of how many seconds passed since the last stats passed to event handlers */
 	gint last_event_stats;
+	/*! \brief Sampling counters for the audio and video stats passed to event handlers (see janus_events_should_notify_sampled) */
+	guint event_stats_sampling[2];
+	/*! \brief Bytes of DataChannel messages from the plugin still waiting in the outgoing queue */
+	volatile gint data_queued;
+	/*! \brief Bytes of DataChannel messages the SCTP stack has yet to send or get acknowledged */
+	volatile gint data_buffered;
+	/*! \brief Whether there are DataChannel messages waiting for room in the SCTP send buffer */
+	volatile gint data_pending;
+	/*! \brief Whether the buffered DataChannel data exceeded the high watermark, and the plugin is waiting for data_ready */
+	volatile gint data_throttled;
 	/*! \brief Flag to decide whether or not packets need to be dumped to a text2pcap file */
 	volatile gint dump_packets;
 	/*! \brief In case this session must be saved to text2pcap, the instance to dump packets to */
@@ -354,6 +598,8 @@ struct janus_ice_stream {
 	char *audio_codec, *video_codec;
 	/*! \brief Pointer to function to check if a packet is a keyframe (depends on negotiated codec) */
 	gboolean (* video_is_keyframe)(char* buffer, int len);
+	/*! \brief Negotiated video codec, used to parse the payload descriptor of incoming packets once */
+	janus_videocodec video_codec_id;
 	/*! \brief Media direction */
 	gboolean audio_send, audio_recv, video_send, video_recv;
 	/*! \brief RTCP context for the audio stream */
@@ -380,14 +626,16 @@ struct janus_ice_stream {
 	guint transport_wide_cc_ext_id;
 	/*! \brief Last received transport wide seq num */
 	guint32 transport_wide_cc_last_seq_num;
-	/*! \brief Last transport wide seq num sent on feedback */
-	guint32 transport_wide_cc_last_feedback_seq_num;
+	/*! \brief First transport wide extended seq num not sent on feedback yet */
+	guint32 transport_wide_cc_base_seq_num;
+	/*! \brief Highest transport wide extended seq num received so far */
+	guint32 transport_wide_cc_max_seq_num;
 	/*! \brief Transport wide cc transport seq num wrap cycles */
 	guint16 transport_wide_cc_cycles;
 	/*! \brief Transport wide cc rtp ext ID */
 	guint transport_wide_cc_feedback_count;
-	/*! \brief GLib list of transport wide cc stats in reverse received order */
-	GSList *transport_wide_received_seq_nums;
+	/*! \brief Circular array of transport wide cc reception times, indexed by extended seq num (0 if not received) */
+	guint64 *transport_wide_cc_timestamps;
 	/*! \brief DTLS role of the gateway for this stream */
 	janus_dtls_role dtls_role;
 	/*! \brief Hashing algorhitm used by the peer for the DTLS certificate (e.g., "SHA-256") */
@@ -447,10 +695,8 @@ struct janus_ice_component {
 	gboolean do_audio_nacks;
 	/*! \brief Whether we should do NACKs (in or out) for video */
 	gboolean do_video_nacks;
-	/*! \brief List of previously sent janus_rtp_packet RTP packets, in case we receive NACKs */
-	GQueue *audio_retransmit_buffer, *video_retransmit_buffer;
-	/*! \brief HashTable of retransmittable sequence numbers, in case we receive NACKs */
-	GHashTable *audio_retransmit_seqs, *video_retransmit_seqs;
+	/*! \brief Ring buffers of previously sent RTP packets, in case we receive NACKs */
+	janus_ice_retransmit_buffer *audio_retransmit_buffer, *video_retransmit_buffer;
 	/*! \brief Current sequence number for the RFC4588 rtx SSRC session */
 	guint16 rtx_seq_number;
 	/*! \brief Last time a log message about sending retransmits was printed */
@@ -461,14 +707,28 @@ struct janus_ice_component {
 	gint64 nack_sent_log_ts;
 	/*! \brief Number of NACKs sent since last log message */
 	guint nack_sent_recent_cnt;
-	/*! \brief List of recently received audio sequence numbers (as a support to NACK generation) */
-	janus_seq_info *last_seqs_audio;
-	/*! \brief List of recently received video sequence numbers (as a support to NACK generation, for each simulcast SSRC) */
-	janus_seq_info *last_seqs_video[3];
+	/*! \brief Window of recently received audio sequence numbers (as a support to NACK generation) */
+	janus_seq_window *last_seqs_audio;
+	/*! \brief Window of recently received video sequence numbers (as a support to NACK generation, for each simulcast SSRC) */
+	janus_seq_window *last_seqs_video[3];
 	/*! \brief Stats for incoming data (audio/video/data) */
 	janus_ice_stats in_stats;
 	/*! \brief Stats for outgoing data (audio/video/data) */
 	janus_ice_stats out_stats;
+	/*! \brief Batch of packets waiting to be flushed, if batched egress is enabled */
+	janus_ice_egress_batch *egress_batch;
+	/*! \brief Number of packets sent through batched egress */
+	guint64 egress_packets;
+	/*! \brief Number of syscalls batched egress needed to send them */
+	guint64 egress_syscalls;
+	/*! \brief Number of packets sent as part of UDP GSO messages */
+	guint64 egress_gso_packets;
+	/*! \brief Shared socket the peer was nominated on, when ICE-Lite multiplexing is enabled */
+	janus_ice_mux_socket *mux_socket;
+	/*! \brief Address of the peer on the shared socket, when ICE-Lite multiplexing is enabled */
+	struct sockaddr_storage mux_address;
+	/*! \brief Length of the address of the peer on the shared socket */
+	socklen_t mux_address_len;
 	/*! \brief Helper flag to avoid flooding the console with the same error all over again */
 	gboolean noerrorlog;
 	/*! \brief Mutex to lock/unlock this component */
@@ -557,6 +817,13 @@ void janus_ice_component_destroy(janus_ice_component *component);
  * @param[in] buf The packet data (buffer)
  * @param[in] len The buffer lenght */
 void janus_ice_relay_rtp(janus_ice_handle *handle, int video, char *buf, int len);
+/*! \brief Gateway shared RTP callback, called when a plugin has an RTP packet shared with other peers to send to a peer
+ * \note The packet is not copied here, but only when it's about to be encrypted
+ * @param[in] handle The Janus ICE handle associated with the peer
+ * @param[in] video Whether this is an audio or a video frame
+ * @param[in] packet The refcounted packet to send (a reference is added until it's sent)
+ * @param[in] override The header changes specific to this peer, if any */
+void janus_ice_relay_rtp_shared(janus_ice_handle *handle, int video, janus_plugin_rtp_shared *packet, janus_plugin_rtp_override *override);
 /*! \brief Gateway RTCP callback, called when a plugin has an RTCP message to send to a peer
  * @param[in] handle The Janus ICE handle associated with the peer
  * @param[in] video Whether this is related to an audio or a video stream
@@ -568,6 +835,26 @@ void janus_ice_relay_rtcp(janus_ice_handle *handle, int video, char *buf, int le
  * @param[in] buf The message data (buffer)
  * @param[in] len The buffer lenght */
 void janus_ice_relay_data(janus_ice_handle *handle, char *buf, int len);
+/*! \brief Gateway SCTP/DataChannel callback, called when a plugin has binary data to send to a peer
+ * @param[in] handle The Janus ICE handle associated with the peer
+ * @param[in] buf The message data (buffer)
+ * @param[in] len The buffer lenght */
+void janus_ice_relay_binary_data(janus_ice_handle *handle, char *buf, int len);
+/*! \brief Gateway shared SCTP/DataChannel callback, called when a plugin has a message shared with other peers to send to a peer
+ * \note The message is never copied here: a reference is kept until it's passed to the SCTP stack
+ * @param[in] handle The Janus ICE handle associated with the peer
+ * @param[in] packet The refcounted message to send
+ * @param[in] binary Whether this is a binary message or a text one */
+void janus_ice_relay_data_shared(janus_ice_handle *handle, janus_plugin_rtp_shared *packet, gboolean binary);
+/*! \brief Method to check how much DataChannel data is waiting to be sent to a peer
+ * @param[in] handle The Janus ICE handle associated with the peer
+ * @returns The bytes queued in the core or buffered in the SCTP stack */
+int janus_ice_data_buffered(janus_ice_handle *handle);
+/*! \brief Method to tell the handle loop there's room in the SCTP send buffer again
+ * \note Called by the SCTP stack: the loop will then send any pending message,
+ * and notify the plugin via data_ready if it was waiting for the buffered data to go down
+ * @param[in] handle The Janus ICE handle associated with the peer */
+void janus_ice_notify_data_writable(janus_ice_handle *handle);
 /*! \brief Plugin SCTP/DataChannel callback, called by the SCTP stack when when there's data for a plugin
  * @param[in] handle The Janus ICE handle associated with the peer
  * @param[in] buffer The message data (buffer)
@@ -615,6 +902,30 @@ void janus_ice_restart(janus_ice_handle *handle);
 /*! \brief Method to resend all the existing candidates via trickle (e.g., after an ICE restart)
  * @param[in] handle The Janus ICE handle this method refers to */
 void janus_ice_resend_trickles(janus_ice_handle *handle);
+/*! \brief Method to get a summary of the latency histograms of a handle
+ * @param[in] handle The handle to query
+ * @returns A JSON object with the summary, or NULL if we have no latency info for the handle */
+json_t *janus_ice_handle_latency_info(janus_ice_handle *handle);
+/*! \brief Method to set the affinity group of a handle (e.g., all the handles in the same VideoRoom room)
+ * \note Handles in the same group will be placed on the same NUMA node, if a
+ * \c media_cpus policy is configured. This only has effect if called before
+ * the ICE agent of the handle is created, i.e., before media is negotiated
+ * @param[in] handle The handle to update
+ * @param[in] group The affinity group (NULL to reset it) */
+void janus_ice_handle_set_affinity_group(janus_ice_handle *handle, const char *group);
+/*! \brief Method to get the effective CPU placement of a handle
+ * @param[in] handle The handle to query
+ * @returns A JSON object with the placement, or NULL if there's no \c media_cpus policy */
+json_t *janus_ice_handle_affinity_info(janus_ice_handle *handle);
+/*! \brief Method to send a packet to the peer right away, on the selected pair (or on the shared socket, if multiplexing)
+ * \note Unlike packets queued by janus_ice_relay_rtp and the like, this doesn't
+ * go through the outgoing queue and is not batched: it's used, e.g., by the DTLS stack
+ * @param[in] handle The handle to send the packet on
+ * @param[in] component The component to send the packet on
+ * @param[in] len The packet length
+ * @param[in] buf The packet data
+ * @returns The number of bytes sent, or a negative integer on errors */
+int janus_ice_send_raw(janus_ice_handle *handle, janus_ice_component *component, int len, char *buf);
 ///@}
 
 #endif
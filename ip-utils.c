@@ -12,6 +12,7 @@
  */
 
 #include <errno.h>
+#include <stdlib.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
@@ -321,3 +322,144 @@ char *janus_network_detect_local_ip_as_string(janus_network_query_options addr_t
 		return NULL;
 	return g_strdup(janus_network_address_string_from_buffer(&buf));
 }
+
+int janus_network_string_to_prefix(const char *user_value, janus_network_prefix *result) {
+	if(user_value == NULL || result == NULL || strlen(user_value) == 0)
+		return -EINVAL;
+	memset(result, 0, sizeof(janus_network_prefix));
+	char value[INET6_ADDRSTRLEN+5];
+	if(g_strlcpy(value, user_value, sizeof(value)) >= sizeof(value))
+		return -EINVAL;
+	int bits = -1;
+	char *slash = strchr(value, '/');
+	if(slash != NULL) {
+		/* CIDR notation */
+		*slash = '\0';
+		char *end = NULL;
+		long b = strtol(slash+1, &end, 10);
+		if(end == slash+1 || *end != '\0' || b < 0)
+			return -EINVAL;
+		bits = b;
+	}
+	janus_network_address *a = &result->address;
+	if(janus_network_string_to_address(janus_network_query_options_any_ip, value, a) == 0) {
+		int max = (a->family == AF_INET) ? 32 : 128;
+		if(bits > max)
+			return -EINVAL;
+		result->bits = (bits < 0) ? max : bits;
+	} else if(bits < 0 && strchr(value, ':') == NULL && strchr(value, '.') != NULL) {
+		/* Leading groups of an IPv4 address (e.g., 192.168.), padded with zeros */
+		gchar **groups = g_strsplit(value, ".", -1);
+		int n = 0, i = 0;
+		for(i=0; groups[i] != NULL; i++) {
+			if(strlen(groups[i]) == 0 && groups[i+1] == NULL)
+				break;
+			char *end = NULL;
+			long b = strtol(groups[i], &end, 10);
+			if(n == 4 || strlen(groups[i]) == 0 || *end != '\0' || b < 0 || b > 255) {
+				g_strfreev(groups);
+				return -EINVAL;
+			}
+			((uint8_t *)&a->ipv4.s_addr)[n] = b;
+			n++;
+		}
+		g_strfreev(groups);
+		if(n == 0)
+			return -EINVAL;
+		a->family = AF_INET;
+		result->bits = n*8;
+	} else if(bits < 0 && strchr(value, ':') != NULL && strstr(value, "::") == NULL) {
+		/* Leading groups of an IPv6 address (e.g., 2001:db8:), padded with zeros */
+		size_t len = strlen(value);
+		while(len > 0 && value[len-1] == ':')
+			value[--len] = '\0';
+		int n = 1;
+		char *c = value;
+		while((c = strchr(c, ':')) != NULL) {
+			n++;
+			c++;
+		}
+		char padded[sizeof(value)+2];
+		g_snprintf(padded, sizeof(padded), "%s::", value);
+		if(n >= 8 || inet_pton(AF_INET6, padded, &a->ipv6) <= 0)
+			return -EINVAL;
+		a->family = AF_INET6;
+		result->bits = n*16;
+	} else {
+		return -EINVAL;
+	}
+	/* Zero the bits after the prefix, so that we can compare bytes */
+	uint8_t *bytes = (a->family == AF_INET) ? (uint8_t *)&a->ipv4.s_addr : a->ipv6.s6_addr;
+	int size = (a->family == AF_INET) ? 4 : 16, i = 0;
+	for(i=0; i<size; i++) {
+		if(result->bits >= (i+1)*8)
+			continue;
+		bytes[i] &= (result->bits > i*8) ? (uint8_t)(0xFF << (8 - (result->bits - i*8))) : 0;
+	}
+	return 0;
+}
+
+int janus_network_address_matches_prefix(const janus_network_address *a, const janus_network_prefix *prefix) {
+	if(janus_network_address_is_null(a) || prefix == NULL || a->family != prefix->address.family)
+		return 0;
+	const uint8_t *b1 = (a->family == AF_INET) ? (const uint8_t *)&a->ipv4.s_addr : a->ipv6.s6_addr;
+	const uint8_t *b2 = (a->family == AF_INET) ? (const uint8_t *)&prefix->address.ipv4.s_addr : prefix->address.ipv6.s6_addr;
+	int bytes = prefix->bits / 8, rest = prefix->bits % 8;
+	if(bytes > 0 && janus_ip_compare_byte_arrays(b1, b2, bytes) != 0)
+		return 0;
+	if(rest > 0 && (b1[bytes] & (uint8_t)(0xFF << (8 - rest))) != b2[bytes])
+		return 0;
+	return 1;
+}
+
+janus_network_filter *janus_network_filter_new(void) {
+	janus_network_filter *filter = g_malloc0(sizeof(janus_network_filter));
+	filter->names = g_ptr_array_new_with_free_func(g_free);
+	filter->prefixes = g_array_new(FALSE, FALSE, sizeof(janus_network_prefix));
+	return filter;
+}
+
+int janus_network_filter_add(janus_network_filter *filter, const char *user_value) {
+	if(filter == NULL || user_value == NULL || strlen(user_value) == 0)
+		return -EINVAL;
+	janus_network_prefix prefix;
+	if(janus_network_string_to_prefix(user_value, &prefix) == 0)
+		g_array_append_val(filter->prefixes, prefix);
+	else
+		g_ptr_array_add(filter->names, g_strdup(user_value));
+	return 0;
+}
+
+int janus_network_filter_is_empty(const janus_network_filter *filter) {
+	return !filter || (filter->names->len == 0 && filter->prefixes->len == 0);
+}
+
+int janus_network_filter_matches_name(const janus_network_filter *filter, const char *name) {
+	if(filter == NULL || name == NULL)
+		return 0;
+	guint i = 0;
+	for(i=0; i<filter->names->len; i++) {
+		if(strstr(name, (const char *)g_ptr_array_index(filter->names, i)))
+			return 1;
+	}
+	return 0;
+}
+
+int janus_network_filter_matches_address(const janus_network_filter *filter, const janus_network_address *a) {
+	if(filter == NULL || janus_network_address_is_null(a))
+		return 0;
+	guint i = 0;
+	for(i=0; i<filter->prefixes->len; i++) {
+		if(janus_network_address_matches_prefix(a, &g_array_index(filter->prefixes, janus_network_prefix, i)))
+			return 1;
+	}
+	return 0;
+}
+
+void janus_network_filter_destroy(janus_network_filter *filter) {
+	if(filter == NULL)
+		return;
+	g_ptr_array_free(filter->names, TRUE);
+	g_array_free(filter->prefixes, TRUE);
+	g_free(filter);
+}
@@ -20,6 +20,8 @@
 #include <ifaddrs.h>
 #include <netinet/in.h>
 
+#include <glib.h>
+
 
 /** @name Janus helper methods to match names and addresses with network interfaces/devices.
  */
@@ -243,6 +245,85 @@ int janus_network_detect_local_ip(janus_network_query_options addr_type, janus_n
  * \return 0 in case of success, -EINVAL otherwise otherwise
  */
 char *janus_network_detect_local_ip_as_string(janus_network_query_options addr_type);
+
+/*!
+ * \brief Pre-parsed list of interface names and address prefixes to match network interfaces against
+ * (e.g., the ICE enforce and ignore lists). Values that look like (parts of) an IP address are parsed
+ * once, when added, as binary prefixes, which means matching an address against the filter doesn't
+ * involve any string formatting or comparison; anything else is considered (part of) an interface name.
+ * \see \c janus_network_filter_add
+ */
+typedef struct janus_network_filter {
+	/*! \brief Interface names (or parts of them) */
+	GPtrArray *names;
+	/*! \brief Address prefixes, as janus_network_prefix instances */
+	GArray *prefixes;
+} janus_network_filter;
+
+/*!
+ * \brief Structure to hold an address prefix (e.g., 192.168.0.0/16) in a janus_network_filter
+ */
+typedef struct janus_network_prefix {
+	/*! \brief The address, with all the bits after the prefix length set to zero */
+	janus_network_address address;
+	/*! \brief The prefix length, in bits */
+	int bits;
+} janus_network_prefix;
+
+/*!
+ * \brief Parse an address prefix: this can be an address (e.g., 10.0.0.1, as a /32), a CIDR notation
+ * (e.g., 10.0.0.0/8 or fd00::/8), or the first groups of an address (e.g., 192.168. or 2001:db8:, which are
+ * the same as 192.168.0.0/16 and 2001:db8::/32 respectively)
+ * \param user_value The string to parse
+ * \param result Pointer to a valid janus_network_prefix instance that will contain the result
+ * \return 0 in case of success, -EINVAL otherwise
+ */
+int janus_network_string_to_prefix(const char *user_value, janus_network_prefix *result);
+/*!
+ * \brief Check whether an address matches a prefix
+ * \param a The address to check
+ * \param prefix The prefix to match
+ * \return A positive integer if the address matches, 0 otherwise
+ */
+int janus_network_address_matches_prefix(const janus_network_address *a, const janus_network_prefix *prefix);
+/*!
+ * \brief Create a new, empty, network filter
+ * \return A pointer to a new janus_network_filter instance
+ */
+janus_network_filter *janus_network_filter_new(void);
+/*!
+ * \brief Add an interface name or an address prefix to a network filter
+ * \param filter The filter to add the value to
+ * \param user_value The interface name (or part of it, e.g., eth or vmnet) or address prefix to add
+ * \return 0 in case of success, -EINVAL otherwise
+ * \see \c janus_network_string_to_prefix
+ */
+int janus_network_filter_add(janus_network_filter *filter, const char *user_value);
+/*!
+ * \brief Check whether a network filter is empty
+ * \param filter The filter to check
+ * \return A positive integer if the filter is NULL or empty, 0 otherwise
+ */
+int janus_network_filter_is_empty(const janus_network_filter *filter);
+/*!
+ * \brief Check whether an interface name matches any of the names in a network filter
+ * \param filter The filter to check
+ * \param name The interface name
+ * \return A positive integer if the name matches, 0 otherwise
+ */
+int janus_network_filter_matches_name(const janus_network_filter *filter, const char *name);
+/*!
+ * \brief Check whether an address matches any of the prefixes in a network filter
+ * \param filter The filter to check
+ * \param a The address to check
+ * \return A positive integer if the address matches, 0 otherwise
+ */
+int janus_network_filter_matches_address(const janus_network_filter *filter, const janus_network_address *a);
+/*!
+ * \brief Destroy a network filter
+ * \param filter The filter to destroy
+ */
+void janus_network_filter_destroy(janus_network_filter *filter);
 ///@}
 
 #endif
@@ -25,6 +25,9 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <poll.h>
+#if defined(HAVE_LIBCURL) || defined(HAVE_SAMPLEEVH)
+#include <curl/curl.h>
+#endif
 
 #include "janus.h"
 #include "version.h"
@@ -33,10 +36,15 @@
 #include "apierror.h"
 #include "debug.h"
 #include "ip-utils.h"
+#include "affinity.h"
 #include "rtcp.h"
 #include "auth.h"
 #include "record.h"
 #include "events.h"
+#include "metrics.h"
+#include "memory.h"
+#include "load.h"
+#include "trace.h"
 
 
 #define JANUS_NAME				"Janus WebRTC Gateway"
@@ -135,10 +143,21 @@ static struct janus_json_parameter queryhandler_parameters[] = {
 	{"handler", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
 	{"request", JSON_OBJECT, 0}
 };
+static struct janus_json_parameter querytransport_parameters[] = {
+	{"transport", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
+	{"request", JSON_OBJECT, 0}
+};
 static struct janus_json_parameter customevent_parameters[] = {
 	{"schema", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
 	{"data", JSON_OBJECT, JANUS_JSON_PARAM_REQUIRED}
 };
+static struct janus_json_parameter latency_parameters[] = {
+	{"enable", JANUS_JSON_BOOL, 0},
+	{"reset", JANUS_JSON_BOOL, 0}
+};
+static struct janus_json_parameter memory_parameters[] = {
+	{"details", JANUS_JSON_BOOL, 0}
+};
 static struct janus_json_parameter text2pcap_parameters[] = {
 	{"folder", JSON_STRING, 0},
 	{"filename", JSON_STRING, 0},
@@ -206,6 +225,7 @@ static uint reclaim_session_timeout = DEFAULT_RECLAIM_SESSION_TIMEOUT;
 
 
 /* Information */
+static json_t *janus_startup_info(void);
 static json_t *janus_info(const char *transaction) {
 	/* Prepare a summary on the gateway */
 	json_t *info = janus_create_message("server_info", 0, transaction);
@@ -232,9 +252,12 @@ static json_t *janus_info(const char *transaction) {
 		json_object_set_new(info, "public-ip", json_string(public_ip));
 	json_object_set_new(info, "ipv6", janus_ice_is_ipv6_enabled() ? json_true() : json_false());
 	json_object_set_new(info, "ice-lite", janus_ice_is_ice_lite_enabled() ? json_true() : json_false());
+	json_object_set_new(info, "ice-lite-mux", janus_ice_is_lite_mux_enabled() ? json_true() : json_false());
 	json_object_set_new(info, "ice-tcp", janus_ice_is_ice_tcp_enabled() ? json_true() : json_false());
 	json_object_set_new(info, "full-trickle", janus_ice_is_full_trickle_enabled() ? json_true() : json_false());
 	json_object_set_new(info, "rfc-4588", janus_is_rfc4588_enabled() ? json_true() : json_false());
+	json_object_set_new(info, "egress-batch", json_integer(janus_get_egress_batch()));
+	json_object_set_new(info, "ingress-batch", json_integer(janus_get_ingress_batch()));
 	if(janus_ice_get_stun_server() != NULL) {
 		char server[255];
 		g_snprintf(server, 255, "%s:%"SCNu16, janus_ice_get_stun_server(), janus_ice_get_stun_port());
@@ -248,6 +271,7 @@ static json_t *janus_info(const char *transaction) {
 	json_object_set_new(info, "api_secret", api_secret ? json_true() : json_false());
 	json_object_set_new(info, "auth_token", janus_auth_is_enabled() ? json_true() : json_false());
 	json_object_set_new(info, "event_handlers", janus_events_is_enabled() ? json_true() : json_false());
+	json_object_set_new(info, "load", janus_load_info(FALSE));
 	/* Available transports */
 	json_t *t_data = json_object();
 	if(transports && g_hash_table_size(transports) > 0) {
@@ -311,6 +335,8 @@ static json_t *janus_info(const char *transaction) {
 		}
 	}
 	json_object_set_new(info, "plugins", p_data);
+	/* How long it took to start, and where the time was spent */
+	json_object_set_new(info, "startup", janus_startup_info());
 
 	return info;
 }
@@ -379,6 +405,7 @@ gboolean janus_transport_is_api_secret_valid(janus_transport *plugin, const char
 gboolean janus_transport_is_auth_token_needed(janus_transport *plugin);
 gboolean janus_transport_is_auth_token_valid(janus_transport *plugin, const char *token);
 void janus_transport_notify_event(janus_transport *plugin, void *transport, json_t *event);
+gboolean janus_transport_events_is_enabled(void);
 
 static janus_transport_callbacks janus_handler_transport =
 	{
@@ -388,13 +415,41 @@ static janus_transport_callbacks janus_handler_transport =
 		.is_api_secret_valid = janus_transport_is_api_secret_valid,
 		.is_auth_token_needed = janus_transport_is_auth_token_needed,
 		.is_auth_token_valid = janus_transport_is_auth_token_valid,
-		.events_is_enabled = janus_events_is_enabled,
+		.events_is_enabled = janus_transport_events_is_enabled,
 		.notify_event = janus_transport_notify_event,
 	};
-static GAsyncQueue *requests = NULL;
 static janus_request exit_message;
 static GThreadPool *tasks = NULL;
 void janus_transport_task(gpointer data, gpointer user_data);
+/* Incoming requests are dispatched to a pool of workers, sharded by
+ * session, so that requests for the same session are still handled
+ * in order, while one slow request can't block everybody else */
+typedef struct janus_request_worker {
+	guint id;
+	GThread *thread;
+	GAsyncQueue *queue;
+	/* Stats, protected by request_stats_mutex */
+	guint64 processed;
+	gint64 busy_time, window_start;
+	/* Time spent handling requests since startup, and when we last computed the load */
+	gint64 busy_total, load_busy;
+} janus_request_worker;
+static janus_request_worker *request_workers = NULL;
+static guint request_workers_num = 0;
+#define JANUS_DEFAULT_REQUEST_WORKERS	4
+/* Per-request-type latency (from reception to completion) */
+static const char *janus_request_types[] = {
+	"create", "attach", "message", "trickle", "keepalive", "detach",
+	"hangup", "destroy", "claim", "info", "ping", "admin", "other"
+};
+#define JANUS_REQUEST_TYPES	(sizeof(janus_request_types)/sizeof(*janus_request_types))
+typedef struct janus_request_type_stats {
+	guint64 count;
+	gint64 total, max;
+} janus_request_type_stats;
+static janus_request_type_stats request_stats[JANUS_REQUEST_TYPES];
+static janus_mutex request_stats_mutex = JANUS_MUTEX_INITIALIZER;
+static json_t *janus_request_workers_info(void);
 ///@}
 
 
@@ -407,22 +462,35 @@ void janus_transport_task(gpointer data, gpointer user_data);
 int janus_plugin_push_event(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *transaction, json_t *message, json_t *jsep);
 json_t *janus_plugin_handle_sdp(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *sdp_type, const char *sdp, gboolean restart);
 void janus_plugin_relay_rtp(janus_plugin_session *plugin_session, int video, char *buf, int len);
+void janus_plugin_relay_rtp_shared(janus_plugin_session *plugin_session, int video, janus_plugin_rtp_shared *packet, janus_plugin_rtp_override *override);
 void janus_plugin_relay_rtcp(janus_plugin_session *plugin_session, int video, char *buf, int len);
 void janus_plugin_relay_data(janus_plugin_session *plugin_session, char *buf, int len);
+void janus_plugin_relay_binary_data(janus_plugin_session *plugin_session, char *buf, int len);
+void janus_plugin_relay_data_shared(janus_plugin_session *plugin_session, janus_plugin_rtp_shared *packet, gboolean binary);
+int janus_plugin_data_buffered(janus_plugin_session *plugin_session);
 void janus_plugin_close_pc(janus_plugin_session *plugin_session);
 void janus_plugin_end_session(janus_plugin_session *plugin_session);
+void janus_plugin_set_affinity_group(janus_plugin_session *plugin_session, const char *group);
+gboolean janus_plugin_admission_check(janus_plugin *plugin);
 void janus_plugin_notify_event(janus_plugin *plugin, janus_plugin_session *plugin_session, json_t *event);
+gboolean janus_plugin_events_is_enabled(void);
 gboolean janus_plugin_auth_is_signature_valid(janus_plugin *plugin, const char *token);
 gboolean janus_plugin_auth_signature_contains(janus_plugin *plugin, const char *token, const char *desc);
 static janus_callbacks janus_handler_plugin =
 	{
 		.push_event = janus_plugin_push_event,
 		.relay_rtp = janus_plugin_relay_rtp,
+		.relay_rtp_shared = janus_plugin_relay_rtp_shared,
 		.relay_rtcp = janus_plugin_relay_rtcp,
 		.relay_data = janus_plugin_relay_data,
+		.relay_binary_data = janus_plugin_relay_binary_data,
+		.data_buffered = janus_plugin_data_buffered,
+		.relay_data_shared = janus_plugin_relay_data_shared,
 		.close_pc = janus_plugin_close_pc,
 		.end_session = janus_plugin_end_session,
-		.events_is_enabled = janus_events_is_enabled,
+		.set_affinity_group = janus_plugin_set_affinity_group,
+		.admission_check = janus_plugin_admission_check,
+		.events_is_enabled = janus_plugin_events_is_enabled,
 		.notify_event = janus_plugin_notify_event,
 		.auth_is_signature_valid = janus_plugin_auth_is_signature_valid,
 		.auth_signature_contains = janus_plugin_auth_signature_contains,
@@ -430,11 +498,36 @@ static janus_callbacks janus_handler_plugin =
 ///@}
 
 
-/* Gateway Sessions */
-static janus_mutex sessions_mutex;
-static GHashTable *sessions = NULL;
+/* Gateway Sessions: the table is sharded by session ID, each shard
+ * with its own lock, so that lookups for different sessions (e.g.,
+ * requests, trickles and keepalives) don't all contend the same mutex */
+#define JANUS_SESSIONS_SHARDS	64
+typedef struct janus_sessions_shard {
+	janus_mutex mutex;
+	GHashTable *sessions;
+} janus_sessions_shard;
+static janus_sessions_shard sessions_shards[JANUS_SESSIONS_SHARDS];
+#define janus_sessions_shard_get(id) (&sessions_shards[(id) % JANUS_SESSIONS_SHARDS])
 static GMainContext *sessions_watchdog_context = NULL;
 
+/* Metrics: the number of sessions is only computed when scraped */
+static gint64 janus_sessions_metric(gpointer data) {
+	gint64 count = 0;
+	guint i = 0;
+	for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+		janus_mutex_lock(&sessions_shards[i].mutex);
+		count += sessions_shards[i].sessions ? g_hash_table_size(sessions_shards[i].sessions) : 0;
+		janus_mutex_unlock(&sessions_shards[i].mutex);
+	}
+	return count;
+}
+static gint64 janus_request_worker_metric(gpointer data) {
+	janus_request_worker *worker = (janus_request_worker *)data;
+	/* The length is negative when threads are waiting on an empty queue */
+	gint length = worker->queue ? g_async_queue_length(worker->queue) : 0;
+	return length > 0 ? length : 0;
+}
+
 
 static void janus_ice_handle_dereference(janus_ice_handle *handle) {
 	if(handle)
@@ -455,56 +548,239 @@ static void janus_session_free(const janus_refcount *session_ref) {
 	g_free(session);
 }
 
-static gboolean janus_check_sessions(gpointer user_data) {
-	if(session_timeout < 1)		/* Session timeouts are disabled */
-		return G_SOURCE_CONTINUE;
-	janus_mutex_lock(&sessions_mutex);
-	if(sessions && g_hash_table_size(sessions) > 0) {
+/* Session timeouts are tracked in a timer wheel with one second slots,
+ * rather than by periodically scanning all sessions: each session is
+ * only looked at when the slot of its deadline comes up. Keepalives just
+ * update last_activity as before, so a session that was active in the
+ * meanwhile is simply moved to the slot of its new deadline when its
+ * current one expires, and deadlines further away than the wheel size
+ * just go around once more. The wheel owns a reference to the sessions
+ * in it, and the lock order is always shard first and wheel second. */
+#define JANUS_SESSIONS_WHEEL_SLOTS	512
+static GList *sessions_wheel[JANUS_SESSIONS_WHEEL_SLOTS];
+static gint64 sessions_wheel_tick = 0;
+static janus_mutex sessions_wheel_mutex = JANUS_MUTEX_INITIALIZER;
+
+static gint64 janus_session_deadline(janus_session *session) {
+	gint64 deadline = session->last_activity + (gint64)session_timeout * G_USEC_PER_SEC;
+	if(g_atomic_int_get(&session->transport_gone)) {
+		gint64 reclaim = session->last_activity + (gint64)reclaim_session_timeout * G_USEC_PER_SEC;
+		if(reclaim < deadline)
+			deadline = reclaim;
+	}
+	return deadline;
+}
+
+/* Must be called with the wheel mutex locked */
+static void janus_session_timer_insert(janus_session *session) {
+	gint64 tick = janus_session_deadline(session) / G_USEC_PER_SEC;
+	if(tick <= sessions_wheel_tick)
+		tick = sessions_wheel_tick + 1;
+	session->timer_slot = tick % JANUS_SESSIONS_WHEEL_SLOTS;
+	sessions_wheel[session->timer_slot] = g_list_concat(session->timer, sessions_wheel[session->timer_slot]);
+}
+
+/* Add a session to the wheel, or move it if its deadline changed */
+static void janus_session_timer_arm(janus_session *session) {
+	janus_mutex_lock(&sessions_wheel_mutex);
+	if(session->timer == NULL) {
+		janus_refcount_increase(&session->ref);
+		session->timer = g_list_alloc();
+		session->timer->data = session;
+	} else {
+		sessions_wheel[session->timer_slot] = g_list_remove_link(sessions_wheel[session->timer_slot], session->timer);
+	}
+	janus_session_timer_insert(session);
+	janus_mutex_unlock(&sessions_wheel_mutex);
+}
+
+static void janus_session_timer_disarm(janus_session *session) {
+	janus_mutex_lock(&sessions_wheel_mutex);
+	if(session->timer == NULL) {
+		janus_mutex_unlock(&sessions_wheel_mutex);
+		return;
+	}
+	sessions_wheel[session->timer_slot] = g_list_remove_link(sessions_wheel[session->timer_slot], session->timer);
+	g_list_free_1(session->timer);
+	session->timer = NULL;
+	janus_mutex_unlock(&sessions_wheel_mutex);
+	janus_refcount_decrease(&session->ref);
+}
+
+/* Re-slot all sessions, e.g., after the session timeout changed */
+static void janus_sessions_timers_rearm(void) {
+	guint i = 0;
+	for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+		janus_sessions_shard *shard = &sessions_shards[i];
+		janus_mutex_lock(&shard->mutex);
 		GHashTableIter iter;
 		gpointer value;
-		g_hash_table_iter_init(&iter, sessions);
-		while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		g_hash_table_iter_init(&iter, shard->sessions);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
 			janus_session *session = (janus_session *) value;
-			if (!session || g_atomic_int_get(&session->destroyed)) {
-				continue;
-			}
-			gint64 now = janus_get_monotonic_time();
-			if ((now - session->last_activity >= (gint64)session_timeout * G_USEC_PER_SEC &&
-					!g_atomic_int_compare_and_exchange(&session->timeout, 0, 1)) ||
-					((g_atomic_int_get(&session->transport_gone) && now - session->last_activity >= (gint64)reclaim_session_timeout * G_USEC_PER_SEC) &&
-							!g_atomic_int_compare_and_exchange(&session->timeout, 0, 1))) {
-				JANUS_LOG(LOG_INFO, "Timeout expired for session %"SCNu64"...\n", session->session_id);
-				/* Mark the session as over, we'll deal with it later */
-				janus_session_handles_clear(session);
-				/* Notify the transport */
-				if(session->source) {
-					json_t *event = janus_create_message("timeout", session->session_id, NULL);
-					/* Send this to the transport client and notify the session's over */
-					session->source->transport->send_message(session->source->instance, NULL, FALSE, event);
-					session->source->transport->session_over(session->source->instance, session->session_id, TRUE, FALSE);
-				}
-				/* Notify event handlers as well */
-				if(janus_events_is_enabled())
-					janus_events_notify_handlers(JANUS_EVENT_TYPE_SESSION, session->session_id, "timeout", NULL);
+			if(session && !g_atomic_int_get(&session->destroyed))
+				janus_session_timer_arm(session);
+		}
+		janus_mutex_unlock(&shard->mutex);
+	}
+}
 
-				/* FIXME Is this safe? apparently it causes hash table errors on the console */
-				g_hash_table_iter_remove(&iter);
+static void janus_sessions_timers_clear(void) {
+	janus_mutex_lock(&sessions_wheel_mutex);
+	guint i = 0;
+	for(i=0; i<JANUS_SESSIONS_WHEEL_SLOTS; i++) {
+		while(sessions_wheel[i] != NULL) {
+			GList *link = sessions_wheel[i];
+			janus_session *session = (janus_session *)link->data;
+			sessions_wheel[i] = g_list_remove_link(sessions_wheel[i], link);
+			g_list_free_1(link);
+			session->timer = NULL;
+			janus_refcount_decrease(&session->ref);
+		}
+	}
+	janus_mutex_unlock(&sessions_wheel_mutex);
+}
 
-				janus_session_destroy(session);
+static gboolean janus_check_sessions(gpointer user_data) {
+	if(session_timeout < 1)		/* Session timeouts are disabled */
+		return G_SOURCE_CONTINUE;
+	gint64 now = janus_get_monotonic_time();
+	gint64 tick = now / G_USEC_PER_SEC;
+	/* Collect the sessions in the slots that came due since the last check:
+	 * the wheel reference is passed to the list of expired sessions */
+	GList *expired = NULL;
+	janus_mutex_lock(&sessions_wheel_mutex);
+	guint steps = 0;
+	while(sessions_wheel_tick < tick && steps < JANUS_SESSIONS_WHEEL_SLOTS) {
+		sessions_wheel_tick++;
+		steps++;
+		guint slot = sessions_wheel_tick % JANUS_SESSIONS_WHEEL_SLOTS;
+		GList *list = sessions_wheel[slot];
+		sessions_wheel[slot] = NULL;
+		while(list != NULL) {
+			GList *link = list;
+			janus_session *session = (janus_session *)link->data;
+			list = g_list_remove_link(list, link);
+			if(g_atomic_int_get(&session->destroyed) || janus_session_deadline(session) <= now) {
+				g_list_free_1(link);
+				session->timer = NULL;
+				expired = g_list_prepend(expired, session);
+			} else {
+				/* Not expired yet (or not anymore), move to the new slot */
+				janus_session_timer_insert(session);
 			}
 		}
 	}
-	janus_mutex_unlock(&sessions_mutex);
+	/* If we fell behind more than a whole round, we've seen all slots already */
+	if(sessions_wheel_tick < tick)
+		sessions_wheel_tick = tick;
+	janus_mutex_unlock(&sessions_wheel_mutex);
+	/* Now get rid of the sessions that timed out */
+	while(expired != NULL) {
+		janus_session *session = (janus_session *)expired->data;
+		expired = g_list_delete_link(expired, expired);
+		janus_sessions_shard *shard = janus_sessions_shard_get(session->session_id);
+		janus_mutex_lock(&shard->mutex);
+		if(g_hash_table_lookup(shard->sessions, &session->session_id) == session &&
+				!g_atomic_int_get(&session->destroyed) &&
+				g_atomic_int_compare_and_exchange(&session->timeout, 0, 1)) {
+			JANUS_LOG(LOG_INFO, "Timeout expired for session %"SCNu64"...\n", session->session_id);
+			/* Mark the session as over, we'll deal with it later */
+			janus_session_handles_clear(session);
+			/* Notify the transport */
+			if(session->source) {
+				json_t *event = janus_create_message("timeout", session->session_id, NULL);
+				/* Send this to the transport client and notify the session's over */
+				session->source->transport->send_message(session->source->instance, NULL, FALSE, event);
+				session->source->transport->session_over(session->source->instance, session->session_id, TRUE, FALSE);
+			}
+			/* Notify event handlers as well */
+			if(janus_events_should_notify(JANUS_EVENT_TYPE_SESSION))
+				janus_events_notify_handlers(JANUS_EVENT_TYPE_SESSION, session->session_id, "timeout", NULL);
+
+			g_hash_table_remove(shard->sessions, &session->session_id);
+
+			janus_session_destroy(session);
+		}
+		janus_mutex_unlock(&shard->mutex);
+		janus_refcount_decrease(&session->ref);
+	}
 
 	return G_SOURCE_CONTINUE;
 }
 
+/* Load score: once per second, we check how busy the request workers were,
+ * how many handles have a backlog of packets to send, how much CPU we used,
+ * and how loaded plugins say they are, and update the score accordingly */
+#define JANUS_LOAD_QUEUE_BACKLOG	25	/* Percentage of the outgoing queue in use */
+static gint64 load_last_check = 0;
+static gboolean janus_load_check(gpointer user_data) {
+	int components[JANUS_LOAD_COMPONENTS] = { 0 };
+	gint64 now = janus_get_monotonic_time();
+	gint64 elapsed = load_last_check > 0 ? (now - load_last_check) : 0;
+	load_last_check = now;
+	components[janus_load_cpu] = janus_load_sample_cpu();
+	/* How busy was the busiest request worker? */
+	guint i = 0;
+	janus_mutex_lock(&request_stats_mutex);
+	for(i=0; i<request_workers_num; i++) {
+		janus_request_worker *worker = &request_workers[i];
+		gint64 busy = worker->busy_total - worker->load_busy;
+		worker->load_busy = worker->busy_total;
+		if(elapsed > 0 && (busy*100)/elapsed > components[janus_load_requests])
+			components[janus_load_requests] = (busy*100)/elapsed;
+	}
+	janus_mutex_unlock(&request_stats_mutex);
+	/* How many handles can't keep up with what they have to send? */
+	guint handles = 0, backlogged = 0;
+	GHashTableIter iter, hiter;
+	gpointer value;
+	for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+		janus_sessions_shard *shard = &sessions_shards[i];
+		janus_mutex_lock(&shard->mutex);
+		g_hash_table_iter_init(&iter, shard->sessions);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_session *session = (janus_session *)value;
+			janus_mutex_lock(&session->mutex);
+			if(session->ice_handles != NULL) {
+				g_hash_table_iter_init(&hiter, session->ice_handles);
+				while(g_hash_table_iter_next(&hiter, NULL, &value)) {
+					int usage = janus_ice_handle_queue_usage((janus_ice_handle *)value);
+					if(usage < 0)
+						continue;
+					handles++;
+					if(usage >= JANUS_LOAD_QUEUE_BACKLOG)
+						backlogged++;
+				}
+			}
+			janus_mutex_unlock(&session->mutex);
+		}
+		janus_mutex_unlock(&shard->mutex);
+	}
+	if(handles > 0)
+		components[janus_load_queues] = (backlogged*100)/handles;
+	/* Finally, ask the plugins that can tell us */
+	if(plugins != NULL) {
+		g_hash_table_iter_init(&iter, plugins);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_plugin *p = (janus_plugin *)value;
+			if(p == NULL || p->get_load == NULL)
+				continue;
+			int load = p->get_load();
+			if(load > components[janus_load_plugins])
+				components[janus_load_plugins] = load;
+		}
+	}
+	janus_load_update(components);
+	return G_SOURCE_CONTINUE;
+}
+
 static gpointer janus_sessions_watchdog(gpointer user_data) {
 	GMainLoop *loop = (GMainLoop *) user_data;
 	GMainContext *watchdog_context = g_main_loop_get_context(loop);
 	GSource *timeout_source;
 
-	timeout_source = g_timeout_source_new_seconds(2);
+	timeout_source = g_timeout_source_new_seconds(1);
 	g_source_set_callback(timeout_source, janus_check_sessions, watchdog_context, NULL);
 	g_source_attach(timeout_source, watchdog_context);
 	g_source_unref(timeout_source);
@@ -542,22 +818,27 @@ janus_session *janus_session_create(guint64 session_id) {
 	g_atomic_int_set(&session->transport_gone, 0);
 	session->last_activity = janus_get_monotonic_time();
 	session->ice_handles = NULL;
+	session->timer = NULL;
+	session->timer_slot = 0;
 	janus_mutex_init(&session->mutex);
-	janus_mutex_lock(&sessions_mutex);
-	g_hash_table_insert(sessions, janus_uint64_dup(session->session_id), session);
-	janus_mutex_unlock(&sessions_mutex);
+	janus_sessions_shard *shard = janus_sessions_shard_get(session->session_id);
+	janus_mutex_lock(&shard->mutex);
+	g_hash_table_insert(shard->sessions, janus_uint64_dup(session->session_id), session);
+	janus_session_timer_arm(session);
+	janus_mutex_unlock(&shard->mutex);
 	return session;
 }
 
 janus_session *janus_session_find(guint64 session_id) {
-	janus_mutex_lock(&sessions_mutex);
-	janus_session *session = g_hash_table_lookup(sessions, &session_id);
+	janus_sessions_shard *shard = janus_sessions_shard_get(session_id);
+	janus_mutex_lock(&shard->mutex);
+	janus_session *session = g_hash_table_lookup(shard->sessions, &session_id);
 	if(session != NULL) {
 		/* A successful find automatically increases the reference counter:
 		 * it's up to the caller to decrease it again when done */
 		janus_refcount_increase(&session->ref);
 	}
-	janus_mutex_unlock(&sessions_mutex);
+	janus_mutex_unlock(&shard->mutex);
 	return session;
 }
 
@@ -662,6 +943,7 @@ janus_request *janus_request_new(janus_transport *transport, janus_transport_ses
 	request->request_id = request_id;
 	request->admin = admin;
 	request->message = message;
+	request->received = janus_get_monotonic_time();
 	return request;
 }
 
@@ -849,7 +1131,7 @@ int janus_process_incoming_request(janus_request *request) {
 		/* Notify the source that a new session has been created */
 		request->transport->session_created(request->instance, session->session_id);
 		/* Notify event handlers */
-		if(janus_events_is_enabled()) {
+		if(janus_events_should_notify(JANUS_EVENT_TYPE_SESSION)) {
 			/* Session created, add info on the transport that originated it */
 			json_t *transport = json_object();
 			json_object_set_new(transport, "transport", json_string(session->source->transport->get_package()));
@@ -944,6 +1226,13 @@ int janus_process_incoming_request(janus_request *request) {
 				}
 			}
 		}
+		/* If admission control is enabled and we're too loaded, refuse new handles */
+		if(!janus_load_is_admitting()) {
+			janus_load_rejected();
+			ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_OVERLOADED,
+				"Too loaded to accept new handles (load score %d)", janus_load_get_score());
+			goto jsondone;
+		}
 		json_t *opaque = json_object_get(root, "opaque_id");
 		const char *opaque_id = opaque ? json_string_value(opaque) : NULL;
 		/* Create handle */
@@ -978,9 +1267,11 @@ int janus_process_incoming_request(janus_request *request) {
 			ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_REQUEST_PATH, "Unhandled request '%s' at this path", message_text);
 			goto jsondone;
 		}
-		janus_mutex_lock(&sessions_mutex);
-		g_hash_table_remove(sessions, &session->session_id);
-		janus_mutex_unlock(&sessions_mutex);
+		janus_sessions_shard *shard = janus_sessions_shard_get(session->session_id);
+		janus_mutex_lock(&shard->mutex);
+		g_hash_table_remove(shard->sessions, &session->session_id);
+		janus_mutex_unlock(&shard->mutex);
+		janus_session_timer_disarm(session);
 		/* Notify the source that the session has been destroyed */
 		if(session->source && session->source->transport) {
 			session->source->transport->session_over(session->source->instance, session->session_id, FALSE, FALSE);
@@ -993,7 +1284,7 @@ int janus_process_incoming_request(janus_request *request) {
 		/* Send the success reply */
 		ret = janus_process_success(request, reply);
 		/* Notify event handlers as well */
-		if(janus_events_is_enabled())
+		if(janus_events_should_notify(JANUS_EVENT_TYPE_SESSION))
 			janus_events_notify_handlers(JANUS_EVENT_TYPE_SESSION, session_id, "destroyed", NULL);
 	} else if(!strcasecmp(message_text, "detach")) {
 		if(handle == NULL) {
@@ -1145,7 +1436,7 @@ int janus_process_incoming_request(janus_request *request) {
 				goto jsondone;
 			}
 			/* Notify event handlers */
-			if(janus_events_is_enabled()) {
+			if(janus_events_should_notify(JANUS_EVENT_TYPE_JSEP)) {
 				janus_events_notify_handlers(JANUS_EVENT_TYPE_JSEP,
 					session_id, handle_id, handle->opaque_id, "remote", jsep_type, jsep_sdp);
 			}
@@ -1666,6 +1957,23 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			json_object_set_new(status, "libnice_debug", janus_ice_is_ice_debugging_enabled() ? json_true() : json_false());
 			json_object_set_new(status, "max_nack_queue", json_integer(janus_get_max_nack_queue()));
 			json_object_set_new(status, "no_media_timer", json_integer(janus_get_no_media_timer()));
+			json_object_set_new(status, "static_event_loops", json_integer(janus_ice_get_static_event_loops()));
+			json_t *loops = janus_ice_static_event_loops_info();
+			if(loops != NULL)
+				json_object_set_new(status, "event_loops", loops);
+			json_object_set_new(status, "packet_pool", janus_ice_packet_pool_info());
+			json_object_set_new(status, "local_addresses", janus_ice_local_addresses_info());
+			json_t *mux = janus_ice_lite_mux_info();
+			if(mux != NULL)
+				json_object_set_new(status, "ice_lite_mux", mux);
+			json_t *dtls_resumption = janus_dtls_session_resumption_info();
+			if(dtls_resumption != NULL)
+				json_object_set_new(status, "dtls_session_resumption", dtls_resumption);
+			json_t *dtls_workers = janus_dtls_workers_info();
+			if(dtls_workers != NULL)
+				json_object_set_new(status, "dtls_workers", dtls_workers);
+			json_object_set_new(status, "media_latency", janus_ice_is_media_latency_enabled() ? json_true() : json_false());
+			json_object_set_new(status, "request_workers", janus_request_workers_info());
 			json_object_set_new(reply, "status", status);
 			/* Send the success reply */
 			ret = janus_process_success(request, reply);
@@ -1686,6 +1994,8 @@ int janus_process_incoming_admin_request(janus_request *request) {
 				goto jsondone;
 			}
 			session_timeout = timeout_num;
+			/* Deadlines changed, move the sessions to the right slots */
+			janus_sessions_timers_rearm();
 			/* Prepare JSON reply */
 			json_t *reply = json_object();
 			json_object_set_new(reply, "janus", json_string("success"));
@@ -1831,6 +2141,50 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			/* Send the success reply */
 			ret = janus_process_success(request, reply);
 			goto jsondone;
+		} else if(!strcasecmp(message_text, "media_latency")) {
+			/* Return the per-plugin latency histograms, optionally enabling/disabling or resetting them */
+			JANUS_VALIDATE_JSON_OBJECT(root, latency_parameters,
+				error_code, error_cause, FALSE,
+				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+			if(error_code != 0) {
+				ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+				goto jsondone;
+			}
+			json_t *enable = json_object_get(root, "enable");
+			if(enable != NULL)
+				janus_ice_set_media_latency_enabled(json_is_true(enable));
+			/* Prepare JSON reply */
+			json_t *reply = janus_create_message("success", 0, transaction_text);
+			json_object_set_new(reply, "enabled", janus_ice_is_media_latency_enabled() ? json_true() : json_false());
+			json_object_set_new(reply, "plugins", janus_ice_media_latency_info());
+			json_object_set_new(reply, "srtp", janus_ice_srtp_timing_info());
+			if(json_is_true(json_object_get(root, "reset")))
+				janus_ice_media_latency_reset();
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
+		} else if(!strcasecmp(message_text, "memory")) {
+			/* Return the memory accounted for, per subsystem and per account */
+			JANUS_VALIDATE_JSON_OBJECT(root, memory_parameters,
+				error_code, error_cause, FALSE,
+				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+			if(error_code != 0) {
+				ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+				goto jsondone;
+			}
+			/* Prepare JSON reply */
+			json_t *reply = janus_create_message("success", 0, transaction_text);
+			json_object_set_new(reply, "memory", janus_memory_info(json_is_true(json_object_get(root, "details"))));
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
+		} else if(!strcasecmp(message_text, "load")) {
+			/* Return the load score, its components and the admission control state */
+			json_t *reply = janus_create_message("success", 0, transaction_text);
+			json_object_set_new(reply, "load", janus_load_info(TRUE));
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
 		} else if(!strcasecmp(message_text, "set_no_media_timer")) {
 			/* Change the current value for the no-media timer */
 			JANUS_VALIDATE_JSON_OBJECT(root, nmt_parameters,
@@ -1877,6 +2231,41 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			}
 			json_t *query = json_object_get(root, "request");
 			json_t *response = evh->handle_request(query);
+			/* The request may have changed the events the handler is interested in */
+			janus_events_update_mask();
+			/* Prepare JSON reply */
+			json_t *reply = json_object();
+			json_object_set_new(reply, "janus", json_string("success"));
+			json_object_set_new(reply, "transaction", json_string(transaction_text));
+			json_object_set_new(reply, "response", response ? response : json_object());
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
+		} else if(!strcasecmp(message_text, "query_transport")) {
+			/* Contact a transport plugin and expect a response */
+			JANUS_VALIDATE_JSON_OBJECT(root, querytransport_parameters,
+				error_code, error_cause, FALSE,
+				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+			if(error_code != 0) {
+				ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+				goto jsondone;
+			}
+			const char *transport_value = json_string_value(json_object_get(root, "transport"));
+			janus_transport *transport = g_hash_table_lookup(transports, transport_value);
+			if(transport == NULL) {
+				/* No such transport... */
+				g_snprintf(error_cause, sizeof(error_cause), "%s", "Invalid transport");
+				ret = janus_process_error_string(request, session_id, transaction_text, JANUS_ERROR_PLUGIN_NOT_FOUND, error_cause);
+				goto jsondone;
+			}
+			if(transport->query_transport == NULL) {
+				/* Transport doesn't implement the hook... */
+				g_snprintf(error_cause, sizeof(error_cause), "%s", "Transport doesn't support queries");
+				ret = janus_process_error_string(request, session_id, transaction_text, JANUS_ERROR_UNKNOWN, error_cause);
+				goto jsondone;
+			}
+			json_t *query = json_object_get(root, "request");
+			json_t *response = transport->query_transport(query);
 			/* Prepare JSON reply */
 			json_t *reply = json_object();
 			json_object_set_new(reply, "janus", json_string("success"));
@@ -1897,7 +2286,7 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			json_t *schema = json_object_get(root, "schema");
 			const char *schema_value = json_string_value(schema);
 			json_t *data = json_object_get(root, "data");
-			if(janus_events_is_enabled()) {
+			if(janus_events_should_notify(JANUS_EVENT_TYPE_EXTERNAL)) {
 				json_incref(data);
 				janus_events_notify_handlers(JANUS_EVENT_TYPE_EXTERNAL, 0, schema_value, data);
 			}
@@ -1912,11 +2301,13 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			/* List sessions */
 			session_id = 0;
 			json_t *list = json_array();
-			if(sessions != NULL && g_hash_table_size(sessions) > 0) {
-				janus_mutex_lock(&sessions_mutex);
+			guint i = 0;
+			for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+				janus_sessions_shard *shard = &sessions_shards[i];
+				janus_mutex_lock(&shard->mutex);
 				GHashTableIter iter;
 				gpointer value;
-				g_hash_table_iter_init(&iter, sessions);
+				g_hash_table_iter_init(&iter, shard->sessions);
 				while (g_hash_table_iter_next(&iter, NULL, &value)) {
 					janus_session *session = value;
 					if(session == NULL) {
@@ -1924,7 +2315,7 @@ int janus_process_incoming_admin_request(janus_request *request) {
 					}
 					json_array_append_new(list, json_integer(session->session_id));
 				}
-				janus_mutex_unlock(&sessions_mutex);
+				janus_mutex_unlock(&shard->mutex);
 			}
 			/* Prepare JSON reply */
 			json_t *reply = janus_create_message("success", 0, transaction_text);
@@ -2169,6 +2560,16 @@ int janus_process_incoming_admin_request(janus_request *request) {
 		json_object_set_new(info, "flags", flags);
 		if(handle->agent) {
 			json_object_set_new(info, "agent-created", json_integer(handle->agent_created));
+			if(handle->setup_started > 0) {
+				json_t *gathering = json_object();
+				json_object_set_new(gathering, "setup-us", json_integer(
+					(handle->gathering_started ? handle->gathering_started : handle->setup_started) - handle->setup_started));
+				if(handle->gathering_done > 0) {
+					json_object_set_new(gathering, "gathering-us", json_integer(handle->gathering_done - handle->gathering_started));
+					json_object_set_new(gathering, "candidates", json_integer(handle->gathered_candidates));
+				}
+				json_object_set_new(info, "gathering", gathering);
+			}
 			json_object_set_new(info, "ice-mode", json_string(janus_ice_is_ice_lite_enabled() ? "lite" : "full"));
 			json_object_set_new(info, "ice-role", json_string(handle->controlling ? "controlling" : "controlled"));
 		}
@@ -2182,8 +2583,28 @@ int janus_process_incoming_admin_request(janus_request *request) {
 		json_object_set_new(info, "sdps", sdps);
 		if(handle->pending_trickles)
 			json_object_set_new(info, "pending-trickles", json_integer(g_list_length(handle->pending_trickles)));
-		if(handle->queued_packets)
-			json_object_set_new(info, "queued-packets", json_integer(g_async_queue_length(handle->queued_packets)));
+		if(handle->queued_packets) {
+			json_object_set_new(info, "queued-packets", json_integer(janus_ice_queue_length(handle->queued_packets)));
+			json_object_set_new(info, "queue-drops", json_integer(g_atomic_int_get(&handle->queued_packets->dropped)));
+		}
+		if(handle->ingress_batches > 0) {
+			json_t *ib = json_object();
+			json_object_set_new(ib, "batches", json_integer(handle->ingress_batches));
+			json_object_set_new(ib, "packets", json_integer(handle->ingress_batched_packets));
+			json_object_set_new(ib, "packets-per-batch", json_real((double)handle->ingress_batched_packets/(double)handle->ingress_batches));
+			json_object_set_new(info, "ingress-batch", ib);
+		}
+		json_t *latency = janus_ice_handle_latency_info(handle);
+		if(latency != NULL)
+			json_object_set_new(info, "media-latency", latency);
+		json_t *memory = janus_memory_account_info(handle->memory);
+		if(memory != NULL)
+			json_object_set_new(info, "memory", memory);
+		if(handle->static_loop)
+			json_object_set_new(info, "event-loop", json_integer(handle->static_loop->id));
+		json_t *affinity = janus_ice_handle_affinity_info(handle);
+		if(affinity != NULL)
+			json_object_set_new(info, "affinity", affinity);
 		if(g_atomic_int_get(&handle->dump_packets)) {
 			json_object_set_new(info, "dump-to-text2pcap", json_true());
 			if(handle->text2pcap && handle->text2pcap->filename)
@@ -2481,6 +2902,29 @@ json_t *janus_admin_component_summary(janus_ice_component *component) {
 	json_object_set_new(c, "dtls", d);
 	json_object_set_new(c, "in_stats", in_stats);
 	json_object_set_new(c, "out_stats", out_stats);
+	if(component->egress_batch) {
+		json_t *eb = json_object();
+		json_object_set_new(eb, "packets", json_integer(component->egress_packets));
+		json_object_set_new(eb, "syscalls", json_integer(component->egress_syscalls));
+		json_object_set_new(eb, "gso-packets", json_integer(component->egress_gso_packets));
+		if(component->egress_syscalls > 0)
+			json_object_set_new(eb, "packets-per-syscall", json_real((double)component->egress_packets/(double)component->egress_syscalls));
+		json_object_set_new(c, "egress-batch", eb);
+	}
+	if(component->audio_retransmit_buffer || component->video_retransmit_buffer) {
+		json_t *rb = json_object();
+		size_t memory = 0;
+		if(component->audio_retransmit_buffer) {
+			json_object_set_new(rb, "audio-slots", json_integer(component->audio_retransmit_buffer->size));
+			memory += component->audio_retransmit_buffer->memory;
+		}
+		if(component->video_retransmit_buffer) {
+			json_object_set_new(rb, "video-slots", json_integer(component->video_retransmit_buffer->size));
+			memory += component->video_retransmit_buffer->memory;
+		}
+		json_object_set_new(rb, "memory", json_integer(memory));
+		json_object_set_new(c, "retransmit-buffers", rb);
+	}
 	return c;
 }
 
@@ -2506,37 +2950,54 @@ void janus_transport_incoming_request(janus_transport *plugin, janus_transport_s
 	JANUS_LOG(LOG_VERB, "Got %s API request from %s (%p)\n", admin ? "an admin" : "a Janus", plugin->get_package(), transport);
 	/* Create a janus_request instance to handle the request */
 	janus_request *request = janus_request_new(plugin, transport, request_id, admin, message);
-	/* Enqueue the request, the thread will pick it up */
-	g_async_queue_push(requests, request);
+	/* Enqueue the request, the worker for this session will pick it up: requests
+	 * that don't have a session yet are sharded by transport instance instead */
+	guint index = 0;
+	if(request_workers_num > 1) {
+		json_t *s = json_object_get(message, "session_id");
+		guint64 session_id = json_is_integer(s) ? json_integer_value(s) : 0;
+		if(session_id > 0)
+			index = session_id % request_workers_num;
+		else
+			index = g_direct_hash(transport) % request_workers_num;
+	}
+	g_async_queue_push(request_workers[index].queue, request);
 }
 
 void janus_transport_gone(janus_transport *plugin, janus_transport_session *transport) {
 	/* Get rid of sessions this transport was handling */
 	JANUS_LOG(LOG_VERB, "A %s transport instance has gone away (%p)\n", plugin->get_package(), transport);
-	janus_mutex_lock(&sessions_mutex);
-	if(sessions && g_hash_table_size(sessions) > 0) {
-		GHashTableIter iter;
-		gpointer value;
-		g_hash_table_iter_init(&iter, sessions);
-		while(g_hash_table_iter_next(&iter, NULL, &value)) {
-			janus_session *session = (janus_session *) value;
-			if(!session || g_atomic_int_get(&session->destroyed) || g_atomic_int_get(&session->timeout) || session->last_activity == 0)
-				continue;
-			if(session->source && session->source->instance == transport) {
-				JANUS_LOG(LOG_VERB, "  -- Session %"SCNu64" will be over if not reclaimed\n", session->session_id);
-				JANUS_LOG(LOG_VERB, "  -- Marking Session %"SCNu64" as over\n", session->session_id);
-				if(reclaim_session_timeout < 1) { /* Reclaim session timeouts are disabled */
-					/* Mark the session as destroyed */
-					janus_session_destroy(session);
-					g_hash_table_iter_remove(&iter);
-				} else {
-					/* Set flag for transport_gone. The Janus sessions watchdog will clean this up if not reclaimed*/
-					g_atomic_int_set(&session->transport_gone, 1);
+	guint i = 0;
+	for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+		janus_sessions_shard *shard = &sessions_shards[i];
+		janus_mutex_lock(&shard->mutex);
+		if(g_hash_table_size(shard->sessions) > 0) {
+			GHashTableIter iter;
+			gpointer value;
+			g_hash_table_iter_init(&iter, shard->sessions);
+			while(g_hash_table_iter_next(&iter, NULL, &value)) {
+				janus_session *session = (janus_session *) value;
+				if(!session || g_atomic_int_get(&session->destroyed) || g_atomic_int_get(&session->timeout) || session->last_activity == 0)
+					continue;
+				if(session->source && session->source->instance == transport) {
+					JANUS_LOG(LOG_VERB, "  -- Session %"SCNu64" will be over if not reclaimed\n", session->session_id);
+					JANUS_LOG(LOG_VERB, "  -- Marking Session %"SCNu64" as over\n", session->session_id);
+					if(reclaim_session_timeout < 1) { /* Reclaim session timeouts are disabled */
+						/* Mark the session as destroyed */
+						janus_session_timer_disarm(session);
+						janus_session_destroy(session);
+						g_hash_table_iter_remove(&iter);
+					} else {
+						/* Set flag for transport_gone. The Janus sessions watchdog will clean this up if not reclaimed*/
+						g_atomic_int_set(&session->transport_gone, 1);
+						/* The reclaim timeout may be shorter than the session timeout */
+						janus_session_timer_arm(session);
+					}
 				}
 			}
 		}
+		janus_mutex_unlock(&shard->mutex);
 	}
-	janus_mutex_unlock(&sessions_mutex);
 }
 
 gboolean janus_transport_is_api_secret_needed(janus_transport *plugin) {
@@ -2559,12 +3020,18 @@ gboolean janus_transport_is_auth_token_valid(janus_transport *plugin, const char
 	return token && janus_auth_check_token(token);
 }
 
+gboolean janus_transport_events_is_enabled(void) {
+	/* Transports can only originate transport events, so there's no point
+	 * in having them prepare any if no handler is interested in them */
+	return janus_events_is_type_enabled(JANUS_EVENT_TYPE_TRANSPORT);
+}
+
 void janus_transport_notify_event(janus_transport *plugin, void *transport, json_t *event) {
 	/* A plugin asked to notify an event to the handlers */
 	if(!plugin || !event || !json_is_object(event))
 		return;
 	/* Notify event handlers */
-	if(janus_events_is_enabled()) {
+	if(janus_events_should_notify(JANUS_EVENT_TYPE_TRANSPORT)) {
 		janus_events_notify_handlers(JANUS_EVENT_TYPE_TRANSPORT,
 			0, plugin->get_package(), transport, event);
 	} else {
@@ -2572,6 +3039,28 @@ void janus_transport_notify_event(janus_transport *plugin, void *transport, json
 	}
 }
 
+/* Helper to keep track of how long it took to serve a request */
+static void janus_request_track(janus_request *request, const char *type) {
+	guint i = 0;
+	if(request->admin) {
+		i = JANUS_REQUEST_TYPES-2;
+	} else {
+		for(i=0; i<JANUS_REQUEST_TYPES-2; i++) {
+			if(type && !strcasecmp(type, janus_request_types[i]))
+				break;
+		}
+		if(i == JANUS_REQUEST_TYPES-2)
+			i = JANUS_REQUEST_TYPES-1;
+	}
+	gint64 latency = janus_get_monotonic_time() - request->received;
+	janus_mutex_lock(&request_stats_mutex);
+	request_stats[i].count++;
+	request_stats[i].total += latency;
+	if(latency > request_stats[i].max)
+		request_stats[i].max = latency;
+	janus_mutex_unlock(&request_stats_mutex);
+}
+
 void janus_transport_task(gpointer data, gpointer user_data) {
 	JANUS_LOG(LOG_VERB, "Transport task pool, serving request\n");
 	janus_request *request = (janus_request *)data;
@@ -2583,26 +3072,31 @@ void janus_transport_task(gpointer data, gpointer user_data) {
 		janus_process_incoming_request(request);
 	else
 		janus_process_incoming_admin_request(request);
+	janus_request_track(request, "message");
 	/* Done */
 	janus_request_destroy(request);
 }
 
 
-/* Thread to handle incoming requests: may involve an asynchronous task for plugin messaging */
+/* Request workers: may involve an asynchronous task for plugin messaging */
 static void *janus_transport_requests(void *data) {
-	JANUS_LOG(LOG_INFO, "Joining Janus requests handler thread\n");
+	janus_request_worker *worker = (janus_request_worker *)data;
+	JANUS_LOG(LOG_INFO, "Joining Janus requests handler thread #%u\n", worker->id);
 	janus_request *request = NULL;
 	gboolean destroy = FALSE;
 	while(!g_atomic_int_get(&stop)) {
-		request = g_async_queue_pop(requests);
+		request = g_async_queue_pop(worker->queue);
 		if(request == &exit_message)
 			break;
+		gint64 start = janus_get_monotonic_time();
+		JANUS_TRACE3(request_start, worker->id, request->admin, start - request->received);
 		/* Should we process the request synchronously or with a task from the thread pool? */
 		destroy = TRUE;
+		const gchar *message_text = NULL;
 		if(!request->admin) {
 			/* Process the request synchronously only it's not a message for a plugin */
 			json_t *message = json_object_get(request->message, "janus");
-			const gchar *message_text = json_string_value(message);
+			message_text = json_string_value(message);
 			if(message_text && !strcasecmp(message_text, "message")) {
 				/* Spawn a task thread */
 				GError *tperror = NULL;
@@ -2625,13 +3119,59 @@ static void *janus_transport_requests(void *data) {
 			janus_process_incoming_admin_request(request);
 		}
 		/* Done */
-		if(destroy)
+		if(destroy) {
+			janus_request_track(request, message_text);
 			janus_request_destroy(request);
-	}
-	JANUS_LOG(LOG_INFO, "Leaving Janus requests handler thread\n");
+		}
+		gint64 elapsed = janus_get_monotonic_time() - start;
+		JANUS_TRACE3(request_done, worker->id, !destroy, elapsed);
+		janus_mutex_lock(&request_stats_mutex);
+		worker->processed++;
+		worker->busy_time += elapsed;
+		worker->busy_total += elapsed;
+		janus_mutex_unlock(&request_stats_mutex);
+	}
+	JANUS_LOG(LOG_INFO, "Leaving Janus requests handler thread #%u\n", worker->id);
 	return NULL;
 }
 
+/* Helper to return info on the request workers, for the Admin API: utilization
+ * is computed on the time that passed since the previous time we were asked */
+static json_t *janus_request_workers_info(void) {
+	json_t *info = json_object();
+	json_object_set_new(info, "count", json_integer(request_workers_num));
+	json_t *workers = json_array();
+	gint64 now = janus_get_monotonic_time();
+	guint i = 0;
+	janus_mutex_lock(&request_stats_mutex);
+	for(i=0; i<request_workers_num; i++) {
+		janus_request_worker *worker = &request_workers[i];
+		json_t *w = json_object();
+		json_object_set_new(w, "id", json_integer(worker->id));
+		json_object_set_new(w, "queue", json_integer(g_async_queue_length(worker->queue)));
+		json_object_set_new(w, "processed", json_integer(worker->processed));
+		gint64 elapsed = now - worker->window_start;
+		json_object_set_new(w, "utilization", json_real(elapsed > 0 ? (double)worker->busy_time/(double)elapsed : 0.0));
+		worker->busy_time = 0;
+		worker->window_start = now;
+		json_array_append_new(workers, w);
+	}
+	json_object_set_new(info, "workers", workers);
+	json_t *latency = json_object();
+	for(i=0; i<JANUS_REQUEST_TYPES; i++) {
+		if(request_stats[i].count == 0)
+			continue;
+		json_t *t = json_object();
+		json_object_set_new(t, "count", json_integer(request_stats[i].count));
+		json_object_set_new(t, "avg", json_integer(request_stats[i].total/request_stats[i].count));
+		json_object_set_new(t, "max", json_integer(request_stats[i].max));
+		json_object_set_new(latency, janus_request_types[i], t);
+	}
+	janus_mutex_unlock(&request_stats_mutex);
+	json_object_set_new(info, "latency", latency);
+	return info;
+}
+
 
 /* Event handlers */
 void janus_eventhandler_close(gpointer key, gpointer value, gpointer user_data) {
@@ -2742,7 +3282,7 @@ int janus_plugin_push_event(janus_plugin_session *plugin_session, janus_plugin *
 		janus_ice_resend_trickles(ice_handle);
 	}
 
-	if(jsep != NULL && janus_events_is_enabled()) {
+	if(jsep != NULL && janus_events_should_notify(JANUS_EVENT_TYPE_JSEP)) {
 		/* Notify event handlers as well */
 		janus_events_notify_handlers(JANUS_EVENT_TYPE_JSEP,
 			session->session_id, ice_handle->handle_id, ice_handle->opaque_id, "local", sdp_type, sdp);
@@ -3003,6 +3543,16 @@ void janus_plugin_relay_rtp(janus_plugin_session *plugin_session, int video, cha
 	janus_ice_relay_rtp(handle, video, buf, len);
 }
 
+void janus_plugin_relay_rtp_shared(janus_plugin_session *plugin_session, int video, janus_plugin_rtp_shared *packet, janus_plugin_rtp_override *override) {
+	if((plugin_session < (janus_plugin_session *)0x1000) || g_atomic_int_get(&plugin_session->stopped) || packet == NULL)
+		return;
+	janus_ice_handle *handle = (janus_ice_handle *)plugin_session->gateway_handle;
+	if(!handle || janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP)
+			|| janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT))
+		return;
+	janus_ice_relay_rtp_shared(handle, video, packet, override);
+}
+
 void janus_plugin_relay_rtcp(janus_plugin_session *plugin_session, int video, char *buf, int len) {
 	if((plugin_session < (janus_plugin_session *)0x1000) || g_atomic_int_get(&plugin_session->stopped) || buf == NULL || len < 1)
 		return;
@@ -3027,6 +3577,48 @@ void janus_plugin_relay_data(janus_plugin_session *plugin_session, char *buf, in
 #endif
 }
 
+void janus_plugin_relay_binary_data(janus_plugin_session *plugin_session, char *buf, int len) {
+	if((plugin_session < (janus_plugin_session *)0x1000) || g_atomic_int_get(&plugin_session->stopped) || buf == NULL || len < 1)
+		return;
+	janus_ice_handle *handle = (janus_ice_handle *)plugin_session->gateway_handle;
+	if(!handle || janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP)
+			|| janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT))
+		return;
+#ifdef HAVE_SCTP
+	janus_ice_relay_binary_data(handle, buf, len);
+#else
+	JANUS_LOG(LOG_WARN, "Asked to relay data, but Data Channels support has not been compiled...\n");
+#endif
+}
+
+void janus_plugin_relay_data_shared(janus_plugin_session *plugin_session, janus_plugin_rtp_shared *packet, gboolean binary) {
+	if((plugin_session < (janus_plugin_session *)0x1000) || g_atomic_int_get(&plugin_session->stopped) || packet == NULL)
+		return;
+	janus_ice_handle *handle = (janus_ice_handle *)plugin_session->gateway_handle;
+	if(!handle || janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP)
+			|| janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT))
+		return;
+#ifdef HAVE_SCTP
+	janus_ice_relay_data_shared(handle, packet, binary);
+#else
+	JANUS_LOG(LOG_WARN, "Asked to relay data, but Data Channels support has not been compiled...\n");
+#endif
+}
+
+int janus_plugin_data_buffered(janus_plugin_session *plugin_session) {
+	if((plugin_session < (janus_plugin_session *)0x1000) || g_atomic_int_get(&plugin_session->stopped))
+		return -1;
+	janus_ice_handle *handle = (janus_ice_handle *)plugin_session->gateway_handle;
+	if(!handle || janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP)
+			|| janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT))
+		return -1;
+#ifdef HAVE_SCTP
+	return janus_ice_data_buffered(handle);
+#else
+	return -1;
+#endif
+}
+
 static gboolean janus_plugin_close_pc_internal(gpointer user_data) {
 	/* We actually enforce the close_pc here */
 	janus_plugin_session *plugin_session = (janus_plugin_session *) user_data;
@@ -3101,6 +3693,27 @@ void janus_plugin_end_session(janus_plugin_session *plugin_session) {
 	g_source_unref(timeout_source);
 }
 
+void janus_plugin_set_affinity_group(janus_plugin_session *plugin_session, const char *group) {
+	if((plugin_session < (janus_plugin_session *)0x1000) || !janus_plugin_session_is_alive(plugin_session) || g_atomic_int_get(&plugin_session->stopped))
+		return;
+	janus_ice_handle *handle = (janus_ice_handle *)plugin_session->gateway_handle;
+	janus_ice_handle_set_affinity_group(handle, group);
+}
+
+gboolean janus_plugin_admission_check(janus_plugin *plugin) {
+	if(janus_load_is_admitting())
+		return TRUE;
+	/* The plugin is going to refuse whatever this was for */
+	janus_load_rejected();
+	return FALSE;
+}
+
+gboolean janus_plugin_events_is_enabled(void) {
+	/* Plugins can only originate plugin events, so there's no point
+	 * in having them prepare any if no handler is interested in them */
+	return janus_events_is_type_enabled(JANUS_EVENT_TYPE_PLUGIN);
+}
+
 void janus_plugin_notify_event(janus_plugin *plugin, janus_plugin_session *plugin_session, json_t *event) {
 	/* A plugin asked to notify an event to the handlers */
 	if(!plugin || !event || !json_is_object(event))
@@ -3127,7 +3740,7 @@ void janus_plugin_notify_event(janus_plugin *plugin, janus_plugin_session *plugi
 		session_id = session->session_id;
 	}
 	/* Notify event handlers */
-	if(janus_events_is_enabled()) {
+	if(janus_events_should_notify(JANUS_EVENT_TYPE_PLUGIN)) {
 		janus_events_notify_handlers(JANUS_EVENT_TYPE_PLUGIN,
 			session_id, handle_id, opaque_id, plugin->get_package(), event);
 	} else {
@@ -3144,9 +3757,157 @@ gboolean janus_plugin_auth_signature_contains(janus_plugin *plugin, const char *
 }
 
 
+/* Startup: modules of the same kind (event handlers, plugins, transports)
+ * don't depend on each other, so once they've all been loaded their
+ * init() methods are invoked in parallel, one thread per module. Each
+ * kind still waits for the previous one to be done, which means plugins
+ * can rely on event handlers being there, and the API transports are
+ * only started when all the plugins are ready. Since curl_global_init()
+ * is not thread-safe, and several modules call it in their init(), the
+ * core initializes libcurl once before any module is started, which makes
+ * those calls just increase its reference counter. How long each step and
+ * each module took is logged and returned in the "info" response. */
+typedef enum janus_startup_step_type {
+	janus_startup_step_phase = 0,
+	janus_startup_step_eventhandler,
+	janus_startup_step_plugin,
+	janus_startup_step_transport,
+} janus_startup_step_type;
+static const char *janus_startup_step_types[] = { "phase", "eventhandler", "plugin", "transport" };
+typedef struct janus_startup_step {
+	janus_startup_step_type type;
+	char *name;
+	void *so;
+	gpointer module;
+	int result;
+	gint64 start, end;
+	GThread *thread;
+} janus_startup_step;
+static gboolean parallel_init = TRUE;
+static gint64 startup_begin = 0, startup_end = 0;
+/* The timeline is only modified by the main thread, and only exposed when we're done */
+static GList *startup_timeline = NULL;
+
+static janus_startup_step *janus_startup_step_new(janus_startup_step_type type, const char *name, void *so, gpointer module) {
+	janus_startup_step *step = g_malloc0(sizeof(janus_startup_step));
+	step->type = type;
+	step->name = g_strdup(name);
+	step->so = so;
+	step->module = module;
+	return step;
+}
+
+static void janus_startup_step_free(janus_startup_step *step) {
+	if(step == NULL)
+		return;
+	g_free(step->name);
+	g_free(step);
+}
+
+/* Take note of how long a phase of the startup process took */
+static void janus_startup_phase_done(const char *name, gint64 start) {
+	janus_startup_step *step = janus_startup_step_new(janus_startup_step_phase, name, NULL, NULL);
+	step->start = start;
+	step->end = janus_get_monotonic_time();
+	startup_timeline = g_list_append(startup_timeline, step);
+}
+
+static void janus_startup_step_init(janus_startup_step *step) {
+	step->start = janus_get_monotonic_time();
+	if(step->type == janus_startup_step_eventhandler) {
+		janus_eventhandler *e = (janus_eventhandler *)step->module;
+		step->result = e->init(configs_folder);
+	} else if(step->type == janus_startup_step_plugin) {
+		janus_plugin *p = (janus_plugin *)step->module;
+		step->result = p->init(&janus_handler_plugin, configs_folder);
+	} else if(step->type == janus_startup_step_transport) {
+		janus_transport *t = (janus_transport *)step->module;
+		step->result = t->init(&janus_handler_transport, configs_folder);
+	}
+	step->end = janus_get_monotonic_time();
+}
+
+static void *janus_startup_step_thread(void *data) {
+	janus_startup_step_init((janus_startup_step *)data);
+	return NULL;
+}
+
+/* Initialize a list of modules, in parallel if possible, and wait for all of them */
+static void janus_startup_init_modules(GList *steps) {
+	gboolean parallel = parallel_init && g_list_length(steps) > 1;
+	GList *temp = steps;
+	while(temp) {
+		janus_startup_step *step = (janus_startup_step *)temp->data;
+		temp = temp->next;
+		if(parallel) {
+			GError *error = NULL;
+			char tname[16];
+			g_snprintf(tname, sizeof(tname), "init %s", step->name);
+			step->thread = g_thread_try_new(tname, &janus_startup_step_thread, step, &error);
+			if(error != NULL) {
+				JANUS_LOG(LOG_WARN, "Got error %d (%s) trying to launch the init thread for '%s', initializing it right away...\n",
+					error->code, error->message ? error->message : "??", step->name);
+				g_error_free(error);
+				step->thread = NULL;
+			}
+		}
+		if(step->thread == NULL)
+			janus_startup_step_init(step);
+	}
+	for(temp = steps; temp != NULL; temp = temp->next) {
+		janus_startup_step *step = (janus_startup_step *)temp->data;
+		if(step->thread != NULL) {
+			g_thread_join(step->thread);
+			step->thread = NULL;
+		}
+	}
+	/* Add them to the timeline */
+	startup_timeline = g_list_concat(startup_timeline, g_list_copy(steps));
+}
+
+static void janus_startup_log(void) {
+	JANUS_LOG(LOG_INFO, "Startup completed in %"SCNi64" ms (modules initialized %s):\n",
+		(startup_end - startup_begin)/1000, parallel_init ? "in parallel" : "sequentially");
+	GList *temp = startup_timeline;
+	while(temp) {
+		janus_startup_step *step = (janus_startup_step *)temp->data;
+		JANUS_LOG(LOG_INFO, "  -- [+%6"SCNi64" ms] %s%s%s: %"SCNi64" ms%s\n",
+			(step->start - startup_begin)/1000, step->type == janus_startup_step_phase ? "" : janus_startup_step_types[step->type],
+			step->type == janus_startup_step_phase ? "" : " ", step->name, (step->end - step->start)/1000,
+			step->result < 0 ? " (failed)" : "");
+		temp = temp->next;
+	}
+}
+
+static json_t *janus_startup_info(void) {
+	json_t *startup = json_object();
+	json_object_set_new(startup, "parallel", parallel_init ? json_true() : json_false());
+	if(startup_end == 0)
+		return startup;
+	json_object_set_new(startup, "total_ms", json_integer((startup_end - startup_begin)/1000));
+	json_t *timeline = json_array();
+	GList *temp = startup_timeline;
+	while(temp) {
+		janus_startup_step *step = (janus_startup_step *)temp->data;
+		json_t *s = json_object();
+		json_object_set_new(s, "name", json_string(step->name));
+		json_object_set_new(s, "type", json_string(janus_startup_step_types[step->type]));
+		json_object_set_new(s, "start_ms", json_integer((step->start - startup_begin)/1000));
+		json_object_set_new(s, "duration_ms", json_integer((step->end - step->start)/1000));
+		if(step->result < 0)
+			json_object_set_new(s, "failed", json_true());
+		json_array_append_new(timeline, s);
+		temp = temp->next;
+	}
+	json_object_set_new(startup, "timeline", timeline);
+	return startup;
+}
+
+
 /* Main */
 gint main(int argc, char *argv[])
 {
+	startup_begin = janus_get_monotonic_time();
 	/* Core dumps may be disallowed by parent of this process; change that */
 	struct rlimit core_limits;
 	core_limits.rlim_cur = core_limits.rlim_max = RLIM_INFINITY;
@@ -3458,6 +4219,11 @@ gint main(int argc, char *argv[])
 	if(args_info.rfc_4588_given) {
 		janus_config_add_item(config, "media", "rfc_4588", "yes");
 	}
+	if(args_info.event_loops_given) {
+		char loops[20];
+		g_snprintf(loops, 20, "%d", args_info.event_loops_arg);
+		janus_config_add_item(config, "general", "event_loops", loops);
+	}
 	if(args_info.rtp_port_range_given) {
 		janus_config_add_item(config, "media", "rtp_port_range", args_info.rtp_port_range_arg);
 	}
@@ -3487,7 +4253,7 @@ gint main(int argc, char *argv[])
 			while(index != NULL) {
 				if(strlen(index) > 0) {
 					JANUS_LOG(LOG_INFO, "Adding '%s' to the ICE enforce list...\n", index);
-					janus_ice_enforce_interface(g_strdup(index));
+					janus_ice_enforce_interface(index);
 				}
 				i++;
 				index = list[i];
@@ -3504,7 +4270,7 @@ gint main(int argc, char *argv[])
 			while(index != NULL) {
 				if(strlen(index) > 0) {
 					JANUS_LOG(LOG_INFO, "Adding '%s' to the ICE ignore list...\n", index);
-					janus_ice_ignore_interface(g_strdup(index));
+					janus_ice_ignore_interface(index);
 				}
 				i++;
 				index = list[i];
@@ -3599,6 +4365,9 @@ gint main(int argc, char *argv[])
 		auth_secret = item->value;
 	janus_auth_init(auth_enabled, auth_secret);
 
+	/* Initialize the memory accounting, if compiled in */
+	janus_memory_init();
+
 	/* Initialize the recorder code */
 	item = janus_config_get_item_drilldown(config, "general", "recordings_tmp_ext");
 	if(item && item->value) {
@@ -3606,6 +4375,24 @@ gint main(int argc, char *argv[])
 	} else {
 		janus_recorder_init(FALSE, NULL);
 	}
+	item = janus_config_get_item_drilldown(config, "general", "recordings_index");
+	janus_recorder_enable_index(item && item->value && janus_is_true(item->value));
+	item = janus_config_get_item_drilldown(config, "general", "recordings_writers");
+	if(item && item->value) {
+		int writers = atoi(item->value);
+		size_t block_size = 65536, max_pending = 4*1024*1024;
+		item = janus_config_get_item_drilldown(config, "general", "recordings_block_size");
+		if(item && item->value && atoi(item->value) > 0)
+			block_size = atoi(item->value);
+		item = janus_config_get_item_drilldown(config, "general", "recordings_max_pending");
+		if(item && item->value && atoi(item->value) > 0)
+			max_pending = atoi(item->value);
+		if(writers < 0) {
+			JANUS_LOG(LOG_WARN, "Invalid number of recorder writers, recordings will be written synchronously\n");
+		} else if(writers > 0 && janus_recorder_writers_init(writers, block_size, max_pending) < 0) {
+			JANUS_LOG(LOG_WARN, "Error starting the recorder writers, recordings will be written synchronously\n");
+		}
+	}
 
 	/* Setup ICE stuff (e.g., checking if the provided STUN server is correct) */
 	char *stun_server = NULL, *turn_server = NULL;
@@ -3644,6 +4431,19 @@ gint main(int argc, char *argv[])
 	/* Check if we need to enable the ICE Lite mode */
 	item = janus_config_get_item_drilldown(config, "nat", "ice_lite");
 	ice_lite = (item && item->value) ? janus_is_true(item->value) : FALSE;
+	/* Check if all handles should share the same port (only in ICE Lite mode) */
+	item = janus_config_get_item_drilldown(config, "nat", "ice_lite_mux_port");
+	if(item && item->value) {
+		int mux_port = atoi(item->value), mux_sockets = 1;
+		janus_config_item *sockets = janus_config_get_item_drilldown(config, "nat", "ice_lite_mux_sockets");
+		if(sockets && sockets->value)
+			mux_sockets = atoi(sockets->value);
+		if(mux_port < 0 || mux_port > 65535) {
+			JANUS_LOG(LOG_WARN, "Invalid ice_lite_mux_port value %s, ignoring\n", item->value);
+		} else {
+			janus_ice_set_lite_mux(mux_port, mux_sockets);
+		}
+	}
 	/* Check if we need to enable ICE-TCP support (warning: still broken, for debugging only) */
 	item = janus_config_get_item_drilldown(config, "nat", "ice_tcp");
 	ice_tcp = (item && item->value) ? janus_is_true(item->value) : FALSE;
@@ -3696,6 +4496,59 @@ gint main(int argc, char *argv[])
 	item = janus_config_get_item_drilldown(config, "nat", "turn_rest_api_method");
 	if(item && item->value)
 		turn_rest_api_method = (char *)item->value;
+#endif
+	/* Load score and admission control */
+	int admission_threshold = 0, load_event_period = 10;
+	item = janus_config_get_item_drilldown(config, "general", "admission_threshold");
+	if(item && item->value) {
+		admission_threshold = atoi(item->value);
+		if(admission_threshold < 0 || admission_threshold > 100) {
+			JANUS_LOG(LOG_WARN, "Ignoring admission_threshold value as it's not between 0 and 100\n");
+			admission_threshold = 0;
+		}
+	}
+	item = janus_config_get_item_drilldown(config, "general", "load_event_period");
+	if(item && item->value) {
+		load_event_period = atoi(item->value);
+		if(load_event_period < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring load_event_period value as it's negative\n");
+			load_event_period = 10;
+		}
+	}
+	janus_load_init(admission_threshold, load_event_period);
+	/* How many threads should take care of incoming requests? */
+	item = janus_config_get_item_drilldown(config, "general", "request_workers");
+	if(item && item->value) {
+		int workers = atoi(item->value);
+		if(workers < 1) {
+			JANUS_LOG(LOG_WARN, "Ignoring request_workers value as it's not a positive integer\n");
+		} else {
+			request_workers_num = workers;
+		}
+	}
+	/* Check if we need to use static event loops for media, rather than one per handle */
+	item = janus_config_get_item_drilldown(config, "general", "event_loops");
+	if(item && item->value) {
+		int loops = atoi(item->value);
+		if(loops < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring event_loops value as it's not a positive integer\n");
+		} else {
+			janus_ice_set_static_event_loops(loops);
+		}
+	}
+	/* Check if media event loops and plugin threads should be pinned to specific CPUs */
+	const char *media_cpus = NULL, *plugin_cpus = NULL;
+	item = janus_config_get_item_drilldown(config, "general", "media_cpus");
+	if(item && item->value)
+		media_cpus = item->value;
+	item = janus_config_get_item_drilldown(config, "general", "plugin_cpus");
+	if(item && item->value)
+		plugin_cpus = item->value;
+	if(janus_affinity_init(media_cpus, plugin_cpus) < 0)
+		JANUS_LOG(LOG_WARN, "Invalid media_cpus/plugin_cpus, threads will not be pinned\n");
+#if defined(HAVE_LIBCURL) || defined(HAVE_SAMPLEEVH)
+	/* Initialize libcurl once here, as modules initialized in parallel may use it too */
+	curl_global_init(CURL_GLOBAL_ALL);
 #endif
 	/* Initialize the ICE stack now */
 	janus_ice_init(ice_lite, ice_tcp, full_trickle, ipv6, rtp_min_port, rtp_max_port);
@@ -3774,11 +4627,53 @@ gint main(int argc, char *argv[])
 			janus_set_no_media_timer(nmt);
 		}
 	}
+	/* DataChannel backpressure */
+	int data_high = 0, data_low = -1;
+	item = janus_config_get_item_drilldown(config, "media", "datachannel_high_watermark");
+	if(item && item->value) {
+		data_high = atoi(item->value);
+		if(data_high <= 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring datachannel_high_watermark value as it's not a positive integer\n");
+			data_high = 0;
+		}
+	}
+	item = janus_config_get_item_drilldown(config, "media", "datachannel_low_watermark");
+	if(item && item->value) {
+		data_low = atoi(item->value);
+		if(data_low < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring datachannel_low_watermark value as it's not a positive integer\n");
+			data_low = -1;
+		}
+	}
+	if(data_high > 0 || data_low >= 0)
+		janus_ice_set_data_watermarks(data_high, data_low);
 	/* RFC4588 support */
 	item = janus_config_get_item_drilldown(config, "media", "rfc_4588");
 	if(item && item->value) {
 		janus_set_rfc4588_enabled(janus_is_true(item->value));
 	}
+	item = janus_config_get_item_drilldown(config, "media", "egress_batch");
+	if(item && item->value) {
+		int eb = atoi(item->value);
+		if(eb < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring egress_batch value as it's not a positive integer\n");
+		} else {
+			janus_set_egress_batch(eb);
+		}
+	}
+	item = janus_config_get_item_drilldown(config, "media", "media_latency");
+	if(item && item->value) {
+		janus_ice_set_media_latency_enabled(janus_is_true(item->value));
+	}
+	item = janus_config_get_item_drilldown(config, "media", "ingress_batch");
+	if(item && item->value) {
+		int ib = atoi(item->value);
+		if(ib < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring ingress_batch value as it's not a positive integer\n");
+		} else {
+			janus_set_ingress_batch(ib);
+		}
+	}
 
 	/* Setup OpenSSL stuff */
 	const char *server_pem;
@@ -3807,10 +4702,35 @@ gint main(int argc, char *argv[])
 	SSL_library_init();
 	SSL_load_error_strings();
 	OpenSSL_add_all_algorithms();
-	/* ... and DTLS-SRTP in particular */
+	/* ... and DTLS-SRTP in particular: check if handshakes should be offloaded to workers first */
+	item = janus_config_get_item_drilldown(config, "media", "dtls_workers");
+	if(item && item->value) {
+		int dtls_workers = atoi(item->value), dtls_workers_queue = 0;
+		janus_config_item *queue = janus_config_get_item_drilldown(config, "media", "dtls_workers_queue");
+		if(queue && queue->value)
+			dtls_workers_queue = atoi(queue->value);
+		janus_dtls_set_workers(dtls_workers, dtls_workers_queue);
+	}
+	item = janus_config_get_item_drilldown(config, "media", "srtp_profiles");
+	if(item && item->value && janus_dtls_set_srtp_profiles(item->value) < 0)
+		JANUS_LOG(LOG_WARN, "Invalid srtp_profiles value, using the default SRTP profiles\n");
+	item = janus_config_get_item_drilldown(config, "certificates", "ecdsa_key");
+	if(item && item->value)
+		janus_dtls_set_ecdsa(janus_is_true(item->value));
+	item = janus_config_get_item_drilldown(config, "certificates", "session_resumption");
+	if(item && item->value && janus_is_true(item->value)) {
+		int timeout = 0;
+		janus_config_item *st = janus_config_get_item_drilldown(config, "certificates", "session_timeout");
+		if(st && st->value)
+			timeout = atoi(st->value);
+		janus_dtls_set_session_resumption(TRUE, timeout);
+	}
 	if(janus_dtls_srtp_init(server_pem, server_key, password) < 0) {
 		exit(1);
 	}
+	item = janus_config_get_item_drilldown(config, "certificates", "dtls_benchmark");
+	if(item && item->value && atoi(item->value) > 0)
+		janus_dtls_benchmark(atoi(item->value));
 	/* Check if there's any custom value for the starting MTU to use in the BIO filter */
 	item = janus_config_get_item_drilldown(config, "media", "dtls_mtu");
 	if(item && item->value)
@@ -3826,8 +4746,11 @@ gint main(int argc, char *argv[])
 #endif
 
 	/* Sessions */
-	sessions = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, NULL);
-	janus_mutex_init(&sessions_mutex);
+	guint ss = 0;
+	for(ss=0; ss<JANUS_SESSIONS_SHARDS; ss++) {
+		sessions_shards[ss].sessions = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, NULL);
+		janus_mutex_init(&sessions_shards[ss].mutex);
+	}
 	/* Start the sessions timeout watchdog */
 	sessions_watchdog_context = g_main_context_new();
 	GMainLoop *watchdog_loop = g_main_loop_new(sessions_watchdog_context, FALSE);
@@ -3837,13 +4760,31 @@ gint main(int argc, char *argv[])
 		JANUS_LOG(LOG_FATAL, "Got error %d (%s) trying to start sessions timeout watchdog...\n", error->code, error->message ? error->message : "??");
 		exit(1);
 	}
-	/* Start the thread that will dispatch incoming requests */
-	requests = g_async_queue_new_full((GDestroyNotify) janus_request_destroy);
-	GThread *requests_thread = g_thread_try_new("sessions requests", &janus_transport_requests, NULL, &error);
-	if(error != NULL) {
-		JANUS_LOG(LOG_FATAL, "Got error %d (%s) trying to start requests thread...\n", error->code, error->message ? error->message : "??");
-		exit(1);
+	/* Start the threads that will dispatch incoming requests */
+	if(request_workers_num == 0)
+		request_workers_num = JANUS_DEFAULT_REQUEST_WORKERS;
+	JANUS_LOG(LOG_INFO, "Starting %u request workers\n", request_workers_num);
+	request_workers = g_malloc0(request_workers_num * sizeof(janus_request_worker));
+	guint rw = 0;
+	for(rw=0; rw<request_workers_num; rw++) {
+		janus_request_worker *worker = &request_workers[rw];
+		worker->id = rw;
+		worker->queue = g_async_queue_new_full((GDestroyNotify) janus_request_destroy);
+		worker->window_start = janus_get_monotonic_time();
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "worker=\"%u\"", rw);
+		janus_metric_register_callback("janus_request_queue_depth", tname,
+			"Requests waiting to be handled by each request worker", janus_metric_gauge,
+			janus_request_worker_metric, worker);
+		g_snprintf(tname, sizeof(tname), "requests %u", rw);
+		worker->thread = g_thread_try_new(tname, &janus_transport_requests, worker, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_FATAL, "Got error %d (%s) trying to start requests thread...\n", error->code, error->message ? error->message : "??");
+			exit(1);
+		}
 	}
+	janus_metric_register_callback("janus_sessions", NULL, "Sessions currently active",
+		janus_metric_gauge, janus_sessions_metric, NULL);
 	/* Create a thread pool to handle asynchronous requests, no matter what the transport */
 	error = NULL;
 	tasks = g_thread_pool_new(janus_transport_task, NULL, -1, FALSE, &error);
@@ -3859,6 +4800,14 @@ gint main(int argc, char *argv[])
 	const char *path = NULL;
 	DIR *dir = NULL;
 	/* Event handlers are disabled by default, though: they need to be enabled in the configuration */
+	/* Check if modules should be initialized in parallel */
+	item = janus_config_get_item_drilldown(config, "general", "parallel_init");
+	if(item && item->value)
+		parallel_init = janus_is_true(item->value);
+	janus_startup_phase_done("core", startup_begin);
+	gint64 phase_start = janus_get_monotonic_time();
+	GList *loading = NULL, *temp = NULL;
+
 	item = janus_config_get_item_drilldown(config, "events", "broadcast");
 	gboolean enable_events = FALSE;
 	if(item && item->value)
@@ -3891,6 +4840,29 @@ gint main(int argc, char *argv[])
 					JANUS_LOG(LOG_INFO, "Setting event handlers statistics period to %d seconds\n", period);
 				}
 			}
+			/* Should the queue of events be bounded? */
+			guint queue_size = 0;
+			janus_events_queue_policy queue_policy = janus_events_queue_drop_oldest;
+			item = janus_config_get_item_drilldown(config, "events", "queue_size");
+			if(item && item->value) {
+				int size = atoi(item->value);
+				if(size < 0)
+					JANUS_LOG(LOG_WARN, "Invalid event handlers queue size, using an unbounded queue\n");
+				else
+					queue_size = size;
+			}
+			item = janus_config_get_item_drilldown(config, "events", "queue_policy");
+			if(item && item->value) {
+				int policy = janus_events_queue_policy_from_string(item->value);
+				if(policy < 0)
+					JANUS_LOG(LOG_WARN, "Invalid event handlers queue policy '%s', dropping the oldest events\n", item->value);
+				else
+					queue_policy = policy;
+			}
+			janus_events_set_queue(queue_size, queue_policy);
+			item = janus_config_get_item_drilldown(config, "events", "sampling");
+			if(item && item->value && janus_events_set_sampling(item->value) < 0)
+				JANUS_LOG(LOG_WARN, "Invalid event handlers sampling ratios, some will be ignored\n");
 			/* Any event handlers to ignore? */
 			item = janus_config_get_item_drilldown(config, "events", "disable");
 			if(item && item->value)
@@ -3953,7 +4925,7 @@ gint main(int argc, char *argv[])
 							!janus_eventhandler->get_description ||
 							!janus_eventhandler->get_package ||
 							!janus_eventhandler->get_name ||
-							!janus_eventhandler->incoming_event) {
+							(!janus_eventhandler->incoming_event && !janus_eventhandler->incoming_events)) {
 						JANUS_LOG(LOG_ERR, "\tMissing some mandatory methods/callbacks, skipping this event handler plugin...\n");
 						continue;
 					}
@@ -3962,37 +4934,9 @@ gint main(int argc, char *argv[])
 							janus_eventhandler->get_package(), janus_eventhandler->get_api_compatibility(), JANUS_EVENTHANDLER_API_VERSION);
 						continue;
 					}
-					janus_eventhandler->init(configs_folder);
-					JANUS_LOG(LOG_VERB, "\tVersion: %d (%s)\n", janus_eventhandler->get_version(), janus_eventhandler->get_version_string());
-					JANUS_LOG(LOG_VERB, "\t   [%s] %s\n", janus_eventhandler->get_package(), janus_eventhandler->get_name());
-					JANUS_LOG(LOG_VERB, "\t   %s\n", janus_eventhandler->get_description());
-					JANUS_LOG(LOG_VERB, "\t   Plugin API version: %d\n", janus_eventhandler->get_api_compatibility());
-					JANUS_LOG(LOG_VERB, "\t   Subscriptions:");
-					if(janus_eventhandler->events_mask == 0) {
-						JANUS_LOG(LOG_VERB, " none");
-					} else {
-						if(janus_flags_is_set(&janus_eventhandler->events_mask, JANUS_EVENT_TYPE_SESSION))
-							JANUS_LOG(LOG_VERB, " sessions");
-						if(janus_flags_is_set(&janus_eventhandler->events_mask, JANUS_EVENT_TYPE_HANDLE))
-							JANUS_LOG(LOG_VERB, " handles");
-						if(janus_flags_is_set(&janus_eventhandler->events_mask, JANUS_EVENT_TYPE_JSEP))
-							JANUS_LOG(LOG_VERB, " jsep");
-						if(janus_flags_is_set(&janus_eventhandler->events_mask, JANUS_EVENT_TYPE_WEBRTC))
-							JANUS_LOG(LOG_VERB, " webrtc");
-						if(janus_flags_is_set(&janus_eventhandler->events_mask, JANUS_EVENT_TYPE_MEDIA))
-							JANUS_LOG(LOG_VERB, " media");
-						if(janus_flags_is_set(&janus_eventhandler->events_mask, JANUS_EVENT_TYPE_PLUGIN))
-							JANUS_LOG(LOG_VERB, " plugins");
-						if(janus_flags_is_set(&janus_eventhandler->events_mask, JANUS_EVENT_TYPE_TRANSPORT))
-							JANUS_LOG(LOG_VERB, " transports");
-					}
-					JANUS_LOG(LOG_VERB, "\n");
-					if(eventhandlers == NULL)
-						eventhandlers = g_hash_table_new(g_str_hash, g_str_equal);
-					g_hash_table_insert(eventhandlers, (gpointer)janus_eventhandler->get_package(), janus_eventhandler);
-					if(eventhandlers_so == NULL)
-						eventhandlers_so = g_hash_table_new(g_str_hash, g_str_equal);
-					g_hash_table_insert(eventhandlers_so, (gpointer)janus_eventhandler->get_package(), event);
+					/* We'll initialize all event handlers at the same time */
+					loading = g_list_append(loading, janus_startup_step_new(janus_startup_step_eventhandler,
+						eventent->d_name, event, janus_eventhandler));
 				}
 			}
 		}
@@ -4000,14 +4944,56 @@ gint main(int argc, char *argv[])
 		if(disabled_eventhandlers != NULL)
 			g_strfreev(disabled_eventhandlers);
 		disabled_eventhandlers = NULL;
+		/* Initialize the event handlers we found */
+		janus_startup_init_modules(loading);
+		for(temp = loading; temp != NULL; temp = temp->next) {
+			janus_startup_step *step = (janus_startup_step *)temp->data;
+			janus_eventhandler *janus_eventhandler = step->module;
+			void *event = step->so;
+			JANUS_LOG(LOG_VERB, "Event handler plugin '%s' initialized\n", step->name);
+			JANUS_LOG(LOG_VERB, "\tVersion: %d (%s)\n", janus_eventhandler->get_version(), janus_eventhandler->get_version_string());
+			JANUS_LOG(LOG_VERB, "\t   [%s] %s\n", janus_eventhandler->get_package(), janus_eventhandler->get_name());
+			JANUS_LOG(LOG_VERB, "\t   %s\n", janus_eventhandler->get_description());
+			JANUS_LOG(LOG_VERB, "\t   Plugin API version: %d\n", janus_eventhandler->get_api_compatibility());
+			JANUS_LOG(LOG_VERB, "\t   Subscriptions:");
+			if(janus_eventhandler->events_mask == 0) {
+				JANUS_LOG(LOG_VERB, " none");
+			} else {
+				if(janus_flags_is_set(&janus_eventhandler->events_mask, JANUS_EVENT_TYPE_SESSION))
+					JANUS_LOG(LOG_VERB, " sessions");
+				if(janus_flags_is_set(&janus_eventhandler->events_mask, JANUS_EVENT_TYPE_HANDLE))
+					JANUS_LOG(LOG_VERB, " handles");
+				if(janus_flags_is_set(&janus_eventhandler->events_mask, JANUS_EVENT_TYPE_JSEP))
+					JANUS_LOG(LOG_VERB, " jsep");
+				if(janus_flags_is_set(&janus_eventhandler->events_mask, JANUS_EVENT_TYPE_WEBRTC))
+					JANUS_LOG(LOG_VERB, " webrtc");
+				if(janus_flags_is_set(&janus_eventhandler->events_mask, JANUS_EVENT_TYPE_MEDIA))
+					JANUS_LOG(LOG_VERB, " media");
+				if(janus_flags_is_set(&janus_eventhandler->events_mask, JANUS_EVENT_TYPE_PLUGIN))
+					JANUS_LOG(LOG_VERB, " plugins");
+				if(janus_flags_is_set(&janus_eventhandler->events_mask, JANUS_EVENT_TYPE_TRANSPORT))
+					JANUS_LOG(LOG_VERB, " transports");
+			}
+			JANUS_LOG(LOG_VERB, "\n");
+			if(eventhandlers == NULL)
+				eventhandlers = g_hash_table_new(g_str_hash, g_str_equal);
+			g_hash_table_insert(eventhandlers, (gpointer)janus_eventhandler->get_package(), janus_eventhandler);
+			if(eventhandlers_so == NULL)
+				eventhandlers_so = g_hash_table_new(g_str_hash, g_str_equal);
+			g_hash_table_insert(eventhandlers_so, (gpointer)janus_eventhandler->get_package(), event);
+		}
+		g_list_free(loading);
+		loading = NULL;
 		/* Initialize the event broadcaster */
 		if(janus_events_init(enable_events, (server_name ? server_name : (char *)JANUS_SERVER_NAME), eventhandlers) < 0) {
 			JANUS_LOG(LOG_FATAL, "Error initializing the Event handlers mechanism...\n");
 			exit(1);
 		}
 	}
+	janus_startup_phase_done("event handlers", phase_start);
 
 	/* Load plugins */
+	phase_start = janus_get_monotonic_time();
 	path = PLUGINDIR;
 	item = janus_config_get_item_drilldown(config, "general", "plugins_folder");
 	if(item && item->value)
@@ -4095,37 +5081,52 @@ gint main(int argc, char *argv[])
 					janus_plugin->get_package(), janus_plugin->get_api_compatibility(), JANUS_PLUGIN_API_VERSION);
 				continue;
 			}
-			if(janus_plugin->init(&janus_handler_plugin, configs_folder) < 0) {
-				JANUS_LOG(LOG_WARN, "The '%s' plugin could not be initialized\n", janus_plugin->get_package());
-				dlclose(plugin);
-				continue;
-			}
-			JANUS_LOG(LOG_VERB, "\tVersion: %d (%s)\n", janus_plugin->get_version(), janus_plugin->get_version_string());
-			JANUS_LOG(LOG_VERB, "\t   [%s] %s\n", janus_plugin->get_package(), janus_plugin->get_name());
-			JANUS_LOG(LOG_VERB, "\t   %s\n", janus_plugin->get_description());
-			JANUS_LOG(LOG_VERB, "\t   Plugin API version: %d\n", janus_plugin->get_api_compatibility());
-			if(!janus_plugin->incoming_rtp && !janus_plugin->incoming_rtcp && !janus_plugin->incoming_data) {
-				JANUS_LOG(LOG_WARN, "The '%s' plugin doesn't implement any callback for RTP/RTCP/data... is this on purpose?\n",
-					janus_plugin->get_package());
-			}
-			if(!janus_plugin->incoming_rtp && !janus_plugin->incoming_rtcp && janus_plugin->incoming_data) {
-				JANUS_LOG(LOG_WARN, "The '%s' plugin will only handle data channels (no RTP/RTCP)... is this on purpose?\n",
-					janus_plugin->get_package());
-			}
-			if(plugins == NULL)
-				plugins = g_hash_table_new(g_str_hash, g_str_equal);
-			g_hash_table_insert(plugins, (gpointer)janus_plugin->get_package(), janus_plugin);
-			if(plugins_so == NULL)
-				plugins_so = g_hash_table_new(g_str_hash, g_str_equal);
-			g_hash_table_insert(plugins_so, (gpointer)janus_plugin->get_package(), plugin);
+			/* We'll initialize all plugins at the same time */
+			loading = g_list_append(loading, janus_startup_step_new(janus_startup_step_plugin,
+				pluginent->d_name, plugin, janus_plugin));
 		}
 	}
 	closedir(dir);
 	if(disabled_plugins != NULL)
 		g_strfreev(disabled_plugins);
 	disabled_plugins = NULL;
+	/* Initialize the plugins we found */
+	janus_startup_init_modules(loading);
+	for(temp = loading; temp != NULL; temp = temp->next) {
+		janus_startup_step *step = (janus_startup_step *)temp->data;
+		janus_plugin *janus_plugin = step->module;
+		void *plugin = step->so;
+		if(step->result < 0) {
+			JANUS_LOG(LOG_WARN, "The '%s' plugin could not be initialized\n", janus_plugin->get_package());
+			dlclose(plugin);
+			continue;
+		}
+		JANUS_LOG(LOG_VERB, "Plugin '%s' initialized\n", step->name);
+		JANUS_LOG(LOG_VERB, "\tVersion: %d (%s)\n", janus_plugin->get_version(), janus_plugin->get_version_string());
+		JANUS_LOG(LOG_VERB, "\t   [%s] %s\n", janus_plugin->get_package(), janus_plugin->get_name());
+		JANUS_LOG(LOG_VERB, "\t   %s\n", janus_plugin->get_description());
+		JANUS_LOG(LOG_VERB, "\t   Plugin API version: %d\n", janus_plugin->get_api_compatibility());
+		if(!janus_plugin->incoming_rtp && !janus_plugin->incoming_rtcp && !janus_plugin->incoming_data) {
+			JANUS_LOG(LOG_WARN, "The '%s' plugin doesn't implement any callback for RTP/RTCP/data... is this on purpose?\n",
+				janus_plugin->get_package());
+		}
+		if(!janus_plugin->incoming_rtp && !janus_plugin->incoming_rtcp && janus_plugin->incoming_data) {
+			JANUS_LOG(LOG_WARN, "The '%s' plugin will only handle data channels (no RTP/RTCP)... is this on purpose?\n",
+				janus_plugin->get_package());
+		}
+		if(plugins == NULL)
+			plugins = g_hash_table_new(g_str_hash, g_str_equal);
+		g_hash_table_insert(plugins, (gpointer)janus_plugin->get_package(), janus_plugin);
+		if(plugins_so == NULL)
+			plugins_so = g_hash_table_new(g_str_hash, g_str_equal);
+		g_hash_table_insert(plugins_so, (gpointer)janus_plugin->get_package(), plugin);
+	}
+	g_list_free(loading);
+	loading = NULL;
+	janus_startup_phase_done("plugins", phase_start);
 
 	/* Load transports */
+	phase_start = janus_get_monotonic_time();
 	gboolean janus_api_enabled = FALSE, admin_api_enabled = FALSE;
 	path = TRANSPORTDIR;
 	item = janus_config_get_item_drilldown(config, "general", "transports_folder");
@@ -4214,31 +5215,47 @@ gint main(int argc, char *argv[])
 					janus_transport->get_package(), janus_transport->get_api_compatibility(), JANUS_TRANSPORT_API_VERSION);
 				continue;
 			}
-			if(janus_transport->init(&janus_handler_transport, configs_folder) < 0) {
-				JANUS_LOG(LOG_WARN, "The '%s' plugin could not be initialized\n", janus_transport->get_package());
-				dlclose(transport);
-				continue;
-			}
-			JANUS_LOG(LOG_VERB, "\tVersion: %d (%s)\n", janus_transport->get_version(), janus_transport->get_version_string());
-			JANUS_LOG(LOG_VERB, "\t   [%s] %s\n", janus_transport->get_package(), janus_transport->get_name());
-			JANUS_LOG(LOG_VERB, "\t   %s\n", janus_transport->get_description());
-			JANUS_LOG(LOG_VERB, "\t   Plugin API version: %d\n", janus_transport->get_api_compatibility());
-			JANUS_LOG(LOG_VERB, "\t   Janus API: %s\n", janus_transport->is_janus_api_enabled() ? "enabled" : "disabled");
-			JANUS_LOG(LOG_VERB, "\t   Admin API: %s\n", janus_transport->is_admin_api_enabled() ? "enabled" : "disabled");
-			janus_api_enabled = janus_api_enabled || janus_transport->is_janus_api_enabled();
-			admin_api_enabled = admin_api_enabled || janus_transport->is_admin_api_enabled();
-			if(transports == NULL)
-				transports = g_hash_table_new(g_str_hash, g_str_equal);
-			g_hash_table_insert(transports, (gpointer)janus_transport->get_package(), janus_transport);
-			if(transports_so == NULL)
-				transports_so = g_hash_table_new(g_str_hash, g_str_equal);
-			g_hash_table_insert(transports_so, (gpointer)janus_transport->get_package(), transport);
+			/* We'll initialize all transports at the same time */
+			loading = g_list_append(loading, janus_startup_step_new(janus_startup_step_transport,
+				transportent->d_name, transport, janus_transport));
 		}
 	}
 	closedir(dir);
 	if(disabled_transports != NULL)
 		g_strfreev(disabled_transports);
 	disabled_transports = NULL;
+	/* Initialize the transports we found: this is when the API becomes available */
+	janus_startup_init_modules(loading);
+	for(temp = loading; temp != NULL; temp = temp->next) {
+		janus_startup_step *step = (janus_startup_step *)temp->data;
+		janus_transport *janus_transport = step->module;
+		void *transport = step->so;
+		if(step->result < 0) {
+			JANUS_LOG(LOG_WARN, "The '%s' plugin could not be initialized\n", janus_transport->get_package());
+			dlclose(transport);
+			continue;
+		}
+		JANUS_LOG(LOG_VERB, "Transport plugin '%s' initialized\n", step->name);
+		JANUS_LOG(LOG_VERB, "\tVersion: %d (%s)\n", janus_transport->get_version(), janus_transport->get_version_string());
+		JANUS_LOG(LOG_VERB, "\t   [%s] %s\n", janus_transport->get_package(), janus_transport->get_name());
+		JANUS_LOG(LOG_VERB, "\t   %s\n", janus_transport->get_description());
+		JANUS_LOG(LOG_VERB, "\t   Plugin API version: %d\n", janus_transport->get_api_compatibility());
+		JANUS_LOG(LOG_VERB, "\t   Janus API: %s\n", janus_transport->is_janus_api_enabled() ? "enabled" : "disabled");
+		JANUS_LOG(LOG_VERB, "\t   Admin API: %s\n", janus_transport->is_admin_api_enabled() ? "enabled" : "disabled");
+		janus_api_enabled = janus_api_enabled || janus_transport->is_janus_api_enabled();
+		admin_api_enabled = admin_api_enabled || janus_transport->is_admin_api_enabled();
+		if(transports == NULL)
+			transports = g_hash_table_new(g_str_hash, g_str_equal);
+		g_hash_table_insert(transports, (gpointer)janus_transport->get_package(), janus_transport);
+		if(transports_so == NULL)
+			transports_so = g_hash_table_new(g_str_hash, g_str_equal);
+		g_hash_table_insert(transports_so, (gpointer)janus_transport->get_package(), transport);
+	}
+	g_list_free(loading);
+	loading = NULL;
+	janus_startup_phase_done("transports", phase_start);
+	startup_end = janus_get_monotonic_time();
+	janus_startup_log();
 	/* Make sure at least a Janus API transport is available */
 	if(!janus_api_enabled) {
 		JANUS_LOG(LOG_FATAL, "No Janus API transport is available... enable at least one and restart Janus\n");
@@ -4259,8 +5276,14 @@ gint main(int argc, char *argv[])
 		} while(res == -1 && errno == EINTR);
 	}
 
+	/* Now that plugins are all there, start computing the load score */
+	GSource *load_source = g_timeout_source_new_seconds(1);
+	g_source_set_callback(load_source, janus_load_check, NULL, NULL);
+	g_source_attach(load_source, sessions_watchdog_context);
+	g_source_unref(load_source);
+
 	/* If the Event Handlers mechanism is enabled, notify handlers that Janus just started */
-	if(janus_events_is_enabled()) {
+	if(janus_events_should_notify(JANUS_EVENT_TYPE_CORE)) {
 		json_t *info = json_object();
 		json_object_set_new(info, "status", json_string("started"));
 		json_object_set_new(info, "info", janus_info(NULL));
@@ -4273,7 +5296,7 @@ gint main(int argc, char *argv[])
 	}
 
 	/* If the Event Handlers mechanism is enabled, notify handlers that Janus is hanging up */
-	if(janus_events_is_enabled()) {
+	if(janus_events_should_notify(JANUS_EVENT_TYPE_CORE)) {
 		json_t *info = json_object();
 		json_object_set_new(info, "status", json_string("shutdown"));
 		json_object_set_new(info, "signum", json_integer(stop_signal));
@@ -4303,15 +5326,23 @@ gint main(int argc, char *argv[])
 	}
 	/* Get rid of requests tasks and thread too */
 	g_thread_pool_free(tasks, FALSE, FALSE);
-	JANUS_LOG(LOG_INFO, "Ending requests thread...\n");
-	g_async_queue_push(requests, &exit_message);
-	g_thread_join(requests_thread);
-	requests_thread = NULL;
-	g_async_queue_unref(requests);
+	JANUS_LOG(LOG_INFO, "Ending requests threads...\n");
+	for(rw=0; rw<request_workers_num; rw++)
+		g_async_queue_push(request_workers[rw].queue, &exit_message);
+	for(rw=0; rw<request_workers_num; rw++) {
+		g_thread_join(request_workers[rw].thread);
+		request_workers[rw].thread = NULL;
+		g_async_queue_unref(request_workers[rw].queue);
+	}
+	g_free(request_workers);
+	request_workers = NULL;
 
 	JANUS_LOG(LOG_INFO, "Destroying sessions...\n");
-	g_clear_pointer(&sessions, g_hash_table_destroy);
+	janus_sessions_timers_clear();
+	for(ss=0; ss<JANUS_SESSIONS_SHARDS; ss++)
+		g_clear_pointer(&sessions_shards[ss].sessions, g_hash_table_destroy);
 	janus_ice_deinit();
+	janus_affinity_deinit();
 	JANUS_LOG(LOG_INFO, "Freeing crypto resources...\n");
 	janus_dtls_srtp_cleanup();
 	EVP_cleanup();
@@ -4343,6 +5374,9 @@ gint main(int argc, char *argv[])
 		g_hash_table_destroy(eventhandlers_so);
 	}
 
+#if defined(HAVE_LIBCURL) || defined(HAVE_SAMPLEEVH)
+	curl_global_cleanup();
+#endif
 	janus_recorder_deinit();
 	g_free(local_ip);
 
@@ -4362,6 +5396,11 @@ gint main(int argc, char *argv[])
 	}
 	janus_mutex_unlock(&counters_mutex);
 #endif
+	g_list_free_full(startup_timeline, (GDestroyNotify)janus_startup_step_free);
+	startup_timeline = NULL;
+	janus_memory_deinit();
+	janus_load_deinit();
+	janus_metrics_deinit();
 
 	JANUS_PRINT("Bye!\n");
 
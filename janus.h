@@ -55,6 +55,10 @@ typedef struct janus_session {
 	volatile gint timeout;
 	/*! \brief Flag to notify that transport is gone */
 	volatile gint transport_gone;
+	/*! \brief Link in the sessions timeout wheel, if the session is in there */
+	GList *timer;
+	/*! \brief Slot of the sessions timeout wheel the session is currently in */
+	guint timer_slot;
 	/*! \brief Mutex to lock/unlock this session */
 	janus_mutex mutex;
 	/*! \brief Atomic flag to check if this instance has been destroyed */
@@ -126,6 +130,8 @@ struct janus_request {
 	gboolean admin;
 	/*! \brief Pointer to the original request, if available */
 	json_t *message;
+	/*! \brief Monotonic time of when the request was received, for the request worker stats */
+	gint64 received;
 };
 /*! \brief Helper to allocate a janus_request instance
  * @param[in] transport Pointer to the transport
@@ -0,0 +1,352 @@
+/*! \file    jitter.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Adaptive jitter buffers
+ * \details  Implementation of the jitter estimators and jitter buffers
+ * plugins can use for the RTP streams they receive. The playout time of
+ * a packet is computed from its RTP timestamp, relative to a reference
+ * that follows the fastest packets we've seen (i.e., those that went
+ * through no queueing at all), plus the target delay the estimator came
+ * up with. The reference also slowly moves forward when packets keep on
+ * arriving later than expected, so that a sender whose clock is a bit
+ * slower than ours doesn't make the delay grow with no bounds. Check
+ * jitter.h for details.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include <string.h>
+
+#include "jitter.h"
+#include "rtp.h"
+
+/* Sequence number jumps larger than this mean the stream was restarted */
+#define JANUS_JITTER_MAX_GAP		3000
+/* Maximum number of slots in a jitter buffer */
+#define JANUS_JITTER_MAX_SLOTS		1024
+
+void janus_jitter_estimator_init(janus_jitter_estimator *estimator, guint32 clock_rate, gint64 min_delay, gint64 max_delay) {
+	if(estimator == NULL)
+		return;
+	memset(estimator, 0, sizeof(*estimator));
+	estimator->clock_rate = clock_rate ? clock_rate : 90000;
+	estimator->min_delay = min_delay > 0 ? min_delay : 0;
+	estimator->max_delay = max_delay > estimator->min_delay ? max_delay : estimator->min_delay;
+	estimator->target = estimator->min_delay;
+}
+
+void janus_jitter_estimator_reset(janus_jitter_estimator *estimator) {
+	if(estimator == NULL)
+		return;
+	estimator->started = FALSE;
+	estimator->jitter = 0;
+	estimator->target = estimator->min_delay;
+}
+
+/* Move the target delay towards what the current jitter suggests: fast
+ * when the jitter grows, slowly when it shrinks, to avoid oscillations */
+static void janus_jitter_estimator_adapt(janus_jitter_estimator *estimator) {
+	gint64 desired = 3*(estimator->jitter >> 4);
+	if(desired < estimator->min_delay)
+		desired = estimator->min_delay;
+	else if(desired > estimator->max_delay)
+		desired = estimator->max_delay;
+	if(desired > estimator->target)
+		estimator->target = desired;
+	else
+		estimator->target -= (estimator->target - desired) >> 7;
+}
+
+int janus_jitter_estimator_update(janus_jitter_estimator *estimator, guint16 seq, guint32 ts, gint64 arrival) {
+	if(estimator == NULL)
+		return 0;
+	if(estimator->started) {
+		gint16 diff = (gint16)(seq - estimator->last_seq);
+		if(diff == 0) {
+			estimator->duplicates++;
+			return 1;
+		}
+		if(diff > JANUS_JITTER_MAX_GAP || diff < -JANUS_JITTER_MAX_GAP) {
+			/* The stream was probably restarted, start over (but keep the counters) */
+			estimator->started = FALSE;
+		} else if(diff < 0) {
+			/* Out of order: we accounted it as lost, but it isn't */
+			estimator->packets++;
+			estimator->reordered++;
+			if(estimator->lost > 0)
+				estimator->lost--;
+			return 0;
+		} else {
+			estimator->packets++;
+			estimator->lost += diff - 1;
+			/* RFC 3550 interarrival jitter, in microseconds rather than in RTP clock units */
+			gint64 d = (arrival - estimator->last_arrival) -
+				(gint64)((gint32)(ts - estimator->last_ts)) * G_USEC_PER_SEC / estimator->clock_rate;
+			if(d < 0)
+				d = -d;
+			estimator->jitter += d - ((estimator->jitter + 8) >> 4);
+			if((estimator->jitter >> 4) > estimator->max_jitter)
+				estimator->max_jitter = estimator->jitter >> 4;
+			estimator->last_seq = seq;
+			estimator->last_ts = ts;
+			estimator->last_arrival = arrival;
+			janus_jitter_estimator_adapt(estimator);
+			return 0;
+		}
+	}
+	/* First packet (or first after a restart) */
+	estimator->started = TRUE;
+	estimator->packets++;
+	estimator->last_seq = seq;
+	estimator->last_ts = ts;
+	estimator->last_arrival = arrival;
+	return 0;
+}
+
+void janus_jitter_estimator_late(janus_jitter_estimator *estimator) {
+	if(estimator != NULL)
+		estimator->late++;
+}
+
+gint64 janus_jitter_estimator_get_jitter(janus_jitter_estimator *estimator) {
+	return estimator ? (estimator->jitter >> 4) : 0;
+}
+
+gint64 janus_jitter_estimator_get_target(janus_jitter_estimator *estimator) {
+	return estimator ? estimator->target : 0;
+}
+
+json_t *janus_jitter_estimator_stats(janus_jitter_estimator *estimator) {
+	if(estimator == NULL)
+		return NULL;
+	json_t *stats = json_object();
+	json_object_set_new(stats, "jitter", json_integer(estimator->jitter >> 4));
+	json_object_set_new(stats, "max-jitter", json_integer(estimator->max_jitter));
+	json_object_set_new(stats, "target-delay", json_integer(estimator->target));
+	json_object_set_new(stats, "packets", json_integer(estimator->packets));
+	json_object_set_new(stats, "lost", json_integer(estimator->lost));
+	json_object_set_new(stats, "late", json_integer(estimator->late));
+	json_object_set_new(stats, "duplicates", json_integer(estimator->duplicates));
+	json_object_set_new(stats, "reordered", json_integer(estimator->reordered));
+	return stats;
+}
+
+
+/* Jitter buffers */
+typedef struct janus_jitter_slot {
+	gboolean used;
+	guint16 seq;
+	guint32 ts;
+	gint64 arrival;
+	int length;
+	char data[JANUS_JITTER_BUFFER_MAX_PACKET];
+} janus_jitter_slot;
+
+struct janus_jitter_buffer {
+	/* Estimator for the jitter and the target delay */
+	janus_jitter_estimator estimator;
+	/* Ring of slots, indexed by sequence number */
+	janus_jitter_slot *slots;
+	guint size, mask, count;
+	/* Next sequence number to play out, and highest one we have */
+	gboolean started;
+	guint16 next_seq, high_seq;
+	/* Timing reference: when the packet with timestamp base_ts would have arrived with no jitter */
+	gboolean synced;
+	gint64 base;
+	guint32 base_ts;
+	/* Statistics */
+	guint64 played, skipped, dropped;
+	gint64 delay, max_delay;
+};
+
+janus_jitter_buffer *janus_jitter_buffer_create(guint slots, guint32 clock_rate, gint64 min_delay, gint64 max_delay) {
+	guint size = 1;
+	while(size < slots && size < JANUS_JITTER_MAX_SLOTS)
+		size <<= 1;
+	janus_jitter_buffer *buffer = g_malloc0(sizeof(janus_jitter_buffer));
+	janus_jitter_estimator_init(&buffer->estimator, clock_rate, min_delay, max_delay);
+	buffer->slots = g_malloc0(size * sizeof(janus_jitter_slot));
+	buffer->size = size;
+	buffer->mask = size - 1;
+	return buffer;
+}
+
+void janus_jitter_buffer_destroy(janus_jitter_buffer *buffer) {
+	if(buffer == NULL)
+		return;
+	g_free(buffer->slots);
+	g_free(buffer);
+}
+
+void janus_jitter_buffer_reset(janus_jitter_buffer *buffer) {
+	if(buffer == NULL)
+		return;
+	guint i = 0;
+	for(i=0; i<buffer->size; i++)
+		buffer->slots[i].used = FALSE;
+	buffer->count = 0;
+	buffer->started = FALSE;
+	buffer->synced = FALSE;
+	janus_jitter_estimator_reset(&buffer->estimator);
+}
+
+/* When a packet would have arrived, had there been no jitter */
+static gint64 janus_jitter_buffer_expected(janus_jitter_buffer *buffer, guint32 ts) {
+	return buffer->base +
+		(gint64)((gint32)(ts - buffer->base_ts)) * G_USEC_PER_SEC / buffer->estimator.clock_rate;
+}
+
+/* When a queued packet should be played out */
+static gint64 janus_jitter_buffer_due(janus_jitter_buffer *buffer, janus_jitter_slot *slot) {
+	gint64 due = janus_jitter_buffer_expected(buffer, slot->ts) + buffer->estimator.target;
+	/* Whatever happens, we never hold a packet longer than the maximum delay */
+	if(due > slot->arrival + buffer->estimator.max_delay)
+		due = slot->arrival + buffer->estimator.max_delay;
+	return due;
+}
+
+/* Find the first packet we have, starting from the one we're waiting for */
+static janus_jitter_slot *janus_jitter_buffer_first(janus_jitter_buffer *buffer, guint16 *missing) {
+	if(buffer->count == 0)
+		return NULL;
+	guint16 span = buffer->high_seq - buffer->next_seq, i = 0;
+	for(i=0; i<=span && i<buffer->size; i++) {
+		guint16 seq = buffer->next_seq + i;
+		janus_jitter_slot *slot = &buffer->slots[seq & buffer->mask];
+		if(slot->used && slot->seq == seq) {
+			if(missing)
+				*missing = i;
+			return slot;
+		}
+	}
+	return NULL;
+}
+
+int janus_jitter_buffer_push(janus_jitter_buffer *buffer, char *packet, int length, gint64 now) {
+	if(buffer == NULL || packet == NULL || length < RTP_HEADER_SIZE || length > JANUS_JITTER_BUFFER_MAX_PACKET)
+		return -1;
+	janus_rtp_header *rtp = (janus_rtp_header *)packet;
+	guint16 seq = ntohs(rtp->seq_number);
+	guint32 ts = ntohl(rtp->timestamp);
+	if(janus_jitter_estimator_update(&buffer->estimator, seq, ts, now) > 0)
+		return -1;
+	if(buffer->started) {
+		gint16 diff = (gint16)(seq - buffer->next_seq);
+		if(diff > JANUS_JITTER_MAX_GAP || diff < -JANUS_JITTER_MAX_GAP) {
+			/* The stream was restarted, get rid of what we have */
+			buffer->dropped += buffer->count;
+			guint i = 0;
+			for(i=0; i<buffer->size; i++)
+				buffer->slots[i].used = FALSE;
+			buffer->count = 0;
+			buffer->started = FALSE;
+			buffer->synced = FALSE;
+		} else if(diff < 0) {
+			/* We played out (or gave up on) this one already */
+			janus_jitter_estimator_late(&buffer->estimator);
+			return -1;
+		} else if(diff >= (gint16)buffer->size) {
+			/* No room: drop the oldest packets to make some */
+			while((gint16)(seq - buffer->next_seq) >= (gint16)buffer->size) {
+				janus_jitter_slot *old = &buffer->slots[buffer->next_seq & buffer->mask];
+				if(old->used && old->seq == buffer->next_seq) {
+					old->used = FALSE;
+					buffer->count--;
+					buffer->dropped++;
+				}
+				buffer->next_seq++;
+			}
+		}
+	}
+	if(!buffer->started) {
+		buffer->started = TRUE;
+		buffer->next_seq = seq;
+		buffer->high_seq = seq;
+	}
+	/* Update the timing reference */
+	if(!buffer->synced) {
+		buffer->synced = TRUE;
+		buffer->base = now;
+		buffer->base_ts = ts;
+	} else {
+		gint64 expected = janus_jitter_buffer_expected(buffer, ts);
+		if(now < expected)
+			buffer->base -= (expected - now);
+		else
+			buffer->base += (now - expected) >> 9;
+	}
+	janus_jitter_slot *slot = &buffer->slots[seq & buffer->mask];
+	if(slot->used) {
+		if(slot->seq == seq) {
+			buffer->estimator.duplicates++;
+			return -1;
+		}
+		/* Shouldn't happen, but just in case */
+		buffer->count--;
+		buffer->dropped++;
+	}
+	slot->used = TRUE;
+	slot->seq = seq;
+	slot->ts = ts;
+	slot->arrival = now;
+	slot->length = length;
+	memcpy(slot->data, packet, length);
+	buffer->count++;
+	if((gint16)(seq - buffer->high_seq) > 0)
+		buffer->high_seq = seq;
+	return 0;
+}
+
+int janus_jitter_buffer_pop(janus_jitter_buffer *buffer, char *packet, int size, gint64 now) {
+	if(buffer == NULL || packet == NULL)
+		return 0;
+	guint16 missing = 0;
+	janus_jitter_slot *slot = janus_jitter_buffer_first(buffer, &missing);
+	if(slot == NULL || janus_jitter_buffer_due(buffer, slot) > now)
+		return 0;
+	/* Whatever we were still waiting for before this packet is not coming in time */
+	buffer->skipped += missing;
+	slot->used = FALSE;
+	buffer->count--;
+	buffer->next_seq = slot->seq + 1;
+	/* Move the timing reference to this packet, so that timestamps never wrap */
+	buffer->base = janus_jitter_buffer_expected(buffer, slot->ts);
+	buffer->base_ts = slot->ts;
+	if(slot->length > size) {
+		buffer->dropped++;
+		return 0;
+	}
+	memcpy(packet, slot->data, slot->length);
+	gint64 waited = now - slot->arrival;
+	buffer->delay += (waited - buffer->delay) >> 4;
+	if(waited > buffer->max_delay)
+		buffer->max_delay = waited;
+	buffer->played++;
+	return slot->length;
+}
+
+gint64 janus_jitter_buffer_next(janus_jitter_buffer *buffer, gint64 now) {
+	if(buffer == NULL)
+		return -1;
+	janus_jitter_slot *slot = janus_jitter_buffer_first(buffer, NULL);
+	if(slot == NULL)
+		return -1;
+	gint64 due = janus_jitter_buffer_due(buffer, slot);
+	return due > now ? (due - now) : 0;
+}
+
+json_t *janus_jitter_buffer_stats(janus_jitter_buffer *buffer) {
+	if(buffer == NULL)
+		return NULL;
+	json_t *stats = janus_jitter_estimator_stats(&buffer->estimator);
+	json_object_set_new(stats, "slots", json_integer(buffer->size));
+	json_object_set_new(stats, "queued", json_integer(buffer->count));
+	json_object_set_new(stats, "played", json_integer(buffer->played));
+	json_object_set_new(stats, "skipped", json_integer(buffer->skipped));
+	json_object_set_new(stats, "dropped", json_integer(buffer->dropped));
+	json_object_set_new(stats, "delay", json_integer(buffer->delay));
+	json_object_set_new(stats, "max-delay", json_integer(buffer->max_delay));
+	return stats;
+}
@@ -0,0 +1,144 @@
+/*! \file    jitter.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Adaptive jitter buffers (headers)
+ * \details  Helpers plugins can use to deal with the jitter of the RTP
+ * streams they receive from peers that are not WebRTC users (e.g., SIP
+ * endpoints or RTP sources), or to figure out how much audio to queue
+ * before mixing it. There are two parts. A jitter estimator keeps track
+ * of the interarrival jitter of a stream, as per RFC 3550, and derives a
+ * target playout delay from it: the target grows as soon as the jitter
+ * does, and shrinks slowly when the network calms down, within the bounds
+ * the plugin configured. It also keeps track of packets that were lost,
+ * duplicated, reordered or arrived too late to be used, which is what
+ * plugins can show in their info responses to see the latency/loss
+ * trade-off they're getting. Estimators are plain structs plugins can
+ * embed in their own, as they don't need any memory of their own.
+ *
+ * A jitter buffer uses an estimator to actually delay packets: it's a
+ * fixed ring of slots, indexed by sequence number, that is allocated
+ * once when the buffer is created, which means that pushing and popping
+ * packets never allocates anything. Packets are copied in when they're
+ * pushed, and copied out when they're due, i.e., when the target delay
+ * has passed since the time they'd have arrived with no jitter at all;
+ * packets that arrive after the ones that follow them have already been
+ * played out are dropped and accounted as late, while packets that are
+ * still missing when the ones that follow them are due are skipped.
+ *
+ * Neither estimators nor buffers are thread safe: plugins are expected
+ * to use them from a single thread, or to protect them with their own
+ * locks.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef _JANUS_JITTER_H
+#define _JANUS_JITTER_H
+
+#include <glib.h>
+#include <jansson.h>
+
+/*! \brief Maximum size of the packets a jitter buffer can hold */
+#define JANUS_JITTER_BUFFER_MAX_PACKET	1500
+
+/*! \brief Jitter estimator */
+typedef struct janus_jitter_estimator {
+	/*! \brief RTP clock rate of the stream */
+	guint32 clock_rate;
+	/*! \brief Bounds on the target delay, in microseconds */
+	gint64 min_delay, max_delay;
+	/*! \brief Whether we got any packet yet */
+	gboolean started;
+	/*! \brief Arrival time (monotonic) and RTP timestamp of the most recent in-order packet */
+	gint64 last_arrival;
+	guint32 last_ts;
+	/*! \brief Highest sequence number we got so far */
+	guint16 last_seq;
+	/*! \brief Interarrival jitter, in microseconds (scaled by 16, as in RFC 3550 A.8) */
+	gint64 jitter;
+	/*! \brief Highest jitter we've seen, in microseconds */
+	gint64 max_jitter;
+	/*! \brief Current target delay, in microseconds */
+	gint64 target;
+	/*! \brief Packets received, lost (never received), duplicated, reordered, and received too late to be used */
+	guint64 packets, lost, duplicates, reordered, late;
+} janus_jitter_estimator;
+
+/*! \brief Initialize a jitter estimator
+ * @param[in] estimator The estimator to initialize
+ * @param[in] clock_rate The RTP clock rate of the stream (e.g., 48000 for Opus)
+ * @param[in] min_delay The minimum target delay, in microseconds (also the initial target)
+ * @param[in] max_delay The maximum target delay, in microseconds */
+void janus_jitter_estimator_init(janus_jitter_estimator *estimator, guint32 clock_rate, gint64 min_delay, gint64 max_delay);
+/*! \brief Reset a jitter estimator (e.g., because the stream changed), keeping its configuration
+ * @param[in] estimator The estimator to reset */
+void janus_jitter_estimator_reset(janus_jitter_estimator *estimator);
+/*! \brief Update a jitter estimator with a new packet
+ * @param[in] estimator The estimator to update
+ * @param[in] seq The RTP sequence number of the packet
+ * @param[in] ts The RTP timestamp of the packet
+ * @param[in] arrival When the packet was received (monotonic time)
+ * @returns 0 if the packet is new, 1 if it's a duplicate */
+int janus_jitter_estimator_update(janus_jitter_estimator *estimator, guint16 seq, guint32 ts, gint64 arrival);
+/*! \brief Account for a packet that arrived too late to be used
+ * @param[in] estimator The estimator to update */
+void janus_jitter_estimator_late(janus_jitter_estimator *estimator);
+/*! \brief Get the current interarrival jitter
+ * @param[in] estimator The estimator to query
+ * @returns The jitter, in microseconds */
+gint64 janus_jitter_estimator_get_jitter(janus_jitter_estimator *estimator);
+/*! \brief Get the current target delay
+ * @param[in] estimator The estimator to query
+ * @returns The target delay, in microseconds */
+gint64 janus_jitter_estimator_get_target(janus_jitter_estimator *estimator);
+/*! \brief Get a summary of an estimator, e.g., for a plugin query_session
+ * @param[in] estimator The estimator to query
+ * @returns A JSON object with the jitter, the target delay (in microseconds) and the packet counters */
+json_t *janus_jitter_estimator_stats(janus_jitter_estimator *estimator);
+
+/*! \brief Jitter buffer (opaque) */
+typedef struct janus_jitter_buffer janus_jitter_buffer;
+
+/*! \brief Create a new jitter buffer
+ * @param[in] slots How many packets the buffer can hold (rounded up to a power of 2, at most 1024)
+ * @param[in] clock_rate The RTP clock rate of the stream
+ * @param[in] min_delay The minimum target delay, in microseconds
+ * @param[in] max_delay The maximum target delay, in microseconds
+ * @returns A new jitter buffer */
+janus_jitter_buffer *janus_jitter_buffer_create(guint slots, guint32 clock_rate, gint64 min_delay, gint64 max_delay);
+/*! \brief Destroy a jitter buffer, dropping the packets it still holds
+ * @param[in] buffer The buffer to destroy */
+void janus_jitter_buffer_destroy(janus_jitter_buffer *buffer);
+/*! \brief Drop all the packets a jitter buffer holds, and start again
+ * \note The statistics are kept, but the estimator is reset
+ * @param[in] buffer The buffer to reset */
+void janus_jitter_buffer_reset(janus_jitter_buffer *buffer);
+/*! \brief Add an RTP packet to a jitter buffer
+ * @param[in] buffer The buffer to add the packet to
+ * @param[in] packet The RTP packet (copied)
+ * @param[in] length The length of the packet
+ * @param[in] now The current monotonic time
+ * @returns 0 if the packet was queued, a negative integer if it was dropped
+ * (e.g., because it was late, a duplicate, or invalid) */
+int janus_jitter_buffer_push(janus_jitter_buffer *buffer, char *packet, int length, gint64 now);
+/*! \brief Get the next packet out of a jitter buffer, if it's due
+ * @param[in] buffer The buffer to get the packet from
+ * @param[out] packet Where to copy the packet
+ * @param[in] size The size of the packet buffer
+ * @param[in] now The current monotonic time
+ * @returns The length of the packet, or 0 if no packet is due yet */
+int janus_jitter_buffer_pop(janus_jitter_buffer *buffer, char *packet, int size, gint64 now);
+/*! \brief Find out when the next packet in a jitter buffer will be due
+ * @param[in] buffer The buffer to query
+ * @param[in] now The current monotonic time
+ * @returns How many microseconds until the next packet is due (0 if one
+ * is due already), or -1 if the buffer is empty */
+gint64 janus_jitter_buffer_next(janus_jitter_buffer *buffer, gint64 now);
+/*! \brief Get a summary of a jitter buffer, e.g., for a plugin query_session
+ * @param[in] buffer The buffer to query
+ * @returns A JSON object with the estimator stats, plus the packets queued,
+ * skipped and dropped, and the delay packets actually went through (in microseconds) */
+json_t *janus_jitter_buffer_stats(janus_jitter_buffer *buffer);
+
+#endif
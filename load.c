@@ -0,0 +1,194 @@
+/*! \file    load.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Load score and admission control
+ * \details  Implementation of the load score: the core computes the
+ * components once per second and passes them here, where they're turned
+ * into a single smoothed score, which is what admission control is based
+ * on. The score and the admission state are atomic values, as they're
+ * read by request handlers and plugins far more often than they change.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "load.h"
+#include "debug.h"
+#include "events.h"
+#include "metrics.h"
+#include "utils.h"
+
+static const char *janus_load_component_names[JANUS_LOAD_COMPONENTS] = {
+	"cpu", "requests", "queues", "plugins"
+};
+
+/* Configuration */
+static int admission_threshold = 0, event_period = 0;
+/* Current state: the score and the raw components, and whether we admit new users */
+static volatile gint score = 0, admitting = 1;
+static volatile gint components_last[JANUS_LOAD_COMPONENTS];
+static volatile gint rejected = 0;
+static gint64 admission_changed = 0;
+/* How many updates since the last event we sent */
+static int updates = 0;
+/* Metrics */
+static janus_metric *metric_score = NULL, *metric_components[JANUS_LOAD_COMPONENTS],
+	*metric_rejected = NULL;
+
+static gint64 janus_load_score_metric(gpointer data) {
+	return g_atomic_int_get(&score);
+}
+static gint64 janus_load_component_metric(gpointer data) {
+	return g_atomic_int_get(&components_last[GPOINTER_TO_INT(data)]);
+}
+
+void janus_load_init(int threshold, int period) {
+	admission_threshold = (threshold > 0 && threshold <= 100) ? threshold : 0;
+	event_period = period > 0 ? period : 0;
+	__atomic_store_n(&admission_changed, janus_get_monotonic_time(), __ATOMIC_RELAXED);
+	metric_score = janus_metric_register_callback("janus_load_score", NULL,
+		"Load score of the instance (0-100)", janus_metric_gauge, janus_load_score_metric, NULL);
+	int i = 0;
+	for(i=0; i<JANUS_LOAD_COMPONENTS; i++) {
+		char labels[64];
+		g_snprintf(labels, sizeof(labels), "component=\"%s\"", janus_load_component_names[i]);
+		metric_components[i] = janus_metric_register_callback("janus_load_component", labels,
+			"Components of the load score (0-100)", janus_metric_gauge,
+			janus_load_component_metric, GINT_TO_POINTER(i));
+	}
+	metric_rejected = janus_metric_register("janus_load_rejected_total", NULL,
+		"Handles and joins refused by admission control", janus_metric_counter);
+	if(admission_threshold > 0) {
+		JANUS_LOG(LOG_INFO, "Admission control enabled: refusing new users when the load score reaches %d\n",
+			admission_threshold);
+	}
+	/* Take the first CPU sample, so that the next one has something to compare to */
+	janus_load_sample_cpu();
+}
+
+void janus_load_deinit(void) {
+	janus_metric_unregister(metric_score);
+	metric_score = NULL;
+	int i = 0;
+	for(i=0; i<JANUS_LOAD_COMPONENTS; i++) {
+		janus_metric_unregister(metric_components[i]);
+		metric_components[i] = NULL;
+	}
+	janus_metric_unregister(metric_rejected);
+	metric_rejected = NULL;
+}
+
+int janus_load_sample_cpu(void) {
+	static gint64 last_cpu = 0, last_time = 0;
+	static long cpus = 0;
+	if(cpus == 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		if(cpus < 1)
+			cpus = 1;
+	}
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) < 0)
+		return 0;
+	gint64 cpu = (gint64)usage.ru_utime.tv_sec*G_USEC_PER_SEC + usage.ru_utime.tv_usec +
+		(gint64)usage.ru_stime.tv_sec*G_USEC_PER_SEC + usage.ru_stime.tv_usec;
+	gint64 now = janus_get_monotonic_time();
+	int load = 0;
+	if(last_time > 0 && now > last_time)
+		load = (int)(((cpu - last_cpu)*100)/((now - last_time)*cpus));
+	last_cpu = cpu;
+	last_time = now;
+	return load < 0 ? 0 : (load > 100 ? 100 : load);
+}
+
+static void janus_load_notify(void) {
+	if(!janus_events_should_notify(JANUS_EVENT_TYPE_CORE))
+		return;
+	json_t *info = json_object();
+	json_object_set_new(info, "status", json_string("load"));
+	json_object_set_new(info, "load", janus_load_info(TRUE));
+	janus_events_notify_handlers(JANUS_EVENT_TYPE_CORE, 0, info);
+}
+
+void janus_load_update(int components[JANUS_LOAD_COMPONENTS]) {
+	/* The score is the most loaded component */
+	int raw = 0, i = 0;
+	for(i=0; i<JANUS_LOAD_COMPONENTS; i++) {
+		int c = components[i] < 0 ? 0 : (components[i] > 100 ? 100 : components[i]);
+		g_atomic_int_set(&components_last[i], c);
+		if(c > raw)
+			raw = c;
+	}
+	/* Go up right away, but come down slowly, so that a quiet second doesn't make us look idle */
+	int current = g_atomic_int_get(&score);
+	if(raw >= current)
+		current = raw;
+	else
+		current -= (current - raw + 3)/4;
+	g_atomic_int_set(&score, current);
+	/* Check if admission should change */
+	gboolean notify = FALSE;
+	if(admission_threshold > 0) {
+		gboolean admit = g_atomic_int_get(&admitting);
+		if(admit && current >= admission_threshold) {
+			JANUS_LOG(LOG_WARN, "Load score is %d (threshold %d), refusing new handles and joins\n",
+				current, admission_threshold);
+			g_atomic_int_set(&admitting, 0);
+			__atomic_store_n(&admission_changed, janus_get_monotonic_time(), __ATOMIC_RELAXED);
+			notify = TRUE;
+		} else if(!admit && current < (admission_threshold - JANUS_LOAD_HYSTERESIS)) {
+			JANUS_LOG(LOG_INFO, "Load score is %d, admitting new handles and joins again (%d refused)\n",
+				current, g_atomic_int_get(&rejected));
+			g_atomic_int_set(&admitting, 1);
+			__atomic_store_n(&admission_changed, janus_get_monotonic_time(), __ATOMIC_RELAXED);
+			notify = TRUE;
+		}
+	}
+	updates++;
+	if(event_period > 0 && updates >= event_period)
+		notify = TRUE;
+	if(notify) {
+		updates = 0;
+		janus_load_notify();
+	}
+}
+
+int janus_load_get_score(void) {
+	return g_atomic_int_get(&score);
+}
+
+gboolean janus_load_is_admitting(void) {
+	return admission_threshold == 0 || g_atomic_int_get(&admitting);
+}
+
+void janus_load_rejected(void) {
+	g_atomic_int_inc(&rejected);
+	janus_metric_inc(metric_rejected);
+}
+
+json_t *janus_load_info(gboolean details) {
+	json_t *info = json_object();
+	json_object_set_new(info, "score", json_integer(g_atomic_int_get(&score)));
+	json_object_set_new(info, "admitting", janus_load_is_admitting() ? json_true() : json_false());
+	if(admission_threshold > 0) {
+		json_object_set_new(info, "threshold", json_integer(admission_threshold));
+		json_object_set_new(info, "rejected", json_integer(g_atomic_int_get(&rejected)));
+	}
+	if(details) {
+		json_t *components = json_object();
+		int i = 0;
+		for(i=0; i<JANUS_LOAD_COMPONENTS; i++) {
+			json_object_set_new(components, janus_load_component_names[i],
+				json_integer(g_atomic_int_get(&components_last[i])));
+		}
+		json_object_set_new(info, "components", components);
+		if(admission_threshold > 0) {
+			json_object_set_new(info, "since",
+				json_integer((janus_get_monotonic_time() - __atomic_load_n(&admission_changed, __ATOMIC_RELAXED))/G_USEC_PER_SEC));
+		}
+	}
+	return info;
+}
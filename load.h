@@ -0,0 +1,89 @@
+/*! \file    load.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Load score and admission control (headers)
+ * \details  A single number, from 0 to 100, telling how close a Janus
+ * instance is to its limits, so that a dispatcher or load balancer can
+ * send new users somewhere else before quality drops. The score is
+ * computed by the core once per second out of a few components, each
+ * of them a percentage as well:
+ *
+ * - \c cpu: the CPU time the process consumed, out of the CPUs available;
+ * - \c requests: how busy the busiest request worker was;
+ * - \c queues: how many WebRTC handles have a backlog of packets in their
+ * outgoing queue (i.e., their loop can't keep up with what they must send);
+ * - \c plugins: the highest load plugins reported (e.g., how close the
+ * AudioBridge mixers are to missing their 20ms deadline).
+ *
+ * The score is the highest of them, since whatever resource saturates
+ * first is what degrades media, smoothed so that it goes up as soon as
+ * a component does, and comes down slowly. It is part of the \c info
+ * response, can be queried in more detail with the Admin API \c load
+ * request, and is sent to event handlers as a core event periodically
+ * and whenever admission changes.
+ *
+ * If a threshold is configured (\c admission_threshold in the \c general
+ * section), admission control kicks in as soon as the score reaches it:
+ * new handles are refused with a \c JANUS_ERROR_OVERLOADED error, and
+ * plugins can ask the core whether to refuse users joining (e.g., a
+ * VideoRoom or AudioBridge room) too. New users are admitted again once
+ * the score goes \c JANUS_LOAD_HYSTERESIS points below the threshold,
+ * to avoid flapping.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef _JANUS_LOAD_H
+#define _JANUS_LOAD_H
+
+#include <glib.h>
+#include <jansson.h>
+
+/*! \brief Components of the load score */
+typedef enum janus_load_component {
+	/*! \brief CPU consumed by the process */
+	janus_load_cpu = 0,
+	/*! \brief Request workers utilization */
+	janus_load_requests,
+	/*! \brief Handles with a backlog in their outgoing queue */
+	janus_load_queues,
+	/*! \brief Highest load reported by plugins */
+	janus_load_plugins,
+} janus_load_component;
+/*! \brief Number of components */
+#define JANUS_LOAD_COMPONENTS	4
+
+/*! \brief How many points below the threshold the score must go before admitting users again */
+#define JANUS_LOAD_HYSTERESIS	10
+
+/*! \brief Initialize the load score and admission control
+ * @param[in] threshold Score at which new handles and joins are refused (0 disables admission control)
+ * @param[in] event_period How often the score should be sent to event handlers, in seconds (0 means only when admission changes) */
+void janus_load_init(int threshold, int event_period);
+/*! \brief Get rid of the load score metrics */
+void janus_load_deinit(void);
+
+/*! \brief Helper to sample how much CPU the process consumed since the last time this was called
+ * \note Only meant to be called by whoever computes the score, once per update
+ * @returns The percentage of the available CPUs the process used */
+int janus_load_sample_cpu(void);
+/*! \brief Update the load score with new values for its components
+ * @param[in] components The value of each component (from 0 to 100), indexed by janus_load_component */
+void janus_load_update(int components[JANUS_LOAD_COMPONENTS]);
+
+/*! \brief Get the current load score
+ * @returns The score, from 0 to 100 */
+int janus_load_get_score(void);
+/*! \brief Check whether new handles or users should be admitted
+ * \note Always TRUE if admission control is disabled
+ * @returns TRUE if new users can be admitted, FALSE otherwise */
+gboolean janus_load_is_admitting(void);
+/*! \brief Take note that something was refused because of admission control */
+void janus_load_rejected(void);
+/*! \brief Get a summary of the load, as used by the \c info response, the Admin API \c load request and core events
+ * @param[in] details Whether the value of each component should be included too
+ * @returns A JSON object with the score, whether new users are admitted and how many were refused */
+json_t *janus_load_info(gboolean details);
+
+#endif
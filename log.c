@@ -5,7 +5,14 @@
  * \details   Implementation of a simple buffered logger designed to remove
  * I/O wait from threads that may be sensitive to such delays. Buffers are
  * saved and reused to reduce allocation calls. The logger output can then
- * be printed to stdout and/or a log file.
+ * be printed to stdout and/or a log file. To avoid contention when
+ * many threads are logging at the same time (e.g., media threads at a
+ * verbose log level), each thread writes its lines to its own ring buffer,
+ * which is drained by the log thread without the producer ever taking a
+ * lock: the shared, locked list of buffers is only used as a fallback,
+ * when a line is too long or a ring is full. Lines with integer arguments
+ * only can also be logged as binary records (see JANUS_LOG_DEFERRED),
+ * which are only formatted by the log thread when printing them.
  *
  * \ingroup core
  * \ref core
@@ -13,15 +20,18 @@
 
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "log.h"
+#include "debug.h"
 
 #define THREAD_NAME "log"
 
 typedef struct janus_log_buffer janus_log_buffer;
 struct janus_log_buffer {
 	size_t allocated;
+	gint64 when;
 	janus_log_buffer *next;
 	/* str is grown by allocating beyond the struct */
 	char str[1];
@@ -46,6 +56,64 @@ static janus_log_buffer *printhead = NULL;
 static janus_log_buffer *printtail = NULL;
 static janus_log_buffer *bufferpool = NULL;
 
+/* Per-thread rings: sizes must be powers of 2, and records are aligned
+ * to 16 bytes so that there's always room for a padding header at the end */
+#define JANUS_LOG_RING_SIZE		(32*1024)
+#define JANUS_LOG_RING_LINE		1024
+#define JANUS_LOG_ALIGN(size)	(((size) + 15) & ~15)
+/* How long the log thread sleeps at most when there's nothing to print */
+#define JANUS_LOG_IDLE_WAIT		(100*G_TIME_SPAN_MILLISECOND)
+
+typedef enum janus_log_record_type {
+	janus_log_record_text = 0,
+	janus_log_record_deferred,
+	janus_log_record_padding
+} janus_log_record_type;
+
+typedef struct janus_log_record {
+	/* Size of the whole record, header included */
+	guint32 size;
+	guint32 type;
+	gint64 when;
+	/* Followed by the formatted line, or by a janus_log_deferred_record */
+} janus_log_record;
+
+typedef struct janus_log_deferred_record {
+	int level;
+	int line;
+	guint count;
+	time_t ts;
+	const char *file;
+	const char *function;
+	const char *format;
+	guint64 args[JANUS_LOG_DEFERRED_MAX_ARGS];
+} janus_log_deferred_record;
+
+typedef struct janus_log_ring janus_log_ring;
+struct janus_log_ring {
+	char *data;
+	/* Written by the producer only */
+	volatile guint32 head;
+	guint32 reserved;
+	/* Written by the log thread only */
+	volatile guint32 tail;
+	guint32 drained;
+	/* Set when the thread owning the ring goes away */
+	volatile gint orphaned;
+	/* Where lines are formatted before being copied to the ring */
+	char scratch[JANUS_LOG_RING_LINE];
+	janus_log_ring *next;
+};
+/* List of rings, protected by lock (only used when adding or removing a ring) */
+static janus_log_ring *rings = NULL;
+static void janus_log_ring_orphan(gpointer data) {
+	janus_log_ring *ring = (janus_log_ring *)data;
+	g_atomic_int_set(&ring->orphaned, 1);
+}
+static GPrivate ring_key = G_PRIVATE_INIT(janus_log_ring_orphan);
+/* Whether the log thread is waiting for something to print */
+static volatile gint sleeping = 0;
+
 
 gboolean janus_log_is_stdout_enabled(void) {
 	return janus_log_console;
@@ -71,6 +139,162 @@ static void janus_log_freebuffers(janus_log_buffer **list) {
 	*list = NULL;
 }
 
+static janus_log_ring *janus_log_ring_get(void) {
+	janus_log_ring *ring = g_private_get(&ring_key);
+	if(ring != NULL)
+		return ring;
+	ring = g_malloc0(sizeof(janus_log_ring));
+	ring->data = g_malloc(JANUS_LOG_RING_SIZE);
+	g_mutex_lock(&lock);
+	ring->next = rings;
+	rings = ring;
+	g_mutex_unlock(&lock);
+	g_private_set(&ring_key, ring);
+	return ring;
+}
+
+static void janus_log_ring_free(janus_log_ring *ring) {
+	g_free(ring->data);
+	g_free(ring);
+}
+
+/* Find room for a record in the ring of the current thread, if there's any */
+static janus_log_record *janus_log_ring_reserve(janus_log_ring *ring, guint32 size) {
+	size = JANUS_LOG_ALIGN(size);
+	guint32 head = ring->head;
+	guint32 tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	guint32 offset = head & (JANUS_LOG_RING_SIZE-1);
+	guint32 contiguous = JANUS_LOG_RING_SIZE - offset;
+	guint32 needed = size + (size > contiguous ? contiguous : 0);
+	if(JANUS_LOG_RING_SIZE - (head - tail) < needed)
+		return NULL;
+	if(size > contiguous) {
+		/* Not enough room before the end of the ring, skip to the beginning */
+		janus_log_record *padding = (janus_log_record *)(ring->data + offset);
+		padding->size = contiguous;
+		padding->type = janus_log_record_padding;
+		head += contiguous;
+		offset = 0;
+	}
+	ring->reserved = head + size;
+	janus_log_record *record = (janus_log_record *)(ring->data + offset);
+	record->size = size;
+	record->when = g_get_monotonic_time();
+	return record;
+}
+
+/* Make a reserved record visible to the log thread, waking it up if needed */
+static void janus_log_ring_commit(janus_log_ring *ring) {
+	__atomic_store_n(&ring->head, ring->reserved, __ATOMIC_SEQ_CST);
+	if(g_atomic_int_get(&sleeping) && g_atomic_int_compare_and_exchange(&sleeping, 1, 0)) {
+		g_mutex_lock(&lock);
+		g_cond_signal(&cond);
+		g_mutex_unlock(&lock);
+	}
+}
+
+/* Check whether any ring has something to print (lock must be held) */
+static gboolean janus_log_rings_pending(void) {
+	janus_log_ring *ring = rings;
+	while(ring) {
+		if(__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != ring->tail)
+			return TRUE;
+		ring = ring->next;
+	}
+	return FALSE;
+}
+
+/* Format a deferred record: only integer conversions are supported */
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+static void janus_log_format_deferred(GString *out, const char *format, const guint64 *args, guint count) {
+	const char *p = format;
+	guint arg = 0;
+	char spec[32];
+	while(*p) {
+		if(*p != '%') {
+			const char *next = strchr(p, '%');
+			size_t len = next ? (size_t)(next - p) : strlen(p);
+			g_string_append_len(out, p, len);
+			p += len;
+			continue;
+		}
+		if(*(p+1) == '%') {
+			g_string_append_c(out, '%');
+			p += 2;
+			continue;
+		}
+		/* Isolate the conversion specification */
+		const char *start = p++;
+		while(*p && strchr("-+ #0123456789.", *p))
+			p++;
+		int longs = 0, shorts = 0, sizes = 0;
+		while(*p && strchr("hlqjzt", *p)) {
+			if(*p == 'h')
+				shorts++;
+			else if(*p == 'z' || *p == 't')
+				sizes++;
+			else
+				longs += (*p == 'l') ? 1 : 2;
+			p++;
+		}
+		char conversion = *p;
+		if(conversion == '\0')
+			break;
+		p++;
+		size_t len = p - start;
+		if(len >= sizeof(spec) || arg >= count || !strchr("diouxXcp", conversion)) {
+			/* Not something we can print */
+			g_string_append(out, "<?>");
+			arg++;
+			continue;
+		}
+		memcpy(spec, start, len);
+		spec[len] = '\0';
+		guint64 value = args[arg++];
+		if(conversion == 'p') {
+			g_string_append_printf(out, spec, (void *)(guintptr)value);
+		} else if(conversion == 'd' || conversion == 'i') {
+			if(longs > 1)
+				g_string_append_printf(out, spec, (long long)value);
+			else if(longs == 1)
+				g_string_append_printf(out, spec, (long)value);
+			else if(sizes)
+				g_string_append_printf(out, spec, (gssize)value);
+			else
+				g_string_append_printf(out, spec, shorts > 1 ? (int)(signed char)value :
+					(shorts ? (int)(short)value : (int)value));
+		} else {
+			if(longs > 1)
+				g_string_append_printf(out, spec, (unsigned long long)value);
+			else if(longs == 1)
+				g_string_append_printf(out, spec, (unsigned long)value);
+			else if(sizes)
+				g_string_append_printf(out, spec, (gsize)value);
+			else
+				g_string_append_printf(out, spec, shorts > 1 ? (unsigned int)(unsigned char)value :
+					(shorts ? (unsigned int)(unsigned short)value : (unsigned int)value));
+		}
+	}
+}
+
+#pragma GCC diagnostic warning "-Wformat-nonliteral"
+
+/* Turn a deferred record in a line, the same way JANUS_LOG would */
+static void janus_log_print_deferred(GString *out, janus_log_deferred_record *record) {
+	g_string_truncate(out, 0);
+	if(record->ts > 0) {
+		char ts[64];
+		struct tm tmresult;
+		localtime_r(&record->ts, &tmresult);
+		strftime(ts, sizeof(ts), "[%a %b %e %T %Y] ", &tmresult);
+		g_string_append(out, ts);
+	}
+	g_string_append(out, janus_log_prefix[record->level | ((int)janus_log_colors << 3)]);
+	if(record->level == LOG_FATAL || record->level == LOG_ERR || record->level == LOG_DBG)
+		g_string_append_printf(out, "[%s:%s:%d] ", record->file, record->function, record->line);
+	janus_log_format_deferred(out, record->format, record->args, record->count);
+}
+
 static janus_log_buffer *janus_log_getbuf(void) {
 	janus_log_buffer *b;
 
@@ -91,61 +315,140 @@ static janus_log_buffer *janus_log_getbuf(void) {
 	return b;
 }
 
-static void *janus_log_thread(void *ctx) {
-	janus_log_buffer *head, *b, *tofree = NULL;
+/* Something to print, either from a ring or from the fallback list */
+typedef struct janus_log_line {
+	gint64 when;
+	guint index;
+	janus_log_record *record;
+	janus_log_buffer *buffer;
+} janus_log_line;
 
-	while (!g_atomic_int_get(&stopping)) {
-		g_mutex_lock(&lock);
-		if (!printhead) {
-			g_cond_wait(&cond, &lock);
-		}
-		head = printhead;
-		printhead = printtail = NULL;
-		g_mutex_unlock(&lock);
+static gint janus_log_line_compare(gconstpointer a, gconstpointer b) {
+	const janus_log_line *la = (const janus_log_line *)a, *lb = (const janus_log_line *)b;
+	if(la->when != lb->when)
+		return la->when < lb->when ? -1 : 1;
+	return la->index < lb->index ? -1 : (la->index > lb->index ? 1 : 0);
+}
 
-		if (head) {
-			for (b = head; b; b = b->next) {
-				if(janus_log_console)
-					fputs(b->str, stdout);
-				if(janus_log_file)
-					fputs(b->str, janus_log_file);
-			}
-			g_mutex_lock(&lock);
-			while (head) {
-				b = head;
-				head = b->next;
-				if (poolsz >= maxpoolsz || b->allocated > maxbuffersz) {
-					b->next = tofree;
-					tofree = b;
-					poolsz--;
-				} else {
-					b->next = bufferpool;
-					bufferpool = b;
-				}
+static void janus_log_output(const char *str) {
+	if(janus_log_console)
+		fputs(str, stdout);
+	if(janus_log_file)
+		fputs(str, janus_log_file);
+}
+
+/* Print everything that's available in the rings and in the fallback list,
+ * sorted by time as lines from different threads may be interleaved */
+static gboolean janus_log_drain(GArray *lines, GString *deferred) {
+	janus_log_buffer *head, *b, *tofree = NULL;
+	janus_log_ring *ring, *orphans = NULL, *prev = NULL;
+	guint i = 0;
+	g_array_set_size(lines, 0);
+	g_mutex_lock(&lock);
+	head = printhead;
+	printhead = printtail = NULL;
+	for(b = head; b; b = b->next) {
+		janus_log_line line = { .when = b->when, .index = lines->len, .record = NULL, .buffer = b };
+		g_array_append_val(lines, line);
+	}
+	/* Take note of where each ring is: lines added in the meanwhile will be printed next time */
+	ring = rings;
+	while(ring) {
+		guint32 rhead = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		guint32 tail = ring->tail;
+		while(tail != rhead) {
+			janus_log_record *record = (janus_log_record *)(ring->data + (tail & (JANUS_LOG_RING_SIZE-1)));
+			if(record->type != janus_log_record_padding) {
+				janus_log_line line = { .when = record->when, .index = lines->len, .record = record, .buffer = NULL };
+				g_array_append_val(lines, line);
 			}
-			g_mutex_unlock(&lock);
-			if(janus_log_console)
-				fflush(stdout);
-			if(janus_log_file)
-				fflush(janus_log_file);
-			janus_log_freebuffers(&tofree);
+			tail += record->size;
 		}
+		ring->drained = rhead;
+		ring = ring->next;
 	}
-	/* print any remaining messages, stdout flushed on exit */
-	for (b = printhead; b; b = b->next) {
-		if(janus_log_console)
-			fputs(b->str, stdout);
-		if(janus_log_file)
-			fputs(b->str, janus_log_file);
+	g_mutex_unlock(&lock);
+	if(lines->len == 0)
+		return FALSE;
+	g_array_sort(lines, janus_log_line_compare);
+	for(i=0; i<lines->len; i++) {
+		janus_log_line *line = &g_array_index(lines, janus_log_line, i);
+		if(line->buffer) {
+			janus_log_output(line->buffer->str);
+		} else if(line->record->type == janus_log_record_text) {
+			janus_log_output((char *)(line->record + 1));
+		} else {
+			janus_log_print_deferred(deferred, (janus_log_deferred_record *)(line->record + 1));
+			janus_log_output(deferred->str);
+		}
+	}
+	g_mutex_lock(&lock);
+	/* We're done with what we printed, give the space back to the rings */
+	ring = rings;
+	while(ring) {
+		janus_log_ring *next = ring->next;
+		__atomic_store_n(&ring->tail, ring->drained, __ATOMIC_RELEASE);
+		if(g_atomic_int_get(&ring->orphaned) && ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+			/* The thread is gone and there's nothing left to print */
+			if(prev)
+				prev->next = next;
+			else
+				rings = next;
+			ring->next = orphans;
+			orphans = ring;
+		} else {
+			prev = ring;
+		}
+		ring = next;
 	}
+	while (head) {
+		b = head;
+		head = b->next;
+		if (poolsz >= maxpoolsz || b->allocated > maxbuffersz) {
+			b->next = tofree;
+			tofree = b;
+			poolsz--;
+		} else {
+			b->next = bufferpool;
+			bufferpool = b;
+		}
+	}
+	g_mutex_unlock(&lock);
 	if(janus_log_console)
 		fflush(stdout);
 	if(janus_log_file)
 		fflush(janus_log_file);
-	janus_log_freebuffers(&printhead);
+	janus_log_freebuffers(&tofree);
+	while(orphans) {
+		ring = orphans;
+		orphans = ring->next;
+		janus_log_ring_free(ring);
+	}
+	return TRUE;
+}
+
+static void *janus_log_thread(void *ctx) {
+	GArray *lines = g_array_sized_new(FALSE, FALSE, sizeof(janus_log_line), 256);
+	GString *deferred = g_string_sized_new(INITIAL_BUFSZ);
+
+	while (!g_atomic_int_get(&stopping)) {
+		if(janus_log_drain(lines, deferred))
+			continue;
+		/* Nothing to print: let producers know they have to wake us up */
+		g_mutex_lock(&lock);
+		g_atomic_int_set(&sleeping, 1);
+		if (!printhead && !janus_log_rings_pending() && !g_atomic_int_get(&stopping)) {
+			g_cond_wait_until(&cond, &lock, g_get_monotonic_time() + JANUS_LOG_IDLE_WAIT);
+		}
+		g_atomic_int_set(&sleeping, 0);
+		g_mutex_unlock(&lock);
+	}
+	/* print any remaining messages, stdout flushed on exit */
+	janus_log_drain(lines, deferred);
+	g_array_free(lines, TRUE);
+	g_string_free(deferred, TRUE);
 	janus_log_freebuffers(&bufferpool);
-	g_mutex_clear(&lock);
-	g_cond_clear(&cond);
+	/* Rings of threads that are still alive are left alone, as they may still be used */
 
 	if(janus_log_file)
 		fclose(janus_log_file);
@@ -156,33 +459,99 @@ static void *janus_log_thread(void *ctx) {
 	return NULL;
 }
 
+/* Fallback for lines that can't go through the ring of the thread */
+static void janus_log_enqueue(janus_log_buffer *b) {
+	b->when = g_get_monotonic_time();
+	g_mutex_lock(&lock);
+	if (!printhead) {
+		printhead = printtail = b;
+	} else {
+		printtail->next = b;
+		printtail = b;
+	}
+	g_cond_signal(&cond);
+	g_mutex_unlock(&lock);
+}
+
 void janus_vprintf(const char *format, ...) {
 	int len;
 	va_list ap, ap2;
-	janus_log_buffer *b = janus_log_getbuf();
+	janus_log_ring *ring = janus_log_ring_get();
 
 	va_start(ap, format);
 	va_copy(ap2, ap);
-	/* first try */
-	len = vsnprintf(b->str, b->allocated, format, ap);
+	/* first try: format the line in the scratch buffer of the thread */
+	len = vsnprintf(ring->scratch, sizeof(ring->scratch), format, ap);
 	va_end(ap);
-	if (len >= (int) b->allocated) {
-		/* buffer wasn't big enough */
-		b = g_realloc(b, len + 1 + sizeof(*b));
-		b->allocated = len + 1;
+	if (len >= 0 && len < (int) sizeof(ring->scratch)) {
+		janus_log_record *record = janus_log_ring_reserve(ring, sizeof(janus_log_record) + len + 1);
+		if (record) {
+			record->type = janus_log_record_text;
+			memcpy((char *)(record + 1), ring->scratch, len + 1);
+			janus_log_ring_commit(ring);
+			va_end(ap2);
+			return;
+		}
+	}
+	/* Line too long, or ring full: use a buffer instead */
+	janus_log_buffer *b = janus_log_getbuf();
+	if (len >= 0 && len < (int) b->allocated) {
+		memcpy(b->str, ring->scratch, len + 1);
+	} else {
+		if (len >= (int) b->allocated) {
+			/* buffer wasn't big enough */
+			b = g_realloc(b, len + 1 + sizeof(*b));
+			b->allocated = len + 1;
+		}
 		vsnprintf(b->str, b->allocated, format, ap2);
 	}
 	va_end(ap2);
+	janus_log_enqueue(b);
+}
 
-	g_mutex_lock(&lock);
-	if (!printhead) {
-		printhead = printtail = b;
-	} else {
-		printtail->next = b;
-		printtail = b;
+void janus_log_deferred(int level, const char *file, const char *function, int line,
+		const char *format, const guint64 *args, guint count) {
+	if (count > JANUS_LOG_DEFERRED_MAX_ARGS)
+		count = JANUS_LOG_DEFERRED_MAX_ARGS;
+	janus_log_ring *ring = janus_log_ring_get();
+	janus_log_record *record = janus_log_ring_reserve(ring, sizeof(janus_log_record) + sizeof(janus_log_deferred_record));
+	janus_log_deferred_record temp, *deferred = record ? (janus_log_deferred_record *)(record + 1) : &temp;
+	deferred->level = level;
+	deferred->line = line;
+	deferred->count = count;
+	deferred->ts = janus_log_timestamps ? time(NULL) : 0;
+	deferred->file = file;
+	deferred->function = function;
+	deferred->format = format;
+	if (count > 0)
+		memcpy(deferred->args, args, count * sizeof(guint64));
+	if (record) {
+		record->type = janus_log_record_deferred;
+		janus_log_ring_commit(ring);
+		return;
 	}
-	g_cond_signal(&cond);
-	g_mutex_unlock(&lock);
+	/* Ring full: format the line right away */
+	GString *text = g_string_sized_new(256);
+	janus_log_print_deferred(text, deferred);
+	janus_log_buffer *b = janus_log_getbuf();
+	if (text->len >= b->allocated) {
+		b = g_realloc(b, text->len + 1 + sizeof(*b));
+		b->allocated = text->len + 1;
+	}
+	memcpy(b->str, text->str, text->len + 1);
+	g_string_free(text, TRUE);
+	janus_log_enqueue(b);
+}
+
+int janus_log_ratelimit(volatile gint64 *next, volatile gint *suppressed) {
+	gint64 now = g_get_monotonic_time();
+	gint64 when = __atomic_load_n(next, __ATOMIC_RELAXED);
+	if (now < when || !__atomic_compare_exchange_n(next, &when, now + JANUS_LOG_RATELIMIT_INTERVAL,
+			FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		g_atomic_int_inc(suppressed);
+		return -1;
+	}
+	return __atomic_exchange_n(suppressed, 0, __ATOMIC_RELAXED);
 }
 
 int janus_log_init(gboolean daemon, gboolean console, const char *logfile) {
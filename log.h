@@ -5,7 +5,9 @@
  * \details  Implementation of a simple buffered logger designed to remove
  * I/O wait from threads that may be sensitive to such delays. Buffers are
  * saved and reused to reduce allocation calls. The logger output can then
- * be printed to stdout and/or a log file.
+ * be printed to stdout and/or a log file. Each thread writes to its own
+ * ring buffer, which means logging doesn't involve any lock unless a line
+ * doesn't fit in the ring, in which case the shared list is used instead.
  *
  * \ingroup core
  * \ref core
@@ -23,6 +25,33 @@
 * \note This output is buffered and may not appear immediately on stdout. */
 void janus_vprintf(const char *format, ...) G_GNUC_PRINTF(1, 2);
 
+/*! \brief Maximum number of arguments a deferred log line can have */
+#define JANUS_LOG_DEFERRED_MAX_ARGS	8
+/*! \brief Log a line that will only be formatted by the log thread
+ * \note Only integer (and pointer) conversions are supported, as the
+ * arguments are stored as 64-bit integers and the format string is only
+ * used later on: the format must be a string literal. Use the
+ * JANUS_LOG_DEFERRED macro rather than calling this directly.
+ * @param[in] level Log level of the line
+ * @param[in] file File the line was logged from
+ * @param[in] function Function the line was logged from
+ * @param[in] line Line of code the line was logged from
+ * @param[in] format Format string (must be a string literal)
+ * @param[in] args The arguments of the format string
+ * @param[in] count The number of arguments */
+void janus_log_deferred(int level, const char *file, const char *function, int line,
+	const char *format, const guint64 *args, guint count);
+
+/*! \brief Minimum interval between lines logged from the same rate limited call site (microseconds) */
+#define JANUS_LOG_RATELIMIT_INTERVAL	G_USEC_PER_SEC
+/*! \brief Check whether a rate limited call site can log a line now
+ * \note Use the JANUS_LOG_RATELIMITED macro rather than calling this directly
+ * @param[in,out] next When the call site will be allowed to log again
+ * @param[in,out] suppressed How many lines were suppressed so far
+ * @returns -1 if the line must be suppressed, the number of lines
+ * suppressed since the last one that was logged otherwise */
+int janus_log_ratelimit(volatile gint64 *next, volatile gint *suppressed);
+
 /*! \brief Log initialization
 * \note This should be called before attempting to use the logger. A buffer
 * pool and processing thread are created.
@@ -0,0 +1,264 @@
+/*! \file    memory.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Memory accounting
+ * \details  Implementation of the accounting of the memory held by the
+ * core and by plugins. Accounts are refcounted, and each account holds a
+ * reference to its parent, which means charges can always be propagated
+ * up the tree, even when the object that created the parent is gone.
+ * Charges are atomic operations on the accounts, whereas the tree itself
+ * (which is only needed to list accounts) is protected by a mutex, as
+ * accounts are created and destroyed far less often than they're charged.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include "memory.h"
+#include "debug.h"
+#include "metrics.h"
+#include "mutex.h"
+#include "refcount.h"
+
+static const char *janus_memory_subsystem_names[JANUS_MEMORY_SUBSYSTEMS] = {
+	"handles", "nack", "queues", "keyframes", "events", "recordings", "other"
+};
+
+const char *janus_memory_subsystem_name(janus_memory_subsystem subsystem) {
+	if(subsystem < janus_memory_handles || subsystem > janus_memory_other)
+		return NULL;
+	return janus_memory_subsystem_names[subsystem];
+}
+
+#ifdef HAVE_MEMORY_ACCOUNTING
+
+struct janus_memory_account {
+	/* Name of the account */
+	char *name;
+	/* Parent account, if any (we hold a reference) */
+	janus_memory_account *parent;
+	/* Children of this account (protected by accounts_mutex) */
+	GList *children;
+	/* Bytes charged to this account and its children, per subsystem */
+	gint64 bytes[JANUS_MEMORY_SUBSYSTEMS];
+	/* Sum of the above */
+	gint64 total;
+	/* Cap on the total (0 means no limit) */
+	gint64 limit;
+	/* How many charges were refused because of the cap */
+	gint64 refused;
+	/* Reference counter */
+	janus_refcount ref;
+};
+
+/* Root accounts */
+static GList *roots = NULL;
+static janus_mutex accounts_mutex = JANUS_MUTEX_INITIALIZER;
+
+/* Add (or, if negative, remove) bytes to an account and all its ancestors */
+static void janus_memory_account_update(janus_memory_account *account, janus_memory_subsystem subsystem, gint64 bytes) {
+	while(account != NULL) {
+		__atomic_fetch_add(&account->bytes[subsystem], bytes, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&account->total, bytes, __ATOMIC_RELAXED);
+		account = account->parent;
+	}
+}
+
+static void janus_memory_account_free(const janus_refcount *account_ref) {
+	janus_memory_account *account = janus_refcount_containerof(account_ref, janus_memory_account, ref);
+	/* Whatever is still charged to this account is not held anymore */
+	int i = 0;
+	for(i=0; i<JANUS_MEMORY_SUBSYSTEMS; i++) {
+		gint64 bytes = __atomic_load_n(&account->bytes[i], __ATOMIC_RELAXED);
+		if(bytes != 0 && account->parent)
+			janus_memory_account_update(account->parent, i, -bytes);
+	}
+	janus_mutex_lock(&accounts_mutex);
+	if(account->parent)
+		account->parent->children = g_list_remove(account->parent->children, account);
+	else
+		roots = g_list_remove(roots, account);
+	janus_mutex_unlock(&accounts_mutex);
+	if(account->parent)
+		janus_refcount_decrease(&account->parent->ref);
+	g_list_free(account->children);
+	g_free(account->name);
+	g_free(account);
+}
+
+janus_memory_account *janus_memory_account_create(const char *name, janus_memory_account *parent) {
+	janus_memory_account *account = g_malloc0(sizeof(janus_memory_account));
+	account->name = g_strdup(name ? name : "unnamed");
+	janus_refcount_init(&account->ref, janus_memory_account_free);
+	if(parent != NULL) {
+		janus_refcount_increase(&parent->ref);
+		account->parent = parent;
+	}
+	janus_mutex_lock(&accounts_mutex);
+	if(parent != NULL)
+		parent->children = g_list_prepend(parent->children, account);
+	else
+		roots = g_list_append(roots, account);
+	janus_mutex_unlock(&accounts_mutex);
+	return account;
+}
+
+janus_memory_account *janus_memory_account_ref(janus_memory_account *account) {
+	if(account != NULL)
+		janus_refcount_increase(&account->ref);
+	return account;
+}
+
+void janus_memory_account_destroy(janus_memory_account *account) {
+	if(account != NULL)
+		janus_refcount_decrease(&account->ref);
+}
+
+void janus_memory_account_set_limit(janus_memory_account *account, gint64 limit) {
+	if(account != NULL)
+		__atomic_store_n(&account->limit, limit > 0 ? limit : 0, __ATOMIC_RELAXED);
+}
+
+void janus_memory_charge(janus_memory_account *account, janus_memory_subsystem subsystem, gint64 bytes) {
+	if(account == NULL || bytes == 0 || subsystem < janus_memory_handles || subsystem > janus_memory_other)
+		return;
+	janus_memory_account_update(account, subsystem, bytes);
+}
+
+gboolean janus_memory_try_charge(janus_memory_account *account, janus_memory_subsystem subsystem, gint64 bytes) {
+	if(account == NULL || bytes <= 0 || subsystem < janus_memory_handles || subsystem > janus_memory_other)
+		return TRUE;
+	/* Check the caps first */
+	janus_memory_account *a = account;
+	while(a != NULL) {
+		gint64 limit = __atomic_load_n(&a->limit, __ATOMIC_RELAXED);
+		if(limit > 0 && __atomic_load_n(&a->total, __ATOMIC_RELAXED) + bytes > limit) {
+			__atomic_fetch_add(&a->refused, 1, __ATOMIC_RELAXED);
+			return FALSE;
+		}
+		a = a->parent;
+	}
+	janus_memory_account_update(account, subsystem, bytes);
+	return TRUE;
+}
+
+void janus_memory_release(janus_memory_account *account, janus_memory_subsystem subsystem, gint64 bytes) {
+	if(account == NULL || bytes == 0 || subsystem < janus_memory_handles || subsystem > janus_memory_other)
+		return;
+	janus_memory_account_update(account, subsystem, -bytes);
+}
+
+gint64 janus_memory_account_get_total(janus_memory_account *account) {
+	if(account == NULL)
+		return 0;
+	return __atomic_load_n(&account->total, __ATOMIC_RELAXED);
+}
+
+json_t *janus_memory_account_info(janus_memory_account *account) {
+	if(account == NULL)
+		return NULL;
+	json_t *info = json_object();
+	json_object_set_new(info, "total", json_integer(__atomic_load_n(&account->total, __ATOMIC_RELAXED)));
+	int i = 0;
+	for(i=0; i<JANUS_MEMORY_SUBSYSTEMS; i++) {
+		gint64 bytes = __atomic_load_n(&account->bytes[i], __ATOMIC_RELAXED);
+		if(bytes != 0)
+			json_object_set_new(info, janus_memory_subsystem_names[i], json_integer(bytes));
+	}
+	gint64 limit = __atomic_load_n(&account->limit, __ATOMIC_RELAXED);
+	if(limit > 0) {
+		json_object_set_new(info, "limit", json_integer(limit));
+		json_object_set_new(info, "refused", json_integer(__atomic_load_n(&account->refused, __ATOMIC_RELAXED)));
+	}
+	return info;
+}
+
+/* Metrics, evaluated at scrape time */
+static gint64 janus_memory_subsystem_metric(gpointer data) {
+	int subsystem = GPOINTER_TO_INT(data);
+	gint64 bytes = 0;
+	janus_mutex_lock(&accounts_mutex);
+	GList *l = roots;
+	while(l) {
+		janus_memory_account *account = (janus_memory_account *)l->data;
+		bytes += __atomic_load_n(&account->bytes[subsystem], __ATOMIC_RELAXED);
+		l = l->next;
+	}
+	janus_mutex_unlock(&accounts_mutex);
+	return bytes;
+}
+
+void janus_memory_init(void) {
+	int i = 0;
+	for(i=0; i<JANUS_MEMORY_SUBSYSTEMS; i++) {
+		char labels[64];
+		g_snprintf(labels, sizeof(labels), "subsystem=\"%s\"", janus_memory_subsystem_names[i]);
+		janus_metric_register_callback("janus_memory_bytes", labels,
+			"Memory accounted for, per subsystem", janus_metric_gauge,
+			janus_memory_subsystem_metric, GINT_TO_POINTER(i));
+	}
+}
+
+void janus_memory_deinit(void) {
+	/* Just in case somebody forgot to destroy their accounts */
+	janus_mutex_lock(&accounts_mutex);
+	GList *leftovers = g_list_copy(roots);
+	janus_mutex_unlock(&accounts_mutex);
+	GList *l = leftovers;
+	while(l) {
+		janus_memory_account *account = (janus_memory_account *)l->data;
+		JANUS_LOG(LOG_VERB, "Memory account '%s' still around at shutdown (%"SCNi64" bytes)\n",
+			account->name, __atomic_load_n(&account->total, __ATOMIC_RELAXED));
+		l = l->next;
+	}
+	g_list_free(leftovers);
+}
+
+json_t *janus_memory_info(gboolean details) {
+	json_t *info = json_object();
+	json_object_set_new(info, "enabled", json_true());
+	gint64 totals[JANUS_MEMORY_SUBSYSTEMS] = { 0 }, total = 0;
+	json_t *accounts = json_array();
+	int i = 0;
+	janus_mutex_lock(&accounts_mutex);
+	GList *l = roots, *c = NULL;
+	while(l) {
+		janus_memory_account *account = (janus_memory_account *)l->data;
+		for(i=0; i<JANUS_MEMORY_SUBSYSTEMS; i++)
+			totals[i] += __atomic_load_n(&account->bytes[i], __ATOMIC_RELAXED);
+		total += __atomic_load_n(&account->total, __ATOMIC_RELAXED);
+		json_t *a = janus_memory_account_info(account);
+		json_object_set_new(a, "name", json_string(account->name));
+		json_object_set_new(a, "children", json_integer(g_list_length(account->children)));
+		if(details && account->children) {
+			json_t *children = json_array();
+			for(c = account->children; c != NULL; c = c->next) {
+				janus_memory_account *child = (janus_memory_account *)c->data;
+				json_t *ci = janus_memory_account_info(child);
+				json_object_set_new(ci, "name", json_string(child->name));
+				json_array_append_new(children, ci);
+			}
+			json_object_set_new(a, "accounts", children);
+		}
+		json_array_append_new(accounts, a);
+		l = l->next;
+	}
+	janus_mutex_unlock(&accounts_mutex);
+	json_object_set_new(info, "total", json_integer(total));
+	json_t *subsystems = json_object();
+	for(i=0; i<JANUS_MEMORY_SUBSYSTEMS; i++)
+		json_object_set_new(subsystems, janus_memory_subsystem_names[i], json_integer(totals[i]));
+	json_object_set_new(info, "subsystems", subsystems);
+	json_object_set_new(info, "accounts", accounts);
+	return info;
+}
+
+#else
+
+json_t *janus_memory_info(gboolean details) {
+	json_t *info = json_object();
+	json_object_set_new(info, "enabled", json_false());
+	return info;
+}
+
+#endif
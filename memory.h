@@ -0,0 +1,128 @@
+/*! \file    memory.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Memory accounting (headers)
+ * \details  Lightweight accounting of the memory held by the core and by
+ * plugins, to figure out where it's going when the RSS of a Janus instance
+ * grows. Memory is charged to accounts, which are organized in a tree:
+ * the core creates a root account for ICE handles (with an account for
+ * each handle below it), for the event handlers queue and for recordings,
+ * whereas plugins create their own root accounts, and possibly accounts
+ * for rooms and participants below it. Whatever is charged to an account
+ * is charged to all its ancestors too, split by subsystem (e.g., NACK
+ * buffers, queues, keyframe caches), and any account can have a cap: when
+ * charging an account would exceed its cap, or the cap of any of its
+ * ancestors, janus_memory_try_charge fails, which allows plugins to enforce
+ * per-room limits (e.g., by refusing new participants, or not caching
+ * a keyframe). Updates are lock-free atomic operations, and caps are
+ * checked without locking too, which means they may be exceeded slightly
+ * when several threads charge the same account at the same time.
+ *
+ * Accounting is only compiled in if Janus is configured with
+ * \c --enable-memory-accounting: when it isn't, all the methods that can
+ * be used on a hot path are no-ops (and janus_memory_try_charge always
+ * succeeds), so there's no overhead at all.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef _JANUS_MEMORY_H
+#define _JANUS_MEMORY_H
+
+#include <glib.h>
+#include <jansson.h>
+
+/*! \brief Subsystems memory can be charged for */
+typedef enum janus_memory_subsystem {
+	/*! \brief ICE handles and their outgoing queues */
+	janus_memory_handles = 0,
+	/*! \brief Buffers of packets kept for retransmissions */
+	janus_memory_nack,
+	/*! \brief Packets or frames waiting to be processed (e.g., AudioBridge participants) */
+	janus_memory_queues,
+	/*! \brief Cached keyframes (e.g., the VideoRoom keyframe cache) */
+	janus_memory_keyframes,
+	/*! \brief Events waiting to be passed to event handlers */
+	janus_memory_events,
+	/*! \brief Recorded data waiting to be written to disk */
+	janus_memory_recordings,
+	/*! \brief Anything else */
+	janus_memory_other,
+} janus_memory_subsystem;
+/*! \brief Number of subsystems */
+#define JANUS_MEMORY_SUBSYSTEMS	7
+
+/*! \brief Memory account (opaque) */
+typedef struct janus_memory_account janus_memory_account;
+
+/*! \brief Helper to get the name of a subsystem (e.g., "nack")
+ * @param[in] subsystem The subsystem
+ * @returns The name of the subsystem */
+const char *janus_memory_subsystem_name(janus_memory_subsystem subsystem);
+/*! \brief Get a summary of the memory currently accounted for, as used by the Admin API \c memory request
+ * @param[in] details Whether the children of root accounts (e.g., the rooms of a plugin) should be listed too
+ * @returns A JSON object with the totals per subsystem and the root accounts */
+json_t *janus_memory_info(gboolean details);
+
+#ifdef HAVE_MEMORY_ACCOUNTING
+/*! \brief Initialize the memory accounting (registers the metrics) */
+void janus_memory_init(void);
+/*! \brief Get rid of the root accounts that are still around, at shutdown */
+void janus_memory_deinit(void);
+/*! \brief Create a new account
+ * @param[in] name Name of the account (e.g., "janus.plugin.videoroom", or "room-1234")
+ * @param[in] parent The account this account belongs to, if any (NULL for root accounts)
+ * @returns A new account, or NULL if accounting is not available */
+janus_memory_account *janus_memory_account_create(const char *name, janus_memory_account *parent);
+/*! \brief Add a reference to an account (e.g., to charge it from an object that may outlive its owner)
+ * @param[in] account The account to reference
+ * @returns The same account */
+janus_memory_account *janus_memory_account_ref(janus_memory_account *account);
+/*! \brief Release a reference to an account: when the last one goes, whatever
+ * is still charged to the account is released from its ancestors too
+ * @param[in] account The account to release */
+void janus_memory_account_destroy(janus_memory_account *account);
+/*! \brief Set a cap on the memory charged to an account (including its children)
+ * @param[in] account The account to limit
+ * @param[in] limit The maximum number of bytes (0 means no limit) */
+void janus_memory_account_set_limit(janus_memory_account *account, gint64 limit);
+/*! \brief Charge an account, whatever its cap is (e.g., for memory that has already been allocated)
+ * @param[in] account The account to charge (nothing happens if NULL)
+ * @param[in] subsystem The subsystem the memory is for
+ * @param[in] bytes The number of bytes to charge */
+void janus_memory_charge(janus_memory_account *account, janus_memory_subsystem subsystem, gint64 bytes);
+/*! \brief Charge an account, unless this would exceed its cap or the cap of any of its ancestors
+ * @param[in] account The account to charge (the charge always succeeds if NULL)
+ * @param[in] subsystem The subsystem the memory is for
+ * @param[in] bytes The number of bytes to charge
+ * @returns TRUE if the account was charged, FALSE otherwise */
+gboolean janus_memory_try_charge(janus_memory_account *account, janus_memory_subsystem subsystem, gint64 bytes);
+/*! \brief Release memory previously charged to an account
+ * @param[in] account The account to release the memory from (nothing happens if NULL)
+ * @param[in] subsystem The subsystem the memory was charged for
+ * @param[in] bytes The number of bytes to release */
+void janus_memory_release(janus_memory_account *account, janus_memory_subsystem subsystem, gint64 bytes);
+/*! \brief Get the memory currently charged to an account, including its children
+ * @param[in] account The account to query
+ * @returns The number of bytes charged to the account */
+gint64 janus_memory_account_get_total(janus_memory_account *account);
+/*! \brief Get a summary of an account, e.g., for handle_info or a plugin query_session
+ * @param[in] account The account to query
+ * @returns A JSON object with the bytes charged per subsystem, the cap and how many charges it refused, or NULL if account is NULL */
+json_t *janus_memory_account_info(janus_memory_account *account);
+#else
+static inline void janus_memory_init(void) {}
+static inline void janus_memory_deinit(void) {}
+static inline janus_memory_account *janus_memory_account_create(const char *name, janus_memory_account *parent) { return NULL; }
+static inline janus_memory_account *janus_memory_account_ref(janus_memory_account *account) { return NULL; }
+static inline void janus_memory_account_destroy(janus_memory_account *account) {}
+static inline void janus_memory_account_set_limit(janus_memory_account *account, gint64 limit) {}
+static inline void janus_memory_charge(janus_memory_account *account, janus_memory_subsystem subsystem, gint64 bytes) {}
+static inline gboolean janus_memory_try_charge(janus_memory_account *account, janus_memory_subsystem subsystem, gint64 bytes) { return TRUE; }
+static inline void janus_memory_release(janus_memory_account *account, janus_memory_subsystem subsystem, gint64 bytes) {}
+static inline gint64 janus_memory_account_get_total(janus_memory_account *account) { return 0; }
+static inline json_t *janus_memory_account_info(janus_memory_account *account) { return NULL; }
+#endif
+
+#endif
@@ -0,0 +1,168 @@
+/*! \file    metrics.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Metrics registry
+ * \details  Lightweight registry of counters and gauges, meant to be
+ * updated from hot paths (e.g., for each packet) and aggregated only when
+ * they're scraped. Each metric is split in a number of cells, and each
+ * thread always updates the same cell with relaxed atomic operations, which
+ * means there are no locks involved and threads don't contend the same
+ * cache line. Gauges can also be backed by a callback, evaluated at scrape
+ * time, for values that are cheaper to compute on demand (e.g., the size of
+ * a hashtable). The whole registry can be serialized using the Prometheus
+ * text exposition format, which transports can expose (e.g., \c /metrics).
+ * Plugins can register their own metrics as well.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "metrics.h"
+#include "mutex.h"
+#include "debug.h"
+
+/* Number of cells each metric is split in: threads are assigned one in a round robin fashion */
+#define JANUS_METRIC_CELLS	16
+#define JANUS_METRIC_CACHE_LINE	64
+
+/* Each cell has its own cache line, so that threads updating different cells don't contend */
+typedef struct janus_metric_cell {
+	volatile gint64 value;
+	char padding[JANUS_METRIC_CACHE_LINE - sizeof(gint64)];
+} janus_metric_cell;
+
+struct janus_metric {
+	janus_metric_cell cells[JANUS_METRIC_CELLS];
+	char *name;
+	char *labels;
+	char *help;
+	janus_metric_type type;
+	janus_metric_callback callback;
+	gpointer data;
+};
+
+/* The registry: only registering, unregistering and scraping lock it */
+static GList *metrics = NULL;
+static janus_mutex metrics_mutex = JANUS_MUTEX_INITIALIZER;
+
+/* Cell assigned to the current thread (plus one, as 0 means none yet) */
+static GPrivate metrics_cell;
+static volatile gint metrics_next_cell = 0;
+
+static inline guint janus_metric_cell_index(void) {
+	guint index = GPOINTER_TO_UINT(g_private_get(&metrics_cell));
+	if(index == 0) {
+		index = ((guint)g_atomic_int_add(&metrics_next_cell, 1) % JANUS_METRIC_CELLS) + 1;
+		g_private_set(&metrics_cell, GUINT_TO_POINTER(index));
+	}
+	return index - 1;
+}
+
+static void janus_metric_free(janus_metric *metric) {
+	if(metric == NULL)
+		return;
+	g_free(metric->name);
+	g_free(metric->labels);
+	g_free(metric->help);
+	free(metric);
+}
+
+janus_metric *janus_metric_register_callback(const char *name, const char *labels, const char *help,
+		janus_metric_type type, janus_metric_callback callback, gpointer data) {
+	if(name == NULL || (type != janus_metric_counter && type != janus_metric_gauge))
+		return NULL;
+	janus_metric *metric = NULL;
+	if(posix_memalign((void **)&metric, JANUS_METRIC_CACHE_LINE, sizeof(janus_metric)) != 0 || metric == NULL) {
+		JANUS_LOG(LOG_ERR, "Error allocating metric %s\n", name);
+		return NULL;
+	}
+	memset(metric, 0, sizeof(janus_metric));
+	metric->name = g_strdup(name);
+	metric->labels = (labels && strlen(labels) > 0) ? g_strdup(labels) : NULL;
+	metric->help = help ? g_strdup(help) : NULL;
+	metric->type = type;
+	metric->callback = callback;
+	metric->data = data;
+	janus_mutex_lock(&metrics_mutex);
+	metrics = g_list_append(metrics, metric);
+	janus_mutex_unlock(&metrics_mutex);
+	return metric;
+}
+
+janus_metric *janus_metric_register(const char *name, const char *labels, const char *help, janus_metric_type type) {
+	return janus_metric_register_callback(name, labels, help, type, NULL, NULL);
+}
+
+void janus_metric_unregister(janus_metric *metric) {
+	if(metric == NULL)
+		return;
+	janus_mutex_lock(&metrics_mutex);
+	metrics = g_list_remove(metrics, metric);
+	janus_mutex_unlock(&metrics_mutex);
+	janus_metric_free(metric);
+}
+
+void janus_metric_add(janus_metric *metric, gint64 value) {
+	if(metric == NULL)
+		return;
+	__atomic_fetch_add(&metric->cells[janus_metric_cell_index()].value, value, __ATOMIC_RELAXED);
+}
+
+gint64 janus_metric_get(janus_metric *metric) {
+	if(metric == NULL)
+		return 0;
+	gint64 value = 0;
+	guint i = 0;
+	for(i=0; i<JANUS_METRIC_CELLS; i++)
+		value += __atomic_load_n(&metric->cells[i].value, __ATOMIC_RELAXED);
+	if(metric->callback != NULL)
+		value += metric->callback(metric->data);
+	return value;
+}
+
+char *janus_metrics_dump(void) {
+	GString *text = g_string_sized_new(4096);
+	GHashTable *names = g_hash_table_new(g_str_hash, g_str_equal);
+	janus_mutex_lock(&metrics_mutex);
+	GList *temp = metrics;
+	while(temp) {
+		janus_metric *metric = (janus_metric *)temp->data;
+		if(g_hash_table_contains(names, metric->name)) {
+			temp = temp->next;
+			continue;
+		}
+		g_hash_table_add(names, metric->name);
+		/* Print the whole family at once */
+		if(metric->help)
+			g_string_append_printf(text, "# HELP %s %s\n", metric->name, metric->help);
+		g_string_append_printf(text, "# TYPE %s %s\n", metric->name,
+			metric->type == janus_metric_counter ? "counter" : "gauge");
+		GList *family = temp;
+		while(family) {
+			janus_metric *m = (janus_metric *)family->data;
+			family = family->next;
+			if(strcmp(m->name, metric->name))
+				continue;
+			if(m->labels)
+				g_string_append_printf(text, "%s{%s} %"SCNi64"\n", m->name, m->labels, janus_metric_get(m));
+			else
+				g_string_append_printf(text, "%s %"SCNi64"\n", m->name, janus_metric_get(m));
+		}
+		temp = temp->next;
+	}
+	janus_mutex_unlock(&metrics_mutex);
+	g_hash_table_destroy(names);
+	return g_string_free(text, FALSE);
+}
+
+void janus_metrics_deinit(void) {
+	janus_mutex_lock(&metrics_mutex);
+	GList *list = metrics;
+	metrics = NULL;
+	janus_mutex_unlock(&metrics_mutex);
+	g_list_free_full(list, (GDestroyNotify)janus_metric_free);
+}
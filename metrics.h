@@ -0,0 +1,90 @@
+/*! \file    metrics.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Metrics registry (headers)
+ * \details  Lightweight registry of counters and gauges, meant to be
+ * updated from hot paths (e.g., for each packet) and aggregated only when
+ * they're scraped. Each metric is split in a number of cells, and each
+ * thread always updates the same cell with relaxed atomic operations, which
+ * means there are no locks involved and threads don't contend the same
+ * cache line. Gauges can also be backed by a callback, evaluated at scrape
+ * time, for values that are cheaper to compute on demand (e.g., the size of
+ * a hashtable). The whole registry can be serialized using the Prometheus
+ * text exposition format, which transports can expose (e.g., \c /metrics).
+ * Plugins can register their own metrics as well.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef _JANUS_METRICS_H
+#define _JANUS_METRICS_H
+
+#include <glib.h>
+
+/*! \brief Types of metrics */
+typedef enum janus_metric_type {
+	/*! \brief Monotonically increasing value (e.g., packets received) */
+	janus_metric_counter = 0,
+	/*! \brief Value that can go up and down (e.g., active sessions) */
+	janus_metric_gauge,
+} janus_metric_type;
+
+/*! \brief Metric instance (opaque) */
+typedef struct janus_metric janus_metric;
+
+/*! \brief Callback to evaluate a metric at scrape time
+ * @param[in] data The opaque pointer passed when registering the metric
+ * @returns The current value of the metric */
+typedef gint64 (*janus_metric_callback)(gpointer data);
+
+/*! \brief Register a new metric
+ * \note Metrics with the same name (but different labels) are grouped
+ * together when serialized, and so should have the same help and type:
+ * counters should have a \c _total suffix, as per the Prometheus conventions
+ * @param[in] name The name of the metric (e.g., "janus_packets_received_total")
+ * @param[in] labels The labels for this instance, if any (e.g., "media=\"audio\"")
+ * @param[in] help A short description of the metric
+ * @param[in] type The type of metric
+ * @returns A pointer to the new metric, or NULL in case of errors */
+janus_metric *janus_metric_register(const char *name, const char *labels, const char *help, janus_metric_type type);
+/*! \brief Register a new metric whose value is computed at scrape time
+ * \note The callback is invoked from the thread serializing the registry,
+ * so it must be thread-safe: it should also be quick, e.g., just count
+ * the elements of a table rather than walking it
+ * @param[in] name The name of the metric (e.g., "janus_sessions")
+ * @param[in] labels The labels for this instance, if any
+ * @param[in] help A short description of the metric
+ * @param[in] type The type of metric
+ * @param[in] callback The callback to invoke to get the value of the metric
+ * @param[in] data An opaque pointer to pass to the callback
+ * @returns A pointer to the new metric, or NULL in case of errors */
+janus_metric *janus_metric_register_callback(const char *name, const char *labels, const char *help,
+	janus_metric_type type, janus_metric_callback callback, gpointer data);
+/*! \brief Remove a metric from the registry and free it
+ * \note The metric must not be used anymore after this call, by any thread
+ * @param[in] metric The metric to remove */
+void janus_metric_unregister(janus_metric *metric);
+/*! \brief Add a value to a metric (negative values are only allowed for gauges)
+ * \note This is lock-free and does nothing if the metric is NULL, which
+ * means callers don't need to check whether registering it worked
+ * @param[in] metric The metric to update
+ * @param[in] value The value to add */
+void janus_metric_add(janus_metric *metric, gint64 value);
+/*! \brief Helper to increase a metric by 1 */
+#define janus_metric_inc(metric) janus_metric_add(metric, 1)
+/*! \brief Helper to decrease a gauge by 1 */
+#define janus_metric_dec(metric) janus_metric_add(metric, -1)
+/*! \brief Get the current value of a metric, aggregating all the cells
+ * @param[in] metric The metric to read
+ * @returns The current value of the metric */
+gint64 janus_metric_get(janus_metric *metric);
+
+/*! \brief Serialize the whole registry using the Prometheus text exposition format
+ * \note The returned string must be freed with g_free
+ * @returns A string with the serialized metrics */
+char *janus_metrics_dump(void);
+/*! \brief Get rid of all the metrics still in the registry, at shutdown */
+void janus_metrics_deinit(void);
+
+#endif
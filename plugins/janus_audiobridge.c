@@ -34,8 +34,16 @@ pin = <optional password needed for joining the room>
 sampling_rate = <sampling rate> (e.g., 16000 for wideband mixing)
 audiolevel_ext = yes|no (whether the ssrc-audio-level RTP extension must be
 	negotiated/used or not for new joins, default=yes)
+silence_threshold = 127 (audio level at or above which packets are considered
+	silence, and neither decoded nor mixed, 127=muted, 0='too loud', default=127)
+plc_speakers = 3 (how many of the loudest speakers get their lost packets
+	concealed, 0 to disable concealment, default=3)
+memory_cap = <maximum number of bytes the buffers of the participants can take,
+	if Janus is built with memory accounting; 0=no limit, default>
 record = true|false (whether this room should be recorded, default=false)
 record_file =	/path/to/recording.wav (where to save the recording)
+record_format = wav|opus (whether to record the mix as WAV or as an Opus .mjr
+	file, which is about ten times smaller, default=wav)
 
 	[The following lines are only needed if you want the mixed audio
 	to be automatically forwarded via plain RTP to an external component
@@ -50,6 +58,66 @@ rtp_forward_srtp_suite = length of authentication tag (32 or 80)
 rtp_forward_srtp_crypto = key to use as crypto (base64 encoded key as in SDES)
 rtp_forward_always_on = true|false, whether silence should be forwarded when the room is empty (optional: false used if missing)
 \endverbatim
+ *
+ * Mixing uses vectorized kernels (AVX2, SSE2 or NEON, depending on the
+ * flags the plugin is built with, or plain C otherwise), and the mixed
+ * audio is saturated rather than truncated when converted back to 16 bits,
+ * so that loud rooms clip instead of wrapping around. To check how
+ * expensive mixing is on a specific machine, you can set \c benchmark in
+ * the \c general section to a number of rounds: a few room sizes are then
+ * measured at startup, and the results are written to the logs.
+ *
+ * Participants that aren't contributing to the mix in a specific cycle
+ * (e.g., because they're muted) all get the same full mix, which is
+ * then only encoded once by the mixer, with the same encoder used for
+ * RTP forwarders, rather than once per participant: in rooms where most
+ * participants only listen, this saves most of the encoding work. How
+ * many frames could be shared this way is part of the \c list response.
+ *
+ * Encoding happens in a pool of workers shared by all rooms, rather than
+ * in a thread per participant: the mixer hands participants to the pool
+ * every time it has a new frame for them. The pool has as many workers as
+ * there are cores, unless \c encoding_workers in the \c general section
+ * says otherwise. How much CPU time a room spent mixing and encoding is
+ * part of the info the Admin API returns for its handles.
+ *
+ * By default each room has a mixer thread of its own. With many small
+ * rooms, you can set \c mixer_threads in the \c general section to have
+ * that many threads mix all rooms instead: they all tick on the same
+ * 20ms clock, new rooms go to the thread with the fewest participants,
+ * and rooms are moved around every few seconds if the load gets uneven.
+ * Ticks that take longer than 20ms, and how late they were, are tracked
+ * by the \c janus_audiobridge_mixer_overruns_total and
+ * \c janus_audiobridge_mixer_lateness_us_total metrics.
+ *
+ * Packets that the audio level extension marks as silent enough (see
+ * \c silence_threshold ) and Opus DTX packets are not decoded at all,
+ * and don't contribute to the mix. Lost packets (gaps in the sequence
+ * numbers, or nothing received in time for the mix) are concealed by the
+ * Opus decoder, but only for the few loudest speakers in the room (see
+ * \c plc_speakers ), as concealing silence for everybody else would be
+ * expensive and pointless.
+ *
+ * When Janus is configured with \c --enable-memory-accounting, the buffers
+ * of participants are accounted for per room, and can be checked via the
+ * Admin API \c memory request. Setting \c memory_cap in a room caps
+ * them: participants trying to join a room that can't afford their buffers
+ * anymore get a \c JANUS_AUDIOBRIDGE_ERROR_MEMORY_CAP error.
+ *
+ * The plugin tells the core how close its mixers are to their limits
+ * (the 20ms deadline of the shared mixers, or how much of the CPUs the
+ * mixer threads of the rooms are using), which contributes to the load
+ * score of the instance. When \c admission_threshold is set in the Janus
+ * configuration and the score reached it, participants trying to join a
+ * room, or to move to another one via \c changeroom , get a
+ * \c JANUS_AUDIOBRIDGE_ERROR_OVERLOADED error.
+ *
+ * Recordings of the mix are written by a thread of their own, so that a
+ * slow disk doesn't affect the audio: if it can't keep up, parts of the
+ * recording are dropped instead. Setting \c record_format to \c opus
+ * records the mix as an Opus \c .mjr file (that you can process with
+ * \c janus-pp-rec as any other recording) rather than as a WAV file,
+ * which saves most of the disk bandwidth.
  *
  * \section bridgeapi Audio Bridge API
  * 
@@ -111,8 +179,12 @@ rtp_forward_always_on = true|false, whether silence should be forwarded when the
 	"audiolevel_event" : yes|no (whether to emit event to other users or not),
 	"audio_active_packets" : 100 (number of packets with audio level, default=100, 2 seconds),
 	"audio_level_average" : 25 (average value of audio level, 127=muted, 0='too loud', default=25),
+	"silence_threshold" : 127 (audio level at or above which packets are neither decoded nor mixed, default=127),
+	"plc_speakers" : 3 (how many of the loudest speakers get their lost packets concealed, default=3),
+	"memory_cap" : <maximum number of bytes the buffers of the participants can take, 0=no limit, default>,
 	"record" : <true|false, whether to record the room or not, default false>,
 	"record_file" : "</path/to/the/recording.wav, optional>",
+	"record_format" : "<wav|opus, whether to record the mix as WAV or as an Opus .mjr file, default wav>",
 }
 \endverbatim
  *
@@ -302,7 +374,9 @@ rtp_forward_always_on = true|false, whether silence should be forwarded when the
 			"pin_required" : <true|false, whether a PIN is required to join this room>,
 			"sampling_rate" : <sampling rate of the mixer>,
 			"record" : <true|false, whether the room is being recorded>,
-			"num_participants" : <count of the participants>
+			"num_participants" : <count of the participants>,
+			"frames_shared" : <how many mixed frames were encoded once for all the participants not contributing to the mix>,
+			"sharing_ratio" : <ratio between shared and all the mixed frames sent to participants>
 		},
 		// Other rooms
 	]
@@ -619,6 +693,14 @@ rtp_forward_always_on = true|false, whether silence should be forwarded when the
 #include <jansson.h>
 #include <opus/opus.h>
 #include <sys/time.h>
+#include <time.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include "../debug.h"
 #include "../apierror.h"
@@ -630,6 +712,11 @@ rtp_forward_always_on = true|false, whether silence should be forwarded when the
 #include "../record.h"
 #include "../sdp-utils.h"
 #include "../utils.h"
+#include "../affinity.h"
+#include "../metrics.h"
+#include "../memory.h"
+#include "../jitter.h"
+#include "../trace.h"
 
 
 /* Plugin information */
@@ -655,10 +742,13 @@ void janus_audiobridge_create_session(janus_plugin_session *handle, int *error);
 struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_session *handle, char *transaction, json_t *message, json_t *jsep);
 void janus_audiobridge_setup_media(janus_plugin_session *handle);
 void janus_audiobridge_incoming_rtp(janus_plugin_session *handle, int video, char *buf, int len);
+void janus_audiobridge_incoming_rtp_packet(janus_plugin_session *handle, janus_plugin_rtp_packet *packet);
+static void janus_audiobridge_incoming_rtp_internal(janus_plugin_session *handle, int video, char *buf, int len, janus_rtp_ext_info *extensions);
 void janus_audiobridge_incoming_rtcp(janus_plugin_session *handle, int video, char *buf, int len);
 void janus_audiobridge_hangup_media(janus_plugin_session *handle);
 void janus_audiobridge_destroy_session(janus_plugin_session *handle, int *error);
 json_t *janus_audiobridge_query_session(janus_plugin_session *handle);
+static int janus_audiobridge_get_load(void);
 
 /* Plugin setup */
 static janus_plugin janus_audiobridge_plugin =
@@ -678,10 +768,12 @@ static janus_plugin janus_audiobridge_plugin =
 		.handle_message = janus_audiobridge_handle_message,
 		.setup_media = janus_audiobridge_setup_media,
 		.incoming_rtp = janus_audiobridge_incoming_rtp,
+		.incoming_rtp_packet = janus_audiobridge_incoming_rtp_packet,
 		.incoming_rtcp = janus_audiobridge_incoming_rtcp,
 		.hangup_media = janus_audiobridge_hangup_media,
 		.destroy_session = janus_audiobridge_destroy_session,
 		.query_session = janus_audiobridge_query_session,
+		.get_load = janus_audiobridge_get_load,
 	);
 
 /* Plugin creator */
@@ -706,11 +798,15 @@ static struct janus_json_parameter create_parameters[] = {
 	{"sampling", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"record", JANUS_JSON_BOOL, 0},
 	{"record_file", JSON_STRING, 0},
+	{"record_format", JSON_STRING, 0},
 	{"permanent", JANUS_JSON_BOOL, 0},
 	{"audiolevel_ext", JANUS_JSON_BOOL, 0},
 	{"audiolevel_event", JANUS_JSON_BOOL, 0},
 	{"audio_active_packets", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"audio_level_average", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"silence_threshold", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"plc_speakers", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"memory_cap", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"room", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
 };
 static struct janus_json_parameter edit_parameters[] = {
@@ -786,7 +882,8 @@ static GThread *handler_thread;
 static void *janus_audiobridge_handler(void *data);
 static void janus_audiobridge_relay_rtp_packet(gpointer data, gpointer user_data);
 static void *janus_audiobridge_mixer_thread(void *data);
-static void *janus_audiobridge_participant_thread(void *data);
+static void *janus_audiobridge_mixer_worker_thread(void *data);
+static void janus_audiobridge_encoding_task(gpointer data, gpointer user_data);
 static void janus_audiobridge_hangup_media_internal(janus_plugin_session *handle);
 
 typedef struct janus_audiobridge_message {
@@ -798,6 +895,23 @@ typedef struct janus_audiobridge_message {
 static GAsyncQueue *messages = NULL;
 static janus_audiobridge_message exit_message;
 
+/* Pool of workers encoding the mixed frames for all participants */
+static GThreadPool *encoders = NULL;
+
+/* Shared mixer threads, if we're not using a thread per room: each of them
+ * mixes all the rooms it's been assigned to, on the same 20ms clock */
+typedef struct janus_audiobridge_mixer_worker {
+	int id;					/* Index of this worker */
+	GThread *thread;		/* Thread mixing the rooms */
+	GList *rooms;			/* Rooms this worker is mixing (with a reference) */
+	volatile gint count;	/* How many rooms this worker is mixing */
+	volatile gint load;		/* Participants and forwarders in all those rooms, as of the last tick */
+	janus_mutex mutex;		/* Mutex to lock the list of rooms */
+} janus_audiobridge_mixer_worker;
+static janus_audiobridge_mixer_worker *mixers = NULL;
+static int mixers_count = 0;
+static gint64 mixers_epoch = 0;
+
 
 /* Structs */
 typedef struct janus_audiobridge_room {
@@ -811,10 +925,17 @@ typedef struct janus_audiobridge_room {
 	gboolean audiolevel_event;	/* Whether to emit event to other users about audiolevel */
 	int audio_active_packets;	/* amount of packets with audio level for checkup */
 	int audio_level_average;	/* average audio level */
+	int silence_threshold;		/* Audio level at or above which packets are neither decoded nor mixed */
+	int plc_speakers;			/* How many of the loudest speakers get their lost packets concealed */
+	gint64 memory_cap;			/* Maximum number of bytes the buffers of the participants can take (0=no limit) */
+	janus_memory_account *memory;	/* Account for the memory held by this room */
 	gboolean record;			/* Whether this room has to be recorded or not */
 	gchar *record_file;			/* Path of the recording file */
-	FILE *recording;			/* File to record the room into */
+	gboolean record_opus;		/* Whether the mix should be recorded as Opus (.mjr) rather than WAV */
+	FILE *recording;			/* File to record the room into (only used by the recording thread) */
+	janus_recorder *mix_recorder;	/* Recorder for the mix, if it's recorded as Opus (only used by the recording thread) */
 	gint64 record_lastupdate;	/* Time when we last updated the wav header */
+	volatile gint record_pending;	/* Bytes of the recording waiting for the recording thread */
 	gboolean destroy;			/* Value to flag the room for destruction */
 	GHashTable *participants;	/* Map of participants */
 	gboolean check_tokens;		/* Whether to check tokens when participants join (see below) */
@@ -824,13 +945,107 @@ typedef struct janus_audiobridge_room {
 	janus_mutex mutex;			/* Mutex to lock this room instance */
 	/* RTP forwarders for this room's mix */
 	GHashTable *rtp_forwarders;	/* RTP forwarders list (as a hashmap) */
-	OpusEncoder *rtp_encoder;	/* Opus encoder instance to use for all RTP forwarders */
+	OpusEncoder *rtp_encoder;	/* Opus encoder instance to use for all RTP forwarders, and for the full mix */
 	janus_mutex rtp_mutex;		/* Mutex to lock the RTP forwarders list */
 	int rtp_udp_sock;			/* UDP socket to use to forward RTP packets */
+	guint participants_version;	/* Updated any time a participant joins or leaves, to let the mixer know */
+	guint64 frames_sent;		/* How many mixed frames were sent to participants */
+	guint64 frames_shared;		/* How many of those were the full mix, encoded once for all */
+	gint64 mixing_time;			/* CPU time spent by the mixer thread, in microseconds */
+	gint64 encoding_time;		/* CPU time spent by the workers encoding for this room, in microseconds */
+	struct janus_audiobridge_mixer *mixer;	/* Mixer state, owned by the thread mixing the room */
 	janus_refcount ref;			/* Reference counter for this room */
 } janus_audiobridge_room;
 static GHashTable *rooms;
 static janus_mutex rooms_mutex = JANUS_MUTEX_INITIALIZER;
+static void janus_audiobridge_mixer_launch(janus_audiobridge_room *audiobridge, GError **error);
+
+/* Recordings of the mix are written by a separate thread: mixers send it
+ * chunks of audio (about a second of PCM, or single Opus packets), along
+ * with requests to open and close the file, which it handles in order */
+typedef enum janus_audiobridge_record_action {
+	JANUS_AUDIOBRIDGE_RECORD_OPEN,
+	JANUS_AUDIOBRIDGE_RECORD_PCM,
+	JANUS_AUDIOBRIDGE_RECORD_RTP,
+	JANUS_AUDIOBRIDGE_RECORD_CLOSE
+} janus_audiobridge_record_action;
+typedef struct janus_audiobridge_record_chunk {
+	janus_audiobridge_room *room;		/* Room this chunk belongs to (we hold a reference) */
+	janus_audiobridge_record_action action;
+	char *data;							/* Audio to write, if any */
+	size_t len, size;
+} janus_audiobridge_record_chunk;
+static GThread *record_thread = NULL;
+static GAsyncQueue *record_queue = NULL;
+static janus_audiobridge_record_chunk record_exit_chunk;
+/* How many frames in a row a participant must not contribute to the mix before we send them the shared one (1s) */
+#define JANUS_AUDIOBRIDGE_SHARED_MIX_DELAY	50
+/* How many frames of PCM we group in a chunk (1s) */
+#define JANUS_AUDIOBRIDGE_RECORD_FRAMES		50
+/* How much audio can wait for the writer, per room, before we start dropping it (4MB) */
+#define JANUS_AUDIOBRIDGE_RECORD_MAX_PENDING	(4*1024*1024)
+static void *janus_audiobridge_record_thread(void *data);
+static void janus_audiobridge_record_thread_stop(void);
+
+/* Metrics: the number of rooms is computed when scraped, while mixers update the others */
+/* Root account for the memory held by rooms */
+static janus_memory_account *audiobridge_memory = NULL;
+static janus_metric *metric_rooms = NULL, *metric_mixes = NULL, *metric_mix_time = NULL,
+	*metric_shared_frames = NULL, *metric_mixer_ticks = NULL, *metric_mixer_overruns = NULL,
+	*metric_mixer_lateness = NULL, *metric_skipped_decodes = NULL, *metric_concealed_frames = NULL,
+	*metric_record_dropped = NULL;
+static gint64 janus_audiobridge_rooms_metric(gpointer data) {
+	janus_mutex_lock(&rooms_mutex);
+	gint64 count = rooms ? g_hash_table_size(rooms) : 0;
+	janus_mutex_unlock(&rooms_mutex);
+	return count;
+}
+/* Metrics are registered before any thread that updates them is launched,
+ * and unregistered only after all those threads have been joined */
+static void janus_audiobridge_metrics_register(void) {
+	metric_rooms = janus_metric_register_callback("janus_audiobridge_rooms", NULL,
+		"AudioBridge rooms", janus_metric_gauge, janus_audiobridge_rooms_metric, NULL);
+	metric_mixes = janus_metric_register("janus_audiobridge_mixes_total", NULL,
+		"Audio frames mixed by all AudioBridge rooms", janus_metric_counter);
+	metric_mix_time = janus_metric_register("janus_audiobridge_mix_time_us_total", NULL,
+		"Time spent mixing and sending audio frames in all AudioBridge rooms, in microseconds", janus_metric_counter);
+	metric_shared_frames = janus_metric_register("janus_audiobridge_shared_frames_total", NULL,
+		"Audio frames sent to participants that didn't need an encoding of their own", janus_metric_counter);
+	metric_mixer_ticks = janus_metric_register("janus_audiobridge_mixer_ticks_total", NULL,
+		"Ticks of the shared AudioBridge mixer threads", janus_metric_counter);
+	metric_mixer_overruns = janus_metric_register("janus_audiobridge_mixer_overruns_total", NULL,
+		"Ticks of the shared AudioBridge mixer threads that took longer than 20ms", janus_metric_counter);
+	metric_mixer_lateness = janus_metric_register("janus_audiobridge_mixer_lateness_us_total", NULL,
+		"How late the shared AudioBridge mixer threads were for their next tick, in microseconds", janus_metric_counter);
+	metric_skipped_decodes = janus_metric_register("janus_audiobridge_skipped_decodes_total", NULL,
+		"Incoming AudioBridge packets that weren't decoded, because silent or DTX", janus_metric_counter);
+	metric_concealed_frames = janus_metric_register("janus_audiobridge_concealed_frames_total", NULL,
+		"Lost AudioBridge packets concealed for the loudest speakers", janus_metric_counter);
+	metric_record_dropped = janus_metric_register("janus_audiobridge_record_dropped_total", NULL,
+		"Chunks of AudioBridge mix recordings dropped because the disk couldn't keep up", janus_metric_counter);
+}
+static void janus_audiobridge_metrics_unregister(void) {
+	janus_metric_unregister(metric_rooms);
+	metric_rooms = NULL;
+	janus_metric_unregister(metric_mixes);
+	metric_mixes = NULL;
+	janus_metric_unregister(metric_mix_time);
+	metric_mix_time = NULL;
+	janus_metric_unregister(metric_shared_frames);
+	metric_shared_frames = NULL;
+	janus_metric_unregister(metric_mixer_ticks);
+	metric_mixer_ticks = NULL;
+	janus_metric_unregister(metric_mixer_overruns);
+	metric_mixer_overruns = NULL;
+	janus_metric_unregister(metric_mixer_lateness);
+	metric_mixer_lateness = NULL;
+	janus_metric_unregister(metric_skipped_decodes);
+	metric_skipped_decodes = NULL;
+	janus_metric_unregister(metric_concealed_frames);
+	metric_concealed_frames = NULL;
+	janus_metric_unregister(metric_record_dropped);
+	metric_record_dropped = NULL;
+}
 static char *admin_key = NULL;
 
 typedef struct janus_audiobridge_session {
@@ -846,6 +1061,124 @@ typedef struct janus_audiobridge_session {
 static GHashTable *sessions;
 static janus_mutex sessions_mutex = JANUS_MUTEX_INITIALIZER;
 
+typedef struct janus_audiobridge_rtp_relay_packet {
+	janus_rtp_header *data;
+	gint length;
+	uint32_t ssrc;
+	uint32_t timestamp;
+	uint16_t seq_number;
+	gboolean silence;
+	gboolean encoded;	/* Whether data is an Opus frame encoded by the mixer (length is then in bytes) */
+	gboolean reset;		/* Whether the encoder of the participant must be reset before encoding this frame */
+} janus_audiobridge_rtp_relay_packet;
+
+/* Queue of audio frames for a participant: frames are all allocated in
+ * advance, and only the pointers move around, so that queueing and
+ * dequeueing frames never allocates anything. Frames that are taken out
+ * of the queue must be given back with janus_audiobridge_ring_put */
+#define JANUS_AUDIOBRIDGE_RING_SIZE		16
+#define JANUS_AUDIOBRIDGE_FRAME_SAMPLES	960		/* 20ms at 48kHz */
+typedef struct janus_audiobridge_ring {
+	janus_audiobridge_rtp_relay_packet frames[JANUS_AUDIOBRIDGE_RING_SIZE];	/* All the frames */
+	janus_audiobridge_rtp_relay_packet *queue[JANUS_AUDIOBRIDGE_RING_SIZE];	/* Queued frames, starting from head */
+	janus_audiobridge_rtp_relay_packet *available[JANUS_AUDIOBRIDGE_RING_SIZE];	/* Frames that can be used */
+	guint head, count, free;
+	opus_int16 *samples;	/* Memory for all the frames */
+} janus_audiobridge_ring;
+
+/* Helper to sort incoming RTP packets by sequence numbers */
+static gint janus_audiobridge_rtp_sort(gconstpointer a, gconstpointer b) {
+	janus_audiobridge_rtp_relay_packet *pkt1 = (janus_audiobridge_rtp_relay_packet *)a;
+	janus_audiobridge_rtp_relay_packet *pkt2 = (janus_audiobridge_rtp_relay_packet *)b;
+	if(pkt1->seq_number < 100 && pkt2->seq_number > 65000) {
+		/* Sequence number was probably reset, pkt2 is older */
+		return 1;
+	} else if(pkt2->seq_number < 100 && pkt1->seq_number > 65000) {
+		/* Sequence number was probably reset, pkt1 is older */
+		return -1;
+	}
+	/* Simply compare timestamps */
+	if(pkt1->seq_number < pkt2->seq_number)
+		return -1;
+	else if(pkt1->seq_number > pkt2->seq_number)
+		return 1;
+	return 0;
+}
+
+/* Ring helpers: they're not thread safe, so the caller must hold the right lock */
+static void janus_audiobridge_ring_init(janus_audiobridge_ring *ring) {
+	ring->samples = g_malloc0(JANUS_AUDIOBRIDGE_RING_SIZE*JANUS_AUDIOBRIDGE_FRAME_SAMPLES*sizeof(opus_int16));
+	int i = 0;
+	for(i=0; i<JANUS_AUDIOBRIDGE_RING_SIZE; i++) {
+		ring->frames[i].data = (janus_rtp_header *)(ring->samples + i*JANUS_AUDIOBRIDGE_FRAME_SAMPLES);
+		ring->available[i] = &ring->frames[i];
+	}
+	ring->head = 0;
+	ring->count = 0;
+	ring->free = JANUS_AUDIOBRIDGE_RING_SIZE;
+}
+
+static void janus_audiobridge_ring_deinit(janus_audiobridge_ring *ring) {
+	g_free(ring->samples);
+	ring->samples = NULL;
+	ring->count = 0;
+	ring->free = 0;
+}
+
+/* Memory the rings of a participant take, which is what we charge rooms for */
+#define JANUS_AUDIOBRIDGE_PARTICIPANT_MEMORY	(2*(sizeof(janus_audiobridge_ring) + \
+	JANUS_AUDIOBRIDGE_RING_SIZE*JANUS_AUDIOBRIDGE_FRAME_SAMPLES*sizeof(opus_int16)))
+
+static janus_audiobridge_rtp_relay_packet *janus_audiobridge_ring_pop(janus_audiobridge_ring *ring) {
+	if(ring->count == 0)
+		return NULL;
+	janus_audiobridge_rtp_relay_packet *pkt = ring->queue[ring->head];
+	ring->head = (ring->head + 1) % JANUS_AUDIOBRIDGE_RING_SIZE;
+	ring->count--;
+	return pkt;
+}
+
+static janus_audiobridge_rtp_relay_packet *janus_audiobridge_ring_peek(janus_audiobridge_ring *ring) {
+	return ring->count ? ring->queue[ring->head] : NULL;
+}
+
+static void janus_audiobridge_ring_put(janus_audiobridge_ring *ring, janus_audiobridge_rtp_relay_packet *pkt) {
+	if(pkt != NULL && ring->free < JANUS_AUDIOBRIDGE_RING_SIZE)
+		ring->available[ring->free++] = pkt;
+}
+
+/* Get a frame to fill: if there's none available, the oldest queued frame is dropped */
+static janus_audiobridge_rtp_relay_packet *janus_audiobridge_ring_get(janus_audiobridge_ring *ring) {
+	if(ring->free == 0)
+		janus_audiobridge_ring_put(ring, janus_audiobridge_ring_pop(ring));
+	if(ring->free == 0)
+		return NULL;
+	return ring->available[--ring->free];
+}
+
+/* Queue a frame, either at the end or sorted by sequence number */
+static void janus_audiobridge_ring_push(janus_audiobridge_ring *ring, janus_audiobridge_rtp_relay_packet *pkt, gboolean sorted) {
+	if(ring->count == JANUS_AUDIOBRIDGE_RING_SIZE) {
+		janus_audiobridge_ring_put(ring, pkt);
+		return;
+	}
+	guint pos = ring->count;
+	if(sorted) {
+		/* Packets are usually in order, so start looking from the end */
+		while(pos > 0 && janus_audiobridge_rtp_sort(ring->queue[(ring->head + pos - 1) % JANUS_AUDIOBRIDGE_RING_SIZE], pkt) > 0) {
+			ring->queue[(ring->head + pos) % JANUS_AUDIOBRIDGE_RING_SIZE] = ring->queue[(ring->head + pos - 1) % JANUS_AUDIOBRIDGE_RING_SIZE];
+			pos--;
+		}
+	}
+	ring->queue[(ring->head + pos) % JANUS_AUDIOBRIDGE_RING_SIZE] = pkt;
+	ring->count++;
+}
+
+static void janus_audiobridge_ring_flush(janus_audiobridge_ring *ring) {
+	while(ring->count > 0)
+		janus_audiobridge_ring_put(ring, janus_audiobridge_ring_pop(ring));
+}
+
 typedef struct janus_audiobridge_participant {
 	janus_audiobridge_session *session;
 	janus_audiobridge_room *room;	/* Room */
@@ -857,39 +1190,56 @@ typedef struct janus_audiobridge_participant {
 	volatile gint decoding;	/* Whether this participant is currently decoding */
 	gboolean muted;			/* Whether this participant is muted */
 	int volume_gain;		/* Gain to apply to the input audio (in percentage) */
+	opus_int16 volume_q8;	/* Same gain, in Q8 fixed point, as used by the mixer */
 	int opus_complexity;	/* Complexity to use in the encoder (by default, DEFAULT_COMPLEXITY) */
 	/* RTP stuff */
-	GList *inbuf;			/* Incoming audio from this participant, as an ordered list of packets */
-	GAsyncQueue *outbuf;	/* Mixed audio for this participant */
+	janus_audiobridge_ring inbuf;	/* Incoming audio from this participant, decoded and ordered by sequence number */
+	janus_audiobridge_ring outbuf;	/* Mixed audio for this participant, waiting to be encoded */
+	janus_memory_account *memory;	/* Account of the room the rings are charged to, if any */
 	gint64 last_drop;		/* When we last dropped a packet because the imcoming queue was full */
+	janus_jitter_estimator jitter;	/* Jitter of the incoming audio, which tells us how much of it we should queue */
+	gboolean mixed;			/* Whether we mixed any frame from this participant since the queue was flushed */
+	guint16 last_mixed_seq;	/* Sequence number of the last frame we mixed */
+	guint unmixed;			/* How many frames in a row we didn't mix from this participant (only used by the mixer) */
+	gboolean shared_mix;	/* Whether the last frame we sent was the shared full mix (only used by the mixer) */
 	janus_mutex qmutex;		/* Incoming queue mutex */
+	janus_mutex omutex;		/* Outgoing queue mutex */
 	int opus_pt;			/* Opus payload type */
 	int extmap_id;			/* Audio level RTP extension id, if any */
 	int dBov_level;			/* Value in dBov of the audio level (last value from extension) */
 	int audio_active_packets;	/* Participant's number of audio packets to accumulate */
 	int audio_dBov_sum;	    /* Participant's accumulated dBov value for audio level */
 	gboolean talking;		/* Whether this participant is currently talking (uses audio levels extension) */
+	int level_average;		/* Moving average of the audio level, to find the loudest speakers */
+	volatile gint conceal;	/* Whether losses should be concealed for this participant (only the loudest speakers) */
+	gboolean voiced;		/* Whether the last frame the mixer got from this participant was voice */
+	int concealed;			/* How many frames in a row the mixer concealed for this participant */
 	janus_rtp_switching_context context;	/* Needed in case the participant changes room */
 	/* Opus stuff */
 	OpusEncoder *encoder;		/* Opus encoder instance */
 	OpusDecoder *decoder;		/* Opus decoder instance */
 	gboolean reset;				/* Whether or not the Opus context must be reset, without re-joining the room */
-	GThread *thread;			/* Encoding thread for this participant */
+	volatile gint scheduled;	/* Whether this participant is queued for (or being served by) an encoding worker */
 	janus_recorder *arc;		/* The Janus recorder instance for this user's audio, if enabled */
 	janus_mutex rec_mutex;		/* Mutex to protect the recorder from race conditions */
 	volatile gint destroyed;	/* Whether this room has been destroyed */
 	janus_refcount ref;			/* Reference counter for this participant */
 } janus_audiobridge_participant;
 
-typedef struct janus_audiobridge_rtp_relay_packet {
-	janus_rtp_header *data;
-	gint length;
-	uint32_t ssrc;
-	uint32_t timestamp;
-	uint16_t seq_number;
-	gboolean silence;
-} janus_audiobridge_rtp_relay_packet;
-
+/* Task for the encoding workers: encode and send all the mixed frames for a participant */
+typedef struct janus_audiobridge_encoder_task {
+	janus_audiobridge_session *session;
+	janus_audiobridge_participant *participant;
+	janus_audiobridge_room *room;
+} janus_audiobridge_encoder_task;
+
+/* CPU time consumed by the calling thread, in microseconds */
+static gint64 janus_audiobridge_thread_cpu_time(void) {
+	struct timespec ts;
+	if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) < 0)
+		return 0;
+	return (ts.tv_sec*G_USEC_PER_SEC) + (ts.tv_nsec/1000);
+}
 
 static void janus_audiobridge_participant_destroy(janus_audiobridge_participant *participant) {
 	if(!participant)
@@ -907,6 +1257,19 @@ static void janus_audiobridge_participant_unref(janus_audiobridge_participant *p
 	janus_refcount_decrease(&participant->ref);
 }
 
+/* Release the memory a participant takes from the room it was charged to, if any */
+static void janus_audiobridge_participant_uncharge(janus_audiobridge_participant *participant) {
+	janus_memory_release(participant->memory, janus_memory_queues, JANUS_AUDIOBRIDGE_PARTICIPANT_MEMORY);
+	janus_memory_account_destroy(participant->memory);
+	participant->memory = NULL;
+}
+
+/* Associate a participant with the room we just charged its memory to */
+static void janus_audiobridge_participant_charged(janus_audiobridge_participant *participant, janus_audiobridge_room *audiobridge) {
+	janus_audiobridge_participant_uncharge(participant);
+	participant->memory = janus_memory_account_ref(audiobridge->memory);
+}
+
 static void janus_audiobridge_participant_free(const janus_refcount *participant_ref) {
 	janus_audiobridge_participant *participant = janus_refcount_containerof(participant_ref, janus_audiobridge_participant, ref);
 	/* This participant can be destroyed, free all the resources */
@@ -915,23 +1278,9 @@ static void janus_audiobridge_participant_free(const janus_refcount *participant
 		opus_encoder_destroy(participant->encoder);
 	if(participant->decoder)
 		opus_decoder_destroy(participant->decoder);
-	while(participant->inbuf) {
-		GList *first = g_list_first(participant->inbuf);
-		janus_audiobridge_rtp_relay_packet *pkt = (janus_audiobridge_rtp_relay_packet *)first->data;
-		participant->inbuf = g_list_remove_link(participant->inbuf, first);
-		if(pkt)
-			g_free(pkt->data);
-		g_free(pkt);
-	}
-	if(participant->outbuf != NULL) {
-		while(g_async_queue_length(participant->outbuf) > 0) {
-			janus_audiobridge_rtp_relay_packet *pkt = g_async_queue_pop(participant->outbuf);
-			if(pkt)
-				g_free(pkt->data);
-			g_free(pkt);
-		}
-		g_async_queue_unref(participant->outbuf);
-	}
+	janus_audiobridge_ring_deinit(&participant->inbuf);
+	janus_audiobridge_ring_deinit(&participant->outbuf);
+	janus_audiobridge_participant_uncharge(participant);
 	g_free(participant);
 }
 
@@ -956,12 +1305,20 @@ static void janus_audiobridge_room_destroy(janus_audiobridge_room *audiobridge)
 		return;
 	if(!g_atomic_int_compare_and_exchange(&audiobridge->destroyed, 0, 1))
 		return;
-	/* Wait for the thread to finish */
-	g_thread_join(audiobridge->thread);
+	/* Wait for the thread to finish (shared mixers will let go of the room on their own) */
+	if(audiobridge->thread != NULL)
+		g_thread_join(audiobridge->thread);
 	/* Decrease the counter */
 	janus_refcount_decrease(&audiobridge->ref);
 }
 
+static void janus_audiobridge_room_memory_init(janus_audiobridge_room *audiobridge) {
+	char name[32];
+	g_snprintf(name, sizeof(name), "room-%"SCNu64, audiobridge->room_id);
+	audiobridge->memory = janus_memory_account_create(name, audiobridge_memory);
+	janus_memory_account_set_limit(audiobridge->memory, audiobridge->memory_cap);
+}
+
 static void janus_audiobridge_room_free(const janus_refcount *audiobridge_ref) {
 	janus_audiobridge_room *audiobridge = janus_refcount_containerof(audiobridge_ref, janus_audiobridge_room, ref);
 	/* This room can be destroyed, free all the resources */
@@ -976,6 +1333,7 @@ static void janus_audiobridge_room_free(const janus_refcount *audiobridge_ref) {
 	if(audiobridge->rtp_encoder)
 		opus_encoder_destroy(audiobridge->rtp_encoder);
 	g_hash_table_destroy(audiobridge->rtp_forwarders);
+	janus_memory_account_destroy(audiobridge->memory);
 	g_free(audiobridge);
 }
 
@@ -1089,25 +1447,6 @@ static guint32 janus_audiobridge_rtp_forwarder_add_helper(janus_audiobridge_room
 }
 
 
-/* Helper to sort incoming RTP packets by sequence numbers */
-static gint janus_audiobridge_rtp_sort(gconstpointer a, gconstpointer b) {
-	janus_audiobridge_rtp_relay_packet *pkt1 = (janus_audiobridge_rtp_relay_packet *)a;
-	janus_audiobridge_rtp_relay_packet *pkt2 = (janus_audiobridge_rtp_relay_packet *)b;
-	if(pkt1->seq_number < 100 && pkt2->seq_number > 65000) {
-		/* Sequence number was probably reset, pkt2 is older */
-		return 1;
-	} else if(pkt2->seq_number < 100 && pkt1->seq_number > 65000) {
-		/* Sequence number was probably reset, pkt1 is older */
-		return -1;
-	}
-	/* Simply compare timestamps */
-	if(pkt1->seq_number < pkt2->seq_number)
-		return -1;
-	else if(pkt1->seq_number > pkt2->seq_number)
-		return 1;
-	return 0;
-}
-
 /* Helper struct to generate and parse WAVE headers */
 typedef struct wav_header {
 	char riff[4];
@@ -1127,13 +1466,238 @@ typedef struct wav_header {
 
 
 /* Mixer settings */
-#define DEFAULT_PREBUFFERING	6
+/* Bounds on how much audio we queue for each participant: within them,
+ * the target follows the jitter we measure on the incoming stream */
+#define JITTER_MIN_DELAY	(2*20000)
+#define JITTER_MAX_DELAY	((JANUS_AUDIOBRIDGE_RING_SIZE/2)*20000)
+
+/* How many frames we should queue for a participant before mixing them,
+ * given the jitter of its stream: we'll drop frames when we get twice as many */
+static guint janus_audiobridge_participant_queue_target(janus_audiobridge_participant *participant) {
+	guint frames = (janus_jitter_estimator_get_target(&participant->jitter) + 19999) / 20000;
+	return CLAMP(frames, 2, JANUS_AUDIOBRIDGE_RING_SIZE/2);
+}
+
+/* Get rid of the frames queued for a participant, and start measuring the jitter again */
+static void janus_audiobridge_participant_flush(janus_audiobridge_participant *participant) {
+	janus_audiobridge_ring_flush(&participant->inbuf);
+	janus_jitter_estimator_reset(&participant->jitter);
+	participant->mixed = FALSE;
+}
+
+/* Get rid of the mixed frames still waiting to be encoded for a participant, e.g., when leaving a room */
+static void janus_audiobridge_participant_flush_out(janus_audiobridge_participant *participant) {
+	janus_mutex_lock(&participant->omutex);
+	janus_audiobridge_ring_flush(&participant->outbuf);
+	janus_mutex_unlock(&participant->omutex);
+}
+
+/* Mixing kernels: gains are applied in Q8 fixed point (256 means 100%),
+ * contributions are summed in 32 bits, and the result is saturated to
+ * 16 bits rather than truncated, so that loud mixes clip instead of
+ * wrapping around. The vectorized versions give the same results as the
+ * scalar ones, which are also used for the trailing samples */
+static opus_int16 janus_audiobridge_gain_q8(int volume) {
+	if(volume <= 0)
+		return 0;
+	if(volume >= (G_MAXINT16*100)/256)
+		return G_MAXINT16;
+	return (volume*256)/100;
+}
+
+static inline opus_int16 janus_audiobridge_saturate(opus_int32 sample) {
+	if(sample > G_MAXINT16)
+		return G_MAXINT16;
+	if(sample < G_MININT16)
+		return G_MININT16;
+	return sample;
+}
+
+/* Add a contribution to the mix (buffer += (samples*gain)>>8) */
+static void janus_audiobridge_mix_add_scalar(opus_int32 *buffer, const opus_int16 *samples, opus_int16 gain, int count) {
+	int i = 0;
+	if(gain == 256) {
+		for(i=0; i<count; i++)
+			buffer[i] += samples[i];
+	} else {
+		for(i=0; i<count; i++)
+			buffer[i] += (samples[i]*gain) >> 8;
+	}
+}
+
+static void janus_audiobridge_mix_add(opus_int32 *buffer, const opus_int16 *samples, opus_int16 gain, int count) {
+	int i = 0;
+#if defined(__AVX2__)
+	__m256i g = _mm256_set1_epi32(gain);
+	for(; i+8<=count; i+=8) {
+		__m256i in = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(samples+i)));
+		in = _mm256_srai_epi32(_mm256_mullo_epi32(in, g), 8);
+		__m256i acc = _mm256_loadu_si256((const __m256i *)(buffer+i));
+		_mm256_storeu_si256((__m256i *)(buffer+i), _mm256_add_epi32(acc, in));
+	}
+#elif defined(__SSE2__)
+	__m128i g = _mm_set1_epi16(gain);
+	for(; i+8<=count; i+=8) {
+		__m128i in = _mm_loadu_si128((const __m128i *)(samples+i));
+		/* Build the 32 bits products out of their low and high halves */
+		__m128i lo = _mm_mullo_epi16(in, g), hi = _mm_mulhi_epi16(in, g);
+		__m128i p0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 8);
+		__m128i p1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 8);
+		__m128i a0 = _mm_loadu_si128((const __m128i *)(buffer+i));
+		__m128i a1 = _mm_loadu_si128((const __m128i *)(buffer+i+4));
+		_mm_storeu_si128((__m128i *)(buffer+i), _mm_add_epi32(a0, p0));
+		_mm_storeu_si128((__m128i *)(buffer+i+4), _mm_add_epi32(a1, p1));
+	}
+#elif defined(__ARM_NEON)
+	for(; i+8<=count; i+=8) {
+		int16x8_t in = vld1q_s16(samples+i);
+		int32x4_t p0 = vshrq_n_s32(vmull_n_s16(vget_low_s16(in), gain), 8);
+		int32x4_t p1 = vshrq_n_s32(vmull_n_s16(vget_high_s16(in), gain), 8);
+		vst1q_s32(buffer+i, vaddq_s32(vld1q_s32(buffer+i), p0));
+		vst1q_s32(buffer+i+4, vaddq_s32(vld1q_s32(buffer+i+4), p1));
+	}
+#endif
+	if(i < count)
+		janus_audiobridge_mix_add_scalar(buffer+i, samples+i, gain, count-i);
+}
+
+/* Remove a contribution from the mix, if any, and saturate the result
+ * to 16 bits (out = saturate(buffer - (samples*gain)>>8)) */
+static void janus_audiobridge_mix_minus_scalar(opus_int16 *out, const opus_int32 *buffer, const opus_int16 *samples, opus_int16 gain, int count) {
+	int i = 0;
+	if(samples == NULL) {
+		for(i=0; i<count; i++)
+			out[i] = janus_audiobridge_saturate(buffer[i]);
+	} else {
+		for(i=0; i<count; i++)
+			out[i] = janus_audiobridge_saturate(buffer[i] - ((samples[i]*gain) >> 8));
+	}
+}
+
+static void janus_audiobridge_mix_minus(opus_int16 *out, const opus_int32 *buffer, const opus_int16 *samples, opus_int16 gain, int count) {
+	int i = 0;
+#if defined(__AVX2__)
+	__m256i g = _mm256_set1_epi32(gain);
+	for(; i+16<=count; i+=16) {
+		__m256i a0 = _mm256_loadu_si256((const __m256i *)(buffer+i));
+		__m256i a1 = _mm256_loadu_si256((const __m256i *)(buffer+i+8));
+		if(samples != NULL) {
+			__m256i in0 = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(samples+i)));
+			__m256i in1 = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(samples+i+8)));
+			a0 = _mm256_sub_epi32(a0, _mm256_srai_epi32(_mm256_mullo_epi32(in0, g), 8));
+			a1 = _mm256_sub_epi32(a1, _mm256_srai_epi32(_mm256_mullo_epi32(in1, g), 8));
+		}
+		/* Packing works within 128 bits lanes, so fix the order afterwards */
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(a0, a1), 0xD8);
+		_mm256_storeu_si256((__m256i *)(out+i), packed);
+	}
+#elif defined(__SSE2__)
+	__m128i g = _mm_set1_epi16(gain);
+	for(; i+8<=count; i+=8) {
+		__m128i a0 = _mm_loadu_si128((const __m128i *)(buffer+i));
+		__m128i a1 = _mm_loadu_si128((const __m128i *)(buffer+i+4));
+		if(samples != NULL) {
+			__m128i in = _mm_loadu_si128((const __m128i *)(samples+i));
+			__m128i lo = _mm_mullo_epi16(in, g), hi = _mm_mulhi_epi16(in, g);
+			a0 = _mm_sub_epi32(a0, _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 8));
+			a1 = _mm_sub_epi32(a1, _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 8));
+		}
+		_mm_storeu_si128((__m128i *)(out+i), _mm_packs_epi32(a0, a1));
+	}
+#elif defined(__ARM_NEON)
+	for(; i+8<=count; i+=8) {
+		int32x4_t a0 = vld1q_s32(buffer+i);
+		int32x4_t a1 = vld1q_s32(buffer+i+4);
+		if(samples != NULL) {
+			int16x8_t in = vld1q_s16(samples+i);
+			a0 = vsubq_s32(a0, vshrq_n_s32(vmull_n_s16(vget_low_s16(in), gain), 8));
+			a1 = vsubq_s32(a1, vshrq_n_s32(vmull_n_s16(vget_high_s16(in), gain), 8));
+		}
+		vst1q_s16(out+i, vcombine_s16(vqmovn_s32(a0), vqmovn_s32(a1)));
+	}
+#endif
+	if(i < count)
+		janus_audiobridge_mix_minus_scalar(out+i, buffer+i, samples ? samples+i : NULL, gain, count-i);
+}
+
+#if defined(__AVX2__)
+#define JANUS_AUDIOBRIDGE_MIX_KERNEL	"AVX2"
+#elif defined(__SSE2__)
+#define JANUS_AUDIOBRIDGE_MIX_KERNEL	"SSE2"
+#elif defined(__ARM_NEON)
+#define JANUS_AUDIOBRIDGE_MIX_KERNEL	"NEON"
+#else
+#define JANUS_AUDIOBRIDGE_MIX_KERNEL	"scalar"
+#endif
+
+/* Measure how long mixing a frame takes, with the kernels we have and with
+ * the scalar ones, for a few room sizes (enabled by "benchmark" in the
+ * configuration file): the audio is random, and gains are set so that
+ * both the unity gain and the generic paths are exercised */
+static void janus_audiobridge_mixer_benchmark(int rounds) {
+	int rates[] = { 16000, 48000 };
+	int sizes[] = { 10, 50, 200 };
+	JANUS_LOG(LOG_INFO, "Benchmarking the AudioBridge mixer (%s, %d rounds)...\n", JANUS_AUDIOBRIDGE_MIX_KERNEL, rounds);
+	opus_int32 buffer[960];
+	opus_int16 out[960], check[960];
+	int r = 0, z = 0, i = 0, j = 0, n = 0;
+	for(r=0; r<2; r++) {
+		int samples = rates[r]/50;
+		for(z=0; z<3; z++) {
+			int participants = sizes[z];
+			opus_int16 *audio = g_malloc(participants*samples*sizeof(opus_int16));
+			opus_int16 *gains = g_malloc(participants*sizeof(opus_int16));
+			for(i=0; i<participants*samples; i++)
+				audio[i] = (g_random_int() & 0xFFFF) >> 3;
+			for(i=0; i<participants; i++)
+				gains[i] = janus_audiobridge_gain_q8((i % 2) ? 100 : 75);
+			gint64 elapsed[2] = { 0, 0 };
+			gboolean match = TRUE;
+			for(j=0; j<2; j++) {
+				gint64 start = janus_get_monotonic_time();
+				for(n=0; n<rounds; n++) {
+					memset(buffer, 0, samples*sizeof(opus_int32));
+					for(i=0; i<participants; i++) {
+						if(j == 0)
+							janus_audiobridge_mix_add(buffer, audio+i*samples, gains[i], samples);
+						else
+							janus_audiobridge_mix_add_scalar(buffer, audio+i*samples, gains[i], samples);
+					}
+					for(i=0; i<participants; i++) {
+						if(j == 0)
+							janus_audiobridge_mix_minus(out, buffer, audio+i*samples, gains[i], samples);
+						else
+							janus_audiobridge_mix_minus_scalar(out, buffer, audio+i*samples, gains[i], samples);
+					}
+				}
+				elapsed[j] = janus_get_monotonic_time() - start;
+				if(j == 0) {
+					/* Keep the last mix-minus frame, to compare it with the scalar one */
+					memcpy(check, out, samples*sizeof(opus_int16));
+				} else if(memcmp(check, out, samples*sizeof(opus_int16))) {
+					match = FALSE;
+				}
+			}
+			JANUS_LOG(match ? LOG_INFO : LOG_WARN, "  -- %d participants at %d Hz: %.2f us per frame (scalar: %.2f us)%s\n",
+				participants, rates[r], (double)elapsed[0]/rounds, (double)elapsed[1]/rounds,
+				match ? "" : ", results don't match!");
+			g_free(audio);
+			g_free(gains);
+		}
+	}
+}
 
 
 /* Opus settings */		
 #define	BUFFER_SAMPLES	8000
 #define	OPUS_SAMPLES	160
 #define USE_FEC			0
+/* Opus packets this small are DTX (or comfort noise), there's nothing to decode */
+#define DTX_MAX_SIZE	2
+/* How many frames in a row can be concealed, before we assume it's not a loss */
+#define MAX_CONCEALED	3
+static janus_audiobridge_rtp_relay_packet *janus_audiobridge_conceal(janus_audiobridge_participant *p,
+	int samples, guint16 seq_number, gboolean sorted);
 #define DEFAULT_COMPLEXITY	4
 
 
@@ -1153,6 +1717,8 @@ typedef struct wav_header {
 #define JANUS_AUDIOBRIDGE_ERROR_ALREADY_JOINED	491
 #define JANUS_AUDIOBRIDGE_ERROR_NO_SUCH_USER	492
 #define JANUS_AUDIOBRIDGE_ERROR_INVALID_SDP		493
+#define JANUS_AUDIOBRIDGE_ERROR_MEMORY_CAP		494
+#define JANUS_AUDIOBRIDGE_ERROR_OVERLOADED		495
 
 static int janus_audiobridge_create_udp_socket_if_needed(janus_audiobridge_room *audiobridge) {
 	if(audiobridge->rtp_udp_sock > 0) {
@@ -1290,6 +1856,8 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 		return -1;
 	}
 
+	audiobridge_memory = janus_memory_account_create(JANUS_AUDIOBRIDGE_PACKAGE, NULL);
+
 	/* Read configuration */
 	char filename[255];
 	g_snprintf(filename, 255, "%s/%s.cfg", config_path, JANUS_AUDIOBRIDGE_PACKAGE);
@@ -1304,6 +1872,45 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 	messages = g_async_queue_new_full((GDestroyNotify) janus_audiobridge_message_free);
 	/* This is the callback we'll need to invoke to contact the gateway */
 	gateway = callback;
+	janus_audiobridge_metrics_register();
+
+	/* Mixed frames are encoded by a pool of workers, rather than by a thread per participant */
+	int workers = g_get_num_processors();
+	if(config != NULL) {
+		janus_config_item *item = janus_config_get_item_drilldown(config, "general", "encoding_workers");
+		if(item != NULL && item->value != NULL) {
+			if(atoi(item->value) > 0)
+				workers = atoi(item->value);
+			else
+				JANUS_LOG(LOG_WARN, "Invalid encoding_workers value provided, using default: %d\n", workers);
+		}
+	}
+	GError *enc_error = NULL;
+	encoders = g_thread_pool_new(janus_audiobridge_encoding_task, NULL, workers, FALSE, &enc_error);
+	if(enc_error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the AudioBridge encoding workers...\n", enc_error->code, enc_error->message ? enc_error->message : "??");
+		g_error_free(enc_error);
+		janus_audiobridge_metrics_unregister();
+		janus_config_destroy(config);
+		return -1;
+	}
+	JANUS_LOG(LOG_VERB, "Using %d workers for encoding\n", workers);
+
+	/* Recordings of the mix are written by a thread of their own */
+	GError *rec_error = NULL;
+	record_queue = g_async_queue_new();
+	record_thread = g_thread_try_new("audiobridge rec", janus_audiobridge_record_thread, NULL, &rec_error);
+	if(rec_error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the AudioBridge recording thread...\n", rec_error->code, rec_error->message ? rec_error->message : "??");
+		g_error_free(rec_error);
+		g_async_queue_unref(record_queue);
+		record_queue = NULL;
+		g_thread_pool_free(encoders, FALSE, TRUE);
+		encoders = NULL;
+		janus_audiobridge_metrics_unregister();
+		janus_config_destroy(config);
+		return -1;
+	}
 
 	/* Parse configuration to populate the rooms list */
 	if(config != NULL) {
@@ -1317,6 +1924,50 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 		if(!notify_events && callback->events_is_enabled()) {
 			JANUS_LOG(LOG_WARN, "Notification of events to handlers disabled for %s\n", JANUS_AUDIOBRIDGE_NAME);
 		}
+		janus_config_item *benchmark = janus_config_get_item_drilldown(config, "general", "benchmark");
+		if(benchmark != NULL && benchmark->value != NULL && atoi(benchmark->value) > 0)
+			janus_audiobridge_mixer_benchmark(atoi(benchmark->value));
+		janus_config_item *threads = janus_config_get_item_drilldown(config, "general", "mixer_threads");
+		if(threads != NULL && threads->value != NULL) {
+			if(atoi(threads->value) >= 0)
+				mixers_count = atoi(threads->value);
+			else
+				JANUS_LOG(LOG_WARN, "Invalid mixer_threads value provided, using a thread per room\n");
+		}
+		if(mixers_count > 0) {
+			/* Rooms will be mixed by a few shared threads, rather than a thread each */
+			mixers = g_malloc0(mixers_count * sizeof(janus_audiobridge_mixer_worker));
+			mixers_epoch = janus_get_monotonic_time();
+			int i = 0;
+			for(i=0; i<mixers_count; i++) {
+				mixers[i].id = i;
+				janus_mutex_init(&mixers[i].mutex);
+				GError *error = NULL;
+				char tname[16];
+				g_snprintf(tname, sizeof(tname), "mixer pool %d", i);
+				mixers[i].thread = g_thread_try_new(tname, &janus_audiobridge_mixer_worker_thread, &mixers[i], &error);
+				if(error != NULL) {
+					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the AudioBridge mixer threads...\n", error->code, error->message ? error->message : "??");
+					g_error_free(error);
+					g_atomic_int_set(&stopping, 1);
+					for(i=0; i<mixers_count; i++) {
+						if(mixers[i].thread != NULL)
+							g_thread_join(mixers[i].thread);
+					}
+					g_free(mixers);
+					mixers = NULL;
+					mixers_count = 0;
+					janus_audiobridge_record_thread_stop();
+					g_thread_pool_free(encoders, FALSE, TRUE);
+					encoders = NULL;
+					g_atomic_int_set(&stopping, 0);
+					janus_audiobridge_metrics_unregister();
+					janus_config_destroy(config);
+					return -1;
+				}
+			}
+			JANUS_LOG(LOG_VERB, "Using %d shared threads for mixing\n", mixers_count);
+		}
 		/* Iterate on all rooms */
 		GList *cl = janus_config_get_categories(config);
 		while(cl != NULL) {
@@ -1333,10 +1984,14 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 			janus_config_item *audiolevel_event = janus_config_get_item(cat, "audiolevel_event");
 			janus_config_item *audio_active_packets = janus_config_get_item(cat, "audio_active_packets");
 			janus_config_item *audio_level_average = janus_config_get_item(cat, "audio_level_average");
+			janus_config_item *silence_threshold = janus_config_get_item(cat, "silence_threshold");
+			janus_config_item *plc_speakers = janus_config_get_item(cat, "plc_speakers");
+			janus_config_item *memcap = janus_config_get_item(cat, "memory_cap");
 			janus_config_item *secret = janus_config_get_item(cat, "secret");
 			janus_config_item *pin = janus_config_get_item(cat, "pin");
 			janus_config_item *record = janus_config_get_item(cat, "record");
 			janus_config_item *recfile = janus_config_get_item(cat, "record_file");
+			janus_config_item *recformat = janus_config_get_item(cat, "record_format");
 			if(sampling == NULL || sampling->value == NULL) {
 				JANUS_LOG(LOG_ERR, "Can't add the audio room, missing mandatory information...\n");
 				cl = cl->next;
@@ -1390,6 +2045,26 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 					}
 				}
 			}
+			audiobridge->silence_threshold = 127;
+			if(silence_threshold != NULL && silence_threshold->value != NULL) {
+				if(atoi(silence_threshold->value) > 0 && atoi(silence_threshold->value) <= 127) {
+					audiobridge->silence_threshold = atoi(silence_threshold->value);
+				} else {
+					JANUS_LOG(LOG_WARN, "Invalid silence_threshold value provided, using default: %d\n", audiobridge->silence_threshold);
+				}
+			}
+			audiobridge->plc_speakers = 3;
+			if(plc_speakers != NULL && plc_speakers->value != NULL) {
+				if(atoi(plc_speakers->value) >= 0) {
+					audiobridge->plc_speakers = atoi(plc_speakers->value);
+				} else {
+					JANUS_LOG(LOG_WARN, "Invalid plc_speakers value provided, using default: %d\n", audiobridge->plc_speakers);
+				}
+			}
+			audiobridge->memory_cap = 0;
+			if(memcap != NULL && memcap->value != NULL && g_ascii_strtoll(memcap->value, NULL, 10) > 0)
+				audiobridge->memory_cap = g_ascii_strtoll(memcap->value, NULL, 10);
+			janus_audiobridge_room_memory_init(audiobridge);
 
 			if(secret != NULL && secret->value != NULL) {
 				audiobridge->room_secret = g_strdup(secret->value);
@@ -1402,6 +2077,7 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 				audiobridge->record = TRUE;
 			if(recfile && recfile->value)
 				audiobridge->record_file = g_strdup(recfile->value);
+			audiobridge->record_opus = recformat && recformat->value && !strcasecmp(recformat->value, "opus");
 			audiobridge->recording = NULL;
 			audiobridge->destroy = 0;
 			audiobridge->participants = g_hash_table_new_full(g_int64_hash, g_int64_equal,
@@ -1427,13 +2103,9 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 
 			/* We need a thread for the mix */
 			GError *error = NULL;
-			char tname[16];
-			g_snprintf(tname, sizeof(tname), "mixer %"SCNu64, audiobridge->room_id);
-			janus_refcount_increase(&audiobridge->ref);
-			audiobridge->thread = g_thread_try_new(tname, &janus_audiobridge_mixer_thread, audiobridge, &error);
+			janus_audiobridge_mixer_launch(audiobridge, &error);
 			if(error != NULL) {
 				/* FIXME We should clear some resources... */
-				janus_refcount_decrease(&audiobridge->ref);
 				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the mixer thread...\n", error->code, error->message ? error->message : "??");
 			} else {
 				janus_mutex_lock(&rooms_mutex);
@@ -1463,9 +2135,10 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 	GError *error = NULL;
 	handler_thread = g_thread_try_new("audiobridge handler", janus_audiobridge_handler, NULL, &error);
 	if(error != NULL) {
-		g_atomic_int_set(&initialized, 0);
 		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the AudioBridge handler thread...\n", error->code, error->message ? error->message : "??");
-		janus_config_destroy(config);
+		g_error_free(error);
+		/* Rooms are mixed, and possibly recorded, already: tear everything down */
+		janus_audiobridge_destroy();
 		return -1;
 	}
 	JANUS_LOG(LOG_INFO, "%s initialized!\n", JANUS_AUDIOBRIDGE_NAME);
@@ -1488,13 +2161,32 @@ void janus_audiobridge_destroy(void) {
 	janus_mutex_unlock(&sessions_mutex);
 	janus_mutex_lock(&rooms_mutex);
 	g_hash_table_destroy(rooms);
+	rooms = NULL;
 	janus_mutex_unlock(&rooms_mutex);
+	/* Wait for the shared mixers, if any, to let go of the rooms */
+	int i = 0;
+	for(i=0; i<mixers_count; i++) {
+		if(mixers[i].thread != NULL)
+			g_thread_join(mixers[i].thread);
+	}
+	g_free(mixers);
+	mixers = NULL;
+	mixers_count = 0;
+	/* Mixers are all done, wait for the recordings of the mix to be complete */
+	janus_audiobridge_record_thread_stop();
+	/* Wait for the encoding workers to be done with what's left */
+	g_thread_pool_free(encoders, FALSE, TRUE);
+	encoders = NULL;
+	/* Mixers are gone, we can get rid of the metrics */
+	janus_audiobridge_metrics_unregister();
 	g_async_queue_unref(messages);
 	messages = NULL;
 	sessions = NULL;
 
 	janus_config_destroy(config);
 	g_free(admin_key);
+	janus_memory_account_destroy(audiobridge_memory);
+	audiobridge_memory = NULL;
 
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
@@ -1594,6 +2286,40 @@ static void janus_audiobridge_notify_participants(janus_audiobridge_participant
 	}
 }
 
+/* How close mixers are to their limits since the last time we were asked:
+ * the core only calls this once a second, from a single thread. Shared
+ * mixers have a 20ms budget for each tick, for all the rooms they mix,
+ * while rooms with a mixer of their own have a 20ms budget each, but all
+ * those threads compete for the same CPUs, which is what we look at then */
+static int janus_audiobridge_get_load(void) {
+	static gint64 last_when = 0, last_time = 0, last_ticks = 0, last_overruns = 0;
+	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
+		return 0;
+	gint64 now = janus_get_monotonic_time();
+	gint64 mix_time = janus_metric_get(metric_mix_time),
+		ticks = janus_metric_get(metric_mixer_ticks), overruns = janus_metric_get(metric_mixer_overruns);
+	gint64 d_when = last_when ? now - last_when : 0, d_time = mix_time - last_time,
+		d_ticks = ticks - last_ticks, d_overruns = overruns - last_overruns;
+	last_when = now;
+	last_time = mix_time;
+	last_ticks = ticks;
+	last_overruns = overruns;
+	int load = 0;
+	if(mixers_count > 0) {
+		if(d_ticks <= 0)
+			return 0;
+		load = (int)((d_time*100)/(d_ticks*20000));
+		/* Missing deadlines is worse than being close to them: a 10% of late ticks is as bad as it gets */
+		if((d_overruns*1000)/d_ticks > load)
+			load = (int)((d_overruns*1000)/d_ticks);
+	} else {
+		if(d_when <= 0)
+			return 0;
+		load = (int)((d_time*100)/(d_when*g_get_num_processors()));
+	}
+	return load > 100 ? 100 : load;
+}
+
 json_t *janus_audiobridge_query_session(janus_plugin_session *handle) {
 	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized)) {
 		return NULL;
@@ -1614,8 +2340,16 @@ json_t *janus_audiobridge_query_session(janus_plugin_session *handle) {
 	if(participant) {
 		janus_mutex_lock(&rooms_mutex);
 		janus_audiobridge_room *room = participant->room;
-		if(room != NULL)
+		if(room != NULL) {
 			json_object_set_new(info, "room", json_integer(room->room_id));
+			/* CPU time spent by the room so far, mixing and encoding */
+			json_t *cpu = json_object();
+			janus_mutex_lock(&room->mutex);
+			json_object_set_new(cpu, "mixing", json_integer(room->mixing_time));
+			json_object_set_new(cpu, "encoding", json_integer(room->encoding_time));
+			janus_mutex_unlock(&room->mutex);
+			json_object_set_new(info, "room-cpu-time", cpu);
+		}
 		janus_mutex_unlock(&rooms_mutex);
 		json_object_set_new(info, "id", json_integer(participant->user_id));
 		if(participant->display)
@@ -1623,13 +2357,14 @@ json_t *janus_audiobridge_query_session(janus_plugin_session *handle) {
 		json_object_set_new(info, "muted", participant->muted ? json_true() : json_false());
 		json_object_set_new(info, "active", g_atomic_int_get(&participant->active) ? json_true() : json_false());
 		json_object_set_new(info, "pre-buffering", participant->prebuffering ? json_true() : json_false());
-		if(participant->inbuf) {
-			janus_mutex_lock(&participant->qmutex);
-			json_object_set_new(info, "queue-in", json_integer(g_list_length(participant->inbuf)));
-			janus_mutex_unlock(&participant->qmutex);
-		}
-		if(participant->outbuf)
-			json_object_set_new(info, "queue-out", json_integer(g_async_queue_length(participant->outbuf)));
+		janus_mutex_lock(&participant->qmutex);
+		json_object_set_new(info, "queue-in", json_integer(participant->inbuf.count));
+		json_object_set_new(info, "queue-target", json_integer(janus_audiobridge_participant_queue_target(participant)));
+		json_object_set_new(info, "jitter", janus_jitter_estimator_stats(&participant->jitter));
+		janus_mutex_unlock(&participant->qmutex);
+		janus_mutex_lock(&participant->omutex);
+		json_object_set_new(info, "queue-out", json_integer(participant->outbuf.count));
+		janus_mutex_unlock(&participant->omutex);
 		if(participant->last_drop > 0)
 			json_object_set_new(info, "last-drop", json_integer(participant->last_drop));
 		if(participant->arc && participant->arc->filename)
@@ -1725,8 +2460,12 @@ struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_sessio
 		json_t *audiolevel_event = json_object_get(root, "audiolevel_event");
 		json_t *audio_active_packets = json_object_get(root, "audio_active_packets");
 		json_t *audio_level_average = json_object_get(root, "audio_level_average");
+		json_t *silence_threshold = json_object_get(root, "silence_threshold");
+		json_t *plc_speakers = json_object_get(root, "plc_speakers");
+		json_t *memcap = json_object_get(root, "memory_cap");
 		json_t *record = json_object_get(root, "record");
 		json_t *recfile = json_object_get(root, "record_file");
+		json_t *recformat = json_object_get(root, "record_format");
 		json_t *permanent = json_object_get(root, "permanent");
 		if(allowed) {
 			/* Make sure the "allowed" array only contains strings */
@@ -1820,6 +2559,17 @@ struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_sessio
 				JANUS_LOG(LOG_WARN, "Invalid audio_level_average value provided, using default: %d\n", audiobridge->audio_level_average);
 			}
 		}
+		audiobridge->silence_threshold = 127;
+		if(silence_threshold) {
+			if(json_integer_value(silence_threshold) > 0 && json_integer_value(silence_threshold) <= 127) {
+				audiobridge->silence_threshold = json_integer_value(silence_threshold);
+			} else {
+				JANUS_LOG(LOG_WARN, "Invalid silence_threshold value provided, using default: %d\n", audiobridge->silence_threshold);
+			}
+		}
+		audiobridge->plc_speakers = plc_speakers ? json_integer_value(plc_speakers) : 3;
+		audiobridge->memory_cap = memcap ? json_integer_value(memcap) : 0;
+		janus_audiobridge_room_memory_init(audiobridge);
 		switch(audiobridge->sampling_rate) {
 			case 8000:
 			case 12000:
@@ -1840,6 +2590,10 @@ struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_sessio
 			audiobridge->record = TRUE;
 		if(recfile)
 			audiobridge->record_file = g_strdup(json_string_value(recfile));
+		if(recformat && strcasecmp(json_string_value(recformat), "wav") && strcasecmp(json_string_value(recformat), "opus")) {
+			JANUS_LOG(LOG_WARN, "Unsupported record_format %s, recording as WAV\n", json_string_value(recformat));
+		}
+		audiobridge->record_opus = recformat && !strcasecmp(json_string_value(recformat), "opus");
 		audiobridge->recording = NULL;
 		audiobridge->destroy = 0;
 		audiobridge->participants = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, NULL);
@@ -1871,15 +2625,11 @@ struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_sessio
 			audiobridge->room_pin ? audiobridge->room_pin : "no pin");
 		/* We need a thread for the mix */
 		GError *error = NULL;
-		char tname[16];
-		g_snprintf(tname, sizeof(tname), "mixer %"SCNu64, audiobridge->room_id);
-		janus_refcount_increase(&audiobridge->ref);
-		audiobridge->thread = g_thread_try_new(tname, &janus_audiobridge_mixer_thread, audiobridge, &error);
+		janus_audiobridge_mixer_launch(audiobridge, &error);
 		if(error != NULL) {
 			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the mixer thread...\n", error->code, error->message ? error->message : "??");
 			error_code = JANUS_AUDIOBRIDGE_ERROR_UNKNOWN_ERROR;
 			g_snprintf(error_cause, 512, "Got error %d (%s) trying to launch the mixer thread", error->code, error->message ? error->message : "??");
-			janus_refcount_decrease(&audiobridge->ref);
 			g_hash_table_remove(rooms, &audiobridge->room_id);
 			janus_mutex_unlock(&rooms_mutex);
 			goto plugin_response;
@@ -1916,10 +2666,20 @@ struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_sessio
 					janus_config_add_item(config, cat, "audio_level_average", value);
 				}
 			}
+			g_snprintf(value, BUFSIZ, "%d", audiobridge->silence_threshold);
+			janus_config_add_item(config, cat, "silence_threshold", value);
+			g_snprintf(value, BUFSIZ, "%d", audiobridge->plc_speakers);
+			janus_config_add_item(config, cat, "plc_speakers", value);
+			if(audiobridge->memory_cap) {
+				g_snprintf(value, BUFSIZ, "%"SCNi64, audiobridge->memory_cap);
+				janus_config_add_item(config, cat, "memory_cap", value);
+			}
 			if(audiobridge->record_file) {
 				janus_config_add_item(config, cat, "record", "yes");
 				janus_config_add_item(config, cat, "record_file", audiobridge->record_file);
 			}
+			if(audiobridge->record_opus)
+				janus_config_add_item(config, cat, "record_format", "opus");
 			/* Save modified configuration */
 			if(janus_config_save(config, config_folder, JANUS_AUDIOBRIDGE_PACKAGE) < 0)
 				save = FALSE;	/* This will notify the user the room is not permanent */
@@ -2025,6 +2785,8 @@ struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_sessio
 				janus_config_add_item(config, cat, "record", "yes");
 				janus_config_add_item(config, cat, "record_file", audiobridge->record_file);
 			}
+			if(audiobridge->record_opus)
+				janus_config_add_item(config, cat, "record_format", "opus");
 			/* Save modified configuration */
 			if(janus_config_save(config, config_folder, JANUS_AUDIOBRIDGE_PACKAGE) < 0)
 				save = FALSE;	/* This will notify the user the room changes are not permanent */
@@ -2120,18 +2882,7 @@ struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_sessio
 				/* Get rid of queued packets */
 				janus_mutex_lock(&p->qmutex);
 				g_atomic_int_set(&p->active, 0);
-				while(p->inbuf) {
-					GList *first = g_list_first(p->inbuf);
-					janus_audiobridge_rtp_relay_packet *pkt = (janus_audiobridge_rtp_relay_packet *)first->data;
-					p->inbuf = g_list_remove_link(p->inbuf, first);
-					first = NULL;
-					if(pkt == NULL)
-						continue;
-					g_free(pkt->data);
-					pkt->data = NULL;
-					g_free(pkt);
-					pkt = NULL;
-				}
+				janus_audiobridge_participant_flush(p);
 				janus_mutex_unlock(&p->qmutex);
 				/* Request a WebRTC hangup */
 				gateway->close_pc(p->session->handle);
@@ -2182,6 +2933,13 @@ struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_sessio
 			json_object_set_new(rl, "pin_required", room->room_pin ? json_true() : json_false());
 			json_object_set_new(rl, "record", room->record ? json_true() : json_false());
 			json_object_set_new(rl, "num_participants", json_integer(g_hash_table_size(room->participants)));
+			/* The mixer updates these counters while holding the room mutex */
+			janus_mutex_lock(&room->mutex);
+			guint64 frames_sent = room->frames_sent, frames_shared = room->frames_shared;
+			janus_mutex_unlock(&room->mutex);
+			json_object_set_new(rl, "frames_shared", json_integer(frames_shared));
+			json_object_set_new(rl, "sharing_ratio", json_real(frames_sent ?
+				(double)frames_shared/frames_sent : 0.0));
 			json_array_append_new(list, rl);
 			janus_refcount_decrease(&room->ref);
 		}
@@ -2744,6 +3502,17 @@ void janus_audiobridge_setup_media(janus_plugin_session *handle) {
 }
 
 void janus_audiobridge_incoming_rtp(janus_plugin_session *handle, int video, char *buf, int len) {
+	janus_audiobridge_incoming_rtp_internal(handle, video, buf, len, NULL);
+}
+
+void janus_audiobridge_incoming_rtp_packet(janus_plugin_session *handle, janus_plugin_rtp_packet *packet) {
+	if(packet == NULL)
+		return;
+	/* The core already parsed the RTP extensions for us */
+	janus_audiobridge_incoming_rtp_internal(handle, packet->video, packet->buffer, packet->length, &packet->extensions);
+}
+
+static void janus_audiobridge_incoming_rtp_internal(janus_plugin_session *handle, int video, char *buf, int len, janus_rtp_ext_info *extensions) {
 	if(handle == NULL || g_atomic_int_get(&handle->stopped) || g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
 		return;
 	janus_audiobridge_session *session = (janus_audiobridge_session *)handle->plugin_handle;
@@ -2770,23 +3539,28 @@ void janus_audiobridge_incoming_rtp(janus_plugin_session *handle, int video, cha
 			}
 			participant->reset = FALSE;
 		}
-		/* Decode frame (Opus -> slinear) */
+		/* Decode frame (Opus -> slinear): we do it on the stack, and then copy
+		 * the frame we'll actually mix to one of those of the incoming queue */
 		janus_rtp_header *rtp = (janus_rtp_header *)buf;
-		janus_audiobridge_rtp_relay_packet *pkt = g_malloc(sizeof(janus_audiobridge_rtp_relay_packet));
-		pkt->data = g_malloc0(BUFFER_SAMPLES*sizeof(opus_int16));
+		opus_int16 decoded[BUFFER_SAMPLES];
+		janus_audiobridge_rtp_relay_packet frame, *pkt = &frame;
+		pkt->data = (janus_rtp_header *)decoded;
 		pkt->ssrc = 0;
 		pkt->timestamp = ntohl(rtp->timestamp);
 		pkt->seq_number = ntohs(rtp->seq_number);
 		/* We might check the audio level extension to see if this is silence */
 		pkt->silence = FALSE;
+		pkt->encoded = FALSE;
 		pkt->length = 0;
 
 		if(participant->extmap_id > 0) {
 			/* Check the audio levels, in case we need to notify participants about who's talking */
 			int level = 0;
-			if(janus_rtp_header_extension_parse_audio_level(buf, len, participant->extmap_id, &level) == 0) {
-				/* Is this silence? */
-				pkt->silence = (level == 127);
+			if((extensions ? janus_rtp_ext_info_audio_level(extensions, buf, participant->extmap_id, &level) :
+					janus_rtp_header_extension_parse_audio_level(buf, len, participant->extmap_id, &level)) == 0) {
+				/* Is this silence (or quiet enough we can treat it as such)? */
+				pkt->silence = (level >= participant->room->silence_threshold);
+				participant->level_average = (participant->level_average*7 + level)/8;
 				if(participant->room->audiolevel_event) {
 					/* We also need to detect who's talking: update our monitoring stuff */
 					participant->audio_dBov_sum += level;
@@ -2831,63 +3605,108 @@ void janus_audiobridge_incoming_rtp(janus_plugin_session *handle, int video, cha
 				}
 			}
 		}
-		if(!g_atomic_int_compare_and_exchange(&participant->decoding, 0, 1)) {
-			/* This means we're cleaning up, so don't try to decode */
-			g_free(pkt->data);
-			g_free(pkt);
-			return;
-		}
 		int plen = 0;
 		const unsigned char *payload = (const unsigned char *)janus_rtp_payload(buf, len, &plen);
 		if(!payload) {
-			g_atomic_int_set(&participant->decoding, 0);
 			JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error accessing the RTP payload\n");
-			g_free(pkt->data);
-			g_free(pkt);
 			return;
 		}
-		pkt->length = opus_decode(participant->decoder, payload, plen, (opus_int16 *)pkt->data, BUFFER_SAMPLES, USE_FEC);
-		g_atomic_int_set(&participant->decoding, 0);
-		if(pkt->length < 0) {
-			JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error decoding the Opus frame: %d (%s)\n", pkt->length, opus_strerror(pkt->length));
-			g_free(pkt->data);
-			g_free(pkt);
+		if(plen <= DTX_MAX_SIZE)
+			pkt->silence = TRUE;
+		/* Keep track of the jitter, and check if this frame is still useful */
+		janus_mutex_lock(&participant->qmutex);
+		gboolean in_order = participant->jitter.started;
+		guint16 prev_seq = participant->jitter.last_seq;
+		if(janus_jitter_estimator_update(&participant->jitter, pkt->seq_number, pkt->timestamp, janus_get_monotonic_time()) > 0) {
+			/* Duplicate */
+			janus_mutex_unlock(&participant->qmutex);
 			return;
 		}
+		if(participant->mixed) {
+			gint16 diff = (gint16)(pkt->seq_number - participant->last_mixed_seq);
+			if(diff <= 0 && diff > -1000) {
+				/* We mixed the frames that follow this one already, it's too late for it */
+				janus_jitter_estimator_late(&participant->jitter);
+				janus_mutex_unlock(&participant->qmutex);
+				return;
+			}
+		}
+		gint16 gap = in_order ? (gint16)(pkt->seq_number - prev_seq) - 1 : 0;
+		if(gap > 0 && gap <= MAX_CONCEALED && participant->voiced && g_atomic_int_get(&participant->conceal)) {
+			/* We lost something from one of the loudest speakers: conceal it now,
+			 * before decoding this frame, so that the decoder state follows the
+			 * stream, unless the mixer already concealed those frames itself */
+			int samples = participant->room->sampling_rate/50;
+			guint16 seq = prev_seq;
+			while(gap-- > 0) {
+				seq++;
+				if(participant->mixed && (gint16)(seq - participant->last_mixed_seq) <= 0)
+					continue;
+				if(janus_audiobridge_conceal(participant, samples, seq, TRUE) == NULL)
+					break;
+			}
+		}
+		janus_mutex_unlock(&participant->qmutex);
+		if(pkt->silence) {
+			/* Nothing to mix, so don't waste time decoding this: we still
+			 * queue an empty frame, though, to keep track of the timing */
+			janus_metric_inc(metric_skipped_decodes);
+		} else {
+			if(!g_atomic_int_compare_and_exchange(&participant->decoding, 0, 1)) {
+				/* This means we're cleaning up, so don't try to decode */
+				return;
+			}
+			pkt->length = opus_decode(participant->decoder, payload, plen, (opus_int16 *)pkt->data, BUFFER_SAMPLES, USE_FEC);
+			g_atomic_int_set(&participant->decoding, 0);
+			if(pkt->length < 0) {
+				JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error decoding the Opus frame: %d (%s)\n", pkt->length, opus_strerror(pkt->length));
+				return;
+			}
+		}
 		/* Enqueue the decoded frame */
 		janus_mutex_lock(&participant->qmutex);
+		janus_audiobridge_rtp_relay_packet *queued = janus_audiobridge_ring_get(&participant->inbuf);
+		if(queued == NULL) {
+			janus_mutex_unlock(&participant->qmutex);
+			return;
+		}
+		/* The mixer never uses more than 20ms of audio from each frame */
+		int samples = MIN(pkt->length, JANUS_AUDIOBRIDGE_FRAME_SAMPLES);
+		if(!pkt->silence) {
+			memcpy(queued->data, decoded, samples*sizeof(opus_int16));
+			if(samples < JANUS_AUDIOBRIDGE_FRAME_SAMPLES)
+				memset((opus_int16 *)queued->data + samples, 0, (JANUS_AUDIOBRIDGE_FRAME_SAMPLES-samples)*sizeof(opus_int16));
+		}
+		queued->length = samples;
+		queued->ssrc = pkt->ssrc;
+		queued->timestamp = pkt->timestamp;
+		queued->seq_number = pkt->seq_number;
+		queued->silence = pkt->silence;
+		queued->encoded = FALSE;
 		/* Insert packets sorting by sequence number */
-		participant->inbuf = g_list_insert_sorted(participant->inbuf, pkt, &janus_audiobridge_rtp_sort);
+		janus_audiobridge_ring_push(&participant->inbuf, queued, TRUE);
+		/* How much we queue depends on the jitter we're measuring */
+		guint target = janus_audiobridge_participant_queue_target(participant);
 		if(participant->prebuffering) {
 			/* Still pre-buffering: do we have enough packets now? */
-			if(g_list_length(participant->inbuf) == DEFAULT_PREBUFFERING) {
+			if(participant->inbuf.count >= target) {
 				participant->prebuffering = FALSE;
 				JANUS_LOG(LOG_VERB, "Prebuffering done! Finally adding the user to the mix\n");
 			} else {
-				JANUS_LOG(LOG_VERB, "Still prebuffering (got %d packets), not adding the user to the mix yet\n", g_list_length(participant->inbuf));
+				JANUS_LOG(LOG_VERB, "Still prebuffering (got %u packets), not adding the user to the mix yet\n", participant->inbuf.count);
 			}
 		} else {
 			/* Make sure we're not queueing too many packets: if so, get rid of the older ones */
-			if(g_list_length(participant->inbuf) >= DEFAULT_PREBUFFERING*2) {
+			if(participant->inbuf.count >= target*2) {
 				gint64 now = janus_get_monotonic_time();
 				if(now - participant->last_drop > 5*G_USEC_PER_SEC) {
-					JANUS_LOG(LOG_VERB, "Too many packets in queue (%d > %d), removing older ones\n",
-						g_list_length(participant->inbuf), DEFAULT_PREBUFFERING*2);
+					JANUS_LOG(LOG_VERB, "Too many packets in queue (%u > %u), removing older ones\n",
+						participant->inbuf.count, target*2);
 					participant->last_drop = now;
 				}
-				while(g_list_length(participant->inbuf) > DEFAULT_PREBUFFERING*2) {
-					/* Remove this packet: it's too old */
-					GList *first = g_list_first(participant->inbuf);
-					janus_audiobridge_rtp_relay_packet *pkt = (janus_audiobridge_rtp_relay_packet *)first->data;
-					participant->inbuf = g_list_remove_link(participant->inbuf, first);
-					first = NULL;
-					if(pkt == NULL)
-						continue;
-					g_free(pkt->data);
-					pkt->data = NULL;
-					g_free(pkt);
-					pkt = NULL;
-				}
+				/* Remove the packets that are too old */
+				while(participant->inbuf.count > target*2)
+					janus_audiobridge_ring_put(&participant->inbuf, janus_audiobridge_ring_pop(&participant->inbuf));
 			}
 		}
 		janus_mutex_unlock(&participant->qmutex);
@@ -2946,6 +3765,7 @@ static void janus_audiobridge_hangup_media_internal(janus_plugin_session *handle
 		json_object_set_new(event, "room", json_integer(audiobridge->room_id));
 		json_object_set_new(event, "leaving", json_integer(participant->user_id));
 		removed = g_hash_table_remove(audiobridge->participants, &participant->user_id);
+		audiobridge->participants_version++;
 		GHashTableIter iter;
 		gpointer value;
 		g_hash_table_iter_init(&iter, audiobridge->participants);
@@ -2997,21 +3817,14 @@ static void janus_audiobridge_hangup_media_internal(janus_plugin_session *handle
 	participant->audio_active_packets = 0;
 	participant->audio_dBov_sum = 0;
 	participant->talking = FALSE;
+	participant->level_average = 127;
+	participant->voiced = FALSE;
+	participant->concealed = 0;
 	/* Get rid of queued packets */
-	while(participant->inbuf) {
-		GList *first = g_list_first(participant->inbuf);
-		janus_audiobridge_rtp_relay_packet *pkt = (janus_audiobridge_rtp_relay_packet *)first->data;
-		participant->inbuf = g_list_remove_link(participant->inbuf, first);
-		first = NULL;
-		if(pkt == NULL)
-			continue;
-		g_free(pkt->data);
-		pkt->data = NULL;
-		g_free(pkt);
-		pkt = NULL;
-	}
+	janus_audiobridge_participant_flush(participant);
 	participant->last_drop = 0;
 	janus_mutex_unlock(&participant->qmutex);
+	janus_audiobridge_participant_flush_out(participant);
 	if(audiobridge != NULL) {
 		janus_mutex_unlock(&audiobridge->mutex);
 		if(removed) {
@@ -3086,6 +3899,12 @@ static void *janus_audiobridge_handler(void *data) {
 				JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT);
 			if(error_code != 0)
 				goto error;
+			if(!gateway->admission_check(&janus_audiobridge_plugin)) {
+				JANUS_LOG(LOG_WARN, "Too loaded to accept new participants\n");
+				error_code = JANUS_AUDIOBRIDGE_ERROR_OVERLOADED;
+				g_snprintf(error_cause, 512, "Too loaded to accept new participants");
+				goto error;
+			}
 			json_t *room = json_object_get(root, "room");
 			guint64 room_id = json_integer_value(room);
 			janus_mutex_lock(&rooms_mutex);
@@ -3161,32 +3980,44 @@ static void *janus_audiobridge_handler(void *data) {
 				}
 			}
 			JANUS_LOG(LOG_VERB, "  -- Participant ID: %"SCNu64"\n", user_id);
+			/* Make sure the room can afford the buffers of a new participant */
+			if(!janus_memory_try_charge(audiobridge->memory, janus_memory_queues, JANUS_AUDIOBRIDGE_PARTICIPANT_MEMORY)) {
+				janus_mutex_unlock(&audiobridge->mutex);
+				janus_refcount_decrease(&audiobridge->ref);
+				JANUS_LOG(LOG_ERR, "Memory cap of room %"SCNu64" reached, can't add participant\n", audiobridge->room_id);
+				error_code = JANUS_AUDIOBRIDGE_ERROR_MEMORY_CAP;
+				g_snprintf(error_cause, 512, "Memory cap of room %"SCNu64" reached", audiobridge->room_id);
+				goto error;
+			}
 			if(participant == NULL) {
 				participant = g_malloc0(sizeof(janus_audiobridge_participant));
 				janus_refcount_init(&participant->ref, janus_audiobridge_participant_free);
 				g_atomic_int_set(&participant->active, 0);
 				participant->prebuffering = TRUE;
 				participant->display = NULL;
-				participant->inbuf = NULL;
-				participant->outbuf = NULL;
+				janus_audiobridge_ring_init(&participant->inbuf);
+				janus_audiobridge_ring_init(&participant->outbuf);
+				janus_jitter_estimator_init(&participant->jitter, 48000, JITTER_MIN_DELAY, JITTER_MAX_DELAY);
 				participant->last_drop = 0;
 				participant->encoder = NULL;
 				participant->decoder = NULL;
 				participant->reset = FALSE;
+				participant->level_average = 127;
 				janus_mutex_init(&participant->qmutex);
+				janus_mutex_init(&participant->omutex);
 				participant->arc = NULL;
 				janus_mutex_init(&participant->rec_mutex);
 			}
 			participant->session = session;
 			participant->room = audiobridge;
 			participant->user_id = user_id;
+			janus_audiobridge_participant_charged(participant, audiobridge);
 			g_free(participant->display);
 			participant->display = display_text ? g_strdup(display_text) : NULL;
 			participant->muted = muted ? json_is_true(muted) : FALSE;	/* By default, everyone's unmuted when joining */
 			participant->volume_gain = volume;
+			participant->volume_q8 = janus_audiobridge_gain_q8(volume);
 			participant->opus_complexity = complexity;
-			if(participant->outbuf == NULL)
-				participant->outbuf = g_async_queue_new();
 			g_atomic_int_set(&participant->active, g_atomic_int_get(&session->started));
 			if(!g_atomic_int_get(&session->started)) {
 				/* Initialize the RTP context only if we're renegotiating */
@@ -3205,6 +4036,9 @@ static void *janus_audiobridge_handler(void *data) {
 					janus_mutex_unlock(&audiobridge->mutex);
 					janus_refcount_decrease(&audiobridge->ref);
 					g_free(participant->display);
+					janus_audiobridge_ring_deinit(&participant->inbuf);
+					janus_audiobridge_ring_deinit(&participant->outbuf);
+					janus_audiobridge_participant_uncharge(participant);
 					g_free(participant);
 					JANUS_LOG(LOG_ERR, "Error creating Opus encoder\n");
 					error_code = JANUS_AUDIOBRIDGE_ERROR_LIBOPUS_ERROR;
@@ -3244,6 +4078,9 @@ static void *janus_audiobridge_handler(void *data) {
 					if(participant->decoder)
 						opus_decoder_destroy(participant->decoder);
 					participant->decoder = NULL;
+					janus_audiobridge_ring_deinit(&participant->inbuf);
+					janus_audiobridge_ring_deinit(&participant->outbuf);
+					janus_audiobridge_participant_uncharge(participant);
 					g_free(participant);
 					JANUS_LOG(LOG_ERR, "Error creating Opus encoder\n");
 					error_code = JANUS_AUDIOBRIDGE_ERROR_LIBOPUS_ERROR;
@@ -3252,29 +4089,17 @@ static void *janus_audiobridge_handler(void *data) {
 				}
 			}
 			participant->reset = FALSE;
-			/* Finally, start the encoding thread if it hasn't already */
-			if(participant->thread == NULL) {
-				GError *error = NULL;
-				char roomtrunc[5], parttrunc[5];
-				g_snprintf(roomtrunc, sizeof(roomtrunc), "%"SCNu64, audiobridge->room_id);
-				g_snprintf(parttrunc, sizeof(parttrunc), "%"SCNu64, participant->user_id);
-				char tname[16];
-				g_snprintf(tname, sizeof(tname), "mixer %s %s", roomtrunc, parttrunc);
-				janus_refcount_increase(&session->ref);
-				janus_refcount_increase(&participant->ref);
-				participant->thread = g_thread_try_new(tname, &janus_audiobridge_participant_thread, participant, &error);
-				if(error != NULL) {
-					janus_refcount_decrease(&participant->ref);
-					janus_refcount_decrease(&session->ref);
-					/* FIXME We should fail here... */
-					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the participant thread...\n", error->code, error->message ? error->message : "??");
-				}
-			}
+			/* Mixed frames will be encoded by the workers, scheduled by the mixer */
 			
 			/* Done */
 			session->participant = participant;
 			janus_refcount_increase(&participant->ref);
+			/* Keep the participants of the same room on the same NUMA node */
+			char group[64];
+			g_snprintf(group, sizeof(group), "audiobridge-%"SCNu64, audiobridge->room_id);
+			gateway->set_affinity_group(session->handle, group);
 			g_hash_table_insert(audiobridge->participants, janus_uint64_dup(participant->user_id), participant);
+			audiobridge->participants_version++;
 			/* Notify the other participants */
 			json_t *newuser = json_object();
 			json_object_set_new(newuser, "audiobridge", json_string("joined"));
@@ -3359,8 +4184,10 @@ static void *janus_audiobridge_handler(void *data) {
 			json_t *recfile = json_object_get(root, "filename");
 			json_t *display = json_object_get(root, "display");
 			json_t *update = json_object_get(root, "update");
-			if(gain)
+			if(gain) {
 				participant->volume_gain = json_integer_value(gain);
+				participant->volume_q8 = janus_audiobridge_gain_q8(participant->volume_gain);
+			}
 			if(quality) {
 				int complexity = json_integer_value(quality);
 				if(complexity < 1 || complexity > 10) {
@@ -3380,19 +4207,7 @@ static void *janus_audiobridge_handler(void *data) {
 					if(participant->muted) {
 						/* Clear the queued packets waiting to be handled */
 						janus_mutex_lock(&participant->qmutex);
-						while(participant->inbuf) {
-							GList *first = g_list_first(participant->inbuf);
-							janus_audiobridge_rtp_relay_packet *pkt = (janus_audiobridge_rtp_relay_packet *)first->data;
-							participant->inbuf = g_list_remove_link(participant->inbuf, first);
-							first = NULL;
-							if(pkt == NULL)
-								continue;
-							if(pkt->data)
-								g_free(pkt->data);
-							pkt->data = NULL;
-							g_free(pkt);
-							pkt = NULL;
-						}
+						janus_audiobridge_participant_flush(participant);
 						janus_mutex_unlock(&participant->qmutex);
 					}
 				}
@@ -3510,6 +4325,13 @@ static void *janus_audiobridge_handler(void *data) {
 				JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT);
 			if(error_code != 0)
 				goto error;
+			/* Moving to another room is the same as joining it, as far as the mixers are concerned */
+			if(!gateway->admission_check(&janus_audiobridge_plugin)) {
+				JANUS_LOG(LOG_WARN, "Too loaded to accept new participants\n");
+				error_code = JANUS_AUDIOBRIDGE_ERROR_OVERLOADED;
+				g_snprintf(error_cause, 512, "Too loaded to accept new participants");
+				goto error;
+			}
 			json_t *room = json_object_get(root, "room");
 			guint64 room_id = json_integer_value(room);
 			janus_mutex_lock(&rooms_mutex);
@@ -3596,6 +4418,16 @@ static void *janus_audiobridge_handler(void *data) {
 				}
 			}
 			JANUS_LOG(LOG_VERB, "  -- Participant ID in new room %"SCNu64": %"SCNu64"\n", room_id, user_id);
+			/* Make sure the new room can afford our buffers */
+			if(!janus_memory_try_charge(audiobridge->memory, janus_memory_queues, JANUS_AUDIOBRIDGE_PARTICIPANT_MEMORY)) {
+				janus_mutex_unlock(&audiobridge->mutex);
+				janus_refcount_decrease(&audiobridge->ref);
+				janus_mutex_unlock(&rooms_mutex);
+				JANUS_LOG(LOG_ERR, "Memory cap of room %"SCNu64" reached, can't add participant\n", audiobridge->room_id);
+				error_code = JANUS_AUDIOBRIDGE_ERROR_MEMORY_CAP;
+				g_snprintf(error_cause, 512, "Memory cap of room %"SCNu64" reached", audiobridge->room_id);
+				goto error;
+			}
 			participant->prebuffering = TRUE;
 			participant->audio_active_packets = 0;
 			participant->audio_dBov_sum = 0;
@@ -3605,11 +4437,13 @@ static void *janus_audiobridge_handler(void *data) {
 			/* Leave the old room first... */
 			janus_mutex_lock(&old_audiobridge->mutex);
 			g_hash_table_remove(old_audiobridge->participants, &participant->user_id);
+			old_audiobridge->participants_version++;
 			if(old_audiobridge->sampling_rate != audiobridge->sampling_rate) {
 				/* Create a new one that takes into account the sampling rate we want now */
 				int error = 0;
 				OpusEncoder *new_encoder = opus_encoder_create(audiobridge->sampling_rate, 1, OPUS_APPLICATION_VOIP, &error);
 				if(error != OPUS_OK) {
+					janus_memory_release(audiobridge->memory, janus_memory_queues, JANUS_AUDIOBRIDGE_PARTICIPANT_MEMORY);
 					janus_refcount_decrease(&audiobridge->ref);
 					if(new_encoder)
 						opus_encoder_destroy(new_encoder);
@@ -3619,6 +4453,7 @@ static void *janus_audiobridge_handler(void *data) {
 					g_snprintf(error_cause, 512, "Error creating Opus decoder");
 					/* Join the old room again... */
 					g_hash_table_insert(audiobridge->participants, janus_uint64_dup(participant->user_id), participant);
+					audiobridge->participants_version++;
 					janus_mutex_unlock(&old_audiobridge->mutex);
 					janus_mutex_unlock(&audiobridge->mutex);
 					janus_mutex_unlock(&rooms_mutex);
@@ -3646,6 +4481,7 @@ static void *janus_audiobridge_handler(void *data) {
 				error = 0;
 				OpusDecoder *new_decoder = opus_decoder_create(audiobridge->sampling_rate, 1, &error);
 				if(error != OPUS_OK) {
+					janus_memory_release(audiobridge->memory, janus_memory_queues, JANUS_AUDIOBRIDGE_PARTICIPANT_MEMORY);
 					janus_refcount_decrease(&audiobridge->ref);
 					if(new_encoder)
 						opus_encoder_destroy(new_encoder);
@@ -3658,6 +4494,7 @@ static void *janus_audiobridge_handler(void *data) {
 					g_snprintf(error_cause, 512, "Error creating Opus decoder");
 					/* Join the old room again... */
 					g_hash_table_insert(audiobridge->participants, janus_uint64_dup(participant->user_id), participant);
+					audiobridge->participants_version++;
 					janus_mutex_unlock(&old_audiobridge->mutex);
 					janus_mutex_unlock(&audiobridge->mutex);
 					janus_mutex_unlock(&rooms_mutex);
@@ -3700,6 +4537,8 @@ static void *janus_audiobridge_handler(void *data) {
 				gateway->notify_event(&janus_audiobridge_plugin, session->handle, info);
 			}
 			janus_mutex_unlock(&old_audiobridge->mutex);
+			/* What the old room mixed for us and wasn't sent yet is of no use anymore */
+			janus_audiobridge_participant_flush_out(participant);
 			/* Stop recording, if we were (since this is a new room, a new recording would be required, so a new configure) */
 			janus_mutex_lock(&participant->rec_mutex);
 			janus_audiobridge_recorder_close(participant);
@@ -3710,17 +4549,20 @@ static void *janus_audiobridge_handler(void *data) {
 			g_free(participant->display);
 			participant->display = display_text ? g_strdup(display_text) : NULL;
 			participant->room = audiobridge;
+			janus_audiobridge_participant_charged(participant, audiobridge);
 			participant->muted = muted ? json_is_true(muted) : FALSE;	/* When switching to a new room, you're unmuted by default */
 			participant->audio_active_packets = 0;
 			participant->audio_dBov_sum = 0;
 			participant->talking = FALSE;
 			participant->volume_gain = volume;
+			participant->volume_q8 = janus_audiobridge_gain_q8(volume);
 			if(quality) {
 				participant->opus_complexity = complexity;
 				if(participant->encoder)
 					opus_encoder_ctl(participant->encoder, OPUS_SET_COMPLEXITY(participant->opus_complexity));
 			}
 			g_hash_table_insert(audiobridge->participants, janus_uint64_dup(participant->user_id), participant);
+			audiobridge->participants_version++;
 			/* Notify the other participants */
 			json_t *newuser = json_object();
 			json_object_set_new(newuser, "audiobridge", json_string("joined"));
@@ -3815,25 +4657,16 @@ static void *janus_audiobridge_handler(void *data) {
 				json_decref(event);
 				/* Actually leave the room... */
 				removed = g_hash_table_remove(audiobridge->participants, &participant->user_id);
+				audiobridge->participants_version++;
 				participant->room = NULL;
 			}
 			/* Get rid of queued packets */
 			janus_mutex_lock(&participant->qmutex);
 			g_atomic_int_set(&participant->active, 0);
 			participant->prebuffering = TRUE;
-			while(participant->inbuf) {
-				GList *first = g_list_first(participant->inbuf);
-				janus_audiobridge_rtp_relay_packet *pkt = (janus_audiobridge_rtp_relay_packet *)first->data;
-				participant->inbuf = g_list_remove_link(participant->inbuf, first);
-				first = NULL;
-				if(pkt == NULL)
-					continue;
-				g_free(pkt->data);
-				pkt->data = NULL;
-				g_free(pkt);
-				pkt = NULL;
-			}
+			janus_audiobridge_participant_flush(participant);
 			janus_mutex_unlock(&participant->qmutex);
+			janus_audiobridge_participant_flush_out(participant);
 			/* Stop recording, if we were */
 			janus_mutex_lock(&participant->rec_mutex);
 			janus_audiobridge_recorder_close(participant);
@@ -3882,7 +4715,7 @@ static void *janus_audiobridge_handler(void *data) {
 			/* Prepare an SDP answer */
 			const char *type = "answer";
 			char error_str[512];
-			janus_sdp *offer = janus_sdp_parse(msg_sdp, error_str, sizeof(error_str));
+			janus_sdp *offer = janus_sdp_parse_transient(msg_sdp, error_str, sizeof(error_str));
 			if(offer == NULL) {
 				json_decref(event);
 				JANUS_LOG(LOG_ERR, "Error parsing offer: %s\n", error_str);
@@ -3934,7 +4767,7 @@ static void *janus_audiobridge_handler(void *data) {
 				JANUS_SDP_OA_DATA, FALSE,
 				JANUS_SDP_OA_DONE);
 			/* Replace the session name */
-			g_free(answer->s_name);
+			janus_sdp_arena_free_string(answer->arena, answer->s_name);
 			char s_name[100];
 			g_snprintf(s_name, sizeof(s_name), "AudioBridge %"SCNu64, participant->room->room_id);
 			answer->s_name = g_strdup(s_name);
@@ -4012,157 +4845,152 @@ error:
 	return NULL;
 }
 
-/* Thread to mix the contributions from all participants */
-static void *janus_audiobridge_mixer_thread(void *data) {
-	JANUS_LOG(LOG_VERB, "Audio bridge thread starting...\n");
-	janus_audiobridge_room *audiobridge = (janus_audiobridge_room *)data;
-	if(!audiobridge) {
-		JANUS_LOG(LOG_ERR, "Invalid room!\n");
-		return NULL;
-	}
-	JANUS_LOG(LOG_VERB, "Thread is for mixing room %"SCNu64" (%s) at rate %"SCNu32"...\n", audiobridge->room_id, audiobridge->room_name, audiobridge->sampling_rate);
+/* Helper to hand a participant to the encoding workers, unless it's been already */
+static void janus_audiobridge_schedule_encoding(janus_audiobridge_room *audiobridge, janus_audiobridge_participant *participant) {
+	if(!g_atomic_int_compare_and_exchange(&participant->scheduled, 0, 1))
+		return;
+	janus_audiobridge_encoder_task *task = g_malloc(sizeof(janus_audiobridge_encoder_task));
+	janus_refcount_increase(&participant->session->ref);
+	task->session = participant->session;
+	janus_refcount_increase(&participant->ref);
+	task->participant = participant;
+	janus_refcount_increase(&audiobridge->ref);
+	task->room = audiobridge;
+	g_thread_pool_push(encoders, task, NULL);
+}
 
-	/* Do we need to record the mix? */
-	if(audiobridge->record) {
-		char filename[255];
-		if(audiobridge->record_file) {
-			g_snprintf(filename, 255, "%s", audiobridge->record_file);
-		} else {
-			g_snprintf(filename, 255, "janus-audioroom-%"SCNu64".wav", audiobridge->room_id);
-		}
-		audiobridge->recording = fopen(filename, "wb");
-		if(audiobridge->recording == NULL) {
-			JANUS_LOG(LOG_WARN, "Recording requested, but could NOT open file %s for writing...\n", filename);
-		} else {
-			JANUS_LOG(LOG_VERB, "Recording requested, opened file %s for writing\n", filename);
-			/* Write WAV header */
-			wav_header header = {
-				{'R', 'I', 'F', 'F'},
-				0,
-				{'W', 'A', 'V', 'E'},
-				{'f', 'm', 't', ' '},
-				16,
-				1,
-				1,
-				audiobridge->sampling_rate,
-				audiobridge->sampling_rate * 2,
-				2,
-				16,
-				{'d', 'a', 't', 'a'},
-				0
-			};
-			if(fwrite(&header, 1, sizeof(header), audiobridge->recording) != sizeof(header)) {
-				JANUS_LOG(LOG_ERR, "Error writing WAV header...\n");
-			}
-			fflush(audiobridge->recording);
-			audiobridge->record_lastupdate = janus_get_monotonic_time();
-		}
+/* Helper to encode the full mix, for all the participants that get it and
+ * for the RTP forwarders, which is why we use the forwarders encoder */
+static opus_int32 janus_audiobridge_encode_mix(janus_audiobridge_room *audiobridge,
+		opus_int32 *buffer, opus_int16 *outBuffer, int samples, unsigned char *payload) {
+	opus_int32 length = -1;
+	janus_audiobridge_mix_minus(outBuffer, buffer, NULL, 0, samples);
+	janus_mutex_lock(&audiobridge->rtp_mutex);
+	if(janus_audiobridge_create_opus_encoder_if_needed(audiobridge) == 0) {
+		length = opus_encode(audiobridge->rtp_encoder, outBuffer, samples, payload, 1500-12);
+		if(length < 0)
+			JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error encoding the Opus frame: %d (%s)\n", length, opus_strerror(length));
 	}
+	janus_mutex_unlock(&audiobridge->rtp_mutex);
+	return length;
+}
 
-	/* Buffer (we allocate assuming 48kHz, although we'll likely use less than that) */
-	int samples = audiobridge->sampling_rate/50;
-	opus_int32 buffer[960], sumBuffer[960];
-	opus_int16 outBuffer[960], *curBuffer = NULL;
-	memset(buffer, 0, 960*4);
-	memset(sumBuffer, 0, 960*4);
-	memset(outBuffer, 0, 960*2);
+/* State of the mixer of a room, whether it has a thread of its own or not */
+typedef struct janus_audiobridge_mixer {
+	int samples;				/* Samples per frame, in each 20ms tick */
+	opus_int32 buffer[960];		/* Buffer for the mix (we allocate assuming 48kHz, although we'll likely use less than that) */
+	opus_int16 outBuffer[960];	/* Buffer for the mix, as 16 bits samples */
+	unsigned char *rtpbuffer;	/* Base RTP packet, in case there are forwarders involved */
+	gint16 seq;					/* RTP sequence number */
+	gint32 ts;					/* RTP timestamp */
+	int prev_count;				/* Participants and forwarders in the previous tick */
+	GPtrArray *participants;	/* Participants we're mixing, which we only update when somebody joins or leaves */
+	guint participants_version;	/* Version of the room participants the array refers to */
+	guint ticks;				/* How many frames we mixed so far */
+	GArray *speakers;			/* Snapshot of the levels of the participants, to pick the loudest speakers */
+	struct janus_audiobridge_record_chunk *record_chunk;	/* Mixed audio not handed to the recording writer yet */
+} janus_audiobridge_mixer;
+
+static janus_audiobridge_record_chunk *janus_audiobridge_record_chunk_new(janus_audiobridge_room *audiobridge,
+		janus_audiobridge_record_action action, size_t size) {
+	janus_audiobridge_record_chunk *chunk = g_malloc0(sizeof(janus_audiobridge_record_chunk));
+	janus_refcount_increase(&audiobridge->ref);
+	chunk->room = audiobridge;
+	chunk->action = action;
+	chunk->data = size ? g_malloc(size) : NULL;
+	chunk->size = size;
+	return chunk;
+}
 
-	/* Base RTP packet, in case there are forwarders involved */
-	unsigned char *rtpbuffer = g_malloc0(1500);
-	janus_rtp_header *rtph = (janus_rtp_header *)rtpbuffer;
-	rtph->version = 2;
+static void janus_audiobridge_record_chunk_free(janus_audiobridge_record_chunk *chunk) {
+	janus_refcount_decrease(&chunk->room->ref);
+	g_free(chunk->data);
+	g_free(chunk);
+}
 
-	/* Timer */
-	struct timeval now, before;
-	gettimeofday(&before, NULL);
-	now.tv_sec = before.tv_sec;
-	now.tv_usec = before.tv_usec;
-	time_t passed, d_s, d_us;
+static void janus_audiobridge_record_enqueue(janus_audiobridge_record_chunk *chunk) {
+	janus_audiobridge_room *audiobridge = chunk->room;
+	if(chunk->len > 0 && g_atomic_int_get(&audiobridge->record_pending) + chunk->len > JANUS_AUDIOBRIDGE_RECORD_MAX_PENDING) {
+		/* The disk can't keep up, better lose some of the recording than stall */
+		JANUS_LOG_RATELIMITED(LOG_WARN, "Recording of room %"SCNu64" is falling behind, dropping audio\n", audiobridge->room_id);
+		janus_metric_inc(metric_record_dropped);
+		janus_audiobridge_record_chunk_free(chunk);
+		return;
+	}
+	g_atomic_int_add(&audiobridge->record_pending, chunk->len);
+	g_async_queue_push(record_queue, chunk);
+}
 
-	/* RTP */
-	gint16 seq = 0;
-	gint32 ts = 0;
+/* Wait for the recordings of the mix to be written, and get rid of the writer */
+static void janus_audiobridge_record_thread_stop(void) {
+	if(record_thread == NULL)
+		return;
+	g_async_queue_push(record_queue, &record_exit_chunk);
+	g_thread_join(record_thread);
+	record_thread = NULL;
+	g_async_queue_unref(record_queue);
+	record_queue = NULL;
+}
 
-	/* Loop */
-	int i=0;
-	int count = 0, rf_count = 0, prev_count = 0;
-	while(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&audiobridge->destroyed)) {
-		/* See if it's time to prepare a frame */
-		gettimeofday(&now, NULL);
-		d_s = now.tv_sec - before.tv_sec;
-		d_us = now.tv_usec - before.tv_usec;
-		if(d_us < 0) {
-			d_us += 1000000;
-			--d_s;
-		}
-		passed = d_s*1000000 + d_us;
-		if(passed < 15000) {	/* Let's wait about 15ms at max */
-			g_usleep(5000);
-			continue;
-		}
-		/* Update the reference time */
-		before.tv_usec += 20000;
-		if(before.tv_usec > 1000000) {
-			before.tv_sec++;
-			before.tv_usec -= 1000000;
-		}
-		/* Do we need to mix at all? */
-		janus_mutex_lock_nodebug(&audiobridge->mutex);
-		count = g_hash_table_size(audiobridge->participants);
-		rf_count = g_hash_table_size(audiobridge->rtp_forwarders);
-		janus_mutex_unlock_nodebug(&audiobridge->mutex);
-		if((count+rf_count) == 0) {
-			/* No participant and RTP forwarders, do nothing */
-			if(prev_count > 0) {
-				JANUS_LOG(LOG_VERB, "Last user/forwarder just left room %"SCNu64", going idle...\n", audiobridge->room_id);
-				prev_count = 0;
+/* Thread writing the recordings of the mix, so that a slow disk never stalls the mixers */
+static void *janus_audiobridge_record_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining AudioBridge recording thread\n");
+	janus_audiobridge_record_chunk *chunk = NULL;
+	while(TRUE) {
+		chunk = g_async_queue_pop(record_queue);
+		if(chunk == &record_exit_chunk)
+			break;
+		janus_audiobridge_room *audiobridge = chunk->room;
+		if(chunk->action == JANUS_AUDIOBRIDGE_RECORD_OPEN && audiobridge->record_opus) {
+			char filename[255];
+			if(audiobridge->record_file) {
+				g_snprintf(filename, 255, "%s", audiobridge->record_file);
+			} else {
+				g_snprintf(filename, 255, "janus-audioroom-%"SCNu64, audiobridge->room_id);
 			}
-			continue;
-		}
-		if(prev_count == 0) {
-			JANUS_LOG(LOG_VERB, "First user/forwarder just joined room %"SCNu64", waking it up...\n", audiobridge->room_id);
-		}
-		prev_count = count+rf_count;
-		/* Update RTP header information */
-		seq++;
-		ts += 960;
-		/* Mix all contributions */
-		janus_mutex_lock_nodebug(&audiobridge->mutex);
-		GList *participants_list = g_hash_table_get_values(audiobridge->participants);
-		janus_mutex_unlock_nodebug(&audiobridge->mutex);
-		for(i=0; i<samples; i++)
-			buffer[i] = 0;
-		GList *ps = participants_list;
-		while(ps) {
-			janus_audiobridge_participant *p = (janus_audiobridge_participant *)ps->data;
-			janus_mutex_lock(&p->qmutex);
-			if(!p->session || !g_atomic_int_get(&p->session->started) || !g_atomic_int_get(&p->active) || p->muted || p->prebuffering || !p->inbuf) {
-				janus_mutex_unlock(&p->qmutex);
-				ps = ps->next;
-				continue;
+			audiobridge->mix_recorder = janus_recorder_create(NULL, "opus", filename);
+			if(audiobridge->mix_recorder == NULL) {
+				JANUS_LOG(LOG_WARN, "Recording requested, but could NOT open file %s for writing...\n", filename);
+			} else {
+				JANUS_LOG(LOG_VERB, "Recording requested, opened file %s for writing\n", audiobridge->mix_recorder->filename);
 			}
-			GList *peek = g_list_first(p->inbuf);
-			janus_audiobridge_rtp_relay_packet *pkt = (janus_audiobridge_rtp_relay_packet *)(peek ? peek->data : NULL);
-			if(pkt != NULL && !pkt->silence) {
-				curBuffer = (opus_int16 *)pkt->data;
-				for(i=0; i<samples; i++) {
-					if(p->volume_gain == 100) {
-						buffer[i] += curBuffer[i];
-					} else {
-						buffer[i] += (curBuffer[i]*p->volume_gain)/100;
-					}
-				}
+		} else if(chunk->action == JANUS_AUDIOBRIDGE_RECORD_OPEN) {
+			char filename[255];
+			if(audiobridge->record_file) {
+				g_snprintf(filename, 255, "%s", audiobridge->record_file);
+			} else {
+				g_snprintf(filename, 255, "janus-audioroom-%"SCNu64".wav", audiobridge->room_id);
 			}
-			janus_mutex_unlock(&p->qmutex);
-			ps = ps->next;
-		}
-		/* Are we recording the mix? (only do it if there's someone in, though...) */
-		if(audiobridge->recording != NULL && g_list_length(participants_list) > 0) {
-			for(i=0; i<samples; i++) {
-				/* FIXME Smoothen/Normalize instead of truncating? */
-				outBuffer[i] = buffer[i];
+			audiobridge->recording = fopen(filename, "wb");
+			if(audiobridge->recording == NULL) {
+				JANUS_LOG(LOG_WARN, "Recording requested, but could NOT open file %s for writing...\n", filename);
+			} else {
+				JANUS_LOG(LOG_VERB, "Recording requested, opened file %s for writing\n", filename);
+				/* Write WAV header */
+				wav_header header = {
+					{'R', 'I', 'F', 'F'},
+					0,
+					{'W', 'A', 'V', 'E'},
+					{'f', 'm', 't', ' '},
+					16,
+					1,
+					1,
+					audiobridge->sampling_rate,
+					audiobridge->sampling_rate * 2,
+					2,
+					16,
+					{'d', 'a', 't', 'a'},
+					0
+				};
+				if(fwrite(&header, 1, sizeof(header), audiobridge->recording) != sizeof(header)) {
+					JANUS_LOG(LOG_ERR, "Error writing WAV header...\n");
+				}
+				fflush(audiobridge->recording);
+				audiobridge->record_lastupdate = janus_get_monotonic_time();
 			}
-			fwrite(outBuffer, sizeof(opus_int16), samples, audiobridge->recording);
+		} else if(chunk->action == JANUS_AUDIOBRIDGE_RECORD_PCM && audiobridge->recording != NULL) {
+			if(fwrite(chunk->data, sizeof(char), chunk->len, audiobridge->recording) != chunk->len)
+				JANUS_LOG_RATELIMITED(LOG_ERR, "Error saving the recording of room %"SCNu64"...\n", audiobridge->room_id);
 			/* Every 5 seconds we update the wav header */
 			gint64 now = janus_get_monotonic_time();
 			if(now - audiobridge->record_lastupdate >= 5*G_USEC_PER_SEC) {
@@ -4181,122 +5009,442 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 					fseek(audiobridge->recording, 0, SEEK_END);
 				}
 			}
-		}
-		/* Send proper packet to each participant (remove own contribution) */
-		ps = participants_list;
-		while(ps) {
-			janus_audiobridge_participant *p = (janus_audiobridge_participant *)ps->data;
-			if(!p->session || !g_atomic_int_get(&p->session->started)) {
-				ps = ps->next;
-				continue;
+		} else if(chunk->action == JANUS_AUDIOBRIDGE_RECORD_RTP && audiobridge->mix_recorder != NULL) {
+			janus_recorder_save_frame(audiobridge->mix_recorder, chunk->data, chunk->len);
+		} else if(chunk->action == JANUS_AUDIOBRIDGE_RECORD_CLOSE) {
+			if(audiobridge->mix_recorder != NULL) {
+				janus_recorder_close(audiobridge->mix_recorder);
+				janus_refcount_decrease(&audiobridge->mix_recorder->ref);
+				audiobridge->mix_recorder = NULL;
 			}
-			janus_audiobridge_rtp_relay_packet *pkt = NULL;
-			janus_mutex_lock(&p->qmutex);
-			if(g_atomic_int_get(&p->active) && !p->muted && !p->prebuffering && p->inbuf) {
-				GList *first = g_list_first(p->inbuf);
-				pkt = (janus_audiobridge_rtp_relay_packet *)(first ? first->data : NULL);
-				p->inbuf = g_list_delete_link(p->inbuf, first);
+			if(audiobridge->recording) {
+				/* Update the length in the header */
+				fseek(audiobridge->recording, 0, SEEK_END);
+				long int size = ftell(audiobridge->recording);
+				if(size >= 8) {
+					size -= 8;
+					fseek(audiobridge->recording, 4, SEEK_SET);
+					fwrite(&size, sizeof(uint32_t), 1, audiobridge->recording);
+					size += 8;
+					fseek(audiobridge->recording, 40, SEEK_SET);
+					fwrite(&size, sizeof(uint32_t), 1, audiobridge->recording);
+					fflush(audiobridge->recording);
+				}
+				fclose(audiobridge->recording);
+				audiobridge->recording = NULL;
 			}
+		}
+		g_atomic_int_add(&audiobridge->record_pending, -(gint)chunk->len);
+		janus_audiobridge_record_chunk_free(chunk);
+	}
+	JANUS_LOG(LOG_VERB, "Leaving AudioBridge recording thread\n");
+	return NULL;
+}
+
+/* Prepare a room for mixing */
+static void janus_audiobridge_mixer_start(janus_audiobridge_room *audiobridge) {
+	/* Do we need to record the mix? The file is opened by the writer thread */
+	if(audiobridge->record)
+		janus_audiobridge_record_enqueue(janus_audiobridge_record_chunk_new(audiobridge,
+			JANUS_AUDIOBRIDGE_RECORD_OPEN, 0));
+
+	janus_audiobridge_mixer *mixer = g_malloc0(sizeof(janus_audiobridge_mixer));
+	mixer->samples = audiobridge->sampling_rate/50;
+	mixer->rtpbuffer = g_malloc0(1500);
+	janus_rtp_header *rtph = (janus_rtp_header *)mixer->rtpbuffer;
+	rtph->version = 2;
+	mixer->participants = g_ptr_array_new_with_free_func((GDestroyNotify)janus_audiobridge_participant_unref);
+	audiobridge->mixer = mixer;
+}
+
+/* Pick the loudest speakers in a room, the only ones we conceal losses for */
+typedef struct janus_audiobridge_speaker {
+	int level;
+	janus_audiobridge_participant *participant;
+} janus_audiobridge_speaker;
+static int janus_audiobridge_speaker_sort(const void *a, const void *b) {
+	return ((const janus_audiobridge_speaker *)a)->level - ((const janus_audiobridge_speaker *)b)->level;
+}
+static void janus_audiobridge_update_speakers(janus_audiobridge_room *audiobridge, GPtrArray *participants) {
+	guint n = 0;
+	if(audiobridge->plc_speakers == 0 || participants->len == 0) {
+		for(n=0; n<participants->len; n++)
+			g_atomic_int_set(&((janus_audiobridge_participant *)g_ptr_array_index(participants, n))->conceal, 0);
+		return;
+	}
+	/* Take a snapshot of the levels, as they're updated while we sort: we
+	 * keep the array around, so that we only allocate when the room grows */
+	janus_audiobridge_mixer *mixer = audiobridge->mixer;
+	if(mixer->speakers == NULL)
+		mixer->speakers = g_array_sized_new(FALSE, FALSE, sizeof(janus_audiobridge_speaker), participants->len);
+	g_array_set_size(mixer->speakers, participants->len);
+	janus_audiobridge_speaker *speakers = (janus_audiobridge_speaker *)mixer->speakers->data;
+	for(n=0; n<participants->len; n++) {
+		janus_audiobridge_participant *p = (janus_audiobridge_participant *)g_ptr_array_index(participants, n);
+		speakers[n].level = p->muted ? 128 : p->level_average;
+		speakers[n].participant = p;
+	}
+	qsort(speakers, participants->len, sizeof(janus_audiobridge_speaker), janus_audiobridge_speaker_sort);
+	for(n=0; n<participants->len; n++)
+		g_atomic_int_set(&speakers[n].participant->conceal, n < (guint)audiobridge->plc_speakers && speakers[n].level <= 127);
+}
+
+/* Conceal a lost packet from a participant, using the Opus decoder: the
+ * frame is queued as if it was received with the provided sequence number
+ * (sorted, unless the queue is empty), and must be called with the incoming
+ * queue mutex locked */
+static janus_audiobridge_rtp_relay_packet *janus_audiobridge_conceal(janus_audiobridge_participant *p,
+		int samples, guint16 seq_number, gboolean sorted) {
+	if(!g_atomic_int_compare_and_exchange(&p->decoding, 0, 1))
+		return NULL;
+	janus_audiobridge_rtp_relay_packet *pkt = janus_audiobridge_ring_get(&p->inbuf);
+	if(pkt == NULL || p->decoder == NULL) {
+		if(pkt != NULL)
+			janus_audiobridge_ring_put(&p->inbuf, pkt);
+		g_atomic_int_set(&p->decoding, 0);
+		return NULL;
+	}
+	/* The decoder extrapolates from what it decoded last */
+	int length = opus_decode(p->decoder, NULL, 0, (opus_int16 *)pkt->data, samples, 0);
+	g_atomic_int_set(&p->decoding, 0);
+	if(length <= 0) {
+		janus_audiobridge_ring_put(&p->inbuf, pkt);
+		return NULL;
+	}
+	if(length < JANUS_AUDIOBRIDGE_FRAME_SAMPLES)
+		memset((opus_int16 *)pkt->data + length, 0, (JANUS_AUDIOBRIDGE_FRAME_SAMPLES-length)*sizeof(opus_int16));
+	pkt->length = length;
+	pkt->ssrc = 0;
+	pkt->timestamp = 0;
+	pkt->seq_number = seq_number;
+	pkt->silence = FALSE;
+	pkt->encoded = FALSE;
+	janus_audiobridge_ring_push(&p->inbuf, pkt, sorted);
+	p->concealed++;
+	janus_metric_inc(metric_concealed_frames);
+	return pkt;
+}
+
+/* Mix a frame for a room, and send it to participants and forwarders:
+ * returns how many participants and forwarders there are, which is what
+ * we use as the load of the room, or 0 if there was no need to mix */
+static int janus_audiobridge_mixer_tick(janus_audiobridge_room *audiobridge) {
+	janus_audiobridge_mixer *mixer = audiobridge->mixer;
+	int samples = mixer->samples;
+	opus_int32 *buffer = mixer->buffer;
+	opus_int16 *outBuffer = mixer->outBuffer, *curBuffer = NULL;
+	unsigned char *rtpbuffer = mixer->rtpbuffer;
+	janus_rtp_header *rtph = (janus_rtp_header *)rtpbuffer;
+	GPtrArray *participants = mixer->participants;
+	int i = 0;
+	guint n = 0;
+	/* Do we need to mix at all? */
+	janus_mutex_lock_nodebug(&audiobridge->mutex);
+	int count = g_hash_table_size(audiobridge->participants);
+	int rf_count = g_hash_table_size(audiobridge->rtp_forwarders);
+	janus_mutex_unlock_nodebug(&audiobridge->mutex);
+	if((count+rf_count) == 0) {
+		/* No participant and RTP forwarders, do nothing */
+		if(mixer->prev_count > 0) {
+			JANUS_LOG(LOG_VERB, "Last user/forwarder just left room %"SCNu64", going idle...\n", audiobridge->room_id);
+			mixer->prev_count = 0;
+			/* Nobody's left, don't keep references to old participants */
+			g_ptr_array_set_size(participants, 0);
+		}
+		return 0;
+	}
+	if(mixer->prev_count == 0) {
+		JANUS_LOG(LOG_VERB, "First user/forwarder just joined room %"SCNu64", waking it up...\n", audiobridge->room_id);
+	}
+	mixer->prev_count = count+rf_count;
+	/* Update RTP header information */
+	gint16 seq = ++mixer->seq;
+	gint32 ts = (mixer->ts += 960);
+	/* Mix all contributions */
+	JANUS_TRACE2(audiobridge_mix_start, audiobridge->room_id, count+rf_count);
+	gint64 mix_start = janus_get_monotonic_time();
+	gint64 cpu_start = janus_audiobridge_thread_cpu_time();
+	janus_mutex_lock_nodebug(&audiobridge->mutex);
+	if(mixer->participants_version != audiobridge->participants_version) {
+		/* Somebody joined or left, update our own list of participants */
+		g_ptr_array_set_size(participants, 0);
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, audiobridge->participants);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_audiobridge_participant *p = (janus_audiobridge_participant *)value;
+			janus_refcount_increase(&p->ref);
+			g_ptr_array_add(participants, p);
+		}
+		mixer->participants_version = audiobridge->participants_version;
+		mixer->ticks = 0;
+	}
+	janus_mutex_unlock_nodebug(&audiobridge->mutex);
+	/* Once per second, check who the loudest speakers are */
+	if(mixer->ticks++ % 50 == 0)
+		janus_audiobridge_update_speakers(audiobridge, participants);
+	for(i=0; i<samples; i++)
+		buffer[i] = 0;
+	for(n=0; n<participants->len; n++) {
+		janus_audiobridge_participant *p = (janus_audiobridge_participant *)g_ptr_array_index(participants, n);
+		janus_mutex_lock(&p->qmutex);
+		if(!p->session || !g_atomic_int_get(&p->session->started) || !g_atomic_int_get(&p->active) || p->muted || p->prebuffering) {
 			janus_mutex_unlock(&p->qmutex);
-			curBuffer = (opus_int16 *)((pkt && !pkt->silence) ? pkt->data : NULL);
-			for(i=0; i<samples; i++) {
-				if(p->volume_gain == 100)
-					sumBuffer[i] = buffer[i] - (curBuffer ? (curBuffer[i]) : 0);
-				else
-					sumBuffer[i] = buffer[i] - (curBuffer ? (curBuffer[i]*p->volume_gain)/100 : 0);
+			continue;
+		}
+		janus_audiobridge_rtp_relay_packet *pkt = janus_audiobridge_ring_peek(&p->inbuf);
+		if(pkt == NULL && p->voiced && p->concealed < MAX_CONCEALED && g_atomic_int_get(&p->conceal)) {
+			/* We got nothing in time from one of the loudest speakers, conceal the loss:
+			 * the queue is empty, so this will be the next frame we mix */
+			pkt = janus_audiobridge_conceal(p, samples, p->last_mixed_seq+1, FALSE);
+		} else if(pkt != NULL) {
+			p->voiced = !pkt->silence;
+			p->concealed = 0;
+		}
+		if(pkt != NULL && !pkt->silence) {
+			curBuffer = (opus_int16 *)pkt->data;
+			janus_audiobridge_mix_add(buffer, curBuffer, p->volume_q8, samples);
+		}
+		janus_mutex_unlock(&p->qmutex);
+	}
+	/* Are we recording the mix? (only do it if there's someone in, though...) */
+	if(audiobridge->record && !audiobridge->record_opus && participants->len > 0) {
+		/* We hand chunks of about a second to the writer, rather than every frame */
+		if(mixer->record_chunk == NULL) {
+			mixer->record_chunk = janus_audiobridge_record_chunk_new(audiobridge,
+				JANUS_AUDIOBRIDGE_RECORD_PCM, JANUS_AUDIOBRIDGE_RECORD_FRAMES*samples*sizeof(opus_int16));
+		}
+		janus_audiobridge_record_chunk *chunk = mixer->record_chunk;
+		janus_audiobridge_mix_minus((opus_int16 *)(chunk->data + chunk->len), buffer, NULL, 0, samples);
+		chunk->len += samples*sizeof(opus_int16);
+		if(chunk->len + samples*sizeof(opus_int16) > chunk->size) {
+			janus_audiobridge_record_enqueue(chunk);
+			mixer->record_chunk = NULL;
+		}
+	}
+	/* Send proper packet to each participant (remove own contribution): those
+	 * not contributing (e.g., muted) all get the same full mix, so we encode it
+	 * only once here, and reuse it for the RTP forwarders too. Since switching
+	 * between that and their own encoder is audible, participants only move to
+	 * the shared mix after not contributing for a while, and their encoder is
+	 * reset when they start contributing again, as its state would be stale */
+	opus_int32 shared_length = 0;
+	guint64 sent = 0, shared = 0;
+	for(n=0; n<participants->len; n++) {
+		janus_audiobridge_participant *p = (janus_audiobridge_participant *)g_ptr_array_index(participants, n);
+		if(!p->session || !g_atomic_int_get(&p->session->started))
+			continue;
+		janus_audiobridge_rtp_relay_packet *pkt = NULL;
+		janus_mutex_lock(&p->qmutex);
+		if(g_atomic_int_get(&p->active) && !p->muted && !p->prebuffering)
+			pkt = janus_audiobridge_ring_pop(&p->inbuf);
+		if(pkt != NULL) {
+			p->mixed = TRUE;
+			p->last_mixed_seq = pkt->seq_number;
+		}
+		janus_mutex_unlock(&p->qmutex);
+		curBuffer = (opus_int16 *)((pkt && !pkt->silence) ? pkt->data : NULL);
+		if(curBuffer == NULL || p->volume_q8 == 0) {
+			if(p->unmixed < JANUS_AUDIOBRIDGE_SHARED_MIX_DELAY)
+				p->unmixed++;
+		} else {
+			p->unmixed = 0;
+		}
+		gboolean use_shared = (p->unmixed >= JANUS_AUDIOBRIDGE_SHARED_MIX_DELAY);
+		if(use_shared && shared_length == 0)
+			shared_length = janus_audiobridge_encode_mix(audiobridge, buffer, outBuffer, samples, rtpbuffer+12);
+		janus_mutex_lock(&p->omutex);
+		janus_audiobridge_rtp_relay_packet *mixedpkt = janus_audiobridge_ring_get(&p->outbuf);
+		janus_mutex_unlock(&p->omutex);
+		if(mixedpkt != NULL) {
+			mixedpkt->reset = FALSE;
+			if(use_shared && shared_length > 0) {
+				/* Enqueue the full mix we encoded already */
+				memcpy(mixedpkt->data, rtpbuffer+12, shared_length);
+				mixedpkt->length = shared_length;
+				mixedpkt->encoded = TRUE;
+				p->shared_mix = TRUE;
+				shared++;
+			} else {
+				/* Enqueue this mixed frame for encoding in the workers */
+				janus_audiobridge_mix_minus((opus_int16 *)mixedpkt->data, buffer, curBuffer, p->volume_q8, samples);
+				mixedpkt->length = samples;	/* We set the number of samples here, not the data length */
+				mixedpkt->encoded = FALSE;
+				mixedpkt->reset = p->shared_mix;
+				p->shared_mix = FALSE;
 			}
-			for(i=0; i<samples; i++)
-				/* FIXME Smoothen/Normalize instead of truncating? */
-				outBuffer[i] = sumBuffer[i];
-			/* Enqueue this mixed frame for encoding in the participant thread */
-			janus_audiobridge_rtp_relay_packet *mixedpkt = g_malloc(sizeof(janus_audiobridge_rtp_relay_packet));
-			mixedpkt->data = g_malloc(samples*2);
-			memcpy(mixedpkt->data, outBuffer, samples*2);
-			mixedpkt->length = samples;	/* We set the number of samples here, not the data length */
 			mixedpkt->timestamp = ts;
 			mixedpkt->seq_number = seq;
 			mixedpkt->ssrc = audiobridge->room_id;
 			mixedpkt->silence = FALSE;
-			g_async_queue_push(p->outbuf, mixedpkt);
-			if(pkt) {
-				g_free(pkt->data);
-				pkt->data = NULL;
-				g_free(pkt);
-				pkt = NULL;
+			janus_mutex_lock(&p->omutex);
+			janus_audiobridge_ring_push(&p->outbuf, mixedpkt, FALSE);
+			janus_mutex_unlock(&p->omutex);
+			janus_audiobridge_schedule_encoding(audiobridge, p);
+			sent++;
+		}
+		if(pkt) {
+			janus_mutex_lock(&p->qmutex);
+			janus_audiobridge_ring_put(&p->inbuf, pkt);
+			janus_mutex_unlock(&p->qmutex);
+		}
+	}
+	if(sent > 0) {
+		janus_mutex_lock_nodebug(&audiobridge->mutex);
+		audiobridge->frames_sent += sent;
+		audiobridge->frames_shared += shared;
+		janus_mutex_unlock_nodebug(&audiobridge->mutex);
+		if(shared > 0)
+			janus_metric_add(metric_shared_frames, shared);
+	}
+	/* Are we recording the mix as Opus? We can reuse the frame we encoded, if any */
+	if(audiobridge->record && audiobridge->record_opus && participants->len > 0) {
+		if(shared_length <= 0)
+			shared_length = janus_audiobridge_encode_mix(audiobridge, buffer, outBuffer, samples, rtpbuffer+12);
+		if(shared_length > 0) {
+			janus_audiobridge_record_chunk *chunk = janus_audiobridge_record_chunk_new(audiobridge,
+				JANUS_AUDIOBRIDGE_RECORD_RTP, 12+shared_length);
+			janus_rtp_header *header = (janus_rtp_header *)chunk->data;
+			header->version = 2;
+			header->type = 111;
+			header->seq_number = htons(seq);
+			header->timestamp = htonl(ts);
+			header->ssrc = htonl(audiobridge->room_id);
+			memcpy(chunk->data+12, rtpbuffer+12, shared_length);
+			chunk->len = 12+shared_length;
+			janus_audiobridge_record_enqueue(chunk);
+		}
+	}
+	/* Forward the mixed packet as RTP to any RTP forwarder that may be listening */
+	janus_mutex_lock(&audiobridge->rtp_mutex);
+	if(g_hash_table_size(audiobridge->rtp_forwarders) > 0 && audiobridge->rtp_encoder) {
+		/* If the room is empty, check if there's any RTP forwarder with an "always on" option */
+		gboolean go_on = FALSE;
+		if(count == 0) {
+			GHashTableIter iter;
+			gpointer value;
+			g_hash_table_iter_init(&iter, audiobridge->rtp_forwarders);
+			while(g_hash_table_iter_next(&iter, NULL, &value)) {
+				janus_audiobridge_rtp_forwarder* forwarder = (janus_audiobridge_rtp_forwarder *)value;
+				if(forwarder->always_on) {
+					go_on = TRUE;
+					break;
+				}
 			}
-			ps = ps->next;
+		} else {
+			go_on = TRUE;
 		}
-		g_list_free(participants_list);
-		/* Forward the mixed packet as RTP to any RTP forwarder that may be listening */
-		janus_mutex_lock(&audiobridge->rtp_mutex);
-		if(g_hash_table_size(audiobridge->rtp_forwarders) > 0 && audiobridge->rtp_encoder) {
-			/* If the room is empty, check if there's any RTP forwarder with an "always on" option */
-			gboolean go_on = FALSE;
-			if(count == 0) {
+		if(go_on) {
+			/* Encode the mixed frame first, if we didn't for the participants already */
+			opus_int32 length = shared_length;
+			if(length <= 0) {
+				janus_audiobridge_mix_minus(outBuffer, buffer, NULL, 0, samples);
+				length = opus_encode(audiobridge->rtp_encoder, outBuffer, samples, rtpbuffer+12, 1500-12);
+			}
+			if(length < 0) {
+				JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error encoding the Opus frame: %d (%s)\n", length, opus_strerror(length));
+			} else {
+				/* Then send it to everybody */
 				GHashTableIter iter;
-				gpointer value;
+				gpointer key, value;
 				g_hash_table_iter_init(&iter, audiobridge->rtp_forwarders);
-				while(g_hash_table_iter_next(&iter, NULL, &value)) {
+				while(audiobridge->rtp_udp_sock > 0 && g_hash_table_iter_next(&iter, &key, &value)) {
+					guint32 stream_id = GPOINTER_TO_UINT(key);
 					janus_audiobridge_rtp_forwarder* forwarder = (janus_audiobridge_rtp_forwarder *)value;
-					if(forwarder->always_on) {
-						go_on = TRUE;
-						break;
-					}
-				}
-			} else {
-				go_on = TRUE;
-			}
-			if(go_on) {
-				/* Encode the mixed frame first*/
-				for(i=0; i<samples; i++)
-					outBuffer[i] = buffer[i];
-				opus_int32 length = opus_encode(audiobridge->rtp_encoder, outBuffer, samples, rtpbuffer+12, 1500-12);
-				if(length < 0) {
-					JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error encoding the Opus frame: %d (%s)\n", length, opus_strerror(length));
-				} else {
-					/* Then send it to everybody */
-					GHashTableIter iter;
-					gpointer key, value;
-					g_hash_table_iter_init(&iter, audiobridge->rtp_forwarders);
-					while(audiobridge->rtp_udp_sock > 0 && g_hash_table_iter_next(&iter, &key, &value)) {
-						guint32 stream_id = GPOINTER_TO_UINT(key);
-						janus_audiobridge_rtp_forwarder* forwarder = (janus_audiobridge_rtp_forwarder *)value;
-						if(count == 0 && !forwarder->always_on)
-							continue;
-						/* Update header */
-						rtph->type = forwarder->payload_type;
-						rtph->ssrc = htonl(forwarder->ssrc ? forwarder->ssrc : stream_id);
-						forwarder->seq_number++;
-						rtph->seq_number = htons(forwarder->seq_number);
-						forwarder->timestamp += 960;
-						rtph->timestamp = htonl(forwarder->timestamp);
-						/* Send RTP packet */
-						if(sendto(audiobridge->rtp_udp_sock, rtpbuffer, length+12, 0, (struct sockaddr*)&forwarder->serv_addr, sizeof(forwarder->serv_addr)) < 0) {
-							JANUS_LOG(LOG_HUGE, "Error forwarding mixed RTP packet for room %"SCNu64"... %s (len=%d)...\n",
-								audiobridge->room_id, strerror(errno), length+12);
-						}
+					if(count == 0 && !forwarder->always_on)
+						continue;
+					/* Update header */
+					rtph->type = forwarder->payload_type;
+					rtph->ssrc = htonl(forwarder->ssrc ? forwarder->ssrc : stream_id);
+					forwarder->seq_number++;
+					rtph->seq_number = htons(forwarder->seq_number);
+					forwarder->timestamp += 960;
+					rtph->timestamp = htonl(forwarder->timestamp);
+					/* Send RTP packet */
+					if(sendto(audiobridge->rtp_udp_sock, rtpbuffer, length+12, 0, (struct sockaddr*)&forwarder->serv_addr, sizeof(forwarder->serv_addr)) < 0) {
+						JANUS_LOG(LOG_HUGE, "Error forwarding mixed RTP packet for room %"SCNu64"... %s (len=%d)...\n",
+							audiobridge->room_id, strerror(errno), length+12);
 					}
 				}
 			}
 		}
-		janus_mutex_unlock(&audiobridge->rtp_mutex);
 	}
-	if(audiobridge->recording) {
-		/* Update the length in the header */
-		fseek(audiobridge->recording, 0, SEEK_END);
-		long int size = ftell(audiobridge->recording);
-		if(size >= 8) {
-			size -= 8;
-			fseek(audiobridge->recording, 4, SEEK_SET);
-			fwrite(&size, sizeof(uint32_t), 1, audiobridge->recording);
-			size += 8;
-			fseek(audiobridge->recording, 40, SEEK_SET);
-			fwrite(&size, sizeof(uint32_t), 1, audiobridge->recording);
-			fflush(audiobridge->recording);
-			fclose(audiobridge->recording);
+	janus_mutex_unlock(&audiobridge->rtp_mutex);
+	janus_metric_inc(metric_mixes);
+	janus_metric_add(metric_mix_time, janus_get_monotonic_time() - mix_start);
+	gint64 spent = janus_audiobridge_thread_cpu_time() - cpu_start;
+	janus_mutex_lock_nodebug(&audiobridge->mutex);
+	audiobridge->mixing_time += spent;
+	janus_mutex_unlock_nodebug(&audiobridge->mutex);
+	JANUS_TRACE2(audiobridge_mix_done, audiobridge->room_id, spent);
+	return count+rf_count;
+}
+
+/* Done mixing a room: close the recording, if any, and free the resources */
+static void janus_audiobridge_mixer_stop(janus_audiobridge_room *audiobridge) {
+	janus_audiobridge_mixer *mixer = audiobridge->mixer;
+	audiobridge->mixer = NULL;
+	if(mixer == NULL)
+		return;
+	if(mixer->record_chunk != NULL)
+		janus_audiobridge_record_enqueue(mixer->record_chunk);
+	if(audiobridge->record)
+		janus_audiobridge_record_enqueue(janus_audiobridge_record_chunk_new(audiobridge,
+			JANUS_AUDIOBRIDGE_RECORD_CLOSE, 0));
+	g_free(mixer->rtpbuffer);
+	g_ptr_array_free(mixer->participants, TRUE);
+	if(mixer->speakers != NULL)
+		g_array_free(mixer->speakers, TRUE);
+	g_free(mixer);
+}
+
+/* Thread to mix the contributions from all participants */
+static void *janus_audiobridge_mixer_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Audio bridge thread starting...\n");
+	janus_audiobridge_room *audiobridge = (janus_audiobridge_room *)data;
+	if(!audiobridge) {
+		JANUS_LOG(LOG_ERR, "Invalid room!\n");
+		return NULL;
+	}
+	JANUS_LOG(LOG_VERB, "Thread is for mixing room %"SCNu64" (%s) at rate %"SCNu32"...\n", audiobridge->room_id, audiobridge->room_name, audiobridge->sampling_rate);
+	/* Stay on the same NUMA node as the participants of this room, if needed */
+	char group[64];
+	g_snprintf(group, sizeof(group), "audiobridge-%"SCNu64, audiobridge->room_id);
+	janus_affinity_pin_plugin_thread(group);
+
+	janus_audiobridge_mixer_start(audiobridge);
+
+	/* Timer */
+	struct timeval now, before;
+	gettimeofday(&before, NULL);
+	now.tv_sec = before.tv_sec;
+	now.tv_usec = before.tv_usec;
+	time_t passed, d_s, d_us;
+
+	/* Loop */
+	while(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&audiobridge->destroyed)) {
+		/* See if it's time to prepare a frame */
+		gettimeofday(&now, NULL);
+		d_s = now.tv_sec - before.tv_sec;
+		d_us = now.tv_usec - before.tv_usec;
+		if(d_us < 0) {
+			d_us += 1000000;
+			--d_s;
+		}
+		passed = d_s*1000000 + d_us;
+		if(passed < 15000) {	/* Let's wait about 15ms at max */
+			g_usleep(5000);
+			continue;
+		}
+		/* Update the reference time */
+		before.tv_usec += 20000;
+		if(before.tv_usec > 1000000) {
+			before.tv_sec++;
+			before.tv_usec -= 1000000;
 		}
+		janus_audiobridge_mixer_tick(audiobridge);
 	}
-	g_free(rtpbuffer);
+	janus_audiobridge_mixer_stop(audiobridge);
 	JANUS_LOG(LOG_VERB, "Leaving mixer thread for room %"SCNu64" (%s)...\n", audiobridge->room_id, audiobridge->room_name);
 
 	janus_refcount_decrease(&audiobridge->ref);
@@ -4304,70 +5452,233 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 	return NULL;
 }
 
-/* Thread to encode a mixed frame and send it to a specific participant */
-static void *janus_audiobridge_participant_thread(void *data) {
-	JANUS_LOG(LOG_VERB, "AudioBridge Participant thread starting...\n");
-	janus_audiobridge_participant *participant = (janus_audiobridge_participant *)data;
-	if(!participant) {
-		JANUS_LOG(LOG_ERR, "Invalid participant!\n");
-		g_thread_unref(g_thread_self());
-		return NULL;
+/* Start mixing a room, either in a thread of its own or in a shared mixer */
+static void janus_audiobridge_mixer_launch(janus_audiobridge_room *audiobridge, GError **error) {
+	janus_refcount_increase(&audiobridge->ref);
+	if(mixers_count == 0) {
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "mixer %"SCNu64, audiobridge->room_id);
+		audiobridge->thread = g_thread_try_new(tname, &janus_audiobridge_mixer_thread, audiobridge, error);
+		if(*error != NULL)
+			janus_refcount_decrease(&audiobridge->ref);
+		return;
+	}
+	/* Pick the shared mixer with the lowest load (or the fewest rooms, in case of a tie) */
+	janus_audiobridge_mixer_worker *worker = &mixers[0];
+	int i = 0;
+	for(i=1; i<mixers_count; i++) {
+		int load = g_atomic_int_get(&mixers[i].load), best = g_atomic_int_get(&worker->load);
+		if(load < best || (load == best && g_atomic_int_get(&mixers[i].count) < g_atomic_int_get(&worker->count)))
+			worker = &mixers[i];
 	}
-	JANUS_LOG(LOG_VERB, "Thread is for participant %"SCNu64" (%s)\n", participant->user_id, participant->display ? participant->display : "??");
-	janus_audiobridge_session *session = participant->session;
+	janus_mutex_lock(&worker->mutex);
+	worker->rooms = g_list_append(worker->rooms, audiobridge);
+	g_atomic_int_inc(&worker->count);
+	janus_mutex_unlock(&worker->mutex);
+	JANUS_LOG(LOG_VERB, "Room %"SCNu64" (%s) will be mixed by shared mixer #%d\n",
+		audiobridge->room_id, audiobridge->room_name, worker->id);
+}
+
+/* Move a room from a shared mixer to the least loaded one, if that makes
+ * their loads more even: participants join rooms after they've been
+ * assigned, so the initial choice may not be the best one for long */
+static void janus_audiobridge_mixer_rebalance(janus_audiobridge_mixer_worker *worker) {
+	janus_audiobridge_mixer_worker *target = NULL;
+	int i = 0;
+	for(i=0; i<mixers_count; i++) {
+		if(&mixers[i] == worker)
+			continue;
+		if(target == NULL || g_atomic_int_get(&mixers[i].load) < g_atomic_int_get(&target->load))
+			target = &mixers[i];
+	}
+	if(target == NULL)
+		return;
+	/* Lock both workers, always in the same order */
+	janus_audiobridge_mixer_worker *first = worker->id < target->id ? worker : target,
+		*second = worker->id < target->id ? target : worker;
+	janus_mutex_lock(&first->mutex);
+	janus_mutex_lock(&second->mutex);
+	int diff = g_atomic_int_get(&worker->load) - g_atomic_int_get(&target->load);
+	/* Moving a room with load L changes the difference by 2L, so look
+	 * for the busiest room that still is less busy than the difference */
+	GList *move = NULL, *l = worker->rooms;
+	int load = 0;
+	while(l != NULL) {
+		janus_audiobridge_room *audiobridge = (janus_audiobridge_room *)l->data;
+		if(audiobridge->mixer != NULL && !g_atomic_int_get(&audiobridge->destroyed)) {
+			int room_load = audiobridge->mixer->prev_count;
+			if(room_load > load && room_load < diff) {
+				move = l;
+				load = room_load;
+			}
+		}
+		l = l->next;
+	}
+	if(move != NULL) {
+		janus_audiobridge_room *audiobridge = (janus_audiobridge_room *)move->data;
+		worker->rooms = g_list_remove_link(worker->rooms, move);
+		target->rooms = g_list_concat(target->rooms, move);
+		g_atomic_int_add(&worker->count, -1);
+		g_atomic_int_inc(&target->count);
+		g_atomic_int_add(&worker->load, -load);
+		g_atomic_int_add(&target->load, load);
+		JANUS_LOG(LOG_VERB, "Moved room %"SCNu64" (%s) from shared mixer #%d to #%d\n",
+			audiobridge->room_id, audiobridge->room_name, worker->id, target->id);
+	}
+	janus_mutex_unlock(&second->mutex);
+	janus_mutex_unlock(&first->mutex);
+}
+
+/* Thread mixing all the rooms assigned to a shared mixer: all shared mixers
+ * tick on the same clock, and sleep until the next 20ms deadline rather than
+ * polling, so that the frames of all rooms are sent at the right time */
+static void *janus_audiobridge_mixer_worker_thread(void *data) {
+	janus_audiobridge_mixer_worker *worker = (janus_audiobridge_mixer_worker *)data;
+	JANUS_LOG(LOG_VERB, "Shared mixer #%d starting...\n", worker->id);
+	gint64 tick = (janus_get_monotonic_time() - mixers_epoch)/20000 + 1;
+	gint64 deadline = 0, now = 0;
+	while(!g_atomic_int_get(&stopping)) {
+		deadline = mixers_epoch + tick*20000;
+		now = janus_get_monotonic_time();
+		if(now < deadline)
+			g_usleep(deadline - now);
+		/* Mix all rooms, and get rid of the ones that have been destroyed */
+		int load = 0;
+		janus_mutex_lock(&worker->mutex);
+		GList *l = worker->rooms;
+		while(l != NULL) {
+			GList *next = l->next;
+			janus_audiobridge_room *audiobridge = (janus_audiobridge_room *)l->data;
+			if(g_atomic_int_get(&audiobridge->destroyed)) {
+				worker->rooms = g_list_delete_link(worker->rooms, l);
+				g_atomic_int_add(&worker->count, -1);
+				janus_audiobridge_mixer_stop(audiobridge);
+				JANUS_LOG(LOG_VERB, "Shared mixer #%d done with room %"SCNu64" (%s)...\n",
+					worker->id, audiobridge->room_id, audiobridge->room_name);
+				janus_refcount_decrease(&audiobridge->ref);
+			} else {
+				if(audiobridge->mixer == NULL)
+					janus_audiobridge_mixer_start(audiobridge);
+				load += janus_audiobridge_mixer_tick(audiobridge);
+			}
+			l = next;
+		}
+		janus_mutex_unlock(&worker->mutex);
+		g_atomic_int_set(&worker->load, load);
+		janus_metric_inc(metric_mixer_ticks);
+		/* Did we take so long we're late for the next tick? */
+		tick++;
+		now = janus_get_monotonic_time();
+		deadline = mixers_epoch + tick*20000;
+		if(now > deadline) {
+			janus_metric_inc(metric_mixer_overruns);
+			janus_metric_add(metric_mixer_lateness, now - deadline);
+			if(now - deadline > 100000) {
+				/* We're way too late, skip the ticks we missed rather than rushing them */
+				JANUS_LOG(LOG_WARN, "Shared mixer #%d is %"SCNi64"ms late (%d rooms), skipping ahead\n",
+					worker->id, (now - deadline)/1000, g_atomic_int_get(&worker->count));
+				tick = (now - mixers_epoch)/20000 + 1;
+			}
+		}
+		/* Every few seconds, check if we should hand a room to somebody else */
+		if(mixers_count > 1 && tick % 250 == 0)
+			janus_audiobridge_mixer_rebalance(worker);
+	}
+	/* We're shutting down, let go of all rooms */
+	janus_mutex_lock(&worker->mutex);
+	while(worker->rooms != NULL) {
+		janus_audiobridge_room *audiobridge = (janus_audiobridge_room *)worker->rooms->data;
+		worker->rooms = g_list_delete_link(worker->rooms, worker->rooms);
+		janus_audiobridge_mixer_stop(audiobridge);
+		janus_refcount_decrease(&audiobridge->ref);
+	}
+	g_atomic_int_set(&worker->count, 0);
+	janus_mutex_unlock(&worker->mutex);
+	JANUS_LOG(LOG_VERB, "Leaving shared mixer #%d...\n", worker->id);
+	return NULL;
+}
+
+/* Encoding worker: encode and send all the mixed frames queued for a participant */
+static void janus_audiobridge_encoding_task(gpointer data, gpointer user_data) {
+	janus_audiobridge_encoder_task *task = (janus_audiobridge_encoder_task *)data;
+	janus_audiobridge_session *session = task->session;
+	janus_audiobridge_participant *participant = task->participant;
+	gint64 cpu_start = janus_audiobridge_thread_cpu_time();
 
 	/* Output buffer */
-	janus_audiobridge_rtp_relay_packet *outpkt = g_malloc(sizeof(janus_audiobridge_rtp_relay_packet));
-	outpkt->data = g_malloc0(1500);
-	outpkt->ssrc = 0;
-	outpkt->timestamp = 0;
-	outpkt->seq_number = 0;
-	outpkt->length = 0;
-	outpkt->silence = FALSE;
-	unsigned char *payload = (unsigned char *)outpkt->data;
+	char buffer[1500];
+	janus_audiobridge_rtp_relay_packet outpkt = { 0 };
+	outpkt.data = (janus_rtp_header *)buffer;
+	memset(buffer, 0, sizeof(buffer));
+	unsigned char *payload = (unsigned char *)buffer;
 
 	janus_audiobridge_rtp_relay_packet *mixedpkt = NULL;
-
-	/* Start working: check the outgoing queue for packets, then encode and send them */
-	while(!g_atomic_int_get(&stopping) && g_atomic_int_get(&session->destroyed) == 0) {
-		mixedpkt = g_async_queue_timeout_pop(participant->outbuf, 100000);
-		if(mixedpkt != NULL && g_atomic_int_get(&session->destroyed) == 0 && g_atomic_int_get(&session->started)) {
-			/* Encode raw frame to Opus */
-			if(g_atomic_int_get(&participant->active) && participant->encoder &&
-					g_atomic_int_compare_and_exchange(&participant->encoding, 0, 1)) {
-				opus_int16 *outBuffer = (opus_int16 *)mixedpkt->data;
-				outpkt->length = opus_encode(participant->encoder, outBuffer, mixedpkt->length, payload+12, BUFFER_SAMPLES-12);
-				g_atomic_int_set(&participant->encoding, 0);
-				if(outpkt->length < 0) {
-					JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error encoding the Opus frame: %d (%s)\n", outpkt->length, opus_strerror(outpkt->length));
-				} else {
-					outpkt->length += 12;	/* Take the RTP header into consideration */
-					/* Update RTP header */
-					outpkt->data->version = 2;
-					outpkt->data->markerbit = 0;	/* FIXME Should be 1 for the first packet */
-					outpkt->data->seq_number = htons(mixedpkt->seq_number);
-					outpkt->data->timestamp = htonl(mixedpkt->timestamp);
-					outpkt->data->ssrc = htonl(mixedpkt->ssrc);	/* The gateway will fix this anyway */
-					/* Backup the actual timestamp and sequence number set by the audiobridge, in case a room is changed */
-					outpkt->ssrc = mixedpkt->ssrc;
-					outpkt->timestamp = mixedpkt->timestamp;
-					outpkt->seq_number = mixedpkt->seq_number;
-					janus_audiobridge_relay_rtp_packet(participant->session, outpkt);
+	while(TRUE) {
+		while(TRUE) {
+			janus_mutex_lock(&participant->omutex);
+			mixedpkt = janus_audiobridge_ring_pop(&participant->outbuf);
+			janus_mutex_unlock(&participant->omutex);
+			if(mixedpkt == NULL)
+				break;
+			if(!g_atomic_int_get(&stopping) && g_atomic_int_get(&session->destroyed) == 0 && g_atomic_int_get(&session->started)) {
+				/* Encode raw frame to Opus, unless the mixer did it for us already */
+				gboolean encoded = FALSE;
+				if(g_atomic_int_get(&participant->active) && mixedpkt->encoded) {
+					memcpy(payload+12, mixedpkt->data, mixedpkt->length);
+					outpkt.length = mixedpkt->length;
+					encoded = TRUE;
+				} else if(g_atomic_int_get(&participant->active) && participant->encoder &&
+						g_atomic_int_compare_and_exchange(&participant->encoding, 0, 1)) {
+					opus_int16 *outBuffer = (opus_int16 *)mixedpkt->data;
+					if(mixedpkt->reset) {
+						/* We sent the shared mix in the meanwhile, start from a clean state */
+						opus_encoder_ctl(participant->encoder, OPUS_RESET_STATE);
+					}
+					outpkt.length = opus_encode(participant->encoder, outBuffer, mixedpkt->length, payload+12, sizeof(buffer)-12);
+					g_atomic_int_set(&participant->encoding, 0);
+					encoded = TRUE;
+				}
+				if(encoded) {
+					if(outpkt.length < 0) {
+						JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error encoding the Opus frame: %d (%s)\n", outpkt.length, opus_strerror(outpkt.length));
+					} else {
+						outpkt.length += 12;	/* Take the RTP header into consideration */
+						/* Update RTP header */
+						outpkt.data->version = 2;
+						outpkt.data->markerbit = 0;	/* FIXME Should be 1 for the first packet */
+						outpkt.data->seq_number = htons(mixedpkt->seq_number);
+						outpkt.data->timestamp = htonl(mixedpkt->timestamp);
+						outpkt.data->ssrc = htonl(mixedpkt->ssrc);	/* The gateway will fix this anyway */
+						/* Backup the actual timestamp and sequence number set by the audiobridge, in case a room is changed */
+						outpkt.ssrc = mixedpkt->ssrc;
+						outpkt.timestamp = mixedpkt->timestamp;
+						outpkt.seq_number = mixedpkt->seq_number;
+						janus_audiobridge_relay_rtp_packet(session, &outpkt);
+					}
 				}
 			}
-			g_free(mixedpkt->data);
-			g_free(mixedpkt);
+			janus_mutex_lock(&participant->omutex);
+			janus_audiobridge_ring_put(&participant->outbuf, mixedpkt);
+			janus_mutex_unlock(&participant->omutex);
 		}
+		/* We're done, unless the mixer queued something else in the meanwhile */
+		g_atomic_int_set(&participant->scheduled, 0);
+		janus_mutex_lock(&participant->omutex);
+		guint queued = participant->outbuf.count;
+		janus_mutex_unlock(&participant->omutex);
+		if(queued == 0 || !g_atomic_int_compare_and_exchange(&participant->scheduled, 0, 1))
+			break;
 	}
-	/* We're done, get rid of the resources */
-	g_free(outpkt->data);
-	g_free(outpkt);
-	JANUS_LOG(LOG_VERB, "AudioBridge Participant thread leaving...\n");
 
+	janus_audiobridge_room *audiobridge = task->room;
+	gint64 spent = janus_audiobridge_thread_cpu_time() - cpu_start;
+	janus_mutex_lock_nodebug(&audiobridge->mutex);
+	audiobridge->encoding_time += spent;
+	janus_mutex_unlock_nodebug(&audiobridge->mutex);
+	janus_refcount_decrease(&audiobridge->ref);
 	janus_refcount_decrease(&participant->ref);
 	janus_refcount_decrease(&session->ref);
-	g_thread_unref(g_thread_self());
-	return NULL;
+	g_free(task);
 }
 
 static void janus_audiobridge_relay_rtp_packet(gpointer data, gpointer user_data) {
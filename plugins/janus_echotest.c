@@ -93,6 +93,32 @@
 	"result": "done"
 }
 \endverbatim
+ *
+ * \section echoprobe Latency probes
+ *
+ * The Echo Test can also be used by synthetic monitoring clients to tell
+ * how much of the round-trip time of the echoed packets is spent in Janus
+ * rather than on the network. To do that, clients negotiate a custom RTP
+ * extension in their offer (\c http://www.meetecho.com/experiments/rtp-hdrext/janus-probe ),
+ * which the answer will accept with the same ID, and reserve an 8 bytes
+ * slot for it in the packets they send. The plugin fills the slot of each
+ * echoed packet with two 32-bit values in network byte order:
+ *
+ * - the time Janus received the packet, as the middle 32 bits of an NTP
+ * timestamp (as in the LSR field of RTCP Receiver Reports);
+ * - the time, in microseconds, between that and when the packet was handed
+ * back to the core to be sent, i.e., SRTP decryption and processing.
+ *
+ * Janus only knows when packets were received from the network if media
+ * latency tracking is enabled (see \c media_latency in the \c media
+ * section of \c janus.cfg and the \c media_latency Admin API request):
+ * if it isn't, the receive time is when the packet got to the plugin, and
+ * the processing time only covers the plugin itself. Since the slot is
+ * filled before the packet is queued and encrypted again, the time spent in
+ * the outgoing queue and in SRTP is not part of it: the \c media-latency
+ * section of \c handle_info has histograms for both, and the \c probe
+ * section of the Echo Test info in \c handle_info counts the probes with
+ * the average and maximum processing times.
  */
 
 #include "plugin.h"
@@ -118,6 +144,10 @@
 #define JANUS_ECHOTEST_AUTHOR			"Meetecho s.r.l."
 #define JANUS_ECHOTEST_PACKAGE			"janus.plugin.echotest"
 
+/* RTP extension latency probes are stamped with, and how many bytes they need */
+#define JANUS_ECHOTEST_PROBE_EXTMAP		"http://www.meetecho.com/experiments/rtp-hdrext/janus-probe"
+#define JANUS_ECHOTEST_PROBE_LENGTH		8
+
 /* Plugin methods */
 janus_plugin *create(void);
 int janus_echotest_init(janus_callbacks *callback, const char *config_path);
@@ -133,6 +163,7 @@ void janus_echotest_create_session(janus_plugin_session *handle, int *error);
 struct janus_plugin_result *janus_echotest_handle_message(janus_plugin_session *handle, char *transaction, json_t *message, json_t *jsep);
 void janus_echotest_setup_media(janus_plugin_session *handle);
 void janus_echotest_incoming_rtp(janus_plugin_session *handle, int video, char *buf, int len);
+void janus_echotest_incoming_rtp_packet(janus_plugin_session *handle, janus_plugin_rtp_packet *packet);
 void janus_echotest_incoming_rtcp(janus_plugin_session *handle, int video, char *buf, int len);
 void janus_echotest_incoming_data(janus_plugin_session *handle, char *buf, int len);
 void janus_echotest_slow_link(janus_plugin_session *handle, int uplink, int video);
@@ -158,6 +189,7 @@ static janus_plugin janus_echotest_plugin =
 		.handle_message = janus_echotest_handle_message,
 		.setup_media = janus_echotest_setup_media,
 		.incoming_rtp = janus_echotest_incoming_rtp,
+		.incoming_rtp_packet = janus_echotest_incoming_rtp_packet,
 		.incoming_rtcp = janus_echotest_incoming_rtcp,
 		.incoming_data = janus_echotest_incoming_data,
 		.slow_link = janus_echotest_slow_link,
@@ -204,6 +236,9 @@ typedef struct janus_echotest_session {
 	uint32_t ssrc[3];		/* Only needed in case VP8 simulcasting is involved */
 	int rtpmapid_extmap_id;	/* Only needed in case Firefox's RID-based simulcasting is involved */
 	char *rid[3];			/* Only needed in case Firefox's RID-based simulcasting is involved */
+	int probe_extmap_id;	/* ID of the latency probe extension, if negotiated */
+	guint64 probes;			/* How many latency probes we stamped */
+	gint64 probe_delay_total, probe_delay_max;	/* Processing time of the probes, in microseconds */
 	int substream;			/* Which simulcast substream we should forward back */
 	int substream_target;	/* As above, but to handle transitions (e.g., wait for keyframe) */
 	int templayer;			/* Which simulcast temporal layer we should forward back */
@@ -396,6 +431,7 @@ void janus_echotest_create_session(janus_plugin_session *handle, int *error) {
 	session->templayer = -1;
 	session->templayer_target = 0;
 	session->last_relayed = 0;
+	session->probe_extmap_id = -1;
 	janus_vp8_simulcast_context_reset(&session->simulcast_context);
 	session->destroyed = 0;
 	g_atomic_int_set(&session->hangingup, 0);
@@ -469,6 +505,16 @@ json_t *janus_echotest_query_session(janus_plugin_session *handle) {
 			json_object_set_new(recording, "data", json_string(session->drc->filename));
 		json_object_set_new(info, "recording", recording);
 	}
+	if(session->probe_extmap_id > 0) {
+		json_t *probe = json_object();
+		json_object_set_new(probe, "extmap_id", json_integer(session->probe_extmap_id));
+		json_object_set_new(probe, "count", json_integer(session->probes));
+		if(session->probes > 0) {
+			json_object_set_new(probe, "avg_processing_us", json_integer(session->probe_delay_total/session->probes));
+			json_object_set_new(probe, "max_processing_us", json_integer(session->probe_delay_max));
+		}
+		json_object_set_new(info, "probe", probe);
+	}
 	json_object_set_new(info, "slowlink_count", json_integer(session->slowlink_count));
 	json_object_set_new(info, "hangingup", json_integer(g_atomic_int_get(&session->hangingup)));
 	json_object_set_new(info, "destroyed", json_integer(g_atomic_int_get(&session->destroyed)));
@@ -662,6 +708,29 @@ void janus_echotest_incoming_rtp(janus_plugin_session *handle, int video, char *
 	}
 }
 
+void janus_echotest_incoming_rtp_packet(janus_plugin_session *handle, janus_plugin_rtp_packet *packet) {
+	if(handle == NULL || g_atomic_int_get(&handle->stopped) || g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
+		return;
+	janus_echotest_session *session = (janus_echotest_session *)handle->plugin_handle;
+	if(session && session->probe_extmap_id > 0 && janus_rtp_ext_info_has(&packet->extensions, session->probe_extmap_id) &&
+			packet->extensions.length[session->probe_extmap_id] >= JANUS_ECHOTEST_PROBE_LENGTH) {
+		/* This is a latency probe: stamp when we received it, and how long it took us to get here */
+		gint64 now = janus_get_monotonic_time();
+		gint64 received = packet->received > 0 ? packet->received : now;
+		gint64 delay = now - received;
+		gint64 wallclock = janus_get_real_time() - delay;
+		guint32 sec = (guint32)(wallclock / G_USEC_PER_SEC) + 2208988800u;	/* NTP epoch */
+		guint32 frac = (guint32)(((wallclock % G_USEC_PER_SEC) << 16) / G_USEC_PER_SEC);
+		guint32 values[2] = { htonl((sec << 16) | frac), htonl((guint32)delay) };
+		memcpy(packet->buffer + packet->extensions.offset[session->probe_extmap_id], values, sizeof(values));
+		session->probes++;
+		session->probe_delay_total += delay;
+		if(delay > session->probe_delay_max)
+			session->probe_delay_max = delay;
+	}
+	janus_echotest_incoming_rtp(handle, packet->video, packet->buffer, packet->length);
+}
+
 void janus_echotest_incoming_rtcp(janus_plugin_session *handle, int video, char *buf, int len) {
 	if(handle == NULL || g_atomic_int_get(&handle->stopped) || g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
 		return;
@@ -1153,7 +1222,7 @@ static void *janus_echotest_handler(void *data) {
 			/* Answer the offer and send it to the gateway, to start the echo test */
 			const char *type = "answer";
 			char error_str[512];
-			janus_sdp *offer = janus_sdp_parse(msg_sdp, error_str, sizeof(error_str));
+			janus_sdp *offer = janus_sdp_parse_transient(msg_sdp, error_str, sizeof(error_str));
 			if(offer == NULL) {
 				json_decref(event);
 				JANUS_LOG(LOG_ERR, "Error parsing offer: %s\n", error_str);
@@ -1164,10 +1233,31 @@ static void *janus_echotest_handler(void *data) {
 			/* Check if we need to negotiate the rtp-stream-id extension */
 			session->rtpmapid_extmap_id = -1;
 			janus_sdp_mdirection extmap_mdir = JANUS_SDP_SENDRECV;
+			/* Check if this is a monitoring client that wants latency probes too */
+			int probe_extmap_id = -1;
+			gboolean probe_audio = FALSE, probe_video = FALSE;
 			GList *temp = offer->m_lines;
 			while(temp) {
 				/* Which media are available? */
 				janus_sdp_mline *m = (janus_sdp_mline *)temp->data;
+				if((m->type == JANUS_SDP_AUDIO || m->type == JANUS_SDP_VIDEO) && m->port > 0) {
+					GList *ma = m->attributes;
+					while(ma) {
+						janus_sdp_attribute *a = (janus_sdp_attribute *)ma->data;
+						if(a->name && a->value && !strcasecmp(a->name, "extmap") && strstr(a->value, JANUS_ECHOTEST_PROBE_EXTMAP)) {
+							int id = atoi(a->value);
+							if(id > 0 && id <= JANUS_RTP_EXT_INFO_MAX_ID && (probe_extmap_id == -1 || probe_extmap_id == id)) {
+								probe_extmap_id = id;
+								if(m->type == JANUS_SDP_AUDIO)
+									probe_audio = TRUE;
+								else
+									probe_video = TRUE;
+							}
+							break;
+						}
+						ma = ma->next;
+					}
+				}
 				if(m->type == JANUS_SDP_VIDEO && m->port > 0) {
 					/* Are the extmaps we care about there? */
 					GList *ma = m->attributes;
@@ -1213,6 +1303,17 @@ static void *janus_echotest_handler(void *data) {
 					"%d%s %s\r\n", session->rtpmapid_extmap_id, direction, JANUS_RTP_EXTMAP_RTP_STREAM_ID);
 				janus_sdp_attribute_add_to_mline(janus_sdp_mline_find(answer, JANUS_SDP_VIDEO), a);
 			}
+			session->probe_extmap_id = probe_extmap_id;
+			if(probe_audio && janus_sdp_mline_find(answer, JANUS_SDP_AUDIO)) {
+				janus_sdp_attribute *a = janus_sdp_attribute_create("extmap",
+					"%d %s\r\n", probe_extmap_id, JANUS_ECHOTEST_PROBE_EXTMAP);
+				janus_sdp_attribute_add_to_mline(janus_sdp_mline_find(answer, JANUS_SDP_AUDIO), a);
+			}
+			if(probe_video && janus_sdp_mline_find(answer, JANUS_SDP_VIDEO)) {
+				janus_sdp_attribute *a = janus_sdp_attribute_create("extmap",
+					"%d %s\r\n", probe_extmap_id, JANUS_ECHOTEST_PROBE_EXTMAP);
+				janus_sdp_attribute_add_to_mline(janus_sdp_mline_find(answer, JANUS_SDP_VIDEO), a);
+			}
 			if(janus_sdp_get_codec_pt(answer, "vp8") < 0) {
 				/* VP8 was not negotiated, if simulcasting was enabled then disable it here */
 				session->ssrc[0] = 0;
@@ -84,13 +84,19 @@
  * - \c configureMedium(): specify whether audio/video/data can be received/sent;
  * - \c addRecipient(): specify which user should receive a user's media;
  * - \c removeRecipient(): specify which user should not receive a user's media anymore;
+ * - \c addRoute(): relay a user's media to another user in C, bypassing Lua (see below);
+ * - \c setRouteSimulcast(): choose the substream and temporal layer a route should relay;
+ * - \c removeRoute(): stop relaying a user's media to another user in C;
  * - \c setBitrate(): specify the bitrate to force on a user via REMB feedback;
  * - \c setPliFreq(): specify how often the plugin should send a PLI to this user;
  * - \c sendPli(): send a PLI (keyframe request);
  * - \c startRecording(): start recording audio, video and or data for a user;
  * - \c stopRecording(): start recording audio, video and or data for a user;
  * - \c pokeScheduler(): notify the C code that there's a coroutine to resume;
- * - \c timeCallback(): trigger the execution of a Lua function after X milliseconds.
+ * - \c timeCallback(): trigger the execution of a Lua function after X milliseconds;
+ * - \c setSharedValue(): set (or remove, if \c nil) a string value all Lua VMs can access;
+ * - \c getSharedValue(): get a string value set by any Lua VM;
+ * - \c publishMessage(): send a string message on a named channel to all other Lua VMs.
  *
  * As anticipated in the previous section, almost all these methods also
  * expect the unique session identifier to address a specific user in the
@@ -175,6 +181,76 @@ timeCallback("resumeScheduler", nil, 0)
  * compact and less verbose, and as such is preferred in cases where
  * timing and opaque arguments are not needed.
  *
+ * \section luavms Multiple Lua VMs
+ *
+ * By default the script is loaded in a single Lua state, which means
+ * that all callbacks (messages, timers, coroutines, and so on) are
+ * serialized, and the Lua logic can't use more than one core. Setting
+ * the \c vms property in the plugin configuration to a higher value
+ * loads the same script in as many independent Lua states instead: each
+ * state has its own lock, coroutines scheduler and timer loop, and each
+ * session is pinned to one of them when it's created. This means all the
+ * callbacks for a session (and all the timers and coroutines originated
+ * by it) will always be executed in the same state, while sessions pinned
+ * to different states will be handled in parallel.
+ *
+ * The flip side is that Lua variables are not shared across states, so
+ * a script that correlates different sessions (e.g., the VideoRoom sample)
+ * only sees the sessions pinned to its own state. Scripts that need to
+ * share something can use \c setSharedValue() and \c getSharedValue(),
+ * which access a key/value store all states share, or \c publishMessage():
+ * the latter delivers a message to all the other states, by invoking their
+ * \c channelMessage(channel, message) function, if the script implements it:
+ *
+ * \verbatim
+-- Let the other VMs know about a new room
+publishMessage("rooms", "{\"created\":1234}")
+-- ... which they'll receive as
+function channelMessage(channel, message)
+	-- channel is "rooms", message is the string above
+end
+\endverbatim
+ *
+ * Messages are delivered asynchronously, by the scheduler of each state,
+ * and \c publishMessage() returns how many states they were sent to. The
+ * Admin API information for Lua sessions includes, besides what the script
+ * returns in \c querySession(), a \c lua object with the state the session
+ * is pinned to and, for all states, how many sessions they have and how
+ * long callbacks had to wait to lock them.
+ *
+ * \section luaroutes Media routes
+ *
+ * Scripts that implement \c incomingRtp() or \c incomingData() get all
+ * packets passed to Lua, which means locking the Lua state for each of
+ * them: this is flexible, but it doesn't scale when many users exchange
+ * media. Scripts that only need to decide who gets what, rather than
+ * manipulate the packets themselves, can configure media routes instead:
+ *
+ * \verbatim
+-- Relay audio and video (but not data) from user 1234 to user 5678
+addRoute(1234, 5678, true, true, false)
+-- If 1234 is simulcasting, only relay the medium substream and base layer
+setRouteSimulcast(1234, 5678, 1, 0)
+-- Done
+removeRoute(1234, 5678)
+\endverbatim
+ *
+ * Calling \c addRoute() again for the same users updates the route. As
+ * long as a user has at least a route for a medium, packets of that medium
+ * are relayed by the plugin in C to all the routes recipients (with their
+ * sequence numbers and timestamps fixed, and with the same checks on what
+ * users can send and receive \c configureMedium() is used for), and are
+ * NOT passed to \c incomingRtp() or \c incomingData(), nor to the
+ * recipients added with \c addRecipient(). If the user is simulcasting,
+ * each route can relay a different VP8 substream and temporal layer: by
+ * default the highest quality is relayed, falling back to lower substreams
+ * when the target one isn't available, and keyframe requests are sent to
+ * the user automatically when a route is added or a substream is changed.
+ * Routes are removed automatically when the user's PeerConnection goes
+ * away, and are listed in the \c lua object of the Admin API information
+ * for the user. Everything else (e.g., RTCP feedback from recipients,
+ * \c setPliFreq() or \c setBitrate()) is still up to the Lua script.
+ *
  * Refer to the \ref luapapi section for more information on how you
  * can register your own C functions.
  */
@@ -254,8 +330,10 @@ volatile gint lua_initialized = 0, lua_stopping = 0;
 janus_callbacks *janus_core = NULL;
 
 /* Lua stuff */
-lua_State *lua_state = NULL;
-janus_mutex lua_mutex = JANUS_MUTEX_INITIALIZER;
+janus_lua_vm *lua_vms = NULL;
+guint lua_vms_num = 1;
+/* Key we use to store the VM pointer in the registry of each Lua state */
+#define JANUS_LUA_VM_KEY	"janus_lua_vm"
 static const char *lua_functions[] = {
 	"init", "destroy", "resumeScheduler",
 	"createSession", "destroySession", "querySession",
@@ -279,19 +357,30 @@ static char *lua_script_package = NULL;
 static gboolean has_incoming_rtp = FALSE;
 static gboolean has_incoming_rtcp = FALSE;
 static gboolean has_incoming_data = FALSE;
-/* Lua C scheduler (for coroutines) */
-static GThread *scheduler_thread = NULL;
+static gboolean has_channel_message = FALSE;
+/* Lua C scheduler (for coroutines), one per VM */
 static void *janus_lua_scheduler(void *data);
-static GAsyncQueue *events = NULL;
-typedef enum janus_lua_event {
+typedef enum janus_lua_event_type {
 	janus_lua_event_none = 0,
 	janus_lua_event_resume,		/* Resume one or more pending coroutines */
+	janus_lua_event_channel,	/* Deliver a message published on a channel */
 	janus_lua_event_exit		/* Break the scheduler loop */
+} janus_lua_event_type;
+typedef struct janus_lua_event {
+	janus_lua_event_type type;
+	char *channel;				/* Channel the message was published on, if any */
+	char *message;				/* Content of the message, if any */
 } janus_lua_event;
-/* Lua timer loop (for scheduled callbacks) */
-static GMainContext *timer_context = NULL;
-static GMainLoop *timer_loop = NULL;
-static GThread *timer_thread = NULL;
+static janus_lua_event resume_event = { janus_lua_event_resume, NULL, NULL };
+static janus_lua_event exit_event = { janus_lua_event_exit, NULL, NULL };
+static void janus_lua_event_free(janus_lua_event *event) {
+	if(event == NULL || event == &resume_event || event == &exit_event)
+		return;
+	g_free(event->channel);
+	g_free(event->message);
+	g_free(event);
+}
+/* Lua timer loop (for scheduled callbacks), one per VM */
 static void *janus_lua_timer(void *data);
 static gboolean janus_lua_timer_cb(void *data);
 typedef struct janus_lua_callback {
@@ -300,7 +389,68 @@ typedef struct janus_lua_callback {
 	GSource *source;
 	char *function;
 	char *argument;
+	janus_lua_vm *vm;
 } janus_lua_callback;
+/* Values shared by all VMs, e.g., to correlate sessions pinned to different VMs */
+static GHashTable *lua_shared = NULL;
+static janus_mutex lua_shared_mutex = JANUS_MUTEX_INITIALIZER;
+
+/* Helpers to manage the Lua VMs */
+janus_lua_vm *janus_lua_vm_get(guint32 id) {
+	if(lua_vms == NULL || lua_vms_num == 0)
+		return NULL;
+	/* Session IDs are random, so they're already evenly spread */
+	return &lua_vms[id % lua_vms_num];
+}
+
+void janus_lua_vm_lock(janus_lua_vm *vm) {
+	if(vm == NULL)
+		return;
+	gint64 waited = 0;
+	if(pthread_mutex_trylock(&vm->mutex) != 0) {
+		/* Somebody else is using this state, keep track of how long we wait */
+		gint64 start = janus_get_monotonic_time();
+		janus_mutex_lock(&vm->mutex);
+		waited = janus_get_monotonic_time() - start;
+	}
+	janus_mutex_lock(&vm->stats_mutex);
+	vm->locks++;
+	if(waited > 0) {
+		vm->contended++;
+		vm->wait_total += waited;
+		if(waited > vm->wait_max)
+			vm->wait_max = waited;
+	}
+	janus_mutex_unlock(&vm->stats_mutex);
+}
+
+void janus_lua_vm_unlock(janus_lua_vm *vm) {
+	if(vm == NULL)
+		return;
+	janus_mutex_unlock(&vm->mutex);
+}
+
+/* Get the VM a Lua state (or any coroutine created in it) belongs to */
+static janus_lua_vm *janus_lua_vm_from_state(lua_State *s) {
+	lua_getfield(s, LUA_REGISTRYINDEX, JANUS_LUA_VM_KEY);
+	janus_lua_vm *vm = (janus_lua_vm *)lua_touserdata(s, -1);
+	lua_pop(s, 1);
+	return vm;
+}
+
+static json_t *janus_lua_vm_info(janus_lua_vm *vm) {
+	json_t *info = json_object();
+	json_object_set_new(info, "id", json_integer(vm->id));
+	json_object_set_new(info, "sessions", json_integer(g_atomic_int_get(&vm->sessions)));
+	janus_mutex_lock(&vm->stats_mutex);
+	json_object_set_new(info, "locks", json_integer(vm->locks));
+	json_object_set_new(info, "contended", json_integer(vm->contended));
+	json_object_set_new(info, "wait-total-us", json_integer(vm->wait_total));
+	json_object_set_new(info, "wait-avg-us", json_integer(vm->contended ? vm->wait_total/(gint64)vm->contended : 0));
+	json_object_set_new(info, "wait-max-us", json_integer(vm->wait_max));
+	janus_mutex_unlock(&vm->stats_mutex);
+	return info;
+}
 
 /* Helper function to sample the number of occupied slots into Lua stack */
 static void janus_lua_stackdump(lua_State* l) {
@@ -341,6 +491,146 @@ typedef struct janus_lua_rtp_relay_packet {
 static void janus_lua_relay_rtp_packet(gpointer data, gpointer user_data);
 static void janus_lua_relay_data_packet(gpointer data, gpointer user_data);
 
+/* Media routes: the Lua script decides who should get what, but packets are
+ * relayed in C without involving the Lua state at all (see addRoute) */
+static janus_lua_route *janus_lua_route_find(janus_lua_session *session, janus_lua_session *recipient) {
+	GSList *l = session->routes;
+	while(l) {
+		janus_lua_route *route = (janus_lua_route *)l->data;
+		if(route->recipient == recipient)
+			return route;
+		l = l->next;
+	}
+	return NULL;
+}
+
+static void janus_lua_route_free(janus_lua_route *route) {
+	if(route == NULL)
+		return;
+	janus_refcount_decrease(&route->recipient->ref);
+	g_free(route);
+}
+
+/* Update the flags we check on incoming packets: must be called with routes_mutex locked */
+static void janus_lua_routes_update(janus_lua_session *session) {
+	gint routed = 0;
+	GSList *l = session->routes;
+	while(l) {
+		janus_lua_route *route = (janus_lua_route *)l->data;
+		if(route->audio)
+			routed |= JANUS_LUA_ROUTED_AUDIO;
+		if(route->video)
+			routed |= JANUS_LUA_ROUTED_VIDEO;
+		if(route->data)
+			routed |= JANUS_LUA_ROUTED_DATA;
+		l = l->next;
+	}
+	g_atomic_int_set(&session->routed, routed);
+}
+
+static void janus_lua_routes_clear(janus_lua_session *session) {
+	janus_mutex_lock(&session->routes_mutex);
+	g_slist_free_full(session->routes, (GDestroyNotify)janus_lua_route_free);
+	session->routes = NULL;
+	g_atomic_int_set(&session->routed, 0);
+	janus_mutex_unlock(&session->routes_mutex);
+}
+
+static void janus_lua_route_rtp(janus_lua_session *session, janus_lua_route *route, janus_lua_rtp_relay_packet *packet) {
+	janus_lua_session *recipient = route->recipient;
+	if(!recipient->handle || !g_atomic_int_get(&recipient->started) || g_atomic_int_get(&recipient->destroyed))
+		return;
+	if(!packet->is_video) {
+		if(!route->audio || !recipient->accept_audio)
+			return;
+		janus_rtp_header_update((janus_rtp_header *)packet->data, &route->context, FALSE, 960);
+		janus_core->relay_rtp(recipient->handle, 0, (char *)packet->data, packet->length);
+		packet->data->timestamp = htonl(packet->timestamp);
+		packet->data->seq_number = htons(packet->seq_number);
+		return;
+	}
+	if(!route->video || !recipient->accept_video)
+		return;
+	if(session->ssrc[0] == 0) {
+		/* No simulcast, just fix sequence number and timestamp and relay */
+		janus_rtp_header_update((janus_rtp_header *)packet->data, &route->context, TRUE, 4500);
+		janus_core->relay_rtp(recipient->handle, 1, (char *)packet->data, packet->length);
+		packet->data->timestamp = htonl(packet->timestamp);
+		packet->data->seq_number = htons(packet->seq_number);
+		return;
+	}
+	/* Handle simulcast: don't relay if it's not the SSRC we wanted to handle */
+	uint32_t ssrc = ntohl(packet->data->ssrc);
+	int plen = 0;
+	char *payload = janus_rtp_payload((char *)packet->data, packet->length, &plen);
+	if(payload == NULL)
+		return;
+	gboolean switched = FALSE;
+	if(route->substream != route->substream_target) {
+		/* There has been a change: switch as soon as we get packets from the target */
+		int step = (route->substream < 1 && route->substream_target == 2);
+		if(ssrc == session->ssrc[route->substream_target] || (step && ssrc == session->ssrc[step])) {
+			route->substream = (ssrc == session->ssrc[route->substream_target] ? route->substream_target : step);
+			JANUS_LOG(LOG_VERB, "Route %"SCNu32" --> %"SCNu32" switched to substream %d\n",
+				session->id, recipient->id, route->substream);
+			switched = TRUE;
+		}
+	}
+	gint64 now = janus_get_monotonic_time();
+	if(route->last_relayed == 0) {
+		/* Let's start slow */
+		route->last_relayed = now;
+	} else if(now-route->last_relayed >= 250000) {
+		/* No packet relayed for 250ms, fallback to a lower substream */
+		route->last_relayed = now;
+		int substream = route->substream-1;
+		if(substream < 0)
+			substream = 0;
+		if(route->substream != substream) {
+			JANUS_LOG(LOG_WARN, "No packet received on substream %d for a while, falling back to %d\n",
+				route->substream, substream);
+			route->substream = substream;
+			/* Send a PLI */
+			session->pli_latest = now;
+			char rtcpbuf[12];
+			janus_rtcp_pli((char *)&rtcpbuf, 12);
+			janus_core->relay_rtcp(session->handle, 1, rtcpbuf, 12);
+		}
+	}
+	if(route->substream < 0 || ssrc != session->ssrc[route->substream])
+		return;
+	route->last_relayed = now;
+	/* Check if there's any temporal scalability to take into account */
+	uint16_t picid = 0;
+	uint8_t tlzi = 0;
+	uint8_t tid = 0;
+	uint8_t ybit = 0;
+	uint8_t keyidx = 0;
+	if(janus_vp8_parse_descriptor(payload, plen, &picid, &tlzi, &tid, &ybit, &keyidx) == 0) {
+		if(route->templayer != route->templayer_target) {
+			route->templayer = route->templayer_target;
+			JANUS_LOG(LOG_VERB, "Route %"SCNu32" --> %"SCNu32" switched to temporal layer %d\n",
+				session->id, recipient->id, route->templayer);
+		}
+		if(tid > route->templayer) {
+			/* We increase the base sequence number, or there will be gaps when delivering later */
+			janus_rtp_switching_context_skip(&route->context, TRUE);
+			return;
+		}
+	}
+	/* If we got here, update the RTP header and send the packet */
+	janus_rtp_header_update((janus_rtp_header *)packet->data, &route->context, TRUE, 4500);
+	char vp8pd[6];
+	int pdlen = plen < (int)sizeof(vp8pd) ? plen : (int)sizeof(vp8pd);
+	memcpy(vp8pd, payload, pdlen);
+	janus_vp8_simulcast_descriptor_update(payload, plen, &route->simulcast_context, switched);
+	janus_core->relay_rtp(recipient->handle, 1, (char *)packet->data, packet->length);
+	/* Restore what the publisher set, as it will be needed by the next route */
+	packet->data->timestamp = htonl(packet->timestamp);
+	packet->data->seq_number = htons(packet->seq_number);
+	memcpy(payload, vp8pd, pdlen);
+}
+
 
 /* Helper struct to address outgoing notifications, e.g., involving PeerConnections */
 typedef enum janus_lua_async_event_type {
@@ -377,7 +667,12 @@ static void *janus_lua_async_event_helper(void *data) {
 /* Methods that we expose to the Lua script */
 static int janus_lua_method_pokescheduler(lua_State *s) {
 	/* This method allows the Lua script to poke the scheduler and have it wake up ASAP */
-	g_async_queue_push(events, GUINT_TO_POINTER(janus_lua_event_resume));
+	janus_lua_vm *vm = janus_lua_vm_from_state(s);
+	if(vm == NULL) {
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	g_async_queue_push(vm->events, &resume_event);
 	lua_pushnumber(s, 0);
 	return 1;
 }
@@ -398,21 +693,110 @@ static int janus_lua_method_timecallback(lua_State *s) {
 	}
 	const char *argument = lua_tostring(s, 2);
 	guint32 ms = lua_tonumber(s, 3);
-	/* Create a callback instance */
+	janus_lua_vm *vm = janus_lua_vm_from_state(s);
+	if(vm == NULL) {
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	/* Create a callback instance (the callback will be invoked in the same VM) */
 	janus_lua_callback *cb = g_malloc0(sizeof(janus_lua_callback));
+	cb->vm = vm;
 	cb->function = g_strdup(function);
 	if(argument != NULL)
 		cb->argument = g_strdup(argument);
 	cb->ms = ms;
 	cb->source = g_timeout_source_new(ms);
 	g_source_set_callback(cb->source, janus_lua_timer_cb, cb, NULL);
-	cb->id = g_source_attach(cb->source, timer_context);
+	cb->id = g_source_attach(cb->source, vm->timer_context);
 	JANUS_LOG(LOG_WARN, "Created scheduled callback (%"SCNu32"ms) with ID %u\n", cb->ms, cb->id);
 	/* Done */
 	lua_pushnumber(s, 0);
 	return 1;
 }
 
+static int janus_lua_method_setsharedvalue(lua_State *s) {
+	/* This method allows the Lua script to set a value all VMs can access (nil removes it) */
+	int n = lua_gettop(s);
+	if(n != 2) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 2)\n", n);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	const char *key = lua_tostring(s, 1);
+	if(key == NULL) {
+		JANUS_LOG(LOG_ERR, "Invalid argument (missing key)\n");
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	const char *value = lua_tostring(s, 2);
+	janus_mutex_lock(&lua_shared_mutex);
+	if(value == NULL)
+		g_hash_table_remove(lua_shared, key);
+	else
+		g_hash_table_insert(lua_shared, g_strdup(key), g_strdup(value));
+	janus_mutex_unlock(&lua_shared_mutex);
+	lua_pushnumber(s, 0);
+	return 1;
+}
+
+static int janus_lua_method_getsharedvalue(lua_State *s) {
+	/* This method allows the Lua script to get a value set by any VM */
+	int n = lua_gettop(s);
+	if(n != 1) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 1)\n", n);
+		lua_pushnil(s);
+		return 1;
+	}
+	const char *key = lua_tostring(s, 1);
+	if(key == NULL) {
+		lua_pushnil(s);
+		return 1;
+	}
+	janus_mutex_lock(&lua_shared_mutex);
+	const char *value = g_hash_table_lookup(lua_shared, key);
+	if(value == NULL)
+		lua_pushnil(s);
+	else
+		lua_pushstring(s, value);
+	janus_mutex_unlock(&lua_shared_mutex);
+	return 1;
+}
+
+static int janus_lua_method_publishmessage(lua_State *s) {
+	/* This method allows the Lua script to send a message to all the other VMs */
+	int n = lua_gettop(s);
+	if(n != 2) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 2)\n", n);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	const char *channel = lua_tostring(s, 1);
+	const char *message = lua_tostring(s, 2);
+	if(channel == NULL || message == NULL) {
+		JANUS_LOG(LOG_ERR, "Invalid arguments (missing channel or message)\n");
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	janus_lua_vm *vm = janus_lua_vm_from_state(s);
+	int reached = 0;
+	if(has_channel_message) {
+		/* Messages are delivered by the scheduler of each VM, asynchronously */
+		guint i = 0;
+		for(i=0; i<lua_vms_num; i++) {
+			if(&lua_vms[i] == vm)
+				continue;
+			janus_lua_event *event = g_malloc0(sizeof(janus_lua_event));
+			event->type = janus_lua_event_channel;
+			event->channel = g_strdup(channel);
+			event->message = g_strdup(message);
+			g_async_queue_push(lua_vms[i].events, event);
+			reached++;
+		}
+	}
+	lua_pushnumber(s, reached);
+	return 1;
+}
+
 static int janus_lua_method_pushevent(lua_State *s) {
 	/* Get the arguments from the provided state */
 	int n = lua_gettop(s);
@@ -729,6 +1113,160 @@ static int janus_lua_method_removerecipient(lua_State *s) {
 	return 1;
 }
 
+static int janus_lua_method_addroute(lua_State *s) {
+	/* Get the arguments from the provided state */
+	int n = lua_gettop(s);
+	if(n != 5) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 5)\n", n);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	guint32 id = lua_tonumber(s, 1);
+	guint32 rid = lua_tonumber(s, 2);
+	gboolean audio = lua_toboolean(s, 3);
+	gboolean video = lua_toboolean(s, 4);
+	gboolean data = lua_toboolean(s, 5);
+	if(id == rid) {
+		JANUS_LOG(LOG_ERR, "Can't route media from a session to itself\n");
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	/* Find the sessions */
+	janus_mutex_lock(&lua_sessions_mutex);
+	janus_lua_session *session = g_hash_table_lookup(lua_ids, GUINT_TO_POINTER(id));
+	janus_lua_session *recipient = g_hash_table_lookup(lua_ids, GUINT_TO_POINTER(rid));
+	if(session == NULL || g_atomic_int_get(&session->destroyed) ||
+			recipient == NULL || g_atomic_int_get(&recipient->destroyed)) {
+		janus_mutex_unlock(&lua_sessions_mutex);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	janus_refcount_increase(&session->ref);
+	janus_refcount_increase(&recipient->ref);
+	janus_mutex_unlock(&lua_sessions_mutex);
+	/* Add a new route, or update the existing one */
+	janus_mutex_lock(&session->routes_mutex);
+	janus_lua_route *route = janus_lua_route_find(session, recipient);
+	if(route == NULL) {
+		route = g_malloc0(sizeof(janus_lua_route));
+		janus_refcount_increase(&recipient->ref);
+		route->recipient = recipient;
+		route->substream = -1;
+		route->substream_target = 2;	/* Let's aim for the highest quality */
+		route->templayer = -1;
+		route->templayer_target = 2;	/* Let's aim for all temporal layers */
+		janus_rtp_switching_context_reset(&route->context);
+		janus_vp8_simulcast_context_reset(&route->simulcast_context);
+		session->routes = g_slist_append(session->routes, route);
+	}
+	gboolean pli = video && !route->video;
+	route->audio = audio;
+	route->video = video;
+	route->data = data;
+	janus_lua_routes_update(session);
+	janus_mutex_unlock(&session->routes_mutex);
+	if(pli && g_atomic_int_get(&session->started)) {
+		/* New video recipient, send a keyframe request */
+		session->pli_latest = janus_get_monotonic_time();
+		char rtcpbuf[12];
+		janus_rtcp_pli((char *)&rtcpbuf, 12);
+		janus_core->relay_rtcp(session->handle, 1, rtcpbuf, 12);
+	}
+	/* Done */
+	janus_refcount_decrease(&session->ref);
+	janus_refcount_decrease(&recipient->ref);
+	lua_pushnumber(s, 0);
+	return 1;
+}
+
+static int janus_lua_method_setroutesimulcast(lua_State *s) {
+	/* Get the arguments from the provided state */
+	int n = lua_gettop(s);
+	if(n != 4) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 4)\n", n);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	guint32 id = lua_tonumber(s, 1);
+	guint32 rid = lua_tonumber(s, 2);
+	int substream = lua_tonumber(s, 3);
+	int temporal = lua_tonumber(s, 4);
+	if(substream < 0 || substream > 2 || temporal < 0 || temporal > 2) {
+		JANUS_LOG(LOG_ERR, "Invalid substream (%d) or temporal layer (%d)\n", substream, temporal);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	/* Find the sessions */
+	janus_mutex_lock(&lua_sessions_mutex);
+	janus_lua_session *session = g_hash_table_lookup(lua_ids, GUINT_TO_POINTER(id));
+	janus_lua_session *recipient = g_hash_table_lookup(lua_ids, GUINT_TO_POINTER(rid));
+	if(session == NULL || g_atomic_int_get(&session->destroyed) || recipient == NULL) {
+		janus_mutex_unlock(&lua_sessions_mutex);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	janus_refcount_increase(&session->ref);
+	janus_mutex_unlock(&lua_sessions_mutex);
+	janus_mutex_lock(&session->routes_mutex);
+	janus_lua_route *route = janus_lua_route_find(session, recipient);
+	if(route == NULL) {
+		janus_mutex_unlock(&session->routes_mutex);
+		janus_refcount_decrease(&session->ref);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	gboolean pli = (route->substream_target != substream);
+	route->substream_target = substream;
+	route->templayer_target = temporal;
+	janus_mutex_unlock(&session->routes_mutex);
+	if(pli && session->ssrc[0] != 0 && g_atomic_int_get(&session->started)) {
+		/* We'll need a keyframe on the new substream */
+		session->pli_latest = janus_get_monotonic_time();
+		char rtcpbuf[12];
+		janus_rtcp_pli((char *)&rtcpbuf, 12);
+		janus_core->relay_rtcp(session->handle, 1, rtcpbuf, 12);
+	}
+	/* Done */
+	janus_refcount_decrease(&session->ref);
+	lua_pushnumber(s, 0);
+	return 1;
+}
+
+static int janus_lua_method_removeroute(lua_State *s) {
+	/* Get the arguments from the provided state */
+	int n = lua_gettop(s);
+	if(n != 2) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 2)\n", n);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	guint32 id = lua_tonumber(s, 1);
+	guint32 rid = lua_tonumber(s, 2);
+	/* Find the sessions */
+	janus_mutex_lock(&lua_sessions_mutex);
+	janus_lua_session *session = g_hash_table_lookup(lua_ids, GUINT_TO_POINTER(id));
+	janus_lua_session *recipient = g_hash_table_lookup(lua_ids, GUINT_TO_POINTER(rid));
+	if(session == NULL || recipient == NULL) {
+		janus_mutex_unlock(&lua_sessions_mutex);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	janus_refcount_increase(&session->ref);
+	janus_mutex_unlock(&lua_sessions_mutex);
+	janus_mutex_lock(&session->routes_mutex);
+	janus_lua_route *route = janus_lua_route_find(session, recipient);
+	if(route != NULL) {
+		session->routes = g_slist_remove(session->routes, route);
+		janus_lua_routes_update(session);
+	}
+	janus_mutex_unlock(&session->routes_mutex);
+	janus_lua_route_free(route);
+	/* Done */
+	janus_refcount_decrease(&session->ref);
+	lua_pushnumber(s, route ? 0 : -1);
+	return 1;
+}
+
 static int janus_lua_method_setbitrate(lua_State *s) {
 	/* Get the arguments from the provided state */
 	int n = lua_gettop(s);
@@ -1067,48 +1605,9 @@ static int janus_lua_method_stoprecording(lua_State *s) {
 }
 
 
-/* Plugin implementation */
-int janus_lua_init(janus_callbacks *callback, const char *config_path) {
-	if(g_atomic_int_get(&lua_stopping)) {
-		/* Still stopping from before */
-		return -1;
-	}
-	if(callback == NULL || config_path == NULL) {
-		/* Invalid arguments */
-		return -1;
-	}
-
-	/* Read configuration */
-	char filename[255];
-	g_snprintf(filename, 255, "%s/%s.cfg", config_path, JANUS_LUA_PACKAGE);
-	JANUS_LOG(LOG_VERB, "Configuration file: %s\n", filename);
-	janus_config *config = janus_config_parse(filename);
-	if(config == NULL) {
-		/* No config means no Lua script */
-		JANUS_LOG(LOG_ERR, "Failed to load configuration file for Lua plugin...\n");
-		return -1;
-	}
-	janus_config_print(config);
-	char *lua_folder = NULL;
-	janus_config_item *folder = janus_config_get_item_drilldown(config, "general", "path");
-	if(folder && folder->value)
-		lua_folder = g_strdup(folder->value);
-	janus_config_item *script = janus_config_get_item_drilldown(config, "general", "script");
-	if(script == NULL || script->value == NULL) {
-		JANUS_LOG(LOG_ERR, "Missing script path in Lua plugin configuration...\n");
-		janus_config_destroy(config);
-		g_free(lua_folder);
-		return -1;
-	}
-	char *lua_file = g_strdup(script->value);
-	char *lua_config = NULL;
-	janus_config_item *conf = janus_config_get_item_drilldown(config, "general", "config");
-	if(conf && conf->value)
-		lua_config = g_strdup(conf->value);
-	janus_config_destroy(config);
-
-	/* Initialize Lua */
-	lua_state = luaL_newstate();
+/* Helper to create a Lua state for a VM and load the script in it */
+static int janus_lua_vm_load(janus_lua_vm *vm, const char *lua_folder, const char *lua_file) {
+	lua_State *lua_state = luaL_newstate();
 	luaL_openlibs(lua_state);
 
 	if(lua_folder != NULL) {
@@ -1124,10 +1623,16 @@ int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 		lua_setfield(lua_state, -2, "path");
 		lua_pop(lua_state, 1);
 	}
+	/* Keep track of which VM this state belongs to */
+	lua_pushlightuserdata(lua_state, vm);
+	lua_setfield(lua_state, LUA_REGISTRYINDEX, JANUS_LUA_VM_KEY);
 
 	/* Register our functions */
 	lua_register(lua_state, "pokeScheduler", janus_lua_method_pokescheduler);
 	lua_register(lua_state, "timeCallback", janus_lua_method_timecallback);
+	lua_register(lua_state, "setSharedValue", janus_lua_method_setsharedvalue);
+	lua_register(lua_state, "getSharedValue", janus_lua_method_getsharedvalue);
+	lua_register(lua_state, "publishMessage", janus_lua_method_publishmessage);
 	lua_register(lua_state, "pushEvent", janus_lua_method_pushevent);
 	lua_register(lua_state, "notifyEvent", janus_lua_method_notifyevent);
 	lua_register(lua_state, "eventsIsEnabled", janus_lua_method_eventsisenabled);
@@ -1136,6 +1641,9 @@ int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 	lua_register(lua_state, "configureMedium", janus_lua_method_configuremedium);
 	lua_register(lua_state, "addRecipient", janus_lua_method_addrecipient);
 	lua_register(lua_state, "removeRecipient", janus_lua_method_removerecipient);
+	lua_register(lua_state, "addRoute", janus_lua_method_addroute);
+	lua_register(lua_state, "setRouteSimulcast", janus_lua_method_setroutesimulcast);
+	lua_register(lua_state, "removeRoute", janus_lua_method_removeroute);
 	lua_register(lua_state, "setBitrate", janus_lua_method_setbitrate);
 	lua_register(lua_state, "setPliFreq", janus_lua_method_setplifreq);
 	lua_register(lua_state, "sendPli", janus_lua_method_sendpli);
@@ -1152,8 +1660,6 @@ int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 	if(err) {
 		JANUS_LOG(LOG_ERR, "Error loading Lua script %s: %s\n", lua_file, lua_tostring(lua_state, -1));
 		lua_close(lua_state);
-		g_free(lua_folder);
-		g_free(lua_file);
 		return -1;
 	}
 	/* Make sure that all the functions we need are there */
@@ -1163,14 +1669,135 @@ int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 		if(lua_isfunction(lua_state, lua_gettop(lua_state)) == 0) {
 			JANUS_LOG(LOG_ERR, "Function '%s' is missing in %s\n", lua_functions[i], lua_file);
 			lua_close(lua_state);
+			return -1;
+		}
+	}
+	lua_settop(lua_state, 0);
+	vm->state = lua_state;
+	return 0;
+}
+
+/* Helper to stop the schedulers and timer loops of all VMs */
+static void janus_lua_vms_stop(void) {
+	if(lua_vms == NULL)
+		return;
+	uint i=0;
+	for(i=0; i<lua_vms_num; i++) {
+		janus_lua_vm *vm = &lua_vms[i];
+		if(vm->scheduler_thread != NULL) {
+			g_async_queue_push(vm->events, &exit_event);
+			g_thread_join(vm->scheduler_thread);
+			vm->scheduler_thread = NULL;
+		}
+		if(vm->timer_loop != NULL)
+			g_main_loop_quit(vm->timer_loop);
+		if(vm->timer_thread != NULL) {
+			g_thread_join(vm->timer_thread);
+			vm->timer_thread = NULL;
+		}
+		if(vm->timer_loop != NULL) {
+			g_main_loop_unref(vm->timer_loop);
+			vm->timer_loop = NULL;
+		}
+		if(vm->timer_context != NULL) {
+			g_main_context_unref(vm->timer_context);
+			vm->timer_context = NULL;
+		}
+	}
+}
+
+/* Helper to close all the Lua states and free the VMs */
+static void janus_lua_vms_free(void) {
+	if(lua_vms == NULL)
+		return;
+	uint i=0;
+	for(i=0; i<lua_vms_num; i++) {
+		janus_lua_vm *vm = &lua_vms[i];
+		janus_mutex_lock(&vm->mutex);
+		if(vm->state != NULL)
+			lua_close(vm->state);
+		vm->state = NULL;
+		janus_mutex_unlock(&vm->mutex);
+		if(vm->events != NULL)
+			g_async_queue_unref(vm->events);
+		vm->events = NULL;
+	}
+	g_free(lua_vms);
+	lua_vms = NULL;
+}
+
+
+/* Plugin implementation */
+int janus_lua_init(janus_callbacks *callback, const char *config_path) {
+	if(g_atomic_int_get(&lua_stopping)) {
+		/* Still stopping from before */
+		return -1;
+	}
+	if(callback == NULL || config_path == NULL) {
+		/* Invalid arguments */
+		return -1;
+	}
+
+	/* Read configuration */
+	char filename[255];
+	g_snprintf(filename, 255, "%s/%s.cfg", config_path, JANUS_LUA_PACKAGE);
+	JANUS_LOG(LOG_VERB, "Configuration file: %s\n", filename);
+	janus_config *config = janus_config_parse(filename);
+	if(config == NULL) {
+		/* No config means no Lua script */
+		JANUS_LOG(LOG_ERR, "Failed to load configuration file for Lua plugin...\n");
+		return -1;
+	}
+	janus_config_print(config);
+	char *lua_folder = NULL;
+	janus_config_item *folder = janus_config_get_item_drilldown(config, "general", "path");
+	if(folder && folder->value)
+		lua_folder = g_strdup(folder->value);
+	janus_config_item *script = janus_config_get_item_drilldown(config, "general", "script");
+	if(script == NULL || script->value == NULL) {
+		JANUS_LOG(LOG_ERR, "Missing script path in Lua plugin configuration...\n");
+		janus_config_destroy(config);
+		g_free(lua_folder);
+		return -1;
+	}
+	char *lua_file = g_strdup(script->value);
+	char *lua_config = NULL;
+	janus_config_item *conf = janus_config_get_item_drilldown(config, "general", "config");
+	if(conf && conf->value)
+		lua_config = g_strdup(conf->value);
+	janus_config_item *vms = janus_config_get_item_drilldown(config, "general", "vms");
+	if(vms && vms->value) {
+		int num = atoi(vms->value);
+		if(num < 1) {
+			JANUS_LOG(LOG_WARN, "Invalid number of Lua VMs (%d), using 1\n", num);
+			num = 1;
+		}
+		lua_vms_num = num;
+	}
+	janus_config_destroy(config);
+
+	/* Initialize Lua: we load the script in as many independent states as configured */
+	lua_vms = g_malloc0(lua_vms_num * sizeof(janus_lua_vm));
+	uint i=0;
+	for(i=0; i<lua_vms_num; i++) {
+		lua_vms[i].id = i;
+		janus_mutex_init(&lua_vms[i].mutex);
+		janus_mutex_init(&lua_vms[i].stats_mutex);
+	}
+	for(i=0; i<lua_vms_num; i++) {
+		if(janus_lua_vm_load(&lua_vms[i], lua_folder, lua_file) < 0) {
+			janus_lua_vms_free();
 			g_free(lua_folder);
 			g_free(lua_file);
+			g_free(lua_config);
 			return -1;
 		}
 	}
 	/* Some Lua functions are optional (e.g., those to directly handle RTP, RTCP and
 	 * data, as those will typically be kept at a C level, with Lua only dictating
-	 * the logic, or those overriding the plugin namespace and versioning information */
+	 * the logic, or those overriding the plugin namespace and versioning information):
+	 * all VMs run the same script, so checking the first one is enough */
+	lua_State *lua_state = lua_vms[0].state;
 	lua_getglobal(lua_state, "getVersion");
 	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0)
 		has_get_version = TRUE;
@@ -1198,39 +1825,54 @@ int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 	lua_getglobal(lua_state, "incomingData");
 	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0)
 		has_incoming_data = TRUE;
+	lua_getglobal(lua_state, "channelMessage");
+	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0)
+		has_channel_message = TRUE;
+	lua_settop(lua_state, 0);
 
 	lua_sessions = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_lua_session_destroy);
 	lua_ids = g_hash_table_new(NULL, NULL);
-	events = g_async_queue_new();
+	lua_shared = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, (GDestroyNotify)g_free);
+	for(i=0; i<lua_vms_num; i++)
+		lua_vms[i].events = g_async_queue_new_full((GDestroyNotify)janus_lua_event_free);
 
 	g_atomic_int_set(&lua_initialized, 1);
 
-	/* Launch the scheduler thread (which will be responsible for resuming asynchronous coroutines) */
+	/* Launch the scheduler threads (which will be responsible for resuming asynchronous
+	 * coroutines) and the timer loop threads (which will be responsible for scheduling
+	 * timed callbacks) for all the VMs */
 	GError *error = NULL;
-	scheduler_thread = g_thread_try_new("lua scheduler", janus_lua_scheduler, NULL, &error);
-	if(error != NULL) {
-		g_atomic_int_set(&lua_initialized, 0);
-		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Lua scheduler thread...\n",
-			error->code, error->message ? error->message : "??");
-		lua_close(lua_state);
-		g_free(lua_folder);
-		g_free(lua_file);
-		g_free(lua_config);
-		return -1;
+	for(i=0; i<lua_vms_num; i++) {
+		janus_lua_vm *vm = &lua_vms[i];
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "lua sched %u", vm->id);
+		vm->scheduler_thread = g_thread_try_new(tname, janus_lua_scheduler, vm, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Lua scheduler thread...\n",
+				error->code, error->message ? error->message : "??");
+			break;
+		}
+		vm->timer_context = g_main_context_new();
+		vm->timer_loop = g_main_loop_new(vm->timer_context, FALSE);
+		g_snprintf(tname, sizeof(tname), "lua timer %u", vm->id);
+		vm->timer_thread = g_thread_try_new(tname, janus_lua_timer, vm->timer_loop, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Lua timer loop thread...\n",
+				error->code, error->message ? error->message : "??");
+			break;
+		}
 	}
-	/* Launch the timer loop thread (which will be responsible for scheduling timed callbacks) */
-	timer_context = g_main_context_new();
-	timer_loop = g_main_loop_new(timer_context, FALSE);
-	timer_thread = g_thread_try_new("lua timer", janus_lua_timer, timer_loop, &error);
 	if(error != NULL) {
+		g_error_free(error);
 		g_atomic_int_set(&lua_initialized, 0);
-		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Lua timer loop thread...\n",
-			error->code, error->message ? error->message : "??");
-		if(timer_loop != NULL)
-			g_main_loop_unref(timer_loop);
-		if(timer_context != NULL)
-			g_main_context_unref(timer_context);
-		lua_close(lua_state);
+		janus_lua_vms_stop();
+		janus_lua_vms_free();
+		g_hash_table_destroy(lua_sessions);
+		lua_sessions = NULL;
+		g_hash_table_destroy(lua_ids);
+		lua_ids = NULL;
+		g_hash_table_destroy(lua_shared);
+		lua_shared = NULL;
 		g_free(lua_folder);
 		g_free(lua_file);
 		g_free(lua_config);
@@ -1240,16 +1882,20 @@ int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 	/* This is the callback we'll need to invoke to contact the gateway */
 	janus_core = callback;
 
-	/* Init the Lua script, in case it's needed */
-	lua_getglobal(lua_state, "init");
-	lua_pushstring(lua_state, lua_config);
-	lua_call(lua_state, 1, 0);
+	/* Init the Lua script in all VMs, in case it's needed */
+	for(i=0; i<lua_vms_num; i++) {
+		janus_lua_vm_lock(&lua_vms[i]);
+		lua_getglobal(lua_vms[i].state, "init");
+		lua_pushstring(lua_vms[i].state, lua_config);
+		lua_call(lua_vms[i].state, 1, 0);
+		janus_lua_vm_unlock(&lua_vms[i]);
+	}
 
 	g_free(lua_folder);
 	g_free(lua_file);
 	g_free(lua_config);
 
-	JANUS_LOG(LOG_INFO, "%s initialized!\n", JANUS_LUA_NAME);
+	JANUS_LOG(LOG_INFO, "%s initialized (%u Lua VMs)!\n", JANUS_LUA_NAME, lua_vms_num);
 	return 0;
 }
 
@@ -1258,45 +1904,30 @@ void janus_lua_destroy(void) {
 		return;
 	g_atomic_int_set(&lua_stopping, 1);
 
-	g_async_queue_push(events, GUINT_TO_POINTER(janus_lua_event_exit));
-	if(scheduler_thread != NULL) {
-		g_thread_join(scheduler_thread);
-		scheduler_thread = NULL;
-	}
-	if(timer_loop != NULL)
-		g_main_loop_quit(timer_loop);
-	if(timer_thread != NULL) {
-		g_thread_join(timer_thread);
-		timer_thread = NULL;
-	}
-	if(timer_loop != NULL) {
-		g_main_loop_unref(timer_loop);
-		timer_loop = NULL;
-	}
-	if(timer_context != NULL) {
-		g_main_context_unref(timer_context);
-		timer_context = NULL;
-	}
+	/* Stop the schedulers and the timer loops */
+	janus_lua_vms_stop();
 
-	/* Deinit the Lua script, in case it's needed */
-	janus_mutex_lock(&lua_mutex);
-	lua_getglobal(lua_state, "destroy");
-	lua_call(lua_state, 0, 0);
-	janus_mutex_unlock(&lua_mutex);
+	/* Deinit the Lua script in all VMs, in case it's needed */
+	uint i=0;
+	for(i=0; i<lua_vms_num; i++) {
+		janus_lua_vm_lock(&lua_vms[i]);
+		lua_getglobal(lua_vms[i].state, "destroy");
+		lua_call(lua_vms[i].state, 0, 0);
+		janus_lua_vm_unlock(&lua_vms[i]);
+	}
 
 	janus_mutex_lock(&lua_sessions_mutex);
 	g_hash_table_destroy(lua_sessions);
 	lua_sessions = NULL;
 	g_hash_table_destroy(lua_ids);
 	lua_ids = NULL;
-	g_async_queue_unref(events);
-	events = NULL;
 	janus_mutex_unlock(&lua_sessions_mutex);
 
-	janus_mutex_lock(&lua_mutex);
-	lua_close(lua_state);
-	lua_state = NULL;
-	janus_mutex_unlock(&lua_mutex);
+	janus_lua_vms_free();
+	janus_mutex_lock(&lua_shared_mutex);
+	g_hash_table_destroy(lua_shared);
+	lua_shared = NULL;
+	janus_mutex_unlock(&lua_shared_mutex);
 
 	g_free(lua_script_version_string);
 	g_free(lua_script_description);
@@ -1318,18 +1949,19 @@ int janus_lua_get_version(void) {
 	/* Check if the Lua script wants to override this method and return info itself */
 	if(has_get_version) {
 		/* Yep, pass the request to the Lua script and return the info */
-		janus_mutex_lock(&lua_mutex);
+		janus_lua_vm *vm = &lua_vms[0];
+		janus_lua_vm_lock(vm);
 		/* Unless we asked already */
 		if(lua_script_version != -1) {
-			janus_mutex_unlock(&lua_mutex);
+			janus_lua_vm_unlock(vm);
 			return lua_script_version;
 		}
-		lua_State *t = lua_newthread(lua_state);
+		lua_State *t = lua_newthread(vm->state);
 		lua_getglobal(t, "getVersion");
 		lua_call(t, 0, 1);
 		lua_script_version = (int)lua_tonumber(t, -1);
 		lua_pop(t, 1);
-		janus_mutex_unlock(&lua_mutex);
+		janus_lua_vm_unlock(vm);
 		return lua_script_version;
 	}
 	/* No override, return the Janus Lua plugin info */
@@ -1340,20 +1972,21 @@ const char *janus_lua_get_version_string(void) {
 	/* Check if the Lua script wants to override this method and return info itself */
 	if(has_get_version_string) {
 		/* Yep, pass the request to the Lua script and return the info */
-		janus_mutex_lock(&lua_mutex);
+		janus_lua_vm *vm = &lua_vms[0];
+		janus_lua_vm_lock(vm);
 		/* Unless we asked already */
 		if(lua_script_version_string != NULL) {
-			janus_mutex_unlock(&lua_mutex);
+			janus_lua_vm_unlock(vm);
 			return lua_script_version_string;
 		}
-		lua_State *t = lua_newthread(lua_state);
+		lua_State *t = lua_newthread(vm->state);
 		lua_getglobal(t, "getVersionString");
 		lua_call(t, 0, 1);
 		const char *version = lua_tostring(t, -1);
 		if(version != NULL)
 			lua_script_version_string = g_strdup(version);
 		lua_pop(t, 1);
-		janus_mutex_unlock(&lua_mutex);
+		janus_lua_vm_unlock(vm);
 		return lua_script_version_string;
 	}
 	/* No override, return the Janus Lua plugin info */
@@ -1364,20 +1997,21 @@ const char *janus_lua_get_description(void) {
 	/* Check if the Lua script wants to override this method and return info itself */
 	if(has_get_description) {
 		/* Yep, pass the request to the Lua script and return the info */
-		janus_mutex_lock(&lua_mutex);
+		janus_lua_vm *vm = &lua_vms[0];
+		janus_lua_vm_lock(vm);
 		/* Unless we asked already */
 		if(lua_script_description != NULL) {
-			janus_mutex_unlock(&lua_mutex);
+			janus_lua_vm_unlock(vm);
 			return lua_script_description;
 		}
-		lua_State *t = lua_newthread(lua_state);
+		lua_State *t = lua_newthread(vm->state);
 		lua_getglobal(t, "getDescription");
 		lua_call(t, 0, 1);
 		const char *description = lua_tostring(t, -1);
 		if(description != NULL)
 			lua_script_description = g_strdup(description);
 		lua_pop(t, 1);
-		janus_mutex_unlock(&lua_mutex);
+		janus_lua_vm_unlock(vm);
 		return lua_script_description;
 	}
 	/* No override, return the Janus Lua plugin info */
@@ -1388,20 +2022,21 @@ const char *janus_lua_get_name(void) {
 	/* Check if the Lua script wants to override this method and return info itself */
 	if(has_get_name) {
 		/* Yep, pass the request to the Lua script and return the info */
-		janus_mutex_lock(&lua_mutex);
+		janus_lua_vm *vm = &lua_vms[0];
+		janus_lua_vm_lock(vm);
 		/* Unless we asked already */
 		if(lua_script_name != NULL) {
-			janus_mutex_unlock(&lua_mutex);
+			janus_lua_vm_unlock(vm);
 			return lua_script_name;
 		}
-		lua_State *t = lua_newthread(lua_state);
+		lua_State *t = lua_newthread(vm->state);
 		lua_getglobal(t, "getName");
 		lua_call(t, 0, 1);
 		const char *name = lua_tostring(t, -1);
 		if(name != NULL)
 			lua_script_name = g_strdup(name);
 		lua_pop(t, 1);
-		janus_mutex_unlock(&lua_mutex);
+		janus_lua_vm_unlock(vm);
 		return lua_script_name;
 	}
 	/* No override, return the Janus Lua plugin info */
@@ -1412,20 +2047,21 @@ const char *janus_lua_get_author(void) {
 	/* Check if the Lua script wants to override this method and return info itself */
 	if(has_get_author) {
 		/* Yep, pass the request to the Lua script and return the info */
-		janus_mutex_lock(&lua_mutex);
+		janus_lua_vm *vm = &lua_vms[0];
+		janus_lua_vm_lock(vm);
 		/* Unless we asked already */
 		if(lua_script_author != NULL) {
-			janus_mutex_unlock(&lua_mutex);
+			janus_lua_vm_unlock(vm);
 			return lua_script_author;
 		}
-		lua_State *t = lua_newthread(lua_state);
+		lua_State *t = lua_newthread(vm->state);
 		lua_getglobal(t, "getAuthor");
 		lua_call(t, 0, 1);
 		const char *author = lua_tostring(t, -1);
 		if(author != NULL)
 			lua_script_author = g_strdup(author);
 		lua_pop(t, 1);
-		janus_mutex_unlock(&lua_mutex);
+		janus_lua_vm_unlock(vm);
 		return lua_script_author;
 	}
 	/* No override, return the Janus Lua plugin info */
@@ -1436,20 +2072,21 @@ const char *janus_lua_get_package(void) {
 	/* Check if the Lua script wants to override this method and return info itself */
 	if(has_get_package) {
 		/* Yep, pass the request to the Lua script and return the info */
-		janus_mutex_lock(&lua_mutex);
+		janus_lua_vm *vm = &lua_vms[0];
+		janus_lua_vm_lock(vm);
 		/* Unless we asked already */
 		if(lua_script_package != NULL) {
-			janus_mutex_unlock(&lua_mutex);
+			janus_lua_vm_unlock(vm);
 			return lua_script_package;
 		}
-		lua_State *t = lua_newthread(lua_state);
+		lua_State *t = lua_newthread(vm->state);
 		lua_getglobal(t, "getPackage");
 		lua_call(t, 0, 1);
 		const char *package = lua_tostring(t, -1);
 		if(package != NULL)
 			lua_script_package = g_strdup(package);
 		lua_pop(t, 1);
-		janus_mutex_unlock(&lua_mutex);
+		janus_lua_vm_unlock(vm);
 		return lua_script_package;
 	}
 	/* No override, return the Janus Lua plugin info */
@@ -1483,8 +2120,12 @@ void janus_lua_create_session(janus_plugin_session *handle, int *error) {
 	session->handle = handle;
 	session->id = id;
 	janus_rtp_switching_context_reset(&session->rtpctx);
+	janus_mutex_init(&session->routes_mutex);
 	g_atomic_int_set(&session->hangingup, 0);
 	g_atomic_int_set(&session->destroyed, 0);
+	/* Pin the session to one of the Lua VMs */
+	session->vm = janus_lua_vm_get(id);
+	g_atomic_int_inc(&session->vm->sessions);
 	janus_refcount_init(&session->ref, janus_lua_session_free);
 	handle->plugin_handle = session;
 	g_hash_table_insert(lua_sessions, handle, session);
@@ -1492,13 +2133,14 @@ void janus_lua_create_session(janus_plugin_session *handle, int *error) {
 	janus_mutex_unlock(&lua_sessions_mutex);
 
 	/* Notify the Lua script */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_vm *vm = session->vm;
+	janus_lua_vm_lock(vm);
+	lua_State *t = lua_newthread(vm->state);
 	lua_getglobal(t, "createSession");
 	lua_pushnumber(t, session->id);
 	lua_call(t, 1, 0);
-	lua_pop(lua_state, 1);
-	janus_mutex_unlock(&lua_mutex);
+	lua_pop(vm->state, 1);
+	janus_lua_vm_unlock(vm);
 
 	return;
 }
@@ -1522,13 +2164,14 @@ void janus_lua_destroy_session(janus_plugin_session *handle, int *error) {
 	janus_mutex_unlock(&lua_sessions_mutex);
 
 	/* Notify the Lua script */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_vm *vm = session->vm;
+	janus_lua_vm_lock(vm);
+	lua_State *t = lua_newthread(vm->state);
 	lua_getglobal(t, "destroySession");
 	lua_pushnumber(t, id);
 	lua_call(t, 1, 0);
-	lua_pop(lua_state, 1);
-	janus_mutex_unlock(&lua_mutex);
+	lua_pop(vm->state, 1);
+	janus_lua_vm_unlock(vm);
 
 	/* Get any rid references recipients of this sessions may have */
 	janus_mutex_lock(&session->recipients_mutex);
@@ -1541,11 +2184,14 @@ void janus_lua_destroy_session(janus_plugin_session *handle, int *error) {
 		session->recipients = g_slist_remove(session->recipients, recipient);
 	}
 	janus_mutex_unlock(&session->recipients_mutex);
+	/* Same for the routes */
+	janus_lua_routes_clear(session);
 
 	/* Finally, remove from the hashtable */
 	janus_mutex_lock(&lua_sessions_mutex);
 	g_hash_table_remove(lua_sessions, handle);
 	janus_mutex_unlock(&lua_sessions_mutex);
+	g_atomic_int_add(&vm->sessions, -1);
 	janus_refcount_decrease(&session->ref);
 
 	return;
@@ -1564,24 +2210,61 @@ json_t *janus_lua_query_session(janus_plugin_session *handle) {
 	}
 	janus_refcount_increase(&session->ref);
 	janus_mutex_unlock(&lua_sessions_mutex);
+	/* Prepare a list of the routes the Lua script configured for this session */
+	json_t *routes = json_array();
+	janus_mutex_lock(&session->routes_mutex);
+	GSList *l = session->routes;
+	while(l) {
+		janus_lua_route *route = (janus_lua_route *)l->data;
+		json_t *r = json_object();
+		json_object_set_new(r, "recipient", json_integer(route->recipient->id));
+		json_object_set_new(r, "audio", route->audio ? json_true() : json_false());
+		json_object_set_new(r, "video", route->video ? json_true() : json_false());
+		json_object_set_new(r, "data", route->data ? json_true() : json_false());
+		if(session->ssrc[0] != 0) {
+			json_object_set_new(r, "substream", json_integer(route->substream));
+			json_object_set_new(r, "substream-target", json_integer(route->substream_target));
+			json_object_set_new(r, "temporal-layer", json_integer(route->templayer));
+			json_object_set_new(r, "temporal-layer-target", json_integer(route->templayer_target));
+		}
+		json_array_append_new(routes, r);
+		l = l->next;
+	}
+	janus_mutex_unlock(&session->routes_mutex);
 	/* Ask the Lua script for information on this session */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_vm *vm = session->vm;
+	janus_lua_vm_lock(vm);
+	lua_State *t = lua_newthread(vm->state);
 	lua_getglobal(t, "querySession");
 	lua_pushnumber(t, session->id);
 	lua_call(t, 1, 1);
-	lua_pop(lua_state, 1);
+	lua_pop(vm->state, 1);
 	janus_refcount_decrease(&session->ref);
 	const char *info = lua_tostring(t, -1);
 	lua_pop(t, 1);
 	/* We need a Jansson object */
 	json_error_t error;
 	json_t *json = json_loads(info, 0, &error);
-	janus_mutex_unlock(&lua_mutex);
+	janus_lua_vm_unlock(vm);
 	if(!json) {
 		JANUS_LOG(LOG_ERR, "JSON error: on line %d: %s", error.line, error.text);
+		json_decref(routes);
 		return NULL;
 	}
+	if(!json_is_object(json)) {
+		json_decref(routes);
+	} else {
+		/* Add info on the VM this session is pinned to, and on all the others */
+		json_t *lua = json_object();
+		json_object_set_new(lua, "vm", json_integer(vm->id));
+		json_t *list = json_array();
+		uint i=0;
+		for(i=0; i<lua_vms_num; i++)
+			json_array_append_new(list, janus_lua_vm_info(&lua_vms[i]));
+		json_object_set_new(lua, "vms", list);
+		json_object_set_new(lua, "routes", routes);
+		json_object_set_new(json, "lua", lua);
+	}
 	return json;
 }
 
@@ -1609,17 +2292,25 @@ struct janus_plugin_result *janus_lua_handle_message(janus_plugin_session *handl
 		return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "No session associated with this handle", NULL);
 	}
 	char *jsep_text = jsep ? json_dumps(jsep, JSON_INDENT(0) | JSON_PRESERVE_ORDER) : NULL;
+	/* If the offer is simulcasting, take note of the SSRCs, in case the script configures routes */
+	json_t *simulcast = jsep ? json_object_get(jsep, "simulcast") : NULL;
+	if(simulcast && json_is_object(simulcast)) {
+		session->ssrc[0] = json_integer_value(json_object_get(simulcast, "ssrc-0"));
+		session->ssrc[1] = json_integer_value(json_object_get(simulcast, "ssrc-1"));
+		session->ssrc[2] = json_integer_value(json_object_get(simulcast, "ssrc-2"));
+	}
 	json_decref(jsep);
 	/* Invoke the script function */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_vm *vm = session->vm;
+	janus_lua_vm_lock(vm);
+	lua_State *t = lua_newthread(vm->state);
 	lua_getglobal(t, "handleMessage");
 	lua_pushnumber(t, session->id);
 	lua_pushstring(t, transaction);
 	lua_pushstring(t, message_text);
 	lua_pushstring(t, jsep_text);
 	lua_call(t, 4, 2);
-	lua_pop(lua_state, 1);
+	lua_pop(vm->state, 1);
 	janus_refcount_decrease(&session->ref);
 	if(message_text != NULL)
 		free(message_text);
@@ -1628,7 +2319,7 @@ struct janus_plugin_result *janus_lua_handle_message(janus_plugin_session *handl
 	g_free(transaction);
 	int n = lua_gettop(t);
 	if(n != 2) {
-		janus_mutex_unlock(&lua_mutex);
+		janus_lua_vm_unlock(vm);
 		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 2)\n", n);
 		return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "Lua error", NULL);
 	}
@@ -1638,20 +2329,20 @@ struct janus_plugin_result *janus_lua_handle_message(janus_plugin_session *handl
 	lua_pop(t, 2);
 	if(res < 0) {
 		/* We got an error */
-		janus_mutex_unlock(&lua_mutex);
+		janus_lua_vm_unlock(vm);
 		return janus_plugin_result_new(JANUS_PLUGIN_ERROR, response ? response : "Lua error", NULL);
 	} else if(res == 0) {
 		/* Synchronous response: we need a Jansson object */
 		json_error_t error;
 		json_t *json = json_loads(response, 0, &error);
-		janus_mutex_unlock(&lua_mutex);
+		janus_lua_vm_unlock(vm);
 		if(!json) {
 			JANUS_LOG(LOG_ERR, "JSON error: on line %d: %s\n", error.line, error.text);
 			return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "Lua error", NULL);
 		}
 		return janus_plugin_result_new(JANUS_PLUGIN_OK, NULL, json);
 	}
-	janus_mutex_unlock(&lua_mutex);
+	janus_lua_vm_unlock(vm);
 	/* If we got here, it's an asynchronous response */
 	return janus_plugin_result_new(JANUS_PLUGIN_OK_WAIT, NULL, NULL);
 }
@@ -1678,16 +2369,32 @@ void janus_lua_setup_media(janus_plugin_session *handle) {
 	session->pli_latest = janus_get_monotonic_time();
 
 	/* Notify the Lua script */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_vm *vm = session->vm;
+	janus_lua_vm_lock(vm);
+	lua_State *t = lua_newthread(vm->state);
 	lua_getglobal(t, "setupMedia");
 	lua_pushnumber(t, session->id);
 	lua_call(t, 1, 0);
-	lua_pop(lua_state, 1);
-	janus_mutex_unlock(&lua_mutex);
+	lua_pop(vm->state, 1);
+	janus_lua_vm_unlock(vm);
 	janus_refcount_decrease(&session->ref);
 }
 
+/* Check if we need to send any PLI to this media source */
+static void janus_lua_check_pli(janus_lua_session *session) {
+	if(session->pli_freq == 0)
+		return;
+	/* We send a FIR every tot seconds, depending on what the Lua script configured */
+	gint64 now = janus_get_monotonic_time();
+	if((now-session->pli_latest) >= ((gint64)session->pli_freq*G_USEC_PER_SEC)) {
+		session->pli_latest = now;
+		char rtcpbuf[12];
+		janus_rtcp_pli((char *)&rtcpbuf, 12);
+		JANUS_LOG(LOG_HUGE, "Sending PLI to session %"SCNu32"\n", session->id);
+		janus_core->relay_rtcp(session->handle, 1, rtcpbuf, 12);
+	}
+}
+
 void janus_lua_incoming_rtp(janus_plugin_session *handle, int video, char *buf, int len) {
 	if(handle == NULL || handle->stopped || g_atomic_int_get(&lua_stopping) || !g_atomic_int_get(&lua_initialized))
 		return;
@@ -1698,19 +2405,42 @@ void janus_lua_incoming_rtp(janus_plugin_session *handle, int video, char *buf,
 	}
 	if(g_atomic_int_get(&session->destroyed) || g_atomic_int_get(&session->hangingup))
 		return;
+	/* If the Lua script configured routes for this medium, relay in C without involving Lua */
+	if(g_atomic_int_get(&session->routed) & (video ? JANUS_LUA_ROUTED_VIDEO : JANUS_LUA_ROUTED_AUDIO)) {
+		if((video && !session->send_video) || (!video && !session->send_audio))
+			return;
+		janus_recorder_save_frame(video ? session->vrc : session->arc, buf, len);
+		janus_lua_rtp_relay_packet packet;
+		packet.data = (rtp_header *)buf;
+		packet.length = len;
+		packet.is_video = video;
+		packet.timestamp = ntohl(packet.data->timestamp);
+		packet.seq_number = ntohs(packet.data->seq_number);
+		janus_mutex_lock_nodebug(&session->routes_mutex);
+		GSList *l = session->routes;
+		while(l) {
+			janus_lua_route_rtp(session, (janus_lua_route *)l->data, &packet);
+			l = l->next;
+		}
+		janus_mutex_unlock_nodebug(&session->routes_mutex);
+		if(video)
+			janus_lua_check_pli(session);
+		return;
+	}
 	/* Check if the Lua script wants to handle/manipulate RTP packets itself */
 	if(has_incoming_rtp) {
 		/* Yep, pass the data to the Lua script and return */
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
+		janus_lua_vm *vm = session->vm;
+		janus_lua_vm_lock(vm);
+		lua_State *t = lua_newthread(vm->state);
 		lua_getglobal(t, "incomingRtp");
 		lua_pushnumber(t, session->id);
 		lua_pushboolean(t, video);
 		lua_pushlstring(t, buf, len);
 		lua_pushnumber(t, len);
 		lua_call(t, 4, 0);
-		lua_pop(lua_state, 1);
-		janus_mutex_unlock(&lua_mutex);
+		lua_pop(vm->state, 1);
+		janus_lua_vm_unlock(vm);
 		return;
 	}
 	/* Is this session allowed to send media? */
@@ -1731,19 +2461,9 @@ void janus_lua_incoming_rtp(janus_plugin_session *handle, int video, char *buf,
 	janus_mutex_lock_nodebug(&session->recipients_mutex);
 	g_slist_foreach(session->recipients, janus_lua_relay_rtp_packet, &packet);
 	janus_mutex_unlock_nodebug(&session->recipients_mutex);
-
 	/* Check if we need to send any PLI to this media source */
-	if(video && session->pli_freq > 0) {
-		/* We send a FIR every tot seconds, depending on what the Lua script configured */
-		gint64 now = janus_get_monotonic_time();
-		if((now-session->pli_latest) >= ((gint64)session->pli_freq*G_USEC_PER_SEC)) {
-			session->pli_latest = now;
-			char rtcpbuf[12];
-			janus_rtcp_pli((char *)&rtcpbuf, 12);
-			JANUS_LOG(LOG_HUGE, "Sending PLI to session %"SCNu32"\n", session->id);
-			janus_core->relay_rtcp(handle, 1, rtcpbuf, 12);
-		}
-	}
+	if(video)
+		janus_lua_check_pli(session);
 }
 
 void janus_lua_incoming_rtcp(janus_plugin_session *handle, int video, char *buf, int len) {
@@ -1759,16 +2479,17 @@ void janus_lua_incoming_rtcp(janus_plugin_session *handle, int video, char *buf,
 	/* Check if the Lua script wants to handle/manipulate RTCP packets itself */
 	if(has_incoming_rtcp) {
 		/* Yep, pass the data to the Lua script and return */
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
+		janus_lua_vm *vm = session->vm;
+		janus_lua_vm_lock(vm);
+		lua_State *t = lua_newthread(vm->state);
 		lua_getglobal(t, "incomingRtcp");
 		lua_pushnumber(t, session->id);
 		lua_pushboolean(t, video);
 		lua_pushlstring(t, buf, len);
 		lua_pushnumber(t, len);
 		lua_call(t, 4, 0);
-		lua_pop(lua_state, 1);
-		janus_mutex_unlock(&lua_mutex);
+		lua_pop(vm->state, 1);
+		janus_lua_vm_unlock(vm);
 		return;
 	}
 	/* If a REMB arrived, make sure we cap it to our configuration, and send it as a video RTCP */
@@ -1797,18 +2518,36 @@ void janus_lua_incoming_data(janus_plugin_session *handle, char *buf, int len) {
 		return;
 	/* Are we recording? */
 	janus_recorder_save_frame(session->drc, buf, len);
+	/* If the Lua script configured routes for data, relay in C without involving Lua */
+	if(g_atomic_int_get(&session->routed) & JANUS_LUA_ROUTED_DATA) {
+		if(!session->send_data)
+			return;
+		janus_mutex_lock_nodebug(&session->routes_mutex);
+		GSList *l = session->routes;
+		while(l) {
+			janus_lua_route *route = (janus_lua_route *)l->data;
+			janus_lua_session *recipient = route->recipient;
+			if(route->data && recipient->handle && g_atomic_int_get(&recipient->started) &&
+					!g_atomic_int_get(&recipient->destroyed) && recipient->accept_data)
+				janus_core->relay_data(recipient->handle, buf, len);
+			l = l->next;
+		}
+		janus_mutex_unlock_nodebug(&session->routes_mutex);
+		return;
+	}
 	/* Check if the Lua script wants to handle/manipulate data channel packets itself */
 	if(has_incoming_data) {
 		/* Yep, pass the data to the Lua script and return */
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
+		janus_lua_vm *vm = session->vm;
+		janus_lua_vm_lock(vm);
+		lua_State *t = lua_newthread(vm->state);
 		lua_getglobal(t, "incomingData");
 		lua_pushnumber(t, session->id);
 		lua_pushlstring(t, buf, len);
 		lua_pushnumber(t, len);
 		lua_call(t, 3, 0);
-		lua_pop(lua_state, 1);
-		janus_mutex_unlock(&lua_mutex);
+		lua_pop(vm->state, 1);
+		janus_lua_vm_unlock(vm);
 		return;
 	}
 	/* Is this session allowed to send data? */
@@ -1890,15 +2629,21 @@ void janus_lua_hangup_media(janus_plugin_session *handle) {
 		janus_refcount_decrease(&recipient->ref);
 	}
 	janus_mutex_unlock(&session->recipients_mutex);
+	/* Same for the routes */
+	janus_lua_routes_clear(session);
+	session->ssrc[0] = 0;
+	session->ssrc[1] = 0;
+	session->ssrc[2] = 0;
 
 	/* Notify the Lua script */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_vm *vm = session->vm;
+	janus_lua_vm_lock(vm);
+	lua_State *t = lua_newthread(vm->state);
 	lua_getglobal(t, "hangupMedia");
 	lua_pushnumber(t, session->id);
 	lua_call(t, 1, 0);
-	lua_pop(lua_state, 1);
-	janus_mutex_unlock(&lua_mutex);
+	lua_pop(vm->state, 1);
+	janus_lua_vm_unlock(vm);
 	janus_refcount_decrease(&session->ref);
 }
 
@@ -1948,24 +2693,36 @@ static void janus_lua_relay_data_packet(gpointer data, gpointer user_data) {
 /* This is a scheduler thread: if we know there are coroutines to resume
  * in Lua (e.g., for asynchronous requests), we do that ourselves here */
 static void *janus_lua_scheduler(void *data) {
-	JANUS_LOG(LOG_VERB, "Joining Lua scheduler thread\n");
+	janus_lua_vm *vm = (janus_lua_vm *)data;
+	JANUS_LOG(LOG_VERB, "Joining Lua scheduler thread (VM %u)\n", vm->id);
 	janus_lua_event *event = NULL;
 	/* Wait until there are events to process */
 	while(g_atomic_int_get(&lua_initialized) && !g_atomic_int_get(&lua_stopping)) {
-		event = g_async_queue_pop(events);
-		if(event == GUINT_TO_POINTER(janus_lua_event_exit))
+		event = g_async_queue_pop(vm->events);
+		if(event == &exit_event)
 			break;
-		if(event == GUINT_TO_POINTER(janus_lua_event_resume)) {
+		if(event == &resume_event) {
 			/* There are coroutines to resume */
-			janus_mutex_lock(&lua_mutex);
-			lua_getglobal(lua_state, "resumeScheduler");
-			lua_call(lua_state, 0, 0);
+			janus_lua_vm_lock(vm);
+			lua_getglobal(vm->state, "resumeScheduler");
+			lua_call(vm->state, 0, 0);
 			/* Print the count of elements into Lua stack */
-			janus_lua_stackdump(lua_state);
-			janus_mutex_unlock(&lua_mutex);
+			janus_lua_stackdump(vm->state);
+			janus_lua_vm_unlock(vm);
+		} else if(event->type == janus_lua_event_channel) {
+			/* Another VM published a message on a channel */
+			janus_lua_vm_lock(vm);
+			lua_State *t = lua_newthread(vm->state);
+			lua_getglobal(t, "channelMessage");
+			lua_pushstring(t, event->channel);
+			lua_pushstring(t, event->message);
+			lua_call(t, 2, 0);
+			lua_pop(vm->state, 1);
+			janus_lua_vm_unlock(vm);
 		}
+		janus_lua_event_free(event);
 	}
-	JANUS_LOG(LOG_VERB, "Leaving Lua scheduler thread\n");
+	JANUS_LOG(LOG_VERB, "Leaving Lua scheduler thread (VM %u)\n", vm->id);
 	return NULL;
 }
 
@@ -1990,8 +2747,9 @@ static gboolean janus_lua_timer_cb(void *data) {
 		return FALSE;
 	/* Invoke the callback with the provided argument, if available */
 	JANUS_LOG(LOG_WARN, "Invoking scheduled callback (waited %"SCNu32"ms) with ID %u\n", cb->ms, cb->id);
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_vm *vm = cb->vm;
+	janus_lua_vm_lock(vm);
+	lua_State *t = lua_newthread(vm->state);
 	lua_getglobal(t, cb->function);
 	if(cb->argument == NULL) {
 		lua_call(t, 0, 0);
@@ -1999,8 +2757,8 @@ static gboolean janus_lua_timer_cb(void *data) {
 		lua_pushstring(t, cb->argument);
 		lua_call(t, 1, 0);
 	}
-	lua_pop(lua_state, 1);
-	janus_mutex_unlock(&lua_mutex);
+	lua_pop(vm->state, 1);
+	janus_lua_vm_unlock(vm);
 	/* Done */
 	g_source_destroy(cb->source);
 	g_source_unref(cb->source);
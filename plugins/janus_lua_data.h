@@ -45,9 +45,33 @@
 extern volatile gint lua_initialized, lua_stopping;
 extern janus_callbacks *janus_core;
 
-/* Lua state: we define state and mutex as extern */
-extern lua_State *lua_state;
-extern janus_mutex lua_mutex;
+/* Lua states: the script can be loaded in multiple independent Lua
+ * states (VMs), each with its own mutex, scheduler and timers, and each
+ * session is pinned to one of them: we define the VMs as extern */
+typedef struct janus_lua_vm {
+	guint id;						/* Index of this VM */
+	lua_State *state;				/* Lua state of this VM */
+	janus_mutex mutex;				/* Mutex to lock the Lua state */
+	GAsyncQueue *events;			/* Events for the coroutines scheduler of this VM */
+	GThread *scheduler_thread;		/* Thread resuming coroutines in this VM */
+	GMainContext *timer_context;	/* Context for the timed callbacks in this VM */
+	GMainLoop *timer_loop;			/* Loop for the timed callbacks in this VM */
+	GThread *timer_thread;			/* Thread running the timed callbacks in this VM */
+	volatile gint sessions;			/* Number of sessions pinned to this VM */
+	/* Statistics on how long we waited to lock the state */
+	janus_mutex stats_mutex;		/* Mutex to protect the statistics */
+	guint64 locks;					/* How many times the state was locked */
+	guint64 contended;				/* How many times we had to wait to lock it */
+	gint64 wait_total;				/* Time spent waiting for the lock, in microseconds */
+	gint64 wait_max;				/* Longest wait for the lock, in microseconds */
+} janus_lua_vm;
+extern janus_lua_vm *lua_vms;
+extern guint lua_vms_num;
+/* Get the VM a session ID is pinned to */
+janus_lua_vm *janus_lua_vm_get(guint32 id);
+/* Lock/unlock the state of a VM, keeping track of the time spent waiting */
+void janus_lua_vm_lock(janus_lua_vm *vm);
+void janus_lua_vm_unlock(janus_lua_vm *vm);
 
 /* If you need any additional property add them below this line */
 typedef struct janus_play_frame_packet {
@@ -81,6 +105,26 @@ typedef struct janus_play_recording {
 } janus_play_recording;
 
 
+/* Media route from a session to a recipient: routes are configured by the
+ * Lua script (see addRoute), but packets are relayed entirely in C */
+typedef struct janus_lua_route {
+	struct janus_lua_session *recipient;	/* Session to relay media to */
+	gboolean audio;							/* Whether audio should be relayed */
+	gboolean video;							/* Whether video should be relayed */
+	gboolean data;							/* Whether data should be relayed */
+	int substream;							/* Simulcast substream currently relayed */
+	int substream_target;					/* Simulcast substream we want to relay */
+	int templayer;							/* Simulcast temporal layer currently relayed */
+	int templayer_target;					/* Simulcast temporal layer we want to relay */
+	gint64 last_relayed;					/* When we last relayed a video packet (for simulcast fallbacks) */
+	janus_rtp_switching_context context;	/* RTP context, as routes from different sessions may be switched */
+	janus_vp8_simulcast_context simulcast_context;	/* VP8 simulcast context for this route */
+} janus_lua_route;
+/* Flags to quickly check which media a session has routes for */
+#define JANUS_LUA_ROUTED_AUDIO	(1 << 0)
+#define JANUS_LUA_ROUTED_VIDEO	(1 << 1)
+#define JANUS_LUA_ROUTED_DATA	(1 << 2)
+
 /* Lua session: we keep only the barebone stuff here, the rest will be in the Lua script */
 typedef struct janus_lua_session {
 	janus_plugin_session *handle;		/* Pointer to the core-plugin session */
@@ -98,6 +142,10 @@ typedef struct janus_lua_session {
 	gint64 pli_latest;					/* Time of latest sent PLI (to avoid flooding) */
 	GSList *recipients;					/* Sessions that should receive media from this session */
 	janus_mutex recipients_mutex;		/* Mutex to lock the recipients list */
+	GSList *routes;						/* Media routes from this session, handled in C (janus_lua_route) */
+	janus_mutex routes_mutex;			/* Mutex to lock the routes list */
+	volatile gint routed;				/* Which media have routes (JANUS_LUA_ROUTED_* flags) */
+	uint32_t ssrc[3];					/* Simulcast SSRCs of this session, if it's simulcasting */
 	janus_recorder *arc;				/* The Janus recorder instance for audio, if enabled */
 	janus_recorder *vrc;				/* The Janus recorder instance for video, if enabled */
 	janus_recorder *drc;				/* The Janus recorder instance for data, if enabled */
@@ -105,6 +153,7 @@ typedef struct janus_lua_session {
 	volatile gint started;				/* Whether this session's PeerConnection is ready or not */
 	volatile gint hangingup;			/* Whether this session's PeerConnection is hanging up */
 	volatile gint destroyed;			/* Whether this session's been marked as destroyed */
+	janus_lua_vm *vm;					/* Lua VM this session is pinned to */
 	/* If you need any additional property (e.g., for hooks you added in janus_lua_extra.c) add them below this line */
 
 	gboolean active;
@@ -112,7 +161,6 @@ typedef struct janus_lua_session {
 	janus_play_recording *recording;
 	janus_play_frame_packet *aframes;	/* Audio frames (for playout) */
 	janus_play_frame_packet *vframes;	/* Video frames (for playout) */
-	lua_State *lua_state;
 	const char *transaction_id;
 
 	/* Reference counter */
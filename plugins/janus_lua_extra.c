@@ -42,7 +42,7 @@
 static void janus_play_recording_free(const janus_refcount *recording_ref);
 janus_play_frame_packet *janus_play_get_frames(const char *dir, const char *filename);
 static void *janus_play_playout_thread(void *data);
-void lua_push_event(lua_State *state, guint32 id, const char *tr, const char *json);
+void lua_push_event(janus_lua_vm *vm, guint32 id, const char *tr, const char *json);
 void janus_rtp_header_update2(janus_rtp_header *header, janus_rtp_switching_context *context, gboolean video, int step);
 
 
@@ -109,7 +109,6 @@ static int janus_lua_method_startplaying(lua_State *lua_state) {
 	session->active = TRUE;
 
 
-	session->lua_state = lua_state;
 	session->transaction_id = tr;
 
 	GError *error = NULL;
@@ -173,8 +172,8 @@ void janus_lua_register_extra_functions(lua_State *state) {
 		return;
 	/* Register all extra functions here */
 	// lua_register(state, "testExtraFunction", janus_lua_extra_sample);
-	lua_register(lua_state, "startPlaying", janus_lua_method_startplaying);
-	lua_register(lua_state, "stopPlaying", janus_lua_method_stopplaying);
+	lua_register(state, "startPlaying", janus_lua_method_startplaying);
+	lua_register(state, "stopPlaying", janus_lua_method_stopplaying);
 
 }
 
@@ -191,15 +190,20 @@ static void janus_play_recording_free(const janus_refcount *recording_ref) {
 	g_free(recording);
 }
 
-void lua_push_event(lua_State *state, guint32 id, const char *tr, const char *json) {
+void lua_push_event(janus_lua_vm *vm, guint32 id, const char *tr, const char *json) {
+	if(vm == NULL)
+		return;
 	/* Can't call pushEvent straight from janus_lua_extra.c. So have to call it via lua */
-	/* Notify the Lua script */
-	lua_State *t = lua_newthread(lua_state);
+	/* Notify the Lua script (in the VM the session is pinned to) */
+	janus_lua_vm_lock(vm);
+	lua_State *t = lua_newthread(vm->state);
 	lua_getglobal(t, "luaPushEvent");
 	lua_pushnumber(t, id);
 	lua_pushstring(t, tr);
 	lua_pushstring(t, json);
 	lua_call(t, 3, 0);
+	lua_pop(vm->state, 1);
+	janus_lua_vm_unlock(vm);
 }
 
 janus_play_frame_packet *janus_play_get_frames(const char *dir, const char *filename) {
@@ -602,7 +606,7 @@ static void *janus_play_playout_thread(void *data) {
 	session->rtpctx.v_seq_reset = TRUE;
 
 	const char *json = "{\"play\": \"start\"}";
-	lua_push_event(session->lua_state, session->id, session->transaction_id, json);
+	lua_push_event(session->vm, session->id, session->transaction_id, json);
 
 	while(!g_atomic_int_get(&session->destroyed) && session->active
 			&& !g_atomic_int_get(&rec->destroyed) && (audio || video) && session->recording->stop_playing == FALSE) {
@@ -755,7 +759,7 @@ static void *janus_play_playout_thread(void *data) {
 	} else {
 		json = "{\"play\": \"ended\"}";
 	}
-	lua_push_event(session->lua_state, session->id, session->transaction_id, json);
+	lua_push_event(session->vm, session->id, session->transaction_id, json);
 
 	/* Get rid of the indexes */
 	janus_play_frame_packet *tmp = NULL;
@@ -48,6 +48,24 @@
  * take care of any adaptation that may be needed to make this work with
  * the signalling protocol of your choice.
  *
+ * By default, the plugin spawns a thread for each session, to relay the
+ * RTP and RTCP packets the peer sends. When bridging many sessions at the
+ * same time, you can set the \c relay_loops property in the plugin
+ * configuration to have a few shared loops take care of that instead, as
+ * in the SIP plugin: the \c janus_relay_* metrics tell how many sessions
+ * each loop is serving, and how busy it is.
+ *
+ * Peers that are not WebRTC endpoints may send media over networks with
+ * quite some jitter, and browsers don't always deal with that as well as
+ * they do when the jitter comes from their own PeerConnection. Setting
+ * the \c jitter_buffer property to a maximum delay (in milliseconds) has
+ * the plugin queue the RTP packets the peer sends before relaying them:
+ * how much they're delayed depends on the jitter the plugin measures,
+ * within that maximum, and how many packets arrived too late or were lost
+ * is available in the session info in the Admin API. Notice that, when
+ * using the shared relay loops, queued packets are relayed when others
+ * arrive, rather than on a timer, so playout is a bit less regular.
+ *
  * \section nosipapi NoSIP Plugin API
  *
  * The plugin mainly supports two requests, \c generate and \c process,
@@ -170,6 +188,8 @@
 #include "../ip-utils.h"
 #include "../sdp-utils.h"
 #include "../utils.h"
+#include "../relay-loop.h"
+#include "../jitter.h"
 
 
 /* Plugin information */
@@ -265,6 +285,13 @@ static janus_callbacks *gateway = NULL;
 static char *local_ip = NULL;
 static uint16_t rtp_range_min = 10000;
 static uint16_t rtp_range_max = 60000;
+static int relay_loops = 0;
+static janus_relay_pool *relay_pool = NULL;
+static gint64 jitter_buffer = 0;
+/* Jitter buffers settings (the maximum delay is what jitter_buffer says) */
+#define JITTER_BUFFER_MIN_DELAY		20000
+#define JITTER_BUFFER_AUDIO_SLOTS	64
+#define JITTER_BUFFER_VIDEO_SLOTS	256
 
 static GThread *handler_thread;
 static void *janus_nosip_handler(void *data);
@@ -309,6 +336,14 @@ typedef struct janus_nosip_media {
 	janus_rtp_switching_context context;
 	int pipefd[2];
 	gboolean updated;
+	/* Relaying state, owned by the relay thread or loop */
+	struct sockaddr_in server_addr;
+	gboolean have_server_ip;
+	int astep, vstep;
+	guint32 ats, vts;
+	int pollerrs;
+	guint64 relay_id;
+	janus_jitter_buffer *audio_jb, *video_jb;	/* Only if jitter_buffer is set (protected by the session mutex) */
 } janus_nosip_media;
 
 typedef struct janus_nosip_session {
@@ -583,6 +618,7 @@ char *janus_nosip_sdp_manipulate(janus_nosip_session *session, janus_sdp *sdp, g
 /* Media */
 static int janus_nosip_allocate_local_ports(janus_nosip_session *session);
 static void *janus_nosip_relay_thread(void *data);
+static void janus_nosip_relay_start(janus_nosip_session *session);
 
 
 /* Error codes */
@@ -662,6 +698,27 @@ int janus_nosip_init(janus_callbacks *callback, const char *config_path) {
 			JANUS_LOG(LOG_VERB, "NoSIP RTP/RTCP port range: %u -- %u\n", rtp_range_min, rtp_range_max);
 		}
 
+		item = janus_config_get_item_drilldown(config, "general", "relay_loops");
+		if(item && item->value) {
+			relay_loops = atoi(item->value);
+			if(relay_loops < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid number of relay loops (%d), using a thread per session\n", relay_loops);
+				relay_loops = 0;
+			}
+		}
+
+		item = janus_config_get_item_drilldown(config, "general", "jitter_buffer");
+		if(item && item->value) {
+			int ms = atoi(item->value);
+			if(ms < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid jitter buffer delay (%d), disabling the jitter buffer\n", ms);
+				ms = 0;
+			}
+			jitter_buffer = (gint64)ms*1000;
+			if(jitter_buffer > 0)
+				JANUS_LOG(LOG_VERB, "Queueing the peers' media for up to %dms, depending on the jitter\n", ms);
+		}
+
 		item = janus_config_get_item_drilldown(config, "general", "events");
 		if(item != NULL && item->value != NULL)
 			notify_events = janus_is_true(item->value);
@@ -694,6 +751,13 @@ int janus_nosip_init(janus_callbacks *callback, const char *config_path) {
 
 	g_atomic_int_set(&initialized, 1);
 
+	if(relay_loops > 0) {
+		/* Relay media from peers in a few shared loops, rather than in a thread per session */
+		relay_pool = janus_relay_pool_create("nosip", relay_loops);
+		if(relay_pool == NULL)
+			JANUS_LOG(LOG_WARN, "Couldn't start the relay loops, using a thread per session\n");
+	}
+
 	GError *error = NULL;
 	/* Launch the thread that will handle incoming messages */
 	handler_thread = g_thread_try_new("nosip handler", janus_nosip_handler, NULL, &error);
@@ -716,6 +780,9 @@ void janus_nosip_destroy(void) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+	/* Stop the relay loops, if any: this releases the sessions they were handling */
+	janus_relay_pool_destroy(relay_pool);
+	relay_pool = NULL;
 	/* FIXME We should destroy the sessions cleanly */
 	janus_mutex_lock(&sessions_mutex);
 	g_hash_table_destroy(sessions);
@@ -812,6 +879,7 @@ void janus_nosip_create_session(janus_plugin_session *handle, int *error) {
 	session->media.pipefd[0] = -1;
 	session->media.pipefd[1] = -1;
 	session->media.updated = FALSE;
+	session->media.relay_id = 0;
 	janus_mutex_init(&session->rec_mutex);
 	g_atomic_int_set(&session->destroyed, 0);
 	g_atomic_int_set(&session->hangingup, 0);
@@ -865,6 +933,19 @@ json_t *janus_nosip_query_session(janus_plugin_session *handle) {
 		json_object_set_new(info, "srtp-required", json_string(session->media.require_srtp ? "yes" : "no"));
 		json_object_set_new(info, "sdes-local", json_string(session->media.has_srtp_local ? "yes" : "no"));
 		json_object_set_new(info, "sdes-remote", json_string(session->media.has_srtp_remote ? "yes" : "no"));
+		guint64 relay_id = session->media.relay_id;
+		if(relay_id > 0)
+			json_object_set_new(info, "relay-loop", json_integer(janus_relay_pool_loop_index(relay_id)));
+		janus_mutex_lock(&session->mutex);
+		if(session->media.audio_jb || session->media.video_jb) {
+			json_t *jb = json_object();
+			if(session->media.audio_jb)
+				json_object_set_new(jb, "audio", janus_jitter_buffer_stats(session->media.audio_jb));
+			if(session->media.video_jb)
+				json_object_set_new(jb, "video", janus_jitter_buffer_stats(session->media.video_jb));
+			json_object_set_new(info, "jitter-buffer", jb);
+		}
+		janus_mutex_unlock(&session->mutex);
 	}
 	if(session->arc || session->vrc || session->arc_peer || session->vrc_peer) {
 		json_t *recording = json_object();
@@ -1098,8 +1179,10 @@ static void janus_nosip_hangup_media_internal(janus_plugin_session *handle) {
 		return;
 	if(g_atomic_int_add(&session->hangingup, 1))
 		return;
-	/* Notify the thread that it's time to go */
-	if(session->media.pipefd[1] > 0) {
+	/* Notify the thread (or loop) that it's time to go */
+	if(session->media.relay_id > 0) {
+		janus_relay_pool_wakeup(relay_pool, session->media.relay_id);
+	} else if(session->media.pipefd[1] > 0) {
 		int code = 1;
 		ssize_t res = 0;
 		do {
@@ -1379,15 +1462,7 @@ static void *janus_nosip_handler(void *data) {
 			if(!sdp_update && !offer) {
 				/* Start the media */
 				session->media.ready = 1;	/* FIXME Maybe we need a better way to signal this */
-				GError *error = NULL;
-				char tname[16];
-				g_snprintf(tname, sizeof(tname), "nosiprtp %p", session);
-				janus_refcount_increase(&session->ref);
-				g_thread_try_new(tname, janus_nosip_relay_thread, session, &error);
-				if(error != NULL) {
-					janus_refcount_decrease(&session->ref);
-					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n", error->code, error->message ? error->message : "??");
-				}
+				janus_nosip_relay_start(session);
 			}
 		} else if(!strcasecmp(request_text, "hangup")) {
 			/* Get rid of an ongoing session */
@@ -1693,7 +1768,10 @@ void janus_nosip_sdp_process(janus_nosip_session *session, janus_sdp *sdp, gbool
 	if(update && changed && *changed) {
 		/* Something changed: mark this on the session, so that the thread can update the sockets */
 		session->media.updated = TRUE;
-		if(session->media.pipefd[1] > 0) {
+		if(session->media.relay_id > 0) {
+			/* The session is handled by the relay loops */
+			janus_relay_pool_wakeup(relay_pool, session->media.relay_id);
+		} else if(session->media.pipefd[1] > 0) {
 			int code = 1;
 			ssize_t res = 0;
 			do {
@@ -1711,7 +1789,7 @@ char *janus_nosip_sdp_manipulate(janus_nosip_session *session, janus_sdp *sdp, g
 	GList *temp = sdp->m_lines;
 	while(temp) {
 		janus_sdp_mline *m = (janus_sdp_mline *)temp->data;
-		g_free(m->proto);
+		janus_sdp_arena_free_string(m->arena, m->proto);
 		m->proto = g_strdup(session->media.require_srtp ? "RTP/SAVP" : "RTP/AVP");
 		if(m->type == JANUS_SDP_AUDIO) {
 			m->port = session->media.local_audio_rtp_port;
@@ -1736,7 +1814,7 @@ char *janus_nosip_sdp_manipulate(janus_nosip_session *session, janus_sdp *sdp, g
 				m->attributes = g_list_append(m->attributes, a);
 			}
 		}
-		g_free(m->c_addr);
+		janus_sdp_arena_free_string(m->arena, m->c_addr);
 		m->c_addr = g_strdup(local_ip);
 		if(answer && (m->type == JANUS_SDP_AUDIO || m->type == JANUS_SDP_VIDEO)) {
 			/* Check which codec was negotiated eventually */
@@ -1940,62 +2018,313 @@ static void janus_nosip_connect_sockets(janus_nosip_session *session, struct soc
 
 }
 
-/* Thread to relay RTP/RTCP frames coming from the peer */
-static void *janus_nosip_relay_thread(void *data) {
-	janus_nosip_session *session = (janus_nosip_session *)data;
-	if(!session) {
-		g_thread_unref(g_thread_self());
-		return NULL;
-	}
-	JANUS_LOG(LOG_INFO, "[NoSIP-%p] Starting relay thread\n", session);
+/* RTP clock rate of the audio codec we negotiated, which the jitter buffer needs */
+static guint32 janus_nosip_audio_clock_rate(janus_nosip_session *session) {
+	const char *codec = janus_sdp_get_codec_name(session->sdp, session->media.audio_pt);
+	if(codec == NULL || !strcasecmp(codec, "opus"))
+		return 48000;
+	if(!strcasecmp(codec, "isac32"))
+		return 32000;
+	if(!strcasecmp(codec, "isac16"))
+		return 16000;
+	return 8000;
+}
 
-	gboolean have_server_ip = TRUE;
-	struct sockaddr_in server_addr;
-	memset(&server_addr, 0, sizeof(server_addr));
-	server_addr.sin_family = AF_INET;
+/* Prepare the relaying of RTP/RTCP frames coming from the peer: this
+ * is shared by the per-session relay threads and the relay loops */
+static void janus_nosip_relay_setup(janus_nosip_session *session) {
+	JANUS_LOG(LOG_INFO, "[NoSIP-%p] Starting relay\n", session);
+	session->media.astep = 0;
+	session->media.vstep = 0;
+	session->media.ats = 0;
+	session->media.vts = 0;
+	session->media.pollerrs = 0;
+
+	session->media.have_server_ip = TRUE;
+	struct sockaddr_in *server_addr = &session->media.server_addr;
+	memset(server_addr, 0, sizeof(*server_addr));
+	server_addr->sin_family = AF_INET;
 	if(session->media.remote_ip == NULL) {
 		JANUS_LOG(LOG_WARN, "[NoSIP-%p] No remote IP?\n", session);
 	} else {
-		if((inet_aton(session->media.remote_ip, &server_addr.sin_addr)) <= 0) {	/* Not a numeric IP... */
+		if((inet_aton(session->media.remote_ip, &server_addr->sin_addr)) <= 0) {	/* Not a numeric IP... */
 			struct hostent *host = gethostbyname(session->media.remote_ip);	/* ...resolve name */
 			if(!host) {
 				JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't get host (%s)\n", session, session->media.remote_ip);
-				have_server_ip = FALSE;
+				session->media.have_server_ip = FALSE;
 			} else {
-				server_addr.sin_addr = *(struct in_addr *)host->h_addr_list;
+				server_addr->sin_addr = *(struct in_addr *)host->h_addr_list;
+			}
+		}
+	}
+	if(session->media.have_server_ip) {
+		janus_nosip_connect_sockets(session, server_addr);
+	}
+	if(jitter_buffer > 0) {
+		/* Media from the peer will go through a jitter buffer before we relay it */
+		janus_mutex_lock(&session->mutex);
+		if(session->media.has_audio && session->media.audio_jb == NULL) {
+			session->media.audio_jb = janus_jitter_buffer_create(JITTER_BUFFER_AUDIO_SLOTS,
+				janus_nosip_audio_clock_rate(session), JITTER_BUFFER_MIN_DELAY, jitter_buffer);
+		}
+		if(session->media.has_video && session->media.video_jb == NULL) {
+			session->media.video_jb = janus_jitter_buffer_create(JITTER_BUFFER_VIDEO_SLOTS,
+				90000, JITTER_BUFFER_MIN_DELAY, jitter_buffer);
+		}
+		janus_mutex_unlock(&session->mutex);
+	}
+}
+
+/* Check if we should keep on relaying, and apply session updates, if any */
+static gboolean janus_nosip_relay_active(janus_nosip_session *session) {
+	if(session == NULL || g_atomic_int_get(&session->destroyed) || g_atomic_int_get(&session->hangingup))
+		return FALSE;
+	if(session->media.updated) {
+		/* Apparently there was a session update */
+		if(session->media.have_server_ip && (inet_aton(session->media.remote_ip, &session->media.server_addr.sin_addr) == 0)) {
+			janus_nosip_connect_sockets(session, &session->media.server_addr);
+		} else {
+			JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't update session details: missing or invalid remote IP address? (%s)\n",
+				session, session->media.remote_ip);
+		}
+		session->media.updated = FALSE;
+	}
+	return TRUE;
+}
+
+/* Handle an error on one of the RTP/RTCP sockets: returns a negative
+ * integer if it's bad enough that the session should be considered over */
+static int janus_nosip_relay_error(janus_nosip_session *session, int fd, int error) {
+	if(error == 0) {
+		/* Maybe not a breaking error after all? */
+		return 0;
+	} else if(error == 111) {
+		/* ICMP error? If it's related to RTCP, let's just close the RTCP socket and move on */
+		if(fd == session->media.audio_rtcp_fd) {
+			JANUS_LOG(LOG_WARN, "[NoSIP-%p] Got a '%s' on the audio RTCP socket, closing it\n",
+				session, strerror(error));
+			janus_relay_pool_remove_fd(relay_pool, session->media.relay_id, fd);
+			close(session->media.audio_rtcp_fd);
+			session->media.audio_rtcp_fd = -1;
+		} else if(fd == session->media.video_rtcp_fd) {
+			JANUS_LOG(LOG_WARN, "[NoSIP-%p] Got a '%s' on the video RTCP socket, closing it\n",
+				session, strerror(error));
+			janus_relay_pool_remove_fd(relay_pool, session->media.relay_id, fd);
+			close(session->media.video_rtcp_fd);
+			session->media.video_rtcp_fd = -1;
+		}
+	}
+	/* FIXME Should we be more tolerant of ICMP errors on RTP sockets as well? */
+	session->media.pollerrs++;
+	if(session->media.pollerrs < 100)
+		return 0;
+	JANUS_LOG(LOG_ERR, "[NoSIP-%p] Too many errors polling socket %d\n", session, fd);
+	JANUS_LOG(LOG_ERR, "[NoSIP-%p]   -- %d (%s)\n", session, error, strerror(error));
+	/* Can we assume it's pretty much over, after a POLLERR? */
+	/* FIXME Close the PeerConnection */
+	gateway->close_pc(session->handle);
+	return -1;
+}
+
+/* Relay an RTP packet from the peer to the browser, once it's out of the jitter buffer (if any) */
+static void janus_nosip_relay_rtp(janus_nosip_session *session, gboolean video, char *buffer, int bytes) {
+	rtp_header *header = (rtp_header *)buffer;
+	/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
+	guint32 timestamp = ntohl(header->timestamp);
+	janus_rtp_header_update(header, &session->media.context, video,
+		(video ? (session->media.vstep ? session->media.vstep : 4500) : (session->media.astep ? session->media.astep : 960)));
+	if(video) {
+		if(session->media.vts == 0) {
+			session->media.vts = timestamp;
+		} else if(session->media.vstep == 0) {
+			session->media.vstep = timestamp-session->media.vts;
+			if(session->media.vstep < 0) {
+				session->media.vstep = 0;
+			}
+		}
+	} else {
+		if(session->media.ats == 0) {
+			session->media.ats = timestamp;
+		} else if(session->media.astep == 0) {
+			session->media.astep = timestamp-session->media.ats;
+			if(session->media.astep < 0) {
+				session->media.astep = 0;
+			}
+		}
+	}
+	/* Save the frame if we're recording */
+	janus_recorder_save_frame(video ? session->vrc_peer : session->arc_peer, buffer, bytes);
+	/* Relay to browser */
+	gateway->relay_rtp(session->handle, video, buffer, bytes);
+}
+
+/* Relay the packets in the jitter buffers that are due: returns how long
+ * until the next one will be (in microseconds), or -1 if none is queued.
+ * The buffers are only accessed with the session mutex locked, as they
+ * can go away when the session is updated, but we relay with it unlocked */
+static gint64 janus_nosip_relay_drain(janus_nosip_session *session, gint64 now) {
+	char packet[JANUS_JITTER_BUFFER_MAX_PACKET];
+	gint64 next = -1, wait = 0;
+	int i = 0, bytes = 0;
+	for(i=0; i<2; i++) {
+		while(TRUE) {
+			janus_mutex_lock(&session->mutex);
+			janus_jitter_buffer *jb = i ? session->media.video_jb : session->media.audio_jb;
+			if(jb == NULL) {
+				janus_mutex_unlock(&session->mutex);
+				break;
+			}
+			bytes = janus_jitter_buffer_pop(jb, packet, sizeof(packet), now);
+			if(bytes <= 0) {
+				wait = janus_jitter_buffer_next(jb, now);
+				janus_mutex_unlock(&session->mutex);
+				if(wait >= 0 && (next < 0 || wait < next))
+					next = wait;
+				break;
 			}
+			janus_mutex_unlock(&session->mutex);
+			janus_nosip_relay_rtp(session, i == 1, packet, bytes);
 		}
 	}
-	if(have_server_ip) {
-		janus_nosip_connect_sockets(session, &server_addr);
+	return next;
+}
+
+/* Handle an RTP/RTCP packet received from the peer */
+static void janus_nosip_relay_incoming(janus_nosip_session *session, int fd, char *buffer, int bytes) {
+	/* Let's check what this is */
+	gboolean video = fd == session->media.video_rtp_fd || fd == session->media.video_rtcp_fd;
+	gboolean rtcp = fd == session->media.audio_rtcp_fd || fd == session->media.video_rtcp_fd;
+	if(!rtcp) {
+		/* Audio or Video RTP */
+		session->media.pollerrs = 0;
+		rtp_header *header = (rtp_header *)buffer;
+		if((video && session->media.video_ssrc_peer != ntohl(header->ssrc)) ||
+				(!video && session->media.audio_ssrc_peer != ntohl(header->ssrc))) {
+			if(video) {
+				session->media.video_ssrc_peer = ntohl(header->ssrc);
+			} else {
+				session->media.audio_ssrc_peer = ntohl(header->ssrc);
+			}
+			JANUS_LOG(LOG_VERB, "[NoSIP-%p] Got SIP peer %s SSRC: %"SCNu32"\n",
+				session, video ? "video" : "audio", session->media.audio_ssrc_peer);
+		}
+		/* Is this SRTP? */
+		if(session->media.has_srtp_remote) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect(
+				(video ? session->media.video_srtp_in : session->media.audio_srtp_in),
+				buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				guint32 timestamp = ntohl(header->timestamp);
+				guint16 seq = ntohs(header->seq_number);
+				JANUS_LOG(LOG_ERR, "[NoSIP-%p] %s SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
+					session, video ? "Video" : "Audio", janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
+				return;
+			}
+			bytes = buflen;
+		}
+		/* Queue the packet in the jitter buffer, if we have one, or relay it right away */
+		janus_mutex_lock(&session->mutex);
+		janus_jitter_buffer *jb = video ? session->media.video_jb : session->media.audio_jb;
+		if(jb == NULL) {
+			janus_mutex_unlock(&session->mutex);
+			janus_nosip_relay_rtp(session, video, buffer, bytes);
+			return;
+		}
+		gint64 now = janus_get_monotonic_time();
+		janus_jitter_buffer_push(jb, buffer, bytes, now);
+		janus_mutex_unlock(&session->mutex);
+		janus_nosip_relay_drain(session, now);
+	} else {
+		/* Audio or Video RTCP */
+		if(session->media.has_srtp_remote) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect_rtcp(
+				(video ? session->media.video_srtp_in : session->media.audio_srtp_in),
+				buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				JANUS_LOG(LOG_ERR, "[NoSIP-%p] %s SRTCP unprotect error: %s (len=%d-->%d)\n",
+					session, video ? "Video" : "Audio", janus_srtp_error_str(res), bytes, buflen);
+				return;
+			}
+			bytes = buflen;
+		}
+		/* Relay to browser */
+		gateway->relay_rtcp(session->handle, video, buffer, bytes);
 	}
+}
+
+/* Close the RTP/RTCP sockets and clean up when we're done relaying */
+static void janus_nosip_relay_cleanup(janus_nosip_session *session) {
+	session->media.relay_id = 0;
+	if(session->media.audio_rtp_fd != -1) {
+		close(session->media.audio_rtp_fd);
+		session->media.audio_rtp_fd = -1;
+	}
+	if(session->media.audio_rtcp_fd != -1) {
+		close(session->media.audio_rtcp_fd);
+		session->media.audio_rtcp_fd = -1;
+	}
+	session->media.local_audio_rtp_port = 0;
+	session->media.local_audio_rtcp_port = 0;
+	session->media.audio_ssrc = 0;
+	if(session->media.video_rtp_fd != -1) {
+		close(session->media.video_rtp_fd);
+		session->media.video_rtp_fd = -1;
+	}
+	if(session->media.video_rtcp_fd != -1) {
+		close(session->media.video_rtcp_fd);
+		session->media.video_rtcp_fd = -1;
+	}
+	session->media.local_video_rtp_port = 0;
+	session->media.local_video_rtcp_port = 0;
+	session->media.video_ssrc = 0;
+	if(session->media.pipefd[0] > 0) {
+		close(session->media.pipefd[0]);
+		session->media.pipefd[0] = -1;
+	}
+	if(session->media.pipefd[1] > 0) {
+		close(session->media.pipefd[1]);
+		session->media.pipefd[1] = -1;
+	}
+	/* Clean up SRTP stuff, if needed */
+	janus_nosip_srtp_cleanup(session);
+	/* Get rid of the jitter buffers, if any */
+	janus_mutex_lock(&session->mutex);
+	janus_jitter_buffer_destroy(session->media.audio_jb);
+	session->media.audio_jb = NULL;
+	janus_jitter_buffer_destroy(session->media.video_jb);
+	session->media.video_jb = NULL;
+	janus_mutex_unlock(&session->mutex);
+}
+
+/* Thread to relay RTP/RTCP frames coming from the peer */
+static void *janus_nosip_relay_thread(void *data) {
+	janus_nosip_session *session = (janus_nosip_session *)data;
+	if(!session) {
+		g_thread_unref(g_thread_self());
+		return NULL;
+	}
+	janus_nosip_relay_setup(session);
 
 	/* File descriptors */
 	socklen_t addrlen;
 	struct sockaddr_in remote;
-	int resfd = 0, bytes = 0, pollerrs = 0;
+	int resfd = 0, bytes = 0;
 	struct pollfd fds[5];
 	int pipe_fd = session->media.pipefd[0];
 	char buffer[1500];
 	memset(buffer, 0, 1500);
 	/* Loop */
-	int num = 0;
+	int num = 0, timeout = 0;
+	gint64 next = 0;
 	gboolean goon = TRUE;
-	int astep = 0, vstep = 0;
-	guint32 ats = 0, vts = 0;
-	while(goon && session != NULL &&
-			!g_atomic_int_get(&session->destroyed) && !g_atomic_int_get(&session->hangingup)) {
-		if(session->media.updated) {
-			/* Apparently there was a session update */
-			if(have_server_ip && (inet_aton(session->media.remote_ip, &server_addr.sin_addr) == 0)) {
-				janus_nosip_connect_sockets(session, &server_addr);
-			} else {
-				JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't update session details: missing or invalid remote IP address? (%s)\n",
-					session, session->media.remote_ip);
-			}
-			session->media.updated = FALSE;
-		}
-
+	while(goon && janus_nosip_relay_active(session)) {
+		/* If we're queueing packets, relay those that are due, and wake up in time for the next one */
+		timeout = 1000;
+		next = janus_nosip_relay_drain(session, janus_get_monotonic_time());
+		if(next >= 0 && next < 1000000)
+			timeout = (next + 999) / 1000;
 		/* Prepare poll */
 		num = 0;
 		if(session->media.audio_rtp_fd != -1) {
@@ -2029,7 +2358,7 @@ static void *janus_nosip_relay_thread(void *data) {
 			num++;
 		}
 		/* Wait for some data */
-		resfd = poll(fds, num, 1000);
+		resfd = poll(fds, num, timeout);
 		if(resfd < 0) {
 			if(errno == EINTR) {
 				JANUS_LOG(LOG_HUGE, "[NoSIP-%p] Got an EINTR (%s), ignoring...\n", session, strerror(errno));
@@ -2054,35 +2383,10 @@ static void *janus_nosip_relay_thread(void *data) {
 				int error = 0;
 				socklen_t errlen = sizeof(error);
 				getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, (void *)&error, &errlen);
-				if(error == 0) {
-					/* Maybe not a breaking error after all? */
-					continue;
-				} else if(error == 111) {
-					/* ICMP error? If it's related to RTCP, let's just close the RTCP socket and move on */
-					if(fds[i].fd == session->media.audio_rtcp_fd) {
-						JANUS_LOG(LOG_WARN, "[NoSIP-%p] Got a '%s' on the audio RTCP socket, closing it\n",
-							session, strerror(error));
-						close(session->media.audio_rtcp_fd);
-						session->media.audio_rtcp_fd = -1;
-					} else if(fds[i].fd == session->media.video_rtcp_fd) {
-						JANUS_LOG(LOG_WARN, "[NoSIP-%p] Got a '%s' on the video RTCP socket, closing it\n",
-							session, strerror(error));
-						close(session->media.video_rtcp_fd);
-						session->media.video_rtcp_fd = -1;
-					}
+				if(janus_nosip_relay_error(session, fds[i].fd, error) < 0) {
+					goon = FALSE;
+					break;
 				}
-				/* FIXME Should we be more tolerant of ICMP errors on RTP sockets as well? */
-				pollerrs++;
-				if(pollerrs < 100)
-					continue;
-				JANUS_LOG(LOG_ERR, "[NoSIP-%p] Too many errors polling %d (socket #%d): %s...\n", session,
-					fds[i].fd, i, fds[i].revents & POLLERR ? "POLLERR" : "POLLHUP");
-				JANUS_LOG(LOG_ERR, "[NoSIP-%p]   -- %d (%s)\n", session, error, strerror(error));
-				/* Can we assume it's pretty much over, after a POLLERR? */
-				goon = FALSE;
-				/* FIXME Close the PeerConnection */
-				gateway->close_pc(session->handle);
-				break;
 			} else if(fds[i].revents & POLLIN) {
 				if(pipe_fd != -1 && fds[i].fd == pipe_fd) {
 					/* Poll interrupted for a reason, go on */
@@ -2097,122 +2401,75 @@ static void *janus_nosip_relay_thread(void *data) {
 					/* Failed to read? */
 					continue;
 				}
-				/* Let's check what this is */
-				gboolean video = fds[i].fd == session->media.video_rtp_fd || fds[i].fd == session->media.video_rtcp_fd;
-				gboolean rtcp = fds[i].fd == session->media.audio_rtcp_fd || fds[i].fd == session->media.video_rtcp_fd;
-				if(!rtcp) {
-					/* Audio or Video RTP */
-					pollerrs = 0;
-					rtp_header *header = (rtp_header *)buffer;
-					if((video && session->media.video_ssrc_peer != ntohl(header->ssrc)) ||
-							(!video && session->media.audio_ssrc_peer != ntohl(header->ssrc))) {
-						if(video) {
-							session->media.video_ssrc_peer = ntohl(header->ssrc);
-						} else {
-							session->media.audio_ssrc_peer = ntohl(header->ssrc);
-						}
-						JANUS_LOG(LOG_VERB, "[NoSIP-%p] Got SIP peer %s SSRC: %"SCNu32"\n",
-							session, video ? "video" : "audio", session->media.audio_ssrc_peer);
-					}
-					/* Is this SRTP? */
-					if(session->media.has_srtp_remote) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect(
-							(video ? session->media.video_srtp_in : session->media.audio_srtp_in),
-							buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							guint32 timestamp = ntohl(header->timestamp);
-							guint16 seq = ntohs(header->seq_number);
-							JANUS_LOG(LOG_ERR, "[NoSIP-%p] %s SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
-								session, video ? "Video" : "Audio", janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
-					guint32 timestamp = ntohl(header->timestamp);
-					janus_rtp_header_update(header, &session->media.context, video,
-						(video ? (vstep ? vstep : 4500) : (astep ? astep : 960)));
-					if(video) {
-						if(vts == 0) {
-							vts = timestamp;
-						} else if(vstep == 0) {
-							vstep = timestamp-vts;
-							if(vstep < 0) {
-								vstep = 0;
-							}
-						}
-					} else {
-						if(ats == 0) {
-							ats = timestamp;
-						} else if(astep == 0) {
-							astep = timestamp-ats;
-							if(astep < 0) {
-								astep = 0;
-							}
-						}
-					}
-					/* Save the frame if we're recording */
-					janus_recorder_save_frame(video ? session->vrc_peer : session->arc_peer, buffer, bytes);
-					/* Relay to browser */
-					gateway->relay_rtp(session->handle, video, buffer, bytes);
-					continue;
-				} else {
-					/* Audio or Video RTCP */
-					if(session->media.has_srtp_remote) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect_rtcp(
-							(video ? session->media.video_srtp_in : session->media.audio_srtp_in),
-							buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							JANUS_LOG(LOG_ERR, "[NoSIP-%p] %s SRTCP unprotect error: %s (len=%d-->%d)\n",
-								session, video ? "Video" : "Audio", janus_srtp_error_str(res), bytes, buflen);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Relay to browser */
-					gateway->relay_rtcp(session->handle, video, buffer, bytes);
-					continue;
-				}
+				janus_nosip_relay_incoming(session, fds[i].fd, buffer, bytes);
 			}
 		}
 	}
-	if(session->media.audio_rtp_fd != -1) {
-		close(session->media.audio_rtp_fd);
-		session->media.audio_rtp_fd = -1;
-	}
-	if(session->media.audio_rtcp_fd != -1) {
-		close(session->media.audio_rtcp_fd);
-		session->media.audio_rtcp_fd = -1;
-	}
-	session->media.local_audio_rtp_port = 0;
-	session->media.local_audio_rtcp_port = 0;
-	session->media.audio_ssrc = 0;
-	if(session->media.video_rtp_fd != -1) {
-		close(session->media.video_rtp_fd);
-		session->media.video_rtp_fd = -1;
-	}
-	if(session->media.video_rtcp_fd != -1) {
-		close(session->media.video_rtcp_fd);
-		session->media.video_rtcp_fd = -1;
-	}
-	session->media.local_video_rtp_port = 0;
-	session->media.local_video_rtcp_port = 0;
-	session->media.video_ssrc = 0;
-	if(session->media.pipefd[0] > 0) {
-		close(session->media.pipefd[0]);
-		session->media.pipefd[0] = -1;
-	}
-	if(session->media.pipefd[1] > 0) {
-		close(session->media.pipefd[1]);
-		session->media.pipefd[1] = -1;
-	}
-	/* Clean up SRTP stuff, if needed */
-	janus_nosip_srtp_cleanup(session);
+	janus_nosip_relay_cleanup(session);
 	/* Done */
 	JANUS_LOG(LOG_INFO, "Leaving NoSIP relay thread\n");
 	janus_refcount_decrease(&session->ref);
 	g_thread_unref(g_thread_self());
 	return NULL;
 }
+
+/* Callbacks for sessions handled by the shared relay loops, rather than by a thread */
+static void janus_nosip_relay_loop_incoming(gpointer user_data, int fd, char *buf, int len) {
+	janus_nosip_relay_incoming((janus_nosip_session *)user_data, fd, buf, len);
+}
+
+static int janus_nosip_relay_loop_error(gpointer user_data, int fd, int error) {
+	janus_nosip_session *session = (janus_nosip_session *)user_data;
+	/* If we just updated the session, let's wait until things have calmed down */
+	if(session->media.updated)
+		return 0;
+	return janus_nosip_relay_error(session, fd, error);
+}
+
+static gboolean janus_nosip_relay_loop_check(gpointer user_data) {
+	janus_nosip_session *session = (janus_nosip_session *)user_data;
+	if(!janus_nosip_relay_active(session))
+		return FALSE;
+	/* Don't keep packets in the jitter buffers forever if the peer stopped sending */
+	janus_nosip_relay_drain(session, janus_get_monotonic_time());
+	return TRUE;
+}
+
+static void janus_nosip_relay_loop_done(gpointer user_data) {
+	janus_nosip_session *session = (janus_nosip_session *)user_data;
+	janus_nosip_relay_cleanup(session);
+	JANUS_LOG(LOG_INFO, "[NoSIP-%p] Session removed from the relay loops\n", session);
+	janus_refcount_decrease(&session->ref);
+}
+
+static janus_relay_callbacks janus_nosip_relay_callbacks = {
+	.incoming = janus_nosip_relay_loop_incoming,
+	.error = janus_nosip_relay_loop_error,
+	.check = janus_nosip_relay_loop_check,
+	.done = janus_nosip_relay_loop_done,
+};
+
+/* Start relaying media from the peer, either in the relay loops or in a dedicated thread */
+static void janus_nosip_relay_start(janus_nosip_session *session) {
+	janus_refcount_increase(&session->ref);
+	if(relay_pool != NULL) {
+		janus_nosip_relay_setup(session);
+		int fds[4] = { session->media.audio_rtp_fd, session->media.audio_rtcp_fd,
+			session->media.video_rtp_fd, session->media.video_rtcp_fd };
+		session->media.relay_id = janus_relay_pool_add(relay_pool, fds, 4, &janus_nosip_relay_callbacks, session);
+		if(session->media.relay_id == 0) {
+			JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't add the session to the relay loops...\n", session);
+			janus_nosip_relay_cleanup(session);
+			janus_refcount_decrease(&session->ref);
+		}
+		return;
+	}
+	GError *error = NULL;
+	char tname[16];
+	g_snprintf(tname, sizeof(tname), "nosiprtp %p", session);
+	g_thread_try_new(tname, janus_nosip_relay_thread, session, &error);
+	if(error != NULL) {
+		janus_refcount_decrease(&session->ref);
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n", error->code, error->message ? error->message : "??");
+	}
+}
@@ -24,7 +24,12 @@
  * 
  * The configuration process is quite easy: just choose where the
  * recordings should be saved. The same folder will also be used to list
- * the available recordings that can be replayed.
+ * the available recordings that can be replayed: the plugin watches it
+ * for .nfo files being added or removed, where inotify is available, so
+ * the list is always up to date. Optionally, a \c catalogue path can be
+ * configured as well: the plugin will save the list of recordings there,
+ * which means that when restarting only the .nfo files that were added
+ * or modified in the meanwhile will need to be parsed.
  * 
  * \note The application creates a special file in INI format with
  * \c .nfo extension for each recording that is saved. This is necessary
@@ -52,25 +57,31 @@
  * get a response directly within the context of the transaction. \c list
  * lists all the available recordings, while \c update forces the plugin
  * to scan the folder of recordings again in case some were added manually
- * and not indexed in the meanwhile.
+ * and not indexed in the meanwhile (only new or modified .nfo files are
+ * parsed), which can be useful when the folder can't be watched.
  * 
- * The \c record , \c play , \c start and \c stop requests instead are
- * all asynchronous, which means you'll get a notification about their
- * success or failure in an event. \c record asks the plugin to start
- * recording a session; \c play asks the plugin to prepare the playout
- * of one of the previously recorded sessions; \c start starts the
- * actual playout, and \c stop stops whatever the session was for, i.e.,
- * recording or replaying.
+ * The \c record , \c play , \c start , \c pause , \c resume , \c seek
+ * and \c stop requests instead are all asynchronous, which means you'll
+ * get a notification about their success or failure in an event. \c record
+ * asks the plugin to start recording a session; \c play asks the plugin
+ * to prepare the playout of one of the previously recorded sessions;
+ * \c start starts the actual playout; \c pause , \c resume and \c seek
+ * control an ongoing playout, and \c stop stops whatever the session
+ * was for, i.e., recording or replaying.
  * 
  * The \c list request has to be formatted as follows:
  *
 \verbatim
 {
-	"request" : "list"
+	"request" : "list",
+	"offset" : <how many recordings to skip; optional, default=0>,
+	"limit" : <how many recordings to return at most; optional, default=all>
 }
 \endverbatim
  *
- * A successful request will result in an array of recordings:
+ * A successful request will result in an array of recordings, sorted by
+ * their ID, along with the total number of recordings available, which
+ * can be used to paginate the list:
  * 
 \verbatim
 {
@@ -83,10 +94,12 @@
 			"audio": "<Audio rec file, if any; optional>",
 			"video": "<Video rec file, if any; optional>",
 			"audio_codec": "<Audio codec, if any; optional>",
-			"video_codec": "<Video codec, if any; optional>"
+			"video_codec": "<Video codec, if any; optional>",
+			"duration": <Duration in milliseconds, if the recording has a seek index; optional>
 		},
 		<other recordings>
-	]
+	],
+	"total" : <total number of recordings available>
 }
 \endverbatim
  * 
@@ -218,6 +231,35 @@
 	}
 }
 \endverbatim
+ * 
+ * An ongoing playout can be paused and resumed with \c pause and \c resume
+ * requests, which only need the name of the request and result in a
+ * \c paused and \c playing status respectively. A \c seek request
+ * moves the playout to a different position instead:
+ * 
+\verbatim
+{
+	"request" : "seek",
+	"position" : <position to move to, in milliseconds from the beginning>
+}
+\endverbatim
+ * 
+ * which results in a \c seeking status:
+ * 
+\verbatim
+{
+	"recordplay" : "event",
+	"result": {
+		"status" : "seeking",
+		"position" : <position that was requested>
+	}
+}
+\endverbatim
+ * 
+ * Video always restarts from the last keyframe before the requested
+ * position, and audio is kept in sync with it. Seeking is immediate for
+ * recordings that have a seek index: for the ones that don't, the
+ * recording is scanned from the beginning to find the position.
  * 
  * Just as before, a \c stop request can interrupt the playout process at
  * any time, and tear the associated PeerConnection down:
@@ -255,9 +297,13 @@
 #include "plugin.h"
 
 #include <dirent.h>
+#include <poll.h>
 #include <arpa/inet.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
 #include <jansson.h>
 
 #include "../debug.h"
@@ -337,6 +383,10 @@ janus_plugin *create(void) {
 static struct janus_json_parameter request_parameters[] = {
 	{"request", JSON_STRING, JANUS_JSON_PARAM_REQUIRED}
 };
+static struct janus_json_parameter list_parameters[] = {
+	{"offset", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"limit", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
+};
 static struct janus_json_parameter configure_parameters[] = {
 	{"video-bitrate-max", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"video-keyframe-interval", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
@@ -351,6 +401,9 @@ static struct janus_json_parameter play_parameters[] = {
 	{"id", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
 	{"restart", JANUS_JSON_BOOL, 0}
 };
+static struct janus_json_parameter seek_parameters[] = {
+	{"position", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE}
+};
 
 /* Useful stuff */
 static volatile gint initialized = 0, stopping = 0;
@@ -374,15 +427,37 @@ typedef struct janus_recordplay_rtp_header_extension {
 	uint16_t length;
 } janus_recordplay_rtp_header_extension;
 
-typedef struct janus_recordplay_frame_packet {
-	uint16_t seq;	/* RTP Sequence number */
-	uint64_t ts;	/* RTP Timestamp */
-	int len;		/* Length of the data */
-	long offset;	/* Offset of the data in the file */
-	struct janus_recordplay_frame_packet *next;
-	struct janus_recordplay_frame_packet *prev;
-} janus_recordplay_frame_packet;
-janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, const char *filename);
+/* A track (audio or video) of a recording being played: packets are read
+ * from the .mjr file only when needed, one packet ahead of the playout */
+typedef struct janus_recordplay_track {
+	FILE *file;					/* The .mjr file we're reading from */
+	long size;					/* Size of the file */
+	long offset;				/* Offset of the next frame to read in the file */
+	janus_recorder_index *index;	/* Seek index of the recording, if available */
+	gboolean video;				/* Whether this is a video track */
+	int pt;						/* Payload type to use when sending packets */
+	int khz;					/* Clock rate of the codec, in kHz */
+	const char *codec;			/* Codec of the track, to look for keyframes when there's no index */
+	char buffer[1500];			/* The next packet to send */
+	int len;					/* Length of the next packet (0 if there's nothing left) */
+	guint64 ts;					/* RTP timestamp of the next packet, taking resets into account */
+	guint32 last_ts;			/* Last RTP timestamp we read, to detect resets */
+	guint64 ts_cycles;			/* How many timestamp resets we detected */
+	guint64 first_ts;			/* Timestamp of the first packet in the file */
+	guint64 anchor_ts;			/* Timestamp of the packet the timing of the playout is anchored to */
+	gint64 anchor_time;			/* Monotonic time that packet was (or will be) sent at */
+} janus_recordplay_track;
+static janus_recordplay_track *janus_recordplay_track_open(const char *dir, const char *filename, gboolean video, int pt, const char *codec);
+static void janus_recordplay_track_close(janus_recordplay_track *track);
+
+/* Playout of a recording to a viewer */
+typedef struct janus_recordplay_player {
+	struct janus_recordplay_session *session;		/* The viewer */
+	struct janus_recordplay_recording *recording;	/* The recording */
+	janus_recordplay_track *audio, *video;			/* The tracks we play */
+	gint64 next;		/* When the next packet must be sent */
+	gint64 paused;		/* When the playout was paused, if it is */
+} janus_recordplay_player;
 
 typedef struct janus_recordplay_recording {
 	guint64 id;					/* Recording unique ID */
@@ -394,7 +469,11 @@ typedef struct janus_recordplay_recording {
 	char *vrc_file;				/* Video file name */
 	const char *vcodec;			/* Codec used for video, if available */
 	int video_pt;				/* Payload types to use for audio when playing recordings */
-	char *offer;				/* The SDP offer that will be sent to watchers */
+	gint64 duration;			/* Duration in ms from the seek index (0 if not checked yet, -1 if unavailable) */
+	char *nfo;					/* Name of the .nfo file describing this recording, if any */
+	time_t nfo_mtime;			/* When the .nfo file was last modified */
+	GSequenceIter *sorted;		/* Where this recording is in the sorted catalogue, if completed */
+	char *offer;				/* The SDP offer that will be sent to watchers (generated when first needed) */
 	GList *viewers;				/* List of users watching this recording */
 	volatile gint completed;	/* Whether this recording was completed or still going on */
 	volatile gint destroyed;	/* Whether this recording has been marked as destroyed */
@@ -402,7 +481,15 @@ typedef struct janus_recordplay_recording {
 	janus_mutex mutex;			/* Mutex for this recording */
 } janus_recordplay_recording;
 static GHashTable *recordings = NULL;
+static GSequence *recordings_sorted = NULL;	/* Completed recordings, sorted by ID, for paginated lists */
+static GHashTable *recordings_nfo = NULL;	/* Name of the .nfo file --> ID of the recording */
 static janus_mutex recordings_mutex = JANUS_MUTEX_INITIALIZER;
+static char *catalogue_path = NULL;
+static gboolean catalogue_dirty = FALSE;
+static GThread *watcher_thread;
+static void *janus_recordplay_watcher_thread(void *data);
+static void janus_recordplay_catalogue_load(void);
+static void janus_recordplay_catalogue_save(void);
 
 typedef struct janus_recordplay_session {
 	janus_plugin_session *handle;
@@ -415,8 +502,10 @@ typedef struct janus_recordplay_session {
 	janus_recorder *arc;	/* Audio recorder */
 	janus_recorder *vrc;	/* Video recorder */
 	janus_mutex rec_mutex;	/* Mutex to protect the recorders from race conditions */
-	janus_recordplay_frame_packet *aframes;	/* Audio frames (for playout) */
-	janus_recordplay_frame_packet *vframes;	/* Video frames (for playout) */
+	janus_recordplay_player *player;	/* Playout state, until the playout starts */
+	janus_mutex mutex;		/* Mutex to protect the playout state */
+	volatile gint paused;	/* Whether the playout is paused */
+	volatile gint seek;		/* Position to seek to in the playout, in ms (-1 if none) */
 	guint video_remb_startup;
 	gint64 video_remb_last;
 	guint32 video_bitrate;
@@ -430,6 +519,7 @@ typedef struct janus_recordplay_session {
 } janus_recordplay_session;
 static GHashTable *sessions;
 static janus_mutex sessions_mutex = JANUS_MUTEX_INITIALIZER;
+static void janus_recordplay_player_free(janus_recordplay_player *player);
 
 static void janus_recordplay_session_destroy(janus_recordplay_session *session) {
 	if(session && g_atomic_int_compare_and_exchange(&session->destroyed, 0, 1))
@@ -441,6 +531,11 @@ static void janus_recordplay_session_free(const janus_refcount *session_ref) {
 	/* Remove the reference to the core plugin session */
 	janus_refcount_decrease(&session->handle->ref);
 	/* This session can be destroyed, free all the resources */
+	janus_mutex_lock(&session->mutex);
+	janus_recordplay_player *player = session->player;
+	session->player = NULL;
+	janus_mutex_unlock(&session->mutex);
+	janus_recordplay_player_free(player);
 	g_free(session);
 }
 
@@ -457,14 +552,24 @@ static void janus_recordplay_recording_free(const janus_refcount *recording_ref)
 	g_free(recording->date);
 	g_free(recording->arc_file);
 	g_free(recording->vrc_file);
+	g_free(recording->nfo);
 	g_free(recording->offer);
 	g_free(recording);
 }
 
 
+static gint janus_recordplay_recording_compare(gconstpointer a, gconstpointer b, gpointer data) {
+	guint64 ia = ((janus_recordplay_recording *)a)->id, ib = ((janus_recordplay_recording *)b)->id;
+	return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
 static char *recordings_path = NULL;
 void janus_recordplay_update_recordings_list(void);
+static GThread *playout_thread;
 static void *janus_recordplay_playout_thread(void *data);
+static GAsyncQueue *playout_queue = NULL;	/* New players, and wake-up calls, for the playout thread */
+static janus_recordplay_player playout_wakeup, playout_exit;
+static janus_recordplay_player *janus_recordplay_player_create(janus_recordplay_recording *rec, const char **warning);
 
 /* Helper to send RTCP feedback back to recorders, if needed */
 void janus_recordplay_send_rtcp_feedback(janus_plugin_session *handle, int video, char *buf, int len);
@@ -473,6 +578,25 @@ void janus_recordplay_send_rtcp_feedback(janus_plugin_session *handle, int video
 #define AUDIO_PT		111
 #define VIDEO_PT		100
 
+/* Helper method to get the duration of a recording from its seek index, if any (in ms, -1 if unavailable) */
+static gint64 janus_recordplay_get_duration(janus_recordplay_recording *rec) {
+	gint64 duration = -1;
+	const char *files[2] = { rec->arc_file, rec->vrc_file };
+	char source[1024];
+	int i = 0;
+	for(i=0; i<2; i++) {
+		if(files[i] == NULL)
+			continue;
+		g_snprintf(source, 1024, "%s/%s.mjr", recordings_path, files[i]);
+		janus_recorder_index *index = janus_recorder_index_load(source, 0);
+		if(index == NULL)
+			continue;
+		duration = MAX(duration, janus_recorder_index_duration(index)/1000);
+		janus_recorder_index_free(index);
+	}
+	return duration;
+}
+
 /* Helper method to check which codec was used in a specific recording */
 static const char *janus_recordplay_parse_codec(const char *dir, const char *filename) {
 	if(dir == NULL || filename == NULL)
@@ -634,6 +758,26 @@ static int janus_recordplay_generate_offer(janus_recordplay_recording *rec) {
 	return 0;
 }
 
+/* Helper method to initialize the common properties of a completed recording we found */
+static void janus_recordplay_recording_init(janus_recordplay_recording *rec) {
+	rec->audio_pt = AUDIO_PT;
+	if(rec->acodec) {
+		/* Some audio codecs have a fixed payload type that we can't mess with */
+		if(!strcasecmp(rec->acodec, "pcmu"))
+			rec->audio_pt = 0;
+		else if(!strcasecmp(rec->acodec, "pcma"))
+			rec->audio_pt = 8;
+		else if(!strcasecmp(rec->acodec, "g722"))
+			rec->audio_pt = 9;
+	}
+	rec->video_pt = VIDEO_PT;
+	rec->viewers = NULL;
+	g_atomic_int_set(&rec->destroyed, 0);
+	g_atomic_int_set(&rec->completed, 1);
+	janus_refcount_init(&rec->ref, janus_recordplay_recording_free);
+	janus_mutex_init(&rec->mutex);
+}
+
 static void janus_recordplay_message_free(janus_recordplay_message *msg) {
 	if(!msg || msg == &exit_message)
 		return;
@@ -694,6 +838,9 @@ int janus_recordplay_init(janus_callbacks *callback, const char *config_path) {
 		janus_config_item *path = janus_config_get_item_drilldown(config, "general", "path");
 		if(path && path->value)
 			recordings_path = g_strdup(path->value);
+		janus_config_item *catalogue = janus_config_get_item_drilldown(config, "general", "catalogue");
+		if(catalogue && catalogue->value)
+			catalogue_path = g_strdup(catalogue->value);
 		janus_config_item *events = janus_config_get_item_drilldown(config, "general", "events");
 		if(events != NULL && events->value != NULL)
 			notify_events = janus_is_true(events->value);
@@ -719,10 +866,15 @@ int janus_recordplay_init(janus_callbacks *callback, const char *config_path) {
 		}
 	}
 	recordings = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, (GDestroyNotify)janus_recordplay_recording_destroy);
+	recordings_sorted = g_sequence_new(NULL);
+	recordings_nfo = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, (GDestroyNotify)g_free);
+	/* If we have a catalogue, we'll only need to check what changed since it was saved */
+	janus_recordplay_catalogue_load();
 	janus_recordplay_update_recordings_list();
 	
 	sessions = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_recordplay_session_destroy);
 	messages = g_async_queue_new_full((GDestroyNotify) janus_recordplay_message_free);
+	playout_queue = g_async_queue_new();
 	/* This is the callback we'll need to invoke to contact the gateway */
 	gateway = callback;
 
@@ -736,6 +888,20 @@ int janus_recordplay_init(janus_callbacks *callback, const char *config_path) {
 		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Record&Play handler thread...\n", error->code, error->message ? error->message : "??");
 		return -1;
 	}
+	/* Launch the thread that will keep the list of recordings up to date */
+	watcher_thread = g_thread_try_new("recordplay watcher", janus_recordplay_watcher_thread, NULL, &error);
+	if(error != NULL) {
+		/* Not fatal, 'update' requests will still work */
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Record&Play watcher thread...\n", error->code, error->message ? error->message : "??");
+		g_clear_error(&error);
+	}
+	/* Launch the thread that will play recordings to all viewers */
+	playout_thread = g_thread_try_new("recordplay playout", janus_recordplay_playout_thread, NULL, &error);
+	if(error != NULL) {
+		g_atomic_int_set(&initialized, 0);
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Record&Play playout thread...\n", error->code, error->message ? error->message : "??");
+		return -1;
+	}
 	JANUS_LOG(LOG_INFO, "%s initialized!\n", JANUS_RECORDPLAY_NAME);
 	return 0;
 }
@@ -750,13 +916,34 @@ void janus_recordplay_destroy(void) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+	g_async_queue_push(playout_queue, &playout_exit);
+	if(playout_thread != NULL) {
+		g_thread_join(playout_thread);
+		playout_thread = NULL;
+	}
+	if(watcher_thread != NULL) {
+		g_thread_join(watcher_thread);
+		watcher_thread = NULL;
+	}
+	janus_recordplay_catalogue_save();
 	/* FIXME We should destroy the sessions cleanly */
 	janus_mutex_lock(&sessions_mutex);
 	g_hash_table_destroy(sessions);
+	janus_mutex_lock(&recordings_mutex);
+	g_sequence_free(recordings_sorted);
+	recordings_sorted = NULL;
+	g_hash_table_destroy(recordings_nfo);
+	recordings_nfo = NULL;
 	g_hash_table_destroy(recordings);
+	recordings = NULL;
+	janus_mutex_unlock(&recordings_mutex);
 	janus_mutex_unlock(&sessions_mutex);
+	g_free(catalogue_path);
+	catalogue_path = NULL;
 	g_async_queue_unref(messages);
 	messages = NULL;
+	g_async_queue_unref(playout_queue);
+	playout_queue = NULL;
 	sessions = NULL;
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
@@ -813,6 +1000,7 @@ void janus_recordplay_create_session(janus_plugin_session *handle, int *error) {
 	session->arc = NULL;
 	session->vrc = NULL;
 	janus_mutex_init(&session->rec_mutex);
+	janus_mutex_init(&session->mutex);
 	g_atomic_int_set(&session->hangingup, 0);
 	g_atomic_int_set(&session->destroyed, 0);
 	session->video_remb_startup = 4;
@@ -821,6 +1009,7 @@ void janus_recordplay_create_session(janus_plugin_session *handle, int *error) {
 	session->video_keyframe_request_last = 0;
 	session->video_keyframe_interval = 15000; 	/* 15 seconds by default */
 	session->video_fir_seq = 0;
+	g_atomic_int_set(&session->seek, -1);
 	janus_refcount_init(&session->ref, janus_recordplay_session_free);
 	handle->plugin_handle = session;
 
@@ -937,17 +1126,23 @@ struct janus_plugin_result *janus_recordplay_handle_message(janus_plugin_session
 		json_object_set_new(response, "recordplay", json_string("ok"));
 		goto plugin_response;
 	} else if(!strcasecmp(request_text, "list")) {
+		JANUS_VALIDATE_JSON_OBJECT(root, list_parameters,
+			error_code, error_cause, TRUE,
+			JANUS_RECORDPLAY_ERROR_MISSING_ELEMENT, JANUS_RECORDPLAY_ERROR_INVALID_ELEMENT);
+		if(error_code != 0)
+			goto plugin_response;
+		json_t *offset = json_object_get(root, "offset");
+		json_t *limit = json_object_get(root, "limit");
 		json_t *list = json_array();
 		JANUS_LOG(LOG_VERB, "Request for the list of recordings\n");
-		/* Return a list of all available recordings */
+		/* Return a list of the available recordings, sorted by ID (ongoing ones are not listed) */
 		janus_mutex_lock(&recordings_mutex);
-		GHashTableIter iter;
-		gpointer value;
-		g_hash_table_iter_init(&iter, recordings);
-		while (g_hash_table_iter_next(&iter, NULL, &value)) {
-			janus_recordplay_recording *rec = value;
-			if(!g_atomic_int_get(&rec->completed))	/* Ongoing recording, skip */
-				continue;
+		gint total = g_sequence_get_length(recordings_sorted);
+		json_int_t count = limit ? json_integer_value(limit) : total;
+		json_int_t start = offset ? json_integer_value(offset) : 0;
+		GSequenceIter *iter = g_sequence_get_iter_at_pos(recordings_sorted, start > total ? total : (gint)start);
+		for(; count > 0 && !g_sequence_iter_is_end(iter); count--, iter = g_sequence_iter_next(iter)) {
+			janus_recordplay_recording *rec = g_sequence_get(iter);
 			janus_refcount_increase(&rec->ref);
 			json_t *ml = json_object();
 			json_object_set_new(ml, "id", json_integer(rec->id));
@@ -959,6 +1154,12 @@ struct janus_plugin_result *janus_recordplay_handle_message(janus_plugin_session
 			json_object_set_new(ml, "video", rec->vrc_file ? json_true() : json_false());
 			if(rec->vcodec)
 				json_object_set_new(ml, "video_codec", json_string(rec->vcodec));
+			if(rec->duration == 0) {
+				rec->duration = janus_recordplay_get_duration(rec);
+				catalogue_dirty = TRUE;
+			}
+			if(rec->duration >= 0)
+				json_object_set_new(ml, "duration", json_integer(rec->duration));
 			janus_refcount_decrease(&rec->ref);
 			json_array_append_new(list, ml);
 		}
@@ -967,6 +1168,7 @@ struct janus_plugin_result *janus_recordplay_handle_message(janus_plugin_session
 		response = json_object();
 		json_object_set_new(response, "recordplay", json_string("list"));
 		json_object_set_new(response, "list", list);
+		json_object_set_new(response, "total", json_integer(total));
 		goto plugin_response;
 	} else if(!strcasecmp(request_text, "configure")) {
 		JANUS_VALIDATE_JSON_OBJECT(root, configure_parameters,
@@ -994,7 +1196,9 @@ struct janus_plugin_result *janus_recordplay_handle_message(janus_plugin_session
 		json_object_set_new(response, "settings", settings); 
 		goto plugin_response;
 	} else if(!strcasecmp(request_text, "record") || !strcasecmp(request_text, "play")
-			|| !strcasecmp(request_text, "start") || !strcasecmp(request_text, "stop")) {
+			|| !strcasecmp(request_text, "start") || !strcasecmp(request_text, "stop")
+			|| !strcasecmp(request_text, "pause") || !strcasecmp(request_text, "resume")
+			|| !strcasecmp(request_text, "seek")) {
 		/* These messages are handled asynchronously */
 		janus_recordplay_message *msg = g_malloc(sizeof(janus_recordplay_message));
 		msg->handle = handle;
@@ -1058,16 +1262,20 @@ void janus_recordplay_setup_media(janus_plugin_session *handle) {
 	g_atomic_int_set(&session->hangingup, 0);
 	/* Take note of the fact that the session is now active */
 	session->active = TRUE;
-	if(!session->recorder) {
-		GError *error = NULL;
+	janus_recordplay_player *player = NULL;
+	janus_mutex_lock(&session->mutex);
+	if(!session->recorder && session->recording != NULL) {
+		player = session->player;
+		session->player = NULL;
+	}
+	janus_mutex_unlock(&session->mutex);
+	if(player != NULL) {
+		/* Hand the playout to the playout thread */
 		janus_refcount_increase(&session->ref);
-		g_thread_try_new("recordplay playout thread", &janus_recordplay_playout_thread, session, &error);
-		if(error != NULL) {
-			janus_refcount_decrease(&session->ref);
-			/* FIXME Should we notify this back to the user somehow? */
-			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Record&Play playout thread...\n", error->code, error->message ? error->message : "??");
-			gateway->close_pc(session->handle);
-		}
+		janus_refcount_increase(&session->recording->ref);
+		player->session = session;
+		player->recording = session->recording;
+		g_async_queue_push(playout_queue, player);
 	}
 	janus_refcount_decrease(&session->ref);
 }
@@ -1202,6 +1410,15 @@ static void janus_recordplay_hangup_media_internal(janus_plugin_session *handle)
 		return;
 	}
 	session->simulcast_ssrc = 0;
+	if(!session->recorder) {
+		/* If we were playing something, let the playout thread know */
+		janus_mutex_lock(&session->mutex);
+		janus_recordplay_player *player = session->player;
+		session->player = NULL;
+		janus_mutex_unlock(&session->mutex);
+		janus_recordplay_player_free(player);
+		g_async_queue_push(playout_queue, &playout_wakeup);
+	}
 
 	/* Send an event to the browser and tell it's over */
 	json_t *event = json_object();
@@ -1268,7 +1485,22 @@ static void janus_recordplay_hangup_media_internal(janus_plugin_session *handle)
 				/* Write to the file now */
 				fwrite(nfo, strlen(nfo), sizeof(char), file);
 				fclose(file);
-				g_atomic_int_set(&session->recording->completed, 1);
+				/* Add the recording to the catalogue */
+				janus_mutex_lock(&recordings_mutex);
+				janus_recordplay_recording *rec = session->recording;
+				g_atomic_int_set(&rec->completed, 1);
+				if(recordings != NULL && g_hash_table_lookup(recordings, &rec->id) == rec) {
+					struct stat st;
+					if(rec->nfo == NULL && stat(nfofile, &st) == 0) {
+						rec->nfo = g_strdup_printf("%"SCNu64".nfo", rec->id);
+						rec->nfo_mtime = st.st_mtime;
+						g_hash_table_insert(recordings_nfo, g_strdup(rec->nfo), janus_uint64_dup(rec->id));
+					}
+					if(rec->sorted == NULL)
+						rec->sorted = g_sequence_insert_sorted(recordings_sorted, rec, janus_recordplay_recording_compare, NULL);
+					catalogue_dirty = TRUE;
+				}
+				janus_mutex_unlock(&recordings_mutex);
 				/* Generate the offer */
 				if(janus_recordplay_generate_offer(session->recording) < 0) {
 					JANUS_LOG(LOG_WARN, "Could not generate offer for recording %"SCNu64"...\n", session->recording->id);
@@ -1501,7 +1733,7 @@ recdone:
 				JANUS_SDP_OA_VIDEO_DIRECTION, JANUS_SDP_RECVONLY,
 				JANUS_SDP_OA_DATA, FALSE,
 				JANUS_SDP_OA_DONE);
-			g_free(answer->s_name);
+			janus_sdp_arena_free_string(answer->arena, answer->s_name);
 			char s_name[100];
 			g_snprintf(s_name, sizeof(s_name), "Recording %"SCNu64, rec->id);
 			answer->s_name = g_strdup(s_name);
@@ -1551,6 +1783,7 @@ recdone:
 			guint64 id_value = 0;
 			janus_recordplay_recording *rec = NULL;
 			const char *warning = NULL;
+			gboolean has_audio = FALSE, has_video = FALSE;
 			if(sdp_update || do_restart) {
 				/* Renegotiation: make sure the user provided an offer, and send answer */
 				JANUS_LOG(LOG_VERB, "Request to perform an ICE restart on existing playout\n");
@@ -1585,8 +1818,12 @@ recdone:
 			/* Look for this recording */
 			janus_mutex_lock(&recordings_mutex);
 			rec = g_hash_table_lookup(recordings, &id_value);
-			if(rec != NULL)
+			if(rec != NULL) {
 				janus_refcount_increase(&rec->ref);
+				/* Offers are only prepared when someone wants to play a recording */
+				if(rec->offer == NULL && g_atomic_int_get(&rec->completed) && janus_recordplay_generate_offer(rec) < 0)
+					JANUS_LOG(LOG_WARN, "Could not generate offer for recording %"SCNu64"...\n", rec->id);
+			}
 			janus_mutex_unlock(&recordings_mutex);
 			if(rec == NULL || rec->offer == NULL || g_atomic_int_get(&rec->destroyed)) {
 				if(rec != NULL)
@@ -1596,26 +1833,23 @@ recdone:
 				g_snprintf(error_cause, 512, "No such recording");
 				goto error;
 			}
-			/* Access the frames */
-			if(rec->arc_file) {
-				session->aframes = janus_recordplay_get_frames(recordings_path, rec->arc_file);
-				if(session->aframes == NULL) {
-					JANUS_LOG(LOG_WARN, "Error opening audio recording, trying to go on anyway\n");
-					warning = "Broken audio file, playing video only";
-				}
-			}
-			if(rec->vrc_file) {
-				session->vframes = janus_recordplay_get_frames(recordings_path, rec->vrc_file);
-				if(session->vframes == NULL) {
-					JANUS_LOG(LOG_WARN, "Error opening video recording, trying to go on anyway\n");
-					warning = "Broken video file, playing audio only";
-				}
-			}
-			if(session->aframes == NULL && session->vframes == NULL) {
+			/* Open the files: packets will only be read when sending them */
+			janus_recordplay_player *player = janus_recordplay_player_create(rec, &warning);
+			if(player == NULL) {
+				janus_refcount_decrease(&rec->ref);
 				error_code = JANUS_RECORDPLAY_ERROR_INVALID_RECORDING;
 				g_snprintf(error_cause, 512, "Error opening recording files");
 				goto error;
 			}
+			has_audio = (player->audio != NULL);
+			has_video = (player->video != NULL);
+			janus_mutex_lock(&session->mutex);
+			janus_recordplay_player *old_player = session->player;
+			session->player = player;
+			janus_mutex_unlock(&session->mutex);
+			janus_recordplay_player_free(old_player);
+			g_atomic_int_set(&session->paused, 0);
+			g_atomic_int_set(&session->seek, -1);
 			session->recording = rec;
 			session->recorder = FALSE;
 			rec->viewers = g_list_append(rec->viewers, session);
@@ -1634,12 +1868,12 @@ playdone:
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string("playout"));
 				json_object_set_new(info, "id", json_integer(id_value));
-				json_object_set_new(info, "audio", session->aframes ? json_true() : json_false());
-				json_object_set_new(info, "video", session->vframes ? json_true() : json_false());
+				json_object_set_new(info, "audio", has_audio ? json_true() : json_false());
+				json_object_set_new(info, "video", has_video ? json_true() : json_false());
 				gateway->notify_event(&janus_recordplay_plugin, session->handle, info);
 			}
 		} else if(!strcasecmp(request_text, "start")) {
-			if(!session->aframes && !session->vframes) {
+			if(session->recorder || session->recording == NULL) {
 				JANUS_LOG(LOG_ERR, "Not a playout session, can't start\n");
 				error_code = JANUS_RECORDPLAY_ERROR_INVALID_STATE;
 				g_snprintf(error_cause, 512, "Not a playout session, can't start");
@@ -1662,6 +1896,40 @@ playdone:
 				json_object_set_new(info, "id", json_integer(session->recording->id));
 				gateway->notify_event(&janus_recordplay_plugin, session->handle, info);
 			}
+		} else if(!strcasecmp(request_text, "pause") || !strcasecmp(request_text, "resume")) {
+			gboolean pause = !strcasecmp(request_text, "pause");
+			if(session->recorder || session->recording == NULL) {
+				JANUS_LOG(LOG_ERR, "Not a playout session, can't %s\n", request_text);
+				error_code = JANUS_RECORDPLAY_ERROR_INVALID_STATE;
+				g_snprintf(error_cause, 512, "Not a playout session, can't %s", request_text);
+				goto error;
+			}
+			g_atomic_int_set(&session->paused, pause);
+			g_async_queue_push(playout_queue, &playout_wakeup);
+			/* Done! */
+			result = json_object();
+			json_object_set_new(result, "status", json_string(pause ? "paused" : "playing"));
+		} else if(!strcasecmp(request_text, "seek")) {
+			if(session->recorder || session->recording == NULL) {
+				JANUS_LOG(LOG_ERR, "Not a playout session, can't seek\n");
+				error_code = JANUS_RECORDPLAY_ERROR_INVALID_STATE;
+				g_snprintf(error_cause, 512, "Not a playout session, can't seek");
+				goto error;
+			}
+			JANUS_VALIDATE_JSON_OBJECT(root, seek_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_RECORDPLAY_ERROR_MISSING_ELEMENT, JANUS_RECORDPLAY_ERROR_INVALID_ELEMENT);
+			if(error_code != 0)
+				goto error;
+			json_int_t position = json_integer_value(json_object_get(root, "position"));
+			if(position > G_MAXINT)
+				position = G_MAXINT;
+			g_atomic_int_set(&session->seek, (gint)position);
+			g_async_queue_push(playout_queue, &playout_wakeup);
+			/* Done! */
+			result = json_object();
+			json_object_set_new(result, "status", json_string("seeking"));
+			json_object_set_new(result, "position", json_integer(position));
 		} else if(!strcasecmp(request_text, "stop")) {
 			/* Done! */
 			result = json_object();
@@ -1730,150 +1998,424 @@ error:
 	return NULL;
 }
 
+/* Helper to parse a .nfo file and create the recording it describes */
+static janus_recordplay_recording *janus_recordplay_recording_from_nfo(const char *nfofile) {
+	char recpath[1024];
+	g_snprintf(recpath, 1024, "%s/%s", recordings_path, nfofile);
+	janus_config *nfo = janus_config_parse(recpath);
+	if(nfo == NULL) {
+		JANUS_LOG(LOG_ERR, "Invalid recording '%s'...\n", nfofile);
+		return NULL;
+	}
+	GList *cl = janus_config_get_categories(nfo);
+	if(cl == NULL || cl->data == NULL) {
+		JANUS_LOG(LOG_WARN, "No recording info in '%s', skipping...\n", nfofile);
+		janus_config_destroy(nfo);
+		return NULL;
+	}
+	janus_config_category *cat = (janus_config_category *)cl->data;
+	guint64 id = g_ascii_strtoull(cat->name, NULL, 0);
+	if(id == 0) {
+		JANUS_LOG(LOG_WARN, "Invalid ID, skipping...\n");
+		janus_config_destroy(nfo);
+		return NULL;
+	}
+	janus_config_item *name = janus_config_get_item(cat, "name");
+	janus_config_item *date = janus_config_get_item(cat, "date");
+	janus_config_item *audio = janus_config_get_item(cat, "audio");
+	janus_config_item *video = janus_config_get_item(cat, "video");
+	if(!name || !name->value || strlen(name->value) == 0 || !date || !date->value || strlen(date->value) == 0) {
+		JANUS_LOG(LOG_WARN, "Invalid info for recording %"SCNu64", skipping...\n", id);
+		janus_config_destroy(nfo);
+		return NULL;
+	}
+	if((!audio || !audio->value) && (!video || !video->value)) {
+		JANUS_LOG(LOG_WARN, "No audio and no video in recording %"SCNu64", skipping...\n", id);
+		janus_config_destroy(nfo);
+		return NULL;
+	}
+	janus_recordplay_recording *rec = g_malloc0(sizeof(janus_recordplay_recording));
+	rec->id = id;
+	rec->name = g_strdup(name->value);
+	rec->date = g_strdup(date->value);
+	if(audio && audio->value) {
+		rec->arc_file = g_strdup(audio->value);
+		char *ext = strstr(rec->arc_file, ".mjr");
+		if(ext != NULL)
+			*ext = '\0';
+		/* Check which codec is in this recording */
+		rec->acodec = janus_recordplay_parse_codec(recordings_path, rec->arc_file);
+	}
+	if(video && video->value) {
+		rec->vrc_file = g_strdup(video->value);
+		char *ext = strstr(rec->vrc_file, ".mjr");
+		if(ext != NULL)
+			*ext = '\0';
+		/* Check which codec is in this recording */
+		rec->vcodec = janus_recordplay_parse_codec(recordings_path, rec->vrc_file);
+	}
+	janus_config_destroy(nfo);
+	rec->nfo = g_strdup(nfofile);
+	janus_recordplay_recording_init(rec);
+	return rec;
+}
+
+/* Add a recording to the catalogue (recordings_mutex must be locked) */
+static void janus_recordplay_recording_add(janus_recordplay_recording *rec) {
+	g_hash_table_insert(recordings, janus_uint64_dup(rec->id), rec);
+	if(rec->nfo != NULL)
+		g_hash_table_insert(recordings_nfo, g_strdup(rec->nfo), janus_uint64_dup(rec->id));
+	if(g_atomic_int_get(&rec->completed) && rec->sorted == NULL)
+		rec->sorted = g_sequence_insert_sorted(recordings_sorted, rec, janus_recordplay_recording_compare, NULL);
+	catalogue_dirty = TRUE;
+}
+
+/* Remove a recording from the catalogue (recordings_mutex must be locked) */
+static void janus_recordplay_recording_remove(guint64 id) {
+	janus_recordplay_recording *rec = g_hash_table_lookup(recordings, &id);
+	if(rec == NULL)
+		return;
+	JANUS_LOG(LOG_VERB, "Recording %"SCNu64" is not available anymore, removing...\n", id);
+	if(rec->nfo != NULL)
+		g_hash_table_remove(recordings_nfo, rec->nfo);
+	if(rec->sorted != NULL)
+		g_sequence_remove(rec->sorted);
+	rec->sorted = NULL;
+	g_hash_table_remove(recordings, &id);
+	catalogue_dirty = TRUE;
+}
+
+/* Import a .nfo file, unless we know it already and it didn't change
+ * since then (recordings_mutex must be locked) */
+static void janus_recordplay_import_nfo(const char *nfofile, time_t mtime) {
+	guint64 *known = g_hash_table_lookup(recordings_nfo, nfofile);
+	if(known != NULL) {
+		janus_recordplay_recording *rec = g_hash_table_lookup(recordings, known);
+		if(rec != NULL && rec->nfo_mtime == mtime)
+			return;
+		/* The file changed, load it again */
+		janus_recordplay_recording_remove(*known);
+	}
+	JANUS_LOG(LOG_VERB, "Importing recording '%s'...\n", nfofile);
+	janus_recordplay_recording *rec = janus_recordplay_recording_from_nfo(nfofile);
+	if(rec == NULL)
+		return;
+	rec->nfo_mtime = mtime;
+	janus_recordplay_recording *existing = g_hash_table_lookup(recordings, &rec->id);
+	if(existing != NULL) {
+		/* Most likely one of ours, that we just wrote the .nfo file for */
+		JANUS_LOG(LOG_VERB, "Skipping recording with ID %"SCNu64", it's already in the list...\n", rec->id);
+		if(existing->nfo == NULL) {
+			existing->nfo = g_strdup(nfofile);
+			existing->nfo_mtime = mtime;
+			g_hash_table_insert(recordings_nfo, g_strdup(nfofile), janus_uint64_dup(existing->id));
+			catalogue_dirty = TRUE;
+		}
+		janus_refcount_decrease(&rec->ref);
+		return;
+	}
+	/* Add to the list of recordings */
+	janus_recordplay_recording_add(rec);
+}
+
+/* Scan the folder for changes: only new or modified .nfo files are parsed,
+ * and recordings whose .nfo file went away are removed */
 void janus_recordplay_update_recordings_list(void) {
 	if(recordings_path == NULL)
 		return;
 	JANUS_LOG(LOG_VERB, "Updating recordings list in %s\n", recordings_path);
-	janus_mutex_lock(&recordings_mutex);
-	/* First of all, let's keep track of which recordings are currently available */
-	GList *old_recordings = NULL;
-	if(recordings != NULL && g_hash_table_size(recordings) > 0) {
-		GHashTableIter iter;
-		gpointer value;
-		g_hash_table_iter_init(&iter, recordings);
-		while(g_hash_table_iter_next(&iter, NULL, &value)) {
-			janus_recordplay_recording *rec = value;
-			if(rec) {
-				janus_refcount_increase(&rec->ref);
-				old_recordings = g_list_append(old_recordings, &rec->id);
-			}
-		}
-	}
 	/* Open dir */
 	DIR *dir = opendir(recordings_path);
 	if(!dir) {
 		JANUS_LOG(LOG_ERR, "Couldn't open folder...\n");
-		g_list_free(old_recordings);
-		janus_mutex_unlock(&recordings_mutex);
 		return;
 	}
+	janus_mutex_lock(&recordings_mutex);
+	GHashTable *found = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, NULL);
 	struct dirent *recent = NULL;
 	char recpath[1024];
+	struct stat st;
 	while((recent = readdir(dir))) {
 		int len = strlen(recent->d_name);
 		if(len < 4)
 			continue;
 		if(strcasecmp(recent->d_name+len-4, ".nfo"))
 			continue;
-		JANUS_LOG(LOG_VERB, "Importing recording '%s'...\n", recent->d_name);
-		memset(recpath, 0, 1024);
 		g_snprintf(recpath, 1024, "%s/%s", recordings_path, recent->d_name);
-		janus_config *nfo = janus_config_parse(recpath);
-		if(nfo == NULL) { 
-			JANUS_LOG(LOG_ERR, "Invalid recording '%s'...\n", recent->d_name);
+		if(stat(recpath, &st) < 0)
 			continue;
-		}
-		GList *cl = janus_config_get_categories(nfo);
-		if(cl == NULL || cl->data == NULL) {
-			JANUS_LOG(LOG_WARN, "No recording info in '%s', skipping...\n", recent->d_name);
-			janus_config_destroy(nfo);
+		g_hash_table_add(found, g_strdup(recent->d_name));
+		janus_recordplay_import_nfo(recent->d_name, st.st_mtime);
+	}
+	closedir(dir);
+	/* Now let's check if any of the previously existing recordings was removed */
+	GList *removed = NULL;
+	GHashTableIter iter;
+	gpointer key, value;
+	g_hash_table_iter_init(&iter, recordings_nfo);
+	while(g_hash_table_iter_next(&iter, &key, &value)) {
+		if(!g_hash_table_contains(found, key))
+			removed = g_list_prepend(removed, janus_uint64_dup(*(guint64 *)value));
+	}
+	GList *l = removed;
+	while(l) {
+		janus_recordplay_recording_remove(*(guint64 *)l->data);
+		l = l->next;
+	}
+	g_list_free_full(removed, (GDestroyNotify)g_free);
+	g_hash_table_destroy(found);
+	JANUS_LOG(LOG_VERB, "%u recordings available\n", g_hash_table_size(recordings));
+	janus_mutex_unlock(&recordings_mutex);
+}
+
+/* The catalogue is a text file with a line per recording, with tab separated
+ * (and escaped) fields: it allows us to know about all the recordings at
+ * startup without parsing all .nfo files and reading the headers of all
+ * .mjr files, as we'll only need to do that for the ones that changed */
+#define JANUS_RECORDPLAY_CATALOGUE_HEADER	"JANUSRPC1"
+
+static void janus_recordplay_catalogue_load(void) {
+	if(catalogue_path == NULL)
+		return;
+	gchar *contents = NULL;
+	if(!g_file_get_contents(catalogue_path, &contents, NULL, NULL)) {
+		JANUS_LOG(LOG_VERB, "No catalogue in %s yet\n", catalogue_path);
+		return;
+	}
+	gchar **lines = g_strsplit(contents, "\n", -1);
+	g_free(contents);
+	if(lines[0] == NULL || strcmp(lines[0], JANUS_RECORDPLAY_CATALOGUE_HEADER)) {
+		JANUS_LOG(LOG_WARN, "Invalid catalogue %s, ignoring it\n", catalogue_path);
+		g_strfreev(lines);
+		return;
+	}
+	janus_mutex_lock(&recordings_mutex);
+	int i = 0, loaded = 0;
+	for(i=1; lines[i] != NULL; i++) {
+		gchar **fields = g_strsplit(lines[i], "\t", -1);
+		if(g_strv_length(fields) != 10) {
+			g_strfreev(fields);
 			continue;
 		}
-		janus_config_category *cat = (janus_config_category *)cl->data;
-		guint64 id = g_ascii_strtoull(cat->name, NULL, 0);
-		if(id == 0) {
-			JANUS_LOG(LOG_WARN, "Invalid ID, skipping...\n");
-			janus_config_destroy(nfo);
+		guint64 id = g_ascii_strtoull(fields[0], NULL, 10);
+		if(id == 0 || g_hash_table_lookup(recordings, &id) != NULL) {
+			g_strfreev(fields);
 			continue;
 		}
-		janus_recordplay_recording *rec = g_hash_table_lookup(recordings, &id);
-		if(rec != NULL) {
-			JANUS_LOG(LOG_VERB, "Skipping recording with ID %"SCNu64", it's already in the list...\n", id);
-			janus_config_destroy(nfo);
-			/* Mark that we updated this recording */
-			old_recordings = g_list_remove(old_recordings, &rec->id);
-			janus_refcount_decrease(&rec->ref);
-			continue;
+		janus_recordplay_recording *rec = g_malloc0(sizeof(janus_recordplay_recording));
+		rec->id = id;
+		rec->nfo_mtime = g_ascii_strtoll(fields[1], NULL, 10);
+		rec->duration = g_ascii_strtoll(fields[2], NULL, 10);
+		rec->nfo = g_strcompress(fields[3]);
+		rec->name = g_strcompress(fields[4]);
+		rec->date = g_strcompress(fields[5]);
+		if(strlen(fields[6]) > 0) {
+			rec->arc_file = g_strcompress(fields[6]);
+			rec->acodec = janus_sdp_match_preferred_codec(JANUS_SDP_AUDIO, fields[7]);
 		}
-		janus_config_item *name = janus_config_get_item(cat, "name");
-		janus_config_item *date = janus_config_get_item(cat, "date");
-		janus_config_item *audio = janus_config_get_item(cat, "audio");
-		janus_config_item *video = janus_config_get_item(cat, "video");
-		if(!name || !name->value || strlen(name->value) == 0 || !date || !date->value || strlen(date->value) == 0) {
-			JANUS_LOG(LOG_WARN, "Invalid info for recording %"SCNu64", skipping...\n", id);
-			janus_config_destroy(nfo);
-			continue;
+		if(strlen(fields[8]) > 0) {
+			rec->vrc_file = g_strcompress(fields[8]);
+			rec->vcodec = janus_sdp_match_preferred_codec(JANUS_SDP_VIDEO, fields[9]);
 		}
-		if((!audio || !audio->value) && (!video || !video->value)) {
-			JANUS_LOG(LOG_WARN, "No audio and no video in recording %"SCNu64", skipping...\n", id);
-			janus_config_destroy(nfo);
+		g_strfreev(fields);
+		janus_recordplay_recording_init(rec);
+		janus_recordplay_recording_add(rec);
+		loaded++;
+	}
+	g_strfreev(lines);
+	catalogue_dirty = FALSE;
+	janus_mutex_unlock(&recordings_mutex);
+	JANUS_LOG(LOG_INFO, "Loaded %d recordings from catalogue %s\n", loaded, catalogue_path);
+}
+
+static void janus_recordplay_catalogue_save(void) {
+	if(catalogue_path == NULL)
+		return;
+	/* Prepare the contents first, and only write them when we're done */
+	GString *contents = g_string_new(JANUS_RECORDPLAY_CATALOGUE_HEADER "\n");
+	janus_mutex_lock(&recordings_mutex);
+	if(!catalogue_dirty) {
+		janus_mutex_unlock(&recordings_mutex);
+		g_string_free(contents, TRUE);
+		return;
+	}
+	catalogue_dirty = FALSE;
+	GSequenceIter *iter = g_sequence_get_begin_iter(recordings_sorted);
+	while(!g_sequence_iter_is_end(iter)) {
+		janus_recordplay_recording *rec = g_sequence_get(iter);
+		iter = g_sequence_iter_next(iter);
+		/* Recordings without a .nfo file can't be found again when restarting */
+		if(rec->nfo == NULL)
 			continue;
+		gchar *nfo = g_strescape(rec->nfo, NULL), *name = g_strescape(rec->name, NULL), *date = g_strescape(rec->date, NULL),
+			*arc = g_strescape(rec->arc_file ? rec->arc_file : "", NULL), *vrc = g_strescape(rec->vrc_file ? rec->vrc_file : "", NULL);
+		g_string_append_printf(contents, "%"SCNu64"\t%"SCNi64"\t%"SCNi64"\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n",
+			rec->id, (gint64)rec->nfo_mtime, rec->duration, nfo, name, date,
+			arc, rec->acodec ? rec->acodec : "", vrc, rec->vcodec ? rec->vcodec : "");
+		g_free(nfo);
+		g_free(name);
+		g_free(date);
+		g_free(arc);
+		g_free(vrc);
+	}
+	janus_mutex_unlock(&recordings_mutex);
+	GError *error = NULL;
+	if(!g_file_set_contents(catalogue_path, contents->str, contents->len, &error)) {
+		JANUS_LOG(LOG_ERR, "Error saving catalogue %s: %s\n", catalogue_path, error && error->message ? error->message : "??");
+		g_clear_error(&error);
+	}
+	g_string_free(contents, TRUE);
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+/* Helper to process the inotify events about the recordings folder */
+static void janus_recordplay_watcher_read(int fd) {
+	char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	int len = 0;
+	while((len = read(fd, buffer, sizeof(buffer))) > 0) {
+		char *ptr = buffer;
+		while(ptr < buffer + len) {
+			struct inotify_event *event = (struct inotify_event *)ptr;
+			ptr += sizeof(struct inotify_event) + event->len;
+			if(event->mask & IN_Q_OVERFLOW) {
+				/* We missed something, check everything again */
+				JANUS_LOG(LOG_WARN, "Too many changes in %s, scanning the folder again\n", recordings_path);
+				janus_recordplay_update_recordings_list();
+				continue;
+			}
+			int nlen = event->len > 0 ? strlen(event->name) : 0;
+			if(nlen < 4 || strcasecmp(event->name+nlen-4, ".nfo"))
+				continue;
+			janus_mutex_lock(&recordings_mutex);
+			if(event->mask & (IN_MOVED_FROM | IN_DELETE)) {
+				guint64 *id = g_hash_table_lookup(recordings_nfo, event->name);
+				if(id != NULL)
+					janus_recordplay_recording_remove(*id);
+			} else {
+				char recpath[1024];
+				struct stat st;
+				g_snprintf(recpath, 1024, "%s/%s", recordings_path, event->name);
+				if(stat(recpath, &st) == 0)
+					janus_recordplay_import_nfo(event->name, st.st_mtime);
+			}
+			janus_mutex_unlock(&recordings_mutex);
 		}
-		rec = g_malloc0(sizeof(janus_recordplay_recording));
-		rec->id = id;
-		rec->name = g_strdup(name->value);
-		rec->date = g_strdup(date->value);
-		if(audio && audio->value) {
-			rec->arc_file = g_strdup(audio->value);
-			char *ext = strstr(rec->arc_file, ".mjr");
-			if(ext != NULL)
-				*ext = '\0';
-			/* Check which codec is in this recording */
-			rec->acodec = janus_recordplay_parse_codec(recordings_path, rec->arc_file);
+	}
+}
+#endif
+
+/* Thread keeping the catalogue up to date: we get notified when .nfo files
+ * are added or removed, if inotify is available, and we periodically save
+ * the catalogue to disk when there are changes */
+static void *janus_recordplay_watcher_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining Record&Play watcher thread\n");
+	int fd = -1;
+#ifdef HAVE_SYS_INOTIFY_H
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(fd < 0 || inotify_add_watch(fd, recordings_path, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0) {
+		JANUS_LOG(LOG_WARN, "Couldn't watch %s for changes (%d), use 'update' requests to refresh the list\n", recordings_path, errno);
+		if(fd > -1)
+			close(fd);
+		fd = -1;
+	}
+	struct pollfd pfd;
+#endif
+	gint64 last_save = janus_get_monotonic_time();
+	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
+#ifdef HAVE_SYS_INOTIFY_H
+		if(fd > -1) {
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			if(poll(&pfd, 1, 500) > 0 && (pfd.revents & POLLIN))
+				janus_recordplay_watcher_read(fd);
+		} else
+#endif
+		g_usleep(500000);
+		gint64 now = janus_get_monotonic_time();
+		if(now - last_save >= 5*G_USEC_PER_SEC) {
+			last_save = now;
+			janus_recordplay_catalogue_save();
 		}
-		if(video && video->value) {
-			rec->vrc_file = g_strdup(video->value);
-			char *ext = strstr(rec->vrc_file, ".mjr");
-			if(ext != NULL)
-				*ext = '\0';
-			/* Check which codec is in this recording */
-			rec->vcodec = janus_recordplay_parse_codec(recordings_path, rec->vrc_file);
+	}
+	if(fd > -1)
+		close(fd);
+	JANUS_LOG(LOG_VERB, "Leaving Record&Play watcher thread\n");
+	return NULL;
+}
+
+/* Read the next RTP packet of a track (returns FALSE when there's nothing left to read) */
+static gboolean janus_recordplay_track_read(janus_recordplay_track *track) {
+	char header[8];
+	uint16_t len = 0;
+	track->len = 0;
+	while(track->offset + 10 <= track->size) {
+		/* Read frame header */
+		fseek(track->file, track->offset, SEEK_SET);
+		if(fread(header, sizeof(char), 8, track->file) != 8 || header[0] != 'M' ||
+				fread(&len, sizeof(uint16_t), 1, track->file) != 1) {
+			JANUS_LOG(LOG_WARN, "Invalid header at offset %ld, stopping here...\n", track->offset);
+			return FALSE;
 		}
-		rec->audio_pt = AUDIO_PT;
-		if(rec->acodec) {
-			/* Some audio codecs have a fixed payload type that we can't mess with */
-			if(!strcasecmp(rec->acodec, "pcmu"))
-				rec->audio_pt = 0;
-			else if(!strcasecmp(rec->acodec, "pcma"))
-				rec->audio_pt = 8;
-			else if(!strcasecmp(rec->acodec, "g722"))
-				rec->audio_pt = 9;
+		len = ntohs(len);
+		track->offset += 10;
+		if(header[1] == 'J' || len < 12 || len > sizeof(track->buffer)) {
+			/* Info header, or not RTP, skip */
+			track->offset += len;
+			continue;
 		}
-		rec->video_pt = VIDEO_PT;
-		rec->viewers = NULL;
-		if(janus_recordplay_generate_offer(rec) < 0) {
-			JANUS_LOG(LOG_WARN, "Could not generate offer for recording %"SCNu64"...\n", rec->id);
+		if(fread(track->buffer, sizeof(char), len, track->file) != len) {
+			JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%"SCNu16"), stopping here...\n", len);
+			return FALSE;
 		}
-		g_atomic_int_set(&rec->destroyed, 0);
-		g_atomic_int_set(&rec->completed, 1);
-		janus_refcount_init(&rec->ref, janus_recordplay_recording_free);
-		janus_mutex_init(&rec->mutex);
-		
-		janus_config_destroy(nfo);
-
-		/* Add to the list of recordings */
-		g_hash_table_insert(recordings, janus_uint64_dup(rec->id), rec);
-	}
-	closedir(dir);
-	/* Now let's check if any of the previously existing recordings was removed */
-	if(old_recordings != NULL) {
-		while(old_recordings != NULL) {
-			guint64 id = *((guint64 *)old_recordings->data);
-			JANUS_LOG(LOG_VERB, "Recording %"SCNu64" is not available anymore, removing...\n", id);
-			janus_recordplay_recording *old_rec = g_hash_table_lookup(recordings, &id);
-			if(old_rec != NULL) {
-				/* Remove it */
-				g_hash_table_remove(recordings, &id);
-				janus_refcount_decrease(&old_rec->ref);
-			}
-			old_recordings = old_recordings->next;
+		track->offset += len;
+		track->len = len;
+		/* Take care of timestamp resets */
+		janus_rtp_header *rtp = (janus_rtp_header *)track->buffer;
+		guint32 ts = ntohl(rtp->timestamp);
+		if(ts < track->last_ts && track->last_ts - ts > G_MAXINT32) {
+			track->ts_cycles++;
+			track->last_ts = ts;
+		} else if(ts > track->last_ts && ts - track->last_ts > G_MAXINT32 && track->ts_cycles > 0) {
+			/* Out of order packet from before the reset */
+			track->ts = ((track->ts_cycles-1) << 32) + ts;
+			return TRUE;
+		} else {
+			track->last_ts = ts;
 		}
-		g_list_free(old_recordings);
+		track->ts = (track->ts_cycles << 32) + ts;
+		return TRUE;
 	}
-	janus_mutex_unlock(&recordings_mutex);
+	return FALSE;
 }
 
-janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, const char *filename) {
+/* Helper to check if the next packet of a video track is (the start of) a keyframe */
+static gboolean janus_recordplay_track_is_keyframe(janus_recordplay_track *track) {
+	if(!track->video || track->codec == NULL || track->len == 0)
+		return FALSE;
+	int plen = 0;
+	char *payload = janus_rtp_payload(track->buffer, track->len, &plen);
+	if(payload == NULL)
+		return FALSE;
+	if(!strcasecmp(track->codec, "vp8"))
+		return janus_vp8_is_keyframe(payload, plen);
+	else if(!strcasecmp(track->codec, "vp9"))
+		return janus_vp9_is_keyframe(payload, plen);
+	else if(!strcasecmp(track->codec, "h264"))
+		return janus_h264_is_keyframe(payload, plen);
+	return FALSE;
+}
+
+static void janus_recordplay_track_close(janus_recordplay_track *track) {
+	if(track == NULL)
+		return;
+	if(track->file)
+		fclose(track->file);
+	janus_recorder_index_free(track->index);
+	g_free(track);
+}
+
+static janus_recordplay_track *janus_recordplay_track_open(const char *dir, const char *filename, gboolean video, int pt, const char *codec) {
 	if(!dir || !filename)
 		return NULL;
 	/* Open the file */
@@ -1887,556 +2429,242 @@ janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, cons
 		JANUS_LOG(LOG_ERR, "Could not open file %s\n", source);
 		return NULL;
 	}
+	janus_recordplay_track *track = g_malloc0(sizeof(janus_recordplay_track));
+	track->file = file;
 	fseek(file, 0L, SEEK_END);
-	long fsize = ftell(file);
+	track->size = ftell(file);
 	fseek(file, 0L, SEEK_SET);
-	JANUS_LOG(LOG_VERB, "File is %zu bytes\n", fsize);
+	JANUS_LOG(LOG_VERB, "File is %ld bytes\n", track->size);
+	track->video = video;
+	track->pt = pt;
+	track->khz = video ? 90 : ((pt == 0 || pt == 8 || pt == 9) ? 8 : 48);
+	track->codec = codec;
+	/* We only read packets when we need them: the index, if available, is what we use to seek */
+	track->index = janus_recorder_index_load(source, track->size);
+	JANUS_LOG(LOG_VERB, "Recording %s %s a seek index\n", source, track->index ? "has" : "doesn't have");
+	if(!janus_recordplay_track_read(track)) {
+		JANUS_LOG(LOG_ERR, "No RTP packets in %s\n", source);
+		janus_recordplay_track_close(track);
+		return NULL;
+	}
+	track->first_ts = track->ts;
+	return track;
+}
 
-	/* Pre-parse */
-	JANUS_LOG(LOG_VERB, "Pre-parsing file %s to generate ordered index...\n", source);
-	gboolean parsed_header = FALSE;
-	int bytes = 0;
-	long offset = 0;
-	uint16_t len = 0, count = 0;
-	uint32_t first_ts = 0, last_ts = 0, reset = 0;	/* To handle whether there's a timestamp reset in the recording */
-	char prebuffer[1500];
-	memset(prebuffer, 0, 1500);
-	/* Let's look for timestamp resets first */
-	while(offset < fsize) {
-		/* Read frame header */
-		fseek(file, offset, SEEK_SET);
-		bytes = fread(prebuffer, sizeof(char), 8, file);
-		if(bytes != 8 || prebuffer[0] != 'M') {
-			JANUS_LOG(LOG_ERR, "Invalid header...\n");
-			fclose(file);
-			return NULL;
-		}
-		if(prebuffer[1] == 'E') {
-			/* Either the old .mjr format header ('MEETECHO' header followed by 'audio' or 'video'), or a frame */
-			offset += 8;
-			bytes = fread(&len, sizeof(uint16_t), 1, file);
-			len = ntohs(len);
-			offset += 2;
-			if(len == 5 && !parsed_header) {
-				/* This is the main header */
-				parsed_header = TRUE;
-				JANUS_LOG(LOG_VERB, "Old .mjr header format\n");
-				bytes = fread(prebuffer, sizeof(char), 5, file);
-				if(prebuffer[0] == 'v') {
-					JANUS_LOG(LOG_INFO, "This is an old video recording, assuming VP8\n");
-				} else if(prebuffer[0] == 'a') {
-					JANUS_LOG(LOG_INFO, "This is an old audio recording, assuming Opus\n");
-				} else {
-					JANUS_LOG(LOG_WARN, "Unsupported recording media type...\n");
-					fclose(file);
-					return NULL;
-				}
-				offset += len;
-				continue;
-			} else if(len < 12) {
-				/* Not RTP, skip */
-				JANUS_LOG(LOG_VERB, "Skipping packet (not RTP?)\n");
-				offset += len;
-				continue;
-			}
-		} else if(prebuffer[1] == 'J') {
-			/* New .mjr format, the header may contain useful info */
-			offset += 8;
-			bytes = fread(&len, sizeof(uint16_t), 1, file);
-			len = ntohs(len);
-			offset += 2;
-			if(len > 0 && !parsed_header) {
-				/* This is the info header */
-				JANUS_LOG(LOG_VERB, "New .mjr header format\n");
-				bytes = fread(prebuffer, sizeof(char), len, file);
-				if(bytes < 0) {
-					JANUS_LOG(LOG_ERR, "Error reading from file... %s\n", strerror(errno));
-					fclose(file);
-					return NULL;
-				}
-				parsed_header = TRUE;
-				prebuffer[len] = '\0';
-				json_error_t error;
-				json_t *info = json_loads(prebuffer, 0, &error);
-				if(!info) {
-					JANUS_LOG(LOG_ERR, "JSON error: on line %d: %s\n", error.line, error.text);
-					JANUS_LOG(LOG_WARN, "Error parsing info header...\n");
-					fclose(file);
-					return NULL;
-				}
-				/* Is it audio or video? */
-				json_t *type = json_object_get(info, "t");
-				if(!type || !json_is_string(type)) {
-					JANUS_LOG(LOG_WARN, "Missing/invalid recording type in info header...\n");
-					json_decref(info);
-					fclose(file);
-					return NULL;
-				}
-				const char *t = json_string_value(type);
-				int video = 0;
-				gint64 c_time = 0, w_time = 0;
-				if(!strcasecmp(t, "v")) {
-					video = 1;
-				} else if(!strcasecmp(t, "a")) {
-					video = 0;
-				} else {
-					JANUS_LOG(LOG_WARN, "Unsupported recording type '%s' in info header...\n", t);
-					json_decref(info);
-					fclose(file);
-					return NULL;
-				}
-				/* What codec was used? */
-				json_t *codec = json_object_get(info, "c");
-				if(!codec || !json_is_string(codec)) {
-					JANUS_LOG(LOG_WARN, "Missing recording codec in info header...\n");
-					json_decref(info);
-					fclose(file);
-					return NULL;
-				}
-				const char *c = json_string_value(codec);
-				/* When was the file created? */
-				json_t *created = json_object_get(info, "s");
-				if(!created || !json_is_integer(created)) {
-					JANUS_LOG(LOG_WARN, "Missing recording created time in info header...\n");
-					json_decref(info);
-					fclose(file);
-					return NULL;
-				}
-				c_time = json_integer_value(created);
-				/* When was the first frame written? */
-				json_t *written = json_object_get(info, "u");
-				if(!written || !json_is_integer(written)) {
-					JANUS_LOG(LOG_WARN, "Missing recording written time in info header...\n");
-					json_decref(info);
-					fclose(file);
-					return NULL;
-				}
-				w_time = json_integer_value(created);
-				/* Summary */
-				JANUS_LOG(LOG_VERB, "This is %s recording:\n", video ? "a video" : "an audio");
-				JANUS_LOG(LOG_VERB, "  -- Codec:   %s\n", c);
-				JANUS_LOG(LOG_VERB, "  -- Created: %"SCNi64"\n", c_time);
-				JANUS_LOG(LOG_VERB, "  -- Written: %"SCNi64"\n", w_time);
-				json_decref(info);
-			}
-		} else {
-			JANUS_LOG(LOG_ERR, "Invalid header...\n");
-			fclose(file);
-			return NULL;
-		}
-		/* Only read RTP header */
-		bytes = fread(prebuffer, sizeof(char), 16, file);
-		janus_rtp_header *rtp = (janus_rtp_header *)prebuffer;
-		if(last_ts == 0) {
-			first_ts = ntohl(rtp->timestamp);
-			if(first_ts > 1000*1000)	/* Just used to check whether a packet is pre- or post-reset */
-				first_ts -= 1000*1000;
-		} else {
-			if(ntohl(rtp->timestamp) < last_ts) {
-				/* The new timestamp is smaller than the next one, is it a timestamp reset or simply out of order? */
-				if(last_ts-ntohl(rtp->timestamp) > 2*1000*1000*1000) {
-					reset = ntohl(rtp->timestamp);
-					JANUS_LOG(LOG_VERB, "Timestamp reset: %"SCNu32"\n", reset);
-				}
-			} else if(ntohl(rtp->timestamp) < reset) {
-				JANUS_LOG(LOG_VERB, "Updating timestamp reset: %"SCNu32" (was %"SCNu32")\n", ntohl(rtp->timestamp), reset);
-				reset = ntohl(rtp->timestamp);
-			}
-		}
-		last_ts = ntohl(rtp->timestamp);
-		/* Skip data for now */
-		offset += len;
+/* When the next packet of a track must be sent (G_MAXINT64 if there's none) */
+static gint64 janus_recordplay_track_deadline(janus_recordplay_track *track) {
+	if(track == NULL || track->len == 0)
+		return G_MAXINT64;
+	return track->anchor_time + (((gint64)track->ts - (gint64)track->anchor_ts)*1000)/track->khz;
+}
+
+/* Make the next packet of a track go out at a specific time, and the following ones after it */
+static void janus_recordplay_track_anchor(janus_recordplay_track *track, gint64 when) {
+	if(track == NULL)
+		return;
+	track->anchor_ts = track->ts;
+	track->anchor_time = when;
+}
+
+/* Move a track to a position (in us), returning the position it actually
+ * landed on (video goes back to the previous keyframe), or -1 if past the end */
+static gint64 janus_recordplay_track_seek(janus_recordplay_track *track, gint64 position) {
+	track->ts_cycles = 0;
+	track->last_ts = 0;
+	if(track->index != NULL) {
+		/* We have an index, so we know where to go right away */
+		const janus_recorder_index_entry *entry = janus_recorder_index_seek(track->index, position, track->video);
+		if(entry == NULL)
+			entry = &track->index->entries[0];
+		track->offset = entry->offset;
+		if(!janus_recordplay_track_read(track))
+			return -1;
+		return entry->saved - track->index->entries[0].saved;
 	}
-	/* Now let's parse the frames and order them */
-	offset = 0;
-	janus_recordplay_frame_packet *list = NULL, *last = NULL;
-	while(offset < fsize) {
-		/* Read frame header */
-		fseek(file, offset, SEEK_SET);
-		bytes = fread(prebuffer, sizeof(char), 8, file);
-		prebuffer[8] = '\0';
-		JANUS_LOG(LOG_HUGE, "Header: %s\n", prebuffer);
-		offset += 8;
-		bytes = fread(&len, sizeof(uint16_t), 1, file);
-		len = ntohs(len);
-		JANUS_LOG(LOG_HUGE, "  -- Length: %"SCNu16"\n", len);
-		offset += 2;
-		if(prebuffer[1] == 'J' || len < 12) {
-			/* Not RTP, skip */
-			JANUS_LOG(LOG_HUGE, "  -- Not RTP, skipping\n");
-			offset += len;
-			continue;
-		}
-		/* Only read RTP header */
-		bytes = fread(prebuffer, sizeof(char), 16, file);
-		if(bytes < 0) {
-			JANUS_LOG(LOG_WARN, "Error reading RTP header, stopping here...\n");
+	/* No index, we'll have to go through the file from the beginning */
+	long offset = 0, found = 0;
+	gint64 found_position = 0;
+	track->offset = 0;
+	while(TRUE) {
+		offset = track->offset;
+		if(!janus_recordplay_track_read(track))
 			break;
+		gint64 when = (((gint64)track->ts - (gint64)track->first_ts)*1000)/track->khz;
+		if(when > position)
+			break;
+		if(!track->video || janus_recordplay_track_is_keyframe(track)) {
+			found = offset;
+			found_position = when;
 		}
-		janus_rtp_header *rtp = (janus_rtp_header *)prebuffer;
-		JANUS_LOG(LOG_HUGE, "  -- RTP packet (ssrc=%"SCNu32", pt=%"SCNu16", ext=%"SCNu16", seq=%"SCNu16", ts=%"SCNu32")\n",
-				ntohl(rtp->ssrc), rtp->type, rtp->extension, ntohs(rtp->seq_number), ntohl(rtp->timestamp));
-		/* Generate frame packet and insert in the ordered list */
-		janus_recordplay_frame_packet *p = g_malloc(sizeof(janus_recordplay_frame_packet));
-		p->seq = ntohs(rtp->seq_number);
-		if(reset == 0) {
-			/* Simple enough... */
-			p->ts = ntohl(rtp->timestamp);
-		} else {
-			/* Is this packet pre- or post-reset? */
-			if(ntohl(rtp->timestamp) > first_ts) {
-				/* Pre-reset... */
-				p->ts = ntohl(rtp->timestamp);
-			} else {
-				/* Post-reset... */
-				uint64_t max32 = UINT32_MAX;
-				max32++;
-				p->ts = max32+ntohl(rtp->timestamp);
-			}
-		}
-		p->len = len;
-		p->offset = offset;
-		p->next = NULL;
-		p->prev = NULL;
-		if(list == NULL) {
-			/* First element becomes the list itself (and the last item), at least for now */
-			list = p;
-			last = p;
-		} else {
-			/* Check where we should insert this, starting from the end */
-			int added = 0;
-			janus_recordplay_frame_packet *tmp = last;
-			while(tmp) {
-				if(tmp->ts < p->ts) {
-					/* The new timestamp is greater than the last one we have, append */
-					added = 1;
-					if(tmp->next != NULL) {
-						/* We're inserting */
-						tmp->next->prev = p;
-						p->next = tmp->next;
-					} else {
-						/* Update the last packet */
-						last = p;
-					}
-					tmp->next = p;
-					p->prev = tmp;
-					break;
-				} else if(tmp->ts == p->ts) {
-					/* Same timestamp, check the sequence number */
-					if(tmp->seq < p->seq && (abs(tmp->seq - p->seq) < 10000)) {
-						/* The new sequence number is greater than the last one we have, append */
-						added = 1;
-						if(tmp->next != NULL) {
-							/* We're inserting */
-							tmp->next->prev = p;
-							p->next = tmp->next;
-						} else {
-							/* Update the last packet */
-							last = p;
-						}
-						tmp->next = p;
-						p->prev = tmp;
-						break;
-					} else if(tmp->seq > p->seq && (abs(tmp->seq - p->seq) > 10000)) {
-						/* The new sequence number (resetted) is greater than the last one we have, append */
-						added = 1;
-						if(tmp->next != NULL) {
-							/* We're inserting */
-							tmp->next->prev = p;
-							p->next = tmp->next;
-						} else {
-							/* Update the last packet */
-							last = p;
-						}
-						tmp->next = p;
-						p->prev = tmp;
-						break;
-					}
-				}
-				/* If either the timestamp ot the sequence number we just got is smaller, keep going back */
-				tmp = tmp->prev;
-			}
-			if(!added) {
-				/* We reached the start */
-				p->next = list;
-				list->prev = p;
-				list = p;
-			}
-		}
-		/* Skip data for now */
-		offset += len;
-		count++;
 	}
-	
-	JANUS_LOG(LOG_VERB, "Counted %"SCNu16" RTP packets\n", count);
-	janus_recordplay_frame_packet *tmp = list;
-	count = 0;
-	while(tmp) {
-		count++;
-		JANUS_LOG(LOG_HUGE, "[%10lu][%4d] seq=%"SCNu16", ts=%"SCNu64"\n", tmp->offset, tmp->len, tmp->seq, tmp->ts);
-		tmp = tmp->next;
-	}
-	JANUS_LOG(LOG_VERB, "Counted %"SCNu16" frame packets\n", count);
-	
-	/* Done! */
-	fclose(file);
-	return list;
+	track->ts_cycles = 0;
+	track->last_ts = 0;
+	track->offset = found;
+	if(!janus_recordplay_track_read(track))
+		return -1;
+	return found_position;
 }
 
-static void *janus_recordplay_playout_thread(void *data) {
-	janus_recordplay_session *session = (janus_recordplay_session *)data;
-	if(!session) {
-		JANUS_LOG(LOG_ERR, "Invalid session, can't start playout thread...\n");
-		g_thread_unref(g_thread_self());
-		return NULL;
+/* Send all the packets of a track that are due */
+static void janus_recordplay_track_send(janus_recordplay_player *player, janus_recordplay_track *track, gint64 now) {
+	while(track != NULL && track->len > 0 && janus_recordplay_track_deadline(track) <= now) {
+		/* Update payload type */
+		janus_rtp_header *rtp = (janus_rtp_header *)track->buffer;
+		rtp->type = track->pt;
+		gateway->relay_rtp(player->session->handle, track->video, track->buffer, track->len);
+		janus_recordplay_track_read(track);
 	}
-	if(!session->recording) {
-		janus_refcount_decrease(&session->ref);
-		JANUS_LOG(LOG_ERR, "No recording object, can't start playout thread...\n");
-		g_thread_unref(g_thread_self());
-		return NULL;
+}
+
+static janus_recordplay_player *janus_recordplay_player_create(janus_recordplay_recording *rec, const char **warning) {
+	janus_recordplay_player *player = g_malloc0(sizeof(janus_recordplay_player));
+	if(rec->arc_file) {
+		player->audio = janus_recordplay_track_open(recordings_path, rec->arc_file, FALSE, rec->audio_pt, rec->acodec);
+		if(player->audio == NULL) {
+			JANUS_LOG(LOG_WARN, "Error opening audio recording, trying to go on anyway\n");
+			*warning = "Broken audio file, playing video only";
+		}
 	}
-	janus_refcount_increase(&session->recording->ref);
-	janus_recordplay_recording *rec = session->recording;
-	if(session->recorder) {
-		janus_refcount_decrease(&rec->ref);
-		janus_refcount_decrease(&session->ref);
-		JANUS_LOG(LOG_ERR, "This is a recorder, can't start playout thread...\n");
-		g_thread_unref(g_thread_self());
-		return NULL;
+	if(rec->vrc_file) {
+		player->video = janus_recordplay_track_open(recordings_path, rec->vrc_file, TRUE, rec->video_pt, rec->vcodec);
+		if(player->video == NULL) {
+			JANUS_LOG(LOG_WARN, "Error opening video recording, trying to go on anyway\n");
+			*warning = "Broken video file, playing audio only";
+		}
 	}
-	if(!session->aframes && !session->vframes) {
-		janus_refcount_decrease(&rec->ref);
-		janus_refcount_decrease(&session->ref);
-		JANUS_LOG(LOG_ERR, "No audio and no video frames, can't start playout thread...\n");
-		g_thread_unref(g_thread_self());
+	if(player->audio == NULL && player->video == NULL) {
+		g_free(player);
 		return NULL;
 	}
-	JANUS_LOG(LOG_INFO, "Joining playout thread\n");
-	/* Open the files */
-	FILE *afile = NULL, *vfile = NULL;
-	if(session->aframes) {
-		char source[1024];
-		if(strstr(rec->arc_file, ".mjr"))
-			g_snprintf(source, 1024, "%s/%s", recordings_path, rec->arc_file);
-		else
-			g_snprintf(source, 1024, "%s/%s.mjr", recordings_path, rec->arc_file);
-		afile = fopen(source, "rb");
-		if(afile == NULL) {
-			janus_refcount_decrease(&rec->ref);
-			janus_refcount_decrease(&session->ref);
-			JANUS_LOG(LOG_ERR, "Could not open audio file %s, can't start playout thread...\n", source);
-			g_thread_unref(g_thread_self());
-			return NULL;
-		}
+	return player;
+}
+
+static void janus_recordplay_player_free(janus_recordplay_player *player) {
+	if(player == NULL)
+		return;
+	janus_recordplay_track_close(player->audio);
+	janus_recordplay_track_close(player->video);
+	if(player->recording)
+		janus_refcount_decrease(&player->recording->ref);
+	if(player->session)
+		janus_refcount_decrease(&player->session->ref);
+	g_free(player);
+}
+
+/* Move the playout to a position (in us), keeping audio and video in sync */
+static void janus_recordplay_player_seek(janus_recordplay_player *player, gint64 position, gint64 now) {
+	gint64 apos = player->audio ? janus_recordplay_track_seek(player->audio, position) : -1;
+	gint64 vpos = player->video ? janus_recordplay_track_seek(player->video, position) : -1;
+	JANUS_LOG(LOG_VERB, "Seeking to %"SCNi64"ms (audio=%"SCNi64", video=%"SCNi64")\n",
+		position/1000, apos/1000, vpos/1000);
+	/* The tracks may have landed on different positions, start from the earliest */
+	gint64 start = (apos >= 0 && vpos >= 0) ? MIN(apos, vpos) : MAX(apos, vpos);
+	if(apos >= 0)
+		janus_recordplay_track_anchor(player->audio, now + apos - start);
+	if(vpos >= 0)
+		janus_recordplay_track_anchor(player->video, now + vpos - start);
+}
+
+/* Check if a player should keep going, take care of pause and seek requests,
+ * and figure out when it will need to send something next */
+static gboolean janus_recordplay_player_update(janus_recordplay_player *player, gint64 now) {
+	janus_recordplay_session *session = player->session;
+	if(g_atomic_int_get(&session->destroyed) || !session->active || g_atomic_int_get(&player->recording->destroyed))
+		return FALSE;
+	gboolean paused = g_atomic_int_get(&session->paused);
+	if(paused && player->paused == 0) {
+		player->paused = now;
+	} else if(!paused && player->paused > 0) {
+		/* Shift everything by how long we've been paused */
+		if(player->audio)
+			player->audio->anchor_time += now - player->paused;
+		if(player->video)
+			player->video->anchor_time += now - player->paused;
+		player->paused = 0;
 	}
-	if(session->vframes) {
-		char source[1024];
-		if(strstr(rec->vrc_file, ".mjr"))
-			g_snprintf(source, 1024, "%s/%s", recordings_path, rec->vrc_file);
-		else
-			g_snprintf(source, 1024, "%s/%s.mjr", recordings_path, rec->vrc_file);
-		vfile = fopen(source, "rb");
-		if(vfile == NULL) {
-			janus_refcount_decrease(&rec->ref);
-			janus_refcount_decrease(&session->ref);
-			JANUS_LOG(LOG_ERR, "Could not open video file %s, can't start playout thread...\n", source);
-			if(afile)
-				fclose(afile);
-			afile = NULL;
-			g_thread_unref(g_thread_self());
-			return NULL;
-		}
+	gint seek = g_atomic_int_get(&session->seek);
+	if(seek >= 0 && g_atomic_int_compare_and_exchange(&session->seek, seek, -1)) {
+		/* If we're paused, we'll start from there when resumed */
+		janus_recordplay_player_seek(player, (gint64)seek*1000, player->paused ? player->paused : now);
 	}
-	
-	/* Timer */
-	gboolean asent = FALSE, vsent = FALSE;
-	struct timeval now, abefore, vbefore;
-	time_t d_s, d_us;
-	gettimeofday(&now, NULL);
-	gettimeofday(&abefore, NULL);
-	gettimeofday(&vbefore, NULL);
-
-	janus_recordplay_frame_packet *audio = session->aframes, *video = session->vframes;
-	char *buffer = g_malloc0(1500);
-	int bytes = 0;
-	int64_t ts_diff = 0, passed = 0;
+	if(player->paused > 0) {
+		player->next = G_MAXINT64;
+		return TRUE;
+	}
+	player->next = MIN(janus_recordplay_track_deadline(player->audio), janus_recordplay_track_deadline(player->video));
+	return player->next < G_MAXINT64;
+}
 
-	int audio_pt = session->recording->audio_pt;
-	int video_pt = session->recording->video_pt;
+/* A player is done, tear the PeerConnection down: hangup_media will do the rest */
+static void janus_recordplay_player_done(janus_recordplay_player *player) {
+	janus_recordplay_recording *rec = player->recording;
+	janus_mutex_lock(&rec->mutex);
+	rec->viewers = g_list_remove(rec->viewers, player->session);
+	janus_mutex_unlock(&rec->mutex);
+	gateway->close_pc(player->session->handle);
+	janus_recordplay_player_free(player);
+}
 
-	int akhz = 48;
-	if(audio_pt == 0 || audio_pt == 8 || audio_pt == 9)
-		akhz = 8;
-	int vkhz = 90;
+static gint janus_recordplay_player_compare(gconstpointer a, gconstpointer b) {
+	gint64 na = ((janus_recordplay_player *)a)->next, nb = ((janus_recordplay_player *)b)->next;
+	return na < nb ? -1 : (na > nb ? 1 : 0);
+}
 
-	while(!g_atomic_int_get(&session->destroyed) && session->active
-			&& !g_atomic_int_get(&rec->destroyed) && (audio || video)) {
-		if(!asent && !vsent) {
-			/* We skipped the last round, so sleep a bit (5ms) */
-			g_usleep(5000);
+/* Thread sending the recordings to all viewers: players are kept sorted by
+ * when they need to send their next packet, and we sleep until then, unless
+ * a new player or a wake-up call (e.g., for a seek) is queued in the meanwhile */
+static void *janus_recordplay_playout_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining Record&Play playout thread\n");
+	GList *players = NULL;
+	janus_recordplay_player *player = NULL;
+	gint64 now = 0, timeout = 0, last_check = janus_get_monotonic_time();
+	while(!g_atomic_int_get(&stopping)) {
+		now = janus_get_monotonic_time();
+		timeout = G_USEC_PER_SEC;
+		if(players != NULL)
+			timeout = MIN(timeout, ((janus_recordplay_player *)players->data)->next - now);
+		player = timeout > 0 ? g_async_queue_timeout_pop(playout_queue, timeout) : g_async_queue_try_pop(playout_queue);
+		if(player == &playout_exit)
+			break;
+		now = janus_get_monotonic_time();
+		if(player != NULL && player != &playout_wakeup) {
+			/* New viewer, start right away */
+			janus_recordplay_track_anchor(player->audio, now);
+			janus_recordplay_track_anchor(player->video, now);
+			players = g_list_prepend(players, player);
 		}
-		asent = FALSE;
-		vsent = FALSE;
-		if(audio) {
-			if(audio == session->aframes) {
-				/* First packet, send now */
-				fseek(afile, audio->offset, SEEK_SET);
-				bytes = fread(buffer, sizeof(char), audio->len, afile);
-				if(bytes != audio->len)
-					JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, audio->len);
-				/* Update payload type */
-				janus_rtp_header *rtp = (janus_rtp_header *)buffer;
-				rtp->type = audio_pt;
-				gateway->relay_rtp(session->handle, 0, (char *)buffer, bytes);
-				gettimeofday(&now, NULL);
-				abefore.tv_sec = now.tv_sec;
-				abefore.tv_usec = now.tv_usec;
-				asent = TRUE;
-				audio = audio->next;
-			} else {
-				/* What's the timestamp skip from the previous packet? */
-				ts_diff = audio->ts - audio->prev->ts;
-				ts_diff = (ts_diff*1000)/akhz;
-				/* Check if it's time to send */
-				gettimeofday(&now, NULL);
-				d_s = now.tv_sec - abefore.tv_sec;
-				d_us = now.tv_usec - abefore.tv_usec;
-				if(d_us < 0) {
-					d_us += 1000000;
-					--d_s;
-				}
-				passed = d_s*1000000 + d_us;
-				if(passed < (ts_diff-5000)) {
-					asent = FALSE;
-				} else {
-					/* Update the reference time */
-					abefore.tv_usec += ts_diff%1000000;
-					if(abefore.tv_usec > 1000000) {
-						abefore.tv_sec++;
-						abefore.tv_usec -= 1000000;
-					}
-					if(ts_diff/1000000 > 0) {
-						abefore.tv_sec += ts_diff/1000000;
-						abefore.tv_usec -= ts_diff/1000000;
-					}
-					/* Send now */
-					fseek(afile, audio->offset, SEEK_SET);
-					bytes = fread(buffer, sizeof(char), audio->len, afile);
-					if(bytes != audio->len)
-						JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, audio->len);
-					/* Update payload type */
-					janus_rtp_header *rtp = (janus_rtp_header *)buffer;
-					rtp->type = audio_pt;
-					gateway->relay_rtp(session->handle, 0, (char *)buffer, bytes);
-					asent = TRUE;
-					audio = audio->next;
+		if(player != NULL || now - last_check >= G_USEC_PER_SEC) {
+			/* Something may have changed, check all the players again */
+			last_check = now;
+			GList *l = players;
+			while(l) {
+				GList *next = l->next;
+				janus_recordplay_player *p = (janus_recordplay_player *)l->data;
+				if(!janus_recordplay_player_update(p, now)) {
+					players = g_list_delete_link(players, l);
+					janus_recordplay_player_done(p);
 				}
+				l = next;
 			}
+			players = g_list_sort(players, janus_recordplay_player_compare);
 		}
-		if(video) {
-			if(video == session->vframes) {
-				/* First packets: there may be many of them with the same timestamp, send them all */
-				uint64_t ts = video->ts;
-				while(video && video->ts == ts) {
-					fseek(vfile, video->offset, SEEK_SET);
-					bytes = fread(buffer, sizeof(char), video->len, vfile);
-					if(bytes != video->len)
-						JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, video->len);
-					/* Update payload type */
-					janus_rtp_header *rtp = (janus_rtp_header *)buffer;
-					rtp->type = video_pt;
-					gateway->relay_rtp(session->handle, 1, (char *)buffer, bytes);
-					video = video->next;
-				}
-				vsent = TRUE;
-				gettimeofday(&now, NULL);
-				vbefore.tv_sec = now.tv_sec;
-				vbefore.tv_usec = now.tv_usec;
-			} else {
-				/* What's the timestamp skip from the previous packet? */
-				ts_diff = video->ts - video->prev->ts;
-				ts_diff = (ts_diff*1000)/vkhz;
-				/* Check if it's time to send */
-				gettimeofday(&now, NULL);
-				d_s = now.tv_sec - vbefore.tv_sec;
-				d_us = now.tv_usec - vbefore.tv_usec;
-				if(d_us < 0) {
-					d_us += 1000000;
-					--d_s;
-				}
-				passed = d_s*1000000 + d_us;
-				if(passed < (ts_diff-5000)) {
-					vsent = FALSE;
-				} else {
-					/* Update the reference time */
-					vbefore.tv_usec += ts_diff%1000000;
-					if(vbefore.tv_usec > 1000000) {
-						vbefore.tv_sec++;
-						vbefore.tv_usec -= 1000000;
-					}
-					if(ts_diff/1000000 > 0) {
-						vbefore.tv_sec += ts_diff/1000000;
-						vbefore.tv_usec -= ts_diff/1000000;
-					}
-					/* There may be multiple packets with the same timestamp, send them all */
-					uint64_t ts = video->ts;
-					while(video && video->ts == ts) {
-						/* Send now */
-						fseek(vfile, video->offset, SEEK_SET);
-						bytes = fread(buffer, sizeof(char), video->len, vfile);
-						if(bytes != video->len)
-							JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, video->len);
-						/* Update payload type */
-						janus_rtp_header *rtp = (janus_rtp_header *)buffer;
-						rtp->type = video_pt;
-						gateway->relay_rtp(session->handle, 1, (char *)buffer, bytes);
-						video = video->next;
-					}
-					vsent = TRUE;
-				}
+		/* Send whatever is due */
+		while(players != NULL) {
+			player = (janus_recordplay_player *)players->data;
+			if(player->next > now)
+				break;
+			players = g_list_delete_link(players, players);
+			janus_recordplay_track_send(player, player->audio, now);
+			janus_recordplay_track_send(player, player->video, now);
+			if(!janus_recordplay_player_update(player, now)) {
+				janus_recordplay_player_done(player);
+				continue;
 			}
+			players = g_list_insert_sorted(players, player, janus_recordplay_player_compare);
 		}
 	}
-	
-	g_free(buffer);
-
-	/* Get rid of the indexes */
-	janus_recordplay_frame_packet *tmp = NULL;
-	audio = session->aframes;
-	while(audio) {
-		tmp = audio->next;
-		g_free(audio);
-		audio = tmp;
-	}
-	session->aframes = NULL;
-	video = session->vframes;
-	while(video) {
-		tmp = video->next;
-		g_free(video);
-		video = tmp;
-	}
-	session->vframes = NULL;
-
-	if(afile)
-		fclose(afile);
-	afile = NULL;
-	if(vfile)
-		fclose(vfile);
-	vfile = NULL;
-
-	/* Remove from the list of viewers */
-	janus_mutex_lock(&rec->mutex);
-	rec->viewers = g_list_remove(rec->viewers, session);
-	janus_mutex_unlock(&rec->mutex);
-
-	/* Tell the core to tear down the PeerConnection, hangup_media will do the rest */
-	gateway->close_pc(session->handle);
-	
-	janus_refcount_decrease(&rec->ref);
-	janus_refcount_decrease(&session->ref);
-
-	JANUS_LOG(LOG_INFO, "Leaving playout thread\n");
-	g_thread_unref(g_thread_self());
+	/* Get rid of the players that were still there */
+	g_list_free_full(players, (GDestroyNotify)janus_recordplay_player_free);
+	JANUS_LOG(LOG_VERB, "Leaving Record&Play playout thread\n");
 	return NULL;
 }
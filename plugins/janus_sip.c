@@ -29,6 +29,29 @@
  * need to fork in the same place. This specific functionality, though, has
  * not been implemented as of yet.
  *
+ * By default, the plugin spawns a thread for each call, to relay the
+ * RTP and RTCP packets the SIP peer sends. On boxes handling thousands of
+ * concurrent calls, you can set the \c relay_loops property in the plugin
+ * configuration to have a few shared loops take care of that instead:
+ * each call is assigned to the least loaded loop when it starts, and the
+ * loops read packets in batches, when more than one is available. The
+ * \c janus_relay_* metrics tell how many calls each loop is serving, and
+ * how busy it is.
+ *
+ * In the same way, each registered account gets its own thread running
+ * its own Sofia stack by default. Setting the \c sofia_stacks property
+ * creates accounts on a few shared stacks instead (each account is
+ * still a separate NUA instance, with its own transports), which helps
+ * when many accounts are registered at the same time. Each stack exposes
+ * how many accounts it serves (\c janus_sip_stack_accounts), how many
+ * REGISTER and INVITE transactions are waiting for a response
+ * (\c janus_sip_stack_pending), and a histogram of how long it took to
+ * get one (\c janus_sip_transaction_latency_ms, automatic refreshes
+ * excluded). To avoid accounts registered at the same time refreshing
+ * their registrations at the same time too, \c register_jitter can be
+ * used to randomly shorten the expiry they ask for, by up to the
+ * configured percentage.
+ *
  * \section sipapi SIP Plugin API
  *
  * All requests you can send in the SIP Plugin API are asynchronous,
@@ -400,6 +423,7 @@
 
 #include <arpa/inet.h>
 #include <net/if.h>
+#include <fcntl.h>
 
 #include <jansson.h>
 
@@ -410,6 +434,7 @@
 #include <sofia-sip/url.h>
 #include <sofia-sip/tport_tag.h>
 #include <sofia-sip/su_log.h>
+#include <sofia-sip/su_wait.h>
 
 #include "../debug.h"
 #include "../apierror.h"
@@ -422,6 +447,8 @@
 #include "../sdp-utils.h"
 #include "../utils.h"
 #include "../ip-utils.h"
+#include "../relay-loop.h"
+#include "../metrics.h"
 
 
 /* Plugin information */
@@ -551,6 +578,13 @@ static char *user_agent;
 static int register_ttl = JANUS_DEFAULT_REGISTER_TTL;
 static uint16_t rtp_range_min = 10000;
 static uint16_t rtp_range_max = 60000;
+/* Shared loops to relay media from SIP peers, if configured (a thread per call otherwise) */
+static int relay_loops = 0;
+static janus_relay_pool *relay_pool = NULL;
+/* Shared Sofia stacks to create accounts on, if configured (a thread per account otherwise) */
+static int sofia_stacks = 0;
+/* How much registration expiries should be randomly reduced, to spread refreshes (percentage) */
+static int register_jitter = 0;
 
 static GThread *handler_thread;
 static void *janus_sip_handler(void *data);
@@ -683,6 +717,12 @@ typedef struct janus_sip_media {
 	janus_rtp_switching_context context;
 	int pipefd[2];
 	gboolean updated;
+	/* Relaying state, used by the relay thread or by the relay loops */
+	struct sockaddr_in server_addr;
+	int astep, vstep;
+	guint32 ats, vts;
+	int pollerrs;
+	guint64 relay_id;
 } janus_sip_media;
 
 typedef struct janus_sip_session {
@@ -816,12 +856,53 @@ static void janus_sip_message_free(janus_sip_message *msg) {
 #undef NUA_HMAGIC_T
 #define NUA_HMAGIC_T	ssip_oper_t
 
+/* Shared Sofia stacks: rather than having each account spawn a thread
+ * with its own root, these are a few threads running a root each, that
+ * the NUA instances of many accounts are created on. NUA instances are
+ * created and destroyed by the stack thread itself, when asked to */
+#define JANUS_SIP_LATENCY_BUCKETS	8
+static int janus_sip_latency_buckets[JANUS_SIP_LATENCY_BUCKETS] = { 50, 100, 250, 500, 1000, 2500, 5000, 10000 };
+typedef struct janus_sip_stack_loop {
+	int index;
+	GThread *thread;
+	su_root_t *root;
+	su_wait_t wait[1];
+	int wakefd[2];
+	GAsyncQueue *requests;
+	volatile gint accounts;
+	volatile gint pending;
+	janus_metric *accounts_metric, *pending_metric;
+	janus_metric *latency[JANUS_SIP_LATENCY_BUCKETS+1];
+	janus_metric *latency_sum, *latency_count;
+} janus_sip_stack_loop;
+static janus_sip_stack_loop *stack_loops = NULL;
+static int num_stack_loops = 0;
+
+typedef enum janus_sip_stack_request_type {
+	janus_sip_stack_request_create = 0,
+	janus_sip_stack_request_destroy,
+} janus_sip_stack_request_type;
+typedef struct janus_sip_stack_request {
+	janus_sip_stack_request_type type;
+	janus_sip_session *session;
+} janus_sip_stack_request;
+static janus_sip_stack_request stack_exit_request;
+
+/* Used to wait for the NUA of an account to be ready, whoever creates it */
+static janus_mutex stacks_mutex = JANUS_MUTEX_INITIALIZER;
+static janus_condition stacks_cond;
+
 struct ssip_s {
 	su_home_t s_home[1];
 	su_root_t *s_root;
 	nua_t *s_nua;
 	nua_handle_t *s_nh_r, *s_nh_i;
 	janus_sip_session *session;
+	/* Shared stack this account was created on, if any */
+	janus_sip_stack_loop *loop;
+	gboolean shutdown;
+	/* When the latest REGISTER and INVITE we sent were sent, if still waiting for a response */
+	gint64 register_started, invite_started;
 };
 
 
@@ -1030,6 +1111,14 @@ static void janus_sip_srtp_cleanup(janus_sip_session *session) {
 
 /* Sofia Event thread */
 gpointer janus_sip_sofia_thread(gpointer user_data);
+/* Shared Sofia stacks */
+static int janus_sip_stack_loops_start(int count);
+static void janus_sip_stack_loops_stop(void);
+static void janus_sip_stack_loop_add(janus_sip_session *session);
+static void janus_sip_stack_loop_remove(janus_sip_session *session);
+static gboolean janus_sip_stack_wait_nua(janus_sip_session *session);
+static void janus_sip_stack_transaction_started(janus_sip_session *session, gint64 *started);
+static void janus_sip_stack_transaction_done(janus_sip_session *session, gint64 *started);
 /* Sofia callbacks */
 void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase, nua_t *nua, nua_magic_t *magic, nua_handle_t *nh, nua_hmagic_t *hmagic, sip_t const *sip, tagi_t tags[]);
 /* SDP parsing and manipulation */
@@ -1037,6 +1126,7 @@ void janus_sip_sdp_process(janus_sip_session *session, janus_sdp *sdp, gboolean
 char *janus_sip_sdp_manipulate(janus_sip_session *session, janus_sdp *sdp, gboolean answer);
 /* Media */
 static int janus_sip_allocate_local_ports(janus_sip_session *session);
+static void janus_sip_relay_start(janus_sip_session *session);
 static void *janus_sip_relay_thread(void *data);
 
 
@@ -1286,6 +1376,34 @@ int janus_sip_init(janus_callbacks *callback, const char *config_path) {
 			JANUS_LOG(LOG_VERB, "SIP RTP/RTCP port range: %u -- %u\n", rtp_range_min, rtp_range_max);
 		}
 
+		item = janus_config_get_item_drilldown(config, "general", "sofia_stacks");
+		if(item && item->value) {
+			sofia_stacks = atoi(item->value);
+			if(sofia_stacks < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid number of Sofia stacks (%d), using a thread per account\n", sofia_stacks);
+				sofia_stacks = 0;
+			}
+		}
+
+		item = janus_config_get_item_drilldown(config, "general", "register_jitter");
+		if(item && item->value) {
+			register_jitter = atoi(item->value);
+			if(register_jitter < 0 || register_jitter > 50) {
+				JANUS_LOG(LOG_WARN, "Invalid registration jitter (%d%%), it must be between 0 and 50: disabling it\n", register_jitter);
+				register_jitter = 0;
+			}
+			JANUS_LOG(LOG_VERB, "SIP registration jitter set to %d%%\n", register_jitter);
+		}
+
+		item = janus_config_get_item_drilldown(config, "general", "relay_loops");
+		if(item && item->value) {
+			relay_loops = atoi(item->value);
+			if(relay_loops < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid number of relay loops (%d), using a thread per call\n", relay_loops);
+				relay_loops = 0;
+			}
+		}
+
 		item = janus_config_get_item_drilldown(config, "general", "events");
 		if(item != NULL && item->value != NULL)
 			notify_events = janus_is_true(item->value);
@@ -1318,6 +1436,9 @@ int janus_sip_init(janus_callbacks *callback, const char *config_path) {
 		setenv("TPORT_LOG", "1", 1);
 		su_log_redirect(NULL, janus_sip_sofia_logger, NULL);
 	}
+	janus_condition_init(&stacks_cond);
+	if(sofia_stacks > 0 && janus_sip_stack_loops_start(sofia_stacks) < 0)
+		JANUS_LOG(LOG_WARN, "Couldn't start the shared Sofia stacks, using a thread per account\n");
 
 	sessions = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_sip_session_destroy);
 	identities = g_hash_table_new(g_str_hash, g_str_equal);
@@ -1328,6 +1449,13 @@ int janus_sip_init(janus_callbacks *callback, const char *config_path) {
 
 	g_atomic_int_set(&initialized, 1);
 
+	if(relay_loops > 0) {
+		/* Relay media from SIP peers in a few shared loops, rather than in a thread per call */
+		relay_pool = janus_relay_pool_create("sip", relay_loops);
+		if(relay_pool == NULL)
+			JANUS_LOG(LOG_WARN, "Couldn't start the relay loops, using a thread per call\n");
+	}
+
 	/* Launch the thread that will handle incoming messages */
 	GError *error = NULL;
 	handler_thread = g_thread_try_new("sip handler", janus_sip_handler, NULL, &error);
@@ -1350,6 +1478,11 @@ void janus_sip_destroy(void) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+	/* Stop the relay loops, if any: this releases the calls they were handling */
+	janus_relay_pool_destroy(relay_pool);
+	relay_pool = NULL;
+	/* Stop the shared Sofia stacks, if any */
+	janus_sip_stack_loops_stop();
 	/* FIXME We should destroy the sessions cleanly */
 	janus_mutex_lock(&sessions_mutex);
 	g_hash_table_destroy(sessions);
@@ -1478,6 +1611,7 @@ void janus_sip_create_session(janus_plugin_session *handle, int *error) {
 	session->media.pipefd[0] = -1;
 	session->media.pipefd[1] = -1;
 	session->media.updated = FALSE;
+	session->media.relay_id = 0;
 	janus_mutex_init(&session->rec_mutex);
 	g_atomic_int_set(&session->hangingup, 0);
 	g_atomic_int_set(&session->destroyed, 0);
@@ -1539,12 +1673,18 @@ json_t *janus_sip_query_session(janus_plugin_session *handle) {
 	json_object_set_new(info, "identity", session->account.identity ? json_string(session->account.identity) : NULL);
 	json_object_set_new(info, "registration_status", json_string(janus_sip_registration_status_string(session->account.registration_status)));
 	json_object_set_new(info, "call_status", json_string(janus_sip_call_status_string(session->status)));
+	ssip_t *stack = session->stack;
+	if(stack && stack->loop)
+		json_object_set_new(info, "sip-stack", json_integer(stack->loop->index));
 	if(session->callee) {
 		json_object_set_new(info, "callee", json_string(session->callee));
 		json_object_set_new(info, "auto-ack", json_string(session->media.autoack ? "yes" : "no"));
 		json_object_set_new(info, "srtp-required", json_string(session->media.require_srtp ? "yes" : "no"));
 		json_object_set_new(info, "sdes-local", json_string(session->media.has_srtp_local ? "yes" : "no"));
 		json_object_set_new(info, "sdes-remote", json_string(session->media.has_srtp_remote ? "yes" : "no"));
+		guint64 relay_id = session->media.relay_id;
+		if(relay_id > 0)
+			json_object_set_new(info, "relay-loop", json_integer(janus_relay_pool_loop_index(relay_id)));
 	}
 	if(session->arc || session->vrc || session->arc_peer || session->vrc_peer) {
 		json_t *recording = json_object();
@@ -2032,6 +2172,13 @@ static void *janus_sip_handler(void *data) {
 				ttl = json_integer_value(reg_ttl);
 			if(ttl <= 0)
 				ttl = JANUS_DEFAULT_REGISTER_TTL;
+			if(register_jitter > 0) {
+				/* Ask for a slightly shorter expiry, so that refreshes for accounts
+				 * registered at the same time don't all happen at the same time too */
+				ttl -= g_random_int_range(0, ttl*register_jitter/100 + 1);
+				if(ttl <= 0)
+					ttl = 1;
+			}
 
 			/* Parse display name */
 			const char* display_name_text = NULL;
@@ -2169,28 +2316,25 @@ static void *janus_sip_handler(void *data) {
 
 			session->account.registration_status = janus_sip_registration_status_registering;
 			if(!refresh && session->stack == NULL) {
-				/* Start the thread first */
-				GError *error = NULL;
-				char tname[16];
-				g_snprintf(tname, sizeof(tname), "sip %s", session->account.username);
-				janus_refcount_increase(&session->ref);
-				g_thread_try_new(tname, janus_sip_sofia_thread, session, &error);
-				if(error != NULL) {
-					janus_refcount_decrease(&session->ref);
-					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the SIP Sofia thread...\n", error->code, error->message ? error->message : "??");
-					error_code = JANUS_SIP_ERROR_UNKNOWN_ERROR;
-					g_snprintf(error_cause, 512, "Got error %d (%s) trying to launch the SIP Sofia thread", error->code, error->message ? error->message : "??");
-					goto error;
-				}
-				long int timeout = 0;
-				while(session->stack == NULL || session->stack->s_nua == NULL) {
-					g_usleep(100000);
-					timeout += 100000;
-					if(timeout >= 2000000) {
-						break;
+				if(stack_loops != NULL) {
+					/* Create the account on one of the shared stacks */
+					janus_sip_stack_loop_add(session);
+				} else {
+					/* Start the thread first */
+					GError *error = NULL;
+					char tname[16];
+					g_snprintf(tname, sizeof(tname), "sip %s", session->account.username);
+					janus_refcount_increase(&session->ref);
+					g_thread_try_new(tname, janus_sip_sofia_thread, session, &error);
+					if(error != NULL) {
+						janus_refcount_decrease(&session->ref);
+						JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the SIP Sofia thread...\n", error->code, error->message ? error->message : "??");
+						error_code = JANUS_SIP_ERROR_UNKNOWN_ERROR;
+						g_snprintf(error_cause, 512, "Got error %d (%s) trying to launch the SIP Sofia thread", error->code, error->message ? error->message : "??");
+						goto error;
 					}
 				}
-				if(timeout >= 2000000) {
+				if(!janus_sip_stack_wait_nua(session)) {
 					JANUS_LOG(LOG_ERR, "Two seconds passed and still no NUA, problems with the thread?\n");
 					error_code = JANUS_SIP_ERROR_UNKNOWN_ERROR;
 					g_snprintf(error_cause, 512, "Two seconds passed and still no NUA, problems with the thread?");
@@ -2239,6 +2383,7 @@ static void *janus_sip_handler(void *data) {
 				char ttl_text[20];
 				g_snprintf(ttl_text, sizeof(ttl_text), "%d", ttl);
 				/* Send the REGISTER */
+				janus_sip_stack_transaction_started(session, &session->stack->register_started);
 				nua_register(session->stack->s_nh_r,
 					NUTAG_M_USERNAME(session->account.authuser),
 					NUTAG_M_DISPLAY(session->account.display_name),
@@ -2288,6 +2433,7 @@ static void *janus_sip_handler(void *data) {
 			}
 			/* Unregister now */
 			session->account.registration_status = janus_sip_registration_status_unregistering;
+			janus_sip_stack_transaction_started(session, &session->stack->register_started);
 			nua_unregister(session->stack->s_nh_r, TAG_END());
 			result = json_object();
 			json_object_set_new(result, "event", json_string("unregistering"));
@@ -2536,6 +2682,7 @@ static void *janus_sip_handler(void *data) {
 			g_hash_table_insert(callids, session->callid, session);
 			janus_mutex_unlock(&sessions_mutex);
 			session->media.autoack = do_autoack;
+			janus_sip_stack_transaction_started(session, &session->stack->invite_started);
 			nua_invite(session->stack->s_nh_i,
 				SIPTAG_FROM_STR(from_hdr),
 				SIPTAG_TO_STR(uri_text),
@@ -2698,15 +2845,7 @@ static void *janus_sip_handler(void *data) {
 			if(answer) {
 				/* Start the media */
 				session->media.ready = TRUE;	/* FIXME Maybe we need a better way to signal this */
-				GError *error = NULL;
-				char tname[16];
-				g_snprintf(tname, sizeof(tname), "siprtp %s", session->account.username);
-				janus_refcount_increase(&session->ref);
-				g_thread_try_new(tname, janus_sip_relay_thread, session, &error);
-				if(error != NULL) {
-					janus_refcount_decrease(&session->ref);
-					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n", error->code, error->message ? error->message : "??");
-				}
+				janus_sip_relay_start(session);
 			}
 		} else if(!strcasecmp(request_text, "update")) {
 			/* Update an existing call */
@@ -2764,6 +2903,7 @@ static void *janus_sip_handler(void *data) {
 			session->sdp = parsed_sdp;
 			session->media.update = TRUE;
 			JANUS_LOG(LOG_VERB, "Prepared SDP for update:\n%s", sdp);
+			janus_sip_stack_transaction_started(session, &session->stack->invite_started);
 			nua_invite(session->stack->s_nh_i,
 				SOATAG_USER_SDP_STR(sdp),
 				TAG_END());
@@ -2887,6 +3027,7 @@ static void *janus_sip_handler(void *data) {
 				}
 				/* Send the re-INVITE */
 				char *sdp = janus_sdp_write(session->sdp);
+				janus_sip_stack_transaction_started(session, &session->stack->invite_started);
 				nua_invite(session->stack->s_nh_i,
 					SOATAG_USER_SDP_STR(sdp),
 					TAG_END());
@@ -3575,7 +3716,13 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 				/* shutdown in progress -> return */
 				break;
 			}
-			if(ssip != NULL) {
+			if(ssip != NULL && ssip->loop != NULL) {
+				/* Shared stack: have the stack thread get rid of the NUA, once we're out of here */
+				if(!ssip->shutdown) {
+					ssip->shutdown = TRUE;
+					janus_sip_stack_loop_remove(session);
+				}
+			} else if(ssip != NULL) {
 				/* end the event loop. su_root_run() will return */
 				su_root_break(ssip->s_root);
 			}
@@ -3600,6 +3747,8 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 			break;
 		case nua_r_invite: {
 			JANUS_LOG(LOG_VERB, "[%s][%s]: %d %s\n", session->account.username, nua_event_name(event), status, phrase ? phrase : "??");
+			if(ssip != NULL && status > 100 && status != 401 && status != 407)
+				janus_sip_stack_transaction_done(session, &ssip->invite_started);
 
 			gboolean in_progress = FALSE;
 			if(status < 200) {
@@ -3750,15 +3899,7 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 				break;
 			}
 			if(!session->media.earlymedia && !session->media.update) {
-				GError *error = NULL;
-				char tname[16];
-				g_snprintf(tname, sizeof(tname), "siprtp %s", session->account.username);
-				janus_refcount_increase(&session->ref);
-				g_thread_try_new(tname, janus_sip_relay_thread, session, &error);
-				if(error != NULL) {
-					janus_refcount_decrease(&session->ref);
-					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n", error->code, error->message ? error->message : "??");
-				}
+				janus_sip_relay_start(session);
 			}
 			/* Send event back to the browser */
 			json_t *jsep = NULL;
@@ -3801,6 +3942,8 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 		case nua_r_register:
 		case nua_r_unregister: {
 			JANUS_LOG(LOG_VERB, "[%s][%s]: %d %s\n", session->account.username, nua_event_name(event), status, phrase ? phrase : "??");
+			if(ssip != NULL && status > 100 && status != 401 && status != 407)
+				janus_sip_stack_transaction_done(session, &ssip->register_started);
 			if(status == 200) {
 				if(event == nua_r_register) {
 					if(session->account.registration_status < janus_sip_registration_status_registered)
@@ -4051,7 +4194,10 @@ void janus_sip_sdp_process(janus_sip_session *session, janus_sdp *sdp, gboolean
 	if(update && changed && *changed) {
 		/* Something changed: mark this on the session, so that the thread can update the sockets */
 		session->media.updated = TRUE;
-		if(session->media.pipefd[1] > 0) {
+		if(session->media.relay_id > 0) {
+			/* The call is handled by the relay loops */
+			janus_relay_pool_wakeup(relay_pool, session->media.relay_id);
+		} else if(session->media.pipefd[1] > 0) {
 			int code = 1;
 			ssize_t res = 0;
 			do {
@@ -4069,7 +4215,7 @@ char *janus_sip_sdp_manipulate(janus_sip_session *session, janus_sdp *sdp, gbool
 	GList *temp = sdp->m_lines;
 	while(temp) {
 		janus_sdp_mline *m = (janus_sdp_mline *)temp->data;
-		g_free(m->proto);
+		janus_sdp_arena_free_string(m->arena, m->proto);
 		m->proto = g_strdup(session->media.require_srtp ? "RTP/SAVP" : "RTP/AVP");
 		if(m->type == JANUS_SDP_AUDIO) {
 			m->port = session->media.local_audio_rtp_port;
@@ -4094,7 +4240,7 @@ char *janus_sip_sdp_manipulate(janus_sip_session *session, janus_sdp *sdp, gbool
 				m->attributes = g_list_append(m->attributes, a);
 			}
 		}
-		g_free(m->c_addr);
+		janus_sdp_arena_free_string(m->arena, m->c_addr);
 		m->c_addr = g_strdup(local_ip);
 		if(answer && (m->type == JANUS_SDP_AUDIO || m->type == JANUS_SDP_VIDEO)) {
 			/* Check which codec was negotiated eventually */
@@ -4298,38 +4444,251 @@ static void janus_sip_connect_sockets(janus_sip_session *session, struct sockadd
 
 }
 
-/* Thread to relay RTP/RTCP frames coming from the SIP peer */
-static void *janus_sip_relay_thread(void *data) {
-	janus_sip_session *session = (janus_sip_session *)data;
-	if(!session) {
-		g_thread_unref(g_thread_self());
-		return NULL;
-	}
-	if(!session->account.username || !session->callee) {
-		janus_refcount_decrease(&session->ref);
-		g_thread_unref(g_thread_self());
-		return NULL;
-	}
-	JANUS_LOG(LOG_VERB, "Starting relay thread (%s <--> %s)\n", session->account.username, session->callee);
+/* Prepare the relaying of RTP/RTCP frames coming from the SIP peer: this
+ * is shared by the per-call relay threads and the relay loops */
+static gboolean janus_sip_relay_setup(janus_sip_session *session) {
+	if(!session->account.username || !session->callee)
+		return FALSE;
+	JANUS_LOG(LOG_VERB, "Starting relay (%s <--> %s)\n", session->account.username, session->callee);
+	session->media.astep = 0;
+	session->media.vstep = 0;
+	session->media.ats = 0;
+	session->media.vts = 0;
+	session->media.pollerrs = 0;
 
 	gboolean have_server_ip = TRUE;
-	struct sockaddr_in server_addr;
-	memset(&server_addr, 0, sizeof(server_addr));
-	server_addr.sin_family = AF_INET;
-	if(inet_aton(session->media.remote_ip, &server_addr.sin_addr) == 0) {	/* Not a numeric IP... */
+	struct sockaddr_in *server_addr = &session->media.server_addr;
+	memset(server_addr, 0, sizeof(*server_addr));
+	server_addr->sin_family = AF_INET;
+	if(inet_aton(session->media.remote_ip, &server_addr->sin_addr) == 0) {	/* Not a numeric IP... */
 		struct hostent *host = gethostbyname(session->media.remote_ip);	/* ...resolve name */
 		if(!host) {
 			JANUS_LOG(LOG_ERR, "[SIP-%s] Couldn't get host (%s)\n", session->account.username, session->media.remote_ip);
 			have_server_ip = FALSE;
 		} else {
-			server_addr.sin_addr = *(struct in_addr *)host->h_addr_list;
+			server_addr->sin_addr = *(struct in_addr *)host->h_addr_list;
 		}
 	}
 	if(have_server_ip)
-		janus_sip_connect_sockets(session, &server_addr);
+		janus_sip_connect_sockets(session, server_addr);
 
 	if(!session->callee) {
-		JANUS_LOG(LOG_VERB, "[SIP-%s] Leaving thread, no callee...\n", session->account.username);
+		JANUS_LOG(LOG_VERB, "[SIP-%s] Not relaying, no callee...\n", session->account.username);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Check if we should keep on relaying, and apply session updates, if any */
+static gboolean janus_sip_relay_active(janus_sip_session *session) {
+	if(session == NULL || g_atomic_int_get(&session->destroyed) ||
+			session->status <= janus_sip_call_status_idle ||
+			session->status >= janus_sip_call_status_closing)	/* FIXME We need a per-call watchdog as well */
+		return FALSE;
+	if(session->media.updated) {
+		/* Apparently there was a session update */
+		if(session->media.remote_ip != NULL && (inet_aton(session->media.remote_ip, &session->media.server_addr.sin_addr) != 0)) {
+			janus_sip_connect_sockets(session, &session->media.server_addr);
+		} else {
+			JANUS_LOG(LOG_ERR, "[SIP-%p] Couldn't update session details: missing or invalid remote IP address? (%s)\n",
+				session->account.username, session->media.remote_ip);
+		}
+		session->media.updated = FALSE;
+	}
+	return TRUE;
+}
+
+/* Handle an error on one of the RTP/RTCP sockets: returns a negative
+ * integer if it's bad enough that the call should be considered over */
+static int janus_sip_relay_error(janus_sip_session *session, int fd, int error) {
+	if(error == 0) {
+		/* Maybe not a breaking error after all? */
+		return 0;
+	} else if(error == 111) {
+		/* ICMP error? If it's related to RTCP, let's just close the RTCP socket and move on */
+		if(fd == session->media.audio_rtcp_fd) {
+			JANUS_LOG(LOG_WARN, "[SIP-%s] Got a '%s' on the audio RTCP socket, closing it\n",
+				session->account.username, strerror(error));
+			janus_relay_pool_remove_fd(relay_pool, session->media.relay_id, fd);
+			close(session->media.audio_rtcp_fd);
+			session->media.audio_rtcp_fd = -1;
+			return 0;
+		} else if(fd == session->media.video_rtcp_fd) {
+			JANUS_LOG(LOG_WARN, "[SIP-%s] Got a '%s' on the video RTCP socket, closing it\n",
+				session->account.username, strerror(error));
+			janus_relay_pool_remove_fd(relay_pool, session->media.relay_id, fd);
+			close(session->media.video_rtcp_fd);
+			session->media.video_rtcp_fd = -1;
+			return 0;
+		}
+	}
+	/* FIXME Should we be more tolerant of ICMP errors on RTP sockets as well? */
+	session->media.pollerrs++;
+	if(session->media.pollerrs < 100)
+		return 0;
+	JANUS_LOG(LOG_ERR, "[SIP-%s] Too many errors polling socket %d\n", session->account.username, fd);
+	JANUS_LOG(LOG_ERR, "[SIP-%s]   -- %d (%s)\n", session->account.username, error, strerror(error));
+	/* Can we assume it's pretty much over, after a POLLERR? */
+	/* FIXME Simulate a "hangup" coming from the browser */
+	janus_sip_message *msg = g_malloc(sizeof(janus_sip_message));
+	msg->handle = session->handle;
+	msg->message = json_pack("{ss}", "request", "hangup");
+	msg->transaction = NULL;
+	msg->jsep = NULL;
+	g_async_queue_push(messages, msg);
+	return -1;
+}
+
+/* Handle an RTP/RTCP packet received from the SIP peer */
+static void janus_sip_relay_incoming(janus_sip_session *session, int fd, char *buffer, int bytes) {
+	session->media.pollerrs = 0;
+	if(session->media.audio_rtp_fd != -1 && fd == session->media.audio_rtp_fd) {
+		/* Got something audio (RTP) */
+		janus_rtp_header *header = (janus_rtp_header *)buffer;
+		if(session->media.audio_ssrc_peer != ntohl(header->ssrc)) {
+			session->media.audio_ssrc_peer = ntohl(header->ssrc);
+			JANUS_LOG(LOG_VERB, "Got SIP peer audio SSRC: %"SCNu32"\n", session->media.audio_ssrc_peer);
+		}
+		/* Is this SRTP? */
+		if(session->media.has_srtp_remote) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect(session->media.audio_srtp_in, buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				guint32 timestamp = ntohl(header->timestamp);
+				guint16 seq = ntohs(header->seq_number);
+				JANUS_LOG(LOG_ERR, "[SIP-%s] Audio SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
+					session->account.username, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
+				return;
+			}
+			bytes = buflen;
+		}
+		/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
+		guint32 timestamp = ntohl(header->timestamp);
+		janus_rtp_header_update(header, &session->media.context, FALSE, session->media.astep ? session->media.astep : 960);
+		if(session->media.ats == 0) {
+			session->media.ats = timestamp;
+		} else if(session->media.astep == 0) {
+			session->media.astep = timestamp-session->media.ats;
+			if(session->media.astep < 0)
+				session->media.astep = 0;
+		}
+		/* Save the frame if we're recording */
+		janus_recorder_save_frame(session->arc_peer, buffer, bytes);
+		/* Relay to browser */
+		gateway->relay_rtp(session->handle, 0, buffer, bytes);
+	} else if(session->media.audio_rtcp_fd != -1 && fd == session->media.audio_rtcp_fd) {
+		/* Got something audio (RTCP) */
+		/* Is this SRTCP? */
+		if(session->media.has_srtp_remote) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect_rtcp(session->media.audio_srtp_in, buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				JANUS_LOG(LOG_ERR, "[SIP-%s] Audio SRTCP unprotect error: %s (len=%d-->%d)\n",
+					session->account.username, janus_srtp_error_str(res), bytes, buflen);
+				return;
+			}
+			bytes = buflen;
+		}
+		/* Relay to browser */
+		gateway->relay_rtcp(session->handle, 0, buffer, bytes);
+	} else if(session->media.video_rtp_fd != -1 && fd == session->media.video_rtp_fd) {
+		/* Got something video (RTP) */
+		janus_rtp_header *header = (janus_rtp_header *)buffer;
+		if(session->media.video_ssrc_peer != ntohl(header->ssrc)) {
+			session->media.video_ssrc_peer = ntohl(header->ssrc);
+			JANUS_LOG(LOG_VERB, "Got SIP peer video SSRC: %"SCNu32"\n", session->media.video_ssrc_peer);
+		}
+		/* Is this SRTP? */
+		if(session->media.has_srtp_remote) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect(session->media.video_srtp_in, buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				guint32 timestamp = ntohl(header->timestamp);
+				guint16 seq = ntohs(header->seq_number);
+				JANUS_LOG(LOG_ERR, "[SIP-%s] Video SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
+					session->account.username, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
+				return;
+			}
+			bytes = buflen;
+		}
+		/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
+		janus_rtp_header_update(header, &session->media.context, TRUE, session->media.vstep ? session->media.vstep : 4500);
+		guint32 timestamp = ntohl(header->timestamp);
+		if(session->media.vts == 0) {
+			session->media.vts = timestamp;
+		} else if(session->media.vstep == 0) {
+			session->media.vstep = timestamp-session->media.vts;
+			if(session->media.vstep < 0)
+				session->media.vstep = 0;
+		}
+		/* Save the frame if we're recording */
+		janus_recorder_save_frame(session->vrc_peer, buffer, bytes);
+		/* Relay to browser */
+		gateway->relay_rtp(session->handle, 1, buffer, bytes);
+	} else if(session->media.video_rtcp_fd != -1 && fd == session->media.video_rtcp_fd) {
+		/* Got something video (RTCP) */
+		/* Is this SRTCP? */
+		if(session->media.has_srtp_remote) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect_rtcp(session->media.video_srtp_in, buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				JANUS_LOG(LOG_ERR, "[SIP-%s] Video SRTP unprotect error: %s (len=%d-->%d)\n",
+					session->account.username, janus_srtp_error_str(res), bytes, buflen);
+				return;
+			}
+			bytes = buflen;
+		}
+		/* Relay to browser */
+		gateway->relay_rtcp(session->handle, 1, buffer, bytes);
+	}
+}
+
+/* Close the RTP/RTCP sockets and clean up when we're done relaying */
+static void janus_sip_relay_cleanup(janus_sip_session *session) {
+	session->media.relay_id = 0;
+	if(session->media.audio_rtp_fd != -1) {
+		close(session->media.audio_rtp_fd);
+		session->media.audio_rtp_fd = -1;
+	}
+	if(session->media.audio_rtcp_fd != -1) {
+		close(session->media.audio_rtcp_fd);
+		session->media.audio_rtcp_fd = -1;
+	}
+	session->media.local_audio_rtp_port = 0;
+	session->media.local_audio_rtcp_port = 0;
+	session->media.audio_ssrc = 0;
+	if(session->media.video_rtp_fd != -1) {
+		close(session->media.video_rtp_fd);
+		session->media.video_rtp_fd = -1;
+	}
+	if(session->media.video_rtcp_fd != -1) {
+		close(session->media.video_rtcp_fd);
+		session->media.video_rtcp_fd = -1;
+	}
+	session->media.local_video_rtp_port = 0;
+	session->media.local_video_rtcp_port = 0;
+	session->media.video_ssrc = 0;
+	session->media.simulcast_ssrc = 0;
+	if(session->media.pipefd[0] > 0) {
+		close(session->media.pipefd[0]);
+		session->media.pipefd[0] = -1;
+	}
+	if(session->media.pipefd[1] > 0) {
+		close(session->media.pipefd[1]);
+		session->media.pipefd[1] = -1;
+	}
+	/* Clean up SRTP stuff, if needed */
+	janus_sip_srtp_cleanup(session);
+}
+
+/* Thread to relay RTP/RTCP frames coming from the SIP peer */
+static void *janus_sip_relay_thread(void *data) {
+	janus_sip_session *session = (janus_sip_session *)data;
+	if(!session) {
+		g_thread_unref(g_thread_self());
+		return NULL;
+	}
+	if(!janus_sip_relay_setup(session)) {
 		janus_refcount_decrease(&session->ref);
 		g_thread_unref(g_thread_self());
 		return NULL;
@@ -4337,7 +4696,7 @@ static void *janus_sip_relay_thread(void *data) {
 	/* File descriptors */
 	socklen_t addrlen;
 	struct sockaddr_in remote;
-	int resfd = 0, bytes = 0, pollerrs = 0;
+	int resfd = 0, bytes = 0;
 	struct pollfd fds[5];
 	int pipe_fd = session->media.pipefd[0];
 	char buffer[1500];
@@ -4345,23 +4704,7 @@ static void *janus_sip_relay_thread(void *data) {
 	/* Loop */
 	int num = 0;
 	gboolean goon = TRUE;
-	int astep = 0, vstep = 0;
-	guint32 ats = 0, vts = 0;
-	while(goon && session != NULL && !g_atomic_int_get(&session->destroyed) &&
-			session->status > janus_sip_call_status_idle &&
-			session->status < janus_sip_call_status_closing) {	/* FIXME We need a per-call watchdog as well */
-
-		if(session->media.updated) {
-			/* Apparently there was a session update */
-			if(session->media.remote_ip != NULL && (inet_aton(session->media.remote_ip, &server_addr.sin_addr) != 0)) {
-				janus_sip_connect_sockets(session, &server_addr);
-			} else {
-				JANUS_LOG(LOG_ERR, "[SIP-%p] Couldn't update session details: missing or invalid remote IP address? (%s)\n",
-					session->account.username, session->media.remote_ip);
-			}
-			session->media.updated = FALSE;
-		}
-
+	while(goon && janus_sip_relay_active(session)) {
 		/* Prepare poll */
 		num = 0;
 		if(session->media.audio_rtp_fd != -1) {
@@ -4422,41 +4765,10 @@ static void *janus_sip_relay_thread(void *data) {
 				int error = 0;
 				socklen_t errlen = sizeof(error);
 				getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, (void *)&error, &errlen);
-				if(error == 0) {
-					/* Maybe not a breaking error after all? */
-					continue;
-				} else if(error == 111) {
-					/* ICMP error? If it's related to RTCP, let's just close the RTCP socket and move on */
-					if(fds[i].fd == session->media.audio_rtcp_fd) {
-						JANUS_LOG(LOG_WARN, "[SIP-%s] Got a '%s' on the audio RTCP socket, closing it\n",
-							session->account.username, strerror(error));
-						close(session->media.audio_rtcp_fd);
-						session->media.audio_rtcp_fd = -1;
-						continue;
-					} else if(fds[i].fd == session->media.video_rtcp_fd) {
-						JANUS_LOG(LOG_WARN, "[SIP-%s] Got a '%s' on the video RTCP socket, closing it\n",
-							session->account.username, strerror(error));
-						close(session->media.video_rtcp_fd);
-						session->media.video_rtcp_fd = -1;
-						continue;
-					}
+				if(janus_sip_relay_error(session, fds[i].fd, error) < 0) {
+					goon = FALSE;
+					break;
 				}
-				/* FIXME Should we be more tolerant of ICMP errors on RTP sockets as well? */
-				pollerrs++;
-				if(pollerrs < 100)
-					continue;
-				JANUS_LOG(LOG_ERR, "[SIP-%s] Too many errors polling %d (socket #%d): %s...\n", session->account.username,
-					fds[i].fd, i, fds[i].revents & POLLERR ? "POLLERR" : "POLLHUP");
-				JANUS_LOG(LOG_ERR, "[SIP-%s]   -- %d (%s)\n", session->account.username, error, strerror(error));
-				goon = FALSE;	/* Can we assume it's pretty much over, after a POLLERR? */
-				/* FIXME Simulate a "hangup" coming from the browser */
-				janus_sip_message *msg = g_malloc(sizeof(janus_sip_message));
-				msg->handle = session->handle;
-				msg->message = json_pack("{ss}", "request", "hangup");
-				msg->transaction = NULL;
-				msg->jsep = NULL;
-				g_async_queue_push(messages, msg);
-				break;
 			} else if(fds[i].revents & POLLIN) {
 				if(pipe_fd != -1 && fds[i].fd == pipe_fd) {
 					/* Poll interrupted for a reason, go on */
@@ -4465,173 +4777,17 @@ static void *janus_sip_relay_thread(void *data) {
 					break;
 				}
 				/* Got an RTP/RTCP packet */
-				if(session->media.audio_rtp_fd != -1 && fds[i].fd == session->media.audio_rtp_fd) {
-					/* Got something audio (RTP) */
-					addrlen = sizeof(remote);
-					bytes = recvfrom(session->media.audio_rtp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0) {
-						/* Failed to read? */
-						continue;
-					}
-					pollerrs = 0;
-					janus_rtp_header *header = (janus_rtp_header *)buffer;
-					if(session->media.audio_ssrc_peer != ntohl(header->ssrc)) {
-						session->media.audio_ssrc_peer = ntohl(header->ssrc);
-						JANUS_LOG(LOG_VERB, "Got SIP peer audio SSRC: %"SCNu32"\n", session->media.audio_ssrc_peer);
-					}
-					/* Is this SRTP? */
-					if(session->media.has_srtp_remote) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect(session->media.audio_srtp_in, buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							guint32 timestamp = ntohl(header->timestamp);
-							guint16 seq = ntohs(header->seq_number);
-							JANUS_LOG(LOG_ERR, "[SIP-%s] Audio SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
-								session->account.username, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
-					guint32 timestamp = ntohl(header->timestamp);
-					janus_rtp_header_update(header, &session->media.context, FALSE, astep ? astep : 960);
-					if(ats == 0) {
-						ats = timestamp;
-					} else if(astep == 0) {
-						astep = timestamp-ats;
-						if(astep < 0)
-							astep = 0;
-					}
-					/* Save the frame if we're recording */
-					janus_recorder_save_frame(session->arc_peer, buffer, bytes);
-					/* Relay to browser */
-					gateway->relay_rtp(session->handle, 0, buffer, bytes);
-					continue;
-				} else if(session->media.audio_rtcp_fd != -1 && fds[i].fd == session->media.audio_rtcp_fd) {
-					/* Got something audio (RTCP) */
-					addrlen = sizeof(remote);
-					bytes = recvfrom(session->media.audio_rtcp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0) {
-						/* Failed to read? */
-						continue;
-					}
-					pollerrs = 0;
-					/* Is this SRTCP? */
-					if(session->media.has_srtp_remote) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect_rtcp(session->media.audio_srtp_in, buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							JANUS_LOG(LOG_ERR, "[SIP-%s] Audio SRTCP unprotect error: %s (len=%d-->%d)\n",
-								session->account.username, janus_srtp_error_str(res), bytes, buflen);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Relay to browser */
-					gateway->relay_rtcp(session->handle, 0, buffer, bytes);
-					continue;
-				} else if(session->media.video_rtp_fd != -1 && fds[i].fd == session->media.video_rtp_fd) {
-					/* Got something video (RTP) */
-					addrlen = sizeof(remote);
-					bytes = recvfrom(session->media.video_rtp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0) {
-						/* Failed to read? */
-						continue;
-					}
-					pollerrs = 0;
-					janus_rtp_header *header = (janus_rtp_header *)buffer;
-					if(session->media.video_ssrc_peer != ntohl(header->ssrc)) {
-						session->media.video_ssrc_peer = ntohl(header->ssrc);
-						JANUS_LOG(LOG_VERB, "Got SIP peer video SSRC: %"SCNu32"\n", session->media.video_ssrc_peer);
-					}
-					/* Is this SRTP? */
-					if(session->media.has_srtp_remote) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect(session->media.video_srtp_in, buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							guint32 timestamp = ntohl(header->timestamp);
-							guint16 seq = ntohs(header->seq_number);
-							JANUS_LOG(LOG_ERR, "[SIP-%s] Video SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
-								session->account.username, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
-					janus_rtp_header_update(header, &session->media.context, TRUE, vstep ? vstep : 4500);
-					guint32 timestamp = ntohl(header->timestamp);
-					if(vts == 0) {
-						vts = timestamp;
-					} else if(vstep == 0) {
-						vstep = timestamp-vts;
-						if(vstep < 0)
-							vstep = 0;
-					}
-					/* Save the frame if we're recording */
-					janus_recorder_save_frame(session->vrc_peer, buffer, bytes);
-					/* Relay to browser */
-					gateway->relay_rtp(session->handle, 1, buffer, bytes);
-					continue;
-				} else if(session->media.video_rtcp_fd != -1 && fds[i].fd == session->media.video_rtcp_fd) {
-					/* Got something video (RTCP) */
-					addrlen = sizeof(remote);
-					bytes = recvfrom(session->media.video_rtcp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0) {
-						/* Failed to read? */
-						continue;
-					}
-					pollerrs = 0;
-					/* Is this SRTCP? */
-					if(session->media.has_srtp_remote) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect_rtcp(session->media.video_srtp_in, buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							JANUS_LOG(LOG_ERR, "[SIP-%s] Video SRTP unprotect error: %s (len=%d-->%d)\n",
-								session->account.username, janus_srtp_error_str(res), bytes, buflen);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Relay to browser */
-					gateway->relay_rtcp(session->handle, 1, buffer, bytes);
+				addrlen = sizeof(remote);
+				bytes = recvfrom(fds[i].fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
+				if(bytes < 0) {
+					/* Failed to read? */
 					continue;
 				}
+				janus_sip_relay_incoming(session, fds[i].fd, buffer, bytes);
 			}
 		}
 	}
-	if(session->media.audio_rtp_fd != -1) {
-		close(session->media.audio_rtp_fd);
-		session->media.audio_rtp_fd = -1;
-	}
-	if(session->media.audio_rtcp_fd != -1) {
-		close(session->media.audio_rtcp_fd);
-		session->media.audio_rtcp_fd = -1;
-	}
-	session->media.local_audio_rtp_port = 0;
-	session->media.local_audio_rtcp_port = 0;
-	session->media.audio_ssrc = 0;
-	if(session->media.video_rtp_fd != -1) {
-		close(session->media.video_rtp_fd);
-		session->media.video_rtp_fd = -1;
-	}
-	if(session->media.video_rtcp_fd != -1) {
-		close(session->media.video_rtcp_fd);
-		session->media.video_rtcp_fd = -1;
-	}
-	session->media.local_video_rtp_port = 0;
-	session->media.local_video_rtcp_port = 0;
-	session->media.video_ssrc = 0;
-	session->media.simulcast_ssrc = 0;
-	if(session->media.pipefd[0] > 0) {
-		close(session->media.pipefd[0]);
-		session->media.pipefd[0] = -1;
-	}
-	if(session->media.pipefd[1] > 0) {
-		close(session->media.pipefd[1]);
-		session->media.pipefd[1] = -1;
-	}
-	/* Clean up SRTP stuff, if needed */
-	janus_sip_srtp_cleanup(session);
+	janus_sip_relay_cleanup(session);
 	/* Done */
 	JANUS_LOG(LOG_VERB, "Leaving SIP relay thread\n");
 	janus_refcount_decrease(&session->ref);
@@ -4639,27 +4795,68 @@ static void *janus_sip_relay_thread(void *data) {
 	return NULL;
 }
 
+/* Callbacks for calls handled by the shared relay loops, rather than by a thread */
+static void janus_sip_relay_loop_incoming(gpointer user_data, int fd, char *buf, int len) {
+	janus_sip_relay_incoming((janus_sip_session *)user_data, fd, buf, len);
+}
 
-/* Sofia Event thread */
-gpointer janus_sip_sofia_thread(gpointer user_data) {
+static int janus_sip_relay_loop_error(gpointer user_data, int fd, int error) {
 	janus_sip_session *session = (janus_sip_session *)user_data;
-	if(session == NULL) {
-		g_thread_unref(g_thread_self());
-		return NULL;
+	/* If we just updated the session, let's wait until things have calmed down */
+	if(session->media.updated)
+		return 0;
+	return janus_sip_relay_error(session, fd, error);
+}
+
+static gboolean janus_sip_relay_loop_check(gpointer user_data) {
+	return janus_sip_relay_active((janus_sip_session *)user_data);
+}
+
+static void janus_sip_relay_loop_done(gpointer user_data) {
+	janus_sip_session *session = (janus_sip_session *)user_data;
+	janus_sip_relay_cleanup(session);
+	JANUS_LOG(LOG_VERB, "[SIP-%s] Call removed from the relay loops\n", session->account.username);
+	janus_refcount_decrease(&session->ref);
+}
+
+static janus_relay_callbacks janus_sip_relay_callbacks = {
+	.incoming = janus_sip_relay_loop_incoming,
+	.error = janus_sip_relay_loop_error,
+	.check = janus_sip_relay_loop_check,
+	.done = janus_sip_relay_loop_done,
+};
+
+/* Start relaying media from the SIP peer, either in the relay loops or in a dedicated thread */
+static void janus_sip_relay_start(janus_sip_session *session) {
+	janus_refcount_increase(&session->ref);
+	if(relay_pool != NULL) {
+		if(!janus_sip_relay_setup(session)) {
+			janus_refcount_decrease(&session->ref);
+			return;
+		}
+		int fds[4] = { session->media.audio_rtp_fd, session->media.audio_rtcp_fd,
+			session->media.video_rtp_fd, session->media.video_rtcp_fd };
+		session->media.relay_id = janus_relay_pool_add(relay_pool, fds, 4, &janus_sip_relay_callbacks, session);
+		if(session->media.relay_id == 0) {
+			JANUS_LOG(LOG_ERR, "[SIP-%s] Couldn't add the call to the relay loops...\n", session->account.username);
+			janus_sip_relay_cleanup(session);
+			janus_refcount_decrease(&session->ref);
+		}
+		return;
 	}
-	if(session->account.username == NULL) {
+	GError *error = NULL;
+	char tname[16];
+	g_snprintf(tname, sizeof(tname), "siprtp %s", session->account.username);
+	g_thread_try_new(tname, janus_sip_relay_thread, session, &error);
+	if(error != NULL) {
 		janus_refcount_decrease(&session->ref);
-		g_thread_unref(g_thread_self());
-		return NULL;
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n", error->code, error->message ? error->message : "??");
 	}
-	JANUS_LOG(LOG_VERB, "Joining sofia loop thread (%s)...\n", session->account.username);
-	session->stack = g_malloc0(sizeof(ssip_t));
-	session->stack->session = session;
-	session->stack->s_nua = NULL;
-	session->stack->s_nh_r = NULL;
-	session->stack->s_nh_i = NULL;
-	session->stack->s_root = su_root_create(session->stack);
-	su_home_init(session->stack->s_home);
+}
+
+
+/* Create the NUA of an account on the root of its stack */
+static void janus_sip_stack_create_nua(janus_sip_session *session) {
 	JANUS_LOG(LOG_VERB, "Setting up sofia stack (sip:%s@%s)\n", session->account.username, local_ip);
 	char sip_url[128];
 	char sips_url[128];
@@ -4677,7 +4874,7 @@ gpointer janus_sip_sofia_thread(gpointer user_data) {
 		g_strlcat(outbound_options, " options-keepalive", sizeof(outbound_options));
 	if(!behind_nat)
 		g_strlcat(outbound_options, " no-natify", sizeof(outbound_options));
-	session->stack->s_nua = nua_create(session->stack->s_root,
+	nua_t *nua = nua_create(session->stack->s_root,
 				janus_sip_sofia_callback,
 				session,
 				SIPTAG_ALLOW_STR("INVITE, ACK, BYE, CANCEL, OPTIONS, UPDATE, MESSAGE, INFO"),
@@ -4689,17 +4886,280 @@ gpointer janus_sip_sofia_thread(gpointer user_data) {
 				NUTAG_OUTBOUND(outbound_options),
 				SIPTAG_SUPPORTED(NULL),
 				TAG_NULL());
+	/* Wake up whoever's waiting for the NUA to be ready */
+	janus_mutex_lock(&stacks_mutex);
+	session->stack->s_nua = nua;
+	janus_condition_broadcast(&stacks_cond);
+	janus_mutex_unlock(&stacks_mutex);
+}
+
+/* Get rid of the NUA of an account, and of its stack */
+static void janus_sip_stack_destroy_nua(janus_sip_session *session) {
+	ssip_t *stack = session->stack;
+	janus_sip_stack_transaction_done(session, &stack->register_started);
+	janus_sip_stack_transaction_done(session, &stack->invite_started);
+	nua_destroy(stack->s_nua);
+	if(stack->loop == NULL) {
+		/* The root was ours */
+		su_root_destroy(stack->s_root);
+	}
+	stack->s_root = NULL;
+	su_home_deinit(stack->s_home);
+	su_home_unref(stack->s_home);
+	g_free(stack);
+	session->stack = NULL;
+}
+
+/* Wait (at most two seconds) for the NUA of an account to be ready */
+static gboolean janus_sip_stack_wait_nua(janus_sip_session *session) {
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += 2;
+	gboolean ready = FALSE;
+	int res = 0;
+	janus_mutex_lock(&stacks_mutex);
+	while(!(ready = (session->stack != NULL && session->stack->s_nua != NULL)) && res != ETIMEDOUT) {
+		res = janus_condition_timedwait(&stacks_cond, &stacks_mutex, &deadline);
+	}
+	janus_mutex_unlock(&stacks_mutex);
+	return ready;
+}
+
+/* Sofia Event thread */
+gpointer janus_sip_sofia_thread(gpointer user_data) {
+	janus_sip_session *session = (janus_sip_session *)user_data;
+	if(session == NULL) {
+		g_thread_unref(g_thread_self());
+		return NULL;
+	}
+	if(session->account.username == NULL) {
+		janus_refcount_decrease(&session->ref);
+		g_thread_unref(g_thread_self());
+		return NULL;
+	}
+	JANUS_LOG(LOG_VERB, "Joining sofia loop thread (%s)...\n", session->account.username);
+	session->stack = g_malloc0(sizeof(ssip_t));
+	session->stack->session = session;
+	session->stack->s_nua = NULL;
+	session->stack->s_nh_r = NULL;
+	session->stack->s_nh_i = NULL;
+	session->stack->s_root = su_root_create(session->stack);
+	su_home_init(session->stack->s_home);
+	janus_sip_stack_create_nua(session);
 	su_root_run(session->stack->s_root);
 	/* When we get here, we're done */
-	nua_destroy(session->stack->s_nua);
-	su_root_destroy(session->stack->s_root);
-	session->stack->s_root = NULL;
-	su_home_deinit(session->stack->s_home);
-	su_home_unref(session->stack->s_home);
-	g_free(session->stack);
-	session->stack = NULL;
+	janus_sip_stack_destroy_nua(session);
 	janus_refcount_decrease(&session->ref);
 	JANUS_LOG(LOG_VERB, "Leaving sofia loop thread...\n");
 	g_thread_unref(g_thread_self());
 	return NULL;
 }
+
+/* Shared Sofia stacks */
+static void janus_sip_stack_loop_push(janus_sip_stack_loop *loop, janus_sip_stack_request *request) {
+	g_async_queue_push(loop->requests, request);
+	int code = 1;
+	ssize_t res = 0;
+	do {
+		res = write(loop->wakefd[1], &code, sizeof(int));
+	} while(res == -1 && errno == EINTR);
+}
+
+static void janus_sip_stack_loop_add(janus_sip_session *session) {
+	/* Pick the stack with the fewest accounts */
+	janus_sip_stack_loop *loop = &stack_loops[0];
+	int i = 0;
+	for(i=1; i<num_stack_loops; i++) {
+		if(g_atomic_int_get(&stack_loops[i].accounts) < g_atomic_int_get(&loop->accounts))
+			loop = &stack_loops[i];
+	}
+	JANUS_LOG(LOG_VERB, "Creating account %s on shared sofia stack #%d\n", session->account.username, loop->index);
+	janus_refcount_increase(&session->ref);
+	g_atomic_int_inc(&loop->accounts);
+	ssip_t *stack = g_malloc0(sizeof(ssip_t));
+	stack->session = session;
+	stack->loop = loop;
+	su_home_init(stack->s_home);
+	session->stack = stack;
+	janus_sip_stack_request *request = g_malloc(sizeof(janus_sip_stack_request));
+	request->type = janus_sip_stack_request_create;
+	request->session = session;
+	janus_sip_stack_loop_push(loop, request);
+}
+
+static void janus_sip_stack_loop_remove(janus_sip_session *session) {
+	janus_sip_stack_request *request = g_malloc(sizeof(janus_sip_stack_request));
+	request->type = janus_sip_stack_request_destroy;
+	request->session = session;
+	janus_sip_stack_loop_push(session->stack->loop, request);
+}
+
+/* Invoked by the root of a shared stack when there are new requests for it */
+static int janus_sip_stack_loop_wakeup(ssip_t *magic, su_wait_t *w, su_wakeup_arg_t *arg) {
+	janus_sip_stack_loop *loop = (janus_sip_stack_loop *)arg;
+	int code = 0;
+	while(read(loop->wakefd[0], &code, sizeof(int)) > 0);
+	janus_sip_stack_request *request = NULL;
+	while((request = g_async_queue_try_pop(loop->requests)) != NULL) {
+		if(request == &stack_exit_request) {
+			su_root_break(loop->root);
+			continue;
+		}
+		janus_sip_session *session = request->session;
+		if(request->type == janus_sip_stack_request_create) {
+			session->stack->s_root = loop->root;
+			janus_sip_stack_create_nua(session);
+		} else {
+			janus_sip_stack_destroy_nua(session);
+			g_atomic_int_add(&loop->accounts, -1);
+			JANUS_LOG(LOG_VERB, "Account %s removed from shared sofia stack #%d\n",
+				session->account.username, loop->index);
+			janus_refcount_decrease(&session->ref);
+		}
+		g_free(request);
+	}
+	return 0;
+}
+
+static void *janus_sip_stack_loop_thread(void *data) {
+	janus_sip_stack_loop *loop = (janus_sip_stack_loop *)data;
+	JANUS_LOG(LOG_VERB, "Joining shared sofia stack #%d...\n", loop->index);
+	loop->root = su_root_create(NULL);
+	if(loop->root == NULL) {
+		JANUS_LOG(LOG_ERR, "Couldn't create the root of shared sofia stack #%d...\n", loop->index);
+		return NULL;
+	}
+	/* Have the NUA instances run in this thread too, rather than each in a thread of its own */
+	su_root_threading(loop->root, 0);
+	su_wait_create(loop->wait, loop->wakefd[0], SU_WAIT_IN);
+	su_root_register(loop->root, loop->wait, janus_sip_stack_loop_wakeup, (su_wakeup_arg_t *)loop, 0);
+	su_root_run(loop->root);
+	/* When we get here, we're shutting down: if there are accounts left
+	 * (which we don't destroy cleanly, as in the thread per account case),
+	 * we leave the root alone, as their NUA instances still refer to it */
+	if(g_atomic_int_get(&loop->accounts) == 0)
+		su_root_destroy(loop->root);
+	loop->root = NULL;
+	JANUS_LOG(LOG_VERB, "Leaving shared sofia stack #%d...\n", loop->index);
+	return NULL;
+}
+
+static gint64 janus_sip_stack_loop_accounts(gpointer data) {
+	return g_atomic_int_get(&((janus_sip_stack_loop *)data)->accounts);
+}
+
+static gint64 janus_sip_stack_loop_pending(gpointer data) {
+	return g_atomic_int_get(&((janus_sip_stack_loop *)data)->pending);
+}
+
+static int janus_sip_stack_loops_start(int count) {
+	stack_loops = g_malloc0(count * sizeof(janus_sip_stack_loop));
+	int i = 0, j = 0;
+	for(i=0; i<count; i++) {
+		janus_sip_stack_loop *loop = &stack_loops[i];
+		loop->index = i;
+		if(pipe(loop->wakefd) < 0) {
+			JANUS_LOG(LOG_ERR, "Error creating pipe for shared sofia stack #%d: %d (%s)\n", i, errno, strerror(errno));
+			break;
+		}
+		fcntl(loop->wakefd[0], F_SETFL, O_NONBLOCK);
+		loop->requests = g_async_queue_new();
+		char labels[64], le_labels[96];
+		g_snprintf(labels, sizeof(labels), "stack=\"%d\"", i);
+		loop->accounts_metric = janus_metric_register_callback("janus_sip_stack_accounts", labels,
+			"Accounts created on each shared Sofia stack", janus_metric_gauge,
+			janus_sip_stack_loop_accounts, loop);
+		loop->pending_metric = janus_metric_register_callback("janus_sip_stack_pending", labels,
+			"REGISTER and INVITE transactions still waiting for a response, per shared Sofia stack", janus_metric_gauge,
+			janus_sip_stack_loop_pending, loop);
+		for(j=0; j<=JANUS_SIP_LATENCY_BUCKETS; j++) {
+			if(j < JANUS_SIP_LATENCY_BUCKETS)
+				g_snprintf(le_labels, sizeof(le_labels), "%s,le=\"%d\"", labels, janus_sip_latency_buckets[j]);
+			else
+				g_snprintf(le_labels, sizeof(le_labels), "%s,le=\"+Inf\"", labels);
+			loop->latency[j] = janus_metric_register("janus_sip_transaction_latency_ms_bucket", le_labels,
+				"Time it took to get a response to REGISTER and INVITE transactions, in milliseconds (cumulative)",
+				janus_metric_counter);
+		}
+		loop->latency_sum = janus_metric_register("janus_sip_transaction_latency_ms_sum", labels,
+			"Time it took to get a response to REGISTER and INVITE transactions, in milliseconds (sum)",
+			janus_metric_counter);
+		loop->latency_count = janus_metric_register("janus_sip_transaction_latency_ms_count", labels,
+			"REGISTER and INVITE transactions that got a response", janus_metric_counter);
+		num_stack_loops++;
+		GError *error = NULL;
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "sip stack %d", i);
+		loop->thread = g_thread_try_new(tname, janus_sip_stack_loop_thread, loop, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch shared sofia stack #%d...\n",
+				error->code, error->message ? error->message : "??", i);
+			g_error_free(error);
+			loop->thread = NULL;
+			break;
+		}
+	}
+	if(num_stack_loops < count || stack_loops[count-1].thread == NULL) {
+		janus_sip_stack_loops_stop();
+		return -1;
+	}
+	JANUS_LOG(LOG_INFO, "Started %d shared sofia stacks\n", count);
+	return 0;
+}
+
+static void janus_sip_stack_loops_stop(void) {
+	if(stack_loops == NULL)
+		return;
+	int i = 0, j = 0;
+	for(i=0; i<num_stack_loops; i++) {
+		janus_sip_stack_loop *loop = &stack_loops[i];
+		if(loop->thread != NULL) {
+			janus_sip_stack_loop_push(loop, &stack_exit_request);
+			g_thread_join(loop->thread);
+			loop->thread = NULL;
+		}
+		janus_metric_unregister(loop->accounts_metric);
+		janus_metric_unregister(loop->pending_metric);
+		for(j=0; j<=JANUS_SIP_LATENCY_BUCKETS; j++)
+			janus_metric_unregister(loop->latency[j]);
+		janus_metric_unregister(loop->latency_sum);
+		janus_metric_unregister(loop->latency_count);
+		janus_sip_stack_request *request = NULL;
+		while((request = g_async_queue_try_pop(loop->requests)) != NULL) {
+			if(request != &stack_exit_request)
+				g_free(request);
+		}
+		g_async_queue_unref(loop->requests);
+		close(loop->wakefd[0]);
+		close(loop->wakefd[1]);
+	}
+	g_free(stack_loops);
+	stack_loops = NULL;
+	num_stack_loops = 0;
+}
+
+/* Keep track of how long SIP transactions take on shared stacks */
+static void janus_sip_stack_transaction_started(janus_sip_session *session, gint64 *started) {
+	if(session->stack == NULL || session->stack->loop == NULL)
+		return;
+	if(*started == 0)
+		g_atomic_int_inc(&session->stack->loop->pending);
+	*started = janus_get_monotonic_time();
+}
+
+static void janus_sip_stack_transaction_done(janus_sip_session *session, gint64 *started) {
+	if(session->stack == NULL || session->stack->loop == NULL || *started == 0)
+		return;
+	janus_sip_stack_loop *loop = session->stack->loop;
+	gint64 latency = (janus_get_monotonic_time() - *started)/1000;
+	*started = 0;
+	g_atomic_int_add(&loop->pending, -1);
+	int i = 0;
+	for(i=0; i<JANUS_SIP_LATENCY_BUCKETS; i++) {
+		if(latency <= janus_sip_latency_buckets[i])
+			janus_metric_inc(loop->latency[i]);
+	}
+	janus_metric_inc(loop->latency[JANUS_SIP_LATENCY_BUCKETS]);
+	janus_metric_add(loop->latency_sum, latency);
+	janus_metric_inc(loop->latency_count);
+}
@@ -15,7 +15,9 @@
  * SIP plugin. The API it exposes is exactly the same, meaning it should
  * be pretty straightforward to switch from one plugin to another on the
  * client side. The configuration file looks exactly the same as well.
- * As such, you can mostly refer to the \ref sip for both.
+ * As such, you can mostly refer to the \ref sip for both, including the
+ * \c relay_loops property to relay media in a few shared loops rather
+ * than in a thread per call.
  *
  * \section sipapi SIPre Plugin API
  *
@@ -85,6 +87,7 @@
 #include "../rtcp.h"
 #include "../sdp-utils.h"
 #include "../utils.h"
+#include "../relay-loop.h"
 #include "../ip-utils.h"
 
 
@@ -210,6 +213,8 @@ static char *user_agent;
 static uint32_t register_ttl = JANUS_DEFAULT_REGISTER_TTL;
 static uint16_t rtp_range_min = 10000;
 static uint16_t rtp_range_max = 60000;
+static int relay_loops = 0;
+static janus_relay_pool *relay_pool = NULL;
 
 static GThread *handler_thread;
 static void *janus_sipre_handler(void *data);
@@ -488,6 +493,12 @@ typedef struct janus_sipre_media {
 	janus_rtp_switching_context context;
 	int pipefd[2];
 	gboolean updated;
+	/* Relaying state, owned by the relay thread or loop */
+	struct sockaddr_in server_addr;
+	int astep, vstep;
+	guint32 ats, vts;
+	int pollerrs;
+	guint64 relay_id;
 } janus_sipre_media;
 
 struct janus_sipre_session {
@@ -904,6 +915,7 @@ char *janus_sipre_sdp_manipulate(janus_sipre_session *session, janus_sdp *sdp, g
 /* Media */
 static int janus_sipre_allocate_local_ports(janus_sipre_session *session);
 static void *janus_sipre_relay_thread(void *data);
+static void janus_sipre_relay_start(janus_sipre_session *session);
 
 
 /* Error codes */
@@ -1042,6 +1054,15 @@ int janus_sipre_init(janus_callbacks *callback, const char *config_path) {
 			JANUS_LOG(LOG_VERB, "SIPre RTP/RTCP port range: %u -- %u\n", rtp_range_min, rtp_range_max);
 		}
 
+		item = janus_config_get_item_drilldown(config, "general", "relay_loops");
+		if(item && item->value) {
+			relay_loops = atoi(item->value);
+			if(relay_loops < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid number of relay loops (%d), using a thread per call\n", relay_loops);
+				relay_loops = 0;
+			}
+		}
+
 		item = janus_config_get_item_drilldown(config, "general", "events");
 		if(item != NULL && item->value != NULL) {
 			notify_events = janus_is_true(item->value);
@@ -1078,6 +1099,13 @@ int janus_sipre_init(janus_callbacks *callback, const char *config_path) {
 
 	g_atomic_int_set(&initialized, 1);
 
+	if(relay_loops > 0) {
+		/* Relay media from SIP peers in a few shared loops, rather than in a thread per call */
+		relay_pool = janus_relay_pool_create("sipre", relay_loops);
+		if(relay_pool == NULL)
+			JANUS_LOG(LOG_WARN, "Couldn't start the relay loops, using a thread per call\n");
+	}
+
 	GError *error = NULL;
 	/* Launch the thread that will handle incoming API messages */
 	handler_thread = g_thread_try_new("sipre handler", janus_sipre_handler, NULL, &error);
@@ -1124,6 +1152,9 @@ void janus_sipre_destroy(void) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+	/* Stop the relay loops, if any: this releases the calls they were handling */
+	janus_relay_pool_destroy(relay_pool);
+	relay_pool = NULL;
 
 	/* Break the libre loop */
 	mqueue_push(mq, janus_sipre_mqueue_event_do_exit, NULL);
@@ -1252,6 +1283,7 @@ void janus_sipre_create_session(janus_plugin_session *handle, int *error) {
 	session->media.pipefd[0] = -1;
 	session->media.pipefd[1] = -1;
 	session->media.updated = FALSE;
+	session->media.relay_id = 0;
 	janus_mutex_init(&session->rec_mutex);
 	g_atomic_int_set(&session->destroyed, 0);
 	g_atomic_int_set(&session->hangingup, 0);
@@ -1318,6 +1350,9 @@ json_t *janus_sipre_query_session(janus_plugin_session *handle) {
 		json_object_set_new(info, "srtp-required", json_string(session->media.require_srtp ? "yes" : "no"));
 		json_object_set_new(info, "sdes-local", json_string(session->media.has_srtp_local ? "yes" : "no"));
 		json_object_set_new(info, "sdes-remote", json_string(session->media.has_srtp_remote ? "yes" : "no"));
+		guint64 relay_id = session->media.relay_id;
+		if(relay_id > 0)
+			json_object_set_new(info, "relay-loop", json_integer(janus_relay_pool_loop_index(relay_id)));
 	}
 	if(session->arc || session->vrc || session->arc_peer || session->vrc_peer) {
 		json_t *recording = json_object();
@@ -2247,15 +2282,7 @@ static void *janus_sipre_handler(void *data) {
 			if(answer) {
 				/* Start the media */
 				session->media.ready = TRUE;	/* FIXME Maybe we need a better way to signal this */
-				GError *error = NULL;
-				char tname[16];
-				g_snprintf(tname, sizeof(tname), "siprertp %s", session->account.username);
-				janus_refcount_increase(&session->ref);
-				g_thread_try_new(tname, janus_sipre_relay_thread, session, &error);
-				if(error != NULL) {
-					janus_refcount_decrease(&session->ref);
-					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n", error->code, error->message ? error->message : "??");
-				}
+				janus_sipre_relay_start(session);
 			}
 		} else if(!strcasecmp(request_text, "update")) {
 			/* Update an existing call */
@@ -2888,7 +2915,10 @@ void janus_sipre_sdp_process(janus_sipre_session *session, janus_sdp *sdp, gbool
 	if(update && changed && *changed) {
 		/* Something changed: mark this on the session, so that the thread can update the sockets */
 		session->media.updated = TRUE;
-		if(session->media.pipefd[1] > 0) {
+		if(session->media.relay_id > 0) {
+			/* The call is handled by the relay loops */
+			janus_relay_pool_wakeup(relay_pool, session->media.relay_id);
+		} else if(session->media.pipefd[1] > 0) {
 			int code = 1;
 			ssize_t res = 0;
 			do {
@@ -2906,7 +2936,7 @@ char *janus_sipre_sdp_manipulate(janus_sipre_session *session, janus_sdp *sdp, g
 	GList *temp = sdp->m_lines;
 	while(temp) {
 		janus_sdp_mline *m = (janus_sdp_mline *)temp->data;
-		g_free(m->proto);
+		janus_sdp_arena_free_string(m->arena, m->proto);
 		m->proto = g_strdup(session->media.require_srtp ? "RTP/SAVP" : "RTP/AVP");
 		if(m->type == JANUS_SDP_AUDIO) {
 			m->port = session->media.local_audio_rtp_port;
@@ -2931,7 +2961,7 @@ char *janus_sipre_sdp_manipulate(janus_sipre_session *session, janus_sdp *sdp, g
 				m->attributes = g_list_append(m->attributes, a);
 			}
 		}
-		g_free(m->c_addr);
+		janus_sdp_arena_free_string(m->arena, m->c_addr);
 		m->c_addr = g_strdup(local_ip);
 		if(answer && (m->type == JANUS_SDP_AUDIO || m->type == JANUS_SDP_VIDEO)) {
 			/* Check which codec was negotiated eventually */
@@ -3135,38 +3165,228 @@ static void janus_sipre_connect_sockets(janus_sipre_session *session, struct soc
 
 }
 
-/* Thread to relay RTP/RTCP frames coming from the SIPre peer */
-static void *janus_sipre_relay_thread(void *data) {
-	janus_sipre_session *session = (janus_sipre_session *)data;
-	if(!session) {
-		g_thread_unref(g_thread_self());
-		return NULL;
-	}
-	if(!session->account.username || !session->callee) {
-		janus_refcount_decrease(&session->ref);
-		g_thread_unref(g_thread_self());
-		return NULL;
-	}
-	JANUS_LOG(LOG_VERB, "Starting relay thread (%s <--> %s)\n", session->account.username, session->callee);
+/* Prepare the relaying of RTP/RTCP frames coming from the SIPre peer: this
+ * is shared by the per-call relay threads and the relay loops */
+static gboolean janus_sipre_relay_setup(janus_sipre_session *session) {
+	if(!session->account.username || !session->callee)
+		return FALSE;
+	JANUS_LOG(LOG_VERB, "Starting relay (%s <--> %s)\n", session->account.username, session->callee);
+	session->media.astep = 0;
+	session->media.vstep = 0;
+	session->media.ats = 0;
+	session->media.vts = 0;
+	session->media.pollerrs = 0;
 
 	gboolean have_server_ip = TRUE;
-	struct sockaddr_in server_addr;
-	memset(&server_addr, 0, sizeof(server_addr));
-	server_addr.sin_family = AF_INET;
-	if(inet_aton(session->media.remote_ip, &server_addr.sin_addr) == 0) {	/* Not a numeric IP... */
+	struct sockaddr_in *server_addr = &session->media.server_addr;
+	memset(server_addr, 0, sizeof(*server_addr));
+	server_addr->sin_family = AF_INET;
+	if(inet_aton(session->media.remote_ip, &server_addr->sin_addr) == 0) {	/* Not a numeric IP... */
 		struct hostent *host = gethostbyname(session->media.remote_ip);	/* ...resolve name */
 		if(!host) {
 			JANUS_LOG(LOG_ERR, "[SIPre-%s] Couldn't get host (%s)\n", session->account.username, session->media.remote_ip);
 			have_server_ip = FALSE;
 		} else {
-			server_addr.sin_addr = *(struct in_addr *)host->h_addr_list;
+			server_addr->sin_addr = *(struct in_addr *)host->h_addr_list;
 		}
 	}
 	if(have_server_ip)
-		janus_sipre_connect_sockets(session, &server_addr);
+		janus_sipre_connect_sockets(session, server_addr);
 
 	if(!session->callee) {
-		JANUS_LOG(LOG_VERB, "[SIPre-%s] Leaving thread, no callee...\n", session->account.username);
+		JANUS_LOG(LOG_VERB, "[SIPre-%s] Leaving relay, no callee...\n", session->account.username);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Check if we should keep on relaying, and apply session updates, if any */
+static gboolean janus_sipre_relay_active(janus_sipre_session *session) {
+	if(session == NULL || g_atomic_int_get(&session->destroyed) ||
+			session->status <= janus_sipre_call_status_idle ||
+			session->status >= janus_sipre_call_status_closing)	/* FIXME We need a per-call watchdog as well */
+		return FALSE;
+	if(session->media.updated) {
+		/* Apparently there was a session update */
+		if(session->media.remote_ip != NULL && (inet_aton(session->media.remote_ip, &session->media.server_addr.sin_addr) != 0)) {
+			janus_sipre_connect_sockets(session, &session->media.server_addr);
+		} else {
+			JANUS_LOG(LOG_ERR, "[SIPre-%s] Couldn't update session details (missing or invalid remote IP address)\n", session->account.username);
+		}
+		session->media.updated = FALSE;
+	}
+	return TRUE;
+}
+
+/* Handle an error on one of the RTP/RTCP sockets: returns a negative
+ * integer if it's bad enough that the call should be considered over */
+static int janus_sipre_relay_error(janus_sipre_session *session, int fd, int error) {
+	if(error == 0) {
+		/* Maybe not a breaking error after all? */
+		return 0;
+	} else if(error == 111) {
+		/* ICMP error? If it's related to RTCP, let's just close the RTCP socket and move on */
+		if(fd == session->media.audio_rtcp_fd) {
+			JANUS_LOG(LOG_WARN, "[SIPre-%s] Got a '%s' on the audio RTCP socket, closing it\n",
+				session->account.username, strerror(error));
+			janus_relay_pool_remove_fd(relay_pool, session->media.relay_id, fd);
+			close(session->media.audio_rtcp_fd);
+			session->media.audio_rtcp_fd = -1;
+			return 0;
+		} else if(fd == session->media.video_rtcp_fd) {
+			JANUS_LOG(LOG_WARN, "[SIPre-%s] Got a '%s' on the video RTCP socket, closing it\n",
+				session->account.username, strerror(error));
+			janus_relay_pool_remove_fd(relay_pool, session->media.relay_id, fd);
+			close(session->media.video_rtcp_fd);
+			session->media.video_rtcp_fd = -1;
+			return 0;
+		}
+	}
+	/* FIXME Should we be more tolerant of ICMP errors on RTP sockets as well? */
+	session->media.pollerrs++;
+	if(session->media.pollerrs < 100)
+		return 0;
+	JANUS_LOG(LOG_ERR, "[SIPre-%s] Too many errors polling socket %d\n", session->account.username, fd);
+	JANUS_LOG(LOG_ERR, "[SIPre-%s]   -- %d (%s)\n", session->account.username, error, strerror(error));
+	/* Can we assume it's pretty much over, after a POLLERR? */
+	/* FIXME Simulate a "hangup" coming from the browser */
+	janus_sipre_message *msg = g_malloc(sizeof(janus_sipre_message));
+	msg->handle = session->handle;
+	msg->message = json_pack("{ss}", "request", "hangup");
+	msg->transaction = NULL;
+	msg->jsep = NULL;
+	g_async_queue_push(messages, msg);
+	return -1;
+}
+
+/* Handle an RTP/RTCP packet received from the SIPre peer */
+static void janus_sipre_relay_incoming(janus_sipre_session *session, int fd, char *buffer, int bytes) {
+	/* Let's check what this is */
+	gboolean video = fd == session->media.video_rtp_fd || fd == session->media.video_rtcp_fd;
+	gboolean rtcp = fd == session->media.audio_rtcp_fd || fd == session->media.video_rtcp_fd;
+	if(!rtcp) {
+		/* Audio or Video RTP */
+		session->media.pollerrs = 0;
+		rtp_header *header = (rtp_header *)buffer;
+		if((video && session->media.video_ssrc_peer != ntohl(header->ssrc)) ||
+				(!video && session->media.audio_ssrc_peer != ntohl(header->ssrc))) {
+			if(video) {
+				session->media.video_ssrc_peer = ntohl(header->ssrc);
+			} else {
+				session->media.audio_ssrc_peer = ntohl(header->ssrc);
+			}
+			JANUS_LOG(LOG_VERB, "[SIPre-%s] Got SIP peer %s SSRC: %"SCNu32"\n",
+				session->account.username ? session->account.username : "unknown",
+				video ? "video" : "audio", session->media.audio_ssrc_peer);
+		}
+		/* Is this SRTP? */
+		if(session->media.has_srtp_remote) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect(
+				(video ? session->media.video_srtp_in : session->media.audio_srtp_in),
+				buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				guint32 timestamp = ntohl(header->timestamp);
+				guint16 seq = ntohs(header->seq_number);
+				JANUS_LOG(LOG_ERR, "[SIPre-%s] %s SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
+					session->account.username ? session->account.username : "unknown",
+					video ? "Video" : "Audio", janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
+				return;
+			}
+			bytes = buflen;
+		}
+		/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
+		guint32 timestamp = ntohl(header->timestamp);
+		janus_rtp_header_update(header, &session->media.context, video,
+			(video ? (session->media.vstep ? session->media.vstep : 4500) : (session->media.astep ? session->media.astep : 960)));
+		if(video) {
+			if(session->media.vts == 0) {
+				session->media.vts = timestamp;
+			} else if(session->media.vstep == 0) {
+				session->media.vstep = timestamp-session->media.vts;
+				if(session->media.vstep < 0) {
+					session->media.vstep = 0;
+				}
+			}
+		} else {
+			if(session->media.ats == 0) {
+				session->media.ats = timestamp;
+			} else if(session->media.astep == 0) {
+				session->media.astep = timestamp-session->media.ats;
+				if(session->media.astep < 0) {
+					session->media.astep = 0;
+				}
+			}
+		}
+		/* Save the frame if we're recording */
+		janus_recorder_save_frame(video ? session->vrc_peer : session->arc_peer, buffer, bytes);
+		/* Relay to browser */
+		gateway->relay_rtp(session->handle, video, buffer, bytes);
+	} else {
+		/* Audio or Video RTCP */
+		if(session->media.has_srtp_remote) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect_rtcp(
+				(video ? session->media.video_srtp_in : session->media.audio_srtp_in),
+				buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				JANUS_LOG(LOG_ERR, "[SIPre-%s] %s SRTCP unprotect error: %s (len=%d-->%d)\n",
+					session->account.username ? session->account.username : "unknown",
+					video ? "Video" : "Audio", janus_srtp_error_str(res), bytes, buflen);
+				return;
+			}
+			bytes = buflen;
+		}
+		/* Relay to browser */
+		gateway->relay_rtcp(session->handle, video, buffer, bytes);
+	}
+}
+
+/* Close the RTP/RTCP sockets and clean up when we're done relaying */
+static void janus_sipre_relay_cleanup(janus_sipre_session *session) {
+	session->media.relay_id = 0;
+	if(session->media.audio_rtp_fd != -1) {
+		close(session->media.audio_rtp_fd);
+		session->media.audio_rtp_fd = -1;
+	}
+	if(session->media.audio_rtcp_fd != -1) {
+		close(session->media.audio_rtcp_fd);
+		session->media.audio_rtcp_fd = -1;
+	}
+	session->media.local_audio_rtp_port = 0;
+	session->media.local_audio_rtcp_port = 0;
+	session->media.audio_ssrc = 0;
+	if(session->media.video_rtp_fd != -1) {
+		close(session->media.video_rtp_fd);
+		session->media.video_rtp_fd = -1;
+	}
+	if(session->media.video_rtcp_fd != -1) {
+		close(session->media.video_rtcp_fd);
+		session->media.video_rtcp_fd = -1;
+	}
+	session->media.local_video_rtp_port = 0;
+	session->media.local_video_rtcp_port = 0;
+	session->media.video_ssrc = 0;
+	if(session->media.pipefd[0] > 0) {
+		close(session->media.pipefd[0]);
+		session->media.pipefd[0] = -1;
+	}
+	if(session->media.pipefd[1] > 0) {
+		close(session->media.pipefd[1]);
+		session->media.pipefd[1] = -1;
+	}
+	/* Clean up SRTP stuff, if needed */
+	janus_sipre_srtp_cleanup(session);
+}
+
+/* Thread to relay RTP/RTCP frames coming from the SIPre peer */
+static void *janus_sipre_relay_thread(void *data) {
+	janus_sipre_session *session = (janus_sipre_session *)data;
+	if(!session) {
+		g_thread_unref(g_thread_self());
+		return NULL;
+	}
+	if(!janus_sipre_relay_setup(session)) {
 		janus_refcount_decrease(&session->ref);
 		g_thread_unref(g_thread_self());
 		return NULL;
@@ -3174,7 +3394,7 @@ static void *janus_sipre_relay_thread(void *data) {
 	/* File descriptors */
 	socklen_t addrlen;
 	struct sockaddr_in remote;
-	int resfd = 0, bytes = 0, pollerrs = 0;
+	int resfd = 0, bytes = 0;
 	struct pollfd fds[5];
 	int pipe_fd = session->media.pipefd[0];
 	char buffer[1500];
@@ -3182,22 +3402,7 @@ static void *janus_sipre_relay_thread(void *data) {
 	/* Loop */
 	int num = 0;
 	gboolean goon = TRUE;
-	int astep = 0, vstep = 0;
-	guint32 ats = 0, vts = 0;
-	while(goon && session != NULL && !g_atomic_int_get(&session->destroyed) &&
-			session->status > janus_sipre_call_status_idle &&
-			session->status < janus_sipre_call_status_closing) {	/* FIXME We need a per-call watchdog as well */
-
-		if(session->media.updated) {
-			/* Apparently there was a session update */
-			if(session->media.remote_ip != NULL && (inet_aton(session->media.remote_ip, &server_addr.sin_addr) != 0)) {
-				janus_sipre_connect_sockets(session, &server_addr);
-			} else {
-				JANUS_LOG(LOG_ERR, "[SIPre-%s] Couldn't update session details (missing or invalid remote IP address)\n", session->account.username);
-			}
-			session->media.updated = FALSE;
-		}
-
+	while(goon && janus_sipre_relay_active(session)) {
 		/* Prepare poll */
 		num = 0;
 		if(session->media.audio_rtp_fd != -1) {
@@ -3258,42 +3463,10 @@ static void *janus_sipre_relay_thread(void *data) {
 				int error = 0;
 				socklen_t errlen = sizeof(error);
 				getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, (void *)&error, &errlen);
-				if(error == 0) {
-					/* Maybe not a breaking error after all? */
-					continue;
-				} else if(error == 111) {
-					/* ICMP error? If it's related to RTCP, let's just close the RTCP socket and move on */
-					if(fds[i].fd == session->media.audio_rtcp_fd) {
-						JANUS_LOG(LOG_WARN, "[SIPre-%s] Got a '%s' on the audio RTCP socket, closing it\n",
-							session->account.username, strerror(error));
-						close(session->media.audio_rtcp_fd);
-						session->media.audio_rtcp_fd = -1;
-						continue;
-					} else if(fds[i].fd == session->media.video_rtcp_fd) {
-						JANUS_LOG(LOG_WARN, "[SIPre-%s] Got a '%s' on the video RTCP socket, closing it\n",
-							session->account.username, strerror(error));
-						close(session->media.video_rtcp_fd);
-						session->media.video_rtcp_fd = -1;
-						continue;
-					}
+				if(janus_sipre_relay_error(session, fds[i].fd, error) < 0) {
+					goon = FALSE;
+					break;
 				}
-				/* FIXME Should we be more tolerant of ICMP errors on RTP sockets as well? */
-				pollerrs++;
-				if(pollerrs < 100)
-					continue;
-				JANUS_LOG(LOG_ERR, "[SIPre-%s] Too many errors polling %d (socket #%d): %s...\n", session->account.username,
-					fds[i].fd, i, fds[i].revents & POLLERR ? "POLLERR" : "POLLHUP");
-				JANUS_LOG(LOG_ERR, "[SIPre-%s]   -- %d (%s)\n", session->account.username, error, strerror(error));
-				/* Can we assume it's pretty much over, after a POLLERR? */
-				goon = FALSE;
-				/* FIXME Simulate a "hangup" coming from the browser */
-				janus_sipre_message *msg = g_malloc(sizeof(janus_sipre_message));
-				msg->handle = session->handle;
-				msg->message = json_pack("{ss}", "request", "hangup");
-				msg->transaction = NULL;
-				msg->jsep = NULL;
-				g_async_queue_push(messages, msg);
-				break;
 			} else if(fds[i].revents & POLLIN) {
 				if(pipe_fd != -1 && fds[i].fd == pipe_fd) {
 					/* Poll interrupted for a reason, go on */
@@ -3308,122 +3481,11 @@ static void *janus_sipre_relay_thread(void *data) {
 					/* Failed to read? */
 					continue;
 				}
-				/* Let's check what this is */
-				gboolean video = fds[i].fd == session->media.video_rtp_fd || fds[i].fd == session->media.video_rtcp_fd;
-				gboolean rtcp = fds[i].fd == session->media.audio_rtcp_fd || fds[i].fd == session->media.video_rtcp_fd;
-				if(!rtcp) {
-					/* Audio or Video RTP */
-					pollerrs = 0;
-					rtp_header *header = (rtp_header *)buffer;
-					if((video && session->media.video_ssrc_peer != ntohl(header->ssrc)) ||
-							(!video && session->media.audio_ssrc_peer != ntohl(header->ssrc))) {
-						if(video) {
-							session->media.video_ssrc_peer = ntohl(header->ssrc);
-						} else {
-							session->media.audio_ssrc_peer = ntohl(header->ssrc);
-						}
-						JANUS_LOG(LOG_VERB, "[SIPre-%s] Got SIP peer %s SSRC: %"SCNu32"\n",
-							session->account.username ? session->account.username : "unknown",
-							video ? "video" : "audio", session->media.audio_ssrc_peer);
-					}
-					/* Is this SRTP? */
-					if(session->media.has_srtp_remote) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect(
-							(video ? session->media.video_srtp_in : session->media.audio_srtp_in),
-							buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							guint32 timestamp = ntohl(header->timestamp);
-							guint16 seq = ntohs(header->seq_number);
-							JANUS_LOG(LOG_ERR, "[SIPre-%s] %s SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
-								session->account.username ? session->account.username : "unknown",
-								video ? "Video" : "Audio", janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
-					guint32 timestamp = ntohl(header->timestamp);
-					janus_rtp_header_update(header, &session->media.context, video,
-						(video ? (vstep ? vstep : 4500) : (astep ? astep : 960)));
-					if(video) {
-						if(vts == 0) {
-							vts = timestamp;
-						} else if(vstep == 0) {
-							vstep = timestamp-vts;
-							if(vstep < 0) {
-								vstep = 0;
-							}
-						}
-					} else {
-						if(ats == 0) {
-							ats = timestamp;
-						} else if(astep == 0) {
-							astep = timestamp-ats;
-							if(astep < 0) {
-								astep = 0;
-							}
-						}
-					}
-					/* Save the frame if we're recording */
-					janus_recorder_save_frame(video ? session->vrc_peer : session->arc_peer, buffer, bytes);
-					/* Relay to browser */
-					gateway->relay_rtp(session->handle, video, buffer, bytes);
-					continue;
-				} else {
-					/* Audio or Video RTCP */
-					if(session->media.has_srtp_remote) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect_rtcp(
-							(video ? session->media.video_srtp_in : session->media.audio_srtp_in),
-							buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							JANUS_LOG(LOG_ERR, "[SIPre-%s] %s SRTCP unprotect error: %s (len=%d-->%d)\n",
-								session->account.username ? session->account.username : "unknown",
-								video ? "Video" : "Audio", janus_srtp_error_str(res), bytes, buflen);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Relay to browser */
-					gateway->relay_rtcp(session->handle, video, buffer, bytes);
-					continue;
-				}
+				janus_sipre_relay_incoming(session, fds[i].fd, buffer, bytes);
 			}
 		}
 	}
-	if(session->media.audio_rtp_fd != -1) {
-		close(session->media.audio_rtp_fd);
-		session->media.audio_rtp_fd = -1;
-	}
-	if(session->media.audio_rtcp_fd != -1) {
-		close(session->media.audio_rtcp_fd);
-		session->media.audio_rtcp_fd = -1;
-	}
-	session->media.local_audio_rtp_port = 0;
-	session->media.local_audio_rtcp_port = 0;
-	session->media.audio_ssrc = 0;
-	if(session->media.video_rtp_fd != -1) {
-		close(session->media.video_rtp_fd);
-		session->media.video_rtp_fd = -1;
-	}
-	if(session->media.video_rtcp_fd != -1) {
-		close(session->media.video_rtcp_fd);
-		session->media.video_rtcp_fd = -1;
-	}
-	session->media.local_video_rtp_port = 0;
-	session->media.local_video_rtcp_port = 0;
-	session->media.video_ssrc = 0;
-	if(session->media.pipefd[0] > 0) {
-		close(session->media.pipefd[0]);
-		session->media.pipefd[0] = -1;
-	}
-	if(session->media.pipefd[1] > 0) {
-		close(session->media.pipefd[1]);
-		session->media.pipefd[1] = -1;
-	}
-	/* Clean up SRTP stuff, if needed */
-	janus_sipre_srtp_cleanup(session);
+	janus_sipre_relay_cleanup(session);
 	/* Done */
 	JANUS_LOG(LOG_VERB, "Leaving SIPre relay thread\n");
 	janus_refcount_decrease(&session->ref);
@@ -3431,6 +3493,64 @@ static void *janus_sipre_relay_thread(void *data) {
 	return NULL;
 }
 
+/* Callbacks for calls handled by the shared relay loops, rather than by a thread */
+static void janus_sipre_relay_loop_incoming(gpointer user_data, int fd, char *buf, int len) {
+	janus_sipre_relay_incoming((janus_sipre_session *)user_data, fd, buf, len);
+}
+
+static int janus_sipre_relay_loop_error(gpointer user_data, int fd, int error) {
+	janus_sipre_session *session = (janus_sipre_session *)user_data;
+	/* If we just updated the session, let's wait until things have calmed down */
+	if(session->media.updated)
+		return 0;
+	return janus_sipre_relay_error(session, fd, error);
+}
+
+static gboolean janus_sipre_relay_loop_check(gpointer user_data) {
+	return janus_sipre_relay_active((janus_sipre_session *)user_data);
+}
+
+static void janus_sipre_relay_loop_done(gpointer user_data) {
+	janus_sipre_session *session = (janus_sipre_session *)user_data;
+	janus_sipre_relay_cleanup(session);
+	JANUS_LOG(LOG_VERB, "[SIPre-%s] Call removed from the relay loops\n", session->account.username);
+	janus_refcount_decrease(&session->ref);
+}
+
+static janus_relay_callbacks janus_sipre_relay_callbacks = {
+	.incoming = janus_sipre_relay_loop_incoming,
+	.error = janus_sipre_relay_loop_error,
+	.check = janus_sipre_relay_loop_check,
+	.done = janus_sipre_relay_loop_done,
+};
+
+/* Start relaying media from the SIPre peer, either in the relay loops or in a dedicated thread */
+static void janus_sipre_relay_start(janus_sipre_session *session) {
+	janus_refcount_increase(&session->ref);
+	if(relay_pool != NULL) {
+		if(!janus_sipre_relay_setup(session)) {
+			janus_refcount_decrease(&session->ref);
+			return;
+		}
+		int fds[4] = { session->media.audio_rtp_fd, session->media.audio_rtcp_fd,
+			session->media.video_rtp_fd, session->media.video_rtcp_fd };
+		session->media.relay_id = janus_relay_pool_add(relay_pool, fds, 4, &janus_sipre_relay_callbacks, session);
+		if(session->media.relay_id == 0) {
+			JANUS_LOG(LOG_ERR, "[SIPre-%s] Couldn't add the call to the relay loops...\n", session->account.username);
+			janus_sipre_relay_cleanup(session);
+			janus_refcount_decrease(&session->ref);
+		}
+		return;
+	}
+	GError *error = NULL;
+	char tname[16];
+	g_snprintf(tname, sizeof(tname), "siprertp %s", session->account.username);
+	g_thread_try_new(tname, janus_sipre_relay_thread, session, &error);
+	if(error != NULL) {
+		janus_refcount_decrease(&session->ref);
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n", error->code, error->message ? error->message : "??");
+	}
+}
 
 /* libre loop thread */
 gpointer janus_sipre_stack_thread(gpointer user_data) {
@@ -3839,15 +3959,7 @@ int janus_sipre_cb_answer(const struct sip_msg *msg, void *arg) {
 		return 0;
 	}
 	if(!session->media.earlymedia && !session->media.update) {
-		GError *error = NULL;
-		char tname[16];
-		g_snprintf(tname, sizeof(tname), "siprertp %s", session->account.username);
-		janus_refcount_increase(&session->ref);
-		g_thread_try_new(tname, janus_sipre_relay_thread, session, &error);
-		if(error != NULL) {
-			janus_refcount_decrease(&session->ref);
-			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n", error->code, error->message ? error->message : "??");
-		}
+		janus_sipre_relay_start(session);
 	}
 	/* Send event back to the browser */
 	json_t *jsep = NULL;
@@ -51,9 +51,12 @@
  *
  * \verbatim
 [stream-name]
-type = rtp|live|ondemand|rtsp
+type = rtp|live|ondemand|rtsp|relay
        rtp = stream originated by an external tool (e.g., gstreamer or
              ffmpeg) and sent to the plugin via RTP
+       relay = same as rtp, but the RTP is sent by the Streaming plugin
+               of another Janus instance (the origin), which this
+               instance (the edge) subscribes to
        live = local file streamed live to multiple listeners
               (multiple listeners = same streaming context)
        ondemand = local file streamed on-demand to a single listener
@@ -86,7 +89,12 @@ videopt = <video RTP payload type> (e.g., 100)
 videortpmap = RTP map of the video codec (e.g., VP8/90000)
 videofmtp = Codec specific parameters, if any
 videobufferkf = yes|no (whether the plugin should store the latest
-	keyframe and send it immediately for new viewers, EXPERIMENTAL)
+	keyframe, and all the audio and video packets that followed it, and
+	send them immediately to new viewers, so that they can start decoding
+	right away; this is done for each substream, when simulcasting, and
+	a GOP is not cached if it's longer than 1024 packets. The GOP is sent
+	in a burst, with compressed timestamps so that it's decoded right away,
+	and only the last 100ms of audio are sent along with it)
 videosimulcast = yes|no (do|don't enable video simulcasting)
 videoport2 = second local port for receiving video frames (only for rtp, and simulcasting)
 videoport3 = third local port for receiving video frames (only for rtp, and simulcasting)
@@ -95,10 +103,16 @@ videoskew = yes|no (whether the plugin should perform skew
 collision = in case of collision (more than one SSRC hitting the same port), the plugin
 	will discard incoming RTP packets with a new SSRC unless this many milliseconds
 	passed, which would then change the current SSRC (0=disabled)
+threads = number of helper threads to spread the viewers of this mountpoint
+	across, each relaying packets to its own share of viewers (default=0,
+	meaning the thread receiving the media relays to all viewers itself;
+	also available for the 'rtsp' type below)
 dataport = local port for receiving data messages to relay
 dataiface = network interface or IP address to bind to, if any (binds to all otherwise)
 databuffermsg = yes|no (whether the plugin should store the latest
 	message and send it immediately for new viewers)
+datatype = text|binary (type of data this mountpoint will relay, default=text:
+	binary messages are relayed as they are, rather than as strings)
 
 In case you want to use SRTP for your RTP-based mountpoint, you'll need
 to configure the SRTP-related properties as well, namely the suite to
@@ -109,6 +123,15 @@ feed the mountpoint, as you may risk getting SRTP decrypt errors:
 srtpsuite = 32
 srtpcrypto = WbTBosdVUZqEb6Htqhn+m3z7wUh4RJVR8nE15GbN
 
+The following options are only valid for the 'relay' type, in addition
+to the 'rtp' ones (the ports are where the origin will send media to):
+origins = comma separated list of host:port addresses of the origins,
+	in order of preference; the port is the relay_port of the origin,
+	and the edge fails over to the next origin when the current one
+	stops acknowledging the subscription or stops sending media
+origin_id = ID of the mountpoint to relay on the origins
+origin_pin = PIN of the mountpoint on the origins, if needed
+
 The following options are only valid for the 'rstp' type:
 url = RTSP stream URL
 rtsp_user = RTSP authorization username, if needed
@@ -116,6 +139,25 @@ rtsp_pwd = RTSP authorization password, if needed
 rtsp_failcheck = whether an error should be returned if connecting to the RTSP server fails (default=yes)
 rtspiface = network interface IP address or device name to listen on when receiving RTSP streams
 \endverbatim
+ *
+ * To scale a broadcast beyond what a single instance can serve, Janus
+ * instances can be chained: setting a \c relay_port in the \c general
+ * section makes an instance act as an origin, which means that other
+ * instances (the edges) can subscribe to its RTP mountpoints using
+ * \c relay mountpoints, and get the media sent to their own ports.
+ * Subscriptions are small JSON messages sent over UDP and refreshed
+ * every second: edges that stop refreshing them are dropped after ten
+ * seconds. Before accepting a subscription, origins challenge the edge
+ * with a nonce it must send back, so that media is never sent to an
+ * address that didn't ask for it. The control socket is bound to the
+ * \c relay_address in the \c general section, which is the loopback
+ * interface by default: edges and origins on different machines need a
+ * routable address there, and origins will only accept subscriptions on
+ * such an address if a \c relay_secret (shared by all origins and edges)
+ * is configured as well, in which case all messages are signed with it. Only the base substream of simulcast mountpoints is relayed.
+ * When a viewer on an edge asks for a keyframe, the request is forwarded
+ * to the origin, which answers with the GOP it cached, if \c videobufferkf
+ * is enabled; an edge can be an origin for other edges as well.
  *
  * \section streamapi Streaming API
  *
@@ -242,6 +284,25 @@ rtspiface = network interface IP address or device name to listen on when receiv
  * is listening on will only be returned if you provide the correct secret,
  * as otherwise they're treated like sensitive information and are not
  * returned to generic \c info calls.
+ * RTP mountpoints also return \c audio_drops and \c video_drops
+ * properties, the number of packets the kernel had to drop since the
+ * mountpoint was created because the plugin couldn't read them fast
+ * enough: these are only updated on systems that can report them (e.g.,
+ * Linux with \c SO_RXQ_OVFL), and are always 0 otherwise. They also
+ * return a \c relay_time_us property, the average time in microseconds
+ * it takes the thread receiving the media to relay a packet to all
+ * viewers: when the mountpoint was created with a \c threads value,
+ * relaying is delegated to helper threads instead, and a \c threads
+ * array details, for each of them, how many viewers it's serving, how
+ * many packets are waiting in its queue and its own \c relay_time_us.
+ * Finally, \c audio_jitter and \c video_jitter objects tell how much
+ * jitter (in microseconds, as per RFC 3550) the plugin is measuring on
+ * the media it receives, and how many packets were lost, reordered or
+ * duplicated on the way: this is the same estimator the NoSIP and
+ * AudioBridge plugins use for their jitter buffers, so the \c target-delay
+ * property tells how much a jitter buffer would have to delay the media
+ * to absorb that jitter; for simulcast mountpoints, the video stats only
+ * refer to the first substream.
  *
  * We've seen how you can create a new mountpoint via configuration file,
  * but you can create one via API as well, using the \c create request.
@@ -646,6 +707,8 @@ rtspiface = network interface IP address or device name to listen on when receiv
 #include <sys/socket.h>
 #include <sys/time.h>
 
+#include <openssl/hmac.h>
+
 #include <jansson.h>
 
 #ifdef HAVE_LIBCURL
@@ -662,6 +725,8 @@ rtspiface = network interface IP address or device name to listen on when receiv
 #include "../record.h"
 #include "../utils.h"
 #include "../ip-utils.h"
+#include "../affinity.h"
+#include "../jitter.h"
 
 
 /* Plugin information */
@@ -764,9 +829,15 @@ static struct janus_json_parameter rtp_parameters[] = {
 	{"video", JANUS_JSON_BOOL, 0},
 	{"data", JANUS_JSON_BOOL, 0},
 	{"collision", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"threads", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"srtpsuite", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"srtpcrypto", JSON_STRING, 0}
 };
+static struct janus_json_parameter relay_parameters[] = {
+	{"origins", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
+	{"origin_id", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
+	{"origin_pin", JSON_STRING, 0}
+};
 static struct janus_json_parameter live_parameters[] = {
 	{"id", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"name", JSON_STRING, 0},
@@ -801,7 +872,8 @@ static struct janus_json_parameter rtsp_parameters[] = {
 	{"videortpmap", JSON_STRING, 0},
 	{"videofmtp", JSON_STRING, 0},
 	{"rtspiface", JSON_STRING, 0},
-	{"rtsp_failcheck", JANUS_JSON_BOOL, 0}
+	{"rtsp_failcheck", JANUS_JSON_BOOL, 0},
+	{"threads", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
 };
 #endif
 static struct janus_json_parameter rtp_audio_parameters[] = {
@@ -829,6 +901,7 @@ static struct janus_json_parameter rtp_video_parameters[] = {
 static struct janus_json_parameter rtp_data_parameters[] = {
 	{"dataport", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
 	{"databuffermsg", JANUS_JSON_BOOL, 0},
+	{"datatype", JSON_STRING, 0},
 	{"dataiface", JSON_STRING, 0}
 };
 static struct janus_json_parameter destroy_parameters[] = {
@@ -874,10 +947,19 @@ static janus_callbacks *gateway = NULL;
 static GThread *handler_thread;
 static void *janus_streaming_handler(void *data);
 
-static void *janus_streaming_ondemand_thread(void *data);
+static GThread *playout_thread;
+/* Edge-origin relaying */
+static int relay_port = 0, relay_fd = -1;
+static struct in_addr relay_address;	/* Where the control socket is bound (loopback by default) */
+static char *relay_secret = NULL;		/* If set, control messages are signed with it */
+static guint64 relay_cookie_key[4];		/* Random key for the nonces we challenge edges with */
+static GThread *relay_control_thread;
+static void *janus_streaming_relay_control_thread(void *data);
+static void *janus_streaming_playout_thread(void *data);
 static void *janus_streaming_filesource_thread(void *data);
 static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data);
 static void *janus_streaming_relay_thread(void *data);
+static void *janus_streaming_helper_thread(void *data);
 static void janus_streaming_hangup_media_internal(janus_plugin_session *handle);
 
 typedef enum janus_streaming_type {
@@ -892,13 +974,19 @@ typedef enum janus_streaming_source {
 	janus_streaming_source_rtp,
 } janus_streaming_source;
 
+/* Maximum number of packets we cache for a GOP (per substream) */
+#define JANUS_STREAMING_GOP_MAX_PACKETS	1024
+/* How much of the cached audio we send to new viewers, along with the GOP (in us) */
+#define JANUS_STREAMING_GOP_AUDIO_WINDOW	100000
 typedef struct janus_streaming_rtp_keyframe {
 	gboolean enabled;
-	/* If enabled, we store the packets of the last keyframe, to immediately send them for new viewers */
-	GList *latest_keyframe;
-	/* This is where we store packets while we're still collecting the whole keyframe */
-	GList *temp_keyframe;
-	guint32 temp_ts;
+	/* If enabled, for each substream we store all the packets since the last keyframe,
+	 * audio included, to immediately send them to new viewers */
+	GQueue *gop[3];
+	/* Timestamp of the keyframe each GOP started from */
+	guint32 gop_ts[3];
+	/* Whether each GOP is usable (we got its keyframe, and it didn't outgrow the cache) */
+	gboolean gop_valid[3];
 	janus_mutex mutex;
 } janus_streaming_rtp_keyframe;
 
@@ -929,6 +1017,10 @@ typedef struct janus_streaming_rtp_source {
 	gint64 last_received_audio;
 	gint64 last_received_video;
 	gint64 last_received_data;
+	guint32 audio_drops;		/* Packets the kernel dropped on the audio socket, if we know */
+	guint32 video_drops[3];		/* Packets the kernel dropped on the video sockets, if we know */
+	janus_jitter_estimator audio_jitter;	/* Jitter measured on the audio stream */
+	janus_jitter_estimator video_jitter;	/* Jitter measured on the (first) video stream */
 #ifdef HAVE_LIBCURL
 	gboolean rtsp;
 	CURL *curl;
@@ -946,6 +1038,7 @@ typedef struct janus_streaming_rtp_source {
 #endif
 	janus_streaming_rtp_keyframe keyframe;
 	gboolean buffermsg;
+	gboolean textdata;
 	int rtp_collision;
 	void *last_msg;
 	janus_mutex buffermsg_mutex;
@@ -962,6 +1055,8 @@ typedef struct janus_streaming_rtp_source {
 
 typedef struct janus_streaming_file_source {
 	char *filename;
+	char *cache;		/* The file contents, read the first time an on-demand viewer needs them */
+	gsize cache_size;	/* Size of the file contents */
 } janus_streaming_file_source;
 
 /* used for audio/video fd and rtcp fd */
@@ -999,7 +1094,14 @@ typedef struct janus_streaming_mountpoint {
 	GDestroyNotify source_destroy;
 	janus_streaming_codecs codecs;
 	gboolean audio, video, data;
+	/* Cached offers (everything after the o= line), one per combination of offered media */
+	char *sdp_templates[8];
 	GList/*<unowned janus_streaming_session>*/ *listeners;
+	int helper_threads;	/* If > 0, the listeners are spread across this many helper threads */
+	GList/*<owned janus_streaming_helper>*/ *threads;
+	gint64 relay_time;	/* Average time it takes to relay a packet to all listeners (us, atomic) */
+	struct janus_streaming_relay *relay;	/* Only for relay mountpoints, to get media from origins */
+	GList/*<owned janus_streaming_relay_subscriber>*/ *subscribers;	/* Edges relaying this mountpoint */
 	volatile gint destroyed;
 	janus_mutex mutex;
 	janus_refcount ref;
@@ -1008,6 +1110,57 @@ GHashTable *mountpoints;
 janus_mutex mountpoints_mutex;
 static char *admin_key = NULL;
 
+/* Helper thread relaying the packets of a mountpoint to a subset of its listeners */
+typedef struct janus_streaming_helper {
+	janus_streaming_mountpoint *mp;
+	guint id;
+	GThread *thread;
+	volatile gint num_viewers;
+	GList/*<unowned janus_streaming_session>*/ *viewers;
+	GAsyncQueue *queued_packets;
+	gint64 relay_time;	/* Average time it takes to relay a packet to all viewers (us, atomic) */
+	janus_mutex mutex;
+} janus_streaming_helper;
+static int janus_streaming_helpers_start(janus_streaming_mountpoint *mp, int threads);
+static void janus_streaming_helpers_stop(janus_streaming_mountpoint *mp);
+static void janus_streaming_helper_add_viewer(janus_streaming_mountpoint *mp, gpointer session);
+static void janus_streaming_helper_remove_viewer(janus_streaming_mountpoint *mp, gpointer session);
+
+/* How long an origin waits for keep-alives before dropping an edge, and
+ * how long an edge waits for acks from an origin before failing over */
+#define JANUS_STREAMING_RELAY_TIMEOUT	(10*G_USEC_PER_SEC)
+#define JANUS_STREAMING_RELAY_FAILOVER	(3*G_USEC_PER_SEC)
+/* Length of the nonces origins challenge edges with (hex), and how long
+ * they're valid for, which is also how old a signed message can be (seconds) */
+#define JANUS_STREAMING_RELAY_NONCE_LEN		32
+#define JANUS_STREAMING_RELAY_NONCE_PERIOD	30
+/* Edge-side info on the origins of a relay mountpoint */
+typedef struct janus_streaming_relay {
+	struct sockaddr_in *origins;	/* Control addresses of the origins, in order of preference */
+	int origins_num;
+	char *origins_text;
+	int current;					/* Which origin we're currently subscribed to */
+	guint64 origin_id;				/* ID of the mountpoint on the origins */
+	char *origin_pin;
+	gint64 subscribed;				/* When we started subscribing to the current origin */
+	gint64 last_ack;				/* When the current origin last acknowledged our subscription */
+	gint64 last_keyframe_request;
+	guint failovers;
+	char nonce[JANUS_STREAMING_RELAY_NONCE_LEN+1];	/* What the current origin challenged us with */
+	janus_mutex mutex;
+} janus_streaming_relay;
+/* Origin-side info on an edge subscribed to a mountpoint */
+typedef struct janus_streaming_relay_subscriber {
+	guint64 edge_id;				/* ID of the relay mountpoint on the edge */
+	struct sockaddr_in control;		/* Where the edge sends control messages from */
+	struct sockaddr_in audio, video;	/* Where we send media to */
+	gint64 last_seen;
+} janus_streaming_relay_subscriber;
+static janus_streaming_relay *janus_streaming_relay_new(const char *origins, guint64 origin_id, const char *pin);
+static void janus_streaming_relay_free(janus_streaming_relay *relay);
+static void janus_streaming_relay_unsubscribe(janus_streaming_mountpoint *mp);
+static void janus_streaming_relay_request_keyframe(janus_streaming_mountpoint *mp);
+
 /* Helper to create an RTP live source (e.g., from gstreamer/ffmpeg/vlc/etc.) */
 janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 		uint64_t id, char *name, char *desc,
@@ -1015,7 +1168,8 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 		gboolean doaudio, char *amcast, const janus_network_address *aiface, uint16_t aport, uint8_t acodec, char *artpmap, char *afmtp, gboolean doaskew,
 		gboolean dovideo, char *vmcast, const janus_network_address *viface, uint16_t vport, uint8_t vcodec, char *vrtpmap, char *vfmtp, gboolean bufferkf,
 			gboolean simulcast, uint16_t vport2, uint16_t vport3, gboolean dovskew, int rtp_collision,
-		gboolean dodata, const janus_network_address *diface, uint16_t dport, gboolean buffermsg);
+		gboolean dodata, const janus_network_address *diface, uint16_t dport, gboolean buffermsg, gboolean textdata,
+		int threads);
 /* Helper to create a file/ondemand live source */
 janus_streaming_mountpoint *janus_streaming_create_file_source(
 		uint64_t id, char *name, char *desc, char *filename,
@@ -1027,7 +1181,7 @@ janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 		gboolean doaudio, char *artpmap, char *afmtp,
 		gboolean dovideo, char *vrtpmap, char *vfmtp,
 		const janus_network_address *iface,
-		gboolean error_on_failure);
+		gboolean error_on_failure, int threads);
 
 
 typedef struct janus_streaming_message {
@@ -1062,6 +1216,14 @@ typedef struct janus_streaming_session {
 static GHashTable *sessions;
 static janus_mutex sessions_mutex = JANUS_MUTEX_INITIALIZER;
 
+/* Scheduler for on-demand mountpoints */
+#define JANUS_STREAMING_PLAYOUT_SLOTS	20	/* One per millisecond, as we send a packet every 20ms */
+#define JANUS_STREAMING_PLAYOUT_FRAME	160	/* Bytes (and samples) we send per packet */
+static GList *playout_wheel[JANUS_STREAMING_PLAYOUT_SLOTS];
+static guint64 playout_tick = 0;
+static janus_mutex playout_mutex = JANUS_MUTEX_INITIALIZER;
+static int janus_streaming_playout_add(janus_streaming_session *session, janus_streaming_mountpoint *mp);
+
 static void janus_streaming_session_destroy(janus_streaming_session *session) {
 	if(session && g_atomic_int_compare_and_exchange(&session->destroyed, 0, 1))
 		janus_refcount_decrease(&session->ref);
@@ -1094,6 +1256,10 @@ static void janus_streaming_mountpoint_destroy(janus_streaming_mountpoint *mount
 	/* Wait for the thread to finish */
 	if(mountpoint->thread != NULL)
 		g_thread_join(mountpoint->thread);
+	/* Now that nothing is feeding them anymore, get rid of the helpers too */
+	janus_streaming_helpers_stop(mountpoint);
+	/* If we're an edge, tell the origin we don't need the media anymore */
+	janus_streaming_relay_unsubscribe(mountpoint);
 	/* Decrease the counter */
 	janus_refcount_decrease(&mountpoint->ref);
 }
@@ -1101,6 +1267,9 @@ static void janus_streaming_mountpoint_destroy(janus_streaming_mountpoint *mount
 static void janus_streaming_mountpoint_free(const janus_refcount *mp_ref) {
 	janus_streaming_mountpoint *mp = janus_refcount_containerof(mp_ref, janus_streaming_mountpoint, ref);
 	/* This mountpoint can be destroyed, free all the resources */
+	janus_streaming_helpers_stop(mp);
+	janus_streaming_relay_free(mp->relay);
+	g_list_free_full(mp->subscribers, (GDestroyNotify)g_free);
 
 	g_free(mp->name);
 	g_free(mp->description);
@@ -1119,10 +1288,71 @@ static void janus_streaming_mountpoint_free(const janus_refcount *mp_ref) {
 	g_free(mp->codecs.audio_fmtp);
 	g_free(mp->codecs.video_rtpmap);
 	g_free(mp->codecs.video_fmtp);
+	int i = 0;
+	for(i=0; i<8; i++)
+		g_free(mp->sdp_templates[i]);
 
 	g_free(mp);
 }
 
+/* Helper to get rid of the cached offers, e.g., when the codecs change (call with mp->mutex locked) */
+static void janus_streaming_mountpoint_sdp_reset(janus_streaming_mountpoint *mp) {
+	int i = 0;
+	for(i=0; i<8; i++) {
+		g_free(mp->sdp_templates[i]);
+		mp->sdp_templates[i] = NULL;
+	}
+}
+
+/* Helper to get the offer to send viewers, minus the session-specific o= line: as only the
+ * media the viewer wants can change, we build it once per combination (call with mp->mutex locked) */
+static const char *janus_streaming_mountpoint_sdp_template(janus_streaming_mountpoint *mp,
+		gboolean audio, gboolean video, gboolean data) {
+	int index = (audio ? 1 : 0) | (video ? 2 : 0) | (data ? 4 : 0);
+	if(mp->sdp_templates[index] != NULL)
+		return mp->sdp_templates[index];
+	GString *sdp = g_string_sized_new(1024);
+	g_string_append_printf(sdp, "s=Mountpoint %"SCNu64"\r\n", mp->id);
+	g_string_append(sdp, "t=0 0\r\n");
+	if(mp->codecs.audio_pt >= 0 && audio) {
+		/* Add audio line */
+		g_string_append_printf(sdp,
+			"m=audio 1 RTP/SAVPF %d\r\n"
+			"c=IN IP4 1.1.1.1\r\n",
+			mp->codecs.audio_pt);
+		if(mp->codecs.audio_rtpmap)
+			g_string_append_printf(sdp, "a=rtpmap:%d %s\r\n", mp->codecs.audio_pt, mp->codecs.audio_rtpmap);
+		if(mp->codecs.audio_fmtp)
+			g_string_append_printf(sdp, "a=fmtp:%d %s\r\n", mp->codecs.audio_pt, mp->codecs.audio_fmtp);
+		g_string_append(sdp, "a=sendonly\r\n");
+	}
+	if(mp->codecs.video_pt >= 0 && video) {
+		/* Add video line */
+		g_string_append_printf(sdp,
+			"m=video 1 RTP/SAVPF %d\r\n"
+			"c=IN IP4 1.1.1.1\r\n",
+			mp->codecs.video_pt);
+		if(mp->codecs.video_rtpmap)
+			g_string_append_printf(sdp, "a=rtpmap:%d %s\r\n", mp->codecs.video_pt, mp->codecs.video_rtpmap);
+		if(mp->codecs.video_fmtp)
+			g_string_append_printf(sdp, "a=fmtp:%d %s\r\n", mp->codecs.video_pt, mp->codecs.video_fmtp);
+		g_string_append_printf(sdp, "a=rtcp-fb:%d nack\r\n", mp->codecs.video_pt);
+		g_string_append_printf(sdp, "a=rtcp-fb:%d goog-remb\r\n", mp->codecs.video_pt);
+		g_string_append(sdp, "a=sendonly\r\n");
+	}
+#ifdef HAVE_SCTP
+	if(mp->data && data) {
+		/* Add data line */
+		g_string_append(sdp,
+			"m=application 1 DTLS/SCTP 5000\r\n"
+			"c=IN IP4 1.1.1.1\r\n"
+			"a=sctpmap:5000 webrtc-datachannel 16\r\n");
+	}
+#endif
+	mp->sdp_templates[index] = g_string_free(sdp, FALSE);
+	return mp->sdp_templates[index];
+}
+
 static void janus_streaming_message_free(janus_streaming_message *msg) {
 	if(!msg || msg == &exit_message)
 		return;
@@ -1150,15 +1380,141 @@ static void janus_streaming_message_free(janus_streaming_message *msg) {
 typedef struct janus_streaming_rtp_relay_packet {
 	janus_rtp_header *data;
 	gint length;
+	/* Copy of the packet as received, shared by all viewers (may be NULL) */
+	janus_plugin_rtp_shared *shared;
 	gboolean is_rtp;	/* This may be a data packet and not RTP */
 	gboolean is_video;
 	gboolean is_keyframe;
 	gboolean simulcast;
+	gboolean binary;	/* For data packets, whether this is a binary message rather than text */
 	int codec, substream;
 	uint32_t timestamp;
 	uint16_t seq_number;
+	/* When we received (or generated) the packet, so that viewers don't need to check the clock each */
+	gint64 received;
 } janus_streaming_rtp_relay_packet;
 
+/* Helpers to manage the GOP cache of a mountpoint: when enabled, for each
+ * substream we keep all the video packets since the latest keyframe, and
+ * the audio packets that came along with them, so that new viewers can
+ * get them right away instead of having to wait for the next keyframe */
+static void janus_streaming_gop_packet_free(janus_streaming_rtp_relay_packet *pkt) {
+	if(pkt == NULL)
+		return;
+	g_free(pkt->data);
+	g_free(pkt);
+}
+
+static void janus_streaming_gop_clear(janus_streaming_rtp_keyframe *keyframe, int index) {
+	if(keyframe->gop[index] != NULL) {
+		g_queue_free_full(keyframe->gop[index], (GDestroyNotify)janus_streaming_gop_packet_free);
+		keyframe->gop[index] = NULL;
+	}
+	keyframe->gop_valid[index] = FALSE;
+}
+
+/* Add a packet to the GOP caches: the packet must already have been updated
+ * by the mountpoint switching context, as it would be relayed to viewers */
+static void janus_streaming_gop_cache(janus_streaming_mountpoint *mountpoint, janus_streaming_rtp_relay_packet *packet, gboolean keyframe) {
+	janus_streaming_rtp_source *source = mountpoint->source;
+	janus_mutex_lock(&source->keyframe.mutex);
+	int i = 0;
+	for(i=0; i<3; i++) {
+		if(packet->is_video && packet->substream != i)
+			continue;
+		if(packet->is_video && keyframe && (!source->keyframe.gop_valid[i] || packet->timestamp != source->keyframe.gop_ts[i])) {
+			/* New keyframe, get rid of the old GOP and start a new one */
+			JANUS_LOG(LOG_HUGE, "[%s] New keyframe received on substream %d! ts=%"SCNu32"\n", mountpoint->name, i, packet->timestamp);
+			janus_streaming_gop_clear(&source->keyframe, i);
+			source->keyframe.gop[i] = g_queue_new();
+			source->keyframe.gop_ts[i] = packet->timestamp;
+			source->keyframe.gop_valid[i] = TRUE;
+		}
+		if(!source->keyframe.gop_valid[i])
+			continue;
+		if(g_queue_get_length(source->keyframe.gop[i]) >= JANUS_STREAMING_GOP_MAX_PACKETS) {
+			/* The GOP is too long for the cache, stop until the next keyframe */
+			JANUS_LOG(LOG_WARN, "[%s] GOP on substream %d is longer than %d packets, not caching it\n",
+				mountpoint->name, i, JANUS_STREAMING_GOP_MAX_PACKETS);
+			janus_streaming_gop_clear(&source->keyframe, i);
+			continue;
+		}
+		janus_streaming_rtp_relay_packet *pkt = g_malloc(sizeof(janus_streaming_rtp_relay_packet));
+		*pkt = *packet;
+		pkt->data = g_malloc(packet->length);
+		memcpy(pkt->data, packet->data, packet->length);
+		pkt->shared = NULL;
+		/* Mark the packet so that it's relayed before the viewer is started */
+		pkt->is_keyframe = TRUE;
+		g_queue_push_tail(source->keyframe.gop[i], pkt);
+	}
+	janus_mutex_unlock(&source->keyframe.mutex);
+}
+
+/* Send the cached GOP to a new viewer, from the substream closest to the one they want:
+ * as it's sent in a single burst, the video frames get consecutive timestamps ending at
+ * the latest cached one, so that the viewer decodes them right away rather than playing
+ * them back in real time (which would add the GOP duration as latency), while the audio
+ * is capped to what was received last, for the same reason */
+static void janus_streaming_gop_replay(janus_streaming_session *session, janus_streaming_rtp_source *source) {
+	janus_mutex_lock(&source->keyframe.mutex);
+	int index = source->simulcast ? session->substream_target : 0;
+	if(index < 0 || index > 2)
+		index = 0;
+	while(index > 0 && !source->keyframe.gop_valid[index])
+		index--;
+	if(source->keyframe.gop_valid[index] && source->keyframe.gop[index] != NULL &&
+			!g_queue_is_empty(source->keyframe.gop[index])) {
+		GQueue *gop = source->keyframe.gop[index];
+		JANUS_LOG(LOG_HUGE, "Sending cached GOP: %d packets\n", g_queue_get_length(gop));
+		if(source->simulcast && index != session->substream) {
+			/* Start from the substream we have a GOP for: since the target doesn't
+			 * change, we'll switch to that as soon as it gets a keyframe */
+			session->substream = index;
+			session->last_relayed = janus_get_monotonic_time();
+		}
+		/* Count the video frames, and check when the latest packet was received */
+		int frames = 0;
+		guint32 last_ts = 0;
+		gint64 last_received = ((janus_streaming_rtp_relay_packet *)gop->tail->data)->received;
+		GList *temp = gop->head;
+		while(temp) {
+			janus_streaming_rtp_relay_packet *pkt = (janus_streaming_rtp_relay_packet *)temp->data;
+			if(pkt->is_video && (frames == 0 || pkt->timestamp != last_ts)) {
+				frames++;
+				last_ts = pkt->timestamp;
+			}
+			temp = temp->next;
+		}
+		/* The cached packets are sent now, so that's when they were received as far as
+		 * rewriting timestamps is concerned */
+		gint64 now = janus_get_monotonic_time();
+		int frame = 0;
+		guint32 frame_ts = 0;
+		temp = gop->head;
+		while(temp) {
+			janus_streaming_rtp_relay_packet *pkt = (janus_streaming_rtp_relay_packet *)temp->data;
+			temp = temp->next;
+			if(!pkt->is_video && pkt->received < last_received - JANUS_STREAMING_GOP_AUDIO_WINDOW)
+				continue;
+			janus_streaming_rtp_relay_packet copy = *pkt;
+			copy.received = now;
+			if(pkt->is_video) {
+				if(frame == 0 || pkt->timestamp != frame_ts) {
+					frame++;
+					frame_ts = pkt->timestamp;
+				}
+				copy.timestamp = last_ts - (guint32)(frames - frame);
+				copy.data->timestamp = htonl(copy.timestamp);
+			}
+			janus_streaming_relay_rtp_packet(session, &copy);
+			/* Restore the timestamp the packet was cached with */
+			pkt->data->timestamp = htonl(pkt->timestamp);
+		}
+	}
+	janus_mutex_unlock(&source->keyframe.mutex);
+}
+
 
 /* Error codes */
 #define JANUS_STREAMING_ERROR_NO_MESSAGE			450
@@ -1207,12 +1563,38 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 	/* Threads will expect this to be set */
 	g_atomic_int_set(&initialized, 1);
 
+	/* Unless configured otherwise, edge-origin relaying only works locally */
+	relay_address.s_addr = htonl(INADDR_LOOPBACK);
+	int i = 0;
+	for(i=0; i<4; i++)
+		relay_cookie_key[i] = janus_random_uint64();
+
 	/* Parse configuration to populate the mountpoints */
 	if(config != NULL) {
 		/* Any admin key to limit who can "create"? */
 		janus_config_item *key = janus_config_get_item_drilldown(config, "general", "admin_key");
 		if(key != NULL && key->value != NULL)
 			admin_key = g_strdup(key->value);
+		janus_config_item *rport = janus_config_get_item_drilldown(config, "general", "relay_port");
+		if(rport != NULL && rport->value != NULL)
+			relay_port = atoi(rport->value);
+		if(relay_port < 0 || relay_port > 65535) {
+			JANUS_LOG(LOG_WARN, "Invalid relay port %d, disabling origin mode\n", relay_port);
+			relay_port = 0;
+		}
+		janus_config_item *raddress = janus_config_get_item_drilldown(config, "general", "relay_address");
+		if(raddress != NULL && raddress->value != NULL && inet_pton(AF_INET, raddress->value, &relay_address) != 1) {
+			JANUS_LOG(LOG_WARN, "Invalid relay address '%s', using the loopback interface\n", raddress->value);
+			relay_address.s_addr = htonl(INADDR_LOOPBACK);
+		}
+		janus_config_item *rsecret = janus_config_get_item_drilldown(config, "general", "relay_secret");
+		if(rsecret != NULL && rsecret->value != NULL && strlen(rsecret->value) > 0)
+			relay_secret = g_strdup(rsecret->value);
+		if(relay_port > 0 && relay_secret == NULL && relay_address.s_addr != htonl(INADDR_LOOPBACK)) {
+			/* Without a secret anybody could subscribe, so we only allow that locally */
+			JANUS_LOG(LOG_WARN, "Origin mode on a non-loopback relay address requires a relay_secret, disabling it\n");
+			relay_port = 0;
+		}
 		janus_config_item *events = janus_config_get_item_drilldown(config, "general", "events");
 		if(events != NULL && events->value != NULL)
 			notify_events = janus_is_true(events->value);
@@ -1234,7 +1616,7 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 				cl = cl->next;
 				continue;
 			}
-			if(!strcasecmp(type->value, "rtp")) {
+			if(!strcasecmp(type->value, "rtp") || !strcasecmp(type->value, "relay")) {
 				janus_network_address video_iface, audio_iface, data_iface;
 				/* RTP live source (e.g., from gstreamer/ffmpeg/vlc/etc.) */
 				janus_config_item *id = janus_config_get_item(cat, "id");
@@ -1266,7 +1648,9 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 				janus_config_item *vport3 = janus_config_get_item(cat, "videoport3");
 				janus_config_item *dport = janus_config_get_item(cat, "dataport");
 				janus_config_item *dbm = janus_config_get_item(cat, "databuffermsg");
+				janus_config_item *dtype = janus_config_get_item(cat, "datatype");
 				janus_config_item *rtpcollision = janus_config_get_item(cat, "collision");
+				janus_config_item *threads = janus_config_get_item(cat, "threads");
 				janus_config_item *ssuite = janus_config_get_item(cat, "srtpsuite");
 				janus_config_item *scrypto = janus_config_get_item(cat, "srtpcrypto");
 				gboolean is_private = priv && priv->value && janus_is_true(priv->value);
@@ -1277,17 +1661,22 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 				gboolean dodata = data && data->value && janus_is_true(data->value);
 				gboolean bufferkf = video && vkf && vkf->value && janus_is_true(vkf->value);
 				gboolean simulcast = video && vsc && vsc->value && janus_is_true(vsc->value);
-				if(simulcast && bufferkf) {
-					/* FIXME We'll need to take care of this */
-					JANUS_LOG(LOG_WARN, "Simulcasting enabled, so disabling buffering of keyframes\n");
-					bufferkf = FALSE;
-				}
 				gboolean buffermsg = data && dbm && dbm->value && janus_is_true(dbm->value);
+				gboolean textdata = TRUE;
 				if(!doaudio && !dovideo && !dodata) {
 					JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream '%s', no audio, video or data have to be streamed...\n", cat->name);
 					cl = cl->next;
 					continue;
 				}
+				if(dodata && dtype && dtype->value) {
+					if(!strcasecmp(dtype->value, "binary")) {
+						textdata = FALSE;
+					} else if(strcasecmp(dtype->value, "text")) {
+						JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream '%s', invalid data type '%s'...\n", cat->name, dtype->value);
+						cl = cl->next;
+						continue;
+					}
+				}
 				if(doaudio &&
 						(aport == NULL || aport->value == NULL || atoi(aport->value) == 0 ||
 						acodec == NULL || acodec->value == NULL ||
@@ -1374,6 +1763,21 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 					doaudio ? "enabled" : "NOT enabled",
 					dovideo ? "enabled" : "NOT enabled",
 					dodata ? "enabled" : "NOT enabled");
+				janus_streaming_relay *relay = NULL;
+				if(!strcasecmp(type->value, "relay")) {
+					/* We'll get the media from another Janus instance */
+					janus_config_item *origins = janus_config_get_item(cat, "origins");
+					janus_config_item *origin_id = janus_config_get_item(cat, "origin_id");
+					janus_config_item *origin_pin = janus_config_get_item(cat, "origin_pin");
+					relay = janus_streaming_relay_new(origins ? origins->value : NULL,
+						(origin_id && origin_id->value) ? g_ascii_strtoull(origin_id->value, 0, 10) : 0,
+						origin_pin ? origin_pin->value : NULL);
+					if(relay == NULL) {
+						JANUS_LOG(LOG_ERR, "Can't add 'relay' stream '%s', missing or invalid origins...\n", cat->name);
+						cl = cl->next;
+						continue;
+					}
+				}
 				janus_streaming_mountpoint *mp = NULL;
 				if((mp = janus_streaming_create_rtp_source(
 						(id && id->value) ? g_ascii_strtoull(id->value, 0, 10) : 0,
@@ -1405,11 +1809,15 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 						dodata,
 						dodata && diface && diface->value ? &data_iface : NULL,
 						(dport && dport->value) ? atoi(dport->value) : 0,
-						buffermsg)) == NULL) {
+						buffermsg,
+						textdata,
+						(threads && threads->value) ? atoi(threads->value) : 0)) == NULL) {
 					JANUS_LOG(LOG_ERR, "Error creating 'rtp' stream '%s'...\n", cat->name);
+					janus_streaming_relay_free(relay);
 					cl = cl->next;
 					continue;
 				}
+				mp->relay = relay;
 				mp->is_private = is_private;
 				if(secret && secret->value)
 					mp->secret = g_strdup(secret->value);
@@ -1567,6 +1975,7 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 				janus_config_item *vfmtp = janus_config_get_item(cat, "videofmtp");
 				janus_config_item *iface = janus_config_get_item(cat, "rtspiface");
 				janus_config_item *failerr = janus_config_get_item(cat, "rtsp_failcheck");
+				janus_config_item *threads = janus_config_get_item(cat, "threads");
 				janus_network_address iface_value;
 				if(file == NULL || file->value == NULL) {
 					JANUS_LOG(LOG_ERR, "Can't add 'rtsp' stream '%s', missing mandatory information...\n", cat->name);
@@ -1621,7 +2030,8 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 						vrtpmap ? (char *)vrtpmap->value : NULL,
 						vfmtp ? (char *)vfmtp->value : NULL,
 						iface && iface->value ? &iface_value : NULL,
-						error_on_failure)) == NULL) {
+						error_on_failure,
+						(threads && threads->value) ? atoi(threads->value) : 0)) == NULL) {
 					JANUS_LOG(LOG_ERR, "Error creating 'rtsp' stream '%s'...\n", cat->name);
 					cl = cl->next;
 					continue;
@@ -1672,6 +2082,43 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 		janus_config_destroy(config);
 		return -1;
 	}
+	/* Launch the thread that will take care of all on-demand viewers */
+	playout_thread = g_thread_try_new("streaming playout", janus_streaming_playout_thread, NULL, &error);
+	if(error != NULL) {
+		g_atomic_int_set(&initialized, 0);
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Streaming playout thread...\n", error->code, error->message ? error->message : "??");
+		janus_config_destroy(config);
+		return -1;
+	}
+	/* Create the socket for relay control messages: we only accept subscriptions from
+	 * edges if a port was configured, but we always need it to act as an edge */
+	relay_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if(relay_fd < 0) {
+		JANUS_LOG(LOG_ERR, "Error creating the relay control socket, edge-origin relaying disabled...\n");
+	} else {
+		struct sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_port = htons(relay_port);
+		address.sin_addr = relay_address;
+		if(bind(relay_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+			JANUS_LOG(LOG_ERR, "Error binding the relay control socket to %s:%d, edge-origin relaying disabled...\n",
+				inet_ntoa(relay_address), relay_port);
+			close(relay_fd);
+			relay_fd = -1;
+		} else {
+			if(relay_port > 0)
+				JANUS_LOG(LOG_INFO, "Accepting subscriptions from edges on %s:%d%s\n", inet_ntoa(relay_address),
+					relay_port, relay_secret ? " (signed)" : "");
+			relay_control_thread = g_thread_try_new("streaming relay", janus_streaming_relay_control_thread, NULL, &error);
+			if(error != NULL) {
+				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Streaming relay control thread...\n", error->code, error->message ? error->message : "??");
+				g_clear_error(&error);
+				close(relay_fd);
+				relay_fd = -1;
+			}
+		}
+	}
 	JANUS_LOG(LOG_INFO, "%s initialized!\n", JANUS_STREAMING_NAME);
 	return 0;
 }
@@ -1686,6 +2133,14 @@ void janus_streaming_destroy(void) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+	if(playout_thread != NULL) {
+		g_thread_join(playout_thread);
+		playout_thread = NULL;
+	}
+	if(relay_control_thread != NULL) {
+		g_thread_join(relay_control_thread);
+		relay_control_thread = NULL;
+	}
 
 	/* Remove all mountpoints */
 	janus_mutex_lock(&mountpoints_mutex);
@@ -1700,6 +2155,12 @@ void janus_streaming_destroy(void) {
 
 	janus_config_destroy(config);
 	g_free(admin_key);
+	if(relay_fd > -1)
+		close(relay_fd);
+	relay_fd = -1;
+	relay_port = 0;
+	g_free(relay_secret);
+	relay_secret = NULL;
 
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
@@ -2009,8 +2470,10 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 					if(source->video_port[2] > -1)
 						json_object_set_new(ml, "videoport3", json_integer(source->video_port[2]));
 				}
-				if(mp->data)
+				if(mp->data) {
 					json_object_set_new(ml, "dataport", json_integer(source->data_port));
+					json_object_set_new(ml, "datatype", json_string(source->textdata ? "text" : "binary"));
+				}
 			}
 			if(source->audio_fd != -1)
 				json_object_set_new(ml, "audio_age_ms", json_integer((now - source->last_received_audio) / 1000));
@@ -2018,6 +2481,46 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 				json_object_set_new(ml, "video_age_ms", json_integer((now - source->last_received_video) / 1000));
 			if(source->data_fd != -1)
 				json_object_set_new(ml, "data_age_ms", json_integer((now - source->last_received_data) / 1000));
+			if(source->audio_fd != -1)
+				json_object_set_new(ml, "audio_drops", json_integer(source->audio_drops));
+			if(source->video_fd[0] != -1 || source->video_fd[1] != -1 || source->video_fd[2] != -1)
+				json_object_set_new(ml, "video_drops", json_integer((json_int_t)source->video_drops[0] + source->video_drops[1] + source->video_drops[2]));
+			if(source->audio_fd != -1)
+				json_object_set_new(ml, "audio_jitter", janus_jitter_estimator_stats(&source->audio_jitter));
+			if(source->video_fd[0] != -1)
+				json_object_set_new(ml, "video_jitter", janus_jitter_estimator_stats(&source->video_jitter));
+			json_object_set_new(ml, "relay_time_us", json_integer(__atomic_load_n(&mp->relay_time, __ATOMIC_RELAXED)));
+			if(mp->relay != NULL) {
+				janus_streaming_relay *relay = mp->relay;
+				json_t *r = json_object();
+				if(admin) {
+					json_object_set_new(r, "origins", json_string(relay->origins_text));
+					json_object_set_new(r, "origin_id", json_integer(relay->origin_id));
+				}
+				json_object_set_new(r, "origin", json_integer(relay->current+1));
+				json_object_set_new(r, "connected", relay->last_ack > 0 ? json_true() : json_false());
+				json_object_set_new(r, "failovers", json_integer(relay->failovers));
+				json_object_set_new(ml, "relay", r);
+			}
+			janus_mutex_lock(&mp->mutex);
+			if(mp->subscribers != NULL)
+				json_object_set_new(ml, "edges", json_integer(g_list_length(mp->subscribers)));
+			janus_mutex_unlock(&mp->mutex);
+			if(mp->helper_threads > 0) {
+				json_t *helpers = json_array();
+				GList *l = mp->threads;
+				while(l) {
+					janus_streaming_helper *helper = (janus_streaming_helper *)l->data;
+					json_t *h = json_object();
+					json_object_set_new(h, "id", json_integer(helper->id));
+					json_object_set_new(h, "viewers", json_integer(g_atomic_int_get(&helper->num_viewers)));
+					json_object_set_new(h, "queued", json_integer(g_async_queue_length(helper->queued_packets)));
+					json_object_set_new(h, "relay_time_us", json_integer(__atomic_load_n(&helper->relay_time, __ATOMIC_RELAXED)));
+					json_array_append_new(helpers, h);
+					l = l->next;
+				}
+				json_object_set_new(ml, "threads", helpers);
+			}
 			janus_mutex_lock(&source->rec_mutex);
 			if(admin && (source->arc || source->vrc || source->drc)) {
 				json_t *recording = json_object();
@@ -2075,7 +2578,7 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 			goto plugin_response;
 		}
 		janus_streaming_mountpoint *mp = NULL;
-		if(!strcasecmp(type_text, "rtp")) {
+		if(!strcasecmp(type_text, "rtp") || !strcasecmp(type_text, "relay")) {
 			janus_network_address audio_iface, video_iface, data_iface;
 			/* RTP live source (e.g., from gstreamer/ffmpeg/vlc/etc.) */
 			JANUS_VALIDATE_JSON_OBJECT(root, rtp_parameters,
@@ -2083,6 +2586,14 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 				JANUS_STREAMING_ERROR_MISSING_ELEMENT, JANUS_STREAMING_ERROR_INVALID_ELEMENT);
 			if(error_code != 0)
 				goto plugin_response;
+			if(!strcasecmp(type_text, "relay")) {
+				/* Same as RTP, but we'll get the media from another Janus instance */
+				JANUS_VALIDATE_JSON_OBJECT(root, relay_parameters,
+					error_code, error_cause, TRUE,
+					JANUS_STREAMING_ERROR_MISSING_ELEMENT, JANUS_STREAMING_ERROR_INVALID_ELEMENT);
+				if(error_code != 0)
+					goto plugin_response;
+			}
 			json_t *id = json_object_get(root, "id");
 			json_t *name = json_object_get(root, "name");
 			json_t *desc = json_object_get(root, "description");
@@ -2091,6 +2602,7 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 			json_t *video = json_object_get(root, "video");
 			json_t *data = json_object_get(root, "data");
 			json_t *rtpcollision = json_object_get(root, "collision");
+			json_t *threads = json_object_get(root, "threads");
 			json_t *ssuite = json_object_get(root, "srtpsuite");
 			json_t *scrypto = json_object_get(root, "srtpcrypto");
 			gboolean doaudio = audio ? json_is_true(audio) : FALSE;
@@ -2167,11 +2679,6 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 				bufferkf = vkf ? json_is_true(vkf) : FALSE;
 				json_t *vsc = json_object_get(root, "videosimulcast");
 				simulcast = vsc ? json_is_true(vsc) : FALSE;
-				if(simulcast && bufferkf) {
-					/* FIXME We'll need to take care of this */
-					JANUS_LOG(LOG_WARN, "Simulcasting enabled, so disabling buffering of keyframes\n");
-					bufferkf = FALSE;
-				}
 				json_t *videoport2 = json_object_get(root, "videoport2");
 				vport2 = json_integer_value(videoport2);
 				json_t *videoport3 = json_object_get(root, "videoport3");
@@ -2192,7 +2699,7 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 				dovskew = vskew ? json_is_true(vskew) : FALSE;
 			}
 			uint16_t dport = 0;
-			gboolean buffermsg = FALSE;
+			gboolean buffermsg = FALSE, textdata = TRUE;
 			if(dodata) {
 				JANUS_VALIDATE_JSON_OBJECT(root, rtp_data_parameters,
 					error_code, error_cause, TRUE,
@@ -2204,6 +2711,18 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 				dport = json_integer_value(dataport);
 				json_t *dbm = json_object_get(root, "databuffermsg");
 				buffermsg = dbm ? json_is_true(dbm) : FALSE;
+				json_t *dtype = json_object_get(root, "datatype");
+				if(dtype) {
+					const char *type = json_string_value(dtype);
+					if(!strcasecmp(type, "binary")) {
+						textdata = FALSE;
+					} else if(strcasecmp(type, "text")) {
+						JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream '%s', invalid data type '%s'...\n", (const char *)json_string_value(name), type);
+						error_code = JANUS_STREAMING_ERROR_INVALID_ELEMENT;
+						g_snprintf(error_cause, 512, "Invalid data type '%s'", type);
+						goto plugin_response;
+					}
+				}
 				json_t *diface = json_object_get(root, "dataiface");
 				if(diface) {
 					const char *miface = (const char *)json_string_value(diface);
@@ -2237,6 +2756,19 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 					goto plugin_response;
 				}
 			}
+			janus_streaming_relay *relay = NULL;
+			if(!strcasecmp(type_text, "relay")) {
+				json_t *origin_pin = json_object_get(root, "origin_pin");
+				relay = janus_streaming_relay_new(json_string_value(json_object_get(root, "origins")),
+					json_integer_value(json_object_get(root, "origin_id")),
+					origin_pin ? json_string_value(origin_pin) : NULL);
+				if(relay == NULL) {
+					JANUS_LOG(LOG_ERR, "Can't add 'relay' stream, invalid origins...\n");
+					error_code = JANUS_STREAMING_ERROR_INVALID_ELEMENT;
+					g_snprintf(error_cause, 512, "Can't add 'relay' stream, invalid origins");
+					goto plugin_response;
+				}
+			}
 			JANUS_LOG(LOG_VERB, "Audio %s, Video %s\n", doaudio ? "enabled" : "NOT enabled", dovideo ? "enabled" : "NOT enabled");
 			mp = janus_streaming_create_rtp_source(
 					id ? json_integer_value(id) : 0,
@@ -2248,13 +2780,16 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 					dovideo, vmcast, &video_iface, vport, vcodec, vrtpmap, vfmtp, bufferkf,
 					simulcast, vport2, vport3, dovskew,
 					rtpcollision ? json_integer_value(rtpcollision) : 0,
-					dodata, &data_iface, dport, buffermsg);
+					dodata, &data_iface, dport, buffermsg, textdata,
+					threads ? json_integer_value(threads) : 0);
 			if(mp == NULL) {
+				janus_streaming_relay_free(relay);
 				JANUS_LOG(LOG_ERR, "Error creating 'rtp' stream...\n");
 				error_code = JANUS_STREAMING_ERROR_CANT_CREATE;
 				g_snprintf(error_cause, 512, "Error creating 'rtp' stream");
 				goto plugin_response;
 			}
+			mp->relay = relay;
 			mp->is_private = is_private ? json_is_true(is_private) : FALSE;
 		} else if(!strcasecmp(type_text, "live")) {
 			/* File live source */
@@ -2415,6 +2950,7 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 			json_t *password = json_object_get(root, "rtsp_pwd");
 			json_t *iface = json_object_get(root, "rtspiface");
 			json_t *failerr = json_object_get(root, "rtsp_check");
+			json_t *threads = json_object_get(root, "threads");
 			gboolean doaudio = audio ? json_is_true(audio) : FALSE;
 			gboolean dovideo = video ? json_is_true(video) : FALSE;
 			gboolean error_on_failure = failerr ? json_is_true(failerr) : TRUE;
@@ -2446,7 +2982,8 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 					doaudio, (char *)json_string_value(audiortpmap), (char *)json_string_value(audiofmtp),
 					dovideo, (char *)json_string_value(videortpmap), (char *)json_string_value(videofmtp),
 					&multicast_iface,
-					error_on_failure);
+					error_on_failure,
+					threads ? json_integer_value(threads) : 0);
 			if(mp == NULL) {
 				JANUS_LOG(LOG_ERR, "Error creating 'rtsp' stream...\n");
 				error_code = JANUS_STREAMING_ERROR_CANT_CREATE;
@@ -2483,7 +3020,7 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 			if(mp->is_private)
 				janus_config_add_item(config, mp->name, "is_private", "yes");
 			/* Per type values */
-			if(!strcasecmp(type_text, "rtp")) {
+			if(!strcasecmp(type_text, "rtp") || !strcasecmp(type_text, "relay")) {
 				janus_config_add_item(config, mp->name, "audio", mp->codecs.audio_pt >= 0 ? "yes" : "no");
 				janus_streaming_rtp_source *source = mp->source;
 				if(mp->codecs.audio_pt >= 0) {
@@ -2544,6 +3081,8 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 					janus_config_add_item(config, mp->name, "dataport", value);
 					if(source->buffermsg)
 						janus_config_add_item(config, mp->name, "databuffermsg", "yes");
+					if(!source->textdata)
+						janus_config_add_item(config, mp->name, "datatype", "binary");
 					json_t *diface = json_object_get(root, "dataiface");
 					if(diface)
 						janus_config_add_item(config, mp->name, "dataiface", json_string_value(diface));
@@ -2587,6 +3126,17 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 					janus_config_add_item(config, mp->name, "rtspiface", json_string_value(iface));
 			}
 			/* Some more common values */
+			if(mp->relay != NULL) {
+				janus_config_add_item(config, mp->name, "origins", mp->relay->origins_text);
+				g_snprintf(value, BUFSIZ, "%"SCNu64, mp->relay->origin_id);
+				janus_config_add_item(config, mp->name, "origin_id", value);
+				if(mp->relay->origin_pin)
+					janus_config_add_item(config, mp->name, "origin_pin", mp->relay->origin_pin);
+			}
+			if(mp->helper_threads > 0) {
+				g_snprintf(value, BUFSIZ, "%d", mp->helper_threads);
+				janus_config_add_item(config, mp->name, "threads", value);
+			}
 			if(mp->secret)
 				janus_config_add_item(config, mp->name, "secret", mp->secret);
 			if(mp->pin)
@@ -2606,7 +3156,7 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 		json_object_set_new(ml, "description", json_string(mp->description));
 		json_object_set_new(ml, "type", json_string(mp->streaming_type == janus_streaming_type_live ? "live" : "on demand"));
 		json_object_set_new(ml, "is_private", mp->is_private ? json_true() : json_false());
-		if(!strcasecmp(type_text, "rtp")) {
+		if(!strcasecmp(type_text, "rtp") || !strcasecmp(type_text, "relay")) {
 			janus_streaming_rtp_source *source = mp->source;
 			if (source->audio_fd != -1) {
 				json_object_set_new(ml, "audio_port", json_integer(source->audio_port));
@@ -2758,7 +3308,7 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 					if(iface)
 						janus_config_add_item(config, mp->name, "rtspiface", json_string_value(iface));
 				} else {
-					janus_config_add_item(config, mp->name, "type", "rtp");
+					janus_config_add_item(config, mp->name, "type", mp->relay ? "relay" : "rtp");
 					janus_config_add_item(config, mp->name, "audio", mp->codecs.audio_pt >= 0 ? "yes" : "no");
 					janus_streaming_rtp_source *source = mp->source;
 					if(mp->codecs.audio_pt >= 0) {
@@ -2819,6 +3369,8 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 						janus_config_add_item(config, mp->name, "dataport", value);
 						if(source->buffermsg)
 							janus_config_add_item(config, mp->name, "databuffermsg", "yes");
+						if(!source->textdata)
+							janus_config_add_item(config, mp->name, "datatype", "binary");
 						json_t *diface = json_object_get(root, "dataiface");
 						if(diface)
 							janus_config_add_item(config, mp->name, "dataiface", json_string_value(diface));
@@ -2837,6 +3389,17 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 				janus_config_add_item(config, mp->name, "video", mp->codecs.video_pt ? "yes" : "no");
 			}
 			/* Some more common values */
+			if(mp->relay != NULL) {
+				janus_config_add_item(config, mp->name, "origins", mp->relay->origins_text);
+				g_snprintf(value, BUFSIZ, "%"SCNu64, mp->relay->origin_id);
+				janus_config_add_item(config, mp->name, "origin_id", value);
+				if(mp->relay->origin_pin)
+					janus_config_add_item(config, mp->name, "origin_pin", mp->relay->origin_pin);
+			}
+			if(mp->helper_threads > 0) {
+				g_snprintf(value, BUFSIZ, "%d", mp->helper_threads);
+				janus_config_add_item(config, mp->name, "threads", value);
+			}
 			if(mp->secret)
 				janus_config_add_item(config, mp->name, "secret", mp->secret);
 			if(mp->pin)
@@ -2921,6 +3484,7 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 				/* Tell the core to tear down the PeerConnection, hangup_media will do the rest */
 				gateway->push_event(session->handle, &janus_streaming_plugin, NULL, event, NULL);
 				gateway->close_pc(session->handle);
+				janus_streaming_helper_remove_viewer(mp, session);
 				janus_refcount_decrease(&session->ref);
 				janus_refcount_decrease(&mp->ref);
 			}
@@ -3308,17 +3872,8 @@ void janus_streaming_setup_media(janus_plugin_session *handle) {
 	if(mountpoint->streaming_source == janus_streaming_source_rtp) {
 		janus_streaming_rtp_source *source = mountpoint->source;
 		if(source->keyframe.enabled) {
-			JANUS_LOG(LOG_HUGE, "Any keyframe to send?\n");
-			janus_mutex_lock(&source->keyframe.mutex);
-			if(source->keyframe.latest_keyframe != NULL) {
-				JANUS_LOG(LOG_HUGE, "Yep! %d packets\n", g_list_length(source->keyframe.latest_keyframe));
-				GList *temp = source->keyframe.latest_keyframe;
-				while(temp) {
-					janus_streaming_relay_rtp_packet(session, temp->data);
-					temp = temp->next;
-				}
-			}
-			janus_mutex_unlock(&source->keyframe.mutex);
+			JANUS_LOG(LOG_HUGE, "Any GOP to send?\n");
+			janus_streaming_gop_replay(session, source);
 		}
 		if(source->buffermsg) {
 			JANUS_LOG(LOG_HUGE, "Any recent datachannel message to send?\n");
@@ -3352,6 +3907,13 @@ void janus_streaming_incoming_rtp(janus_plugin_session *handle, int video, char
 void janus_streaming_incoming_rtcp(janus_plugin_session *handle, int video, char *buf, int len) {
 	if(handle == NULL || g_atomic_int_get(&handle->stopped) || g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
 		return;
+	/* If this is a relay mountpoint, keyframe requests are forwarded to the origin */
+	janus_streaming_session *session = (janus_streaming_session *)handle->plugin_handle;
+	if(video && session != NULL && !g_atomic_int_get(&session->destroyed)) {
+		janus_streaming_mountpoint *mp = session->mountpoint;
+		if(mp != NULL && mp->relay != NULL && (janus_rtcp_has_pli(buf, len) || janus_rtcp_has_fir(buf, len)))
+			janus_streaming_relay_request_keyframe(mp);
+	}
 	/* We might interested in the available bandwidth that the user advertizes */
 	uint64_t bw = janus_rtcp_get_remb(buf, len);
 	if(bw > 0) {
@@ -3397,6 +3959,7 @@ static void janus_streaming_hangup_media_internal(janus_plugin_session *handle)
 		JANUS_LOG(LOG_VERB, "  -- Removing the session from the mountpoint listeners\n");
 		if(g_list_find(mp->listeners, session) != NULL) {
 			JANUS_LOG(LOG_VERB, "  -- -- Found!\n");
+			janus_streaming_helper_remove_viewer(mp, session);
 			janus_refcount_decrease(&mp->ref);
 			janus_refcount_decrease(&session->ref);
 		}
@@ -3525,6 +4088,10 @@ static void *janus_streaming_handler(void *data) {
 			}
 			session->stopping = FALSE;
 			session->mountpoint = mp;
+			/* Keep the viewers of the same mountpoint on the same NUMA node */
+			char group[64];
+			g_snprintf(group, sizeof(group), "streaming-%"SCNu64, mp->id);
+			gateway->set_affinity_group(session->handle, group);
 			session->sdp_version = 1;	/* This needs to be increased when it changes */
 			session->sdp_sessid = janus_get_real_time();
 			/* Check what we should offer */
@@ -3549,21 +4116,12 @@ static void *janus_streaming_handler(void *data) {
 				goto error;
 			}
 			if(mp->streaming_type == janus_streaming_type_on_demand) {
-				GError *error = NULL;
-				char tname[16];
-				g_snprintf(tname, sizeof(tname), "mp %"SCNu64, id_value);
-				janus_refcount_increase(&session->ref);
-				janus_refcount_increase(&mp->ref);
-				g_thread_try_new(tname, &janus_streaming_ondemand_thread, session, &error);
-				if(error != NULL) {
+				if(janus_streaming_playout_add(session, mp) < 0) {
 					session->mountpoint = NULL;
 					janus_mutex_unlock(&mp->mutex);
-					janus_refcount_decrease(&session->ref);	/* This is for the failed thread */
-					janus_refcount_decrease(&mp->ref);		/* This is for the failed thread */
 					janus_refcount_decrease(&mp->ref);
-					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the on-demand thread...\n", error->code, error->message ? error->message : "??");
 					error_code = JANUS_STREAMING_ERROR_UNKNOWN_ERROR;
-					g_snprintf(error_cause, 512, "Got error %d (%s) trying to launch the on-demand thread", error->code, error->message ? error->message : "??");
+					g_snprintf(error_cause, 512, "Error opening the file of the on-demand mountpoint");
 					goto error;
 				}
 			} else if(mp->streaming_source == janus_streaming_source_rtp) {
@@ -3603,84 +4161,18 @@ static void *janus_streaming_handler(void *data) {
 done:
 			/* Let's prepare an offer now, but let's also check if there's something we need to skip */
 			sdp_type = "offer";	/* We're always going to do the offer ourselves, never answer */
-			char sdptemp[2048];
-			memset(sdptemp, 0, 2048);
-			gchar buffer[512];
-			memset(buffer, 0, 512);
-			g_snprintf(buffer, 512,
-				"v=0\r\no=%s %"SCNu64" %"SCNu64" IN IP4 127.0.0.1\r\n",
-					"-", session->sdp_sessid, session->sdp_version);
-			g_strlcat(sdptemp, buffer, 2048);
-			g_snprintf(buffer, 512,
-				"s=Mountpoint %"SCNu64"\r\n", mp->id);
-			g_strlcat(sdptemp, buffer, 2048);
-			g_strlcat(sdptemp, "t=0 0\r\n", 2048);
-			if(mp->codecs.audio_pt >= 0 && session->audio) {
-				/* Add audio line */
-				g_snprintf(buffer, 512,
-					"m=audio 1 RTP/SAVPF %d\r\n"
-					"c=IN IP4 1.1.1.1\r\n",
-					mp->codecs.audio_pt);
-				g_strlcat(sdptemp, buffer, 2048);
-				if(mp->codecs.audio_rtpmap) {
-					g_snprintf(buffer, 512,
-						"a=rtpmap:%d %s\r\n",
-						mp->codecs.audio_pt, mp->codecs.audio_rtpmap);
-					g_strlcat(sdptemp, buffer, 2048);
-				}
-				if(mp->codecs.audio_fmtp) {
-					g_snprintf(buffer, 512,
-						"a=fmtp:%d %s\r\n",
-						mp->codecs.audio_pt, mp->codecs.audio_fmtp);
-					g_strlcat(sdptemp, buffer, 2048);
-				}
-				g_strlcat(sdptemp, "a=sendonly\r\n", 2048);
-			}
-			if(mp->codecs.video_pt >= 0 && session->video) {
-				/* Add video line */
-				g_snprintf(buffer, 512,
-					"m=video 1 RTP/SAVPF %d\r\n"
-					"c=IN IP4 1.1.1.1\r\n",
-					mp->codecs.video_pt);
-				g_strlcat(sdptemp, buffer, 2048);
-				if(mp->codecs.video_rtpmap) {
-					g_snprintf(buffer, 512,
-						"a=rtpmap:%d %s\r\n",
-						mp->codecs.video_pt, mp->codecs.video_rtpmap);
-					g_strlcat(sdptemp, buffer, 2048);
-				}
-				if(mp->codecs.video_fmtp) {
-					g_snprintf(buffer, 512,
-						"a=fmtp:%d %s\r\n",
-						mp->codecs.video_pt, mp->codecs.video_fmtp);
-					g_strlcat(sdptemp, buffer, 2048);
-				}
-				g_snprintf(buffer, 512,
-					"a=rtcp-fb:%d nack\r\n",
-					mp->codecs.video_pt);
-				g_strlcat(sdptemp, buffer, 2048);
-				g_snprintf(buffer, 512,
-					"a=rtcp-fb:%d goog-remb\r\n",
-					mp->codecs.video_pt);
-				g_strlcat(sdptemp, buffer, 2048);
-				g_strlcat(sdptemp, "a=sendonly\r\n", 2048);
-			}
-#ifdef HAVE_SCTP
-			if(mp->data && session->data) {
-				/* Add data line */
-				g_snprintf(buffer, 512,
-					"m=application 1 DTLS/SCTP 5000\r\n"
-					"c=IN IP4 1.1.1.1\r\n"
-					"a=sctpmap:5000 webrtc-datachannel 16\r\n");
-				g_strlcat(sdptemp, buffer, 2048);
-			}
-#endif
-			sdp = g_strdup(sdptemp);
+			/* Only the o= line is specific to this viewer, the rest comes from the mountpoint */
+			sdp = g_strdup_printf("v=0\r\no=%s %"SCNu64" %"SCNu64" IN IP4 127.0.0.1\r\n%s",
+				"-", session->sdp_sessid, session->sdp_version,
+				janus_streaming_mountpoint_sdp_template(mp, session->audio, session->video, session->data));
 			JANUS_LOG(LOG_VERB, "Going to %s this SDP:\n%s\n", sdp_type, sdp);
 			result = json_object();
 			json_object_set_new(result, "status", json_string(do_restart ? "updating" : "preparing"));
-			/* Add the user to the list of watchers and we're done */
-			mp->listeners = g_list_append(mp->listeners, session);
+			/* Add the user to the list of watchers, unless this is a renegotiation, and we're done */
+			if(g_list_find(mp->listeners, session) == NULL) {
+				mp->listeners = g_list_append(mp->listeners, session);
+				janus_streaming_helper_add_viewer(mp, session);
+			}
 			janus_mutex_unlock(&mp->mutex);
 		} else if(!strcasecmp(request_text, "start")) {
 			if(session->mountpoint == NULL) {
@@ -3837,11 +4329,13 @@ done:
 			/* Unsubscribe from the previous mountpoint and subscribe to the new one */
 			janus_mutex_lock(&oldmp->mutex);
 			oldmp->listeners = g_list_remove_all(oldmp->listeners, session);
+			janus_streaming_helper_remove_viewer(oldmp, session);
 			janus_refcount_decrease(&oldmp->ref);	/* This is for the user going away */
 			janus_mutex_unlock(&oldmp->mutex);
 			/* Subscribe to the new one */
 			janus_mutex_lock(&mp->mutex);
 			mp->listeners = g_list_append(mp->listeners, session);
+			janus_streaming_helper_add_viewer(mp, session);
 			janus_mutex_unlock(&mp->mutex);
 			session->mountpoint = mp;
 			session->paused = FALSE;
@@ -4000,6 +4494,13 @@ static int janus_streaming_create_fd(int port, in_addr_t mcast, const janus_netw
 		close(fd);
 		return -1;
 	}
+#ifdef SO_RXQ_OVFL
+	/* Ask the kernel to tell us how many packets it dropped because we were too slow */
+	int ovfl = 1;
+	if(setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &ovfl, sizeof(ovfl)) < 0) {
+		JANUS_LOG(LOG_WARN, "[%s] %s listener setsockopt SO_RXQ_OVFL failed\n", mountpointname, listenername);
+	}
+#endif
 	return fd;
 }
 
@@ -4046,25 +4547,9 @@ static void janus_streaming_rtp_source_free(janus_streaming_rtp_source *source)
 		close(source->pipefd[1]);
 	}
 	janus_mutex_lock(&source->keyframe.mutex);
-	GList *temp = NULL;
-	while(source->keyframe.latest_keyframe) {
-		temp = g_list_first(source->keyframe.latest_keyframe);
-		source->keyframe.latest_keyframe = g_list_remove_link(source->keyframe.latest_keyframe, temp);
-		janus_streaming_rtp_relay_packet *pkt = (janus_streaming_rtp_relay_packet *)temp->data;
-		g_free(pkt->data);
-		g_free(pkt);
-		g_list_free(temp);
-	}
-	source->keyframe.latest_keyframe = NULL;
-	while(source->keyframe.temp_keyframe) {
-		temp = g_list_first(source->keyframe.temp_keyframe);
-		source->keyframe.temp_keyframe = g_list_remove_link(source->keyframe.temp_keyframe, temp);
-		janus_streaming_rtp_relay_packet *pkt = (janus_streaming_rtp_relay_packet *)temp->data;
-		g_free(pkt->data);
-		g_free(pkt);
-		g_list_free(temp);
-	}
-	source->keyframe.latest_keyframe = NULL;
+	int i = 0;
+	for(i=0; i<3; i++)
+		janus_streaming_gop_clear(&source->keyframe, i);
 	janus_mutex_unlock(&source->keyframe.mutex);
 	janus_mutex_lock(&source->buffermsg_mutex);
 	if(source->last_msg) {
@@ -4106,6 +4591,7 @@ static void janus_streaming_rtp_source_free(janus_streaming_rtp_source *source)
 }
 
 static void janus_streaming_file_source_free(janus_streaming_file_source *source) {
+	g_free(source->cache);
 	g_free(source->filename);
 	g_free(source);
 }
@@ -4117,7 +4603,8 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 		gboolean doaudio, char *amcast, const janus_network_address *aiface, uint16_t aport, uint8_t acodec, char *artpmap, char *afmtp, gboolean doaskew,
 		gboolean dovideo, char *vmcast, const janus_network_address *viface, uint16_t vport, uint8_t vcodec, char *vrtpmap, char *vfmtp, gboolean bufferkf,
 			gboolean simulcast, uint16_t vport2, uint16_t vport3, gboolean dovskew, int rtp_collision,
-		gboolean dodata, const janus_network_address *diface, uint16_t dport, gboolean buffermsg) {
+		gboolean dodata, const janus_network_address *diface, uint16_t dport, gboolean buffermsg, gboolean textdata,
+		int threads) {
 	janus_mutex_lock(&mountpoints_mutex);
 	if(id == 0) {
 		JANUS_LOG(LOG_VERB, "Missing id, will generate a random one...\n");
@@ -4338,6 +4825,10 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 	janus_rtp_switching_context_reset(&live_rtp_source->context[0]);
 	janus_rtp_switching_context_reset(&live_rtp_source->context[1]);
 	janus_rtp_switching_context_reset(&live_rtp_source->context[2]);
+	/* We only measure the jitter, here, so the bounds on the target delay are only for reference */
+	const char *aclock = artpmap ? strchr(artpmap, '/') : NULL;
+	janus_jitter_estimator_init(&live_rtp_source->audio_jitter, aclock ? atoi(aclock+1) : 48000, 20000, 500000);
+	janus_jitter_estimator_init(&live_rtp_source->video_jitter, 90000, 20000, 500000);
 	janus_mutex_init(&live_rtp_source->rec_mutex);
 	live_rtp_source->audio_fd = audio_fd;
 	live_rtp_source->video_fd[0] = video_fd[0];
@@ -4353,12 +4844,10 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 	live_rtp_source->last_received_video = janus_get_monotonic_time();
 	live_rtp_source->last_received_data = janus_get_monotonic_time();
 	live_rtp_source->keyframe.enabled = bufferkf;
-	live_rtp_source->keyframe.latest_keyframe = NULL;
-	live_rtp_source->keyframe.temp_keyframe = NULL;
-	live_rtp_source->keyframe.temp_ts = 0;
 	janus_mutex_init(&live_rtp_source->keyframe.mutex);
 	live_rtp_source->rtp_collision = rtp_collision;
 	live_rtp_source->buffermsg = buffermsg;
+	live_rtp_source->textdata = textdata;
 	live_rtp_source->last_msg = NULL;
 	janus_mutex_init(&live_rtp_source->buffermsg_mutex);
 	live_rtp->source = live_rtp_source;
@@ -4382,6 +4871,12 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 	g_atomic_int_set(&live_rtp->destroyed, 0);
 	janus_refcount_init(&live_rtp->ref, janus_streaming_mountpoint_free);
 	janus_mutex_init(&live_rtp->mutex);
+	/* Spawn the helper threads first, if needed, so that they're ready before any viewer joins */
+	if(janus_streaming_helpers_start(live_rtp, threads) < 0) {
+		janus_mutex_unlock(&mountpoints_mutex);
+		janus_refcount_decrease(&live_rtp->ref);
+		return NULL;
+	}
 	g_hash_table_insert(mountpoints, janus_uint64_dup(live_rtp->id), live_rtp);
 	janus_mutex_unlock(&mountpoints_mutex);
 	GError *error = NULL;
@@ -4761,6 +5256,10 @@ static int janus_streaming_rtsp_connect_to_server(janus_streaming_mountpoint *mp
 		mp->codecs.video_rtpmap = dovideo ? g_strdup(vrtpmap) : NULL;
 	if(mp->codecs.video_fmtp == NULL)
 		mp->codecs.video_fmtp = dovideo ? g_strdup(vfmtp) : NULL;
+	/* The payload types may have changed, so the cached offers are not valid anymore */
+	janus_mutex_lock(&mp->mutex);
+	janus_streaming_mountpoint_sdp_reset(mp);
+	janus_mutex_unlock(&mp->mutex);
 	source->audio_fd = audio_fds.fd;
 	source->audio_rtcp_fd = audio_fds.rtcp_fd;
 	source->rtsp_asport = asport;
@@ -4871,7 +5370,7 @@ janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 		gboolean doaudio, char *artpmap, char *afmtp,
 		gboolean dovideo, char *vrtpmap, char *vfmtp,
 		const janus_network_address *iface,
-		gboolean error_on_failure) {
+		gboolean error_on_failure, int threads) {
 	if(url == NULL) {
 		JANUS_LOG(LOG_ERR, "Can't add 'rtsp' stream, missing url...\n");
 		return NULL;
@@ -4967,6 +5466,12 @@ janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 			return NULL;
 		}
 	}
+	/* Spawn the helper threads first, if needed */
+	if(janus_streaming_helpers_start(live_rtsp, threads) < 0) {
+		janus_mutex_unlock(&mountpoints_mutex);
+		janus_refcount_decrease(&live_rtsp->ref);
+		return NULL;
+	}
 	/* Start the thread that will receive the media packets */
 	GError *error = NULL;
 	char tname[16];
@@ -4992,145 +5497,167 @@ janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 		gboolean doaudio, char *audiortpmap, char *audiofmtp,
 		gboolean dovideo, char *videortpmap, char *videofmtp,
 		const janus_network_address *iface,
-		gboolean error_on_failure) {
+		gboolean error_on_failure, int threads) {
 	JANUS_LOG(LOG_ERR, "RTSP need libcurl\n");
 	return NULL;
 }
 #endif
 
-/* FIXME Thread to send RTP packets from a file (on demand) */
-static void *janus_streaming_ondemand_thread(void *data) {
-	JANUS_LOG(LOG_VERB, "Filesource (on demand) RTP thread starting...\n");
-	janus_streaming_session *session = (janus_streaming_session *)data;
-	if(!session) {
-		JANUS_LOG(LOG_ERR, "Invalid session!\n");
-		g_thread_unref(g_thread_self());
-		return NULL;
-	}
-	janus_streaming_mountpoint *mountpoint = session->mountpoint;
-	if(!mountpoint) {
-		JANUS_LOG(LOG_ERR, "Invalid mountpoint!\n");
-		janus_refcount_decrease(&session->ref);
-		g_thread_unref(g_thread_self());
-		return NULL;
-	}
-	if(mountpoint->streaming_source != janus_streaming_source_file) {
-		JANUS_LOG(LOG_ERR, "[%s] Not an file source mountpoint!\n", mountpoint->name);
-		janus_refcount_decrease(&session->ref);
-		janus_refcount_decrease(&mountpoint->ref);
-		g_thread_unref(g_thread_self());
-		return NULL;
+/* On-demand mountpoints are all played out by a single thread, driven by a
+ * timer wheel: the wheel has a slot per millisecond, and since file sources
+ * send a packet every 20ms, a viewer goes back to the same slot after each
+ * round. Viewers only need a cursor in the (shared) cached file, and a count
+ * of the packets sent so far, to derive sequence numbers and timestamps. */
+typedef struct janus_streaming_playout_viewer {
+	janus_streaming_session *session;
+	janus_streaming_mountpoint *mountpoint;
+	gsize offset;		/* Where we are in the file */
+	guint32 sent;		/* How many packets we sent so far */
+} janus_streaming_playout_viewer;
+
+static void janus_streaming_playout_viewer_free(janus_streaming_playout_viewer *viewer) {
+	if(viewer == NULL)
+		return;
+	janus_refcount_decrease(&viewer->session->ref);
+	janus_refcount_decrease(&viewer->mountpoint->ref);
+	g_free(viewer);
+}
+
+/* Add a new viewer to the scheduler, caching the file of the mountpoint if
+ * this is the first time it's needed (the mountpoint mutex must be locked) */
+static int janus_streaming_playout_add(janus_streaming_session *session, janus_streaming_mountpoint *mp) {
+	if(session == NULL || mp == NULL)
+		return -1;
+	janus_streaming_file_source *source = mp->source;
+	if(source == NULL || source->filename == NULL) {
+		JANUS_LOG(LOG_ERR, "[%s] Invalid file source mountpoint!\n", mp->name);
+		return -1;
 	}
-	if(mountpoint->streaming_type != janus_streaming_type_on_demand) {
-		JANUS_LOG(LOG_ERR, "[%s] Not an on-demand file source mountpoint!\n", mountpoint->name);
-		janus_refcount_decrease(&session->ref);
-		janus_refcount_decrease(&mountpoint->ref);
-		g_thread_unref(g_thread_self());
-		return NULL;
+	if(source->cache == NULL) {
+		/* We read the whole file rather than mapping it, as it may be changed
+		 * (e.g., truncated) while we use it, and we'd crash accessing it then */
+		GError *error = NULL;
+		gchar *contents = NULL;
+		gsize size = 0;
+		if(!g_file_get_contents(source->filename, &contents, &size, &error)) {
+			JANUS_LOG(LOG_ERR, "[%s] Couldn't open file source %s: %s\n", mp->name, source->filename,
+				error && error->message ? error->message : "??");
+			g_clear_error(&error);
+			return -1;
+		}
+		if(size == 0) {
+			JANUS_LOG(LOG_ERR, "[%s] File source %s is empty\n", mp->name, source->filename);
+			g_free(contents);
+			return -1;
+		}
+		source->cache = contents;
+		source->cache_size = size;
+		JANUS_LOG(LOG_VERB, "[%s] Cached file source %s (%zu bytes)\n", mp->name, source->filename, size);
 	}
+	janus_streaming_playout_viewer *viewer = g_malloc0(sizeof(janus_streaming_playout_viewer));
+	janus_refcount_increase(&session->ref);
+	janus_refcount_increase(&mp->ref);
+	viewer->session = session;
+	viewer->mountpoint = mp;
+	janus_mutex_lock(&playout_mutex);
+	/* Viewers are spread across the slots according to when they joined */
+	guint slot = (playout_tick + 1) % JANUS_STREAMING_PLAYOUT_SLOTS;
+	playout_wheel[slot] = g_list_prepend(playout_wheel[slot], viewer);
+	janus_mutex_unlock(&playout_mutex);
+	return 0;
+}
+
+/* Send the next packet to an on-demand viewer: returns FALSE if the viewer is gone */
+static gboolean janus_streaming_playout_send(janus_streaming_playout_viewer *viewer, char *buf) {
+	janus_streaming_session *session = viewer->session;
+	janus_streaming_mountpoint *mountpoint = viewer->mountpoint;
+	if(g_atomic_int_get(&mountpoint->destroyed) || session->stopping || g_atomic_int_get(&session->destroyed))
+		return FALSE;
+	/* If not started or paused, wait some more */
+	if(!session->started || session->paused || !mountpoint->enabled)
+		return TRUE;
 	janus_streaming_file_source *source = mountpoint->source;
-	if(source == NULL || source->filename == NULL) {
-		JANUS_LOG(LOG_ERR, "[%s] Invalid file source mountpoint!\n", mountpoint->name);
-		janus_refcount_decrease(&session->ref);
-		janus_refcount_decrease(&mountpoint->ref);
-		g_thread_unref(g_thread_self());
-		return NULL;
-	}
-	JANUS_LOG(LOG_VERB, "[%s] Opening file source %s...\n", mountpoint->name, source->filename);
-	FILE *audio = fopen(source->filename, "rb");
-	if(!audio) {
-		JANUS_LOG(LOG_ERR, "[%s] Ooops, audio file missing!\n", mountpoint->name);
-		janus_refcount_decrease(&session->ref);
-		janus_refcount_decrease(&mountpoint->ref);
-		g_thread_unref(g_thread_self());
-		return NULL;
+	if(viewer->offset >= source->cache_size) {
+		/* FIXME We're doing this forever... should this be configurable? */
+		JANUS_LOG(LOG_VERB, "[%s] Rewind! (%s)\n", mountpoint->name, source->filename);
+		viewer->offset = 0;
+		return TRUE;
 	}
-	JANUS_LOG(LOG_VERB, "[%s] Streaming audio file: %s\n", mountpoint->name, source->filename);
-	/* Buffer */
-	char *buf = g_malloc0(1024);
-	char *name = g_strdup(mountpoint->name ? mountpoint->name : "??");
-	/* Set up RTP */
-	gint16 seq = 1;
-	gint32 ts = 0;
+	if(mountpoint->active == FALSE)
+		mountpoint->active = TRUE;
+	/* The last frame in the file may be shorter than the others */
+	gsize len = source->cache_size - viewer->offset;
+	if(len > JANUS_STREAMING_PLAYOUT_FRAME)
+		len = JANUS_STREAMING_PLAYOUT_FRAME;
+	/* Prepare the RTP packet */
 	janus_rtp_header *header = (janus_rtp_header *)buf;
+	memset(header, 0, RTP_HEADER_SIZE);
 	header->version = 2;
-	header->markerbit = 1;
+	header->markerbit = (viewer->sent == 0);
 	header->type = mountpoint->codecs.audio_pt;
-	header->seq_number = htons(seq);
-	header->timestamp = htonl(ts);
+	header->seq_number = htons((guint16)(viewer->sent + 1));
+	header->timestamp = htonl(viewer->sent * JANUS_STREAMING_PLAYOUT_FRAME);
 	header->ssrc = htonl(1);	/* The gateway will fix this anyway */
-	/* Timer */
-	struct timeval now, before;
-	gettimeofday(&before, NULL);
-	now.tv_sec = before.tv_sec;
-	now.tv_usec = before.tv_usec;
-	time_t passed, d_s, d_us;
-	/* Loop */
-	gint read = 0;
+	memcpy(buf + RTP_HEADER_SIZE, source->cache + viewer->offset, len);
+	viewer->offset += len;
+	viewer->sent++;
+	/* Relay to the viewer */
 	janus_streaming_rtp_relay_packet packet;
-	while(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&mountpoint->destroyed) && !session->stopping && !g_atomic_int_get(&session->destroyed)) {
-		/* See if it's time to prepare a frame */
-		gettimeofday(&now, NULL);
-		d_s = now.tv_sec - before.tv_sec;
-		d_us = now.tv_usec - before.tv_usec;
-		if(d_us < 0) {
-			d_us += 1000000;
-			--d_s;
-		}
-		passed = d_s*1000000 + d_us;
-		if(passed < 18000) {	/* Let's wait about 18ms */
-			g_usleep(5000);
+	memset(&packet, 0, sizeof(packet));
+	packet.data = header;
+	packet.length = RTP_HEADER_SIZE + len;
+	packet.is_rtp = TRUE;
+	packet.is_video = FALSE;
+	packet.is_keyframe = FALSE;
+	/* Backup the actual timestamp and sequence number */
+	packet.timestamp = ntohl(packet.data->timestamp);
+	packet.seq_number = ntohs(packet.data->seq_number);
+	packet.received = janus_get_monotonic_time();
+	/* Go! */
+	janus_streaming_relay_rtp_packet(session, &packet);
+	return TRUE;
+}
+
+/* Thread to send RTP packets from files to all on-demand viewers */
+static void *janus_streaming_playout_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining Streaming on-demand playout thread\n");
+	char buf[RTP_HEADER_SIZE + JANUS_STREAMING_PLAYOUT_FRAME];
+	gint64 now = 0, next = janus_get_monotonic_time();
+	while(!g_atomic_int_get(&stopping)) {
+		now = janus_get_monotonic_time();
+		if(now < next) {
+			g_usleep(next - now);
 			continue;
 		}
-		/* Update the reference time */
-		before.tv_usec += 20000;
-		if(before.tv_usec > 1000000) {
-			before.tv_sec++;
-			before.tv_usec -= 1000000;
-		}
-		/* If not started or paused, wait some more */
-		if(!session->started || session->paused || !mountpoint->enabled)
-			continue;
-		/* Read frame from file... */
-		read = fread(buf + RTP_HEADER_SIZE, sizeof(char), 160, audio);
-		if(feof(audio)) {
-			/* FIXME We're doing this forever... should this be configurable? */
-			JANUS_LOG(LOG_VERB, "[%s] Rewind! (%s)\n", name, source->filename);
-			fseek(audio, 0, SEEK_SET);
-			continue;
+		/* If we're way too late (e.g., the machine was suspended) don't try to catch up */
+		if(now - next > 100000)
+			next = now;
+		next += 1000;
+		janus_mutex_lock(&playout_mutex);
+		guint slot = playout_tick % JANUS_STREAMING_PLAYOUT_SLOTS;
+		playout_tick++;
+		GList *l = playout_wheel[slot];
+		while(l) {
+			GList *tmp = l->next;
+			janus_streaming_playout_viewer *viewer = (janus_streaming_playout_viewer *)l->data;
+			if(!janus_streaming_playout_send(viewer, buf)) {
+				JANUS_LOG(LOG_VERB, "[%s] On-demand viewer done\n", viewer->mountpoint->name);
+				playout_wheel[slot] = g_list_delete_link(playout_wheel[slot], l);
+				janus_streaming_playout_viewer_free(viewer);
+			}
+			l = tmp;
 		}
-		if(read < 0)
-			break;
-		if(mountpoint->active == FALSE)
-			mountpoint->active = TRUE;
-		//~ JANUS_LOG(LOG_VERB, " ... Preparing RTP packet (pt=%u, seq=%u, ts=%u)...\n",
-			//~ header->type, ntohs(header->seq_number), ntohl(header->timestamp));
-		//~ JANUS_LOG(LOG_VERB, " ... Read %d bytes from the audio file...\n", read);
-		/* Relay on all sessions */
-		packet.data = header;
-		packet.length = RTP_HEADER_SIZE + read;
-		packet.is_rtp = TRUE;
-		packet.is_video = FALSE;
-		packet.is_keyframe = FALSE;
-		/* Backup the actual timestamp and sequence number */
-		packet.timestamp = ntohl(packet.data->timestamp);
-		packet.seq_number = ntohs(packet.data->seq_number);
-		/* Go! */
-		janus_streaming_relay_rtp_packet(session, &packet);
-		/* Update header */
-		seq++;
-		header->seq_number = htons(seq);
-		ts += 160;
-		header->timestamp = htonl(ts);
-		header->markerbit = 0;
+		janus_mutex_unlock(&playout_mutex);
 	}
-	JANUS_LOG(LOG_VERB, "[%s] Leaving filesource (ondemand) thread\n", name);
-	g_free(name);
-	g_free(buf);
-	fclose(audio);
-	janus_refcount_decrease(&session->ref);
-	janus_refcount_decrease(&mountpoint->ref);
-	g_thread_unref(g_thread_self());
+	/* Get rid of the viewers that were still there */
+	janus_mutex_lock(&playout_mutex);
+	guint i = 0;
+	for(i=0; i<JANUS_STREAMING_PLAYOUT_SLOTS; i++) {
+		g_list_free_full(playout_wheel[i], (GDestroyNotify)janus_streaming_playout_viewer_free);
+		playout_wheel[i] = NULL;
+	}
+	janus_mutex_unlock(&playout_mutex);
+	JANUS_LOG(LOG_VERB, "Leaving Streaming on-demand playout thread\n");
 	return NULL;
 }
 
@@ -5188,6 +5715,7 @@ static void *janus_streaming_filesource_thread(void *data) {
 	/* Loop */
 	gint read = 0;
 	janus_streaming_rtp_relay_packet packet;
+	packet.shared = NULL;
 	while(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&mountpoint->destroyed)) {
 		/* See if it's time to prepare a frame */
 		gettimeofday(&now, NULL);
@@ -5235,10 +5763,16 @@ static void *janus_streaming_filesource_thread(void *data) {
 		/* Backup the actual timestamp and sequence number */
 		packet.timestamp = ntohl(packet.data->timestamp);
 		packet.seq_number = ntohs(packet.data->seq_number);
+		packet.received = janus_get_monotonic_time();
 		/* Go! */
 		janus_mutex_lock_nodebug(&mountpoint->mutex);
+		packet.shared = mountpoint->listeners ? janus_plugin_rtp_shared_new((char *)packet.data, packet.length) : NULL;
 		g_list_foreach(mountpoint->listeners, janus_streaming_relay_rtp_packet, &packet);
 		janus_mutex_unlock_nodebug(&mountpoint->mutex);
+		if(packet.shared != NULL) {
+			janus_refcount_decrease(&packet.shared->ref);
+			packet.shared = NULL;
+		}
 		/* Update header */
 		seq++;
 		header->seq_number = htons(seq);
@@ -5254,8 +5788,941 @@ static void *janus_streaming_filesource_thread(void *data) {
 	return NULL;
 }
 		
-/* Thread to relay RTP frames coming from gstreamer/ffmpeg/others */
-static void *janus_streaming_relay_thread(void *data) {
+/* Edge-origin relaying: edges subscribe to mountpoints on origins, and keep
+ * their subscription alive, with small JSON messages sent over UDP to the
+ * relay port of the origin; origins answer with an ack, and send the RTP
+ * packets of the mountpoint to the ports the edge asked for. Before doing
+ * anything for an edge, origins challenge it with a nonce bound to its
+ * address, which the edge must echo back: this way we never send anything
+ * but the challenge to an address that didn't prove it asked for it. When
+ * a relay_secret is configured, all messages are signed with it as well */
+static void janus_streaming_relay_nonce_reset(janus_streaming_relay *relay) {
+	memset(relay->nonce, '0', JANUS_STREAMING_RELAY_NONCE_LEN);
+	relay->nonce[JANUS_STREAMING_RELAY_NONCE_LEN] = '\0';
+}
+
+static janus_streaming_relay *janus_streaming_relay_new(const char *origins, guint64 origin_id, const char *pin) {
+	if(origins == NULL || origin_id == 0)
+		return NULL;
+	janus_streaming_relay *relay = g_malloc0(sizeof(janus_streaming_relay));
+	gchar **list = g_strsplit(origins, ",", -1);
+	int i = 0;
+	for(i=0; list[i] != NULL; i++) {
+		gchar *origin = g_strstrip(list[i]);
+		gchar *colon = strrchr(origin, ':');
+		if(colon == NULL || atoi(colon+1) <= 0 || atoi(colon+1) > 65535) {
+			JANUS_LOG(LOG_ERR, "Invalid origin '%s' (should be host:port)\n", origin);
+			continue;
+		}
+		*colon = '\0';
+		struct addrinfo hints, *res = NULL;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_DGRAM;
+		if(getaddrinfo(origin, NULL, &hints, &res) != 0 || res == NULL) {
+			JANUS_LOG(LOG_ERR, "Couldn't resolve origin '%s'\n", origin);
+			if(res)
+				freeaddrinfo(res);
+			continue;
+		}
+		struct sockaddr_in address;
+		memcpy(&address, res->ai_addr, sizeof(address));
+		address.sin_port = htons(atoi(colon+1));
+		freeaddrinfo(res);
+		relay->origins = g_realloc(relay->origins, (relay->origins_num+1) * sizeof(struct sockaddr_in));
+		relay->origins[relay->origins_num] = address;
+		relay->origins_num++;
+	}
+	g_strfreev(list);
+	if(relay->origins_num == 0) {
+		g_free(relay);
+		return NULL;
+	}
+	relay->origins_text = g_strdup(origins);
+	relay->origin_id = origin_id;
+	relay->origin_pin = pin ? g_strdup(pin) : NULL;
+	janus_streaming_relay_nonce_reset(relay);
+	janus_mutex_init(&relay->mutex);
+	return relay;
+}
+
+static void janus_streaming_relay_free(janus_streaming_relay *relay) {
+	if(relay == NULL)
+		return;
+	g_free(relay->origins);
+	g_free(relay->origins_text);
+	g_free(relay->origin_pin);
+	g_free(relay);
+}
+
+/* Helper to compute the HMAC-SHA256 of a text, as a (possibly truncated) hex string */
+static void janus_streaming_relay_hmac(const void *key, int key_len, const char *text, char *hex, size_t hex_len) {
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned int len = 0, i = 0;
+	hex[0] = '\0';
+	if(HMAC(EVP_sha256(), key, key_len, (const unsigned char *)text, strlen(text), digest, &len) == NULL)
+		return;
+	for(i=0; i<len && 2*i+2 < hex_len; i++)
+		g_snprintf(hex + 2*i, 3, "%02x", digest[i]);
+}
+
+/* Nonces are bound to the address of the edge, the mountpoints involved, and a time period */
+static void janus_streaming_relay_nonce(struct sockaddr_in *remote, guint64 id, guint64 edge_id, gint64 period, char *nonce) {
+	char text[128];
+	g_snprintf(text, sizeof(text), "%"SCNu32":%"SCNu16":%"SCNu64":%"SCNu64":%"SCNi64,
+		ntohl(remote->sin_addr.s_addr), ntohs(remote->sin_port), id, edge_id, period);
+	janus_streaming_relay_hmac(relay_cookie_key, sizeof(relay_cookie_key), text, nonce, JANUS_STREAMING_RELAY_NONCE_LEN+1);
+}
+
+static gboolean janus_streaming_relay_nonce_check(const char *nonce, struct sockaddr_in *remote, guint64 id, guint64 edge_id) {
+	if(nonce == NULL || strlen(nonce) != JANUS_STREAMING_RELAY_NONCE_LEN)
+		return FALSE;
+	/* Nonces from the previous period are fine too, edges will get a new one soon */
+	gint64 period = janus_get_real_time() / (JANUS_STREAMING_RELAY_NONCE_PERIOD*G_USEC_PER_SEC);
+	char expected[JANUS_STREAMING_RELAY_NONCE_LEN+1];
+	int i = 0;
+	for(i=0; i<2; i++) {
+		janus_streaming_relay_nonce(remote, id, edge_id, period-i, expected);
+		if(janus_strcmp_const_time(nonce, expected))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/* If we have a secret, check the message was signed with it, and is recent */
+static gboolean janus_streaming_relay_verify(json_t *root) {
+	if(relay_secret == NULL)
+		return TRUE;
+	json_t *sig = json_object_get(root, "signature");
+	if(sig == NULL || !json_is_string(sig))
+		return FALSE;
+	gint64 timestamp = json_integer_value(json_object_get(root, "timestamp"));
+	gint64 now = janus_get_real_time() / G_USEC_PER_SEC;
+	if(timestamp < now - JANUS_STREAMING_RELAY_NONCE_PERIOD || timestamp > now + JANUS_STREAMING_RELAY_NONCE_PERIOD)
+		return FALSE;
+	/* The signature covers the message without the signature itself */
+	char *signature = g_strdup(json_string_value(sig));
+	json_object_del(root, "signature");
+	char *text = json_dumps(root, JSON_COMPACT | JSON_SORT_KEYS);
+	gboolean valid = FALSE;
+	if(text != NULL) {
+		char expected[2*EVP_MAX_MD_SIZE+1];
+		janus_streaming_relay_hmac(relay_secret, strlen(relay_secret), text, expected, sizeof(expected));
+		valid = janus_strcmp_const_time(signature, expected);
+		free(text);
+	}
+	g_free(signature);
+	return valid;
+}
+
+/* Helper to send a control message to a relay peer: if max_len is not 0,
+ * the message is only sent if it's not larger than that */
+static void janus_streaming_relay_send_limited(const char *request, guint64 id, guint64 edge_id, json_t *extra,
+		struct sockaddr_in *peer, size_t max_len) {
+	if(relay_fd < 0 || peer == NULL) {
+		json_decref(extra);
+		return;
+	}
+	json_t *msg = extra ? extra : json_object();
+	json_object_set_new(msg, "relay", json_string(request));
+	json_object_set_new(msg, "id", json_integer(id));
+	if(edge_id > 0)
+		json_object_set_new(msg, "edge_id", json_integer(edge_id));
+	if(relay_secret != NULL) {
+		/* Sign the message, with a timestamp to limit replays */
+		json_object_set_new(msg, "timestamp", json_integer(janus_get_real_time() / G_USEC_PER_SEC));
+		char *unsigned_text = json_dumps(msg, JSON_COMPACT | JSON_SORT_KEYS);
+		if(unsigned_text != NULL) {
+			char signature[2*EVP_MAX_MD_SIZE+1];
+			janus_streaming_relay_hmac(relay_secret, strlen(relay_secret), unsigned_text, signature, sizeof(signature));
+			json_object_set_new(msg, "signature", json_string(signature));
+			free(unsigned_text);
+		}
+	}
+	char *text = json_dumps(msg, JSON_COMPACT | JSON_SORT_KEYS);
+	json_decref(msg);
+	if(text == NULL)
+		return;
+	if(max_len > 0 && strlen(text) > max_len) {
+		JANUS_LOG(LOG_HUGE, "Not sending relay '%s' message, larger than the request (%zu > %zu)\n",
+			request, strlen(text), max_len);
+	} else if(sendto(relay_fd, text, strlen(text), 0, (struct sockaddr *)peer, sizeof(struct sockaddr_in)) < 0) {
+		JANUS_LOG(LOG_HUGE, "Error sending relay '%s' message: %d (%s)\n", request, errno, strerror(errno));
+	}
+	free(text);
+}
+
+static void janus_streaming_relay_send(const char *request, guint64 id, guint64 edge_id, json_t *extra, struct sockaddr_in *peer) {
+	janus_streaming_relay_send_limited(request, id, edge_id, extra, peer, 0);
+}
+
+/* Edge: send a request to the current origin (relay mutex locked), echoing the
+ * nonce it challenged us with: until we have one we send a placeholder of the
+ * same length, since origins ignore requests smaller than the challenge */
+static void janus_streaming_relay_send_origin(janus_streaming_mountpoint *mp, const char *request, json_t *extra) {
+	janus_streaming_relay *relay = mp->relay;
+	json_t *msg = extra ? extra : json_object();
+	json_object_set_new(msg, "nonce", json_string(relay->nonce));
+	janus_streaming_relay_send(request, relay->origin_id, mp->id, msg, &relay->origins[relay->current]);
+}
+
+/* Edge: (re)subscribe to the current origin, which also works as a keep-alive */
+static void janus_streaming_relay_subscribe(janus_streaming_mountpoint *mp) {
+	janus_streaming_relay *relay = mp->relay;
+	janus_streaming_rtp_source *source = mp->source;
+	json_t *extra = json_object();
+	if(source->audio_port > 0)
+		json_object_set_new(extra, "audioport", json_integer(source->audio_port));
+	if(source->video_port[0] > 0)
+		json_object_set_new(extra, "videoport", json_integer(source->video_port[0]));
+	if(relay->origin_pin)
+		json_object_set_new(extra, "pin", json_string(relay->origin_pin));
+	janus_streaming_relay_send_origin(mp, "subscribe", extra);
+}
+
+static void janus_streaming_relay_unsubscribe(janus_streaming_mountpoint *mp) {
+	janus_streaming_relay *relay = mp->relay;
+	if(relay == NULL)
+		return;
+	janus_mutex_lock(&relay->mutex);
+	janus_streaming_relay_send_origin(mp, "unsubscribe", NULL);
+	janus_mutex_unlock(&relay->mutex);
+}
+
+/* Edge: ask the origin for a keyframe, e.g., because a viewer sent a PLI */
+static void janus_streaming_relay_request_keyframe(janus_streaming_mountpoint *mp) {
+	janus_streaming_relay *relay = mp->relay;
+	if(relay == NULL)
+		return;
+	gint64 now = janus_get_monotonic_time();
+	janus_mutex_lock(&relay->mutex);
+	/* Don't flood the origin with requests */
+	if(now - relay->last_keyframe_request >= G_USEC_PER_SEC) {
+		relay->last_keyframe_request = now;
+		JANUS_LOG(LOG_VERB, "[%s] Asking origin for a keyframe\n", mp->name);
+		janus_streaming_relay_send_origin(mp, "keyframe", NULL);
+	}
+	janus_mutex_unlock(&relay->mutex);
+}
+
+/* Origin: send the RTP packets of a mountpoint to the edges subscribed to it
+ * (the mountpoint mutex must be locked); we only relay the base substream */
+static void janus_streaming_relay_to_subscribers(janus_streaming_mountpoint *mp, janus_streaming_rtp_relay_packet *packet) {
+	if(mp->subscribers == NULL || relay_fd < 0 || !packet->is_rtp || (packet->is_video && packet->substream > 0))
+		return;
+	GList *l = mp->subscribers;
+	while(l) {
+		janus_streaming_relay_subscriber *s = (janus_streaming_relay_subscriber *)l->data;
+		struct sockaddr_in *peer = packet->is_video ? &s->video : &s->audio;
+		if(peer->sin_port != 0)
+			sendto(relay_fd, (char *)packet->data, packet->length, 0, (struct sockaddr *)peer, sizeof(struct sockaddr_in));
+		l = l->next;
+	}
+}
+
+/* Origin: send the cached GOP, if any, to an edge, so that it can start right away */
+static void janus_streaming_relay_send_gop(janus_streaming_mountpoint *mp, janus_streaming_relay_subscriber *s) {
+	janus_streaming_rtp_source *source = mp->source;
+	if(!source->keyframe.enabled)
+		return;
+	janus_mutex_lock(&source->keyframe.mutex);
+	if(source->keyframe.gop_valid[0] && source->keyframe.gop[0] != NULL) {
+		GList *temp = source->keyframe.gop[0]->head;
+		while(temp) {
+			janus_streaming_rtp_relay_packet *pkt = (janus_streaming_rtp_relay_packet *)temp->data;
+			struct sockaddr_in *peer = pkt->is_video ? &s->video : &s->audio;
+			if(peer->sin_port != 0)
+				sendto(relay_fd, (char *)pkt->data, pkt->length, 0, (struct sockaddr *)peer, sizeof(struct sockaddr_in));
+			temp = temp->next;
+		}
+	}
+	janus_mutex_unlock(&source->keyframe.mutex);
+}
+
+/* Find a subscriber by the address its control messages come from (mountpoint mutex locked) */
+static janus_streaming_relay_subscriber *janus_streaming_relay_find_subscriber(janus_streaming_mountpoint *mp, guint64 edge_id, struct sockaddr_in *remote) {
+	GList *l = mp->subscribers;
+	while(l) {
+		janus_streaming_relay_subscriber *s = (janus_streaming_relay_subscriber *)l->data;
+		if(s->edge_id == edge_id && s->control.sin_addr.s_addr == remote->sin_addr.s_addr && s->control.sin_port == remote->sin_port)
+			return s;
+		l = l->next;
+	}
+	return NULL;
+}
+
+/* Handle a control message coming from an edge (if we're an origin) or an origin (if we're an edge) */
+static void janus_streaming_relay_handle_message(char *buffer, size_t len, struct sockaddr_in *remote) {
+	json_error_t error;
+	json_t *root = json_loads(buffer, 0, &error);
+	if(root == NULL || !json_is_object(root)) {
+		JANUS_LOG(LOG_WARN, "Invalid relay message: %s\n", root ? "not an object" : error.text);
+		json_decref(root);
+		return;
+	}
+	if(!janus_streaming_relay_verify(root)) {
+		JANUS_LOG(LOG_WARN, "Invalid signature in relay message from %s:%d, ignoring\n",
+			inet_ntoa(remote->sin_addr), ntohs(remote->sin_port));
+		json_decref(root);
+		return;
+	}
+	const char *request = json_string_value(json_object_get(root, "relay"));
+	guint64 id = json_integer_value(json_object_get(root, "id"));
+	guint64 edge_id = json_integer_value(json_object_get(root, "edge_id"));
+	if(request == NULL || id == 0) {
+		json_decref(root);
+		return;
+	}
+	if(!strcasecmp(request, "ack") || !strcasecmp(request, "error") || !strcasecmp(request, "challenge")) {
+		/* We're an edge, and this is about one of our relay mountpoints */
+		janus_mutex_lock(&mountpoints_mutex);
+		janus_streaming_mountpoint *mp = g_hash_table_lookup(mountpoints, &edge_id);
+		if(mp != NULL && mp->relay != NULL && mp->relay->origin_id == id) {
+			janus_streaming_relay *relay = mp->relay;
+			janus_mutex_lock(&relay->mutex);
+			struct sockaddr_in *origin = &relay->origins[relay->current];
+			if(origin->sin_addr.s_addr == remote->sin_addr.s_addr && origin->sin_port == remote->sin_port) {
+				if(!strcasecmp(request, "ack")) {
+					if(relay->last_ack == 0)
+						JANUS_LOG(LOG_INFO, "[%s] Subscribed to origin #%d\n", mp->name, relay->current+1);
+					relay->last_ack = janus_get_monotonic_time();
+				} else if(!strcasecmp(request, "challenge")) {
+					/* Echo the nonce back right away */
+					const char *nonce = json_string_value(json_object_get(root, "nonce"));
+					if(nonce != NULL && strlen(nonce) == JANUS_STREAMING_RELAY_NONCE_LEN) {
+						g_strlcpy(relay->nonce, nonce, sizeof(relay->nonce));
+						janus_streaming_relay_subscribe(mp);
+					}
+				} else {
+					JANUS_LOG(LOG_WARN, "[%s] Origin #%d refused our subscription: %s\n", mp->name, relay->current+1,
+						json_string_value(json_object_get(root, "error")));
+				}
+			}
+			janus_mutex_unlock(&relay->mutex);
+		}
+		janus_mutex_unlock(&mountpoints_mutex);
+		json_decref(root);
+		return;
+	}
+	/* If we got here, we're an origin and this comes from an edge */
+	if(relay_port == 0) {
+		json_decref(root);
+		return;
+	}
+	if(!janus_streaming_relay_nonce_check(json_string_value(json_object_get(root, "nonce")), remote, id, edge_id)) {
+		/* We don't know if the edge is really there: the only thing we send is a
+		 * challenge, no larger than the request, and only for subscriptions */
+		if(!strcasecmp(request, "subscribe")) {
+			char nonce[JANUS_STREAMING_RELAY_NONCE_LEN+1];
+			janus_streaming_relay_nonce(remote, id, edge_id,
+				janus_get_real_time() / (JANUS_STREAMING_RELAY_NONCE_PERIOD*G_USEC_PER_SEC), nonce);
+			json_t *extra = json_object();
+			json_object_set_new(extra, "nonce", json_string(nonce));
+			janus_streaming_relay_send_limited("challenge", id, edge_id, extra, remote, len);
+		}
+		json_decref(root);
+		return;
+	}
+	janus_mutex_lock(&mountpoints_mutex);
+	janus_streaming_mountpoint *mp = g_hash_table_lookup(mountpoints, &id);
+	if(mp == NULL || mp->streaming_source != janus_streaming_source_rtp || g_atomic_int_get(&mp->destroyed)) {
+		janus_mutex_unlock(&mountpoints_mutex);
+		json_t *extra = json_object();
+		json_object_set_new(extra, "error", json_string("No such mountpoint"));
+		janus_streaming_relay_send("error", id, edge_id, extra, remote);
+		json_decref(root);
+		return;
+	}
+	janus_refcount_increase(&mp->ref);
+	janus_mutex_unlock(&mountpoints_mutex);
+	janus_mutex_lock(&mp->mutex);
+	janus_streaming_relay_subscriber *s = janus_streaming_relay_find_subscriber(mp, edge_id, remote);
+	if(!strcasecmp(request, "subscribe")) {
+		const char *pin = json_string_value(json_object_get(root, "pin"));
+		if(mp->pin && (pin == NULL || strcmp(mp->pin, pin))) {
+			janus_mutex_unlock(&mp->mutex);
+			json_t *extra = json_object();
+			json_object_set_new(extra, "error", json_string("Unauthorized (wrong pin)"));
+			janus_streaming_relay_send("error", id, edge_id, extra, remote);
+		} else {
+			gboolean new_subscriber = (s == NULL);
+			if(new_subscriber) {
+				s = g_malloc0(sizeof(janus_streaming_relay_subscriber));
+				s->edge_id = edge_id;
+				s->control = *remote;
+				mp->subscribers = g_list_append(mp->subscribers, s);
+			}
+			/* Media goes to the same host the subscription came from */
+			int aport = json_integer_value(json_object_get(root, "audioport"));
+			int vport = json_integer_value(json_object_get(root, "videoport"));
+			s->audio = *remote;
+			s->audio.sin_port = (aport > 0 && aport < 65536) ? htons(aport) : 0;
+			s->video = *remote;
+			s->video.sin_port = (vport > 0 && vport < 65536) ? htons(vport) : 0;
+			s->last_seen = janus_get_monotonic_time();
+			if(new_subscriber) {
+				JANUS_LOG(LOG_INFO, "[%s] New edge subscribed (%s:%d, %d subscribers)\n", mp->name,
+					inet_ntoa(remote->sin_addr), ntohs(remote->sin_port), g_list_length(mp->subscribers));
+				janus_streaming_relay_send_gop(mp, s);
+			}
+			janus_mutex_unlock(&mp->mutex);
+			janus_streaming_relay_send("ack", id, edge_id, NULL, remote);
+		}
+	} else if(!strcasecmp(request, "unsubscribe")) {
+		if(s != NULL) {
+			mp->subscribers = g_list_remove(mp->subscribers, s);
+			g_free(s);
+			JANUS_LOG(LOG_INFO, "[%s] Edge unsubscribed (%d subscribers)\n", mp->name, g_list_length(mp->subscribers));
+		}
+		janus_mutex_unlock(&mp->mutex);
+	} else if(!strcasecmp(request, "keyframe")) {
+		if(s != NULL) {
+			/* Send what we have, and if we're an edge ourselves, ask further up */
+			janus_streaming_relay_send_gop(mp, s);
+		}
+		janus_mutex_unlock(&mp->mutex);
+		if(s != NULL && mp->relay != NULL)
+			janus_streaming_relay_request_keyframe(mp);
+	} else {
+		janus_mutex_unlock(&mp->mutex);
+		JANUS_LOG(LOG_WARN, "Unknown relay request '%s'\n", request);
+	}
+	janus_refcount_decrease(&mp->ref);
+	json_decref(root);
+}
+
+/* Periodic checks: origins get rid of edges that went away, and edges keep
+ * their subscriptions alive, failing over to the next origin when needed */
+static void janus_streaming_relay_check(gint64 now) {
+	janus_mutex_lock(&mountpoints_mutex);
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, mountpoints);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_streaming_mountpoint *mp = value;
+		if(g_atomic_int_get(&mp->destroyed))
+			continue;
+		if(mp->subscribers != NULL) {
+			janus_mutex_lock(&mp->mutex);
+			GList *l = mp->subscribers;
+			while(l) {
+				GList *next = l->next;
+				janus_streaming_relay_subscriber *s = (janus_streaming_relay_subscriber *)l->data;
+				if(now - s->last_seen > JANUS_STREAMING_RELAY_TIMEOUT) {
+					JANUS_LOG(LOG_WARN, "[%s] Edge %s:%d timed out\n", mp->name,
+						inet_ntoa(s->control.sin_addr), ntohs(s->control.sin_port));
+					mp->subscribers = g_list_delete_link(mp->subscribers, l);
+					g_free(s);
+				}
+				l = next;
+			}
+			janus_mutex_unlock(&mp->mutex);
+		}
+		janus_streaming_relay *relay = mp->relay;
+		if(relay == NULL)
+			continue;
+		janus_streaming_rtp_source *source = mp->source;
+		janus_mutex_lock(&relay->mutex);
+		/* Is the current origin still alive? We check both acks and media */
+		gint64 last_media = MAX(source->last_received_audio, source->last_received_video);
+		gboolean failed = FALSE;
+		if(relay->subscribed == 0) {
+			relay->subscribed = now;
+		} else if(now - MAX(relay->last_ack, relay->subscribed) > JANUS_STREAMING_RELAY_FAILOVER) {
+			failed = TRUE;
+		} else if(relay->last_ack > 0 && now - MAX(last_media, relay->subscribed) > 2*JANUS_STREAMING_RELAY_FAILOVER) {
+			failed = TRUE;
+		}
+		if(failed) {
+			janus_streaming_relay_send_origin(mp, "unsubscribe", NULL);
+			int previous = relay->current;
+			relay->current = (relay->current + 1) % relay->origins_num;
+			janus_streaming_relay_nonce_reset(relay);
+			if(relay->origins_num > 1) {
+				JANUS_LOG(LOG_WARN, "[%s] Origin #%d not responding, failing over to origin #%d\n",
+					mp->name, previous+1, relay->current+1);
+			} else if(relay->last_ack > 0) {
+				JANUS_LOG(LOG_WARN, "[%s] Origin not responding, retrying\n", mp->name);
+			}
+			relay->subscribed = now;
+			relay->last_ack = 0;
+			relay->failovers++;
+		}
+		janus_streaming_relay_subscribe(mp);
+		janus_mutex_unlock(&relay->mutex);
+	}
+	janus_mutex_unlock(&mountpoints_mutex);
+}
+
+/* Thread handling the relay control socket */
+static void *janus_streaming_relay_control_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining Streaming relay control thread\n");
+	char buffer[1500];
+	struct pollfd fds[1];
+	gint64 last_check = 0;
+	while(!g_atomic_int_get(&stopping)) {
+		fds[0].fd = relay_fd;
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		int res = poll(fds, 1, 250);
+		if(res < 0) {
+			if(errno == EINTR)
+				continue;
+			JANUS_LOG(LOG_ERR, "Error polling the relay control socket: %d (%s)\n", errno, strerror(errno));
+			break;
+		}
+		if(res > 0 && (fds[0].revents & POLLIN)) {
+			struct sockaddr_in remote;
+			socklen_t addrlen = sizeof(remote);
+			int len = recvfrom(relay_fd, buffer, sizeof(buffer)-1, 0, (struct sockaddr *)&remote, &addrlen);
+			if(len > 0) {
+				buffer[len] = '\0';
+				janus_streaming_relay_handle_message(buffer, len, &remote);
+			}
+		}
+		gint64 now = janus_get_monotonic_time();
+		if(now - last_check >= G_USEC_PER_SEC) {
+			last_check = now;
+			janus_streaming_relay_check(now);
+		}
+	}
+	JANUS_LOG(LOG_VERB, "Leaving Streaming relay control thread\n");
+	return NULL;
+}
+
+/* Placeholder we queue to tell a helper thread it's time to wrap up */
+static janus_streaming_rtp_relay_packet exit_packet;
+
+/* Helpers to copy a packet for a helper thread, and to get rid of the copy */
+#define JANUS_STREAMING_HELPER_PAYLOAD_PREFIX	64
+static janus_streaming_rtp_relay_packet *janus_streaming_helper_packet_copy(janus_streaming_rtp_relay_packet *packet) {
+	janus_streaming_rtp_relay_packet *copy = g_malloc(sizeof(janus_streaming_rtp_relay_packet));
+	*copy = *packet;
+	if(copy->is_rtp && copy->shared != NULL) {
+		/* Viewers update the header of the packet (and the VP8 payload descriptor)
+		 * before relaying it, so each helper needs its own copy of that: the rest
+		 * of the payload is in the shared packet, so we only keep what's needed
+		 * to inspect the payload (e.g., to check if it's a keyframe) */
+		int plen = 0;
+		char *payload = janus_rtp_payload((char *)packet->data, packet->length, &plen);
+		if(payload != NULL)
+			copy->length = (payload - (char *)packet->data) + MIN(plen, JANUS_STREAMING_HELPER_PAYLOAD_PREFIX);
+		janus_refcount_increase(&copy->shared->ref);
+	}
+	copy->data = g_malloc(copy->length);
+	memcpy(copy->data, packet->data, copy->length);
+	return copy;
+}
+
+static void janus_streaming_helper_packet_free(janus_streaming_rtp_relay_packet *packet) {
+	if(packet == NULL || packet == &exit_packet)
+		return;
+	if(packet->shared != NULL)
+		janus_refcount_decrease(&packet->shared->ref);
+	g_free(packet->data);
+	g_free(packet);
+}
+
+/* Spawn the helper threads of a mountpoint, if any were requested */
+static int janus_streaming_helpers_start(janus_streaming_mountpoint *mp, int threads) {
+	if(mp == NULL || threads < 1)
+		return 0;
+	int i = 0;
+	for(i=0; i<threads; i++) {
+		janus_streaming_helper *helper = g_malloc0(sizeof(janus_streaming_helper));
+		helper->mp = mp;
+		helper->id = i+1;
+		helper->queued_packets = g_async_queue_new();
+		janus_mutex_init(&helper->mutex);
+		mp->threads = g_list_append(mp->threads, helper);
+		mp->helper_threads++;
+		GError *error = NULL;
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "mp %"SCNu64"/%d", mp->id, helper->id);
+		helper->thread = g_thread_try_new(tname, &janus_streaming_helper_thread, helper, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "[%s] Got error %d (%s) trying to launch helper thread #%d...\n",
+				mp->name, error->code, error->message ? error->message : "??", helper->id);
+			g_error_free(error);
+			janus_streaming_helpers_stop(mp);
+			return -1;
+		}
+	}
+	JANUS_LOG(LOG_VERB, "[%s] Spawned %d helper threads\n", mp->name, mp->helper_threads);
+	return 0;
+}
+
+/* Stop and get rid of the helper threads of a mountpoint, if any */
+static void janus_streaming_helpers_stop(janus_streaming_mountpoint *mp) {
+	if(mp == NULL || mp->threads == NULL)
+		return;
+	GList *l = mp->threads;
+	while(l) {
+		janus_streaming_helper *helper = (janus_streaming_helper *)l->data;
+		if(helper->thread != NULL) {
+			g_async_queue_push(helper->queued_packets, &exit_packet);
+			g_thread_join(helper->thread);
+			helper->thread = NULL;
+		}
+		janus_streaming_rtp_relay_packet *pkt = NULL;
+		while((pkt = g_async_queue_try_pop(helper->queued_packets)) != NULL)
+			janus_streaming_helper_packet_free(pkt);
+		g_async_queue_unref(helper->queued_packets);
+		g_list_free(helper->viewers);
+		g_free(helper);
+		l = l->next;
+	}
+	g_list_free(mp->threads);
+	mp->threads = NULL;
+	mp->helper_threads = 0;
+}
+
+/* Assign a new viewer to the helper thread that is serving the fewest viewers
+ * (the mountpoint mutex must be locked when calling this) */
+static void janus_streaming_helper_add_viewer(janus_streaming_mountpoint *mp, gpointer session) {
+	if(mp == NULL || mp->helper_threads < 1 || session == NULL)
+		return;
+	janus_streaming_helper *helper = NULL;
+	GList *l = mp->threads;
+	while(l) {
+		janus_streaming_helper *h = (janus_streaming_helper *)l->data;
+		janus_mutex_lock(&h->mutex);
+		gboolean found = (g_list_find(h->viewers, session) != NULL);
+		janus_mutex_unlock(&h->mutex);
+		if(found) {
+			/* Already served by this helper, or it would get every packet twice */
+			return;
+		}
+		if(helper == NULL || g_atomic_int_get(&h->num_viewers) < g_atomic_int_get(&helper->num_viewers))
+			helper = h;
+		l = l->next;
+	}
+	janus_mutex_lock(&helper->mutex);
+	helper->viewers = g_list_append(helper->viewers, session);
+	g_atomic_int_inc(&helper->num_viewers);
+	janus_mutex_unlock(&helper->mutex);
+	JANUS_LOG(LOG_VERB, "[%s] Viewer assigned to helper thread #%d (%d viewers)\n",
+		mp->name, helper->id, g_atomic_int_get(&helper->num_viewers));
+}
+
+/* Remove a viewer from the helper thread serving it, if any: when this returns,
+ * the helper is guaranteed not to be relaying packets to this viewer anymore */
+static void janus_streaming_helper_remove_viewer(janus_streaming_mountpoint *mp, gpointer session) {
+	if(mp == NULL || mp->helper_threads < 1 || session == NULL)
+		return;
+	GList *l = mp->threads;
+	while(l) {
+		janus_streaming_helper *helper = (janus_streaming_helper *)l->data;
+		janus_mutex_lock(&helper->mutex);
+		if(g_list_find(helper->viewers, session) != NULL) {
+			helper->viewers = g_list_remove_all(helper->viewers, session);
+			g_atomic_int_dec_and_test(&helper->num_viewers);
+			janus_mutex_unlock(&helper->mutex);
+			return;
+		}
+		janus_mutex_unlock(&helper->mutex);
+		l = l->next;
+	}
+}
+
+/* Thread relaying the packets queued by the relay thread to a subset of the viewers */
+static void *janus_streaming_helper_thread(void *data) {
+	janus_streaming_helper *helper = (janus_streaming_helper *)data;
+	janus_streaming_mountpoint *mp = helper->mp;
+	JANUS_LOG(LOG_VERB, "[%s/#%d] Joining Streaming helper thread\n", mp->name, helper->id);
+	janus_streaming_rtp_relay_packet *pkt = NULL;
+	while(TRUE) {
+		pkt = g_async_queue_pop(helper->queued_packets);
+		if(pkt == &exit_packet)
+			break;
+		gint64 start = janus_get_monotonic_time();
+		janus_mutex_lock(&helper->mutex);
+		g_list_foreach(helper->viewers, janus_streaming_relay_rtp_packet, pkt);
+		janus_mutex_unlock(&helper->mutex);
+		gint64 elapsed = janus_get_monotonic_time() - start;
+		gint64 relay_time = __atomic_load_n(&helper->relay_time, __ATOMIC_RELAXED);
+		__atomic_store_n(&helper->relay_time, relay_time ? (relay_time*15 + elapsed)/16 : elapsed, __ATOMIC_RELAXED);
+		janus_streaming_helper_packet_free(pkt);
+	}
+	JANUS_LOG(LOG_VERB, "[%s/#%d] Leaving Streaming helper thread\n", mp->name, helper->id);
+	return NULL;
+}
+
+/* Relay a packet to all the listeners of a mountpoint: if the mountpoint has
+ * helper threads we just queue a copy for each of them, and they'll take care
+ * of their own share of the listeners */
+static void janus_streaming_relay_to_listeners(janus_streaming_mountpoint *mountpoint, janus_streaming_rtp_relay_packet *packet) {
+	gint64 start = janus_get_monotonic_time();
+	janus_mutex_lock(&mountpoint->mutex);
+	/* Any edge relaying this mountpoint? */
+	janus_streaming_relay_to_subscribers(mountpoint, packet);
+	if(mountpoint->listeners == NULL) {
+		janus_mutex_unlock(&mountpoint->mutex);
+		return;
+	}
+	/* Data is sent as it is, but RTP packets are shared by all listeners */
+	if(packet->is_rtp)
+		packet->shared = janus_plugin_rtp_shared_new((char *)packet->data, packet->length);
+	if(mountpoint->helper_threads > 0) {
+		GList *l = mountpoint->threads;
+		while(l) {
+			janus_streaming_helper *helper = (janus_streaming_helper *)l->data;
+			if(g_atomic_int_get(&helper->num_viewers) > 0)
+				g_async_queue_push(helper->queued_packets, janus_streaming_helper_packet_copy(packet));
+			l = l->next;
+		}
+	} else {
+		g_list_foreach(mountpoint->listeners, janus_streaming_relay_rtp_packet, packet);
+	}
+	janus_mutex_unlock(&mountpoint->mutex);
+	if(packet->shared != NULL) {
+		janus_refcount_decrease(&packet->shared->ref);
+		packet->shared = NULL;
+	}
+	gint64 elapsed = janus_get_monotonic_time() - start;
+	gint64 relay_time = __atomic_load_n(&mountpoint->relay_time, __ATOMIC_RELAXED);
+	__atomic_store_n(&mountpoint->relay_time, relay_time ? (relay_time*15 + elapsed)/16 : elapsed, __ATOMIC_RELAXED);
+}
+
+/* Packets we try to read from an RTP socket at a time, when we're notified it's readable */
+#define JANUS_STREAMING_RECV_BATCH	16
+typedef struct janus_streaming_recv_batch {
+	char buffers[JANUS_STREAMING_RECV_BATCH][1500];
+	int lengths[JANUS_STREAMING_RECV_BATCH];
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr msgs[JANUS_STREAMING_RECV_BATCH];
+	struct iovec iovs[JANUS_STREAMING_RECV_BATCH];
+	struct sockaddr_in remotes[JANUS_STREAMING_RECV_BATCH];
+	char controls[JANUS_STREAMING_RECV_BATCH][CMSG_SPACE(sizeof(uint32_t))];
+#endif
+} janus_streaming_recv_batch;
+
+/* Read as many packets as are available on a socket (up to a batch) with a
+ * single recvmmsg, where supported, and update how many packets the kernel
+ * dropped because the socket buffer was full, if it tells us: returns how
+ * many packets were read, or -1 in case of errors */
+static int janus_streaming_recv_packets(int fd, janus_streaming_recv_batch *batch, guint32 *drops) {
+#ifdef HAVE_RECVMMSG
+	int i = 0;
+	for(i=0; i<JANUS_STREAMING_RECV_BATCH; i++) {
+		batch->iovs[i].iov_base = batch->buffers[i];
+		batch->iovs[i].iov_len = sizeof(batch->buffers[i]);
+		struct msghdr *msg = &batch->msgs[i].msg_hdr;
+		memset(msg, 0, sizeof(*msg));
+		msg->msg_name = &batch->remotes[i];
+		msg->msg_namelen = sizeof(batch->remotes[i]);
+		msg->msg_iov = &batch->iovs[i];
+		msg->msg_iovlen = 1;
+		msg->msg_control = batch->controls[i];
+		msg->msg_controllen = sizeof(batch->controls[i]);
+	}
+	/* We've been told there's something to read, so we don't need to wait */
+	int count = recvmmsg(fd, batch->msgs, JANUS_STREAMING_RECV_BATCH, MSG_DONTWAIT, NULL);
+	if(count < 0)
+		return -1;
+	for(i=0; i<count; i++) {
+		batch->lengths[i] = batch->msgs[i].msg_len;
+#ifdef SO_RXQ_OVFL
+		struct cmsghdr *cmsg = NULL;
+		for(cmsg = CMSG_FIRSTHDR(&batch->msgs[i].msg_hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&batch->msgs[i].msg_hdr, cmsg)) {
+			if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+				memcpy(drops, CMSG_DATA(cmsg), sizeof(uint32_t));
+		}
+#endif
+	}
+	return count;
+#else
+	struct sockaddr_in remote;
+	socklen_t addrlen = sizeof(remote);
+	int bytes = recvfrom(fd, batch->buffers[0], sizeof(batch->buffers[0]), 0, (struct sockaddr*)&remote, &addrlen);
+	if(bytes < 0)
+		return -1;
+	batch->lengths[0] = bytes;
+	return 1;
+#endif
+}
+
+/* Relay an audio packet received by an RTP mountpoint to all its viewers */
+static void janus_streaming_relay_audio_packet(janus_streaming_mountpoint *mountpoint, const char *name,
+		char *buffer, int bytes, gint64 now, uint32_t *last_ssrc) {
+	janus_streaming_rtp_source *source = mountpoint->source;
+	janus_streaming_rtp_relay_packet packet;
+	memset(&packet, 0, sizeof(packet));
+	janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+	uint32_t ssrc = ntohl(rtp->ssrc);
+	if(source->rtp_collision > 0 && *last_ssrc && ssrc != *last_ssrc &&
+			(now-source->last_received_audio) < (gint64)1000*source->rtp_collision) {
+		JANUS_LOG(LOG_WARN, "[%s] RTP collision on audio mountpoint, dropping packet (ssrc=%u)\n", name, ssrc);
+		return;
+	}
+	source->last_received_audio = now;
+	//~ JANUS_LOG(LOG_VERB, "************************\nGot %d bytes on the audio channel...\n", bytes);
+	/* If paused, ignore this packet */
+	if(!mountpoint->enabled)
+		return;
+	/* Is this SRTP? */
+	if(source->is_srtp) {
+		int buflen = bytes;
+		srtp_err_status_t res = srtp_unprotect(source->srtp_ctx, buffer, &buflen);
+		//~ if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+		if(res != srtp_err_status_ok) {
+			guint32 timestamp = ntohl(rtp->timestamp);
+			guint16 seq = ntohs(rtp->seq_number);
+			JANUS_LOG(LOG_ERR, "[%s] Audio SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
+				name, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
+			return;
+		}
+		bytes = buflen;
+	}
+	//~ JANUS_LOG(LOG_VERB, " ... parsed RTP packet (ssrc=%u, pt=%u, seq=%u, ts=%u)...\n",
+		//~ ntohl(rtp->ssrc), rtp->type, ntohs(rtp->seq_number), ntohl(rtp->timestamp));
+	/* Relay on all sessions */
+	packet.data = rtp;
+	packet.length = bytes;
+	packet.is_rtp = TRUE;
+	packet.is_video = FALSE;
+	packet.is_keyframe = FALSE;
+	/* Do we have a new stream? */
+	if(ssrc != *last_ssrc) {
+		*last_ssrc = ssrc;
+		JANUS_LOG(LOG_INFO, "[%s] New audio stream! (ssrc=%u)\n", name, *last_ssrc);
+		janus_jitter_estimator_reset(&source->audio_jitter);
+	}
+	janus_jitter_estimator_update(&source->audio_jitter, ntohs(rtp->seq_number), ntohl(rtp->timestamp), now);
+	packet.data->type = mountpoint->codecs.audio_pt;
+	/* Is there a recorder? */
+	janus_rtp_header_update(packet.data, &source->context[0], FALSE, 0);
+	if (source->askew) {
+		int ret = janus_rtp_skew_compensate_audio(packet.data, &source->context[0], now);
+		if (ret < 0) {
+			JANUS_LOG(LOG_WARN, "[%s] Dropping %d packets, audio source clock is too fast (ssrc=%u)\n", name, -ret, *last_ssrc);
+			return;
+		} else if (ret > 0) {
+			JANUS_LOG(LOG_WARN, "[%s] Jumping %d RTP sequence numbers, audio source clock is too slow (ssrc=%u)\n", name, ret, *last_ssrc);
+		}
+	}
+	packet.data->ssrc = ntohl((uint32_t)mountpoint->id);
+	janus_recorder_save_frame(source->arc, buffer, bytes);
+	packet.data->ssrc = ssrc;
+	/* Backup the actual timestamp and sequence number set by the restreamer, in case switching is involved */
+	packet.timestamp = ntohl(packet.data->timestamp);
+	packet.seq_number = ntohs(packet.data->seq_number);
+	packet.received = now;
+	/* Add to the GOP we're caching, if any, as pre-roll for new viewers */
+	if(source->keyframe.enabled)
+		janus_streaming_gop_cache(mountpoint, &packet, FALSE);
+	/* Go! */
+	janus_streaming_relay_to_listeners(mountpoint, &packet);
+}
+
+/* Relay a video packet received by an RTP mountpoint to all its viewers,
+ * and keep track of keyframes, if we need to */
+static void janus_streaming_relay_video_packet(janus_streaming_mountpoint *mountpoint, const char *name,
+		int index, char *buffer, int bytes, gint64 now, uint32_t *last_ssrc) {
+	janus_streaming_rtp_source *source = mountpoint->source;
+	janus_streaming_rtp_relay_packet packet;
+	memset(&packet, 0, sizeof(packet));
+	janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+	uint32_t ssrc = ntohl(rtp->ssrc);
+	if(source->rtp_collision > 0 && *last_ssrc && ssrc != *last_ssrc &&
+			(now-source->last_received_video) < (gint64)1000*source->rtp_collision) {
+		JANUS_LOG(LOG_WARN, "[%s] RTP collision on video mountpoint, dropping packet (ssrc=%u)\n", name, ssrc);
+		return;
+	}
+	source->last_received_video = now;
+	//~ JANUS_LOG(LOG_VERB, "************************\nGot %d bytes on the video channel...\n", bytes);
+	/* Is this SRTP? */
+	if(source->is_srtp) {
+		int buflen = bytes;
+		srtp_err_status_t res = srtp_unprotect(source->srtp_ctx, buffer, &buflen);
+		//~ if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+		if(res != srtp_err_status_ok) {
+			guint32 timestamp = ntohl(rtp->timestamp);
+			guint16 seq = ntohs(rtp->seq_number);
+			JANUS_LOG(LOG_ERR, "[%s] Video SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
+				name, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
+			return;
+		}
+		bytes = buflen;
+	}
+	/* If paused, ignore this packet (and forget the GOP we were caching, as it would have a gap now) */
+	if(!mountpoint->enabled) {
+		if(source->keyframe.enabled && source->keyframe.gop_valid[index]) {
+			janus_mutex_lock(&source->keyframe.mutex);
+			janus_streaming_gop_clear(&source->keyframe, index);
+			janus_mutex_unlock(&source->keyframe.mutex);
+		}
+		return;
+	}
+	//~ JANUS_LOG(LOG_VERB, " ... parsed RTP packet (ssrc=%u, pt=%u, seq=%u, ts=%u)...\n",
+		//~ ntohl(rtp->ssrc), rtp->type, ntohs(rtp->seq_number), ntohl(rtp->timestamp));
+	/* Relay on all sessions */
+	packet.data = rtp;
+	packet.length = bytes;
+	packet.is_rtp = TRUE;
+	packet.is_video = TRUE;
+	packet.is_keyframe = FALSE;
+	packet.simulcast = source->simulcast;
+	packet.substream = index;
+	packet.codec = mountpoint->codecs.video_codec;
+	/* Do we have a new stream? */
+	if(ssrc != *last_ssrc) {
+		*last_ssrc = ssrc;
+		JANUS_LOG(LOG_INFO, "[%s] New video stream! (ssrc=%u, index %d)\n", name, *last_ssrc, index);
+		if(index == 0)
+			janus_jitter_estimator_reset(&source->video_jitter);
+	}
+	if(index == 0)
+		janus_jitter_estimator_update(&source->video_jitter, ntohs(rtp->seq_number), ntohl(rtp->timestamp), now);
+	packet.data->type = mountpoint->codecs.video_pt;
+	/* Is there a recorder? (FIXME notice we only record the first substream, if simulcasting) */
+	janus_rtp_header_update(packet.data, &source->context[index], TRUE, 0);
+	if (source->vskew) {
+		int ret = janus_rtp_skew_compensate_video(packet.data, &source->context[index], now);
+		if (ret < 0) {
+			JANUS_LOG(LOG_WARN, "[%s] Dropping %d packets, video source clock is too fast (ssrc=%u, index %d)\n", name, -ret, *last_ssrc, index);
+			return;
+		} else if (ret > 0) {
+			JANUS_LOG(LOG_WARN, "[%s] Jumping %d RTP sequence numbers, video source clock is too slow (ssrc=%u, index %d)\n", name, ret, *last_ssrc, index);
+		}
+	}
+	if(index == 0) {
+		packet.data->ssrc = ntohl((uint32_t)mountpoint->id);
+		janus_recorder_save_frame(source->vrc, buffer, bytes);
+		packet.data->ssrc = ssrc;
+	}
+	/* Backup the actual timestamp and sequence number set by the restreamer, in case switching is involved */
+	packet.timestamp = ntohl(packet.data->timestamp);
+	packet.seq_number = ntohs(packet.data->seq_number);
+	packet.received = now;
+	/* Is this (part of) a keyframe we need to start caching a new GOP from? */
+	if(source->keyframe.enabled) {
+		gboolean kf = FALSE;
+		int plen = 0;
+		char *payload = janus_rtp_payload((char *)packet.data, packet.length, &plen);
+		if(payload) {
+			switch(mountpoint->codecs.video_codec) {
+				case JANUS_STREAMING_VP8:
+					kf = janus_vp8_is_keyframe(payload, plen);
+					break;
+				case JANUS_STREAMING_VP9:
+					kf = janus_vp9_is_keyframe(payload, plen);
+					break;
+				case JANUS_STREAMING_H264:
+					kf = janus_h264_is_keyframe(payload, plen);
+					break;
+				default:
+					break;
+			}
+		}
+		janus_streaming_gop_cache(mountpoint, &packet, kf);
+	}
+	/* Go! */
+	janus_streaming_relay_to_listeners(mountpoint, &packet);
+}
+
+/* Thread to relay RTP frames coming from gstreamer/ffmpeg/others */
+static void *janus_streaming_relay_thread(void *data) {
 	JANUS_LOG(LOG_VERB, "Starting streaming relay thread\n");
 	janus_streaming_mountpoint *mountpoint = (janus_streaming_mountpoint *)data;
 	if(!mountpoint) {
@@ -5278,8 +6745,12 @@ static void *janus_streaming_relay_thread(void *data) {
 	int data_fd = source->data_fd;
 	int pipe_fd = source->pipefd[0];
 	char *name = g_strdup(mountpoint->name ? mountpoint->name : "??");
+	/* Stay on the same NUMA node as the viewers of this mountpoint, if needed */
+	char group[64];
+	g_snprintf(group, sizeof(group), "streaming-%"SCNu64, mountpoint->id);
+	janus_affinity_pin_plugin_thread(group);
 	/* Needed to fix seq and ts */
-	uint32_t ssrc = 0, a_last_ssrc = 0, v_last_ssrc[3] = {0, 0, 0};
+	uint32_t a_last_ssrc = 0, v_last_ssrc[3] = {0, 0, 0};
 	/* File descriptors */
 	socklen_t addrlen;
 	struct sockaddr_in remote;
@@ -5287,6 +6758,8 @@ static void *janus_streaming_relay_thread(void *data) {
 	struct pollfd fds[6];
 	char buffer[1500];
 	memset(buffer, 0, 1500);
+	/* Audio and video are read in batches */
+	janus_streaming_recv_batch *batch = g_malloc0(sizeof(janus_streaming_recv_batch));
 #ifdef HAVE_LIBCURL
 	/* In case this is an RTSP restreamer, we may have to send keep-alives from time to time */
 	gint64 now = janus_get_monotonic_time(), before = now, ka_timeout = 0;
@@ -5298,6 +6771,7 @@ static void *janus_streaming_relay_thread(void *data) {
 	/* Loop */
 	int num = 0;
 	janus_streaming_rtp_relay_packet packet;
+	packet.shared = NULL;
 	while(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&mountpoint->destroyed)) {
 #ifdef HAVE_LIBCURL
 		/* Let's check regularly if the RTSP server seems to be gone */
@@ -5480,73 +6954,10 @@ static void *janus_streaming_relay_thread(void *data) {
 #ifdef HAVE_LIBCURL
 					source->reconnect_timer = now;
 #endif
-					addrlen = sizeof(remote);
-					bytes = recvfrom(audio_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0) {
-						/* Failed to read? */
-						continue;
-					}
-					janus_rtp_header *rtp = (janus_rtp_header *)buffer;
-					ssrc = ntohl(rtp->ssrc);
-					if(source->rtp_collision > 0 && a_last_ssrc && ssrc != a_last_ssrc &&
-							(now-source->last_received_audio) < (gint64)1000*source->rtp_collision) {
-						JANUS_LOG(LOG_WARN, "[%s] RTP collision on audio mountpoint, dropping packet (ssrc=%u)\n", name, ssrc);
-						continue;
-					}
-					source->last_received_audio = now;
-					//~ JANUS_LOG(LOG_VERB, "************************\nGot %d bytes on the audio channel...\n", bytes);
-					/* If paused, ignore this packet */
-					if(!mountpoint->enabled)
-						continue;
-					/* Is this SRTP? */
-					if(source->is_srtp) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect(source->srtp_ctx, buffer, &buflen);
-						//~ if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-						if(res != srtp_err_status_ok) {
-							guint32 timestamp = ntohl(rtp->timestamp);
-							guint16 seq = ntohs(rtp->seq_number);
-							JANUS_LOG(LOG_ERR, "[%s] Audio SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
-								name, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
-							continue;
-						}
-						bytes = buflen;
-					}
-					//~ JANUS_LOG(LOG_VERB, " ... parsed RTP packet (ssrc=%u, pt=%u, seq=%u, ts=%u)...\n",
-						//~ ntohl(rtp->ssrc), rtp->type, ntohs(rtp->seq_number), ntohl(rtp->timestamp));
-					/* Relay on all sessions */
-					packet.data = rtp;
-					packet.length = bytes;
-					packet.is_rtp = TRUE;
-					packet.is_video = FALSE;
-					packet.is_keyframe = FALSE;
-					/* Do we have a new stream? */
-					if(ssrc != a_last_ssrc) {
-						a_last_ssrc = ssrc;
-						JANUS_LOG(LOG_INFO, "[%s] New audio stream! (ssrc=%u)\n", name, a_last_ssrc);
-					}
-					packet.data->type = mountpoint->codecs.audio_pt;
-					/* Is there a recorder? */
-					janus_rtp_header_update(packet.data, &source->context[0], FALSE, 0);
-					if (source->askew) {
-						int ret = janus_rtp_skew_compensate_audio(packet.data, &source->context[0], now);
-						if (ret < 0) {
-							JANUS_LOG(LOG_WARN, "[%s] Dropping %d packets, audio source clock is too fast (ssrc=%u)\n", name, -ret, a_last_ssrc);
-							continue;
-						} else if (ret > 0) {
-							JANUS_LOG(LOG_WARN, "[%s] Jumping %d RTP sequence numbers, audio source clock is too slow (ssrc=%u)\n", name, ret, a_last_ssrc);
-						}
-					}
-					packet.data->ssrc = ntohl((uint32_t)mountpoint->id);
-					janus_recorder_save_frame(source->arc, buffer, bytes);
-					packet.data->ssrc = ssrc;
-					/* Backup the actual timestamp and sequence number set by the restreamer, in case switching is involved */
-					packet.timestamp = ntohl(packet.data->timestamp);
-					packet.seq_number = ntohs(packet.data->seq_number);
-					/* Go! */
-					janus_mutex_lock(&mountpoint->mutex);
-					g_list_foreach(mountpoint->listeners, janus_streaming_relay_rtp_packet, &packet);
-					janus_mutex_unlock(&mountpoint->mutex);
+					int count = janus_streaming_recv_packets(audio_fd, batch, &source->audio_drops);
+					int n = 0;
+					for(n=0; n<count; n++)
+						janus_streaming_relay_audio_packet(mountpoint, name, batch->buffers[n], batch->lengths[n], now, &a_last_ssrc);
 					continue;
 				} else if((video_fd[0] != -1 && fds[i].fd == video_fd[0]) ||
 						(video_fd[1] != -1 && fds[i].fd == video_fd[1]) ||
@@ -5565,161 +6976,10 @@ static void *janus_streaming_relay_thread(void *data) {
 #ifdef HAVE_LIBCURL
 					source->reconnect_timer = now;
 #endif
-					addrlen = sizeof(remote);
-					bytes = recvfrom(fds[i].fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0) {
-						/* Failed to read? */
-						continue;
-					}
-					janus_rtp_header *rtp = (janus_rtp_header *)buffer;
-					ssrc = ntohl(rtp->ssrc);
-					if(source->rtp_collision > 0 && v_last_ssrc[index] && ssrc != v_last_ssrc[index] &&
-							(now-source->last_received_video) < (gint64)1000*source->rtp_collision) {
-						JANUS_LOG(LOG_WARN, "[%s] RTP collision on video mountpoint, dropping packet (ssrc=%u)\n", name, ssrc);
-						continue;
-					}
-					source->last_received_video = now;
-					//~ JANUS_LOG(LOG_VERB, "************************\nGot %d bytes on the video channel...\n", bytes);
-					/* Is this SRTP? */
-					if(source->is_srtp) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect(source->srtp_ctx, buffer, &buflen);
-						//~ if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-						if(res != srtp_err_status_ok) {
-							guint32 timestamp = ntohl(rtp->timestamp);
-							guint16 seq = ntohs(rtp->seq_number);
-							JANUS_LOG(LOG_ERR, "[%s] Video SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
-								name, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* First of all, let's check if this is (part of) a keyframe that we may need to save it for future reference */
-					if(source->keyframe.enabled) {
-						if(source->keyframe.temp_ts > 0 && ntohl(rtp->timestamp) != source->keyframe.temp_ts) {
-							/* We received the last part of the keyframe, get rid of the old one and use this from now on */
-							JANUS_LOG(LOG_HUGE, "[%s] ... ... last part of keyframe received! ts=%"SCNu32", %d packets\n",
-								name, source->keyframe.temp_ts, g_list_length(source->keyframe.temp_keyframe));
-							source->keyframe.temp_ts = 0;
-							janus_mutex_lock(&source->keyframe.mutex);
-							GList *temp = NULL;
-							while(source->keyframe.latest_keyframe) {
-								temp = g_list_first(source->keyframe.latest_keyframe);
-								source->keyframe.latest_keyframe = g_list_remove_link(source->keyframe.latest_keyframe, temp);
-								janus_streaming_rtp_relay_packet *pkt = (janus_streaming_rtp_relay_packet *)temp->data;
-								g_free(pkt->data);
-								g_free(pkt);
-								g_list_free(temp);
-							}
-							source->keyframe.latest_keyframe = source->keyframe.temp_keyframe;
-							source->keyframe.temp_keyframe = NULL;
-							janus_mutex_unlock(&source->keyframe.mutex);
-						} else if(ntohl(rtp->timestamp) == source->keyframe.temp_ts) {
-							/* Part of the keyframe we're currently saving, store */
-							janus_mutex_lock(&source->keyframe.mutex);
-							JANUS_LOG(LOG_HUGE, "[%s] ... other part of keyframe received! ts=%"SCNu32"\n", name, source->keyframe.temp_ts);
-							janus_streaming_rtp_relay_packet *pkt = g_malloc0(sizeof(janus_streaming_rtp_relay_packet));
-							pkt->data = g_malloc(bytes);
-							memcpy(pkt->data, buffer, bytes);
-							pkt->data->ssrc = htons(1);
-							pkt->data->type = mountpoint->codecs.video_pt;
-							packet.is_rtp = TRUE;
-							packet.is_video = TRUE;
-							packet.is_keyframe = TRUE;
-							pkt->length = bytes;
-							pkt->timestamp = source->keyframe.temp_ts;
-							pkt->seq_number = ntohs(rtp->seq_number);
-							source->keyframe.temp_keyframe = g_list_append(source->keyframe.temp_keyframe, pkt);
-							janus_mutex_unlock(&source->keyframe.mutex);
-						} else {
-							gboolean kf = FALSE;
-							/* Parse RTP header first */
-							janus_rtp_header *header = (janus_rtp_header *)buffer;
-							guint32 timestamp = ntohl(header->timestamp);
-							guint16 seq = ntohs(header->seq_number);
-							JANUS_LOG(LOG_HUGE, "Checking if packet (size=%d, seq=%"SCNu16", ts=%"SCNu32") is a key frame...\n",
-								bytes, seq, timestamp);
-							int plen = 0;
-							char *payload = janus_rtp_payload(buffer, bytes, &plen);
-							if(payload) {
-								switch(mountpoint->codecs.video_codec) {
-									case JANUS_STREAMING_VP8:
-										kf = janus_vp8_is_keyframe(payload, plen);
-										break;
-									case JANUS_STREAMING_VP9:
-										kf = janus_vp9_is_keyframe(payload, plen);
-										break;
-									case JANUS_STREAMING_H264:
-										kf = janus_h264_is_keyframe(payload, plen);
-										break;
-									default:
-										break;
-								}
-								if(kf) {
-									/* New keyframe, start saving it */
-									source->keyframe.temp_ts = ntohl(rtp->timestamp);
-									JANUS_LOG(LOG_HUGE, "[%s] New keyframe received! ts=%"SCNu32"\n", name, source->keyframe.temp_ts);
-									janus_mutex_lock(&source->keyframe.mutex);
-									janus_streaming_rtp_relay_packet *pkt = g_malloc0(sizeof(janus_streaming_rtp_relay_packet));
-									pkt->data = g_malloc(bytes);
-									memcpy(pkt->data, buffer, bytes);
-									pkt->data->ssrc = htons(1);
-									pkt->data->type = mountpoint->codecs.video_pt;
-									packet.is_rtp = TRUE;
-									packet.is_video = TRUE;
-									packet.is_keyframe = TRUE;
-									pkt->length = bytes;
-									pkt->timestamp = source->keyframe.temp_ts;
-									pkt->seq_number = ntohs(rtp->seq_number);
-									source->keyframe.temp_keyframe = g_list_append(source->keyframe.temp_keyframe, pkt);
-									janus_mutex_unlock(&source->keyframe.mutex);
-								}
-							}
-						}
-					}
-					/* If paused, ignore this packet */
-					if(!mountpoint->enabled)
-						continue;
-					//~ JANUS_LOG(LOG_VERB, " ... parsed RTP packet (ssrc=%u, pt=%u, seq=%u, ts=%u)...\n",
-						//~ ntohl(rtp->ssrc), rtp->type, ntohs(rtp->seq_number), ntohl(rtp->timestamp));
-					/* Relay on all sessions */
-					packet.data = rtp;
-					packet.length = bytes;
-					packet.is_rtp = TRUE;
-					packet.is_video = TRUE;
-					packet.is_keyframe = FALSE;
-					packet.simulcast = source->simulcast;
-					packet.substream = index;
-					packet.codec = mountpoint->codecs.video_codec;
-					/* Do we have a new stream? */
-					if(ssrc != v_last_ssrc[index]) {
-						v_last_ssrc[index] = ssrc;
-						JANUS_LOG(LOG_INFO, "[%s] New video stream! (ssrc=%u, index %d)\n", name, v_last_ssrc[index], index);
-					}
-					packet.data->type = mountpoint->codecs.video_pt;
-					/* Is there a recorder? (FIXME notice we only record the first substream, if simulcasting) */
-					janus_rtp_header_update(packet.data, &source->context[index], TRUE, 0);
-					if (source->vskew) {
-						int ret = janus_rtp_skew_compensate_video(packet.data, &source->context[index], now);
-						if (ret < 0) {
-							JANUS_LOG(LOG_WARN, "[%s] Dropping %d packets, video source clock is too fast (ssrc=%u, index %d)\n", name, -ret, v_last_ssrc[index], index);
-							continue;
-						} else if (ret > 0) {
-							JANUS_LOG(LOG_WARN, "[%s] Jumping %d RTP sequence numbers, video source clock is too slow (ssrc=%u, index %d)\n", name, ret, v_last_ssrc[index], index);
-						}
-					}
-					if(index == 0) {
-						packet.data->ssrc = ntohl((uint32_t)mountpoint->id);
-						janus_recorder_save_frame(source->vrc, buffer, bytes);
-						packet.data->ssrc = ssrc;
-					}
-					/* Backup the actual timestamp and sequence number set by the restreamer, in case switching is involved */
-					packet.timestamp = ntohl(packet.data->timestamp);
-					packet.seq_number = ntohs(packet.data->seq_number);
-					/* Go! */
-					janus_mutex_lock(&mountpoint->mutex);
-					g_list_foreach(mountpoint->listeners, janus_streaming_relay_rtp_packet, &packet);
-					janus_mutex_unlock(&mountpoint->mutex);
+					int count = janus_streaming_recv_packets(fds[i].fd, batch, &source->video_drops[index]);
+					int n = 0;
+					for(n=0; n<count; n++)
+						janus_streaming_relay_video_packet(mountpoint, name, index, batch->buffers[n], batch->lengths[n], now, &v_last_ssrc[index]);
 					continue;
 				} else if(data_fd != -1 && fds[i].fd == data_fd) {
 					/* Got something data (text) */
@@ -5735,30 +6995,36 @@ static void *janus_streaming_relay_thread(void *data) {
 						/* Failed to read? */
 						continue;
 					}
-					/* Get a string out of the data */
+					/* Get a string out of the data, unless this is binary data we relay as it is */
 					char *text = g_malloc(bytes+1);
 					memcpy(text, buffer, bytes);
 					*(text+bytes) = '\0';
 					/* Relay on all sessions */
 					packet.data = (janus_rtp_header *)text;
-					packet.length = bytes+1;
+					packet.length = source->textdata ? bytes+1 : bytes;
 					packet.is_rtp = FALSE;
+					packet.binary = !source->textdata;
 					/* Is there a recorder? */
-					janus_recorder_save_frame(source->drc, text, strlen(text));
+					janus_recorder_save_frame(source->drc, text, source->textdata ? strlen(text) : bytes);
 					/* Are we keeping track of the last message being relayed? */
 					if(source->buffermsg) {
 						janus_mutex_lock(&source->buffermsg_mutex);
 						janus_streaming_rtp_relay_packet *pkt = g_malloc0(sizeof(janus_streaming_rtp_relay_packet));
 						pkt->data = g_malloc(bytes+1);
 						memcpy(pkt->data, text, bytes+1);
-						packet.is_rtp = FALSE;
-						pkt->length = bytes+1;
+						pkt->is_rtp = FALSE;
+						pkt->binary = packet.binary;
+						pkt->length = packet.length;
+						if(source->last_msg != NULL) {
+							janus_streaming_rtp_relay_packet *prev = (janus_streaming_rtp_relay_packet *)source->last_msg;
+							g_free(prev->data);
+							g_free(prev);
+						}
+						source->last_msg = pkt;
 						janus_mutex_unlock(&source->buffermsg_mutex);
 					}
 					/* Go! */
-					janus_mutex_lock(&mountpoint->mutex);
-					g_list_foreach(mountpoint->listeners, janus_streaming_relay_rtp_packet, &packet);
-					janus_mutex_unlock(&mountpoint->mutex);
+					janus_streaming_relay_to_listeners(mountpoint, &packet);
 					packet.data = NULL;
 					g_free(text);
 					continue;
@@ -5786,6 +7052,7 @@ static void *janus_streaming_relay_thread(void *data) {
 			/* Tell the core to tear down the PeerConnection, hangup_media will do the rest */
 			gateway->push_event(session->handle, &janus_streaming_plugin, NULL, event, NULL);
 			gateway->close_pc(session->handle);
+			janus_streaming_helper_remove_viewer(mountpoint, session);
 			janus_refcount_decrease(&session->ref);
 			janus_refcount_decrease(&mountpoint->ref);
 		}
@@ -5796,11 +7063,33 @@ static void *janus_streaming_relay_thread(void *data) {
 	janus_mutex_unlock(&mountpoint->mutex);
 
 	JANUS_LOG(LOG_VERB, "[%s] Leaving streaming relay thread\n", name);
+	g_free(batch);
 	g_free(name);
 	janus_refcount_decrease(&mountpoint->ref);
 	return NULL;
 }
 
+/* Helper to relay the shared copy of a packet to a viewer: the header of our own
+ * copy has already been updated for this viewer, so we use that as the override */
+static void janus_streaming_relay_shared_rtp(janus_streaming_session *session, janus_streaming_rtp_relay_packet *packet,
+		char *payload, int payload_len) {
+	if(gateway == NULL)
+		return;
+	if(packet->shared == NULL) {
+		gateway->relay_rtp(session->handle, packet->is_video, (char *)packet->data, packet->length);
+		return;
+	}
+	janus_plugin_rtp_override override;
+	janus_plugin_rtp_override_from_header(&override, (char *)packet->data, packet->length);
+	if(payload != NULL && payload_len > 0 && payload_len <= JANUS_PLUGIN_RTP_OVERRIDE_PAYLOAD) {
+		/* Some payload bytes were changed for this viewer as well */
+		override.payload_offset = 0;
+		override.payload_len = payload_len;
+		memcpy(override.payload, payload, payload_len);
+	}
+	gateway->relay_rtp_shared(session->handle, packet->is_video, packet->shared, &override);
+}
+
 static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data) {
 	janus_streaming_rtp_relay_packet *packet = (janus_streaming_rtp_relay_packet *)user_data;
 	if(!packet || !packet->data || packet->length < 1) {
@@ -5818,6 +7107,8 @@ static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data)
 	}
 
 	if(packet->is_rtp) {
+		/* Packets we relay should always tell us when we got them, but just in case */
+		gint64 received = packet->received ? packet->received : janus_get_monotonic_time();
 		/* Make sure there hasn't been a publisher switch by checking the SSRC */
 		if(packet->is_video) {
 			if(!session->video)
@@ -5910,18 +7201,21 @@ static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data)
 							JANUS_LOG(LOG_HUGE, "Dropping packet (it's temporal layer %d, but we're capping at %d)\n",
 								tid, session->templayer);
 							/* We increase the base sequence number, or there will be gaps when delivering later */
-							session->context.v_base_seq++;
+							janus_rtp_switching_context_skip(&session->context, TRUE);
 							return;
 						}
 					}
 					/* If we got here, update the RTP header and send the packet */
-					janus_rtp_header_update(packet->data, &session->context, TRUE, 0);
+					janus_rtp_header_rewrite(packet->data, &session->context, TRUE,
+						packet->timestamp, packet->seq_number, received);
 					memcpy(vp8pd, payload, sizeof(vp8pd));
 					janus_vp8_simulcast_descriptor_update(payload, plen, &session->simulcast_context, switched);
 				}
 				/* Send the packet */
-				if(gateway != NULL)
-					gateway->relay_rtp(session->handle, packet->is_video, (char *)packet->data, packet->length);
+				if(packet->codec == JANUS_STREAMING_VP8)
+					janus_streaming_relay_shared_rtp(session, packet, payload, plen < (int)sizeof(vp8pd) ? plen : (int)sizeof(vp8pd));
+				else
+					janus_streaming_relay_shared_rtp(session, packet, NULL, 0);
 				/* Restore the timestamp and sequence number to what the publisher set them to */
 				packet->data->timestamp = htonl(packet->timestamp);
 				packet->data->seq_number = htons(packet->seq_number);
@@ -5931,9 +7225,9 @@ static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data)
 				}
 			} else {
 				/* Fix sequence number and timestamp (switching may be involved) */
-				janus_rtp_header_update(packet->data, &session->context, TRUE, 0);
-				if(gateway != NULL)
-					gateway->relay_rtp(session->handle, packet->is_video, (char *)packet->data, packet->length);
+				janus_rtp_header_rewrite(packet->data, &session->context, TRUE,
+					packet->timestamp, packet->seq_number, received);
+				janus_streaming_relay_shared_rtp(session, packet, NULL, 0);
 				/* Restore the timestamp and sequence number to what the publisher set them to */
 				packet->data->timestamp = htonl(packet->timestamp);
 				packet->data->seq_number = htons(packet->seq_number);
@@ -5942,9 +7236,9 @@ static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data)
 			if(!session->audio)
 				return;
 			/* Fix sequence number and timestamp (switching may be involved) */
-			janus_rtp_header_update(packet->data, &session->context, FALSE, 0);
-			if(gateway != NULL)
-				gateway->relay_rtp(session->handle, packet->is_video, (char *)packet->data, packet->length);
+			janus_rtp_header_rewrite(packet->data, &session->context, FALSE,
+				packet->timestamp, packet->seq_number, received);
+			janus_streaming_relay_shared_rtp(session, packet, NULL, 0);
 			/* Restore the timestamp and sequence number to what the publisher set them to */
 			packet->data->timestamp = htonl(packet->timestamp);
 			packet->data->seq_number = htons(packet->seq_number);
@@ -5954,8 +7248,12 @@ static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data)
 		if(!session->data)
 			return;
 		char *text = (char *)packet->data;
-		if(gateway != NULL && text != NULL)
-			gateway->relay_data(session->handle, text, strlen(text));
+		if(gateway != NULL && text != NULL) {
+			if(packet->binary)
+				gateway->relay_binary_data(session->handle, text, packet->length);
+			else
+				gateway->relay_data(session->handle, text, strlen(text));
+		}
 	}
 
 	return;
@@ -42,6 +42,27 @@
  * infrastructure than Janus, and yet you also want to have text-based
  * communication (e.g., to add a chatroom to an audio or video conference).
  *
+ * Messages and events addressed to participants are serialized only
+ * once, and relayed by a pool of delivery workers rather than by the
+ * thread that handled the request: rooms are assigned to workers by ID,
+ * which means a busy room doesn't stall the others, while messages for
+ * the same room are still relayed in order. The number of workers can
+ * be configured with the \c delivery_workers property in the \c general
+ * section (0 relays messages right away, as soon as they're handled).
+ * Workers relay whatever is waiting for them in one go, optionally waiting
+ * up to \c batch_time milliseconds for more: if \c batch_messages is
+ * enabled, all the messages a participant has to receive in such a batch
+ * are sent as a single JSON array on the data channel, which means clients
+ * must be prepared to receive either a JSON object or an array of them.
+ *
+ * Participants that can't keep up with the messages of their rooms (e.g.,
+ * because they're on a slow network) don't make Janus buffer an unbounded
+ * amount of data for them: as soon as more than \c max_buffered bytes
+ * are waiting to be sent to a participant on the data channel, new
+ * messages are kept in a per-participant backlog instead, which is sent
+ * when Janus tells the plugin the participant caught up. If the backlog
+ * grows beyond \c max_backlog bytes, new messages are dropped.
+ *
  * Notice that, in general, all users can create rooms. If you want to
  * limit this functionality, you can configure an admin \c admin_key in
  * the plugin settings. When configured, only "create" requests that
@@ -474,6 +495,7 @@ void janus_textroom_setup_media(janus_plugin_session *handle);
 void janus_textroom_incoming_rtp(janus_plugin_session *handle, int video, char *buf, int len);
 void janus_textroom_incoming_rtcp(janus_plugin_session *handle, int video, char *buf, int len);
 void janus_textroom_incoming_data(janus_plugin_session *handle, char *buf, int len);
+void janus_textroom_data_ready(janus_plugin_session *handle);
 void janus_textroom_slow_link(janus_plugin_session *handle, int uplink, int video);
 void janus_textroom_hangup_media(janus_plugin_session *handle);
 void janus_textroom_destroy_session(janus_plugin_session *handle, int *error);
@@ -499,6 +521,7 @@ static janus_plugin janus_textroom_plugin =
 		.incoming_rtp = janus_textroom_incoming_rtp,
 		.incoming_rtcp = janus_textroom_incoming_rtcp,
 		.incoming_data = janus_textroom_incoming_data,
+		.data_ready = janus_textroom_data_ready,
 		.slow_link = janus_textroom_slow_link,
 		.hangup_media = janus_textroom_hangup_media,
 		.destroy_session = janus_textroom_destroy_session,
@@ -616,6 +639,11 @@ typedef struct janus_textroom_session {
 	gint64 sdp_version;
 	GHashTable *rooms;			/* Map of rooms this user is in, and related participant instance */
 	janus_mutex mutex;			/* Mutex to lock this session */
+	GQueue *backlog;			/* Messages waiting for the peer to catch up with what we sent already */
+	size_t backlog_bytes;		/* Size of the messages in the backlog */
+	gboolean throttled;			/* Whether new messages should go in the backlog */
+	guint64 dropped;			/* Messages dropped because the backlog was full */
+	janus_mutex data_mutex;		/* Mutex to protect the backlog */
 	volatile gint setup;
 	volatile gint hangingup;
 	volatile gint destroyed;
@@ -654,12 +682,16 @@ static void janus_textroom_session_destroy(janus_textroom_session *session) {
 	if(session && g_atomic_int_compare_and_exchange(&session->destroyed, 0, 1))
 		janus_refcount_decrease(&session->ref);
 }
+static void janus_textroom_backlog_message_free(GString *message) {
+	g_string_free(message, TRUE);
+}
 static void janus_textroom_session_free(const janus_refcount *session_ref) {
 	janus_textroom_session *session = janus_refcount_containerof(session_ref, janus_textroom_session, ref);
 	/* Remove the reference to the core plugin session */
 	janus_refcount_decrease(&session->handle->ref);
 	/* This session can be destroyed, free all the resources */
 	g_hash_table_destroy(session->rooms);
+	g_queue_free_full(session->backlog, (GDestroyNotify)janus_textroom_backlog_message_free);
 	g_free(session);
 }
 
@@ -713,6 +745,259 @@ static void janus_textroom_message_free(janus_textroom_message *msg) {
 }
 
 
+/* Messages and events we send to participants are serialized only once,
+ * and the resulting text is shared by all the recipients */
+typedef struct janus_textroom_payload {
+	char *text;					/* Serialized message (owned by jansson) */
+	size_t len;					/* Length of the serialized message */
+	janus_refcount ref;
+} janus_textroom_payload;
+
+static void janus_textroom_payload_free(const janus_refcount *payload_ref) {
+	janus_textroom_payload *payload = janus_refcount_containerof(payload_ref, janus_textroom_payload, ref);
+	free(payload->text);
+	g_free(payload);
+}
+
+static janus_textroom_payload *janus_textroom_payload_new(json_t *msg) {
+	janus_textroom_payload *payload = g_malloc0(sizeof(janus_textroom_payload));
+	payload->text = json_dumps(msg, json_format);
+	payload->len = payload->text ? strlen(payload->text) : 0;
+	janus_refcount_init(&payload->ref, janus_textroom_payload_free);
+	return payload;
+}
+
+/* A payload to relay to a list of recipients: the list is taken when
+ * the delivery is prepared, so that who receives what doesn't depend on
+ * when the delivery worker actually gets to it */
+typedef struct janus_textroom_delivery {
+	janus_textroom_payload *payload;
+	GPtrArray *recipients;		/* Sessions to relay the payload to */
+} janus_textroom_delivery;
+static janus_textroom_delivery exit_delivery;
+
+static void janus_textroom_session_dereference(janus_textroom_session *session) {
+	if(session)
+		janus_refcount_decrease(&session->ref);
+}
+
+static janus_textroom_delivery *janus_textroom_delivery_new(janus_textroom_payload *payload, guint size) {
+	janus_textroom_delivery *delivery = g_malloc0(sizeof(janus_textroom_delivery));
+	janus_refcount_increase(&payload->ref);
+	delivery->payload = payload;
+	delivery->recipients = g_ptr_array_new_full(size, (GDestroyNotify)janus_textroom_session_dereference);
+	return delivery;
+}
+
+static void janus_textroom_delivery_add(janus_textroom_delivery *delivery, janus_textroom_session *session) {
+	if(delivery == NULL || session == NULL)
+		return;
+	janus_refcount_increase(&session->ref);
+	g_ptr_array_add(delivery->recipients, session);
+}
+
+static void janus_textroom_delivery_free(janus_textroom_delivery *delivery) {
+	if(delivery == NULL || delivery == &exit_delivery)
+		return;
+	g_ptr_array_free(delivery->recipients, TRUE);
+	janus_refcount_decrease(&delivery->payload->ref);
+	g_free(delivery);
+}
+
+/* Relaying to participants happens on a pool of delivery workers, so that
+ * a large room doesn't stall all the others: rooms are sharded on the
+ * workers by ID, which means deliveries for the same room (and so for
+ * the same recipient in that room) are always relayed in order */
+typedef struct janus_textroom_worker {
+	guint id;
+	GAsyncQueue *deliveries;
+	GThread *thread;
+} janus_textroom_worker;
+static janus_textroom_worker *workers = NULL;
+static guint workers_num = 4;
+/* How long a worker waits for more deliveries to batch, in ms (0=don't wait) */
+static guint batch_time = 0;
+/* Whether multiple messages for the same recipient should be relayed as a single JSON array */
+static gboolean batch_messages = FALSE;
+/* Maximum number of deliveries a worker handles in one go, and maximum size of batched messages */
+#define JANUS_TEXTROOM_BATCH_DELIVERIES	64
+#define JANUS_TEXTROOM_BATCH_SIZE		16384
+
+/* Backpressure: how much data can be waiting to be sent to a participant
+ * before we start keeping new messages in its backlog, and how large the
+ * backlog can get before we start dropping messages (0 disables it) */
+static int max_buffered = 1048576;
+static size_t max_backlog = 4194304;
+
+/* Send what's in the backlog of a participant, for as long as it can take it (data_mutex must be locked) */
+static void janus_textroom_backlog_flush(janus_textroom_session *session) {
+	GString *message = NULL;
+	while((message = g_queue_peek_head(session->backlog)) != NULL) {
+		if(gateway->data_buffered(session->handle) >= max_buffered) {
+			session->throttled = TRUE;
+			return;
+		}
+		g_queue_pop_head(session->backlog);
+		session->backlog_bytes -= message->len;
+		gateway->relay_data(session->handle, message->str, message->len);
+		janus_textroom_backlog_message_free(message);
+	}
+	session->throttled = FALSE;
+}
+
+static void janus_textroom_relay(janus_textroom_session *session, const char *text, size_t len) {
+	if(session == NULL || text == NULL || len == 0 || g_atomic_int_get(&session->destroyed) ||
+			session->handle == NULL || session->handle->stopped)
+		return;
+	if(max_buffered == 0) {
+		gateway->relay_data(session->handle, (char *)text, len);
+		return;
+	}
+	janus_mutex_lock(&session->data_mutex);
+	/* If we were waiting for the participant to catch up, check if it did */
+	if(session->throttled)
+		janus_textroom_backlog_flush(session);
+	if(!session->throttled) {
+		gateway->relay_data(session->handle, (char *)text, len);
+		if(gateway->data_buffered(session->handle) >= max_buffered)
+			session->throttled = TRUE;
+	} else if(session->backlog_bytes + len > max_backlog) {
+		/* The participant is way too slow, drop the message */
+		if(session->dropped++ == 0)
+			JANUS_LOG(LOG_WARN, "Backlog of participant full (%zu bytes), dropping messages\n", session->backlog_bytes);
+	} else {
+		g_queue_push_tail(session->backlog, g_string_new_len(text, len));
+		session->backlog_bytes += len;
+	}
+	janus_mutex_unlock(&session->data_mutex);
+}
+
+/* Helper to coalesce what a recipient has to receive in a batch */
+typedef struct janus_textroom_batch {
+	janus_textroom_session *session;
+	GString *buffer;			/* Comma separated messages, without the array brackets */
+	guint count;				/* Number of messages in the buffer */
+} janus_textroom_batch;
+
+static void janus_textroom_batch_flush(janus_textroom_batch *batch) {
+	if(batch->count == 0)
+		return;
+	if(batch->count > 1) {
+		g_string_prepend_c(batch->buffer, '[');
+		g_string_append_c(batch->buffer, ']');
+	}
+	janus_textroom_relay(batch->session, batch->buffer->str, batch->buffer->len);
+	g_string_truncate(batch->buffer, 0);
+	batch->count = 0;
+}
+
+static void janus_textroom_batch_free(janus_textroom_batch *batch) {
+	janus_textroom_batch_flush(batch);
+	g_string_free(batch->buffer, TRUE);
+	g_free(batch);
+}
+
+static void janus_textroom_deliver_all(GList *deliveries) {
+	if(deliveries == NULL)
+		return;
+	if(!batch_messages || deliveries->next == NULL) {
+		/* Relay each payload as it is */
+		GList *dl = deliveries;
+		while(dl) {
+			janus_textroom_delivery *delivery = (janus_textroom_delivery *)dl->data;
+			guint i = 0;
+			for(i=0; i<delivery->recipients->len; i++) {
+				janus_textroom_relay(g_ptr_array_index(delivery->recipients, i),
+					delivery->payload->text, delivery->payload->len);
+			}
+			dl = dl->next;
+		}
+		return;
+	}
+	/* Coalesce all the payloads for the same recipient, so that we send
+	 * as few messages as possible (the input list is already in order) */
+	GHashTable *batches = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_textroom_batch_free);
+	GList *dl = deliveries;
+	while(dl) {
+		janus_textroom_delivery *delivery = (janus_textroom_delivery *)dl->data;
+		janus_textroom_payload *payload = delivery->payload;
+		guint i = 0;
+		for(i=0; i<delivery->recipients->len; i++) {
+			janus_textroom_session *session = g_ptr_array_index(delivery->recipients, i);
+			janus_textroom_batch *batch = g_hash_table_lookup(batches, session);
+			if(batch == NULL) {
+				batch = g_malloc0(sizeof(janus_textroom_batch));
+				batch->session = session;
+				batch->buffer = g_string_sized_new(payload->len + 2);
+				g_hash_table_insert(batches, session, batch);
+			}
+			if(batch->count > 0 && batch->buffer->len + payload->len + 3 > JANUS_TEXTROOM_BATCH_SIZE)
+				janus_textroom_batch_flush(batch);
+			if(batch->count > 0)
+				g_string_append_c(batch->buffer, ',');
+			g_string_append_len(batch->buffer, payload->text, payload->len);
+			batch->count++;
+		}
+		dl = dl->next;
+	}
+	/* Destroying the table flushes all the batches: the deliveries we got
+	 * these sessions from still hold a reference, so this is safe */
+	g_hash_table_destroy(batches);
+}
+
+/* Thread relaying the deliveries for the rooms assigned to a worker */
+static void *janus_textroom_worker_thread(void *data) {
+	janus_textroom_worker *worker = (janus_textroom_worker *)data;
+	JANUS_LOG(LOG_VERB, "Joining TextRoom delivery worker #%u\n", worker->id);
+	gboolean exiting = FALSE;
+	while(!exiting) {
+		janus_textroom_delivery *delivery = g_async_queue_pop(worker->deliveries);
+		if(delivery == &exit_delivery)
+			break;
+		/* Get whatever else is waiting (possibly waiting a bit for more) */
+		GList *deliveries = g_list_prepend(NULL, delivery);
+		guint count = 1;
+		gint64 deadline = janus_get_monotonic_time() + (gint64)batch_time*1000;
+		while(count < JANUS_TEXTROOM_BATCH_DELIVERIES) {
+			gint64 wait = deadline - janus_get_monotonic_time();
+			delivery = wait > 0 ? g_async_queue_timeout_pop(worker->deliveries, wait) :
+				g_async_queue_try_pop(worker->deliveries);
+			if(delivery == NULL)
+				break;
+			if(delivery == &exit_delivery) {
+				exiting = TRUE;
+				break;
+			}
+			deliveries = g_list_prepend(deliveries, delivery);
+			count++;
+		}
+		deliveries = g_list_reverse(deliveries);
+		janus_textroom_deliver_all(deliveries);
+		g_list_free_full(deliveries, (GDestroyNotify)janus_textroom_delivery_free);
+	}
+	JANUS_LOG(LOG_VERB, "Leaving TextRoom delivery worker #%u\n", worker->id);
+	return NULL;
+}
+
+/* Hand a delivery to the worker responsible for a room (or relay it
+ * right away, if workers are disabled): this takes ownership of it */
+static void janus_textroom_deliver(guint64 room_id, janus_textroom_delivery *delivery) {
+	if(delivery == NULL)
+		return;
+	if(delivery->recipients->len == 0 || delivery->payload->text == NULL) {
+		janus_textroom_delivery_free(delivery);
+		return;
+	}
+	if(workers == NULL) {
+		GList *deliveries = g_list_prepend(NULL, delivery);
+		janus_textroom_deliver_all(deliveries);
+		g_list_free_full(deliveries, (GDestroyNotify)janus_textroom_delivery_free);
+		return;
+	}
+	g_async_queue_push(workers[room_id % workers_num].deliveries, delivery);
+}
+
+
 /* SDP template: we only offer data channels */
 #define sdp_template \
 		"v=0\r\n" \
@@ -812,6 +1097,47 @@ int janus_textroom_init(janus_callbacks *callback, const char *config_path) {
 		if(!notify_events && callback->events_is_enabled()) {
 			JANUS_LOG(LOG_WARN, "Notification of events to handlers disabled for %s\n", JANUS_TEXTROOM_NAME);
 		}
+		/* How should we relay messages to participants? */
+		janus_config_item *item_workers = janus_config_get_item_drilldown(config, "general", "delivery_workers");
+		if(item_workers != NULL && item_workers->value != NULL) {
+			int num = atoi(item_workers->value);
+			if(num < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid number of delivery workers (%d), using the default (%u)\n", num, workers_num);
+			} else {
+				workers_num = num;
+			}
+		}
+		janus_config_item *item_batch = janus_config_get_item_drilldown(config, "general", "batch_time");
+		if(item_batch != NULL && item_batch->value != NULL) {
+			int ms = atoi(item_batch->value);
+			if(ms < 0 || ms > 1000) {
+				JANUS_LOG(LOG_WARN, "Invalid batch time (%d), not waiting for more messages to batch\n", ms);
+				batch_time = 0;
+			} else {
+				batch_time = ms;
+			}
+		}
+		janus_config_item *item_messages = janus_config_get_item_drilldown(config, "general", "batch_messages");
+		if(item_messages != NULL && item_messages->value != NULL)
+			batch_messages = janus_is_true(item_messages->value);
+		janus_config_item *item_buffered = janus_config_get_item_drilldown(config, "general", "max_buffered");
+		if(item_buffered != NULL && item_buffered->value != NULL) {
+			int bytes = atoi(item_buffered->value);
+			if(bytes < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid max_buffered value (%d), using the default (%d)\n", bytes, max_buffered);
+			} else {
+				max_buffered = bytes;
+			}
+		}
+		janus_config_item *item_backlog = janus_config_get_item_drilldown(config, "general", "max_backlog");
+		if(item_backlog != NULL && item_backlog->value != NULL) {
+			int bytes = atoi(item_backlog->value);
+			if(bytes < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid max_backlog value (%d), using the default (%zu)\n", bytes, max_backlog);
+			} else {
+				max_backlog = bytes;
+			}
+		}
 		/* Iterate on all rooms */
 		GList *cl = janus_config_get_categories(config);
 		while(cl != NULL) {
@@ -892,6 +1218,39 @@ int janus_textroom_init(janus_callbacks *callback, const char *config_path) {
 		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the TextRoom handler thread...\n", error->code, error->message ? error->message : "??");
 		return -1;
 	}
+	/* Launch the delivery workers, if any */
+	if(workers_num > 0) {
+		workers = g_malloc0(workers_num * sizeof(janus_textroom_worker));
+		guint i = 0;
+		for(i=0; i<workers_num; i++) {
+			workers[i].id = i;
+			workers[i].deliveries = g_async_queue_new_full((GDestroyNotify)janus_textroom_delivery_free);
+		}
+		for(i=0; i<workers_num; i++) {
+			char tname[16];
+			g_snprintf(tname, sizeof(tname), "textroom wrk%u", i);
+			workers[i].thread = g_thread_try_new(tname, janus_textroom_worker_thread, &workers[i], &error);
+			if(error != NULL) {
+				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch a TextRoom delivery worker...\n", error->code, error->message ? error->message : "??");
+				g_error_free(error);
+				error = NULL;
+				/* Fallback to one worker less (or none), as the others are working fine */
+				break;
+			}
+		}
+		if(i < workers_num) {
+			guint j = 0;
+			for(j=i; j<workers_num; j++)
+				g_async_queue_unref(workers[j].deliveries);
+			workers_num = i;
+			if(workers_num == 0) {
+				g_free(workers);
+				workers = NULL;
+			}
+		}
+	}
+	JANUS_LOG(LOG_VERB, "Relaying messages with %u delivery workers (batch time: %ums, batched messages: %s)\n",
+		workers_num, batch_time, batch_messages ? "yes" : "no");
 	JANUS_LOG(LOG_INFO, "%s initialized!\n", JANUS_TEXTROOM_NAME);
 	return 0;
 }
@@ -906,6 +1265,17 @@ void janus_textroom_destroy(void) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+	if(workers != NULL) {
+		guint i = 0;
+		for(i=0; i<workers_num; i++)
+			g_async_queue_push(workers[i].deliveries, &exit_delivery);
+		for(i=0; i<workers_num; i++) {
+			g_thread_join(workers[i].thread);
+			g_async_queue_unref(workers[i].deliveries);
+		}
+		g_free(workers);
+		workers = NULL;
+	}
 
 	/* FIXME We should destroy the sessions cleanly */
 	janus_mutex_lock(&sessions_mutex);
@@ -975,6 +1345,8 @@ void janus_textroom_create_session(janus_plugin_session *handle, int *error) {
 	janus_textroom_session *session = g_malloc0(sizeof(janus_textroom_session));
 	session->handle = handle;
 	session->rooms = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, (GDestroyNotify)janus_textroom_participant_dereference);
+	session->backlog = g_queue_new();
+	janus_mutex_init(&session->data_mutex);
 	session->destroyed = 0;
 	janus_mutex_init(&session->mutex);
 	janus_refcount_init(&session->ref, janus_textroom_session_free);
@@ -1025,6 +1397,14 @@ json_t *janus_textroom_query_session(janus_plugin_session *handle) {
 	/* TODO Return meaningful info: participant details, rooms they're in, etc. */
 	json_t *info = json_object();
 	json_object_set_new(info, "destroyed", json_integer(session->destroyed));
+	janus_mutex_lock(&session->data_mutex);
+	json_t *backlog = json_object();
+	json_object_set_new(backlog, "throttled", session->throttled ? json_true() : json_false());
+	json_object_set_new(backlog, "messages", json_integer(g_queue_get_length(session->backlog)));
+	json_object_set_new(backlog, "bytes", json_integer(session->backlog_bytes));
+	json_object_set_new(backlog, "dropped", json_integer(session->dropped));
+	janus_mutex_unlock(&session->data_mutex);
+	json_object_set_new(info, "backlog", backlog);
 	janus_refcount_decrease(&session->ref);
 	return info;
 }
@@ -1277,8 +1657,9 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 		json_object_set_new(msg, "text", json_string(message));
 		if(username || usernames)
 			json_object_set_new(msg, "whisper", json_true());
-		char *msg_text = json_dumps(msg, json_format);
+		janus_textroom_payload *payload = janus_textroom_payload_new(msg);
 		json_decref(msg);
+		janus_textroom_delivery *delivery = NULL;
 		/* Start preparing the response too */
 		reply = json_object();
 		json_object_set_new(reply, "textroom", json_string("success"));
@@ -1290,18 +1671,19 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			JANUS_LOG(LOG_VERB, "To %s in %"SCNu64": %s\n", to, room_id, message);
 			janus_textroom_participant *top = g_hash_table_lookup(textroom->participants, to);
 			if(top) {
-				janus_refcount_increase(&top->ref);
-				gateway->relay_data(top->session->handle, msg_text, strlen(msg_text));
-				janus_refcount_decrease(&top->ref);
+				delivery = janus_textroom_delivery_new(payload, 1);
+				janus_textroom_delivery_add(delivery, top->session);
 				json_object_set_new(sent, to, json_true());
 			} else {
 				JANUS_LOG(LOG_WARN, "User %s is not in room %"SCNu64", failed to send message\n", to, room_id);
 				json_object_set_new(sent, to, json_false());
 			}
+			janus_textroom_deliver(room_id, delivery);
 			json_object_set_new(reply, "sent", sent);
 		} else if(usernames) {
 			/* A limited number of users */
 			json_t *sent = json_object();
+			delivery = janus_textroom_delivery_new(payload, json_array_size(usernames));
 			size_t i = 0;
 			for(i=0; i<json_array_size(usernames); i++) {
 				json_t *u = json_array_get(usernames, i);
@@ -1309,30 +1691,29 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 				JANUS_LOG(LOG_VERB, "To %s in %"SCNu64": %s\n", to, room_id, message);
 				janus_textroom_participant *top = g_hash_table_lookup(textroom->participants, to);
 				if(top) {
-					janus_refcount_increase(&top->ref);
-					gateway->relay_data(top->session->handle, msg_text, strlen(msg_text));
-					janus_refcount_decrease(&top->ref);
+					janus_textroom_delivery_add(delivery, top->session);
 					json_object_set_new(sent, to, json_true());
 				} else {
 					JANUS_LOG(LOG_WARN, "User %s is not in room %"SCNu64", failed to send message\n", to, room_id);
 					json_object_set_new(sent, to, json_false());
 				}
 			}
+			janus_textroom_deliver(room_id, delivery);
 			json_object_set_new(reply, "sent", sent);
 		} else {
 			/* Everybody in the room */
 			JANUS_LOG(LOG_VERB, "To everybody in %"SCNu64": %s\n", room_id, message);
 			if(textroom->participants) {
+				delivery = janus_textroom_delivery_new(payload, g_hash_table_size(textroom->participants));
 				GHashTableIter iter;
 				gpointer value;
 				g_hash_table_iter_init(&iter, textroom->participants);
 				while(g_hash_table_iter_next(&iter, NULL, &value)) {
 					janus_textroom_participant *top = value;
 					JANUS_LOG(LOG_VERB, "  >> To %s in %"SCNu64": %s\n", top->username, room_id, message);
-					janus_refcount_increase(&top->ref);
-					gateway->relay_data(top->session->handle, msg_text, strlen(msg_text));
-					janus_refcount_decrease(&top->ref);
+					janus_textroom_delivery_add(delivery, top->session);
 				}
+				janus_textroom_deliver(room_id, delivery);
 			}
 #ifdef HAVE_LIBCURL
 			/* Is there a backend waiting for this message too? */
@@ -1349,7 +1730,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 					headers = curl_slist_append(headers, "Content-Type: application/json");
 					headers = curl_slist_append(headers, "charsets: utf-8");
 					curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-					curl_easy_setopt(curl, CURLOPT_POSTFIELDS, msg_text);
+					curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload->text);
 					curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, janus_textroom_write_data);
 					/* Send the request */
 					res = curl_easy_perform(curl);
@@ -1365,7 +1746,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 #endif
 		}
 		janus_refcount_decrease(&participant->ref);
-		free(msg_text);
+		janus_refcount_decrease(&payload->ref);
 		janus_mutex_unlock(&textroom->mutex);
 		janus_refcount_decrease(&textroom->ref);
 		/* By default we send a confirmation back to the user that sent this message:
@@ -1454,10 +1835,12 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			json_object_set_new(event, "username", json_string(username_text));
 			if(display_text != NULL)
 				json_object_set_new(event, "display", json_string(display_text));
-			char *event_text = json_dumps(event, json_format);
+			janus_textroom_payload *payload = janus_textroom_payload_new(event);
 			json_decref(event);
-			gateway->relay_data(handle, event_text, strlen(event_text));
+			if(payload->text != NULL)
+				janus_textroom_relay(session, payload->text, payload->len);
 			/* Broadcast */
+			janus_textroom_delivery *delivery = janus_textroom_delivery_new(payload, g_hash_table_size(textroom->participants));
 			GHashTableIter iter;
 			gpointer value;
 			g_hash_table_iter_init(&iter, textroom->participants);
@@ -1467,7 +1850,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 					continue;	/* Skip us */
 				janus_refcount_increase(&top->ref);
 				JANUS_LOG(LOG_VERB, "  >> To %s in %"SCNu64"\n", top->username, room_id);
-				gateway->relay_data(top->session->handle, event_text, strlen(event_text));
+				janus_textroom_delivery_add(delivery, top->session);
 				/* Take note of this user */
 				json_t *p = json_object();
 				json_object_set_new(p, "username", json_string(top->username));
@@ -1476,7 +1859,8 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 				json_array_append_new(list, p);
 				janus_refcount_decrease(&top->ref);
 			}
-			free(event_text);
+			janus_textroom_deliver(room_id, delivery);
+			janus_refcount_decrease(&payload->ref);
 		}
 		janus_mutex_unlock(&session->mutex);
 		janus_mutex_unlock(&textroom->mutex);
@@ -1541,10 +1925,12 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			json_object_set_new(event, "textroom", json_string("leave"));
 			json_object_set_new(event, "room", json_integer(textroom->room_id));
 			json_object_set_new(event, "username", json_string(participant->username));
-			char *event_text = json_dumps(event, json_format);
+			janus_textroom_payload *payload = janus_textroom_payload_new(event);
 			json_decref(event);
-			gateway->relay_data(handle, event_text, strlen(event_text));
+			if(payload->text != NULL)
+				janus_textroom_relay(session, payload->text, payload->len);
 			/* Broadcast */
+			janus_textroom_delivery *delivery = janus_textroom_delivery_new(payload, g_hash_table_size(textroom->participants));
 			GHashTableIter iter;
 			gpointer value;
 			g_hash_table_iter_init(&iter, textroom->participants);
@@ -1552,12 +1938,11 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 				janus_textroom_participant *top = value;
 				if(top == participant)
 					continue;	/* Skip us */
-				janus_refcount_increase(&top->ref);
 				JANUS_LOG(LOG_VERB, "  >> To %s in %"SCNu64"\n", top->username, room_id);
-				gateway->relay_data(top->session->handle, event_text, strlen(event_text));
-				janus_refcount_decrease(&top->ref);
+				janus_textroom_delivery_add(delivery, top->session);
 			}
-			free(event_text);
+			janus_textroom_deliver(room_id, delivery);
+			janus_refcount_decrease(&payload->ref);
 		}
 		/* Also notify event handlers */
 		if(notify_events && gateway->events_is_enabled()) {
@@ -1761,18 +2146,20 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			json_object_set_new(event, "textroom", json_string("kicked"));
 			json_object_set_new(event, "room", json_integer(textroom->room_id));
 			json_object_set_new(event, "username", json_string(participant->username));
-			char *event_text = json_dumps(event, json_format);
+			janus_textroom_payload *payload = janus_textroom_payload_new(event);
 			json_decref(event);
 			/* Broadcast */
+			janus_textroom_delivery *delivery = janus_textroom_delivery_new(payload, g_hash_table_size(textroom->participants));
 			GHashTableIter iter;
 			gpointer value;
 			g_hash_table_iter_init(&iter, textroom->participants);
 			while(g_hash_table_iter_next(&iter, NULL, &value)) {
 				janus_textroom_participant *top = value;
 				JANUS_LOG(LOG_VERB, "  >> To %s in %"SCNu64"\n", top->username, room_id);
-				gateway->relay_data(top->session->handle, event_text, strlen(event_text));
+				janus_textroom_delivery_add(delivery, top->session);
 			}
-			free(event_text);
+			janus_textroom_deliver(room_id, delivery);
+			janus_refcount_decrease(&payload->ref);
 		}
 		/* Also notify event handlers */
 		if(notify_events && gateway->events_is_enabled()) {
@@ -2161,10 +2548,12 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			json_t *event = json_object();
 			json_object_set_new(event, "textroom", json_string("destroyed"));
 			json_object_set_new(event, "room", json_integer(textroom->room_id));
-			char *event_text = json_dumps(event, json_format);
+			janus_textroom_payload *payload = janus_textroom_payload_new(event);
 			json_decref(event);
-			gateway->relay_data(handle, event_text, strlen(event_text));
+			if(payload->text != NULL)
+				janus_textroom_relay(session, payload->text, payload->len);
 			/* Broadcast */
+			janus_textroom_delivery *delivery = janus_textroom_delivery_new(payload, g_hash_table_size(textroom->participants));
 			GHashTableIter iter;
 			gpointer value;
 			g_hash_table_iter_init(&iter, textroom->participants);
@@ -2172,14 +2561,15 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 				janus_textroom_participant *top = value;
 				janus_refcount_increase(&top->ref);
 				JANUS_LOG(LOG_VERB, "  >> To %s in %"SCNu64"\n", top->username, room_id);
-				gateway->relay_data(top->session->handle, event_text, strlen(event_text));
+				janus_textroom_delivery_add(delivery, top->session);
 				janus_mutex_lock(&top->session->mutex);
 				g_hash_table_remove(top->session->rooms, &room_id);
 				janus_mutex_unlock(&top->session->mutex);
 				janus_refcount_decrease(&top->ref);
 				janus_textroom_participant_destroy(top);
 			}
-			free(event_text);
+			janus_textroom_deliver(room_id, delivery);
+			janus_refcount_decrease(&payload->ref);
 		}
 		janus_mutex_unlock(&textroom->mutex);
 		janus_mutex_unlock(&rooms_mutex);
@@ -2227,7 +2617,7 @@ msg_response:
 					/* Reply via data channels */
 					char *reply_text = json_dumps(reply, json_format);
 					json_decref(reply);
-					gateway->relay_data(handle, reply_text, strlen(reply_text));
+					janus_textroom_relay(session, reply_text, strlen(reply_text));
 					free(reply_text);
 				} else {
 					/* Reply via Janus API */
@@ -2240,6 +2630,21 @@ msg_response:
 	return NULL;
 }
 
+void janus_textroom_data_ready(janus_plugin_session *handle) {
+	if(handle == NULL || handle->stopped || g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
+		return;
+	janus_textroom_session *session = (janus_textroom_session *)handle->plugin_handle;
+	if(!session || g_atomic_int_get(&session->destroyed))
+		return;
+	/* The participant caught up, send what we kept in the backlog */
+	janus_refcount_increase(&session->ref);
+	janus_mutex_lock(&session->data_mutex);
+	if(session->throttled)
+		janus_textroom_backlog_flush(session);
+	janus_mutex_unlock(&session->data_mutex);
+	janus_refcount_decrease(&session->ref);
+}
+
 void janus_textroom_slow_link(janus_plugin_session *handle, int uplink, int video) {
 	/* We don't do audio/video */
 }
@@ -2263,6 +2668,13 @@ static void janus_textroom_hangup_media_internal(janus_plugin_session *handle) {
 		return;
 	if(g_atomic_int_add(&session->hangingup, 1))
 		return;
+	/* Nothing we kept in the backlog can be sent anymore */
+	janus_mutex_lock(&session->data_mutex);
+	g_queue_free_full(session->backlog, (GDestroyNotify)janus_textroom_backlog_message_free);
+	session->backlog = g_queue_new();
+	session->backlog_bytes = 0;
+	session->throttled = FALSE;
+	janus_mutex_unlock(&session->data_mutex);
 	/* Get rid of all participants */
 	janus_mutex_lock(&session->mutex);
 	GList *list = NULL;
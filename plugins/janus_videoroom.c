@@ -84,7 +84,61 @@ notify_joining = true|false (optional, whether to notify all participants when a
             new feeds (publishers), and enabling this may result extra notification
             traffic. This flag is particularly useful when enabled with \c require_pvtid
             for admin to manage listening only participants. default=false)
+fanout_threshold = <number of subscribers above which a publisher's packets are relayed
+            by the fan-out workers, if enabled; 0=never, default is the global setting>
+keyframe_window = <minimum time, in milliseconds, between keyframe requests sent to a
+            publisher because of its subscribers (PLI/FIR they send, new subscriptions,
+            substream changes); requests within the window are dropped. 0=no limit, default>
+memory_cap = <maximum number of bytes the keyframe caches of the publishers in this room
+            can hold, when Janus is built with memory accounting; 0=no limit, default>
 \endverbatim
+ *
+ * By default, the packets of a publisher are relayed to all its subscribers
+ * on the thread that received them, which for webinars with thousands
+ * of subscribers can be too much work for a single core. Setting
+ * \c fanout_workers in the \c general section of the configuration file
+ * creates a pool of workers instead: when a publisher has at least
+ * \c fanout_threshold subscribers (200 by default, and configurable per
+ * room as well), its subscribers are partitioned across the workers, and
+ * each of them relays the packet to its share. Each subscriber is always
+ * served by the same worker, so the order of packets is preserved; to
+ * keep it that way, publishers only go back to relaying packets themselves
+ * once their audience drops below half the threshold and the workers are
+ * done with the packets they had queued. The
+ * \c janus_videoroom_fanout_time_us_total and
+ * \c janus_videoroom_fanout_packets_total metrics tell how long it takes,
+ * on average, to relay a packet to all subscribers in either mode.
+ *
+ * Besides, any new subscriber normally means asking the publisher for a
+ * new keyframe, which in large rooms results in publishers being flooded
+ * with requests any time many subscribers join at the same time. Setting
+ * \c keyframe_cache in the \c general section to a number of packets
+ * (e.g., 500) tells the plugin to keep a copy of all the video packets
+ * received since the latest keyframe of each publisher (and of each
+ * simulcast substream), as long as they're less than that: new subscribers
+ * get those right away, with their sequence numbers and timestamps
+ * rewritten as for any other packet, and the publisher is only asked for
+ * a keyframe when there's nothing cached to send.
+ *
+ * Subscribers cause keyframe requests in other ways too, e.g., when they
+ * experience losses and send PLIs, or when they change substream. Setting
+ * \c keyframe_window in a room limits how often a publisher is asked for
+ * a keyframe because of them: requests arriving less than that many
+ * milliseconds after the previous one are dropped, since a keyframe is
+ * on its way already. The \c janus_videoroom_keyframe_requests_total
+ * metric counts how many requests were forwarded and suppressed.
+ *
+ * When Janus is configured with \c --enable-memory-accounting, the memory
+ * held by the keyframe caches is accounted for per publisher and per room,
+ * and can be checked via the Admin API \c memory request. Setting
+ * \c memory_cap in a room caps it: when caching a packet would exceed
+ * the cap, the cache of that stream is emptied, and publishers are asked
+ * for keyframes as if no cache was configured until the next keyframe.
+ *
+ * When \c admission_threshold is set in the Janus configuration and the
+ * load score of the instance reached it, new publishers and subscribers
+ * trying to join a room get a \c JANUS_VIDEOROOM_ERROR_OVERLOADED error,
+ * while participants that are in a room already are not affected.
  *
  * Note that recording will work with all codecs except iSAC.
  *
@@ -95,8 +149,9 @@ notify_joining = true|false (optional, whether to notify all participants when a
  * (invalid JSON, invalid request) which will always result in a
  * synchronous error response even for asynchronous requests. 
  *
- * \c create , \c destroy , \c edit , \c exists, \c list, \c allowed, \c kick and
- * and \c listparticipants are synchronous requests, which means you'll
+ * \c create , \c destroy , \c edit , \c exists, \c list, \c allowed, \c kick ,
+ * \c add_remote_publisher , \c remove_remote_publisher and
+ * \c listparticipants are synchronous requests, which means you'll
  * get a response directly within the context of the transaction.
  * \c create allows you to create a new video room dynamically, as an
  * alternative to using the configuration file; \c edit allows you to
@@ -160,6 +215,57 @@ notify_joining = true|false (optional, whether to notify all participants when a
  *
  * If you requested a permanent room but a \c false value is returned
  * instead, good chances are that there are permission problems.
+ *
+ * When you need to provision many rooms at the same time (e.g., thousands
+ * of rooms when a new deployment starts), you can use \c create_rooms
+ * instead, which creates all of them in a single request. Each object in
+ * the \c rooms array is formatted exactly as the properties of a \c create
+ * request would be, while \c permanent at the top level applies to all the
+ * rooms that don't specify it themselves. The main difference, besides the
+ * reduced number of messages, is that the configuration file is only saved
+ * once, after all the rooms have been created, rather than once per room:
+ *
+\verbatim
+{
+	"request" : "create_rooms",
+	"permanent" : <true|false, whether the rooms should be saved in the config file, default false>,
+	"rooms" : [
+		{
+			"room" : <unique numeric ID, optional, chosen by plugin if missing>,
+			"description" : "<pretty name of the room, optional>",
+			...
+		},
+		// Other rooms
+	]
+}
+\endverbatim
+ *
+ * Rooms that can't be created don't prevent the others from being created,
+ * which is why the \c created_rooms response lists both the rooms that
+ * were created and the ones that failed, with the index of the related
+ * object in the \c rooms array, and the reason:
+ *
+\verbatim
+{
+	"videoroom" : "created_rooms",
+	"created" : [
+		{
+			"room" : <unique numeric ID>,
+			"permanent" : <true if saved to config file, false if not>
+		},
+		// Other rooms
+	],
+	"failed" : [
+		{
+			"index" : <index of the room in the request>,
+			"room" : <unique numeric ID of the room, if provided>,
+			"error_code" : <numeric ID, check Macros below>,
+			"error" : "<error description as a string>"
+		},
+		// Other rooms
+	]
+}
+\endverbatim
  *
  * An error instead (and the same applies to all other requests, so this
  * won't be repeated) would provide both an error code and a more verbose
@@ -175,8 +281,8 @@ notify_joining = true|false (optional, whether to notify all participants when a
  *
  * Notice that, in general, all users can create rooms. If you want to
  * limit this functionality, you can configure an admin \c admin_key in
- * the plugin settings. When configured, only "create" requests that
- * include the correct \c admin_key value in an "admin_key" property
+ * the plugin settings. When configured, only "create" (and "create_rooms")
+ * requests that include the correct \c admin_key value in an "admin_key" property
  * will succeed, and will be rejected otherwise.
  *
  * Once a room has been created, you can still edit some (but not all)
@@ -339,6 +445,8 @@ notify_joining = true|false (optional, whether to notify all participants when a
 			"max_publishers" : <how many publishers can actually publish via WebRTC at the same time>,
 			"bitrate" : <bitrate cap that should be forced (via REMB) on all publishers by default>,
 			"fir_freq" : <how often a keyframe request is sent via PLI/FIR to active publishers>,
+			"keyframe_window" : <minimum time between keyframe requests caused by subscribers, in ms, if limited>,
+			"memory_cap" : <maximum number of bytes the keyframe caches of the room can hold, if limited>,
 			"audiocodec" : "<comma separated list of allowed audio codecs>",
 			"videocodec" : "<comma separated list of allowed video codecs>",
 			"record" : <true|false, whether the room is being recorded>,
@@ -374,7 +482,8 @@ notify_joining = true|false (optional, whether to notify all participants when a
 			"display" : "<display name of the participant, if any; optional>",
 			"talking" : <true|false, whether user is talking or not (only if audio levels are used)>,
 			"internal_audio_ssrc" : <audio SSRC used internally for this active publisher>,
-			"internal_video_ssrc" : <video SSRC used internally for this active publisher>
+			"internal_video_ssrc" : <video SSRC used internally for this active publisher>,
+			"remote" : <true, if this is a remote publisher added via add_remote_publisher>
 		},
 		// Other participants
 	]
@@ -494,6 +603,7 @@ notify_joining = true|false (optional, whether to notify all participants when a
 	"bitrate" : <bitrate cap to return via REMB; optional, overrides the global room value if present>,
 	"record" : <true|false, whether this publisher should be recorded or not; optional>,
 	"filename" : "<if recording, the base path/file to use for the recording files; optional>",
+	"record_substreams" : "<if simulcasting, which substreams to record: base (default), highest or all; optional>",
 	"display" : "<new display name to use in the room; optional>"
 }
 \endverbatim
@@ -512,6 +622,17 @@ notify_joining = true|false (optional, whether to notify all participants when a
  * 
  * This event will be accompanied by the prepared JSEP SDP answer.
  *
+ * When a publisher is simulcasting and is being recorded, only the base
+ * substream is recorded by default. Setting \c record_substreams to
+ * \c highest records the highest substream the publisher is sending
+ * instead, while \c all records each substream in its own file (the
+ * additional substreams use a \c -video-sc1 and \c -video-sc2 suffix),
+ * so that you don't need a separate subscriber just to get a high quality
+ * recording. Changing this property with a \c configure while recording
+ * closes the current recordings and starts new ones, without any need for
+ * a renegotiation. When using VP9-SVC all layers are in the same stream,
+ * and so they're always all recorded.
+ *
  * Notice that you can also use \c configure as a request instead of
  * \c publish to start publishing. The two are functionally equivalent
  * for publishing, but from a semantic perspective \c publish is the
@@ -602,6 +723,7 @@ notify_joining = true|false (optional, whether to notify all participants when a
 	"bitrate" : <bitrate cap to return via REMB; optional, overrides the global room value if present>,
 	"record" : <true|false, whether this publisher should be recorded or not; optional>,
 	"filename" : "<if recording, the base path/file to use for the recording files; optional>",
+	"record_substreams" : "<if simulcasting, which substreams to record: base (default), highest or all; optional>",
 	"display" : "<new display name to use in the room; optional>"
 }
 \endverbatim
@@ -655,9 +777,18 @@ notify_joining = true|false (optional, whether to notify all participants when a
 	"video_ptype_3" : <if simulcasting or doing VP9-SVC, video payload type to use the third substream/layer; optional>,
 	"data_port" : <port to forward the datachannel messages to>,
 	"srtp_suite" : <length of authentication tag (32 or 80); optional>,
-	"srtp_crypto" : "<key to use as crypto (base64 encoded key as in SDES); optional>"
+	"srtp_crypto" : "<key to use as crypto (base64 encoded key as in SDES); optional>",
+	"feedback" : <true|false, whether RTCP feedback for video should be accepted back on the forwarder socket; optional>
 }
 \endverbatim
+ *
+ * When \c feedback is \c true (not supported for SRTP forwarders), the
+ * plugin keeps a short buffer of the video packets it forwarded, and
+ * listens for RTCP coming back from the address it's forwarding to:
+ * NACKs are answered with retransmissions from the buffer, while PLIs
+ * and FIRs are turned into keyframe requests for the publisher. This
+ * is what allows another Janus instance to cascade the room, as
+ * explained below.
  *
  * A successful request will result in an \c rtp_forward response, containing
  * the relevant info associated to the new forwarder(s):
@@ -738,7 +869,8 @@ notify_joining = true|false (optional, whether to notify all participants when a
 					"ssrc" : <SSRC this forwarder is using, if any>,
 					"pt" : <payload type this forwarder is using, if any>,
 					"substream" : <video substream this video forwarder is relaying, if any>,
-					"srtp" : <true|false, whether the RTP stream is encrypted>
+					"srtp" : <true|false, whether the RTP stream is encrypted>,
+					"send_errors" : <how many packets couldn't be sent to the recipient so far>
 				},
 				// Other forwarders for this publisher
 			],
@@ -747,6 +879,76 @@ notify_joining = true|false (optional, whether to notify all participants when a
 	]
 }
 \endverbatim * 
+ *
+ * RTP forwarders can also be used to make a room span more than a single
+ * Janus instance, e.g., to serve a large audience from edges close to
+ * the viewers while publishers only talk to the origin. To do that, you
+ * first add a remote publisher to the room on the edge, using the
+ * \c add_remote_publisher request:
+ *
+\verbatim
+{
+	"request" : "add_remote_publisher",
+	"room" : <unique numeric ID of the room on the edge>,
+	"secret" : "<room secret; mandatory if configured>",
+	"id" : <unique ID to assign to the remote publisher; optional, random if missing>,
+	"display" : "<display name of the remote publisher; optional>",
+	"audiocodec" : "<audio codec of the remote publisher, if any (e.g., opus)>",
+	"videocodec" : "<video codec of the remote publisher, if any (e.g., vp8)>",
+	"simulcast" : <true|false, whether the remote publisher is simulcasting (VP8 only); optional>,
+	"data" : <true|false, whether the remote publisher relays data too; optional>,
+	"host" : "<local address to bind the sockets to; optional, all interfaces if missing>",
+	"origin" : "<IPv4 address of the origin the media will come from; optional>"
+}
+\endverbatim
+ *
+ * Since the edge sends feedback back to where media comes from, it only
+ * accepts the media of each stream from a single address: if \c origin
+ * is provided, packets coming from any other address are dropped (the
+ * port can change, e.g., if the forwarder is recreated), while if it's
+ * missing the first address media is received from is pinned, and any
+ * other sender is ignored from then on.
+ *
+ * The remote publisher will be announced to participants of the room as
+ * any other publisher, and subscribers can attach to it as usual. A
+ * successful request will result in a \c remote_publisher response,
+ * containing the ports the edge is waiting for media on:
+ *
+\verbatim
+{
+	"videoroom" : "remote_publisher",
+	"room" : <unique numeric ID, same as request>,
+	"id" : <unique numeric ID of the remote publisher>,
+	"audio_port" : <port to send audio RTP packets to, if any>,
+	"video_port" : <port to send video RTP packets to, if any>,
+	"video_port_2" : <port to send the second video substream to, if simulcasting>,
+	"video_port_3" : <port to send the third video substream to, if simulcasting>,
+	"data_port" : <port to send datachannel messages to, if any>
+}
+\endverbatim
+ *
+ * You can then create an \c rtp_forward on the origin for the actual
+ * publisher, using the edge address as \c host , the ports above, and
+ * \c feedback set to \c true : the edge will send NACKs for lost packets
+ * and keyframe requests for its subscribers back to the origin, using
+ * the same ports. Payload types and SSRCs are rewritten by the edge, so
+ * there's no need to specify them. Notice that header extensions are not
+ * negotiated for remote publishers, which means features depending on
+ * them (e.g., audio levels) are not available on the edge. To get rid
+ * of a remote publisher, e.g., because the actual publisher left the
+ * room on the origin, you can use \c remove_remote_publisher :
+ *
+\verbatim
+{
+	"request" : "remove_remote_publisher",
+	"room" : <unique numeric ID of the room on the edge>,
+	"secret" : "<room secret; mandatory if configured>",
+	"id" : <unique numeric ID of the remote publisher>
+}
+\endverbatim
+ *
+ * which will notify participants the publisher left, and return a
+ * generic \c success response.
  * 
  * To conclude, you can leave a room you previously joined as publisher
  * using the \c leave request. This will also implicitly unpublish you
@@ -804,7 +1006,8 @@ notify_joining = true|false (optional, whether to notify all participants when a
 	"request" : "join",
 	"ptype" : "subscriber",
 	"room" : <unique ID of the room to subscribe in>,
-	"feed" : <unique ID of the publisher to subscribe to; mandatory>,
+	"feed" : <unique ID of the publisher to subscribe to; mandatory, unless speaker is used>,
+	"speaker" : <rank of the active speaker to follow (0 is the most recent one), as explained below; optional>,
 	"private_id" : <unique ID of the publisher that originated this request; optional, unless mandated by the room configuration>,
 	"close_pc" : <true|false, depending on whether or not the PeerConnection should be automatically closed when the publisher leaves; true by default>,
 	"audio" : <true|false, depending on whether or not audio should be relayed; true by default>,
@@ -812,7 +1015,8 @@ notify_joining = true|false (optional, whether to notify all participants when a
 	"data" : <true|false, depending on whether or not data should be relayed; true by default>,
 	"offer_audio" : <true|false; whether or not audio should be negotiated; true by default if the publisher has audio>,
 	"offer_video" : <true|false; whether or not video should be negotiated; true by default if the publisher has video>,
-	"offer_data" : <true|false; whether or not datachannels should be negotiated; true by default if the publisher has datachannels>
+	"offer_data" : <true|false; whether or not datachannels should be negotiated; true by default if the publisher has datachannels>,
+	"auto_layers" : <true|false; whether simulcast substreams/VP9-SVC layers should be picked automatically, as explained below; false by default>
 }
 \endverbatim
  *
@@ -837,7 +1041,8 @@ notify_joining = true|false (optional, whether to notify all participants when a
 	"videoroom" : "attached",
 	"room" : <room ID>,
 	"feed" : <publisher ID>,
-	"display" : "<the display name of the publisher, if any>"
+	"display" : "<the display name of the publisher, if any>",
+	"speaker" : <rank of the active speaker being followed, if any>
 }
 \endverbatim
  *
@@ -920,7 +1125,8 @@ notify_joining = true|false (optional, whether to notify all participants when a
 	"substream" : <substream to receive (0-2), in case simulcasting is enabled; optional>,
 	"temporal" : <temporal layers to receive (0-2), in case simulcasting is enabled; optional>,
 	"spatial_layer" : <spatial layer to receive (0-1), in case VP9-SVC is enabled; optional>,
-	"temporal_layer" : <temporal layers to receive (0-2), in case VP9-SVC is enabled; optional>
+	"temporal_layer" : <temporal layers to receive (0-2), in case VP9-SVC is enabled; optional>,
+	"auto_layers" : <true|false, whether substreams/layers should be picked automatically; optional>
 }
 \endverbatim
  *
@@ -935,6 +1141,20 @@ notify_joining = true|false (optional, whether to notify all participants when a
  * but within the context of VP9-SVC publishers, and will have no effect
  * on subscriptions associated to regular publishers.
  *
+ * Rather than picking substreams and layers themselves, subscribers can
+ * set \c auto_layers to \c true and let the plugin do it for them. In
+ * that case, the plugin measures how much each substream (or spatial
+ * layer) of the publisher takes, and compares it to the bandwidth the
+ * subscriber reports via REMB: as soon as the estimate doesn't cover
+ * what's being sent anymore, a lower substream is picked (and, when
+ * already on the lowest one, fewer temporal layers), while going up
+ * again only happens when the estimate covers the next layer with a 20%
+ * margin and nothing changed for a few seconds, to avoid oscillations.
+ * The usual \c substream and \c temporal events will notify the
+ * subscriber about the changes. Explicitly asking for a substream or
+ * layer in a \c configure request disables the automatic selection,
+ * unless \c auto_layers is passed as well.
+ *
  * Another interesting feature that subscribers can take advantage of is the
  * so-called publisher "switching". Basically, when subscribed to a specific
  * publisher and receiving media from them, you can at any time "switch"
@@ -974,6 +1194,31 @@ notify_joining = true|false (optional, whether to notify all participants when a
 	"id" : <unique ID of the new publisher>
 }
 \endverbatim
+ *
+ * In large rooms, subscribing to all publishers may not be an option,
+ * and clients typically only want to see the few people that are
+ * actually talking. Rather than tracking the \c talking events and
+ * sending \c switch requests themselves, subscribers can pass a
+ * \c speaker rank instead of a \c feed when joining: a subscription
+ * with \c speaker set to \c 0 will always relay the publisher that
+ * started talking most recently, one with \c 1 the one before, and so
+ * on, which means that, to get the last N speakers, a client just
+ * needs N subscriptions with ranks from \c 0 to \c N-1 . The plugin
+ * keeps the publishers of the room ordered by when they last started
+ * talking (which requires \c audiolevel_event to be enabled in the room),
+ * and switches the subscriptions accordingly whenever that changes, or
+ * when the followed publisher goes away: the publisher owning the
+ * subscriptions (as identified by \c private_id ) and publishers using
+ * different codecs are skipped. Each time this happens, the subscriber
+ * receives a \c switched event, just as if a \c switch request had been
+ * sent, with an additional \c speaker property containing the rank.
+ * Since the whole subscription moves from a publisher to another, audio
+ * included, such subscriptions are typically joined with \c offer_audio
+ * set to \c false , with audio received by means of regular subscriptions
+ * to all publishers (or a mix of them, e.g., from the AudioBridge plugin).
+ * Sending a \c switch request for a specific \c feed stops following
+ * speakers; besides, \c close_pc has no effect for such subscriptions,
+ * which are only closed when the room is destroyed.
  *
  * Finally, to stop the subscription to the mountpoint and tear down the
  * related PeerConnection, you can use the \c leave request. Since context
@@ -1010,8 +1255,11 @@ notify_joining = true|false (optional, whether to notify all participants when a
 #include "../record.h"
 #include "../sdp-utils.h"
 #include "../utils.h"
+#include "../metrics.h"
+#include "../memory.h"
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <poll.h>
 
 
 /* Plugin information */
@@ -1037,6 +1285,10 @@ void janus_videoroom_create_session(janus_plugin_session *handle, int *error);
 struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session *handle, char *transaction, json_t *message, json_t *jsep);
 void janus_videoroom_setup_media(janus_plugin_session *handle);
 void janus_videoroom_incoming_rtp(janus_plugin_session *handle, int video, char *buf, int len);
+void janus_videoroom_incoming_rtp_packet(janus_plugin_session *handle, janus_plugin_rtp_packet *packet);
+void janus_videoroom_incoming_rtp_batch(janus_plugin_session *handle, janus_plugin_rtp_packet *packets, int count);
+static void janus_videoroom_incoming_rtp_internal(janus_plugin_session *handle, int video, char *buf, int len,
+	janus_rtp_ext_info *extensions, janus_rtp_media_info *media, gint64 received);
 void janus_videoroom_incoming_rtcp(janus_plugin_session *handle, int video, char *buf, int len);
 void janus_videoroom_incoming_data(janus_plugin_session *handle, char *buf, int len);
 void janus_videoroom_slow_link(janus_plugin_session *handle, int uplink, int video);
@@ -1062,6 +1314,8 @@ static janus_plugin janus_videoroom_plugin =
 		.handle_message = janus_videoroom_handle_message,
 		.setup_media = janus_videoroom_setup_media,
 		.incoming_rtp = janus_videoroom_incoming_rtp,
+		.incoming_rtp_packet = janus_videoroom_incoming_rtp_packet,
+		.incoming_rtp_batch = janus_videoroom_incoming_rtp_batch,
 		.incoming_rtcp = janus_videoroom_incoming_rtcp,
 		.incoming_data = janus_videoroom_incoming_data,
 		.slow_link = janus_videoroom_slow_link,
@@ -1108,6 +1362,13 @@ static struct janus_json_parameter create_parameters[] = {
 	{"rec_dir", JSON_STRING, 0},
 	{"permanent", JANUS_JSON_BOOL, 0},
 	{"notify_joining", JANUS_JSON_BOOL, 0},
+	{"fanout_threshold", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"keyframe_window", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"memory_cap", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+};
+static struct janus_json_parameter create_rooms_parameters[] = {
+	{"rooms", JSON_ARRAY, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_NONEMPTY},
+	{"permanent", JANUS_JSON_BOOL, 0}
 };
 static struct janus_json_parameter edit_parameters[] = {
 	{"room", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
@@ -1149,6 +1410,7 @@ static struct janus_json_parameter join_parameters[] = {
 	{"bitrate", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"record", JANUS_JSON_BOOL, 0},
 	{"filename", JSON_STRING, 0},
+	{"record_substreams", JSON_STRING, 0},
 	{"token", JSON_STRING, 0}
 };
 static struct janus_json_parameter publish_parameters[] = {
@@ -1160,6 +1422,7 @@ static struct janus_json_parameter publish_parameters[] = {
 	{"bitrate", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"record", JANUS_JSON_BOOL, 0},
 	{"filename", JSON_STRING, 0},
+	{"record_substreams", JSON_STRING, 0},
 	{"display", JSON_STRING, 0},
 	/* The following are just to force a renegotiation and/or an ICE restart */
 	{"update", JANUS_JSON_BOOL, 0},
@@ -1183,13 +1446,29 @@ static struct janus_json_parameter rtp_forward_parameters[] = {
 	{"data_port", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"host", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
 	{"srtp_suite", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
-	{"srtp_crypto", JSON_STRING, 0}
+	{"srtp_crypto", JSON_STRING, 0},
+	{"feedback", JANUS_JSON_BOOL, 0}
 };
 static struct janus_json_parameter stop_rtp_forward_parameters[] = {
 	{"room", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
 	{"publisher_id", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
 	{"stream_id", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE}
 };
+static struct janus_json_parameter remote_publisher_parameters[] = {
+	{"room", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
+	{"id", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"display", JSON_STRING, 0},
+	{"audiocodec", JSON_STRING, 0},
+	{"videocodec", JSON_STRING, 0},
+	{"simulcast", JANUS_JSON_BOOL, 0},
+	{"data", JANUS_JSON_BOOL, 0},
+	{"host", JSON_STRING, 0},
+	{"origin", JSON_STRING, 0}
+};
+static struct janus_json_parameter remove_remote_publisher_parameters[] = {
+	{"room", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
+	{"id", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE}
+};
 static struct janus_json_parameter publisher_parameters[] = {
 	{"id", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"display", JSON_STRING, 0}
@@ -1204,11 +1483,14 @@ static struct janus_json_parameter configure_parameters[] = {
 	/* For VP9 SVC */
 	{"spatial_layer", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"temporal_layer", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	/* Automatic substream/layer selection, based on the subscriber bandwidth */
+	{"auto_layers", JANUS_JSON_BOOL, 0},
 	/* The following is to handle a renegotiation */
 	{"update", JANUS_JSON_BOOL, 0},
 };
 static struct janus_json_parameter subscriber_parameters[] = {
-	{"feed", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
+	{"feed", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"speaker", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"private_id", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"close_pc", JANUS_JSON_BOOL, 0},
 	{"audio", JANUS_JSON_BOOL, 0},
@@ -1216,7 +1498,8 @@ static struct janus_json_parameter subscriber_parameters[] = {
 	{"data", JANUS_JSON_BOOL, 0},
 	{"offer_audio", JANUS_JSON_BOOL, 0},
 	{"offer_video", JANUS_JSON_BOOL, 0},
-	{"offer_data", JANUS_JSON_BOOL, 0}
+	{"offer_data", JANUS_JSON_BOOL, 0},
+	{"auto_layers", JANUS_JSON_BOOL, 0}
 };
 
 /* Static configuration instance */
@@ -1240,6 +1523,22 @@ typedef enum janus_videoroom_p_type {
 	janus_videoroom_p_type_publisher,			/* Participant (for receiving events) and optionally publisher */
 } janus_videoroom_p_type;
 
+/* Which simulcast substreams of a publisher should be recorded */
+typedef enum janus_videoroom_record_substreams {
+	janus_videoroom_record_base = 0,		/* Only the base substream (default) */
+	janus_videoroom_record_highest,			/* Only the highest substream */
+	janus_videoroom_record_all,				/* All substreams, each in its own file */
+} janus_videoroom_record_substreams;
+static int janus_videoroom_record_substreams_from_name(const char *name) {
+	if(name == NULL || !strcasecmp(name, "base"))
+		return janus_videoroom_record_base;
+	else if(!strcasecmp(name, "highest"))
+		return janus_videoroom_record_highest;
+	else if(!strcasecmp(name, "all"))
+		return janus_videoroom_record_all;
+	return -1;
+}
+
 typedef struct janus_videoroom_message {
 	janus_plugin_session *handle;
 	char *transaction;
@@ -1278,6 +1577,12 @@ typedef struct janus_videoroom {
 	gboolean check_allowed;		/* Whether to check tokens when participants join (see below) */
 	GHashTable *allowed;		/* Map of participants (as tokens) allowed to join */
 	gboolean notify_joining;	/* Whether an event is sent to notify all participants if a new participant joins the room */
+	guint fanout_threshold;		/* Number of subscribers above which packets are relayed by the fan-out workers (0=never) */
+	guint keyframe_window;		/* Minimum time between keyframe requests subscribers cause to a publisher, in ms (0=no limit) */
+	GList *speakers;			/* IDs of the publishers, ordered by when they last started talking (most recent first) */
+	GSList *speaker_subscribers;	/* Subscribers following active speakers rather than a specific feed */
+	gint64 memory_cap;			/* Maximum number of bytes the keyframe caches of this room can hold (0=no limit) */
+	janus_memory_account *memory;	/* Account for the memory held by this room */
 	janus_mutex mutex;			/* Mutex to lock this room instance */
 	janus_refcount ref;			/* Reference counter for this room */
 } janus_videoroom;
@@ -1285,6 +1590,17 @@ static GHashTable *rooms;
 static janus_mutex rooms_mutex = JANUS_MUTEX_INITIALIZER;
 static char *admin_key = NULL;
 
+/* Metrics, all computed when scraped */
+static janus_metric *metric_rooms = NULL, *metric_publishers = NULL;
+/* Root account for the memory held by rooms */
+static janus_memory_account *videoroom_memory = NULL;
+static gint64 janus_videoroom_rooms_metric(gpointer data) {
+	janus_mutex_lock(&rooms_mutex);
+	gint64 count = rooms ? g_hash_table_size(rooms) : 0;
+	janus_mutex_unlock(&rooms_mutex);
+	return count;
+}
+
 typedef struct janus_videoroom_session {
 	janus_plugin_session *handle;
 	gint64 sdp_sessid;
@@ -1313,7 +1629,35 @@ typedef struct janus_videoroom_rtp_forwarder {
 	/* Only needed for SRTP forwarders */
 	gboolean is_srtp;
 	janus_videoroom_srtp_context *srtp_ctx;
+	/* Only needed for video forwarders whose recipient can send feedback (e.g., a remote publisher on another Janus) */
+	gboolean feedback;
+	struct janus_videoroom_rtp_forwarder_packet *buffer;
+	/* How many packets we couldn't send to the recipient */
+	guint32 send_errors;
 } janus_videoroom_rtp_forwarder;
+/* Recent packets sent by a forwarder with feedback, in case the recipient NACKs them */
+#define JANUS_VIDEOROOM_FORWARDER_BUFFER	256
+typedef struct janus_videoroom_rtp_forwarder_packet {
+	guint16 seq;
+	int length;
+	char data[1500];
+} janus_videoroom_rtp_forwarder_packet;
+/* Packets for the forwarders of a publisher are accumulated and sent together
+ * (with a single sendmmsg, where available) rather than with a sendto each:
+ * since forwarders may override the payload type or SSRC, only the RTP header
+ * of plain RTP packets is copied, and sent along with the rest of the packet */
+#define JANUS_VIDEOROOM_FORWARDER_BATCH	32
+typedef struct janus_videoroom_forwarder_batch {
+	int count;
+	janus_videoroom_rtp_forwarder *forwarders[JANUS_VIDEOROOM_FORWARDER_BATCH];
+	struct iovec iovs[JANUS_VIDEOROOM_FORWARDER_BATCH][2];
+	char headers[JANUS_VIDEOROOM_FORWARDER_BATCH][12];
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr msgs[JANUS_VIDEOROOM_FORWARDER_BATCH];
+#else
+	struct msghdr msgs[JANUS_VIDEOROOM_FORWARDER_BATCH];
+#endif
+} janus_videoroom_forwarder_batch;
 /* SRTP encryption may be needed, and potentially shared */
 struct janus_videoroom_srtp_context {
 	GHashTable *contexts;
@@ -1326,6 +1670,38 @@ struct janus_videoroom_srtp_context {
 	uint8_t count;
 };
 
+/* Remote publishers are fed by RTP forwarders on another Janus instance
+ * (e.g., the origin of a cascaded room): we receive each stream on its own
+ * socket, and send keyframe requests and NACKs back to where it comes from */
+#define JANUS_VIDEOROOM_REMOTE_AUDIO	0
+#define JANUS_VIDEOROOM_REMOTE_VIDEO	1	/* 1, 2 and 3, one per simulcast substream */
+#define JANUS_VIDEOROOM_REMOTE_DATA		4
+#define JANUS_VIDEOROOM_REMOTE_STREAMS	5
+/* Losses we ask the origin to retransmit, a keyframe is requested for larger gaps */
+#define JANUS_VIDEOROOM_REMOTE_MAX_NACKS	16
+typedef struct janus_videoroom_remote {
+	int fd[JANUS_VIDEOROOM_REMOTE_STREAMS];		/* Sockets we receive media on (-1 if unused) */
+	guint16 port[JANUS_VIDEOROOM_REMOTE_STREAMS];	/* Ports they're bound to */
+	struct sockaddr_in origin[JANUS_VIDEOROOM_REMOTE_STREAMS];	/* Where media comes from, and so where feedback goes */
+	volatile gint has_origin[JANUS_VIDEOROOM_REMOTE_STREAMS];
+	struct in_addr expected;	/* Address media must come from, if configured */
+	gboolean has_expected;
+	guint16 seq[3];			/* Highest video sequence number we received, per substream */
+	gboolean seq_valid[3];
+	volatile gint stopping;
+} janus_videoroom_remote;
+
+/* Keyframe cache: the packets received since the latest keyframe of a
+ * stream, which we can send to new subscribers right away rather than
+ * asking the publisher for a new keyframe any time somebody subscribes */
+typedef struct janus_videoroom_gop {
+	GList *packets;		/* janus_videoroom_rtp_relay_packet copies, most recent first */
+	guint count;		/* How many packets we have */
+	uint32_t timestamp;	/* RTP timestamp of the keyframe */
+	gint64 bytes;		/* Memory the cached packets take */
+	janus_memory_account *account;	/* Account the cached packets are charged to (the publisher's) */
+} janus_videoroom_gop;
+
 typedef struct janus_videoroom_publisher {
 	janus_videoroom_session *session;
 	janus_videoroom *room;	/* Room */
@@ -1334,6 +1710,7 @@ typedef struct janus_videoroom_publisher {
 	guint32 pvt_id;		/* This is sent to the publisher for mapping purposes, but shouldn't be shared with others */
 	gchar *display;		/* Display name (just for fun) */
 	gchar *sdp;			/* The SDP this publisher negotiated, if any */
+	gchar *sdp_offers[8];	/* Offers for subscribers, cached per combination of offered media */
 	gboolean audio, video, data;		/* Whether audio, video and/or data is going to be sent by this publisher */
 	janus_audiocodec acodec;	/* Audio codec this publisher is using */
 	janus_videocodec vcodec;	/* Video codec this publisher is using */
@@ -1360,30 +1737,77 @@ typedef struct janus_videoroom_publisher {
 	gint64 remb_startup;/* Incremental changes on REMB to reach the target at startup */
 	gint64 remb_latest;	/* Time of latest sent REMB (to avoid flooding) */
 	gint64 fir_latest;	/* Time of latest sent FIR (to avoid flooding) */
+	gint64 keyframe_requested;	/* Time of the latest keyframe request, whatever the reason, to coalesce those of subscribers */
+	guint32 keyframe_suppressed;	/* How many keyframe requests of subscribers we dropped */
 	gint fir_seq;		/* FIR sequence number */
 	gboolean recording_active;	/* Whether this publisher has to be recorded or not */
 	gchar *recording_base;	/* Base name for the recording (e.g., /path/to/filename, will generate /path/to/filename-audio.mjr and/or /path/to/filename-video.mjr */
 	janus_recorder *arc;	/* The Janus recorder instance for this publisher's audio, if enabled */
 	janus_recorder *vrc;	/* The Janus recorder instance for this user's video, if enabled */
+	janus_recorder *vrc_sc[2];	/* The Janus recorder instances for the other simulcast substreams, if recording them all */
+	int vrc_substream;		/* The simulcast substream vrc records (the base one, unless configured otherwise) */
+	janus_videoroom_record_substreams record_substreams;	/* Which simulcast substreams should be recorded */
 	janus_recorder *drc;	/* The Janus recorder instance for this publisher's data, if enabled */
 	janus_mutex rec_mutex;	/* Mutex to protect the recorders from race conditions */
 	GSList *subscribers;	/* Subscriptions to this publisher (who's watching this publisher)  */
+	guint subscribers_count;	/* How many subscriptions there are in the list above */
+	gboolean fanout;		/* Whether the fan-out workers are relaying this publisher's packets */
+	volatile gint fanout_pending;	/* How many packets of this publisher the fan-out workers are still relaying */
 	GSList *subscriptions;	/* Subscriptions this publisher has created (who this publisher is watching) */
 	janus_mutex subscribers_mutex;
 	GHashTable *rtp_forwarders;
 	GHashTable *srtp_contexts;
 	janus_mutex rtp_forwarders_mutex;
 	int udp_sock; /* The udp socket on which to forward rtp packets */
+	gboolean forwarders_feedback;	/* Whether any forwarder may get feedback on udp_sock */
+	gint64 feedback_latest;	/* Last time we checked udp_sock for feedback */
+	janus_videoroom_remote *remote;	/* Only set for remote publishers, whose media comes from another Janus instance */
+	uint32_t layer_bytes[3];		/* Video bytes received in the current second, per simulcast substream or VP9 spatial layer */
+	uint32_t layer_bitrate[3];		/* Video bitrate measured in the last second, per simulcast substream or VP9 spatial layer */
+	gint64 layer_bitrate_latest;	/* When we last measured the bitrates above */
+	janus_videoroom_gop gop[3];		/* Packets since the latest keyframe, per simulcast substream (only the first if not simulcasting) */
+	janus_mutex gop_mutex;
+	janus_memory_account *memory;	/* Account for the memory held by this publisher (keyframe caches) */
 	gboolean kicked;	/* Whether this participant has been kicked */
 	volatile gint destroyed;
 	janus_refcount ref;
 } janus_videoroom_publisher;
+
+/* Count the participants that are actually publishing, in all rooms */
+static gint64 janus_videoroom_publishers_metric(gpointer data) {
+	gint64 count = 0;
+	janus_mutex_lock(&rooms_mutex);
+	GHashTableIter iter, piter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, rooms);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_videoroom *room = (janus_videoroom *)value;
+		janus_mutex_lock(&room->mutex);
+		g_hash_table_iter_init(&piter, room->participants);
+		while(g_hash_table_iter_next(&piter, NULL, &value)) {
+			janus_videoroom_publisher *p = (janus_videoroom_publisher *)value;
+			if(p->sdp != NULL)
+				count++;
+		}
+		janus_mutex_unlock(&room->mutex);
+	}
+	janus_mutex_unlock(&rooms_mutex);
+	return count;
+}
 static void janus_videoroom_rtp_forwarder_free_helper(gpointer data);
 static void janus_videoroom_srtp_context_free_helper(gpointer data);
+static void janus_videoroom_remote_pli(janus_videoroom_publisher *p);
+static void janus_videoroom_incoming_rtp_publisher(janus_videoroom_publisher *participant, int video, char *buf, int len,
+	janus_rtp_ext_info *extensions, janus_rtp_media_info *media, gint64 received);
+static void janus_videoroom_incoming_data_publisher(janus_videoroom_publisher *participant, char *buf, int len);
+static void janus_videoroom_recorder_create(janus_videoroom_publisher *participant, gboolean audio, gboolean video, gboolean data);
+static int janus_videoroom_remote_socket(const char *host, guint16 *port);
+static void *janus_videoroom_remote_thread(void *data);
+static void janus_videoroom_gop_reset(janus_videoroom_gop *gop);
 static guint32 janus_videoroom_rtp_forwarder_add_helper(janus_videoroom_publisher *p,
 	const gchar* host, int port, int pt, uint32_t ssrc,
 	int srtp_suite, const char *srtp_crypto,
-	int substream, gboolean is_video, gboolean is_data);
+	int substream, gboolean is_video, gboolean is_data, gboolean feedback);
 
 typedef struct janus_videoroom_subscriber {
 	janus_videoroom_session *session;
@@ -1393,6 +1817,7 @@ typedef struct janus_videoroom_subscriber {
 	gboolean close_pc;		/* Whether we should automatically close the PeerConnection when the publisher goes away */
 	guint32 pvt_id;			/* Private ID of the participant that is subscribing (if available/provided) */
 	janus_sdp *sdp;			/* Offer we sent this listener (may be updated within renegotiations) */
+	gchar *sdp_offer;		/* Offer we sent this listener when joining, only parsed to sdp if we need to update it */
 	janus_rtp_switching_context context;	/* Needed in case there are publisher switches on this subscriber */
 	int substream;			/* Which VP8 simulcast substream we should forward, in case the publisher is simulcasting */
 	int substream_target;	/* As above, but to handle transitions (e.g., wait for keyframe) */
@@ -1409,6 +1834,13 @@ typedef struct janus_videoroom_subscriber {
 	 * simulcast, which has similar info (substream/templayer) but in a completely different context */
 	int spatial_layer, target_spatial_layer;
 	int temporal_layer, target_temporal_layer;
+	guint fanout_worker;	/* Which worker relays packets to this subscriber, when fanning out in parallel */
+	gboolean auto_layers;	/* Whether substreams/layers are picked automatically, based on the bandwidth the subscriber reports */
+	uint32_t bwe;			/* Smoothed estimate of the subscriber's downlink, as reported in REMB */
+	gint64 bwe_latest;		/* When we last changed substream/layers automatically */
+	int speaker;			/* Rank of the active speaker this subscriber follows (-1 if it's subscribed to a specific feed) */
+	janus_audiocodec speaker_acodec;	/* Codecs of the feed we negotiated, that the speakers we switch to must use too */
+	janus_videocodec speaker_vcodec;
 	volatile gint destroyed;
 	janus_refcount ref;
 } janus_videoroom_subscriber;
@@ -1416,17 +1848,150 @@ typedef struct janus_videoroom_subscriber {
 typedef struct janus_videoroom_rtp_relay_packet {
 	janus_rtp_header *data;
 	gint length;
+	/* Copy of the packet as sent by the publisher, shared by all subscribers */
+	janus_plugin_rtp_shared *shared;
 	gboolean is_video;
 	uint32_t ssrc[3];
 	uint32_t timestamp;
 	uint16_t seq_number;
+	/* When we received the packet, so that subscribers don't need to check the clock each */
+	gint64 received;
 	/* The following are only relevant if we're doing VP9 SVC*/
 	gboolean svc;
 	int spatial_layer;
 	int temporal_layer;
 	uint8_t pbit, dbit, ubit, bbit, ebit;
+	/* Payload descriptor info as parsed by the core, if available */
+	janus_rtp_media_info *media;
 } janus_videoroom_rtp_relay_packet;
 
+/* Parallel fan-out: when a publisher has many subscribers, relaying a
+ * packet to all of them on the publisher's thread can take more than one
+ * core can handle. Above a threshold, subscribers are partitioned across
+ * a pool of workers instead: each subscriber is always served by the same
+ * worker, which means its packets are still relayed in order. Once a
+ * publisher goes parallel, it only goes back to relaying inline when it
+ * has less than half the threshold subscribers and the workers are done
+ * with all its packets, so that a subscriber is never served by two
+ * threads at the same time. Each packet is copied once, and each worker
+ * copies it again before relaying it, since relaying changes the header
+ * for each subscriber */
+#define JANUS_VIDEOROOM_FANOUT_MAX_WORKERS	32
+typedef struct janus_videoroom_fanout_packet {
+	janus_videoroom_publisher *publisher;
+	janus_videoroom_rtp_relay_packet packet;
+	janus_rtp_media_info media;
+	gint64 started;
+	volatile gint pending;
+	char buffer[0];
+} janus_videoroom_fanout_packet;
+typedef struct janus_videoroom_fanout_job {
+	janus_videoroom_fanout_packet *packet;
+	GPtrArray *subscribers;
+} janus_videoroom_fanout_job;
+typedef struct janus_videoroom_fanout_worker {
+	guint id;
+	GThread *thread;
+	GAsyncQueue *queue;
+} janus_videoroom_fanout_worker;
+static janus_videoroom_fanout_worker *fanout_workers[JANUS_VIDEOROOM_FANOUT_MAX_WORKERS];
+static guint fanout_workers_count = 0, fanout_threshold = 0;
+/* Maximum number of packets to keep in the keyframe cache of each stream (0 disables it) */
+static guint keyframe_cache_packets = 0;
+static volatile gint fanout_next_worker = 0;
+static janus_videoroom_fanout_job fanout_exit_job;
+static janus_metric *metric_fanout_packets[2] = { NULL, NULL }, *metric_fanout_time[2] = { NULL, NULL };
+static janus_metric *metric_keyframe_requests[2] = { NULL, NULL };
+
+static void janus_videoroom_fanout_packet_unref(janus_videoroom_fanout_packet *fp) {
+	if(!g_atomic_int_dec_and_test(&fp->pending))
+		return;
+	/* The last worker to be done with a packet accounts for the whole fan-out */
+	janus_metric_inc(metric_fanout_packets[1]);
+	janus_metric_add(metric_fanout_time[1], janus_get_monotonic_time() - fp->started);
+	if(fp->packet.shared != NULL)
+		janus_refcount_decrease(&fp->packet.shared->ref);
+	g_atomic_int_add(&fp->publisher->fanout_pending, -1);
+	janus_refcount_decrease_nodebug(&fp->publisher->ref);
+	g_free(fp);
+}
+
+static void *janus_videoroom_fanout_thread(void *data) {
+	janus_videoroom_fanout_worker *worker = (janus_videoroom_fanout_worker *)data;
+	JANUS_LOG(LOG_VERB, "Joining VideoRoom fan-out worker #%u\n", worker->id);
+	char buffer[1500];
+	janus_videoroom_fanout_job *job = NULL;
+	while((job = g_async_queue_pop(worker->queue)) != &fanout_exit_job) {
+		janus_videoroom_fanout_packet *fp = job->packet;
+		/* Work on our own copy of the packet (on the stack, unless it's unusually large) */
+		janus_videoroom_rtp_relay_packet packet = fp->packet;
+		char *copy = packet.length > (int)sizeof(buffer) ? g_malloc(packet.length) : buffer;
+		memcpy(copy, fp->buffer, packet.length);
+		packet.data = (janus_rtp_header *)copy;
+		guint i = 0;
+		for(i=0; i<job->subscribers->len; i++) {
+			janus_videoroom_subscriber *subscriber = g_ptr_array_index(job->subscribers, i);
+			janus_videoroom_session *session = subscriber->session;
+			if(!g_atomic_int_get(&subscriber->destroyed) && !g_atomic_int_get(&session->destroyed))
+				janus_videoroom_relay_rtp_packet(subscriber, &packet);
+			janus_refcount_decrease(&session->ref);
+			janus_refcount_decrease(&subscriber->ref);
+		}
+		g_ptr_array_free(job->subscribers, TRUE);
+		if(copy != buffer)
+			g_free(copy);
+		janus_videoroom_fanout_packet_unref(fp);
+		g_free(job);
+	}
+	JANUS_LOG(LOG_VERB, "Leaving VideoRoom fan-out worker #%u\n", worker->id);
+	return NULL;
+}
+
+/* Partition the subscribers of a publisher across the workers (subscribers_mutex must be locked) */
+static void janus_videoroom_fanout(janus_videoroom_publisher *publisher, janus_videoroom_rtp_relay_packet *packet) {
+	janus_videoroom_fanout_packet *fp = g_malloc(sizeof(janus_videoroom_fanout_packet) + packet->length);
+	fp->started = janus_get_monotonic_time();
+	janus_refcount_increase_nodebug(&publisher->ref);
+	fp->publisher = publisher;
+	g_atomic_int_inc(&publisher->fanout_pending);
+	fp->packet = *packet;
+	memcpy(fp->buffer, packet->data, packet->length);
+	fp->packet.data = (janus_rtp_header *)fp->buffer;
+	if(packet->media != NULL) {
+		fp->media = *packet->media;
+		fp->packet.media = &fp->media;
+	}
+	if(fp->packet.shared != NULL)
+		janus_refcount_increase(&fp->packet.shared->ref);
+	janus_videoroom_fanout_job *jobs[JANUS_VIDEOROOM_FANOUT_MAX_WORKERS];
+	memset(jobs, 0, sizeof(jobs));
+	guint count = 0;
+	GSList *s = publisher->subscribers;
+	while(s) {
+		janus_videoroom_subscriber *subscriber = (janus_videoroom_subscriber *)s->data;
+		s = s->next;
+		if(subscriber == NULL || subscriber->session == NULL || subscriber->paused || subscriber->kicked)
+			continue;
+		guint id = subscriber->fanout_worker % fanout_workers_count;
+		if(jobs[id] == NULL) {
+			jobs[id] = g_malloc(sizeof(janus_videoroom_fanout_job));
+			jobs[id]->packet = fp;
+			jobs[id]->subscribers = g_ptr_array_sized_new(64);
+			count++;
+		}
+		janus_refcount_increase(&subscriber->ref);
+		janus_refcount_increase(&subscriber->session->ref);
+		g_ptr_array_add(jobs[id]->subscribers, subscriber);
+	}
+	/* One extra reference, so that no worker frees the packet while we're still queueing jobs */
+	g_atomic_int_set(&fp->pending, count+1);
+	guint i = 0;
+	for(i=0; i<fanout_workers_count; i++) {
+		if(jobs[i] != NULL)
+			g_async_queue_push(fanout_workers[i]->queue, jobs[i]);
+	}
+	janus_videoroom_fanout_packet_unref(fp);
+}
 
 /* Freeing stuff */
 static void janus_videoroom_subscriber_destroy(janus_videoroom_subscriber *s) {
@@ -1438,6 +2003,7 @@ static void janus_videoroom_subscriber_free(const janus_refcount *s_ref) {
 	janus_videoroom_subscriber *s = janus_refcount_containerof(s_ref, janus_videoroom_subscriber, ref);
 	/* This subscriber can be destroyed, free all the resources */
 	janus_sdp_destroy(s->sdp);
+	g_free(s->sdp_offer);
 	g_free(s);
 }
 
@@ -1455,16 +2021,57 @@ static void janus_videoroom_publisher_destroy(janus_videoroom_publisher *p) {
 		janus_refcount_decrease(&p->ref);
 }
 
+/* Get rid of the cached subscriber offers, e.g., because the publisher SDP changed */
+static void janus_videoroom_publisher_sdp_reset(janus_videoroom_publisher *p) {
+	int i = 0;
+	for(i=0; i<8; i++) {
+		g_free(p->sdp_offers[i]);
+		p->sdp_offers[i] = NULL;
+	}
+}
+
+/* Get the offer to send to a new subscriber: this only depends on the publisher SDP and
+ * on which media the subscriber wants, so we parse, munge and write it only once for each
+ * combination, and new subscribers just get a copy (call with subscribers_mutex locked) */
+static const char *janus_videoroom_publisher_sdp_offer(janus_videoroom_publisher *p,
+		gboolean audio, gboolean video, gboolean data) {
+	if(p->sdp == NULL)
+		return NULL;
+	/* Only strip what the publisher is actually sending */
+	int index = (p->audio && !audio ? 1 : 0) | (p->video && !video ? 2 : 0) | (p->data && !data ? 4 : 0);
+	if(p->sdp_offers[index] != NULL)
+		return p->sdp_offers[index];
+	char error_str[512];
+	janus_sdp *offer = janus_sdp_parse_transient(p->sdp, error_str, sizeof(error_str));
+	if(offer == NULL) {
+		JANUS_LOG(LOG_ERR, "Error parsing publisher SDP: %s\n", error_str);
+		return NULL;
+	}
+	offer->o_version = 1;
+	if(index & 1)
+		janus_sdp_mline_remove(offer, JANUS_SDP_AUDIO);
+	if(index & 2)
+		janus_sdp_mline_remove(offer, JANUS_SDP_VIDEO);
+	if(index & 4)
+		janus_sdp_mline_remove(offer, JANUS_SDP_APPLICATION);
+	p->sdp_offers[index] = janus_sdp_write(offer);
+	janus_sdp_destroy(offer);
+	return p->sdp_offers[index];
+}
+
 static void janus_videoroom_publisher_free(const janus_refcount *p_ref) {
 	janus_videoroom_publisher *p = janus_refcount_containerof(p_ref, janus_videoroom_publisher, ref);
 	g_free(p->display);
 	p->display = NULL;
 	g_free(p->sdp);
 	p->sdp = NULL;
+	janus_videoroom_publisher_sdp_reset(p);
 	g_free(p->recording_base);
 	p->recording_base = NULL;
 	janus_recorder_destroy(p->arc);
 	janus_recorder_destroy(p->vrc);
+	janus_recorder_destroy(p->vrc_sc[0]);
+	janus_recorder_destroy(p->vrc_sc[1]);
 	janus_recorder_destroy(p->drc);
 
 	if(p->udp_sock > 0)
@@ -1474,9 +2081,28 @@ static void janus_videoroom_publisher_free(const janus_refcount *p_ref) {
 	g_hash_table_destroy(p->srtp_contexts);
 	p->srtp_contexts = NULL;
 	g_slist_free(p->subscribers);
+	p->subscribers_count = 0;
+	if(p->remote != NULL) {
+		int i = 0;
+		for(i=0; i<JANUS_VIDEOROOM_REMOTE_STREAMS; i++) {
+			if(p->remote->fd[i] >= 0)
+				close(p->remote->fd[i]);
+		}
+		g_free(p->remote);
+		p->remote = NULL;
+		/* Remote publishers own their session */
+		g_atomic_int_set(&p->session->destroyed, 1);
+		janus_refcount_decrease(&p->session->ref);
+	}
+
+	janus_videoroom_gop_reset(&p->gop[0]);
+	janus_videoroom_gop_reset(&p->gop[1]);
+	janus_videoroom_gop_reset(&p->gop[2]);
+	janus_memory_account_destroy(p->memory);
 
 	janus_mutex_destroy(&p->subscribers_mutex);
 	janus_mutex_destroy(&p->rtp_forwarders_mutex);
+	janus_mutex_destroy(&p->gop_mutex);
 	g_free(p);
 }
 
@@ -1487,8 +2113,9 @@ static void janus_videoroom_session_destroy(janus_videoroom_session *session) {
 
 static void janus_videoroom_session_free(const janus_refcount *session_ref) {
 	janus_videoroom_session *session = janus_refcount_containerof(session_ref, janus_videoroom_session, ref);
-	/* Remove the reference to the core plugin session */
-	janus_refcount_decrease(&session->handle->ref);
+	/* Remove the reference to the core plugin session (remote publishers have none) */
+	if(session->handle != NULL)
+		janus_refcount_decrease(&session->handle->ref);
 	/* This session can be destroyed, free all the resources */
 	janus_mutex_destroy(&session->mutex);
 	g_free(session);
@@ -1503,6 +2130,23 @@ static void janus_videoroom_room_destroy(janus_videoroom *room) {
 		janus_refcount_decrease(&room->ref);
 }
 
+/* Memory accounting helpers */
+static void janus_videoroom_room_memory_init(janus_videoroom *room) {
+	char name[32];
+	g_snprintf(name, sizeof(name), "room-%"SCNu64, room->room_id);
+	room->memory = janus_memory_account_create(name, videoroom_memory);
+	janus_memory_account_set_limit(room->memory, room->memory_cap);
+}
+
+static void janus_videoroom_publisher_memory_init(janus_videoroom_publisher *p) {
+	char name[32];
+	g_snprintf(name, sizeof(name), "publisher-%"SCNu64, p->user_id);
+	p->memory = janus_memory_account_create(name, p->room ? p->room->memory : NULL);
+	int i = 0;
+	for(i=0; i<3; i++)
+		p->gop[i].account = p->memory;
+}
+
 static void janus_videoroom_room_free(const janus_refcount *room_ref) {
 	janus_videoroom *room = janus_refcount_containerof(room_ref, janus_videoroom, ref);
 	/* This room can be destroyed, free all the resources */
@@ -1513,6 +2157,9 @@ static void janus_videoroom_room_free(const janus_refcount *room_ref) {
 	g_hash_table_destroy(room->participants);
 	g_hash_table_destroy(room->private_ids);
 	g_hash_table_destroy(room->allowed);
+	g_list_free_full(room->speakers, (GDestroyNotify)g_free);
+	g_slist_free(room->speaker_subscribers);
+	janus_memory_account_destroy(room->memory);
 	g_free(room);
 }
 
@@ -1566,6 +2213,13 @@ static void janus_videoroom_codecstr(janus_videoroom *videoroom, char *audio_cod
 }
 
 static void janus_videoroom_reqfir(janus_videoroom_publisher *publisher, const char *reason) {
+	if(publisher->remote != NULL) {
+		/* Remote publisher, ask the origin instead */
+		JANUS_LOG(LOG_VERB, "%s sending PLI to the origin of %"SCNu64" (%s)\n", reason, publisher->user_id, publisher->display ? publisher->display : "??");
+		janus_videoroom_remote_pli(publisher);
+		publisher->fir_latest = janus_get_monotonic_time();
+		return;
+	}
 	/* Send a FIR */
 	char buf[20];
 	janus_rtcp_fir((char *)&buf, 20, &publisher->fir_seq);
@@ -1577,6 +2231,248 @@ static void janus_videoroom_reqfir(janus_videoroom_publisher *publisher, const c
 	gateway->relay_rtcp(publisher->session->handle, 1, buf, 12);
 	/* Update the time of when we last sent a keyframe request */
 	publisher->fir_latest = janus_get_monotonic_time();
+	publisher->keyframe_requested = publisher->fir_latest;
+}
+
+/* Check whether a keyframe request caused by a subscriber should be dropped, because
+ * the publisher was asked for one recently enough (whoever asked): a keyframe is
+ * coming anyway, and asking again would only make the publisher bitrate spike */
+static gboolean janus_videoroom_keyframe_suppress(janus_videoroom_publisher *publisher) {
+	janus_videoroom *room = publisher->room;
+	gint64 now = janus_get_monotonic_time();
+	if(room != NULL && room->keyframe_window > 0 && publisher->keyframe_requested > 0 &&
+			now - publisher->keyframe_requested < (gint64)room->keyframe_window*1000) {
+		publisher->keyframe_suppressed++;
+		janus_metric_inc(metric_keyframe_requests[1]);
+		return TRUE;
+	}
+	publisher->keyframe_requested = now;
+	janus_metric_inc(metric_keyframe_requests[0]);
+	return FALSE;
+}
+
+static void janus_videoroom_reqfir_subscriber(janus_videoroom_publisher *publisher, const char *reason) {
+	if(janus_videoroom_keyframe_suppress(publisher)) {
+		JANUS_LOG(LOG_HUGE, "%s, but a keyframe was requested to %"SCNu64" already\n", reason, publisher->user_id);
+		return;
+	}
+	janus_videoroom_reqfir(publisher, reason);
+}
+
+/* Keep track of how much each simulcast substream or VP9 spatial layer takes */
+static void janus_videoroom_publisher_layer_bitrate(janus_videoroom_publisher *p, int layer, int len) {
+	if(layer < 0 || layer > 2)
+		return;
+	p->layer_bytes[layer] += len;
+	gint64 now = janus_get_monotonic_time();
+	if(p->layer_bitrate_latest == 0) {
+		p->layer_bitrate_latest = now;
+		return;
+	}
+	gint64 elapsed = now - p->layer_bitrate_latest;
+	if(elapsed < G_USEC_PER_SEC)
+		return;
+	int i = 0;
+	for(i=0; i<3; i++) {
+		p->layer_bitrate[i] = (uint32_t)((guint64)p->layer_bytes[i] * 8 * G_USEC_PER_SEC / elapsed);
+		p->layer_bytes[i] = 0;
+	}
+	p->layer_bitrate_latest = now;
+}
+
+/* Keyframe cache management */
+static void janus_videoroom_gop_packet_free(gpointer data) {
+	janus_videoroom_rtp_relay_packet *pkt = (janus_videoroom_rtp_relay_packet *)data;
+	g_free(pkt->data);
+	g_free(pkt);
+}
+
+static void janus_videoroom_gop_reset(janus_videoroom_gop *gop) {
+	g_list_free_full(gop->packets, janus_videoroom_gop_packet_free);
+	gop->packets = NULL;
+	gop->count = 0;
+	gop->timestamp = 0;
+	janus_memory_release(gop->account, janus_memory_keyframes, gop->bytes);
+	gop->bytes = 0;
+}
+
+static void janus_videoroom_gop_update(janus_videoroom_publisher *p, janus_videoroom_rtp_relay_packet *packet, int layer) {
+	if(keyframe_cache_packets == 0 || layer < 0 || layer > 2)
+		return;
+	janus_videoroom_gop *gop = &p->gop[layer];
+	gboolean keyframe = FALSE;
+	if(gop->packets == NULL || packet->timestamp != gop->timestamp) {
+		/* Check if this is the beginning of a new keyframe */
+		if(packet->media != NULL) {
+			keyframe = packet->media->keyframe;
+		} else {
+			int plen = 0;
+			char *payload = janus_rtp_payload((char *)packet->data, packet->length, &plen);
+			if(payload == NULL)
+				return;
+			if(p->vcodec == JANUS_VIDEOCODEC_VP8)
+				keyframe = janus_vp8_is_keyframe(payload, plen);
+			else if(p->vcodec == JANUS_VIDEOCODEC_VP9)
+				keyframe = janus_vp9_is_keyframe(payload, plen);
+			else if(p->vcodec == JANUS_VIDEOCODEC_H264)
+				keyframe = janus_h264_is_keyframe(payload, plen);
+		}
+	}
+	if(!keyframe && gop->packets == NULL)
+		return;
+	janus_mutex_lock(&p->gop_mutex);
+	if(keyframe) {
+		/* New keyframe, get rid of what we had and start again from here */
+		janus_videoroom_gop_reset(gop);
+		gop->timestamp = packet->timestamp;
+	} else if(gop->count >= keyframe_cache_packets) {
+		/* Too long since the keyframe, replaying all this wouldn't be a good idea */
+		JANUS_LOG(LOG_HUGE, "Keyframe cache of %"SCNu64" full (substream %d), waiting for a new keyframe\n", p->user_id, layer);
+		janus_videoroom_gop_reset(gop);
+		janus_mutex_unlock(&p->gop_mutex);
+		return;
+	}
+	gint64 size = sizeof(janus_videoroom_rtp_relay_packet) + packet->length;
+	if(!janus_memory_try_charge(gop->account, janus_memory_keyframes, size)) {
+		/* The room reached its memory cap, stop caching until the next keyframe */
+		JANUS_LOG(LOG_HUGE, "Memory cap of room %"SCNu64" reached, emptying the keyframe cache of %"SCNu64" (substream %d)\n",
+			p->room_id, p->user_id, layer);
+		janus_videoroom_gop_reset(gop);
+		janus_mutex_unlock(&p->gop_mutex);
+		return;
+	}
+	gop->bytes += size;
+	janus_videoroom_rtp_relay_packet *pkt = g_malloc(sizeof(janus_videoroom_rtp_relay_packet));
+	*pkt = *packet;
+	pkt->data = g_malloc(packet->length);
+	memcpy(pkt->data, packet->data, packet->length);
+	pkt->shared = NULL;
+	pkt->media = NULL;
+	gop->packets = g_list_prepend(gop->packets, pkt);
+	gop->count++;
+	janus_mutex_unlock(&p->gop_mutex);
+}
+
+/* Send a new subscriber what we have in the keyframe cache: returns FALSE if we had nothing to send */
+static gboolean janus_videoroom_gop_replay(janus_videoroom_subscriber *s) {
+	janus_videoroom_publisher *p = s->feed;
+	if(keyframe_cache_packets == 0 || p == NULL || !s->video || s->paused)
+		return FALSE;
+	int layer = 0;
+	if(p->ssrc[0] != 0)
+		layer = (s->substream_target >= 0 && s->substream_target <= 2) ? s->substream_target : 2;
+	/* Lock the subscribers, so that no other packet is relayed to anybody while we do this */
+	janus_mutex_lock(&p->subscribers_mutex);
+	janus_mutex_lock(&p->gop_mutex);
+	if(p->gop[layer].packets == NULL) {
+		janus_mutex_unlock(&p->gop_mutex);
+		janus_mutex_unlock(&p->subscribers_mutex);
+		return FALSE;
+	}
+	JANUS_LOG(LOG_VERB, "Sending %u cached packets of %"SCNu64" (substream %d) to new subscriber\n",
+		p->gop[layer].count, p->user_id, layer);
+	/* Treat the cached keyframe as the beginning of a new stream, so that sequence
+	 * numbers and timestamps are rewritten from there, whatever was sent before */
+	s->context.v_last_ssrc = 0;
+	if(p->ssrc[0] != 0 && s->substream != layer) {
+		s->substream = layer;
+		s->last_relayed = janus_get_monotonic_time();
+		janus_vp8_simulcast_context_reset(&s->simulcast_context);
+		json_t *event = json_object();
+		json_object_set_new(event, "videoroom", json_string("event"));
+		json_object_set_new(event, "room", json_integer(s->room_id));
+		json_object_set_new(event, "substream", json_integer(s->substream));
+		gateway->push_event(s->session->handle, &janus_videoroom_plugin, NULL, event, NULL);
+		json_decref(event);
+	}
+	/* The cached packets are sent now, so that's when they were received as far as
+	 * rewriting timestamps is concerned */
+	gint64 now = janus_get_monotonic_time();
+	GList *temp = g_list_last(p->gop[layer].packets);
+	while(temp) {
+		((janus_videoroom_rtp_relay_packet *)temp->data)->received = now;
+		janus_videoroom_relay_rtp_packet(s, temp->data);
+		temp = temp->prev;
+	}
+	janus_mutex_unlock(&p->gop_mutex);
+	janus_mutex_unlock(&p->subscribers_mutex);
+	return TRUE;
+}
+
+/* Automatic substream/layer selection: we go down as soon as the estimate
+ * doesn't cover what we're sending anymore, but only go up again when it
+ * covers the next layer with some margin, and hasn't changed for a while */
+#define JANUS_VIDEOROOM_BWE_DOWN_HOLD	G_USEC_PER_SEC
+#define JANUS_VIDEOROOM_BWE_UP_HOLD		(4*G_USEC_PER_SEC)
+#define JANUS_VIDEOROOM_BWE_UP_MARGIN	120		/* Percentage of the layer bitrate */
+static void janus_videoroom_subscriber_auto_layers(janus_videoroom_subscriber *s, uint32_t remb) {
+	janus_videoroom_publisher *p = s->feed;
+	if(p == NULL || remb == 0)
+		return;
+	/* Drops in the estimate are followed right away, increases are smoothed */
+	if(s->bwe == 0 || remb < s->bwe)
+		s->bwe = remb;
+	else
+		s->bwe = (uint32_t)(((guint64)s->bwe*3 + remb)/4);
+	gboolean simulcast = (p->ssrc[0] != 0);
+	gboolean svc = (!simulcast && s->room && s->room->do_svc && p->vcodec == JANUS_VIDEOCODEC_VP9);
+	if(!simulcast && !svc)
+		return;
+	/* Figure out what each layer costs: with SVC, a spatial layer needs the lower ones too */
+	guint64 needed[3];
+	int i = 0;
+	for(i=0; i<3; i++)
+		needed[i] = p->layer_bitrate[i] + ((svc && i > 0) ? needed[i-1] : 0);
+	int max = simulcast ? 2 : 1;	/* FIXME Chrome only sends two spatial layers */
+	int current = simulcast ? s->substream_target : s->target_spatial_layer;
+	int temporal = simulcast ? s->templayer_target : s->target_temporal_layer;
+	if(current < 0 || current > max)
+		current = max;
+	if(temporal < 0 || temporal > 2)
+		temporal = 2;
+	if(needed[0] == 0)
+		return;		/* We don't know enough about the publisher yet */
+	int target = current, target_temporal = temporal;
+	guint64 bwe = s->bwe;
+	gint64 now = janus_get_monotonic_time();
+	/* We don't know what temporal layers take: we assume they add up evenly */
+	guint64 base = needed[0] * (temporal+1) / 3;
+	if((needed[current] > 0 && bwe < needed[current]) || (current == 0 && bwe < base)) {
+		if(now - s->bwe_latest < JANUS_VIDEOROOM_BWE_DOWN_HOLD)
+			return;
+		while(target > 0 && (needed[target] == 0 || needed[target] > bwe))
+			target--;
+		if(target == 0) {
+			target_temporal = 2;
+			while(target_temporal > 0 && needed[0] * (target_temporal+1) / 3 > bwe)
+				target_temporal--;
+		}
+	} else {
+		if(now - s->bwe_latest < JANUS_VIDEOROOM_BWE_UP_HOLD)
+			return;
+		if(temporal < 2) {
+			if(bwe*100 >= needed[0] * (temporal+2) / 3 * JANUS_VIDEOROOM_BWE_UP_MARGIN)
+				target_temporal = temporal+1;
+		} else if(current < max && needed[current+1] > 0 &&
+				bwe*100 >= needed[current+1] * JANUS_VIDEOROOM_BWE_UP_MARGIN) {
+			target = current+1;
+		}
+	}
+	if(target == current && target_temporal == temporal)
+		return;
+	JANUS_LOG(LOG_VERB, "Subscriber estimate is %"SCNu32", switching from %d/%d to %d/%d (%s)\n",
+		s->bwe, current, temporal, target, target_temporal, simulcast ? "simulcast" : "SVC");
+	s->bwe_latest = now;
+	if(simulcast) {
+		s->substream_target = target;
+		s->templayer_target = target_temporal;
+	} else {
+		s->target_spatial_layer = target;
+		s->target_temporal_layer = target_temporal;
+	}
+	/* Other substreams, or higher spatial layers, need a keyframe to be decoded */
+	if(target != current && (simulcast || target > current))
+		janus_videoroom_reqfir_subscriber(p, "Automatic layer change");
 }
 
 /* Error codes */
@@ -1598,12 +2494,13 @@ static void janus_videoroom_reqfir(janus_videoroom_publisher *publisher, const c
 #define JANUS_VIDEOROOM_ERROR_NOT_PUBLISHED		435
 #define JANUS_VIDEOROOM_ERROR_ID_EXISTS			436
 #define JANUS_VIDEOROOM_ERROR_INVALID_SDP		437
+#define JANUS_VIDEOROOM_ERROR_OVERLOADED		438
 
 
 static guint32 janus_videoroom_rtp_forwarder_add_helper(janus_videoroom_publisher *p,
 		const gchar *host, int port, int pt, uint32_t ssrc,
 		int srtp_suite, const char *srtp_crypto,
-		int substream, gboolean is_video, gboolean is_data) {
+		int substream, gboolean is_video, gboolean is_data, gboolean feedback) {
 	if(!p || !host) {
 		return 0;
 	}
@@ -1677,6 +2574,12 @@ static guint32 janus_videoroom_rtp_forwarder_add_helper(janus_videoroom_publishe
 	forward->ssrc = ssrc;
 	forward->substream = substream;
 	forward->is_data = is_data;
+	if(feedback && is_video && !forward->is_srtp) {
+		/* The recipient will send keyframe requests and NACKs to our socket */
+		forward->feedback = TRUE;
+		forward->buffer = g_malloc0(JANUS_VIDEOROOM_FORWARDER_BUFFER * sizeof(janus_videoroom_rtp_forwarder_packet));
+		p->forwarders_feedback = TRUE;
+	}
 	forward->serv_addr.sin_family = AF_INET;
 	inet_pton(AF_INET, host, &(forward->serv_addr.sin_addr));
 	forward->serv_addr.sin_port = htons(port);
@@ -1700,12 +2603,114 @@ static void janus_videoroom_rtp_forwarder_free_helper(gpointer data) {
 				if(forward->srtp_ctx->count == 0 && forward->srtp_ctx->contexts != NULL)
 					g_hash_table_remove(forward->srtp_ctx->contexts, forward->srtp_ctx->id);
 			}
+			g_free(forward->buffer);
 			g_free(forward);
 			forward = NULL;
 		}
 	}
 }
 
+/* Forwarders batching (rtp_forwarders_mutex must be locked) */
+static void janus_videoroom_forwarder_batch_flush(janus_videoroom_publisher *p, janus_videoroom_forwarder_batch *batch) {
+	if(batch->count == 0)
+		return;
+	int i = 0, done = 0;
+	for(i=0; i<batch->count; i++) {
+		janus_videoroom_rtp_forwarder *forward = batch->forwarders[i];
+#ifdef HAVE_SENDMMSG
+		struct msghdr *msg = &batch->msgs[i].msg_hdr;
+#else
+		struct msghdr *msg = &batch->msgs[i];
+#endif
+		memset(msg, 0, sizeof(*msg));
+		msg->msg_name = &forward->serv_addr;
+		msg->msg_namelen = sizeof(forward->serv_addr);
+		msg->msg_iov = batch->iovs[i];
+		msg->msg_iovlen = batch->iovs[i][1].iov_len > 0 ? 2 : 1;
+	}
+	while(done < batch->count && p->udp_sock > 0) {
+#ifdef HAVE_SENDMMSG
+		int res = sendmmsg(p->udp_sock, &batch->msgs[done], batch->count-done, 0);
+#else
+		int res = sendmsg(p->udp_sock, &batch->msgs[done], 0) < 0 ? -1 : 1;
+#endif
+		if(res > 0) {
+			done += res;
+			continue;
+		}
+		if(res < 0 && errno == EINTR)
+			continue;
+		/* Whatever the recipient of this packet, skip it and go on with the others */
+		batch->forwarders[done]->send_errors++;
+		done++;
+	}
+	batch->count = 0;
+}
+
+static void janus_videoroom_forwarder_batch_add(janus_videoroom_publisher *p, janus_videoroom_forwarder_batch *batch,
+		janus_videoroom_rtp_forwarder *forward, char *buf, int len, char *header) {
+	if(batch->count == JANUS_VIDEOROOM_FORWARDER_BATCH)
+		janus_videoroom_forwarder_batch_flush(p, batch);
+	int i = batch->count;
+	batch->forwarders[i] = forward;
+	if(header != NULL && len > 12) {
+		memcpy(batch->headers[i], header, 12);
+		batch->iovs[i][0].iov_base = batch->headers[i];
+		batch->iovs[i][0].iov_len = 12;
+		batch->iovs[i][1].iov_base = buf+12;
+		batch->iovs[i][1].iov_len = len-12;
+	} else {
+		batch->iovs[i][0].iov_base = buf;
+		batch->iovs[i][0].iov_len = len;
+		batch->iovs[i][1].iov_base = NULL;
+		batch->iovs[i][1].iov_len = 0;
+	}
+	batch->count++;
+}
+
+/* Handle keyframe requests and NACKs recipients of forwarders sent to our socket (rtp_forwarders_mutex must be locked) */
+static void janus_videoroom_rtp_forwarder_feedback(janus_videoroom_publisher *p) {
+	char buf[1500];
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+	janus_rtcp_summary summary;
+	gboolean keyframe = FALSE;
+	int len = 0;
+	while((len = recvfrom(p->udp_sock, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&addr, &addrlen)) > 0) {
+		addrlen = sizeof(addr);
+		if(janus_rtcp_summarize(buf, len, &summary) < 0)
+			continue;
+		/* Recipients send feedback from the port we forward to, use that to find the forwarder */
+		janus_videoroom_rtp_forwarder *forward = NULL;
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, p->rtp_forwarders);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_videoroom_rtp_forwarder *f = (janus_videoroom_rtp_forwarder *)value;
+			if(f->feedback && f->serv_addr.sin_addr.s_addr == addr.sin_addr.s_addr &&
+					f->serv_addr.sin_port == addr.sin_port) {
+				forward = f;
+				break;
+			}
+		}
+		if(forward == NULL)
+			continue;
+		if(summary.has_pli || summary.has_fir)
+			keyframe = TRUE;
+		int i = 0;
+		for(i=0; i<summary.nacks_count; i++) {
+			janus_videoroom_rtp_forwarder_packet *pkt = &forward->buffer[summary.nacks[i] % JANUS_VIDEOROOM_FORWARDER_BUFFER];
+			if(pkt->length == 0 || pkt->seq != summary.nacks[i])
+				continue;
+			JANUS_LOG(LOG_HUGE, "Retransmitting packet %"SCNu16" of %s to a remote recipient\n", pkt->seq, p->display ? p->display : "??");
+			if(sendto(p->udp_sock, pkt->data, pkt->length, 0, (struct sockaddr*)&forward->serv_addr, sizeof(forward->serv_addr)) < 0)
+				forward->send_errors++;
+		}
+	}
+	if(keyframe)
+		janus_videoroom_reqfir(p, "Remote recipient");
+}
+
 static void janus_videoroom_srtp_context_free_helper(gpointer data) {
 	if(data) {
 		janus_videoroom_srtp_context *srtp_ctx = (janus_videoroom_srtp_context *)data;
@@ -1731,6 +2736,8 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 		return -1;
 	}
 
+	videoroom_memory = janus_memory_account_create(JANUS_VIDEOROOM_PACKAGE, NULL);
+
 	/* Read configuration */
 	char filename[255];
 	g_snprintf(filename, 255, "%s/%s.cfg", config_path, JANUS_VIDEOROOM_PACKAGE);
@@ -1761,6 +2768,23 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 		if(!notify_events && callback->events_is_enabled()) {
 			JANUS_LOG(LOG_WARN, "Notification of events to handlers disabled for %s\n", JANUS_VIDEOROOM_NAME);
 		}
+		/* Should we fan out packets to subscribers in parallel, in large rooms? */
+		janus_config_item *workers = janus_config_get_item_drilldown(config, "general", "fanout_workers");
+		if(workers != NULL && workers->value != NULL && atoi(workers->value) > 0) {
+			fanout_workers_count = atoi(workers->value);
+			if(fanout_workers_count > JANUS_VIDEOROOM_FANOUT_MAX_WORKERS) {
+				JANUS_LOG(LOG_WARN, "Too many fan-out workers (%u), using %d\n", fanout_workers_count, JANUS_VIDEOROOM_FANOUT_MAX_WORKERS);
+				fanout_workers_count = JANUS_VIDEOROOM_FANOUT_MAX_WORKERS;
+			}
+			fanout_threshold = 200;
+			janus_config_item *threshold = janus_config_get_item_drilldown(config, "general", "fanout_threshold");
+			if(threshold != NULL && threshold->value != NULL && atoi(threshold->value) >= 0)
+				fanout_threshold = atoi(threshold->value);
+		}
+		/* Should we keep the packets since the latest keyframe, to send them to new subscribers? */
+		janus_config_item *kfcache = janus_config_get_item_drilldown(config, "general", "keyframe_cache");
+		if(kfcache != NULL && kfcache->value != NULL && atoi(kfcache->value) > 0)
+			keyframe_cache_packets = atoi(kfcache->value);
 		/* Iterate on all rooms */
 		GList *cl = janus_config_get_categories(config);
 		while(cl != NULL) {
@@ -1789,6 +2813,9 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 			janus_config_item *playoutdelay_ext = janus_config_get_item(cat, "playoutdelay_ext");
 			janus_config_item *transport_wide_cc_ext = janus_config_get_item(cat, "transport_wide_cc_ext");
 			janus_config_item *notify_joining = janus_config_get_item(cat, "notify_joining");
+			janus_config_item *fanout = janus_config_get_item(cat, "fanout_threshold");
+			janus_config_item *kfwindow = janus_config_get_item(cat, "keyframe_window");
+			janus_config_item *memcap = janus_config_get_item(cat, "memory_cap");
 			janus_config_item *record = janus_config_get_item(cat, "record");
 			janus_config_item *rec_dir = janus_config_get_item(cat, "rec_dir");
 			/* Create the video room */
@@ -1920,6 +2947,16 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 			videoroom->notify_joining = FALSE;
 			if(notify_joining != NULL && notify_joining->value != NULL)
 				videoroom->notify_joining = janus_is_true(notify_joining->value);
+			videoroom->fanout_threshold = fanout_threshold;
+			if(fanout != NULL && fanout->value != NULL && atoi(fanout->value) >= 0)
+				videoroom->fanout_threshold = atoi(fanout->value);
+			videoroom->keyframe_window = 0;
+			if(kfwindow != NULL && kfwindow->value != NULL && atoi(kfwindow->value) > 0)
+				videoroom->keyframe_window = atoi(kfwindow->value);
+			videoroom->memory_cap = 0;
+			if(memcap != NULL && memcap->value != NULL && g_ascii_strtoll(memcap->value, NULL, 10) > 0)
+				videoroom->memory_cap = g_ascii_strtoll(memcap->value, NULL, 10);
+			janus_videoroom_room_memory_init(videoroom);
 			g_atomic_int_set(&videoroom->destroyed, 0);
 			janus_mutex_init(&videoroom->mutex);
 			janus_refcount_init(&videoroom->ref, janus_videoroom_room_free);
@@ -1975,6 +3012,46 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 		janus_config_destroy(config);
 		return -1;
 	}
+	metric_rooms = janus_metric_register_callback("janus_videoroom_rooms", NULL,
+		"VideoRoom rooms", janus_metric_gauge, janus_videoroom_rooms_metric, NULL);
+	metric_publishers = janus_metric_register_callback("janus_videoroom_publishers", NULL,
+		"VideoRoom participants currently publishing", janus_metric_gauge, janus_videoroom_publishers_metric, NULL);
+	const char *modes[2] = { "mode=\"inline\"", "mode=\"parallel\"" };
+	int m = 0;
+	for(m=0; m<2; m++) {
+		metric_fanout_packets[m] = janus_metric_register("janus_videoroom_fanout_packets_total", modes[m],
+			"RTP packets relayed by VideoRoom publishers to their subscribers", janus_metric_counter);
+		metric_fanout_time[m] = janus_metric_register("janus_videoroom_fanout_time_us_total", modes[m],
+			"Time spent relaying RTP packets from VideoRoom publishers to all their subscribers, in microseconds", janus_metric_counter);
+	}
+	metric_keyframe_requests[0] = janus_metric_register("janus_videoroom_keyframe_requests_total", "result=\"forwarded\"",
+		"Keyframe requests caused by VideoRoom subscribers", janus_metric_counter);
+	metric_keyframe_requests[1] = janus_metric_register("janus_videoroom_keyframe_requests_total", "result=\"suppressed\"",
+		"Keyframe requests caused by VideoRoom subscribers", janus_metric_counter);
+	/* Launch the fan-out workers, if needed */
+	guint w = 0;
+	for(w=0; w<fanout_workers_count; w++) {
+		janus_videoroom_fanout_worker *worker = g_malloc0(sizeof(janus_videoroom_fanout_worker));
+		worker->id = w;
+		worker->queue = g_async_queue_new();
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "vroom fanout %u", w);
+		worker->thread = g_thread_try_new(tname, janus_videoroom_fanout_thread, worker, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch a VideoRoom fan-out worker, parallel fan-out disabled\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			error = NULL;
+			g_async_queue_unref(worker->queue);
+			g_free(worker);
+			break;
+		}
+		fanout_workers[w] = worker;
+	}
+	fanout_workers_count = w;
+	if(fanout_workers_count > 0)
+		JANUS_LOG(LOG_INFO, "Parallel fan-out enabled, %u workers (rooms with at least %u subscribers by default)\n",
+			fanout_workers_count, fanout_threshold);
 	JANUS_LOG(LOG_INFO, "%s initialized!\n", JANUS_VIDEOROOM_NAME);
 	return 0;
 }
@@ -1983,12 +3060,34 @@ void janus_videoroom_destroy(void) {
 	if(!g_atomic_int_get(&initialized))
 		return;
 	g_atomic_int_set(&stopping, 1);
+	janus_metric_unregister(metric_rooms);
+	metric_rooms = NULL;
+	janus_metric_unregister(metric_publishers);
+	metric_publishers = NULL;
 
 	g_async_queue_push(messages, &exit_message);
 	if(handler_thread != NULL) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+	guint w = 0;
+	for(w=0; w<fanout_workers_count; w++) {
+		g_async_queue_push(fanout_workers[w]->queue, &fanout_exit_job);
+		g_thread_join(fanout_workers[w]->thread);
+		g_async_queue_unref(fanout_workers[w]->queue);
+		g_free(fanout_workers[w]);
+		fanout_workers[w] = NULL;
+	}
+	fanout_workers_count = 0;
+	int m = 0;
+	for(m=0; m<2; m++) {
+		janus_metric_unregister(metric_fanout_packets[m]);
+		metric_fanout_packets[m] = NULL;
+		janus_metric_unregister(metric_fanout_time[m]);
+		metric_fanout_time[m] = NULL;
+		janus_metric_unregister(metric_keyframe_requests[m]);
+		metric_keyframe_requests[m] = NULL;
+	}
 
 	/* FIXME We should destroy the sessions cleanly */
 	janus_mutex_lock(&sessions_mutex);
@@ -2004,6 +3103,8 @@ void janus_videoroom_destroy(void) {
 
 	janus_config_destroy(config);
 	g_free(admin_key);
+	janus_memory_account_destroy(videoroom_memory);
+	videoroom_memory = NULL;
 
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
@@ -2124,6 +3225,138 @@ static void janus_videoroom_participant_joining(janus_videoroom_publisher *p) {
 	}
 }
 
+/* Add a subscriber to a publisher, or remove it (subscribers_mutex must be locked) */
+static void janus_videoroom_publisher_add_subscriber(janus_videoroom_publisher *publisher, janus_videoroom_subscriber *subscriber) {
+	publisher->subscribers = g_slist_append(publisher->subscribers, subscriber);
+	publisher->subscribers_count++;
+}
+static gboolean janus_videoroom_publisher_remove_subscriber(janus_videoroom_publisher *publisher, janus_videoroom_subscriber *subscriber) {
+	GSList *link = g_slist_find(publisher->subscribers, subscriber);
+	if(link == NULL)
+		return FALSE;
+	publisher->subscribers = g_slist_delete_link(publisher->subscribers, link);
+	publisher->subscribers_count--;
+	return TRUE;
+}
+
+/* Move a subscriber to a different publisher: the caller must have increased the
+ * references to the publisher and its session, which are passed to the subscriber */
+static void janus_videoroom_subscriber_switch(janus_videoroom_subscriber *subscriber, janus_videoroom_publisher *publisher) {
+	gboolean paused = subscriber->paused;
+	subscriber->paused = TRUE;
+	/* Unsubscribe from the previous publisher, unless it got rid of us already */
+	janus_videoroom_publisher *prev_feed = subscriber->feed;
+	if(prev_feed) {
+		janus_mutex_lock(&prev_feed->subscribers_mutex);
+		gboolean found = janus_videoroom_publisher_remove_subscriber(prev_feed, subscriber);
+		janus_mutex_unlock(&prev_feed->subscribers_mutex);
+		if(found) {
+			janus_refcount_decrease(&prev_feed->session->ref);
+			g_clear_pointer(&subscriber->feed, janus_videoroom_publisher_dereference);
+		} else {
+			prev_feed = NULL;
+		}
+	}
+	if(prev_feed == NULL)
+		janus_refcount_increase(&subscriber->ref);	/* The publisher references the subscriber */
+	/* Subscribe to the new one */
+	if(!publisher->audio)
+		subscriber->audio = FALSE;	/* ... unless the publisher isn't sending any audio */
+	if(!publisher->video)
+		subscriber->video = FALSE;	/* ... unless the publisher isn't sending any video */
+	if(!publisher->data)
+		subscriber->data = FALSE;	/* ... unless the publisher isn't sending any data */
+	if(subscriber->room && subscriber->room->do_svc) {
+		/* This subscriber belongs to a room where VP9 SVC has been enabled,
+		 * let's assume we're interested in all layers for the time being */
+		subscriber->spatial_layer = -1;
+		subscriber->target_spatial_layer = 1;		/* FIXME Chrome sends 0 and 1 */
+		subscriber->temporal_layer = -1;
+		subscriber->target_temporal_layer = 2;	/* FIXME Chrome sends 0, 1 and 2 */
+	}
+	janus_mutex_lock(&publisher->subscribers_mutex);
+	janus_videoroom_publisher_add_subscriber(publisher, subscriber);
+	janus_mutex_unlock(&publisher->subscribers_mutex);
+	subscriber->feed = publisher;
+	subscriber->paused = paused;
+	/* Start from the cached keyframe, if any, or send a FIR to the new publisher */
+	if(!janus_videoroom_gop_replay(subscriber))
+		janus_videoroom_reqfir_subscriber(publisher, "Switching existing subscriber to new publisher");
+	/* Also notify event handlers */
+	if(notify_events && gateway->events_is_enabled()) {
+		json_t *info = json_object();
+		json_object_set_new(info, "event", json_string("switched"));
+		json_object_set_new(info, "room", json_integer(publisher->room_id));
+		json_object_set_new(info, "feed", json_integer(publisher->user_id));
+		if(subscriber->speaker >= 0)
+			json_object_set_new(info, "speaker", json_integer(subscriber->speaker));
+		gateway->notify_event(&janus_videoroom_plugin, subscriber->session->handle, info);
+	}
+}
+
+/* Active speakers: room->mutex has to be locked for all these helpers */
+static janus_videoroom_publisher *janus_videoroom_speakers_pick(janus_videoroom *room, int rank,
+		guint32 pvt_id, janus_videoroom_subscriber *subscriber) {
+	GList *l = room->speakers;
+	while(l) {
+		janus_videoroom_publisher *p = g_hash_table_lookup(room->participants, (guint64 *)l->data);
+		l = l->next;
+		if(p == NULL || g_atomic_int_get(&p->destroyed) || p->kicked || p->sdp == NULL || p->session == NULL)
+			continue;
+		/* Subscriptions never follow the participant they belong to */
+		if(pvt_id > 0 && p->pvt_id == pvt_id)
+			continue;
+		/* Switching only works if the codecs are the same as those we negotiated */
+		if(subscriber && (p->acodec != subscriber->speaker_acodec || p->vcodec != subscriber->speaker_vcodec))
+			continue;
+		if(rank == 0)
+			return p;
+		rank--;
+	}
+	return NULL;
+}
+
+static void janus_videoroom_speakers_remove(janus_videoroom *room, guint64 user_id) {
+	GList *l = room->speakers;
+	while(l) {
+		if(*(guint64 *)l->data == user_id) {
+			g_free(l->data);
+			room->speakers = g_list_delete_link(room->speakers, l);
+			return;
+		}
+		l = l->next;
+	}
+}
+
+static void janus_videoroom_speakers_update(janus_videoroom *room) {
+	if(g_atomic_int_get(&room->destroyed))
+		return;
+	GSList *l = room->speaker_subscribers;
+	while(l) {
+		janus_videoroom_subscriber *s = (janus_videoroom_subscriber *)l->data;
+		l = l->next;
+		if(g_atomic_int_get(&s->destroyed) || s->session == NULL)
+			continue;
+		janus_videoroom_publisher *p = janus_videoroom_speakers_pick(room, s->speaker, s->pvt_id, s);
+		if(p == NULL || p == s->feed)
+			continue;
+		JANUS_LOG(LOG_VERB, "Switching speaker subscriber (rank %d) to %"SCNu64"\n", s->speaker, p->user_id);
+		janus_refcount_increase(&p->ref);
+		janus_refcount_increase(&p->session->ref);
+		janus_videoroom_subscriber_switch(s, p);
+		json_t *event = json_object();
+		json_object_set_new(event, "videoroom", json_string("event"));
+		json_object_set_new(event, "switched", json_string("ok"));
+		json_object_set_new(event, "room", json_integer(room->room_id));
+		json_object_set_new(event, "id", json_integer(p->user_id));
+		if(p->display)
+			json_object_set_new(event, "display", json_string(p->display));
+		json_object_set_new(event, "speaker", json_integer(s->speaker));
+		gateway->push_event(s->session->handle, &janus_videoroom_plugin, NULL, event, NULL);
+		json_decref(event);
+	}
+}
+
 static void janus_videoroom_leave_or_unpublish(janus_videoroom_publisher *participant, gboolean is_leaving, gboolean kicked) {
 	/* we need to check if the room still exists, may have been destroyed already */
 	if(participant->room == NULL)
@@ -2144,10 +3377,13 @@ static void janus_videoroom_leave_or_unpublish(janus_videoroom_publisher *partic
 		json_integer(participant->user_id));
 	janus_mutex_lock(&participant->room->mutex);
 	janus_videoroom_notify_participants(participant, event);
+	/* Whoever was following this publisher as a speaker needs somebody else */
+	janus_videoroom_speakers_remove(participant->room, participant->user_id);
 	if(is_leaving) {
 		g_hash_table_remove(participant->room->participants, &participant->user_id);
 		g_hash_table_remove(participant->room->private_ids, GUINT_TO_POINTER(participant->pvt_id));
 	}
+	janus_videoroom_speakers_update(participant->room);
 	janus_mutex_unlock(&participant->room->mutex);
 	json_decref(event);
 }
@@ -2234,7 +3470,7 @@ json_t *janus_videoroom_query_session(janus_plugin_session *handle) {
 				if(participant->display)
 					json_object_set_new(info, "display", json_string(participant->display));
 				if(participant->subscribers)
-					json_object_set_new(info, "viewers", json_integer(g_slist_length(participant->subscribers)));
+					json_object_set_new(info, "viewers", json_integer(participant->subscribers_count));
 				json_t *media = json_object();
 				json_object_set_new(media, "audio", participant->audio ? json_true() : json_false());
 				if(participant->audio)
@@ -2245,6 +3481,11 @@ json_t *janus_videoroom_query_session(janus_plugin_session *handle) {
 				json_object_set_new(media, "data", participant->data ? json_true() : json_false());
 				json_object_set_new(info, "media", media);
 				json_object_set_new(info, "bitrate", json_integer(participant->bitrate));
+				if(participant->keyframe_suppressed > 0)
+					json_object_set_new(info, "keyframe-requests-suppressed", json_integer(participant->keyframe_suppressed));
+				json_t *memory = janus_memory_account_info(participant->memory);
+				if(memory != NULL)
+					json_object_set_new(info, "memory", memory);
 				if(participant->ssrc[0] != 0)
 					json_object_set_new(info, "simulcast", json_true());
 				if(participant->arc || participant->vrc || participant->drc) {
@@ -2253,6 +3494,15 @@ json_t *janus_videoroom_query_session(janus_plugin_session *handle) {
 						json_object_set_new(recording, "audio", json_string(participant->arc->filename));
 					if(participant->vrc && participant->vrc->filename)
 						json_object_set_new(recording, "video", json_string(participant->vrc->filename));
+					if(participant->vrc_sc[0] || participant->vrc_sc[1]) {
+						json_t *substreams = json_array();
+						int i = 0;
+						for(i=0; i<2; i++) {
+							if(participant->vrc_sc[i] && participant->vrc_sc[i]->filename)
+								json_array_append_new(substreams, json_string(participant->vrc_sc[i]->filename));
+						}
+						json_object_set_new(recording, "video_substreams", substreams);
+					}
 					if(participant->drc && participant->drc->filename)
 						json_object_set_new(recording, "data", json_string(participant->drc->filename));
 					json_object_set_new(info, "recording", recording);
@@ -2291,6 +3541,12 @@ json_t *janus_videoroom_query_session(janus_plugin_session *handle) {
 					json_object_set_new(info, "temporal-layer-target", json_integer(participant->templayer_target));
 				}
 				json_object_set_new(info, "media", media);
+				if(participant->speaker >= 0)
+					json_object_set_new(info, "speaker", json_integer(participant->speaker));
+				if(participant->auto_layers) {
+					json_object_set_new(info, "auto-layers", json_true());
+					json_object_set_new(info, "bwe", json_integer(participant->bwe));
+				}
 				if(participant->room && participant->room->do_svc) {
 					json_t *svc = json_object();
 					json_object_set_new(svc, "spatial-layer", json_integer(participant->spatial_layer));
@@ -2357,30 +3613,402 @@ static int janus_videoroom_access_room(json_t *root, gboolean check_modify, gboo
 	return 0;
 }
 
-struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session *handle, char *transaction, json_t *message, json_t *jsep) {
-	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
-		return janus_plugin_result_new(JANUS_PLUGIN_ERROR, g_atomic_int_get(&stopping) ? "Shutting down" : "Plugin not initialized", NULL);
-
-	/* Pre-parse the message */
+/* Helper to create a new room out of a "create" request: the room is added to
+ * the configuration too, if it's permanent, but the file is not saved yet */
+static int janus_videoroom_create_room(json_t *root, guint64 *created, gboolean *saved, char *error_cause, int error_cause_size) {
 	int error_code = 0;
-	char error_cause[512];
-	json_t *root = message;
-	json_t *response = NULL;
-
-	janus_mutex_lock(&sessions_mutex);
-	janus_videoroom_session *session = janus_videoroom_lookup_session(handle);
-	if(!session) {
-		JANUS_LOG(LOG_ERR, "No session associated with this handle...\n");
-		error_code = JANUS_VIDEOROOM_ERROR_UNKNOWN_ERROR;
-		g_snprintf(error_cause, 512, "%s", "session associated with this handle...");
-		goto plugin_response;
+	char error_cause2[512];
+	JANUS_VALIDATE_JSON_OBJECT(root, create_parameters,
+		error_code, error_cause2, TRUE,
+		JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+	if(error_code != 0) {
+		g_strlcpy(error_cause, error_cause2, error_cause_size);
+		return error_code;
 	}
-	/* Increase the reference counter for this session: we'll decrease it after we handle the message */
-	janus_refcount_increase(&session->ref);
-	janus_mutex_unlock(&sessions_mutex);
-	if(g_atomic_int_get(&session->destroyed)) {
-		JANUS_LOG(LOG_ERR, "Session has already been marked as destroyed...\n");
-		error_code = JANUS_VIDEOROOM_ERROR_UNKNOWN_ERROR;
+	json_t *desc = json_object_get(root, "description");
+	json_t *is_private = json_object_get(root, "is_private");
+	json_t *req_pvtid = json_object_get(root, "require_pvtid");
+	json_t *secret = json_object_get(root, "secret");
+	json_t *pin = json_object_get(root, "pin");
+	json_t *bitrate = json_object_get(root, "bitrate");
+	json_t *fir_freq = json_object_get(root, "fir_freq");
+	json_t *publishers = json_object_get(root, "publishers");
+	json_t *allowed = json_object_get(root, "allowed");
+	json_t *audiocodec = json_object_get(root, "audiocodec");
+	if(audiocodec) {
+		const char *audiocodec_value = json_string_value(audiocodec);
+		gchar **list = g_strsplit(audiocodec_value, ",", 4);
+		gchar *codec = list[0];
+		if(codec != NULL) {
+			int i=0;
+			while(codec != NULL) {
+				if(i == 3) {
+					break;
+				}
+				if(strlen(codec) == 0 || JANUS_AUDIOCODEC_NONE == janus_audiocodec_from_name(codec)) {
+					JANUS_LOG(LOG_ERR, "Invalid element (audiocodec can only be or contain opus, isac32, isac16, pcmu, pcma or g722)\n");
+					error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+					g_snprintf(error_cause, error_cause_size, "Invalid element (audiocodec can only be or contain opus, isac32, isac16, pcmu, pcma or g722)");
+					return error_code;
+				}
+				i++;
+				codec = list[i];
+			}
+		}
+		g_clear_pointer(&list, g_strfreev);
+	}
+	json_t *videocodec = json_object_get(root, "videocodec");
+	if(videocodec) {
+		const char *videocodec_value = json_string_value(videocodec);
+		gchar **list = g_strsplit(videocodec_value, ",", 4);
+		gchar *codec = list[0];
+		if(codec != NULL) {
+			int i=0;
+			while(codec != NULL) {
+				if(i == 3) {
+					break;
+				}
+				if(strlen(codec) == 0 || JANUS_VIDEOCODEC_NONE == janus_videocodec_from_name(codec)) {
+					JANUS_LOG(LOG_ERR, "Invalid element (videocodec can only be or contain vp8, vp9 or h264)\n");
+					error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+					g_snprintf(error_cause, error_cause_size, "Invalid element (videocodec can only be or contain vp8, vp9 or h264)");
+					return error_code;
+				}
+				i++;
+				codec = list[i];
+			}
+		}
+		g_clear_pointer(&list, g_strfreev);
+	}
+	json_t *svc = json_object_get(root, "video_svc");
+	json_t *audiolevel_ext = json_object_get(root, "audiolevel_ext");
+	json_t *audiolevel_event = json_object_get(root, "audiolevel_event");
+	json_t *audio_active_packets = json_object_get(root, "audio_active_packets");
+	json_t *audio_level_average = json_object_get(root, "audio_level_average");
+	json_t *videoorient_ext = json_object_get(root, "videoorient_ext");
+	json_t *playoutdelay_ext = json_object_get(root, "playoutdelay_ext");
+	json_t *transport_wide_cc_ext = json_object_get(root, "transport_wide_cc_ext");
+	json_t *notify_joining = json_object_get(root, "notify_joining");
+	json_t *fanout = json_object_get(root, "fanout_threshold");
+	json_t *kfwindow = json_object_get(root, "keyframe_window");
+	json_t *memcap = json_object_get(root, "memory_cap");
+	json_t *record = json_object_get(root, "record");
+	json_t *rec_dir = json_object_get(root, "rec_dir");
+	json_t *permanent = json_object_get(root, "permanent");
+	if(allowed) {
+		/* Make sure the "allowed" array only contains strings */
+		gboolean ok = TRUE;
+		if(json_array_size(allowed) > 0) {
+			size_t i = 0;
+			for(i=0; i<json_array_size(allowed); i++) {
+				json_t *a = json_array_get(allowed, i);
+				if(!a || !json_is_string(a)) {
+					ok = FALSE;
+					break;
+				}
+			}
+		}
+		if(!ok) {
+			JANUS_LOG(LOG_ERR, "Invalid element in the allowed array (not a string)\n");
+			error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+			g_snprintf(error_cause, error_cause_size, "Invalid element in the allowed array (not a string)");
+			return error_code;
+		}
+	}
+	gboolean save = permanent ? json_is_true(permanent) : FALSE;
+	if(save && config == NULL) {
+		JANUS_LOG(LOG_ERR, "No configuration file, can't create permanent room\n");
+		error_code = JANUS_VIDEOROOM_ERROR_UNKNOWN_ERROR;
+		g_snprintf(error_cause, error_cause_size, "No configuration file, can't create permanent room");
+		return error_code;
+	}
+	guint64 room_id = 0;
+	json_t *room = json_object_get(root, "room");
+	if(room) {
+		room_id = json_integer_value(room);
+		if(room_id == 0) {
+			JANUS_LOG(LOG_WARN, "Desired room ID is 0, which is not allowed... picking random ID instead\n");
+		}
+	}
+	janus_mutex_lock(&rooms_mutex);
+	if(room_id > 0) {
+		/* Let's make sure the room doesn't exist already */
+		if(g_hash_table_lookup(rooms, &room_id) != NULL) {
+			/* It does... */
+			janus_mutex_unlock(&rooms_mutex);
+			JANUS_LOG(LOG_ERR, "Room %"SCNu64" already exists!\n", room_id);
+			error_code = JANUS_VIDEOROOM_ERROR_ROOM_EXISTS;
+			g_snprintf(error_cause, error_cause_size, "Room %"SCNu64" already exists", room_id);
+			return error_code;
+		}
+	}
+	/* Create the room */
+	janus_videoroom *videoroom = g_malloc0(sizeof(janus_videoroom));
+	/* Generate a random ID */
+	if(room_id == 0) {
+		while(room_id == 0) {
+			room_id = janus_random_uint64();
+			if(g_hash_table_lookup(rooms, &room_id) != NULL) {
+				/* Room ID already taken, try another one */
+				room_id = 0;
+			}
+		}
+	}
+	videoroom->room_id = room_id;
+	char *description = NULL;
+	if(desc != NULL && strlen(json_string_value(desc)) > 0) {
+		description = g_strdup(json_string_value(desc));
+	} else {
+		char roomname[255];
+		g_snprintf(roomname, 255, "Room %"SCNu64"", videoroom->room_id);
+		description = g_strdup(roomname);
+	}
+	videoroom->room_name = description;
+	videoroom->is_private = is_private ? json_is_true(is_private) : FALSE;
+	videoroom->require_pvtid = req_pvtid ? json_is_true(req_pvtid) : FALSE;
+	if(secret)
+		videoroom->room_secret = g_strdup(json_string_value(secret));
+	if(pin)
+		videoroom->room_pin = g_strdup(json_string_value(pin));
+	videoroom->max_publishers = 3;	/* FIXME How should we choose a default? */
+	if(publishers)
+		videoroom->max_publishers = json_integer_value(publishers);
+	if(videoroom->max_publishers < 0)
+		videoroom->max_publishers = 3;	/* FIXME How should we choose a default? */
+	videoroom->bitrate = 0;
+	if(bitrate)
+		videoroom->bitrate = json_integer_value(bitrate);
+	if(videoroom->bitrate > 0 && videoroom->bitrate < 64000)
+		videoroom->bitrate = 64000;	/* Don't go below 64k */
+	videoroom->fir_freq = 0;
+	if(fir_freq)
+		videoroom->fir_freq = json_integer_value(fir_freq);
+	/* By default, we force Opus as the only audio codec */
+	videoroom->acodec[0] = JANUS_AUDIOCODEC_OPUS;
+	videoroom->acodec[1] = JANUS_AUDIOCODEC_NONE;
+	videoroom->acodec[2] = JANUS_AUDIOCODEC_NONE;
+	/* Check if we're forcing a different single codec, or allowing more than one */
+	if(audiocodec) {
+		const char *audiocodec_value = json_string_value(audiocodec);
+		gchar **list = g_strsplit(audiocodec_value, ",", 4);
+		gchar *codec = list[0];
+		if(codec != NULL) {
+			int i=0;
+			while(codec != NULL) {
+				if(i == 3) {
+					JANUS_LOG(LOG_WARN, "Ignoring extra audio codecs: %s\n", codec);
+					break;
+				}
+				if(strlen(codec) > 0)
+					videoroom->acodec[i] = janus_audiocodec_from_name(codec);
+				i++;
+				codec = list[i];
+			}
+		}
+		g_clear_pointer(&list, g_strfreev);
+	}
+	/* By default, we force VP8 as the only video codec */
+	videoroom->vcodec[0] = JANUS_VIDEOCODEC_VP8;
+	videoroom->vcodec[1] = JANUS_VIDEOCODEC_NONE;
+	videoroom->vcodec[2] = JANUS_VIDEOCODEC_NONE;
+	/* Check if we're forcing a different single codec, or allowing more than one */
+	if(videocodec) {
+		const char *videocodec_value = json_string_value(videocodec);
+		gchar **list = g_strsplit(videocodec_value, ",", 4);
+		gchar *codec = list[0];
+		if(codec != NULL) {
+			int i=0;
+			while(codec != NULL) {
+				if(i == 3) {
+					JANUS_LOG(LOG_WARN, "Ignoring extra video codecs: %s\n", codec);
+					break;
+				}
+				if(strlen(codec) > 0)
+					videoroom->vcodec[i] = janus_videocodec_from_name(codec);
+				i++;
+				codec = list[i];
+			}
+		}
+		g_clear_pointer(&list, g_strfreev);
+	}
+	if(svc && json_is_true(svc)) {
+		if(videoroom->vcodec[0] == JANUS_VIDEOCODEC_VP9 &&
+				videoroom->vcodec[1] == JANUS_VIDEOCODEC_NONE &&
+				videoroom->vcodec[2] == JANUS_VIDEOCODEC_NONE) {
+			videoroom->do_svc = TRUE;
+		} else {
+			JANUS_LOG(LOG_WARN, "SVC is only supported, in an experimental way, for VP9 only rooms: disabling it...\n");
+		}
+	}
+	videoroom->audiolevel_ext = audiolevel_ext ? json_is_true(audiolevel_ext) : TRUE;
+	videoroom->audiolevel_event = audiolevel_event ? json_is_true(audiolevel_event) : FALSE;
+	if(videoroom->audiolevel_event) {
+		videoroom->audio_active_packets = 100;
+		if(json_integer_value(audio_active_packets) > 0) {
+			videoroom->audio_active_packets = json_integer_value(audio_active_packets);
+		} else {
+			JANUS_LOG(LOG_WARN, "Invalid audio_active_packets value provided, using default: %d\n", videoroom->audio_active_packets);
+		}
+		videoroom->audio_level_average = 25;
+		if(json_integer_value(audio_level_average) > 0) {
+			videoroom->audio_level_average = json_integer_value(audio_level_average);
+		} else {
+			JANUS_LOG(LOG_WARN, "Invalid audio_level_average value provided, using default: %d\n", videoroom->audio_level_average);
+		}
+	}
+	videoroom->videoorient_ext = videoorient_ext ? json_is_true(videoorient_ext) : TRUE;
+	videoroom->playoutdelay_ext = playoutdelay_ext ? json_is_true(playoutdelay_ext) : TRUE;
+	videoroom->transport_wide_cc_ext = transport_wide_cc_ext ? json_is_true(transport_wide_cc_ext) : FALSE;
+	/* By default, the videoroom plugin does not notify about participants simply joining the room.
+	   It only notifies when the participant actually starts publishing media. */
+	videoroom->notify_joining = notify_joining ? json_is_true(notify_joining) : FALSE;
+	videoroom->fanout_threshold = fanout ? json_integer_value(fanout) : fanout_threshold;
+	videoroom->keyframe_window = kfwindow ? json_integer_value(kfwindow) : 0;
+	videoroom->memory_cap = memcap ? json_integer_value(memcap) : 0;
+	janus_videoroom_room_memory_init(videoroom);
+	if(record) {
+		videoroom->record = json_is_true(record);
+	}
+	if(rec_dir) {
+		videoroom->rec_dir = g_strdup(json_string_value(rec_dir));
+	}
+	g_atomic_int_set(&videoroom->destroyed, 0);
+	janus_mutex_init(&videoroom->mutex);
+	janus_refcount_init(&videoroom->ref, janus_videoroom_room_free);
+	videoroom->participants = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, NULL);
+	videoroom->private_ids = g_hash_table_new(NULL, NULL);
+	videoroom->allowed = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, NULL);
+	if(allowed != NULL) {
+		/* Populate the "allowed" list as an ACL for people trying to join */
+		if(json_array_size(allowed) > 0) {
+			size_t i = 0;
+			for(i=0; i<json_array_size(allowed); i++) {
+				const char *token = json_string_value(json_array_get(allowed, i));
+				if(!g_hash_table_lookup(videoroom->allowed, token))
+					g_hash_table_insert(videoroom->allowed, g_strdup(token), GINT_TO_POINTER(TRUE));
+			}
+		}
+		videoroom->check_allowed = TRUE;
+	}
+	/* Compute a list of the supported codecs for the summary */
+	char audio_codecs[100], video_codecs[100];
+	janus_videoroom_codecstr(videoroom, audio_codecs, video_codecs, sizeof(audio_codecs), "|");
+	JANUS_LOG(LOG_VERB, "Created videoroom: %"SCNu64" (%s, %s, %s/%s codecs, secret: %s, pin: %s, pvtid: %s)\n",
+		videoroom->room_id, videoroom->room_name,
+		videoroom->is_private ? "private" : "public",
+		audio_codecs, video_codecs,
+		videoroom->room_secret ? videoroom->room_secret : "no secret",
+		videoroom->room_pin ? videoroom->room_pin : "no pin",
+		videoroom->require_pvtid ? "required" : "optional");
+	if(videoroom->record) {
+		JANUS_LOG(LOG_VERB, "  -- Room is going to be recorded in %s\n", videoroom->rec_dir ? videoroom->rec_dir : "the current folder");
+	}
+	if(save) {
+		/* This room is permanent: add it to the configuration too (it's
+		 * up to the caller to save the file, which may be done only once
+		 * when creating several rooms at the same time) */
+		JANUS_LOG(LOG_VERB, "Adding room %"SCNu64" to the config file\n", videoroom->room_id);
+		janus_mutex_lock(&config_mutex);
+		char cat[BUFSIZ], value[BUFSIZ];
+		/* The room ID is the category */
+		g_snprintf(cat, BUFSIZ, "%"SCNu64, videoroom->room_id);
+		janus_config_add_category(config, cat);
+		/* Now for the values */
+		janus_config_add_item(config, cat, "description", videoroom->room_name);
+		if(videoroom->is_private)
+			janus_config_add_item(config, cat, "is_private", "yes");
+		if(videoroom->require_pvtid)
+			janus_config_add_item(config, cat, "require_pvtid", "yes");
+		g_snprintf(value, BUFSIZ, "%"SCNu32, videoroom->bitrate);
+		janus_config_add_item(config, cat, "bitrate", value);
+		g_snprintf(value, BUFSIZ, "%d", videoroom->max_publishers);
+		janus_config_add_item(config, cat, "publishers", value);
+		if(videoroom->fir_freq) {
+			g_snprintf(value, BUFSIZ, "%"SCNu16, videoroom->fir_freq);
+			janus_config_add_item(config, cat, "fir_freq", value);
+		}
+		char video_codecs[100];
+		char audio_codecs[100];
+		janus_videoroom_codecstr(videoroom, audio_codecs, video_codecs, sizeof(audio_codecs), ",");
+		janus_config_add_item(config, cat, "audiocodec", audio_codecs);
+		janus_config_add_item(config, cat, "videocodec", video_codecs);
+		if(videoroom->do_svc)
+			janus_config_add_item(config, cat, "video_svc", "yes");
+		if(videoroom->room_secret)
+			janus_config_add_item(config, cat, "secret", videoroom->room_secret);
+		if(videoroom->room_pin)
+			janus_config_add_item(config, cat, "pin", videoroom->room_pin);
+		if(videoroom->audiolevel_ext) {
+			janus_config_add_item(config, cat, "audiolevel_ext", "yes");
+			if(videoroom->audiolevel_event)
+				janus_config_add_item(config, cat, "audiolevel_event", "yes");
+			if(videoroom->audio_active_packets > 0) {
+				g_snprintf(value, BUFSIZ, "%d", videoroom->audio_active_packets);
+				janus_config_add_item(config, cat, "audio_active_packets", value);
+			}
+			if(videoroom->audio_level_average > 0) {
+				g_snprintf(value, BUFSIZ, "%d", videoroom->audio_level_average);
+				janus_config_add_item(config, cat, "audio_level_average", value);
+			}
+		}
+		if(videoroom->videoorient_ext)
+			janus_config_add_item(config, cat, "videoorient_ext", "yes");
+		if(videoroom->playoutdelay_ext)
+			janus_config_add_item(config, cat, "playoutdelay_ext", "yes");
+		if(videoroom->transport_wide_cc_ext)
+			janus_config_add_item(config, cat, "transport_wide_cc_ext", "yes");
+		if(videoroom->notify_joining)
+			janus_config_add_item(config, cat, "notify_joining", "yes");
+		if(videoroom->fanout_threshold != fanout_threshold) {
+			g_snprintf(value, BUFSIZ, "%u", videoroom->fanout_threshold);
+			janus_config_add_item(config, cat, "fanout_threshold", value);
+		}
+		if(videoroom->keyframe_window) {
+			g_snprintf(value, BUFSIZ, "%u", videoroom->keyframe_window);
+			janus_config_add_item(config, cat, "keyframe_window", value);
+		}
+		if(videoroom->memory_cap) {
+			g_snprintf(value, BUFSIZ, "%"SCNi64, videoroom->memory_cap);
+			janus_config_add_item(config, cat, "memory_cap", value);
+		}
+		if(videoroom->record)
+			janus_config_add_item(config, cat, "record", "yes");
+		if(videoroom->rec_dir)
+			janus_config_add_item(config, cat, "rec_dir", videoroom->rec_dir);
+		janus_mutex_unlock(&config_mutex);
+	}
+
+	g_hash_table_insert(rooms, janus_uint64_dup(videoroom->room_id), videoroom);
+	*created = videoroom->room_id;
+	*saved = save;
+	janus_mutex_unlock(&rooms_mutex);
+	return 0;
+}
+
+struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session *handle, char *transaction, json_t *message, json_t *jsep) {
+	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
+		return janus_plugin_result_new(JANUS_PLUGIN_ERROR, g_atomic_int_get(&stopping) ? "Shutting down" : "Plugin not initialized", NULL);
+
+	/* Pre-parse the message */
+	int error_code = 0;
+	char error_cause[512];
+	json_t *root = message;
+	json_t *response = NULL;
+
+	janus_mutex_lock(&sessions_mutex);
+	janus_videoroom_session *session = janus_videoroom_lookup_session(handle);
+	if(!session) {
+		JANUS_LOG(LOG_ERR, "No session associated with this handle...\n");
+		error_code = JANUS_VIDEOROOM_ERROR_UNKNOWN_ERROR;
+		g_snprintf(error_cause, 512, "%s", "session associated with this handle...");
+		goto plugin_response;
+	}
+	/* Increase the reference counter for this session: we'll decrease it after we handle the message */
+	janus_refcount_increase(&session->ref);
+	janus_mutex_unlock(&sessions_mutex);
+	if(g_atomic_int_get(&session->destroyed)) {
+		JANUS_LOG(LOG_ERR, "Session has already been marked as destroyed...\n");
+		error_code = JANUS_VIDEOROOM_ERROR_UNKNOWN_ERROR;
 		g_snprintf(error_cause, 512, "%s", "Session has already been marked as destroyed...");
 		goto plugin_response;
 	}
@@ -2409,11 +4037,6 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 	if(!strcasecmp(request_text, "create")) {
 		/* Create a new videoroom */
 		JANUS_LOG(LOG_VERB, "Creating a new videoroom\n");
-		JANUS_VALIDATE_JSON_OBJECT(root, create_parameters,
-			error_code, error_cause, TRUE,
-			JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
-		if(error_code != 0)
-			goto plugin_response;
 		if(admin_key != NULL) {
 			/* An admin key was specified: make sure it was provided, and that it's valid */
 			JANUS_VALIDATE_JSON_OBJECT(root, adminkey_parameters,
@@ -2426,343 +4049,19 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 			if(error_code != 0)
 				goto plugin_response;
 		}
-		json_t *desc = json_object_get(root, "description");
-		json_t *is_private = json_object_get(root, "is_private");
-		json_t *req_pvtid = json_object_get(root, "require_pvtid");
-		json_t *secret = json_object_get(root, "secret");
-		json_t *pin = json_object_get(root, "pin");
-		json_t *bitrate = json_object_get(root, "bitrate");
-		json_t *fir_freq = json_object_get(root, "fir_freq");
-		json_t *publishers = json_object_get(root, "publishers");
-		json_t *allowed = json_object_get(root, "allowed");
-		json_t *audiocodec = json_object_get(root, "audiocodec");
-		if(audiocodec) {
-			const char *audiocodec_value = json_string_value(audiocodec);
-			gchar **list = g_strsplit(audiocodec_value, ",", 4);
-			gchar *codec = list[0];
-			if(codec != NULL) {
-				int i=0;
-				while(codec != NULL) {
-					if(i == 3) {
-						break;
-					}
-					if(strlen(codec) == 0 || JANUS_AUDIOCODEC_NONE == janus_audiocodec_from_name(codec)) {
-						JANUS_LOG(LOG_ERR, "Invalid element (audiocodec can only be or contain opus, isac32, isac16, pcmu, pcma or g722)\n");
-						error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
-						g_snprintf(error_cause, 512, "Invalid element (audiocodec can only be or contain opus, isac32, isac16, pcmu, pcma or g722)");
-						goto plugin_response;
-					}
-					i++;
-					codec = list[i];
-				}
-			}
-			g_clear_pointer(&list, g_strfreev);
-		}
-		json_t *videocodec = json_object_get(root, "videocodec");
-		if(videocodec) {
-			const char *videocodec_value = json_string_value(videocodec);
-			gchar **list = g_strsplit(videocodec_value, ",", 4);
-			gchar *codec = list[0];
-			if(codec != NULL) {
-				int i=0;
-				while(codec != NULL) {
-					if(i == 3) {
-						break;
-					}
-					if(strlen(codec) == 0 || JANUS_VIDEOCODEC_NONE == janus_videocodec_from_name(codec)) {
-						JANUS_LOG(LOG_ERR, "Invalid element (videocodec can only be or contain vp8, vp9 or h264)\n");
-						error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
-						g_snprintf(error_cause, 512, "Invalid element (videocodec can only be or contain vp8, vp9 or h264)");
-						goto plugin_response;
-					}
-					i++;
-					codec = list[i];
-				}
-			}
-			g_clear_pointer(&list, g_strfreev);
-		}
-		json_t *svc = json_object_get(root, "video_svc");
-		json_t *audiolevel_ext = json_object_get(root, "audiolevel_ext");
-		json_t *audiolevel_event = json_object_get(root, "audiolevel_event");
-		json_t *audio_active_packets = json_object_get(root, "audio_active_packets");
-		json_t *audio_level_average = json_object_get(root, "audio_level_average");
-		json_t *videoorient_ext = json_object_get(root, "videoorient_ext");
-		json_t *playoutdelay_ext = json_object_get(root, "playoutdelay_ext");
-		json_t *transport_wide_cc_ext = json_object_get(root, "transport_wide_cc_ext");
-		json_t *notify_joining = json_object_get(root, "notify_joining");
-		json_t *record = json_object_get(root, "record");
-		json_t *rec_dir = json_object_get(root, "rec_dir");
-		json_t *permanent = json_object_get(root, "permanent");
-		if(allowed) {
-			/* Make sure the "allowed" array only contains strings */
-			gboolean ok = TRUE;
-			if(json_array_size(allowed) > 0) {
-				size_t i = 0;
-				for(i=0; i<json_array_size(allowed); i++) {
-					json_t *a = json_array_get(allowed, i);
-					if(!a || !json_is_string(a)) {
-						ok = FALSE;
-						break;
-					}
-				}
-			}
-			if(!ok) {
-				JANUS_LOG(LOG_ERR, "Invalid element in the allowed array (not a string)\n");
-				error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
-				g_snprintf(error_cause, 512, "Invalid element in the allowed array (not a string)");
-				goto plugin_response;
-			}
-		}
-		gboolean save = permanent ? json_is_true(permanent) : FALSE;
-		if(save && config == NULL) {
-			JANUS_LOG(LOG_ERR, "No configuration file, can't create permanent room\n");
-			error_code = JANUS_VIDEOROOM_ERROR_UNKNOWN_ERROR;
-			g_snprintf(error_cause, 512, "No configuration file, can't create permanent room");
-			goto plugin_response;
-		}
 		guint64 room_id = 0;
-		json_t *room = json_object_get(root, "room");
-		if(room) {
-			room_id = json_integer_value(room);
-			if(room_id == 0) {
-				JANUS_LOG(LOG_WARN, "Desired room ID is 0, which is not allowed... picking random ID instead\n");
-			}
-		}
-		janus_mutex_lock(&rooms_mutex);
-		if(room_id > 0) {
-			/* Let's make sure the room doesn't exist already */
-			if(g_hash_table_lookup(rooms, &room_id) != NULL) {
-				/* It does... */
-				janus_mutex_unlock(&rooms_mutex);
-				JANUS_LOG(LOG_ERR, "Room %"SCNu64" already exists!\n", room_id);
-				error_code = JANUS_VIDEOROOM_ERROR_ROOM_EXISTS;
-				g_snprintf(error_cause, 512, "Room %"SCNu64" already exists", room_id);
-				goto plugin_response;
-			}
-		}
-		/* Create the room */
-		janus_videoroom *videoroom = g_malloc0(sizeof(janus_videoroom));
-		/* Generate a random ID */
-		if(room_id == 0) {
-			while(room_id == 0) {
-				room_id = janus_random_uint64();
-				if(g_hash_table_lookup(rooms, &room_id) != NULL) {
-					/* Room ID already taken, try another one */
-					room_id = 0;
-				}
-			}
-		}
-		videoroom->room_id = room_id;
-		char *description = NULL;
-		if(desc != NULL && strlen(json_string_value(desc)) > 0) {
-			description = g_strdup(json_string_value(desc));
-		} else {
-			char roomname[255];
-			g_snprintf(roomname, 255, "Room %"SCNu64"", videoroom->room_id);
-			description = g_strdup(roomname);
-		}
-		videoroom->room_name = description;
-		videoroom->is_private = is_private ? json_is_true(is_private) : FALSE;
-		videoroom->require_pvtid = req_pvtid ? json_is_true(req_pvtid) : FALSE;
-		if(secret)
-			videoroom->room_secret = g_strdup(json_string_value(secret));
-		if(pin)
-			videoroom->room_pin = g_strdup(json_string_value(pin));
-		videoroom->max_publishers = 3;	/* FIXME How should we choose a default? */
-		if(publishers)
-			videoroom->max_publishers = json_integer_value(publishers);
-		if(videoroom->max_publishers < 0)
-			videoroom->max_publishers = 3;	/* FIXME How should we choose a default? */
-		videoroom->bitrate = 0;
-		if(bitrate)
-			videoroom->bitrate = json_integer_value(bitrate);
-		if(videoroom->bitrate > 0 && videoroom->bitrate < 64000)
-			videoroom->bitrate = 64000;	/* Don't go below 64k */
-		videoroom->fir_freq = 0;
-		if(fir_freq)
-			videoroom->fir_freq = json_integer_value(fir_freq);
-		/* By default, we force Opus as the only audio codec */
-		videoroom->acodec[0] = JANUS_AUDIOCODEC_OPUS;
-		videoroom->acodec[1] = JANUS_AUDIOCODEC_NONE;
-		videoroom->acodec[2] = JANUS_AUDIOCODEC_NONE;
-		/* Check if we're forcing a different single codec, or allowing more than one */
-		if(audiocodec) {
-			const char *audiocodec_value = json_string_value(audiocodec);
-			gchar **list = g_strsplit(audiocodec_value, ",", 4);
-			gchar *codec = list[0];
-			if(codec != NULL) {
-				int i=0;
-				while(codec != NULL) {
-					if(i == 3) {
-						JANUS_LOG(LOG_WARN, "Ignoring extra audio codecs: %s\n", codec);
-						break;
-					}
-					if(strlen(codec) > 0)
-						videoroom->acodec[i] = janus_audiocodec_from_name(codec);
-					i++;
-					codec = list[i];
-				}
-			}
-			g_clear_pointer(&list, g_strfreev);
-		}
-		/* By default, we force VP8 as the only video codec */
-		videoroom->vcodec[0] = JANUS_VIDEOCODEC_VP8;
-		videoroom->vcodec[1] = JANUS_VIDEOCODEC_NONE;
-		videoroom->vcodec[2] = JANUS_VIDEOCODEC_NONE;
-		/* Check if we're forcing a different single codec, or allowing more than one */
-		if(videocodec) {
-			const char *videocodec_value = json_string_value(videocodec);
-			gchar **list = g_strsplit(videocodec_value, ",", 4);
-			gchar *codec = list[0];
-			if(codec != NULL) {
-				int i=0;
-				while(codec != NULL) {
-					if(i == 3) {
-						JANUS_LOG(LOG_WARN, "Ignoring extra video codecs: %s\n", codec);
-						break;
-					}
-					if(strlen(codec) > 0)
-						videoroom->vcodec[i] = janus_videocodec_from_name(codec);
-					i++;
-					codec = list[i];
-				}
-			}
-			g_clear_pointer(&list, g_strfreev);
-		}
-		if(svc && json_is_true(svc)) {
-			if(videoroom->vcodec[0] == JANUS_VIDEOCODEC_VP9 &&
-					videoroom->vcodec[1] == JANUS_VIDEOCODEC_NONE &&
-					videoroom->vcodec[2] == JANUS_VIDEOCODEC_NONE) {
-				videoroom->do_svc = TRUE;
-			} else {
-				JANUS_LOG(LOG_WARN, "SVC is only supported, in an experimental way, for VP9 only rooms: disabling it...\n");
-			}
-		}
-		videoroom->audiolevel_ext = audiolevel_ext ? json_is_true(audiolevel_ext) : TRUE;
-		videoroom->audiolevel_event = audiolevel_event ? json_is_true(audiolevel_event) : FALSE;
-		if(videoroom->audiolevel_event) {
-			videoroom->audio_active_packets = 100;
-			if(json_integer_value(audio_active_packets) > 0) {
-				videoroom->audio_active_packets = json_integer_value(audio_active_packets);
-			} else {
-				JANUS_LOG(LOG_WARN, "Invalid audio_active_packets value provided, using default: %d\n", videoroom->audio_active_packets);
-			}
-			videoroom->audio_level_average = 25;
-			if(json_integer_value(audio_level_average) > 0) {
-				videoroom->audio_level_average = json_integer_value(audio_level_average);
-			} else {
-				JANUS_LOG(LOG_WARN, "Invalid audio_level_average value provided, using default: %d\n", videoroom->audio_level_average);
-			}
-		}
-		videoroom->videoorient_ext = videoorient_ext ? json_is_true(videoorient_ext) : TRUE;
-		videoroom->playoutdelay_ext = playoutdelay_ext ? json_is_true(playoutdelay_ext) : TRUE;
-		videoroom->transport_wide_cc_ext = transport_wide_cc_ext ? json_is_true(transport_wide_cc_ext) : FALSE;
-		/* By default, the videoroom plugin does not notify about participants simply joining the room.
-		   It only notifies when the participant actually starts publishing media. */
-		videoroom->notify_joining = notify_joining ? json_is_true(notify_joining) : FALSE;
-		if(record) {
-			videoroom->record = json_is_true(record);
-		}
-		if(rec_dir) {
-			videoroom->rec_dir = g_strdup(json_string_value(rec_dir));
-		}
-		g_atomic_int_set(&videoroom->destroyed, 0);
-		janus_mutex_init(&videoroom->mutex);
-		janus_refcount_init(&videoroom->ref, janus_videoroom_room_free);
-		videoroom->participants = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, NULL);
-		videoroom->private_ids = g_hash_table_new(NULL, NULL);
-		videoroom->allowed = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, NULL);
-		if(allowed != NULL) {
-			/* Populate the "allowed" list as an ACL for people trying to join */
-			if(json_array_size(allowed) > 0) {
-				size_t i = 0;
-				for(i=0; i<json_array_size(allowed); i++) {
-					const char *token = json_string_value(json_array_get(allowed, i));
-					if(!g_hash_table_lookup(videoroom->allowed, token))
-						g_hash_table_insert(videoroom->allowed, g_strdup(token), GINT_TO_POINTER(TRUE));
-				}
-			}
-			videoroom->check_allowed = TRUE;
-		}
-		/* Compute a list of the supported codecs for the summary */
-		char audio_codecs[100], video_codecs[100];
-		janus_videoroom_codecstr(videoroom, audio_codecs, video_codecs, sizeof(audio_codecs), "|");
-		JANUS_LOG(LOG_VERB, "Created videoroom: %"SCNu64" (%s, %s, %s/%s codecs, secret: %s, pin: %s, pvtid: %s)\n",
-			videoroom->room_id, videoroom->room_name,
-			videoroom->is_private ? "private" : "public",
-			audio_codecs, video_codecs,
-			videoroom->room_secret ? videoroom->room_secret : "no secret",
-			videoroom->room_pin ? videoroom->room_pin : "no pin",
-			videoroom->require_pvtid ? "required" : "optional");
-		if(videoroom->record) {
-			JANUS_LOG(LOG_VERB, "  -- Room is going to be recorded in %s\n", videoroom->rec_dir ? videoroom->rec_dir : "the current folder");
-		}
+		gboolean save = FALSE;
+		error_code = janus_videoroom_create_room(root, &room_id, &save, error_cause, sizeof(error_cause));
+		if(error_code != 0)
+			goto plugin_response;
 		if(save) {
-			/* This room is permanent: save to the configuration file too
-			 * FIXME: We should check if anything fails... */
-			JANUS_LOG(LOG_VERB, "Saving room %"SCNu64" permanently in config file\n", videoroom->room_id);
-			janus_mutex_lock(&config_mutex);
-			char cat[BUFSIZ], value[BUFSIZ];
-			/* The room ID is the category */
-			g_snprintf(cat, BUFSIZ, "%"SCNu64, videoroom->room_id);
-			janus_config_add_category(config, cat);
-			/* Now for the values */
-			janus_config_add_item(config, cat, "description", videoroom->room_name);
-			if(videoroom->is_private)
-				janus_config_add_item(config, cat, "is_private", "yes");
-			if(videoroom->require_pvtid)
-				janus_config_add_item(config, cat, "require_pvtid", "yes");
-			g_snprintf(value, BUFSIZ, "%"SCNu32, videoroom->bitrate);
-			janus_config_add_item(config, cat, "bitrate", value);
-			g_snprintf(value, BUFSIZ, "%d", videoroom->max_publishers);
-			janus_config_add_item(config, cat, "publishers", value);
-			if(videoroom->fir_freq) {
-				g_snprintf(value, BUFSIZ, "%"SCNu16, videoroom->fir_freq);
-				janus_config_add_item(config, cat, "fir_freq", value);
-			}
-			char video_codecs[100];
-			char audio_codecs[100];
-			janus_videoroom_codecstr(videoroom, audio_codecs, video_codecs, sizeof(audio_codecs), ",");
-			janus_config_add_item(config, cat, "audiocodec", audio_codecs);
-			janus_config_add_item(config, cat, "videocodec", video_codecs);
-			if(videoroom->do_svc)
-				janus_config_add_item(config, cat, "video_svc", "yes");
-			if(videoroom->room_secret)
-				janus_config_add_item(config, cat, "secret", videoroom->room_secret);
-			if(videoroom->room_pin)
-				janus_config_add_item(config, cat, "pin", videoroom->room_pin);
-			if(videoroom->audiolevel_ext) {
-				janus_config_add_item(config, cat, "audiolevel_ext", "yes");
-				if(videoroom->audiolevel_event)
-					janus_config_add_item(config, cat, "audiolevel_event", "yes");
-				if(videoroom->audio_active_packets > 0) {
-					g_snprintf(value, BUFSIZ, "%d", videoroom->audio_active_packets);
-					janus_config_add_item(config, cat, "audio_active_packets", value);
-				}
-				if(videoroom->audio_level_average > 0) {
-					g_snprintf(value, BUFSIZ, "%d", videoroom->audio_level_average);
-					janus_config_add_item(config, cat, "audio_level_average", value);
-				}
-			}
-			if(videoroom->videoorient_ext)
-				janus_config_add_item(config, cat, "videoorient_ext", "yes");
-			if(videoroom->playoutdelay_ext)
-				janus_config_add_item(config, cat, "playoutdelay_ext", "yes");
-			if(videoroom->transport_wide_cc_ext)
-				janus_config_add_item(config, cat, "transport_wide_cc_ext", "yes");
-			if(videoroom->notify_joining)
-				janus_config_add_item(config, cat, "notify_joining", "yes");
-			if(videoroom->record)
-				janus_config_add_item(config, cat, "record", "yes");
-			if(videoroom->rec_dir)
-				janus_config_add_item(config, cat, "rec_dir", videoroom->rec_dir);
 			/* Save modified configuration */
+			janus_mutex_lock(&config_mutex);
 			if(janus_config_save(config, config_folder, JANUS_VIDEOROOM_PACKAGE) < 0)
 				save = FALSE;	/* This will notify the user the room is not permanent */
 			janus_mutex_unlock(&config_mutex);
 		}
-
-		g_hash_table_insert(rooms, janus_uint64_dup(videoroom->room_id), videoroom);
+		janus_mutex_lock(&rooms_mutex);
 		/* Show updated rooms list */
 		GHashTableIter iter;
 		gpointer value;
@@ -2775,16 +4074,109 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 		/* Send info back */
 		response = json_object();
 		json_object_set_new(response, "videoroom", json_string("created"));
-		json_object_set_new(response, "room", json_integer(videoroom->room_id));
+		json_object_set_new(response, "room", json_integer(room_id));
 		json_object_set_new(response, "permanent", save ? json_true() : json_false());
 		/* Also notify event handlers */
 		if(notify_events && gateway->events_is_enabled()) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string("created"));
-			json_object_set_new(info, "room", json_integer(videoroom->room_id));
+			json_object_set_new(info, "room", json_integer(room_id));
 			gateway->notify_event(&janus_videoroom_plugin, session->handle, info);
 		}
 		goto plugin_response;
+	} else if(!strcasecmp(request_text, "create_rooms")) {
+		/* Create many videorooms at once: this works exactly as "create" for
+		 * each of them, but the configuration file is only saved once at the end */
+		JANUS_LOG(LOG_VERB, "Creating new videorooms in bulk\n");
+		JANUS_VALIDATE_JSON_OBJECT(root, create_rooms_parameters,
+			error_code, error_cause, TRUE,
+			JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+		if(error_code != 0)
+			goto plugin_response;
+		if(admin_key != NULL) {
+			/* An admin key was specified: make sure it was provided, and that it's valid */
+			JANUS_VALIDATE_JSON_OBJECT(root, adminkey_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+			if(error_code != 0)
+				goto plugin_response;
+			JANUS_CHECK_SECRET(admin_key, root, "admin_key", error_code, error_cause,
+				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT, JANUS_VIDEOROOM_ERROR_UNAUTHORIZED);
+			if(error_code != 0)
+				goto plugin_response;
+		}
+		json_t *list = json_object_get(root, "rooms");
+		json_t *permanent = json_object_get(root, "permanent");
+		gboolean save = permanent ? json_is_true(permanent) : FALSE;
+		if(save && config == NULL) {
+			JANUS_LOG(LOG_ERR, "No configuration file, can't create permanent rooms\n");
+			error_code = JANUS_VIDEOROOM_ERROR_UNKNOWN_ERROR;
+			g_snprintf(error_cause, 512, "No configuration file, can't create permanent rooms");
+			goto plugin_response;
+		}
+		json_t *created = json_array(), *failed = json_array();
+		int saved = 0;
+		size_t i = 0;
+		for(i=0; i<json_array_size(list); i++) {
+			json_t *r = json_array_get(list, i);
+			guint64 room_id = 0;
+			gboolean room_saved = FALSE;
+			char room_error[512];
+			int room_error_code = 0;
+			if(!json_is_object(r)) {
+				room_error_code = JANUS_VIDEOROOM_ERROR_INVALID_JSON;
+				g_snprintf(room_error, sizeof(room_error), "JSON error: not an object");
+			} else {
+				/* The top level "permanent" applies to all rooms that don't override it */
+				json_t *settings = json_copy(r);
+				if(save && json_object_get(settings, "permanent") == NULL)
+					json_object_set_new(settings, "permanent", json_true());
+				room_error_code = janus_videoroom_create_room(settings, &room_id, &room_saved, room_error, sizeof(room_error));
+				json_decref(settings);
+			}
+			if(room_error_code != 0) {
+				json_t *f = json_object();
+				json_object_set_new(f, "index", json_integer(i));
+				json_t *room = json_is_object(r) ? json_object_get(r, "room") : NULL;
+				if(room)
+					json_object_set(f, "room", room);
+				json_object_set_new(f, "error_code", json_integer(room_error_code));
+				json_object_set_new(f, "error", json_string(room_error));
+				json_array_append_new(failed, f);
+				continue;
+			}
+			if(room_saved)
+				saved++;
+			json_t *c = json_object();
+			json_object_set_new(c, "room", json_integer(room_id));
+			json_object_set_new(c, "permanent", room_saved ? json_true() : json_false());
+			json_array_append_new(created, c);
+			/* Also notify event handlers */
+			if(notify_events && gateway->events_is_enabled()) {
+				json_t *info = json_object();
+				json_object_set_new(info, "event", json_string("created"));
+				json_object_set_new(info, "room", json_integer(room_id));
+				gateway->notify_event(&janus_videoroom_plugin, session->handle, info);
+			}
+		}
+		if(saved > 0) {
+			/* Save modified configuration, once for all the rooms */
+			janus_mutex_lock(&config_mutex);
+			if(janus_config_save(config, config_folder, JANUS_VIDEOROOM_PACKAGE) < 0) {
+				/* This will notify the user the rooms are not permanent */
+				for(i=0; i<json_array_size(created); i++)
+					json_object_set_new(json_array_get(created, i), "permanent", json_false());
+			}
+			janus_mutex_unlock(&config_mutex);
+		}
+		JANUS_LOG(LOG_VERB, "Created %zu videorooms (%zu failed, %d permanent)\n",
+			json_array_size(created), json_array_size(failed), saved);
+		/* Send info back */
+		response = json_object();
+		json_object_set_new(response, "videoroom", json_string("created_rooms"));
+		json_object_set_new(response, "created", created);
+		json_object_set_new(response, "failed", failed);
+		goto plugin_response;
 	} else if(!strcasecmp(request_text, "edit")) {
 		/* Edit the properties for an existing videoroom */
 		JANUS_LOG(LOG_VERB, "Attempt to edit the properties of an existing videoroom room\n");
@@ -3013,6 +4405,10 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 				json_object_set_new(rl, "max_publishers", json_integer(room->max_publishers));
 				json_object_set_new(rl, "bitrate", json_integer(room->bitrate));
 				json_object_set_new(rl, "fir_freq", json_integer(room->fir_freq));
+				if(room->keyframe_window)
+					json_object_set_new(rl, "keyframe_window", json_integer(room->keyframe_window));
+				if(room->memory_cap)
+					json_object_set_new(rl, "memory_cap", json_integer(room->memory_cap));
 				char audio_codecs[100];
 				char video_codecs[100];
 				janus_videoroom_codecstr(room, audio_codecs, video_codecs, sizeof(audio_codecs), ",");
@@ -3109,6 +4505,15 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 			}
 			srtp_crypto = json_string_value(s_crypto);
 		}
+		/* The recipient may be a remote publisher on another Janus, which will send feedback */
+		json_t *fb = json_object_get(root, "feedback");
+		gboolean feedback = fb ? json_is_true(fb) : FALSE;
+		if(feedback && srtp_crypto != NULL) {
+			JANUS_LOG(LOG_ERR, "Feedback is not supported on SRTP forwarders\n");
+			error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+			g_snprintf(error_cause, 512, "Feedback is not supported on SRTP forwarders");
+			goto plugin_response;
+		}
 		guint64 room_id = json_integer_value(room);
 		guint64 publisher_id = json_integer_value(pub_id);
 		const char *host = json_string_value(json_host);
@@ -3147,22 +4552,22 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 		guint32 data_handle = 0;
 		if(audio_port > 0) {
 			audio_handle = janus_videoroom_rtp_forwarder_add_helper(publisher, host, audio_port, audio_pt, audio_ssrc,
-				srtp_suite, srtp_crypto, 0, FALSE, FALSE);
+				srtp_suite, srtp_crypto, 0, FALSE, FALSE, FALSE);
 		}
 		if(video_port[0] > 0) {
 			video_handle[0] = janus_videoroom_rtp_forwarder_add_helper(publisher, host, video_port[0], video_pt[0], video_ssrc[0],
-				srtp_suite, srtp_crypto, 0, TRUE, FALSE);
+				srtp_suite, srtp_crypto, 0, TRUE, FALSE, feedback);
 		}
 		if(video_port[1] > 0) {
 			video_handle[1] = janus_videoroom_rtp_forwarder_add_helper(publisher, host, video_port[1], video_pt[1], video_ssrc[1],
-				srtp_suite, srtp_crypto, 1, TRUE, FALSE);
+				srtp_suite, srtp_crypto, 1, TRUE, FALSE, feedback);
 		}
 		if(video_port[2] > 0) {
 			video_handle[2] = janus_videoroom_rtp_forwarder_add_helper(publisher, host, video_port[2], video_pt[2], video_ssrc[2],
-				srtp_suite, srtp_crypto, 2, TRUE, FALSE);
+				srtp_suite, srtp_crypto, 2, TRUE, FALSE, feedback);
 		}
 		if(data_port > 0) {
-			data_handle = janus_videoroom_rtp_forwarder_add_helper(publisher, host, data_port, 0, 0, 0, NULL, 0, FALSE, TRUE);
+			data_handle = janus_videoroom_rtp_forwarder_add_helper(publisher, host, data_port, 0, 0, 0, NULL, 0, FALSE, TRUE, FALSE);
 		}
 		janus_mutex_unlock(&videoroom->mutex);
 		response = json_object();
@@ -3187,70 +4592,379 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 				json_object_set_new(rtp_stream, "video_3", json_integer(video_port[2]));
 			}
 		}
-		if(data_handle > 0) {
-			json_object_set_new(rtp_stream, "data_stream_id", json_integer(data_handle));
-			json_object_set_new(rtp_stream, "data", json_integer(data_port));
+		if(data_handle > 0) {
+			json_object_set_new(rtp_stream, "data_stream_id", json_integer(data_handle));
+			json_object_set_new(rtp_stream, "data", json_integer(data_port));
+		}
+		/* These two unrefs are related to the message handling */
+		janus_refcount_decrease(&publisher->ref);
+		janus_refcount_decrease(&videoroom->ref);
+		json_object_set_new(rtp_stream, "host", json_string(host));
+		json_object_set_new(response, "publisher_id", json_integer(publisher_id));
+		json_object_set_new(response, "rtp_stream", rtp_stream);
+		json_object_set_new(response, "room", json_integer(room_id));
+		json_object_set_new(response, "videoroom", json_string("rtp_forward"));
+		goto plugin_response;
+	} else if(!strcasecmp(request_text, "stop_rtp_forward")) {
+		JANUS_VALIDATE_JSON_OBJECT(root, stop_rtp_forward_parameters,
+			error_code, error_cause, TRUE,
+			JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+		if(error_code != 0)
+			goto plugin_response;
+		json_t *room = json_object_get(root, "room");
+		json_t *pub_id = json_object_get(root, "publisher_id");
+		json_t *id = json_object_get(root, "stream_id");
+
+		guint64 room_id = json_integer_value(room);
+		guint64 publisher_id = json_integer_value(pub_id);
+		guint32 stream_id = json_integer_value(id);
+		janus_mutex_lock(&rooms_mutex);
+		janus_videoroom *videoroom = NULL;
+		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
+		janus_mutex_unlock(&rooms_mutex);
+		if(error_code != 0)
+			goto plugin_response;
+		janus_mutex_lock(&videoroom->mutex);
+		janus_refcount_increase(&videoroom->ref);
+		janus_videoroom_publisher *publisher = g_hash_table_lookup(videoroom->participants, &publisher_id);
+		if(publisher == NULL) {
+			janus_mutex_unlock(&videoroom->mutex);
+			janus_refcount_decrease(&videoroom->ref);
+			JANUS_LOG(LOG_ERR, "No such publisher (%"SCNu64")\n", publisher_id);
+			error_code = JANUS_VIDEOROOM_ERROR_NO_SUCH_FEED;
+			g_snprintf(error_cause, 512, "No such feed (%"SCNu64")", publisher_id);
+			goto plugin_response;
+		}
+		janus_refcount_increase(&publisher->ref);	/* Just to handle the message now */
+		janus_mutex_lock(&publisher->rtp_forwarders_mutex);
+		if(!g_hash_table_remove(publisher->rtp_forwarders, GUINT_TO_POINTER(stream_id))) {
+			janus_mutex_unlock(&publisher->rtp_forwarders_mutex);
+			janus_refcount_decrease(&publisher->ref);
+			janus_mutex_unlock(&videoroom->mutex);
+			janus_refcount_decrease(&videoroom->ref);
+			JANUS_LOG(LOG_ERR, "No such stream (%"SCNu32")\n", stream_id);
+			error_code = JANUS_VIDEOROOM_ERROR_NO_SUCH_FEED;
+			g_snprintf(error_cause, 512, "No such stream (%"SCNu32")", stream_id);
+			goto plugin_response;
+		}
+		janus_mutex_unlock(&publisher->rtp_forwarders_mutex);
+		janus_refcount_decrease(&publisher->ref);
+		janus_mutex_unlock(&videoroom->mutex);
+		janus_refcount_decrease(&videoroom->ref);
+		response = json_object();
+		json_object_set_new(response, "videoroom", json_string("stop_rtp_forward"));
+		json_object_set_new(response, "room", json_integer(room_id));
+		json_object_set_new(response, "publisher_id", json_integer(publisher_id));
+		json_object_set_new(response, "stream_id", json_integer(stream_id));
+		goto plugin_response;
+	} else if(!strcasecmp(request_text, "add_remote_publisher")) {
+		/* Add a publisher whose media is forwarded by another Janus instance (e.g., the origin of a cascaded room) */
+		JANUS_VALIDATE_JSON_OBJECT(root, remote_publisher_parameters,
+			error_code, error_cause, TRUE,
+			JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+		if(error_code != 0)
+			goto plugin_response;
+		json_t *room = json_object_get(root, "room");
+		json_t *id = json_object_get(root, "id");
+		json_t *display = json_object_get(root, "display");
+		json_t *audiocodec = json_object_get(root, "audiocodec");
+		json_t *videocodec = json_object_get(root, "videocodec");
+		json_t *simulcast = json_object_get(root, "simulcast");
+		json_t *data = json_object_get(root, "data");
+		json_t *host = json_object_get(root, "host");
+		json_t *origin = json_object_get(root, "origin");
+		janus_audiocodec acodec = audiocodec ? janus_audiocodec_from_name(json_string_value(audiocodec)) : JANUS_AUDIOCODEC_NONE;
+		janus_videocodec vcodec = videocodec ? janus_videocodec_from_name(json_string_value(videocodec)) : JANUS_VIDEOCODEC_NONE;
+		gboolean do_simulcast = simulcast ? json_is_true(simulcast) : FALSE;
+		gboolean do_data = data ? json_is_true(data) : FALSE;
+		const char *host_text = host ? json_string_value(host) : NULL;
+		const char *origin_text = origin ? json_string_value(origin) : NULL;
+		struct in_addr host_addr, origin_addr;
+		if((audiocodec && acodec == JANUS_AUDIOCODEC_NONE) || (videocodec && vcodec == JANUS_VIDEOCODEC_NONE)) {
+			JANUS_LOG(LOG_ERR, "Unsupported codec\n");
+			error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+			g_snprintf(error_cause, 512, "Unsupported codec");
+			goto plugin_response;
+		}
+		if(acodec == JANUS_AUDIOCODEC_NONE && vcodec == JANUS_VIDEOCODEC_NONE && !do_data) {
+			JANUS_LOG(LOG_ERR, "Missing element (audiocodec, videocodec or data)\n");
+			error_code = JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT;
+			g_snprintf(error_cause, 512, "Missing element (audiocodec, videocodec or data)");
+			goto plugin_response;
+		}
+		if(do_simulcast && vcodec != JANUS_VIDEOCODEC_VP8) {
+			JANUS_LOG(LOG_ERR, "Simulcasting is only supported for VP8\n");
+			error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+			g_snprintf(error_cause, 512, "Simulcasting is only supported for VP8");
+			goto plugin_response;
+		}
+		if(host_text != NULL && inet_pton(AF_INET, host_text, &host_addr) != 1) {
+			JANUS_LOG(LOG_ERR, "Invalid host (%s)\n", host_text);
+			error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+			g_snprintf(error_cause, 512, "Invalid host (%s)", host_text);
+			goto plugin_response;
+		}
+		if(origin_text != NULL && inet_pton(AF_INET, origin_text, &origin_addr) != 1) {
+			JANUS_LOG(LOG_ERR, "Invalid origin (%s)\n", origin_text);
+			error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+			g_snprintf(error_cause, 512, "Invalid origin (%s)", origin_text);
+			goto plugin_response;
+		}
+		guint64 room_id = json_integer_value(room);
+		janus_mutex_lock(&rooms_mutex);
+		janus_videoroom *videoroom = NULL;
+		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
+		janus_mutex_unlock(&rooms_mutex);
+		if(error_code != 0)
+			goto plugin_response;
+		janus_refcount_increase(&videoroom->ref);
+		janus_mutex_lock(&videoroom->mutex);
+		/* The codecs must be among the ones the room allows */
+		gboolean acodec_ok = (acodec == JANUS_AUDIOCODEC_NONE), vcodec_ok = (vcodec == JANUS_VIDEOCODEC_NONE);
+		int i = 0;
+		for(i=0; i<3; i++) {
+			if(acodec != JANUS_AUDIOCODEC_NONE && videoroom->acodec[i] == acodec)
+				acodec_ok = TRUE;
+			if(vcodec != JANUS_VIDEOCODEC_NONE && videoroom->vcodec[i] == vcodec)
+				vcodec_ok = TRUE;
+		}
+		if(!acodec_ok || !vcodec_ok) {
+			janus_mutex_unlock(&videoroom->mutex);
+			janus_refcount_decrease(&videoroom->ref);
+			JANUS_LOG(LOG_ERR, "Codec not allowed in room %"SCNu64"\n", room_id);
+			error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+			g_snprintf(error_cause, 512, "Codec not allowed in room %"SCNu64, room_id);
+			goto plugin_response;
+		}
+		guint64 user_id = id ? json_integer_value(id) : 0;
+		if(user_id > 0 && g_hash_table_lookup(videoroom->participants, &user_id) != NULL) {
+			janus_mutex_unlock(&videoroom->mutex);
+			janus_refcount_decrease(&videoroom->ref);
+			JANUS_LOG(LOG_ERR, "User ID %"SCNu64" already exists\n", user_id);
+			error_code = JANUS_VIDEOROOM_ERROR_ID_EXISTS;
+			g_snprintf(error_cause, 512, "User ID %"SCNu64" already exists", user_id);
+			goto plugin_response;
+		}
+		while(user_id == 0) {
+			user_id = janus_random_uint64();
+			if(g_hash_table_lookup(videoroom->participants, &user_id) != NULL)
+				user_id = 0;
+		}
+		/* Create the sockets we'll receive the media on */
+		janus_videoroom_remote *remote = g_malloc0(sizeof(janus_videoroom_remote));
+		for(i=0; i<JANUS_VIDEOROOM_REMOTE_STREAMS; i++)
+			remote->fd[i] = -1;
+		if(origin_text != NULL) {
+			remote->expected = origin_addr;
+			remote->has_expected = TRUE;
+		}
+		gboolean failed = FALSE;
+		if(acodec != JANUS_AUDIOCODEC_NONE) {
+			remote->fd[JANUS_VIDEOROOM_REMOTE_AUDIO] = janus_videoroom_remote_socket(host_text, &remote->port[JANUS_VIDEOROOM_REMOTE_AUDIO]);
+			failed = failed || remote->fd[JANUS_VIDEOROOM_REMOTE_AUDIO] < 0;
+		}
+		if(vcodec != JANUS_VIDEOCODEC_NONE) {
+			for(i=0; i<(do_simulcast ? 3 : 1); i++) {
+				remote->fd[JANUS_VIDEOROOM_REMOTE_VIDEO+i] = janus_videoroom_remote_socket(host_text, &remote->port[JANUS_VIDEOROOM_REMOTE_VIDEO+i]);
+				failed = failed || remote->fd[JANUS_VIDEOROOM_REMOTE_VIDEO+i] < 0;
+			}
+		}
+		if(do_data) {
+			remote->fd[JANUS_VIDEOROOM_REMOTE_DATA] = janus_videoroom_remote_socket(host_text, &remote->port[JANUS_VIDEOROOM_REMOTE_DATA]);
+			failed = failed || remote->fd[JANUS_VIDEOROOM_REMOTE_DATA] < 0;
+		}
+		if(failed) {
+			for(i=0; i<JANUS_VIDEOROOM_REMOTE_STREAMS; i++) {
+				if(remote->fd[i] >= 0)
+					close(remote->fd[i]);
+			}
+			g_free(remote);
+			janus_mutex_unlock(&videoroom->mutex);
+			janus_refcount_decrease(&videoroom->ref);
+			error_code = JANUS_VIDEOROOM_ERROR_UNKNOWN_ERROR;
+			g_snprintf(error_cause, 512, "Could not create sockets for the remote publisher");
+			goto plugin_response;
+		}
+		/* Remote publishers have no PeerConnection, and so a session without a handle */
+		janus_videoroom_session *rsession = g_malloc0(sizeof(janus_videoroom_session));
+		rsession->handle = NULL;
+		rsession->participant_type = janus_videoroom_p_type_publisher;
+		rsession->started = TRUE;
+		janus_mutex_init(&rsession->mutex);
+		g_atomic_int_set(&rsession->destroyed, 0);
+		janus_refcount_init(&rsession->ref, janus_videoroom_session_free);
+		janus_videoroom_publisher *publisher = g_malloc0(sizeof(janus_videoroom_publisher));
+		publisher->session = rsession;
+		rsession->participant = publisher;
+		publisher->room_id = videoroom->room_id;
+		publisher->room = videoroom;
+		publisher->user_id = user_id;
+		janus_videoroom_publisher_memory_init(publisher);
+		publisher->display = display ? g_strdup(json_string_value(display)) : NULL;
+		publisher->audio = (acodec != JANUS_AUDIOCODEC_NONE);
+		publisher->video = (vcodec != JANUS_VIDEOCODEC_NONE);
+		publisher->data = do_data;
+		publisher->acodec = acodec;
+		publisher->vcodec = vcodec;
+		publisher->audio_pt = publisher->audio ? janus_audiocodec_pt(acodec) : -1;
+		publisher->video_pt = publisher->video ? janus_videocodec_pt(vcodec) : -1;
+		publisher->audio_active = publisher->audio;
+		publisher->video_active = publisher->video;
+		publisher->data_active = publisher->data;
+		publisher->audio_ssrc = janus_random_uint32();
+		publisher->video_ssrc = janus_random_uint32();
+		if(do_simulcast) {
+			publisher->ssrc[0] = publisher->video_ssrc;
+			publisher->ssrc[1] = janus_random_uint32();
+			publisher->ssrc[2] = janus_random_uint32();
+		}
+		publisher->record_substreams = janus_videoroom_record_base;
+		janus_mutex_init(&publisher->rec_mutex);
+		janus_mutex_init(&publisher->gop_mutex);
+		publisher->bitrate = videoroom->bitrate;
+		janus_mutex_init(&publisher->subscribers_mutex);
+		/* Remote publishers can be forwarded in turn (e.g., to further edges) */
+		janus_mutex_init(&publisher->rtp_forwarders_mutex);
+		publisher->rtp_forwarders = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_videoroom_rtp_forwarder_free_helper);
+		publisher->srtp_contexts = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)janus_videoroom_srtp_context_free_helper);
+		publisher->udp_sock = -1;
+		publisher->remote = remote;
+		g_atomic_int_set(&publisher->destroyed, 0);
+		janus_refcount_init(&publisher->ref, janus_videoroom_publisher_free);
+		/* Prepare the SDP we'll offer subscribers */
+		char s_name[100];
+		g_snprintf(s_name, sizeof(s_name), "VideoRoom %"SCNu64, videoroom->room_id);
+		janus_sdp *offer = janus_sdp_generate_offer(s_name, "1.1.1.1",
+			JANUS_SDP_OA_AUDIO, publisher->audio,
+			JANUS_SDP_OA_AUDIO_CODEC, janus_audiocodec_name(publisher->acodec),
+			JANUS_SDP_OA_AUDIO_PT, janus_audiocodec_pt(publisher->acodec),
+			JANUS_SDP_OA_AUDIO_DIRECTION, JANUS_SDP_SENDONLY,
+			JANUS_SDP_OA_VIDEO, publisher->video,
+			JANUS_SDP_OA_VIDEO_CODEC, janus_videocodec_name(publisher->vcodec),
+			JANUS_SDP_OA_VIDEO_PT, janus_videocodec_pt(publisher->vcodec),
+			JANUS_SDP_OA_VIDEO_DIRECTION, JANUS_SDP_SENDONLY,
+			JANUS_SDP_OA_DATA, publisher->data,
+			JANUS_SDP_OA_DONE);
+		publisher->sdp = janus_sdp_write(offer);
+		janus_sdp_destroy(offer);
+		if(videoroom->record) {
+			janus_mutex_lock(&publisher->rec_mutex);
+			janus_videoroom_recorder_create(publisher, publisher->audio, publisher->video, publisher->data);
+			janus_mutex_unlock(&publisher->rec_mutex);
 		}
-		/* These two unrefs are related to the message handling */
-		janus_refcount_decrease(&publisher->ref);
-		janus_refcount_decrease(&videoroom->ref);
-		json_object_set_new(rtp_stream, "host", json_string(host));
-		json_object_set_new(response, "publisher_id", json_integer(publisher_id));
-		json_object_set_new(response, "rtp_stream", rtp_stream);
+		g_hash_table_insert(videoroom->participants, janus_uint64_dup(publisher->user_id), publisher);
+		/* Start receiving media: the thread has references to us and the room */
+		janus_refcount_increase(&publisher->ref);
+		janus_refcount_increase(&videoroom->ref);
+		GError *error = NULL;
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "vroom remote");
+		g_thread_try_new(tname, janus_videoroom_remote_thread, publisher, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the remote publisher thread...\n",
+				error->code, error->message ? error->message : "??");
+			error_code = JANUS_VIDEOROOM_ERROR_UNKNOWN_ERROR;
+			g_snprintf(error_cause, 512, "Got error %d (%s) trying to launch the remote publisher thread",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			janus_refcount_decrease(&videoroom->ref);
+			janus_refcount_decrease(&publisher->ref);
+			g_hash_table_remove(videoroom->participants, &user_id);
+			janus_mutex_unlock(&videoroom->mutex);
+			janus_refcount_decrease(&videoroom->ref);
+			goto plugin_response;
+		}
+		videoroom->speakers = g_list_append(videoroom->speakers, janus_uint64_dup(publisher->user_id));
+		janus_videoroom_speakers_update(videoroom);
+		/* Notify all other participants that there's a new publisher */
+		json_t *list = json_array();
+		json_t *pl = json_object();
+		json_object_set_new(pl, "id", json_integer(publisher->user_id));
+		if(publisher->display)
+			json_object_set_new(pl, "display", json_string(publisher->display));
+		if(publisher->audio)
+			json_object_set_new(pl, "audio_codec", json_string(janus_audiocodec_name(publisher->acodec)));
+		if(publisher->video)
+			json_object_set_new(pl, "video_codec", json_string(janus_videocodec_name(publisher->vcodec)));
+		json_array_append_new(list, pl);
+		json_t *pub = json_object();
+		json_object_set_new(pub, "videoroom", json_string("event"));
+		json_object_set_new(pub, "room", json_integer(publisher->room_id));
+		json_object_set_new(pub, "publishers", list);
+		janus_videoroom_notify_participants(publisher, pub);
+		json_decref(pub);
+		janus_mutex_unlock(&videoroom->mutex);
+		/* Also notify event handlers */
+		if(notify_events && gateway->events_is_enabled()) {
+			json_t *info = json_object();
+			json_object_set_new(info, "event", json_string("published"));
+			json_object_set_new(info, "room", json_integer(room_id));
+			json_object_set_new(info, "id", json_integer(user_id));
+			json_object_set_new(info, "remote", json_true());
+			gateway->notify_event(&janus_videoroom_plugin, NULL, info);
+		}
+		JANUS_LOG(LOG_INFO, "Added remote publisher %"SCNu64" to room %"SCNu64"\n", user_id, room_id);
+		response = json_object();
+		json_object_set_new(response, "videoroom", json_string("remote_publisher"));
 		json_object_set_new(response, "room", json_integer(room_id));
-		json_object_set_new(response, "videoroom", json_string("rtp_forward"));
+		json_object_set_new(response, "id", json_integer(user_id));
+		if(remote->fd[JANUS_VIDEOROOM_REMOTE_AUDIO] >= 0)
+			json_object_set_new(response, "audio_port", json_integer(remote->port[JANUS_VIDEOROOM_REMOTE_AUDIO]));
+		if(remote->fd[JANUS_VIDEOROOM_REMOTE_VIDEO] >= 0)
+			json_object_set_new(response, "video_port", json_integer(remote->port[JANUS_VIDEOROOM_REMOTE_VIDEO]));
+		if(remote->fd[JANUS_VIDEOROOM_REMOTE_VIDEO+1] >= 0)
+			json_object_set_new(response, "video_port_2", json_integer(remote->port[JANUS_VIDEOROOM_REMOTE_VIDEO+1]));
+		if(remote->fd[JANUS_VIDEOROOM_REMOTE_VIDEO+2] >= 0)
+			json_object_set_new(response, "video_port_3", json_integer(remote->port[JANUS_VIDEOROOM_REMOTE_VIDEO+2]));
+		if(remote->fd[JANUS_VIDEOROOM_REMOTE_DATA] >= 0)
+			json_object_set_new(response, "data_port", json_integer(remote->port[JANUS_VIDEOROOM_REMOTE_DATA]));
+		/* The reference we took on the room is now owned by the publisher */
 		goto plugin_response;
-	} else if(!strcasecmp(request_text, "stop_rtp_forward")) {
-		JANUS_VALIDATE_JSON_OBJECT(root, stop_rtp_forward_parameters,
+	} else if(!strcasecmp(request_text, "remove_remote_publisher")) {
+		JANUS_VALIDATE_JSON_OBJECT(root, remove_remote_publisher_parameters,
 			error_code, error_cause, TRUE,
 			JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
 		if(error_code != 0)
 			goto plugin_response;
 		json_t *room = json_object_get(root, "room");
-		json_t *pub_id = json_object_get(root, "publisher_id");
-		json_t *id = json_object_get(root, "stream_id");
-
+		json_t *id = json_object_get(root, "id");
 		guint64 room_id = json_integer_value(room);
-		guint64 publisher_id = json_integer_value(pub_id);
-		guint32 stream_id = json_integer_value(id);
+		guint64 user_id = json_integer_value(id);
 		janus_mutex_lock(&rooms_mutex);
 		janus_videoroom *videoroom = NULL;
 		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
 		janus_mutex_unlock(&rooms_mutex);
 		if(error_code != 0)
 			goto plugin_response;
-		janus_mutex_lock(&videoroom->mutex);
 		janus_refcount_increase(&videoroom->ref);
-		janus_videoroom_publisher *publisher = g_hash_table_lookup(videoroom->participants, &publisher_id);
-		if(publisher == NULL) {
+		janus_mutex_lock(&videoroom->mutex);
+		janus_videoroom_publisher *publisher = g_hash_table_lookup(videoroom->participants, &user_id);
+		if(publisher == NULL || publisher->remote == NULL) {
 			janus_mutex_unlock(&videoroom->mutex);
 			janus_refcount_decrease(&videoroom->ref);
-			JANUS_LOG(LOG_ERR, "No such publisher (%"SCNu64")\n", publisher_id);
+			JANUS_LOG(LOG_ERR, "No such remote publisher (%"SCNu64")\n", user_id);
 			error_code = JANUS_VIDEOROOM_ERROR_NO_SUCH_FEED;
-			g_snprintf(error_cause, 512, "No such feed (%"SCNu64")", publisher_id);
+			g_snprintf(error_cause, 512, "No such remote publisher (%"SCNu64")", user_id);
 			goto plugin_response;
 		}
-		janus_refcount_increase(&publisher->ref);	/* Just to handle the message now */
-		janus_mutex_lock(&publisher->rtp_forwarders_mutex);
-		if(!g_hash_table_remove(publisher->rtp_forwarders, GUINT_TO_POINTER(stream_id))) {
-			janus_mutex_unlock(&publisher->rtp_forwarders_mutex);
-			janus_refcount_decrease(&publisher->ref);
-			janus_mutex_unlock(&videoroom->mutex);
-			janus_refcount_decrease(&videoroom->ref);
-			JANUS_LOG(LOG_ERR, "No such stream (%"SCNu32")\n", stream_id);
-			error_code = JANUS_VIDEOROOM_ERROR_NO_SUCH_FEED;
-			g_snprintf(error_cause, 512, "No such stream (%"SCNu32")", stream_id);
-			goto plugin_response;
+		janus_refcount_increase(&publisher->ref);
+		janus_mutex_unlock(&videoroom->mutex);
+		/* Tell everybody the publisher is gone, the thread will get rid of the subscribers */
+		g_atomic_int_set(&publisher->remote->stopping, 1);
+		janus_videoroom_leave_or_unpublish(publisher, TRUE, FALSE);
+		if(notify_events && gateway->events_is_enabled()) {
+			json_t *info = json_object();
+			json_object_set_new(info, "event", json_string("unpublished"));
+			json_object_set_new(info, "room", json_integer(room_id));
+			json_object_set_new(info, "id", json_integer(user_id));
+			json_object_set_new(info, "remote", json_true());
+			gateway->notify_event(&janus_videoroom_plugin, NULL, info);
 		}
-		janus_mutex_unlock(&publisher->rtp_forwarders_mutex);
 		janus_refcount_decrease(&publisher->ref);
-		janus_mutex_unlock(&videoroom->mutex);
-		janus_refcount_decrease(&videoroom->ref);
+		JANUS_LOG(LOG_INFO, "Removed remote publisher %"SCNu64" from room %"SCNu64"\n", user_id, room_id);
 		response = json_object();
-		json_object_set_new(response, "videoroom", json_string("stop_rtp_forward"));
-		json_object_set_new(response, "room", json_integer(room_id));
-		json_object_set_new(response, "publisher_id", json_integer(publisher_id));
-		json_object_set_new(response, "stream_id", json_integer(stream_id));
+		json_object_set_new(response, "videoroom", json_string("success"));
+		janus_refcount_decrease(&videoroom->ref);
 		goto plugin_response;
 	} else if(!strcasecmp(request_text, "exists")) {
 		/* Check whether a given room exists or not, returns true/false */	
@@ -3496,6 +5210,8 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 			if(p->display)
 				json_object_set_new(pl, "display", json_string(p->display));
 			json_object_set_new(pl, "publisher", (p->sdp && p->session->started) ? json_true() : json_false());
+			if(p->remote != NULL)
+				json_object_set_new(pl, "remote", json_true());
 			if((p->sdp && p->session->started)) {
 				if(p->audio_level_extmap_id > 0)
 					json_object_set_new(pl, "talking", p->talking ? json_true() : json_false());
@@ -3589,6 +5305,7 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 				}
 				if(rpv->is_srtp)
 					json_object_set_new(fl, "srtp", json_true());
+				json_object_set_new(fl, "send_errors", json_integer(rpv->send_errors));
 				json_array_append_new(flist, fl);
 			}		
 			janus_mutex_unlock(&p->rtp_forwarders_mutex);
@@ -3690,6 +5407,10 @@ void janus_videoroom_setup_media(janus_plugin_session *handle) {
 			json_object_set_new(pub, "publishers", list);
 			janus_mutex_lock(&participant->room->mutex);
 			janus_videoroom_notify_participants(participant, pub);
+			/* New publishers are the least recent speakers until they talk */
+			janus_videoroom_speakers_remove(participant->room, participant->user_id);
+			participant->room->speakers = g_list_append(participant->room->speakers, janus_uint64_dup(participant->user_id));
+			janus_videoroom_speakers_update(participant->room);
 			janus_mutex_unlock(&participant->room->mutex);
 			json_decref(pub);
 			/* Also notify event handlers */
@@ -3706,7 +5427,9 @@ void janus_videoroom_setup_media(janus_plugin_session *handle) {
 			if(s && s->feed) {
 				janus_videoroom_publisher *p = s->feed;
 				if(p && p->session) {
-					janus_videoroom_reqfir(p, "New subscriber available");
+					/* If we have a recent keyframe, there's no need to ask the publisher for one */
+					if(!janus_videoroom_gop_replay(s))
+						janus_videoroom_reqfir_subscriber(p, "New subscriber available");
 					/* Also notify event handlers */
 					if(notify_events && gateway->events_is_enabled()) {
 						json_t *info = json_object();
@@ -3723,6 +5446,40 @@ void janus_videoroom_setup_media(janus_plugin_session *handle) {
 }
 
 void janus_videoroom_incoming_rtp(janus_plugin_session *handle, int video, char *buf, int len) {
+	janus_videoroom_incoming_rtp_internal(handle, video, buf, len, NULL, NULL, 0);
+}
+
+void janus_videoroom_incoming_rtp_packet(janus_plugin_session *handle, janus_plugin_rtp_packet *packet) {
+	if(packet == NULL)
+		return;
+	/* The core already parsed the RTP extensions and the payload descriptor for us */
+	janus_videoroom_incoming_rtp_internal(handle, packet->video, packet->buffer, packet->length, &packet->extensions,
+		packet->media.codec != JANUS_VIDEOCODEC_NONE ? &packet->media : NULL, packet->received);
+}
+
+void janus_videoroom_incoming_rtp_batch(janus_plugin_session *handle, janus_plugin_rtp_packet *packets, int count) {
+	if(handle == NULL || packets == NULL || g_atomic_int_get(&handle->stopped) || g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized) || !gateway)
+		return;
+	janus_videoroom_session *session = (janus_videoroom_session *)handle->plugin_handle;
+	if(!session || g_atomic_int_get(&session->destroyed) || session->participant_type != janus_videoroom_p_type_publisher)
+		return;
+	/* Look the publisher up once for the whole batch */
+	janus_videoroom_publisher *participant = janus_videoroom_session_get_publisher_nodebug(session);
+	if(participant == NULL)
+		return;
+	int i = 0;
+	for(i=0; i<count; i++) {
+		if(g_atomic_int_get(&participant->destroyed) || participant->kicked || participant->room == NULL)
+			break;
+		janus_plugin_rtp_packet *packet = &packets[i];
+		janus_videoroom_incoming_rtp_publisher(participant, packet->video, packet->buffer, packet->length, &packet->extensions,
+			packet->media.codec != JANUS_VIDEOCODEC_NONE ? &packet->media : NULL, packet->received);
+	}
+	janus_videoroom_publisher_dereference_nodebug(participant);
+}
+
+static void janus_videoroom_incoming_rtp_internal(janus_plugin_session *handle, int video, char *buf, int len,
+		janus_rtp_ext_info *extensions, janus_rtp_media_info *media, gint64 received) {
 	if(handle == NULL || g_atomic_int_get(&handle->stopped) || g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized) || !gateway)
 		return;
 	janus_videoroom_session *session = (janus_videoroom_session *)handle->plugin_handle;
@@ -3735,12 +5492,20 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, int video, char
 		janus_videoroom_publisher_dereference_nodebug(participant);
 		return;
 	}
+	janus_videoroom_incoming_rtp_publisher(participant, video, buf, len, extensions, media, received);
+	janus_videoroom_publisher_dereference_nodebug(participant);
+}
+
+/* Process a packet sent by a publisher, whether it comes from its PeerConnection or from another Janus (remote publishers) */
+static void janus_videoroom_incoming_rtp_publisher(janus_videoroom_publisher *participant, int video, char *buf, int len,
+		janus_rtp_ext_info *extensions, janus_rtp_media_info *media, gint64 received) {
 	janus_videoroom *videoroom = participant->room;
 
 	/* In case this is an audio packet and we're doing talk detection, check the audio level extension */
 	if(!video && videoroom->audiolevel_event && participant->audio_active) {
 		int level = 0;
-		if(janus_rtp_header_extension_parse_audio_level(buf, len, participant->audio_level_extmap_id, &level) == 0) {
+		if((extensions ? janus_rtp_ext_info_audio_level(extensions, buf, participant->audio_level_extmap_id, &level) :
+				janus_rtp_header_extension_parse_audio_level(buf, len, participant->audio_level_extmap_id, &level)) == 0) {
 			participant->audio_dBov_sum += level;
 			participant->audio_active_packets++;
 			participant->audio_dBov_level = level;
@@ -3768,6 +5533,13 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, int video, char
 					json_object_set_new(event, "id", json_integer(participant->user_id));
 					janus_videoroom_notify_participants(participant, event);
 					json_decref(event);
+					if(participant->talking && videoroom->speakers &&
+							*(guint64 *)videoroom->speakers->data != participant->user_id) {
+						/* This is the most recent speaker now */
+						janus_videoroom_speakers_remove(videoroom, participant->user_id);
+						videoroom->speakers = g_list_prepend(videoroom->speakers, janus_uint64_dup(participant->user_id));
+						janus_videoroom_speakers_update(videoroom);
+					}
 					janus_mutex_unlock(&videoroom->mutex);
 					/* Also notify event handlers */
 					if(notify_events && gateway->events_is_enabled()) {
@@ -3775,7 +5547,7 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, int video, char
 						json_object_set_new(info, "videoroom", json_string(participant->talking ? "talking" : "stopped-talking"));
 						json_object_set_new(info, "room", json_integer(videoroom->room_id));
 						json_object_set_new(info, "id", json_integer(participant->user_id));
-						gateway->notify_event(&janus_videoroom_plugin, session->handle, info);
+						gateway->notify_event(&janus_videoroom_plugin, participant->session->handle, info);
 					}
 				}
 			}
@@ -3806,6 +5578,8 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, int video, char
 				srtp_ctx->slen = 0;
 			}
 		}
+		janus_videoroom_forwarder_batch batch;
+		batch.count = 0;
 		GHashTableIter iter;
 		gpointer value;
 		g_hash_table_iter_init(&iter, participant->rtp_forwarders);
@@ -3822,10 +5596,15 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, int video, char
 					(!video && !rtp_forward->is_video && !rtp_forward->is_data)) {
 				/* Check if this is an RTP or SRTP forwarder */
 				if(!rtp_forward->is_srtp) {
-					/* Plain RTP */
-					if(sendto(participant->udp_sock, buf, len, 0, (struct sockaddr*)&rtp_forward->serv_addr, sizeof(rtp_forward->serv_addr)) < 0) {
-						JANUS_LOG(LOG_HUGE, "Error forwarding RTP %s packet for %s... %s (len=%d)...\n",
-							(video ? "video" : "audio"), participant->display, strerror(errno), len);
+					/* Plain RTP: the batch keeps a copy of the header as it is now */
+					janus_videoroom_forwarder_batch_add(participant, &batch, rtp_forward, buf, len, buf);
+					if(rtp_forward->buffer != NULL && len <= 1500) {
+						/* Keep a copy, in case the recipient NACKs it */
+						guint16 seq = ntohs(rtp->seq_number);
+						janus_videoroom_rtp_forwarder_packet *pkt = &rtp_forward->buffer[seq % JANUS_VIDEOROOM_FORWARDER_BUFFER];
+						pkt->seq = seq;
+						pkt->length = len;
+						memcpy(pkt->data, buf, len);
 					}
 				} else {
 					/* SRTP: check if we already encrypted the packet before */
@@ -3843,9 +5622,10 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, int video, char
 							rtp_forward->srtp_ctx->slen = protected;
 						}
 					}
-					if(rtp_forward->srtp_ctx->slen > 0 && sendto(participant->udp_sock, rtp_forward->srtp_ctx->sbuf, rtp_forward->srtp_ctx->slen, 0, (struct sockaddr*)&rtp_forward->serv_addr, sizeof(rtp_forward->serv_addr)) < 0) {
-						JANUS_LOG(LOG_HUGE, "Error forwarding SRTP %s packet for %s... %s (len=%d)...\n",
-							(video ? "video" : "audio"), participant->display, strerror(errno), rtp_forward->srtp_ctx->slen);
+					/* Forwarders sharing the context all send the same encrypted packet */
+					if(rtp_forward->srtp_ctx->slen > 0) {
+						janus_videoroom_forwarder_batch_add(participant, &batch, rtp_forward,
+							rtp_forward->srtp_ctx->sbuf, rtp_forward->srtp_ctx->slen, NULL);
 					}
 				}
 			}
@@ -3853,13 +5633,24 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, int video, char
 			rtp->type = pt;
 			rtp->ssrc = htonl(ssrc);
 		}
+		janus_videoroom_forwarder_batch_flush(participant, &batch);
+		if(video && participant->forwarders_feedback && participant->udp_sock > 0) {
+			/* Check if remote recipients sent us any feedback, but not for every packet */
+			gint64 now = janus_get_monotonic_time();
+			if(now - participant->feedback_latest >= 10000) {
+				participant->feedback_latest = now;
+				janus_videoroom_rtp_forwarder_feedback(participant);
+			}
+		}
 		janus_mutex_unlock(&participant->rtp_forwarders_mutex);
 		/* Set the payload type of the publisher */
 		rtp->type = video ? participant->video_pt : participant->audio_pt;
-		if(sc < 1) {
-			/* Save the frame if we're recording
-			 * FIXME: for video, we're currently only recording the base substream, when simulcasting */
+		if(sc == -1 || sc == participant->vrc_substream) {
+			/* Save the frame if we're recording (when simulcasting, only the substream we've been asked to) */
 			janus_recorder_save_frame(video ? participant->vrc : participant->arc, buf, len);
+		} else if(sc > 0 && participant->vrc_sc[sc-1] != NULL) {
+			/* We're recording all substreams, each in its own file */
+			janus_recorder_save_frame(participant->vrc_sc[sc-1], buf, len);
 		}
 		/* Done, relay it */
 		janus_videoroom_rtp_relay_packet packet;
@@ -3867,7 +5658,23 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, int video, char
 		packet.length = len;
 		packet.is_video = video;
 		packet.svc = FALSE;
-		if(video && videoroom->do_svc) {
+		/* Only use the info the core parsed if it matches the codec we expect */
+		if(media != NULL && (!video || media->codec != participant->vcodec))
+			media = NULL;
+		packet.media = media;
+		if(video && videoroom->do_svc && media != NULL) {
+			/* The core already parsed the layers for us */
+			if(media->vp9_svc) {
+				packet.svc = TRUE;
+				packet.spatial_layer = media->vp9_spatial_layer;
+				packet.temporal_layer = media->vp9_temporal_layer;
+				packet.pbit = media->vp9_p;
+				packet.dbit = media->vp9_d;
+				packet.ubit = media->vp9_u;
+				packet.bbit = media->vp9_b;
+				packet.ebit = media->vp9_e;
+			}
+		} else if(video && videoroom->do_svc) {
 			/* We're doing SVC: let's parse this packet to see which layers are there */
 			int plen = 0;
 			char *payload = janus_rtp_payload(buf, len, &plen);
@@ -3888,16 +5695,42 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, int video, char
 				}
 			}
 		}
+		if(video)
+			janus_videoroom_publisher_layer_bitrate(participant, sc != -1 ? sc : (packet.svc ? packet.spatial_layer : -1), len);
 		packet.ssrc[0] = (sc != -1 ? participant->ssrc[0] : 0);
 		packet.ssrc[1] = (sc != -1 ? participant->ssrc[1] : 0);
 		packet.ssrc[2] = (sc != -1 ? participant->ssrc[2] : 0);
 		/* Backup the actual timestamp and sequence number set by the publisher, in case switching is involved */
 		packet.timestamp = ntohl(packet.data->timestamp);
 		packet.seq_number = ntohs(packet.data->seq_number);
+		packet.received = janus_get_monotonic_time();
+		if(video)
+			janus_videoroom_gop_update(participant, &packet, sc != -1 ? sc : 0);
 		/* Go: some viewers may decide to drop the packet, but that's up to them */
 		janus_mutex_lock_nodebug(&participant->subscribers_mutex);
-		g_slist_foreach(participant->subscribers, janus_videoroom_relay_rtp_packet, &packet);
+		packet.shared = participant->subscribers ? janus_plugin_rtp_shared_new(buf, len) : NULL;
+		if(packet.shared != NULL)
+			packet.shared->received = received;
+		if(!participant->fanout) {
+			participant->fanout = fanout_workers_count > 0 && videoroom->fanout_threshold > 0 &&
+				participant->subscribers_count >= videoroom->fanout_threshold;
+		} else if((videoroom->fanout_threshold == 0 || participant->subscribers_count < videoroom->fanout_threshold/2) &&
+				g_atomic_int_get(&participant->fanout_pending) == 0) {
+			/* The audience shrunk and the workers are done with our packets, we can go back to relaying inline */
+			participant->fanout = FALSE;
+		}
+		if(participant->fanout) {
+			/* Large room, let the workers relay the packet */
+			janus_videoroom_fanout(participant, &packet);
+		} else {
+			gint64 started = janus_get_monotonic_time();
+			g_slist_foreach(participant->subscribers, janus_videoroom_relay_rtp_packet, &packet);
+			janus_metric_inc(metric_fanout_packets[0]);
+			janus_metric_add(metric_fanout_time[0], janus_get_monotonic_time() - started);
+		}
 		janus_mutex_unlock_nodebug(&participant->subscribers_mutex);
+		if(packet.shared != NULL)
+			janus_refcount_decrease(&packet.shared->ref);
 
 		/* Check if we need to send any REMB, FIR or PLI back to this publisher */
 		if(video && participant->video_active) {
@@ -3921,7 +5754,7 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, int video, char
 				JANUS_LOG(LOG_VERB, "Sending REMB (%s, %"SCNu32")\n", participant->display, bitrate);
 				char rtcpbuf[24];
 				janus_rtcp_remb((char *)(&rtcpbuf), 24, bitrate);
-				gateway->relay_rtcp(handle, video, rtcpbuf, 24);
+				gateway->relay_rtcp(participant->session->handle, video, rtcpbuf, 24);
 				if(participant->remb_startup == 0)
 					participant->remb_latest = janus_get_monotonic_time();
 			}
@@ -3931,10 +5764,13 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, int video, char
 				gint64 now = janus_get_monotonic_time();
 				/* First check if this is a keyframe, though: if so, we reset the timer */
 				int plen = 0;
-				char *payload = janus_rtp_payload(buf, len, &plen);
-				if(payload == NULL)
+				char *payload = media ? NULL : janus_rtp_payload(buf, len, &plen);
+				if(media == NULL && payload == NULL)
 					return;
-				if(participant->vcodec == JANUS_VIDEOCODEC_VP8) {
+				if(media != NULL) {
+					if(media->keyframe)
+						participant->fir_latest = now;
+				} else if(participant->vcodec == JANUS_VIDEOCODEC_VP8) {
 					if(janus_vp8_is_keyframe(payload, plen))
 						participant->fir_latest = now;
 				} else if(participant->vcodec == JANUS_VIDEOCODEC_VP9) {
@@ -3951,7 +5787,6 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, int video, char
 			}
 		}
 	}
-	janus_videoroom_publisher_dereference_nodebug(participant);
 }
 
 void janus_videoroom_incoming_rtcp(janus_plugin_session *handle, int video, char *buf, int len) {
@@ -3971,11 +5806,20 @@ void janus_videoroom_incoming_rtcp(janus_plugin_session *handle, int video, char
 			return;
 		if(!s->video)
 			return;	/* The only feedback we handle is video related anyway... */
-		if(janus_rtcp_has_fir(buf, len)) {
+		janus_rtcp_summary summary;
+		if(janus_rtcp_summarize(buf, len, &summary) < 0)
+			return;
+		/* Many subscribers may be asking for a keyframe at the same time, check if we should just drop this */
+		gboolean suppressed = FALSE;
+		if((summary.has_fir || summary.has_pli) && s->feed && !s->feed->remote)
+			suppressed = janus_videoroom_keyframe_suppress(s->feed);
+		if(summary.has_fir) {
 			/* We got a FIR, forward it to the publisher */
 			if(s->feed) {
 				janus_videoroom_publisher *p = s->feed;
-				if(p && p->session) {
+				if(p && p->remote) {
+					janus_videoroom_reqfir_subscriber(p, "Got a FIR from a subscriber");
+				} else if(p && p->session && !suppressed) {
 					char rtcpbuf[20];
 					janus_rtcp_fir((char *)&rtcpbuf, 20, &p->fir_seq);
 					JANUS_LOG(LOG_VERB, "Got a FIR from a subscriber, forwarding it to %"SCNu64" (%s)\n", p->user_id, p->display ? p->display : "??");
@@ -3985,11 +5829,13 @@ void janus_videoroom_incoming_rtcp(janus_plugin_session *handle, int video, char
 				}
 			}
 		}
-		if(janus_rtcp_has_pli(buf, len)) {
+		if(summary.has_pli) {
 			/* We got a PLI, forward it to the publisher */
 			if(s->feed) {
 				janus_videoroom_publisher *p = s->feed;
-				if(p && p->session) {
+				if(p && p->remote) {
+					janus_videoroom_reqfir_subscriber(p, "Got a PLI from a subscriber");
+				} else if(p && p->session && !suppressed) {
 					char rtcpbuf[12];
 					janus_rtcp_pli((char *)&rtcpbuf, 12);
 					JANUS_LOG(LOG_VERB, "Got a PLI from a subscriber, forwarding it to %"SCNu64" (%s)\n", p->user_id, p->display ? p->display : "??");
@@ -3999,9 +5845,9 @@ void janus_videoroom_incoming_rtcp(janus_plugin_session *handle, int video, char
 				}
 			}
 		}
-		uint32_t bitrate = janus_rtcp_get_remb(buf, len);
-		if(bitrate > 0) {
-			/* FIXME We got a REMB from this subscriber, should we do something about it? */
+		if(summary.remb > 0 && s->auto_layers) {
+			/* Use the bandwidth this subscriber reports to pick the right substream/layers */
+			janus_videoroom_subscriber_auto_layers(s, summary.remb);
 		}
 	}
 }
@@ -4021,35 +5867,40 @@ void janus_videoroom_incoming_data(janus_plugin_session *handle, char *buf, int
 		janus_videoroom_publisher_dereference_nodebug(participant);
 		return;
 	}
+	janus_videoroom_incoming_data_publisher(participant, buf, len);
+	janus_videoroom_publisher_dereference_nodebug(participant);
+}
+
+/* Process a message sent by a publisher, whether it comes from its PeerConnection or from another Janus (remote publishers) */
+static void janus_videoroom_incoming_data_publisher(janus_videoroom_publisher *participant, char *buf, int len) {
 	/* Any forwarder involved? */
 	janus_mutex_lock(&participant->rtp_forwarders_mutex);
 	/* Forward RTP to the appropriate port for the rtp_forwarders associated with this publisher, if there are any */
+	janus_videoroom_forwarder_batch batch;
+	batch.count = 0;
 	GHashTableIter iter;
 	gpointer value;
 	g_hash_table_iter_init(&iter, participant->rtp_forwarders);
 	while(participant->udp_sock > 0 && g_hash_table_iter_next(&iter, NULL, &value)) {
 		janus_videoroom_rtp_forwarder* rtp_forward = (janus_videoroom_rtp_forwarder*)value;
-		if(rtp_forward->is_data) {
-			if(sendto(participant->udp_sock, buf, len, 0, (struct sockaddr*)&rtp_forward->serv_addr, sizeof(rtp_forward->serv_addr)) < 0) {
-				JANUS_LOG(LOG_HUGE, "Error forwarding data packet for %s... %s (len=%d)...\n",
-					participant->display, strerror(errno), len);
-			}
-		}
+		if(rtp_forward->is_data)
+			janus_videoroom_forwarder_batch_add(participant, &batch, rtp_forward, buf, len, NULL);
 	}
+	janus_videoroom_forwarder_batch_flush(participant, &batch);
 	janus_mutex_unlock(&participant->rtp_forwarders_mutex);
-	/* Get a string out of the data */
-	char *text = g_malloc(len+1);
-	memcpy(text, buf, len);
-	*(text+len) = '\0';
-	JANUS_LOG(LOG_VERB, "Got a DataChannel message (%zu bytes) to forward: %s\n", strlen(text), text);
+	JANUS_LOG(LOG_VERB, "Got a DataChannel message (%d bytes) to forward: %.*s\n", len, len, buf);
 	/* Save the message if we're recording */
-	janus_recorder_save_frame(participant->drc, text, strlen(text));
-	/* Relay to all subscribers */
+	janus_recorder_save_frame(participant->drc, buf, len);
+	/* Relay to all subscribers: the message is wrapped only once, and shared by all of them */
 	janus_mutex_lock_nodebug(&participant->subscribers_mutex);
-	g_slist_foreach(participant->subscribers, janus_videoroom_relay_data_packet, text);
+	if(participant->subscribers != NULL) {
+		janus_plugin_rtp_shared *message = janus_plugin_rtp_shared_new(buf, len);
+		if(message != NULL) {
+			g_slist_foreach(participant->subscribers, janus_videoroom_relay_data_packet, message);
+			janus_refcount_decrease(&message->ref);
+		}
+	}
 	janus_mutex_unlock_nodebug(&participant->subscribers_mutex);
-	g_free(text);
-	janus_videoroom_publisher_dereference_nodebug(participant);
 }
 
 void janus_videoroom_slow_link(janus_plugin_session *handle, int uplink, int video) {
@@ -4150,6 +6001,32 @@ static void janus_videoroom_recorder_create(janus_videoroom_publisher *participa
 				JANUS_LOG(LOG_ERR, "Couldn't open an video recording file for this publisher!\n");
 			}
 		}
+		/* When simulcasting, check which substreams we should record */
+		participant->vrc_substream = 0;
+		if(participant->vrc != NULL && participant->ssrc[0] != 0 &&
+				participant->record_substreams != janus_videoroom_record_base) {
+			int highest = participant->ssrc[2] ? 2 : (participant->ssrc[1] ? 1 : 0);
+			if(participant->record_substreams == janus_videoroom_record_highest) {
+				participant->vrc_substream = highest;
+			} else {
+				/* The base substream goes in the usual file, the others get their own */
+				int sc = 0;
+				for(sc=1; sc<=highest; sc++) {
+					memset(filename, 0, 255);
+					if(participant->recording_base) {
+						g_snprintf(filename, 255, "%s-video-sc%d", participant->recording_base, sc);
+					} else {
+						g_snprintf(filename, 255, "videoroom-%"SCNu64"-user-%"SCNu64"-%"SCNi64"-video-sc%d",
+							participant->room_id, participant->user_id, now, sc);
+					}
+					participant->vrc_sc[sc-1] = janus_recorder_create(participant->room->rec_dir,
+						janus_videocodec_name(participant->vcodec), filename);
+					if(participant->vrc_sc[sc-1] == NULL) {
+						JANUS_LOG(LOG_ERR, "Couldn't open a video recording file for substream %d of this publisher!\n", sc);
+					}
+				}
+			}
+		}
 	}
 	if(data) {
 		memset(filename, 0, 255);
@@ -4189,6 +6066,16 @@ static void janus_videoroom_recorder_close(janus_videoroom_publisher *participan
 		JANUS_LOG(LOG_INFO, "Closed video recording %s\n", rc->filename ? rc->filename : "??");
 		janus_recorder_destroy(rc);
 	}
+	int i = 0;
+	for(i=0; i<2; i++) {
+		if(participant->vrc_sc[i]) {
+			janus_recorder *rc = participant->vrc_sc[i];
+			participant->vrc_sc[i] = NULL;
+			janus_recorder_close(rc);
+			JANUS_LOG(LOG_INFO, "Closed video recording %s\n", rc->filename ? rc->filename : "??");
+			janus_recorder_destroy(rc);
+		}
+	}
 	if(participant->drc) {
 		janus_recorder *rc = participant->drc;
 		participant->drc = NULL;
@@ -4198,6 +6085,199 @@ static void janus_videoroom_recorder_close(janus_videoroom_publisher *participan
 	}
 }
 
+/* Detach all subscribers from a publisher that stopped publishing (subscribers_mutex must be locked) */
+static void janus_videoroom_publisher_drop_subscribers(janus_videoroom_publisher *participant) {
+	while(participant->subscribers) {
+		janus_videoroom_subscriber *s = (janus_videoroom_subscriber *)participant->subscribers->data;
+		if(s) {
+			janus_videoroom_publisher_remove_subscriber(participant, s);
+			janus_refcount_decrease(&participant->session->ref);
+			if(s->speaker >= 0 && s->room && !g_atomic_int_get(&s->room->destroyed)) {
+				/* This subscriber follows speakers, we'll switch it to somebody else */
+				if(s->feed)
+					g_clear_pointer(&s->feed, janus_videoroom_publisher_dereference);
+				janus_refcount_decrease(&s->ref);
+				continue;
+			}
+			if(s->feed)
+				g_clear_pointer(&s->feed, janus_videoroom_publisher_dereference);
+			if(s->room)
+				g_clear_pointer(&s->room, janus_videoroom_room_dereference);
+			if(s->session && s->close_pc)
+				gateway->close_pc(s->session->handle);
+			janus_refcount_decrease(&s->ref);
+		}
+	}
+}
+
+/* Remote publishers: we receive each stream on its own socket */
+static int janus_videoroom_remote_socket(const char *host, guint16 *port) {
+	int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if(fd < 0)
+		return -1;
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = 0;
+	address.sin_addr.s_addr = INADDR_ANY;
+	if(host != NULL)
+		inet_pton(AF_INET, host, &address.sin_addr);
+	socklen_t len = sizeof(address);
+	if(bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+			getsockname(fd, (struct sockaddr *)&address, &len) < 0) {
+		JANUS_LOG(LOG_ERR, "Error binding socket for remote publisher... %d (%s)\n", errno, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	*port = ntohs(address.sin_port);
+	return fd;
+}
+
+/* Send feedback to where a stream of a remote publisher comes from */
+static void janus_videoroom_remote_feedback(janus_videoroom_publisher *p, int stream, char *buf, int len) {
+	janus_videoroom_remote *remote = p->remote;
+	if(remote->fd[stream] < 0 || !g_atomic_int_get(&remote->has_origin[stream]))
+		return;
+	if(sendto(remote->fd[stream], buf, len, 0, (struct sockaddr *)&remote->origin[stream], sizeof(remote->origin[stream])) < 0) {
+		JANUS_LOG(LOG_HUGE, "Error sending feedback for remote publisher %s... %s (len=%d)...\n",
+			p->display ? p->display : "??", strerror(errno), len);
+	}
+}
+
+static void janus_videoroom_remote_pli(janus_videoroom_publisher *p) {
+	char buf[12];
+	janus_rtcp_pli((char *)&buf, 12);
+	int i = 0;
+	for(i=JANUS_VIDEOROOM_REMOTE_VIDEO; i<JANUS_VIDEOROOM_REMOTE_VIDEO+3; i++)
+		janus_videoroom_remote_feedback(p, i, buf, 12);
+}
+
+/* Check if we missed any video packet from the origin, and if so NACK it (or ask for a keyframe, if we missed too many) */
+static void janus_videoroom_remote_check_losses(janus_videoroom_publisher *p, int sc, guint16 seq) {
+	janus_videoroom_remote *remote = p->remote;
+	if(!remote->seq_valid[sc]) {
+		remote->seq_valid[sc] = TRUE;
+		remote->seq[sc] = seq;
+		return;
+	}
+	gint16 diff = (gint16)(seq - remote->seq[sc]);
+	if(diff <= 0)
+		return;	/* Retransmission or out of order packet */
+	if(diff > JANUS_VIDEOROOM_REMOTE_MAX_NACKS+1) {
+		janus_videoroom_reqfir(p, "Too many packets lost from the origin");
+	} else if(diff > 1) {
+		GSList *nacks = NULL;
+		guint16 missing = seq-1;
+		while(missing != remote->seq[sc]) {
+			nacks = g_slist_prepend(nacks, GUINT_TO_POINTER(missing));
+			missing--;
+		}
+		char rtcpbuf[64];
+		int res = janus_rtcp_nacks((char *)&rtcpbuf, sizeof(rtcpbuf), nacks);
+		g_slist_free(nacks);
+		if(res > 0) {
+			JANUS_LOG(LOG_HUGE, "Lost %d packets from the origin of %s, sending NACK\n", diff-1, p->display ? p->display : "??");
+			janus_videoroom_remote_feedback(p, JANUS_VIDEOROOM_REMOTE_VIDEO+sc, rtcpbuf, res);
+		}
+	}
+	remote->seq[sc] = seq;
+}
+
+/* Thread receiving the media of a remote publisher */
+static void *janus_videoroom_remote_thread(void *data) {
+	janus_videoroom_publisher *p = (janus_videoroom_publisher *)data;
+	janus_videoroom_remote *remote = p->remote;
+	janus_videoroom *room = p->room;
+	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Joining remote publisher thread (%s)\n", p->user_id, p->display ? p->display : "??");
+	struct pollfd fds[JANUS_VIDEOROOM_REMOTE_STREAMS];
+	int streams[JANUS_VIDEOROOM_REMOTE_STREAMS];
+	char buffer[1500];
+	struct sockaddr_in address;
+	socklen_t addrlen;
+	while(!g_atomic_int_get(&stopping) && g_atomic_int_get(&initialized) && !g_atomic_int_get(&remote->stopping) &&
+			!g_atomic_int_get(&p->destroyed) && !p->kicked && !g_atomic_int_get(&room->destroyed)) {
+		int i = 0, num = 0;
+		for(i=0; i<JANUS_VIDEOROOM_REMOTE_STREAMS; i++) {
+			if(remote->fd[i] < 0)
+				continue;
+			fds[num].fd = remote->fd[i];
+			fds[num].events = POLLIN;
+			fds[num].revents = 0;
+			streams[num] = i;
+			num++;
+		}
+		int res = poll(fds, num, 500);
+		if(res < 0) {
+			if(errno == EINTR)
+				continue;
+			JANUS_LOG(LOG_ERR, "[%"SCNu64"] Error polling remote publisher sockets... %d (%s)\n", p->user_id, errno, strerror(errno));
+			break;
+		} else if(res == 0) {
+			continue;
+		}
+		for(i=0; i<num; i++) {
+			if(!(fds[i].revents & POLLIN))
+				continue;
+			addrlen = sizeof(address);
+			int len = recvfrom(fds[i].fd, buffer, sizeof(buffer), 0, (struct sockaddr *)&address, &addrlen);
+			if(len <= 0)
+				continue;
+			int stream = streams[i];
+			if(address.sin_family != AF_INET ||
+					(remote->has_expected && address.sin_addr.s_addr != remote->expected.s_addr)) {
+				/* Not from the origin we were told about */
+				JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Dropping packet from an unexpected address\n", p->user_id);
+				continue;
+			}
+			if(!g_atomic_int_get(&remote->has_origin[stream])) {
+				/* Keep track of where this stream comes from, that's where feedback goes */
+				remote->origin[stream] = address;
+				g_atomic_int_set(&remote->has_origin[stream], 1);
+			} else if(remote->origin[stream].sin_addr.s_addr != address.sin_addr.s_addr ||
+					remote->origin[stream].sin_port != address.sin_port) {
+				if(!remote->has_expected) {
+					/* We pinned the first sender, ignore anybody else */
+					JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Dropping packet from an address other than the origin\n", p->user_id);
+					continue;
+				}
+				/* Same origin, but a different port (e.g., a new forwarder) */
+				remote->origin[stream] = address;
+			}
+			if(stream == JANUS_VIDEOROOM_REMOTE_DATA) {
+				if(p->data_active)
+					janus_videoroom_incoming_data_publisher(p, buffer, len);
+				continue;
+			}
+			janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+			if(len < 12 || rtp->version != 2 || (rtp->type >= 72 && rtp->type <= 76))
+				continue;	/* Not RTP */
+			if(stream == JANUS_VIDEOROOM_REMOTE_AUDIO) {
+				rtp->ssrc = htonl(p->audio_ssrc);
+				janus_videoroom_incoming_rtp_publisher(p, 0, buffer, len, NULL, NULL, 0);
+				continue;
+			}
+			/* Use our own SSRCs, so that we know which substream is which */
+			int sc = stream - JANUS_VIDEOROOM_REMOTE_VIDEO;
+			rtp->ssrc = htonl(p->ssrc[0] ? p->ssrc[sc] : p->video_ssrc);
+			janus_videoroom_remote_check_losses(p, sc, ntohs(rtp->seq_number));
+			janus_videoroom_incoming_rtp_publisher(p, 1, buffer, len, NULL, NULL, 0);
+		}
+	}
+	/* Whoever stopped us already told the other participants, just get rid of the subscribers */
+	janus_mutex_lock(&p->subscribers_mutex);
+	janus_videoroom_publisher_drop_subscribers(p);
+	janus_mutex_unlock(&p->subscribers_mutex);
+	/* There's no session to be destroyed, so we release the reference to the room ourselves */
+	janus_mutex_lock(&room->mutex);
+	g_clear_pointer(&p->room, janus_videoroom_room_dereference);
+	janus_mutex_unlock(&room->mutex);
+	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Leaving remote publisher thread\n", p->user_id);
+	janus_refcount_decrease(&room->ref);
+	janus_refcount_decrease(&p->ref);
+	g_thread_unref(g_thread_self());
+	return NULL;
+}
+
 void janus_videoroom_hangup_media(janus_plugin_session *handle) {
 	JANUS_LOG(LOG_INFO, "[%s-%p] No WebRTC media anymore; %p %p\n", JANUS_VIDEOROOM_PACKAGE, handle, handle->gateway_handle, handle->plugin_handle);
 	janus_mutex_lock(&sessions_mutex);
@@ -4234,6 +6314,7 @@ static void janus_videoroom_hangup_media_internal(janus_plugin_session *handle)
 		janus_mutex_lock(&participant->subscribers_mutex);
 		g_free(participant->sdp);
 		participant->sdp = NULL;
+		janus_videoroom_publisher_sdp_reset(participant);
 		participant->firefox = FALSE;
 		participant->audio_active = FALSE;
 		participant->video_active = FALSE;
@@ -4246,21 +6327,14 @@ static void janus_videoroom_hangup_media_internal(janus_plugin_session *handle)
 		participant->remb_latest = 0;
 		participant->fir_latest = 0;
 		participant->fir_seq = 0;
-		while(participant->subscribers) {
-			janus_videoroom_subscriber *s = (janus_videoroom_subscriber *)participant->subscribers->data;
-			if(s) {
-				participant->subscribers = g_slist_remove(participant->subscribers, s);
-				janus_refcount_decrease(&participant->session->ref);
-				if(s->feed)
-					g_clear_pointer(&s->feed, janus_videoroom_publisher_dereference);
-				if(s->room)
-					g_clear_pointer(&s->room, janus_videoroom_room_dereference);
-				if(s->session && s->close_pc)
-					gateway->close_pc(s->session->handle);
-				janus_refcount_decrease(&s->ref);
-			}
-		}
+		janus_videoroom_publisher_drop_subscribers(participant);
 		janus_mutex_unlock(&participant->subscribers_mutex);
+		/* Whatever we cached can't be used for a new PeerConnection */
+		janus_mutex_lock(&participant->gop_mutex);
+		janus_videoroom_gop_reset(&participant->gop[0]);
+		janus_videoroom_gop_reset(&participant->gop[1]);
+		janus_videoroom_gop_reset(&participant->gop[2]);
+		janus_mutex_unlock(&participant->gop_mutex);
 		janus_videoroom_leave_or_unpublish(participant, FALSE, FALSE);
 		/* Also notify event handlers */
 		if(notify_events && gateway->events_is_enabled()) {
@@ -4276,10 +6350,18 @@ static void janus_videoroom_hangup_media_internal(janus_plugin_session *handle)
 		janus_videoroom_subscriber *subscriber = (janus_videoroom_subscriber *)session->participant;
 		if(subscriber) {
 			subscriber->paused = TRUE;
+			if(subscriber->speaker >= 0 && subscriber->room) {
+				/* Stop following speakers */
+				janus_mutex_lock(&subscriber->room->mutex);
+				subscriber->room->speaker_subscribers = g_slist_remove(subscriber->room->speaker_subscribers, subscriber);
+				janus_mutex_unlock(&subscriber->room->mutex);
+				if(subscriber->feed == NULL)
+					g_clear_pointer(&subscriber->room, janus_videoroom_room_dereference);
+			}
 			janus_videoroom_publisher *publisher = subscriber->feed;
 			if(publisher != NULL) {
 				janus_mutex_lock(&publisher->subscribers_mutex);
-				publisher->subscribers = g_slist_remove(publisher->subscribers, subscriber);
+				janus_videoroom_publisher_remove_subscriber(publisher, subscriber);
 				if(subscriber->pvt_id > 0 && publisher->room != NULL) {
 					janus_videoroom_publisher *owner = g_hash_table_lookup(publisher->room->private_ids, GUINT_TO_POINTER(subscriber->pvt_id));
 					if(owner != NULL) {
@@ -4376,6 +6458,12 @@ static void *janus_videoroom_handler(void *data) {
 				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
 			if(error_code != 0)
 				goto error;
+			if(!gateway->admission_check(&janus_videoroom_plugin)) {
+				JANUS_LOG(LOG_WARN, "Too loaded to accept new participants\n");
+				error_code = JANUS_VIDEOROOM_ERROR_OVERLOADED;
+				g_snprintf(error_cause, 512, "Too loaded to accept new participants");
+				goto error;
+			}
 			janus_mutex_lock(&rooms_mutex);
 			error_code = janus_videoroom_access_room(root, FALSE, TRUE, &videoroom, error_cause, sizeof(error_cause));
 			if(error_code != 0) {
@@ -4437,6 +6525,17 @@ static void *janus_videoroom_handler(void *data) {
 					}
 				}
 				JANUS_LOG(LOG_VERB, "  -- Publisher ID: %"SCNu64"\n", user_id);
+				json_t *record_substreams = json_object_get(root, "record_substreams");
+				int substreams = janus_videoroom_record_substreams_from_name(
+					record_substreams ? json_string_value(record_substreams) : NULL);
+				if(substreams < 0) {
+					janus_mutex_unlock(&videoroom->mutex);
+					janus_refcount_decrease(&videoroom->ref);
+					JANUS_LOG(LOG_ERR, "Invalid value for record_substreams: %s\n", json_string_value(record_substreams));
+					error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+					g_snprintf(error_cause, 512, "Invalid value for record_substreams (should be base, highest or all)");
+					goto error;
+				}
 				/* Process the request */
 				json_t *audio = NULL, *video = NULL, *data = NULL,
 					*bitrate = NULL, *record = NULL, *recfile = NULL;
@@ -4456,6 +6555,7 @@ static void *janus_videoroom_handler(void *data) {
 				publisher->room = videoroom;
 				videoroom = NULL;
 				publisher->user_id = user_id;
+				janus_videoroom_publisher_memory_init(publisher);
 				publisher->display = display_text ? g_strdup(display_text) : NULL;
 				publisher->sdp = NULL;		/* We'll deal with this later */
 				publisher->audio = FALSE;	/* We'll deal with this later */
@@ -4470,11 +6570,17 @@ static void *janus_videoroom_handler(void *data) {
 				publisher->recording_base = NULL;
 				publisher->arc = NULL;
 				publisher->vrc = NULL;
+				publisher->vrc_sc[0] = NULL;
+				publisher->vrc_sc[1] = NULL;
+				publisher->vrc_substream = 0;
+				publisher->record_substreams = substreams;
 				publisher->drc = NULL;
 				janus_mutex_init(&publisher->rec_mutex);
+				janus_mutex_init(&publisher->gop_mutex);
 				publisher->firefox = FALSE;
 				publisher->bitrate = publisher->room->bitrate;
 				publisher->subscribers = NULL;
+				publisher->subscribers_count = 0;
 				publisher->subscriptions = NULL;
 				janus_mutex_init(&publisher->subscribers_mutex);
 				publisher->audio_pt = -1;	/* We'll deal with this later */
@@ -4534,6 +6640,10 @@ static void *janus_videoroom_handler(void *data) {
 				session->participant_type = janus_videoroom_p_type_publisher;
 				session->participant = publisher;
 				janus_mutex_unlock(&session->mutex);
+				/* Keep the participants of the same room on the same NUMA node */
+				char group[64];
+				g_snprintf(group, sizeof(group), "videoroom-%"SCNu64, publisher->room_id);
+				gateway->set_affinity_group(session->handle, group);
 				/* Return a list of all available publishers (those with an SDP available, that is) */
 				json_t *list = json_array();
 				GHashTableIter iter;
@@ -4596,6 +6706,14 @@ static void *janus_videoroom_handler(void *data) {
 				}
 				json_t *feed = json_object_get(root, "feed");
 				guint64 feed_id = json_integer_value(feed);
+				json_t *speaker = json_object_get(root, "speaker");
+				if(feed == NULL && speaker == NULL) {
+					JANUS_LOG(LOG_ERR, "Missing element (feed or speaker)\n");
+					error_code = JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT;
+					g_snprintf(error_cause, 512, "Missing element (feed or speaker)");
+					janus_mutex_unlock(&videoroom->mutex);
+					goto error;
+				}
 				json_t *pvt = json_object_get(root, "private_id");
 				guint64 pvt_id = json_integer_value(pvt);
 				json_t *cpc = json_object_get(root, "close_pc");
@@ -4606,8 +6724,23 @@ static void *janus_videoroom_handler(void *data) {
 				json_t *offer_audio = json_object_get(root, "offer_audio");
 				json_t *offer_video = json_object_get(root, "offer_video");
 				json_t *offer_data = json_object_get(root, "offer_data");
+				json_t *auto_layers = json_object_get(root, "auto_layers");
 				janus_videoroom_publisher *owner = NULL;
-				janus_videoroom_publisher *publisher = g_hash_table_lookup(videoroom->participants, &feed_id);
+				janus_videoroom_publisher *publisher = NULL;
+				if(speaker != NULL) {
+					/* Start from whoever is there at this rank right now */
+					publisher = janus_videoroom_speakers_pick(videoroom, json_integer_value(speaker), pvt_id, NULL);
+					if(publisher == NULL) {
+						JANUS_LOG(LOG_ERR, "No speaker at rank %"SCNu64"\n", (guint64)json_integer_value(speaker));
+						error_code = JANUS_VIDEOROOM_ERROR_NO_SUCH_FEED;
+						g_snprintf(error_cause, 512, "No speaker at rank %"SCNu64, (guint64)json_integer_value(speaker));
+						janus_mutex_unlock(&videoroom->mutex);
+						goto error;
+					}
+					feed_id = publisher->user_id;
+				} else {
+					publisher = g_hash_table_lookup(videoroom->participants, &feed_id);
+				}
 				if(publisher == NULL || g_atomic_int_get(&publisher->destroyed) || publisher->sdp == NULL) {
 					JANUS_LOG(LOG_ERR, "No such feed (%"SCNu64")\n", feed_id);
 					error_code = JANUS_VIDEOROOM_ERROR_NO_SUCH_FEED;
@@ -4638,6 +6771,7 @@ static void *janus_videoroom_handler(void *data) {
 					subscriber->feed = publisher;
 					subscriber->pvt_id = pvt_id;
 					subscriber->close_pc = close_pc;
+					subscriber->fanout_worker = (guint)g_atomic_int_add(&fanout_next_worker, 1);
 					/* Initialize the subscriber context */
 					janus_rtp_switching_context_reset(&subscriber->context);
 					subscriber->audio_offered = offer_audio ? json_is_true(offer_audio) : TRUE;	/* True by default */
@@ -4672,6 +6806,10 @@ static void *janus_videoroom_handler(void *data) {
 					subscriber->templayer = -1;
 					subscriber->templayer_target = 2;
 					subscriber->last_relayed = 0;
+					subscriber->auto_layers = auto_layers ? json_is_true(auto_layers) : FALSE;
+					subscriber->speaker = speaker ? json_integer_value(speaker) : -1;
+					subscriber->speaker_acodec = publisher->acodec;
+					subscriber->speaker_vcodec = publisher->vcodec;
 					janus_vp8_simulcast_context_reset(&subscriber->simulcast_context);
 					if(subscriber->room->do_svc) {
 						/* This subscriber belongs to a room where VP9 SVC has been enabled,
@@ -4682,9 +6820,19 @@ static void *janus_videoroom_handler(void *data) {
 						subscriber->target_temporal_layer = 2;	/* FIXME Chrome sends 0, 1 and 2 */
 					}
 					session->participant = subscriber;
+					/* Keep the participants of the same room on the same NUMA node */
+					char group[64];
+					g_snprintf(group, sizeof(group), "videoroom-%"SCNu64, subscriber->room_id);
+					gateway->set_affinity_group(session->handle, group);
 					janus_mutex_lock(&publisher->subscribers_mutex);
-					publisher->subscribers = g_slist_append(publisher->subscribers, subscriber);
+					janus_videoroom_publisher_add_subscriber(publisher, subscriber);
 					janus_mutex_unlock(&publisher->subscribers_mutex);
+					if(subscriber->speaker >= 0) {
+						/* From now on, speaker changes will switch this subscriber too */
+						janus_mutex_lock(&subscriber->room->mutex);
+						subscriber->room->speaker_subscribers = g_slist_append(subscriber->room->speaker_subscribers, subscriber);
+						janus_mutex_unlock(&subscriber->room->mutex);
+					}
 					if(owner != NULL) {
 						/* Note: we should refcount these subscription-publisher mappings as well */
 						janus_mutex_lock(&owner->subscribers_mutex);
@@ -4697,32 +6845,25 @@ static void *janus_videoroom_handler(void *data) {
 					json_object_set_new(event, "id", json_integer(feed_id));
 					if(publisher->display)
 						json_object_set_new(event, "display", json_string(publisher->display));
+					if(subscriber->speaker >= 0)
+						json_object_set_new(event, "speaker", json_integer(subscriber->speaker));
 					if(legacy)
 						json_object_set_new(event, "warning", json_string("Deprecated use of 'listener' ptype, update to the new 'subscriber' ASAP"));
 					session->participant_type = janus_videoroom_p_type_subscriber;
 					JANUS_LOG(LOG_VERB, "Preparing JSON event as a reply\n");
 					/* Negotiate by sending the selected publisher SDP back */
 					janus_mutex_lock(&publisher->subscribers_mutex);
-					if(publisher->sdp != NULL) {
-						/* Check if there's something the original SDP has that we should remove */
-						janus_sdp *offer = janus_sdp_parse(publisher->sdp, NULL, 0);
-						subscriber->sdp = offer;
+					/* Check if there's something the original SDP has that we should remove:
+					 * the munged offer is cached, so we don't parse it again for each subscriber */
+					const char *sdp = janus_videoroom_publisher_sdp_offer(publisher,
+						subscriber->audio_offered, subscriber->video_offered, subscriber->data_offered);
+					if(sdp != NULL) {
 						session->sdp_version = 1;
-						subscriber->sdp->o_version = session->sdp_version;
-						if((publisher->audio && !subscriber->audio_offered) ||
-								(publisher->video && !subscriber->video_offered) ||
-								(publisher->data && !subscriber->data_offered)) {
-							JANUS_LOG(LOG_VERB, "Munging SDP offer to adapt it to the subscriber's requirements\n");
-							if(publisher->audio && !subscriber->audio_offered)
-								janus_sdp_mline_remove(offer, JANUS_SDP_AUDIO);
-							if(publisher->video && !subscriber->video_offered)
-								janus_sdp_mline_remove(offer, JANUS_SDP_VIDEO);
-							if(publisher->data && !subscriber->data_offered)
-								janus_sdp_mline_remove(offer, JANUS_SDP_APPLICATION);
-						}
-						char* sdp = janus_sdp_write(offer);
+						janus_sdp_destroy(subscriber->sdp);
+						subscriber->sdp = NULL;
+						g_free(subscriber->sdp_offer);
+						subscriber->sdp_offer = g_strdup(sdp);
 						json_t *jsep = json_pack("{ssss}", "type", "offer", "sdp", sdp);
-						g_free(sdp);
 						janus_mutex_unlock(&publisher->subscribers_mutex);
 						/* How long will the gateway take to push the event? */
 						g_atomic_int_set(&session->hangingup, 0);
@@ -4805,8 +6946,18 @@ static void *janus_videoroom_handler(void *data) {
 				json_t *bitrate = json_object_get(root, "bitrate");
 				json_t *record = json_object_get(root, "record");
 				json_t *recfile = json_object_get(root, "filename");
+				json_t *record_substreams = json_object_get(root, "record_substreams");
 				json_t *display = json_object_get(root, "display");
 				json_t *update = json_object_get(root, "update");
+				int substreams = janus_videoroom_record_substreams_from_name(
+					record_substreams ? json_string_value(record_substreams) : NULL);
+				if(substreams < 0) {
+					JANUS_LOG(LOG_ERR, "Invalid value for record_substreams: %s\n", json_string_value(record_substreams));
+					janus_refcount_decrease(&participant->ref);
+					error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+					g_snprintf(error_cause, 512, "Invalid value for record_substreams (should be base, highest or all)");
+					goto error;
+				}
 				if(audio) {
 					gboolean audio_active = json_is_true(audio);
 					if(session->started && audio_active && !participant->audio_active) {
@@ -4902,8 +7053,24 @@ static void *janus_videoroom_handler(void *data) {
 					participant->recording_base = g_strdup(json_string_value(recfile));
 					JANUS_LOG(LOG_VERB, "Setting recording basename: %s (room %"SCNu64", user %"SCNu64")\n", participant->recording_base, participant->room_id, participant->user_id);
 				}
+				gboolean substreams_changed = FALSE;
+				if(record_substreams && (int)participant->record_substreams != substreams) {
+					participant->record_substreams = substreams;
+					substreams_changed = TRUE;
+					JANUS_LOG(LOG_VERB, "Setting recorded substreams: %s (room %"SCNu64", user %"SCNu64")\n",
+						json_string_value(record_substreams), participant->room_id, participant->user_id);
+				}
 				/* Do we need to do something with the recordings right now? */
-				if(participant->recording_active != prev_recording_active) {
+				if(substreams_changed && participant->recording_active && prev_recording_active &&
+						participant->sdp && participant->ssrc[0] != 0) {
+					/* Different substreams should be recorded: new layers go in new files */
+					janus_videoroom_recorder_close(participant);
+					janus_videoroom_recorder_create(
+						participant, strstr(participant->sdp, "m=audio") != NULL,
+						strstr(participant->sdp, "m=video") != NULL,
+						strstr(participant->sdp, "m=application") != NULL);
+					janus_videoroom_reqfir(participant, "Recording video");
+				} else if(participant->recording_active != prev_recording_active) {
 					/* Something changed */
 					if(!participant->recording_active) {
 						/* Not recording (anymore?) */
@@ -4963,6 +7130,15 @@ static void *janus_videoroom_handler(void *data) {
 							json_object_set_new(recording, "audio", json_string(participant->arc->filename));
 						if(participant->vrc && participant->vrc->filename)
 							json_object_set_new(recording, "video", json_string(participant->vrc->filename));
+						if(participant->vrc_sc[0] || participant->vrc_sc[1]) {
+							json_t *substreams = json_array();
+							int i = 0;
+							for(i=0; i<2; i++) {
+								if(participant->vrc_sc[i] && participant->vrc_sc[i]->filename)
+									json_array_append_new(substreams, json_string(participant->vrc_sc[i]->filename));
+							}
+							json_object_set_new(recording, "video_substreams", substreams);
+						}
 						if(participant->drc && participant->drc->filename)
 							json_object_set_new(recording, "data", json_string(participant->drc->filename));
 						json_object_set_new(info, "recording", recording);
@@ -5030,7 +7206,10 @@ static void *janus_videoroom_handler(void *data) {
 				goto error;
 			} else if(!strcasecmp(request_text, "start")) {
 				/* Start/restart receiving the publisher streams */
+				gboolean was_paused = subscriber->paused;
 				subscriber->paused = FALSE;
+				if(was_paused && session->started)
+					janus_videoroom_gop_replay(subscriber);
 				event = json_object();
 				json_object_set_new(event, "videoroom", json_string("event"));
 				json_object_set_new(event, "room", json_integer(subscriber->room_id));
@@ -5055,6 +7234,7 @@ static void *janus_videoroom_handler(void *data) {
 				json_t *spatial = json_object_get(root, "spatial_layer");
 				json_t *temporal = json_object_get(root, "temporal_layer");
 				json_t *sc_substream = json_object_get(root, "substream");
+				json_t *auto_layers = json_object_get(root, "auto_layers");
 				if(json_integer_value(sc_substream) > 2) {
 					JANUS_LOG(LOG_ERR, "Invalid element (substream should be 0, 1 or 2)\n");
 					error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
@@ -5077,7 +7257,7 @@ static void *janus_videoroom_handler(void *data) {
 						subscriber->video = json_is_true(video);
 						if(subscriber->video) {
 							/* Send a FIR */
-							janus_videoroom_reqfir(publisher, "Restoring video for subscriber");
+							janus_videoroom_reqfir_subscriber(publisher, "Restoring video for subscriber");
 						}
 					}
 					if(data && publisher->data && subscriber->data_offered)
@@ -5097,7 +7277,7 @@ static void *janus_videoroom_handler(void *data) {
 							json_decref(event);
 						} else {
 							/* Send a FIR */
-							janus_videoroom_reqfir(publisher, "Simulcasting substream change");
+							janus_videoroom_reqfir_subscriber(publisher, "Simulcasting substream change");
 						}
 					}
 					if(sc_temporal && publisher->ssrc[0] != 0) {
@@ -5114,10 +7294,18 @@ static void *janus_videoroom_handler(void *data) {
 							json_decref(event);
 						} else {
 							/* Send a FIR */
-							janus_videoroom_reqfir(publisher, "Simulcasting temporal layer change");
+							janus_videoroom_reqfir_subscriber(publisher, "Simulcasting temporal layer change");
 						}
 					}
 				}
+				if(auto_layers) {
+					subscriber->auto_layers = json_is_true(auto_layers);
+					subscriber->bwe = 0;
+					subscriber->bwe_latest = 0;
+				} else if(sc_substream || sc_temporal || spatial || temporal) {
+					/* Asking for specific substreams/layers disables the automatic selection */
+					subscriber->auto_layers = FALSE;
+				}
 				if(subscriber->room->do_svc) {
 					/* Also check if the viewer is trying to configure a layer change */
 					if(spatial) {
@@ -5135,7 +7323,7 @@ static void *janus_videoroom_handler(void *data) {
 							json_decref(event);
 						} else if(spatial_layer != subscriber->target_spatial_layer) {
 							/* Send a FIR to the new RTP forward publisher */
-							janus_videoroom_reqfir(publisher, "Need to downscale spatially");
+							janus_videoroom_reqfir_subscriber(publisher, "Need to downscale spatially");
 						}
 						subscriber->target_spatial_layer = spatial_layer;
 					}
@@ -5168,13 +7356,21 @@ static void *janus_videoroom_handler(void *data) {
 					if(publisher->sdp != NULL) {
 						char temp_error[512];
 						JANUS_LOG(LOG_VERB, "Munging SDP offer (update) to adapt it to the subscriber's requirements\n");
-						janus_sdp *offer = janus_sdp_parse(publisher->sdp, temp_error, sizeof(temp_error));
+						janus_sdp *offer = janus_sdp_parse_transient(publisher->sdp, temp_error, sizeof(temp_error));
 						if(publisher->audio && !subscriber->audio_offered)
 							janus_sdp_mline_remove(offer, JANUS_SDP_AUDIO);
 						if(publisher->video && !subscriber->video_offered)
 							janus_sdp_mline_remove(offer, JANUS_SDP_VIDEO);
 						if(publisher->data && !subscriber->data_offered)
 							janus_sdp_mline_remove(offer, JANUS_SDP_APPLICATION);
+						/* This is an update: if we never touched the offer we sent when joining, parse it now */
+						if(subscriber->sdp == NULL && subscriber->sdp_offer != NULL) {
+							subscriber->sdp = janus_sdp_parse(subscriber->sdp_offer, temp_error, sizeof(temp_error));
+							g_free(subscriber->sdp_offer);
+							subscriber->sdp_offer = NULL;
+						}
+						if(subscriber->sdp == NULL)
+							subscriber->sdp = janus_sdp_new(NULL, NULL);
 						/* This is an update, check if we need to update */
 						janus_sdp_mtype mtype[3] = { JANUS_SDP_AUDIO, JANUS_SDP_VIDEO, JANUS_SDP_APPLICATION };
 						int i=0;
@@ -5202,16 +7398,15 @@ static void *janus_videoroom_handler(void *data) {
 									/* Copy/replace the other properties */
 									m->c_ipv4 = m_new->c_ipv4;
 									if(m_new->c_addr && (m->c_addr == NULL || strcmp(m->c_addr, m_new->c_addr))) {
-										g_free(m->c_addr);
+										janus_sdp_arena_free_string(m->arena, m->c_addr);
 										m->c_addr = g_strdup(m_new->c_addr);
 									}
 									if(m_new->b_name && (m->b_name == NULL || strcmp(m->b_name, m_new->b_name))) {
-										g_free(m->b_name);
+										janus_sdp_arena_free_string(m->arena, m->b_name);
 										m->b_name = g_strdup(m_new->b_name);
 									}
 									m->b_value = m_new->b_value;
-									g_list_free_full(m->fmts, (GDestroyNotify)g_free);
-									m->fmts = NULL;
+									janus_sdp_mline_free_fmts(m);
 									GList *fmts = m_new->fmts;
 									while(fmts) {
 										char *fmt = (char *)fmts->data;
@@ -5272,6 +7467,12 @@ static void *janus_videoroom_handler(void *data) {
 				if(error_code != 0)
 					goto error;
 				json_t *feed = json_object_get(root, "feed");
+				if(feed == NULL) {
+					JANUS_LOG(LOG_ERR, "Missing element (feed)\n");
+					error_code = JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT;
+					g_snprintf(error_cause, 512, "Missing element (feed)");
+					goto error;
+				}
 				guint64 feed_id = json_integer_value(feed);
 				json_t *audio = json_object_get(root, "audio");
 				json_t *video = json_object_get(root, "video");
@@ -5297,57 +7498,31 @@ static void *janus_videoroom_handler(void *data) {
 					janus_mutex_unlock(&subscriber->room->mutex);
 					goto error;
 				}
-				janus_refcount_increase(&publisher->ref);
-				janus_refcount_increase(&publisher->session->ref);
-				janus_mutex_unlock(&subscriber->room->mutex);
-				gboolean paused = subscriber->paused;
-				subscriber->paused = TRUE;
-				/* Unsubscribe from the previous publisher */
+				/* Make sure the codecs are compliant first */
 				janus_videoroom_publisher *prev_feed = subscriber->feed;
-				if(prev_feed) {
-					/* ... but make sure the codecs are compliant first */
-					if(publisher->acodec != prev_feed->acodec || publisher->vcodec != prev_feed->vcodec) {
-						janus_refcount_decrease(&publisher->session->ref);
-						janus_refcount_decrease(&publisher->ref);
-						subscriber->paused = paused;
-						JANUS_LOG(LOG_ERR, "The two publishers are not using the same codecs, can't switch\n");
-						error_code = JANUS_VIDEOROOM_ERROR_INVALID_SDP;
-						g_snprintf(error_cause, 512, "The two publishers are not using the same codecs, can't switch");
-						goto error;
-					}
-					/* Go on */
-					janus_mutex_lock(&prev_feed->subscribers_mutex);
-					prev_feed->subscribers = g_slist_remove(prev_feed->subscribers, subscriber);
-					janus_mutex_unlock(&prev_feed->subscribers_mutex);
-					janus_refcount_decrease(&prev_feed->session->ref);
-					g_clear_pointer(&subscriber->feed, janus_videoroom_publisher_dereference);
+				if((prev_feed && (publisher->acodec != prev_feed->acodec || publisher->vcodec != prev_feed->vcodec)) ||
+						(prev_feed == NULL && subscriber->speaker >= 0 &&
+						(publisher->acodec != subscriber->speaker_acodec || publisher->vcodec != subscriber->speaker_vcodec))) {
+					janus_mutex_unlock(&subscriber->room->mutex);
+					JANUS_LOG(LOG_ERR, "The two publishers are not using the same codecs, can't switch\n");
+					error_code = JANUS_VIDEOROOM_ERROR_INVALID_SDP;
+					g_snprintf(error_cause, 512, "The two publishers are not using the same codecs, can't switch");
+					goto error;
+				}
+				if(subscriber->speaker >= 0) {
+					/* A specific feed was asked for, stop following speakers */
+					subscriber->room->speaker_subscribers = g_slist_remove(subscriber->room->speaker_subscribers, subscriber);
+					subscriber->speaker = -1;
 				}
 				/* Subscribe to the new one */
+				janus_refcount_increase(&publisher->ref);
+				janus_refcount_increase(&publisher->session->ref);
 				subscriber->audio = audio ? json_is_true(audio) : TRUE;	/* True by default */
-				if(!publisher->audio)
-					subscriber->audio = FALSE;	/* ... unless the publisher isn't sending any audio */
 				subscriber->video = video ? json_is_true(video) : TRUE;	/* True by default */
-				if(!publisher->video)
-					subscriber->video = FALSE;	/* ... unless the publisher isn't sending any video */
 				subscriber->data = data ? json_is_true(data) : TRUE;	/* True by default */
-				if(!publisher->data)
-					subscriber->data = FALSE;	/* ... unless the publisher isn't sending any data */
-				if(subscriber->room && subscriber->room->do_svc) {
-					/* This subscriber belongs to a room where VP9 SVC has been enabled,
-					 * let's assume we're interested in all layers for the time being */
-					subscriber->spatial_layer = -1;
-					subscriber->target_spatial_layer = 1;		/* FIXME Chrome sends 0 and 1 */
-					subscriber->temporal_layer = -1;
-					subscriber->target_temporal_layer = 2;	/* FIXME Chrome sends 0, 1 and 2 */
-				}
-				janus_mutex_lock(&publisher->subscribers_mutex);
-				publisher->subscribers = g_slist_append(publisher->subscribers, subscriber);
-				janus_mutex_unlock(&publisher->subscribers_mutex);
-				subscriber->feed = publisher;
-				/* Send a FIR to the new publisher */
-				janus_videoroom_reqfir(publisher, "Switching existing subscriber to new publisher");
+				janus_videoroom_subscriber_switch(subscriber, publisher);
+				janus_mutex_unlock(&subscriber->room->mutex);
 				/* Done */
-				subscriber->paused = paused;
 				event = json_object();
 				json_object_set_new(event, "videoroom", json_string("event"));
 				json_object_set_new(event, "switched", json_string("ok"));
@@ -5355,14 +7530,6 @@ static void *janus_videoroom_handler(void *data) {
 				json_object_set_new(event, "id", json_integer(feed_id));
 				if(publisher->display)
 					json_object_set_new(event, "display", json_string(publisher->display));
-				/* Also notify event handlers */
-				if(notify_events && gateway->events_is_enabled()) {
-					json_t *info = json_object();
-					json_object_set_new(info, "event", json_string("switched"));
-					json_object_set_new(info, "room", json_integer(publisher->room_id));
-					json_object_set_new(info, "feed", json_integer(publisher->user_id));
-					gateway->notify_event(&janus_videoroom_plugin, session->handle, info);
-				}
 			} else if(!strcasecmp(request_text, "leave")) {
 				guint64 room_id = subscriber ? subscriber->room_id : 0;
 				/* Tell the core to tear down the PeerConnection, hangup_media will do the rest */
@@ -5561,7 +7728,7 @@ static void *janus_videoroom_handler(void *data) {
 					JANUS_SDP_OA_DONE);
 				janus_sdp_destroy(offer);
 				/* Replace the session name */
-				g_free(answer->s_name);
+				janus_sdp_arena_free_string(answer->arena, answer->s_name);
 				char s_name[100];
 				g_snprintf(s_name, sizeof(s_name), "VideoRoom %"SCNu64, videoroom->room_id);
 				answer->s_name = g_strdup(s_name);
@@ -5705,12 +7872,8 @@ static void *janus_videoroom_handler(void *data) {
 				/* Generate an SDP string we can offer subscribers later on */
 				char *offer_sdp = janus_sdp_write(offer);
 				if(!sdp_update) {
-					/* Is this room recorded? */
 					janus_mutex_lock(&participant->rec_mutex);
-					if(videoroom->record || participant->recording_active) {
-						janus_videoroom_recorder_create(participant, participant->audio, participant->video, participant->data);
-					}
-					/* Is simulcasting involved */
+					/* Is simulcasting involved (we need to know before creating the recorders) */
 					if(msg_simulcast && participant->vcodec == JANUS_VIDEOCODEC_VP8) {
 						JANUS_LOG(LOG_VERB, "Publisher is going to do simulcasting\n");
 						participant->ssrc[0] = json_integer_value(json_object_get(msg_simulcast, "ssrc-0"));
@@ -5722,6 +7885,10 @@ static void *janus_videoroom_handler(void *data) {
 						participant->ssrc[1] = 0;
 						participant->ssrc[2] = 0;
 					}
+					/* Is this room recorded? */
+					if(videoroom->record || participant->recording_active) {
+						janus_videoroom_recorder_create(participant, participant->audio, participant->video, participant->data);
+					}
 					janus_mutex_unlock(&participant->rec_mutex);
 				}
 				janus_sdp_destroy(offer);
@@ -5741,8 +7908,11 @@ static void *janus_videoroom_handler(void *data) {
 					g_free(offer_sdp);
 				} else {
 					/* Store the participant's SDP for interested subscribers */
+					janus_mutex_lock(&participant->subscribers_mutex);
 					g_free(participant->sdp);
 					participant->sdp = offer_sdp;
+					janus_videoroom_publisher_sdp_reset(participant);
+					janus_mutex_unlock(&participant->subscribers_mutex);
 					/* We'll wait for the setup_media event before actually telling subscribers */
 				}
 				/* Unless this is an update, in which case schedule a new offer for all viewers */
@@ -5797,6 +7967,27 @@ error:
 	return NULL;
 }
 
+/* Helper to relay the shared copy of a packet to a subscriber: the header of our
+ * own copy has already been updated for this subscriber, so we use that as the override */
+static void janus_videoroom_relay_shared_rtp(janus_videoroom_session *session, janus_videoroom_rtp_relay_packet *packet,
+		char *payload, int payload_len) {
+	if(gateway == NULL)
+		return;
+	if(packet->shared == NULL) {
+		gateway->relay_rtp(session->handle, packet->is_video, (char *)packet->data, packet->length);
+		return;
+	}
+	janus_plugin_rtp_override override;
+	janus_plugin_rtp_override_from_header(&override, (char *)packet->data, packet->length);
+	if(payload != NULL && payload_len > 0 && payload_len <= JANUS_PLUGIN_RTP_OVERRIDE_PAYLOAD) {
+		/* Some payload bytes were changed for this subscriber as well */
+		override.payload_offset = 0;
+		override.payload_len = payload_len;
+		memcpy(override.payload, payload, payload_len);
+	}
+	gateway->relay_rtp_shared(session->handle, packet->is_video, packet->shared, &override);
+}
+
 /* Helper to quickly relay RTP packets from publishers to subscribers */
 static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data) {
 	janus_videoroom_rtp_relay_packet *packet = (janus_videoroom_rtp_relay_packet *)user_data;
@@ -5872,7 +8063,7 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 			if(temporal_layer < packet->temporal_layer) {
 				/* Drop the packet: update the context to make sure sequence number is increased normally later */
 				JANUS_LOG(LOG_HUGE, "Dropping packet (temporal layer %d < %d)\n", temporal_layer, packet->temporal_layer);
-				subscriber->context.v_base_seq++;
+				janus_rtp_switching_context_skip(&subscriber->context, TRUE);
 				return;
 			}
 			int spatial_layer = subscriber->spatial_layer;
@@ -5911,7 +8102,7 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 			if(spatial_layer < packet->spatial_layer) {
 				/* Drop the packet: update the context to make sure sequence number is increased normally later */
 				JANUS_LOG(LOG_HUGE, "Dropping packet (spatial layer %d < %d)\n", spatial_layer, packet->spatial_layer);
-				subscriber->context.v_base_seq++;
+				janus_rtp_switching_context_skip(&subscriber->context, TRUE);
 				return;
 			} else if(packet->ebit && spatial_layer == packet->spatial_layer) {
 				/* If we stop at layer 0, we need a marker bit now, as the one from layer 1 will not be received */
@@ -5922,12 +8113,12 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 			JANUS_LOG(LOG_HUGE, "Sending packet (spatial=%d, temporal=%d)\n",
 				packet->spatial_layer, packet->temporal_layer);
 			/* Fix sequence number and timestamp (publisher switching may be involved) */
-			janus_rtp_header_update(packet->data, &subscriber->context, TRUE, 4500);
+			janus_rtp_header_rewrite(packet->data, &subscriber->context, TRUE,
+				packet->timestamp, packet->seq_number, packet->received);
 			if(override_mark_bit && !has_marker_bit) {
 				packet->data->markerbit = 1;
 			}
-			if(gateway != NULL)
-				gateway->relay_rtp(session->handle, packet->is_video, (char *)packet->data, packet->length);
+			janus_videoroom_relay_shared_rtp(session, packet, NULL, 0);
 			if(override_mark_bit && !has_marker_bit) {
 				packet->data->markerbit = 0;
 			}
@@ -5981,12 +8172,15 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 						JANUS_LOG(LOG_WARN, "No packet received on substream %d for a while, falling back to %d\n",
 							subscriber->substream, substream);
 						subscriber->substream = substream;
-						/* Send a PLI */
-						JANUS_LOG(LOG_VERB, "Just (re-)enabled video, sending a PLI to recover it\n");
-						char rtcpbuf[12];
-						memset(rtcpbuf, 0, 12);
-						janus_rtcp_pli((char *)&rtcpbuf, 12);
-						if(subscriber->feed && subscriber->feed->session && subscriber->feed->session->handle) {
+						/* Send a PLI, unless the publisher was asked for a keyframe recently enough */
+						if(subscriber->feed && subscriber->feed->remote) {
+							janus_videoroom_reqfir_subscriber(subscriber->feed, "Simulcast substream fallback");
+						} else if(subscriber->feed && subscriber->feed->session && subscriber->feed->session->handle &&
+								!janus_videoroom_keyframe_suppress(subscriber->feed)) {
+							JANUS_LOG(LOG_VERB, "Just (re-)enabled video, sending a PLI to recover it\n");
+							char rtcpbuf[12];
+							memset(rtcpbuf, 0, 12);
+							janus_rtcp_pli((char *)&rtcpbuf, 12);
 							gateway->relay_rtcp(subscriber->feed->session->handle, 1, rtcpbuf, 12);
 							/* Update the time of when we last sent a keyframe request */
 							subscriber->feed->fir_latest = janus_get_monotonic_time();
@@ -6013,7 +8207,18 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 			uint8_t tid = 0;
 			uint8_t ybit = 0;
 			uint8_t keyidx = 0;
-			if(janus_vp8_parse_descriptor(payload, plen, &picid, &tlzi, &tid, &ybit, &keyidx) == 0) {
+			int res = 0;
+			if(packet->media != NULL && packet->media->codec == JANUS_VIDEOCODEC_VP8 && packet->media->vp8_descriptor) {
+				/* The core parsed the descriptor already */
+				picid = packet->media->vp8_picid;
+				tlzi = packet->media->vp8_tl0picidx;
+				tid = packet->media->vp8_tid;
+				ybit = packet->media->vp8_y;
+				keyidx = packet->media->vp8_keyidx;
+			} else {
+				res = janus_vp8_parse_descriptor(payload, plen, &picid, &tlzi, &tid, &ybit, &keyidx);
+			}
+			if(res == 0) {
 				//~ JANUS_LOG(LOG_WARN, "%"SCNu16", %u, %u, %u, %u\n", picid, tlzi, tid, ybit, keyidx);
 				if(subscriber->templayer != subscriber->templayer_target) {
 					/* FIXME We should be smarter in deciding when to switch */
@@ -6030,18 +8235,18 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 					JANUS_LOG(LOG_HUGE, "Dropping packet (it's temporal layer %d, but we're capping at %d)\n",
 						tid, subscriber->templayer);
 					/* We increase the base sequence number, or there will be gaps when delivering later */
-					subscriber->context.v_base_seq++;
+					janus_rtp_switching_context_skip(&subscriber->context, TRUE);
 					return;
 				}
 			}
 			/* If we got here, update the RTP header and send the packet */
-			janus_rtp_header_update(packet->data, &subscriber->context, TRUE, 4500);
+			janus_rtp_header_rewrite(packet->data, &subscriber->context, TRUE,
+				packet->timestamp, packet->seq_number, packet->received);
 			char vp8pd[6];
 			memcpy(vp8pd, payload, sizeof(vp8pd));
 			janus_vp8_simulcast_descriptor_update(payload, plen, &subscriber->simulcast_context, switched);
 			/* Send the packet */
-			if(gateway != NULL)
-				gateway->relay_rtp(session->handle, packet->is_video, (char *)packet->data, packet->length);
+			janus_videoroom_relay_shared_rtp(session, packet, payload, plen < (int)sizeof(vp8pd) ? plen : (int)sizeof(vp8pd));
 			/* Restore the timestamp and sequence number to what the publisher set them to */
 			packet->data->timestamp = htonl(packet->timestamp);
 			packet->data->seq_number = htons(packet->seq_number);
@@ -6049,10 +8254,10 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 			memcpy(payload, vp8pd, sizeof(vp8pd));
 		} else {
 			/* Fix sequence number and timestamp (publisher switching may be involved) */
-			janus_rtp_header_update(packet->data, &subscriber->context, TRUE, 4500);
+			janus_rtp_header_rewrite(packet->data, &subscriber->context, TRUE,
+				packet->timestamp, packet->seq_number, packet->received);
 			/* Send the packet */
-			if(gateway != NULL)
-				gateway->relay_rtp(session->handle, packet->is_video, (char *)packet->data, packet->length);
+			janus_videoroom_relay_shared_rtp(session, packet, NULL, 0);
 			/* Restore the timestamp and sequence number to what the publisher set them to */
 			packet->data->timestamp = htonl(packet->timestamp);
 			packet->data->seq_number = htons(packet->seq_number);
@@ -6064,10 +8269,10 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 			return;
 		}
 		/* Fix sequence number and timestamp (publisher switching may be involved) */
-		janus_rtp_header_update(packet->data, &subscriber->context, FALSE, 960);
+		janus_rtp_header_rewrite(packet->data, &subscriber->context, FALSE,
+			packet->timestamp, packet->seq_number, packet->received);
 		/* Send the packet */
-		if(gateway != NULL)
-			gateway->relay_rtp(session->handle, packet->is_video, (char *)packet->data, packet->length);
+		janus_videoroom_relay_shared_rtp(session, packet, NULL, 0);
 		/* Restore the timestamp and sequence number to what the publisher set them to */
 		packet->data->timestamp = htonl(packet->timestamp);
 		packet->data->seq_number = htons(packet->seq_number);
@@ -6077,7 +8282,7 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 }
 
 static void janus_videoroom_relay_data_packet(gpointer data, gpointer user_data) {
-	char *text = (char *)user_data;
+	janus_plugin_rtp_shared *message = (janus_plugin_rtp_shared *)user_data;
 	janus_videoroom_subscriber *subscriber = (janus_videoroom_subscriber *)data;
 	if(!subscriber || !subscriber->session || !subscriber->data || subscriber->paused) {
 		return;
@@ -6089,9 +8294,9 @@ static void janus_videoroom_relay_data_packet(gpointer data, gpointer user_data)
 	if(!session->started) {
 		return;
 	}
-	if(gateway != NULL && text != NULL) {
-		JANUS_LOG(LOG_VERB, "Forwarding DataChannel message (%zu bytes) to viewer: %s\n", strlen(text), text);
-		gateway->relay_data(session->handle, text, strlen(text));
+	if(gateway != NULL && message != NULL) {
+		JANUS_LOG(LOG_HUGE, "Forwarding DataChannel message (%d bytes) to viewer\n", message->length);
+		gateway->relay_data_shared(session->handle, message, FALSE);
 	}
 	return;
 }
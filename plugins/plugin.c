@@ -15,6 +15,7 @@
 
 #include "../apierror.h"
 #include "../debug.h"
+#include "../rtp.h"
 
 janus_plugin_result *janus_plugin_result_new(janus_plugin_result_type type, const char *text, json_t *content) {
 	JANUS_LOG(LOG_HUGE, "Creating plugin result...\n");
@@ -38,3 +39,31 @@ void janus_plugin_result_destroy(janus_plugin_result *result) {
 	g_free(result);
 }
 
+static void janus_plugin_rtp_shared_free(const janus_refcount *packet_ref) {
+	janus_plugin_rtp_shared *packet = janus_refcount_containerof(packet_ref, janus_plugin_rtp_shared, ref);
+	g_free(packet->buffer);
+	g_free(packet);
+}
+
+janus_plugin_rtp_shared *janus_plugin_rtp_shared_new(char *buf, int len) {
+	if(buf == NULL || len < 1)
+		return NULL;
+	janus_plugin_rtp_shared *packet = g_malloc(sizeof(janus_plugin_rtp_shared));
+	packet->buffer = g_malloc(len);
+	memcpy(packet->buffer, buf, len);
+	packet->length = len;
+	packet->received = 0;
+	janus_refcount_init(&packet->ref, janus_plugin_rtp_shared_free);
+	return packet;
+}
+
+void janus_plugin_rtp_override_from_header(janus_plugin_rtp_override *override, char *buf, int len) {
+	if(override == NULL || buf == NULL || len < 12)
+		return;
+	janus_rtp_header *header = (janus_rtp_header *)buf;
+	override->seq_number = ntohs(header->seq_number);
+	override->timestamp = ntohl(header->timestamp);
+	override->markerbit = header->markerbit;
+	override->payload_offset = 0;
+	override->payload_len = 0;
+}
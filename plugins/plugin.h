@@ -19,8 +19,18 @@
  * important thing is that it MUST be a JSON object, as it will be included
  * as such within the Janus session/handle protocol;
  * - \c relay_rtp(): to send/relay the peer an RTP packet;
+ * - \c relay_rtp_shared(): to send/relay the peer an RTP packet that is
+ * shared with other peers, without copying it (see janus_plugin_rtp_shared);
  * - \c relay_rtcp(): to send/relay the peer an RTCP message.
  * - \c relay_data(): to send/relay the peer a SCTP DataChannel message.
+ * - \c relay_binary_data(): to send/relay the peer a binary SCTP DataChannel message.
+ * - \c relay_data_shared(): to send/relay the peer a SCTP DataChannel message that is
+ * shared with other peers, without copying it.
+ * - \c data_buffered(): to check how much DataChannel data is waiting to be sent to the peer.
+ * - \c set_affinity_group(): to group handles that share the same media
+ * path (e.g., a room), so that they're placed on the same NUMA node.
+ * - \c admission_check(): to check whether new users (e.g., joining a room)
+ * should be refused, because the instance is too loaded.
  *
  * On the other hand, a plugin that wants to register at the gateway
  * needs to implement the \c janus_plugin interface. Besides, as a
@@ -62,15 +72,19 @@ janus_plugin *create(void) {
  * - \c handle_message(): a callback to notify you the peer sent you a message/request;
  * - \c setup_media(): a callback to notify you the peer PeerConnection is now ready to be used;
  * - \c incoming_rtp(): a callback to notify you a peer has sent you a RTP packet;
+ * - \c incoming_rtp_batch(): a callback to notify you a peer has sent you several RTP packets at once;
+ * - \c incoming_rtp_packet(): a callback to notify you a peer has sent you a RTP packet, with its RTP extensions already parsed;
  * - \c incoming_rtcp(): a callback to notify you a peer has sent you a RTCP message;
  * - \c incoming_data(): a callback to notify you a peer has sent you a message on a SCTP DataChannel;
+ * - \c data_ready(): a callback to notify you the DataChannel data buffered for a peer went below the low watermark;
  * - \c slow_link(): a callback to notify you a peer has sent a lot of NACKs recently, and the media path may be slow;
  * - \c hangup_media(): a callback to notify you the peer PeerConnection has been closed (e.g., after a DTLS alert);
  * - \c query_session(): this method is called by the gateway to get plugin-specific info on a session between you and a peer;
  * - \c destroy_session(): this method is called by the gateway to destroy a session between you and a peer.
  *
  * All the above methods and callbacks, except for \c incoming_rtp ,
- * \c incoming_rtcp , \c incoming_data and \c slow_link , are mandatory:
+ * \c incoming_rtp_batch , \c incoming_rtp_packet , \c incoming_rtcp , \c incoming_data , \c data_ready and
+ * \c slow_link , are mandatory:
  * the Janus core will reject a plugin that doesn't implement any of the
  * mandatory callbacks. The previously mentioned ones, instead, are
  * optional, so you're free to implement only those you care about. If
@@ -158,6 +172,7 @@ janus_plugin *create(void) {
 #include <glib.h>
 
 #include "refcount.h"
+#include "rtp.h"
 
 
 /*! \brief Version of the API, to match the one plugins were compiled against
@@ -169,7 +184,7 @@ janus_plugin *create(void) {
  * gateway or it will crash.
  *
  */
-#define JANUS_PLUGIN_API_VERSION	10
+#define JANUS_PLUGIN_API_VERSION	17
 
 /*! \brief Initialization of all plugin properties to NULL
  *
@@ -201,12 +216,16 @@ static janus_plugin janus_echotest_plugin =
 		.handle_message = NULL,			\
 		.setup_media = NULL,			\
 		.incoming_rtp = NULL,			\
+		.incoming_rtp_batch = NULL,		\
+		.incoming_rtp_packet = NULL,	\
 		.incoming_rtcp = NULL,			\
 		.incoming_data = NULL,			\
+		.data_ready = NULL,				\
 		.slow_link = NULL,				\
 		.hangup_media = NULL,			\
 		.destroy_session = NULL,		\
 		.query_session = NULL, 			\
+		.get_load = NULL,				\
 		## __VA_ARGS__ }
 
 
@@ -222,6 +241,13 @@ typedef struct janus_plugin_result janus_plugin_result;
 /* Use forward declaration to avoid including jansson.h */
 typedef struct json_t json_t;
 
+/*! \brief RTP packet that can be relayed to multiple peers without copying it */
+typedef struct janus_plugin_rtp_shared janus_plugin_rtp_shared;
+/*! \brief Per-peer changes to apply to a janus_plugin_rtp_shared packet */
+typedef struct janus_plugin_rtp_override janus_plugin_rtp_override;
+/*! \brief RTP packet passed to plugins as part of a batch */
+typedef struct janus_plugin_rtp_packet janus_plugin_rtp_packet;
+
 /*! \brief Plugin-Gateway session mapping */
 struct janus_plugin_session {
 	/*! \brief Opaque pointer to the gateway core-level handle */
@@ -331,6 +357,33 @@ struct janus_plugin {
 	 * @returns A json_t object with the requested info */
 	json_t *(* const query_session)(janus_plugin_session *handle);
 
+	/*! \brief Method to handle several incoming RTP packets from a peer at once
+	 * \note This is only used when batched ingress is enabled in the core: plugins
+	 * that don't implement it get the packets one by one via incoming_rtp instead
+	 * @param[in] handle The plugin/gateway session used for this peer
+	 * @param[in] packets The packets, in the order they were received
+	 * @param[in] count The number of packets in the batch */
+	void (* const incoming_rtp_batch)(janus_plugin_session *handle, janus_plugin_rtp_packet *packets, int count);
+	/*! \brief Method to be notified when it's fine to send DataChannel messages to a peer again
+	 * \note This is called when the data buffered for the peer (see data_buffered in
+	 * janus_callbacks) exceeded the high watermark, and then went below the low one: plugins
+	 * that relay a lot of data can use it to pause sending in the meanwhile
+	 * @param[in] handle The plugin/gateway session used for this peer */
+	void (* const data_ready)(janus_plugin_session *handle);
+	/*! \brief Method to get how loaded the plugin is, as part of the load score of the core
+	 * \note This is optional, and is called by the core once per second: plugins
+	 * that have resources of their own that may saturate before the rest of the
+	 * instance does (e.g., the AudioBridge mixers) should implement it
+	 * @returns How loaded the plugin is, from 0 (idle) to 100 (saturated) */
+	int (* const get_load)(void);
+	/*! \brief Method to handle an incoming RTP packet from a peer, along with the RTP extensions the core already parsed
+	 * \note If implemented, the core uses this instead of incoming_rtp, so that
+	 * plugins don't need to walk the extensions block again: incoming_rtp must
+	 * still be implemented, though (e.g., for older cores)
+	 * @param[in] handle The plugin/gateway session used for this peer
+	 * @param[in] packet The packet, with its parsed extensions */
+	void (* const incoming_rtp_packet)(janus_plugin_session *handle, janus_plugin_rtp_packet *packet);
+
 };
 
 /*! \brief Callbacks to contact the gateway */
@@ -396,12 +449,140 @@ struct janus_callbacks {
 	 * @param[in] desc The descriptor to search for
 	 * @returns TRUE if the token is valid, not expired and contains the descriptor, FALSE otherwise */
 	gboolean (* const auth_signature_contains)(janus_plugin *plugin, const char *token, const char *descriptor);
+
+	/*! \brief Callback to relay an RTP packet shared by multiple peers (e.g., all the
+	 * subscribers of the same publisher), as an alternative to relay_rtp
+	 * \note The core only takes a reference to the packet, and copies it
+	 * right before encrypting it, applying the provided override: this
+	 * means the plugin MUST NOT modify the packet after relaying it
+	 * @param[in] handle The plugin/gateway session used for this peer
+	 * @param[in] video Whether this is an audio or a video frame
+	 * @param[in] packet The refcounted packet to relay
+	 * @param[in] override The header changes specific to this peer (copied by the core, may be NULL) */
+	void (* const relay_rtp_shared)(janus_plugin_session *handle, int video, janus_plugin_rtp_shared *packet, janus_plugin_rtp_override *override);
+	/*! \brief Callback to relay binary SCTP/DataChannel messages to a peer
+	 * @param[in] handle The plugin/gateway session that will be used for this peer
+	 * @param[in] buf The message data (buffer)
+	 * @param[in] len The buffer lenght */
+	void (* const relay_binary_data)(janus_plugin_session *handle, char *buf, int len);
+	/*! \brief Callback to check how much SCTP/DataChannel data is waiting to be sent to a peer
+	 * \note This is the equivalent of the bufferedAmount property in the browser: it
+	 * includes what's still queued in the core and what the SCTP stack didn't send
+	 * or get acknowledged yet. If it exceeds the high watermark, the plugin will be
+	 * notified via data_ready when it goes below the low one
+	 * @param[in] handle The plugin/gateway session that will be used for this peer
+	 * @returns The amount of buffered data in bytes, or -1 in case of errors */
+	int (* const data_buffered)(janus_plugin_session *handle);
+	/*! \brief Callback to relay a SCTP/DataChannel message shared by multiple peers (e.g.,
+	 * all the subscribers of the same publisher), as an alternative to relay_data
+	 * \note The message is wrapped in a janus_plugin_rtp_shared instance, even though
+	 * it's not RTP: the core only takes a reference to it, applies no header changes,
+	 * and never copies it, which means the plugin MUST NOT modify it after relaying it
+	 * @param[in] handle The plugin/gateway session that will be used for this peer
+	 * @param[in] packet The refcounted message to relay
+	 * @param[in] binary Whether this should be sent as a binary message or a text one */
+	void (* const relay_data_shared)(janus_plugin_session *handle, janus_plugin_rtp_shared *packet, gboolean binary);
+	/*! \brief Callback to tell the core which affinity group a plugin/gateway session belongs to
+	 * \note If a \c media_cpus policy is configured, handles in the same group
+	 * (e.g., all the participants of a VideoRoom room) are placed on the same NUMA
+	 * node. Only effective if called before media is negotiated for the handle
+	 * @param[in] handle The plugin/gateway session to update
+	 * @param[in] group The affinity group (e.g., "videoroom-1234"), or NULL to reset it */
+	void (* const set_affinity_group)(janus_plugin_session *handle, const char *group);
+	/*! \brief Callback to check whether new users should be admitted, e.g., before they join a room
+	 * \note This always succeeds, unless admission control is enabled in the core and
+	 * the load score reached its threshold: if it fails, the plugin is expected to refuse
+	 * the request (which the core accounts as rejected), e.g., with an error code of its own.
+	 * Like the other callbacks, this is always provided, so plugins can call it unconditionally
+	 * @param[in] plugin The plugin admitting the user
+	 * @returns TRUE if the user can be admitted, FALSE otherwise */
+	gboolean (* const admission_check)(janus_plugin *plugin);
 };
 
 /*! \brief The hook that plugins need to implement to be created from the gateway */
 typedef janus_plugin* create_p(void);
 
 
+/** @name Janus shared RTP packets
+ * @brief Plugins relaying the same RTP packet to many peers (e.g., the
+ * VideoRoom forwarding a publisher to its subscribers) can wrap it in a
+ * janus_plugin_rtp_shared instance once, and then pass it to relay_rtp_shared
+ * for each peer along with a janus_plugin_rtp_override describing the
+ * header changes for that specific peer (sequence number, timestamp,
+ * marker bit and, optionally, a few payload bytes, e.g., to update a
+ * VP8 payload descriptor). This way the core doesn't need to copy the
+ * packet for each peer when queueing it, but only once, when encrypting it.
+ */
+///@{
+/*! \brief Janus shared RTP packet */
+struct janus_plugin_rtp_shared {
+	/*! \brief The packet data (never modified after creation) */
+	char *buffer;
+	/*! \brief The packet length */
+	int length;
+	/*! \brief When the core received the original packet (see janus_plugin_rtp_packet), if known, or 0:
+	 * this is how the end-to-end latency is tracked even when the packet is relayed by another thread */
+	gint64 received;
+	/*! \brief Reference counter for this instance */
+	janus_refcount ref;
+};
+
+/*! \brief Maximum number of payload bytes a janus_plugin_rtp_override can change */
+#define JANUS_PLUGIN_RTP_OVERRIDE_PAYLOAD	8
+/*! \brief Janus per-peer RTP header override */
+struct janus_plugin_rtp_override {
+	/*! \brief Sequence number to use (host order) */
+	uint16_t seq_number;
+	/*! \brief Timestamp to use (host order) */
+	uint32_t timestamp;
+	/*! \brief Marker bit to use, or -1 to leave it as it is */
+	int8_t markerbit;
+	/*! \brief Offset, from the start of the RTP payload, of the bytes to overwrite */
+	int payload_offset;
+	/*! \brief Number of payload bytes to overwrite (0 if none) */
+	int payload_len;
+	/*! \brief The payload bytes to write */
+	char payload[JANUS_PLUGIN_RTP_OVERRIDE_PAYLOAD];
+};
+
+/*! \brief Helper to create a janus_plugin_rtp_shared instance, copying the provided packet
+ * @param[in] buf The packet data to copy
+ * @param[in] len The packet length
+ * @returns A janus_plugin_rtp_shared instance with a single reference, if successful, or NULL otherwise */
+janus_plugin_rtp_shared *janus_plugin_rtp_shared_new(char *buf, int len);
+
+/*! \brief Helper to fill a janus_plugin_rtp_override from an RTP header
+ * \note This is useful when a plugin updated the header of its own copy of the
+ * packet (e.g., with janus_rtp_header_update): the override will contain the
+ * sequence number, timestamp and marker bit of the provided header
+ * @param[in] override The janus_plugin_rtp_override instance to fill
+ * @param[in] buf The RTP packet to take the values from
+ * @param[in] len The RTP packet length */
+void janus_plugin_rtp_override_from_header(janus_plugin_rtp_override *override, char *buf, int len);
+
+/*! \brief Janus incoming RTP packet (e.g., in a batch of incoming packets)
+ * \note The buffers are only valid for the duration of the incoming_rtp_batch
+ * or incoming_rtp_packet call: as with incoming_rtp, plugins can modify them,
+ * but must copy what they need (and the extension offsets are only valid as
+ * long as the RTP header is left untouched). As this is shared with plugins,
+ * new properties must be added at the end, along with a JANUS_PLUGIN_API_VERSION bump */
+struct janus_plugin_rtp_packet {
+	/*! \brief Whether this is an audio or a video packet */
+	int video;
+	/*! \brief The packet data (already decrypted) */
+	char *buffer;
+	/*! \brief The packet length */
+	int length;
+	/*! \brief The RTP extensions in the packet, parsed by the core (see the janus_rtp_ext_info_* helpers) */
+	janus_rtp_ext_info extensions;
+	/*! \brief Codec-specific info on the payload of video packets, parsed by the core (codec is JANUS_VIDEOCODEC_NONE if unavailable) */
+	janus_rtp_media_info media;
+	/*! \brief When the core received the packet, before decrypting it (monotonic time), or 0 if media latency tracking is disabled */
+	gint64 received;
+};
+///@}
+
+
 /** @name Janus plugin results
  * @brief When a client sends a message to a plugin (e.g., a request or a
  * command) this is notified to the plugin through a handle_message()
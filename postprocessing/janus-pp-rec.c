@@ -37,13 +37,72 @@
 \verbatim
 ./janus-pp-rec --header /path/to/source.mjr
 ./janus-pp-rec --parse /path/to/source.mjr
+\endverbatim
+ *
+ * If the recording has a seek index (a \c .mjr.idx file next to it, which
+ * Janus saves when \c recordings_index is enabled), the header summary
+ * includes the duration of the recording and how many keyframes it has.
+ *
+ * By default, all the packets are ordered in memory before processing
+ * them, which for long recordings can take quite a lot of memory. Setting
+ * the \c JANUS_PPREC_STREAM environment variable to a number of packets
+ * (e.g., 500) enables a streaming mode instead: packets are only put back
+ * in order within a window of that size, and are processed as we go, so
+ * that memory stays bounded no matter how long the recording is. Video
+ * recordings are read twice in this mode, since resolution and framerate
+ * must be known before the target file is created, while text data is
+ * always processed the usual way; packets that arrive later than the
+ * window allows for are dropped. In both modes, the tool prints how long
+ * the processing took and the peak memory usage when it's done:
+ *
+\verbatim
+JANUS_PPREC_STREAM=500 ./janus-pp-rec /path/to/source.mjr /path/to/destination.opus
+\endverbatim
+ *
+ * Rather than processing audio and video recordings separately, and then
+ * muxing them with an external tool, you can also ask for an Opus audio
+ * recording to be added as a second track to the .webm (VP8/VP9) or .mp4
+ * (H.264) file generated out of a video recording. Audio and video are
+ * synced using the time the first frame was written to each recording:
+ *
+\verbatim
+./janus-pp-rec --mux /path/to/audio.mjr /path/to/video.mjr /path/to/destination.[webm|mp4]
+\endverbatim
+ *
+ * You can also generate an HLS playlist with fragmented MP4 segments out
+ * of an H.264 recording while it's still being recorded, which means it's
+ * ready to be served as soon as the recording ends: in this live mode, the
+ * tool follows the recording as it grows, and a new segment is added to
+ * the playlist every \c JANUS_PPREC_HLS_TIME seconds (4 by default). The
+ * tool stops when the recording is closed (which it can only tell when the
+ * recorder uses a temporary extension) or when no data was written for
+ * \c JANUS_PPREC_LIVE_TIMEOUT seconds (10 by default):
+ *
+\verbatim
+./janus-pp-rec --live /path/to/source.mjr.tmp /path/to/playlist.m3u8
+\endverbatim
+ *
+ * To process many recordings in one go, you can pass a folder (all the
+ * \c .mjr files in it will be processed) or a manifest (a text file with
+ * the path to a recording per line) in batch mode, along with the folder
+ * to save the processed files to: the target format is chosen automatically
+ * depending on the codec, and recordings are processed in parallel by as
+ * many workers as the \c JANUS_PPREC_WORKERS environment variable says
+ * (by default, one per CPU). For each recording, a JSON summary with the
+ * duration, number of packets and gaps is saved next to the processed
+ * file; you can get the same summary when processing a single recording
+ * by setting the \c JANUS_PPREC_SUMMARY environment variable to the path
+ * to save it to:
+ *
+\verbatim
+JANUS_PPREC_WORKERS=8 ./janus-pp-rec --batch /path/to/recordings /path/to/processed
 \endverbatim
  *
  * \note This utility does not do any form of transcoding. It just
  * depacketizes the RTP frames in order to get the payload, and saves
  * the frames in a valid container. Any further post-processing (e.g.,
- * muxing audio and video belonging to the same media session in a single
- * .webm file) is up to third-party applications.
+ * muxing codecs other than the ones listed above, or mixing different
+ * recordings together) is up to third-party applications.
  * 
  * \ingroup postprocessing
  * \ref postprocessing
@@ -59,14 +118,23 @@
 #include <string.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
 
 #include <glib.h>
 #include <jansson.h>
 
 #include "../debug.h"
 #include "../version.h"
+#include "../record-index.h"
 #include "pp-rtp.h"
 #include "pp-webm.h"
+#include "pp-mux.h"
 #include "pp-h264.h"
 #include "pp-opus.h"
 #include "pp-g711.h"
@@ -85,6 +153,27 @@ static janus_pp_frame_packet *list = NULL, *last = NULL;
 static int working = 0;
 
 static int post_reset_trigger = 200;
+static int stream_window = 0;
+static gint64 start_time = 0;
+
+static int video = 0, data = 0;
+static int opus = 0, g711 = 0, g722 = 0, vp8 = 0, vp9 = 0, h264 = 0;
+
+/* Source recordings mapped in memory (we may have two when muxing) */
+typedef struct janus_pp_source_map {
+	FILE *file;
+	void *map;
+	size_t size;
+} janus_pp_source_map;
+static janus_pp_source_map source_maps[2];
+
+/* Summary of the processing, saved as JSON if JANUS_PPREC_SUMMARY is set */
+static char *summary_path = NULL;
+static char codec_name[16];
+static uint64_t summary_first_ts = 0, summary_last_ts = 0;
+static uint16_t summary_last_seq = 0;
+static uint32_t summary_packets = 0, summary_gaps = 0, summary_lost = 0;
+static uint64_t summary_dropped = 0;
 
 
 /* Signal handler */
@@ -93,300 +182,721 @@ static void janus_pp_handle_signal(int signum) {
 }
 
 
-/* Main Code */
-int main(int argc, char *argv[])
-{
-	janus_log_init(FALSE, TRUE, NULL);
-	atexit(janus_log_destroy);
+/* Create the target file, depending on the codec */
+static int janus_pp_create(char *destination) {
+	if(!video && !data) {
+		if(opus) {
+			if(janus_pp_opus_create(destination) < 0) {
+				JANUS_LOG(LOG_ERR, "Error creating .opus file...\n");
+				return -1;
+			}
+		} else if(g711) {
+			if(janus_pp_g711_create(destination) < 0) {
+				JANUS_LOG(LOG_ERR, "Error creating .wav file...\n");
+				return -1;
+			}
+		} else if(g722) {
+			if(janus_pp_g722_create(destination) < 0) {
+				JANUS_LOG(LOG_ERR, "Error creating .wav file...\n");
+				return -1;
+			}
+		}
+	} else if(data) {
+		if(janus_pp_srt_create(destination) < 0) {
+			JANUS_LOG(LOG_ERR, "Error creating .srt file...\n");
+			return -1;
+		}
+	} else {
+		if(vp8 || vp9) {
+			if(janus_pp_webm_create(destination, vp8) < 0) {
+				JANUS_LOG(LOG_ERR, "Error creating .webm file...\n");
+				return -1;
+			}
+		} else if(h264) {
+			if(janus_pp_h264_create(destination) < 0) {
+				JANUS_LOG(LOG_ERR, "Error creating .mp4 file...\n");
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
 
-	JANUS_LOG(LOG_INFO, "Janus version: %d (%s)\n", janus_version, janus_version_string);
-	JANUS_LOG(LOG_INFO, "Janus commit: %s\n", janus_build_git_sha);
-	JANUS_LOG(LOG_INFO, "Compiled on:  %s\n\n", janus_build_git_time);
+/* Process the ordered packets, depending on the codec */
+static int janus_pp_process(FILE *file, janus_pp_frame_packet *list) {
+	if(!video && !data) {
+		if(opus) {
+			if(janus_pp_opus_process(file, list, &working) < 0) {
+				JANUS_LOG(LOG_ERR, "Error processing Opus RTP frames...\n");
+			}
+		} else if(g711) {
+			if(janus_pp_g711_process(file, list, &working) < 0) {
+				JANUS_LOG(LOG_ERR, "Error processing G.711 RTP frames...\n");
+			}
+		} else if(g722) {
+			if(janus_pp_g722_process(file, list, &working) < 0) {
+				JANUS_LOG(LOG_ERR, "Error processing G.722 RTP frames...\n");
+			}
+		}
+	} else if(data) {
+		if(janus_pp_srt_process(file, list, &working) < 0) {
+			JANUS_LOG(LOG_ERR, "Error processing text data frames...\n");
+		}
+	} else {
+		if(vp8 || vp9) {
+			if(janus_pp_webm_process(file, list, vp8, &working) < 0) {
+				JANUS_LOG(LOG_ERR, "Error processing %s RTP frames...\n", vp8 ? "VP8" : "VP9");
+			}
+		} else {
+			if(janus_pp_h264_process(file, list, &working) < 0) {
+				JANUS_LOG(LOG_ERR, "Error processing H.264 RTP frames...\n");
+			}
+		}
+	}
+	return 0;
+}
 
-	/* Check the JANUS_PPREC_DEBUG environment variable for the debugging level */
-	if(g_getenv("JANUS_PPREC_DEBUG") != NULL) {
-		int val = atoi(g_getenv("JANUS_PPREC_DEBUG"));
-		if(val >= LOG_NONE && val <= LOG_MAX)
-			janus_log_level = val;
-		JANUS_LOG(LOG_INFO, "Logging level: %d\n", janus_log_level);
+/* Close the target file, depending on the codec */
+static void janus_pp_close(void) {
+	if(video) {
+		if(vp8 || vp9) {
+			janus_pp_webm_close();
+		} else {
+			janus_pp_h264_close();
+		}
+	} else if(data) {
+		janus_pp_srt_close();
+	} else {
+		if(opus) {
+			janus_pp_opus_close();
+		} else if(g711) {
+			janus_pp_g711_close();
+		} else if(g722) {
+			janus_pp_g722_close();
+		}
 	}
-	if(g_getenv("JANUS_PPREC_POSTRESETTRIGGER") != NULL) {
-		int val = atoi(g_getenv("JANUS_PPREC_POSTRESETTRIGGER"));
-		if(val >= 0)
-			post_reset_trigger = val;
-		JANUS_LOG(LOG_INFO, "Post reset trigger: %d\n", post_reset_trigger);
+}
+
+/* Print the size of the target file */
+static void janus_pp_destination_size(char *destination) {
+	FILE *file = fopen(destination, "rb");
+	if(file == NULL) {
+		JANUS_LOG(LOG_INFO, "No destination file %s??\n", destination);
+	} else {
+		fseek(file, 0L, SEEK_END);
+		long fsize = ftell(file);
+		fseek(file, 0L, SEEK_SET);
+		JANUS_LOG(LOG_INFO, "%s is %zu bytes\n", destination, fsize);
+		fclose(file);
 	}
-	
-	/* Evaluate arguments */
-	if(argc != 3) {
-		JANUS_LOG(LOG_INFO, "Usage: %s source.mjr destination.[opus|wav|webm|mp4|srt]\n", argv[0]);
-		JANUS_LOG(LOG_INFO, "       %s --header source.mjr (only parse header)\n", argv[0]);
-		JANUS_LOG(LOG_INFO, "       %s --parse source.mjr (only parse and re-order packets)\n", argv[0]);
-		return -1;
+}
+
+/* Print how long the processing took, and how much memory we needed */
+static void janus_pp_report(long fsize, uint32_t count) {
+	gint64 elapsed = g_get_monotonic_time() - start_time;
+	double seconds = elapsed > 0 ? (double)elapsed/G_USEC_PER_SEC : 0.000001;
+	struct rusage usage;
+	long peak = 0;
+	if(getrusage(RUSAGE_SELF, &usage) == 0)
+		peak = usage.ru_maxrss;
+	JANUS_LOG(LOG_INFO, "Processed %ld bytes and %"SCNu32" packets in %.3fs (%.2f MB/s, %.0f packets/s), peak RSS %ld KB\n",
+		fsize, count, seconds, (double)fsize/(1024*1024)/seconds, (double)count/seconds, peak);
+}
+
+/* Open the source recording: we map it in memory and read it through a
+ * memory backed stream, so that the processors can keep on seeking and
+ * reading as they always did, but without a system call for each frame */
+static FILE *janus_pp_source_open(const char *source, long *size) {
+	int fd = open(source, O_RDONLY);
+	if(fd < 0)
+		return NULL;
+	struct stat s;
+	if(fstat(fd, &s) < 0) {
+		close(fd);
+		return NULL;
 	}
-	char *source = NULL, *destination = NULL, *extension = NULL;
-	gboolean header_only = !strcmp(argv[1], "--header");
-	gboolean parse_only = !strcmp(argv[1], "--parse");
-	if(header_only || parse_only) {
-		/* Only parse the .mjr header and/or re-order the packets, no processing */
-		source = argv[2];
-	} else {
-		/* Post-process the .mjr recording */
-		source = argv[1];
-		destination = argv[2];
-		JANUS_LOG(LOG_INFO, "%s --> %s\n", source, destination);
-		/* Check the extension */
-		extension = strrchr(destination, '.');
-		if(extension == NULL) {
-			/* No extension? */
-			JANUS_LOG(LOG_ERR, "No extension? Unsupported target file\n");
-			exit(1);
+	*size = s.st_size;
+	if(s.st_size > 0) {
+		void *map = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(map != MAP_FAILED) {
+			madvise(map, s.st_size, MADV_SEQUENTIAL);
+			FILE *file = fmemopen(map, s.st_size, "rb");
+			if(file != NULL) {
+				close(fd);
+				int i = 0;
+				for(i=0; i<2; i++) {
+					if(source_maps[i].file == NULL) {
+						source_maps[i].file = file;
+						source_maps[i].map = map;
+						source_maps[i].size = s.st_size;
+						break;
+					}
+				}
+				return file;
+			}
+			munmap(map, s.st_size);
 		}
-		if(strcasecmp(extension, ".opus") && strcasecmp(extension, ".wav") &&
-				strcasecmp(extension, ".webm") && strcasecmp(extension, ".mp4") &&
-				strcasecmp(extension, ".srt")) {
-			/* Unsupported extension? */
-			JANUS_LOG(LOG_ERR, "Unsupported extension '%s'\n", extension);
-			exit(1);
+		JANUS_LOG(LOG_WARN, "Couldn't map %s in memory, falling back to regular reads\n", source);
+	}
+	/* Fallback to a regular file */
+	FILE *file = fdopen(fd, "rb");
+	if(file == NULL)
+		close(fd);
+	return file;
+}
+
+static void janus_pp_source_close(FILE *file) {
+	if(file == NULL)
+		return;
+	fclose(file);
+	int i = 0;
+	for(i=0; i<2; i++) {
+		if(source_maps[i].file == file) {
+			munmap(source_maps[i].map, source_maps[i].size);
+			memset(&source_maps[i], 0, sizeof(janus_pp_source_map));
+			break;
 		}
 	}
-	FILE *file = fopen(source, "rb");
-	if(file == NULL) {
-		JANUS_LOG(LOG_ERR, "Could not open file %s\n", source);
-		return -1;
+}
+
+/* Keep track of the ordered packets, for the summary */
+static void janus_pp_summary_add(janus_pp_frame_packet *p) {
+	if(summary_packets == 0)
+		summary_first_ts = p->ts;
+	if(p->ts > summary_last_ts)
+		summary_last_ts = p->ts;
+	if(!data && summary_packets > 0) {
+		uint16_t diff = p->seq - summary_last_seq;
+		if(diff > 1 && diff < 32768) {
+			summary_gaps++;
+			summary_lost += diff-1;
+		}
 	}
-	fseek(file, 0L, SEEK_END);
-	long fsize = ftell(file);
-	fseek(file, 0L, SEEK_SET);
-	JANUS_LOG(LOG_INFO, "File is %zu bytes\n", fsize);
+	summary_last_seq = p->seq;
+	summary_packets++;
+}
 
-	/* Handle SIGINT */
-	working = 1;
-	signal(SIGINT, janus_pp_handle_signal);
+/* Save a JSON summary of the processing, if we were asked to */
+static void janus_pp_summary_write(const char *source, const char *destination, const char *error) {
+	if(summary_path == NULL)
+		return;
+	json_t *summary = json_object();
+	json_object_set_new(summary, "source", json_string(source));
+	if(destination != NULL)
+		json_object_set_new(summary, "destination", json_string(destination));
+	if(error != NULL) {
+		json_object_set_new(summary, "error", json_string(error));
+	} else {
+		/* Data timestamps are in microseconds, RTP ones depend on the codec */
+		int rate = data ? G_USEC_PER_SEC : (video ? 90000 : (opus ? 48000 : 8000));
+		json_object_set_new(summary, "type", json_string(video ? "video" : (data ? "data" : "audio")));
+		json_object_set_new(summary, "codec", json_string(codec_name));
+		json_object_set_new(summary, "packets", json_integer(summary_packets));
+		json_object_set_new(summary, "duration", json_real(summary_packets > 0 ?
+			(double)(summary_last_ts - summary_first_ts)/rate : 0.0));
+		json_object_set_new(summary, "gaps", json_integer(summary_gaps));
+		json_object_set_new(summary, "lost", json_integer(summary_lost));
+		json_object_set_new(summary, "dropped", json_integer(summary_dropped));
+	}
+	if(json_dump_file(summary, summary_path, JSON_INDENT(3) | JSON_PRESERVE_ORDER) < 0)
+		JANUS_LOG(LOG_ERR, "Error saving summary to %s\n", summary_path);
+	json_decref(summary);
+}
 
-	/* Pre-parse */
-	JANUS_LOG(LOG_INFO, "Pre-parsing file to generate ordered index...\n");
-	gboolean parsed_header = FALSE;
-	int video = 0, data = 0;
-	int opus = 0, g711 = 0, g722 = 0, vp8 = 0, vp9 = 0, h264 = 0;
-	gint64 c_time = 0, w_time = 0;
-	int bytes = 0, skip = 0;
-	long offset = 0;
-	uint16_t len = 0;
-	uint32_t count = 0;
-	uint32_t ssrc = 0;
+/* Peek at the info header of a recording, to find out which kind of file we can create */
+static const char *janus_pp_target_extension(const char *source) {
+	FILE *file = fopen(source, "rb");
+	if(file == NULL)
+		return NULL;
+	const char *extension = NULL;
 	char prebuffer[1500];
-	memset(prebuffer, 0, 1500);
-	/* Let's look for timestamp resets first */
-	while(working && offset < fsize) {
-		if(header_only && parsed_header) {
-			/* We only needed to parse the header */
-			exit(0);
+	uint16_t len = 0;
+	if(fread(prebuffer, sizeof(char), 8, file) != 8 || fread(&len, sizeof(uint16_t), 1, file) != 1) {
+		fclose(file);
+		return NULL;
+	}
+	len = ntohs(len);
+	if(prebuffer[1] == 'E' && len == 5) {
+		/* Old .mjr format, either VP8 or Opus */
+		if(fread(prebuffer, sizeof(char), 5, file) == 5)
+			extension = (prebuffer[0] == 'v') ? ".webm" : (prebuffer[0] == 'a' ? ".opus" : NULL);
+	} else if(prebuffer[1] == 'J' && len < sizeof(prebuffer) && fread(prebuffer, sizeof(char), len, file) == len) {
+		prebuffer[len] = '\0';
+		json_t *info = json_loads(prebuffer, 0, NULL);
+		const char *t = json_string_value(json_object_get(info, "t"));
+		const char *c = json_string_value(json_object_get(info, "c"));
+		if(t && c) {
+			if(!strcasecmp(c, "vp8") || !strcasecmp(c, "vp9"))
+				extension = ".webm";
+			else if(!strcasecmp(c, "h264"))
+				extension = ".mp4";
+			else if(!strcasecmp(c, "opus"))
+				extension = ".opus";
+			else if(!strcasecmp(c, "g711") || !strcasecmp(c, "pcmu") || !strcasecmp(c, "pcma") || !strcasecmp(c, "g722"))
+				extension = ".wav";
+			else if(!strcasecmp(t, "d") && !strcasecmp(c, "text"))
+				extension = ".srt";
 		}
-		/* Read frame header */
-		skip = 0;
-		fseek(file, offset, SEEK_SET);
-		bytes = fread(prebuffer, sizeof(char), 8, file);
-		if(bytes != 8 || prebuffer[0] != 'M') {
-			JANUS_LOG(LOG_WARN, "Invalid header at offset %ld (%s), the processing will stop here...\n",
-				offset, bytes != 8 ? "not enough bytes" : "wrong prefix");
+		if(info)
+			json_decref(info);
+	}
+	fclose(file);
+	return extension;
+}
+
+/* Batch mode: we process a list of recordings in parallel, each in its
+ * own process (the processors all rely on static state) */
+typedef struct janus_pp_batch_job {
+	char *source;
+	char *destination;
+	char *summary;
+} janus_pp_batch_job;
+
+static void janus_pp_batch_job_free(janus_pp_batch_job *job) {
+	g_free(job->source);
+	g_free(job->destination);
+	g_free(job->summary);
+	g_free(job);
+}
+
+static void janus_pp_batch_job_done(janus_pp_batch_job *job, const char *error) {
+	if(error == NULL) {
+		JANUS_LOG(LOG_INFO, "[batch] %s --> %s\n", job->source, job->destination);
+		return;
+	}
+	JANUS_LOG(LOG_ERR, "[batch] Error processing %s: %s\n", job->source, error);
+	/* Let's leave a summary for this recording anyway, with the error */
+	summary_path = job->summary;
+	janus_pp_summary_write(job->source, job->destination, error);
+	summary_path = NULL;
+}
+
+static int janus_pp_batch(const char *program, const char *input, const char *output, int workers) {
+	/* Find out which recordings we need to process */
+	GList *sources = NULL;
+	if(g_file_test(input, G_FILE_TEST_IS_DIR)) {
+		GDir *dir = g_dir_open(input, 0, NULL);
+		if(dir == NULL) {
+			JANUS_LOG(LOG_ERR, "Could not open directory %s\n", input);
+			return -1;
+		}
+		const char *name = NULL;
+		while((name = g_dir_read_name(dir)) != NULL) {
+			if(g_str_has_suffix(name, ".mjr"))
+				sources = g_list_prepend(sources, g_build_filename(input, name, NULL));
+		}
+		g_dir_close(dir);
+		sources = g_list_sort(sources, (GCompareFunc)strcmp);
+	} else {
+		/* A manifest, with a recording per line */
+		gchar *content = NULL;
+		if(!g_file_get_contents(input, &content, NULL, NULL)) {
+			JANUS_LOG(LOG_ERR, "Could not read manifest %s\n", input);
+			return -1;
+		}
+		gchar **lines = g_strsplit(content, "\n", -1);
+		int i = 0;
+		for(i=0; lines[i] != NULL; i++) {
+			char *line = g_strstrip(lines[i]);
+			if(*line == '\0' || *line == '#')
+				continue;
+			sources = g_list_append(sources, g_strdup(line));
+		}
+		g_strfreev(lines);
+		g_free(content);
+	}
+	if(g_mkdir_with_parents(output, 0755) < 0) {
+		JANUS_LOG(LOG_ERR, "Could not create output directory %s\n", output);
+		g_list_free_full(sources, (GDestroyNotify)g_free);
+		return -1;
+	}
+	/* We launch ourselves for each recording */
+	char *path = g_find_program_in_path(program);
+	if(path == NULL) {
+		JANUS_LOG(LOG_ERR, "Could not find the path to %s\n", program);
+		g_list_free_full(sources, (GDestroyNotify)g_free);
+		return -1;
+	}
+	guint total = g_list_length(sources), failed = 0;
+	JANUS_LOG(LOG_INFO, "[batch] %u recordings to process, %d workers\n", total, workers);
+	/* Children get the same environment we have, plus where to save the summary */
+	gchar **env = g_get_environ();
+	GHashTable *jobs = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_pp_batch_job_free);
+	GList *next = sources;
+	while(next != NULL || g_hash_table_size(jobs) > 0) {
+		if(working && next != NULL && g_hash_table_size(jobs) < (guint)workers) {
+			const char *source = (const char *)next->data;
+			next = next->next;
+			janus_pp_batch_job *job = g_malloc0(sizeof(janus_pp_batch_job));
+			job->source = g_strdup(source);
+			char *name = g_path_get_basename(source);
+			if(g_str_has_suffix(name, ".mjr"))
+				name[strlen(name)-4] = '\0';
+			const char *extension = janus_pp_target_extension(source);
+			job->destination = g_strdup_printf("%s/%s%s", output, name, extension ? extension : "");
+			job->summary = g_strdup_printf("%s/%s.json", output, name);
+			g_free(name);
+			if(extension == NULL) {
+				janus_pp_batch_job_done(job, "unsupported or invalid recording");
+				janus_pp_batch_job_free(job);
+				failed++;
+				continue;
+			}
+			/* Prepare everything we need before forking */
+			gchar **child_env = g_environ_setenv(g_strdupv(env), "JANUS_PPREC_SUMMARY", job->summary, TRUE);
+			char *args[] = { path, job->source, job->destination, NULL };
+			pid_t pid = fork();
+			if(pid == 0) {
+				execve(path, args, child_env);
+				_exit(127);
+			}
+			g_strfreev(child_env);
+			if(pid < 0) {
+				janus_pp_batch_job_done(job, "couldn't fork");
+				janus_pp_batch_job_free(job);
+				failed++;
+				continue;
+			}
+			g_hash_table_insert(jobs, GINT_TO_POINTER(pid), job);
+			continue;
+		}
+		if(g_hash_table_size(jobs) == 0)
+			break;
+		/* Wait for one of the workers to finish */
+		int status = 0;
+		pid_t pid = waitpid(-1, &status, 0);
+		if(pid < 0) {
+			if(errno == EINTR)
+				continue;
 			break;
 		}
-		if(prebuffer[1] == 'E') {
-			/* Either the old .mjr format header ('MEETECHO' header followed by 'audio' or 'video'), or a frame */
-			offset += 8;
-			bytes = fread(&len, sizeof(uint16_t), 1, file);
-			len = ntohs(len);
-			offset += 2;
-			if(len == 5 && !parsed_header) {
-				/* This is the main header */
-				parsed_header = TRUE;
-				JANUS_LOG(LOG_WARN, "Old .mjr header format\n");
-				bytes = fread(prebuffer, sizeof(char), 5, file);
-				if(prebuffer[0] == 'v') {
-					JANUS_LOG(LOG_INFO, "This is a video recording, assuming VP8\n");
-					video = 1;
-					data = 0;
-					vp8 = 1;
-					if(extension && strcasecmp(extension, ".webm")) {
-						JANUS_LOG(LOG_ERR, "VP8 RTP packets can only be converted to a .webm file\n");
-						exit(1);
-					}
-				} else if(prebuffer[0] == 'a') {
-					JANUS_LOG(LOG_INFO, "This is an audio recording, assuming Opus\n");
-					video = 0;
-					data = 0;
-					opus = 1;
-					if(extension && strcasecmp(extension, ".opus")) {
-						JANUS_LOG(LOG_ERR, "Opus RTP packets can only be converted to an .opus file\n");
-						exit(1);
-					}
-				} else if(prebuffer[0] == 'd') {
-					JANUS_LOG(LOG_INFO, "This is a text data recording, assuming SRT\n");
-					video = 0;
-					data = 1;
-					if(extension && strcasecmp(extension, ".srt")) {
-						JANUS_LOG(LOG_ERR, "Data channel packets can only be converted to a .srt file\n");
-						exit(1);
-					}
-				} else {
-					JANUS_LOG(LOG_WARN, "Unsupported recording media type...\n");
-					exit(1);
-				}
-				offset += len;
-				continue;
-			} else if(!data && len < 12) {
-				/* Not RTP, skip */
-				JANUS_LOG(LOG_VERB, "Skipping packet (not RTP?)\n");
-				offset += len;
-				continue;
-			}
-		} else if(prebuffer[1] == 'J') {
-			/* New .mjr format, the header may contain useful info */
-			offset += 8;
-			bytes = fread(&len, sizeof(uint16_t), 1, file);
-			len = ntohs(len);
-			offset += 2;
-			if(len > 0 && !parsed_header) {
-				/* This is the info header */
-				JANUS_LOG(LOG_WARN, "New .mjr header format\n");
-				bytes = fread(prebuffer, sizeof(char), len, file);
-				parsed_header = TRUE;
-				prebuffer[len] = '\0';
-				json_error_t error;
-				json_t *info = json_loads(prebuffer, 0, &error);
-				if(!info) {
-					JANUS_LOG(LOG_ERR, "JSON error: on line %d: %s\n", error.line, error.text);
-					JANUS_LOG(LOG_WARN, "Error parsing info header...\n");
-					exit(1);
-				}
-				/* Is it audio or video? */
-				json_t *type = json_object_get(info, "t");
-				if(!type || !json_is_string(type)) {
-					JANUS_LOG(LOG_WARN, "Missing/invalid recording type in info header...\n");
-					exit(1);
-				}
-				const char *t = json_string_value(type);
-				if(!strcasecmp(t, "v")) {
-					video = 1;
-					data = 0;
-				} else if(!strcasecmp(t, "a")) {
-					video = 0;
-					data = 0;
-				} else if(!strcasecmp(t, "d")) {
-					video = 0;
-					data = 1;
+		janus_pp_batch_job *job = g_hash_table_lookup(jobs, GINT_TO_POINTER(pid));
+		if(job == NULL)
+			continue;
+		if(WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+			janus_pp_batch_job_done(job, NULL);
+		} else {
+			char error[64];
+			if(WIFEXITED(status))
+				g_snprintf(error, sizeof(error), "exited with status %d", WEXITSTATUS(status));
+			else
+				g_snprintf(error, sizeof(error), "killed by signal %d", WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+			janus_pp_batch_job_done(job, error);
+			failed++;
+		}
+		g_hash_table_remove(jobs, GINT_TO_POINTER(pid));
+	}
+	g_hash_table_destroy(jobs);
+	g_strfreev(env);
+	g_list_free_full(sources, (GDestroyNotify)g_free);
+	g_free(path);
+	JANUS_LOG(LOG_INFO, "[batch] Processed %u recordings (%u failed) in %.3fs\n", total, failed,
+		(double)(g_get_monotonic_time() - start_time)/G_USEC_PER_SEC);
+	return failed > 0 ? 1 : 0;
+}
+
+/* Insert a packet in the ordered list, starting from the end */
+static void janus_pp_list_add(janus_pp_frame_packet *p) {
+	if(list == NULL) {
+		/* First element becomes the list itself (and the last item), at least for now */
+		list = p;
+		last = p;
+	} else if(!p->drop) {
+		/* Check where we should insert this, starting from the end */
+		int added = 0;
+		janus_pp_frame_packet *tmp = last;
+		while(tmp) {
+			if(tmp->ts < p->ts) {
+				/* The new timestamp is greater than the last one we have, append */
+				added = 1;
+				if(tmp->next != NULL) {
+					/* We're inserting */
+					tmp->next->prev = p;
+					p->next = tmp->next;
 				} else {
-					JANUS_LOG(LOG_WARN, "Unsupported recording type '%s' in info header...\n", t);
-					exit(1);
-				}
-				/* What codec was used? */
-				json_t *codec = json_object_get(info, "c");
-				if(!codec || !json_is_string(codec)) {
-					JANUS_LOG(LOG_WARN, "Missing recording codec in info header...\n");
-					exit(1);
+					/* Update the last packet */
+					last = p;
 				}
-				const char *c = json_string_value(codec);
-				if(video) {
-					if(!strcasecmp(c, "vp8")) {
-						vp8 = 1;
-						if(extension && strcasecmp(extension, ".webm")) {
-							JANUS_LOG(LOG_ERR, "VP8 RTP packets can only be converted to a .webm file\n");
-							exit(1);
-						}
-					} else if(!strcasecmp(c, "vp9")) {
-						vp9 = 1;
-						if(extension && strcasecmp(extension, ".webm")) {
-							JANUS_LOG(LOG_ERR, "VP9 RTP packets can only be converted to a .webm file\n");
-							exit(1);
-						}
-					} else if(!strcasecmp(c, "h264")) {
-						h264 = 1;
-						if(extension && strcasecmp(extension, ".mp4")) {
-							JANUS_LOG(LOG_ERR, "H.264 RTP packets can only be converted to a .mp4 file\n");
-							exit(1);
-						}
+				tmp->next = p;
+				p->prev = tmp;
+				break;
+			} else if(tmp->ts == p->ts) {
+				/* Same timestamp, check the sequence number */
+				if(tmp->seq < p->seq && (abs(tmp->seq - p->seq) < 10000)) {
+					/* The new sequence number is greater than the last one we have, append */
+					added = 1;
+					if(tmp->next != NULL) {
+						/* We're inserting */
+						tmp->next->prev = p;
+						p->next = tmp->next;
 					} else {
-						JANUS_LOG(LOG_WARN, "The post-processor only supports VP8, VP9 and H.264 video for now (was '%s')...\n", c);
-						exit(1);
+						/* Update the last packet */
+						last = p;
 					}
-				} else if(!video && !data) {
-					if(!strcasecmp(c, "opus")) {
-						opus = 1;
-						if(extension && strcasecmp(extension, ".opus")) {
-							JANUS_LOG(LOG_ERR, "Opus RTP packets can only be converted to a .opus file\n");
-							exit(1);
-						}
-					} else if(!strcasecmp(c, "g711") || !strcasecmp(c, "pcmu") || !strcasecmp(c, "pcma")) {
-						g711 = 1;
-						if(extension && strcasecmp(extension, ".wav")) {
-							JANUS_LOG(LOG_ERR, "G.711 RTP packets can only be converted to a .wav file\n");
-							exit(1);
-						}
-					} else if(!strcasecmp(c, "g722")) {
-						g722 = 1;
-						if(extension && strcasecmp(extension, ".wav")) {
-							JANUS_LOG(LOG_ERR, "G.722 RTP packets can only be converted to a .wav file\n");
-							exit(1);
-						}
+					tmp->next = p;
+					p->prev = tmp;
+					break;
+				} else if(tmp->seq > p->seq && (abs(tmp->seq - p->seq) > 10000)) {
+					/* The new sequence number (resetted) is greater than the last one we have, append */
+					added = 1;
+					if(tmp->next != NULL) {
+						/* We're inserting */
+						tmp->next->prev = p;
+						p->next = tmp->next;
 					} else {
-						JANUS_LOG(LOG_WARN, "The post-processor only supports Opus and G.711 audio for now (was '%s')...\n", c);
-						exit(1);
-					}
-				} else if(data) {
-					if(strcasecmp(c, "text")) {
-						JANUS_LOG(LOG_WARN, "The post-processor only supports text data for now (was '%s')...\n", c);
-						exit(1);
-					}
-					if(extension && strcasecmp(extension, ".srt")) {
-						JANUS_LOG(LOG_ERR, "Data channel packets can only be converted to a .srt file\n");
-						exit(1);
+						/* Update the last packet */
+						last = p;
 					}
+					tmp->next = p;
+					p->prev = tmp;
+					break;
+				} else if(tmp->seq == p->seq) {
+					/* Maybe a retransmission? Skip */
+					JANUS_LOG(LOG_WARN, "Skipping duplicate packet (seq=%"SCNu16")\n", p->seq);
+					p->drop = 1;
+					break;
 				}
-				/* When was the file created? */
-				json_t *created = json_object_get(info, "s");
-				if(!created || !json_is_integer(created)) {
-					JANUS_LOG(LOG_WARN, "Missing recording created time in info header...\n");
-					exit(1);
-				}
-				c_time = json_integer_value(created);
-				/* When was the first frame written? */
-				json_t *written = json_object_get(info, "u");
-				if(!written || !json_is_integer(written)) {
-					JANUS_LOG(LOG_WARN, "Missing recording written time in info header...\n");
-					exit(1);
-				}
-				w_time = json_integer_value(written);
-				/* Summary */
-				JANUS_LOG(LOG_INFO, "This is %s recording:\n", video ? "a video" : (data ? "a text data" : "an audio"));
-				JANUS_LOG(LOG_INFO, "  -- Codec:   %s\n", c);
-				JANUS_LOG(LOG_INFO, "  -- Created: %"SCNi64"\n", c_time);
-				JANUS_LOG(LOG_INFO, "  -- Written: %"SCNi64"\n", w_time);
 			}
-		} else {
-			JANUS_LOG(LOG_ERR, "Invalid header...\n");
-			exit(1);
+			/* If either the timestamp ot the sequence number we just got is smaller, keep going back */
+			tmp = tmp->prev;
 		}
-		/* Skip data for now */
-		offset += len;
+		if(p->drop) {
+			/* We don't need this */
+			g_free(p);
+		} else if(!added) {
+			/* We reached the start */
+			p->next = list;
+			list->prev = p;
+			list = p;
+		}
+	} else {
+		/* Only padding, we don't need this either */
+		g_free(p);
 	}
-	if(!working)
-		exit(0);
-	/* Now let's parse the frames and order them */
-	uint32_t last_ts = 0, reset = 0;
-	int times_resetted = 0;
-	int post_reset_pkts = 0;
-	offset = 0;
+}
+
+
+/* Streaming mode: rather than keeping all the packets in memory and
+ * ordering them in a list, we only keep a window of packets in a heap
+ * sorted by (extended) sequence number, and pass them in order to the
+ * processors in chunks. Chunks are only cut when the timestamp changes,
+ * so that frames are never split, and the head of each chunk points back
+ * to the last packet of the previous one (which in turn points to the
+ * first packet of the recording): this way the processors can still
+ * look at what came before, and find out the timestamp we started from */
+#define JANUS_PP_STREAM_CHUNK	4096
+typedef struct janus_pp_stream_entry {
+	guint64 key;
+	janus_pp_frame_packet *packet;
+} janus_pp_stream_entry;
+typedef struct janus_pp_stream {
+	FILE *file;
+	int (*process)(FILE *file, janus_pp_frame_packet *list);
+	GArray *heap;
+	guint64 highest, emitted;
+	gboolean started;
+	janus_pp_frame_packet *first, *anchor, *head, *tail;
+	guint count, chunk;
+	guint64 processed, dropped;
+} janus_pp_stream;
+
+static janus_pp_stream *janus_pp_stream_create(FILE *file, int (*process)(FILE *file, janus_pp_frame_packet *list)) {
+	janus_pp_stream *stream = g_malloc0(sizeof(janus_pp_stream));
+	stream->file = file;
+	stream->process = process;
+	stream->chunk = JANUS_PP_STREAM_CHUNK;
+	stream->heap = g_array_sized_new(FALSE, FALSE, sizeof(janus_pp_stream_entry), stream_window+1);
+	return stream;
+}
+
+/* Pass the current chunk to the processor, and only keep what we need of it */
+static void janus_pp_stream_chunk(janus_pp_stream *stream) {
+	if(stream->head == NULL)
+		return;
+	stream->tail->next = NULL;
+	if(stream->process != NULL && working)
+		stream->process(stream->file, stream->head);
+	janus_pp_frame_packet *tmp = stream->head, *next = NULL;
+	while(tmp != stream->tail) {
+		next = tmp->next;
+		if(tmp != stream->first)
+			g_free(tmp);
+		tmp = next;
+	}
+	if(stream->anchor != NULL && stream->anchor != stream->first)
+		g_free(stream->anchor);
+	stream->first->next = NULL;
+	stream->anchor = stream->tail;
+	stream->anchor->prev = (stream->anchor != stream->first) ? stream->first : NULL;
+	stream->head = NULL;
+	stream->tail = NULL;
+	stream->count = 0;
+}
+
+/* Append the next packet in order to the current chunk */
+static void janus_pp_stream_emit(janus_pp_stream *stream, janus_pp_stream_entry *entry) {
+	janus_pp_frame_packet *p = entry->packet;
+	if(stream->started && entry->key <= stream->emitted) {
+		/* Duplicate, or too late to be put back in order */
+		JANUS_LOG(LOG_WARN, "Skipping late or duplicate packet (seq=%"SCNu16")\n", p->seq);
+		stream->dropped++;
+		g_free(p);
+		return;
+	}
+	stream->started = TRUE;
+	stream->emitted = entry->key;
+	if(stream->count >= stream->chunk && p->ts != stream->tail->ts)
+		janus_pp_stream_chunk(stream);
+	p->next = NULL;
+	if(stream->first == NULL) {
+		stream->first = p;
+		p->prev = NULL;
+	} else {
+		p->prev = stream->head ? stream->tail : stream->anchor;
+	}
+	if(stream->head == NULL)
+		stream->head = p;
+	else
+		stream->tail->next = p;
+	stream->tail = p;
+	stream->count++;
+	stream->processed++;
+}
+
+/* Remove the packet with the lowest sequence number from the heap */
+static janus_pp_stream_entry janus_pp_stream_pop(janus_pp_stream *stream) {
+	GArray *heap = stream->heap;
+	janus_pp_stream_entry top = g_array_index(heap, janus_pp_stream_entry, 0);
+	guint size = heap->len-1;
+	if(size > 0) {
+		janus_pp_stream_entry moved = g_array_index(heap, janus_pp_stream_entry, size);
+		guint i = 0;
+		while(2*i+1 < size) {
+			guint child = 2*i+1;
+			if(child+1 < size && g_array_index(heap, janus_pp_stream_entry, child+1).key <
+					g_array_index(heap, janus_pp_stream_entry, child).key)
+				child++;
+			if(g_array_index(heap, janus_pp_stream_entry, child).key >= moved.key)
+				break;
+			g_array_index(heap, janus_pp_stream_entry, i) = g_array_index(heap, janus_pp_stream_entry, child);
+			i = child;
+		}
+		g_array_index(heap, janus_pp_stream_entry, i) = moved;
+	}
+	g_array_set_size(heap, size);
+	return top;
+}
+
+static void janus_pp_stream_add(janus_pp_stream *stream, janus_pp_frame_packet *p) {
+	if(p->drop) {
+		/* Only padding, we don't need this */
+		stream->dropped++;
+		g_free(p);
+		return;
+	}
+	/* Extend the sequence number, taking wrap-arounds into account */
+	janus_pp_stream_entry entry = { .packet = p };
+	if(stream->highest == 0) {
+		stream->highest = ((guint64)1 << 32) | p->seq;
+		entry.key = stream->highest;
+	} else {
+		entry.key = stream->highest + (int16_t)(p->seq - (uint16_t)stream->highest);
+		if(entry.key > stream->highest)
+			stream->highest = entry.key;
+	}
+	/* Add to the heap */
+	GArray *heap = stream->heap;
+	g_array_set_size(heap, heap->len+1);
+	guint i = heap->len-1;
+	while(i > 0) {
+		guint parent = (i-1)/2;
+		if(g_array_index(heap, janus_pp_stream_entry, parent).key <= entry.key)
+			break;
+		g_array_index(heap, janus_pp_stream_entry, i) = g_array_index(heap, janus_pp_stream_entry, parent);
+		i = parent;
+	}
+	g_array_index(heap, janus_pp_stream_entry, i) = entry;
+	/* If the window is full, the lowest packet can go */
+	if(heap->len > (guint)stream_window) {
+		janus_pp_stream_entry next = janus_pp_stream_pop(stream);
+		janus_pp_stream_emit(stream, &next);
+	}
+}
+
+/* Drain the window and process what's left */
+static void janus_pp_stream_flush(janus_pp_stream *stream) {
+	while(stream->heap->len > 0) {
+		janus_pp_stream_entry next = janus_pp_stream_pop(stream);
+		janus_pp_stream_emit(stream, &next);
+	}
+	janus_pp_stream_chunk(stream);
+}
+
+static void janus_pp_stream_destroy(janus_pp_stream *stream) {
+	if(stream == NULL)
+		return;
+	janus_pp_stream_flush(stream);
+	g_array_free(stream->heap, TRUE);
+	if(stream->anchor != NULL && stream->anchor != stream->first)
+		g_free(stream->anchor);
+	g_free(stream->first);
+	g_free(stream);
+}
+
+/* Stream callbacks: the first pass, for video, and the actual processing */
+static int janus_pp_stream_preprocess(FILE *file, janus_pp_frame_packet *list) {
+	if(vp8 || vp9)
+		return janus_pp_webm_preprocess_scan(file, list, vp8);
+	else if(h264)
+		return janus_pp_h264_preprocess_scan(file, list);
+	return 0;
+}
+
+static int janus_pp_stream_parse(FILE *file, janus_pp_frame_packet *list) {
+	janus_pp_frame_packet *tmp = list;
+	while(tmp) {
+		janus_pp_summary_add(tmp);
+		tmp = tmp->next;
+	}
+	return 0;
+}
+
+static int janus_pp_stream_process(FILE *file, janus_pp_frame_packet *list) {
+	janus_pp_stream_parse(file, list);
+	return janus_pp_process(file, list);
+}
+
+/* Where we are in the parsing, so that we can resume it when a live
+ * recording grows (we stop at the first incomplete frame otherwise) */
+typedef struct janus_pp_parse_state {
+	long offset;
+	uint32_t last_ts, reset;
+	int times_resetted;
+	int post_reset_pkts;
+	uint32_t count;
+	uint32_t ssrc;
+} janus_pp_parse_state;
+
+/* Parse the frames in the recording, and either order them in the list
+ * or, in streaming mode, pass them through the reorder window */
+static void janus_pp_parse_frames_from(FILE *file, long fsize, gint64 c_time, janus_pp_stream *stream, janus_pp_parse_state *state) {
+	uint32_t last_ts = state->last_ts, reset = state->reset;
+	int times_resetted = state->times_resetted;
+	int post_reset_pkts = state->post_reset_pkts;
+	int bytes = 0, skip = 0;
+	long offset = state->offset, start = offset;
+	uint16_t len = 0;
+	uint32_t count = state->count;
+	uint32_t ssrc = state->ssrc;
+	char prebuffer[1500];
+	memset(prebuffer, 0, 1500);
 	/* Timestamp reset related stuff */
-	last_ts = 0;
-	reset = 0;
-	times_resetted = 0;
-	post_reset_pkts = 0;
 	uint64_t max32 = UINT32_MAX;
 	/* Start loop */
 	while(working && offset < fsize) {
 		/* Read frame header */
 		skip = 0;
+		start = offset;
 		fseek(file, offset, SEEK_SET);
 		bytes = fread(prebuffer, sizeof(char), 8, file);
 		if(bytes != 8 || prebuffer[0] != 'M') {
@@ -400,6 +910,11 @@ int main(int argc, char *argv[])
 		len = ntohs(len);
 		JANUS_LOG(LOG_VERB, "  -- Length: %"SCNu16"\n", len);
 		offset += 2;
+		if(bytes != 1 || offset + len > fsize) {
+			/* Incomplete frame (e.g., still being written), stop here */
+			offset = start;
+			break;
+		}
 		if(prebuffer[1] == 'J' || (!data && len < 12)) {
 			/* Not RTP, skip */
 			JANUS_LOG(LOG_VERB, "  -- Not RTP, skipping\n");
@@ -532,83 +1047,633 @@ int main(int argc, char *argv[])
 		p->skip = skip;
 		p->next = NULL;
 		p->prev = NULL;
-		if(list == NULL) {
-			/* First element becomes the list itself (and the last item), at least for now */
-			list = p;
-			last = p;
-		} else if(!p->drop) {
-			/* Check where we should insert this, starting from the end */
-			int added = 0;
-			janus_pp_frame_packet *tmp = last;
-			while(tmp) {
-				if(tmp->ts < p->ts) {
-					/* The new timestamp is greater than the last one we have, append */
-					added = 1;
-					if(tmp->next != NULL) {
-						/* We're inserting */
-						tmp->next->prev = p;
-						p->next = tmp->next;
-					} else {
-						/* Update the last packet */
-						last = p;
-					}
-					tmp->next = p;
-					p->prev = tmp;
-					break;
-				} else if(tmp->ts == p->ts) {
-					/* Same timestamp, check the sequence number */
-					if(tmp->seq < p->seq && (abs(tmp->seq - p->seq) < 10000)) {
-						/* The new sequence number is greater than the last one we have, append */
-						added = 1;
-						if(tmp->next != NULL) {
-							/* We're inserting */
-							tmp->next->prev = p;
-							p->next = tmp->next;
-						} else {
-							/* Update the last packet */
-							last = p;
-						}
-						tmp->next = p;
-						p->prev = tmp;
-						break;
-					} else if(tmp->seq > p->seq && (abs(tmp->seq - p->seq) > 10000)) {
-						/* The new sequence number (resetted) is greater than the last one we have, append */
-						added = 1;
-						if(tmp->next != NULL) {
-							/* We're inserting */
-							tmp->next->prev = p;
-							p->next = tmp->next;
-						} else {
-							/* Update the last packet */
-							last = p;
-						}
-						tmp->next = p;
-						p->prev = tmp;
-						break;
-					} else if(tmp->seq == p->seq) {
-						/* Maybe a retransmission? Skip */
-						JANUS_LOG(LOG_WARN, "Skipping duplicate packet (seq=%"SCNu16")\n", p->seq);
-						p->drop = 1;
-						break;
-					}
-				}
-				/* If either the timestamp ot the sequence number we just got is smaller, keep going back */
-				tmp = tmp->prev;
-			}
-			if(p->drop) {
-				/* We don't need this */
-				g_free(p);
-			} else if(!added) {
-				/* We reached the start */
-				p->next = list;
-				list->prev = p;
-				list = p;
-			}
+		if(stream != NULL) {
+			/* Streaming mode: the packet goes through the reorder window */
+			janus_pp_stream_add(stream, p);
+		} else {
+			janus_pp_list_add(p);
 		}
 		/* Skip data for now */
 		offset += len;
 		count++;
 	}
+	state->offset = offset;
+	state->last_ts = last_ts;
+	state->reset = reset;
+	state->times_resetted = times_resetted;
+	state->post_reset_pkts = post_reset_pkts;
+	state->count = count;
+	state->ssrc = ssrc;
+}
+
+static uint32_t janus_pp_parse_frames(FILE *file, long fsize, gint64 c_time, janus_pp_stream *stream) {
+	janus_pp_parse_state state = { 0 };
+	janus_pp_parse_frames_from(file, fsize, c_time, stream, &state);
+	return state.count;
+}
+
+
+
+/* Parse the info header of a recording, and check it matches the target */
+static void janus_pp_parse_header(FILE *file, long fsize, char *extension, gboolean header_only, gint64 *created_time, gint64 *written_time) {
+	JANUS_LOG(LOG_INFO, "Pre-parsing file to generate ordered index...\n");
+	gboolean parsed_header = FALSE;
+	gint64 c_time = 0, w_time = 0;
+	int bytes = 0, skip = 0;
+	long offset = 0;
+	uint16_t len = 0;
+	char prebuffer[1500];
+	memset(prebuffer, 0, 1500);
+	/* Let's look for timestamp resets first */
+	while(working && offset < fsize) {
+		if(header_only && parsed_header) {
+			/* We only needed to parse the header */
+			exit(0);
+		}
+		/* Read frame header */
+		skip = 0;
+		fseek(file, offset, SEEK_SET);
+		bytes = fread(prebuffer, sizeof(char), 8, file);
+		if(bytes != 8 || prebuffer[0] != 'M') {
+			JANUS_LOG(LOG_WARN, "Invalid header at offset %ld (%s), the processing will stop here...\n",
+				offset, bytes != 8 ? "not enough bytes" : "wrong prefix");
+			break;
+		}
+		if(prebuffer[1] == 'E') {
+			/* Either the old .mjr format header ('MEETECHO' header followed by 'audio' or 'video'), or a frame */
+			offset += 8;
+			bytes = fread(&len, sizeof(uint16_t), 1, file);
+			len = ntohs(len);
+			offset += 2;
+			if(len == 5 && !parsed_header) {
+				/* This is the main header */
+				parsed_header = TRUE;
+				JANUS_LOG(LOG_WARN, "Old .mjr header format\n");
+				bytes = fread(prebuffer, sizeof(char), 5, file);
+				if(prebuffer[0] == 'v') {
+					JANUS_LOG(LOG_INFO, "This is a video recording, assuming VP8\n");
+					video = 1;
+					data = 0;
+					vp8 = 1;
+					g_strlcpy(codec_name, "vp8", sizeof(codec_name));
+					if(extension && strcasecmp(extension, ".webm")) {
+						JANUS_LOG(LOG_ERR, "VP8 RTP packets can only be converted to a .webm file\n");
+						exit(1);
+					}
+				} else if(prebuffer[0] == 'a') {
+					JANUS_LOG(LOG_INFO, "This is an audio recording, assuming Opus\n");
+					video = 0;
+					data = 0;
+					opus = 1;
+					g_strlcpy(codec_name, "opus", sizeof(codec_name));
+					if(extension && strcasecmp(extension, ".opus")) {
+						JANUS_LOG(LOG_ERR, "Opus RTP packets can only be converted to an .opus file\n");
+						exit(1);
+					}
+				} else if(prebuffer[0] == 'd') {
+					JANUS_LOG(LOG_INFO, "This is a text data recording, assuming SRT\n");
+					video = 0;
+					data = 1;
+					if(extension && strcasecmp(extension, ".srt")) {
+						JANUS_LOG(LOG_ERR, "Data channel packets can only be converted to a .srt file\n");
+						exit(1);
+					}
+				} else {
+					JANUS_LOG(LOG_WARN, "Unsupported recording media type...\n");
+					exit(1);
+				}
+				offset += len;
+				continue;
+			} else if(!data && len < 12) {
+				/* Not RTP, skip */
+				JANUS_LOG(LOG_VERB, "Skipping packet (not RTP?)\n");
+				offset += len;
+				continue;
+			}
+		} else if(prebuffer[1] == 'J') {
+			/* New .mjr format, the header may contain useful info */
+			offset += 8;
+			bytes = fread(&len, sizeof(uint16_t), 1, file);
+			len = ntohs(len);
+			offset += 2;
+			if(len > 0 && !parsed_header) {
+				/* This is the info header */
+				JANUS_LOG(LOG_WARN, "New .mjr header format\n");
+				bytes = fread(prebuffer, sizeof(char), len, file);
+				parsed_header = TRUE;
+				prebuffer[len] = '\0';
+				json_error_t error;
+				json_t *info = json_loads(prebuffer, 0, &error);
+				if(!info) {
+					JANUS_LOG(LOG_ERR, "JSON error: on line %d: %s\n", error.line, error.text);
+					JANUS_LOG(LOG_WARN, "Error parsing info header...\n");
+					exit(1);
+				}
+				/* Is it audio or video? */
+				json_t *type = json_object_get(info, "t");
+				if(!type || !json_is_string(type)) {
+					JANUS_LOG(LOG_WARN, "Missing/invalid recording type in info header...\n");
+					exit(1);
+				}
+				const char *t = json_string_value(type);
+				if(!strcasecmp(t, "v")) {
+					video = 1;
+					data = 0;
+				} else if(!strcasecmp(t, "a")) {
+					video = 0;
+					data = 0;
+				} else if(!strcasecmp(t, "d")) {
+					video = 0;
+					data = 1;
+				} else {
+					JANUS_LOG(LOG_WARN, "Unsupported recording type '%s' in info header...\n", t);
+					exit(1);
+				}
+				/* What codec was used? */
+				json_t *codec = json_object_get(info, "c");
+				if(!codec || !json_is_string(codec)) {
+					JANUS_LOG(LOG_WARN, "Missing recording codec in info header...\n");
+					exit(1);
+				}
+				const char *c = json_string_value(codec);
+				g_strlcpy(codec_name, c, sizeof(codec_name));
+				if(video) {
+					if(!strcasecmp(c, "vp8")) {
+						vp8 = 1;
+						if(extension && strcasecmp(extension, ".webm")) {
+							JANUS_LOG(LOG_ERR, "VP8 RTP packets can only be converted to a .webm file\n");
+							exit(1);
+						}
+					} else if(!strcasecmp(c, "vp9")) {
+						vp9 = 1;
+						if(extension && strcasecmp(extension, ".webm")) {
+							JANUS_LOG(LOG_ERR, "VP9 RTP packets can only be converted to a .webm file\n");
+							exit(1);
+						}
+					} else if(!strcasecmp(c, "h264")) {
+						h264 = 1;
+						if(extension && strcasecmp(extension, ".mp4")) {
+							JANUS_LOG(LOG_ERR, "H.264 RTP packets can only be converted to a .mp4 file\n");
+							exit(1);
+						}
+					} else {
+						JANUS_LOG(LOG_WARN, "The post-processor only supports VP8, VP9 and H.264 video for now (was '%s')...\n", c);
+						exit(1);
+					}
+				} else if(!video && !data) {
+					if(!strcasecmp(c, "opus")) {
+						opus = 1;
+						if(extension && strcasecmp(extension, ".opus")) {
+							JANUS_LOG(LOG_ERR, "Opus RTP packets can only be converted to a .opus file\n");
+							exit(1);
+						}
+					} else if(!strcasecmp(c, "g711") || !strcasecmp(c, "pcmu") || !strcasecmp(c, "pcma")) {
+						g711 = 1;
+						if(extension && strcasecmp(extension, ".wav")) {
+							JANUS_LOG(LOG_ERR, "G.711 RTP packets can only be converted to a .wav file\n");
+							exit(1);
+						}
+					} else if(!strcasecmp(c, "g722")) {
+						g722 = 1;
+						if(extension && strcasecmp(extension, ".wav")) {
+							JANUS_LOG(LOG_ERR, "G.722 RTP packets can only be converted to a .wav file\n");
+							exit(1);
+						}
+					} else {
+						JANUS_LOG(LOG_WARN, "The post-processor only supports Opus and G.711 audio for now (was '%s')...\n", c);
+						exit(1);
+					}
+				} else if(data) {
+					if(strcasecmp(c, "text")) {
+						JANUS_LOG(LOG_WARN, "The post-processor only supports text data for now (was '%s')...\n", c);
+						exit(1);
+					}
+					if(extension && strcasecmp(extension, ".srt")) {
+						JANUS_LOG(LOG_ERR, "Data channel packets can only be converted to a .srt file\n");
+						exit(1);
+					}
+				}
+				/* When was the file created? */
+				json_t *created = json_object_get(info, "s");
+				if(!created || !json_is_integer(created)) {
+					JANUS_LOG(LOG_WARN, "Missing recording created time in info header...\n");
+					exit(1);
+				}
+				c_time = json_integer_value(created);
+				/* When was the first frame written? */
+				json_t *written = json_object_get(info, "u");
+				if(!written || !json_is_integer(written)) {
+					JANUS_LOG(LOG_WARN, "Missing recording written time in info header...\n");
+					exit(1);
+				}
+				w_time = json_integer_value(written);
+				/* Summary */
+				JANUS_LOG(LOG_INFO, "This is %s recording:\n", video ? "a video" : (data ? "a text data" : "an audio"));
+				JANUS_LOG(LOG_INFO, "  -- Codec:   %s\n", c);
+				JANUS_LOG(LOG_INFO, "  -- Created: %"SCNi64"\n", c_time);
+				JANUS_LOG(LOG_INFO, "  -- Written: %"SCNi64"\n", w_time);
+			}
+		} else {
+			JANUS_LOG(LOG_ERR, "Invalid header...\n");
+			exit(1);
+		}
+		/* Skip data for now */
+		offset += len;
+	}
+	*created_time = c_time;
+	*written_time = w_time;
+}
+
+/* Live mode: we follow a recording as it grows, and generate fragmented
+ * MP4 segments and an HLS playlist out of it as we go */
+#define JANUS_PP_LIVE_WINDOW	100
+#define JANUS_PP_LIVE_CHUNK		32
+static char *live_destination = NULL;
+static int live_segment = 4;
+static gboolean live_created = FALSE;
+
+static int janus_pp_live_process(FILE *file, janus_pp_frame_packet *list) {
+	if(!live_created) {
+		/* We can only start when we know the resolution: anything before the first SPS is useless anyway */
+		if(janus_pp_h264_preprocess_scan(file, list) <= 0) {
+			JANUS_LOG(LOG_VERB, "No SPS yet, skipping packets\n");
+			return 0;
+		}
+		janus_pp_h264_preprocess_finish();
+		if(janus_pp_h264_create_hls(live_destination, live_segment) < 0) {
+			JANUS_LOG(LOG_ERR, "Error creating HLS output...\n");
+			working = 0;
+			return -1;
+		}
+		live_created = TRUE;
+	}
+	janus_pp_stream_parse(file, list);
+	return janus_pp_h264_process(file, list, &working);
+}
+
+static int janus_pp_live(char *source, char *destination, int timeout) {
+	/* We can't map the file in memory, since it's still growing */
+	FILE *file = fopen(source, "rb");
+	if(file == NULL) {
+		JANUS_LOG(LOG_ERR, "Could not open file %s\n", source);
+		return -1;
+	}
+	struct stat s;
+	if(fstat(fileno(file), &s) < 0) {
+		fclose(file);
+		return -1;
+	}
+	gint64 c_time = 0, w_time = 0;
+	janus_pp_parse_header(file, s.st_size, NULL, FALSE, &c_time, &w_time);
+	if(!working)
+		exit(0);
+	if(!video || !h264) {
+		JANUS_LOG(LOG_ERR, "Live segments can only be generated out of H.264 recordings\n");
+		exit(1);
+	}
+	live_destination = destination;
+	janus_pp_stream *stream = janus_pp_stream_create(file, janus_pp_live_process);
+	stream->chunk = JANUS_PP_LIVE_CHUNK;
+	janus_pp_parse_state state = { 0 };
+	gint64 idle = 0, poll = 100000;
+	while(working) {
+		if(fstat(fileno(file), &s) < 0)
+			break;
+		if(s.st_size > state.offset) {
+			long before = state.offset;
+			janus_pp_parse_frames_from(file, s.st_size, c_time, stream, &state);
+			if(state.offset > before) {
+				idle = 0;
+				continue;
+			}
+		}
+		/* Is the recording done? Recorders using a temporary extension rename the file when closing */
+		struct stat sp;
+		if(stat(source, &sp) < 0 || sp.st_ino != s.st_ino) {
+			/* The recorder may have written more before closing the file, process that first */
+			while(fstat(fileno(file), &s) == 0 && s.st_size > state.offset) {
+				long before = state.offset;
+				janus_pp_parse_frames_from(file, s.st_size, c_time, stream, &state);
+				if(state.offset == before)
+					break;
+			}
+			JANUS_LOG(LOG_INFO, "Recording closed, wrapping up\n");
+			break;
+		}
+		if(idle >= (gint64)timeout*G_USEC_PER_SEC) {
+			JANUS_LOG(LOG_INFO, "No new data for %d seconds, wrapping up\n", timeout);
+			break;
+		}
+		g_usleep(poll);
+		idle += poll;
+	}
+	janus_pp_stream_flush(stream);
+	JANUS_LOG(LOG_INFO, "Counted %"SCNu32" RTP packets (%"SCNu64" processed, %"SCNu64" late or duplicate)\n",
+		state.count, stream->processed, stream->dropped);
+	summary_dropped = stream->dropped;
+	janus_pp_stream_destroy(stream);
+	if(live_created)
+		janus_pp_h264_close();
+	fclose(file);
+	janus_pp_summary_write(source, destination, live_created ? NULL : "no keyframe");
+	janus_pp_report(state.offset, state.count);
+	JANUS_LOG(LOG_INFO, "Bye!\n");
+	return live_created ? 0 : 1;
+}
+
+/* Mux mode: we process a video recording as usual, and add the frames
+ * of the related audio recording to the same file as a second track */
+static int janus_pp_mux(char *audio_source, char *video_source, char *destination, char *extension) {
+	if(stream_window > 0) {
+		JANUS_LOG(LOG_WARN, "The streaming mode is not available when muxing, ignoring it\n");
+		stream_window = 0;
+	}
+	/* Start from the audio recording */
+	long asize = 0, vsize = 0;
+	FILE *afile = janus_pp_source_open(audio_source, &asize);
+	if(afile == NULL) {
+		JANUS_LOG(LOG_ERR, "Could not open file %s\n", audio_source);
+		return -1;
+	}
+	gint64 a_c_time = 0, a_w_time = 0;
+	janus_pp_parse_header(afile, asize, NULL, FALSE, &a_c_time, &a_w_time);
+	if(!working)
+		exit(0);
+	if(video || data || !opus) {
+		JANUS_LOG(LOG_ERR, "Only Opus audio recordings can be muxed\n");
+		exit(1);
+	}
+	uint32_t count = janus_pp_parse_frames(afile, asize, a_c_time, NULL);
+	if(!working)
+		exit(0);
+	janus_pp_frame_packet *audio = list;
+	list = NULL;
+	last = NULL;
+	opus = 0;
+	/* Now the video recording */
+	FILE *vfile = janus_pp_source_open(video_source, &vsize);
+	if(vfile == NULL) {
+		JANUS_LOG(LOG_ERR, "Could not open file %s\n", video_source);
+		return -1;
+	}
+	gint64 v_c_time = 0, v_w_time = 0;
+	janus_pp_parse_header(vfile, vsize, extension, FALSE, &v_c_time, &v_w_time);
+	if(!working)
+		exit(0);
+	if(!video) {
+		JANUS_LOG(LOG_ERR, "%s is not a video recording\n", video_source);
+		exit(1);
+	}
+	count += janus_pp_parse_frames(vfile, vsize, v_c_time, NULL);
+	if(!working)
+		exit(0);
+	if(audio == NULL || list == NULL) {
+		JANUS_LOG(LOG_ERR, "No %s packets to mux\n", audio == NULL ? "audio" : "video");
+		exit(1);
+	}
+	JANUS_LOG(LOG_INFO, "Counted %"SCNu32" RTP packets\n", count);
+	/* Look for maximum width and height, and for the average framerate */
+	if(vp8 || vp9) {
+		if(janus_pp_webm_preprocess(vfile, list, vp8) < 0) {
+			JANUS_LOG(LOG_ERR, "Error pre-processing %s RTP frames...\n", vp8 ? "VP8" : "VP9");
+			exit(1);
+		}
+	} else if(h264) {
+		if(janus_pp_h264_preprocess(vfile, list) < 0) {
+			JANUS_LOG(LOG_ERR, "Error pre-processing H.264 RTP frames...\n");
+			exit(1);
+		}
+	}
+	/* Sync audio and video using the time their first frame was written */
+	janus_pp_mux_init(afile, audio, a_w_time, v_w_time);
+	if(janus_pp_create(destination) < 0)
+		exit(1);
+	janus_pp_process(vfile, list);
+	janus_pp_close();
+	janus_pp_source_close(vfile);
+	janus_pp_source_close(afile);
+	janus_pp_destination_size(destination);
+	janus_pp_report(asize + vsize, count);
+	janus_pp_frame_packet *lists[2] = { audio, list };
+	int i = 0;
+	for(i=0; i<2; i++) {
+		janus_pp_frame_packet *temp = lists[i], *next = NULL;
+		while(temp) {
+			next = temp->next;
+			g_free(temp);
+			temp = next;
+		}
+	}
+	list = NULL;
+	JANUS_LOG(LOG_INFO, "Bye!\n");
+	return 0;
+}
+
+/* Main Code */
+int main(int argc, char *argv[])
+{
+	janus_log_init(FALSE, TRUE, NULL);
+	atexit(janus_log_destroy);
+	start_time = g_get_monotonic_time();
+
+	JANUS_LOG(LOG_INFO, "Janus version: %d (%s)\n", janus_version, janus_version_string);
+	JANUS_LOG(LOG_INFO, "Janus commit: %s\n", janus_build_git_sha);
+	JANUS_LOG(LOG_INFO, "Compiled on:  %s\n\n", janus_build_git_time);
+
+	/* Check the JANUS_PPREC_DEBUG environment variable for the debugging level */
+	if(g_getenv("JANUS_PPREC_DEBUG") != NULL) {
+		int val = atoi(g_getenv("JANUS_PPREC_DEBUG"));
+		if(val >= LOG_NONE && val <= LOG_MAX)
+			janus_log_level = val;
+		JANUS_LOG(LOG_INFO, "Logging level: %d\n", janus_log_level);
+	}
+	if(g_getenv("JANUS_PPREC_POSTRESETTRIGGER") != NULL) {
+		int val = atoi(g_getenv("JANUS_PPREC_POSTRESETTRIGGER"));
+		if(val >= 0)
+			post_reset_trigger = val;
+		JANUS_LOG(LOG_INFO, "Post reset trigger: %d\n", post_reset_trigger);
+	}
+	/* Check the JANUS_PPREC_STREAM environment variable for the size of the reorder window */
+	if(g_getenv("JANUS_PPREC_STREAM") != NULL) {
+		int val = atoi(g_getenv("JANUS_PPREC_STREAM"));
+		if(val >= 0)
+			stream_window = val;
+		JANUS_LOG(LOG_INFO, "Streaming mode: %s (window of %d packets)\n", stream_window ? "enabled" : "disabled", stream_window);
+	}
+	
+	/* Check the JANUS_PPREC_SUMMARY environment variable for where to save a JSON summary */
+	if(g_getenv("JANUS_PPREC_SUMMARY") != NULL) {
+		summary_path = (char *)g_getenv("JANUS_PPREC_SUMMARY");
+		JANUS_LOG(LOG_INFO, "Summary: %s\n", summary_path);
+	}
+	
+	/* Evaluate arguments */
+	gboolean batch = (argc > 1 && !strcmp(argv[1], "--batch"));
+	gboolean mux = (argc > 1 && !strcmp(argv[1], "--mux"));
+	gboolean live = (argc > 1 && !strcmp(argv[1], "--live"));
+	if((!batch && !mux && !live && argc != 3) || ((batch || live) && argc != 4) || (mux && argc != 5)) {
+		JANUS_LOG(LOG_INFO, "Usage: %s source.mjr destination.[opus|wav|webm|mp4|srt]\n", argv[0]);
+		JANUS_LOG(LOG_INFO, "       %s --header source.mjr (only parse header)\n", argv[0]);
+		JANUS_LOG(LOG_INFO, "       %s --parse source.mjr (only parse and re-order packets)\n", argv[0]);
+		JANUS_LOG(LOG_INFO, "       %s --batch folder|manifest output-folder (process many recordings in parallel)\n", argv[0]);
+		JANUS_LOG(LOG_INFO, "       %s --mux audio.mjr video.mjr destination.[webm|mp4] (mux audio and video in the same file)\n", argv[0]);
+		JANUS_LOG(LOG_INFO, "       %s --live source.mjr playlist.m3u8 (generate HLS segments while recording)\n", argv[0]);
+		return -1;
+	}
+	if(live) {
+		/* Check the JANUS_PPREC_HLS_TIME and JANUS_PPREC_LIVE_TIMEOUT environment variables for the segment duration and when to stop */
+		int timeout = 10;
+		if(g_getenv("JANUS_PPREC_HLS_TIME") != NULL) {
+			int val = atoi(g_getenv("JANUS_PPREC_HLS_TIME"));
+			if(val > 0)
+				live_segment = val;
+		}
+		if(g_getenv("JANUS_PPREC_LIVE_TIMEOUT") != NULL) {
+			int val = atoi(g_getenv("JANUS_PPREC_LIVE_TIMEOUT"));
+			if(val > 0)
+				timeout = val;
+		}
+		if(stream_window == 0)
+			stream_window = JANUS_PP_LIVE_WINDOW;
+		JANUS_LOG(LOG_INFO, "%s --> %s (live, %ds segments)\n", argv[2], argv[3], live_segment);
+		working = 1;
+		signal(SIGINT, janus_pp_handle_signal);
+		return janus_pp_live(argv[2], argv[3], timeout);
+	}
+	if(mux) {
+		char *extension = strrchr(argv[4], '.');
+		if(extension == NULL || (strcasecmp(extension, ".webm") && strcasecmp(extension, ".mp4"))) {
+			JANUS_LOG(LOG_ERR, "Audio and video can only be muxed in a .webm or .mp4 file\n");
+			exit(1);
+		}
+		JANUS_LOG(LOG_INFO, "%s + %s --> %s\n", argv[2], argv[3], argv[4]);
+		working = 1;
+		signal(SIGINT, janus_pp_handle_signal);
+		return janus_pp_mux(argv[2], argv[3], argv[4], extension);
+	}
+	if(batch) {
+		/* Check the JANUS_PPREC_WORKERS environment variable for how many recordings to process at the same time */
+		int workers = sysconf(_SC_NPROCESSORS_ONLN);
+		if(g_getenv("JANUS_PPREC_WORKERS") != NULL) {
+			int val = atoi(g_getenv("JANUS_PPREC_WORKERS"));
+			if(val > 0)
+				workers = val;
+		}
+		if(workers < 1)
+			workers = 1;
+		/* Summaries are saved by each worker, next to the processed files */
+		summary_path = NULL;
+		working = 1;
+		signal(SIGINT, janus_pp_handle_signal);
+		return janus_pp_batch(argv[0], argv[2], argv[3], workers);
+	}
+	char *source = NULL, *destination = NULL, *extension = NULL;
+	gboolean header_only = !strcmp(argv[1], "--header");
+	gboolean parse_only = !strcmp(argv[1], "--parse");
+	if(header_only || parse_only) {
+		/* Only parse the .mjr header and/or re-order the packets, no processing */
+		source = argv[2];
+	} else {
+		/* Post-process the .mjr recording */
+		source = argv[1];
+		destination = argv[2];
+		JANUS_LOG(LOG_INFO, "%s --> %s\n", source, destination);
+		/* Check the extension */
+		extension = strrchr(destination, '.');
+		if(extension == NULL) {
+			/* No extension? */
+			JANUS_LOG(LOG_ERR, "No extension? Unsupported target file\n");
+			exit(1);
+		}
+		if(strcasecmp(extension, ".opus") && strcasecmp(extension, ".wav") &&
+				strcasecmp(extension, ".webm") && strcasecmp(extension, ".mp4") &&
+				strcasecmp(extension, ".srt")) {
+			/* Unsupported extension? */
+			JANUS_LOG(LOG_ERR, "Unsupported extension '%s'\n", extension);
+			exit(1);
+		}
+	}
+	long fsize = 0;
+	FILE *file = janus_pp_source_open(source, &fsize);
+	if(file == NULL) {
+		JANUS_LOG(LOG_ERR, "Could not open file %s\n", source);
+		return -1;
+	}
+	JANUS_LOG(LOG_INFO, "File is %zu bytes\n", fsize);
+	/* Check if there's an index we can get a summary from */
+	janus_recorder_index *index = janus_recorder_index_load(source, fsize);
+	if(index != NULL) {
+		size_t i = 0, keyframes = 0;
+		for(i=0; i<index->count; i++) {
+			if(index->entries[i].flags & JANUS_RECORDER_INDEX_KEYFRAME)
+				keyframes++;
+		}
+		JANUS_LOG(LOG_INFO, "Index: %zu entries, %zu keyframes, %.3fs%s\n", index->count, keyframes,
+			(double)janus_recorder_index_duration(index)/G_USEC_PER_SEC,
+			(index->entries[index->count-1].flags & JANUS_RECORDER_INDEX_LAST) ? "" : " (incomplete recording)");
+		janus_recorder_index_free(index);
+	}
+
+	/* Handle SIGINT */
+	working = 1;
+	signal(SIGINT, janus_pp_handle_signal);
+
+	/* Pre-parse */
+	gint64 c_time = 0, w_time = 0;
+	janus_pp_parse_header(file, fsize, extension, header_only, &c_time, &w_time);
+	uint32_t count = 0;
+	if(!working)
+		exit(0);
+	/* Now let's parse the frames and order them */
+	if(stream_window > 0 && data) {
+		JANUS_LOG(LOG_WARN, "Data recordings don't need the streaming mode, ignoring it\n");
+		stream_window = 0;
+	}
+	if(stream_window > 0) {
+		/* Streaming mode: packets are re-ordered in a bounded window, and processed in chunks as we go */
+		janus_pp_stream *stream = NULL;
+		if(video) {
+			/* We need a first pass to find out the resolution and framerate */
+			stream = janus_pp_stream_create(file, janus_pp_stream_preprocess);
+			count = janus_pp_parse_frames(file, fsize, c_time, stream);
+			janus_pp_stream_destroy(stream);
+			if(!working)
+				exit(0);
+			if(vp8 || vp9)
+				janus_pp_webm_preprocess_finish();
+			else if(h264)
+				janus_pp_h264_preprocess_finish();
+		}
+		if(parse_only) {
+			if(!video) {
+				stream = janus_pp_stream_create(file, janus_pp_stream_parse);
+				count = janus_pp_parse_frames(file, fsize, c_time, stream);
+				summary_dropped = stream->dropped;
+				janus_pp_stream_destroy(stream);
+			}
+			JANUS_LOG(LOG_INFO, "Parsing and reordering completed, bye!\n");
+			janus_pp_summary_write(source, NULL, NULL);
+			janus_pp_report(fsize, count);
+			exit(0);
+		}
+		if(janus_pp_create(destination) < 0)
+			exit(1);
+		stream = janus_pp_stream_create(file, janus_pp_stream_process);
+		count = janus_pp_parse_frames(file, fsize, c_time, stream);
+		janus_pp_stream_flush(stream);
+		JANUS_LOG(LOG_INFO, "Counted %"SCNu32" RTP packets (%"SCNu64" processed, %"SCNu64" late or duplicate)\n",
+			count, stream->processed, stream->dropped);
+		summary_dropped = stream->dropped;
+		janus_pp_stream_destroy(stream);
+		janus_pp_close();
+		janus_pp_source_close(file);
+		janus_pp_destination_size(destination);
+		janus_pp_summary_write(source, destination, NULL);
+		janus_pp_report(fsize, count);
+		JANUS_LOG(LOG_INFO, "Bye!\n");
+		return 0;
+	}
+	count = janus_pp_parse_frames(file, fsize, c_time, NULL);
 	if(!working)
 		exit(0);
 	
@@ -617,6 +1682,7 @@ int main(int argc, char *argv[])
 	count = 0;
 	while(tmp) {
 		count++;
+		janus_pp_summary_add(tmp);
 		if(!data)
 			JANUS_LOG(LOG_VERB, "[%10lu][%4d] seq=%"SCNu16", ts=%"SCNu64", time=%"SCNu64"s\n", tmp->offset, tmp->len, tmp->seq, tmp->ts, (tmp->ts-list->ts)/90000);
 		else
@@ -643,106 +1709,23 @@ int main(int argc, char *argv[])
 	if(parse_only) {
 		/* We only needed to parse and re-order the packets, we're done here */
 		JANUS_LOG(LOG_INFO, "Parsing and reordering completed, bye!\n");
+		janus_pp_summary_write(source, NULL, NULL);
 		exit(0);
 	}
 
-	if(!video && !data) {
-		if(opus) {
-			if(janus_pp_opus_create(destination) < 0) {
-				JANUS_LOG(LOG_ERR, "Error creating .opus file...\n");
-				exit(1);
-			}
-		} else if(g711) {
-			if(janus_pp_g711_create(destination) < 0) {
-				JANUS_LOG(LOG_ERR, "Error creating .wav file...\n");
-				exit(1);
-			}
-		} else if(g722) {
-			if(janus_pp_g722_create(destination) < 0) {
-				JANUS_LOG(LOG_ERR, "Error creating .wav file...\n");
-				exit(1);
-			}
-		}
-	} else if(data) {
-		if(janus_pp_srt_create(destination) < 0) {
-			JANUS_LOG(LOG_ERR, "Error creating .srt file...\n");
-			exit(1);
-		}
-	} else {
-		if(vp8 || vp9) {
-			if(janus_pp_webm_create(destination, vp8) < 0) {
-				JANUS_LOG(LOG_ERR, "Error creating .webm file...\n");
-				exit(1);
-			}
-		} else if(h264) {
-			if(janus_pp_h264_create(destination) < 0) {
-				JANUS_LOG(LOG_ERR, "Error creating .mp4 file...\n");
-				exit(1);
-			}
-		}
-	}
+	if(janus_pp_create(destination) < 0)
+		exit(1);
 	
 	/* Loop */
-	if(!video && !data) {
-		if(opus) {
-			if(janus_pp_opus_process(file, list, &working) < 0) {
-				JANUS_LOG(LOG_ERR, "Error processing Opus RTP frames...\n");
-			}
-		} else if(g711) {
-			if(janus_pp_g711_process(file, list, &working) < 0) {
-				JANUS_LOG(LOG_ERR, "Error processing G.711 RTP frames...\n");
-			}
-		} else if(g722) {
-			if(janus_pp_g722_process(file, list, &working) < 0) {
-				JANUS_LOG(LOG_ERR, "Error processing G.722 RTP frames...\n");
-			}
-		}
-	} else if(data) {
-		if(janus_pp_srt_process(file, list, &working) < 0) {
-			JANUS_LOG(LOG_ERR, "Error processing text data frames...\n");
-		}
-	} else {
-		if(vp8 || vp9) {
-			if(janus_pp_webm_process(file, list, vp8, &working) < 0) {
-				JANUS_LOG(LOG_ERR, "Error processing %s RTP frames...\n", vp8 ? "VP8" : "VP9");
-			}
-		} else {
-			if(janus_pp_h264_process(file, list, &working) < 0) {
-				JANUS_LOG(LOG_ERR, "Error processing H.264 RTP frames...\n");
-			}
-		}
-	}
+	janus_pp_process(file, list);
 
 	/* Clean up */
-	if(video) {
-		if(vp8 || vp9) {
-			janus_pp_webm_close();
-		} else {
-			janus_pp_h264_close();
-		}
-	} else if(data) {
-		janus_pp_srt_close();
-	} else {
-		if(opus) {
-			janus_pp_opus_close();
-		} else if(g711) {
-			janus_pp_g711_close();
-		} else if(g722) {
-			janus_pp_g722_close();
-		}
-	}
-	fclose(file);
+	janus_pp_close();
+	janus_pp_source_close(file);
 	
-	file = fopen(destination, "rb");
-	if(file == NULL) {
-		JANUS_LOG(LOG_INFO, "No destination file %s??\n", destination);
-	} else {
-		fseek(file, 0L, SEEK_END);
-		fsize = ftell(file);
-		fseek(file, 0L, SEEK_SET);
-		JANUS_LOG(LOG_INFO, "%s is %zu bytes\n", destination, fsize);
-		fclose(file);
-	}
+	janus_pp_destination_size(destination);
+	janus_pp_summary_write(source, destination, NULL);
+	janus_pp_report(fsize, count);
 	janus_pp_frame_packet *temp = list, *next = NULL;
 	while(temp) {
 		next = temp->next;
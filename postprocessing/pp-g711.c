@@ -153,6 +153,7 @@ int janus_pp_g711_process(FILE *file, janus_pp_frame_packet *list, int *working)
 	if(!file || !list || !working)
 		return -1;
 	janus_pp_frame_packet *tmp = list;
+	uint64_t first_ts = janus_pp_first_ts(list);
 	long int offset = 0;
 	int bytes = 0, len = 0, steps = 0, last_seq = 0;
 	uint8_t *buffer = g_malloc0(1500);
@@ -162,7 +163,7 @@ int janus_pp_g711_process(FILE *file, janus_pp_frame_packet *list, int *working)
 	while(*working && tmp != NULL) {
 		if(tmp->prev != NULL && (tmp->seq - tmp->prev->seq > 1)) {
 			JANUS_LOG(LOG_WARN, "Lost a packet here? (got seq %"SCNu16" after %"SCNu16", time ~%"SCNu64"s)\n",
-				tmp->seq, tmp->prev->seq, (tmp->ts-list->ts)/48000);
+				tmp->seq, tmp->prev->seq, (tmp->ts-first_ts)/48000);
 			/* FIXME Write the silence packet N times to fill in the gaps */
 			int i=0;
 			for(i=0; i<(tmp->seq-tmp->prev->seq-1); i++) {
@@ -181,7 +182,7 @@ int janus_pp_g711_process(FILE *file, janus_pp_frame_packet *list, int *working)
 		}
 		if(tmp->drop) {
 			/* We marked this packet as one to drop, before */
-			JANUS_LOG(LOG_WARN, "Dropping previously marked audio packet (time ~%"SCNu64"s)\n", (tmp->ts-list->ts)/48000);
+			JANUS_LOG(LOG_WARN, "Dropping previously marked audio packet (time ~%"SCNu64"s)\n", (tmp->ts-first_ts)/48000);
 			tmp = tmp->next;
 			continue;
 		}
@@ -201,7 +202,7 @@ int janus_pp_g711_process(FILE *file, janus_pp_frame_packet *list, int *working)
 			steps++;
 		}
 		JANUS_LOG(LOG_VERB, "Writing %d bytes out of %d (seq=%"SCNu16", step=%"SCNu16", ts=%"SCNu64", time=%"SCNu64"s)\n",
-			bytes, tmp->len, tmp->seq, diff, tmp->ts, (tmp->ts-list->ts)/8000);
+			bytes, tmp->len, tmp->seq, diff, tmp->ts, (tmp->ts-first_ts)/8000);
 		/* Decode and save to wav */
 		uint8_t *data = (uint8_t *)buffer;
 		int i=0;
@@ -23,6 +23,7 @@
 #include <libavformat/avformat.h>
 
 #include "pp-h264.h"
+#include "pp-mux.h"
 #include "../debug.h"
 
 
@@ -56,9 +57,13 @@ static AVStream *vStream;
 static AVCodecContext *vEncoder;
 #endif
 static int max_width = 0, max_height = 0, fps = 0;
+/* Shared by all the calls, in case we get the frames in chunks */
+static int min_ts_diff = 0, max_ts_diff = 0;
+static uint32_t keyframe_ts = 0;
 
 
-int janus_pp_h264_create(char *destination) {
+/* Create the output, either a regular MP4 file or live HLS segments */
+static int janus_pp_h264_create_format(char *destination, const char *format, AVDictionary **options) {
 	if(destination == NULL)
 		return -1;
 	/* Setup FFmpeg */
@@ -70,13 +75,13 @@ int janus_pp_h264_create(char *destination) {
 				(janus_log_level == LOG_WARN ? AV_LOG_WARNING :
 					(janus_log_level == LOG_INFO ? AV_LOG_INFO :
 						(janus_log_level == LOG_VERB ? AV_LOG_VERBOSE : AV_LOG_DEBUG))))));
-	/* MP4 output */
+	/* MP4 (or HLS) output */
 	fctx = avformat_alloc_context();
 	if(fctx == NULL) {
 		JANUS_LOG(LOG_ERR, "Error allocating context\n");
 		return -1;
 	}
-	fctx->oformat = av_guess_format("mp4", NULL, NULL);
+	fctx->oformat = av_guess_format(format, NULL, NULL);
 	if(fctx->oformat == NULL) {
 		JANUS_LOG(LOG_ERR, "Error guessing format\n");
 		return -1;
@@ -130,17 +135,44 @@ int janus_pp_h264_create(char *destination) {
 	//~ if (fctx->flags & AVFMT_GLOBALHEADER)
 		vStream->codec->flags |= CODEC_FLAG_GLOBAL_HEADER;
 #endif
-	if(avio_open(&fctx->pb, fctx->filename, AVIO_FLAG_WRITE) < 0) {
+	/* If we're muxing an audio recording as well, add a track for it */
+	if(janus_pp_mux_add_stream(fctx) < 0)
+		return -1;
+	/* Muxers like HLS open the files they write to themselves */
+	if(!(fctx->oformat->flags & AVFMT_NOFILE) && avio_open(&fctx->pb, fctx->filename, AVIO_FLAG_WRITE) < 0) {
 		JANUS_LOG(LOG_ERR, "Error opening file for output\n");
 		return -1;
 	}
-	if(avformat_write_header(fctx, NULL) < 0) {
+	if(avformat_write_header(fctx, options) < 0) {
 		JANUS_LOG(LOG_ERR, "Error writing header\n");
 		return -1;
 	}
 	return 0;
 }
 
+int janus_pp_h264_create(char *destination) {
+	return janus_pp_h264_create_format(destination, "mp4", NULL);
+}
+
+int janus_pp_h264_create_hls(char *destination, int segment) {
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(57, 83, 100)
+	JANUS_LOG(LOG_FATAL, "Your FFmpeg version does not support fragmented MP4 segments for HLS\n");
+	return -1;
+#else
+	/* Fragmented MP4 segments, and a playlist that grows as they're ready */
+	char value[16];
+	g_snprintf(value, sizeof(value), "%d", segment > 0 ? segment : 4);
+	AVDictionary *options = NULL;
+	av_dict_set(&options, "hls_segment_type", "fmp4", 0);
+	av_dict_set(&options, "hls_time", value, 0);
+	av_dict_set(&options, "hls_playlist_type", "event", 0);
+	av_dict_set(&options, "hls_flags", "independent_segments+temp_file", 0);
+	int res = janus_pp_h264_create_format(destination, "hls", &options);
+	av_dict_free(&options);
+	return res;
+#endif
+}
+
 /* Helpers to decode Exp-Golomb */
 static uint32_t janus_pp_h264_eg_getbit(uint8_t *base, uint32_t offset) {
 	return ((*(base + (offset >> 0x3))) >> (0x7 - (offset & 0x7))) & 0x1;
@@ -224,11 +256,12 @@ static void janus_pp_h264_parse_sps(char *buffer, int *width, int *height) {
 }
 
 
-int janus_pp_h264_preprocess(FILE *file, janus_pp_frame_packet *list) {
+int janus_pp_h264_preprocess_scan(FILE *file, janus_pp_frame_packet *list) {
 	if(!file || !list)
 		return -1;
 	janus_pp_frame_packet *tmp = list;
-	int bytes = 0, min_ts_diff = 0, max_ts_diff = 0;
+	uint64_t first_ts = janus_pp_first_ts(list);
+	int bytes = 0, found = 0;
 	char prebuffer[1500];
 	memset(prebuffer, 0, 1500);
 	while(tmp) {
@@ -242,7 +275,7 @@ int janus_pp_h264_preprocess(FILE *file, janus_pp_frame_packet *list) {
 			}
 			if(tmp->seq - tmp->prev->seq > 1) {
 				JANUS_LOG(LOG_WARN, "Lost a packet here? (got seq %"SCNu16" after %"SCNu16", time ~%"SCNu64"s)\n",
-					tmp->seq, tmp->prev->seq, (tmp->ts-list->ts)/90000); 
+					tmp->seq, tmp->prev->seq, (tmp->ts-first_ts)/90000); 
 			}
 		}
 		/* Parse H264 header now */
@@ -256,6 +289,7 @@ int janus_pp_h264_preprocess(FILE *file, janus_pp_frame_packet *list) {
 			JANUS_LOG(LOG_VERB, "Parsing width/height\n");
 			int width = 0, height = 0;
 			janus_pp_h264_parse_sps(prebuffer, &width, &height);
+			found++;
 			if(width > max_width)
 				max_width = width;
 			if(height > max_height)
@@ -278,6 +312,7 @@ int janus_pp_h264_preprocess(FILE *file, janus_pp_frame_packet *list) {
 					JANUS_LOG(LOG_VERB, "Parsing width/height\n");
 					int width = 0, height = 0;
 					janus_pp_h264_parse_sps(buffer, &width, &height);
+					found++;
 					if(width > max_width)
 						max_width = width;
 					if(height > max_height)
@@ -289,12 +324,16 @@ int janus_pp_h264_preprocess(FILE *file, janus_pp_frame_packet *list) {
 		}
 		if(tmp->drop) {
 			/* We marked this packet as one to drop, before */
-			JANUS_LOG(LOG_WARN, "Dropping previously marked video packet (time ~%"SCNu64"s)\n", (tmp->ts-list->ts)/90000);
+			JANUS_LOG(LOG_WARN, "Dropping previously marked video packet (time ~%"SCNu64"s)\n", (tmp->ts-first_ts)/90000);
 			tmp = tmp->next;
 			continue;
 		}
 		tmp = tmp->next;
 	}
+	return found;
+}
+
+void janus_pp_h264_preprocess_finish(void) {
 	int mean_ts = min_ts_diff;	/* FIXME: was an actual mean, (max_ts_diff+min_ts_diff)/2; */
 	fps = (90000/(mean_ts > 0 ? mean_ts : 30));
 	JANUS_LOG(LOG_INFO, "  -- %dx%d (fps [%d,%d] ~ %d)\n", max_width, max_height, min_ts_diff, max_ts_diff, fps);
@@ -307,6 +346,12 @@ int janus_pp_h264_preprocess(FILE *file, janus_pp_frame_packet *list) {
 		JANUS_LOG(LOG_WARN, "No fps?? assuming 1...\n");
 		fps = 1;	/* Prevent divide by zero error */
 	}
+}
+
+int janus_pp_h264_preprocess(FILE *file, janus_pp_frame_packet *list) {
+	if(janus_pp_h264_preprocess_scan(file, list) < 0)
+		return -1;
+	janus_pp_h264_preprocess_finish();
 	return 0;
 }
 
@@ -314,13 +359,13 @@ int janus_pp_h264_process(FILE *file, janus_pp_frame_packet *list, int *working)
 	if(!file || !list || !working)
 		return -1;
 	janus_pp_frame_packet *tmp = list;
+	uint64_t first_ts = janus_pp_first_ts(list);
 
 	int bytes = 0, numBytes = max_width*max_height*3;	/* FIXME */
 	uint8_t *received_frame = g_malloc0(numBytes);
 	uint8_t *buffer = g_malloc0(10000), *start = buffer;
 	int len = 0, frameLen = 0;
 	int keyFrame = 0;
-	uint32_t keyframe_ts = 0;
 
 	while(*working && tmp != NULL) {
 		keyFrame = 0;
@@ -357,7 +402,7 @@ int janus_pp_h264_process(FILE *file, janus_pp_frame_packet *list, int *working)
 				/* Is this the first keyframe we find? */
 				if(keyframe_ts == 0) {
 					keyframe_ts = tmp->ts;
-					JANUS_LOG(LOG_INFO, "First keyframe: %"SCNu64"\n", tmp->ts-list->ts);
+					JANUS_LOG(LOG_INFO, "First keyframe: %"SCNu64"\n", tmp->ts-first_ts);
 				}
 			}
 			/* Frame manipulation */
@@ -432,10 +477,12 @@ int janus_pp_h264_process(FILE *file, janus_pp_frame_packet *list, int *working)
 				packet.flags |= AV_PKT_FLAG_KEY;
 
 			/* First we save to the file... */
-			packet.dts = tmp->ts-list->ts;
-			packet.pts = tmp->ts-list->ts;
+			packet.dts = tmp->ts-first_ts + janus_pp_mux_video_offset()*90/1000;
+			packet.pts = packet.dts;
+			/* If we're muxing audio too, write all the audio frames that come before this */
+			janus_pp_mux_write(fctx, packet.pts*1000/90);
 			JANUS_LOG(LOG_HUGE, "%"SCNu64" - %"SCNu64" --> %"SCNu64"\n",
-				tmp->ts, list->ts, packet.pts);
+				tmp->ts, first_ts, packet.pts);
 			if(fctx) {
 				int res = av_write_frame(fctx, &packet);
 				if(res < 0) {
@@ -452,6 +499,7 @@ int janus_pp_h264_process(FILE *file, janus_pp_frame_packet *list, int *working)
 
 /* Close MP4 file */
 void janus_pp_h264_close(void) {
+	janus_pp_mux_close(fctx);
 	if(fctx != NULL)
 		av_write_trailer(fctx);
 #ifdef USE_CODECPAR
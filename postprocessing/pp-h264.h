@@ -18,7 +18,10 @@
 
 /* H.264 stuff */
 int janus_pp_h264_create(char *destination);
+int janus_pp_h264_create_hls(char *destination, int segment);
 int janus_pp_h264_preprocess(FILE *file, janus_pp_frame_packet *list);
+int janus_pp_h264_preprocess_scan(FILE *file, janus_pp_frame_packet *list);
+void janus_pp_h264_preprocess_finish(void);
 int janus_pp_h264_process(FILE *file, janus_pp_frame_packet *list, int *working);
 void janus_pp_h264_close(void);
 
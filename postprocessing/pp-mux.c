@@ -0,0 +1,160 @@
+/*! \file    pp-mux.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Post-processing to add an Opus track to video files
+ * \details  Implementation of the post-processing code (based on FFmpeg)
+ * needed to add the Opus frames of an audio recording to the .webm or
+ * .mp4 file generated out of the related video recording. The video
+ * processors call this code before writing each frame, so that audio
+ * frames are interleaved with video frames in the right order.
+ *
+ * \ingroup postprocessing
+ * \ref postprocessing
+ */
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include "pp-mux.h"
+#include "../debug.h"
+
+
+#define LIBAVCODEC_VER_AT_LEAST(major, minor) \
+	(LIBAVCODEC_VERSION_MAJOR > major || \
+	 (LIBAVCODEC_VERSION_MAJOR == major && \
+	  LIBAVCODEC_VERSION_MINOR >= minor))
+
+#if LIBAVCODEC_VER_AT_LEAST(56, 56)
+#ifndef FF_INPUT_BUFFER_PADDING_SIZE
+#define FF_INPUT_BUFFER_PADDING_SIZE AV_INPUT_BUFFER_PADDING_SIZE
+#endif
+#endif
+
+#if LIBAVCODEC_VER_AT_LEAST(57, 14)
+#define USE_CODECPAR
+#endif
+
+
+/* Audio track */
+static FILE *audio_file = NULL;
+static janus_pp_frame_packet *audio_list = NULL, *audio_next = NULL;
+static uint64_t audio_first_ts = 0;
+/* Offsets (in microseconds) to add to audio and video, depending on which started first */
+static int64_t audio_offset = 0, video_offset = 0;
+static AVStream *aStream = NULL;
+
+void janus_pp_mux_init(FILE *file, janus_pp_frame_packet *list, int64_t audio_written, int64_t video_written) {
+	audio_file = file;
+	audio_list = list;
+	audio_next = list;
+	audio_first_ts = list ? list->ts : 0;
+	/* Whatever started first is at time 0 */
+	if(audio_written > video_written) {
+		audio_offset = audio_written - video_written;
+		video_offset = 0;
+	} else {
+		audio_offset = 0;
+		video_offset = video_written - audio_written;
+	}
+	JANUS_LOG(LOG_INFO, "Muxing audio and video (audio offset %"SCNi64"us, video offset %"SCNi64"us)\n",
+		audio_offset, video_offset);
+}
+
+int64_t janus_pp_mux_video_offset(void) {
+	return audio_list ? video_offset : 0;
+}
+
+int janus_pp_mux_add_stream(AVFormatContext *fctx) {
+	if(fctx == NULL || audio_list == NULL)
+		return 0;
+#if LIBAVCODEC_VERSION_MAJOR < 55
+	JANUS_LOG(LOG_FATAL, "Your FFmpeg version does not support Opus\n");
+	return -1;
+#else
+	aStream = avformat_new_stream(fctx, 0);
+	if(aStream == NULL) {
+		JANUS_LOG(LOG_ERR, "Error adding audio stream\n");
+		return -1;
+	}
+	aStream->id = fctx->nb_streams-1;
+	aStream->time_base = (AVRational){1, 48000};
+	/* Containers need an OpusHead as codec private data (RFC 7845) */
+	uint8_t *opushead = av_mallocz(19 + FF_INPUT_BUFFER_PADDING_SIZE);
+	memcpy(opushead, "OpusHead", 8);
+	opushead[8] = 1;	/* Version */
+	opushead[9] = 2;	/* Channels */
+	opushead[12] = 48000 & 0xFF;	/* Input sample rate (little endian) */
+	opushead[13] = (48000 >> 8) & 0xFF;
+	opushead[14] = (48000 >> 16) & 0xFF;
+#ifdef USE_CODECPAR
+	aStream->codecpar->codec_type = AVMEDIA_TYPE_AUDIO;
+	aStream->codecpar->codec_id = AV_CODEC_ID_OPUS;
+	aStream->codecpar->sample_rate = 48000;
+	aStream->codecpar->channels = 2;
+	aStream->codecpar->extradata = opushead;
+	aStream->codecpar->extradata_size = 19;
+#else
+	aStream->codec->codec_type = AVMEDIA_TYPE_AUDIO;
+	aStream->codec->codec_id = AV_CODEC_ID_OPUS;
+	aStream->codec->sample_rate = 48000;
+	aStream->codec->channels = 2;
+	aStream->codec->time_base = (AVRational){1, 48000};
+	aStream->codec->extradata = opushead;
+	aStream->codec->extradata_size = 19;
+	if(fctx->oformat->flags & AVFMT_GLOBALHEADER)
+		aStream->codec->flags |= CODEC_FLAG_GLOBAL_HEADER;
+#endif
+	/* Older versions of the MP4 muxer consider Opus experimental */
+	fctx->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+	return 0;
+#endif
+}
+
+void janus_pp_mux_write(AVFormatContext *fctx, int64_t until) {
+	if(fctx == NULL || aStream == NULL)
+		return;
+	uint8_t buffer[1500+FF_INPUT_BUFFER_PADDING_SIZE];
+	while(audio_next != NULL) {
+		janus_pp_frame_packet *tmp = audio_next;
+		int64_t when = (int64_t)((tmp->ts - audio_first_ts)*1000/48) + audio_offset;
+		if(when > until)
+			break;
+		audio_next = tmp->next;
+		if(tmp->drop)
+			continue;
+		int len = tmp->len-12-tmp->skip;
+		if(len <= 0 || len > 1500)
+			continue;
+		fseek(audio_file, tmp->offset+12+tmp->skip, SEEK_SET);
+		int bytes = fread(buffer, sizeof(char), len, audio_file);
+		if(bytes != len) {
+			JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, len);
+			continue;
+		}
+		memset(buffer + len, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+		AVPacket packet;
+		av_init_packet(&packet);
+		packet.stream_index = aStream->index;
+		packet.data = buffer;
+		packet.size = len;
+		packet.flags |= AV_PKT_FLAG_KEY;
+		packet.dts = av_rescale_q(when, (AVRational){1, 1000000}, aStream->time_base);
+		packet.pts = packet.dts;
+		if(av_write_frame(fctx, &packet) < 0) {
+			JANUS_LOG(LOG_ERR, "Error writing audio frame to file...\n");
+		}
+	}
+}
+
+void janus_pp_mux_close(AVFormatContext *fctx) {
+	if(aStream == NULL)
+		return;
+	/* Write whatever is left, before the trailer */
+	janus_pp_mux_write(fctx, INT64_MAX);
+	aStream = NULL;
+}
@@ -0,0 +1,31 @@
+/*! \file    pp-mux.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Post-processing to add an Opus track to video files (headers)
+ * \details  Implementation of the post-processing code (based on FFmpeg)
+ * needed to add the Opus frames of an audio recording to the .webm or
+ * .mp4 file generated out of the related video recording, so that they
+ * don't need to be muxed by an external tool later on. Audio and video
+ * are synced using the time the first frame was written to each
+ * recording, as saved by Janus in their info header.
+ *
+ * \ingroup postprocessing
+ * \ref postprocessing
+ */
+
+#ifndef _JANUS_PP_MUX
+#define _JANUS_PP_MUX
+
+#include <stdio.h>
+
+#include <libavformat/avformat.h>
+
+#include "pp-rtp.h"
+
+void janus_pp_mux_init(FILE *file, janus_pp_frame_packet *list, int64_t audio_written, int64_t video_written);
+int64_t janus_pp_mux_video_offset(void);
+int janus_pp_mux_add_stream(AVFormatContext *fctx);
+void janus_pp_mux_write(AVFormatContext *fctx, int64_t until);
+void janus_pp_mux_close(AVFormatContext *fctx);
+
+#endif
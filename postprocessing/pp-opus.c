@@ -67,6 +67,7 @@ int janus_pp_opus_process(FILE *file, janus_pp_frame_packet *list, int *working)
 	if(!file || !list || !working)
 		return -1;
 	janus_pp_frame_packet *tmp = list;
+	uint64_t first_ts = janus_pp_first_ts(list);
 	long int offset = 0;
 	int bytes = 0, len = 0, steps = 0, last_seq = 0;
 	uint64_t pos = 0;
@@ -74,16 +75,16 @@ int janus_pp_opus_process(FILE *file, janus_pp_frame_packet *list, int *working)
 	while(*working && tmp != NULL) {
 		if(tmp->prev != NULL && ((tmp->ts - tmp->prev->ts)/48/20 > 1)) {
 			JANUS_LOG(LOG_WARN, "Lost a packet here? (got seq %"SCNu16" after %"SCNu16", time ~%"SCNu64"s)\n",
-				tmp->seq, tmp->prev->seq, (tmp->ts-list->ts)/48000);
+				tmp->seq, tmp->prev->seq, (tmp->ts-first_ts)/48000);
 			/* FIXME Write the silence packet N times to fill in the gaps */
 			ogg_packet *op = op_from_pkt((const unsigned char *)opus_silence, sizeof(opus_silence));
 			/* use ts differ to insert silence packet */
 			int silence_count = (tmp->ts - tmp->prev->ts)/48/20 - 1;
-			pos = (tmp->prev->ts - list->ts) / 48 / 20 + 1;
+			pos = (tmp->prev->ts - first_ts) / 48 / 20 + 1;
 			JANUS_LOG(LOG_WARN, "[FILL] pos: %06"SCNu64", writing silences (count=%d)\n", pos, silence_count);
 			int i=0;
 			for(i=0; i<silence_count; i++) {
-				pos = (tmp->prev->ts - list->ts) / 48 / 20 + i + 1;
+				pos = (tmp->prev->ts - first_ts) / 48 / 20 + i + 1;
 				op->granulepos = 960*(pos); /* FIXME: get this from the toc byte */
 				ogg_stream_packetin(stream, op);
 				ogg_write();
@@ -93,7 +94,7 @@ int janus_pp_opus_process(FILE *file, janus_pp_frame_packet *list, int *working)
 		}
 		if(tmp->drop) {
 			/* We marked this packet as one to drop, before */
-			JANUS_LOG(LOG_WARN, "Dropping previously marked audio packet (time ~%"SCNu64"s)\n", (tmp->ts-list->ts)/48000);
+			JANUS_LOG(LOG_WARN, "Dropping previously marked audio packet (time ~%"SCNu64"s)\n", (tmp->ts-first_ts)/48000);
 			tmp = tmp->next;
 			continue;
 		}
@@ -113,9 +114,9 @@ int janus_pp_opus_process(FILE *file, janus_pp_frame_packet *list, int *working)
 			steps++;
 		}
 		ogg_packet *op = op_from_pkt((const unsigned char *)buffer, bytes);
-		pos = (tmp->ts - list->ts) / 48 / 20;
+		pos = (tmp->ts - first_ts) / 48 / 20;
 		JANUS_LOG(LOG_VERB, "pos: %06"SCNu64", writing %d bytes out of %d (seq=%"SCNu16", step=%"SCNu16", ts=%"SCNu64", time=%"SCNu64"s)\n",
-			pos, bytes, tmp->len, tmp->seq, diff, tmp->ts, (tmp->ts-list->ts)/48000);
+			pos, bytes, tmp->len, tmp->seq, diff, tmp->ts, (tmp->ts-first_ts)/48000);
 		op->granulepos = 960*(pos); /* FIXME: get this from the toc byte */
 		ogg_stream_packetin(stream, op);
 		g_free(op);
@@ -54,5 +54,16 @@ typedef struct janus_pp_frame_packet {
 	struct janus_pp_frame_packet *prev;
 } janus_pp_frame_packet;
 
+/* Get the timestamp of the first packet, going back from any packet in
+ * the list: in streaming mode, the processors only get a chunk at a time,
+ * whose head points back to the last packet of the previous chunk, which
+ * in turn points to the very first packet in the recording */
+static inline uint64_t janus_pp_first_ts(janus_pp_frame_packet *list) {
+	janus_pp_frame_packet *first = list;
+	while(first->prev != NULL)
+		first = first->prev;
+	return first->ts;
+}
+
 
 #endif
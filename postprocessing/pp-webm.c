@@ -23,6 +23,7 @@
 #include <libavformat/avformat.h>
 
 #include "pp-webm.h"
+#include "pp-mux.h"
 #include "../debug.h"
 
 
@@ -65,6 +66,9 @@ static AVStream *vStream;
 static AVCodecContext *vEncoder;
 #endif
 static int max_width = 0, max_height = 0, fps = 0;
+/* Shared by all the calls, in case we get the frames in chunks */
+static int min_ts_diff = 0, max_ts_diff = 0;
+static uint32_t keyframe_ts = 0;
 
 int janus_pp_webm_create(char *destination, int vp8) {
 	if(destination == NULL)
@@ -151,6 +155,9 @@ int janus_pp_webm_create(char *destination, int vp8) {
 	if (fctx->flags & AVFMT_GLOBALHEADER)
 		vStream->codec->flags |= CODEC_FLAG_GLOBAL_HEADER;
 #endif
+	/* If we're muxing an audio recording as well, add a track for it */
+	if(janus_pp_mux_add_stream(fctx) < 0)
+		return -1;
 	//~ fctx->timestamp = 0;
 	//~ if(url_fopen(&fctx->pb, fctx->filename, URL_WRONLY) < 0) {
 	if(avio_open(&fctx->pb, fctx->filename, AVIO_FLAG_WRITE) < 0) {
@@ -169,11 +176,12 @@ int janus_pp_webm_create(char *destination, int vp8) {
 	return 0;
 }
 
-int janus_pp_webm_preprocess(FILE *file, janus_pp_frame_packet *list, int vp8) {
+int janus_pp_webm_preprocess_scan(FILE *file, janus_pp_frame_packet *list, int vp8) {
 	if(!file || !list)
 		return -1;
 	janus_pp_frame_packet *tmp = list;
-	int bytes = 0, min_ts_diff = 0, max_ts_diff = 0;
+	uint64_t first_ts = janus_pp_first_ts(list);
+	int bytes = 0;
 	char prebuffer[1500];
 	memset(prebuffer, 0, 1500);
 	while(tmp) {
@@ -187,12 +195,12 @@ int janus_pp_webm_preprocess(FILE *file, janus_pp_frame_packet *list, int vp8) {
 			}
 			if(tmp->prev != NULL && (tmp->seq - tmp->prev->seq > 1)) {
 				JANUS_LOG(LOG_WARN, "Lost a packet here? (got seq %"SCNu16" after %"SCNu16", time ~%"SCNu64"s)\n",
-					tmp->seq, tmp->prev->seq, (tmp->ts-list->ts)/90000);
+					tmp->seq, tmp->prev->seq, (tmp->ts-first_ts)/90000);
 			}
 		}
 		if(tmp->drop) {
 			/* We marked this packet as one to drop, before */
-			JANUS_LOG(LOG_WARN, "Dropping previously marked video packet (time ~%"SCNu64"s)\n", (tmp->ts-list->ts)/90000);
+			JANUS_LOG(LOG_WARN, "Dropping previously marked video packet (time ~%"SCNu64"s)\n", (tmp->ts-first_ts)/90000);
 			tmp = tmp->next;
 			continue;
 		}
@@ -338,6 +346,10 @@ int janus_pp_webm_preprocess(FILE *file, janus_pp_frame_packet *list, int vp8) {
 		}
 		tmp = tmp->next;
 	}
+	return 0;
+}
+
+void janus_pp_webm_preprocess_finish(void) {
 	int mean_ts = min_ts_diff;	/* FIXME: was an actual mean, (max_ts_diff+min_ts_diff)/2; */
 	fps = (90000/(mean_ts > 0 ? mean_ts : 30));
 	JANUS_LOG(LOG_INFO, "  -- %dx%d (fps [%d,%d] ~ %d)\n", max_width, max_height, min_ts_diff, max_ts_diff, fps);
@@ -350,6 +362,12 @@ int janus_pp_webm_preprocess(FILE *file, janus_pp_frame_packet *list, int vp8) {
 		JANUS_LOG(LOG_WARN, "No fps?? assuming 1...\n");
 		fps = 1;	/* Prevent divide by zero error */
 	}
+}
+
+int janus_pp_webm_preprocess(FILE *file, janus_pp_frame_packet *list, int vp8) {
+	if(janus_pp_webm_preprocess_scan(file, list, vp8) < 0)
+		return -1;
+	janus_pp_webm_preprocess_finish();
 	return 0;
 }
 
@@ -357,13 +375,13 @@ int janus_pp_webm_process(FILE *file, janus_pp_frame_packet *list, int vp8, int
 	if(!file || !list || !working)
 		return -1;
 	janus_pp_frame_packet *tmp = list;
+	uint64_t first_ts = janus_pp_first_ts(list);
 
 	int bytes = 0, numBytes = max_width*max_height*3;	/* FIXME */
 	uint8_t *received_frame = g_malloc0(numBytes);
 	uint8_t *buffer = g_malloc0(10000), *start = buffer;
 	int len = 0, frameLen = 0;
 	int keyFrame = 0;
-	uint32_t keyframe_ts = 0;
 
 	while(*working && tmp != NULL) {
 		keyFrame = 0;
@@ -458,7 +476,7 @@ int janus_pp_webm_process(FILE *file, janus_pp_frame_packet *list, int vp8, int
 							/* Is this the first keyframe we find? */
 							if(keyframe_ts == 0) {
 								keyframe_ts = tmp->ts;
-								JANUS_LOG(LOG_INFO, "First keyframe: %"SCNu64"\n", tmp->ts-list->ts);
+								JANUS_LOG(LOG_INFO, "First keyframe: %"SCNu64"\n", tmp->ts-first_ts);
 							}
 						}
 					}
@@ -542,7 +560,7 @@ int janus_pp_webm_process(FILE *file, janus_pp_frame_packet *list, int vp8, int
 						 * (FIXME assuming this really means "keyframe...) */
 						if(keyframe_ts == 0) {
 							keyframe_ts = tmp->ts;
-							JANUS_LOG(LOG_INFO, "First keyframe: %"SCNu64"\n", tmp->ts-list->ts);
+							JANUS_LOG(LOG_INFO, "First keyframe: %"SCNu64"\n", tmp->ts-first_ts);
 						}
 					}
 					if(gbit) {
@@ -600,8 +618,10 @@ int janus_pp_webm_process(FILE *file, janus_pp_frame_packet *list, int vp8, int
 			/* First we save to the file... */
 			//~ packet.dts = AV_NOPTS_VALUE;
 			//~ packet.pts = AV_NOPTS_VALUE;
-			packet.dts = (tmp->ts-list->ts)/90;
-			packet.pts = (tmp->ts-list->ts)/90;
+			packet.dts = (tmp->ts-first_ts)/90 + janus_pp_mux_video_offset()/1000;
+			packet.pts = packet.dts;
+			/* If we're muxing audio too, write all the audio frames that come before this */
+			janus_pp_mux_write(fctx, packet.pts*1000);
 			if(fctx) {
 				if(av_write_frame(fctx, &packet) < 0) {
 					JANUS_LOG(LOG_ERR, "Error writing video frame to file...\n");
@@ -617,6 +637,7 @@ int janus_pp_webm_process(FILE *file, janus_pp_frame_packet *list, int vp8, int
 
 /* Close WebM file */
 void janus_pp_webm_close(void) {
+	janus_pp_mux_close(fctx);
 	if(fctx != NULL)
 		av_write_trailer(fctx);
 #ifdef USE_CODECPAR
@@ -19,6 +19,8 @@
 /* WebM stuff */
 int janus_pp_webm_create(char *destination, int vp8);
 int janus_pp_webm_preprocess(FILE *file, janus_pp_frame_packet *list, int vp8);
+int janus_pp_webm_preprocess_scan(FILE *file, janus_pp_frame_packet *list, int vp8);
+void janus_pp_webm_preprocess_finish(void);
 int janus_pp_webm_process(FILE *file, janus_pp_frame_packet *list, int vp8, int *working);
 void janus_pp_webm_close(void);
 
@@ -0,0 +1,151 @@
+/*! \file    record-index.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Seek index for .mjr recordings
+ * \details  Recorders can optionally save an index of the recording in a
+ * sidecar file, named after the recording with an additional \c .idx
+ * extension, which readers can use to seek and to get the duration of a
+ * recording without parsing it all. Check record-index.h for a description
+ * of the format.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include <string.h>
+#include <sys/stat.h>
+
+#include "record-index.h"
+#include "debug.h"
+
+/* Helpers to serialize values in network byte order */
+static void janus_recorder_index_put(guint8 *buf, guint64 value, int bytes) {
+	int i = 0;
+	for(i=bytes-1; i>=0; i--) {
+		buf[i] = value & 0xFF;
+		value >>= 8;
+	}
+}
+
+static guint64 janus_recorder_index_get(const guint8 *buf, int bytes) {
+	guint64 value = 0;
+	int i = 0;
+	for(i=0; i<bytes; i++)
+		value = (value << 8) | buf[i];
+	return value;
+}
+
+int janus_recorder_index_write_header(FILE *file) {
+	if(file == NULL)
+		return -1;
+	if(fwrite(JANUS_RECORDER_INDEX_MAGIC, sizeof(char), strlen(JANUS_RECORDER_INDEX_MAGIC), file) != strlen(JANUS_RECORDER_INDEX_MAGIC))
+		return -2;
+	return 0;
+}
+
+int janus_recorder_index_write_entry(FILE *file, janus_recorder_index_entry *entry) {
+	if(file == NULL || entry == NULL)
+		return -1;
+	guint8 buf[JANUS_RECORDER_INDEX_ENTRY_SIZE];
+	memset(buf, 0, sizeof(buf));
+	janus_recorder_index_put(buf, entry->offset, 8);
+	janus_recorder_index_put(buf+8, (guint64)entry->saved, 8);
+	janus_recorder_index_put(buf+16, entry->timestamp, 4);
+	janus_recorder_index_put(buf+20, entry->seq, 2);
+	buf[22] = entry->flags;
+	if(fwrite(buf, sizeof(char), sizeof(buf), file) != sizeof(buf))
+		return -2;
+	return 0;
+}
+
+janus_recorder_index *janus_recorder_index_load(const char *recording, long size) {
+	if(recording == NULL)
+		return NULL;
+	if(size <= 0) {
+		struct stat s;
+		if(stat(recording, &s) < 0)
+			return NULL;
+		size = s.st_size;
+	}
+	char path[1024];
+	g_snprintf(path, sizeof(path), "%s.idx", recording);
+	FILE *file = fopen(path, "rb");
+	if(file == NULL)
+		return NULL;
+	char magic[8];
+	if(fread(magic, sizeof(char), sizeof(magic), file) != sizeof(magic) ||
+			memcmp(magic, JANUS_RECORDER_INDEX_MAGIC, sizeof(magic))) {
+		JANUS_LOG(LOG_WARN, "Invalid index file %s, ignoring it\n", path);
+		fclose(file);
+		return NULL;
+	}
+	janus_recorder_index *index = g_malloc0(sizeof(janus_recorder_index));
+	size_t allocated = 0;
+	guint8 buf[JANUS_RECORDER_INDEX_ENTRY_SIZE];
+	while(fread(buf, sizeof(char), sizeof(buf), file) == sizeof(buf)) {
+		janus_recorder_index_entry entry;
+		entry.offset = janus_recorder_index_get(buf, 8);
+		entry.saved = (gint64)janus_recorder_index_get(buf+8, 8);
+		entry.timestamp = janus_recorder_index_get(buf+16, 4);
+		entry.seq = janus_recorder_index_get(buf+20, 2);
+		entry.flags = buf[22];
+		/* Ignore entries pointing to data that didn't make it to the recording */
+		if(entry.offset >= (guint64)size)
+			break;
+		/* Entries are appended in order, anything else means the index is broken */
+		if(index->count > 0 && (entry.offset < index->entries[index->count-1].offset ||
+				entry.saved < index->entries[index->count-1].saved)) {
+			JANUS_LOG(LOG_WARN, "Out of order entry in index file %s, ignoring the rest\n", path);
+			break;
+		}
+		if(index->count == allocated) {
+			allocated = allocated ? allocated*2 : 256;
+			index->entries = g_realloc(index->entries, allocated * sizeof(janus_recorder_index_entry));
+		}
+		index->entries[index->count] = entry;
+		index->count++;
+	}
+	fclose(file);
+	if(index->count == 0) {
+		janus_recorder_index_free(index);
+		return NULL;
+	}
+	return index;
+}
+
+gint64 janus_recorder_index_duration(janus_recorder_index *index) {
+	if(index == NULL || index->count == 0)
+		return 0;
+	return index->entries[index->count-1].saved - index->entries[0].saved;
+}
+
+const janus_recorder_index_entry *janus_recorder_index_seek(janus_recorder_index *index, gint64 position, gboolean keyframe) {
+	if(index == NULL || index->count == 0)
+		return NULL;
+	gint64 target = index->entries[0].saved + (position > 0 ? position : 0);
+	/* Find the last entry saved at or before the target */
+	size_t low = 0, high = index->count;
+	while(low < high) {
+		size_t middle = low + (high - low)/2;
+		if(index->entries[middle].saved <= target)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	if(low == 0)
+		return NULL;
+	size_t i = low;
+	while(i > 0) {
+		i--;
+		if(!keyframe || (index->entries[i].flags & JANUS_RECORDER_INDEX_KEYFRAME))
+			return &index->entries[i];
+	}
+	return NULL;
+}
+
+void janus_recorder_index_free(janus_recorder_index *index) {
+	if(index == NULL)
+		return;
+	g_free(index->entries);
+	g_free(index);
+}
@@ -0,0 +1,102 @@
+/*! \file    record-index.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Seek index for .mjr recordings (headers)
+ * \details  Recorders can optionally save an index of the recording in a
+ * sidecar file, named after the recording with an additional \c .idx
+ * extension (e.g., \c rec.mjr --> \c rec.mjr.idx), which means the
+ * \c .mjr format itself doesn't change and existing tools can still read
+ * the recordings as before. The index starts with a \c MJRIDX01 magic
+ * string, followed by fixed size entries in network byte order, each
+ * pointing to a frame in the recording:
+ *
+\verbatim
+ 0               8              16      20  22 23 24
+ +---------------+---------------+-------+---+--+--+
+ |  file offset  |  saved (us)   |  ts   |seq|fl|  |
+ +---------------+---------------+-------+---+--+--+
+\endverbatim
+ *
+ * where the offset is the position of the \c MEETECHO frame header in the
+ * \c .mjr file, the saved time is the real time the frame was saved at,
+ * and timestamp and sequence number are those of the RTP packet (zero
+ * for data). Entries are added periodically, for all video keyframes,
+ * and for the last frame when the recording is closed: as such, they're
+ * sorted by offset and time, which allows readers to find where to start
+ * from with a binary search, and to know how long a recording is without
+ * reading it all. Entries pointing beyond the end of the recording (e.g.,
+ * because the recorder didn't get to write the data) are ignored.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef _JANUS_RECORD_INDEX_H
+#define _JANUS_RECORD_INDEX_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include <glib.h>
+
+/*! \brief Magic string at the beginning of index files */
+#define JANUS_RECORDER_INDEX_MAGIC		"MJRIDX01"
+/*! \brief Size of each entry in an index file */
+#define JANUS_RECORDER_INDEX_ENTRY_SIZE	24
+/*! \brief Flag for entries pointing to the beginning of a video keyframe */
+#define JANUS_RECORDER_INDEX_KEYFRAME	(1 << 0)
+/*! \brief Flag for the entry pointing to the last frame of a complete recording */
+#define JANUS_RECORDER_INDEX_LAST		(1 << 1)
+
+/*! \brief Entry in a recording index */
+typedef struct janus_recorder_index_entry {
+	/*! \brief Offset of the frame in the recording */
+	guint64 offset;
+	/*! \brief Real time the frame was saved at, in microseconds */
+	gint64 saved;
+	/*! \brief RTP timestamp of the frame (zero for data) */
+	guint32 timestamp;
+	/*! \brief RTP sequence number of the frame (zero for data) */
+	guint16 seq;
+	/*! \brief Flags for this entry (e.g., JANUS_RECORDER_INDEX_KEYFRAME) */
+	guint8 flags;
+} janus_recorder_index_entry;
+
+/*! \brief Index of a recording, as loaded from its sidecar file */
+typedef struct janus_recorder_index {
+	/*! \brief Entries, sorted by offset */
+	janus_recorder_index_entry *entries;
+	/*! \brief Number of entries */
+	size_t count;
+} janus_recorder_index;
+
+/*! \brief Write the magic string to a new index file
+ * @param[in] file The index file to write to
+ * @returns 0 in case of success, a negative integer otherwise */
+int janus_recorder_index_write_header(FILE *file);
+/*! \brief Append an entry to an index file
+ * @param[in] file The index file to write to
+ * @param[in] entry The entry to append
+ * @returns 0 in case of success, a negative integer otherwise */
+int janus_recorder_index_write_entry(FILE *file, janus_recorder_index_entry *entry);
+
+/*! \brief Load the index of a recording, if available
+ * @param[in] recording Path to the recording (the index path is derived from it)
+ * @param[in] size Size of the recording, to ignore entries beyond it (0 to check it here)
+ * @returns A janus_recorder_index instance, or NULL if there's no valid index */
+janus_recorder_index *janus_recorder_index_load(const char *recording, long size);
+/*! \brief Get the duration of an indexed recording
+ * @param[in] index The index of the recording
+ * @returns The time between the first and the last indexed frames, in microseconds */
+gint64 janus_recorder_index_duration(janus_recorder_index *index);
+/*! \brief Find where to start reading a recording from, to play it from a specific position
+ * @param[in] index The index of the recording
+ * @param[in] position The position to seek to, in microseconds from the first frame
+ * @param[in] keyframe Whether only entries for keyframes should be returned
+ * @returns The last suitable entry at or before the position, or NULL if there's none */
+const janus_recorder_index_entry *janus_recorder_index_seek(janus_recorder_index *index, gint64 position, gboolean keyframe);
+/*! \brief Free an index
+ * @param[in] index The index to free */
+void janus_recorder_index_free(janus_recorder_index *index);
+
+#endif
@@ -27,6 +27,10 @@
 #include "record.h"
 #include "debug.h"
 #include "utils.h"
+#include "metrics.h"
+#include "memory.h"
+#include "rtp.h"
+#include "trace.h"
 
 #define htonll(x) ((1==htonl(1)) ? (x) : ((gint64)htonl((x) & 0xFFFFFFFF) << 32) | htonl((x) >> 32))
 #define ntohll(x) ((1==ntohl(1)) ? (x) : ((gint64)ntohl((x) & 0xFFFFFFFF) << 32) | ntohl((x) >> 32))
@@ -42,8 +46,50 @@ static gboolean rec_tempname = FALSE;
 /* Extension to add in case tempnames is true (default="tmp" --> ".tmp") */
 static char *rec_tempext = NULL;
 
+/* Whether recorders should save a seek index as well (default=false) */
+static gboolean rec_index = FALSE;
+/* How often frames are added to the index, besides keyframes (1s) */
+#define JANUS_RECORDER_INDEX_INTERVAL	G_USEC_PER_SEC
+
+/* Asynchronous writers: when enabled, recorders append frames to an
+ * in-memory block, and full blocks are written to disk by a pool of threads */
+typedef struct janus_recorder_block {
+	janus_recorder *recorder;
+	char *data;
+	size_t len;
+	gint64 started;
+	gint64 queued;
+} janus_recorder_block;
+typedef struct janus_recorder_writer {
+	guint id;
+	GThread *thread;
+	GAsyncQueue *queue;
+	janus_metric *depth;
+	janus_metric *bytes;
+	janus_metric *flushes;
+	janus_metric *flush_time;
+	janus_metric *errors;
+	/* Recorders served by this writer, so that it can flush those that went idle */
+	GList *recorders;
+	janus_mutex mutex;
+} janus_recorder_writer;
+static janus_recorder_writer *rec_writers = NULL;
+static guint rec_writers_num = 0;
+static volatile gint rec_writers_next = 0;
+/* Size of the blocks, and maximum amount of data per recorder waiting to be written */
+static size_t rec_block_size = 0, rec_max_pending = 0;
+/* Blocks that are not full yet are handed to the writer anyway after this long (1s) */
+#define JANUS_RECORDER_BLOCK_MAX_AGE	G_USEC_PER_SEC
+static janus_metric *rec_dropped = NULL;
+/* Account for the memory of the blocks recorders are filling or waiting to write */
+static janus_memory_account *rec_memory = NULL;
+/* Fake block we use to tell writer threads to stop */
+static janus_recorder_block rec_exit_block;
+static void janus_recorder_block_queue(janus_recorder *recorder);
+
 void janus_recorder_init(gboolean tempnames, const char *extension) {
 	JANUS_LOG(LOG_INFO, "Initializing recorder code\n");
+	rec_memory = janus_memory_account_create("recordings", NULL);
 	if(tempnames) {
 		rec_tempname = TRUE;
 		if(extension == NULL) {
@@ -56,9 +102,190 @@ void janus_recorder_init(gboolean tempnames, const char *extension) {
 	}
 }
 
+void janus_recorder_enable_index(gboolean enabled) {
+	rec_index = enabled;
+	if(rec_index)
+		JANUS_LOG(LOG_INFO, "  -- Saving a seek index for recordings\n");
+}
+
+static janus_recorder_block *janus_recorder_block_new(void) {
+	janus_recorder_block *block = g_malloc0(sizeof(janus_recorder_block));
+	/* Blocks are page aligned, so that writing them doesn't straddle more pages than needed */
+	if(posix_memalign((void **)&block->data, 4096, rec_block_size) != 0)
+		block->data = malloc(rec_block_size);
+	janus_memory_charge(rec_memory, janus_memory_recordings, sizeof(janus_recorder_block) + rec_block_size);
+	return block;
+}
+
+static void janus_recorder_block_free(janus_recorder_block *block) {
+	if(block == NULL)
+		return;
+	free(block->data);
+	g_free(block);
+	janus_memory_release(rec_memory, janus_memory_recordings, sizeof(janus_recorder_block) + rec_block_size);
+}
+
+/* Hand the writer the blocks that haven't been filled in a while, e.g.,
+ * because the recorder stopped receiving frames, so that they don't
+ * stay in memory until the recording is closed */
+static void janus_recorder_writer_flush_idle(janus_recorder_writer *writer) {
+	gint64 now = janus_get_monotonic_time();
+	janus_mutex_lock(&writer->mutex);
+	GList *temp = writer->recorders;
+	while(temp) {
+		janus_recorder *recorder = (janus_recorder *)temp->data;
+		janus_mutex_lock_nodebug(&recorder->mutex);
+		if(g_atomic_int_get(&recorder->writable) && recorder->block != NULL && recorder->block->len > 0 &&
+				now - recorder->block->started >= JANUS_RECORDER_BLOCK_MAX_AGE)
+			janus_recorder_block_queue(recorder);
+		janus_mutex_unlock_nodebug(&recorder->mutex);
+		temp = temp->next;
+	}
+	janus_mutex_unlock(&writer->mutex);
+}
+
+static void *janus_recorder_writer_thread(void *data) {
+	janus_recorder_writer *writer = (janus_recorder_writer *)data;
+	JANUS_LOG(LOG_VERB, "Recorder writer thread #%u started\n", writer->id);
+	janus_recorder_block *block = NULL;
+	gint64 last_check = janus_get_monotonic_time(), now = 0;
+	while(TRUE) {
+		block = g_async_queue_timeout_pop(writer->queue, JANUS_RECORDER_BLOCK_MAX_AGE);
+		now = janus_get_monotonic_time();
+		if(now - last_check >= JANUS_RECORDER_BLOCK_MAX_AGE) {
+			janus_recorder_writer_flush_idle(writer);
+			last_check = now;
+		}
+		if(block == NULL)
+			continue;
+		if(block == &rec_exit_block)
+			break;
+		janus_metric_dec(writer->depth);
+		janus_recorder *recorder = block->recorder;
+		/* The file is unbuffered, so this is a single write for the whole block */
+		size_t written = 0;
+		while(written < block->len) {
+			size_t temp = fwrite(block->data+written, sizeof(char), block->len-written, recorder->file);
+			if(temp == 0) {
+				JANUS_LOG_RATELIMITED(LOG_ERR, "Error saving %zu bytes to %s: %d (%s)\n",
+					block->len-written, recorder->filename, errno, strerror(errno));
+				janus_metric_inc(writer->errors);
+				break;
+			}
+			written += temp;
+		}
+		janus_metric_add(writer->bytes, written);
+		janus_metric_inc(writer->flushes);
+		janus_metric_add(writer->flush_time, janus_get_monotonic_time() - block->queued);
+		janus_mutex_lock_nodebug(&recorder->mutex);
+		recorder->pending -= block->len;
+		block->len = 0;
+		block->recorder = NULL;
+		if(recorder->spare == NULL) {
+			/* Keep the block, the recorder will use it next */
+			recorder->spare = block;
+			block = NULL;
+		}
+		if(recorder->pending == 0)
+			janus_condition_broadcast(&recorder->flushed);
+		janus_mutex_unlock_nodebug(&recorder->mutex);
+		janus_recorder_block_free(block);
+		janus_refcount_decrease(&recorder->ref);
+	}
+	JANUS_LOG(LOG_VERB, "Recorder writer thread #%u leaving\n", writer->id);
+	return NULL;
+}
+
+static void janus_recorder_writer_metrics_unregister(janus_recorder_writer *writer) {
+	janus_metric_unregister(writer->depth);
+	writer->depth = NULL;
+	janus_metric_unregister(writer->bytes);
+	writer->bytes = NULL;
+	janus_metric_unregister(writer->flushes);
+	writer->flushes = NULL;
+	janus_metric_unregister(writer->flush_time);
+	writer->flush_time = NULL;
+	janus_metric_unregister(writer->errors);
+	writer->errors = NULL;
+}
+
+int janus_recorder_writers_init(guint threads, size_t block_size, size_t max_pending) {
+	if(threads == 0 || rec_writers != NULL)
+		return 0;
+	if(block_size < 4096)
+		block_size = 4096;
+	rec_block_size = (block_size + 4095) & ~((size_t)4095);
+	/* We need room for at least a block being filled and one being written */
+	rec_max_pending = MAX(max_pending, 2*rec_block_size);
+	rec_dropped = janus_metric_register("janus_recorder_dropped_frames_total", NULL,
+		"Frames recorders dropped because the writers couldn't keep up", janus_metric_counter);
+	rec_writers = g_malloc0(threads * sizeof(janus_recorder_writer));
+	guint i = 0;
+	for(i=0; i<threads; i++) {
+		janus_recorder_writer *writer = &rec_writers[i];
+		writer->id = i;
+		writer->queue = g_async_queue_new();
+		janus_mutex_init(&writer->mutex);
+		char labels[32];
+		g_snprintf(labels, sizeof(labels), "writer=\"%u\"", i);
+		writer->depth = janus_metric_register("janus_recorder_queue_depth", labels,
+			"Blocks waiting to be written to disk", janus_metric_gauge);
+		writer->bytes = janus_metric_register("janus_recorder_written_bytes_total", labels,
+			"Bytes written to disk by the recorder writers", janus_metric_counter);
+		writer->flushes = janus_metric_register("janus_recorder_flushes_total", labels,
+			"Blocks written to disk by the recorder writers", janus_metric_counter);
+		writer->flush_time = janus_metric_register("janus_recorder_flush_time_us_total", labels,
+			"Time between a block being queued and written to disk, in microseconds", janus_metric_counter);
+		writer->errors = janus_metric_register("janus_recorder_write_errors_total", labels,
+			"Errors writing blocks to disk", janus_metric_counter);
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "rec writer %u", i);
+		GError *error = NULL;
+		writer->thread = g_thread_try_new(tname, janus_recorder_writer_thread, writer, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the recorder writer thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			g_async_queue_unref(writer->queue);
+			writer->queue = NULL;
+			janus_recorder_writer_metrics_unregister(writer);
+			break;
+		}
+	}
+	rec_writers_num = i;
+	if(rec_writers_num == 0) {
+		g_free(rec_writers);
+		rec_writers = NULL;
+		janus_metric_unregister(rec_dropped);
+		rec_dropped = NULL;
+		return -1;
+	}
+	JANUS_LOG(LOG_INFO, "  -- Using %u asynchronous writers (%zu bytes blocks, up to %zu bytes pending per recorder)\n",
+		rec_writers_num, rec_block_size, rec_max_pending);
+	return 0;
+}
+
 void janus_recorder_deinit(void) {
 	rec_tempname = FALSE;
 	g_free(rec_tempext);
+	if(rec_writers != NULL) {
+		/* Writers only stop after all the blocks they had been given are written */
+		guint i = 0;
+		for(i=0; i<rec_writers_num; i++)
+			g_async_queue_push(rec_writers[i].queue, &rec_exit_block);
+		for(i=0; i<rec_writers_num; i++) {
+			g_thread_join(rec_writers[i].thread);
+			g_async_queue_unref(rec_writers[i].queue);
+			janus_recorder_writer_metrics_unregister(&rec_writers[i]);
+		}
+		g_free(rec_writers);
+		rec_writers = NULL;
+		rec_writers_num = 0;
+		janus_metric_unregister(rec_dropped);
+		rec_dropped = NULL;
+	}
+	janus_memory_account_destroy(rec_memory);
+	rec_memory = NULL;
 }
 
 static void janus_recorder_free(const janus_refcount *recorder_ref) {
@@ -71,8 +298,14 @@ static void janus_recorder_free(const janus_refcount *recorder_ref) {
 	recorder->filename = NULL;
 	fclose(recorder->file);
 	recorder->file = NULL;
+	if(recorder->index != NULL)
+		fclose(recorder->index);
+	recorder->index = NULL;
 	g_free(recorder->codec);
 	recorder->codec = NULL;
+	janus_recorder_block_free(recorder->block);
+	janus_recorder_block_free(recorder->spare);
+	janus_condition_destroy(&recorder->flushed);
 	g_free(recorder);
 }
 
@@ -177,24 +410,50 @@ janus_recorder *janus_recorder_create(const char *dir, const char *codec, const
 		}
 	}
 	/* Try opening the file now */
+	char path[1024];
+	memset(path, 0, 1024);
 	if(rec_dir == NULL) {
-		rc->file = fopen(newname, "wb");
+		g_snprintf(path, 1024, "%s", newname);
 	} else {
-		char path[1024];
-		memset(path, 0, 1024);
 		g_snprintf(path, 1024, "%s/%s", rec_dir, newname);
-		rc->file = fopen(path, "wb");
 	}
+	rc->file = fopen(path, "wb");
 	if(rc->file == NULL) {
 		JANUS_LOG(LOG_ERR, "fopen error: %d\n", errno);
 		return NULL;
 	}
+	if(rec_index) {
+		/* The index goes in a sidecar file, so that the recording format doesn't change */
+		char index_path[1024];
+		g_snprintf(index_path, 1024, "%s.idx", path);
+		rc->index = fopen(index_path, "wb");
+		if(rc->index == NULL || janus_recorder_index_write_header(rc->index) < 0) {
+			JANUS_LOG(LOG_WARN, "Couldn't create index %s (%d), the recording won't be indexed\n", index_path, errno);
+			if(rc->index != NULL)
+				fclose(rc->index);
+			rc->index = NULL;
+		}
+	}
 	if(rec_dir)
 		rc->dir = g_strdup(rec_dir);
 	rc->filename = g_strdup(newname);
 	rc->type = type;
+	if(rec_writers != NULL) {
+		/* The writer will write whole blocks, so we don't need stdio buffering */
+		rc->block = janus_recorder_block_new();
+		setvbuf(rc->file, NULL, _IONBF, 0);
+		rc->writer = &rec_writers[(guint)g_atomic_int_add(&rec_writers_next, 1) % rec_writers_num];
+	}
+	janus_condition_init(&rc->flushed);
 	/* Write the first part of the header */
-	fwrite(header, sizeof(char), strlen(header), rc->file);
+	if(rc->writer == NULL) {
+		fwrite(header, sizeof(char), strlen(header), rc->file);
+	} else {
+		memcpy(rc->block->data, header, strlen(header));
+		rc->block->len = strlen(header);
+		rc->block->started = janus_get_monotonic_time();
+	}
+	rc->offset = strlen(header);
 	g_atomic_int_set(&rc->writable, 1);
 	/* We still need to also write the info header first */
 	g_atomic_int_set(&rc->header, 0);
@@ -202,14 +461,161 @@ janus_recorder *janus_recorder_create(const char *dir, const char *codec, const
 	/* Done */
 	g_atomic_int_set(&rc->destroyed, 0);
 	janus_refcount_init(&rc->ref, janus_recorder_free);
+	if(rc->writer != NULL) {
+		/* The writer flushes the blocks we don't fill in time */
+		janus_refcount_increase(&rc->ref);
+		janus_mutex_lock(&rc->writer->mutex);
+		rc->writer->recorders = g_list_prepend(rc->writer->recorders, rc);
+		janus_mutex_unlock(&rc->writer->mutex);
+	}
 	g_free(copy_for_parent);
 	g_free(copy_for_base);
 	return rc;
 }
 
+/* Hand the current block to the writer, and start filling a new one (recorder mutex must be locked) */
+static void janus_recorder_block_queue(janus_recorder *recorder) {
+	janus_recorder_block *block = recorder->block;
+	if(block == NULL || block->len == 0)
+		return;
+	recorder->block = recorder->spare ? recorder->spare : janus_recorder_block_new();
+	recorder->spare = NULL;
+	recorder->pending += block->len;
+	block->recorder = recorder;
+	block->queued = janus_get_monotonic_time();
+	janus_refcount_increase(&recorder->ref);
+	janus_metric_inc(recorder->writer->depth);
+	g_async_queue_push(recorder->writer->queue, block);
+}
+
+/* Append data to the current block, queueing it whenever it's full (recorder mutex must be locked) */
+static void janus_recorder_block_append(janus_recorder *recorder, const void *data, size_t len) {
+	const char *bytes = (const char *)data;
+	while(len > 0) {
+		janus_recorder_block *block = recorder->block;
+		if(block->len == 0)
+			block->started = janus_get_monotonic_time();
+		size_t chunk = MIN(len, rec_block_size - block->len);
+		memcpy(block->data + block->len, bytes, chunk);
+		block->len += chunk;
+		bytes += chunk;
+		len -= chunk;
+		if(block->len == rec_block_size)
+			janus_recorder_block_queue(recorder);
+	}
+}
+
+/* Prepare the info header, as a JSON formatted info */
+static char *janus_recorder_info_header(janus_recorder *recorder) {
+	json_t *info = json_object();
+	/* FIXME Codecs should be configurable in the future */
+	const char *type = NULL;
+	if(recorder->type == JANUS_RECORDER_AUDIO)
+		type = "a";
+	else if(recorder->type == JANUS_RECORDER_VIDEO)
+		type = "v";
+	else if(recorder->type == JANUS_RECORDER_DATA)
+		type = "d";
+	json_object_set_new(info, "t", json_string(type));								/* Audio/Video/Data */
+	json_object_set_new(info, "c", json_string(recorder->codec));					/* Media codec */
+	json_object_set_new(info, "s", json_integer(recorder->created));				/* Created time */
+	json_object_set_new(info, "u", json_integer(janus_get_real_time()));			/* First frame written time */
+	gchar *info_text = json_dumps(info, JSON_PRESERVE_ORDER);
+	json_decref(info);
+	return info_text;
+}
+
+/* Add a frame to the index, if needed (recorder mutex must be locked) */
+static void janus_recorder_index_frame(janus_recorder *recorder, guint64 offset, char *buffer, uint length) {
+	if(recorder->index == NULL)
+		return;
+	janus_recorder_index_entry entry = { 0 };
+	entry.offset = offset;
+	entry.saved = janus_get_real_time();
+	gboolean keyframe = FALSE;
+	if(recorder->type != JANUS_RECORDER_DATA && length >= 12) {
+		janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+		entry.timestamp = ntohl(rtp->timestamp);
+		entry.seq = ntohs(rtp->seq_number);
+		if(recorder->type == JANUS_RECORDER_VIDEO) {
+			int plen = 0;
+			char *payload = janus_rtp_payload(buffer, length, &plen);
+			if(payload != NULL && plen > 0) {
+				if(!strcasecmp(recorder->codec, "vp8"))
+					keyframe = janus_vp8_is_keyframe(payload, plen);
+				else if(!strcasecmp(recorder->codec, "vp9"))
+					keyframe = janus_vp9_is_keyframe(payload, plen);
+				else if(!strcasecmp(recorder->codec, "h264"))
+					keyframe = janus_h264_is_keyframe(payload, plen);
+			}
+			/* Only index the first packet of each keyframe */
+			if(keyframe && recorder->indexed && (recorder->last_indexed.flags & JANUS_RECORDER_INDEX_KEYFRAME) &&
+					recorder->last_indexed.timestamp == entry.timestamp)
+				keyframe = FALSE;
+		}
+	}
+	recorder->last_saved = entry;
+	if(!keyframe && recorder->indexed && entry.saved - recorder->last_indexed.saved < JANUS_RECORDER_INDEX_INTERVAL)
+		return;
+	if(keyframe)
+		entry.flags |= JANUS_RECORDER_INDEX_KEYFRAME;
+	if(janus_recorder_index_write_entry(recorder->index, &entry) < 0) {
+		JANUS_LOG(LOG_WARN, "Error updating the index of %s, it won't be updated anymore\n", recorder->filename);
+		fclose(recorder->index);
+		recorder->index = NULL;
+		return;
+	}
+	recorder->last_indexed = entry;
+	recorder->indexed = TRUE;
+}
+
+/* Save a frame when using the asynchronous writers (recorder mutex must be locked) */
+static int janus_recorder_save_frame_async(janus_recorder *recorder, char *buffer, uint length) {
+	char *info_text = NULL;
+	size_t size = strlen(frame_header) + sizeof(uint16_t) + length;
+	if(recorder->type == JANUS_RECORDER_DATA)
+		size += sizeof(gint64);
+	if(!g_atomic_int_get(&recorder->header)) {
+		info_text = janus_recorder_info_header(recorder);
+		size += sizeof(uint16_t) + strlen(info_text);
+	}
+	if(recorder->pending + recorder->block->len + size > rec_max_pending) {
+		/* The writer can't keep up, drop the frame rather than waiting */
+		free(info_text);
+		janus_metric_inc(rec_dropped);
+		JANUS_LOG_RATELIMITED(LOG_WARN, "Recorder writer too slow, dropping frame for %s\n", recorder->filename);
+		return -6;
+	}
+	if(info_text != NULL) {
+		uint16_t info_bytes = htons(strlen(info_text));
+		janus_recorder_block_append(recorder, &info_bytes, sizeof(uint16_t));
+		janus_recorder_block_append(recorder, info_text, strlen(info_text));
+		recorder->offset += sizeof(uint16_t) + strlen(info_text);
+		free(info_text);
+		g_atomic_int_set(&recorder->header, 1);
+	}
+	guint64 offset = recorder->offset;
+	janus_recorder_block_append(recorder, frame_header, strlen(frame_header));
+	uint16_t header_bytes = htons(recorder->type == JANUS_RECORDER_DATA ? (length+sizeof(gint64)) : length);
+	janus_recorder_block_append(recorder, &header_bytes, sizeof(uint16_t));
+	if(recorder->type == JANUS_RECORDER_DATA) {
+		gint64 now = htonll(janus_get_real_time());
+		janus_recorder_block_append(recorder, &now, sizeof(gint64));
+	}
+	janus_recorder_block_append(recorder, buffer, length);
+	recorder->offset += strlen(frame_header) + sizeof(uint16_t) + length +
+		(recorder->type == JANUS_RECORDER_DATA ? sizeof(gint64) : 0);
+	janus_recorder_index_frame(recorder, offset, buffer, length);
+	/* Don't keep frames in memory for too long, if the block is filling up slowly */
+	if(recorder->block->len > 0 && janus_get_monotonic_time() - recorder->block->started >= JANUS_RECORDER_BLOCK_MAX_AGE)
+		janus_recorder_block_queue(recorder);
+	return 0;
+}
+
 int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint length) {
 	if(!recorder)
 		return -1;
+	JANUS_TRACE3(recorder_save_start, recorder, recorder->type, length);
 	janus_mutex_lock_nodebug(&recorder->mutex);
 	if(!buffer || length < 1) {
 		janus_mutex_unlock_nodebug(&recorder->mutex);
@@ -223,26 +629,20 @@ int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint lengt
 		janus_mutex_unlock_nodebug(&recorder->mutex);
 		return -4;
 	}
+	if(recorder->writer != NULL) {
+		/* Frames are written to disk by the writer threads */
+		int res = janus_recorder_save_frame_async(recorder, buffer, length);
+		janus_mutex_unlock_nodebug(&recorder->mutex);
+		JANUS_TRACE3(recorder_save_done, recorder, length, res);
+		return res;
+	}
 	if(!g_atomic_int_get(&recorder->header)) {
 		/* Write info header as a JSON formatted info */
-		json_t *info = json_object();
-		/* FIXME Codecs should be configurable in the future */
-		const char *type = NULL;
-		if(recorder->type == JANUS_RECORDER_AUDIO)
-			type = "a";
-		else if(recorder->type == JANUS_RECORDER_VIDEO)
-			type = "v";
-		else if(recorder->type == JANUS_RECORDER_DATA)
-			type = "d";
-		json_object_set_new(info, "t", json_string(type));								/* Audio/Video/Data */
-		json_object_set_new(info, "c", json_string(recorder->codec));					/* Media codec */
-		json_object_set_new(info, "s", json_integer(recorder->created));				/* Created time */
-		json_object_set_new(info, "u", json_integer(janus_get_real_time()));			/* First frame written time */
-		gchar *info_text = json_dumps(info, JSON_PRESERVE_ORDER);
-		json_decref(info);
+		gchar *info_text = janus_recorder_info_header(recorder);
 		uint16_t info_bytes = htons(strlen(info_text));
 		fwrite(&info_bytes, sizeof(uint16_t), 1, recorder->file);
 		fwrite(info_text, sizeof(char), strlen(info_text), recorder->file);
+		recorder->offset += sizeof(uint16_t) + strlen(info_text);
 		free(info_text);
 		/* Done */
 		g_atomic_int_set(&recorder->header, 1);
@@ -267,15 +667,62 @@ int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint lengt
 		}
 		tot -= temp;
 	}
+	guint64 offset = recorder->offset;
+	recorder->offset += strlen(frame_header) + sizeof(uint16_t) + length +
+		(recorder->type == JANUS_RECORDER_DATA ? sizeof(gint64) : 0);
+	janus_recorder_index_frame(recorder, offset, buffer, length);
 	/* Done */
 	janus_mutex_unlock_nodebug(&recorder->mutex);
+	JANUS_TRACE3(recorder_save_done, recorder, length, 0);
 	return 0;
 }
 
+/* Stop flushing a recorder when it goes idle */
+static void janus_recorder_writer_remove(janus_recorder *recorder) {
+	if(recorder->writer == NULL)
+		return;
+	janus_mutex_lock(&recorder->writer->mutex);
+	GList *link = g_list_find(recorder->writer->recorders, recorder);
+	if(link != NULL)
+		recorder->writer->recorders = g_list_delete_link(recorder->writer->recorders, link);
+	janus_mutex_unlock(&recorder->writer->mutex);
+	if(link != NULL)
+		janus_refcount_decrease(&recorder->ref);
+}
+
 int janus_recorder_close(janus_recorder *recorder) {
 	if(!recorder || !g_atomic_int_compare_and_exchange(&recorder->writable, 1, 0))
 		return -1;
+	janus_recorder_writer_remove(recorder);
 	janus_mutex_lock_nodebug(&recorder->mutex);
+	if(recorder->writer != NULL && recorder->file) {
+		/* Wait for the writer to be done with the blocks we queued, and write what's left ourselves */
+		while(recorder->pending > 0)
+			janus_condition_wait(&recorder->flushed, &recorder->mutex);
+		janus_recorder_block *block = recorder->block;
+		size_t written = 0;
+		while(block && written < block->len) {
+			size_t temp = fwrite(block->data+written, sizeof(char), block->len-written, recorder->file);
+			if(temp == 0) {
+				JANUS_LOG(LOG_ERR, "Error saving the last %zu bytes to %s...\n", block->len-written, recorder->filename);
+				break;
+			}
+			written += temp;
+		}
+		if(block)
+			block->len = 0;
+	}
+	if(recorder->index != NULL) {
+		/* Make sure the last frame is in the index, so that readers know the whole duration */
+		if(recorder->indexed) {
+			janus_recorder_index_entry *last = &recorder->last_saved;
+			last->flags = (last->offset == recorder->last_indexed.offset ? recorder->last_indexed.flags : 0);
+			last->flags |= JANUS_RECORDER_INDEX_LAST;
+			janus_recorder_index_write_entry(recorder->index, last);
+		}
+		fclose(recorder->index);
+		recorder->index = NULL;
+	}
 	if(recorder->file) {
 		fseek(recorder->file, 0L, SEEK_END);
 		size_t fsize = ftell(recorder->file);
@@ -301,6 +748,14 @@ int janus_recorder_close(janus_recorder *recorder) {
 		if(rename(oldpath, newpath) != 0) {
 			JANUS_LOG(LOG_ERR, "Error renaming %s to %s...\n", recorder->filename, newname);
 		} else {
+			if(rec_index) {
+				/* Rename the index as well, if there's one */
+				char oldindex[1024], newindex[1024];
+				g_snprintf(oldindex, 1024, "%s.idx", oldpath);
+				g_snprintf(newindex, 1024, "%s.idx", newpath);
+				if(rename(oldindex, newindex) != 0 && errno != ENOENT)
+					JANUS_LOG(LOG_WARN, "Error renaming the index of %s...\n", newname);
+			}
 			JANUS_LOG(LOG_INFO, "Recording renamed: %s\n", newname);
 			g_free(recorder->filename);
 			recorder->filename = g_strdup(newname);
@@ -313,5 +768,7 @@ int janus_recorder_close(janus_recorder *recorder) {
 void janus_recorder_destroy(janus_recorder *recorder) {
 	if(!recorder || !g_atomic_int_compare_and_exchange(&recorder->destroyed, 0, 1))
 		return;
+	/* In case the recorder was never closed */
+	janus_recorder_writer_remove(recorder);
 	janus_refcount_decrease(&recorder->ref);
 }
@@ -26,6 +26,7 @@
 
 #include "mutex.h"
 #include "refcount.h"
+#include "record-index.h"
 
 
 /*! \brief Media types we can record */
@@ -55,6 +56,26 @@ typedef struct janus_recorder {
 	volatile int writable;
 	/*! \brief Mutex to lock/unlock this recorder instance */ 
 	janus_mutex mutex;
+	/*! \brief Seek index file for this recording, if enabled */
+	FILE *index;
+	/*! \brief Offset in the recording the next frame will be saved at */
+	guint64 offset;
+	/*! \brief Whether any entry has been added to the index already */
+	gboolean indexed;
+	/*! \brief Last entry added to the index */
+	janus_recorder_index_entry last_indexed;
+	/*! \brief Last frame saved, to add it to the index when closing the recorder */
+	janus_recorder_index_entry last_saved;
+	/*! \brief Writer thread this recorder is assigned to, if asynchronous writers are enabled */
+	struct janus_recorder_writer *writer;
+	/*! \brief Block frames are currently appended to, if asynchronous writers are enabled */
+	struct janus_recorder_block *block;
+	/*! \brief Block to reuse once the writer is done with the previous one (double buffering) */
+	struct janus_recorder_block *spare;
+	/*! \brief Bytes handed to the writer that haven't been written to disk yet */
+	size_t pending;
+	/*! \brief Condition to wait for pending blocks to be written, when closing the recorder */
+	janus_condition flushed;
 	/*! \brief Atomic flag to check if this instance has been destroyed */
 	volatile gint destroyed;
 	/*! \brief Reference counter for this instance */
@@ -65,6 +86,29 @@ typedef struct janus_recorder {
  * @param[in] tempnames Whether the filenames should have a temporary extension, while saving, or not
  * @param[in] extension Extension to add in case tempnames is true */
 void janus_recorder_init(gboolean tempnames, const char *extension);
+/*! \brief Enable or disable the seek index for new recordings
+ * \details When enabled, recorders save an index of the recording in a
+ * sidecar file (e.g., \c rec.mjr.idx for \c rec.mjr), that readers can
+ * use to seek and get the duration without parsing the whole recording:
+ * check record-index.h for more details on the format
+ * @param[in] enabled Whether the index should be saved or not */
+void janus_recorder_enable_index(gboolean enabled);
+/*! \brief Enable the asynchronous writers for the recorders
+ * \details By default, frames are written to disk by the thread saving them,
+ * which means a stalled disk stalls a media thread as well. When writers
+ * are enabled, recorders append frames to an in-memory block instead, and
+ * full blocks (or blocks that haven't filled up in a second, even when
+ * no frame is coming in) are written to disk by a small pool of dedicated threads:
+ * each recorder is always served by the same thread, so that blocks are
+ * written in order. If a recorder has too much data waiting to be written,
+ * new frames are dropped rather than blocking the caller.
+ * \note This must be called after janus_recorder_init and before any
+ * recorder is created: the writers are stopped by janus_recorder_deinit
+ * @param[in] threads Number of writer threads (0 disables the writers)
+ * @param[in] block_size Size of the blocks to write to disk, in bytes (rounded to a multiple of 4096)
+ * @param[in] max_pending Maximum bytes per recorder waiting to be written, before frames are dropped
+ * @returns 0 in case of success, a negative integer otherwise */
+int janus_recorder_writers_init(guint threads, size_t block_size, size_t max_pending);
 /*! \brief De-initialize the recorder code */
 void janus_recorder_deinit(void);
 
@@ -0,0 +1,492 @@
+/*! \file    relay-loop.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Shared relay loops for plugin-owned sockets
+ * \details  Implementation of the epoll-based relay pools plugins can use
+ * to watch the RTP/RTCP sockets of all their calls with a few threads,
+ * rather than with a thread per call. Check relay-loop.h for details.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+#include "relay-loop.h"
+#include "affinity.h"
+#include "metrics.h"
+#include "debug.h"
+#include "utils.h"
+
+#ifdef HAVE_SYS_EPOLL_H
+
+/* Maximum number of loops in a pool: the loop index is in the lower byte of source IDs */
+#define JANUS_RELAY_MAX_LOOPS		64
+/* Events we process per epoll_wait */
+#define JANUS_RELAY_MAX_EVENTS		64
+/* Packets we try to read from a socket at a time, when we're notified it's readable */
+#define JANUS_RELAY_RECV_BATCH		16
+/* How often sources are checked, in microseconds */
+#define JANUS_RELAY_CHECK_INTERVAL	G_USEC_PER_SEC
+
+struct janus_relay_source;
+/* Socket watched by a loop: this is what epoll events point to */
+typedef struct janus_relay_watch {
+	struct janus_relay_source *source;
+	int fd;
+} janus_relay_watch;
+
+typedef struct janus_relay_source {
+	guint64 id;
+	janus_relay_watch watches[JANUS_RELAY_SOURCE_MAX_FDS];
+	int count;
+	janus_relay_callbacks callbacks;
+	gpointer user_data;
+	gboolean removed;
+} janus_relay_source;
+
+/* Requests other threads send to a loop */
+typedef enum janus_relay_request_type {
+	janus_relay_request_add = 0,
+	janus_relay_request_wakeup,
+} janus_relay_request_type;
+typedef struct janus_relay_request {
+	janus_relay_request_type type;
+	guint64 id;
+	janus_relay_source *source;
+} janus_relay_request;
+
+typedef struct janus_relay_recv_batch {
+	char buffers[JANUS_RELAY_RECV_BATCH][1500];
+	int lengths[JANUS_RELAY_RECV_BATCH];
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr msgs[JANUS_RELAY_RECV_BATCH];
+	struct iovec iovs[JANUS_RELAY_RECV_BATCH];
+#endif
+} janus_relay_recv_batch;
+
+typedef struct janus_relay_loop {
+	struct janus_relay_pool *pool;
+	guint index;
+	int epfd;
+	int wakefd[2];
+	volatile gint wake_pending;
+	GAsyncQueue *requests;
+	/* Only accessed by the loop thread */
+	GHashTable *sources;
+	GList *removed;
+	janus_relay_recv_batch batch;
+	GThread *thread;
+	volatile gint num_sources;
+	janus_metric *metric_sources, *metric_packets, *metric_batches, *metric_busy;
+} janus_relay_loop;
+
+struct janus_relay_pool {
+	char *name;
+	janus_relay_loop *loops;
+	guint num_loops;
+	volatile gint stopping;
+	volatile gint counter;
+};
+
+static void janus_relay_request_free(janus_relay_request *request) {
+	g_free(request);
+}
+
+/* Send a request to a loop, and wake it up unless there's a wakeup pending already */
+static void janus_relay_loop_request(janus_relay_loop *loop, janus_relay_request *request) {
+	g_async_queue_push(loop->requests, request);
+	if(g_atomic_int_compare_and_exchange(&loop->wake_pending, 0, 1)) {
+		char code = 1;
+		ssize_t res = 0;
+		do {
+			res = write(loop->wakefd[1], &code, sizeof(code));
+		} while(res == -1 && errno == EINTR);
+	}
+}
+
+static gint64 janus_relay_loop_sources_metric(gpointer data) {
+	janus_relay_loop *loop = (janus_relay_loop *)data;
+	return g_atomic_int_get(&loop->num_sources);
+}
+
+/* Mark a source as removed: the source is only freed at the end of the
+ * current iteration, as there may be more events pointing to it */
+static void janus_relay_loop_remove_source(janus_relay_loop *loop, janus_relay_source *source) {
+	if(source->removed)
+		return;
+	source->removed = TRUE;
+	int i = 0;
+	for(i=0; i<source->count; i++) {
+		if(source->watches[i].fd != -1)
+			epoll_ctl(loop->epfd, EPOLL_CTL_DEL, source->watches[i].fd, NULL);
+	}
+	g_hash_table_remove(loop->sources, &source->id);
+	loop->removed = g_list_prepend(loop->removed, source);
+}
+
+/* Notify plugins about the sources that were removed, and free them */
+static void janus_relay_loop_cleanup(janus_relay_loop *loop) {
+	while(loop->removed) {
+		janus_relay_source *source = (janus_relay_source *)loop->removed->data;
+		loop->removed = g_list_delete_link(loop->removed, loop->removed);
+		if(source->callbacks.done)
+			source->callbacks.done(source->user_data);
+		g_free(source);
+		g_atomic_int_add(&loop->num_sources, -1);
+	}
+}
+
+static void janus_relay_loop_add_source(janus_relay_loop *loop, janus_relay_source *source) {
+	int i = 0;
+	for(i=0; i<source->count; i++) {
+		if(source->watches[i].fd == -1)
+			continue;
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.ptr = &source->watches[i];
+		if(epoll_ctl(loop->epfd, EPOLL_CTL_ADD, source->watches[i].fd, &event) < 0) {
+			JANUS_LOG(LOG_ERR, "[%s-%u] Error watching socket %d: %d (%s)\n", loop->pool->name,
+				loop->index, source->watches[i].fd, errno, strerror(errno));
+			source->watches[i].fd = -1;
+		}
+	}
+	g_hash_table_insert(loop->sources, &source->id, source);
+}
+
+/* Read as many packets as are available on a socket (up to a batch) */
+static int janus_relay_loop_recv(int fd, janus_relay_recv_batch *batch) {
+#ifdef HAVE_RECVMMSG
+	int i = 0;
+	for(i=0; i<JANUS_RELAY_RECV_BATCH; i++) {
+		batch->iovs[i].iov_base = batch->buffers[i];
+		batch->iovs[i].iov_len = sizeof(batch->buffers[i]);
+		struct msghdr *msg = &batch->msgs[i].msg_hdr;
+		memset(msg, 0, sizeof(*msg));
+		msg->msg_iov = &batch->iovs[i];
+		msg->msg_iovlen = 1;
+	}
+	/* We've been told there's something to read, so we don't need to wait */
+	int count = recvmmsg(fd, batch->msgs, JANUS_RELAY_RECV_BATCH, MSG_DONTWAIT, NULL);
+	if(count < 0)
+		return -1;
+	for(i=0; i<count; i++)
+		batch->lengths[i] = batch->msgs[i].msg_len;
+	return count;
+#else
+	int bytes = recv(fd, batch->buffers[0], sizeof(batch->buffers[0]), MSG_DONTWAIT);
+	if(bytes < 0)
+		return -1;
+	batch->lengths[0] = bytes;
+	return 1;
+#endif
+}
+
+static void janus_relay_loop_handle_event(janus_relay_loop *loop, struct epoll_event *event) {
+	janus_relay_watch *watch = (janus_relay_watch *)event->data.ptr;
+	janus_relay_source *source = watch->source;
+	if(source->removed || watch->fd == -1)
+		return;
+	if(event->events & (EPOLLERR | EPOLLHUP)) {
+		int error = 0;
+		socklen_t errlen = sizeof(error);
+		getsockopt(watch->fd, SOL_SOCKET, SO_ERROR, (void *)&error, &errlen);
+		if(source->callbacks.error && source->callbacks.error(source->user_data, watch->fd, error) < 0)
+			janus_relay_loop_remove_source(loop, source);
+		return;
+	}
+	if(!(event->events & EPOLLIN) || source->callbacks.incoming == NULL)
+		return;
+	int count = janus_relay_loop_recv(watch->fd, &loop->batch);
+	if(count <= 0)
+		return;
+	janus_metric_inc(loop->metric_batches);
+	janus_metric_add(loop->metric_packets, count);
+	int i = 0;
+	for(i=0; i<count; i++) {
+		/* The plugin may have stopped watching the socket while handling a packet */
+		if(source->removed || watch->fd == -1)
+			break;
+		source->callbacks.incoming(source->user_data, watch->fd, loop->batch.buffers[i], loop->batch.lengths[i]);
+	}
+}
+
+static void janus_relay_loop_check(janus_relay_loop *loop, janus_relay_source *source) {
+	if(source->removed || source->callbacks.check == NULL)
+		return;
+	if(!source->callbacks.check(source->user_data))
+		janus_relay_loop_remove_source(loop, source);
+}
+
+/* Process the requests other threads sent us */
+static void janus_relay_loop_handle_requests(janus_relay_loop *loop) {
+	/* Reset the flag first, so that new requests will wake us up again */
+	char code[32];
+	while(read(loop->wakefd[0], code, sizeof(code)) == sizeof(code));
+	g_atomic_int_set(&loop->wake_pending, 0);
+	janus_relay_request *request = NULL;
+	while((request = g_async_queue_try_pop(loop->requests)) != NULL) {
+		if(request->type == janus_relay_request_add) {
+			janus_relay_loop_add_source(loop, request->source);
+		} else if(request->type == janus_relay_request_wakeup) {
+			janus_relay_source *source = g_hash_table_lookup(loop->sources, &request->id);
+			if(source != NULL)
+				janus_relay_loop_check(loop, source);
+		}
+		janus_relay_request_free(request);
+	}
+}
+
+static void *janus_relay_loop_thread(void *data) {
+	janus_relay_loop *loop = (janus_relay_loop *)data;
+	JANUS_LOG(LOG_VERB, "[%s-%u] Joining relay loop thread\n", loop->pool->name, loop->index);
+	janus_affinity_pin_plugin_thread(loop->pool->name);
+	struct epoll_event events[JANUS_RELAY_MAX_EVENTS];
+	gint64 last_check = janus_get_monotonic_time();
+	while(!g_atomic_int_get(&loop->pool->stopping)) {
+		gint64 now = janus_get_monotonic_time();
+		int timeout = (int)((last_check + JANUS_RELAY_CHECK_INTERVAL - now)/1000);
+		if(timeout < 0)
+			timeout = 0;
+		int num = epoll_wait(loop->epfd, events, JANUS_RELAY_MAX_EVENTS, timeout);
+		if(num < 0) {
+			if(errno == EINTR)
+				continue;
+			JANUS_LOG(LOG_ERR, "[%s-%u] Error polling: %d (%s)\n", loop->pool->name, loop->index, errno, strerror(errno));
+			break;
+		}
+		gint64 start = janus_get_monotonic_time();
+		gboolean requests = FALSE;
+		int i = 0;
+		for(i=0; i<num; i++) {
+			if(events[i].data.ptr == NULL) {
+				/* Our wakeup pipe, handle the requests when we're done with the sockets */
+				requests = TRUE;
+				continue;
+			}
+			janus_relay_loop_handle_event(loop, &events[i]);
+		}
+		if(requests)
+			janus_relay_loop_handle_requests(loop);
+		if(start - last_check >= JANUS_RELAY_CHECK_INTERVAL) {
+			/* Time to check all the sources */
+			last_check = start;
+			GList *list = g_hash_table_get_values(loop->sources), *l = list;
+			while(l) {
+				janus_relay_loop_check(loop, (janus_relay_source *)l->data);
+				l = l->next;
+			}
+			g_list_free(list);
+		}
+		janus_relay_loop_cleanup(loop);
+		janus_metric_add(loop->metric_busy, janus_get_monotonic_time() - start);
+	}
+	/* We're done: get rid of all the sources that are left */
+	janus_relay_loop_handle_requests(loop);
+	GList *list = g_hash_table_get_values(loop->sources), *l = list;
+	while(l) {
+		janus_relay_loop_remove_source(loop, (janus_relay_source *)l->data);
+		l = l->next;
+	}
+	g_list_free(list);
+	janus_relay_loop_cleanup(loop);
+	JANUS_LOG(LOG_VERB, "[%s-%u] Leaving relay loop thread\n", loop->pool->name, loop->index);
+	return NULL;
+}
+
+janus_relay_pool *janus_relay_pool_create(const char *name, int loops) {
+	if(name == NULL || loops < 1)
+		return NULL;
+	if(loops > JANUS_RELAY_MAX_LOOPS) {
+		JANUS_LOG(LOG_WARN, "[%s] Too many relay loops (%d), using %d\n", name, loops, JANUS_RELAY_MAX_LOOPS);
+		loops = JANUS_RELAY_MAX_LOOPS;
+	}
+	janus_relay_pool *pool = g_malloc0(sizeof(janus_relay_pool));
+	pool->name = g_strdup(name);
+	pool->loops = g_malloc0(loops * sizeof(janus_relay_loop));
+	gboolean failed = FALSE;
+	guint i = 0;
+	for(i=0; i<(guint)loops; i++) {
+		janus_relay_loop *loop = &pool->loops[i];
+		loop->pool = pool;
+		loop->index = i;
+		loop->wakefd[0] = -1;
+		loop->wakefd[1] = -1;
+		pool->num_loops++;
+		loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+		if(loop->epfd < 0 || pipe(loop->wakefd) < 0) {
+			JANUS_LOG(LOG_ERR, "[%s-%u] Error creating relay loop: %d (%s)\n", name, i, errno, strerror(errno));
+			failed = TRUE;
+			break;
+		}
+		fcntl(loop->wakefd[0], F_SETFL, O_NONBLOCK);
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.ptr = NULL;
+		epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakefd[0], &event);
+		loop->requests = g_async_queue_new_full((GDestroyNotify)janus_relay_request_free);
+		loop->sources = g_hash_table_new(g_int64_hash, g_int64_equal);
+		char labels[128];
+		g_snprintf(labels, sizeof(labels), "pool=\"%s\",loop=\"%u\"", name, i);
+		loop->metric_sources = janus_metric_register_callback("janus_relay_sources", labels,
+			"Sources served by relay loops", janus_metric_gauge, janus_relay_loop_sources_metric, loop);
+		loop->metric_packets = janus_metric_register("janus_relay_packets_total", labels,
+			"Packets read by relay loops", janus_metric_counter);
+		loop->metric_batches = janus_metric_register("janus_relay_batches_total", labels,
+			"Batches of packets read by relay loops", janus_metric_counter);
+		loop->metric_busy = janus_metric_register("janus_relay_busy_us_total", labels,
+			"Time relay loops spent handling events", janus_metric_counter);
+		GError *error = NULL;
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "%s relay %u", name, i);
+		loop->thread = g_thread_try_new(tname, janus_relay_loop_thread, loop, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "[%s-%u] Got error %d (%s) trying to launch the relay loop thread...\n",
+				name, i, error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			failed = TRUE;
+			break;
+		}
+	}
+	if(failed) {
+		/* Something went wrong */
+		janus_relay_pool_destroy(pool);
+		return NULL;
+	}
+	JANUS_LOG(LOG_INFO, "[%s] Started %u relay loops\n", name, pool->num_loops);
+	return pool;
+}
+
+void janus_relay_pool_destroy(janus_relay_pool *pool) {
+	if(pool == NULL)
+		return;
+	g_atomic_int_set(&pool->stopping, 1);
+	guint i = 0;
+	for(i=0; i<pool->num_loops; i++) {
+		janus_relay_loop *loop = &pool->loops[i];
+		if(loop->thread != NULL) {
+			janus_relay_request *request = g_malloc0(sizeof(janus_relay_request));
+			request->type = janus_relay_request_wakeup;
+			janus_relay_loop_request(loop, request);
+			g_thread_join(loop->thread);
+			loop->thread = NULL;
+		}
+		janus_metric_unregister(loop->metric_sources);
+		janus_metric_unregister(loop->metric_packets);
+		janus_metric_unregister(loop->metric_batches);
+		janus_metric_unregister(loop->metric_busy);
+		if(loop->requests != NULL)
+			g_async_queue_unref(loop->requests);
+		if(loop->sources != NULL)
+			g_hash_table_destroy(loop->sources);
+		if(loop->epfd >= 0)
+			close(loop->epfd);
+		if(loop->wakefd[0] >= 0)
+			close(loop->wakefd[0]);
+		if(loop->wakefd[1] >= 0)
+			close(loop->wakefd[1]);
+	}
+	g_free(pool->loops);
+	g_free(pool->name);
+	g_free(pool);
+}
+
+guint64 janus_relay_pool_add(janus_relay_pool *pool, int *fds, int count,
+		janus_relay_callbacks *callbacks, gpointer user_data) {
+	if(pool == NULL || fds == NULL || count < 1 || count > JANUS_RELAY_SOURCE_MAX_FDS ||
+			callbacks == NULL || g_atomic_int_get(&pool->stopping))
+		return 0;
+	/* Pick the least loaded loop */
+	janus_relay_loop *loop = &pool->loops[0];
+	guint i = 0;
+	for(i=1; i<pool->num_loops; i++) {
+		if(g_atomic_int_get(&pool->loops[i].num_sources) < g_atomic_int_get(&loop->num_sources))
+			loop = &pool->loops[i];
+	}
+	janus_relay_source *source = g_malloc0(sizeof(janus_relay_source));
+	source->id = ((guint64)(guint)g_atomic_int_add(&pool->counter, 1) + 1) << 8 | loop->index;
+	int n = 0;
+	for(n=0; n<count; n++) {
+		source->watches[n].source = source;
+		source->watches[n].fd = fds[n];
+	}
+	source->count = count;
+	source->callbacks = *callbacks;
+	source->user_data = user_data;
+	g_atomic_int_inc(&loop->num_sources);
+	guint64 id = source->id;
+	janus_relay_request *request = g_malloc0(sizeof(janus_relay_request));
+	request->type = janus_relay_request_add;
+	request->id = id;
+	request->source = source;
+	janus_relay_loop_request(loop, request);
+	return id;
+}
+
+void janus_relay_pool_wakeup(janus_relay_pool *pool, guint64 id) {
+	if(pool == NULL || id == 0)
+		return;
+	guint index = janus_relay_pool_loop_index(id);
+	if(index >= pool->num_loops)
+		return;
+	janus_relay_request *request = g_malloc0(sizeof(janus_relay_request));
+	request->type = janus_relay_request_wakeup;
+	request->id = id;
+	janus_relay_loop_request(&pool->loops[index], request);
+}
+
+void janus_relay_pool_remove_fd(janus_relay_pool *pool, guint64 id, int fd) {
+	if(pool == NULL || id == 0 || fd < 0)
+		return;
+	guint index = janus_relay_pool_loop_index(id);
+	if(index >= pool->num_loops)
+		return;
+	janus_relay_loop *loop = &pool->loops[index];
+	janus_relay_source *source = g_hash_table_lookup(loop->sources, &id);
+	if(source == NULL)
+		return;
+	int i = 0;
+	for(i=0; i<source->count; i++) {
+		if(source->watches[i].fd == fd) {
+			epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+			source->watches[i].fd = -1;
+		}
+	}
+}
+
+#else
+
+/* No epoll: plugins will have to use their own threads */
+janus_relay_pool *janus_relay_pool_create(const char *name, int loops) {
+	JANUS_LOG(LOG_WARN, "[%s] Relay loops not supported on this platform\n", name ? name : "??");
+	return NULL;
+}
+
+void janus_relay_pool_destroy(janus_relay_pool *pool) {
+}
+
+guint64 janus_relay_pool_add(janus_relay_pool *pool, int *fds, int count,
+		janus_relay_callbacks *callbacks, gpointer user_data) {
+	return 0;
+}
+
+void janus_relay_pool_wakeup(janus_relay_pool *pool, guint64 id) {
+}
+
+void janus_relay_pool_remove_fd(janus_relay_pool *pool, guint64 id, int fd) {
+}
+
+#endif
+
+int janus_relay_pool_loop_index(guint64 id) {
+	return (int)(id & 0xFF);
+}
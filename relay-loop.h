@@ -0,0 +1,102 @@
+/*! \file    relay-loop.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Shared relay loops for plugin-owned sockets (headers)
+ * \details  Plugins that bridge WebRTC users to plain RTP endpoints (e.g.,
+ * the SIP, SIPre and NoSIP plugins) own a set of UDP sockets per call, and
+ * traditionally spawn a thread per call to poll them and relay what they
+ * receive. A relay pool is a small set of epoll-based threads shared by all
+ * the calls of a plugin instead: each call (a relay source) is assigned to
+ * the least loaded loop when it's added, and stays there until it's done.
+ * When a socket is readable, the loop reads as many packets as are
+ * available at once (with a single \c recvmmsg, where supported) and passes
+ * them to the plugin one by one. Sources are also checked periodically (and
+ * whenever they're woken up) so that the plugin can tell the loop when the
+ * call is over, pretty much as the old per-call threads did by polling with
+ * a timeout. All callbacks for a source are invoked by the same loop thread,
+ * which means plugins don't need any additional locking for per-call state
+ * they only access from there. Each loop exposes how many sources it's
+ * serving, how many packets it relayed and how long it was busy in the
+ * metrics registry, labelled with the pool name and the loop index.
+ *
+ * Relay pools need epoll, which means they're only available on Linux:
+ * elsewhere janus_relay_pool_create returns NULL, and plugins are expected
+ * to fall back to their own threads.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef _JANUS_RELAY_LOOP_H
+#define _JANUS_RELAY_LOOP_H
+
+#include <glib.h>
+
+/*! \brief Maximum number of sockets a relay source can have */
+#define JANUS_RELAY_SOURCE_MAX_FDS	8
+
+/*! \brief Relay pool (opaque) */
+typedef struct janus_relay_pool janus_relay_pool;
+
+/*! \brief Callbacks a plugin provides when adding a relay source
+ * \note All callbacks are invoked by the loop thread the source was assigned to */
+typedef struct janus_relay_callbacks {
+	/*! \brief A packet was received on one of the sockets of the source
+	 * \note The buffer is owned by the loop and only valid for the duration of the call
+	 * @param[in] user_data The opaque pointer passed when adding the source
+	 * @param[in] fd The socket the packet was received on
+	 * @param[in] buf The packet data
+	 * @param[in] len The packet length */
+	void (*incoming)(gpointer user_data, int fd, char *buf, int len);
+	/*! \brief One of the sockets of the source reported an error (POLLERR/POLLHUP)
+	 * @param[in] user_data The opaque pointer passed when adding the source
+	 * @param[in] fd The socket that reported the error
+	 * @param[in] error The error on the socket (SO_ERROR)
+	 * @returns 0 to keep on going, a negative integer to remove the source */
+	int (*error)(gpointer user_data, int fd, int error);
+	/*! \brief Periodic check (about once a second, or after janus_relay_pool_wakeup)
+	 * @param[in] user_data The opaque pointer passed when adding the source
+	 * @returns TRUE to keep on going, FALSE to remove the source */
+	gboolean (*check)(gpointer user_data);
+	/*! \brief The source has been removed: no other callback will be invoked for it
+	 * \note This is where plugins should close the sockets and release any reference
+	 * @param[in] user_data The opaque pointer passed when adding the source */
+	void (*done)(gpointer user_data);
+} janus_relay_callbacks;
+
+/*! \brief Create a new relay pool
+ * @param[in] name Name of the pool, for logging, threads and metrics (e.g., "sip")
+ * @param[in] loops Number of loops (threads) in the pool
+ * @returns A new pool, or NULL in case of errors (or if relay pools aren't supported) */
+janus_relay_pool *janus_relay_pool_create(const char *name, int loops);
+/*! \brief Stop all the loops of a pool and free it
+ * \note Sources that are still in the pool are removed, and their done callback invoked
+ * @param[in] pool The pool to destroy */
+void janus_relay_pool_destroy(janus_relay_pool *pool);
+/*! \brief Add a new source to the least loaded loop of a pool
+ * @param[in] pool The pool to add the source to
+ * @param[in] fds The sockets to watch (invalid ones, i.e., -1, are skipped)
+ * @param[in] count How many sockets there are (at most JANUS_RELAY_SOURCE_MAX_FDS)
+ * @param[in] callbacks The callbacks to invoke for this source (copied)
+ * @param[in] user_data An opaque pointer to pass to the callbacks
+ * @returns A unique identifier for the source, or 0 in case of errors (in which
+ * case the done callback is NOT invoked) */
+guint64 janus_relay_pool_add(janus_relay_pool *pool, int *fds, int count,
+	janus_relay_callbacks *callbacks, gpointer user_data);
+/*! \brief Have the check callback of a source invoked as soon as possible
+ * \note Safe to call from any thread, even if the source has been removed already
+ * @param[in] pool The pool the source was added to
+ * @param[in] id The unique identifier of the source */
+void janus_relay_pool_wakeup(janus_relay_pool *pool, guint64 id);
+/*! \brief Stop watching one of the sockets of a source (e.g., before closing it)
+ * \note This can only be called from within the callbacks of the source
+ * @param[in] pool The pool the source was added to
+ * @param[in] id The unique identifier of the source
+ * @param[in] fd The socket to stop watching */
+void janus_relay_pool_remove_fd(janus_relay_pool *pool, guint64 id, int fd);
+/*! \brief Get the index of the loop a source was assigned to (e.g., for the Admin API)
+ * @param[in] id The unique identifier of the source
+ * @returns The index of the loop */
+int janus_relay_pool_loop_index(guint64 id);
+
+#endif
@@ -440,6 +440,33 @@ int janus_rtcp_fix_ssrc(janus_rtcp_context *ctx, char *packet, int len, int fixs
 	return 0;
 }
 
+/* Whether janus_rtcp_filter would keep an RTCP packet or not */
+static gboolean janus_rtcp_filter_keep(janus_rtcp_header *rtcp, gboolean log) {
+	switch(rtcp->type) {
+		case RTCP_SR:
+		case RTCP_RR:
+		case RTCP_SDES:
+			/* These are packets we generate ourselves, so remove them */
+			return FALSE;
+		case RTCP_BYE:
+		case RTCP_APP:
+		case RTCP_FIR:
+		case RTCP_PSFB:
+			return TRUE;
+		case RTCP_RTPFB:
+			/* We handle NACKs ourselves as well, remove them */
+			return rtcp->rc != 1;
+		case RTCP_XR:
+			/* FIXME We generate RR/SR ourselves, so remove XR */
+			return FALSE;
+		default:
+			if(log)
+				JANUS_LOG(LOG_ERR, "Unknown RTCP PT %d\n", rtcp->type);
+			/* FIXME Should we allow this to go through instead? */
+			return FALSE;
+	}
+}
+
 char *janus_rtcp_filter(char *packet, int len, int *newlen) {
 	if(packet == NULL || len <= 0 || newlen == NULL)
 		return NULL;
@@ -450,58 +477,165 @@ char *janus_rtcp_filter(char *packet, int len, int *newlen) {
 	char *filtered = NULL;
 	int total = len, length = 0, bytes = 0;
 	/* Iterate on the compound packets */
-	gboolean keep = TRUE;
 	while(rtcp) {
-		keep = TRUE;
 		length = ntohs(rtcp->length);
 		if(length == 0)
 			break;
 		bytes = length*4+4;
+		if(janus_rtcp_filter_keep(rtcp, TRUE)) {
+			/* Keep this packet */
+			if(filtered == NULL)
+				filtered = g_malloc0(total);
+			memcpy(filtered+*newlen, (char *)rtcp, bytes);
+			*newlen += bytes;
+		}
+		total -= bytes;
+		if(total <= 0)
+			break;
+		rtcp = (janus_rtcp_header *)((uint32_t*)rtcp + length + 1);
+	}
+	return filtered;
+}
+
+int janus_rtcp_filter_inplace(char *packet, int len) {
+	if(packet == NULL || len <= 0)
+		return -1;
+	janus_rtcp_header *rtcp = (janus_rtcp_header *)packet;
+	if(rtcp->version != 2)
+		return -1;
+	int total = len, offset = 0, newlen = 0;
+	/* Iterate on the compound packets, and move those we keep at the beginning */
+	while(total >= 4) {
+		rtcp = (janus_rtcp_header *)(packet+offset);
+		int length = ntohs(rtcp->length);
+		if(length == 0)
+			break;
+		int bytes = length*4+4;
+		if(bytes > total)
+			break;
+		if(janus_rtcp_filter_keep(rtcp, TRUE)) {
+			if(newlen != offset)
+				memmove(packet+newlen, packet+offset, bytes);
+			newlen += bytes;
+		}
+		offset += bytes;
+		total -= bytes;
+	}
+	return newlen;
+}
+
+int janus_rtcp_summarize(char *packet, int len, janus_rtcp_summary *summary) {
+	if(summary == NULL)
+		return -1;
+	memset(summary, 0, G_STRUCT_OFFSET(janus_rtcp_summary, nacks));
+	summary->sr_offset = summary->rr_offset = summary->remb_offset = -1;
+	summary->nacks_count = 0;
+	if(packet == NULL || len < 4)
+		return -1;
+	janus_rtcp_header *rtcp = (janus_rtcp_header *)packet;
+	if(rtcp->version != 2)
+		return -1;
+	int total = len, offset = 0;
+	while(total >= 4) {
+		rtcp = (janus_rtcp_header *)(packet+offset);
+		int length = ntohs(rtcp->length);
+		int bytes = length*4+4;
+		if(bytes > total)
+			break;
+		summary->count++;
+		if(janus_rtcp_filter_keep(rtcp, FALSE))
+			summary->filtered_len += bytes;
 		switch(rtcp->type) {
-			case RTCP_SR:
-			case RTCP_RR:
+			case RTCP_SR: {
+				janus_rtcp_sr *sr = (janus_rtcp_sr *)rtcp;
+				if(!summary->has_sr)
+					summary->sr_offset = offset;
+				summary->has_sr = TRUE;
+				if(summary->sender_ssrc == 0 && bytes >= 8)
+					summary->sender_ssrc = ntohl(sr->ssrc);
+				if(summary->receiver_ssrc == 0 && sr->header.rc > 0 && bytes >= 32)
+					summary->receiver_ssrc = ntohl(sr->rb[0].ssrc);
+				break;
+			}
+			case RTCP_RR: {
+				janus_rtcp_rr *rr = (janus_rtcp_rr *)rtcp;
+				if(!summary->has_rr)
+					summary->rr_offset = offset;
+				summary->has_rr = TRUE;
+				if(summary->sender_ssrc == 0 && bytes >= 8)
+					summary->sender_ssrc = ntohl(rr->ssrc);
+				if(summary->receiver_ssrc == 0 && rr->header.rc > 0 && bytes >= 12)
+					summary->receiver_ssrc = ntohl(rr->rb[0].ssrc);
+				break;
+			}
 			case RTCP_SDES:
-				/* These are packets we generate ourselves, so remove them */
-				keep = FALSE;
+				summary->has_sdes = TRUE;
 				break;
 			case RTCP_BYE:
-			case RTCP_APP:
+				summary->has_bye = TRUE;
+				break;
 			case RTCP_FIR:
-			case RTCP_PSFB:
+				summary->has_fir = TRUE;
 				break;
-			case RTCP_RTPFB:
+			case RTCP_RTPFB: {
+				janus_rtcp_fb *rtcpfb = (janus_rtcp_fb *)rtcp;
+				if(summary->sender_ssrc == 0 && bytes >= 8)
+					summary->sender_ssrc = ntohl(rtcpfb->ssrc);
 				if(rtcp->rc == 1) {
-					/* We handle NACKs ourselves as well, remove this too */
-					keep = FALSE;
-					break;
+					/* Generic NACK: collect the sequence numbers */
+					summary->has_nack = TRUE;
+					int nacks = length-2, i = 0, j = 0;	/* Skip SSRCs */
+					for(i=0; i<nacks; i++) {
+						janus_rtcp_nack *nack = (janus_rtcp_nack *)rtcpfb->fci + i;
+						uint16_t pid = ntohs(nack->pid);
+						uint16_t blp = ntohs(nack->blp);
+						if(summary->nacks_count < JANUS_RTCP_SUMMARY_MAX_NACKS)
+							summary->nacks[summary->nacks_count++] = pid;
+						for(j=0; j<16; j++) {
+							if((blp & (1 << j)) && summary->nacks_count < JANUS_RTCP_SUMMARY_MAX_NACKS)
+								summary->nacks[summary->nacks_count++] = pid+j+1;
+						}
+					}
 				}
 				break;
-			case RTCP_XR:
-				/* FIXME We generate RR/SR ourselves, so remove XR */
-				keep = FALSE;
+			}
+			case RTCP_PSFB: {
+				janus_rtcp_fb *rtcpfb = (janus_rtcp_fb *)rtcp;
+				if(summary->sender_ssrc == 0 && bytes >= 8)
+					summary->sender_ssrc = ntohl(rtcpfb->ssrc);
+				if(rtcp->rc == 1) {
+					summary->has_pli = TRUE;
+				} else if(rtcp->rc == 15 && summary->remb_offset < 0 && bytes >= 20) {
+					janus_rtcp_fb_remb *remb = (janus_rtcp_fb_remb *)rtcpfb->fci;
+					if(remb->id[0] == 'R' && remb->id[1] == 'E' && remb->id[2] == 'M' && remb->id[3] == 'B') {
+						unsigned char *data = (unsigned char *)remb + 4;
+						uint8_t brExp = (data[1] >> 2) & 0x3F;
+						uint32_t brMantissa = ((data[1] & 0x03) << 16) + (data[2] << 8) + data[3];
+						summary->remb = brMantissa << brExp;
+						summary->remb_offset = offset;
+					}
+				}
+				break;
+			}
+			case RTCP_XR: {
+				janus_rtcp_xr *xr = (janus_rtcp_xr *)rtcp;
+				summary->has_xr = TRUE;
+				if(summary->sender_ssrc == 0 && bytes >= 8)
+					summary->sender_ssrc = ntohl(xr->ssrc);
 				break;
+			}
 			default:
-				JANUS_LOG(LOG_ERR, "Unknown RTCP PT %d\n", rtcp->type);
-				/* FIXME Should we allow this to go through instead? */
-				keep = FALSE;
 				break;
 		}
-		if(keep) {
-			/* Keep this packet */
-			if(filtered == NULL)
-				filtered = g_malloc0(total);
-			memcpy(filtered+*newlen, (char *)rtcp, bytes);
-			*newlen += bytes;
-		}
-		total -= bytes;
-		if(total <= 0)
+		/* Is this a compound packet? */
+		if(length == 0)
 			break;
-		rtcp = (janus_rtcp_header *)((uint32_t*)rtcp + length + 1);
+		offset += bytes;
+		total -= bytes;
 	}
-	return filtered;
+	return 0;
 }
 
-
 int janus_rtcp_process_incoming_rtp(janus_rtcp_context *ctx, char *packet, int len) {
 	if(ctx == NULL || packet == NULL || len < 1)
 		return -1;
@@ -1138,8 +1272,12 @@ typedef enum janus_rtp_packet_status {
 	janus_rtp_packet_status_reserved = 3
 } janus_rtp_packet_status;
 
-int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssrc, guint32 media, guint8 feedback_packet_count, GQueue *transport_wide_cc_stats) {
-	if(packet == NULL || size < sizeof(janus_rtcp_header) || transport_wide_cc_stats == NULL || g_queue_is_empty(transport_wide_cc_stats))
+int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssrc, guint32 media, guint8 feedback_packet_count,
+		guint16 base_seq_num, guint64 *timestamps, guint count) {
+	if(packet == NULL || size < sizeof(janus_rtcp_header) || timestamps == NULL || count == 0 || count > 0xFFFF)
+		return -1;
+	/* Worst case is a two bytes chunk every seven packets, and a two bytes delta for each of them */
+	if(sizeof(janus_rtcp_header) + 16 + ((count+6)/7)*2 + count*2 + 3 > size)
 		return -1;
 
 	memset(packet, 0, size);
@@ -1153,13 +1291,10 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 	rtcpfb->ssrc = htonl(ssrc);
 	rtcpfb->media = htonl(media);
 
-	/* Get first packet */
-	janus_rtcp_transport_wide_cc_stats *stat = (janus_rtcp_transport_wide_cc_stats *) g_queue_pop_head (transport_wide_cc_stats);
 	/* Calculate temporal info */
-	guint16 base_seq_num = stat->transport_seq_num;
 	gboolean first_received	= FALSE;
 	guint64 reference_time = 0;
-	guint packet_status_count = g_queue_get_length(transport_wide_cc_stats) + 1;
+	guint packet_status_count = count;
 
 	/*
 		0                   1                   2                   3
@@ -1189,26 +1324,28 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 	/* Initial time in us */
 	guint64 timestamp = 0;
 
-	/* Store delta array */
-	GQueue *deltas = g_queue_new();
-	GQueue *statuses = g_queue_new();
+	/* Statuses not written yet: we only need to actually store them when they're
+	 * not all the same, and in that case there can never be more than 14 of them */
+	guint8 statuses[16];
+	guint statuses_len = 0;
 	janus_rtp_packet_status last_status = janus_rtp_packet_status_reserved;
 	janus_rtp_packet_status max_status = janus_rtp_packet_status_notreceived;
 	gboolean all_same = TRUE;
 
 	/* For each packet  */
-	while (stat != NULL) {
+	guint i = 0, j = 0;
+	for(i=0; i<count; i++) {
 		janus_rtp_packet_status status = janus_rtp_packet_status_notreceived;
 
 		/* If got packet */
-		if (stat->timestamp) {
+		if(timestamps[i]) {
 			int delta = 0;
 			/* If first received */
-			if (!first_received) {
+			if(!first_received) {
 				/* Got it  */
 				first_received = TRUE;
 				/* Set it */
-				reference_time = (stat->timestamp/64000);
+				reference_time = (timestamps[i]/64000);
 				/* Get initial time */
 				timestamp = reference_time * 64000;
 				/* also in bufffer */
@@ -1216,28 +1353,26 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 			}
 
 			/* Get delta */
-			if (stat->timestamp>timestamp)
-				delta = (stat->timestamp-timestamp)/250;
+			if(timestamps[i]>timestamp)
+				delta = (timestamps[i]-timestamp)/250;
 			else
-				delta = -(int)((timestamp-stat->timestamp)/250);
+				delta = -(int)((timestamp-timestamps[i])/250);
 			/* If it is negative or too big */
-			if (delta<0 || delta> 127) {
+			if(delta<0 || delta> 127) {
 				/* Big one */
 				status = janus_rtp_packet_status_largeornegativedelta;
 			} else {
 				/* Small */
 				status = janus_rtp_packet_status_smalldelta;
 			}
-			/* Store delta */
-			g_queue_push_tail(deltas, GINT_TO_POINTER(delta));
-			/* Set last time */
-			timestamp = stat->timestamp;
+			/* Set last time: the deltas are written in a second pass */
+			timestamp = timestamps[i];
 		}
 
 		/* Check if all previoues ones were equal and this one the firt different */
-		if (all_same && last_status!=janus_rtp_packet_status_reserved && status!=last_status) {
+		if(all_same && last_status!=janus_rtp_packet_status_reserved && status!=last_status) {
 			/* How big was the same run */
-			if (g_queue_get_length(statuses)>7) {
+			if(statuses_len>7) {
 				guint32 word = 0;
 				/* Write run! */
 				/*
@@ -1250,12 +1385,12 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 				 */
 				word = janus_push_bits(word, 1, 0);
 				word = janus_push_bits(word, 2, last_status);
-				word = janus_push_bits(word, 13, g_queue_get_length(statuses));
+				word = janus_push_bits(word, 13, statuses_len);
 				/* Write word */
 				janus_set2(data, len, word);
 				len += 2;
 				/* Remove all statuses */
-				g_queue_clear(statuses);
+				statuses_len = 0;
 				/* Reset status */
 				last_status = janus_rtp_packet_status_reserved;
 				max_status = janus_rtp_packet_status_notreceived;
@@ -1266,11 +1401,13 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 			}
 		}
 
-		/* Push back statuses, it will be handled later */
-		g_queue_push_tail(statuses, GUINT_TO_POINTER(status));
+		/* Push back statuses, it will be handled later (in a run, they're all the same anyway) */
+		if(statuses_len < sizeof(statuses))
+			statuses[statuses_len] = status;
+		statuses_len++;
 
 		/* If it is bigger */
-		if (status>max_status) {
+		if(status>max_status) {
 			/* Store it */
 			max_status = status;
 		}
@@ -1278,9 +1415,9 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 		last_status = status;
 
 		/* Check if we can still be enquing for a run */
-		if (!all_same) {
+		if(!all_same) {
 			/* Check  */
-			if (!all_same && max_status==janus_rtp_packet_status_largeornegativedelta && g_queue_get_length(statuses)>6) {
+			if(max_status==janus_rtp_packet_status_largeornegativedelta && statuses_len>6) {
 				guint32 word = 0;
 				/*
 					0                   1
@@ -1294,39 +1431,37 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 				word = janus_push_bits(word, 1, 1);
 				word = janus_push_bits(word, 1, 1);
 				/* Set next 7 */
-				size_t i = 0;
-				for (i=0;i<7;++i) {
-					/* Get status */
-					janus_rtp_packet_status status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_pop_head (statuses));
-					/* Write */
-					word = janus_push_bits(word, 2, (guint8)status);
-				}
+				for(j=0; j<7; j++)
+					word = janus_push_bits(word, 2, statuses[j]);
 				/* Write word */
 				janus_set2(data, len, word);
 				len += 2;
+				/* Remove the ones we wrote */
+				statuses_len -= 7;
+				memmove(statuses, statuses+7, statuses_len);
 				/* Reset */
 				last_status = janus_rtp_packet_status_reserved;
 				max_status = janus_rtp_packet_status_notreceived;
 				all_same = TRUE;
 
 				/* We need to restore the values, as there may be more elements on the buffer */
-				for (i=0; i<g_queue_get_length(statuses); ++i) {
+				for(j=0; j<statuses_len; j++) {
 					/* Get status */
-					status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_peek_nth(statuses, i));
+					status = (janus_rtp_packet_status)statuses[j];
 					/* If it is bigger */
-					if (status>max_status) {
+					if(status>max_status) {
 						/* Store it */
 						max_status = status;
 					}
 					//Check if it is the same */
-					if (all_same && last_status!=janus_rtp_packet_status_reserved && status!=last_status) {
+					if(all_same && last_status!=janus_rtp_packet_status_reserved && status!=last_status) {
 						/* Not the same */
 						all_same = FALSE;
 					}
 					/* Store las status */
 					last_status = status;
 				}
-			} else if (!all_same && g_queue_get_length(statuses)>13) {
+			} else if(statuses_len>13) {
 				guint32 word = 0;
 				/*
 					0                   1
@@ -1339,37 +1474,25 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 				 */
 				word = janus_push_bits(word, 1, 1);
 				word = janus_push_bits(word, 1, 0);
-				/* Set next 7 */
-				guint32 i = 0;
-				for (i=0;i<14;++i) {
-					/* Get status */
-					janus_rtp_packet_status status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_pop_head (statuses));
-					/* Write */
-					word = janus_push_bits(word, 1, (guint8)status);
-				}
+				/* Set next 14 */
+				for(j=0; j<14; j++)
+					word = janus_push_bits(word, 1, statuses[j]);
 				/* Write word */
 				janus_set2(data, len, word);
 				len += 2;
 				/* Reset */
+				statuses_len = 0;
 				last_status = janus_rtp_packet_status_reserved;
 				max_status = janus_rtp_packet_status_notreceived;
 				all_same = TRUE;
 			}
 		}
-		/* Free mem */
-		free(stat);
-
-		/* Get next packet stat */
-		stat = (janus_rtcp_transport_wide_cc_stats *) g_queue_pop_head (transport_wide_cc_stats);
 	}
 
-	/* Get status len */
-	size_t statuses_len = g_queue_get_length(statuses);
-
 	/* If not finished yet */
-	if (statuses_len>0) {
+	if(statuses_len>0) {
 		/* How big was the same run */
-		if (all_same) {
+		if(all_same) {
 			guint32 word = 0;
 			/* Write run! */
 			word = janus_push_bits(word, 1, 0);
@@ -1378,20 +1501,14 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 			/* Write word */
 			janus_set2(data, len, word);
 			len += 2;
-		} else if (max_status == janus_rtp_packet_status_largeornegativedelta) {
+		} else if(max_status == janus_rtp_packet_status_largeornegativedelta) {
 			guint32 word = 0;
 			/* Write chunk */
 			word = janus_push_bits(word, 1, 1);
 			word = janus_push_bits(word, 1, 1);
-			/* Get fist status */
-			janus_rtp_packet_status status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_pop_head (statuses));
-			/* Write rest */
-			while(!g_queue_is_empty(statuses)) {
-				/* Write */
-				word = janus_push_bits(word, 2, (guint8)status);
-				/* Next */
-				status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_pop_head (statuses));
-			}
+			/* Write all the pending statuses */
+			for(j=0; j<statuses_len; j++)
+				word = janus_push_bits(word, 2, statuses[j]);
 			/* Write pending */
 			word = janus_push_bits(word, 14-statuses_len*2, 0);
 			/* Write word */
@@ -1402,15 +1519,9 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 			/* Write chunck */
 			word = janus_push_bits(word, 1, 1);
 			word = janus_push_bits(word, 1, 0);
-			/* Get fist status */
-			janus_rtp_packet_status status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_pop_head (statuses));
-			/* Write rest */
-			while(!g_queue_is_empty(statuses)) {
-				/* Write */
-				word = janus_push_bits(word, 1, (guint8)status);
-				/* Next */
-				status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_pop_head (statuses));
-			}
+			/* Write all the pending statuses */
+			for(j=0; j<statuses_len; j++)
+				word = janus_push_bits(word, 1, statuses[j]);
 			/* Write pending */
 			word = janus_push_bits(word, 14-statuses_len, 0);
 			/* Write word */
@@ -1419,12 +1530,19 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 		}
 	}
 
-	/* Write now the deltas */
-	while (!g_queue_is_empty(deltas)) {
-		/* Get next delta */
-		gint delta = GPOINTER_TO_INT(g_queue_pop_head (deltas));
+	/* Write now the deltas, computing them again from the reception times */
+	timestamp = reference_time * 64000;
+	for(i=0; i<count; i++) {
+		if(!timestamps[i])
+			continue;
+		gint delta = 0;
+		if(timestamps[i]>timestamp)
+			delta = (timestamps[i]-timestamp)/250;
+		else
+			delta = -(int)((timestamp-timestamps[i])/250);
+		timestamp = timestamps[i];
 		/* Check size */
-		if (delta<0 || delta>127) {
+		if(delta<0 || delta>127) {
 			/* 2 bytes */
 			janus_set2(data, len, (short)delta);
 			/* Inc */
@@ -1437,12 +1555,8 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 		}
 	}
 
-	/* Clean mem */
-	g_queue_free(statuses);
-	g_queue_free(deltas);
-
 	/* Add zero padding */
-	while (len%4) {
+	while(len%4) {
 		/* Add padding */
 		janus_set1(data, len++, 0);
 	}
@@ -393,6 +393,48 @@ gboolean janus_rtcp_has_pli(char *packet, int len);
  * @returns A list of janus_nack elements containing the sequence numbers to send again */
 GSList *janus_rtcp_get_nacks(char *packet, int len);
 
+/*! \brief Maximum number of NACKed sequence numbers a janus_rtcp_summary can contain */
+#define JANUS_RTCP_SUMMARY_MAX_NACKS	512
+/*! \brief Summary of an RTCP compound packet, as collected by janus_rtcp_summarize
+ * \note This allows the core and plugins to walk the compound packet only once,
+ * rather than calling janus_rtcp_has_fir, janus_rtcp_has_pli, janus_rtcp_get_remb,
+ * janus_rtcp_get_sender_ssrc, janus_rtcp_get_nacks and so on, each scanning it again */
+typedef struct janus_rtcp_summary {
+	/*! \brief Number of RTCP packets in the compound packet */
+	int count;
+	/*! \brief Whether the compound packet contains a SR, a RR, SDES, BYE or XR */
+	gboolean has_sr, has_rr, has_sdes, has_bye, has_xr;
+	/*! \brief Whether the compound packet contains a FIR (legacy), a PLI, or a NACK */
+	gboolean has_fir, has_pli, has_nack;
+	/*! \brief Bitrate reported in a REMB, if any (0 otherwise) */
+	uint32_t remb;
+	/*! \brief SSRC of the sender of the first SR, RR, feedback or XR (0 if none) */
+	uint32_t sender_ssrc;
+	/*! \brief SSRC of the first report block in a SR or RR (0 if none) */
+	uint32_t receiver_ssrc;
+	/*! \brief Offsets of the first SR, RR and REMB in the compound packet (-1 if none) */
+	int sr_offset, rr_offset, remb_offset;
+	/*! \brief Bytes that would be left after janus_rtcp_filter (SR, RR, SDES, NACK and XR removed) */
+	int filtered_len;
+	/*! \brief Sequence numbers NACKed in the compound packet, in order */
+	uint16_t nacks[JANUS_RTCP_SUMMARY_MAX_NACKS];
+	/*! \brief Number of sequence numbers in nacks */
+	int nacks_count;
+} janus_rtcp_summary;
+
+/*! \brief Method to walk an RTCP compound packet once, and collect everything the core and plugins usually look for
+ * @param[in] packet The message data
+ * @param[in] len The message data length in bytes
+ * @param[out] summary The janus_rtcp_summary instance to fill
+ * @returns 0 in case of success, -1 on errors (e.g., not RTCP) */
+int janus_rtcp_summarize(char *packet, int len, janus_rtcp_summary *summary);
+
+/*! \brief Method to filter an outgoing RTCP message in place, as janus_rtcp_filter does but without allocating a new buffer
+ * @param[in] packet The message data, that will be modified
+ * @param[in] len The message data length in bytes
+ * @returns The data length of the filtered RTCP message (0 if all messages have been filtered out), or -1 on errors */
+int janus_rtcp_filter_inplace(char *packet, int len);
+
 /*! \brief Method to remove an RTCP NACK message
  * @param[in] packet The message data
  * @param[in] len The message data length in bytes
@@ -468,13 +510,19 @@ int janus_rtcp_pli(char *packet, int len);
 int janus_rtcp_nacks(char *packet, int len, GSList *nacks);
 
 /*! \brief Method to generate a new RTCP transport wide message to report reception stats
+ * \note The statuses are reported in the same order as the \c timestamps array,
+ * starting from \c base_seq_num: lost packets must have a 0 reception time. The
+ * buffer must be large enough for the worst case, or the method will fail
  * @param[in] packet The buffer data (MUST be at least 16 chars)
  * @param[in] len The message data length in bytes
  * @param[ssrc] ssrc SSRC of the origin stream
  * @param[media] madia SSRC of the destination stream
  * @param[media] feedback_packet_count Feedback paccket count
- * @param[media] transport_wide_cc_stats List of rtp packet reception stats
+ * @param[in] base_seq_num Transport wide sequence number of the first packet to report
+ * @param[in] timestamps Reception times of consecutive packets, in microseconds (0 if not received)
+ * @param[in] count How many packets to report
  * @returns The message data length in bytes, if successful, -1 on errors */
-int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t len, guint32 ssrc, guint32 media, guint8 feedback_packet_count, GQueue *transport_wide_cc_stats);
+int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t len, guint32 ssrc, guint32 media, guint8 feedback_packet_count,
+	guint16 base_seq_num, guint64 *timestamps, guint count);
 
 #endif
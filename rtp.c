@@ -236,6 +236,133 @@ int janus_rtp_header_extension_parse_transport_wide_cc(char *buf, int len, int i
 	return 0;
 }
 
+int janus_rtp_ext_info_parse(char *buf, int len, janus_rtp_ext_info *info) {
+	if(!info)
+		return -1;
+	info->found = 0;
+	if(!buf || len < 12)
+		return -1;
+	janus_rtp_header *rtp = (janus_rtp_header *)buf;
+	if(!rtp->extension)
+		return 0;
+	int hlen = 12 + rtp->csrccount*4;
+	if(len < hlen + 4)
+		return -1;
+	janus_rtp_header_extension *ext = (janus_rtp_header_extension *)(buf+hlen);
+	int extlen = ntohs(ext->length)*4;
+	uint16_t profile = ntohs(ext->type);
+	hlen += 4;
+	if(len < hlen + extlen)
+		return -1;
+	int count = 0, i = 0;
+	uint8_t *data = (uint8_t *)(buf+hlen);
+	if(profile == 0xBEDE) {
+		/* One-byte header (RFC 8285, 4.2) */
+		while(i < extlen) {
+			uint8_t extid = data[i] >> 4;
+			if(extid == 0xF) {
+				break;
+			} else if(extid == 0) {
+				/* Padding */
+				i++;
+				continue;
+			}
+			uint8_t idlen = (data[i] & 0xF)+1;
+			if(i + 1 + idlen > extlen)
+				break;
+			if(!(info->found & (1 << extid))) {
+				info->found |= (1 << extid);
+				info->offset[extid] = hlen+i+1;
+				info->length[extid] = idlen;
+				count++;
+			}
+			i += 1 + idlen;
+		}
+	} else if((profile & 0xFFF0) == 0x1000) {
+		/* Two-byte header (RFC 8285, 4.3) */
+		while(i + 1 < extlen) {
+			uint8_t extid = data[i];
+			if(extid == 0) {
+				/* Padding */
+				i++;
+				continue;
+			}
+			uint8_t idlen = data[i+1];
+			if(i + 2 + idlen > extlen)
+				break;
+			if(extid <= JANUS_RTP_EXT_INFO_MAX_ID && !(info->found & (1 << extid))) {
+				info->found |= (1 << extid);
+				info->offset[extid] = hlen+i+2;
+				info->length[extid] = idlen;
+				count++;
+			}
+			i += 2 + idlen;
+		}
+	}
+	return count;
+}
+
+int janus_rtp_ext_info_audio_level(const janus_rtp_ext_info *info, char *buf, int id, int *level) {
+	if(!buf || !janus_rtp_ext_info_has(info, id) || info->length[id] < 1)
+		return -1;
+	uint8_t byte = buf[info->offset[id]];
+	if(level)
+		*level = byte & 0x7F;
+	return 0;
+}
+
+int janus_rtp_ext_info_video_orientation(const janus_rtp_ext_info *info, char *buf, int id,
+		gboolean *c, gboolean *f, gboolean *r1, gboolean *r0) {
+	if(!buf || !janus_rtp_ext_info_has(info, id) || info->length[id] < 1)
+		return -1;
+	uint8_t byte = buf[info->offset[id]];
+	if(c)
+		*c = (byte & 0x08) >> 3;
+	if(f)
+		*f = (byte & 0x04) >> 2;
+	if(r1)
+		*r1 = (byte & 0x02) >> 1;
+	if(r0)
+		*r0 = byte & 0x01;
+	return 0;
+}
+
+int janus_rtp_ext_info_playout_delay(const janus_rtp_ext_info *info, char *buf, int id,
+		uint16_t *min_delay, uint16_t *max_delay) {
+	if(!buf || !janus_rtp_ext_info_has(info, id) || info->length[id] < 3)
+		return -1;
+	uint8_t *bytes = (uint8_t *)(buf + info->offset[id]);
+	if(min_delay)
+		*min_delay = (bytes[0] << 4) | (bytes[1] >> 4);
+	if(max_delay)
+		*max_delay = ((bytes[1] & 0x0F) << 8) | bytes[2];
+	return 0;
+}
+
+int janus_rtp_ext_info_rtp_stream_id(const janus_rtp_ext_info *info, char *buf, int id,
+		char *sdes_item, int sdes_len) {
+	if(!buf || !sdes_item || sdes_len < 1 || !janus_rtp_ext_info_has(info, id))
+		return -1;
+	int val_len = info->length[id];
+	if(val_len > (sdes_len-1)) {
+		JANUS_LOG(LOG_WARN, "SDES buffer is too small (%d < %d), RTP stream ID will be cut\n", val_len, sdes_len);
+		val_len = sdes_len-1;
+	}
+	memcpy(sdes_item, buf + info->offset[id], val_len);
+	*(sdes_item+val_len) = '\0';
+	return 0;
+}
+
+int janus_rtp_ext_info_transport_wide_cc(const janus_rtp_ext_info *info, char *buf, int id,
+		uint16_t *transSeqNum) {
+	if(!buf || !janus_rtp_ext_info_has(info, id) || info->length[id] < 2)
+		return -1;
+	uint8_t *bytes = (uint8_t *)(buf + info->offset[id]);
+	if(transSeqNum)
+		*transSeqNum = (bytes[0] << 8) | bytes[1];
+	return 0;
+}
+
 /* RTP context related methods */
 void janus_rtp_switching_context_reset(janus_rtp_switching_context *context) {
 	if(context == NULL)
@@ -430,13 +557,7 @@ int janus_rtp_skew_compensate_video(janus_rtp_header *header, janus_rtp_switchin
 	return exit_status;
 }
 
-void janus_rtp_header_update(janus_rtp_header *header, janus_rtp_switching_context *context, gboolean video, int step) {
-	if(header == NULL || context == NULL)
-		return;
-	/* Note: while the step property is still there for compatibility reasons, to
-	 * keep the signature as it was before, it's ignored: whenever there's a switch
-	 * to take into account, we compute how much time passed between the last RTP
-	 * packet with the old SSRC and this new one, and prepare a timestamp accordingly */
+static void janus_rtp_header_update_internal(janus_rtp_header *header, janus_rtp_switching_context *context, gboolean video, gint64 now) {
 	uint32_t ssrc = ntohl(header->ssrc);
 	uint32_t timestamp = ntohl(header->timestamp);
 	uint16_t seq = ntohs(header->seq_number);
@@ -452,7 +573,7 @@ void janus_rtp_header_update(janus_rtp_header *header, janus_rtp_switching_conte
 			context->v_base_seq = seq;
 			/* How much time since the last video RTP packet? We compute an offset accordingly */
 			if(context->v_last_time > 0) {
-				gint64 time_diff = janus_get_monotonic_time() - context->v_last_time;
+				gint64 time_diff = now - context->v_last_time;
 				time_diff = (time_diff*90)/1000; 	/* We're assuming 90khz here */
 				if(time_diff == 0)
 					time_diff = 1;
@@ -478,7 +599,11 @@ void janus_rtp_header_update(janus_rtp_header *header, janus_rtp_switching_conte
 		header->timestamp = htonl(context->v_last_ts);
 		header->seq_number = htons(context->v_last_seq);
 		/* Take note of when we last handled this RTP packet */
-		context->v_last_time = janus_get_monotonic_time();
+		context->v_last_time = now;
+		/* Precompute the offsets for janus_rtp_header_rewrite */
+		context->v_rewrite.ts_offset = context->v_base_ts_prev - context->v_base_ts;
+		context->v_rewrite.seq_offset = context->v_base_seq_prev - context->v_base_seq + 1;
+		context->v_rewrite.valid = TRUE;
 	} else {
 		if(ssrc != context->a_last_ssrc) {
 			/* Audio SSRC changed: update both sequence number and timestamp */
@@ -491,7 +616,7 @@ void janus_rtp_header_update(janus_rtp_header *header, janus_rtp_switching_conte
 			context->a_base_seq = seq;
 			/* How much time since the last audio RTP packet? We compute an offset accordingly */
 			if(context->a_last_time > 0) {
-				gint64 time_diff = janus_get_monotonic_time() - context->a_last_time;
+				gint64 time_diff = now - context->a_last_time;
 				int akhz = 48;
 				if(header->type == 0 || header->type == 8 || header->type == 9)
 					akhz = 8;	/* We're assuming 48khz here (Opus), unless it's G.711/G.722 (8khz) */
@@ -521,7 +646,67 @@ void janus_rtp_header_update(janus_rtp_header *header, janus_rtp_switching_conte
 		header->timestamp = htonl(context->a_last_ts);
 		header->seq_number = htons(context->a_last_seq);
 		/* Take note of when we last handled this RTP packet */
-		context->a_last_time = janus_get_monotonic_time();
+		context->a_last_time = now;
+		/* Precompute the offsets for janus_rtp_header_rewrite */
+		context->a_rewrite.ts_offset = context->a_base_ts_prev - context->a_base_ts;
+		context->a_rewrite.seq_offset = context->a_base_seq_prev - context->a_base_seq + 1;
+		context->a_rewrite.valid = TRUE;
+	}
+}
+
+void janus_rtp_header_update(janus_rtp_header *header, janus_rtp_switching_context *context, gboolean video, int step) {
+	if(header == NULL || context == NULL)
+		return;
+	/* Note: while the step property is still there for compatibility reasons, to
+	 * keep the signature as it was before, it's ignored: whenever there's a switch
+	 * to take into account, we compute how much time passed between the last RTP
+	 * packet with the old SSRC and this new one, and prepare a timestamp accordingly */
+	janus_rtp_header_update_internal(header, context, video, janus_get_monotonic_time());
+}
+
+void janus_rtp_header_rewrite(janus_rtp_header *header, janus_rtp_switching_context *context, gboolean video,
+		uint32_t timestamp, uint16_t seq, gint64 now) {
+	if(header == NULL || context == NULL)
+		return;
+	janus_rtp_rewrite *rewrite = video ? &context->v_rewrite : &context->a_rewrite;
+	uint32_t ssrc = ntohl(header->ssrc);
+	if(!rewrite->valid || (video ? (ssrc != context->v_last_ssrc || context->v_seq_reset) :
+			(ssrc != context->a_last_ssrc || context->a_seq_reset))) {
+		/* Something changed, go through the whole thing */
+		janus_rtp_header_update_internal(header, context, video, now);
+		return;
+	}
+	/* Same SSRC as before, just apply the offsets */
+	uint32_t ts = timestamp + rewrite->ts_offset;
+	uint16_t s = seq + rewrite->seq_offset;
+	header->timestamp = htonl(ts);
+	header->seq_number = htons(s);
+	/* Keep the context coherent, in case we need to switch later */
+	if(video) {
+		context->v_prev_ts = context->v_last_ts;
+		context->v_last_ts = ts;
+		context->v_prev_seq = context->v_last_seq;
+		context->v_last_seq = s;
+		context->v_last_time = now;
+	} else {
+		context->a_prev_ts = context->a_last_ts;
+		context->a_last_ts = ts;
+		context->a_prev_seq = context->a_last_seq;
+		context->a_last_seq = s;
+		context->a_last_time = now;
+	}
+}
+
+void janus_rtp_switching_context_skip(janus_rtp_switching_context *context, gboolean video) {
+	if(context == NULL)
+		return;
+	/* Increasing the base sequence number means the next ones will be one less */
+	if(video) {
+		context->v_base_seq++;
+		context->v_rewrite.seq_offset--;
+	} else {
+		context->a_base_seq++;
+		context->a_rewrite.seq_offset--;
 	}
 }
 
@@ -715,3 +900,51 @@ int janus_videocodec_pt(janus_videocodec vcodec) {
 			return VP8_PT;
 	}
 }
+
+int janus_rtp_media_info_parse(janus_videocodec vcodec, char *buf, int len, janus_rtp_media_info *info) {
+	if(info == NULL)
+		return -1;
+	memset(info, 0, sizeof(*info));
+	int plen = 0;
+	char *payload = janus_rtp_payload(buf, len, &plen);
+	if(payload == NULL || plen < 1)
+		return -1;
+	info->payload_offset = payload - buf;
+	info->payload_len = plen;
+	switch(vcodec) {
+		case JANUS_VIDEOCODEC_VP8:
+			info->keyframe = janus_vp8_is_keyframe(payload, plen);
+			if(janus_vp8_parse_descriptor(payload, plen, &info->vp8_picid, &info->vp8_tl0picidx,
+					&info->vp8_tid, &info->vp8_y, &info->vp8_keyidx) == 0) {
+				info->vp8_descriptor = TRUE;
+			} else {
+				/* Don't let anybody use a zeroed descriptor */
+				info->vp8_picid = 0;
+				info->vp8_tl0picidx = 0;
+				info->vp8_tid = 0;
+				info->vp8_y = 0;
+				info->vp8_keyidx = 0;
+			}
+			break;
+		case JANUS_VIDEOCODEC_VP9: {
+			info->keyframe = janus_vp9_is_keyframe(payload, plen);
+			int found = 0;
+			if(janus_vp9_parse_svc(payload, plen, &found, &info->vp9_spatial_layer, &info->vp9_temporal_layer,
+					&info->vp9_p, &info->vp9_d, &info->vp9_u, &info->vp9_b, &info->vp9_e) == 0 && found)
+				info->vp9_svc = TRUE;
+			break;
+		}
+		case JANUS_VIDEOCODEC_H264:
+			if(plen < 2)
+				return -1;
+			info->keyframe = janus_h264_is_keyframe(payload, plen);
+			info->h264_nal_type = *payload & 0x1F;
+			if(info->h264_nal_type == 28 || info->h264_nal_type == 29)
+				info->h264_nal_type = *(payload+1) & 0x1F;
+			break;
+		default:
+			return -1;
+	}
+	info->codec = vcodec;
+	return 0;
+}
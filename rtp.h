@@ -151,6 +151,101 @@ int janus_rtp_header_extension_parse_rtp_stream_id(char *buf, int len, int id,
 int janus_rtp_header_extension_parse_transport_wide_cc(char *buf, int len, int id,
 	uint16_t *transSeqNum);
 
+/*! \brief Highest RTP extension ID janus_rtp_ext_info keeps track of (i.e., those the one-byte header can carry) */
+#define JANUS_RTP_EXT_INFO_MAX_ID	14
+/*! \brief Where the RTP extensions of a packet are, as parsed by janus_rtp_ext_info_parse
+ * \note Rather than looking for each extension in the packet in turn (as the
+ * janus_rtp_header_extension_parse_* helpers do), the extension block is walked
+ * once, and the janus_rtp_ext_info_* helpers just read from the recorded offsets:
+ * the offsets are relative to the start of the packet, and are only valid as long
+ * as the header of the packet is not modified */
+typedef struct janus_rtp_ext_info {
+	/*! \brief Bitmask of the extension IDs that were found (bit N is ID N) */
+	uint16_t found;
+	/*! \brief Offset of the data of each extension, indexed by ID */
+	uint16_t offset[JANUS_RTP_EXT_INFO_MAX_ID+1];
+	/*! \brief Length of the data of each extension, indexed by ID */
+	uint8_t length[JANUS_RTP_EXT_INFO_MAX_ID+1];
+} janus_rtp_ext_info;
+
+/*! \brief Helper to parse all the RTP extensions in a packet at once (both one-byte and two-byte headers)
+ * @param[in] buf The packet data
+ * @param[in] len The packet data length in bytes
+ * @param[out] info The janus_rtp_ext_info instance to fill
+ * @returns The number of extensions found, or -1 in case of errors */
+int janus_rtp_ext_info_parse(char *buf, int len, janus_rtp_ext_info *info);
+
+/*! \brief Helper to check whether an extension was found in a packet
+ * @param[in] info The parsed extensions
+ * @param[in] id The extension ID to look for
+ * @returns TRUE if found, FALSE otherwise */
+static inline gboolean janus_rtp_ext_info_has(const janus_rtp_ext_info *info, int id) {
+	return info && id > 0 && id <= JANUS_RTP_EXT_INFO_MAX_ID && (info->found & (1 << id));
+}
+
+/*! \brief Helper to get the ssrc-audio-level value from parsed extensions
+ * @param[in] info The parsed extensions
+ * @param[in] buf The packet data the extensions were parsed from
+ * @param[in] id The extension ID to look for
+ * @param[out] level The level value in dBov (0=max, 127=min)
+ * @returns 0 if found, -1 otherwise */
+int janus_rtp_ext_info_audio_level(const janus_rtp_ext_info *info, char *buf, int id, int *level);
+
+/*! \brief Helper to get the video-orientation bits from parsed extensions
+ * @param[in] info The parsed extensions
+ * @param[in] buf The packet data the extensions were parsed from
+ * @param[in] id The extension ID to look for
+ * @param[out] c The value of the Camera (C) bit
+ * @param[out] f The value of the Flip (F) bit
+ * @param[out] r1 The value of the first Rotation (R1) bit
+ * @param[out] r0 The value of the second Rotation (R0) bit
+ * @returns 0 if found, -1 otherwise */
+int janus_rtp_ext_info_video_orientation(const janus_rtp_ext_info *info, char *buf, int id,
+	gboolean *c, gboolean *f, gboolean *r1, gboolean *r0);
+
+/*! \brief Helper to get the playout-delay values from parsed extensions
+ * @param[in] info The parsed extensions
+ * @param[in] buf The packet data the extensions were parsed from
+ * @param[in] id The extension ID to look for
+ * @param[out] min_delay The minimum delay value
+ * @param[out] max_delay The maximum delay value
+ * @returns 0 if found, -1 otherwise */
+int janus_rtp_ext_info_playout_delay(const janus_rtp_ext_info *info, char *buf, int id,
+	uint16_t *min_delay, uint16_t *max_delay);
+
+/*! \brief Helper to get the rtp-stream-id value from parsed extensions
+ * @param[in] info The parsed extensions
+ * @param[in] buf The packet data the extensions were parsed from
+ * @param[in] id The extension ID to look for
+ * @param[out] sdes_item Buffer where the RTP stream ID will be written
+ * @param[in] sdes_len Size of the input/output buffer
+ * @returns 0 if found, -1 otherwise */
+int janus_rtp_ext_info_rtp_stream_id(const janus_rtp_ext_info *info, char *buf, int id,
+	char *sdes_item, int sdes_len);
+
+/*! \brief Helper to get the transport-wide sequence number from parsed extensions
+ * @param[in] info The parsed extensions
+ * @param[in] buf The packet data the extensions were parsed from
+ * @param[in] id The extension ID to look for
+ * @param[out] transSeqNum The transport wide sequence number
+ * @returns 0 if found, -1 otherwise */
+int janus_rtp_ext_info_transport_wide_cc(const janus_rtp_ext_info *info, char *buf, int id,
+	uint16_t *transSeqNum);
+
+/*! \brief Precomputed rewrite of the RTP headers of a stream: as long as
+ * the SSRC doesn't change, the sequence number and timestamp to send are
+ * the incoming ones plus a fixed offset, which is what janus_rtp_header_rewrite
+ * uses instead of going through the whole janus_rtp_header_update logic */
+typedef struct janus_rtp_rewrite {
+	/*! \brief Offset to add to the incoming timestamp */
+	uint32_t ts_offset;
+	/*! \brief Offset to add to the incoming sequence number */
+	uint16_t seq_offset;
+	/*! \brief Whether the offsets have been computed at all (they're only valid
+	 * for the last SSRC the context saw, and as long as no reset was requested) */
+	gboolean valid;
+} janus_rtp_rewrite;
+
 /*! \brief RTP context, in order to make sure SSRC changes result in coherent seq/ts increases */
 typedef struct janus_rtp_switching_context {
 	uint32_t a_last_ssrc, a_last_ts, a_base_ts, a_base_ts_prev, a_prev_ts, a_target_ts, a_start_ts,
@@ -165,6 +260,7 @@ typedef struct janus_rtp_switching_context {
 			v_prev_delay, v_active_delay, v_ts_offset;
 	gint64 a_last_time, a_reference_time, a_start_time,
 			v_last_time, v_reference_time, v_start_time;
+	janus_rtp_rewrite a_rewrite, v_rewrite;
 } janus_rtp_switching_context;
 
 /*! \brief Set (or reset) the context fields to their default values
@@ -178,6 +274,34 @@ void janus_rtp_switching_context_reset(janus_rtp_switching_context *context);
  * @param[in] step \b deprecated The expected timestamp step */
 void janus_rtp_header_update(janus_rtp_header *header, janus_rtp_switching_context *context, gboolean video, int step);
 
+/*! \brief Fast path version of janus_rtp_header_update, for plugins that relay
+ * the same packet to many recipients, each with its own context (e.g., the
+ * subscribers of a VideoRoom publisher, or the viewers of a mountpoint)
+ * \details As long as the SSRC doesn't change, this just adds the offsets
+ * the context precomputed the last time it was updated to the original
+ * sequence number and timestamp, which plugins pass in host order as they
+ * keep them anyway, to restore the header after each recipient. Whenever
+ * something changed (e.g., a switch to a different publisher or substream),
+ * this falls back to janus_rtp_header_update, which computes new offsets.
+ * \note Plugins that skip packets (e.g., because of temporal layers) must use
+ * janus_rtp_switching_context_skip, or the offsets won't take that into account
+ * @param[in] header The RTP header to update
+ * @param[in] context The context to use as a reference
+ * @param[in] video Whether this is an audio or a video packet
+ * @param[in] timestamp The original RTP timestamp of the packet, in host order
+ * @param[in] seq The original RTP sequence number of the packet, in host order
+ * @param[in] now When the packet was received (monotonic time), which can be
+ * retrieved once for all recipients */
+void janus_rtp_header_rewrite(janus_rtp_header *header, janus_rtp_switching_context *context, gboolean video,
+	uint32_t timestamp, uint16_t seq, gint64 now);
+
+/*! \brief Take note of a packet that won't be relayed (e.g., because of the
+ * temporal layer it belongs to), so that the sequence numbers of the packets
+ * that are relayed after that have no gaps
+ * @param[in] context The context to update
+ * @param[in] video Whether this is an audio or a video packet */
+void janus_rtp_switching_context_skip(janus_rtp_switching_context *context, gboolean video);
+
 #define RTP_AUDIO_SKEW_TH_MS 160
 #define RTP_VIDEO_SKEW_TH_MS 160
 #define SKEW_DETECTION_WAIT_TIME_SECS 10
@@ -218,4 +342,36 @@ const char *janus_videocodec_name(janus_videocodec vcodec);
 janus_videocodec janus_videocodec_from_name(const char *name);
 int janus_videocodec_pt(janus_videocodec vcodec);
 
+/*! \brief Codec-specific info on an incoming video packet, as parsed by janus_rtp_media_info_parse
+ * \note The core fills this once when receiving a packet, so that plugins
+ * don't need to locate the payload and parse the payload descriptor again */
+typedef struct janus_rtp_media_info {
+	/*! \brief Video codec the packet was parsed as (JANUS_VIDEOCODEC_NONE if not parsed, e.g., audio) */
+	janus_videocodec codec;
+	/*! \brief Offset of the RTP payload from the start of the packet, and its length */
+	int payload_offset, payload_len;
+	/*! \brief Whether this packet contains the beginning of a keyframe */
+	gboolean keyframe;
+	/*! \brief Whether the VP8 payload descriptor could be parsed (if not, the fields below are not valid) */
+	gboolean vp8_descriptor;
+	/*! \brief VP8 payload descriptor: Picture ID, TL0PICIDX, temporal layer, layer sync bit and KEYIDX */
+	uint16_t vp8_picid;
+	uint8_t vp8_tl0picidx, vp8_tid, vp8_y, vp8_keyidx;
+	/*! \brief Whether VP9 SVC info was found, and which layers this packet belongs to */
+	gboolean vp9_svc;
+	int vp9_spatial_layer, vp9_temporal_layer;
+	/*! \brief VP9 P, D, U, B and E bits */
+	uint8_t vp9_p, vp9_d, vp9_u, vp9_b, vp9_e;
+	/*! \brief H.264 NAL unit type (the type of the fragmented NAL, for FU-A/FU-B) */
+	uint8_t h264_nal_type;
+} janus_rtp_media_info;
+
+/*! \brief Helper to parse the payload descriptor of a video packet once
+ * @param[in] vcodec The video codec of the packet
+ * @param[in] buf The packet data
+ * @param[in] len The packet data length in bytes
+ * @param[out] info The janus_rtp_media_info instance to fill
+ * @returns 0 in case of success, -1 otherwise (e.g., unknown codec or no payload) */
+int janus_rtp_media_info_parse(janus_videocodec vcodec, char *buf, int len, janus_rtp_media_info *info);
+
 #endif
@@ -59,6 +59,7 @@ static uint16_t event_types[] = {
 
 int janus_sctp_data_to_dtls(void *instance, void *buffer, size_t length, uint8_t tos, uint8_t set_df);
 static int janus_sctp_incoming_data(struct socket *sock, union sctp_sockstore addr, void *data, size_t datalen, struct sctp_rcvinfo rcv, int flags, void *ulp_info);
+static int janus_sctp_writable(struct socket *sock, uint32_t sb_free, void *ulp_info);
 janus_sctp_channel *janus_sctp_find_channel_by_stream(janus_sctp_association *sctp, uint16_t stream);
 janus_sctp_channel *janus_sctp_find_free_channel(janus_sctp_association *sctp);
 uint16_t janus_sctp_find_free_stream(janus_sctp_association *sctp);
@@ -68,7 +69,7 @@ int janus_sctp_send_open_response_message(struct socket *sock, uint16_t stream);
 int janus_sctp_send_open_ack_message(struct socket *sock, uint16_t stream);
 void janus_sctp_send_deferred_messages(janus_sctp_association *sctp);
 int janus_sctp_open_channel(janus_sctp_association *sctp, uint8_t unordered, uint16_t pr_policy, uint32_t pr_value);
-int janus_sctp_send_text(janus_sctp_association *sctp, uint16_t id, char *text, size_t length);
+int janus_sctp_send_message(janus_sctp_association *sctp, uint16_t id, char *buf, size_t length, gboolean binary);
 void janus_sctp_reset_outgoing_stream(janus_sctp_association *sctp, uint16_t stream);
 void janus_sctp_send_outgoing_stream_reset(janus_sctp_association *sctp);
 int janus_sctp_close_channel(janus_sctp_association *sctp, uint16_t id);
@@ -118,6 +119,8 @@ static void janus_sctp_association_free(const janus_refcount *sctp_ref) {
 	sctp->debug_dump = NULL;
 #endif
 	g_free(sctp->buffer);
+	if(sctp->pending != NULL)
+		g_queue_free_full(sctp->pending, (GDestroyNotify)g_free);
 	g_free(sctp);
 	sctp = NULL;
 }
@@ -170,10 +173,16 @@ janus_sctp_association *janus_sctp_association_create(janus_dtls_srtp *dtls, jan
 	}
 	sctp->stream_buffer_counter = 0;
 	sctp->sock = NULL;
+	sctp->pending = g_queue_new();
+	g_atomic_int_set(&sctp->pending_bytes, 0);
+	g_atomic_int_set(&sctp->in_flight, 0);
+	g_atomic_int_set(&sctp->writable, 0);
 
 	usrsctp_register_address((void *)sctp);
 	usrsctp_sysctl_set_sctp_ecn_enable(0);
-	if((sock = usrsctp_socket(AF_CONN, SOCK_STREAM, IPPROTO_SCTP, janus_sctp_incoming_data, NULL, 0, (void *)sctp)) == NULL) {
+	/* We want to know when there's room in the send buffer again, rather than polling */
+	if((sock = usrsctp_socket(AF_CONN, SOCK_STREAM, IPPROTO_SCTP, janus_sctp_incoming_data,
+			janus_sctp_writable, JANUS_SCTP_SEND_THRESHOLD, (void *)sctp)) == NULL) {
 		JANUS_LOG(LOG_ERR, "[%"SCNu64"] Error creating usrsctp socket... (%d)\n", sctp->handle_id, errno);
 		janus_refcount_decrease(&sctp->ref);
 		return NULL;
@@ -203,6 +212,14 @@ janus_sctp_association *janus_sctp_association_create(janus_dtls_srtp *dtls, jan
 		janus_refcount_decrease(&sctp->ref);
 		return NULL;
 	}
+	/* Check how large the send buffer is, to estimate how much data it contains */
+	int sndbuf = 0;
+	socklen_t sndbuf_len = sizeof(sndbuf);
+	if(usrsctp_getsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, &sndbuf_len) < 0 || sndbuf <= 0) {
+		JANUS_LOG(LOG_WARN, "[%"SCNu64"] getsockopt error: SO_SNDBUF (%d)\n", sctp->handle_id, errno);
+		sndbuf = 0;
+	}
+	sctp->sndbuf = sndbuf;
 	/* Disable Nagle */
 	uint32_t nodelay = 1;
 	if(usrsctp_setsockopt(sock, IPPROTO_SCTP, SCTP_NODELAY, &nodelay, sizeof(nodelay))) {
@@ -266,6 +283,16 @@ janus_sctp_association *janus_sctp_association_create(janus_dtls_srtp *dtls, jan
 		janus_refcount_decrease(&sctp->ref);
 		return NULL;
 	}
+	/* Make sure SCTP packets, once encrypted, fit in the MTU we use for DTLS */
+	struct sctp_paddrparams peer_param;
+	memset(&peer_param, 0, sizeof(peer_param));
+	memcpy(&peer_param.spp_address, &rconn, sizeof(rconn));
+	peer_param.spp_flags = SPP_PMTUD_DISABLE;
+	peer_param.spp_pathmtu = janus_dtls_bio_filter_get_mtu() - JANUS_DTLS_RECORD_OVERHEAD;
+	if(usrsctp_setsockopt(sock, IPPROTO_SCTP, SCTP_PEER_ADDR_PARAMS, &peer_param, sizeof(peer_param)) < 0) {
+		/* Not fatal, SCTP will just use its default */
+		JANUS_LOG(LOG_WARN, "[%"SCNu64"] setsockopt error: SCTP_PEER_ADDR_PARAMS (%d)\n", sctp->handle_id, errno);
+	}
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Connected to the DataChannel peer\n", sctp->handle_id);
 	sctp->sock = sock;
 	return sctp;
@@ -334,7 +361,56 @@ static int janus_sctp_incoming_data(struct socket *sock, union sctp_sockstore ad
 	return 1;
 }
 
-void janus_sctp_send_data(janus_sctp_association *sctp, char *buf, int len) {
+/* Messages waiting for room in the send buffer */
+typedef struct janus_sctp_pending_message {
+	uint16_t id;
+	gboolean binary;
+	size_t length;
+	char data[];
+} janus_sctp_pending_message;
+static void janus_sctp_in_flight_remove(janus_sctp_association *sctp, size_t length) {
+	/* Never go below zero, in case the writable callback reset the estimate in the meanwhile */
+	gint in_flight = 0;
+	do {
+		in_flight = g_atomic_int_get(&sctp->in_flight);
+	} while(!g_atomic_int_compare_and_exchange(&sctp->in_flight, in_flight,
+		in_flight > (gint)length ? in_flight - (gint)length : 0));
+}
+static void janus_sctp_update_buffered(janus_sctp_association *sctp) {
+	g_atomic_int_set(&sctp->handle->data_buffered, janus_sctp_buffered_amount(sctp));
+}
+static void janus_sctp_queue_message(janus_sctp_association *sctp, uint16_t id, char *buf, size_t len, gboolean binary) {
+	janus_sctp_pending_message *msg = g_malloc(sizeof(janus_sctp_pending_message) + len);
+	msg->id = id;
+	msg->binary = binary;
+	msg->length = len;
+	memcpy(msg->data, buf, len);
+	g_queue_push_tail(sctp->pending, msg);
+	g_atomic_int_add(&sctp->pending_bytes, (gint)len);
+	g_atomic_int_set(&sctp->handle->data_pending, 1);
+	janus_sctp_update_buffered(sctp);
+}
+
+/* Called by the SCTP stack (possibly from its own thread) when there's room in the send buffer */
+static int janus_sctp_writable(struct socket *sock, uint32_t sb_free, void *ulp_info) {
+	janus_sctp_association *sctp = (janus_sctp_association *)ulp_info;
+	if(sctp == NULL || sctp->handle == NULL || g_atomic_int_get(&sctp->destroyed))
+		return 0;
+	if(sctp->sndbuf > 0) {
+		gint in_flight = sb_free < sctp->sndbuf ? (gint)(sctp->sndbuf - sb_free) : 0;
+		g_atomic_int_set(&sctp->in_flight, in_flight);
+		janus_sctp_update_buffered(sctp);
+	}
+	/* We don't send anything from here: if there's something waiting, or the plugin
+	 * is waiting for the buffered amount to go down, let the handle loop take care of it */
+	if(g_atomic_int_get(&sctp->handle->data_pending) || g_atomic_int_get(&sctp->handle->data_throttled)) {
+		if(g_atomic_int_compare_and_exchange(&sctp->writable, 0, 1))
+			janus_ice_notify_data_writable(sctp->handle);
+	}
+	return 1;
+}
+
+void janus_sctp_send_data(janus_sctp_association *sctp, char *buf, int len, gboolean binary) {
 	if(sctp == NULL || buf == NULL || len <= 0)
 		return;
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] SCTP data to send (%d bytes) coming from a plugin.\n",
@@ -370,8 +446,43 @@ void janus_sctp_send_data(janus_sctp_association *sctp, char *buf, int len) {
 			//~ return;
 		//~ }
 	}
-	/* FIXME We're assuming this is a string (we don't support binary data yet) */
-	janus_sctp_send_text(sctp, i, buf, len);
+	if(!g_queue_is_empty(sctp->pending)) {
+		/* There are messages waiting already, queue this one too to preserve the order */
+		janus_sctp_queue_message(sctp, i, buf, len, binary);
+		return;
+	}
+	int res = janus_sctp_send_message(sctp, i, buf, len, binary);
+	if(res == -2) {
+		/* The send buffer is full, we'll try again when it's writable */
+		janus_sctp_queue_message(sctp, i, buf, len, binary);
+	}
+}
+
+void janus_sctp_send_pending(janus_sctp_association *sctp) {
+	if(sctp == NULL || sctp->sock == NULL)
+		return;
+	g_atomic_int_set(&sctp->writable, 0);
+	/* Start from any control message we couldn't send before */
+	janus_sctp_send_deferred_messages(sctp);
+	janus_sctp_pending_message *msg = NULL;
+	while((msg = g_queue_peek_head(sctp->pending)) != NULL) {
+		int res = janus_sctp_send_message(sctp, msg->id, msg->data, msg->length, msg->binary);
+		if(res == -2) {
+			/* Still full */
+			break;
+		}
+		g_queue_pop_head(sctp->pending);
+		g_atomic_int_add(&sctp->pending_bytes, -(gint)msg->length);
+		g_free(msg);
+	}
+	g_atomic_int_set(&sctp->handle->data_pending, g_queue_is_empty(sctp->pending) ? 0 : 1);
+	janus_sctp_update_buffered(sctp);
+}
+
+int janus_sctp_buffered_amount(janus_sctp_association *sctp) {
+	if(sctp == NULL)
+		return 0;
+	return g_atomic_int_get(&sctp->pending_bytes) + g_atomic_int_get(&sctp->in_flight);
 }
 
 
@@ -651,8 +762,9 @@ int janus_sctp_open_channel(janus_sctp_association *sctp, uint8_t unordered, uin
 	return 0;
 }
 
-int janus_sctp_send_text(janus_sctp_association *sctp, uint16_t id, char *text, size_t length) {
-	if(id >= NUMBER_OF_CHANNELS || text == NULL)
+/* Returns 0 if the message was sent, -2 if the send buffer is full, -1 on other errors */
+int janus_sctp_send_message(janus_sctp_association *sctp, uint16_t id, char *buf, size_t length, gboolean binary) {
+	if(id >= NUMBER_OF_CHANNELS || buf == NULL)
 		return -1;
 	struct sctp_sendv_spa spa;
 	janus_sctp_channel *channel = &sctp->channels[id];
@@ -673,20 +785,30 @@ int janus_sctp_send_text(janus_sctp_association *sctp, uint16_t id, char *text,
 	} else {
 		spa.sendv_sndinfo.snd_flags = SCTP_EOR;
 	}
-	spa.sendv_sndinfo.snd_ppid = htonl(DATA_CHANNEL_PPID_DOMSTRING);
+	spa.sendv_sndinfo.snd_ppid = htonl(binary ? DATA_CHANNEL_PPID_BINARY : DATA_CHANNEL_PPID_DOMSTRING);
 	spa.sendv_flags = SCTP_SEND_SNDINFO_VALID;
 	if((channel->pr_policy == SCTP_PR_SCTP_TTL) || (channel->pr_policy == SCTP_PR_SCTP_RTX)) {
 		spa.sendv_prinfo.pr_policy = channel->pr_policy;
 		spa.sendv_prinfo.pr_value = channel->pr_value;
 		spa.sendv_flags |= SCTP_SEND_PRINFO_VALID;
 	}
-	if(usrsctp_sendv(sctp->sock, text, length, NULL, 0,
+	/* Account for the message before handing it to the stack, as the writable
+	 * callback may update the estimate before usrsctp_sendv returns: if the
+	 * send fails, we take it back, so that the estimate doesn't drift */
+	g_atomic_int_add(&sctp->in_flight, (gint)length);
+	if(usrsctp_sendv(sctp->sock, buf, length, NULL, 0,
 			&spa, (socklen_t)sizeof(struct sctp_sendv_spa),
 			SCTP_SENDV_SPA, 0) < 0) {
-		JANUS_LOG(LOG_ERR, "[%"SCNu64"] sctp_sendv error (%d)\n", sctp->handle_id, errno);
+		int error = errno;
+		janus_sctp_in_flight_remove(sctp, length);
+		if(error == EWOULDBLOCK || error == EAGAIN) {
+			JANUS_LOG(LOG_VERB, "[%"SCNu64"] SCTP send buffer full, queueing message\n", sctp->handle_id);
+			return -2;
+		}
+		JANUS_LOG(LOG_ERR, "[%"SCNu64"] sctp_sendv error (%d)\n", sctp->handle_id, error);
 		return -1;
 	}
-	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Message sent on channel %"SCNu16"\n", sctp->handle_id, id); 
+	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Message sent on channel %"SCNu16"\n", sctp->handle_id, id);
 	return 0;
 }
 
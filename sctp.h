@@ -58,6 +58,8 @@ void janus_sctp_deinit(void);
 #define BUFFER_SIZE (1<<16)
 #define NUMBER_OF_CHANNELS (100)
 #define NUMBER_OF_STREAMS (16)
+/* How much room must be free in the send buffer before usrsctp tells us it's writable */
+#define JANUS_SCTP_SEND_THRESHOLD (64*1024)
 
 #define DATA_CHANNEL_PPID_CONTROL           50
 #define DATA_CHANNEL_PPID_DOMSTRING         51
@@ -121,6 +123,16 @@ typedef struct janus_sctp_association {
 	size_t buflen;
 	/*! \brief Current offset of the buffer for handling partial messages */
 	size_t offset;
+	/*! \brief Messages the SCTP stack couldn't take yet (send buffer full), to send when it's writable again */
+	GQueue *pending;
+	/*! \brief Size of the messages in the pending queue (read by the SCTP thread too, so atomic) */
+	volatile gint pending_bytes;
+	/*! \brief Size of the SCTP send buffer */
+	uint32_t sndbuf;
+	/*! \brief Estimate of how many bytes are in the SCTP send buffer (not sent or not acknowledged yet) */
+	volatile gint in_flight;
+	/*! \brief Whether we already asked the handle loop to send pending messages */
+	volatile gint writable;
 #ifdef DEBUG_SCTP
 	FILE *debug_dump;
 #endif
@@ -199,10 +211,23 @@ void janus_sctp_association_destroy(janus_sctp_association *sctp);
 void janus_sctp_data_from_dtls(janus_sctp_association *sctp, char *buf, int len);
 
 /*! \brief Method to send data via SCTP to the peer
+ * \note If the SCTP send buffer is full, the message is queued and sent
+ * when the SCTP stack tells us it's writable again (janus_sctp_send_pending)
  * \param[in] sctp The SCTP association this data is from
  * \param[in] buf The data buffer
- * \param[in] len The buffer length */
-void janus_sctp_send_data(janus_sctp_association *sctp, char *buf, int len);
+ * \param[in] len The buffer length
+ * \param[in] binary Whether this is a binary message (PPID 53) or a text one (PPID 51) */
+void janus_sctp_send_data(janus_sctp_association *sctp, char *buf, int len, gboolean binary);
+
+/*! \brief Method to send the messages that were queued because the SCTP send buffer was full
+ * \note This is called by the handle loop after the SCTP stack notified us it's writable
+ * \param[in] sctp The SCTP association to send the pending messages on */
+void janus_sctp_send_pending(janus_sctp_association *sctp);
+
+/*! \brief Method to get how much data is buffered in an SCTP association
+ * \param[in] sctp The SCTP association to check
+ * \returns The bytes that are queued or in the SCTP send buffer */
+int janus_sctp_buffered_amount(janus_sctp_association *sctp);
 
 #endif
 
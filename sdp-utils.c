@@ -30,6 +30,107 @@ const char *janus_preferred_video_codecs[] = {
 };
 uint janus_video_codecs = sizeof(janus_preferred_video_codecs)/sizeof(*janus_preferred_video_codecs);
 
+/* Arena for transient SDPs: a list of blocks we bump allocate from */
+typedef struct janus_sdp_arena_block {
+	struct janus_sdp_arena_block *next;
+	size_t size, used;
+	char data[];
+} janus_sdp_arena_block;
+struct janus_sdp_arena {
+	janus_sdp_arena_block *blocks;
+};
+#define JANUS_SDP_ARENA_MIN_BLOCK	4096
+
+static janus_sdp_arena_block *janus_sdp_arena_block_new(size_t size) {
+	janus_sdp_arena_block *block = g_malloc(sizeof(janus_sdp_arena_block) + size);
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+static janus_sdp_arena *janus_sdp_arena_new(size_t size) {
+	janus_sdp_arena *arena = g_malloc(sizeof(janus_sdp_arena));
+	arena->blocks = janus_sdp_arena_block_new(size < JANUS_SDP_ARENA_MIN_BLOCK ? JANUS_SDP_ARENA_MIN_BLOCK : size);
+	return arena;
+}
+
+static void janus_sdp_arena_destroy(janus_sdp_arena *arena) {
+	if(arena == NULL)
+		return;
+	janus_sdp_arena_block *block = arena->blocks, *next = NULL;
+	while(block) {
+		next = block->next;
+		g_free(block);
+		block = next;
+	}
+	g_free(arena);
+}
+
+static void *janus_sdp_arena_alloc0(janus_sdp_arena *arena, size_t size) {
+	/* Keep everything 8-bytes aligned */
+	size = (size + 7) & ~((size_t)7);
+	janus_sdp_arena_block *block = arena->blocks;
+	if(block->used + size > block->size) {
+		/* Not enough room, add a new (larger) block in front */
+		size_t bsize = block->size*2;
+		if(bsize < size)
+			bsize = size;
+		block = janus_sdp_arena_block_new(bsize);
+		block->next = arena->blocks;
+		arena->blocks = block;
+	}
+	void *ptr = block->data + block->used;
+	block->used += size;
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+static gboolean janus_sdp_arena_contains(janus_sdp_arena *arena, const void *ptr) {
+	if(arena == NULL || ptr == NULL)
+		return FALSE;
+	janus_sdp_arena_block *block = arena->blocks;
+	while(block) {
+		if((const char *)ptr >= block->data && (const char *)ptr < block->data + block->size)
+			return TRUE;
+		block = block->next;
+	}
+	return FALSE;
+}
+
+/* Allocation helpers used when parsing: they use the arena, if there is one */
+static void *janus_sdp_alloc0(janus_sdp_arena *arena, size_t size) {
+	return arena ? janus_sdp_arena_alloc0(arena, size) : g_malloc0(size);
+}
+
+static char *janus_sdp_strdup(janus_sdp_arena *arena, const char *str) {
+	if(arena == NULL)
+		return g_strdup(str);
+	if(str == NULL)
+		return NULL;
+	size_t len = strlen(str);
+	char *copy = janus_sdp_arena_alloc0(arena, len+1);
+	memcpy(copy, str, len);
+	return copy;
+}
+
+void janus_sdp_arena_free_string(janus_sdp_arena *arena, char *str) {
+	if(!janus_sdp_arena_contains(arena, str))
+		g_free(str);
+}
+
+void janus_sdp_mline_free_fmts(janus_sdp_mline *mline) {
+	if(mline == NULL)
+		return;
+	GList *temp = mline->fmts;
+	while(temp) {
+		janus_sdp_arena_free_string(mline->arena, (char *)temp->data);
+		temp = temp->next;
+	}
+	g_list_free(mline->fmts);
+	mline->fmts = NULL;
+}
+
 /* Reference counters management */
 void janus_sdp_destroy(janus_sdp *sdp) {
 	if(!sdp || !g_atomic_int_compare_and_exchange(&sdp->destroyed, 0, 1))
@@ -53,10 +154,11 @@ void janus_sdp_attribute_destroy(janus_sdp_attribute *a) {
 static void janus_sdp_free(const janus_refcount *sdp_ref) {
 	janus_sdp *sdp = janus_refcount_containerof(sdp_ref, janus_sdp, ref);
 	/* This SDP instance can be destroyed, free all the resources */
-	g_free(sdp->o_name);
-	g_free(sdp->o_addr);
-	g_free(sdp->s_name);
-	g_free(sdp->c_addr);
+	janus_sdp_arena *arena = sdp->arena;
+	janus_sdp_arena_free_string(arena, sdp->o_name);
+	janus_sdp_arena_free_string(arena, sdp->o_addr);
+	janus_sdp_arena_free_string(arena, sdp->s_name);
+	janus_sdp_arena_free_string(arena, sdp->c_addr);
 	GList *temp = sdp->attributes;
 	while(temp) {
 		janus_sdp_attribute *a = (janus_sdp_attribute *)temp->data;
@@ -73,18 +175,23 @@ static void janus_sdp_free(const janus_refcount *sdp_ref) {
 	}
 	g_list_free(sdp->m_lines);
 	sdp->m_lines = NULL;
+	if(arena != NULL) {
+		/* The tree lives in the arena, release it all in one step */
+		janus_sdp_arena_destroy(arena);
+		return;
+	}
 	g_free(sdp);
 }
 
 static void janus_sdp_mline_free(const janus_refcount *mline_ref) {
 	janus_sdp_mline *mline = janus_refcount_containerof(mline_ref, janus_sdp_mline, ref);
 	/* This SDP m-line instance can be destroyed, free all the resources */
-	g_free(mline->type_str);
-	g_free(mline->proto);
-	g_free(mline->c_addr);
-	g_free(mline->b_name);
-	g_list_free_full(mline->fmts, (GDestroyNotify)g_free);
-	mline->fmts = NULL;
+	janus_sdp_arena *arena = mline->arena;
+	janus_sdp_arena_free_string(arena, mline->type_str);
+	janus_sdp_arena_free_string(arena, mline->proto);
+	janus_sdp_arena_free_string(arena, mline->c_addr);
+	janus_sdp_arena_free_string(arena, mline->b_name);
+	janus_sdp_mline_free_fmts(mline);
 	g_list_free(mline->ptypes);
 	mline->ptypes = NULL;
 	GList *temp = mline->attributes;
@@ -94,7 +201,10 @@ static void janus_sdp_mline_free(const janus_refcount *mline_ref) {
 		temp = temp->next;
 	}
 	g_list_free(mline->attributes);
-	g_free(mline);
+	mline->attributes = NULL;
+	/* If the m-line is in an arena, it will be freed with the SDP */
+	if(arena == NULL)
+		g_free(mline);
 }
 
 static void janus_sdp_attribute_free(const janus_refcount *attr_ref) {
@@ -105,6 +215,10 @@ static void janus_sdp_attribute_free(const janus_refcount *attr_ref) {
 	g_free(attr);
 }
 
+static void janus_sdp_attribute_arena_free(const janus_refcount *attr_ref) {
+	/* Attributes parsed to an arena are freed with the SDP they belong to */
+}
+
 
 /* SDP and m-lines/attributes code */
 janus_sdp_mline *janus_sdp_mline_create(janus_sdp_mtype type, guint16 port, const char *proto, janus_sdp_mdirection direction) {
@@ -241,7 +355,7 @@ const char *janus_sdp_mdirection_str(janus_sdp_mdirection direction) {
 	return NULL;
 }
 
-janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
+static janus_sdp *janus_sdp_parse_internal(const char *sdp, char *error, size_t errlen, gboolean transient) {
 	if(!sdp)
 		return NULL;
 	if(strstr(sdp, "v=") != sdp) {
@@ -249,7 +363,11 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 			g_snprintf(error, errlen, "Invalid SDP (doesn't start with v=)");
 		return NULL;
 	}
-	janus_sdp *imported = g_malloc0(sizeof(janus_sdp));
+	/* For transient SDPs, everything goes in a single arena: parsed
+	 * trees are usually a bit more than twice the size of the string */
+	janus_sdp_arena *arena = transient ? janus_sdp_arena_new(2*strlen(sdp) + 1024) : NULL;
+	janus_sdp *imported = janus_sdp_alloc0(arena, sizeof(janus_sdp));
+	imported->arena = arena;
 	g_atomic_int_set(&imported->destroyed, 0);
 	janus_refcount_init(&imported->ref, janus_sdp_free);
 	imported->o_ipv4 = TRUE;
@@ -311,12 +429,12 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 							success = FALSE;
 							break;
 						}
-						imported->o_name = g_strdup(name);
-						imported->o_addr = g_strdup(addr);
+						imported->o_name = janus_sdp_strdup(arena, name);
+						imported->o_addr = janus_sdp_strdup(arena, addr);
 						break;
 					}
 					case 's': {
-						imported->s_name = g_strdup(line+2);
+						imported->s_name = janus_sdp_strdup(arena, line+2);
 						break;
 					}
 					case 't': {
@@ -346,17 +464,17 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 							success = FALSE;
 							break;
 						}
-						imported->c_addr = g_strdup(addr);
+						imported->c_addr = janus_sdp_strdup(arena, addr);
 						break;
 					}
 					case 'a': {
-						janus_sdp_attribute *a = g_malloc0(sizeof(janus_sdp_attribute));
+						janus_sdp_attribute *a = janus_sdp_alloc0(arena, sizeof(janus_sdp_attribute));
 						g_atomic_int_set(&a->destroyed, 0);
-						janus_refcount_init(&a->ref, janus_sdp_attribute_free);
+						janus_refcount_init(&a->ref, arena ? janus_sdp_attribute_arena_free : janus_sdp_attribute_free);
 						line += 2;
 						char *semicolon = strchr(line, ':');
 						if(semicolon == NULL) {
-							a->name = g_strdup(line);
+							a->name = janus_sdp_strdup(arena, line);
 							a->value = NULL;
 						} else {
 							if(*(semicolon+1) == '\0') {
@@ -366,8 +484,8 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 								break;
 							}
 							*semicolon = '\0';
-							a->name = g_strdup(line);
-							a->value = g_strdup(semicolon+1);
+							a->name = janus_sdp_strdup(arena, line);
+							a->value = janus_sdp_strdup(arena, semicolon+1);
 							a->direction = JANUS_SDP_DEFAULT;
 							*semicolon = ':';
 							if(strstr(line, "/sendonly"))
@@ -381,7 +499,8 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 						break;
 					}
 					case 'm': {
-						janus_sdp_mline *m = g_malloc0(sizeof(janus_sdp_mline));
+						janus_sdp_mline *m = janus_sdp_alloc0(arena, sizeof(janus_sdp_mline));
+						m->arena = arena;
 						g_atomic_int_set(&m->destroyed, 0);
 						janus_refcount_init(&m->ref, janus_sdp_mline_free);
 						/* Start with media type, port and protocol */
@@ -394,8 +513,8 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 							break;
 						}
 						m->type = janus_sdp_parse_mtype(type);
-						m->type_str = g_strdup(type);
-						m->proto = g_strdup(proto);
+						m->type_str = janus_sdp_strdup(arena, type);
+						m->proto = janus_sdp_strdup(arena, proto);
 						m->direction = JANUS_SDP_SENDRECV;
 						m->c_ipv4 = TRUE;
 						if(m->port > 0) {
@@ -415,7 +534,7 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 									continue;
 								}
 								/* Add string fmt */
-								m->fmts = g_list_append(m->fmts, g_strdup(mline_parts[mindex]));
+								m->fmts = g_list_append(m->fmts, janus_sdp_strdup(arena, mline_parts[mindex]));
 								/* Add numeric payload type */
 								int ptype = atoi(mline_parts[mindex]);
 								m->ptypes = g_list_append(m->ptypes, GINT_TO_POINTER(ptype));
@@ -460,7 +579,7 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 							success = FALSE;
 							break;
 						}
-						mline->c_addr = g_strdup(addr);
+						mline->c_addr = janus_sdp_strdup(arena, addr);
 						break;
 					}
 					case 'b': {
@@ -473,15 +592,15 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 							break;
 						}
 						*semicolon = '\0';
-						mline->b_name = g_strdup(line);
+						mline->b_name = janus_sdp_strdup(arena, line);
 						mline->b_value = atoi(semicolon+1);
 						*semicolon = ':';
 						break;
 					}
 					case 'a': {
-						janus_sdp_attribute *a = g_malloc0(sizeof(janus_sdp_attribute));
+						janus_sdp_attribute *a = janus_sdp_alloc0(arena, sizeof(janus_sdp_attribute));
 						g_atomic_int_set(&a->destroyed, 0);
-						janus_refcount_init(&a->ref, janus_sdp_attribute_free);
+						janus_refcount_init(&a->ref, arena ? janus_sdp_attribute_arena_free : janus_sdp_attribute_free);
 						line += 2;
 						char *semicolon = strchr(line, ':');
 						if(semicolon == NULL) {
@@ -492,7 +611,7 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 								mline->direction = direction;
 								break;
 							}
-							a->name = g_strdup(line);
+							a->name = janus_sdp_strdup(arena, line);
 							a->value = NULL;
 						} else {
 							if(*(semicolon+1) == '\0') {
@@ -502,8 +621,8 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 								break;
 							}
 							*semicolon = '\0';
-							a->name = g_strdup(line);
-							a->value = g_strdup(semicolon+1);
+							a->name = janus_sdp_strdup(arena, line);
+							a->value = janus_sdp_strdup(arena, semicolon+1);
 							a->direction = JANUS_SDP_DEFAULT;
 							*semicolon = ':';
 							if(strstr(line, "/sendonly"))
@@ -546,6 +665,14 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 	return imported;
 }
 
+janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
+	return janus_sdp_parse_internal(sdp, error, errlen, FALSE);
+}
+
+janus_sdp *janus_sdp_parse_transient(const char *sdp, char *error, size_t errlen) {
+	return janus_sdp_parse_internal(sdp, error, errlen, TRUE);
+}
+
 int janus_sdp_remove_payload_type(janus_sdp *sdp, int pt) {
 	if(!sdp || pt < 0)
 		return -1;
@@ -765,8 +892,7 @@ char *janus_sdp_write(janus_sdp *imported) {
 		g_strlcat(sdp, buffer, JANUS_BUFSIZE);
 		if(m->port == 0) {
 			/* Remove all payload types/formats if we're rejecting the media */
-			g_list_free_full(m->fmts, (GDestroyNotify)g_free);
-			m->fmts = NULL;
+			janus_sdp_mline_free_fmts(m);
 			g_list_free(m->ptypes);
 			m->ptypes = NULL;
 			m->ptypes = g_list_append(m->ptypes, GINT_TO_POINTER(0));
@@ -930,6 +1056,7 @@ const char *janus_sdp_match_preferred_codec(janus_sdp_mtype type, char *codec) {
 
 janus_sdp *janus_sdp_new(const char *name, const char *address) {
 	janus_sdp *sdp = g_malloc(sizeof(janus_sdp));
+	sdp->arena = NULL;
 	g_atomic_int_set(&sdp->destroyed, 0);
 	janus_refcount_init(&sdp->ref, janus_sdp_free);
 	/* Fill in some predefined stuff */
@@ -1120,6 +1247,7 @@ janus_sdp *janus_sdp_generate_answer(janus_sdp *offer, ...) {
 #endif
 
 	janus_sdp *answer = g_malloc(sizeof(janus_sdp));
+	answer->arena = NULL;
 	g_atomic_int_set(&answer->destroyed, 0);
 	janus_refcount_init(&answer->ref, janus_sdp_free);
 	/* Start by copying some of the headers */
@@ -21,6 +21,14 @@
 
 #include "refcount.h"
 
+/*! \brief Bump allocator an SDP parsed with janus_sdp_parse_transient lives in */
+typedef struct janus_sdp_arena janus_sdp_arena;
+/*! \brief Helper method to free a string property of a janus_sdp tree (e.g., to replace
+ * it), which will not call g_free if the string belongs to the arena the tree was parsed to
+ * @param[in] arena The arena the tree was parsed to, if any (NULL means a plain g_free)
+ * @param[in] str The string to free */
+void janus_sdp_arena_free_string(janus_sdp_arena *arena, char *str);
+
 /*! \brief Janus SDP internal object representation */
 typedef struct janus_sdp {
 	/*! \brief v= */
@@ -49,6 +57,8 @@ typedef struct janus_sdp {
 	GList *attributes;
 	/*! \brief List of m= m-lines */
 	GList *m_lines;
+	/*! \brief Arena the tree was allocated from, if parsed with janus_sdp_parse_transient */
+	janus_sdp_arena *arena;
 	/*! \brief Atomic flag to check if this instance has been destroyed */
 	volatile gint destroyed;
 	/*! \brief Reference counter for this instance */
@@ -150,6 +160,8 @@ typedef struct janus_sdp_mline {
 	janus_sdp_mdirection direction;
 	/*! \brief List of m-line attributes */
 	GList *attributes;
+	/*! \brief Arena the m-line was allocated from, if parsed with janus_sdp_parse_transient */
+	janus_sdp_arena *arena;
 	/*! \brief Atomic flag to check if this instance has been destroyed */
 	volatile gint destroyed;
 	/*! \brief Reference counter for this instance */
@@ -169,6 +181,10 @@ janus_sdp_mline *janus_sdp_mline_create(janus_sdp_mtype type, guint16 port, cons
  * @note This method does not remove the m-line from the janus_sdp instance, that's up to the caller
  * @param[in] mline The janus_sdp_mline instance to free */
 void janus_sdp_mline_destroy(janus_sdp_mline *mline);
+/*! \brief Helper method to free all the formats of a janus_sdp_mline instance (e.g., to replace them)
+ * @note Use this rather than freeing the list with g_free, as the m-line may live in an arena
+ * @param[in] mline The janus_sdp_mline instance whose formats should be freed */
+void janus_sdp_mline_free_fmts(janus_sdp_mline *mline);
 /*! \brief Helper method to get the janus_sdp_mline associated to a media type
  * @note This currently returns the first m-line of the specified type it finds: in
  * general, it shouldn't be an issue as we currently only support a single stream
@@ -221,6 +237,19 @@ int janus_sdp_attribute_add_to_mline(janus_sdp_mline *mline, janus_sdp_attribute
  * @returns A pointer to a janus_sdp object, if successful, NULL otherwise; in case
  * of errors, if provided the error string is filled with a reason  */
 janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen);
+/*! \brief Method to parse an SDP string to a short lived janus_sdp object
+ * \note The whole tree (the janus_sdp, its m-lines, attributes and strings) is allocated
+ * in a single arena, which is released in one step by janus_sdp_destroy: this makes it
+ * much cheaper than janus_sdp_parse for SDPs that are only inspected, munged and written
+ * again. The tree can still be modified (attributes and m-lines added or removed), but string
+ * properties must be replaced via janus_sdp_arena_free_string, and no m-line or attribute
+ * can outlive the tree: use janus_sdp_parse for SDP objects that need to be kept around.
+ * @param[in] sdp The SDP string to parse
+ * @param[in,out] error Buffer to receive a reason for an error, if any
+ * @param[in] errlen The length of the error buffer
+ * @returns A pointer to a janus_sdp object, if successful, NULL otherwise; in case
+ * of errors, if provided the error string is filled with a reason  */
+janus_sdp *janus_sdp_parse_transient(const char *sdp, char *error, size_t errlen);
 
 /*! \brief Helper method to quickly remove all traces (m-line, rtpmap, fmtp, etc.) of a payload type
  * @param[in] sdp The janus_sdp object to remove the payload type from
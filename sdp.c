@@ -31,7 +31,8 @@ janus_sdp *janus_sdp_preparse(const char *jsep_sdp, char *error_str, size_t errl
 		JANUS_LOG(LOG_ERR, "  Can't preparse, invalid arguments\n");
 		return NULL;
 	}
-	janus_sdp *parsed_sdp = janus_sdp_parse(jsep_sdp, error_str, errlen);
+	/* The core only needs the parsed SDP for a short while, so we use an arena */
+	janus_sdp *parsed_sdp = janus_sdp_parse_transient(jsep_sdp, error_str, errlen);
 	if(!parsed_sdp) {
 		JANUS_LOG(LOG_ERR, "  Error parsing SDP? %s\n", error_str ? error_str : "(unknown reason)");
 		/* Invalid SDP */
@@ -487,8 +488,7 @@ int janus_sdp_process(void *ice_handle, janus_sdp *remote_sdp, gboolean update)
 						memset(stream->audio_rtcp_ctx, 0, sizeof(*stream->audio_rtcp_ctx));
 						stream->audio_rtcp_ctx->tb = 48000;	/* May change later */
 					}
-					if(component->last_seqs_audio)
-						janus_seq_list_free(&component->last_seqs_audio);
+					janus_seq_window_reset(component->last_seqs_audio);
 					janus_mutex_unlock(&component->mutex);
 				}
 				stream->audio_ssrc_peer = stream->audio_ssrc_peer_new;
@@ -509,8 +509,7 @@ int janus_sdp_process(void *ice_handle, janus_sdp *remote_sdp, gboolean update)
 								memset(stream->video_rtcp_ctx[vindex], 0, sizeof(*stream->video_rtcp_ctx[vindex]));
 								stream->video_rtcp_ctx[vindex]->tb = 90000;
 							}
-							if(component->last_seqs_video[vindex])
-								janus_seq_list_free(&component->last_seqs_video[vindex]);
+							janus_seq_window_reset(component->last_seqs_video[vindex]);
 							janus_mutex_unlock(&component->mutex);
 						}
 					}
@@ -702,7 +701,7 @@ int janus_sdp_parse_candidate(void *ice_stream, const char *candidate, int trick
 				/* Save for the summary, in case we need it */
 				component->remote_candidates = g_slist_append(component->remote_candidates, g_strdup(candidate));
 				/* Notify event handlers */
-				if(janus_events_is_enabled()) {
+				if(janus_events_should_notify(JANUS_EVENT_TYPE_WEBRTC)) {
 					janus_session *session = (janus_session *)handle->session;
 					json_t *info = json_object();
 					json_object_set_new(info, "remote-candidate", json_string(candidate));
@@ -901,7 +900,7 @@ int janus_sdp_anonymize(janus_sdp *anon) {
 	int audio = 0, video = 0, data = 0;
 		/* o= */
 	if(anon->o_addr != NULL) {
-		g_free(anon->o_addr);
+		janus_sdp_arena_free_string(anon->arena, anon->o_addr);
 		anon->o_ipv4 = TRUE;
 		anon->o_addr = g_strdup("1.1.1.1");
 	}
@@ -947,7 +946,7 @@ int janus_sdp_anonymize(janus_sdp *anon) {
 		}
 			/* c= */
 		if(m->c_addr != NULL) {
-			g_free(m->c_addr);
+			janus_sdp_arena_free_string(m->arena, m->c_addr);
 			m->c_ipv4 = TRUE;
 			m->c_addr = g_strdup("1.1.1.1");
 		}
@@ -1032,13 +1031,13 @@ char *janus_sdp_merge(void *ice_handle, janus_sdp *anon, gboolean offer) {
 		anon->o_version = 1;
 	}
 	anon->o_ipv4 = ipv4;
-	g_free(anon->o_addr);
+	janus_sdp_arena_free_string(anon->arena, anon->o_addr);
 	anon->o_addr = g_strdup(janus_get_public_ip());
 	/* Session name s= */
 	if(anon->s_name == NULL)
 		anon->s_name = g_strdup("Meetecho Janus");
 	/* Chrome doesn't like global c= lines, remove it */
-	g_free(anon->c_addr);
+	janus_sdp_arena_free_string(anon->arena, anon->c_addr);
 	anon->c_addr = NULL;
 	/* bundle: add new global attribute */
 	char buffer[2048], buffer_part[512];
@@ -1106,11 +1105,11 @@ char *janus_sdp_merge(void *ice_handle, janus_sdp *anon, gboolean offer) {
 		first = m->attributes;
 		/* Overwrite RTP profile for audio and video */
 		if(m->type == JANUS_SDP_AUDIO || m->type == JANUS_SDP_VIDEO) {
-			g_free(m->proto);
+			janus_sdp_arena_free_string(m->arena, m->proto);
 			m->proto = g_strdup(rtp_profile);
 		}
 		/* Media connection c= */
-		g_free(m->c_addr);
+		janus_sdp_arena_free_string(m->arena, m->c_addr);
 		m->c_ipv4 = ipv4;
 		m->c_addr = g_strdup(janus_get_public_ip());
 		/* Check if we need to refuse the media or not */
@@ -1322,8 +1321,9 @@ char *janus_sdp_merge(void *ice_handle, janus_sdp *anon, gboolean offer) {
 			a = janus_sdp_attribute_create("simulcast", " recv rid=%s", rids);
 			m->attributes = g_list_append(m->attributes, a);
 		}
-		if(!janus_ice_is_full_trickle_enabled()) {
-			/* And now the candidates (but only if we're half-trickling) */
+		if(!janus_ice_is_full_trickle_enabled() || janus_ice_is_lite_mux_enabled()) {
+			/* And now the candidates (but only if we're half-trickling, or if there's
+			 * nothing to trickle as all handles share the same ICE-Lite port) */
 			janus_ice_candidates_to_sdp(handle, m, stream->stream_id, 1);
 			/* Since we're half-trickling, we need to notify the peer that these are all the
 			 * candidates we have for this media stream, via an end-of-candidates attribute:
@@ -0,0 +1,47 @@
+/*! \file    trace.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Static tracepoints (USDT)
+ * \details  Macros to add static tracepoints to the hot paths of the core
+ * and plugins, so that tools like \c bpftrace, \c perf or SystemTap can
+ * attach to them on a production box and get per-handle latency and
+ * throughput breakdowns, without a debug build or a heavy profiler.
+ * Tracepoints are only compiled in if Janus is configured with
+ * \c --enable-usdt (which requires \c sys/sdt.h, e.g., from the
+ * \c systemtap-sdt-dev or \c systemtap-sdt-devel packages): when it
+ * isn't, the macros expand to nothing, and their arguments are not even
+ * evaluated. When they are compiled in, each tracepoint is a single
+ * \c nop instruction until a tool attaches to it, plus whatever it takes
+ * to have the arguments available, which is why the macros should only be
+ * passed values the code has at hand anyway (e.g., the handle ID and the
+ * length of a packet), and never something that needs to be computed.
+ *
+ * All tracepoints belong to the \c janus provider: the list of tracepoints
+ * that are available, and what they carry, is in the \ref usdt section.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef _JANUS_TRACE_H
+#define _JANUS_TRACE_H
+
+#ifdef HAVE_USDT
+#include <sys/sdt.h>
+
+#define JANUS_TRACE1(name, a1) \
+	DTRACE_PROBE1(janus, name, a1)
+#define JANUS_TRACE2(name, a1, a2) \
+	DTRACE_PROBE2(janus, name, a1, a2)
+#define JANUS_TRACE3(name, a1, a2, a3) \
+	DTRACE_PROBE3(janus, name, a1, a2, a3)
+#define JANUS_TRACE4(name, a1, a2, a3, a4) \
+	DTRACE_PROBE4(janus, name, a1, a2, a3, a4)
+#else
+#define JANUS_TRACE1(name, a1)
+#define JANUS_TRACE2(name, a1, a2)
+#define JANUS_TRACE3(name, a1, a2, a3)
+#define JANUS_TRACE4(name, a1, a2, a3, a4)
+#endif
+
+#endif
@@ -42,6 +42,7 @@
 #include "../mutex.h"
 #include "../ip-utils.h"
 #include "../utils.h"
+#include "../metrics.h"
 
 
 /* Transport plugin information */
@@ -149,9 +150,43 @@ static void janus_http_msg_destroy(void *msg) {
 typedef struct janus_http_session {
 	guint64 session_id;			/* Core session identifier */
 	GAsyncQueue *events;		/* Events to notify for this session */
+	struct janus_http_sse *sse;	/* Latest event stream opened for this session, if any (protected by sessions_mutex) */
 	volatile gint destroyed;	/* Whether this session has been destroyed */
 	janus_refcount ref;			/* Reference counter for this session */
 } janus_http_session;
+/* Server-Sent Events stream for a session: instead of long polling, the
+ * client can keep a GET open and get all the events on the same response */
+typedef struct janus_http_sse {
+	janus_transport_session *ts;		/* Transport session of the request that opened the stream */
+	janus_http_session *session;		/* Session whose events we're streaming */
+	gchar *secret, *token;				/* Credentials to use for our keepalives to the core */
+	gint64 last_keepalive;				/* When we last sent a keepalive to the core */
+	GString *pending;					/* Data we prepared but haven't passed to libmicrohttpd yet */
+	size_t offset;						/* How much of the pending data we passed already */
+	struct MHD_Connection *connection;	/* Connection we suspend while there's nothing to send (thread pool only) */
+	gboolean suspended;					/* Whether the connection is suspended now */
+	janus_mutex mutex;					/* Mutex to suspend and resume the connection */
+} janus_http_sse;
+/* How long to wait for an event in each round, and how often we send keepalives */
+#define JANUS_HTTP_SSE_WAIT			G_USEC_PER_SEC
+#define JANUS_HTTP_SSE_KEEPALIVE	(30*G_USEC_PER_SEC)
+#define JANUS_HTTP_SSE_BLOCK_SIZE	(32*1024)
+static gboolean sse_enabled = TRUE;
+/* When a thread pool serves all connections, event streams can't wait for
+ * events in the workers: they suspend their connection instead, and are
+ * resumed when there's an event, or by a thread that checks on them */
+static gboolean sse_suspend = FALSE;
+static GList *sse_streams = NULL;
+static janus_mutex sse_mutex = JANUS_MUTEX_INITIALIZER;
+static GThread *sse_thread = NULL;
+static void *janus_http_sse_thread(void *data);
+static void janus_http_sse_wakeup(struct janus_http_sse *stream);
+/* The flag to allow suspending connections was renamed in newer versions of libmicrohttpd */
+#if MHD_VERSION >= 0x00095300
+#define JANUS_HTTP_SUSPEND_RESUME	MHD_ALLOW_SUSPEND_RESUME
+#else
+#define JANUS_HTTP_SUSPEND_RESUME	MHD_USE_SUSPEND_RESUME
+#endif
 /* We keep track of created sessions as we handle long polls */
 const char *keepalive_id = "keepalive";
 GHashTable *sessions = NULL;
@@ -191,6 +226,10 @@ void janus_http_request_completed(void *cls, struct MHD_Connection *connection,
 int janus_http_notifier(janus_transport_session *ts, janus_http_session *session, int max_events);
 /* Helper to quickly send a success response */
 int janus_http_return_success(janus_transport_session *ts, char *payload);
+/* Helper to quickly send an empty response with the provided status code */
+static int janus_http_return_empty(janus_http_msg *msg, struct MHD_Connection *connection, unsigned int code);
+/* Helper to start streaming events for a session as Server-Sent Events */
+static int janus_http_sse_start(janus_transport_session *ts, janus_http_session *session, const char *secret, const char *token);
 /* Helper to quickly send an error response */
 int janus_http_return_error(janus_transport_session *ts, uint64_t session_id, const char *transaction, gint error, const char *format, ...) G_GNUC_PRINTF(5, 6);
 
@@ -203,6 +242,8 @@ static char *cert_pem_bytes = NULL, *cert_key_bytes = NULL;
 /* Admin/Monitor MHD Web Server */
 static struct MHD_Daemon *admin_ws = NULL, *admin_sws = NULL;
 static char *admin_ws_path = NULL;
+/* Path to expose the metrics on in the admin/monitor web server, if enabled */
+static char *metrics_path = NULL;
 
 /* Custom Access-Control-Allow-Origin value, if specified */
 static char *allow_origin = NULL;
@@ -438,7 +479,7 @@ static struct MHD_Daemon *janus_http_create_daemon(gboolean admin, char *path,
 				JANUS_LOG(LOG_VERB, "Binding to all interfaces for the %s API %s webserver\n",
 					admin ? "Admin" : "Janus", secure ? "HTTPS" : "HTTP");
 				daemon = MHD_start_daemon(
-					MHD_USE_SELECT_INTERNALLY | MHD_USE_DUAL_STACK,
+					MHD_USE_SELECT_INTERNALLY | MHD_USE_DUAL_STACK | (admin ? 0 : JANUS_HTTP_SUSPEND_RESUME),
 					port,
 					admin ? janus_http_admin_client_connect : janus_http_client_connect,
 					NULL,
@@ -453,7 +494,7 @@ static struct MHD_Daemon *janus_http_create_daemon(gboolean admin, char *path,
 					ip ? "IP" : "interface", ip ? ip : interface,
 					admin ? "Admin" : "Janus", secure ? "HTTPS" : "HTTP");
 				daemon = MHD_start_daemon(
-					MHD_USE_SELECT_INTERNALLY | (ipv6 ? MHD_USE_IPv6 : 0),
+					MHD_USE_SELECT_INTERNALLY | (ipv6 ? MHD_USE_IPv6 : 0) | (admin ? 0 : JANUS_HTTP_SUSPEND_RESUME),
 					port,
 					admin ? janus_http_admin_client_connect : janus_http_client_connect,
 					NULL,
@@ -536,7 +577,7 @@ static struct MHD_Daemon *janus_http_create_daemon(gboolean admin, char *path,
 				JANUS_LOG(LOG_VERB, "Binding to all interfaces for the %s API %s webserver\n",
 					admin ? "Admin" : "Janus", secure ? "HTTPS" : "HTTP");
 				daemon = MHD_start_daemon(
-					MHD_USE_SSL | MHD_USE_SELECT_INTERNALLY | MHD_USE_DUAL_STACK,
+					MHD_USE_SSL | MHD_USE_SELECT_INTERNALLY | MHD_USE_DUAL_STACK | (admin ? 0 : JANUS_HTTP_SUSPEND_RESUME),
 					port,
 					admin ? janus_http_admin_client_connect : janus_http_client_connect,
 					NULL,
@@ -557,7 +598,7 @@ static struct MHD_Daemon *janus_http_create_daemon(gboolean admin, char *path,
 					ip ? "IP" : "interface", ip ? ip : interface,
 					admin ? "Admin" : "Janus", secure ? "HTTPS" : "HTTP");
 				daemon = MHD_start_daemon(
-					MHD_USE_SSL | MHD_USE_SELECT_INTERNALLY | (ipv6 ? MHD_USE_IPv6 : 0),
+					MHD_USE_SSL | MHD_USE_SELECT_INTERNALLY | (ipv6 ? MHD_USE_IPv6 : 0) | (admin ? 0 : JANUS_HTTP_SUSPEND_RESUME),
 					port,
 					admin ? janus_http_admin_client_connect : janus_http_client_connect,
 					NULL,
@@ -596,6 +637,204 @@ static void janus_http_add_cors_headers(janus_http_msg *msg, struct MHD_Response
 		MHD_add_response_header(response, "Access-Control-Allow-Headers", msg->acrh);
 }
 
+/* Empty responses (e.g., errors or preflights) are always the same, so we
+ * create them once and reuse them: libmicrohttpd keeps its own reference
+ * to a queued response, which means it's safe to share them across requests */
+static GHashTable *empty_responses = NULL;
+static janus_mutex empty_responses_mutex = JANUS_MUTEX_INITIALIZER;
+
+static int janus_http_return_empty(janus_http_msg *msg, struct MHD_Connection *connection, unsigned int code) {
+	int ret = MHD_NO;
+	struct MHD_Response *response = NULL;
+	if(msg != NULL && (msg->acrm != NULL || msg->acrh != NULL)) {
+		/* The CORS headers depend on the request, create a new response */
+		response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
+		janus_http_add_cors_headers(msg, response);
+		ret = MHD_queue_response(connection, code, response);
+		MHD_destroy_response(response);
+		return ret;
+	}
+	/* Check if we have a shared response for this code already */
+	guint key = (code << 1) | (msg != NULL ? 1 : 0);
+	janus_mutex_lock(&empty_responses_mutex);
+	if(empty_responses == NULL)
+		empty_responses = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)MHD_destroy_response);
+	response = g_hash_table_lookup(empty_responses, GUINT_TO_POINTER(key));
+	if(response == NULL) {
+		response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
+		janus_http_add_cors_headers(msg, response);
+		g_hash_table_insert(empty_responses, GUINT_TO_POINTER(key), response);
+	}
+	janus_mutex_unlock(&empty_responses_mutex);
+	return MHD_queue_response(connection, code, response);
+}
+
+/* Server-Sent Events helpers */
+static void janus_http_sse_keepalive(janus_http_sse *stream) {
+	/* Same fake keepalive we send the core for long polls */
+	char tr[12];
+	janus_http_random_string(12, (char *)&tr);
+	json_t *root = json_object();
+	json_object_set_new(root, "janus", json_string("keepalive"));
+	json_object_set_new(root, "session_id", json_integer(stream->session->session_id));
+	json_object_set_new(root, "transaction", json_string(tr));
+	if(stream->secret)
+		json_object_set_new(root, "apisecret", json_string(stream->secret));
+	if(stream->token)
+		json_object_set_new(root, "token", json_string(stream->token));
+	gateway->incoming_request(&janus_http_transport, stream->ts, (void *)keepalive_id, FALSE, root, NULL);
+	stream->last_keepalive = janus_get_monotonic_time();
+}
+
+static void janus_http_sse_append(janus_http_sse *stream, json_t *event) {
+	/* Each line of the JSON text must be prefixed by "data:" */
+	char *text = json_dumps(event, json_format);
+	json_decref(event);
+	if(text == NULL)
+		return;
+	g_string_append(stream->pending, "data: ");
+	char *line = text, *next = NULL;
+	while((next = strchr(line, '\n')) != NULL) {
+		g_string_append_len(stream->pending, line, next-line);
+		g_string_append(stream->pending, "\ndata: ");
+		line = next+1;
+	}
+	g_string_append(stream->pending, line);
+	g_string_append(stream->pending, "\n\n");
+	free(text);
+}
+
+static ssize_t janus_http_sse_read(void *cls, uint64_t pos, char *buf, size_t max) {
+	janus_http_sse *stream = (janus_http_sse *)cls;
+	while(stream->offset >= stream->pending->len) {
+		g_string_truncate(stream->pending, 0);
+		stream->offset = 0;
+		if(g_atomic_int_get(&stopping) || g_atomic_int_get(&stream->session->destroyed))
+			return MHD_CONTENT_READER_END_OF_STREAM;
+		json_t *event = NULL;
+		if(stream->connection == NULL) {
+			/* We have a thread of our own, so we can wait for events here */
+			event = g_async_queue_timeout_pop(stream->session->events, JANUS_HTTP_SSE_WAIT);
+		} else {
+			/* We're in a thread that serves other connections too: if there's
+			 * nothing to send now, suspend the connection until there is */
+			janus_mutex_lock(&stream->mutex);
+			event = g_async_queue_try_pop(stream->session->events);
+			if(event == NULL && janus_get_monotonic_time() - stream->last_keepalive < JANUS_HTTP_SSE_KEEPALIVE) {
+				stream->suspended = TRUE;
+				MHD_suspend_connection(stream->connection);
+				janus_mutex_unlock(&stream->mutex);
+				return 0;
+			}
+			janus_mutex_unlock(&stream->mutex);
+		}
+		if(event != NULL) {
+			/* Serve all the events we have right now in the same round */
+			do {
+				janus_http_sse_append(stream, event);
+			} while(stream->pending->len < JANUS_HTTP_SSE_BLOCK_SIZE &&
+				(event = g_async_queue_try_pop(stream->session->events)) != NULL);
+		}
+		if(janus_get_monotonic_time() - stream->last_keepalive >= JANUS_HTTP_SSE_KEEPALIVE) {
+			/* Keep the session alive, and let proxies know the stream is still there too */
+			janus_http_sse_keepalive(stream);
+			if(stream->pending->len == 0)
+				g_string_append(stream->pending, ": keepalive\n\n");
+		}
+	}
+	size_t size = MIN(max, stream->pending->len - stream->offset);
+	memcpy(buf, stream->pending->str + stream->offset, size);
+	stream->offset += size;
+	return size;
+}
+
+/* Resume a suspended event stream, e.g., because there's an event to send */
+static void janus_http_sse_wakeup(janus_http_sse *stream) {
+	janus_mutex_lock(&stream->mutex);
+	if(stream->suspended) {
+		stream->suspended = FALSE;
+		MHD_resume_connection(stream->connection);
+	}
+	janus_mutex_unlock(&stream->mutex);
+}
+
+/* Thread resuming the suspended event streams once in a while, so that
+ * they can send keepalives, and notice when their session went away */
+static void *janus_http_sse_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining HTTP event streams thread\n");
+	while(!g_atomic_int_get(&stopping)) {
+		g_usleep(JANUS_HTTP_SSE_WAIT);
+		janus_mutex_lock(&sse_mutex);
+		g_list_foreach(sse_streams, (GFunc)janus_http_sse_wakeup, NULL);
+		janus_mutex_unlock(&sse_mutex);
+	}
+	JANUS_LOG(LOG_VERB, "Leaving HTTP event streams thread\n");
+	return NULL;
+}
+
+static void janus_http_sse_free(void *cls) {
+	janus_http_sse *stream = (janus_http_sse *)cls;
+	JANUS_LOG(LOG_VERB, "Closing event stream for session %"SCNu64"\n", stream->session->session_id);
+	if(stream->connection != NULL) {
+		janus_mutex_lock(&sse_mutex);
+		sse_streams = g_list_remove(sse_streams, stream);
+		janus_mutex_unlock(&sse_mutex);
+		janus_mutex_lock(&sessions_mutex);
+		if(stream->session->sse == stream)
+			stream->session->sse = NULL;
+		janus_mutex_unlock(&sessions_mutex);
+	}
+	janus_refcount_decrease(&stream->session->ref);
+	janus_refcount_decrease(&stream->ts->ref);
+	g_free(stream->secret);
+	g_free(stream->token);
+	g_string_free(stream->pending, TRUE);
+	g_free(stream);
+}
+
+static int janus_http_sse_start(janus_transport_session *ts, janus_http_session *session, const char *secret, const char *token) {
+	janus_http_msg *msg = (janus_http_msg *)ts->transport_p;
+	if(msg == NULL || msg->connection == NULL)
+		return MHD_NO;
+	janus_http_sse *stream = g_malloc0(sizeof(janus_http_sse));
+	janus_refcount_increase(&ts->ref);
+	stream->ts = ts;
+	janus_refcount_increase(&session->ref);
+	stream->session = session;
+	stream->secret = g_strdup(secret);
+	stream->token = g_strdup(token);
+	/* We sent a keepalive when the GET arrived already */
+	stream->last_keepalive = janus_get_monotonic_time();
+	stream->pending = g_string_sized_new(JANUS_HTTP_SSE_BLOCK_SIZE);
+	/* Tell the client right away to wait a bit before reconnecting, if the stream breaks */
+	g_string_append(stream->pending, "retry: 1000\n\n");
+	struct MHD_Response *response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN,
+		JANUS_HTTP_SSE_BLOCK_SIZE, &janus_http_sse_read, stream, &janus_http_sse_free);
+	if(response == NULL) {
+		janus_http_sse_free(stream);
+		return MHD_NO;
+	}
+	if(sse_suspend) {
+		/* Keep track of the stream, so that we can resume it when needed */
+		stream->connection = msg->connection;
+		janus_mutex_init(&stream->mutex);
+		janus_mutex_lock(&sse_mutex);
+		sse_streams = g_list_prepend(sse_streams, stream);
+		janus_mutex_unlock(&sse_mutex);
+		janus_mutex_lock(&sessions_mutex);
+		session->sse = stream;
+		janus_mutex_unlock(&sessions_mutex);
+	}
+	JANUS_LOG(LOG_VERB, "Streaming events for session %"SCNu64" as Server-Sent Events\n", session->session_id);
+	MHD_add_response_header(response, "Content-Type", "text/event-stream");
+	MHD_add_response_header(response, "Cache-Control", "no-cache");
+	MHD_add_response_header(response, "X-Accel-Buffering", "no");
+	janus_http_add_cors_headers(msg, response);
+	int ret = MHD_queue_response(msg->connection, MHD_HTTP_OK, response);
+	MHD_destroy_response(response);
+	return ret;
+}
+
 /* Static callback that we register to */
 static void janus_http_mhd_panic(void *cls, const char *file, unsigned int line, const char *reason) {
 	JANUS_LOG(LOG_WARN, "[%s]: Error in GNU libmicrohttpd %s:%u: %s\n",
@@ -688,6 +927,23 @@ int janus_http_init(janus_transport_callbacks *callback, const char *config_path
 		} else {
 			admin_ws_path = g_strdup("/admin");
 		}
+		/* Check if we should expose the metrics registry as well */
+		item = janus_config_get_item_drilldown(config, "admin", "metrics");
+		if(item && item->value && janus_is_true(item->value)) {
+			item = janus_config_get_item_drilldown(config, "admin", "metrics_path");
+			if(item && item->value && item->value[0] != '/') {
+				JANUS_LOG(LOG_WARN, "Invalid metrics path %s (it should start with a /), using /metrics\n", item->value);
+				item = NULL;
+			}
+			metrics_path = g_strdup((item && item->value) ? item->value : "/metrics");
+			if(!strcasecmp(metrics_path, admin_ws_path)) {
+				JANUS_LOG(LOG_WARN, "The metrics path can't be the same as the admin/monitor base path, metrics disabled\n");
+				g_free(metrics_path);
+				metrics_path = NULL;
+			} else {
+				JANUS_LOG(LOG_INFO, "Metrics will be available on %s in the admin/monitor web server\n", metrics_path);
+			}
+		}
 
 		/* Any ACL for either the Janus or Admin API? */
 		item = janus_config_get_item_drilldown(config, "general", "acl");
@@ -734,6 +990,12 @@ int janus_http_init(janus_transport_callbacks *callback, const char *config_path
 			JANUS_LOG(LOG_INFO, "Restricting Access-Control-Allow-Origin to '%s'\n", allow_origin);
 		}
 
+		/* Can clients ask for events as a Server-Sent Events stream, rather than long polling? */
+		item = janus_config_get_item_drilldown(config, "general", "sse");
+		if(item && item->value)
+			sse_enabled = janus_is_true(item->value);
+		JANUS_LOG(LOG_INFO, "Server-Sent Events streams are %s\n", sse_enabled ? "enabled" : "disabled");
+
 		/* Start with the Janus API web server now */
 		gint64 threads = 0;
 		item = janus_config_get_item_drilldown(config, "general", "threads");
@@ -752,6 +1014,19 @@ int janus_http_init(janus_transport_callbacks *callback, const char *config_path
 				}
 			}
 		}
+		if(sse_enabled && threads > 0) {
+			/* Event streams can't keep a thread of the pool busy waiting for events */
+			sse_suspend = TRUE;
+			GError *error = NULL;
+			sse_thread = g_thread_try_new("http sse", janus_http_sse_thread, NULL, &error);
+			if(error != NULL) {
+				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the HTTP event streams thread, disabling Server-Sent Events...\n",
+					error->code, error->message ? error->message : "??");
+				g_error_free(error);
+				sse_suspend = FALSE;
+				sse_enabled = FALSE;
+			}
+		}
 		item = janus_config_get_item_drilldown(config, "general", "http");
 		if(!item || !item->value || !janus_is_true(item->value)) {
 			JANUS_LOG(LOG_WARN, "HTTP webserver disabled\n");
@@ -918,6 +1193,16 @@ void janus_http_destroy(void) {
 		return;
 	g_atomic_int_set(&stopping, 1);
 
+	if(sse_thread != NULL) {
+		g_thread_join(sse_thread);
+		sse_thread = NULL;
+	}
+	/* Suspended event streams must be resumed for the webservers to close them */
+	janus_mutex_lock(&sse_mutex);
+	g_list_foreach(sse_streams, (GFunc)janus_http_sse_wakeup, NULL);
+	janus_mutex_unlock(&sse_mutex);
+	sse_suspend = FALSE;
+
 	JANUS_LOG(LOG_INFO, "Stopping webserver(s)...\n");
 	if(ws)
 		MHD_stop_daemon(ws);
@@ -939,6 +1224,14 @@ void janus_http_destroy(void) {
 	cert_key_bytes = NULL;
 	g_free(allow_origin);
 	allow_origin = NULL;
+	g_free(metrics_path);
+	metrics_path = NULL;
+
+	janus_mutex_lock(&empty_responses_mutex);
+	if(empty_responses != NULL)
+		g_hash_table_destroy(empty_responses);
+	empty_responses = NULL;
+	janus_mutex_unlock(&empty_responses_mutex);
 
 	g_hash_table_destroy(messages);
 	g_hash_table_destroy(sessions);
@@ -1009,6 +1302,8 @@ int janus_http_send_message(janus_transport_session *transport, void *request_id
 			return -1;
 		}
 		g_async_queue_push(session->events, message);
+		if(session->sse != NULL)
+			janus_http_sse_wakeup(session->sse);
 		janus_mutex_unlock(&sessions_mutex);
 	} else {
 		if(request_id == keepalive_id) {
@@ -1188,10 +1483,7 @@ int janus_http_handler(void *cls, struct MHD_Connection *connection, const char
 		goto done;
 	}
 	if (!strcasecmp(method, "OPTIONS")) {
-		response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
-		janus_http_add_cors_headers(msg, response);
-		ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
-		MHD_destroy_response(response);
+		ret = janus_http_return_empty(msg, connection, MHD_HTTP_OK);
 	}
 	/* Get path components */
 	if(strcasecmp(url, ws_path)) {
@@ -1206,10 +1498,7 @@ int janus_http_handler(void *cls, struct MHD_Connection *connection, const char
 		}
 		if(basepath[0] == NULL || basepath[1] == NULL || basepath[1][0] != '/') {
 			JANUS_LOG(LOG_ERR, "Invalid url %s\n", url);
-			response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
-			janus_http_add_cors_headers(msg, response);
-			ret = MHD_queue_response(connection, MHD_HTTP_NOT_FOUND, response);
-			MHD_destroy_response(response);
+			ret = janus_http_return_empty(msg, connection, MHD_HTTP_NOT_FOUND);
 		}
 		if(firstround) {
 			g_strfreev(basepath);
@@ -1218,10 +1507,7 @@ int janus_http_handler(void *cls, struct MHD_Connection *connection, const char
 		path = g_strsplit(basepath[1], "/", -1);
 		if(path == NULL || path[1] == NULL) {
 			JANUS_LOG(LOG_ERR, "Invalid path %s (%s)\n", basepath[1], path ? path[1] : "");
-			response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
-			janus_http_add_cors_headers(msg, response);
-			ret = MHD_queue_response(connection, MHD_HTTP_NOT_FOUND, response);
-			MHD_destroy_response(response);
+			ret = janus_http_return_empty(msg, connection, MHD_HTTP_NOT_FOUND);
 			g_strfreev(basepath);
 			g_strfreev(path);
 			return ret;
@@ -1243,10 +1529,7 @@ int janus_http_handler(void *cls, struct MHD_Connection *connection, const char
 	}
 	if(session_path != NULL && handle_path != NULL && path[3] != NULL && strlen(path[3]) > 0) {
 		JANUS_LOG(LOG_ERR, "Too many components...\n");
-		response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
-		janus_http_add_cors_headers(msg, response);
-		ret = MHD_queue_response(connection, MHD_HTTP_NOT_FOUND, response);
-		MHD_destroy_response(response);
+		ret = janus_http_return_empty(msg, connection, MHD_HTTP_NOT_FOUND);
 		goto done;
 	}
 	/* Get payload, if any */
@@ -1276,10 +1559,7 @@ int janus_http_handler(void *cls, struct MHD_Connection *connection, const char
 	if(session_path != NULL && !strcmp(session_path, "info")) {
 		/* The info REST endpoint, if contacted through a GET, provides information on the gateway */
 		if(strcasecmp(method, "GET")) {
-			response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
-			janus_http_add_cors_headers(msg, response);
-			ret = MHD_queue_response(connection, MHD_HTTP_BAD_REQUEST, response);
-			MHD_destroy_response(response);
+			ret = janus_http_return_empty(msg, connection, MHD_HTTP_BAD_REQUEST);
 			goto done;
 		}
 		/* Turn this into a fake "info" request */
@@ -1297,10 +1577,7 @@ int janus_http_handler(void *cls, struct MHD_Connection *connection, const char
 		session_id = session_path ? g_ascii_strtoull(session_path, NULL, 10) : 0;
 		if(session_id < 1) {
 			JANUS_LOG(LOG_ERR, "Invalid session %s\n", session_path);
-			response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
-			janus_http_add_cors_headers(msg, response);
-			ret = MHD_queue_response(connection, MHD_HTTP_NOT_FOUND, response);
-			MHD_destroy_response(response);
+			ret = janus_http_return_empty(msg, connection, MHD_HTTP_NOT_FOUND);
 			goto done;
 		}
 		msg->session_id = session_id;
@@ -1328,10 +1605,7 @@ int janus_http_handler(void *cls, struct MHD_Connection *connection, const char
 			}
 			/* We consider a request authorized if either the proper API secret or a valid token has been provided */
 			if(!secret_authorized && !token_authorized) {
-				response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
-				janus_http_add_cors_headers(msg, response);
-				ret = MHD_queue_response(connection, MHD_HTTP_FORBIDDEN, response);
-				MHD_destroy_response(response);
+				ret = janus_http_return_empty(msg, connection, MHD_HTTP_FORBIDDEN);
 				goto done;
 			}
 		}
@@ -1365,14 +1639,22 @@ int janus_http_handler(void *cls, struct MHD_Connection *connection, const char
 		janus_mutex_unlock(&sessions_mutex);
 		if(!session || g_atomic_int_get(&session->destroyed)) {
 			JANUS_LOG(LOG_ERR, "Couldn't find any session %"SCNu64"...\n", session_id);
-			response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
-			janus_http_add_cors_headers(msg, response);
-			ret = MHD_queue_response(connection, MHD_HTTP_NOT_FOUND, response);
-			MHD_destroy_response(response);
+			ret = janus_http_return_empty(msg, connection, MHD_HTTP_NOT_FOUND);
 			goto done;
 		}
 		janus_refcount_increase(&ts->ref);
 		janus_refcount_increase(&session->ref);
+		/* Does the client want us to stream all events on this response, rather than long polling? */
+		if(sse_enabled) {
+			const char *accept = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "Accept");
+			const char *sse = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "sse");
+			if((accept && strstr(accept, "text/event-stream")) || (sse && janus_is_true(sse))) {
+				ret = janus_http_sse_start(ts, session, secret, token);
+				janus_refcount_decrease(&session->ref);
+				janus_refcount_decrease(&ts->ref);
+				goto done;
+			}
+		}
 		/* How many messages can we send back in a single response? (just one by default) */
 		int max_events = 1;
 		const char *maxev = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "maxev");
@@ -1529,17 +1811,27 @@ int janus_http_admin_handler(void *cls, struct MHD_Connection *connection, const
 	/* Parse request */
 	if (strcasecmp(method, "GET") && strcasecmp(method, "POST") && strcasecmp(method, "OPTIONS")) {
 		JANUS_LOG(LOG_ERR, "Unsupported method...\n");
-		response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
-		janus_http_add_cors_headers(msg, response);
-		ret = MHD_queue_response(connection, MHD_HTTP_NOT_IMPLEMENTED, response);
-		MHD_destroy_response(response);
+		ret = janus_http_return_empty(msg, connection, MHD_HTTP_NOT_IMPLEMENTED);
 		return ret;
 	}
 	if (!strcasecmp(method, "OPTIONS")) {
-		response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
+		ret = janus_http_return_empty(msg, connection, MHD_HTTP_OK);
+	}
+	/* Is this a scrape of the metrics? */
+	if(metrics_path != NULL && !strcasecmp(url, metrics_path)) {
+		if(firstround || !strcasecmp(method, "OPTIONS"))
+			return ret;
+		if(strcasecmp(method, "GET")) {
+			ret = janus_http_return_empty(msg, connection, MHD_HTTP_METHOD_NOT_ALLOWED);
+			return ret;
+		}
+		char *metrics = janus_metrics_dump();
+		response = MHD_create_response_from_buffer(strlen(metrics), metrics, MHD_RESPMEM_MUST_FREE);
+		MHD_add_response_header(response, "Content-Type", "text/plain; version=0.0.4; charset=utf-8");
 		janus_http_add_cors_headers(msg, response);
 		ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
 		MHD_destroy_response(response);
+		return ret;
 	}
 	/* Get path components */
 	if(strcasecmp(url, admin_ws_path)) {
@@ -1554,10 +1846,7 @@ int janus_http_admin_handler(void *cls, struct MHD_Connection *connection, const
 		}
 		if(basepath[0] == NULL || basepath[1] == NULL || basepath[1][0] != '/') {
 			JANUS_LOG(LOG_ERR, "Invalid url %s\n", url);
-			response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
-			janus_http_add_cors_headers(msg, response);
-			ret = MHD_queue_response(connection, MHD_HTTP_NOT_FOUND, response);
-			MHD_destroy_response(response);
+			ret = janus_http_return_empty(msg, connection, MHD_HTTP_NOT_FOUND);
 		}
 		if(firstround) {
 			g_strfreev(basepath);
@@ -1566,10 +1855,7 @@ int janus_http_admin_handler(void *cls, struct MHD_Connection *connection, const
 		path = g_strsplit(basepath[1], "/", -1);
 		if(path == NULL || path[1] == NULL) {
 			JANUS_LOG(LOG_ERR, "Invalid path %s (%s)\n", basepath[1], path ? path[1] : "");
-			response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
-			janus_http_add_cors_headers(msg, response);
-			ret = MHD_queue_response(connection, MHD_HTTP_NOT_FOUND, response);
-			MHD_destroy_response(response);
+			ret = janus_http_return_empty(msg, connection, MHD_HTTP_NOT_FOUND);
 			g_strfreev(basepath);
 			g_strfreev(path);
 			return ret;
@@ -1591,10 +1877,7 @@ int janus_http_admin_handler(void *cls, struct MHD_Connection *connection, const
 	}
 	if(session_path != NULL && handle_path != NULL && path[3] != NULL && strlen(path[3]) > 0) {
 		JANUS_LOG(LOG_ERR, "Too many components...\n");
-		response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
-		janus_http_add_cors_headers(msg, response);
-		ret = MHD_queue_response(connection, MHD_HTTP_NOT_FOUND, response);
-		MHD_destroy_response(response);
+		ret = janus_http_return_empty(msg, connection, MHD_HTTP_NOT_FOUND);
 		goto done;
 	}
 	/* Get payload, if any */
@@ -38,6 +38,7 @@
 #include "../config.h"
 #include "../mutex.h"
 #include "../utils.h"
+#include "../cbor.h"
 
 
 /* Transport plugin information */
@@ -127,7 +128,8 @@ typedef struct janus_pfunix_client {
 	int fd;							/* Client socket (in case SOCK_SEQPACKET is used) */
 	struct sockaddr_un addr;		/* Client address (in case SOCK_DGRAM is used) */
 	gboolean admin;					/* Whether this client is for the Admin or Janus API */
-	GAsyncQueue *messages;			/* Queue of outgoing messages to push */
+	GAsyncQueue *messages;			/* Queue of outgoing messages to push (GBytes, as they may be CBOR) */
+	gboolean cbor;					/* Whether the client sent its last request as CBOR, rather than JSON */
 	gboolean session_timeout;		/* Whether a Janus session timeout occurred in the core */
 	janus_transport_session *ts;	/* Janus core-transport session */
 } janus_pfunix_client;
@@ -140,9 +142,9 @@ static void janus_pfunix_client_free(void *client_ref) {
 	JANUS_LOG(LOG_WARN, "Freeing unix sockets client\n");
 	janus_pfunix_client *client = (janus_pfunix_client *) client_ref;
 	if(client->messages != NULL) {
-		char *response = NULL;
+		GBytes *response = NULL;
 		while((response = g_async_queue_try_pop(client->messages)) != NULL) {
-			g_free(response);
+			g_bytes_unref(response);
 		}
 		g_async_queue_unref(client->messages);
 	}
@@ -399,12 +401,23 @@ int janus_pfunix_send_message(janus_transport_session *transport, void *request_
 		return -1;
 	}
 	janus_mutex_unlock(&clients_mutex);
-	/* Convert to string */
-	char *payload = json_dumps(message, json_format);
+	/* Convert to string, or to CBOR if that's what the client used */
+	size_t len = 0;
+	char *payload = NULL;
+	if(client->cbor) {
+		payload = janus_cbor_dumps(message, 0, &len);
+	} else {
+		payload = json_dumps(message, json_format);
+		len = payload ? strlen(payload) : 0;
+	}
 	json_decref(message);
+	if(payload == NULL) {
+		JANUS_LOG(LOG_ERR, "Error serializing message for Unix Sockets client %p\n", client);
+		return -1;
+	}
 	if(client->fd != -1) {
 		/* SOCK_SEQPACKET, enqueue the packet and have poll tell us when it's time to send it */
-		g_async_queue_push(client->messages, payload);
+		g_async_queue_push(client->messages, g_bytes_new_take(payload, len));
 		/* Notify the thread there's data to send */
 		int res = 0;
 		do {
@@ -414,7 +427,7 @@ int janus_pfunix_send_message(janus_transport_session *transport, void *request_
 		/* SOCK_DGRAM, send it right away */
 		int res = 0;
 		do {
-			res = sendto(client->admin ? admin_pfd : pfd, payload, strlen(payload), 0, (struct sockaddr *)&client->addr, sizeof(struct sockaddr_un));
+			res = sendto(client->admin ? admin_pfd : pfd, payload, len, 0, (struct sockaddr *)&client->addr, sizeof(struct sockaddr_un));
 		} while(res == -1 && errno == EINTR);
 		free(payload);
 	}
@@ -578,17 +591,19 @@ void *janus_pfunix_thread(void *data) {
 				janus_mutex_lock(&clients_mutex);
 				janus_pfunix_client *client = g_hash_table_lookup(clients_by_fd, GINT_TO_POINTER(poll_fds[i].fd));
 				if(client != NULL) {
-					char *payload = NULL;
+					GBytes *payload = NULL;
 					while((payload = g_async_queue_try_pop(client->messages)) != NULL) {
+						gsize size = 0;
+						gconstpointer data = g_bytes_get_data(payload, &size);
 						int res = 0;
 						do {
 							if(client->fd < 0)
 								break;
-							res = write(client->fd, payload, strlen(payload));
+							res = write(client->fd, data, size);
 						} while(res == -1 && errno == EINTR);
 						/* FIXME Should we check if sent everything? */
-						JANUS_LOG(LOG_HUGE, "Written %d/%zu bytes on %d\n", res, strlen(payload), client->fd);
-						g_free(payload);
+						JANUS_LOG(LOG_HUGE, "Written %d/%zu bytes on %d\n", res, size, client->fd);
+						g_bytes_unref(payload);
 					}
 					if(client->session_timeout) {
 						/* We should actually get rid of this connection, now */
@@ -599,9 +614,9 @@ void *janus_pfunix_thread(void *data) {
 						g_hash_table_remove(clients_by_fd, GINT_TO_POINTER(poll_fds[i].fd));
 						g_hash_table_remove(clients, client);
 						if(client->messages != NULL) {
-							char *response = NULL;
+							GBytes *response = NULL;
 							while((response = g_async_queue_try_pop(client->messages)) != NULL) {
-								g_free(response);
+								g_bytes_unref(response);
 							}
 							g_async_queue_unref(client->messages);
 						}
@@ -631,6 +646,7 @@ void *janus_pfunix_thread(void *data) {
 							client->admin = (poll_fds[i].fd == admin_pfd);	/* API client type */
 							client->messages = g_async_queue_new();
 							client->session_timeout = FALSE;
+							client->cbor = FALSE;
 							/* Create a transport instance as well */
 							client->ts = janus_transport_session_create(client, janus_pfunix_client_free);
 							/* Take note of this new client */
@@ -678,6 +694,7 @@ void *janus_pfunix_thread(void *data) {
 							client->admin = (poll_fds[i].fd == admin_pfd);	/* API client type */
 							client->messages = g_async_queue_new();
 							client->session_timeout = FALSE;
+							client->cbor = FALSE;
 							/* Create a transport instance as well */
 							client->ts = janus_transport_session_create(client, janus_pfunix_client_free);
 							/* Take note of this new client */
@@ -695,10 +712,16 @@ void *janus_pfunix_thread(void *data) {
 						}
 						janus_mutex_unlock(&clients_mutex);
 						JANUS_LOG(LOG_VERB, "Message from client %s (%d bytes)\n", uaddr->sun_path, res);
-						JANUS_LOG(LOG_HUGE, "%s\n", buffer);
-						/* Parse the JSON payload */
+						/* Parse the CBOR or JSON payload: we'll answer using the same encoding */
 						json_error_t error;
-						json_t *root = json_loads(buffer, 0, &error);
+						json_t *root = NULL;
+						client->cbor = janus_cbor_is_cbor(buffer, res);
+						if(client->cbor) {
+							root = janus_cbor_loadb(buffer, res, &error);
+						} else {
+							JANUS_LOG(LOG_HUGE, "%s\n", buffer);
+							root = json_loadb(buffer, res, 0, &error);
+						}
 						/* Notify the core, passing both the object and, since it may be needed, the error */
 						gateway->incoming_request(&janus_pfunix_transport, client->ts, NULL, client->admin, root, &error);
 					}
@@ -754,10 +777,16 @@ void *janus_pfunix_thread(void *data) {
 					/* If we got here, there's data to handle */
 					buffer[res] = '\0';
 					JANUS_LOG(LOG_VERB, "Message from client %d (%d bytes)\n", poll_fds[i].fd, res);
-					JANUS_LOG(LOG_HUGE, "%s\n", buffer);
-					/* Parse the JSON payload */
+					/* Parse the CBOR or JSON payload: we'll answer using the same encoding */
 					json_error_t error;
-					json_t *root = json_loads(buffer, 0, &error);
+					json_t *root = NULL;
+					client->cbor = janus_cbor_is_cbor(buffer, res);
+					if(client->cbor) {
+						root = janus_cbor_loadb(buffer, res, &error);
+					} else {
+						JANUS_LOG(LOG_HUGE, "%s\n", buffer);
+						root = json_loadb(buffer, res, 0, &error);
+					}
 					/* Notify the core, passing both the object and, since it may be needed, the error */
 					gateway->incoming_request(&janus_pfunix_transport, client->ts, NULL, client->admin, root, &error);
 				}
@@ -0,0 +1,1234 @@
+/*! \file   janus_shm.c
+ * \author Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief  Janus shared memory transport plugin
+ * \details  This is an implementation of a shared memory transport for
+ * the Janus API, meant for applications running on the same machine as
+ * Janus. Rather than sending each message through the kernel as the Unix
+ * Sockets transport does, the application and Janus exchange messages
+ * on a pair of single-producer/single-consumer rings in a memory area
+ * they both map, and only use eventfd descriptors to wake each other up
+ * when the other side is actually waiting for something.
+ *
+ * Clients first connect to a \c SOCK_SEQPACKET Unix Socket: as soon as
+ * the connection is accepted, Janus creates the shared memory area and
+ * sends the client a \c janus_shm_handshake message, which also carries
+ * (as \c SCM_RIGHTS ancillary data) three file descriptors, in this order:
+ * the memory area (to \c mmap as \c MAP_SHARED), the eventfd to write to
+ * in order to wake Janus up, and the eventfd Janus writes to in order to
+ * wake the client up. The area starts with a \c janus_shm_area header,
+ * followed by the requests ring (client to Janus) and then by the
+ * responses ring (Janus to client), each made of a \c janus_shm_ring
+ * header followed by \c ring_size bytes of data. Messages are written
+ * in the rings as a 32-bit length followed by the JSON text, padded to
+ * 8 bytes: when a message doesn't fit before the end of the ring, the
+ * producer writes a \c JANUS_SHM_WRAP length and starts again from the
+ * beginning. The Unix Socket stays open for the whole lifetime of the
+ * client, and closing it is what tells Janus the client has gone away.
+ *
+ * Producers only write on the eventfd of the other side if it set the
+ * \c consumer_waiting flag of the ring (which it does right before
+ * sleeping), while consumers do the same with \c producer_waiting after
+ * making room on a full ring: that is, when both sides are busy, no
+ * system call is involved at all. Just as with the Unix Sockets
+ * transport, the same client can send requests and receive events, and
+ * requests need to include \c session_id and \c handle_id when needed.
+ * Since clients can write anywhere in the area, Janus never trusts what's
+ * in it: the ring size is the one it sent in the handshake, positions are
+ * masked to the ring, and a client that corrupts them gets its messages
+ * dropped (responses) or is disconnected (requests). The memory area is
+ * sealed before being sent, so that clients can't resize it either.
+ * \note When a client goes away, all the sessions it created are
+ * destroyed, exactly as it happens with Unix Sockets and WebSockets.
+ *
+ * \ingroup transports
+ * \ref transports
+ */
+
+#include "transport.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+
+#include "../debug.h"
+#include "../apierror.h"
+#include "../config.h"
+#include "../mutex.h"
+#include "../utils.h"
+
+
+/* Transport plugin information */
+#define JANUS_SHM_VERSION			1
+#define JANUS_SHM_VERSION_STRING	"0.0.1"
+#define JANUS_SHM_DESCRIPTION		"This transport plugin adds shared memory support to the Janus API."
+#define JANUS_SHM_NAME				"JANUS shared memory transport plugin"
+#define JANUS_SHM_AUTHOR			"Meetecho s.r.l."
+#define JANUS_SHM_PACKAGE			"janus.transport.shm"
+
+/* Transport methods */
+janus_transport *create(void);
+int janus_shm_init(janus_transport_callbacks *callback, const char *config_path);
+void janus_shm_destroy(void);
+int janus_shm_get_api_compatibility(void);
+int janus_shm_get_version(void);
+const char *janus_shm_get_version_string(void);
+const char *janus_shm_get_description(void);
+const char *janus_shm_get_name(void);
+const char *janus_shm_get_author(void);
+const char *janus_shm_get_package(void);
+gboolean janus_shm_is_janus_api_enabled(void);
+gboolean janus_shm_is_admin_api_enabled(void);
+int janus_shm_send_message(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message);
+void janus_shm_session_created(janus_transport_session *transport, guint64 session_id);
+void janus_shm_session_over(janus_transport_session *transport, guint64 session_id, gboolean timeout, gboolean claimed);
+void janus_shm_session_claimed(janus_transport_session *transport, guint64 session_id);
+json_t *janus_shm_query_transport(json_t *request);
+
+
+/* Transport setup */
+static janus_transport janus_shm_transport =
+	JANUS_TRANSPORT_INIT (
+		.init = janus_shm_init,
+		.destroy = janus_shm_destroy,
+
+		.get_api_compatibility = janus_shm_get_api_compatibility,
+		.get_version = janus_shm_get_version,
+		.get_version_string = janus_shm_get_version_string,
+		.get_description = janus_shm_get_description,
+		.get_name = janus_shm_get_name,
+		.get_author = janus_shm_get_author,
+		.get_package = janus_shm_get_package,
+
+		.is_janus_api_enabled = janus_shm_is_janus_api_enabled,
+		.is_admin_api_enabled = janus_shm_is_admin_api_enabled,
+
+		.send_message = janus_shm_send_message,
+		.session_created = janus_shm_session_created,
+		.session_over = janus_shm_session_over,
+		.session_claimed = janus_shm_session_claimed,
+
+		.query_transport = janus_shm_query_transport,
+	);
+
+/* Transport creator */
+janus_transport *create(void) {
+	JANUS_LOG(LOG_VERB, "%s created!\n", JANUS_SHM_NAME);
+	return &janus_shm_transport;
+}
+
+
+/* Useful stuff */
+static gint initialized = 0, stopping = 0;
+static janus_transport_callbacks *gateway = NULL;
+static gboolean notify_events = TRUE;
+
+/* JSON serialization options */
+static size_t json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
+
+struct sockaddr_un sizecheck;
+#ifndef UNIX_PATH_MAX
+#define UNIX_PATH_MAX sizeof(sizecheck.sun_path)
+#endif
+
+
+/* Shared memory layout: this is what clients need to implement too */
+#define JANUS_SHM_MAGIC			0x4a53484d	/* "JSHM" */
+#define JANUS_SHM_PROTOCOL		1
+#define JANUS_SHM_WRAP			0xFFFFFFFF
+#define JANUS_SHM_ALIGN(len)	(((len) + 7) & ~((uint64_t)7))
+#define JANUS_SHM_CACHE_LINE	64
+#define JANUS_SHM_DEFAULT_RING	(1024*1024)
+#define JANUS_SHM_MIN_RING		(64*1024)
+#define JANUS_SHM_MAX_RING		(256*1024*1024)
+
+/* Header of the area, followed by the requests and responses rings */
+typedef struct janus_shm_area {
+	uint32_t magic;			/* JANUS_SHM_MAGIC */
+	uint32_t protocol;		/* JANUS_SHM_PROTOCOL */
+	uint32_t ring_size;		/* Size of the data in each ring (power of two) */
+	uint32_t admin;			/* Whether this is an Admin API client */
+	char padding[JANUS_SHM_CACHE_LINE - 4*sizeof(uint32_t)];
+} janus_shm_area;
+
+/* Single-producer/single-consumer ring: head and tail are positions
+ * that only grow, and each side only ever writes its own (and the flag
+ * telling the other side it's waiting); they're on different cache
+ * lines, so that producer and consumer don't contend them */
+typedef struct janus_shm_ring {
+	volatile uint64_t head;					/* Written by the producer */
+	char padding1[JANUS_SHM_CACHE_LINE - sizeof(uint64_t)];
+	volatile uint64_t tail;					/* Written by the consumer */
+	char padding2[JANUS_SHM_CACHE_LINE - sizeof(uint64_t)];
+	volatile uint32_t consumer_waiting;		/* The consumer is sleeping, waiting for data */
+	volatile uint32_t producer_waiting;		/* The producer is sleeping, waiting for room */
+	char padding3[JANUS_SHM_CACHE_LINE - 2*sizeof(uint32_t)];
+	unsigned char data[];
+} janus_shm_ring;
+
+/* What we send clients on the Unix Socket when they connect */
+typedef struct janus_shm_handshake {
+	uint32_t magic;			/* JANUS_SHM_MAGIC */
+	uint32_t protocol;		/* JANUS_SHM_PROTOCOL */
+	uint32_t ring_size;		/* Size of the data in each ring */
+	uint32_t area_size;		/* Size of the whole area to mmap */
+} janus_shm_handshake;
+
+/* Clients map the area read/write, so nothing in it can be trusted: the
+ * size of the rings is always the one we chose, never the one in the header */
+static inline janus_shm_ring *janus_shm_area_ring(janus_shm_area *area, uint32_t ring_size, int index) {
+	return (janus_shm_ring *)((char *)area + sizeof(janus_shm_area) +
+		index * (sizeof(janus_shm_ring) + ring_size));
+}
+
+/* Offset in the ring a position refers to: positions come from shared
+ * memory, so we mask them and keep them aligned, whatever their value */
+static inline uint64_t janus_shm_ring_offset(uint64_t position, uint32_t size) {
+	return position & (size-1) & ~((uint64_t)7);
+}
+
+static inline size_t janus_shm_area_size(uint32_t ring_size) {
+	return sizeof(janus_shm_area) + 2 * (sizeof(janus_shm_ring) + ring_size);
+}
+
+/* Write a message on a ring (producer side): returns 0 if successful, -1
+ * if there's no room for it right now, -2 if it will never fit, and -3
+ * if the other side messed with the positions in the ring */
+static int janus_shm_ring_write(janus_shm_ring *ring, uint32_t size, const char *data, size_t len) {
+	uint64_t need = JANUS_SHM_ALIGN(sizeof(uint32_t) + len);
+	if(need > size/2)
+		return -2;
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if(tail > head || head - tail > size)
+		return -3;
+	uint64_t offset = janus_shm_ring_offset(head, size), contiguous = size - offset;
+	uint64_t total = need > contiguous ? contiguous + need : need;
+	if(size - (head - tail) < total)
+		return -1;
+	if(need > contiguous) {
+		/* Not enough room before the end of the ring, start again from the beginning */
+		*(uint32_t *)(ring->data + offset) = JANUS_SHM_WRAP;
+		head += contiguous;
+		offset = 0;
+	}
+	*(uint32_t *)(ring->data + offset) = (uint32_t)len;
+	memcpy(ring->data + offset + sizeof(uint32_t), data, len);
+	__atomic_store_n(&ring->head, head + need, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* Get the next message on a ring (consumer side) without consuming it:
+ * returns NULL if the ring is empty, or if the message is invalid (in
+ * which case len is set to JANUS_SHM_WRAP) */
+static const char *janus_shm_ring_peek(janus_shm_ring *ring, uint32_t size, uint32_t *len) {
+	*len = 0;
+	uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	if(tail == head)
+		return NULL;
+	if(tail > head || head - tail > size) {
+		/* The other side is messing with the positions */
+		*len = JANUS_SHM_WRAP;
+		return NULL;
+	}
+	uint64_t offset = janus_shm_ring_offset(tail, size);
+	uint32_t length = *(volatile uint32_t *)(ring->data + offset);
+	if(length == JANUS_SHM_WRAP) {
+		/* The message is at the beginning of the ring */
+		tail += size - offset;
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+		if(tail == head)
+			return NULL;
+		offset = 0;
+		length = *(volatile uint32_t *)ring->data;
+	}
+	if(head - tail > size || JANUS_SHM_ALIGN(sizeof(uint32_t) + (uint64_t)length) > MIN(head - tail, size - offset)) {
+		/* The other side is writing garbage */
+		*len = JANUS_SHM_WRAP;
+		return NULL;
+	}
+	*len = length;
+	return (const char *)(ring->data + offset + sizeof(uint32_t));
+}
+
+/* Consume the message we just peeked */
+static void janus_shm_ring_release(janus_shm_ring *ring, uint32_t len) {
+	__atomic_store_n(&ring->tail, ring->tail + JANUS_SHM_ALIGN(sizeof(uint32_t) + len), __ATOMIC_RELEASE);
+}
+
+static inline gboolean janus_shm_ring_is_empty(janus_shm_ring *ring) {
+	return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail;
+}
+
+/* Wake the other side up, but only if it told us it's waiting */
+static inline void janus_shm_notify(volatile uint32_t *waiting, int efd) {
+	if(__atomic_exchange_n(waiting, 0, __ATOMIC_SEQ_CST)) {
+		int res = 0;
+		do {
+			res = eventfd_write(efd, 1);
+		} while(res == -1 && errno == EINTR);
+	}
+}
+
+/* Create the memory area for a new client (or for the benchmark) */
+static janus_shm_area *janus_shm_area_create(uint32_t ring_size, int *fd) {
+	size_t size = janus_shm_area_size(ring_size);
+	int mfd = memfd_create("janus-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if(mfd < 0) {
+		JANUS_LOG(LOG_ERR, "Error creating shared memory area: %d (%s)\n", errno, g_strerror(errno));
+		return NULL;
+	}
+	if(ftruncate(mfd, size) < 0) {
+		JANUS_LOG(LOG_ERR, "Error resizing shared memory area: %d (%s)\n", errno, g_strerror(errno));
+		close(mfd);
+		return NULL;
+	}
+	/* Make sure the client can't resize the area (e.g., truncating it to have
+	 * us crash with a SIGBUS when accessing it): we seal the size before sending
+	 * the descriptor, and prevent any other seal from being added later */
+	if(fcntl(mfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+		JANUS_LOG(LOG_ERR, "Error sealing shared memory area: %d (%s)\n", errno, g_strerror(errno));
+		close(mfd);
+		return NULL;
+	}
+	janus_shm_area *area = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, mfd, 0);
+	if(area == MAP_FAILED) {
+		JANUS_LOG(LOG_ERR, "Error mapping shared memory area: %d (%s)\n", errno, g_strerror(errno));
+		close(mfd);
+		return NULL;
+	}
+	/* The memory of a new memfd is already zeroed, so the rings are empty */
+	area->magic = JANUS_SHM_MAGIC;
+	area->protocol = JANUS_SHM_PROTOCOL;
+	area->ring_size = ring_size;
+	*fd = mfd;
+	return area;
+}
+
+
+/* Shared memory servers */
+static GThread *shm_thread = NULL;
+static void *janus_shm_thread(void *data);
+static int pfd = -1, admin_pfd = -1;
+static uint32_t ring_size = JANUS_SHM_DEFAULT_RING;
+/* Used to wake the thread up, e.g., for new clients or when shutting down */
+static int wake_fd = -1;
+/* How many requests to process for each client before moving to the next one */
+#define JANUS_SHM_BURST		64
+
+/* Shared memory client */
+typedef struct janus_shm_client {
+	int fd;							/* Unix Socket the client connected to (we only watch it for hangups) */
+	int efd;						/* eventfd the client writes to, to wake us up */
+	int client_efd;					/* eventfd we write to, to wake the client up */
+	int mfd;						/* File descriptor of the shared memory area */
+	janus_shm_area *area;			/* Shared memory area */
+	size_t area_size;				/* Size of the shared memory area */
+	uint32_t ring_size;				/* Size of each ring (never read from the area, the client can write there) */
+	janus_shm_ring *requests;		/* Ring for requests (client to Janus) */
+	janus_shm_ring *responses;		/* Ring for responses and events (Janus to client) */
+	gboolean admin;					/* Whether this client is for the Admin or Janus API */
+	GQueue *pending;				/* Outgoing messages that didn't fit in the ring yet */
+	guint64 messages_in, messages_out, messages_delayed;	/* Stats */
+	gboolean gone;					/* Whether the service thread noticed the client went away */
+	volatile gint destroyed;		/* Whether this client has gone away */
+	janus_mutex mutex;				/* Mutex to serialize the writers of the responses ring */
+	janus_transport_session *ts;	/* Janus core-transport session */
+} janus_shm_client;
+static GHashTable *clients = NULL;
+static janus_mutex clients_mutex = JANUS_MUTEX_INITIALIZER;
+
+static void janus_shm_client_free(void *client_ref) {
+	if(!client_ref)
+		return;
+	JANUS_LOG(LOG_VERB, "Freeing shared memory client\n");
+	janus_shm_client *client = (janus_shm_client *)client_ref;
+	if(client->pending != NULL)
+		g_queue_free_full(client->pending, (GDestroyNotify)free);
+	if(client->area != NULL)
+		munmap(client->area, client->area_size);
+	if(client->mfd > -1)
+		close(client->mfd);
+	if(client->efd > -1)
+		close(client->efd);
+	if(client->client_efd > -1)
+		close(client->client_efd);
+	janus_mutex_destroy(&client->mutex);
+	g_free(client);
+}
+
+/* Helper to write to an eventfd (or a wake up fd) */
+static void janus_shm_wake(int efd) {
+	int res = 0;
+	do {
+		res = eventfd_write(efd, 1);
+	} while(res == -1 && errno == EINTR);
+}
+
+/* Helper to create a named Unix Socket for the handshakes */
+static int janus_shm_create_socket(char *pfname) {
+	if(pfname == NULL)
+		return -1;
+	if(strlen(pfname) > UNIX_PATH_MAX) {
+		JANUS_LOG(LOG_WARN, "The provided path name (%s) is longer than %lu characters, it will be truncated\n", pfname, UNIX_PATH_MAX);
+		pfname[UNIX_PATH_MAX] = '\0';
+	}
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(fd < 0) {
+		JANUS_LOG(LOG_FATAL, "Unix Sockets %s creation failed: %d, %s\n", pfname, errno, g_strerror(errno));
+		return -1;
+	}
+	unlink(pfname);
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	g_snprintf(address.sun_path, UNIX_PATH_MAX, "%s", pfname);
+	JANUS_LOG(LOG_VERB, "Binding Unix Socket %s...\n", pfname);
+	if(bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, 128) != 0) {
+		JANUS_LOG(LOG_FATAL, "Bind/listen for Unix Socket %s failed: %d, %s\n", pfname, errno, g_strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* A new client connected: create its memory area and tell it about it */
+static janus_shm_client *janus_shm_client_create(int cfd, gboolean admin) {
+	janus_shm_client *client = g_malloc0(sizeof(janus_shm_client));
+	client->fd = cfd;
+	client->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	client->client_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	client->mfd = -1;
+	client->admin = admin;
+	client->pending = g_queue_new();
+	janus_mutex_init(&client->mutex);
+	if(client->efd < 0 || client->client_efd < 0) {
+		JANUS_LOG(LOG_ERR, "Error creating eventfd for shared memory client: %d (%s)\n", errno, g_strerror(errno));
+		janus_shm_client_free(client);
+		return NULL;
+	}
+	client->area = janus_shm_area_create(ring_size, &client->mfd);
+	if(client->area == NULL) {
+		janus_shm_client_free(client);
+		return NULL;
+	}
+	client->area->admin = admin;
+	client->ring_size = ring_size;
+	client->area_size = janus_shm_area_size(client->ring_size);
+	client->requests = janus_shm_area_ring(client->area, client->ring_size, 0);
+	client->responses = janus_shm_area_ring(client->area, client->ring_size, 1);
+	/* Send the handshake, with the descriptors the client needs */
+	janus_shm_handshake handshake = {
+		.magic = JANUS_SHM_MAGIC,
+		.protocol = JANUS_SHM_PROTOCOL,
+		.ring_size = client->ring_size,
+		.area_size = client->area_size
+	};
+	int fds[3] = { client->mfd, client->efd, client->client_efd };
+	char control[CMSG_SPACE(sizeof(fds))];
+	memset(control, 0, sizeof(control));
+	struct iovec iov = { .iov_base = &handshake, .iov_len = sizeof(handshake) };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	int res = 0;
+	do {
+		res = sendmsg(cfd, &msg, MSG_NOSIGNAL);
+	} while(res == -1 && errno == EINTR);
+	if(res != sizeof(handshake)) {
+		JANUS_LOG(LOG_ERR, "Error sending handshake to shared memory client: %d (%s)\n", errno, g_strerror(errno));
+		janus_shm_client_free(client);
+		return NULL;
+	}
+	client->ts = janus_transport_session_create(client, janus_shm_client_free);
+	return client;
+}
+
+/* Try to write all the messages we couldn't send before (client mutex must be locked) */
+static void janus_shm_client_flush(janus_shm_client *client) {
+	char *payload = NULL;
+	while((payload = g_queue_peek_head(client->pending)) != NULL) {
+		int res = janus_shm_ring_write(client->responses, client->ring_size, payload, strlen(payload));
+		if(res == -1) {
+			/* Still no room: ask the client to wake us up once there's some */
+			__atomic_store_n(&client->responses->producer_waiting, 1, __ATOMIC_SEQ_CST);
+			res = janus_shm_ring_write(client->responses, client->ring_size, payload, strlen(payload));
+			if(res == -1)
+				break;
+			__atomic_store_n(&client->responses->producer_waiting, 0, __ATOMIC_RELAXED);
+		}
+		if(res < 0) {
+			/* The ring is broken, there's no point in keeping this */
+			JANUS_LOG(LOG_ERR, "Invalid ring for shared memory client %d, dropping message\n", client->fd);
+			g_queue_pop_head(client->pending);
+			free(payload);
+			continue;
+		}
+		g_queue_pop_head(client->pending);
+		free(payload);
+		client->messages_out++;
+	}
+	janus_shm_notify(&client->responses->consumer_waiting, client->client_efd);
+}
+
+/* Get rid of a client that went away (always called by the service thread):
+ * when shutting down, we don't notify the core, just as the other transports do */
+static void janus_shm_client_remove(janus_shm_client *client, gboolean notify) {
+	JANUS_LOG(LOG_INFO, "Shared memory client disconnected (%d)\n", client->fd);
+	janus_mutex_lock(&client->mutex);
+	g_atomic_int_set(&client->destroyed, 1);
+	janus_mutex_unlock(&client->mutex);
+	/* Notify core */
+	if(notify)
+		gateway->transport_gone(&janus_shm_transport, client->ts);
+	/* Notify handlers about this transport being gone */
+	if(notify && notify_events && gateway->events_is_enabled()) {
+		json_t *info = json_object();
+		json_object_set_new(info, "event", json_string("disconnected"));
+		gateway->notify_event(&janus_shm_transport, client->ts, info);
+	}
+	janus_mutex_lock(&clients_mutex);
+	g_hash_table_remove(clients, client);
+	janus_mutex_unlock(&clients_mutex);
+	shutdown(client->fd, SHUT_RDWR);
+	close(client->fd);
+	client->fd = -1;
+	/* Unref the transport instance: the memory area goes away with it */
+	janus_transport_session_destroy(client->ts);
+}
+
+/* Handle the requests a client put in its ring: returns -1 if the client is broken */
+static int janus_shm_client_read(janus_shm_client *client) {
+	uint32_t size = client->ring_size, len = 0;
+	int count = 0;
+	while(count < JANUS_SHM_BURST) {
+		const char *data = janus_shm_ring_peek(client->requests, size, &len);
+		if(data == NULL) {
+			if(len == JANUS_SHM_WRAP) {
+				JANUS_LOG(LOG_ERR, "Invalid message in the ring of shared memory client %d, closing it\n", client->fd);
+				return -1;
+			}
+			break;
+		}
+		JANUS_LOG(LOG_VERB, "Message from shared memory client %d (%"SCNu32" bytes)\n", client->fd, len);
+		/* Parse the JSON payload right from the ring, no need to copy it */
+		json_error_t error;
+		json_t *root = json_loadb(data, len, 0, &error);
+		janus_shm_ring_release(client->requests, len);
+		client->messages_in++;
+		count++;
+		/* Notify the core, passing both the object and, since it may be needed, the error */
+		gateway->incoming_request(&janus_shm_transport, client->ts, NULL, client->admin, root, &error);
+	}
+	/* If the client was waiting for some room in the ring, wake it up */
+	if(count > 0)
+		janus_shm_notify(&client->requests->producer_waiting, client->client_efd);
+	return count;
+}
+
+
+/* Benchmark of the shared memory rings, compared to other local transports */
+static void janus_shm_benchmark(int rounds);
+
+/* Transport implementation */
+int janus_shm_init(janus_transport_callbacks *callback, const char *config_path) {
+	if(g_atomic_int_get(&stopping)) {
+		/* Still stopping from before */
+		return -1;
+	}
+	if(callback == NULL || config_path == NULL) {
+		/* Invalid arguments */
+		return -1;
+	}
+
+	/* This is the callback we'll need to invoke to contact the gateway */
+	gateway = callback;
+
+	/* Read configuration */
+	char filename[255];
+	g_snprintf(filename, 255, "%s/%s.cfg", config_path, JANUS_SHM_PACKAGE);
+	JANUS_LOG(LOG_VERB, "Configuration file: %s\n", filename);
+	janus_config *config = janus_config_parse(filename);
+	if(config != NULL) {
+		/* Handle configuration */
+		janus_config_print(config);
+
+		janus_config_item *item = janus_config_get_item_drilldown(config, "general", "json");
+		if(item && item->value) {
+			/* Check how we need to format/serialize the JSON output */
+			if(!strcasecmp(item->value, "indented")) {
+				/* Default: indented, we use three spaces for that */
+				json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
+			} else if(!strcasecmp(item->value, "plain")) {
+				/* Not indented and no new lines, but still readable */
+				json_format = JSON_INDENT(0) | JSON_PRESERVE_ORDER;
+			} else if(!strcasecmp(item->value, "compact")) {
+				/* Compact, so no spaces between separators */
+				json_format = JSON_COMPACT | JSON_PRESERVE_ORDER;
+			} else {
+				JANUS_LOG(LOG_WARN, "Unsupported JSON format option '%s', using default (indented)\n", item->value);
+				json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
+			}
+		}
+
+		/* Check if we need to send events to handlers */
+		janus_config_item *events = janus_config_get_item_drilldown(config, "general", "events");
+		if(events != NULL && events->value != NULL)
+			notify_events = janus_is_true(events->value);
+		if(!notify_events && callback->events_is_enabled()) {
+			JANUS_LOG(LOG_WARN, "Notification of events to handlers disabled for %s\n", JANUS_SHM_NAME);
+		}
+
+		/* How large should the rings be? */
+		item = janus_config_get_item_drilldown(config, "general", "ring_size");
+		if(item && item->value) {
+			long long size = atoll(item->value);
+			if(size < JANUS_SHM_MIN_RING || size > JANUS_SHM_MAX_RING || (size & (size-1)) != 0) {
+				JANUS_LOG(LOG_WARN, "Invalid ring size %s (must be a power of two between %d and %d), using %d\n",
+					item->value, JANUS_SHM_MIN_RING, JANUS_SHM_MAX_RING, JANUS_SHM_DEFAULT_RING);
+			} else {
+				ring_size = size;
+			}
+		}
+
+		/* Should we compare the rings to other local transports first? */
+		item = janus_config_get_item_drilldown(config, "general", "benchmark");
+		if(item && item->value && atoi(item->value) > 0)
+			janus_shm_benchmark(atoi(item->value));
+
+		/* Setup the Janus API handshake socket */
+		item = janus_config_get_item_drilldown(config, "general", "enabled");
+		if(!item || !item->value || !janus_is_true(item->value)) {
+			JANUS_LOG(LOG_WARN, "Shared memory server disabled (Janus API)\n");
+		} else {
+			item = janus_config_get_item_drilldown(config, "general", "path");
+			if(item == NULL || item->value == NULL) {
+				JANUS_LOG(LOG_WARN, "No path configured, skipping shared memory server (Janus API)\n");
+			} else {
+				JANUS_LOG(LOG_INFO, "Configuring shared memory server (Janus API)\n");
+				pfd = janus_shm_create_socket((char *)item->value);
+			}
+		}
+		/* Do the same for the Admin API, if enabled */
+		item = janus_config_get_item_drilldown(config, "admin", "admin_enabled");
+		if(!item || !item->value || !janus_is_true(item->value)) {
+			JANUS_LOG(LOG_WARN, "Shared memory server disabled (Admin API)\n");
+		} else {
+			item = janus_config_get_item_drilldown(config, "admin", "admin_path");
+			if(item == NULL || item->value == NULL) {
+				JANUS_LOG(LOG_WARN, "No path configured, skipping shared memory server (Admin API)\n");
+			} else {
+				JANUS_LOG(LOG_INFO, "Configuring shared memory server (Admin API)\n");
+				admin_pfd = janus_shm_create_socket((char *)item->value);
+			}
+		}
+	}
+	janus_config_destroy(config);
+	config = NULL;
+	if(pfd < 0 && admin_pfd < 0) {
+		JANUS_LOG(LOG_WARN, "No shared memory server started, giving up...\n");
+		return -1;	/* No point in keeping the plugin loaded */
+	}
+	wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(wake_fd < 0) {
+		JANUS_LOG(LOG_FATAL, "Error creating eventfd for the service thread: %d, %s\n", errno, g_strerror(errno));
+		return -1;
+	}
+	JANUS_LOG(LOG_INFO, "Using %"SCNu32" bytes for each shared memory ring\n", ring_size);
+
+	clients = g_hash_table_new(NULL, NULL);
+
+	/* Start the service thread */
+	GError *error = NULL;
+	shm_thread = g_thread_try_new("shm thread", &janus_shm_thread, NULL, &error);
+	if(!shm_thread) {
+		g_atomic_int_set(&initialized, 0);
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the shared memory thread...\n", error->code, error->message ? error->message : "??");
+		return -1;
+	}
+
+	/* Done */
+	g_atomic_int_set(&initialized, 1);
+	JANUS_LOG(LOG_INFO, "%s initialized!\n", JANUS_SHM_NAME);
+	return 0;
+}
+
+void janus_shm_destroy(void) {
+	if(!g_atomic_int_get(&initialized))
+		return;
+	g_atomic_int_set(&stopping, 1);
+
+	/* Stop the service thread */
+	janus_shm_wake(wake_fd);
+	if(shm_thread != NULL) {
+		g_thread_join(shm_thread);
+		shm_thread = NULL;
+	}
+	close(wake_fd);
+	wake_fd = -1;
+
+	g_atomic_int_set(&initialized, 0);
+	g_atomic_int_set(&stopping, 0);
+	JANUS_LOG(LOG_INFO, "%s destroyed!\n", JANUS_SHM_NAME);
+}
+
+int janus_shm_get_api_compatibility(void) {
+	/* Important! This is what your plugin MUST always return: don't lie here or bad things will happen */
+	return JANUS_TRANSPORT_API_VERSION;
+}
+
+int janus_shm_get_version(void) {
+	return JANUS_SHM_VERSION;
+}
+
+const char *janus_shm_get_version_string(void) {
+	return JANUS_SHM_VERSION_STRING;
+}
+
+const char *janus_shm_get_description(void) {
+	return JANUS_SHM_DESCRIPTION;
+}
+
+const char *janus_shm_get_name(void) {
+	return JANUS_SHM_NAME;
+}
+
+const char *janus_shm_get_author(void) {
+	return JANUS_SHM_AUTHOR;
+}
+
+const char *janus_shm_get_package(void) {
+	return JANUS_SHM_PACKAGE;
+}
+
+gboolean janus_shm_is_janus_api_enabled(void) {
+	return pfd > -1;
+}
+
+gboolean janus_shm_is_admin_api_enabled(void) {
+	return admin_pfd > -1;
+}
+
+int janus_shm_send_message(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message) {
+	if(message == NULL)
+		return -1;
+	if(transport == NULL || transport->transport_p == NULL || g_atomic_int_get(&transport->destroyed)) {
+		json_decref(message);
+		return -1;
+	}
+	/* The client is only freed when the transport instance is, so it's safe to use it here */
+	janus_shm_client *client = (janus_shm_client *)transport->transport_p;
+	char *payload = json_dumps(message, json_format);
+	json_decref(message);
+	if(payload == NULL)
+		return -1;
+	size_t len = strlen(payload);
+	janus_mutex_lock(&client->mutex);
+	if(g_atomic_int_get(&client->destroyed)) {
+		janus_mutex_unlock(&client->mutex);
+		JANUS_LOG(LOG_WARN, "Outgoing message for invalid client %p\n", client);
+		free(payload);
+		return -1;
+	}
+	int res = -1;
+	if(g_queue_is_empty(client->pending))
+		res = janus_shm_ring_write(client->responses, client->ring_size, payload, len);
+	if(res == -2) {
+		janus_mutex_unlock(&client->mutex);
+		JANUS_LOG(LOG_ERR, "Message too large for the ring of shared memory client %d (%zu bytes), dropping it\n", client->fd, len);
+		free(payload);
+		return -1;
+	} else if(res == -3) {
+		janus_mutex_unlock(&client->mutex);
+		JANUS_LOG(LOG_ERR, "Invalid ring for shared memory client %d, dropping message\n", client->fd);
+		free(payload);
+		return -1;
+	} else if(res == 0) {
+		client->messages_out++;
+		free(payload);
+		janus_shm_notify(&client->responses->consumer_waiting, client->client_efd);
+	} else {
+		/* No room in the ring, keep it until the client reads something */
+		g_queue_push_tail(client->pending, payload);
+		client->messages_delayed++;
+		janus_shm_client_flush(client);
+	}
+	janus_mutex_unlock(&client->mutex);
+	return 0;
+}
+
+void janus_shm_session_created(janus_transport_session *transport, guint64 session_id) {
+	/* We don't care */
+}
+
+void janus_shm_session_over(janus_transport_session *transport, guint64 session_id, gboolean timeout, gboolean claimed) {
+	/* We don't care either: the client decides when to go away */
+}
+
+void janus_shm_session_claimed(janus_transport_session *transport, guint64 session_id) {
+	/* We don't care about this. We should start receiving messages from the core about this session: no action necessary */
+}
+
+json_t *janus_shm_query_transport(json_t *request) {
+	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
+		return NULL;
+	/* Return some info on all the clients */
+	json_t *response = json_object();
+	json_object_set_new(response, "ring_size", json_integer(ring_size));
+	json_t *list = json_array();
+	janus_mutex_lock(&clients_mutex);
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, clients);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_shm_client *client = value;
+		json_t *info = json_object();
+		janus_mutex_lock(&client->mutex);
+		json_object_set_new(info, "fd", json_integer(client->fd));
+		json_object_set_new(info, "admin_api", client->admin ? json_true() : json_false());
+		json_object_set_new(info, "messages_in", json_integer(client->messages_in));
+		json_object_set_new(info, "messages_out", json_integer(client->messages_out));
+		json_object_set_new(info, "messages_delayed", json_integer(client->messages_delayed));
+		json_object_set_new(info, "pending", json_integer(g_queue_get_length(client->pending)));
+		janus_mutex_unlock(&client->mutex);
+		json_array_append_new(list, info);
+	}
+	janus_mutex_unlock(&clients_mutex);
+	json_object_set_new(response, "clients", list);
+	return response;
+}
+
+
+/* Thread */
+static void *janus_shm_thread(void *data) {
+	JANUS_LOG(LOG_INFO, "Shared memory thread started\n");
+
+	guint size = 16;
+	struct pollfd *poll_fds = g_malloc(size * sizeof(struct pollfd));
+	janus_shm_client **poll_clients = g_malloc(size * sizeof(janus_shm_client *));
+	GList *list = NULL, *temp = NULL;
+
+	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
+		/* Get a snapshot of the clients: we're the only ones removing them, so that's safe */
+		janus_mutex_lock(&clients_mutex);
+		list = g_hash_table_get_values(clients);
+		janus_mutex_unlock(&clients_mutex);
+		guint needed = 3 + 2*g_list_length(list);
+		if(needed > size) {
+			size = needed;
+			poll_fds = g_realloc(poll_fds, size * sizeof(struct pollfd));
+			poll_clients = g_realloc(poll_clients, size * sizeof(janus_shm_client *));
+		}
+		/* Prepare the list of file descriptors, and tell clients we're going to sleep */
+		guint fds = 0;
+		int timeout = -1;
+		poll_fds[fds].fd = wake_fd;
+		poll_fds[fds].events = POLLIN;
+		poll_clients[fds] = NULL;
+		fds++;
+		if(pfd > -1) {
+			poll_fds[fds].fd = pfd;
+			poll_fds[fds].events = POLLIN;
+			poll_clients[fds] = NULL;
+			fds++;
+		}
+		if(admin_pfd > -1) {
+			poll_fds[fds].fd = admin_pfd;
+			poll_fds[fds].events = POLLIN;
+			poll_clients[fds] = NULL;
+			fds++;
+		}
+		for(temp = list; temp != NULL; temp = temp->next) {
+			janus_shm_client *client = (janus_shm_client *)temp->data;
+			poll_fds[fds].fd = client->fd;
+			poll_fds[fds].events = POLLIN;
+			poll_clients[fds] = client;
+			fds++;
+			poll_fds[fds].fd = client->efd;
+			poll_fds[fds].events = POLLIN;
+			poll_clients[fds] = client;
+			fds++;
+			__atomic_store_n(&client->requests->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+			if(!janus_shm_ring_is_empty(client->requests)) {
+				/* Something came in in the meanwhile, don't sleep */
+				__atomic_store_n(&client->requests->consumer_waiting, 0, __ATOMIC_RELAXED);
+				timeout = 0;
+			}
+		}
+
+		int res = poll(poll_fds, fds, timeout);
+		if(res < 0) {
+			if(errno == EINTR) {
+				g_list_free(list);
+				continue;
+			}
+			JANUS_LOG(LOG_ERR, "poll() failed: %d (%s)\n", errno, g_strerror(errno));
+			g_list_free(list);
+			break;
+		}
+		guint i = 0;
+		for(i=0; i<fds; i++) {
+			if(poll_fds[i].revents == 0)
+				continue;
+			janus_shm_client *client = poll_clients[i];
+			if(client == NULL) {
+				if(poll_fds[i].fd == wake_fd) {
+					eventfd_t value = 0;
+					(void)eventfd_read(wake_fd, &value);
+					continue;
+				}
+				/* New client on the Janus or Admin API socket */
+				if(poll_fds[i].revents & (POLLERR | POLLHUP)) {
+					JANUS_LOG(LOG_WARN, "Error polling shared memory %s API socket, disabling it\n",
+						poll_fds[i].fd == pfd ? "Janus" : "Admin");
+					close(poll_fds[i].fd);
+					if(poll_fds[i].fd == pfd)
+						pfd = -1;
+					else
+						admin_pfd = -1;
+					continue;
+				}
+				gboolean admin = (poll_fds[i].fd == admin_pfd);
+				int cfd = accept4(poll_fds[i].fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+				if(cfd < 0)
+					continue;
+				client = janus_shm_client_create(cfd, admin);
+				if(client == NULL) {
+					close(cfd);
+					continue;
+				}
+				JANUS_LOG(LOG_INFO, "Got new shared memory %s API client: %d\n", admin ? "Admin" : "Janus", cfd);
+				janus_mutex_lock(&clients_mutex);
+				g_hash_table_insert(clients, client, client);
+				janus_mutex_unlock(&clients_mutex);
+				/* Notify handlers about this new transport */
+				if(notify_events && gateway->events_is_enabled()) {
+					json_t *info = json_object();
+					json_object_set_new(info, "event", json_string("connected"));
+					json_object_set_new(info, "admin_api", client->admin ? json_true() : json_false());
+					json_object_set_new(info, "fd", json_integer(client->fd));
+					gateway->notify_event(&janus_shm_transport, client->ts, info);
+				}
+				continue;
+			}
+			if(poll_fds[i].fd == client->fd) {
+				/* The client should never write on the socket: any event means it's gone */
+				char buffer[64];
+				if(!(poll_fds[i].revents & (POLLERR | POLLHUP)) && recv(client->fd, buffer, sizeof(buffer), 0) != 0)
+					continue;
+				client->gone = TRUE;	/* We'll clean up below */
+			} else if(poll_fds[i].fd == client->efd) {
+				eventfd_t value = 0;
+				(void)eventfd_read(client->efd, &value);
+			}
+		}
+		/* Now serve all clients: read their requests, and see if we can send what's pending */
+		for(temp = list; temp != NULL; temp = temp->next) {
+			janus_shm_client *client = (janus_shm_client *)temp->data;
+			if(!g_atomic_int_get(&stopping) && !client->gone && janus_shm_client_read(client) >= 0) {
+				janus_mutex_lock(&client->mutex);
+				if(!g_queue_is_empty(client->pending))
+					janus_shm_client_flush(client);
+				janus_mutex_unlock(&client->mutex);
+				continue;
+			}
+			if(!g_atomic_int_get(&stopping))
+				janus_shm_client_remove(client, TRUE);
+		}
+		g_list_free(list);
+		list = NULL;
+	}
+
+	/* Get rid of all the clients that are still there */
+	janus_mutex_lock(&clients_mutex);
+	list = g_hash_table_get_values(clients);
+	janus_mutex_unlock(&clients_mutex);
+	for(temp = list; temp != NULL; temp = temp->next)
+		janus_shm_client_remove((janus_shm_client *)temp->data, FALSE);
+	g_list_free(list);
+	g_free(poll_fds);
+	g_free(poll_clients);
+
+	socklen_t addrlen = sizeof(struct sockaddr_un);
+	struct sockaddr_un addr;
+	int *sockets[2] = { &pfd, &admin_pfd };
+	int i = 0;
+	for(i=0; i<2; i++) {
+		if(*sockets[i] < 0)
+			continue;
+		/* Unlink the path name first */
+		addrlen = sizeof(addr);
+		if(getsockname(*sockets[i], (struct sockaddr *)&addr, &addrlen) != -1) {
+			JANUS_LOG(LOG_INFO, "Unlinking %s\n", addr.sun_path);
+			unlink(addr.sun_path);
+		}
+		close(*sockets[i]);
+		*sockets[i] = -1;
+	}
+
+	g_hash_table_destroy(clients);
+	clients = NULL;
+
+	/* Done */
+	JANUS_LOG(LOG_INFO, "Shared memory thread ended\n");
+	return NULL;
+}
+
+
+/* Benchmark: each channel is one side of a bidirectional link, either
+ * a pair of rings (this transport), a SOCK_SEQPACKET Unix Socket (what
+ * the Unix Sockets transport uses) or a TCP connection on the loopback
+ * interface (the same kernel path the WebSockets transport uses, minus
+ * the WebSockets framing itself, so a lower bound for it) */
+typedef enum janus_shm_bench_type {
+	janus_shm_bench_shm = 0,
+	janus_shm_bench_pfunix,
+	janus_shm_bench_tcp
+} janus_shm_bench_type;
+static const char *janus_shm_bench_names[] = { "shared memory", "Unix Sockets", "TCP loopback" };
+
+typedef struct janus_shm_bench_channel {
+	janus_shm_bench_type type;
+	int fd;							/* Socket (Unix Sockets and TCP) */
+	janus_shm_ring *in, *out;		/* Rings we consume and produce (shared memory) */
+	uint32_t ring_size;
+	int efd, peer_efd;				/* eventfd we wait on, and the one the peer waits on */
+	size_t len;						/* Size of the messages to exchange */
+	int rounds;						/* How many messages the echo side should bounce back */
+	char *buffer;
+} janus_shm_bench_channel;
+
+static void janus_shm_bench_wait(int efd) {
+	struct pollfd pfd = { .fd = efd, .events = POLLIN, .revents = 0 };
+	if(poll(&pfd, 1, 1000) > 0) {
+		eventfd_t value = 0;
+		(void)eventfd_read(efd, &value);
+	}
+}
+
+static int janus_shm_bench_full(int fd, char *buffer, size_t len, gboolean out) {
+	size_t done = 0;
+	while(done < len) {
+		ssize_t res = out ? send(fd, buffer + done, len - done, MSG_NOSIGNAL) : recv(fd, buffer + done, len - done, 0);
+		if(res < 0 && errno == EINTR)
+			continue;
+		if(res <= 0)
+			return -1;
+		done += res;
+	}
+	return 0;
+}
+
+static int janus_shm_bench_send(janus_shm_bench_channel *ch) {
+	if(ch->type == janus_shm_bench_pfunix)
+		return send(ch->fd, ch->buffer, ch->len, MSG_NOSIGNAL) == (ssize_t)ch->len ? 0 : -1;
+	if(ch->type == janus_shm_bench_tcp) {
+		/* TCP is a stream, so we prefix messages with their length (like WebSockets framing) */
+		uint32_t len = htonl(ch->len);
+		memcpy(ch->buffer, &len, sizeof(len));
+		return janus_shm_bench_full(ch->fd, ch->buffer, sizeof(len) + ch->len, TRUE);
+	}
+	while(janus_shm_ring_write(ch->out, ch->ring_size, ch->buffer, ch->len) < 0) {
+		__atomic_store_n(&ch->out->producer_waiting, 1, __ATOMIC_SEQ_CST);
+		if(janus_shm_ring_write(ch->out, ch->ring_size, ch->buffer, ch->len) == 0) {
+			__atomic_store_n(&ch->out->producer_waiting, 0, __ATOMIC_RELAXED);
+			break;
+		}
+		janus_shm_bench_wait(ch->efd);
+	}
+	janus_shm_notify(&ch->out->consumer_waiting, ch->peer_efd);
+	return 0;
+}
+
+static int janus_shm_bench_recv(janus_shm_bench_channel *ch) {
+	if(ch->type == janus_shm_bench_pfunix)
+		return recv(ch->fd, ch->buffer, ch->len, 0) == (ssize_t)ch->len ? 0 : -1;
+	if(ch->type == janus_shm_bench_tcp) {
+		uint32_t len = 0;
+		if(janus_shm_bench_full(ch->fd, ch->buffer, sizeof(len), FALSE) < 0)
+			return -1;
+		memcpy(&len, ch->buffer, sizeof(len));
+		len = ntohl(len);
+		if(len > ch->len)
+			return -1;
+		return janus_shm_bench_full(ch->fd, ch->buffer + sizeof(len), len, FALSE);
+	}
+	uint32_t len = 0;
+	const char *data = NULL;
+	while((data = janus_shm_ring_peek(ch->in, ch->ring_size, &len)) == NULL) {
+		if(len == JANUS_SHM_WRAP)
+			return -1;
+		__atomic_store_n(&ch->in->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+		if(!janus_shm_ring_is_empty(ch->in)) {
+			__atomic_store_n(&ch->in->consumer_waiting, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+		janus_shm_bench_wait(ch->efd);
+	}
+	/* Copy it, as a client would do when parsing the JSON */
+	memcpy(ch->buffer, data, MIN(len, ch->len));
+	janus_shm_ring_release(ch->in, len);
+	janus_shm_notify(&ch->in->producer_waiting, ch->peer_efd);
+	return 0;
+}
+
+static void *janus_shm_bench_echo(void *data) {
+	janus_shm_bench_channel *ch = (janus_shm_bench_channel *)data;
+	int i = 0;
+	for(i=0; i<ch->rounds; i++) {
+		if(janus_shm_bench_recv(ch) < 0 || janus_shm_bench_send(ch) < 0)
+			break;
+	}
+	return NULL;
+}
+
+/* Create the two sides of a link */
+static int janus_shm_bench_link(janus_shm_bench_type type, janus_shm_bench_channel *a, janus_shm_bench_channel *b,
+		janus_shm_area **area, int *mfd) {
+	memset(a, 0, sizeof(*a));
+	memset(b, 0, sizeof(*b));
+	a->type = b->type = type;
+	a->fd = b->fd = a->efd = b->efd = -1;
+	if(type == janus_shm_bench_pfunix) {
+		int fds[2];
+		if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) < 0)
+			return -1;
+		a->fd = fds[0];
+		b->fd = fds[1];
+		return 0;
+	}
+	if(type == janus_shm_bench_tcp) {
+		int lfd = socket(AF_INET, SOCK_STREAM, 0);
+		if(lfd < 0)
+			return -1;
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t addrlen = sizeof(addr);
+		if(bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 1) < 0 ||
+				getsockname(lfd, (struct sockaddr *)&addr, &addrlen) < 0) {
+			close(lfd);
+			return -1;
+		}
+		a->fd = socket(AF_INET, SOCK_STREAM, 0);
+		if(a->fd < 0 || connect(a->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+				(b->fd = accept(lfd, NULL, NULL)) < 0) {
+			if(a->fd > -1)
+				close(a->fd);
+			close(lfd);
+			return -1;
+		}
+		close(lfd);
+		int one = 1;
+		setsockopt(a->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		setsockopt(b->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		return 0;
+	}
+	*area = janus_shm_area_create(ring_size, mfd);
+	if(*area == NULL)
+		return -1;
+	a->ring_size = b->ring_size = ring_size;
+	a->out = b->in = janus_shm_area_ring(*area, ring_size, 0);
+	a->in = b->out = janus_shm_area_ring(*area, ring_size, 1);
+	a->efd = b->peer_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	b->efd = a->peer_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	return 0;
+}
+
+static void janus_shm_bench_unlink(janus_shm_bench_channel *a, janus_shm_bench_channel *b, janus_shm_area *area, int mfd) {
+	janus_shm_bench_channel *chs[2] = { a, b };
+	int i = 0;
+	for(i=0; i<2; i++) {
+		if(chs[i]->fd > -1)
+			close(chs[i]->fd);
+		if(chs[i]->efd > -1)
+			close(chs[i]->efd);
+		g_free(chs[i]->buffer);
+	}
+	if(area != NULL)
+		munmap(area, janus_shm_area_size(a->ring_size));
+	if(mfd > -1)
+		close(mfd);
+}
+
+static void janus_shm_benchmark(int rounds) {
+	/* Typical sizes: an ack, an event, and an event with an SDP */
+	size_t sizes[] = { 100, 1000, 4000 };
+	/* How many requests we keep in flight when measuring the throughput */
+	int window = 16;
+	JANUS_LOG(LOG_INFO, "Benchmarking local transports (%d rounds)...\n", rounds);
+	int type = 0, s = 0, i = 0;
+	for(s=0; s<3; s++) {
+		for(type=janus_shm_bench_shm; type<=janus_shm_bench_tcp; type++) {
+			janus_shm_bench_channel a, b;
+			janus_shm_area *area = NULL;
+			int mfd = -1;
+			if(janus_shm_bench_link(type, &a, &b, &area, &mfd) < 0) {
+				JANUS_LOG(LOG_WARN, "  -- Couldn't setup %s link, skipping it\n", janus_shm_bench_names[type]);
+				janus_shm_bench_unlink(&a, &b, area, mfd);
+				continue;
+			}
+			a.len = b.len = sizes[s];
+			a.buffer = g_malloc(sizes[s] + sizeof(uint32_t));
+			b.buffer = g_malloc(sizes[s] + sizeof(uint32_t));
+			memset(a.buffer, 'x', sizes[s] + sizeof(uint32_t));
+			/* The echo side bounces back both the ping-pong and the pipelined messages */
+			b.rounds = 2*rounds;
+			GError *error = NULL;
+			GThread *echo = g_thread_try_new("shm bench", &janus_shm_bench_echo, &b, &error);
+			if(echo == NULL) {
+				JANUS_LOG(LOG_WARN, "  -- Couldn't start %s echo thread, skipping it\n", janus_shm_bench_names[type]);
+				g_clear_error(&error);
+				janus_shm_bench_unlink(&a, &b, area, mfd);
+				continue;
+			}
+			/* Latency: one request at a time */
+			gboolean failed = FALSE;
+			gint64 start = janus_get_monotonic_time();
+			for(i=0; i<rounds && !failed; i++)
+				failed = (janus_shm_bench_send(&a) < 0 || janus_shm_bench_recv(&a) < 0);
+			gint64 latency = janus_get_monotonic_time() - start;
+			/* Throughput: keep a few requests in flight */
+			int sent = 0, received = 0;
+			start = janus_get_monotonic_time();
+			while(received < rounds && !failed) {
+				while(sent < rounds && sent - received < window && !failed) {
+					failed = janus_shm_bench_send(&a) < 0;
+					sent++;
+				}
+				if(!failed)
+					failed = janus_shm_bench_recv(&a) < 0;
+				received++;
+			}
+			gint64 throughput = janus_get_monotonic_time() - start;
+			if(failed) {
+				/* Unblock the echo side, if needed */
+				if(a.fd > -1)
+					shutdown(a.fd, SHUT_RDWR);
+				JANUS_LOG(LOG_WARN, "  -- %zu bytes, %s: error exchanging messages\n", sizes[s], janus_shm_bench_names[type]);
+			} else {
+				JANUS_LOG(LOG_INFO, "  -- %zu bytes, %s: %.2f us round trip, %.0f requests/s\n",
+					sizes[s], janus_shm_bench_names[type], (double)latency/rounds,
+					throughput > 0 ? (double)rounds*G_USEC_PER_SEC/throughput : 0.0);
+			}
+			g_thread_join(echo);
+			janus_shm_bench_unlink(&a, &b, area, mfd);
+		}
+	}
+}
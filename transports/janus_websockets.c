@@ -33,12 +33,16 @@
 #include <ifaddrs.h>
 
 #include <libwebsockets.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #include "../debug.h"
 #include "../apierror.h"
 #include "../config.h"
 #include "../mutex.h"
 #include "../utils.h"
+#include "../cbor.h"
 
 
 /* Transport plugin information */
@@ -66,6 +70,7 @@ int janus_websockets_send_message(janus_transport_session *transport, void *requ
 void janus_websockets_session_created(janus_transport_session *transport, guint64 session_id);
 void janus_websockets_session_over(janus_transport_session *transport, guint64 session_id, gboolean timeout, gboolean claimed);
 void janus_websockets_session_claimed(janus_transport_session *transport, guint64 session_id);
+json_t *janus_websockets_query_transport(json_t *request);
 
 
 /* Transport setup */
@@ -89,6 +94,7 @@ static janus_transport janus_websockets_transport =
 		.session_created = janus_websockets_session_created,
 		.session_over = janus_websockets_session_over,
 		.session_claimed = janus_websockets_session_claimed,
+		.query_transport = janus_websockets_query_transport,
 	);
 
 /* Transport creator */
@@ -108,12 +114,89 @@ static gboolean notify_events = TRUE;
 /* JSON serialization options */
 static size_t json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
 
+/* Whether bursts of messages can be batched in a single JSON array frame */
+#define JANUS_WEBSOCKETS_BATCH_MAX_SIZE	65536
+static gboolean ws_batching = FALSE;
+static size_t ws_batch_max_size = JANUS_WEBSOCKETS_BATCH_MAX_SIZE;
+
+/* Compression: clients can either negotiate permessage-deflate, in which
+ * case libwebsockets compresses all their frames, or use the deflate
+ * subprotocols, in which case we send frames larger than a threshold as
+ * binary frames containing the zlib compressed JSON payload */
+#ifndef LWS_WITHOUT_EXTENSIONS
+static const struct lws_extension ws_extensions[] = {
+	{ "permessage-deflate", lws_extension_callback_pm_deflate, "permessage-deflate; client_no_context_takeover; client_max_window_bits" },
+	{ NULL, NULL, NULL }
+};
+#endif
+static const struct lws_extension *ws_exts = NULL;
+#ifdef HAVE_ZLIB
+static int ws_deflate_threshold = 0;
+static int ws_deflate_level = Z_DEFAULT_COMPRESSION;
+/* Compression contexts are per service thread, as clients are always served by the same */
+typedef struct janus_websockets_deflater {
+	z_stream stream;
+	gboolean ready;
+	unsigned char *buffer;
+	size_t buflen;
+} janus_websockets_deflater;
+static janus_websockets_deflater *ws_deflaters = NULL;
+static void janus_websockets_deflater_free(janus_websockets_deflater *deflater) {
+	if(deflater->ready)
+		deflateEnd(&deflater->stream);
+	deflater->ready = FALSE;
+	g_free(deflater->buffer);
+	deflater->buffer = NULL;
+	deflater->buflen = 0;
+}
+/* Helper to compress a payload: returns the size of the compressed payload
+ * (in deflater->buffer), or 0 if it failed or wasn't worth it */
+static size_t janus_websockets_deflate(janus_websockets_deflater *deflater, const unsigned char *data, size_t len) {
+	if(!deflater->ready) {
+		memset(&deflater->stream, 0, sizeof(z_stream));
+		if(deflateInit(&deflater->stream, ws_deflate_level) != Z_OK)
+			return 0;
+		deflater->ready = TRUE;
+	} else {
+		deflateReset(&deflater->stream);
+	}
+	size_t bound = deflateBound(&deflater->stream, len);
+	if(bound > deflater->buflen) {
+		deflater->buffer = g_realloc(deflater->buffer, bound);
+		deflater->buflen = bound;
+	}
+	deflater->stream.next_in = (Bytef *)data;
+	deflater->stream.avail_in = len;
+	deflater->stream.next_out = deflater->buffer;
+	deflater->stream.avail_out = bound;
+	if(deflate(&deflater->stream, Z_FINISH) != Z_STREAM_END)
+		return 0;
+	size_t size = bound - deflater->stream.avail_out;
+	return size < len ? size : 0;
+}
+/* Startup benchmark: how much CPU compressing typical messages costs, and how many bytes it saves */
+static void janus_websockets_deflate_benchmark(int rounds);
+#endif
+
 
 /* Logging */
 static int ws_log_level = 0;
 
-/* WebSockets service thread */
-static GThread *ws_thread = NULL;
+/* WebSockets service threads: libwebsockets distributes new clients
+ * across them, and each client is then always served by the same thread */
+#define JANUS_WEBSOCKETS_MAX_THREADS	32
+typedef struct janus_websockets_thread_stats {
+	volatile gint clients;					/* Clients currently served by this thread */
+	volatile gint64 messages_in;			/* Messages received by clients of this thread */
+	volatile gint64 messages_out;			/* Messages sent to clients of this thread */
+	volatile gint64 deflated;				/* Frames we compressed ourselves for clients of this thread */
+	volatile gint64 deflate_saved;			/* Bytes we saved by compressing those frames */
+} janus_websockets_thread_stats;
+static GThread **ws_threads = NULL;
+static int ws_threads_count = 1;
+static janus_websockets_thread_stats *ws_threads_stats = NULL;
+/* Index (plus one) of the service thread we're in */
+static GPrivate ws_thread_index;
 void *janus_websockets_thread(void *data);
 
 
@@ -121,17 +204,49 @@ void *janus_websockets_thread(void *data);
 typedef struct janus_websockets_client {
 	struct lws *wsi;						/* The libwebsockets client instance */
 	GAsyncQueue *messages;					/* Queue of outgoing messages to push */
+	char *held;								/* Message we popped but couldn't fit in the previous batch */
 	char *incoming;							/* Buffer containing the incoming message to process (in case there are fragments) */
+	size_t incoming_len;					/* Size of the incoming message so far */
 	unsigned char *buffer;					/* Buffer containing the message to send */
 	int buflen;								/* Length of the buffer (may be resized after re-allocations) */
 	int bufpending;							/* Data an interrupted previous write couldn't send */
 	int bufoffset;							/* Offset from where the interrupted previous write should resume */
+	gboolean bufbinary;						/* Whether the interrupted previous write was a binary frame */
+	gboolean deflate;						/* Whether this client uses a deflate subprotocol */
+	gboolean cbor;							/* Whether this client uses a CBOR subprotocol */
 	volatile gint session_timeout;			/* Whether a Janus session timeout occurred in the core */
 	volatile gint destroyed;				/* Whether this libwebsockets client instance has been closed */
+	int thread;								/* Index of the service thread serving this client */
 	janus_transport_session *ts;			/* Janus core-transport session */
 } janus_websockets_client;
 
 
+/* Helper to get the next message to send, starting from the one we held back, if any */
+static char *janus_websockets_client_pop(janus_websockets_client *ws_client) {
+	char *message = ws_client->held;
+	if(message != NULL) {
+		ws_client->held = NULL;
+		return message;
+	}
+	return g_async_queue_try_pop(ws_client->messages);
+}
+
+/* Helper to make sure the shared buffer can fit a payload of the specified size:
+ * the buffer grows geometrically and is never shrunk, so that after the first few
+ * messages we can keep on reusing it instead of reallocating it */
+static void janus_websockets_client_reserve(janus_websockets_client *ws_client, struct lws *wsi, size_t size) {
+	int buflen = LWS_SEND_BUFFER_PRE_PADDING + size + LWS_SEND_BUFFER_POST_PADDING;
+	if(buflen <= ws_client->buflen)
+		return;
+	int newlen = ws_client->buflen > 0 ? ws_client->buflen : 4096;
+	while(newlen < buflen)
+		newlen *= 2;
+	JANUS_LOG(LOG_HUGE, "[%p] Re-allocating to %d bytes (was %d, payload is %zu bytes)\n", wsi, newlen, ws_client->buflen, size);
+	ws_client->buffer = g_realloc(ws_client->buffer, newlen);
+	ws_client->buflen = newlen;
+}
+
+
 /* libwebsockets WS context */
 static struct lws_context *wsc = NULL;
 /* Callbacks for HTTP-related events (automatically rejected) */
@@ -164,21 +279,29 @@ static int janus_websockets_admin_callback_secure(
 static struct lws_protocols ws_protocols[] = {
 	{ "http-only", janus_websockets_callback_http, 0, 0 },
 	{ "janus-protocol", janus_websockets_callback, sizeof(janus_websockets_client), 0 },
+	{ "janus-protocol-deflate", janus_websockets_callback, sizeof(janus_websockets_client), 0 },
+	{ "janus-protocol-cbor", janus_websockets_callback, sizeof(janus_websockets_client), 0 },
 	{ NULL, NULL, 0 }
 };
 static struct lws_protocols sws_protocols[] = {
 	{ "http-only", janus_websockets_callback_https, 0, 0 },
 	{ "janus-protocol", janus_websockets_callback_secure, sizeof(janus_websockets_client), 0 },
+	{ "janus-protocol-deflate", janus_websockets_callback_secure, sizeof(janus_websockets_client), 0 },
+	{ "janus-protocol-cbor", janus_websockets_callback_secure, sizeof(janus_websockets_client), 0 },
 	{ NULL, NULL, 0 }
 };
 static struct lws_protocols admin_ws_protocols[] = {
 	{ "http-only", janus_websockets_callback_http, 0, 0 },
 	{ "janus-admin-protocol", janus_websockets_admin_callback, sizeof(janus_websockets_client), 0 },
+	{ "janus-admin-protocol-deflate", janus_websockets_admin_callback, sizeof(janus_websockets_client), 0 },
+	{ "janus-admin-protocol-cbor", janus_websockets_admin_callback, sizeof(janus_websockets_client), 0 },
 	{ NULL, NULL, 0 }
 };
 static struct lws_protocols admin_sws_protocols[] = {
 	{ "http-only", janus_websockets_callback_https, 0, 0 },
 	{ "janus-admin-protocol", janus_websockets_admin_callback_secure, sizeof(janus_websockets_client), 0 },
+	{ "janus-admin-protocol-deflate", janus_websockets_admin_callback_secure, sizeof(janus_websockets_client), 0 },
+	{ "janus-admin-protocol-cbor", janus_websockets_admin_callback_secure, sizeof(janus_websockets_client), 0 },
 	{ NULL, NULL, 0 }
 };
 /* Helper for debugging reasons */
@@ -358,6 +481,64 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 			JANUS_LOG(LOG_WARN, "Notification of events to handlers disabled for %s\n", JANUS_WEBSOCKETS_NAME);
 		}
 
+		/* Check if we can batch bursts of messages */
+		item = janus_config_get_item_drilldown(config, "general", "batching");
+		if(item && item->value)
+			ws_batching = janus_is_true(item->value);
+		item = janus_config_get_item_drilldown(config, "general", "batch_max_size");
+		if(item && item->value) {
+			int size = atoi(item->value);
+			if(size < 1024) {
+				JANUS_LOG(LOG_WARN, "Invalid value for batch_max_size (%d), using %d\n", size, JANUS_WEBSOCKETS_BATCH_MAX_SIZE);
+				size = JANUS_WEBSOCKETS_BATCH_MAX_SIZE;
+			}
+			ws_batch_max_size = size;
+		}
+		if(ws_batching)
+			JANUS_LOG(LOG_INFO, "WebSockets messages will be batched in JSON arrays (up to %zu bytes)\n", ws_batch_max_size);
+
+		/* Check if and how we should compress messages */
+		item = janus_config_get_item_drilldown(config, "general", "permessage_deflate");
+		if(item && item->value && janus_is_true(item->value)) {
+#ifndef LWS_WITHOUT_EXTENSIONS
+			ws_exts = ws_extensions;
+			JANUS_LOG(LOG_INFO, "WebSockets permessage-deflate support enabled\n");
+#else
+			JANUS_LOG(LOG_WARN, "libwebsockets built without extensions, permessage-deflate not available\n");
+#endif
+		}
+#ifdef HAVE_ZLIB
+		item = janus_config_get_item_drilldown(config, "general", "deflate_level");
+		if(item && item->value) {
+			ws_deflate_level = atoi(item->value);
+			if(ws_deflate_level < 0 || ws_deflate_level > 9) {
+				JANUS_LOG(LOG_WARN, "Invalid value for deflate_level (%d), using the default\n", ws_deflate_level);
+				ws_deflate_level = Z_DEFAULT_COMPRESSION;
+			}
+		}
+#endif
+		item = janus_config_get_item_drilldown(config, "general", "deflate_threshold");
+		if(item && item->value) {
+#ifdef HAVE_ZLIB
+			ws_deflate_threshold = atoi(item->value);
+			if(ws_deflate_threshold < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid value for deflate_threshold (%d), disabling compression\n", ws_deflate_threshold);
+				ws_deflate_threshold = 0;
+			}
+			if(ws_deflate_threshold > 0) {
+				JANUS_LOG(LOG_INFO, "Messages larger than %d bytes will be compressed for clients using the deflate subprotocols\n",
+					ws_deflate_threshold);
+			}
+#else
+			JANUS_LOG(LOG_WARN, "WebSockets transport built without zlib, deflate subprotocols not available\n");
+#endif
+		}
+#ifdef HAVE_ZLIB
+		item = janus_config_get_item_drilldown(config, "general", "deflate_benchmark");
+		if(item && item->value && atoi(item->value) > 0)
+			janus_websockets_deflate_benchmark(atoi(item->value));
+#endif
+
 		item = janus_config_get_item_drilldown(config, "general", "ws_logging");
 		if(item && item->value) {
 			ws_log_level = atoi(item->value);
@@ -440,8 +621,17 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 			wscinfo.timeout_secs = pingpong_timeout;
 		}
 #endif
-		/* Force single-thread server */
-		wscinfo.count_threads = 1;
+		/* How many service threads should we use? */
+		ws_threads_count = 1;
+		item = janus_config_get_item_drilldown(config, "general", "ws_threads");
+		if(item && item->value) {
+			ws_threads_count = atoi(item->value);
+			if(ws_threads_count < 1 || ws_threads_count > JANUS_WEBSOCKETS_MAX_THREADS) {
+				JANUS_LOG(LOG_WARN, "Invalid value for ws_threads (%d), using 1\n", ws_threads_count);
+				ws_threads_count = 1;
+			}
+		}
+		wscinfo.count_threads = ws_threads_count;
 
 		/* Create the base context */
 		wsc = lws_create_context(&wscinfo);
@@ -450,6 +640,13 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 			janus_config_destroy(config);
 			return -1;	/* No point in keeping the plugin loaded */
 		}
+		/* libwebsockets caps the number of threads to what it was built for (LWS_MAX_SMP) */
+		int count_threads = lws_get_count_threads(wsc);
+		if(count_threads < ws_threads_count) {
+			JANUS_LOG(LOG_WARN, "libwebsockets only supports %d service thread(s), not %d (LWS_MAX_SMP)\n",
+				count_threads, ws_threads_count);
+			ws_threads_count = count_threads > 0 ? count_threads : 1;
+		}
 
 		/* Setup the Janus API WebSockets server(s) */
 		item = janus_config_get_item_drilldown(config, "general", "ws");
@@ -480,7 +677,7 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 			info.port = wsport;
 			info.iface = ip ? ip : interface;
 			info.protocols = ws_protocols;
-			info.extensions = NULL;
+			info.extensions = ws_exts;
 			info.ssl_cert_filepath = NULL;
 			info.ssl_private_key_filepath = NULL;
 			info.ssl_private_key_password = NULL;
@@ -538,7 +735,7 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 				info.port = wsport;
 				info.iface = ip ? ip : interface;
 				info.protocols = sws_protocols;
-				info.extensions = NULL;
+				info.extensions = ws_exts;
 				info.ssl_cert_filepath = server_pem;
 				info.ssl_private_key_filepath = server_key;
 				info.ssl_private_key_password = password;
@@ -588,7 +785,7 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 			info.port = wsport;
 			info.iface = ip ? ip : interface;
 			info.protocols = admin_ws_protocols;
-			info.extensions = NULL;
+			info.extensions = ws_exts;
 			info.ssl_cert_filepath = NULL;
 			info.ssl_private_key_filepath = NULL;
 			info.ssl_private_key_password = NULL;
@@ -646,7 +843,7 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 				info.port = wsport;
 				info.iface = ip ? ip : interface;
 				info.protocols = admin_sws_protocols;
-				info.extensions = NULL;
+				info.extensions = ws_exts;
 				info.ssl_cert_filepath = server_pem;
 				info.ssl_private_key_filepath = server_key;
 				info.ssl_private_key_password = password;
@@ -681,15 +878,41 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 	g_atomic_int_set(&initialized, 1);
 
 	GError *error = NULL;
-	/* Start the WebSocket service thread */
-	if(ws_janus_api_enabled || ws_admin_api_enabled) {
-		ws_thread = g_thread_try_new("ws thread", &janus_websockets_thread, wsc, &error);
-		if(!ws_thread) {
-			g_atomic_int_set(&initialized, 0);
+	/* Start the WebSocket service threads */
+	ws_threads = g_malloc0(ws_threads_count * sizeof(GThread *));
+	ws_threads_stats = g_malloc0(ws_threads_count * sizeof(janus_websockets_thread_stats));
+#ifdef HAVE_ZLIB
+	ws_deflaters = g_malloc0(ws_threads_count * sizeof(janus_websockets_deflater));
+#endif
+	int i = 0;
+	for(i=0; i<ws_threads_count; i++) {
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "ws thread %d", i);
+		ws_threads[i] = g_thread_try_new(tname, &janus_websockets_thread, GINT_TO_POINTER(i+1), &error);
+		if(!ws_threads[i]) {
 			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the WebSockets thread...\n", error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			/* Stop the threads we started so far */
+			g_atomic_int_set(&stopping, 1);
+			int j = 0;
+			for(j=0; j<i; j++)
+				g_thread_join(ws_threads[j]);
+			g_free(ws_threads);
+			ws_threads = NULL;
+			g_free(ws_threads_stats);
+			ws_threads_stats = NULL;
+#ifdef HAVE_ZLIB
+			g_free(ws_deflaters);
+			ws_deflaters = NULL;
+#endif
+			lws_context_destroy(wsc);
+			wsc = NULL;
+			g_atomic_int_set(&initialized, 0);
+			g_atomic_int_set(&stopping, 0);
 			return -1;
 		}
 	}
+	JANUS_LOG(LOG_INFO, "WebSockets clients will be served by %d thread(s)\n", ws_threads_count);
 
 	/* Done */
 	JANUS_LOG(LOG_INFO, "%s initialized!\n", JANUS_WEBSOCKETS_NAME);
@@ -701,10 +924,15 @@ void janus_websockets_destroy(void) {
 		return;
 	g_atomic_int_set(&stopping, 1);
 
-	/* Stop the service thread */
-	if(ws_thread != NULL) {
-		g_thread_join(ws_thread);
-		ws_thread = NULL;
+	/* Stop the service threads */
+	if(ws_threads != NULL) {
+		int i = 0;
+		for(i=0; i<ws_threads_count; i++) {
+			if(ws_threads[i] != NULL)
+				g_thread_join(ws_threads[i]);
+		}
+		g_free(ws_threads);
+		ws_threads = NULL;
 	}
 
 	/* Destroy the context */
@@ -712,6 +940,17 @@ void janus_websockets_destroy(void) {
 		lws_context_destroy(wsc);
 		wsc = NULL;
 	}
+	g_free(ws_threads_stats);
+	ws_threads_stats = NULL;
+#ifdef HAVE_ZLIB
+	if(ws_deflaters != NULL) {
+		int i = 0;
+		for(i=0; i<ws_threads_count; i++)
+			janus_websockets_deflater_free(&ws_deflaters[i]);
+		g_free(ws_deflaters);
+		ws_deflaters = NULL;
+	}
+#endif
 
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
@@ -728,6 +967,8 @@ static void janus_websockets_destroy_client(
 	janus_mutex_lock(&ws_client->ts->mutex);
 	JANUS_LOG(LOG_INFO, "[%s-%p] Destroying WebSocket client\n", log_prefix, wsi);
 	ws_client->wsi = NULL;
+	if(ws_threads_stats != NULL)
+		g_atomic_int_add(&ws_threads_stats[ws_client->thread].clients, -1);
 	/* Notify handlers about this transport being gone */
 	if(notify_events && gateway->events_is_enabled()) {
 		json_t *info = json_object();
@@ -745,6 +986,8 @@ static void janus_websockets_destroy_client(
 		}
 		g_async_queue_unref(ws_client->messages);
 	}
+	g_free(ws_client->held);
+	ws_client->held = NULL;
 	/* ... and the shared buffers */
 	g_free(ws_client->incoming);
 	ws_client->incoming = NULL;
@@ -808,8 +1051,24 @@ int janus_websockets_send_message(janus_transport_session *transport, void *requ
 		janus_mutex_unlock(&transport->mutex);
 		return -1;
 	}
-	/* Convert to string and enqueue */
-	char *payload = json_dumps(message, json_format);
+	/* Convert to string (or CBOR) and enqueue */
+	char *payload = NULL;
+	if(client->cbor) {
+		size_t len = 0;
+		payload = janus_cbor_dumps(message, sizeof(uint32_t), &len);
+		if(payload != NULL) {
+			uint32_t size = len;
+			memcpy(payload, &size, sizeof(size));
+		}
+	} else {
+		payload = json_dumps(message, json_format);
+	}
+	if(payload == NULL) {
+		JANUS_LOG(LOG_ERR, "Error serializing message for WebSockets client %p\n", client);
+		json_decref(message);
+		janus_mutex_unlock(&transport->mutex);
+		return -1;
+	}
 	g_async_queue_push(client->messages, payload);
 	lws_callback_on_writable(client->wsi);
 	janus_mutex_unlock(&transport->mutex);
@@ -843,25 +1102,151 @@ void janus_websockets_session_claimed(janus_transport_session *transport, guint6
 }
 
 
+#ifdef HAVE_ZLIB
+/* Typical messages we benchmark compression with */
+static char *janus_websockets_benchmark_message(int type) {
+	json_t *message = json_object();
+	json_object_set_new(message, "janus", json_string("event"));
+	json_object_set_new(message, "session_id", json_integer(8137846524151241));
+	json_object_set_new(message, "sender", json_integer(3981275295434126));
+	json_t *plugindata = json_object();
+	json_t *data = json_object();
+	int i = 0;
+	if(type == 0) {
+		/* An SDP offer */
+		json_object_set_new(plugindata, "plugin", json_string("janus.plugin.videoroom"));
+		json_object_set_new(data, "videoroom", json_string("attached"));
+		GString *sdp = g_string_new("v=0\r\no=- 1540894735283484 1 IN IP4 192.168.1.10\r\ns=VideoRoom 1234\r\nt=0 0\r\n"
+			"a=group:BUNDLE audio video\r\na=msid-semantic: WMS janus\r\n");
+		for(i=0; i<2; i++) {
+			g_string_append_printf(sdp, "m=%s 9 UDP/TLS/RTP/SAVPF %s\r\nc=IN IP4 192.168.1.10\r\n"
+				"a=sendonly\r\na=mid:%s\r\na=rtcp-mux\r\na=ice-ufrag:Ouzr\r\na=ice-pwd:Hz5ZLdW0clZEWqbzIUdhpT\r\n"
+				"a=ice-options:trickle\r\na=fingerprint:sha-256 D2:B9:31:8F:DF:24:D8:0E:ED:D2:EF:25:9E:AF:6F:B8:34:AE:53:9C:E6:F3:8F:F2:64:15:FA:E8:7F:53:2D:38\r\n"
+				"a=setup:actpass\r\na=%s\r\na=rtcp-fb:%s nack\r\na=rtcp-fb:%s nack pli\r\n"
+				"a=ssrc:%u cname:janusaudio\r\na=ssrc:%u msid:janus janusa0\r\na=ssrc:%u mslabel:janus\r\n"
+				"a=candidate:1 1 udp 2013266431 192.168.1.10 47345 typ host\r\na=candidate:2 1 udp 1677729535 1.2.3.4 47345 typ srflx raddr 192.168.1.10 rport 47345\r\n"
+				"a=end-of-candidates\r\n",
+				i ? "video" : "audio", i ? "96" : "111", i ? "video" : "audio",
+				i ? "rtpmap:96 VP8/90000" : "rtpmap:111 opus/48000/2", i ? "96" : "111", i ? "96" : "111",
+				3028397001U+i, 3028397001U+i, 3028397001U+i);
+		}
+		json_t *jsep = json_object();
+		json_object_set_new(jsep, "type", json_string("offer"));
+		json_object_set_new(jsep, "sdp", json_string(sdp->str));
+		json_object_set_new(message, "jsep", jsep);
+		g_string_free(sdp, TRUE);
+	} else if(type == 1) {
+		/* A list of participants in a large room */
+		json_object_set_new(plugindata, "plugin", json_string("janus.plugin.videoroom"));
+		json_object_set_new(data, "videoroom", json_string("participants"));
+		json_object_set_new(data, "room", json_integer(1234));
+		json_t *list = json_array();
+		for(i=0; i<50; i++) {
+			json_t *p = json_object();
+			char display[32];
+			g_snprintf(display, sizeof(display), "Participant %d", i);
+			json_object_set_new(p, "id", json_integer(4572883946751230 + i*7919));
+			json_object_set_new(p, "display", json_string(display));
+			json_object_set_new(p, "publisher", i % 3 ? json_true() : json_false());
+			json_object_set_new(p, "talking", json_false());
+			json_array_append_new(list, p);
+		}
+		json_object_set_new(data, "participants", list);
+	} else if(type == 2) {
+		/* A TextRoom broadcast */
+		json_object_set_new(plugindata, "plugin", json_string("janus.plugin.textroom"));
+		json_object_set_new(data, "textroom", json_string("message"));
+		json_object_set_new(data, "room", json_integer(1234));
+		json_object_set_new(data, "from", json_string("alice"));
+		json_object_set_new(data, "date", json_string("2017-03-08T15:47:21+0100"));
+		json_object_set_new(data, "text", json_string("Hi everybody, can you all hear me? I'm going to share my screen in a minute"));
+	} else {
+		/* A small ack */
+		json_decref(data);
+		json_decref(plugindata);
+		json_object_set_new(message, "janus", json_string("ack"));
+		json_object_set_new(message, "transaction", json_string("Ph4wRgMk7Zpx"));
+		char *text = json_dumps(message, json_format);
+		json_decref(message);
+		return text;
+	}
+	json_object_set_new(plugindata, "data", data);
+	json_object_set_new(message, "plugindata", plugindata);
+	char *text = json_dumps(message, json_format);
+	json_decref(message);
+	return text;
+}
+
+static void janus_websockets_deflate_benchmark(int rounds) {
+	const char *names[] = { "SDP offer", "participants list", "textroom message", "ack" };
+	janus_websockets_deflater deflater;
+	memset(&deflater, 0, sizeof(deflater));
+	JANUS_LOG(LOG_INFO, "Benchmarking WebSockets compression (level %d, %d rounds)...\n", ws_deflate_level, rounds);
+	int type = 0, i = 0;
+	for(type=0; type<4; type++) {
+		char *text = janus_websockets_benchmark_message(type);
+		size_t len = strlen(text), size = 0;
+		gint64 start = janus_get_monotonic_time();
+		for(i=0; i<rounds; i++)
+			size = janus_websockets_deflate(&deflater, (unsigned char *)text, len);
+		gint64 elapsed = janus_get_monotonic_time() - start;
+		if(size == 0) {
+			JANUS_LOG(LOG_INFO, "  -- %s: %zu bytes, not worth compressing (%.2f us per message)\n",
+				names[type], len, (double)elapsed/rounds);
+		} else {
+			JANUS_LOG(LOG_INFO, "  -- %s: %zu --> %zu bytes (%.1f%% saved), %.2f us per message, %.1f MB/s\n",
+				names[type], len, size, 100.0*(len-size)/len, (double)elapsed/rounds,
+				elapsed > 0 ? (double)len*rounds/elapsed : 0.0);
+		}
+		free(text);
+	}
+	janus_websockets_deflater_free(&deflater);
+}
+#endif
+
+json_t *janus_websockets_query_transport(json_t *request) {
+	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
+		return NULL;
+	/* Return the clients and messages handled by each service thread */
+	json_t *response = json_object();
+	json_t *threads = json_array();
+	int i = 0;
+	for(i=0; i<ws_threads_count; i++) {
+		janus_websockets_thread_stats *stats = &ws_threads_stats[i];
+		json_t *thread = json_object();
+		json_object_set_new(thread, "thread", json_integer(i));
+		json_object_set_new(thread, "clients", json_integer(g_atomic_int_get(&stats->clients)));
+		json_object_set_new(thread, "messages_in", json_integer(__atomic_load_n(&stats->messages_in, __ATOMIC_RELAXED)));
+		json_object_set_new(thread, "messages_out", json_integer(__atomic_load_n(&stats->messages_out, __ATOMIC_RELAXED)));
+		json_object_set_new(thread, "deflated", json_integer(__atomic_load_n(&stats->deflated, __ATOMIC_RELAXED)));
+		json_object_set_new(thread, "deflate_saved", json_integer(__atomic_load_n(&stats->deflate_saved, __ATOMIC_RELAXED)));
+		json_array_append_new(threads, thread);
+	}
+	json_object_set_new(response, "threads", threads);
+	return response;
+}
+
+
 /* Thread */
 void *janus_websockets_thread(void *data) {
-	struct lws_context *service = (struct lws_context *)data;
-	if(service == NULL) {
+	int tsi = GPOINTER_TO_INT(data) - 1;
+	if(wsc == NULL || tsi < 0) {
 		JANUS_LOG(LOG_ERR, "Invalid service\n");
 		return NULL;
 	}
+	g_private_set(&ws_thread_index, data);
 
-	JANUS_LOG(LOG_INFO, "WebSockets thread started\n");
+	JANUS_LOG(LOG_INFO, "WebSockets thread #%d started\n", tsi);
 
 	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
-		/* libwebsockets is single thread, we cycle through events here */
-		lws_service(service, 50);
+		/* Each service thread cycles through the events of its own clients */
+		lws_service_tsi(wsc, 50, tsi);
 	}
 
 	/* Get rid of the WebSockets server */
-	lws_cancel_service(service);
+	lws_cancel_service(wsc);
 	/* Done */
-	JANUS_LOG(LOG_INFO, "WebSockets thread ended\n");
+	JANUS_LOG(LOG_INFO, "WebSockets thread #%d ended\n", tsi);
 	return NULL;
 }
 
@@ -936,13 +1321,25 @@ static int janus_websockets_common_callback(
 			/* Prepare the session */
 			ws_client->wsi = wsi;
 			ws_client->messages = g_async_queue_new();
+			ws_client->held = NULL;
 			ws_client->buffer = NULL;
 			ws_client->buflen = 0;
 			ws_client->bufpending = 0;
 			ws_client->bufoffset = 0;
+			ws_client->bufbinary = FALSE;
+			/* Check if the client asked for compressed frames */
+			const struct lws_protocols *protocol = lws_get_protocol(wsi);
+			ws_client->deflate = protocol && protocol->name && g_str_has_suffix(protocol->name, "-deflate");
+			/* Or if it wants to use CBOR instead of JSON */
+			ws_client->cbor = protocol && protocol->name && g_str_has_suffix(protocol->name, "-cbor");
 			g_atomic_int_set(&ws_client->session_timeout, 0);
 			g_atomic_int_set(&ws_client->destroyed, 0);
 			ws_client->ts = janus_transport_session_create(ws_client, NULL);
+			/* Callbacks for this client are always invoked by the same service thread */
+			ws_client->thread = GPOINTER_TO_INT(g_private_get(&ws_thread_index)) - 1;
+			if(ws_client->thread < 0 || ws_client->thread >= ws_threads_count)
+				ws_client->thread = 0;
+			g_atomic_int_inc(&ws_threads_stats[ws_client->thread].clients);
 			/* Let us know when the WebSocket channel becomes writeable */
 			lws_callback_on_writable(wsi);
 			JANUS_LOG(LOG_VERB, "[%s-%p]   -- Ready to be used!\n", log_prefix, wsi);
@@ -971,27 +1368,37 @@ static int janus_websockets_common_callback(
 				ws_client->incoming = g_malloc(len+1);
 				memcpy(ws_client->incoming, in, len);
 				ws_client->incoming[len] = '\0';
-				JANUS_LOG(LOG_HUGE, "%s\n", ws_client->incoming);
+				ws_client->incoming_len = len;
+				if(!ws_client->cbor)
+					JANUS_LOG(LOG_HUGE, "%s\n", ws_client->incoming);
 			} else {
-				size_t offset = strlen(ws_client->incoming);
+				size_t offset = ws_client->incoming_len;
 				JANUS_LOG(LOG_HUGE, "[%s-%p] Appending fragment: offset %zu, %zu bytes, %zu remaining\n", log_prefix, wsi, offset, len, remaining);
 				ws_client->incoming = g_realloc(ws_client->incoming, offset+len+1);
 				memcpy(ws_client->incoming+offset, in, len);
 				ws_client->incoming[offset+len] = '\0';
-				JANUS_LOG(LOG_HUGE, "%s\n", ws_client->incoming+offset);
+				ws_client->incoming_len = offset+len;
+				if(!ws_client->cbor)
+					JANUS_LOG(LOG_HUGE, "%s\n", ws_client->incoming+offset);
 			}
 			if(remaining > 0 || !lws_is_final_fragment(wsi)) {
 				/* Still waiting for some more fragments */
 				JANUS_LOG(LOG_HUGE, "[%s-%p] Waiting for more fragments\n", log_prefix, wsi);
 				return 0;
 			}
-			JANUS_LOG(LOG_HUGE, "[%s-%p] Done, parsing message: %zu bytes\n", log_prefix, wsi, strlen(ws_client->incoming));
-			/* If we got here, the message is complete: parse the JSON payload */
+			JANUS_LOG(LOG_HUGE, "[%s-%p] Done, parsing message: %zu bytes\n", log_prefix, wsi, ws_client->incoming_len);
+			/* If we got here, the message is complete: parse the CBOR or JSON payload */
 			json_error_t error;
-			json_t *root = json_loads(ws_client->incoming, 0, &error);
+			json_t *root = NULL;
+			if(ws_client->cbor && janus_cbor_is_cbor(ws_client->incoming, ws_client->incoming_len))
+				root = janus_cbor_loadb(ws_client->incoming, ws_client->incoming_len, &error);
+			else
+				root = json_loadb(ws_client->incoming, ws_client->incoming_len, 0, &error);
 			g_free(ws_client->incoming);
 			ws_client->incoming = NULL;
+			ws_client->incoming_len = 0;
 			/* Notify the core, passing both the object and, since it may be needed, the error */
+			__atomic_fetch_add(&ws_threads_stats[ws_client->thread].messages_in, 1, __ATOMIC_RELAXED);
 			gateway->incoming_request(&janus_websockets_transport, ws_client->ts, NULL, admin, root, &error);
 			return 0;
 		}
@@ -1007,7 +1414,8 @@ static int janus_websockets_common_callback(
 						&& !g_atomic_int_get(&ws_client->destroyed) && !g_atomic_int_get(&stopping)) {
 					JANUS_LOG(LOG_HUGE, "[%s-%p] Completing pending WebSocket write (still need to write last %d bytes)...\n",
 						log_prefix, wsi, ws_client->bufpending);
-					int sent = lws_write(wsi, ws_client->buffer + ws_client->bufoffset, ws_client->bufpending, LWS_WRITE_TEXT);
+					int sent = lws_write(wsi, ws_client->buffer + ws_client->bufoffset, ws_client->bufpending,
+						ws_client->bufbinary ? LWS_WRITE_BINARY : LWS_WRITE_TEXT);
 					JANUS_LOG(LOG_HUGE, "[%s-%p]   -- Sent %d/%d bytes\n", log_prefix, wsi, sent, ws_client->bufpending);
 					if(sent > -1 && sent < ws_client->bufpending) {
 						/* We still couldn't send everything that was left, we'll try and complete this in the next round */
@@ -1023,30 +1431,87 @@ static int janus_websockets_common_callback(
 					janus_mutex_unlock(&ws_client->ts->mutex);
 					return 0;
 				}
-				/* Shoot all the pending messages */
-				char *response = g_async_queue_try_pop(ws_client->messages);
-				if(response && !g_atomic_int_get(&ws_client->destroyed) && !g_atomic_int_get(&stopping)) {
+				/* Shoot the next pending message: libwebsockets only allows a single
+				 * lws_write per writeable callback, so bursts can only be sent at once
+				 * when batching is enabled, and we ask for another callback otherwise */
+				char *response = janus_websockets_client_pop(ws_client);
+				if(response != NULL) {
 					/* Gotcha! */
-					int buflen = LWS_SEND_BUFFER_PRE_PADDING + strlen(response) + LWS_SEND_BUFFER_POST_PADDING;
-					if (buflen > ws_client->buflen) {
-						/* We need a larger shared buffer */
-						JANUS_LOG(LOG_HUGE, "[%s-%p] Re-allocating to %d bytes (was %d, response is %zu bytes)\n", log_prefix, wsi, buflen, ws_client->buflen, strlen(response));
-						ws_client->buflen = buflen;
-						ws_client->buffer = g_realloc(ws_client->buffer, buflen);
+					const char *data = response;
+					size_t len = 0;
+					if(ws_client->cbor) {
+						/* CBOR messages are binary, so they're prefixed by their length */
+						uint32_t size = 0;
+						memcpy(&size, response, sizeof(size));
+						data = response + sizeof(size);
+						len = size;
+					} else {
+						len = strlen(response);
+					}
+					janus_websockets_client_reserve(ws_client, wsi, len);
+					unsigned char *payload = ws_client->buffer + LWS_SEND_BUFFER_PRE_PADDING;
+					size_t total = 0;
+					int batched = 1;
+					char *next = (ws_batching && !ws_client->cbor) ? janus_websockets_client_pop(ws_client) : NULL;
+					if(next == NULL) {
+						memcpy(payload, data, len);
+						total = len;
+					} else {
+						/* There's more queued, pack the burst in a JSON array */
+						janus_websockets_client_reserve(ws_client, wsi, len+2);
+						payload = ws_client->buffer + LWS_SEND_BUFFER_PRE_PADDING;
+						payload[total++] = '[';
+						memcpy(payload+total, response, len);
+						total += len;
+						while(next != NULL) {
+							size_t nlen = strlen(next);
+							if(total + nlen + 2 > ws_batch_max_size) {
+								/* Too large, keep it for the next frame */
+								ws_client->held = next;
+								break;
+							}
+							janus_websockets_client_reserve(ws_client, wsi, total+nlen+2);
+							payload = ws_client->buffer + LWS_SEND_BUFFER_PRE_PADDING;
+							payload[total++] = ',';
+							memcpy(payload+total, next, nlen);
+							total += nlen;
+							free(next);
+							batched++;
+							next = janus_websockets_client_pop(ws_client);
+						}
+						payload[total++] = ']';
+						JANUS_LOG(LOG_HUGE, "[%s-%p] Batched %d messages in a single frame\n", log_prefix, wsi, batched);
 					}
-					memcpy(ws_client->buffer + LWS_SEND_BUFFER_PRE_PADDING, response, strlen(response));
-					JANUS_LOG(LOG_HUGE, "[%s-%p] Sending WebSocket message (%zu bytes)...\n", log_prefix, wsi, strlen(response));
-					int sent = lws_write(wsi, ws_client->buffer + LWS_SEND_BUFFER_PRE_PADDING, strlen(response), LWS_WRITE_TEXT);
-					JANUS_LOG(LOG_HUGE, "[%s-%p]   -- Sent %d/%zu bytes\n", log_prefix, wsi, sent, strlen(response));
-					if(sent > -1 && sent < (int)strlen(response)) {
+					/* We can get rid of the message */
+					free(response);
+					JANUS_LOG(LOG_HUGE, "[%s-%p] Sending WebSocket message (%zu bytes)...\n", log_prefix, wsi, total);
+					gboolean binary = ws_client->cbor;
+#ifdef HAVE_ZLIB
+					if(ws_client->deflate && ws_deflate_threshold > 0 && total >= (size_t)ws_deflate_threshold) {
+						/* Send this as a binary frame with the compressed payload */
+						janus_websockets_deflater *deflater = &ws_deflaters[ws_client->thread];
+						size_t size = janus_websockets_deflate(deflater, payload, total);
+						if(size > 0) {
+							JANUS_LOG(LOG_HUGE, "[%s-%p] Compressed %zu bytes to %zu\n", log_prefix, wsi, total, size);
+							memcpy(payload, deflater->buffer, size);
+							__atomic_fetch_add(&ws_threads_stats[ws_client->thread].deflated, 1, __ATOMIC_RELAXED);
+							__atomic_fetch_add(&ws_threads_stats[ws_client->thread].deflate_saved, total - size, __ATOMIC_RELAXED);
+							total = size;
+							binary = TRUE;
+						}
+					}
+#endif
+					ws_client->bufbinary = binary;
+					int sent = lws_write(wsi, payload, total, binary ? LWS_WRITE_BINARY : LWS_WRITE_TEXT);
+					JANUS_LOG(LOG_HUGE, "[%s-%p]   -- Sent %d/%zu bytes\n", log_prefix, wsi, sent, total);
+					__atomic_fetch_add(&ws_threads_stats[ws_client->thread].messages_out, batched, __ATOMIC_RELAXED);
+					if(sent > -1 && sent < (int)total) {
 						/* We couldn't send everything in a single write, we'll complete this in the next round */
-						ws_client->bufpending = strlen(response) - sent;
+						ws_client->bufpending = total - sent;
 						ws_client->bufoffset = LWS_SEND_BUFFER_PRE_PADDING + sent;
 						JANUS_LOG(LOG_HUGE, "[%s-%p]   -- Couldn't write all bytes (%d missing), setting offset %d\n",
 							log_prefix, wsi, ws_client->bufpending, ws_client->bufoffset);
 					}
-					/* We can get rid of the message */
-					free(response);
 					/* Done for this round, check the next response/notification later */
 					lws_callback_on_writable(wsi);
 					janus_mutex_unlock(&ws_client->ts->mutex);
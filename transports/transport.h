@@ -58,10 +58,12 @@ janus_transport *create(void) {
  * - \c session_created(): this method notifies the transport that a Janus session has been created by one of its requests;
  * - \c session_over(): this method notifies the transport that one of its Janus sessionss is now over, whether because of a timeout or not.
  * - \c session_claimed(): this method notifies the transport that it has claimed a session.
+ * - \c query_transport(): this optional method allows the Admin API to query
+ * the transport for information about its internal state (e.g., statistics).
  *
- * All the above methods and callbacks are mandatory: the Janus core will
- * reject a transport plugin that doesn't implement any of the
- * mandatory callbacks.
+ * All the above methods and callbacks, except \c query_transport(), are
+ * mandatory: the Janus core will reject a transport plugin that doesn't
+ * implement any of the mandatory callbacks.
  *
  * The gateway \c janus_transport_callbacks interface is provided to a
  * transport plugin, together with the path to the configurations files
@@ -97,7 +99,7 @@ janus_transport *create(void) {
 
 
 /*! \brief Version of the API, to match the one transport plugins were compiled against */
-#define JANUS_TRANSPORT_API_VERSION		7
+#define JANUS_TRANSPORT_API_VERSION		8
 
 /*! \brief Initialization of all transport plugin properties to NULL
  *
@@ -129,6 +131,7 @@ static janus_transport janus_http_transport plugin =
 		.session_created = NULL,		\
 		.session_over = NULL,			\
 		.session_claimed = NULL,			\
+		.query_transport = NULL,		\
 		## __VA_ARGS__ }
 
 
@@ -229,6 +232,10 @@ struct janus_transport {
 	 * @param[in] transport Pointer to the new transport session instance that has claimed the session
 	 * @param[in] session_id The session ID that was claimed (if the transport cares) */
 	void (* const session_claimed)(janus_transport_session *transport, guint64 session_id);
+	/*! \brief Method to handle a query from the Admin API (optional)
+	 * @param[in] request The request object, if any (don't unref it)
+	 * @returns A json_t object with the response, which the core will unref */
+	json_t *(* const query_transport)(json_t *request);
 
 };
 
@@ -6,7 +6,10 @@
  * draft, that is a REST API that can be used to access TURN services,
  * more specifically credentials to use. Currently implemented in both
  * rfc5766-turn-server and coturn, and so should be generic enough to
- * be usable here.
+ * be usable here. Credentials are cached and shared by all the handles
+ * for as long as they're valid, and a background thread takes care of
+ * fetching new ones before they expire, which means that, most of the
+ * times, setting up a PeerConnection doesn't involve any HTTP request.
  * \note This implementation depends on \c libcurl and is optional.
  * 
  * \ingroup core
@@ -26,12 +29,39 @@
 #include "debug.h"
 #include "mutex.h"
 #include "ip-utils.h"
+#include "metrics.h"
 
 static const char *api_server = NULL;
 static const char *api_key = NULL;
 static gboolean api_http_get = FALSE;
 static janus_mutex api_mutex = JANUS_MUTEX_INITIALIZER;
 
+/* Cached credentials: they're handed out until three quarters of their
+ * TTL have passed, and refreshed in the background at half of it */
+static janus_turnrest_response *cached = NULL;
+static gint64 cached_refresh = 0, cached_expiry = 0;
+/* Every time a fetch is attempted, this is increased, so that misses can wait for it */
+static guint64 fetches = 0;
+/* Increased whenever the backend changes, so that we don't cache credentials from an old one */
+static guint64 backend_generation = 0;
+/* Set if the backend doesn't tell us how long credentials are valid, in which case we don't cache them */
+static gboolean uncacheable = FALSE;
+static gboolean fetch_needed = FALSE, fetching = FALSE, cache_stopping = FALSE;
+static GMutex cache_mutex;
+static GCond cache_cond;
+static GThread *cache_thread = NULL;
+/* How long to wait before retrying, if a fetch failed */
+#define JANUS_TURNREST_RETRY	(5*G_USEC_PER_SEC)
+/* How long a miss can wait for credentials to be fetched */
+#define JANUS_TURNREST_MISS_WAIT	(11*G_USEC_PER_SEC)
+
+static janus_metric *metric_hits = NULL, *metric_misses = NULL;
+static janus_metric *metric_fetches = NULL, *metric_fetch_errors = NULL, *metric_fetch_time = NULL;
+static volatile gint last_fetch_time = 0;
+static gint64 janus_turnrest_last_fetch_time(gpointer data) {
+	return g_atomic_int_get(&last_fetch_time);
+}
+
 
 /* Buffer we use to receive the response via libcurl */
 typedef struct janus_turnrest_buffer {
@@ -54,12 +84,39 @@ static size_t janus_turnrest_callback(void *payload, size_t size, size_t nmemb,
 }
 
 
+static janus_turnrest_response *janus_turnrest_fetch(void);
+static void *janus_turnrest_thread(void *data);
+
 void janus_turnrest_init(void) {
 	/* Initialize libcurl, needed for contacting the TURN REST API backend */
 	curl_global_init(CURL_GLOBAL_ALL);
+	metric_hits = janus_metric_register("janus_turnrest_cache_hits_total", NULL,
+		"TURN REST API credentials served from the cache", janus_metric_counter);
+	metric_misses = janus_metric_register("janus_turnrest_cache_misses_total", NULL,
+		"TURN REST API credentials that weren't available in the cache", janus_metric_counter);
+	metric_fetches = janus_metric_register("janus_turnrest_fetches_total", NULL,
+		"Requests sent to the TURN REST API backend", janus_metric_counter);
+	metric_fetch_errors = janus_metric_register("janus_turnrest_fetch_errors_total", NULL,
+		"Requests to the TURN REST API backend that failed", janus_metric_counter);
+	metric_fetch_time = janus_metric_register("janus_turnrest_fetch_time_ms_total", NULL,
+		"Time spent waiting for the TURN REST API backend, in milliseconds", janus_metric_counter);
+	janus_metric_register_callback("janus_turnrest_last_fetch_time_ms", NULL,
+		"How long the latest request to the TURN REST API backend took, in milliseconds",
+		janus_metric_gauge, janus_turnrest_last_fetch_time, NULL);
 }
 
 void janus_turnrest_deinit(void) {
+	/* Stop the thread refreshing the credentials, if it's running */
+	g_mutex_lock(&cache_mutex);
+	cache_stopping = TRUE;
+	g_cond_broadcast(&cache_cond);
+	g_mutex_unlock(&cache_mutex);
+	if(cache_thread != NULL) {
+		g_thread_join(cache_thread);
+		cache_thread = NULL;
+	}
+	janus_turnrest_response_destroy(cached);
+	cached = NULL;
 	/* Cleanup the libcurl initialization */
 	curl_global_cleanup();
 	janus_mutex_lock(&api_mutex);
@@ -93,7 +150,30 @@ void janus_turnrest_set_backend(const char *server, const char *key, const char
 			}
 		}
 	}
+	gboolean enabled = (api_server != NULL);
 	janus_mutex_unlock(&api_mutex);
+
+	/* Whatever we had cached came from the old backend: fetch new credentials right away */
+	g_mutex_lock(&cache_mutex);
+	janus_turnrest_response_destroy(cached);
+	cached = NULL;
+	cached_refresh = 0;
+	cached_expiry = 0;
+	backend_generation++;
+	uncacheable = FALSE;
+	fetch_needed = enabled;
+	if(enabled && cache_thread == NULL && !cache_stopping) {
+		GError *error = NULL;
+		cache_thread = g_thread_try_new("turnrest", janus_turnrest_thread, NULL, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the TURN REST API thread, credentials won't be cached...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			cache_thread = NULL;
+		}
+	}
+	g_cond_broadcast(&cache_cond);
+	g_mutex_unlock(&cache_mutex);
 }
 
 const char *janus_turnrest_get_backend(void) {
@@ -108,15 +188,117 @@ static void janus_turnrest_instance_destroy(gpointer data) {
 	g_free(instance);
 }
 
-void janus_turnrest_response_destroy(janus_turnrest_response *response) {
-	if(response == NULL)
-		return;
+static void janus_turnrest_response_free(const janus_refcount *response_ref) {
+	janus_turnrest_response *response = janus_refcount_containerof(response_ref, janus_turnrest_response, ref);
 	g_free(response->username);
 	g_free(response->password);
 	g_list_free_full(response->servers, janus_turnrest_instance_destroy);
+	g_free(response);
+}
+
+void janus_turnrest_response_destroy(janus_turnrest_response *response) {
+	if(response == NULL)
+		return;
+	janus_refcount_decrease(&response->ref);
+}
+
+/* Thread fetching credentials in the background, whenever needed */
+static void *janus_turnrest_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining TURN REST API thread\n");
+	g_mutex_lock(&cache_mutex);
+	while(!cache_stopping) {
+		gint64 now = g_get_monotonic_time();
+		if(!fetch_needed && (cached_refresh == 0 || now < cached_refresh)) {
+			/* Nothing to do yet: wait until it's time for a refresh, or until we're asked */
+			if(cached_refresh > 0)
+				g_cond_wait_until(&cache_cond, &cache_mutex, cached_refresh);
+			else
+				g_cond_wait(&cache_cond, &cache_mutex);
+			continue;
+		}
+		fetch_needed = FALSE;
+		fetching = TRUE;
+		guint64 generation = backend_generation;
+		g_mutex_unlock(&cache_mutex);
+		janus_turnrest_response *response = janus_turnrest_fetch();
+		g_mutex_lock(&cache_mutex);
+		now = g_get_monotonic_time();
+		fetching = FALSE;
+		fetches++;
+		if(generation != backend_generation) {
+			/* The backend changed in the meanwhile, there's a new fetch pending already */
+			janus_turnrest_response_destroy(response);
+		} else if(response != NULL && response->ttl > 0) {
+			janus_turnrest_response_destroy(cached);
+			cached = response;
+			cached_refresh = now + (gint64)response->ttl*G_USEC_PER_SEC/2;
+			cached_expiry = now + (gint64)response->ttl*G_USEC_PER_SEC*3/4;
+		} else {
+			if(response != NULL) {
+				/* No TTL means we can't know for how long these are valid: don't cache
+				 * them, and have handles contact the backend themselves, as before */
+				JANUS_LOG(LOG_WARN, "No TTL in the TURN REST API response, credentials won't be cached\n");
+				janus_turnrest_response_destroy(response);
+				uncacheable = TRUE;
+				cached_refresh = 0;
+			} else {
+				/* Try again in a bit, unless the backend is gone */
+				cached_refresh = janus_turnrest_get_backend() ? now + JANUS_TURNREST_RETRY : 0;
+			}
+		}
+		g_cond_broadcast(&cache_cond);
+	}
+	g_mutex_unlock(&cache_mutex);
+	JANUS_LOG(LOG_VERB, "Leaving TURN REST API thread\n");
+	return NULL;
 }
 
 janus_turnrest_response *janus_turnrest_request(void) {
+	if(janus_turnrest_get_backend() == NULL)
+		return NULL;
+	g_mutex_lock(&cache_mutex);
+	if(cached != NULL && g_get_monotonic_time() < cached_expiry) {
+		/* We have valid credentials already */
+		janus_turnrest_response *response = cached;
+		janus_refcount_increase(&response->ref);
+		g_mutex_unlock(&cache_mutex);
+		janus_metric_inc(metric_hits);
+		return response;
+	}
+	janus_metric_inc(metric_misses);
+	if(cache_thread == NULL || uncacheable) {
+		/* No background thread or no caching, fetch the credentials ourselves */
+		g_mutex_unlock(&cache_mutex);
+		return janus_turnrest_fetch();
+	}
+	/* Ask the thread for new credentials (misses waiting at the same
+	 * time all wait for the same request) and wait for them */
+	if(!fetching) {
+		fetch_needed = TRUE;
+		g_cond_broadcast(&cache_cond);
+	}
+	guint64 attempt = fetches;
+	gint64 deadline = g_get_monotonic_time() + JANUS_TURNREST_MISS_WAIT;
+	while(fetches == attempt && !cache_stopping) {
+		if(!g_cond_wait_until(&cache_cond, &cache_mutex, deadline))
+			break;
+	}
+	janus_turnrest_response *response = NULL;
+	if(cached != NULL && g_get_monotonic_time() < cached_expiry) {
+		response = cached;
+		janus_refcount_increase(&response->ref);
+	}
+	gboolean fetch = (response == NULL && uncacheable);
+	g_mutex_unlock(&cache_mutex);
+	if(fetch) {
+		/* The backend turned out not to provide a TTL, fetch the credentials ourselves */
+		return janus_turnrest_fetch();
+	}
+	return response;
+}
+
+/* Send a request to the TURN REST API backend */
+static janus_turnrest_response *janus_turnrest_fetch(void) {
 	janus_mutex_lock(&api_mutex);
 	if(api_server == NULL) {
 		janus_mutex_unlock(&api_mutex);
@@ -156,9 +338,15 @@ janus_turnrest_response *janus_turnrest_request(void) {
 	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&data);
 	curl_easy_setopt(curl, CURLOPT_USERAGENT, "Janus/1.0");
 	/* Send the request */
+	gint64 start = g_get_monotonic_time();
 	res = curl_easy_perform(curl);
+	gint64 elapsed = (g_get_monotonic_time() - start)/1000;
+	janus_metric_inc(metric_fetches);
+	janus_metric_add(metric_fetch_time, elapsed);
+	g_atomic_int_set(&last_fetch_time, (gint)elapsed);
 	if(res != CURLE_OK) {
 		JANUS_LOG(LOG_ERR, "Couldn't send the request: %s\n", curl_easy_strerror(res));
+		janus_metric_inc(metric_fetch_errors);
 		g_free(data.buffer);
 		curl_easy_cleanup(curl);
 		return NULL;
@@ -172,6 +360,7 @@ janus_turnrest_response *janus_turnrest_request(void) {
 	json_t *root = json_loads(data.buffer, 0, &error);
 	if(!root) {
 		JANUS_LOG(LOG_ERR, "Couldn't parse response: error on line %d: %s", error.line, error.text);
+		janus_metric_inc(metric_fetch_errors);
 		g_free(data.buffer);
 		return NULL;
 	}
@@ -179,37 +368,38 @@ janus_turnrest_response *janus_turnrest_request(void) {
 	json_t *username = json_object_get(root, "username");
 	if(!username) {
 		JANUS_LOG(LOG_ERR, "Invalid response: missing username\n");
-		return NULL;
+		goto invalid;
 	}
 	if(!json_is_string(username)) {
 		JANUS_LOG(LOG_ERR, "Invalid response: username should be a string\n");
-		return NULL;
+		goto invalid;
 	}
 	json_t *password = json_object_get(root, "password");
 	if(!password) {
 		JANUS_LOG(LOG_ERR, "Invalid response: missing password\n");
-		return NULL;
+		goto invalid;
 	}
 	if(!json_is_string(password)) {
 		JANUS_LOG(LOG_ERR, "Invalid response: password should be a string\n");
-		return NULL;
+		goto invalid;
 	}
 	json_t *ttl = json_object_get(root, "ttl");
 	if(ttl && (!json_is_integer(ttl) || json_integer_value(ttl) < 0)) {
 		JANUS_LOG(LOG_ERR, "Invalid response: ttl should be a positive integer\n");
-		return NULL;
+		goto invalid;
 	}
 	json_t *uris = json_object_get(root, "uris");
 	if(!uris) {
 		JANUS_LOG(LOG_ERR, "Invalid response: missing uris\n");
-		return NULL;
+		goto invalid;
 	}
 	if(!json_is_array(uris) || json_array_size(uris) == 0) {
 		JANUS_LOG(LOG_ERR, "Invalid response: uris should be a non-empty array\n");
-		return NULL;
+		goto invalid;
 	}
 	/* Turn the response into a janus_turnrest_response object we can use */
 	janus_turnrest_response *response = g_malloc(sizeof(janus_turnrest_response));
+	janus_refcount_init(&response->ref, janus_turnrest_response_free);
 	response->username = g_strdup(json_string_value(username));
 	response->password = g_strdup(json_string_value(password));
 	response->ttl = ttl ? json_integer_value(ttl) : 0;
@@ -264,13 +454,20 @@ janus_turnrest_response *janus_turnrest_request(void) {
 		/* Add the server to the list */
 		response->servers = g_list_append(response->servers, instance);
 	}
+	json_decref(root);
 	if(response->servers == NULL) {
 		JANUS_LOG(LOG_ERR, "Couldn't find any valid TURN URI in the response...\n");
+		janus_metric_inc(metric_fetch_errors);
 		janus_turnrest_response_destroy(response);
 		return NULL; 
 	}
 	/* Done */
 	return response;
+
+invalid:
+	json_decref(root);
+	janus_metric_inc(metric_fetch_errors);
+	return NULL;
 }
 
 #endif
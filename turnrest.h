@@ -20,6 +20,8 @@
 
 #include <glib.h>
 
+#include "refcount.h"
+
 /*! \brief Initialize the TURN REST API client stack */
 void janus_turnrest_init(void);
 /*! \brief De-initialize the TURN REST API client stack */
@@ -38,7 +40,9 @@ void janus_turnrest_set_backend(const char *server, const char *key, const char
 const char *janus_turnrest_get_backend(void);
 
 
-/*! \brief Complete response from the TURN REST API service */
+/*! \brief Complete response from the TURN REST API service
+ * \note Responses are cached and shared by all the handles that asked
+ * for credentials while they were valid, and so must not be modified */
 typedef struct janus_turnrest_response {
 	/*! \brief TURN username */
 	char *username;
@@ -48,6 +52,8 @@ typedef struct janus_turnrest_response {
 	guint32 ttl;
 	/*! \brief List of TURN servers */
 	GList *servers;
+	/*! \brief Reference counter for this instance */
+	janus_refcount ref;
 } janus_turnrest_response;
 
 /*! \brief Instance of TURN server as returned by TURN REST API service */
@@ -59,13 +65,16 @@ typedef struct janus_turnrest_instance {
 	/*! \brief TURN server transport type */
 	int transport;
 } janus_turnrest_instance;
-/*! \brief De-allocate a janus_turnrest_response instance
- * @param response The janus_turnrest_response instance to destroy */
+/*! \brief Release a janus_turnrest_response instance (it's only freed
+ * when the cache and all the handles sharing it are done with it)
+ * @param response The janus_turnrest_response instance to release */
 void janus_turnrest_response_destroy(janus_turnrest_response *response);
 
 
 /*! \brief Retrieve address and credentials for one or more TURN servers
- * @note Use janus_turnrest_response_destroy to get rid of the response, once done
+ * @note Credentials are served from the cache when they're still valid, and
+ * only if they aren't this waits for a request to the backend to complete.
+ * Use janus_turnrest_response_destroy to get rid of the response, once done
  * @returns A valid janus_turnrest_response instance, if successful, NULL otherwise */
 janus_turnrest_response *janus_turnrest_request(void);
 
@@ -931,6 +931,144 @@ inline guint32 janus_push_bits(guint32 word, size_t num, guint32 val) {
 	return (word << num) | (val & (0xFFFFFFFF>>(32-num)));
 }
 
+/* Latency histograms */
+static int janus_histogram_index(guint32 value) {
+	if(value < JANUS_HISTOGRAM_SUB_BUCKETS)
+		return value;
+	/* Find the power of two, and then the linear sub-bucket within it */
+	int exp = g_bit_storage(value)-1;
+	int sub = (value >> (exp-3)) & (JANUS_HISTOGRAM_SUB_BUCKETS-1);
+	return (exp-2)*JANUS_HISTOGRAM_SUB_BUCKETS + sub;
+}
+static guint32 janus_histogram_value(int index) {
+	/* Return the highest value of the bucket, to be on the safe side */
+	if(index < JANUS_HISTOGRAM_SUB_BUCKETS)
+		return index;
+	int exp = index/JANUS_HISTOGRAM_SUB_BUCKETS + 2;
+	int sub = index % JANUS_HISTOGRAM_SUB_BUCKETS;
+	guint64 low = ((guint64)(JANUS_HISTOGRAM_SUB_BUCKETS + sub)) << (exp-3);
+	guint64 high = low + (G_GUINT64_CONSTANT(1) << (exp-3)) - 1;
+	return high > G_MAXUINT32 ? G_MAXUINT32 : (guint32)high;
+}
+
+void janus_histogram_add(janus_histogram *histogram, gint64 value) {
+	if(histogram == NULL)
+		return;
+	if(value < 0)
+		value = 0;
+	if(value > G_MAXINT32)
+		value = G_MAXINT32;
+	g_atomic_int_inc(&histogram->buckets[janus_histogram_index((guint32)value)]);
+	gint max = g_atomic_int_get(&histogram->max);
+	while(value > max) {
+		if(g_atomic_int_compare_and_exchange(&histogram->max, max, (gint)value))
+			break;
+		max = g_atomic_int_get(&histogram->max);
+	}
+}
+
+void janus_histogram_reset(janus_histogram *histogram) {
+	if(histogram == NULL)
+		return;
+	int i = 0;
+	for(i=0; i<JANUS_HISTOGRAM_BUCKETS; i++)
+		g_atomic_int_set(&histogram->buckets[i], 0);
+	g_atomic_int_set(&histogram->max, 0);
+}
+
+json_t *janus_histogram_summary(janus_histogram *histogram) {
+	json_t *summary = json_object();
+	if(histogram == NULL)
+		return summary;
+	/* Take a snapshot first, as the histogram may be updated in the meanwhile */
+	guint32 buckets[JANUS_HISTOGRAM_BUCKETS];
+	guint64 count = 0;
+	int i = 0;
+	for(i=0; i<JANUS_HISTOGRAM_BUCKETS; i++) {
+		buckets[i] = g_atomic_int_get(&histogram->buckets[i]);
+		count += buckets[i];
+	}
+	json_object_set_new(summary, "count", json_integer(count));
+	if(count > 0) {
+		const char *names[] = { "p50", "p90", "p99", "p999" };
+		double percentiles[] = { 0.5, 0.9, 0.99, 0.999 };
+		int p = 0;
+		guint64 seen = 0;
+		for(i=0; i<JANUS_HISTOGRAM_BUCKETS && p < 4; i++) {
+			seen += buckets[i];
+			while(p < 4 && seen >= (guint64)(percentiles[p]*count + 0.5) && seen > 0) {
+				json_object_set_new(summary, names[p], json_integer(janus_histogram_value(i)));
+				p++;
+			}
+		}
+	}
+	json_object_set_new(summary, "max", json_integer(g_atomic_int_get(&histogram->max)));
+	return summary;
+}
+
+/* Shared JSON events */
+typedef struct janus_json_event_serialized {
+	size_t flags;
+	char *text;
+	size_t len;
+} janus_json_event_serialized;
+
+static void janus_json_event_serialized_free(gpointer data) {
+	janus_json_event_serialized *text = (janus_json_event_serialized *)data;
+	free(text->text);
+	g_free(text);
+}
+
+static void janus_json_event_free(const janus_refcount *event_ref) {
+	janus_json_event *event = janus_refcount_containerof(event_ref, janus_json_event, ref);
+	json_decref(event->json);
+	g_slist_free_full(event->texts, janus_json_event_serialized_free);
+	g_free(event);
+}
+
+janus_json_event *janus_json_event_new(json_t *json) {
+	if(json == NULL)
+		return NULL;
+	janus_json_event *event = g_malloc(sizeof(janus_json_event));
+	event->json = json;
+	event->texts = NULL;
+	janus_mutex_init(&event->mutex);
+	janus_refcount_init(&event->ref, janus_json_event_free);
+	return event;
+}
+
+const char *janus_json_event_text(janus_json_event *event, size_t flags, size_t *len) {
+	if(event == NULL)
+		return NULL;
+	janus_mutex_lock(&event->mutex);
+	GSList *temp = event->texts;
+	while(temp) {
+		janus_json_event_serialized *text = (janus_json_event_serialized *)temp->data;
+		if(text->flags == flags) {
+			janus_mutex_unlock(&event->mutex);
+			if(len)
+				*len = text->len;
+			return text->text;
+		}
+		temp = temp->next;
+	}
+	/* First time we're asked for this format, serialize the event */
+	char *dump = json_dumps(event->json, flags);
+	if(dump == NULL) {
+		janus_mutex_unlock(&event->mutex);
+		return NULL;
+	}
+	janus_json_event_serialized *text = g_malloc(sizeof(janus_json_event_serialized));
+	text->flags = flags;
+	text->text = dump;
+	text->len = strlen(dump);
+	event->texts = g_slist_prepend(event->texts, text);
+	janus_mutex_unlock(&event->mutex);
+	if(len)
+		*len = text->len;
+	return text->text;
+}
+
 inline void janus_set1(guint8 *data,size_t i,guint8 val) {
 	data[i] = val;
 }
@@ -16,6 +16,9 @@
 #include <glib.h>
 #include <jansson.h>
 
+#include "mutex.h"
+#include "refcount.h"
+
 #define JANUS_JSON_STRING			JSON_STRING
 #define JANUS_JSON_INTEGER			JSON_INTEGER
 #define JANUS_JSON_OBJECT			JSON_OBJECT
@@ -293,6 +296,75 @@ int janus_vp9_parse_svc(char *buffer, int len, int *found,
  * @returns 0  New word value*/
 guint32 janus_push_bits(guint32 word, size_t num, guint32 val);
 
+/** @name Janus latency histograms
+ * @brief Log-linear histograms (in the spirit of HdrHistogram) to track
+ * latencies, e.g., in microseconds: each power of two is split in
+ * JANUS_HISTOGRAM_SUB_BUCKETS linear buckets, which means values are
+ * tracked with a relative error of at most 12.5% using a fixed amount
+ * of memory. Updates only use atomic operations, so the same histogram
+ * can be shared by different threads without any lock.
+ */
+///@{
+/*! \brief Number of linear sub-buckets in each power of two */
+#define JANUS_HISTOGRAM_SUB_BUCKETS	8
+/*! \brief Number of buckets, enough for all 32-bit values */
+#define JANUS_HISTOGRAM_BUCKETS		240
+/*! \brief Latency histogram */
+typedef struct janus_histogram {
+	/*! \brief Counters for each bucket */
+	volatile gint buckets[JANUS_HISTOGRAM_BUCKETS];
+	/*! \brief Highest value we've seen */
+	volatile gint max;
+} janus_histogram;
+/*! \brief Helper to add a value to a histogram
+ * @param[in] histogram The histogram to update
+ * @param[in] value The value to add (negative values are considered 0) */
+void janus_histogram_add(janus_histogram *histogram, gint64 value);
+/*! \brief Helper to reset a histogram
+ * @param[in] histogram The histogram to reset */
+void janus_histogram_reset(janus_histogram *histogram);
+/*! \brief Helper to get a summary of a histogram (count, percentiles and max)
+ * @param[in] histogram The histogram to summarize
+ * @returns A JSON object with the summary */
+json_t *janus_histogram_summary(janus_histogram *histogram);
+///@}
+
+/** @name Janus shared JSON events
+ * @brief Refcounted JSON events that are meant to be shared by different
+ * recipients (e.g., all the event handlers) as they are: the event is
+ * serialized lazily the first time a recipient needs its textual version,
+ * and the result is cached, so that other recipients using the same
+ * jansson flags can reuse it rather than encoding the same object again.
+ * As such, the JSON object must NOT be modified once the event is shared.
+ */
+///@{
+/*! \brief Shared JSON event */
+typedef struct janus_json_event {
+	/*! \brief The JSON object, which must be considered read-only */
+	json_t *json;
+	/*! \brief Cached serializations of the object, one per set of jansson flags */
+	GSList *texts;
+	/*! \brief Mutex to lock/unlock the cache */
+	janus_mutex mutex;
+	/*! \brief Reference counter for this instance */
+	janus_refcount ref;
+} janus_json_event;
+/*! \brief Helper to create a new shared event out of a JSON object
+ * \note The event steals the reference to the object
+ * @param[in] json The JSON object to wrap
+ * @returns A new janus_json_event instance, with a reference count of 1 */
+janus_json_event *janus_json_event_new(json_t *json);
+/*! \brief Helper to get the serialized version of a shared event
+ * \note The string is owned by the event, and is valid as long as the
+ * caller holds a reference to it: don't free it or modify it
+ * @param[in] event The event to serialize
+ * @param[in] flags Jansson flags to use when encoding, as in json_dumps
+ * @param[out] len If not NULL, the length of the string (excluding the terminator)
+ * @returns A string with the serialized event, or NULL in case of errors */
+const char *janus_json_event_text(janus_json_event *event, size_t flags, size_t *len);
+///@}
+
+
 /*! \brief Helper method to set one byte at a memory position
  * @param[in] data memory data pointer
  * @param[in] i position in memory to change